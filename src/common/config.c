@@ -5,12 +5,25 @@
 #endif
 
 struct nla_policy joolnl_struct_list_policy[JNLAL_COUNT] = {
-	[JNLAL_ENTRY] = { .type = NLA_NESTED }
+	[JNLAL_ENTRY] = { .type = NLA_NESTED },
+	[JNLAL_RM_ENTRY] = { .type = NLA_NESTED },
 };
 struct nla_policy joolnl_plateau_list_policy[JNLAL_COUNT] = {
 	[JNLAL_ENTRY] = { .type = NLA_U16 }
 };
 
+struct nla_policy joolnl_ifname_list_policy[JNLAL_COUNT] = {
+	[JNLAL_ENTRY] = {
+#ifdef __KERNEL__
+		.type = NLA_NUL_STRING,
+		.len = IFNAME_MAX_SIZE - 1,
+#else
+		.type = NLA_STRING,
+		.maxlen = IFNAME_MAX_SIZE,
+#endif
+	},
+};
+
 struct nla_policy joolnl_instance_entry_policy[JNLAIE_COUNT] = {
 	[JNLAIE_NS] = { .type = NLA_U32 },
 	[JNLAIE_XF] = { .type = NLA_U8 },
@@ -27,6 +40,26 @@ struct nla_policy joolnl_instance_entry_policy[JNLAIE_COUNT] = {
 	},
 };
 
+struct nla_policy joolnl_stats_entry_policy[JNLASTE_COUNT] = {
+	[JNLASTE_INAME] = {
+#ifdef __KERNEL__
+		.type = NLA_NUL_STRING,
+		.len = INAME_MAX_SIZE - 1,
+#else
+		.type = NLA_STRING,
+		.maxlen = INAME_MAX_SIZE,
+#endif
+	},
+	[JNLASTE_COUNTERS] = { .type = NLA_NESTED },
+};
+
+struct nla_policy joolnl_talker_policy[JNLATK_ATTR_COUNT] = {
+	[JNLATK_METRIC] = { .type = NLA_U8 },
+	[JNLATK_PREFIX] = { .type = NLA_NESTED },
+	[JNLATK_COUNT] = { .type = NLA_U64 },
+	[JNLATK_ERROR] = { .type = NLA_U64 },
+};
+
 struct nla_policy joolnl_prefix6_policy[JNLAP_COUNT] = {
 	[JNLAP_ADDR] = JOOLNL_ADDR6_POLICY,
 	[JNLAP_LEN] = { .type = NLA_U8 },
@@ -47,9 +80,42 @@ struct nla_policy joolnl_taddr4_policy[JNLAT_COUNT] = {
 	[JNLAT_PORT] = { .type = NLA_U16 },
 };
 
+struct nla_policy joolnl_mark_range_policy[JNLAMR_COUNT] = {
+	[JNLAMR_FIRST] = { .type = NLA_U32 },
+	[JNLAMR_LAST] = { .type = NLA_U32 },
+};
+
+struct nla_policy joolnl_next_hop6_policy[JNLANH_COUNT] = {
+	[JNLANH_GATEWAY] = JOOLNL_ADDR6_POLICY,
+	[JNLANH_DEV] = {
+#ifdef __KERNEL__
+		.type = NLA_NUL_STRING,
+		.len = IFNAME_MAX_SIZE - 1,
+#else
+		.type = NLA_STRING,
+		.maxlen = IFNAME_MAX_SIZE,
+#endif
+	},
+};
+
+struct nla_policy joolnl_next_hop4_policy[JNLANH_COUNT] = {
+	[JNLANH_GATEWAY] = JOOLNL_ADDR4_POLICY,
+	[JNLANH_DEV] = {
+#ifdef __KERNEL__
+		.type = NLA_NUL_STRING,
+		.len = IFNAME_MAX_SIZE - 1,
+#else
+		.type = NLA_STRING,
+		.maxlen = IFNAME_MAX_SIZE,
+#endif
+	},
+};
+
 struct nla_policy eam_policy[JNLAE_COUNT] = {
 	[JNLAE_PREFIX6] = { .type = NLA_NESTED },
 	[JNLAE_PREFIX4] = { .type = NLA_NESTED },
+	[JNLAE_EA_LEN] = { .type = NLA_U8 },
+	[JNLAE_PSID_OFFSET] = { .type = NLA_U8 },
 };
 
 struct nla_policy joolnl_pool4_entry_policy[JNLAP4_COUNT] = {
@@ -60,6 +126,20 @@ struct nla_policy joolnl_pool4_entry_policy[JNLAP4_COUNT] = {
 	[JNLAP4_PREFIX] = { .type = NLA_NESTED },
 	[JNLAP4_PORT_MIN] = { .type = NLA_U16 },
 	[JNLAP4_PORT_MAX] = { .type = NLA_U16 },
+	[JNLAP4_USED] = { .type = NLA_U64 },
+};
+
+struct nla_policy joolnl_timeout_class_policy[JNLATC_COUNT] = {
+	[JNLATC_PROTO] = { .type = NLA_U8 },
+	[JNLATC_PREFIX] = { .type = NLA_NESTED },
+	[JNLATC_PORT_MIN] = { .type = NLA_U16 },
+	[JNLATC_PORT_MAX] = { .type = NLA_U16 },
+	[JNLATC_TTL] = { .type = NLA_U32 },
+};
+
+struct nla_policy joolnl_pool6_tenant_policy[JNLAPT_COUNT] = {
+	[JNLAPT_PREFIX] = { .type = NLA_NESTED },
+	[JNLAPT_MARK] = { .type = NLA_U32 },
 };
 
 struct nla_policy joolnl_bib_entry_policy[JNLAB_COUNT] = {
@@ -67,6 +147,8 @@ struct nla_policy joolnl_bib_entry_policy[JNLAB_COUNT] = {
 	[JNLAB_SRC4] = { .type = NLA_NESTED },
 	[JNLAB_PROTO] = { .type = NLA_U8 },
 	[JNLAB_STATIC] = { .type = NLA_U8 },
+	[JNLAB_PACKETS] = { .type = NLA_U64 },
+	[JNLAB_BYTES] = { .type = NLA_U64 },
 };
 
 struct nla_policy joolnl_session_entry_policy[JNLASE_COUNT] = {
@@ -78,6 +160,40 @@ struct nla_policy joolnl_session_entry_policy[JNLASE_COUNT] = {
 	[JNLASE_STATE] = { .type = NLA_U8 },
 	[JNLASE_TIMER] = { .type = NLA_U8 },
 	[JNLASE_EXPIRATION] = { .type = NLA_U32 },
+	[JNLASE_PACKETS] = { .type = NLA_U64 },
+	[JNLASE_BYTES] = { .type = NLA_U64 },
+};
+
+struct nla_policy joolnl_filter_policy[JNLAF_COUNT] = {
+	[JNLAF_SRC6] = { .type = NLA_NESTED },
+	[JNLAF_SRC4] = { .type = NLA_NESTED },
+	[JNLAF_PORT_MIN] = { .type = NLA_U16 },
+	[JNLAF_PORT_MAX] = { .type = NLA_U16 },
+	[JNLAF_DST4] = { .type = NLA_NESTED },
+	[JNLAF_STATE] = { .type = NLA_U8 },
+	[JNLAF_MIN_AGE] = { .type = NLA_U32 },
+};
+
+struct nla_policy joolnl_share_policy[JNLASH_COUNT] = {
+	[JNLASH_EAMT] = {
+#ifdef __KERNEL__
+		.type = NLA_NUL_STRING,
+		.len = INAME_MAX_SIZE - 1,
+#else
+		.type = NLA_STRING,
+		.maxlen = INAME_MAX_SIZE,
+#endif
+	},
+	[JNLASH_DENYLIST4] = {
+#ifdef __KERNEL__
+		.type = NLA_NUL_STRING,
+		.len = INAME_MAX_SIZE - 1,
+#else
+		.type = NLA_STRING,
+		.maxlen = INAME_MAX_SIZE,
+#endif
+	},
+	[JNLASH_PUBLISH] = { .type = NLA_U8 },
 };
 
 struct nla_policy siit_globals_policy[JNLAG_COUNT] = {
@@ -89,6 +205,17 @@ struct nla_policy siit_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_RESET_TOS] = { .type = NLA_U8 },
 	[JNLAG_TOS] = { .type = NLA_U8 },
 	[JNLAG_PLATEAUS] = { .type = NLA_NESTED },
+	[JNLAG_ICMP_ERROR_RATE] = { .type = NLA_U32 },
+	[JNLAG_ICMP_ERROR_SOURCE_RATE] = { .type = NLA_U32 },
+	[JNLAG_TCP_MSS_CLAMP] = { .type = NLA_U8 },
+	[JNLAG_NETFILTER_MARKS] = { .type = NLA_NESTED },
+	[JNLAG_CAPTURE_SAMPLE] = { .type = NLA_U32 },
+	[JNLAG_CAPTURE_SNAPLEN] = { .type = NLA_U32 },
+	[JNLAG_INGRESS_DEVICES] = { .type = NLA_NESTED },
+	[JNLAG_NEXT_HOP6] = { .type = NLA_NESTED },
+	[JNLAG_NEXT_HOP4] = { .type = NLA_NESTED },
+	[JNLAG_GENERATE_FLOW_LABEL] = { .type = NLA_U8 },
+	[JNLAG_IPV4_ID_POLICY] = { .type = NLA_U8 },
 	[JNLAG_COMPUTE_CSUM_ZERO] = { .type = NLA_U8 },
 	[JNLAG_HAIRPIN_MODE] = { .type = NLA_U8 },
 	[JNLAG_RANDOMIZE_ERROR_ADDR] = { .type = NLA_U8 },
@@ -105,25 +232,72 @@ struct nla_policy nat64_globals_policy[JNLAG_COUNT] = {
 	[JNLAG_RESET_TOS] = { .type = NLA_U8 },
 	[JNLAG_TOS] = { .type = NLA_U8 },
 	[JNLAG_PLATEAUS] = { .type = NLA_NESTED },
+	[JNLAG_ICMP_ERROR_RATE] = { .type = NLA_U32 },
+	[JNLAG_ICMP_ERROR_SOURCE_RATE] = { .type = NLA_U32 },
+	[JNLAG_TCP_MSS_CLAMP] = { .type = NLA_U8 },
+	[JNLAG_NETFILTER_MARKS] = { .type = NLA_NESTED },
+	[JNLAG_CAPTURE_SAMPLE] = { .type = NLA_U32 },
+	[JNLAG_CAPTURE_SNAPLEN] = { .type = NLA_U32 },
+	[JNLAG_INGRESS_DEVICES] = { .type = NLA_NESTED },
+	[JNLAG_NEXT_HOP6] = { .type = NLA_NESTED },
+	[JNLAG_NEXT_HOP4] = { .type = NLA_NESTED },
+	[JNLAG_GENERATE_FLOW_LABEL] = { .type = NLA_U8 },
+	[JNLAG_IPV4_ID_POLICY] = { .type = NLA_U8 },
 	[JNLAG_DROP_ICMP6_INFO] = { .type = NLA_U8 },
 	[JNLAG_SRC_ICMP6_BETTER] = { .type = NLA_U8 },
 	[JNLAG_F_ARGS] = { .type = NLA_U8 },
+	[JNLAG_F_HASH] = { .type = NLA_U8 },
 	[JNLAG_HANDLE_RST] = { .type = NLA_U8 },
+	[JNLAG_DETERMINISTIC_PREFIX] = { .type = NLA_NESTED },
+	[JNLAG_DETERMINISTIC_LEN] = { .type = NLA_U8 },
 	[JNLAG_TTL_TCP_EST] = { .type = NLA_U32 },
 	[JNLAG_TTL_TCP_TRANS] = { .type = NLA_U32 },
 	[JNLAG_TTL_UDP] = { .type = NLA_U32 },
 	[JNLAG_TTL_ICMP] = { .type = NLA_U32 },
 	[JNLAG_BIB_LOGGING] = { .type = NLA_U8 },
 	[JNLAG_SESSION_LOGGING] = { .type = NLA_U8 },
+	[JNLAG_BIB_LOGGING_BINARY] = { .type = NLA_U8 },
 	[JNLAG_DROP_BY_ADDR] = { .type = NLA_U8 },
 	[JNLAG_DROP_EXTERNAL_TCP] = { .type = NLA_U8 },
 	[JNLAG_MAX_STORED_PKTS] = { .type = NLA_U32 },
+	[JNLAG_MAX_STORED_PKTS_PER_SRC] = { .type = NLA_U32 },
+	[JNLAG_EXPIRY_BUDGET] = { .type = NLA_U32 },
+	[JNLAG_PORT_BLOCK_SIZE] = { .type = NLA_U32 },
+	[JNLAG_SYN_FLOOD_THRESHOLD] = { .type = NLA_U32 },
+	[JNLAG_SUBSCRIBER_PREFIX_LEN] = { .type = NLA_U8 },
+	[JNLAG_SUBSCRIBER_MAX_PORTS] = { .type = NLA_U32 },
+	[JNLAG_SUBSCRIBER_MAX_SESSIONS] = { .type = NLA_U32 },
+	[JNLAG_RSS_QUEUES] = { .type = NLA_U32 },
+	[JNLAG_PORT_PRESERVATION] = { .type = NLA_U8 },
+	[JNLAG_LEAST_LOADED_ADDRESS] = { .type = NLA_U8 },
+	[JNLAG_MAX_SESSIONS] = { .type = NLA_U32 },
+	[JNLAG_REFRESH_GRANULARITY] = { .type = NLA_U32 },
+	[JNLAG_UDP_FAST_PORTS] = { .type = NLA_NESTED },
+	[JNLAG_TTL_UDP_FAST] = { .type = NLA_U32 },
+	[JNLAG_TIMEOUT_CLASSES] = { .type = NLA_NESTED },
+	[JNLAG_POOL6_TENANTS] = { .type = NLA_NESTED },
+	[JNLAG_LATENCY_SAMPLE] = { .type = NLA_U32 },
+	[JNLAG_SESSION_COUNTERS] = { .type = NLA_U8 },
+	[JNLAG_SUBSCRIBER_PACKET_RATE] = { .type = NLA_U32 },
+	[JNLAG_SUBSCRIBER_SESSION_RATE] = { .type = NLA_U32 },
+	[JNLAG_OVERLOAD_THRESHOLD] = { .type = NLA_U8 },
+	[JNLAG_CLUSTER_NODES] = { .type = NLA_U8 },
+	[JNLAG_CLUSTER_NODE] = { .type = NLA_U8 },
+	[JNLAG_POOL4_PRESSURE_LOW] = { .type = NLA_U8 },
+	[JNLAG_POOL4_PRESSURE_HIGH] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_ENABLED] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_FLUSH_ASAP] = { .type = NLA_U8 },
 	[JNLAG_JOOLD_FLUSH_DEADLINE] = { .type = NLA_U32 },
 	[JNLAG_JOOLD_CAPACITY] = { .type = NLA_U32 },
 	[JNLAG_JOOLD_MAX_PAYLOAD] = { .type = NLA_U32 },
 	[JNLAG_JOOLD_MAX_SESSIONS_PER_PACKET] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_MAX_OUTSTANDING] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_SYNC_TCP] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_SYNC_UDP] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_SYNC_ICMP] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_MIN_AGE] = { .type = NLA_U32 },
+	[JNLAG_JOOLD_ESTABLISHED_ONLY] = { .type = NLA_U8 },
+	[JNLAG_JOOLD_FLUSH_WINDOW] = { .type = NLA_U32 },
 };
 
 int iname_validate(const char *iname, bool allow_null)
@@ -16,6 +16,8 @@
 
 #define JOOLNL_FAMILY "Jool"
 #define JOOLNL_MULTICAST_GRP_NAME "joold"
+#define JOOLNL_NATLOG_GRP_NAME "natlog"
+#define JOOLNL_CAPTURE_GRP_NAME "capture"
 
 #define JOOLNL_HDR_MAGIC "jool"
 #define JOOLNL_HDR_MAGIC_LEN 4
@@ -61,9 +63,42 @@ enum joolnl_operation {
 	JNLOP_JOOLD_ADD,
 	JNLOP_JOOLD_ADVERTISE,
 	JNLOP_JOOLD_ACK,
+
+	JNLOP_SESSION_EXPORT,
+	JNLOP_SESSION_IMPORT,
+
+	JNLOP_BIB_ADD_BULK,
+
+	JNLOP_STATS_LATENCY,
+	JNLOP_STATS_DUMP,
+	JNLOP_STATS_TALKERS,
+
+	JNLOP_JOOLD_ADVERTISE_CANCEL,
+	JNLOP_JOOLD_TRANSPORT,
+
+	JNLOP_STATS_PERCPU,
+
+	JNLOP_BIB_PURGE,
+
+	JNLOP_POOL4_USAGE,
+
+	JNLOP_ADDRESS_QUERY64_BULK,
+	JNLOP_ADDRESS_QUERY46_BULK,
+
+	JNLOP_FILE_COMMIT_BATCH,
+
+	JNLOP_STATS_LIFETIMES,
+	JNLOP_STATS_RATES,
 };
 
+/* Entries per JNLOP_BIB_ADD_BULK (or _BULK address query) request, at most. */
+#define JOOLNL_BULK_MAX 4096
+
 enum joolnl_attr_root {
+	/*
+	 * The address to translate. (In the _BULK operations, an array of
+	 * them; up to JOOLNL_BULK_MAX.)
+	 */
 	JNLAR_ADDR_QUERY = 1,
 	JNLAR_GLOBALS,
 	JNLAR_BL4_ENTRIES,
@@ -77,18 +112,85 @@ enum joolnl_attr_root {
 	JNLAR_PROTO,
 	JNLAR_ATOMIC_INIT,
 	JNLAR_ATOMIC_END,
+	/*
+	 * Bitmap; if bit (i % 8) of byte (i / 8) is set, bulk entry i could not
+	 * be added.
+	 */
+	JNLAR_BULK_FAILURES,
+	/* Array of struct natlog_record. (Kernel to userspace only.) */
+	JNLAR_NATLOG_RECORDS,
+	/*
+	 * Bitmap; if bit (i % 8) of byte (i / 8) is set, stat i is requested.
+	 * (JNLOP_STATS_DUMP and JNLOP_STATS_PERCPU. Absent means all of them.)
+	 */
+	JNLAR_STATS_FILTER,
+	/*
+	 * Peer of the kernel session synchronization transport.
+	 * (JNLOP_JOOLD_TRANSPORT. Absent means back to joold.)
+	 */
+	JNLAR_JOOLD_PEER6,
+	JNLAR_JOOLD_PEER4,
+	/*
+	 * Restricts a BIB or session query to the matching entries.
+	 * (JNLOP_BIB_FOREACH, JNLOP_SESSION_FOREACH, JNLOP_BIB_PURGE. See enum
+	 * joolnl_attr_filter.)
+	 */
+	JNLAR_FILTER,
+	/*
+	 * Names the published tables an atomic configuration wants to use or
+	 * publish. (JNLOP_FILE_HANDLE. See enum joolnl_attr_share.)
+	 */
+	JNLAR_SHARE,
+	/*
+	 * Sequence of struct capture_record, each followed by its packet.
+	 * (Kernel to userspace only.)
+	 */
+	JNLAR_CAPTURE_RECORDS,
+	/* Array of struct natlog_latency. (Kernel to userspace only.) */
+	JNLAR_NATLOG_LATENCY,
+	/*
+	 * u8 bitmap; if bit i is set, enum l4_protocol i is requested.
+	 * (JNLOP_BIB_PURGE. Absent means all of them.)
+	 */
+	JNLAR_PROTOS,
+	/* u32; BIB entries removed. (JNLOP_BIB_PURGE's response.) */
+	JNLAR_PURGED,
+	/*
+	 * Array of struct addrxlat_bulk_result, in JNLAR_ADDR_QUERY's order.
+	 * (The _BULK address queries' response.) Can be shorter than the
+	 * query, if it didn't fit; userspace sends the rest again.
+	 */
+	JNLAR_ADDR_RESULTS,
 	JNLAR_COUNT,
 #define JNLAR_MAX (JNLAR_COUNT - 1)
 };
 
 enum joolnl_attr_list {
 	JNLAL_ENTRY = 1,
+	/*
+	 * Sessions, packed. Used by joold and session snapshots; userspace
+	 * only forwards it.
+	 */
+	JNLAL_SESSION_BATCH,
+	/* Like JNLAL_ENTRY, but removes the entry. (Atomic config diffs.) */
+	JNLAL_RM_ENTRY,
 	JNLAL_COUNT,
 #define JNLAL_MAX (JNLAL_COUNT - 1)
 };
 
+/*
+ * JNLAL_SESSION_BATCH layout. (See mod/common/nl/attribute.c.)
+ * `jool session export` snapshots are sequences of these.
+ */
+#define JOOLD_BATCH_VERSION 1
+#define JOOLD_BATCH_ELIDE_DST6 (1 << 0)
+#define JOOLD_BATCH_HDR_SIZE 4
+#define JOOLD_BATCH_RECORD_SIZE 48
+#define JOOLD_BATCH_RECORD_SIZE_ELIDED 36
+
 extern struct nla_policy joolnl_struct_list_policy[JNLAL_COUNT];
 extern struct nla_policy joolnl_plateau_list_policy[JNLAL_COUNT];
+extern struct nla_policy joolnl_ifname_list_policy[JNLAL_COUNT];
 
 #ifdef __KERNEL__
 #define JOOLNL_ADDR6_POLICY { \
@@ -132,6 +234,27 @@ enum joolnl_attr_taddr {
 extern struct nla_policy joolnl_taddr6_policy[JNLAT_COUNT];
 extern struct nla_policy joolnl_taddr4_policy[JNLAT_COUNT];
 
+/* An empty nest means "unset." */
+enum joolnl_attr_mark_range {
+	JNLAMR_FIRST = 1,
+	JNLAMR_LAST,
+	JNLAMR_COUNT,
+#define JNLAMR_MAX (JNLAMR_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_mark_range_policy[JNLAMR_COUNT];
+
+/* An empty nest means "unset." */
+enum joolnl_attr_next_hop {
+	JNLANH_GATEWAY = 1,
+	JNLANH_DEV,
+	JNLANH_COUNT,
+#define JNLANH_MAX (JNLANH_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_next_hop6_policy[JNLANH_COUNT];
+extern struct nla_policy joolnl_next_hop4_policy[JNLANH_COUNT];
+
 enum joolnl_attr_instance_entry {
 	JNLAIE_NS = 1,
 	JNLAIE_XF,
@@ -142,6 +265,34 @@ enum joolnl_attr_instance_entry {
 
 extern struct nla_policy joolnl_instance_entry_policy[JNLAIE_COUNT];
 
+/* One instance's counters, as sent by JNLOP_STATS_DUMP. */
+enum joolnl_attr_stats_entry {
+	JNLASTE_INAME = 1,
+	/* Attribute types are stat IDs. Zero counters are omitted. */
+	JNLASTE_COUNTERS,
+	JNLASTE_COUNT,
+#define JNLASTE_MAX (JNLASTE_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_stats_entry_policy[JNLASTE_COUNT];
+
+/* One top talker, as sent by JNLOP_STATS_TALKERS. */
+enum joolnl_attr_talker {
+	/* enum jool_talker_metric */
+	JNLATK_METRIC = 1,
+	/* The subscriber */
+	JNLATK_PREFIX,
+	/* Estimated metric, since the talker started being tracked */
+	JNLATK_COUNT,
+	/* Maximum overestimation of JNLATK_COUNT */
+	JNLATK_ERROR,
+	JNLATK_PAD,
+	JNLATK_ATTR_COUNT,
+#define JNLATK_MAX (JNLATK_ATTR_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_talker_policy[JNLATK_ATTR_COUNT];
+
 enum joolnl_attr_instance_status {
 	JNLAIS_STATUS = 1,
 	JNLAIS_COUNT,
@@ -158,6 +309,8 @@ enum joolnl_attr_instance_add {
 enum joolnl_attr_eam {
 	JNLAE_PREFIX6 = 1,
 	JNLAE_PREFIX4,
+	JNLAE_EA_LEN,
+	JNLAE_PSID_OFFSET,
 	JNLAE_COUNT,
 #define JNLAE_MAX (JNLAE_COUNT - 1)
 };
@@ -172,17 +325,44 @@ enum joolnl_attr_pool4 {
 	JNLAP4_PREFIX,
 	JNLAP4_PORT_MIN,
 	JNLAP4_PORT_MAX,
+	/* u64; BIB entries using the range. (JNLOP_POOL4_USAGE's response.) */
+	JNLAP4_USED,
+	JNLAP4_PAD,
 	JNLAP4_COUNT,
 #define JNLAP4_MAX (JNLAP4_COUNT - 1)
 };
 
 extern struct nla_policy joolnl_pool4_entry_policy[JNLAP4_COUNT];
 
+enum joolnl_attr_timeout_class {
+	JNLATC_PROTO = 1,
+	JNLATC_PREFIX,
+	JNLATC_PORT_MIN,
+	JNLATC_PORT_MAX,
+	JNLATC_TTL,
+	JNLATC_COUNT,
+#define JNLATC_MAX (JNLATC_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_timeout_class_policy[JNLATC_COUNT];
+
+enum joolnl_attr_pool6_tenant {
+	JNLAPT_PREFIX = 1,
+	JNLAPT_MARK,
+	JNLAPT_COUNT,
+#define JNLAPT_MAX (JNLAPT_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_pool6_tenant_policy[JNLAPT_COUNT];
+
 enum joolnl_attr_bib {
 	JNLAB_SRC6 = 1,
 	JNLAB_SRC4,
 	JNLAB_PROTO,
 	JNLAB_STATIC,
+	JNLAB_PACKETS,
+	JNLAB_BYTES,
+	JNLAB_PAD,
 	JNLAB_COUNT,
 #define JNLAB_MAX (JNLAB_COUNT - 1)
 };
@@ -199,12 +379,75 @@ enum joolnl_attr_session {
 	JNLASE_STATE,
 	JNLASE_TIMER,
 	JNLASE_EXPIRATION,
+	JNLASE_PACKETS,
+	JNLASE_BYTES,
+	JNLASE_PAD,
 	JNLASE_COUNT,
 #define JNLASE_MAX (JNLASE_COUNT - 1)
 };
 
 extern struct nla_policy joolnl_session_entry_policy[JNLASE_COUNT];
 
+/*
+ * Absent attributes match everything. BIB queries only accept JNLAF_SRC6
+ * through JNLAF_PORT_MAX.
+ */
+enum joolnl_attr_filter {
+	JNLAF_SRC6 = 1,
+	JNLAF_SRC4,
+	/* Of the IPv4 source (pool4) transport address */
+	JNLAF_PORT_MIN,
+	JNLAF_PORT_MAX,
+	JNLAF_DST4,
+	/* tcp_state; implies TCP */
+	JNLAF_STATE,
+	/* Milliseconds since the session was created */
+	JNLAF_MIN_AGE,
+	JNLAF_COUNT,
+#define JNLAF_MAX (JNLAF_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_filter_policy[JNLAF_COUNT];
+
+/*
+ * The instance uses the table that is already published under the name, unless
+ * the table is flagged in JNLASH_PUBLISH. In that case, the candidate's own
+ * table is published under the name at commit.
+ */
+enum joolnl_attr_share {
+	JNLASH_EAMT = 1,
+	JNLASH_DENYLIST4,
+	/* JNLASH_PUBLISH_* */
+	JNLASH_PUBLISH,
+	JNLASH_COUNT,
+#define JNLASH_MAX (JNLASH_COUNT - 1)
+};
+
+extern struct nla_policy joolnl_share_policy[JNLASH_COUNT];
+
+#define JNLASH_PUBLISH_EAMT (1 << 0)
+#define JNLASH_PUBLISH_DENYLIST4 (1 << 1)
+
+enum query_filter_flags {
+	QF_SRC6 = (1 << 0),
+	QF_SRC4 = (1 << 1),
+	QF_PORTS = (1 << 2),
+	QF_DST4 = (1 << 3),
+	QF_STATE = (1 << 4),
+	QF_MIN_AGE = (1 << 5),
+};
+
+/* JNLAR_FILTER, unpacked. @flags says which of the fields are set. */
+struct query_filter {
+	unsigned int flags;
+	struct ipv6_prefix src6;
+	struct ipv4_prefix src4;
+	struct port_range ports;
+	struct ipv4_prefix dst4;
+	__u8 state;
+	__u32 min_age;
+};
+
 enum joolnl_attr_address_query {
 	JNLAAQ_ADDR6 = 1,
 	JNLAAQ_ADDR4,
@@ -224,6 +467,17 @@ enum joolnl_attr_global {
 	JNLAG_RESET_TOS,
 	JNLAG_TOS,
 	JNLAG_PLATEAUS,
+	JNLAG_ICMP_ERROR_RATE,
+	JNLAG_ICMP_ERROR_SOURCE_RATE,
+	JNLAG_TCP_MSS_CLAMP,
+	JNLAG_NETFILTER_MARKS,
+	JNLAG_CAPTURE_SAMPLE,
+	JNLAG_CAPTURE_SNAPLEN,
+	JNLAG_INGRESS_DEVICES,
+	JNLAG_NEXT_HOP6,
+	JNLAG_NEXT_HOP4,
+	JNLAG_GENERATE_FLOW_LABEL,
+	JNLAG_IPV4_ID_POLICY,
 
 	/* SIIT */
 	JNLAG_COMPUTE_CSUM_ZERO,
@@ -238,14 +492,43 @@ enum joolnl_attr_global {
 	JNLAG_DROP_ICMP6_INFO,
 	JNLAG_SRC_ICMP6_BETTER,
 	JNLAG_F_ARGS,
+	JNLAG_F_HASH,
 	JNLAG_HANDLE_RST,
+	JNLAG_DETERMINISTIC_PREFIX,
+	JNLAG_DETERMINISTIC_LEN,
 	JNLAG_TTL_TCP_EST,
 	JNLAG_TTL_TCP_TRANS,
 	JNLAG_TTL_UDP,
 	JNLAG_TTL_ICMP,
 	JNLAG_BIB_LOGGING,
 	JNLAG_SESSION_LOGGING,
+	JNLAG_BIB_LOGGING_BINARY,
 	JNLAG_MAX_STORED_PKTS,
+	JNLAG_MAX_STORED_PKTS_PER_SRC,
+	JNLAG_EXPIRY_BUDGET,
+	JNLAG_PORT_BLOCK_SIZE,
+	JNLAG_SYN_FLOOD_THRESHOLD,
+	JNLAG_SUBSCRIBER_PREFIX_LEN,
+	JNLAG_SUBSCRIBER_MAX_PORTS,
+	JNLAG_SUBSCRIBER_MAX_SESSIONS,
+	JNLAG_RSS_QUEUES,
+	JNLAG_PORT_PRESERVATION,
+	JNLAG_LEAST_LOADED_ADDRESS,
+	JNLAG_MAX_SESSIONS,
+	JNLAG_REFRESH_GRANULARITY,
+	JNLAG_UDP_FAST_PORTS,
+	JNLAG_TTL_UDP_FAST,
+	JNLAG_TIMEOUT_CLASSES,
+	JNLAG_POOL6_TENANTS,
+	JNLAG_LATENCY_SAMPLE,
+	JNLAG_SESSION_COUNTERS,
+	JNLAG_SUBSCRIBER_PACKET_RATE,
+	JNLAG_SUBSCRIBER_SESSION_RATE,
+	JNLAG_OVERLOAD_THRESHOLD,
+	JNLAG_CLUSTER_NODES,
+	JNLAG_CLUSTER_NODE,
+	JNLAG_POOL4_PRESSURE_LOW,
+	JNLAG_POOL4_PRESSURE_HIGH,
 
 	/* joold */
 	JNLAG_JOOLD_ENABLED,
@@ -254,6 +537,13 @@ enum joolnl_attr_global {
 	JNLAG_JOOLD_CAPACITY,
 	JNLAG_JOOLD_MAX_PAYLOAD,
 	JNLAG_JOOLD_MAX_SESSIONS_PER_PACKET,
+	JNLAG_JOOLD_MAX_OUTSTANDING,
+	JNLAG_JOOLD_SYNC_TCP,
+	JNLAG_JOOLD_SYNC_UDP,
+	JNLAG_JOOLD_SYNC_ICMP,
+	JNLAG_JOOLD_MIN_AGE,
+	JNLAG_JOOLD_ESTABLISHED_ONLY,
+	JNLAG_JOOLD_FLUSH_WINDOW,
 
 	/* Needs to be last */
 	JNLAG_COUNT,
@@ -282,6 +572,29 @@ enum joolnl_attr_error {
  * IP fragmentation.
  */
 #define JOOLNLHDR_FLAGS_M (1 << 3)
+/**
+ * Atomic configuration (JNLAR_ATOMIC_INIT): Start from the running instance's
+ * tables, and expect the changes (additions and JNLAL_RM_ENTRYs) instead of
+ * full tables.
+ */
+#define JOOLNLHDR_FLAGS_DIFF (1 << 4)
+/**
+ * "I can receive responses of up to JOOLNL_LARGE_MSG_SIZE bytes." (So the
+ * kernel module can pack more entries per foreach response.)
+ */
+#define JOOLNLHDR_FLAGS_LARGE (1 << 5)
+/**
+ * Atomic configuration (JNLAR_ATOMIC_END): Validate the instance, but don't
+ * commit it yet. A JNLOP_FILE_COMMIT_BATCH will, along with the process' other
+ * ready instances.
+ */
+#define JOOLNLHDR_FLAGS_BATCH (1 << 6)
+
+/**
+ * Payload of the large messages; see JOOLNLHDR_FLAGS_LARGE. Leaves room for
+ * the headers, because attribute lengths are 16 bits.
+ */
+#define JOOLNL_LARGE_MSG_SIZE (60 * 1024)
 
 typedef __u8 joolnlhdr_flags; /** See JOOLNLHDR_FLAGS_* above. */
 
@@ -313,6 +626,111 @@ struct joolnlhdr {
 
 #define JOOLNL_HDRLEN NLMSG_ALIGN(sizeof(struct joolnlhdr))
 
+enum natlog_event {
+	NATLOG_BIB_MAPPED = 1,
+	NATLOG_BIB_FORGOT,
+	/* A port block was handed to an IPv6 address. (port-block-size) */
+	NATLOG_BLOCK_MAPPED,
+	NATLOG_BLOCK_FORGOT,
+};
+
+/**
+ * A BIB entry's (or port block's) creation or destruction, as multicasted to
+ * the JOOLNL_NATLOG_GRP_NAME group when logging-bib-binary is enabled.
+ *
+ * Records are fixed-size so a message's JNLAR_NATLOG_RECORDS is a plain array.
+ * Addresses are in network byte order; everything else, in host byte order.
+ * (The collector runs on the same machine.)
+ */
+struct natlog_record {
+	/** Nanoseconds since the epoch (CLOCK_REALTIME) */
+	__u64 timestamp;
+	__u8 src6[16];
+	__u8 src4[4];
+	__u16 src6_port;
+	__u16 src4_port;
+	/**
+	 * Last port of the range that starts at @src4_port. Equals @src4_port,
+	 * except in block events.
+	 */
+	__u16 src4_port_max;
+	__u8 event; /* enum natlog_event */
+	__u8 proto; /* l4_protocol */
+	__u8 reserved[4];
+};
+
+/* Same as JLAT_STAGE_COUNT. */
+#define NATLOG_LATENCY_STAGES 6
+/* natlog_latency.stages value of the stages the packet never reached. */
+#define NATLOG_LATENCY_SKIPPED 0xFFFFFFFFu
+
+/**
+ * The timeline of a translation sampled by latency-sample, as multicasted to
+ * the JOOLNL_NATLOG_GRP_NAME group (in JNLAR_NATLOG_LATENCY arrays), next to
+ * the BIB events.
+ *
+ * Same byte order rules as struct natlog_record.
+ */
+struct natlog_latency {
+	/** When the packet reached the translator. (Same clock as above.) */
+	__u64 timestamp;
+	/**
+	 * Nanoseconds between @timestamp and the end of each stage. Indexed by
+	 * enum jool_latency_stage. The last one (JLAT_SEND) ends when
+	 * dst_output() returns.
+	 */
+	__u32 stages[NATLOG_LATENCY_STAGES];
+	/*
+	 * The packet's incoming tuple. Zero if the translation ended before
+	 * stage JLAT_IN_TUPLE did.
+	 */
+	__u8 src[16];
+	__u8 dst[16];
+	__u16 src_port;
+	__u16 dst_port;
+	__u8 l3_proto; /* l3_protocol */
+	__u8 l4_proto; /* l4_protocol */
+	/** How the translation ended. (verdict, and enum jool_stat_id) */
+	__u8 verdict;
+	__u8 reserved;
+	__u16 stat;
+	__u8 reserved2[6];
+};
+
+enum capture_direction {
+	/* The packet, as it reached the translator. */
+	CAPTURE_IN = 1,
+	/* Its translation, right before it was sent. */
+	CAPTURE_OUT,
+};
+
+/* Maximum capture-snaplen. */
+#define CAPTURE_SNAPLEN_MAX 256
+
+/**
+ * A sampled packet, as multicasted to the JOOLNL_CAPTURE_GRP_NAME group when
+ * capture-sample is enabled.
+ *
+ * A message's JNLAR_CAPTURE_RECORDS is a sequence of these. Each is followed by
+ * the first @caplen bytes of the packet, starting at its network header, and
+ * then by padding, up to CAPTURE_RECORD_LEN(@caplen) bytes in total. All fields
+ * are in host byte order.
+ */
+struct capture_record {
+	/** Nanoseconds since the epoch (CLOCK_REALTIME) */
+	__u64 timestamp;
+	/** Length of the packet, from its network header on. */
+	__u32 len;
+	/** Bytes that were actually captured. */
+	__u16 caplen;
+	__u8 direction; /* enum capture_direction */
+	__u8 reserved;
+};
+
+/* Space a record with @caplen packet bytes takes in JNLAR_CAPTURE_RECORDS. */
+#define CAPTURE_RECORD_LEN(caplen) \
+	((sizeof(struct capture_record) + (caplen) + 7) & ~7)
+
 struct config_prefix6 {
 	bool set;
 	/** Please note that this could be garbage; see above. */
@@ -325,6 +743,28 @@ struct config_prefix4 {
 	struct ipv4_prefix prefix;
 };
 
+struct config_mark_range {
+	bool set;
+	/* Inclusive. Garbage if !@set. */
+	__u32 first;
+	__u32 last;
+};
+
+/* A gateway, and the interface it's reached through. */
+struct config_next_hop6 {
+	bool set;
+	/* Garbage if !@set. */
+	struct in6_addr gateway;
+	char dev[IFNAME_MAX_SIZE];
+};
+
+struct config_next_hop4 {
+	bool set;
+	/* Garbage if !@set. */
+	struct in_addr gateway;
+	char dev[IFNAME_MAX_SIZE];
+};
+
 /**
  * Issued during atomic configuration initialization.
  */
@@ -390,6 +830,28 @@ struct result_addrxlat46 {
 	struct address_translation_entry entry;
 };
 
+/* addrxlat_bulk_result.method of the addresses that could not be translated */
+#define ADDRXLAT_BULK_FAILED 0xFF
+
+/**
+ * One of the translations of a JNLOP_ADDRESS_QUERY64_BULK or
+ * JNLOP_ADDRESS_QUERY46_BULK. Fixed-size, so JNLAR_ADDR_RESULTS is a plain
+ * array. Addresses are in network byte order.
+ */
+struct addrxlat_bulk_result {
+	/* The translated address. (IPv4 results only use the first 4 bytes.) */
+	__u8 addr[16];
+	/* The RFC 6052 prefix, or the EAM's IPv6 prefix. */
+	__u8 prefix6[16];
+	/* The EAM's IPv4 prefix. */
+	__u8 prefix4[4];
+	__u8 prefix6_len;
+	__u8 prefix4_len;
+	/* enum address_translation_method, or ADDRXLAT_BULK_FAILED */
+	__u8 method;
+	__u8 reserved;
+};
+
 enum f_args {
 	F_ARGS_SRC_ADDR = (1 << 3),
 	F_ARGS_SRC_PORT = (1 << 2),
@@ -397,6 +859,12 @@ enum f_args {
 	F_ARGS_DST_PORT = (1 << 0),
 };
 
+/** Hash function used by F(). (RFC 6056 algorithm 3.) */
+enum f_hash {
+	F_HASH_MD5 = 0,
+	F_HASH_SIPHASH = 1,
+};
+
 struct bib_config {
 	/* These values are always measured in milliseconds. */
 	struct {
@@ -404,10 +872,14 @@ struct bib_config {
 		__u32 tcp_trans;
 		__u32 udp;
 		__u32 icmp;
+		/** UDP sessions that already got their response. */
+		__u32 udp_fast;
 	} ttl;
 
 	bool bib_logging;
 	bool session_logging;
+	/** Send BIB events to the JOOLNL_NATLOG_GRP_NAME multicast group? */
+	bool bib_logging_binary;
 
 	/** Use Address-Dependent Filtering? */
 	bool drop_by_addr;
@@ -415,6 +887,129 @@ struct bib_config {
 	bool drop_external_tcp;
 
 	__u32 max_stored_pkts;
+	/**
+	 * Maximum number of type 1 stored packets (see pkt_queue.h) a single
+	 * IPv4 node can have at a time. Zero means unlimited.
+	 */
+	__u32 max_stored_pkts_per_src;
+
+	/**
+	 * Maximum number of sessions each cleaning run is allowed to visit.
+	 * Whatever is left is handled by the following runs.
+	 * Zero means unlimited.
+	 */
+	__u32 expiry_budget;
+
+	/**
+	 * Number of ports reserved at a time for each IPv6 address that needs
+	 * dynamic BIB entries. Zero means no blocks; ports are allocated
+	 * one at a time.
+	 */
+	__u32 port_block_size;
+
+	/**
+	 * V6 SYNs per second (that need new BIB entries) above which new TCP
+	 * connections stop being stored until the IPv4 side answers.
+	 * Zero disables the protection.
+	 */
+	__u32 syn_flood_threshold;
+
+	/** Length of the IPv6 prefixes the subscriber quotas apply to. */
+	__u8 subscriber_prefix_len;
+	/**
+	 * Maximum number of BIB entries (ie. pool4 ports) a subscriber can
+	 * have at a time. Zero means unlimited.
+	 */
+	__u32 subscriber_max_ports;
+	/**
+	 * Maximum number of sessions a subscriber can have at a time. Zero
+	 * means unlimited.
+	 */
+	__u32 subscriber_max_sessions;
+	/**
+	 * Maximum number of packets per second a subscriber can send through
+	 * the translator. Zero means unlimited.
+	 */
+	__u32 subscriber_packet_rate;
+	/**
+	 * Maximum number of sessions per second a subscriber can open. Zero
+	 * means unlimited.
+	 */
+	__u32 subscriber_session_rate;
+
+	/**
+	 * Percentage of a CPU's time spent translating above which that CPU
+	 * starts refusing new BIB entries and sessions (6->4). Zero disables
+	 * the shedding.
+	 */
+	__u8 overload_threshold;
+
+	/**
+	 * Number of active translators that share pool4. If two or more, the
+	 * port space is split in CLUSTER_BLOCK_PORTS-sized blocks, dealt out to
+	 * the nodes round-robin, and new masks are only allocated from
+	 * @cluster_node's blocks. Zero or one disable the partitioning.
+	 */
+	__u8 cluster_nodes;
+	/** This translator's index within the cluster. (0 to nodes - 1.) */
+	__u8 cluster_node;
+
+	/**
+	 * Percentages of a protocol's pool4 transport addresses that need to be
+	 * taken by BIB entries before the cleaner starts shortening the
+	 * protocol's transitory and UDP timeouts (@pressure_low), and before it
+	 * shortens them the most (@pressure_high). Zero @pressure_low disables
+	 * the adaptation.
+	 */
+	__u8 pressure_low;
+	__u8 pressure_high;
+
+	/**
+	 * Number of receive queues the IPv4 interface's RSS spreads traffic
+	 * across. If nonzero, new masks are chosen so the IPv4 side of the
+	 * connection lands on the queue of the CPU that created it.
+	 * Zero disables the steering.
+	 */
+	__u32 rss_queues;
+
+	/**
+	 * Try to reuse the IPv6 source port as the IPv4 source port before
+	 * iterating pool4 the RFC 6056 way?
+	 */
+	bool port_preservation;
+
+	/**
+	 * Start the pool4 iteration from the least occupied of a few of the
+	 * mark's addresses, instead of strictly from the RFC 6056 offset?
+	 */
+	bool least_loaded_address;
+
+	/**
+	 * Maximum number of sessions the instance can hold. Further sessions
+	 * evict the least recently used ones. Zero means unlimited.
+	 */
+	__u32 max_sessions;
+
+	/**
+	 * Packets of established sessions only update the session's timestamp
+	 * if it's older than this. In milliseconds. Zero means always.
+	 */
+	__u32 refresh_granularity;
+
+	/**
+	 * Count the packets and bytes of every session (and, once they close,
+	 * of their BIB entries)?
+	 */
+	bool session_counters;
+
+	/**
+	 * Destination ports of the UDP sessions that are expected to see a
+	 * single response (eg. DNS). Their sessions switch to ttl.udp_fast once
+	 * the response is translated.
+	 */
+	struct port_list udp_fast_ports;
+
+	struct timeout_classes timeout_classes;
 };
 
 #define JOOLD_MAX_PAYLOAD 2048
@@ -473,6 +1068,36 @@ struct joold_config {
 	 * code. (I guess I'm missing something.)
 	 */
 	__u32 max_sessions_per_pkt;
+
+	/**
+	 * Maximum number of packets the kernel module can send to joold
+	 * before it has to wait for an ACK.
+	 *
+	 * One means stop-and-wait, which caps synchronization throughput to
+	 * one packet per userspace round trip. Larger windows let the sync
+	 * keep up with higher session creation rates, at the cost of more
+	 * Netlink messages piling up on joold's socket.
+	 */
+	__u32 max_outstanding;
+
+	/** Synchronize the sessions of each protocol? */
+	bool sync_tcp;
+	bool sync_udp;
+	bool sync_icmp;
+	/**
+	 * Sessions younger than this (in milliseconds) are not synchronized.
+	 * Meant to filter out the ones that die before the standby would need
+	 * them.
+	 */
+	__u32 min_age;
+	/** Only synchronize TCP sessions while they're established? */
+	bool established_only;
+	/**
+	 * If nonzero, queued sessions wait at most this many microseconds
+	 * (rather than @flush_asap's "not at all" or @flush_deadline) for more
+	 * sessions to share their packet with.
+	 */
+	__u32 flush_window;
 };
 
 /**
@@ -530,6 +1155,58 @@ struct jool_globals {
 	 */
 	struct mtu_plateaus plateaus;
 
+	/**
+	 * Maximum number of ICMP errors the instance can generate per second,
+	 * per CPU. Zero means unlimited.
+	 */
+	__u32 icmp_error_rate;
+	/**
+	 * Same as @icmp_error_rate, except for each destination /24 (IPv4) or
+	 * /64 (IPv6).
+	 */
+	__u32 icmp_error_source_rate;
+	/**
+	 * Lower the MSS option of translated SYNs so the peers' segments fit
+	 * in the IPv6 side's MTU?
+	 */
+	bool tcp_mss_clamp;
+	/**
+	 * The packet marks a Netfilter instance translates, if it shares its
+	 * namespace with other Netfilter instances. Unset means "the marks no
+	 * other instance claims." Ignored by iptables instances.
+	 */
+	struct config_mark_range netfilter_marks;
+	/**
+	 * Capture one in every @capture_sample translations. (Both the original
+	 * packet and its translation.) Zero means never.
+	 */
+	__u32 capture_sample;
+	/** Maximum bytes captured from each packet. */
+	__u32 capture_snaplen;
+	/**
+	 * Interfaces whose incoming packets are translated at the netdev
+	 * ingress hook, before the IP layer sees them. Ignored by iptables
+	 * instances.
+	 */
+	struct ingress_devices ingress_devices;
+	/**
+	 * If set, every translated IPv6 packet is sent to this gateway,
+	 * instead of wherever the routing table says.
+	 */
+	struct config_next_hop6 next_hop6;
+	/** Same as @next_hop6, for the translated IPv4 packets. */
+	struct config_next_hop4 next_hop4;
+	/**
+	 * "true" if the translated IPv6 packets should get a flow label hashed
+	 * from their flow. Otherwise the flow label is zero.
+	 */
+	bool generate_flow_label;
+	/**
+	 * How the Identification of translated IPv4 packets that have DF set
+	 * is chosen. (enum ipv4_id_policy)
+	 */
+	__u8 ipv4_id_policy;
+
 	union {
 		struct {
 			/**
@@ -579,6 +1256,8 @@ struct jool_globals {
 			 * See "enum f_args".
 			 */
 			__u8 f_args;
+			/** Hash function F() uses. See "enum f_hash". */
+			__u8 f_hash;
 			/**
 			 * Decrease timer when a FIN packet is received during the
 			 * `V4 FIN RCV` or `V6 FIN RCV` states?
@@ -586,6 +1265,30 @@ struct jool_globals {
 			 */
 			bool handle_rst_during_fin_rcv;
 
+			/**
+			 * IPv6 addresses whose masks are computed from their
+			 * bits instead of allocated. Unset means deterministic
+			 * mode is disabled.
+			 */
+			struct config_prefix6 deterministic_prefix;
+			/**
+			 * Length of each subscriber's prefix (within
+			 * @deterministic_prefix).
+			 */
+			__u8 deterministic_len;
+
+			/**
+			 * Prefixes that also translate like pool6 does. Their
+			 * indexes (plus one) are the sessions' pool6 indexes;
+			 * zero is pool6 itself.
+			 */
+			struct pool6_tenants pool6_tenants;
+			/**
+			 * Send the timeline of one in every @latency_sample
+			 * translations to the NAT log. Zero means never.
+			 */
+			__u32 latency_sample;
+
 			struct bib_config bib;
 			struct joold_config joold;
 		} nat64;
@@ -599,4 +1302,17 @@ enum eam_hairpinning_mode {
 	EHM_INTRINSIC = 2,
 };
 
+/*
+ * RFC 6864: Atomic datagrams (DF set, not fragmented) don't need unique IDs.
+ * Packets that can still be fragmented always get one from the kernel.
+ */
+enum ipv4_id_policy {
+	/* The kernel's generator, __ip_select_ident(). */
+	IIP_KERNEL = 0,
+	/* Zero. */
+	IIP_ZERO = 1,
+	/* A per-CPU counter. */
+	IIP_COUNTER = 2,
+};
+
 #endif /* SRC_COMMON_CONFIG_H_ */
@@ -19,6 +19,11 @@
  * lifetime of UDP bindings, in seconds. We use it as the actual default value.
  */
 #define UDP_DEFAULT (5 * 60)
+/**
+ * Default lifetime of the UDP sessions whose single response has already been
+ * translated (see udp-fast-ports), in seconds. Not an RFC value.
+ */
+#define UDP_FAST_DEFAULT 2
 /**
  * Established connection idle timeout (in seconds).
  * In other words, the tolerance time for established and healthy TCP sessions.
@@ -67,17 +72,53 @@
 #define DEFAULT_FILTER_ICMPV6_INFO false
 #define DEFAULT_DROP_EXTERNAL_CONNECTIONS false
 #define DEFAULT_MAX_STORED_PKTS 10
+#define DEFAULT_MAX_STORED_PKTS_PER_SRC 2
+#define DEFAULT_EXPIRY_BUDGET 0
+#define DEFAULT_PORT_BLOCK_SIZE 0
+#define DEFAULT_SYN_FLOOD_THRESHOLD 0
+#define DEFAULT_SUBSCRIBER_PREFIX_LEN 64
+#define DEFAULT_SUBSCRIBER_MAX_PORTS 0
+#define DEFAULT_SUBSCRIBER_MAX_SESSIONS 0
+#define DEFAULT_SUBSCRIBER_PACKET_RATE 0
+#define DEFAULT_SUBSCRIBER_SESSION_RATE 0
+#define DEFAULT_OVERLOAD_THRESHOLD 0
+/* Ports per cluster partition block. (cluster-nodes) */
+#define CLUSTER_BLOCK_BITS 10
+#define CLUSTER_BLOCK_PORTS (1 << CLUSTER_BLOCK_BITS)
+/* One block per node, at least. */
+#define CLUSTER_MAX_NODES (65536 >> CLUSTER_BLOCK_BITS)
+#define DEFAULT_CLUSTER_NODES 0
+#define DEFAULT_CLUSTER_NODE 0
+#define DEFAULT_POOL4_PRESSURE_LOW 0
+#define DEFAULT_POOL4_PRESSURE_HIGH 95
+#define DEFAULT_RSS_QUEUES 0
+#define DEFAULT_PORT_PRESERVATION false
+#define DEFAULT_LEAST_LOADED_ADDRESS false
+#define DEFAULT_MAX_SESSIONS 0
+#define DEFAULT_REFRESH_GRANULARITY 1000
 #define DEFAULT_SRC_ICMP6ERRS_BETTER true
 #define DEFAULT_F_ARGS 0b1011
+#define DEFAULT_F_HASH F_HASH_MD5
 #define DEFAULT_HANDLE_FIN_RCV_RST false
+#define DEFAULT_DETERMINISTIC_LEN 64
 #define DEFAULT_BIB_LOGGING false
 #define DEFAULT_SESSION_LOGGING false
+#define DEFAULT_BIB_LOGGING_BINARY false
 
 #define DEFAULT_INSTANCE_ENABLED true
 #define DEFAULT_RESET_TRAFFIC_CLASS false
+#define DEFAULT_GENERATE_FLOW_LABEL false
+#define DEFAULT_IPV4_ID_POLICY IIP_KERNEL
 #define DEFAULT_RESET_TOS false
 #define DEFAULT_NEW_TOS 0
 #define DEFAULT_LOWEST_IPV6_MTU 1280
+#define DEFAULT_ICMP_ERROR_RATE 0
+#define DEFAULT_ICMP_ERROR_SOURCE_RATE 0
+#define DEFAULT_TCP_MSS_CLAMP false
+#define DEFAULT_CAPTURE_SAMPLE 0
+#define DEFAULT_CAPTURE_SNAPLEN 128
+#define DEFAULT_LATENCY_SAMPLE 0
+#define DEFAULT_SESSION_COUNTERS false
 #define DEFAULT_COMPUTE_UDP_CSUM0 false
 #define DEFAULT_EAM_HAIRPIN_MODE EHM_INTRINSIC
 #define DEFAULT_RANDOMIZE_RFC6791 true
@@ -111,7 +152,14 @@
  * The root attribute header size and serialized session size need to be
  * computed the hard way. Run the joold unit test to find them in dmesg.
  */
-#define DEFAULT_JOOLD_MAX_SESSIONS_PER_PKT ((1500 - 40 - 8 - 4) / 140)
+#define DEFAULT_JOOLD_MAX_SESSIONS_PER_PKT ((1500 - 40 - 8 - 12) / 48)
+#define DEFAULT_JOOLD_MAX_OUTSTANDING 1
+#define DEFAULT_JOOLD_SYNC_TCP true
+#define DEFAULT_JOOLD_SYNC_UDP true
+#define DEFAULT_JOOLD_SYNC_ICMP true
+#define DEFAULT_JOOLD_MIN_AGE 0
+#define DEFAULT_JOOLD_ESTABLISHED_ONLY false
+#define DEFAULT_JOOLD_FLUSH_WINDOW 0
 
 /* -- IPv6 Pool -- */
 
@@ -128,6 +176,15 @@
 #define DEFAULT_POOL4_MAX_PORT 65535
 
 
+/* -- EAMT -- */
+
+/**
+ * MAP-T rules' default PSID offset ("a"). RFC 7597's; it keeps the system
+ * ports (0-1023) out of every port set.
+ */
+#define DEFAULT_PSID_OFFSET 6
+
+
 /* -- ICMP constants missing from icmp.h and icmpv6.h. -- */
 
 /** Code 0 for ICMP messages of type ICMP_PARAMETERPROB. */
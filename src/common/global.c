@@ -103,6 +103,12 @@ static int raw2nl_plateaus(struct joolnl_global_meta const *meta, void *raw,
 	return jnla_put_plateaus(skb, meta->id, raw);
 }
 
+static int raw2nl_ports(struct joolnl_global_meta const *meta, void *raw,
+		struct sk_buff *skb)
+{
+	return jnla_put_ports(skb, meta->id, raw);
+}
+
 static int raw2nl_prefix6(struct joolnl_global_meta const *meta, void *raw,
 		struct sk_buff *skb)
 {
@@ -119,6 +125,24 @@ static int raw2nl_prefix4(struct joolnl_global_meta const *meta, void *raw,
 			prefix4->set ? &prefix4->prefix : NULL);
 }
 
+static int raw2nl_mark_range(struct joolnl_global_meta const *meta,
+		void *raw, struct sk_buff *skb)
+{
+	return jnla_put_mark_range(skb, meta->id, raw);
+}
+
+static int raw2nl_next_hop6(struct joolnl_global_meta const *meta,
+		void *raw, struct sk_buff *skb)
+{
+	return jnla_put_next_hop6(skb, meta->id, raw);
+}
+
+static int raw2nl_next_hop4(struct joolnl_global_meta const *meta,
+		void *raw, struct sk_buff *skb)
+{
+	return jnla_put_next_hop4(skb, meta->id, raw);
+}
+
 static int nl2raw_bool(struct nlattr *attr, void *raw, bool force)
 {
 	*((bool *)raw) = nla_get_u8(attr);
@@ -142,6 +166,76 @@ static int nl2raw_plateaus(struct nlattr *attr, void *raw, bool force)
 	return jnla_get_plateaus(attr, raw);
 }
 
+static int nl2raw_ports(struct nlattr *attr, void *raw, bool force)
+{
+	return jnla_get_ports(attr, raw);
+}
+
+static int raw2nl_ingress_devices(struct joolnl_global_meta const *meta,
+		void *raw, struct sk_buff *skb)
+{
+	return jnla_put_ingress_devices(skb, meta->id, raw);
+}
+
+static int nl2raw_ingress_devices(struct nlattr *attr, void *raw, bool force)
+{
+	return jnla_get_ingress_devices(attr, raw);
+}
+
+static int raw2nl_timeout_classes(struct joolnl_global_meta const *meta,
+		void *raw, struct sk_buff *skb)
+{
+	return jnla_put_timeout_classes(skb, meta->id, raw);
+}
+
+static int nl2raw_timeout_classes(struct nlattr *attr, void *raw, bool force)
+{
+	return jnla_get_timeout_classes(attr, raw);
+}
+
+static int raw2nl_pool6_tenants(struct joolnl_global_meta const *meta,
+		void *raw, struct sk_buff *skb)
+{
+	return jnla_put_pool6_tenants(skb, meta->id, raw);
+}
+
+static int nl2raw_pool6_tenants(struct nlattr *attr, void *raw, bool force)
+{
+	struct pool6_tenants *tenants = raw;
+	struct config_prefix6 prefix;
+	unsigned int i;
+	int error;
+
+	error = jnla_get_pool6_tenants(attr, tenants);
+	if (error)
+		return error;
+
+	prefix.set = true;
+	for (i = 0; i < tenants->count; i++) {
+		prefix.prefix = tenants->values[i].prefix;
+		error = pool6_validate(&prefix, force);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static int nl2raw_mark_range(struct nlattr *attr, void *raw, bool force)
+{
+	return jnla_get_mark_range(attr, "mark range", raw);
+}
+
+static int nl2raw_next_hop6(struct nlattr *attr, void *raw, bool force)
+{
+	return jnla_get_next_hop6(attr, "IPv6 next hop", raw);
+}
+
+static int nl2raw_next_hop4(struct nlattr *attr, void *raw, bool force)
+{
+	return jnla_get_next_hop4(attr, "IPv4 next hop", raw);
+}
+
 static int validate_prefix6791v4(struct config_prefix4 *prefix, bool force)
 {
 	int error;
@@ -180,6 +274,34 @@ static int nl2raw_pool6791v6(struct nlattr *attr, void *raw, bool force)
 	return prefix->set ? prefix6_validate(&prefix->prefix) : 0;
 }
 
+static int nl2raw_deterministic_prefix(struct nlattr *attr, void *raw,
+		bool force)
+{
+	struct config_prefix6 *prefix = raw;
+	int error;
+
+	error = jnla_get_prefix6_optional(attr, "deterministic prefix", prefix);
+	if (error)
+		return error;
+
+	return prefix->set ? prefix6_validate(&prefix->prefix) : 0;
+}
+
+static int nl2raw_deterministic_len(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 len;
+
+	len = nla_get_u8(attr);
+	if (len > 128) {
+		log_err("deterministic-subscriber-length (%u) is out of range. (0-128)",
+				len);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = len;
+	return 0;
+}
+
 static int nl2raw_pool6791v4(struct nlattr *attr, void *raw, bool force)
 {
 	struct config_prefix4 *prefix = raw;
@@ -206,6 +328,21 @@ static int nl2raw_lowest_ipv6_mtu(struct nlattr *attr, void *raw, bool force)
 	return 0;
 }
 
+static int nl2raw_capture_snaplen(struct nlattr *attr, void *raw, bool force)
+{
+	__u32 snaplen;
+
+	snaplen = nla_get_u32(attr);
+	if (snaplen < 1 || CAPTURE_SNAPLEN_MAX < snaplen) {
+		log_err("capture-snaplen (%u) is out of range. (1-%u)",
+				snaplen, CAPTURE_SNAPLEN_MAX);
+		return -EINVAL;
+	}
+
+	*((__u32 *)raw) = snaplen;
+	return 0;
+}
+
 static int nl2raw_hairpin_mode(struct nlattr *attr, void *raw, bool force)
 {
 	__u8 mode;
@@ -220,6 +357,35 @@ static int nl2raw_hairpin_mode(struct nlattr *attr, void *raw, bool force)
 	return 0;
 }
 
+static int nl2raw_ipv4_id_policy(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 policy;
+
+	policy = nla_get_u8(attr);
+	if (policy != IIP_KERNEL && policy != IIP_ZERO
+			&& policy != IIP_COUNTER) {
+		log_err("Unknown IPv4 ID policy: %u", policy);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = policy;
+	return 0;
+}
+
+static int nl2raw_f_hash(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 hash;
+
+	hash = nla_get_u8(attr);
+	if (hash != F_HASH_MD5 && hash != F_HASH_SIPHASH) {
+		log_err("Unknown F() hash function: %u", hash);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = hash;
+	return 0;
+}
+
 static int validate_timeout(const char *what, __u32 timeout, unsigned int min)
 {
 	if (timeout < min) {
@@ -284,6 +450,98 @@ static int nl2raw_f_args(struct nlattr *attr, void *raw, bool force)
 	return 0;
 }
 
+static int nl2raw_port_block_size(struct nlattr *attr, void *raw, bool force)
+{
+	__u32 size;
+
+	size = nla_get_u32(attr);
+	if (size > 65536u) {
+		log_err("port-block-size (%u) is out of range. (0-%u)", size,
+				65536u);
+		return -EINVAL;
+	}
+
+	*((__u32 *)raw) = size;
+	return 0;
+}
+
+static int nl2raw_subscriber_prefix_len(struct nlattr *attr, void *raw,
+		bool force)
+{
+	__u8 len;
+
+	len = nla_get_u8(attr);
+	if (len > 128u) {
+		log_err("subscriber-prefix-length (%u) is out of range. (0-128)",
+				len);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = len;
+	return 0;
+}
+
+static int nl2raw_overload_threshold(struct nlattr *attr, void *raw,
+		bool force)
+{
+	__u8 threshold;
+
+	threshold = nla_get_u8(attr);
+	if (threshold > 100u) {
+		log_err("overload-threshold (%u) is out of range. (0-100)",
+				threshold);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = threshold;
+	return 0;
+}
+
+static int nl2raw_pool4_pressure(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 percent;
+
+	percent = nla_get_u8(attr);
+	if (percent > 100u) {
+		log_err("pool4 pressure watermarks (%u) are percentages. (0-100)",
+				percent);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = percent;
+	return 0;
+}
+
+static int nl2raw_cluster_nodes(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 nodes;
+
+	nodes = nla_get_u8(attr);
+	if (nodes > CLUSTER_MAX_NODES) {
+		log_err("cluster-nodes (%u) is out of range. (0-%u)", nodes,
+				CLUSTER_MAX_NODES);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = nodes;
+	return 0;
+}
+
+static int nl2raw_cluster_node(struct nlattr *attr, void *raw, bool force)
+{
+	__u8 node;
+
+	node = nla_get_u8(attr);
+	if (node >= CLUSTER_MAX_NODES) {
+		log_err("cluster-node (%u) is out of range. (0-%u)", node,
+				CLUSTER_MAX_NODES - 1);
+		return -EINVAL;
+	}
+
+	*((__u8 *)raw) = node;
+	return 0;
+}
+
 #else
 
 static void print_bool(void *value, bool csv)
@@ -337,6 +595,52 @@ static void print_plateaus(void *value, bool csv)
 		printf("\"");
 }
 
+static void print_ports(void *value, bool csv)
+{
+	struct port_list *ports = value;
+	unsigned int i;
+
+	if (ports->count == 0) {
+		printf("%s", csv ? "" : "(none)");
+		return;
+	}
+
+	if (csv)
+		printf("\"");
+
+	for (i = 0; i < ports->count; i++) {
+		printf("%u", ports->values[i]);
+		if (i != ports->count - 1)
+			printf(",");
+	}
+
+	if (csv)
+		printf("\"");
+}
+
+static void print_ingress_devices(void *value, bool csv)
+{
+	struct ingress_devices *devices = value;
+	unsigned int i;
+
+	if (devices->count == 0) {
+		printf("%s", csv ? "" : "(none)");
+		return;
+	}
+
+	if (csv)
+		printf("\"");
+
+	for (i = 0; i < devices->count; i++) {
+		printf("%s", devices->names[i]);
+		if (i != devices->count - 1)
+			printf(",");
+	}
+
+	if (csv)
+		printf("\"");
+}
+
 static void print_prefix(int af, const void *addr, __u8 len, bool set, bool csv)
 {
 	const char *str;
@@ -368,6 +672,134 @@ static void print_prefix4(void *value, bool csv)
 			prefix->set, csv);
 }
 
+static void print_mark_range(void *value, bool csv)
+{
+	struct config_mark_range *range = value;
+
+	if (!range->set)
+		printf("%s", csv ? "" : "(unset)");
+	else if (range->first == range->last)
+		printf("%u", range->first);
+	else
+		printf("%u-%u", range->first, range->last);
+}
+
+static void print_next_hop(int af, const void *gateway, char const *dev,
+		bool set, bool csv)
+{
+	const char *str;
+	char buffer[INET6_ADDRSTRLEN];
+
+	if (!set) {
+		printf("%s", csv ? "" : "(unset)");
+		return;
+	}
+
+	str = inet_ntop(af, gateway, buffer, sizeof(buffer));
+	if (str)
+		printf("%s%%%s", str, dev);
+	else
+		perror("inet_ntop");
+}
+
+static void print_next_hop6(void *value, bool csv)
+{
+	struct config_next_hop6 *hop = value;
+	print_next_hop(AF_INET6, &hop->gateway, hop->dev, hop->set, csv);
+}
+
+static void print_next_hop4(void *value, bool csv)
+{
+	struct config_next_hop4 *hop = value;
+	print_next_hop(AF_INET, &hop->gateway, hop->dev, hop->set, csv);
+}
+
+static void print_timeout_classes(void *value, bool csv)
+{
+	struct timeout_classes *classes = value;
+	struct timeout_class *class;
+	char buffer[TIMEOUT_BUFLEN];
+	unsigned int i;
+
+	if (classes->count == 0) {
+		printf("%s", csv ? "" : "(none)");
+		return;
+	}
+
+	if (csv)
+		printf("\"");
+
+	for (i = 0; i < classes->count; i++) {
+		class = &classes->values[i];
+
+		printf("%s", l4proto_to_string(class->proto));
+		if (class->range.ports.min != 0
+				|| class->range.ports.max != 65535) {
+			printf(":%u", class->range.ports.min);
+			if (class->range.ports.min != class->range.ports.max)
+				printf("-%u", class->range.ports.max);
+		}
+		if (class->range.prefix.len != 0) {
+			printf("@");
+			print_prefix(AF_INET, &class->range.prefix.addr,
+					class->range.prefix.len, true, csv);
+		}
+		timeout2str(class->ttl, buffer);
+		printf("=%s", buffer);
+
+		if (i != classes->count - 1)
+			printf(",");
+	}
+
+	if (csv)
+		printf("\"");
+}
+
+static void print_pool6_tenants(void *value, bool csv)
+{
+	struct pool6_tenants *tenants = value;
+	struct pool6_tenant *tenant;
+	unsigned int i;
+
+	if (tenants->count == 0) {
+		printf("%s", csv ? "" : "(none)");
+		return;
+	}
+
+	if (csv)
+		printf("\"");
+
+	for (i = 0; i < tenants->count; i++) {
+		tenant = &tenants->values[i];
+		print_prefix(AF_INET6, &tenant->prefix.addr, tenant->prefix.len,
+				true, csv);
+		if (tenant->mark_set)
+			printf("=%u", tenant->mark);
+		if (i != tenants->count - 1)
+			printf(",");
+	}
+
+	if (csv)
+		printf("\"");
+}
+
+static void print_ipv4_id_policy(void *value, bool csv)
+{
+	switch (*((__u8 *)value)) {
+	case IIP_KERNEL:
+		printf("kernel");
+		return;
+	case IIP_ZERO:
+		printf("zero");
+		return;
+	case IIP_COUNTER:
+		printf("counter");
+		return;
+	}
+
+	printf("unknown");
+}
+
 static void print_hairpin_mode(void *value, bool csv)
 {
 	switch (*((__u8 *)value)) {
@@ -385,6 +817,20 @@ static void print_hairpin_mode(void *value, bool csv)
 	printf("unknown");
 }
 
+static void print_f_hash(void *value, bool csv)
+{
+	switch (*((__u8 *)value)) {
+	case F_HASH_MD5:
+		printf("md5");
+		return;
+	case F_HASH_SIPHASH:
+		printf("siphash");
+		return;
+	}
+
+	printf("unknown");
+}
+
 static void print_fargs(void *value, bool csv)
 {
 	__u8 uvalue = *((__u8 *)value);
@@ -428,6 +874,28 @@ static struct jool_result nl2raw_plateaus(struct nlattr *attr, void *raw)
 	return nla_get_plateaus(attr, raw);
 }
 
+static struct jool_result nl2raw_ports(struct nlattr *attr, void *raw)
+{
+	return nla_get_ports(attr, raw);
+}
+
+static struct jool_result nl2raw_ingress_devices(struct nlattr *attr,
+		void *raw)
+{
+	return nla_get_ingress_devices(attr, raw);
+}
+
+static struct jool_result nl2raw_timeout_classes(struct nlattr *attr,
+		void *raw)
+{
+	return nla_get_timeout_classes(attr, raw);
+}
+
+static struct jool_result nl2raw_pool6_tenants(struct nlattr *attr, void *raw)
+{
+	return nla_get_pool6_tenants(attr, raw);
+}
+
 static struct jool_result nl2raw_prefix6(struct nlattr *attr, void *raw)
 {
 	struct config_prefix6 *prefix = raw;
@@ -446,6 +914,21 @@ static struct jool_result nl2raw_prefix6(struct nlattr *attr, void *raw)
 	return result;
 }
 
+static struct jool_result nl2raw_mark_range(struct nlattr *attr, void *raw)
+{
+	return nla_get_mark_range(attr, raw);
+}
+
+static struct jool_result nl2raw_next_hop6(struct nlattr *attr, void *raw)
+{
+	return nla_get_next_hop6(attr, raw);
+}
+
+static struct jool_result nl2raw_next_hop4(struct nlattr *attr, void *raw)
+{
+	return nla_get_next_hop4(attr, raw);
+}
+
 static struct jool_result nl2raw_prefix4(struct nlattr *attr, void *raw)
 {
 	struct config_prefix4 *prefix = raw;
@@ -539,6 +1022,66 @@ static struct jool_result str2nl_plateaus(enum joolnl_attr_global id,
 			: result_success();
 }
 
+static struct jool_result str2nl_ports(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct port_list ports;
+	struct jool_result result;
+
+	result = str_to_port_list(str, &ports);
+	if (result.error)
+		return result;
+
+	return (nla_put_ports(msg, id, &ports) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result str2nl_ingress_devices(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct ingress_devices devices;
+	struct jool_result result;
+
+	result = str_to_ingress_devices(str, &devices);
+	if (result.error)
+		return result;
+
+	return (nla_put_ingress_devices(msg, id, &devices) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result str2nl_timeout_classes(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct timeout_classes classes;
+	struct jool_result result;
+
+	result = str_to_timeout_classes(str, &classes);
+	if (result.error)
+		return result;
+
+	return (nla_put_timeout_classes(msg, id, &classes) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result str2nl_pool6_tenants(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct pool6_tenants tenants;
+	struct jool_result result;
+
+	result = str_to_pool6_tenants(str, &tenants);
+	if (result.error)
+		return result;
+
+	return (nla_put_pool6_tenants(msg, id, &tenants) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
 static struct jool_result str2nl_prefix6(enum joolnl_attr_global id,
 		char const *str, struct nl_msg *msg)
 {
@@ -550,29 +1093,105 @@ static struct jool_result str2nl_prefix6(enum joolnl_attr_global id,
 		result = str_to_prefix6(str, &prefix);
 		if (result.error)
 			return result;
-		prefix_ptr = &prefix;
+		prefix_ptr = &prefix;
+	}
+
+	return (nla_put_prefix6(msg, id, prefix_ptr) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result str2nl_prefix4(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct ipv4_prefix prefix, *prefix_ptr;
+	struct jool_result result;
+
+	prefix_ptr = NULL;
+	if (strcmp(str, "null") != 0) {
+		result = str_to_prefix4(str, &prefix);
+		if (result.error)
+			return result;
+		prefix_ptr = &prefix;
+	}
+
+	return (nla_put_prefix4(msg, id, prefix_ptr) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result str2nl_mark_range(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct config_mark_range range;
+	struct jool_result result;
+
+	range.set = strcmp(str, "null") != 0;
+	if (range.set) {
+		result = str_to_mark_range(str, &range.first, &range.last);
+		if (result.error)
+			return result;
+	}
+
+	return (nla_put_mark_range(msg, id, &range) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result str2nl_next_hop6(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct config_next_hop6 hop;
+	struct jool_result result;
+
+	hop.set = strcmp(str, "null") != 0;
+	if (hop.set) {
+		result = str_to_next_hop6(str, &hop.gateway, hop.dev);
+		if (result.error)
+			return result;
+	}
+
+	return (nla_put_next_hop6(msg, id, &hop) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result str2nl_next_hop4(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	struct config_next_hop4 hop;
+	struct jool_result result;
+
+	hop.set = strcmp(str, "null") != 0;
+	if (hop.set) {
+		result = str_to_next_hop4(str, &hop.gateway, hop.dev);
+		if (result.error)
+			return result;
 	}
 
-	return (nla_put_prefix6(msg, id, prefix_ptr) < 0)
+	return (nla_put_next_hop4(msg, id, &hop) < 0)
 			? joolnl_err_msgsize()
 			: result_success();
 }
 
-static struct jool_result str2nl_prefix4(enum joolnl_attr_global id,
+static struct jool_result str2nl_ipv4_id_policy(enum joolnl_attr_global id,
 		char const *str, struct nl_msg *msg)
 {
-	struct ipv4_prefix prefix, *prefix_ptr;
-	struct jool_result result;
+	__u8 policy;
 
-	prefix_ptr = NULL;
-	if (strcmp(str, "null") != 0) {
-		result = str_to_prefix4(str, &prefix);
-		if (result.error)
-			return result;
-		prefix_ptr = &prefix;
-	}
+	if (strcmp(str, "kernel") == 0)
+		policy = IIP_KERNEL;
+	else if (strcmp(str, "zero") == 0)
+		policy = IIP_ZERO;
+	else if (strcmp(str, "counter") == 0)
+		policy = IIP_COUNTER;
+	else return result_from_error(
+		-EINVAL,
+		"'%s' cannot be parsed as an IPv4 ID policy.\n"
+		"Available options: kernel, zero, counter", str
+	);
 
-	return (nla_put_prefix4(msg, id, prefix_ptr) < 0)
+	return (nla_put_u8(msg, id, policy) < 0)
 			? joolnl_err_msgsize()
 			: result_success();
 }
@@ -599,6 +1218,26 @@ static struct jool_result str2nl_hairpin_mode(enum joolnl_attr_global id,
 			: result_success();
 }
 
+static struct jool_result str2nl_f_hash(enum joolnl_attr_global id,
+		char const *str, struct nl_msg *msg)
+{
+	__u8 hash;
+
+	if (strcmp(str, "md5") == 0)
+		hash = F_HASH_MD5;
+	else if (strcmp(str, "siphash") == 0)
+		hash = F_HASH_SIPHASH;
+	else return result_from_error(
+		-EINVAL,
+		"'%s' cannot be parsed as a F() hash function.\n"
+		"Available options: md5, siphash", str
+	);
+
+	return (nla_put_u8(msg, id, hash) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
 static struct jool_result json2nl_bool(struct joolnl_global_meta const *meta,
 		cJSON *json, struct nl_msg *msg)
 {
@@ -658,16 +1297,16 @@ static struct jool_result json2nl_string(struct joolnl_global_meta const *meta,
 	return type_mismatch(json->string, json, "string");
 }
 
-static struct jool_result json2nl_plateaus(struct joolnl_global_meta const *meta,
-		cJSON *json, struct nl_msg *msg)
+static struct jool_result json2nl_u16_list(struct joolnl_global_meta const *meta,
+		cJSON *json, struct nl_msg *msg, char const *expected)
 {
 	struct nlattr *root;
 	struct jool_result result;
 
 	if (json->type != cJSON_Array)
-		return type_mismatch(json->string, json, "plateaus array");
+		return type_mismatch(json->string, json, expected);
 
-	root = jnla_nest_start(msg, JNLAG_PLATEAUS);
+	root = jnla_nest_start(msg, meta->id);
 	if (!root)
 		return joolnl_err_msgsize();
 
@@ -684,6 +1323,126 @@ static struct jool_result json2nl_plateaus(struct joolnl_global_meta const *meta
 	return result_success();
 }
 
+static struct jool_result json2nl_plateaus(struct joolnl_global_meta const *meta,
+		cJSON *json, struct nl_msg *msg)
+{
+	return json2nl_u16_list(meta, json, msg, "plateaus array");
+}
+
+static struct jool_result json2nl_ports(struct joolnl_global_meta const *meta,
+		cJSON *json, struct nl_msg *msg)
+{
+	return json2nl_u16_list(meta, json, msg, "port array");
+}
+
+static struct jool_result json2nl_ingress_devices(
+		struct joolnl_global_meta const *meta,
+		cJSON *json, struct nl_msg *msg)
+{
+	struct ingress_devices devices;
+	struct jool_result result;
+
+	if (json->type == cJSON_NULL)
+		return meta->type->str2nl(meta->id, "null", msg);
+	if (json->type != cJSON_Array)
+		return type_mismatch(json->string, json, "interface name array");
+
+	devices.count = 0;
+	for (json = json->child; json; json = json->next) {
+		if (json->type != cJSON_String)
+			return type_mismatch(meta->name, json, "string");
+		if (devices.count >= INGRESS_DEVICES_MAX) {
+			return result_from_error(
+				-EINVAL,
+				"Too many ingress devices. The current max is %u.",
+				INGRESS_DEVICES_MAX
+			);
+		}
+
+		result = str_to_ifname(json->valuestring,
+				devices.names[devices.count]);
+		if (result.error)
+			return result;
+		devices.count++;
+	}
+
+	return (nla_put_ingress_devices(msg, meta->id, &devices) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result json2nl_timeout_classes(
+		struct joolnl_global_meta const *meta,
+		cJSON *json, struct nl_msg *msg)
+{
+	struct timeout_classes classes;
+	struct jool_result result;
+
+	if (json->type == cJSON_NULL)
+		return meta->type->str2nl(meta->id, "null", msg);
+	if (json->type != cJSON_Array)
+		return type_mismatch(json->string, json, "timeout class array");
+
+	classes.count = 0;
+	for (json = json->child; json; json = json->next) {
+		if (json->type != cJSON_String)
+			return type_mismatch(meta->name, json, "string");
+		if (classes.count >= TIMEOUT_CLASSES_MAX) {
+			return result_from_error(
+				-EINVAL,
+				"Too many timeout classes. The current max is %u.",
+				TIMEOUT_CLASSES_MAX
+			);
+		}
+
+		result = str_to_timeout_class(json->valuestring,
+				&classes.values[classes.count]);
+		if (result.error)
+			return result;
+		classes.count++;
+	}
+
+	return (nla_put_timeout_classes(msg, meta->id, &classes) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
+static struct jool_result json2nl_pool6_tenants(
+		struct joolnl_global_meta const *meta,
+		cJSON *json, struct nl_msg *msg)
+{
+	struct pool6_tenants tenants;
+	struct jool_result result;
+
+	if (json->type == cJSON_NULL)
+		return meta->type->str2nl(meta->id, "null", msg);
+	if (json->type != cJSON_Array)
+		return type_mismatch(json->string, json, "pool6 tenant array");
+
+	tenants.count = 0;
+	for (json = json->child; json; json = json->next) {
+		if (json->type != cJSON_String)
+			return type_mismatch(meta->name, json, "string");
+		if (tenants.count >= POOL6_TENANTS_MAX) {
+			return result_from_error(
+				-EINVAL,
+				"Too many pool6 tenants. The current max is %u.",
+				POOL6_TENANTS_MAX
+			);
+		}
+
+		result = str_to_pool6_tenant(json->valuestring,
+				&tenants.values[tenants.count]);
+		if (result.error)
+			return result;
+		tenants.count++;
+	}
+
+	return (nla_put_pool6_tenants(msg, meta->id, &tenants) < 0)
+			? joolnl_err_msgsize()
+			: result_success();
+}
+
 #endif
 
 #ifdef __KERNEL__
@@ -733,6 +1492,30 @@ static struct joolnl_global_type gt_plateaus = {
 	USERSPACE_FUNCTIONS(print_plateaus, str2nl_plateaus, json2nl_plateaus, nl2raw_plateaus)
 };
 
+static struct joolnl_global_type gt_ports = {
+	.name = "List of ports separated by commas (\"null\" for none)",
+	KERNEL_FUNCTIONS(raw2nl_ports, nl2raw_ports)
+	USERSPACE_FUNCTIONS(print_ports, str2nl_ports, json2nl_ports, nl2raw_ports)
+};
+
+static struct joolnl_global_type gt_ingress_devices = {
+	.name = "List of interface names separated by commas (\"null\" for none)",
+	KERNEL_FUNCTIONS(raw2nl_ingress_devices, nl2raw_ingress_devices)
+	USERSPACE_FUNCTIONS(print_ingress_devices, str2nl_ingress_devices, json2nl_ingress_devices, nl2raw_ingress_devices)
+};
+
+static struct joolnl_global_type gt_timeout_classes = {
+	.name = "List of <protocol>[:<ports>][@<IPv4 prefix>]=<timeout> separated by commas (\"null\" for none)",
+	KERNEL_FUNCTIONS(raw2nl_timeout_classes, nl2raw_timeout_classes)
+	USERSPACE_FUNCTIONS(print_timeout_classes, str2nl_timeout_classes, json2nl_timeout_classes, nl2raw_timeout_classes)
+};
+
+static struct joolnl_global_type gt_pool6_tenants = {
+	.name = "List of <IPv6 prefix>[=<mark>] separated by commas (\"null\" for none)",
+	KERNEL_FUNCTIONS(raw2nl_pool6_tenants, nl2raw_pool6_tenants)
+	USERSPACE_FUNCTIONS(print_pool6_tenants, str2nl_pool6_tenants, json2nl_pool6_tenants, nl2raw_pool6_tenants)
+};
+
 static struct joolnl_global_type gt_prefix6 = {
 	.name = "IPv6 prefix",
 	KERNEL_FUNCTIONS(raw2nl_prefix6, NULL)
@@ -745,6 +1528,31 @@ static struct joolnl_global_type gt_prefix4 = {
 	USERSPACE_FUNCTIONS(print_prefix4, str2nl_prefix4, json2nl_string, nl2raw_prefix4)
 };
 
+static struct joolnl_global_type gt_mark_range = {
+	.name = "Mark range (\"null\" for unset)",
+	KERNEL_FUNCTIONS(raw2nl_mark_range, nl2raw_mark_range)
+	USERSPACE_FUNCTIONS(print_mark_range, str2nl_mark_range, json2nl_string, nl2raw_mark_range)
+};
+
+static struct joolnl_global_type gt_next_hop6 = {
+	.name = "<IPv6 address>%<interface> (\"null\" for unset)",
+	KERNEL_FUNCTIONS(raw2nl_next_hop6, nl2raw_next_hop6)
+	USERSPACE_FUNCTIONS(print_next_hop6, str2nl_next_hop6, json2nl_string, nl2raw_next_hop6)
+};
+
+static struct joolnl_global_type gt_next_hop4 = {
+	.name = "<IPv4 address>%<interface> (\"null\" for unset)",
+	KERNEL_FUNCTIONS(raw2nl_next_hop4, nl2raw_next_hop4)
+	USERSPACE_FUNCTIONS(print_next_hop4, str2nl_next_hop4, json2nl_string, nl2raw_next_hop4)
+};
+
+static struct joolnl_global_type gt_ipv4_id_policy = {
+	.name = "IPv4 ID Policy",
+	.candidates = "kernel zero counter",
+	KERNEL_FUNCTIONS(raw2nl_u8, nl2raw_ipv4_id_policy)
+	USERSPACE_FUNCTIONS(print_ipv4_id_policy, str2nl_ipv4_id_policy, json2nl_string, nl2raw_u8)
+};
+
 static struct joolnl_global_type gt_hairpin_mode = {
 	.name = "Hairpinning Mode",
 	.candidates = "off simple intrinsic",
@@ -752,6 +1560,13 @@ static struct joolnl_global_type gt_hairpin_mode = {
 	USERSPACE_FUNCTIONS(print_hairpin_mode, str2nl_hairpin_mode, json2nl_string, nl2raw_u8)
 };
 
+static struct joolnl_global_type gt_f_hash = {
+	.name = "F() Hash Function",
+	.candidates = "md5 siphash",
+	KERNEL_FUNCTIONS(raw2nl_u8, nl2raw_f_hash)
+	USERSPACE_FUNCTIONS(print_f_hash, str2nl_f_hash, json2nl_string, nl2raw_u8)
+};
+
 static const struct joolnl_global_meta globals_metadata[] = {
 	{
 		.id = JNLAG_ENABLED,
@@ -816,6 +1631,86 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Set the list of plateaus for ICMPv4 Fragmentation Neededs with MTU unset.",
 		.offset = offsetof(struct jool_globals, plateaus),
 		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_ICMP_ERROR_RATE,
+		.name = "icmp-error-rate",
+		.type = &gt_uint32,
+		.doc = "Set the ICMP errors per second and CPU the instance is allowed to generate (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, icmp_error_rate),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_ICMP_ERROR_SOURCE_RATE,
+		.name = "icmp-error-source-rate",
+		.type = &gt_uint32,
+		.doc = "Set the ICMP errors per second and CPU the instance is allowed to send to each /24 or /64 (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, icmp_error_source_rate),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_TCP_MSS_CLAMP,
+		.name = "tcp-mss-clamp",
+		.type = &gt_bool,
+		.doc = "Lower the MSS of translated TCP SYNs so the segments fit in the IPv6 MTU?",
+		.offset = offsetof(struct jool_globals, tcp_mss_clamp),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_NETFILTER_MARKS,
+		.name = "netfilter-marks",
+		.type = &gt_mark_range,
+		.doc = "Set the packet marks this Netfilter instance translates, when it shares its namespace with other Netfilter instances.",
+		.offset = offsetof(struct jool_globals, netfilter_marks),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_CAPTURE_SAMPLE,
+		.name = "capture-sample",
+		.type = &gt_uint32,
+		.doc = "Multicast one in every <this many> translations (the original packet and its translation) to the capture group (0 = disabled).",
+		.offset = offsetof(struct jool_globals, capture_sample),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_CAPTURE_SNAPLEN,
+		.name = "capture-snaplen",
+		.type = &gt_uint32,
+		.doc = "Maximum bytes captured from each packet, starting at its network header.",
+		.offset = offsetof(struct jool_globals, capture_snaplen),
+		.xt = XT_ANY,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_capture_snaplen,
+#endif
+	}, {
+		.id = JNLAG_INGRESS_DEVICES,
+		.name = "ingress-devices",
+		.type = &gt_ingress_devices,
+		.doc = "Translate the packets arriving through these interfaces at the netdev ingress hook, before the IP layer sees them. (Netfilter instances only.)",
+		.offset = offsetof(struct jool_globals, ingress_devices),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_NEXT_HOP6,
+		.name = "next-hop6",
+		.type = &gt_next_hop6,
+		.doc = "Send every translated IPv6 packet to this gateway, through this interface, without consulting the routing table.",
+		.offset = offsetof(struct jool_globals, next_hop6),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_NEXT_HOP4,
+		.name = "next-hop4",
+		.type = &gt_next_hop4,
+		.doc = "Send every translated IPv4 packet to this gateway, through this interface, without consulting the routing table.",
+		.offset = offsetof(struct jool_globals, next_hop4),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_GENERATE_FLOW_LABEL,
+		.name = "generate-flow-label",
+		.type = &gt_bool,
+		.doc = "Set the IPv6 header's 'Flow Label' field as a hash of the packet's flow? Otherwise set it as zero.",
+		.offset = offsetof(struct jool_globals, generate_flow_label),
+		.xt = XT_ANY,
+	}, {
+		.id = JNLAG_IPV4_ID_POLICY,
+		.name = "ipv4-id-policy",
+		.type = &gt_ipv4_id_policy,
+		.doc = "Source of the Identification of translated IPv4 packets that have DF set. (Others always get the kernel's.)",
+		.offset = offsetof(struct jool_globals, ipv4_id_policy),
+		.xt = XT_ANY,
 	}, {
 		.id = JNLAG_COMPUTE_CSUM_ZERO,
 		.name = "amend-udp-checksum-zero",
@@ -903,6 +1798,14 @@ static const struct joolnl_global_meta globals_metadata[] = {
 #else
 		.print = print_fargs,
 #endif
+	}, {
+		.id = JNLAG_F_HASH,
+		.name = "f-hash",
+		.type = &gt_f_hash,
+		.doc = "Defines the hash function F() uses.\n"
+			"(F() is defined by algorithm 3 of RFC 6056.)",
+		.offset = offsetof(struct jool_globals, nat64.f_hash),
+		.xt = XT_NAT64,
 	}, {
 		.id = JNLAG_HANDLE_RST,
 		.name = "handle-rst-during-fin-rcv",
@@ -910,6 +1813,26 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Use transitory timer when RST is received during the V6 FIN RCV or V4 FIN RCV states?",
 		.offset = offsetof(struct jool_globals, nat64.handle_rst_during_fin_rcv),
 		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_DETERMINISTIC_PREFIX,
+		.name = "deterministic-prefix",
+		.type = &gt_prefix6,
+		.doc = "IPv6 prefix whose addresses get computed (RFC 7422) pool4 port ranges.",
+		.offset = offsetof(struct jool_globals, nat64.deterministic_prefix),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_deterministic_prefix,
+#endif
+	}, {
+		.id = JNLAG_DETERMINISTIC_LEN,
+		.name = "deterministic-subscriber-length",
+		.type = &gt_uint8,
+		.doc = "Prefix length of each deterministic-prefix subscriber.",
+		.offset = offsetof(struct jool_globals, nat64.deterministic_len),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_deterministic_len,
+#endif
 	}, {
 		.id = JNLAG_TTL_TCP_EST,
 		.name = "tcp-est-timeout",
@@ -961,6 +1884,13 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Log sessions as they are created and destroyed?",
 		.offset = offsetof(struct jool_globals, nat64.bib.session_logging),
 		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_BIB_LOGGING_BINARY,
+		.name = "logging-bib-binary",
+		.type = &gt_bool,
+		.doc = "Send BIB creations and destructions to the natlog multicast group?",
+		.offset = offsetof(struct jool_globals, nat64.bib.bib_logging_binary),
+		.xt = XT_NAT64,
 	}, {
 		.id = JNLAG_MAX_STORED_PKTS,
 		.name = "maximum-simultaneous-opens",
@@ -968,6 +1898,202 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Set the maximum allowable 'simultaneous' Simultaneos Opens of TCP connections.",
 		.offset = offsetof(struct jool_globals, nat64.bib.max_stored_pkts),
 		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_MAX_STORED_PKTS_PER_SRC,
+		.name = "maximum-simultaneous-opens-per-source",
+		.type = &gt_uint32,
+		.doc = "Set the maximum allowable Simultaneous Opens per IPv4 node (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, nat64.bib.max_stored_pkts_per_src),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_EXPIRY_BUDGET,
+		.name = "session-expiry-budget",
+		.type = &gt_uint32,
+		.doc = "Set the maximum number of sessions a cleaning run can visit (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, nat64.bib.expiry_budget),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_PORT_BLOCK_SIZE,
+		.name = "port-block-size",
+		.type = &gt_uint32,
+		.doc = "Set the number of ports reserved at a time for each IPv6 address (0 = no blocks).",
+		.offset = offsetof(struct jool_globals, nat64.bib.port_block_size),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_port_block_size,
+#endif
+	}, {
+		.id = JNLAG_SYN_FLOOD_THRESHOLD,
+		.name = "syn-flood-threshold",
+		.type = &gt_uint32,
+		.doc = "Set the IPv6 SYNs per second above which TCP connections are only stored once the IPv4 side answers (0 = disabled).",
+		.offset = offsetof(struct jool_globals, nat64.bib.syn_flood_threshold),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_SUBSCRIBER_PREFIX_LEN,
+		.name = "subscriber-prefix-length",
+		.type = &gt_uint8,
+		.doc = "Set the length of the IPv6 prefixes the subscriber quotas apply to.",
+		.offset = offsetof(struct jool_globals, nat64.bib.subscriber_prefix_len),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_subscriber_prefix_len,
+#endif
+	}, {
+		.id = JNLAG_SUBSCRIBER_MAX_PORTS,
+		.name = "subscriber-max-ports",
+		.type = &gt_uint32,
+		.doc = "Set the maximum number of BIB entries per subscriber (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, nat64.bib.subscriber_max_ports),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_SUBSCRIBER_MAX_SESSIONS,
+		.name = "subscriber-max-sessions",
+		.type = &gt_uint32,
+		.doc = "Set the maximum number of sessions per subscriber (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, nat64.bib.subscriber_max_sessions),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_RSS_QUEUES,
+		.name = "rss-queues",
+		.type = &gt_uint32,
+		.doc = "Set the number of RSS queues new IPv4 masks should be steered across (0 = disabled).",
+		.offset = offsetof(struct jool_globals, nat64.bib.rss_queues),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_PORT_PRESERVATION,
+		.name = "port-preservation",
+		.type = &gt_bool,
+		.doc = "Try to keep the IPv6 source port when allocating IPv4 transport addresses?",
+		.offset = offsetof(struct jool_globals, nat64.bib.port_preservation),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_LEAST_LOADED_ADDRESS,
+		.name = "least-loaded-address",
+		.type = &gt_bool,
+		.doc = "Start pool4 port searches from the least occupied of a few addresses?",
+		.offset = offsetof(struct jool_globals, nat64.bib.least_loaded_address),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_MAX_SESSIONS,
+		.name = "max-sessions",
+		.type = &gt_uint32,
+		.doc = "Set the maximum number of sessions; new ones evict the least recently used (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, nat64.bib.max_sessions),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_REFRESH_GRANULARITY,
+		.name = "session-refresh-granularity",
+		.type = &gt_uint32,
+		.doc = "Set the minimum age (in milliseconds) a session's timestamp needs before a packet rewrites it (0 = always).",
+		.offset = offsetof(struct jool_globals, nat64.bib.refresh_granularity),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_UDP_FAST_PORTS,
+		.name = "udp-fast-ports",
+		.type = &gt_ports,
+		.doc = "Set the destination ports of the UDP sessions that should expire shortly after their first response.",
+		.offset = offsetof(struct jool_globals, nat64.bib.udp_fast_ports),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_TTL_UDP_FAST,
+		.name = "udp-fast-timeout",
+		.type = &gt_timeout,
+		.doc = "Set the lifetime of the udp-fast-ports sessions after their first response (HH:MM:SS.mmm).",
+		.offset = offsetof(struct jool_globals, nat64.bib.ttl.udp_fast),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_TIMEOUT_CLASSES,
+		.name = "timeout-classes",
+		.type = &gt_timeout_classes,
+		.doc = "Set the established timeouts of the sessions towards specific IPv4 prefixes and ports.",
+		.offset = offsetof(struct jool_globals, nat64.bib.timeout_classes),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_POOL6_TENANTS,
+		.name = "pool6-tenants",
+		.type = &gt_pool6_tenants,
+		.doc = "Set the prefixes that translate like pool6, and the pool4 marks their packets use.",
+		.offset = offsetof(struct jool_globals, nat64.pool6_tenants),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_LATENCY_SAMPLE,
+		.name = "latency-sample",
+		.type = &gt_uint32,
+		.doc = "Send the per-stage timeline of one in every <this many> translations to the NAT log (0 = disabled).",
+		.offset = offsetof(struct jool_globals, nat64.latency_sample),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_SESSION_COUNTERS,
+		.name = "session-counters",
+		.type = &gt_bool,
+		.doc = "Count the packets and bytes of every session?",
+		.offset = offsetof(struct jool_globals, nat64.bib.session_counters),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_SUBSCRIBER_PACKET_RATE,
+		.name = "subscriber-packet-rate",
+		.type = &gt_uint32,
+		.doc = "Set the maximum number of packets per second per subscriber (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, nat64.bib.subscriber_packet_rate),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_SUBSCRIBER_SESSION_RATE,
+		.name = "subscriber-session-rate",
+		.type = &gt_uint32,
+		.doc = "Set the maximum number of new sessions per second per subscriber (0 = unlimited).",
+		.offset = offsetof(struct jool_globals, nat64.bib.subscriber_session_rate),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_OVERLOAD_THRESHOLD,
+		.name = "overload-threshold",
+		.type = &gt_uint8,
+		.doc = "Set the percentage of CPU time spent translating above which new sessions start being refused (0 = disabled).",
+		.offset = offsetof(struct jool_globals, nat64.bib.overload_threshold),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_overload_threshold,
+#endif
+	}, {
+		.id = JNLAG_CLUSTER_NODES,
+		.name = "cluster-nodes",
+		.type = &gt_uint8,
+		.doc = "Set the number of active translators the pool4 port space is partitioned across (0 = no partitioning).",
+		.offset = offsetof(struct jool_globals, nat64.bib.cluster_nodes),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_cluster_nodes,
+#endif
+	}, {
+		.id = JNLAG_CLUSTER_NODE,
+		.name = "cluster-node",
+		.type = &gt_uint8,
+		.doc = "Set this translator's index within the cluster-nodes (0 to cluster-nodes - 1).",
+		.offset = offsetof(struct jool_globals, nat64.bib.cluster_node),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_cluster_node,
+#endif
+	}, {
+		.id = JNLAG_POOL4_PRESSURE_LOW,
+		.name = "pool4-pressure-low",
+		.type = &gt_uint8,
+		.doc = "Set the pool4 occupancy percentage above which transitory TCP and UDP sessions start timing out sooner (0 = disabled).",
+		.offset = offsetof(struct jool_globals, nat64.bib.pressure_low),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_pool4_pressure,
+#endif
+	}, {
+		.id = JNLAG_POOL4_PRESSURE_HIGH,
+		.name = "pool4-pressure-high",
+		.type = &gt_uint8,
+		.doc = "Set the pool4 occupancy percentage above which transitory TCP and UDP sessions time out soonest.",
+		.offset = offsetof(struct jool_globals, nat64.bib.pressure_high),
+		.xt = XT_NAT64,
+#ifdef __KERNEL__
+		.nl2raw = nl2raw_pool4_pressure,
+#endif
 	}, {
 		.id = JNLAG_JOOLD_ENABLED,
 		.name = "ss-enabled",
@@ -1010,6 +2136,55 @@ static const struct joolnl_global_meta globals_metadata[] = {
 		.doc = "Maximum number of sessions to send, per joold packet.",
 		.offset = offsetof(struct jool_globals, nat64.joold.max_sessions_per_pkt),
 		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_MAX_OUTSTANDING,
+		.name = "ss-max-outstanding",
+		.type = &gt_uint32,
+		.doc = "Maximum number of joold packets awaiting acknowledgement.",
+		.offset = offsetof(struct jool_globals, nat64.joold.max_outstanding),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_SYNC_TCP,
+		.name = "ss-sync-tcp",
+		.type = &gt_bool,
+		.doc = "Synchronize TCP sessions?",
+		.offset = offsetof(struct jool_globals, nat64.joold.sync_tcp),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_SYNC_UDP,
+		.name = "ss-sync-udp",
+		.type = &gt_bool,
+		.doc = "Synchronize UDP sessions?",
+		.offset = offsetof(struct jool_globals, nat64.joold.sync_udp),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_SYNC_ICMP,
+		.name = "ss-sync-icmp",
+		.type = &gt_bool,
+		.doc = "Synchronize ICMP sessions?",
+		.offset = offsetof(struct jool_globals, nat64.joold.sync_icmp),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_MIN_AGE,
+		.name = "ss-min-age",
+		.type = &gt_uint32,
+		.doc = "Age (in milliseconds) a session needs to reach before it's synchronized.",
+		.offset = offsetof(struct jool_globals, nat64.joold.min_age),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_ESTABLISHED_ONLY,
+		.name = "ss-established-only",
+		.type = &gt_bool,
+		.doc = "Only synchronize TCP sessions while they're established?",
+		.offset = offsetof(struct jool_globals, nat64.joold.established_only),
+		.xt = XT_NAT64,
+	}, {
+		.id = JNLAG_JOOLD_FLUSH_WINDOW,
+		.name = "ss-flush-window",
+		.type = &gt_uint32,
+		.doc = "Maximum microseconds queued sessions wait for company before they're sent (0 = disabled).",
+		.offset = offsetof(struct jool_globals, nat64.joold.flush_window),
+		.xt = XT_NAT64,
 	},
 };
 
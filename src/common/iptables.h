@@ -2,14 +2,27 @@
 #define SRC_COMMON_IPTABLES_H_
 
 #include "common/types.h"
+#ifdef __KERNEL__
+	#include <linux/stddef.h>
+#else
+	#include <stddef.h>
+#endif
 
 #define IPTABLES_SIIT_MODULE_NAME "JOOL_SIIT"
 #define IPTABLES_NAT64_MODULE_NAME "JOOL"
 
+struct target_cache;
+
 /* Mind alignment on this structure. */
 struct target_info {
 	char iname[INAME_MAX_SIZE];
 	__u8 type; /* xlator_type */
+
+	/* Kernel-only from here on. (See kernel_hook_iptables.c.) */
+	struct target_cache *cache __attribute__((aligned(8)));
 };
 
+/* Size of the part of struct target_info that belongs to userspace. */
+#define TARGET_INFO_USERSIZE offsetof(struct target_info, cache)
+
 #endif /* SRC_COMMON_IPTABLES_H_ */
@@ -0,0 +1,64 @@
+#ifndef SRC_COMMON_JOOLD_RING_H_
+#define SRC_COMMON_JOOLD_RING_H_
+
+/**
+ * @file
+ * The session ring: the shared memory through which an instance can hand its
+ * session batches to joold, instead of multicasting them through Netlink.
+ *
+ * joold opens JOOLD_RING_PATH, attaches the file to its instance
+ * (JOOLD_RING_ATTACH), and mmap()s a page (struct joold_ring_hdr) plus
+ * JOOLD_RING_DATA_SIZE bytes (the records) out of it. The kernel appends
+ * records and advances @producer; joold consumes them in place, advances
+ * @consumer, and then ACKs them all at once (JOOLD_RING_ACK). poll() reports
+ * the file readable while there are records left.
+ *
+ * Every record is a struct joold_ring_rec, followed by @len bytes of payload
+ * (the datagram joold would multicast), padded to JOOLD_RING_ALIGN. Records
+ * never wrap; if one doesn't fit in the end of the area, the kernel writes a
+ * JOOLD_RING_PAD record there, which means "continue from the beginning."
+ */
+
+#ifdef __KERNEL__
+#include <linux/ioctl.h>
+#else
+#include <sys/ioctl.h>
+#endif
+#include <linux/types.h>
+#include "common/types.h"
+
+#define JOOLD_RING_NAME "jool_joold"
+#define JOOLD_RING_PATH "/dev/" JOOLD_RING_NAME
+
+/* Has to be a power of two. */
+#define JOOLD_RING_DATA_SIZE (1u << 20)
+#define JOOLD_RING_ALIGN 8
+#define JOOLD_RING_PAD 0xFFFFFFFFu
+
+struct joold_ring_hdr {
+	/*
+	 * The offsets are free-running; the position of offset x in the
+	 * record area is (x & (JOOLD_RING_DATA_SIZE - 1)).
+	 */
+
+	/** End of the last complete record. Written by the kernel. */
+	__u32 producer;
+	/** Offset of the record area, from the start of the mapping. */
+	__u32 data_offset;
+	__u32 data_size;
+	__u8 reserved[52];
+	/** End of the last consumed record. Written by joold. */
+	__u32 consumer;
+};
+
+struct joold_ring_rec {
+	__u32 len;
+	__u32 reserved;
+};
+
+/* Argument: the instance name. */
+#define JOOLD_RING_ATTACH _IOW('J', 1, char[INAME_MAX_SIZE])
+/* Argument: the number of records consumed since the last ACK. (__u32) */
+#define JOOLD_RING_ACK _IOW('J', 2, __u32)
+
+#endif /* SRC_COMMON_JOOLD_RING_H_ */
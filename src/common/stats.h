@@ -1,6 +1,8 @@
 #ifndef SRC_COMMON_STATS_H_
 #define SRC_COMMON_STATS_H_
 
+#include <linux/types.h>
+
 /*
  * TODO (fine) Caller review needed.
  * Make sure there's a counter for every worthwhile event,
@@ -20,6 +22,7 @@ enum jool_stat_id {
 	JSTAT_SESSIONS,
 
 	JSTAT_ENOMEM,
+	JSTAT_THREADED_RING_FULL,
 
 	JSTAT_XLATOR_DISABLED,
 	JSTAT_POOL6_UNSET,
@@ -45,6 +48,8 @@ enum jool_stat_id {
 	JSTAT_UNTRANSLATABLE_DST4,
 	JSTAT_6056_F,
 	JSTAT_MASK_DOMAIN_NOT_FOUND,
+	JSTAT_DETERMINISTIC_NO_PORTS,
+	JSTAT_POOL4_CROWDED,
 	JSTAT_BIB6_NOT_FOUND,
 	JSTAT_BIB4_NOT_FOUND,
 	JSTAT_SESSION_NOT_FOUND,
@@ -57,6 +62,12 @@ enum jool_stat_id {
 	JSTAT_TYPE2PKT,
 	JSTAT_SO_EXISTS,
 	JSTAT_SO_FULL,
+	JSTAT_SO_SRC_FULL,
+	JSTAT_SYN_DEFERRED,
+	JSTAT_SUBSCRIBER_QUOTA,
+	JSTAT_SUBSCRIBER_PACKET_RATE,
+	JSTAT_SUBSCRIBER_SESSION_RATE,
+	JSTAT_OVERLOAD_SHED,
 
 	JSTAT64_SRC,
 	JSTAT64_DST,
@@ -110,6 +121,68 @@ enum jool_stat_id {
 	JSTAT_JOOLD_ADS,
 	JSTAT_JOOLD_ACKS,
 
+	JSTAT_NATLOG_RECORDS_SENT,
+	JSTAT_NATLOG_RECORDS_DROPPED,
+	JSTAT_CAPTURE_RECORDS_SENT,
+	JSTAT_CAPTURE_RECORDS_DROPPED,
+	JSTAT_SESSIONS_CREATED,
+	JSTAT_MEM_BIB,
+	JSTAT_MEM_SESSIONS,
+	JSTAT_STORED_PKTS,
+	JSTAT_JOOLD_QUEUED,
+	JSTAT_MEM_JOOLD,
+	JSTAT_EAMT_NODES,
+	JSTAT_MEM_EAMT,
+	JSTAT_POOL4_TABLES,
+	JSTAT_MEM_POOL4,
+
+	JSTAT_EAMT_CACHE_HIT,
+	JSTAT_EAMT_CACHE_MISS,
+
+	JSTAT_FRAG_HELD,
+	JSTAT_FRAG_EXPIRED,
+	JSTAT_FRAG_NOT_UDP,
+
+	JSTAT_ICMP6ERR_RATELIMITED,
+	JSTAT_ICMP4ERR_RATELIMITED,
+
+	JSTAT_RSS_FALLBACK,
+	JSTAT_PORT_PRESERVED,
+	JSTAT_SESSION_EVICTED,
+	JSTAT_SESSION_EVICT_FAILED,
+	JSTAT_JOOLD_SSS_COALESCED,
+	JSTAT_JOOLD_SSS_FILTERED,
+	JSTAT_JOOLD_WINDOW,
+
+	JSTAT_MAP_PORT,
+
+	JSTAT_MSS_CLAMPED,
+
+	JSTAT46_GSO_SEGMENTED,
+	JSTAT46_GSO_SEGMENT,
+
+	JSTAT_LOCK_BIB_ACQUIRED,
+	JSTAT_LOCK_BIB_CONTENDED,
+	JSTAT_LOCK_BIB_SAMPLED,
+	JSTAT_LOCK_BIB_HOLD_NS,
+	JSTAT_LOCK_POOL4_ACQUIRED,
+	JSTAT_LOCK_POOL4_CONTENDED,
+	JSTAT_LOCK_POOL4_SAMPLED,
+	JSTAT_LOCK_POOL4_HOLD_NS,
+	JSTAT_LOCK_JOOLD_ACQUIRED,
+	JSTAT_LOCK_JOOLD_CONTENDED,
+	JSTAT_LOCK_JOOLD_SAMPLED,
+	JSTAT_LOCK_JOOLD_HOLD_NS,
+
+	JSTAT_BYTES6,
+	JSTAT_BYTES4,
+	JSTAT_BIB_CREATED,
+	JSTAT_SESSIONS_EXPIRED,
+	JSTAT_POOL4_PRESSURE_TCP,
+	JSTAT_POOL4_PRESSURE_UDP,
+	JSTAT_POOL4_PRESSURE_RAISED,
+	JSTAT_JOOLD_RING_FULL,
+
 	/* These 3 need to be last, and in this order. */
 	JSTAT_UNKNOWN, /* "WTF was that" errors only. */
 	JSTAT_PADDING,
@@ -117,4 +190,142 @@ enum jool_stat_id {
 #define JSTAT_MAX (JSTAT_COUNT - 1)
 };
 
+/* Size of a JNLAR_STATS_FILTER bitmap, in bytes. */
+#define JSTAT_FILTER_SIZE ((JSTAT_COUNT + 7) / 8)
+
+/*
+ * Translation stages whose latency can be measured. (See core_common().)
+ * NOTE THAT ANY MODIFICATIONS MADE TO THIS STRUCTURE NEED TO BE CASCADED TO
+ * jlat_stage_names.
+ */
+enum jool_latency_stage {
+	JLAT_IN_TUPLE,
+	JLAT_FILTERING,
+	JLAT_OUT_TUPLE,
+	JLAT_INPLACE,
+	JLAT_TRANSLATE,
+	JLAT_SEND,
+	JLAT_STAGE_COUNT,
+};
+
+enum jool_latency_dir {
+	JLAT_6TO4,
+	JLAT_4TO6,
+	JLAT_DIR_COUNT,
+};
+
+/*
+ * Number of log2 buckets per histogram. Bucket i counts the samples that took
+ * [2^i, 2^(i + 1)) nanoseconds, except bucket 0 also counts the zeroes, and the
+ * last one has no upper bound.
+ */
+#define JLAT_BUCKETS 32
+#define JLAT_HISTOGRAM_COUNT (JLAT_DIR_COUNT * JLAT_STAGE_COUNT)
+
+/*
+ * Session durations recorded when the sessions are removed. (See
+ * `jool stats lifetimes`.)
+ * NOTE THAT ANY MODIFICATIONS MADE TO THIS STRUCTURE NEED TO BE CASCADED TO
+ * jlife_metric_names.
+ */
+enum jool_lifetime_metric {
+	/* From the session's creation to its removal */
+	JLIFE_LIFETIME,
+	/* From the session's last packet to its removal */
+	JLIFE_IDLE,
+	/* From the BIB entry's creation to its removal (dynamic ones only) */
+	JLIFE_PORT_HOLD,
+	JLIFE_METRIC_COUNT,
+};
+
+/*
+ * The timeout that applies to the removed session. (Or, for JLIFE_PORT_HOLD,
+ * to the BIB entry's last session.)
+ * NOTE THAT ANY MODIFICATIONS MADE TO THIS STRUCTURE NEED TO BE CASCADED TO
+ * jlife_class_names.
+ */
+enum jool_lifetime_class {
+	JLIFE_UDP,
+	JLIFE_TCP_EST,
+	JLIFE_TCP_TRANS,
+	JLIFE_ICMP,
+	JLIFE_CLASS_COUNT,
+};
+
+/*
+ * Number of log2 buckets per lifetime histogram. Bucket i counts the durations
+ * of [2^i, 2^(i + 1)) milliseconds, except bucket 0 also counts the zeroes,
+ * and the last one has no upper bound.
+ */
+#define JLIFE_BUCKETS 32
+#define JLIFE_HISTOGRAM_COUNT (JLIFE_METRIC_COUNT * JLIFE_CLASS_COUNT)
+
+/*
+ * Rates the kernel estimates out of the counters. (See `jool stats rates`.)
+ * NOTE THAT ANY MODIFICATIONS MADE TO THIS STRUCTURE NEED TO BE CASCADED TO
+ * jrate_sources and jrate_names.
+ */
+enum jool_rate_id {
+	/* Packets received from IPv6, per second */
+	JRATE_RECEIVED6,
+	/* Packets received from IPv4, per second */
+	JRATE_RECEIVED4,
+	/* Packets translated (in either direction), per second */
+	JRATE_TRANSLATED,
+	/* Bytes received from IPv6, per second */
+	JRATE_BYTES6,
+	/* Bytes received from IPv4, per second */
+	JRATE_BYTES4,
+	/* BIB entries created, per second */
+	JRATE_BIB_CREATED,
+	/* Sessions created, per second */
+	JRATE_SESSIONS_CREATED,
+	/* Sessions expired, per second */
+	JRATE_SESSIONS_EXPIRED,
+	/* Sessions sent to the joold peers, per second */
+	JRATE_JOOLD_SENT,
+	/* Sessions received from the joold peers, per second */
+	JRATE_JOOLD_RCVD,
+	JRATE_COUNT,
+};
+
+/* The rates are fixed-point numbers; this many bits are the fraction. */
+#define JRATE_SHIFT 10
+/*
+ * JNLOP_STATS_RATES sends rate i in an attribute of type i + 1. This one's the
+ * 64-bit alignment padding.
+ */
+#define JRATE_PADDING (JRATE_COUNT + 1)
+
+/* What the top talkers are ranked by. (See `jool stats talkers`.) */
+enum jool_talker_metric {
+	/* Sessions created */
+	JTALK_SESSIONS,
+	/* Bytes translated */
+	JTALK_BYTES,
+	JTALK_METRIC_COUNT,
+};
+
+/* Top talkers tracked (and reported) per metric. */
+#define JTALK_MAX 16
+
+/*
+ * Contents of the /proc/net/jool/<siit|nat64>/<instance> files, which can only
+ * be mmapped (read-only). The kernel refreshes them every second or so, while
+ * they're mapped.
+ *
+ * To read a consistent copy, wait until @seq is even, copy the counters, and
+ * then retry if @seq changed.
+ */
+struct jstat_snapshot {
+	/* Odd while the kernel is writing. */
+	__u32 seq;
+	/* JSTAT_COUNT, according to the kernel module. */
+	__u32 count;
+	/* CLOCK_MONOTONIC of the last refresh, in nanoseconds. */
+	__u64 timestamp;
+	/* Indexed by enum jool_stat_id. */
+	__u64 counters[JSTAT_COUNT];
+};
+
 #endif /* SRC_COMMON_STATS_H_ */
@@ -126,6 +126,14 @@ struct mtu_plateaus {
 	__u16 count;
 };
 
+#define PORT_LIST_MAX 16
+
+struct port_list {
+	__u16 values[PORT_LIST_MAX];
+	/** Actual length of the values array. Zero is a valid (empty) list. */
+	__u16 count;
+};
+
 /**
  * A layer-3 (IPv4) identifier attached to a layer-4 identifier.
  * Because they're paired all the time in this project.
@@ -191,6 +199,14 @@ struct ipv6_prefix {
 struct eamt_entry {
 	struct ipv6_prefix prefix6;
 	struct ipv4_prefix prefix4;
+	/**
+	 * MAP-T (RFC 7599) rules only; zero in plain EAMs.
+	 * Length of the Embedded Address bits; the IPv4 suffix, followed by
+	 * the Port Set ID. They live right after @prefix6.
+	 */
+	__u8 ea_len;
+	/** MAP-T rules only. Number of port bits that precede the PSID. */
+	__u8 psid_offset;
 };
 
 struct port_range {
@@ -203,6 +219,52 @@ struct ipv4_range {
 	struct port_range ports;
 };
 
+#define TIMEOUT_CLASSES_MAX 8
+
+/**
+ * Sessions towards @range (in the session's IPv4 destination) get @ttl as
+ * their established timeout, instead of the protocol's global one.
+ */
+struct timeout_class {
+	/** l4_protocol. Ports are ignored in ICMP. */
+	__u8 proto;
+	struct ipv4_range range;
+	/* Milliseconds. */
+	__u32 ttl;
+};
+
+#define POOL6_TENANTS_MAX 8
+
+/** An additional pool6 prefix. (See pool6-tenants.) */
+struct pool6_tenant {
+	struct ipv6_prefix prefix;
+	/** Replace the packet's mark with @mark during pool4 lookups? */
+	bool mark_set;
+	__u32 mark;
+};
+
+struct pool6_tenants {
+	struct pool6_tenant values[POOL6_TENANTS_MAX];
+	__u8 count;
+};
+
+/* IFNAMSIZ; the kernel and libc headers that define it don't mix well. */
+#define IFNAME_MAX_SIZE 16
+
+#define INGRESS_DEVICES_MAX 4
+
+/** Interfaces a Netfilter instance intercepts early. (See ingress-devices.) */
+struct ingress_devices {
+	char names[INGRESS_DEVICES_MAX][IFNAME_MAX_SIZE];
+	__u8 count;
+};
+
+struct timeout_classes {
+	/* Sessions are assigned the first class they match. */
+	struct timeout_class values[TIMEOUT_CLASSES_MAX];
+	__u8 count;
+};
+
 struct pool4_entry {
 	__u32 mark;
 	/**
@@ -228,6 +290,9 @@ struct bib_entry {
 	__u8 l4_proto;
 	/** Created by userspace app client? */
 	bool is_static;
+	/** Traffic of the entry's sessions. (session-counters) */
+	__u64 packets;
+	__u64 bytes;
 };
 
 /* BIB Entry Printk Pattern */
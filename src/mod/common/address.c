@@ -52,18 +52,6 @@ fail:
 	return -EINVAL;
 }
 
-bool taddr6_equals(const struct ipv6_transport_addr *a,
-		const struct ipv6_transport_addr *b)
-{
-	return addr6_equals(&a->l3, &b->l3) && (a->l4 == b->l4);
-}
-
-bool taddr4_equals(const struct ipv4_transport_addr *a,
-		const struct ipv4_transport_addr *b)
-{
-	return addr4_equals(&a->l3, &b->l3) && (a->l4 == b->l4);
-}
-
 bool prefix6_equals(const struct ipv6_prefix *a, const struct ipv6_prefix *b)
 {
 	return addr6_equals(&a->addr, &b->addr) && (a->len == b->len);
@@ -265,26 +253,3 @@ bool prefix4_has_subnet_scope(struct ipv4_prefix *prefix,
 	return false;
 }
 
-int taddr6_compare(const struct ipv6_transport_addr *a1,
-		const struct ipv6_transport_addr *a2)
-{
-	int gap;
-
-	gap = ipv6_addr_cmp(&a1->l3, &a2->l3);
-	if (gap)
-		return gap;
-
-	return ((int)a1->l4) - ((int)a2->l4);
-}
-
-int taddr4_compare(const struct ipv4_transport_addr *a1,
-		const struct ipv4_transport_addr *a2)
-{
-	int gap;
-
-	gap = ipv4_addr_cmp(&a1->l3, &a2->l3);
-	if (gap)
-		return gap;
-
-	return ((int)a1->l4) - ((int)a2->l4);
-}
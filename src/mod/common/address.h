@@ -28,10 +28,23 @@ static inline bool addr6_equals(const struct in6_addr *a,
 	return ipv6_addr_equal(a, b);
 }
 
-bool taddr4_equals(const struct ipv4_transport_addr *a,
-		const struct ipv4_transport_addr *b);
-bool taddr6_equals(const struct ipv6_transport_addr *a,
-		const struct ipv6_transport_addr *b);
+/*
+ * The transport address functions are called on every step of every BIB and
+ * session lookup, so they're inline, and they compare words rather than bytes.
+ */
+
+static inline bool taddr4_equals(const struct ipv4_transport_addr *a,
+		const struct ipv4_transport_addr *b)
+{
+	return addr4_equals(&a->l3, &b->l3) && (a->l4 == b->l4);
+}
+
+static inline bool taddr6_equals(const struct ipv6_transport_addr *a,
+		const struct ipv6_transport_addr *b)
+{
+	return addr6_equals(&a->l3, &b->l3) && (a->l4 == b->l4);
+}
+
 bool prefix6_equals(const struct ipv6_prefix *a, const struct ipv6_prefix *b);
 bool prefix4_equals(const struct ipv4_prefix *a, const struct ipv4_prefix *b);
 
@@ -86,10 +99,48 @@ static inline int ipv4_addr_cmp(const struct in_addr *a1,
 	return memcmp(a1, a2, sizeof(struct in_addr));
 }
 
-int taddr6_compare(const struct ipv6_transport_addr *a1,
-		const struct ipv6_transport_addr *a2);
-int taddr4_compare(const struct ipv4_transport_addr *a1,
-		const struct ipv4_transport_addr *a2);
+/* Half of @addr, as a host order integer. */
+static inline u64 addr6_half(const struct in6_addr *addr, unsigned int half)
+{
+	return ((u64)be32_to_cpu(addr->s6_addr32[2 * half]) << 32)
+			| be32_to_cpu(addr->s6_addr32[2 * half + 1]);
+}
+
+/*
+ * Same order as ipv6_addr_cmp() (ie. memcmp()), then the port.
+ * The addresses are compared as two 64-bit integers.
+ */
+static inline int taddr6_compare(const struct ipv6_transport_addr *a1,
+		const struct ipv6_transport_addr *a2)
+{
+	u64 w1, w2;
+
+	w1 = addr6_half(&a1->l3, 0);
+	w2 = addr6_half(&a2->l3, 0);
+	if (w1 != w2)
+		return (w1 < w2) ? -1 : 1;
+
+	w1 = addr6_half(&a1->l3, 1);
+	w2 = addr6_half(&a2->l3, 1);
+	if (w1 != w2)
+		return (w1 < w2) ? -1 : 1;
+
+	return ((int)a1->l4) - ((int)a2->l4);
+}
+
+/* Same order as ipv4_addr_cmp(), then the port. */
+static inline int taddr4_compare(const struct ipv4_transport_addr *a1,
+		const struct ipv4_transport_addr *a2)
+{
+	u32 w1, w2;
+
+	w1 = be32_to_cpu(a1->l3.s_addr);
+	w2 = be32_to_cpu(a2->l3.s_addr);
+	if (w1 != w2)
+		return (w1 < w2) ? -1 : 1;
+
+	return ((int)a1->l4) - ((int)a2->l4);
+}
 
 bool addr4_is_scope_subnet(const __be32 addr);
 bool prefix4_has_subnet_scope(struct ipv4_prefix *prefix,
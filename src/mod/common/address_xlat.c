@@ -17,10 +17,11 @@ static bool is_illegal_source(struct in6_addr *src)
 			&& (be32_to_cpu(src->s6_addr32[3]) == 1);
 }
 
-static bool must_not_translate(struct in_addr *addr, struct net *ns)
+static bool must_not_translate(struct xlator *instance, struct in_addr *addr)
 {
 	return addr4_is_scope_subnet(addr->s_addr)
-			|| interface_contains(ns, addr);
+			|| interface_contains(instance->siit.denylist4,
+					instance->ns, addr);
 }
 
 static struct addrxlat_result programming_error(void)
@@ -44,13 +45,14 @@ struct addrxlat_result addrxlat_siit64(struct xlator *instance,
 		return result;
 	}
 
-	error = eamt_xlat_6to4(instance->siit.eamt, in, out);
+	error = eamt_xlat_6to4(instance->siit.eamt, in, out,
+			instance->stats);
 	if (!error)
 		goto success;
 	if (unlikely(error != -ESRCH))
 		return programming_error();
 
-	if (!instance->globals.pool6.set || rfc6052_6to4(&instance->globals.pool6.prefix, in, out)) {
+	if (!instance->fast.pool6_set || rfc6052_6to4(&instance->fast.pool6, in, out)) {
 		result.verdict = ADDRXLAT_TRY_SOMETHING_ELSE;
 		result.reason = "Address lacks both pool6 prefix and EAM.";
 		return result;
@@ -65,7 +67,7 @@ struct addrxlat_result addrxlat_siit64(struct xlator *instance,
 	}
 
 success:
-	if (enable_denylists && must_not_translate(&out->addr, instance->ns)) {
+	if (enable_denylists && must_not_translate(instance, &out->addr)) {
 		result.verdict = ADDRXLAT_ACCEPT;
 		result.reason = "Address is subnet-scoped or belongs to a local interface.";
 		return result;
@@ -84,14 +86,15 @@ struct addrxlat_result addrxlat_siit46(struct xlator *instance,
 	struct addrxlat_result result;
 	int error;
 
-	if (enable_denylists && must_not_translate(&tmp, instance->ns)) {
+	if (enable_denylists && must_not_translate(instance, &tmp)) {
 		result.verdict = ADDRXLAT_ACCEPT;
 		result.reason = "Address is subnet-scoped or belongs to a local interface.";
 		return result;
 	}
 
 	if (enable_eam) {
-		error = eamt_xlat_4to6(instance->siit.eamt, &tmp, out);
+		error = eamt_xlat_4to6(instance->siit.eamt, &tmp, out,
+				instance->stats);
 		if (!error)
 			goto success;
 		if (error != -ESRCH)
@@ -104,13 +107,13 @@ struct addrxlat_result addrxlat_siit46(struct xlator *instance,
 		return result;
 	}
 
-	if (!instance->globals.pool6.set) {
+	if (!instance->fast.pool6_set) {
 		result.verdict = ADDRXLAT_TRY_SOMETHING_ELSE;
 		result.reason = "Address lacks EAMT entry and there's no pool6 prefix.";
 		return result;
 	}
 
-	error = rfc6052_4to6(&instance->globals.pool6.prefix, &tmp, out);
+	error = rfc6052_4to6(&instance->fast.pool6, &tmp, out);
 	if (error)
 		return programming_error();
 
@@ -119,3 +122,20 @@ success:
 	result.reason = NULL;
 	return result;
 }
+
+/**
+ * addrxlat_siit46_wants - Would addrxlat_siit46() (with EAM and denylists
+ * enabled) translate @in? Doesn't translate it, so the EAMT cache stats are
+ * left alone.
+ */
+bool addrxlat_siit46_wants(struct xlator *instance, __be32 in)
+{
+	struct in_addr tmp = { .s_addr = in };
+
+	if (must_not_translate(instance, &tmp))
+		return false;
+	if (eamt_contains4(instance->siit.eamt, in))
+		return true;
+	return instance->fast.pool6_set
+			&& !denylist4_contains(instance->siit.denylist4, &tmp);
+}
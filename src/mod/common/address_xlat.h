@@ -38,5 +38,6 @@ struct addrxlat_result addrxlat_siit64(struct xlator *instance,
 struct addrxlat_result addrxlat_siit46(struct xlator *instance,
 		__be32 in, struct result_addrxlat46 *out,
 		bool enable_eam, bool enable_denylists);
+bool addrxlat_siit46_wants(struct xlator *instance, __be32 in);
 
 #endif /* SRC_MOD_COMMON_ADDRESS_XLAT_H_ */
@@ -28,6 +28,42 @@
 struct config_candidate {
 	struct xlator xlator;
 
+	/**
+	 * Diff mode: Instead of starting out empty, @xlator's tables are
+	 * borrowed from the running instance (@running), and only the ones
+	 * that receive changes are copied. The requests carry the additions
+	 * and removals (JNLAL_RM_ENTRY) that turn the running configuration
+	 * into the new one.
+	 */
+	bool diff;
+	struct xlator running;
+	/** Tables @xlator still shares with @running. (See SHARED_*.) */
+	unsigned int shared;
+	/**
+	 * Names of the published tables the candidate wants to use, or publish
+	 * (if they are flagged in @publish). Empty means neither.
+	 */
+	char eamt_share[INAME_MAX_SIZE];
+	char denylist4_share[INAME_MAX_SIZE];
+	/** JNLASH_PUBLISH_* */
+	__u8 publish;
+	/**
+	 * Diff mode BIB changes. The BIB survives replacements, so these are
+	 * applied to @running's BIB once the instance has been replaced.
+	 */
+	struct bib_delta {
+		struct bib_entry *entries;
+		unsigned int count;
+		unsigned int max;
+	} bib_adds, bib_rms;
+
+	/**
+	 * Its JNLAR_ATOMIC_END had JOOLNLHDR_FLAGS_BATCH, so it's been
+	 * validated, and is waiting for the JNLOP_FILE_COMMIT_BATCH. It can't
+	 * be edited anymore.
+	 */
+	bool ready;
+
 	/** Last jiffy the user made an edit. */
 	unsigned long update_time;
 	/** Process ID of the client that is populating this candidate. */
@@ -43,14 +79,29 @@ struct config_candidate {
  */
 #define TIMEOUT msecs_to_jiffies(2000)
 
+#define SHARED_EAMT (1 << 0)
+#define SHARED_DENYLIST4 (1 << 1)
+#define SHARED_POOL4 (1 << 2)
+
 static LIST_HEAD(db);
 static DEFINE_MUTEX(lock);
 
+static void bib_delta_clean(struct bib_delta *delta)
+{
+	if (delta->entries)
+		__wkvfree("Atomic BIB delta", delta->entries);
+}
+
 static void candidate_destroy(struct config_candidate *candidate)
 {
 	LOG_DEBUG("Destroying atomic configuration candidate '%s'.",
 			candidate->xlator.iname);
 	xlator_put(&candidate->xlator);
+	if (candidate->diff) {
+		xlator_put(&candidate->running);
+		bib_delta_clean(&candidate->bib_adds);
+		bib_delta_clean(&candidate->bib_rms);
+	}
 	list_del(&candidate->list_hook);
 	wkfree(struct config_candidate, candidate);
 }
@@ -96,7 +147,12 @@ static void candidate_expire_maybe(struct config_candidate *candidate)
 	 *
 	 * I'd like to clarify I would rather see a better solution, but I
 	 * genuinely feel like making the handle_*() functions atomic is not it.
+	 *
+	 * A batch can take a while to build, but the ready candidates of the
+	 * process that's still talking to us are clearly not abandoned.
 	 */
+	if (candidate->ready && candidate->pid == task_pid_nr(current))
+		return;
 	if (time_after(jiffies, candidate->update_time + TIMEOUT))
 		candidate_destroy(candidate);
 }
@@ -120,7 +176,8 @@ static int get_candidate(char *iname, struct config_candidate **result)
 	list_for_each_entry_safe(candidate, tmp, &db, list_hook) {
 		if ((candidate->xlator.ns == ns)
 				&& (strcmp(candidate->xlator.iname, iname) == 0)
-				&& (candidate->pid == task_pid_nr(current))) {
+				&& (candidate->pid == task_pid_nr(current))
+				&& !candidate->ready) {
 			*result = candidate;
 			put_net(ns);
 			return 0;
@@ -133,8 +190,128 @@ static int get_candidate(char *iname, struct config_candidate **result)
 	return -ESRCH;
 }
 
+/*
+ * Replaces @candidate's (empty) tables with references to the running
+ * instance's.
+ */
+static int borrow_tables(struct config_candidate *candidate)
+{
+	struct xlator *new = &candidate->xlator;
+	struct xlator *old = &candidate->running;
+	int error;
+
+	error = xlator_find_current(new->iname, new->flags, old);
+	if (error == -ESRCH) {
+		log_err("Diff mode needs the instance to exist already.");
+		return error;
+	}
+	if (error)
+		return error;
+
+	if (xlator_is_siit(new)) {
+		eamt_put(new->siit.eamt);
+		eamt_get(old->siit.eamt);
+		new->siit.eamt = old->siit.eamt;
+		denylist4_put(new->siit.denylist4);
+		denylist4_get(old->siit.denylist4);
+		new->siit.denylist4 = old->siit.denylist4;
+		candidate->shared = SHARED_EAMT | SHARED_DENYLIST4;
+	} else {
+		pool4db_put(new->nat64.pool4);
+		pool4db_get(old->nat64.pool4);
+		new->nat64.pool4 = old->nat64.pool4;
+		candidate->shared = SHARED_POOL4;
+	}
+
+	candidate->diff = true;
+	return 0;
+}
+
+/*
+ * The unshare_*() functions replace a borrowed table with a copy, so the
+ * candidate can modify it.
+ */
+
+static int unshare_eamt(struct config_candidate *candidate)
+{
+	struct eam_table *clone;
+	int error;
+
+	if (!(candidate->shared & SHARED_EAMT))
+		return 0;
+
+	error = eamt_clone(candidate->xlator.siit.eamt, &clone);
+	if (error)
+		return error;
+
+	eamt_put(candidate->xlator.siit.eamt);
+	candidate->xlator.siit.eamt = clone;
+	candidate->shared &= ~SHARED_EAMT;
+	return 0;
+}
+
+static int unshare_denylist4(struct config_candidate *candidate)
+{
+	struct addr4_pool *clone;
+	int error;
+
+	if (!(candidate->shared & SHARED_DENYLIST4))
+		return 0;
+
+	error = denylist4_clone(candidate->xlator.siit.denylist4, &clone);
+	if (error)
+		return error;
+
+	denylist4_put(candidate->xlator.siit.denylist4);
+	candidate->xlator.siit.denylist4 = clone;
+	candidate->shared &= ~SHARED_DENYLIST4;
+	return 0;
+}
+
+static int unshare_pool4(struct config_candidate *candidate)
+{
+	struct pool4 *clone;
+	int error;
+
+	if (!(candidate->shared & SHARED_POOL4))
+		return 0;
+
+	error = pool4db_clone(candidate->xlator.nat64.pool4, &clone);
+	if (error)
+		return error;
+
+	pool4db_put(candidate->xlator.nat64.pool4);
+	candidate->xlator.nat64.pool4 = clone;
+	candidate->shared &= ~SHARED_POOL4;
+	return 0;
+}
+
+/*
+ * Returns whether @attr is an entry @candidate should handle. JNLAL_RM_ENTRY
+ * is only legal in diff mode.
+ */
+static int validate_entry_type(struct config_candidate *candidate,
+		struct nlattr *attr, bool *handle)
+{
+	switch (nla_type(attr)) {
+	case JNLAL_ENTRY:
+		*handle = true;
+		return 0;
+	case JNLAL_RM_ENTRY:
+		if (!candidate->diff) {
+			log_err("Entry removals are only allowed in diff mode.");
+			return -EINVAL;
+		}
+		*handle = true;
+		return 0;
+	}
+
+	*handle = false; /* ? */
+	return 0;
+}
+
 static int handle_init(struct config_candidate **out, struct nlattr *attr,
-		char *iname, xlator_type xt)
+		char *iname, xlator_type xt, bool diff)
 {
 	struct config_candidate *candidate;
 	struct net *ns;
@@ -160,6 +337,23 @@ static int handle_init(struct config_candidate **out, struct nlattr *attr,
 		wkfree(struct config_candidate, candidate);
 		goto end;
 	}
+	candidate->diff = false;
+	candidate->ready = false;
+	candidate->shared = 0;
+	candidate->eamt_share[0] = '\0';
+	candidate->denylist4_share[0] = '\0';
+	candidate->publish = 0;
+	memset(&candidate->bib_adds, 0, sizeof(candidate->bib_adds));
+	memset(&candidate->bib_rms, 0, sizeof(candidate->bib_rms));
+	if (diff) {
+		error = borrow_tables(candidate);
+		if (error) {
+			xlator_put(&candidate->xlator);
+			wkfree(struct config_candidate, candidate);
+			goto end;
+		}
+	}
+
 	candidate->update_time = jiffies;
 	candidate->pid = task_pid_nr(current);
 	list_add(&candidate->list_hook, &db);
@@ -184,6 +378,7 @@ static int handle_eamt(struct config_candidate *new, struct nlattr *root,
 {
 	struct nlattr *attr;
 	struct eamt_entry entry;
+	bool handle;
 	int rem;
 	int error;
 
@@ -194,13 +389,31 @@ static int handle_eamt(struct config_candidate *new, struct nlattr *root,
 		return -EINVAL;
 	}
 
+	error = unshare_eamt(new);
+	if (error)
+		return error;
+
 	nla_for_each_nested(attr, root, rem) {
-		if (nla_type(attr) != JNLAL_ENTRY)
-			continue; /* ? */
+		error = validate_entry_type(new, attr, &handle);
+		if (error)
+			return error;
+		if (!handle)
+			continue;
 		error = jnla_get_eam(attr, "EAMT entry", &entry);
 		if (error)
 			return error;
-		error = eamt_add(new->xlator.siit.eamt, &entry, force, false);
+
+		if (nla_type(attr) == JNLAL_RM_ENTRY) {
+			error = eamt_rm(new->xlator.siit.eamt, &entry.prefix6,
+					&entry.prefix4);
+		} else if (new->diff) {
+			/* The copy is not published, so no need to sync. */
+			error = eamt_add(new->xlator.siit.eamt, &entry, force,
+					false);
+		} else {
+			error = eamt_stage(new->xlator.siit.eamt, &entry,
+					force);
+		}
 		if (error)
 			return error;
 	}
@@ -213,6 +426,7 @@ static int handle_denylist4(struct config_candidate *new, struct nlattr *root,
 {
 	struct nlattr *attr;
 	struct ipv4_prefix entry;
+	bool handle;
 	int rem;
 	int error;
 
@@ -223,13 +437,24 @@ static int handle_denylist4(struct config_candidate *new, struct nlattr *root,
 		return -EINVAL;
 	}
 
+	error = unshare_denylist4(new);
+	if (error)
+		return error;
+
 	nla_for_each_nested(attr, root, rem) {
-		if (nla_type(attr) != JNLAL_ENTRY)
-			continue; /* ? */
+		error = validate_entry_type(new, attr, &handle);
+		if (error)
+			return error;
+		if (!handle)
+			continue;
 		error = jnla_get_prefix4(attr, "IPv4 denylist4 entry", &entry);
 		if (error)
 			return error;
-		error = denylist4_add(new->xlator.siit.denylist4, &entry, force);
+		error = (nla_type(attr) == JNLAL_RM_ENTRY)
+				? denylist4_rm(new->xlator.siit.denylist4,
+						&entry)
+				: denylist4_add(new->xlator.siit.denylist4,
+						&entry, force, false);
 		if (error)
 			return error;
 	}
@@ -237,10 +462,60 @@ static int handle_denylist4(struct config_candidate *new, struct nlattr *root,
 	return 0;
 }
 
+static int handle_share(struct config_candidate *new, struct nlattr *root)
+{
+	struct nlattr *attrs[JNLASH_COUNT];
+	int error;
+
+	LOG_DEBUG("Handling atomic share attribute.");
+
+	if (xlator_is_nat64(&new->xlator)) {
+		log_err("Stateful NAT64 doesn't have shareable tables.");
+		return -EINVAL;
+	}
+
+	error = jnla_parse_nested(attrs, JNLASH_MAX, root, joolnl_share_policy,
+			"Share");
+	if (error)
+		return error;
+
+	if (attrs[JNLASH_EAMT]) {
+		error = jnla_get_str(attrs[JNLASH_EAMT], "EAMT name",
+				INAME_MAX_SIZE, new->eamt_share);
+		if (error)
+			return error;
+	}
+	if (attrs[JNLASH_DENYLIST4]) {
+		error = jnla_get_str(attrs[JNLASH_DENYLIST4], "denylist4 name",
+				INAME_MAX_SIZE, new->denylist4_share);
+		if (error)
+			return error;
+	}
+	if (attrs[JNLASH_PUBLISH])
+		new->publish = nla_get_u8(attrs[JNLASH_PUBLISH]);
+
+	if (((new->publish & JNLASH_PUBLISH_EAMT) && !new->eamt_share[0])
+			|| ((new->publish & JNLASH_PUBLISH_DENYLIST4)
+				&& !new->denylist4_share[0])) {
+		log_err("Tables can't be published without a name.");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * The additions are queued in @entries, and added in bulk whenever a removal
+ * interrupts them. (The removals need to see the preceding additions.)
+ */
 static int handle_pool4(struct config_candidate *new, struct nlattr *root)
 {
+	struct pool4 *pool;
 	struct nlattr *attr;
+	struct pool4_entry *entries;
+	unsigned int count;
 	struct pool4_entry entry;
+	bool handle;
 	int rem;
 	int error;
 
@@ -251,13 +526,134 @@ static int handle_pool4(struct config_candidate *new, struct nlattr *root)
 		return -EINVAL;
 	}
 
+	error = unshare_pool4(new);
+	if (error)
+		return error;
+	pool = new->xlator.nat64.pool4;
+
+	count = 0;
+	nla_for_each_nested(attr, root, rem)
+		count++;
+	if (count == 0)
+		return 0;
+
+	entries = __wkvmalloc("Atomic pool4", count * sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	count = 0;
 	nla_for_each_nested(attr, root, rem) {
-		if (nla_type(attr) != JNLAL_ENTRY)
-			continue; /* ? */
+		error = validate_entry_type(new, attr, &handle);
+		if (error)
+			goto end;
+		if (!handle)
+			continue;
 		error = jnla_get_pool4(attr, "pool4 entry", &entry);
+		if (error)
+			goto end;
+
+		if (nla_type(attr) == JNLAL_ENTRY) {
+			entries[count++] = entry;
+			continue;
+		}
+
+		error = pool4db_add_bulk(pool, entries, count);
+		if (error)
+			goto end;
+		count = 0;
+		error = pool4db_rm_usr(pool, &entry);
+		if (error)
+			goto end;
+	}
+
+	error = pool4db_add_bulk(pool, entries, count);
+	/* Fall through. */
+
+end:
+	__wkvfree("Atomic pool4", entries);
+	return error;
+}
+
+/*
+ * Adds @entries to @jool's BIB in bulk. On failure, the first entry that could
+ * not be added is retried the noisy way, for the error message.
+ */
+static int add_bib_entries(struct xlator *jool, struct bib_entry *entries,
+		unsigned int count)
+{
+	unsigned long *failures;
+	unsigned int i;
+	int error;
+
+	failures = __wkmalloc("Atomic BIB failures",
+			BITS_TO_LONGS(count) * sizeof(unsigned long),
+			GFP_KERNEL);
+	if (!failures)
+		return -ENOMEM;
+
+	error = bib_add_static_bulk(jool, entries, count, failures);
+	if (error)
+		goto end;
+
+	i = find_first_bit(failures, count);
+	if (i < count) {
+		error = bib_add_static(jool, &entries[i]);
+		if (!error)
+			error = -EINVAL;
+	}
+	/* Fall through. */
+
+end:
+	__wkfree("Atomic BIB failures", failures);
+	return error;
+}
+
+static int bib_delta_add(struct bib_delta *delta, struct bib_entry *entry)
+{
+	struct bib_entry *entries;
+	unsigned int max;
+
+	if (delta->count == delta->max) {
+		max = delta->max ? (2 * delta->max) : 64;
+		entries = __wkvmalloc("Atomic BIB delta",
+				max * sizeof(*entries));
+		if (!entries)
+			return -ENOMEM;
+		if (delta->entries) {
+			memcpy(entries, delta->entries,
+					delta->count * sizeof(*entries));
+			__wkvfree("Atomic BIB delta", delta->entries);
+		}
+		delta->entries = entries;
+		delta->max = max;
+	}
+
+	delta->entries[delta->count++] = *entry;
+	return 0;
+}
+
+/* Diff mode; the changes are only queued. (See apply_bib_delta().) */
+static int handle_bib_delta(struct config_candidate *new, struct nlattr *root)
+{
+	struct nlattr *attr;
+	struct bib_entry entry;
+	bool handle;
+	int rem;
+	int error;
+
+	nla_for_each_nested(attr, root, rem) {
+		error = validate_entry_type(new, attr, &handle);
 		if (error)
 			return error;
-		error = pool4db_add(new->xlator.nat64.pool4, &entry);
+		if (!handle)
+			continue;
+		error = jnla_get_bib(attr, "BIB entry", &entry);
+		if (error)
+			return error;
+		error = bib_delta_add((nla_type(attr) == JNLAL_RM_ENTRY)
+						? &new->bib_rms
+						: &new->bib_adds,
+				&entry);
 		if (error)
 			return error;
 	}
@@ -268,7 +664,10 @@ static int handle_pool4(struct config_candidate *new, struct nlattr *root)
 static int handle_bib(struct config_candidate *new, struct nlattr *root)
 {
 	struct nlattr *attr;
-	struct bib_entry entry;
+	struct bib_entry *entries;
+	unsigned int count;
+	unsigned int i;
+	bool handle;
 	int rem;
 	int error;
 
@@ -279,13 +678,147 @@ static int handle_bib(struct config_candidate *new, struct nlattr *root)
 		return -EINVAL;
 	}
 
+	if (new->diff)
+		return handle_bib_delta(new, root);
+
+	count = 0;
+	nla_for_each_nested(attr, root, rem) {
+		error = validate_entry_type(new, attr, &handle);
+		if (error)
+			return error;
+		if (handle)
+			count++;
+	}
+	if (!count)
+		return 0;
+
+	entries = __wkvmalloc("Atomic BIB", count * sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	i = 0;
 	nla_for_each_nested(attr, root, rem) {
 		if (nla_type(attr) != JNLAL_ENTRY)
 			continue; /* ? */
-		error = jnla_get_bib(attr, "BIB entry", &entry);
+		error = jnla_get_bib(attr, "BIB entry", &entries[i]);
+		if (error)
+			goto end;
+		i++;
+	}
+
+	error = add_bib_entries(&new->xlator, entries, count);
+	/* Fall through. */
+
+end:
+	__wkvfree("Atomic BIB", entries);
+	return error;
+}
+
+/* The new static BIB entries have to belong to the new pool4. */
+static int validate_bib_delta(struct config_candidate *candidate)
+{
+	struct bib_delta *adds = &candidate->bib_adds;
+	struct bib_entry *entry;
+	unsigned int i;
+
+	for (i = 0; i < adds->count; i++) {
+		entry = &adds->entries[i];
+		if (!pool4db_contains(candidate->xlator.nat64.pool4,
+				candidate->xlator.ns, entry->l4_proto,
+				&entry->addr4)) {
+			log_err("%s BIB transport address '" TA4PP
+					"' does not belong to pool4.\n"
+					"Please add it there first.",
+					l4proto_to_string(entry->l4_proto),
+					TA4PA(entry->addr4));
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int apply_bib_delta(struct config_candidate *candidate)
+{
+	struct bib_delta *rms = &candidate->bib_rms;
+	struct bib_delta *adds = &candidate->bib_adds;
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < rms->count; i++) {
+		error = bib_rm(&candidate->running, &rms->entries[i]);
+		if (error && error != -ESRCH)
+			return error;
+	}
+
+	return adds->count
+			? add_bib_entries(&candidate->running, adds->entries,
+					adds->count)
+			: 0;
+}
+
+/*
+ * Publishing is reserved to the initial namespace, so a tenant can't hijack
+ * the tables the other tenants are going to look up.
+ */
+static int validate_publisher(struct config_candidate *candidate)
+{
+	if (net_eq(candidate->xlator.ns, &init_net))
+		return 0;
+
+	log_err("Tables can only be published from the initial namespace.");
+	return -EPERM;
+}
+
+/* Replaces the tables the candidate wants to use with the published ones. */
+static int attach_published(struct config_candidate *candidate)
+{
+	struct xlator *jool = &candidate->xlator;
+	struct eam_table *eamt;
+	struct addr4_pool *denylist4;
+
+	if (candidate->eamt_share[0]
+			&& !(candidate->publish & JNLASH_PUBLISH_EAMT)) {
+		eamt = eamt_find_published(candidate->eamt_share);
+		if (!eamt) {
+			log_err("There is no published EAMT named '%s'.",
+					candidate->eamt_share);
+			return -ESRCH;
+		}
+		eamt_put(jool->siit.eamt);
+		jool->siit.eamt = eamt;
+	}
+
+	if (candidate->denylist4_share[0]
+			&& !(candidate->publish & JNLASH_PUBLISH_DENYLIST4)) {
+		denylist4 = denylist4_find_published(candidate->denylist4_share);
+		if (!denylist4) {
+			log_err("There is no published denylist4 named '%s'.",
+					candidate->denylist4_share);
+			return -ESRCH;
+		}
+		denylist4_put(jool->siit.denylist4);
+		jool->siit.denylist4 = denylist4;
+	}
+
+	return 0;
+}
+
+/* Publishes the candidate's own tables, as requested. */
+static int publish_own(struct config_candidate *candidate)
+{
+	struct xlator *jool = &candidate->xlator;
+	int error;
+
+	if (candidate->publish & JNLASH_PUBLISH_EAMT) {
+		error = eamt_publish(jool->siit.eamt, candidate->eamt_share);
 		if (error)
 			return error;
-		error = bib_add_static(&new->xlator, &entry);
+	}
+
+	if (candidate->publish & JNLASH_PUBLISH_DENYLIST4) {
+		error = denylist4_publish(jool->siit.denylist4,
+				candidate->denylist4_share);
 		if (error)
 			return error;
 	}
@@ -293,20 +826,96 @@ static int handle_bib(struct config_candidate *new, struct nlattr *root)
 	return 0;
 }
 
+/* The part of the commit that happens before the instance is replaced. */
+static int commit_validate(struct config_candidate *candidate)
+{
+	int error;
+
+	if (xlator_is_siit(&candidate->xlator)) {
+		error = eamt_commit_staged(candidate->xlator.siit.eamt);
+		if (error)
+			return error;
+		if (candidate->publish) {
+			error = validate_publisher(candidate);
+			if (error)
+				return error;
+		}
+		return attach_published(candidate);
+	}
+
+	return candidate->diff ? validate_bib_delta(candidate) : 0;
+}
+
+/*
+ * The part of the commit that happens after the instance is replaced.
+ * Destroys @candidate.
+ */
+static int commit_finish(struct config_candidate *candidate)
+{
+	int error;
+
+	/* After the replacement, so a failed commit doesn't publish anything. */
+	if (xlator_is_siit(&candidate->xlator)) {
+		error = publish_own(candidate);
+		if (error) {
+			log_err("The instance was replaced, but its tables could not be published. Errcode %d",
+					error);
+			goto end;
+		}
+	}
+
+	if (xlator_is_nat64(&candidate->xlator) && candidate->diff) {
+		error = apply_bib_delta(candidate);
+		if (error) {
+			log_err("The instance was replaced, but its BIB could not be updated. Errcode %d",
+					error);
+			goto end;
+		}
+	}
+
+	error = 0;
+	LOG_DEBUG("The atomic configuration transaction was a success.");
+end:
+	candidate_destroy(candidate);
+	return error;
+}
+
+/* Destroys @candidate, whatever happens. */
 static int commit(struct config_candidate *candidate)
 {
 	int error;
 
 	LOG_DEBUG("Handling atomic END attribute.");
 
+	error = commit_validate(candidate);
+	if (error)
+		goto fail;
+
 	error = xlator_replace(&candidate->xlator);
 	if (error) {
 		log_err("xlator_replace() failed. Errcode %d", error);
-		return error;
+		goto fail;
 	}
 
+	return commit_finish(candidate);
+
+fail:
 	candidate_destroy(candidate);
-	LOG_DEBUG("The atomic configuration transaction was a success.");
+	return error;
+}
+
+/* JNLAR_ATOMIC_END, JOOLNLHDR_FLAGS_BATCH version. */
+static int defer_commit(struct config_candidate *candidate)
+{
+	int error;
+
+	LOG_DEBUG("Handling atomic END attribute (batch).");
+
+	error = commit_validate(candidate);
+	if (error)
+		return error;
+
+	candidate->ready = true;
 	return 0;
 }
 
@@ -326,7 +935,7 @@ int atomconfig_add(struct sk_buff *skb, struct genl_info *info)
 	mutex_lock(&lock);
 
 	error = info->attrs[JNLAR_ATOMIC_INIT]
-			? handle_init(&candidate, info->attrs[JNLAR_ATOMIC_INIT], jhdr->iname, jhdr->xt)
+			? handle_init(&candidate, info->attrs[JNLAR_ATOMIC_INIT], jhdr->iname, jhdr->xt, jhdr->flags & JOOLNLHDR_FLAGS_DIFF)
 			: get_candidate(jhdr->iname, &candidate);
 	if (error)
 		goto end;
@@ -346,6 +955,11 @@ int atomconfig_add(struct sk_buff *skb, struct genl_info *info)
 		if (error)
 			goto revert;
 	}
+	if (info->attrs[JNLAR_SHARE]) {
+		error = handle_share(candidate, info->attrs[JNLAR_SHARE]);
+		if (error)
+			goto revert;
+	}
 	if (info->attrs[JNLAR_POOL4_ENTRIES]) {
 		error = handle_pool4(candidate, info->attrs[JNLAR_POOL4_ENTRIES]);
 		if (error)
@@ -357,7 +971,11 @@ int atomconfig_add(struct sk_buff *skb, struct genl_info *info)
 			goto revert;
 	}
 	if (info->attrs[JNLAR_ATOMIC_END]) {
-		error = commit(candidate);
+		if (!(jhdr->flags & JOOLNLHDR_FLAGS_BATCH)) {
+			error = commit(candidate);
+			goto end;
+		}
+		error = defer_commit(candidate);
 		if (error)
 			goto revert;
 	}
@@ -371,3 +989,73 @@ end:
 	mutex_unlock(&lock);
 	return error;
 }
+
+/**
+ * Commits all the ready candidates of the current process, in the order their
+ * JNLAR_ATOMIC_INITs arrived, as a single xlator_replace_batch().
+ */
+int atomconfig_commit_batch(void)
+{
+	struct config_candidate *candidate;
+	struct config_candidate **batch;
+	struct xlator **jools;
+	unsigned int count;
+	unsigned int committed;
+	unsigned int i;
+	pid_t pid;
+	int error;
+	int error2;
+
+	LOG_DEBUG("Handling atomic batch commit.");
+
+	pid = task_pid_nr(current);
+	mutex_lock(&lock);
+
+	count = 0;
+	list_for_each_entry(candidate, &db, list_hook)
+		if (candidate->ready && candidate->pid == pid)
+			count++;
+	if (count == 0) {
+		log_err("There are no instances waiting to be committed.");
+		error = -ESRCH;
+		goto end;
+	}
+
+	/* One array; the candidates, then their xlators. */
+	batch = __wkvmalloc("Atomic batch", count * (sizeof(*batch)
+			+ sizeof(*jools)), GFP_KERNEL);
+	if (!batch) {
+		error = -ENOMEM;
+		goto end;
+	}
+	jools = (struct xlator **)(batch + count);
+
+	/* list_add() stacks them, so the oldest are at the end. */
+	i = 0;
+	list_for_each_entry_reverse(candidate, &db, list_hook) {
+		if (candidate->ready && candidate->pid == pid) {
+			batch[i] = candidate;
+			jools[i] = &candidate->xlator;
+			i++;
+		}
+	}
+
+	error = xlator_replace_batch(jools, count, &committed);
+
+	for (i = 0; i < committed; i++) {
+		error2 = commit_finish(batch[i]);
+		if (!error)
+			error = error2;
+	}
+	/* The failed one, and the ones after it */
+	for (; i < count; i++)
+		candidate_destroy(batch[i]);
+
+	__wkvfree("Atomic batch", batch);
+	LOG_DEBUG("Committed %u out of %u instances.", committed, count);
+	/* Fall through */
+
+end:
+	mutex_unlock(&lock);
+	return error;
+}
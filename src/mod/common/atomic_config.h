@@ -5,5 +5,6 @@
 
 void atomconfig_teardown(void);
 int atomconfig_add(struct sk_buff *skb, struct genl_info *info);
+int atomconfig_commit_batch(void);
 
 #endif /* SRC_MOD_COMMON_ATOMIC_CONFIG_H_ */
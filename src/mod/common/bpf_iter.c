@@ -0,0 +1,295 @@
+#include "mod/common/bpf_iter.h"
+
+#ifdef JOOL_BPF_ITER
+
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <linux/module.h>
+
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/xlator.h"
+#include "mod/common/db/bib/db.h"
+
+/* Entries copied out of the tables per foreach. */
+#define ITER_CHUNK 32
+
+/*
+ * What the BPF programs see. The verifier wants them by these names, and only
+ * lets the programs move them around.
+ */
+struct bpf_iter_jool_bib {
+	__u64 __opaque[1];
+} __aligned(8);
+
+struct bpf_iter_jool_session {
+	__u64 __opaque[1];
+} __aligned(8);
+
+/* The state behind both kinds of iterators. */
+struct jool_iter {
+	/* Holds a reference. */
+	struct xlator jool;
+	l4_protocol proto;
+
+	/* Whether @offset is defined yet. */
+	bool started;
+	/* Whether the table has nothing beyond @chunk. */
+	bool done;
+	/* The last entry copied; the next foreach resumes after it. */
+	union {
+		struct ipv4_transport_addr bib;
+		struct session_foreach_offset session;
+	} offset;
+
+	/* Entries in @chunk, and the next one to yield. */
+	unsigned int count;
+	unsigned int next;
+	union {
+		struct bib_entry bibs[ITER_CHUNK];
+		struct session_entry sessions[ITER_CHUNK];
+	} chunk;
+};
+
+/* What the opaque iterators actually hold. */
+struct bpf_iter_jool_kern {
+	struct jool_iter *iter;
+} __aligned(8);
+
+static int iter_init(struct bpf_iter_jool_kern *kit, char const *iname,
+		u8 proto)
+{
+	struct jool_iter *iter;
+	int error;
+
+	/* _destroy() is called even if _new() fails. */
+	kit->iter = NULL;
+
+	switch (proto) {
+	case L4PROTO_TCP:
+	case L4PROTO_UDP:
+	case L4PROTO_ICMP:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	iter = wkmalloc(struct jool_iter, GFP_KERNEL);
+	if (!iter)
+		return -ENOMEM;
+
+	error = xlator_find_current(iname, XF_ANY | XT_NAT64, &iter->jool);
+	if (error) {
+		wkfree(struct jool_iter, iter);
+		return error;
+	}
+
+	iter->proto = proto;
+	iter->started = false;
+	iter->done = false;
+	iter->count = 0;
+	iter->next = 0;
+
+	kit->iter = iter;
+	return 0;
+}
+
+static void iter_destroy(struct bpf_iter_jool_kern *kit)
+{
+	struct jool_iter *iter = kit->iter;
+
+	if (!iter)
+		return;
+
+	xlator_put(&iter->jool);
+	wkfree(struct jool_iter, iter);
+	kit->iter = NULL;
+}
+
+/*
+ * Returns whether @iter has an entry waiting in its chunk. If it doesn't,
+ * resets the chunk so it can be refilled.
+ */
+static bool iter_ready(struct jool_iter *iter)
+{
+	if (iter->next < iter->count)
+		return true;
+
+	iter->count = 0;
+	iter->next = 0;
+	return false;
+}
+
+/*
+ * Handles the result of a refill. The callbacks return 1 once the chunk is
+ * full, so zero means the foreach reached the end of the table.
+ */
+static bool iter_refilled(struct jool_iter *iter, int error)
+{
+	iter->done = (error <= 0);
+	if (error < 0)
+		iter->count = 0;
+	if (iter->count == 0)
+		return false;
+
+	iter->started = true;
+	return true;
+}
+
+static int copy_bib(struct bib_entry const *entry, void *arg)
+{
+	struct jool_iter *iter = arg;
+
+	if (iter->count >= ITER_CHUNK)
+		return 1; /* Resume from the previous one later. */
+
+	iter->chunk.bibs[iter->count++] = *entry;
+	iter->offset.bib = entry->addr4;
+	return 0;
+}
+
+static int copy_session(struct session_entry const *entry, void *arg)
+{
+	struct jool_iter *iter = arg;
+
+	if (iter->count >= ITER_CHUNK)
+		return 1; /* Resume from the previous one later. */
+
+	iter->chunk.sessions[iter->count++] = *entry;
+	iter->offset.session.offset.src = entry->src4;
+	iter->offset.session.offset.dst = entry->dst4;
+	iter->offset.session.include_offset = false;
+	return 0;
+}
+
+static struct bib_entry *next_bib(struct jool_iter *iter)
+{
+	int error;
+
+	if (!iter)
+		return NULL;
+
+	if (!iter_ready(iter)) {
+		if (iter->done)
+			return NULL;
+		error = bib_foreach(iter->jool.nat64.bib, iter->proto,
+				copy_bib, iter,
+				iter->started ? &iter->offset.bib : NULL);
+		if (!iter_refilled(iter, error))
+			return NULL;
+	}
+
+	return &iter->chunk.bibs[iter->next++];
+}
+
+static struct session_entry *next_session(struct jool_iter *iter)
+{
+	int error;
+
+	if (!iter)
+		return NULL;
+
+	if (!iter_ready(iter)) {
+		if (iter->done)
+			return NULL;
+		error = bib_foreach_session(&iter->jool, iter->proto,
+				copy_session, iter,
+				iter->started ? &iter->offset.session : NULL);
+		if (!iter_refilled(iter, error))
+			return NULL;
+	}
+
+	return &iter->chunk.sessions[iter->next++];
+}
+
+__bpf_kfunc_start_defs();
+
+/**
+ * bpf_iter_jool_bib_new - Starts a walk on the @proto BIB of the current
+ * namespace's @iname NAT64 instance.
+ */
+__bpf_kfunc int bpf_iter_jool_bib_new(struct bpf_iter_jool_bib *it,
+		const char *iname__str, u8 proto)
+{
+	BUILD_BUG_ON(sizeof(struct bpf_iter_jool_kern)
+			!= sizeof(struct bpf_iter_jool_bib));
+	BUILD_BUG_ON(__alignof__(struct bpf_iter_jool_kern)
+			!= __alignof__(struct bpf_iter_jool_bib));
+	return iter_init((struct bpf_iter_jool_kern *)it, iname__str, proto);
+}
+
+/* Returns a copy of the next BIB entry, or NULL once the walk ended. */
+__bpf_kfunc struct bib_entry *bpf_iter_jool_bib_next(
+		struct bpf_iter_jool_bib *it)
+{
+	return next_bib(((struct bpf_iter_jool_kern *)it)->iter);
+}
+
+__bpf_kfunc void bpf_iter_jool_bib_destroy(struct bpf_iter_jool_bib *it)
+{
+	iter_destroy((struct bpf_iter_jool_kern *)it);
+}
+
+/**
+ * bpf_iter_jool_session_new - Starts a walk on the @proto sessions of the
+ * current namespace's @iname NAT64 instance.
+ */
+__bpf_kfunc int bpf_iter_jool_session_new(struct bpf_iter_jool_session *it,
+		const char *iname__str, u8 proto)
+{
+	BUILD_BUG_ON(sizeof(struct bpf_iter_jool_kern)
+			!= sizeof(struct bpf_iter_jool_session));
+	BUILD_BUG_ON(__alignof__(struct bpf_iter_jool_kern)
+			!= __alignof__(struct bpf_iter_jool_session));
+	return iter_init((struct bpf_iter_jool_kern *)it, iname__str, proto);
+}
+
+/* Returns a copy of the next session, or NULL once the walk ended. */
+__bpf_kfunc struct session_entry *bpf_iter_jool_session_next(
+		struct bpf_iter_jool_session *it)
+{
+	return next_session(((struct bpf_iter_jool_kern *)it)->iter);
+}
+
+__bpf_kfunc void bpf_iter_jool_session_destroy(
+		struct bpf_iter_jool_session *it)
+{
+	iter_destroy((struct bpf_iter_jool_kern *)it);
+}
+
+__bpf_kfunc_end_defs();
+
+BTF_KFUNCS_START(jool_iter_kfuncs)
+BTF_ID_FLAGS(func, bpf_iter_jool_bib_new, KF_ITER_NEW | KF_SLEEPABLE)
+BTF_ID_FLAGS(func, bpf_iter_jool_bib_next,
+		KF_ITER_NEXT | KF_RET_NULL | KF_SLEEPABLE)
+BTF_ID_FLAGS(func, bpf_iter_jool_bib_destroy, KF_ITER_DESTROY | KF_SLEEPABLE)
+BTF_ID_FLAGS(func, bpf_iter_jool_session_new, KF_ITER_NEW | KF_SLEEPABLE)
+BTF_ID_FLAGS(func, bpf_iter_jool_session_next,
+		KF_ITER_NEXT | KF_RET_NULL | KF_SLEEPABLE)
+BTF_ID_FLAGS(func, bpf_iter_jool_session_destroy,
+		KF_ITER_DESTROY | KF_SLEEPABLE)
+BTF_KFUNCS_END(jool_iter_kfuncs)
+
+static const struct btf_kfunc_id_set jool_iter_kfunc_set = {
+	.owner = THIS_MODULE,
+	.set = &jool_iter_kfuncs,
+};
+
+/*
+ * The kfuncs die along with the module's BTF, so there's no teardown.
+ * Failure is not fatal; the translator works the same without them.
+ */
+void bpfiter_setup(void)
+{
+	int error;
+
+	error = register_btf_kfunc_id_set(BPF_PROG_TYPE_UNSPEC,
+			&jool_iter_kfunc_set);
+	if (error)
+		log_info("The BPF iterators are unavailable (error %d). Was the module built with BTF?",
+				error);
+}
+
+#endif /* JOOL_BPF_ITER */
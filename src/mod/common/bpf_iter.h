@@ -0,0 +1,41 @@
+#ifndef SRC_MOD_COMMON_BPF_ITER_H_
+#define SRC_MOD_COMMON_BPF_ITER_H_
+
+/**
+ * @file
+ * BPF iterators over the BIB and session tables, for programs that want to
+ * aggregate them in the kernel, and only hand the summary to userspace.
+ *
+ * They are open-coded iterators (kfuncs), because modules cannot register
+ * bpf_iter targets:
+ *
+ *	struct bpf_iter_jool_session it;
+ *	struct session_entry *session;
+ *
+ *	bpf_iter_jool_session_new(&it, "default", L4PROTO_TCP);
+ *	while ((session = bpf_iter_jool_session_next(&it)))
+ *		...
+ *	bpf_iter_jool_session_destroy(&it);
+ *
+ * (Same for bpf_iter_jool_bib, which yields struct bib_entry.)
+ *
+ * The instance is looked up in the current task's namespace. The iterators
+ * walk copies, through the same chunked foreaches the Netlink dumps use, so
+ * the packet path only waits for a chunk's worth of memcpy()s. Because those
+ * can sleep, so can the kfuncs; only sleepable programs (BPF_PROG_TYPE_SYSCALL,
+ * for example) can use them.
+ */
+
+#include "mod/common/linux_version.h"
+
+#if LINUX_VERSION_AT_LEAST(6, 9, 0, 9999, 0) && IS_ENABLED(CONFIG_BPF_SYSCALL)
+#define JOOL_BPF_ITER
+void bpfiter_setup(void);
+#else
+static inline void bpfiter_setup(void)
+{
+	/* No-op. */
+}
+#endif
+
+#endif /* SRC_MOD_COMMON_BPF_ITER_H_ */
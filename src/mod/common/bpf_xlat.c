@@ -0,0 +1,227 @@
+#include "mod/common/bpf_xlat.h"
+
+#ifdef JOOL_BPF_ITER
+
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <linux/filter.h>
+#include <linux/module.h>
+#include <net/sock.h>
+#include <net/xdp.h>
+
+#include "mod/common/address_xlat.h"
+#include "mod/common/log.h"
+#include "mod/common/xlator.h"
+#include "mod/common/db/bib/db.h"
+
+static struct net *xdp_net(struct xdp_md *ctx)
+{
+	return dev_net(((struct xdp_buff *)ctx)->rxq->dev);
+}
+
+static struct net *skb_net(struct __sk_buff *ctx)
+{
+	struct sk_buff *skb = (struct sk_buff *)ctx;
+	return skb->dev ? dev_net(skb->dev) : sock_net(skb->sk);
+}
+
+/*
+ * The translated version of @tuple, according to @session. (@tuple is the
+ * packet's; @session is the one it belongs to.)
+ */
+static void session2tuple(struct tuple *tuple, struct session_entry *session,
+		struct tuple *result)
+{
+	if (tuple->l3_proto == L3PROTO_IPV6) {
+		result->src.addr4 = session->src4;
+		result->dst.addr4 = session->dst4;
+		result->l3_proto = L3PROTO_IPV4;
+	} else {
+		result->src.addr6 = session->dst6;
+		result->dst.addr6 = session->src6;
+		result->l3_proto = L3PROTO_IPV6;
+	}
+	result->l4_proto = tuple->l4_proto;
+}
+
+static int session_lookup(struct net *ns, char const *iname,
+		struct tuple *tuple, struct tuple *result)
+{
+	struct xlator *jool;
+	struct session_entry session;
+	int error;
+
+	if (tuple->l3_proto != L3PROTO_IPV6 && tuple->l3_proto != L3PROTO_IPV4)
+		return -EINVAL;
+
+	rcu_read_lock_bh();
+
+	error = xlator_find_rcu(ns, XF_ANY | XT_NAT64, iname, &jool);
+	if (error)
+		goto end;
+	error = bib_find_session(jool, tuple, &session);
+	if (error)
+		goto end;
+
+	session2tuple(tuple, &session, result);
+end:
+	rcu_read_unlock_bh();
+	return error;
+}
+
+/* -ESRCH means "no translation"; -EPERM means "Jool would not translate." */
+static int addrxlat_error(struct addrxlat_result result)
+{
+	switch (result.verdict) {
+	case ADDRXLAT_CONTINUE:
+		return 0;
+	case ADDRXLAT_TRY_SOMETHING_ELSE:
+		return -ESRCH;
+	case ADDRXLAT_ACCEPT:
+	case ADDRXLAT_DROP:
+		break;
+	}
+
+	return -EPERM;
+}
+
+static int addr_6to4(struct net *ns, char const *iname, struct in6_addr *in,
+		struct in_addr *out)
+{
+	struct xlator *jool;
+	struct result_addrxlat64 result;
+	int error;
+
+	rcu_read_lock_bh();
+
+	error = xlator_find_rcu(ns, XF_ANY | XT_SIIT, iname, &jool);
+	if (error)
+		goto end;
+	error = addrxlat_error(addrxlat_siit64(jool, in, &result, true));
+	if (!error)
+		*out = result.addr;
+end:
+	rcu_read_unlock_bh();
+	return error;
+}
+
+static int addr_4to6(struct net *ns, char const *iname, struct in_addr *in,
+		struct in6_addr *out)
+{
+	struct xlator *jool;
+	struct result_addrxlat46 result;
+	int error;
+
+	rcu_read_lock_bh();
+
+	error = xlator_find_rcu(ns, XF_ANY | XT_SIIT, iname, &jool);
+	if (error)
+		goto end;
+	error = addrxlat_error(addrxlat_siit46(jool, in->s_addr, &result,
+			true, true));
+	if (!error)
+		*out = result.addr;
+end:
+	rcu_read_unlock_bh();
+	return error;
+}
+
+__bpf_kfunc_start_defs();
+
+/**
+ * bpf_xdp_jool_session_lookup - Finds the session of @tuple's packet in
+ * NAT64 instance @iname, and writes the packet's translated tuple in @result.
+ * Returns 0 on success, -ESRCH if there's no session (or instance).
+ */
+__bpf_kfunc int bpf_xdp_jool_session_lookup(struct xdp_md *xdp_ctx,
+		const char *iname__str, struct tuple *tuple,
+		struct tuple *result)
+{
+	return session_lookup(xdp_net(xdp_ctx), iname__str, tuple, result);
+}
+
+/* Same as bpf_xdp_jool_session_lookup(), for TC. */
+__bpf_kfunc int bpf_skb_jool_session_lookup(struct __sk_buff *skb_ctx,
+		const char *iname__str, struct tuple *tuple,
+		struct tuple *result)
+{
+	return session_lookup(skb_net(skb_ctx), iname__str, tuple, result);
+}
+
+/**
+ * bpf_xdp_jool_addr_6to4 - Translates @in through SIIT instance @iname's EAMT
+ * or pool6. Returns 0 on success, -ESRCH if neither applies, and -EPERM if
+ * the address must not be translated. (eg. denylist4.)
+ */
+__bpf_kfunc int bpf_xdp_jool_addr_6to4(struct xdp_md *xdp_ctx,
+		const char *iname__str, struct in6_addr *in,
+		struct in_addr *out)
+{
+	return addr_6to4(xdp_net(xdp_ctx), iname__str, in, out);
+}
+
+/* Same as bpf_xdp_jool_addr_6to4(), for TC. */
+__bpf_kfunc int bpf_skb_jool_addr_6to4(struct __sk_buff *skb_ctx,
+		const char *iname__str, struct in6_addr *in,
+		struct in_addr *out)
+{
+	return addr_6to4(skb_net(skb_ctx), iname__str, in, out);
+}
+
+/* bpf_xdp_jool_addr_6to4(), the other way around. */
+__bpf_kfunc int bpf_xdp_jool_addr_4to6(struct xdp_md *xdp_ctx,
+		const char *iname__str, struct in_addr *in,
+		struct in6_addr *out)
+{
+	return addr_4to6(xdp_net(xdp_ctx), iname__str, in, out);
+}
+
+/* Same as bpf_xdp_jool_addr_4to6(), for TC. */
+__bpf_kfunc int bpf_skb_jool_addr_4to6(struct __sk_buff *skb_ctx,
+		const char *iname__str, struct in_addr *in,
+		struct in6_addr *out)
+{
+	return addr_4to6(skb_net(skb_ctx), iname__str, in, out);
+}
+
+__bpf_kfunc_end_defs();
+
+BTF_KFUNCS_START(jool_xdp_kfuncs)
+BTF_ID_FLAGS(func, bpf_xdp_jool_session_lookup)
+BTF_ID_FLAGS(func, bpf_xdp_jool_addr_6to4)
+BTF_ID_FLAGS(func, bpf_xdp_jool_addr_4to6)
+BTF_KFUNCS_END(jool_xdp_kfuncs)
+
+BTF_KFUNCS_START(jool_tc_kfuncs)
+BTF_ID_FLAGS(func, bpf_skb_jool_session_lookup)
+BTF_ID_FLAGS(func, bpf_skb_jool_addr_6to4)
+BTF_ID_FLAGS(func, bpf_skb_jool_addr_4to6)
+BTF_KFUNCS_END(jool_tc_kfuncs)
+
+static const struct btf_kfunc_id_set jool_xdp_kfunc_set = {
+	.owner = THIS_MODULE,
+	.set = &jool_xdp_kfuncs,
+};
+
+static const struct btf_kfunc_id_set jool_tc_kfunc_set = {
+	.owner = THIS_MODULE,
+	.set = &jool_tc_kfuncs,
+};
+
+/* Same as bpfiter_setup(); no teardown, and failure only logs. */
+void bpfxlat_setup(void)
+{
+	int error;
+
+	error = register_btf_kfunc_id_set(BPF_PROG_TYPE_XDP,
+			&jool_xdp_kfunc_set);
+	if (!error)
+		error = register_btf_kfunc_id_set(BPF_PROG_TYPE_SCHED_CLS,
+				&jool_tc_kfunc_set);
+	if (error)
+		log_info("The XDP/TC kfuncs are unavailable (error %d). Was the module built with BTF?",
+				error);
+}
+
+#endif /* JOOL_BPF_ITER */
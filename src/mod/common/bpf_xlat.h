@@ -0,0 +1,31 @@
+#ifndef SRC_MOD_COMMON_BPF_XLAT_H_
+#define SRC_MOD_COMMON_BPF_XLAT_H_
+
+/**
+ * @file
+ * BPF kfuncs that let XDP and TC programs query Jool's state, so they can
+ * translate the flows Jool already knows before they reach the stack, and
+ * leave the rest to Jool:
+ *
+ * - bpf_{xdp,skb}_jool_session_lookup() finds a NAT64 session, and returns the
+ *   packet's translated tuple.
+ * - bpf_{xdp,skb}_jool_addr_6to4() and bpf_{xdp,skb}_jool_addr_4to6()
+ *   translate an address through a SIIT instance's EAMT and pool6.
+ *
+ * The instances are named by the programs, and looked up in the namespace of
+ * the context's device. Everything is read-only; the sessions are not
+ * refreshed, and the programs see copies.
+ */
+
+#include "mod/common/bpf_iter.h"
+
+#ifdef JOOL_BPF_ITER
+void bpfxlat_setup(void);
+#else
+static inline void bpfxlat_setup(void)
+{
+	/* No-op. */
+}
+#endif
+
+#endif /* SRC_MOD_COMMON_BPF_XLAT_H_ */
@@ -0,0 +1,429 @@
+#include "mod/common/capture.h"
+
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/timekeeping.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+
+#include "common/xlat.h"
+#include "mod/common/log.h"
+#include "mod/common/stats.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/nl/nl_handler.h"
+
+/* Records per CPU. Has to be a power of two. */
+#define RING_SIZE 128
+#define RING_MASK (RING_SIZE - 1)
+/* Records per Netlink message. Keeps them within a couple of pages. */
+#define RECORDS_PER_MSG 16
+
+/** Bit of capture.pending: Is there a drain waiting in capture_wq? */
+#define CPP_DRAIN_SCHEDULED 0
+
+struct capture_slot {
+	struct capture_record hdr;
+	__u8 data[CAPTURE_SNAPLEN_MAX];
+};
+
+/** Same as struct natlog_ring. */
+struct capture_ring {
+	/** Next slot the producer will write. Only the producer writes it. */
+	unsigned int head;
+	/** Next slot the consumer will read. Only the consumer writes it. */
+	unsigned int tail;
+	struct capture_slot slots[RING_SIZE];
+};
+
+struct capture {
+	/**
+	 * NULL until the capture is first enabled. (See capture_prepare().)
+	 * Never changes afterwards.
+	 */
+	struct capture_ring * __percpu *rings;
+	/** Translations each CPU has to skip before it captures another one. */
+	unsigned int __percpu *countdowns;
+	/** Serializes the consumers, and the allocation of @rings. */
+	struct mutex lock;
+	/** CPP; atomic bitops only. */
+	unsigned long pending;
+	struct kref refs;
+};
+
+/* A request to drain the rings, from the packet path. */
+struct capture_drain {
+	/* Copy of the xlator, because the original is usually on the stack. */
+	struct xlator jool;
+	struct work_struct work;
+};
+
+static struct workqueue_struct *capture_wq;
+static DEFINE_MUTEX(wq_lock);
+
+static int capture_setup(void)
+{
+	int error = 0;
+
+	mutex_lock(&wq_lock);
+	if (!capture_wq) {
+		capture_wq = alloc_workqueue("jool_capture", WQ_UNBOUND, 0);
+		if (!capture_wq)
+			error = -ENOMEM;
+	}
+	mutex_unlock(&wq_lock);
+
+	return error;
+}
+
+void capture_teardown(void)
+{
+	if (capture_wq) {
+		/* Waits for (and drops the references of) pending drains. */
+		destroy_workqueue(capture_wq);
+		capture_wq = NULL;
+	}
+}
+
+static void free_rings(struct capture_ring * __percpu *rings)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		__wkvfree("capture ring", *per_cpu_ptr(rings, cpu));
+	free_percpu(rings);
+}
+
+static struct capture_ring * __percpu *alloc_rings(void)
+{
+	struct capture_ring * __percpu *rings;
+	struct capture_ring *ring;
+	unsigned int cpu;
+
+	rings = alloc_percpu(struct capture_ring *);
+	if (!rings)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		ring = __wkvmalloc("capture ring", sizeof(struct capture_ring));
+		if (!ring) {
+			/* alloc_percpu() zeroes; __wkvfree(NULL) is fine. */
+			free_rings(rings);
+			return NULL;
+		}
+		ring->head = 0;
+		ring->tail = 0;
+		*per_cpu_ptr(rings, cpu) = ring;
+	}
+
+	return rings;
+}
+
+struct capture *capture_alloc(void)
+{
+	struct capture *capture;
+
+	BUILD_BUG_ON(sizeof(struct capture_record) != 16);
+
+	capture = wkmalloc(struct capture, GFP_KERNEL);
+	if (!capture)
+		return NULL;
+	capture->countdowns = alloc_percpu(unsigned int);
+	if (!capture->countdowns) {
+		wkfree(struct capture, capture);
+		return NULL;
+	}
+
+	capture->rings = NULL;
+	mutex_init(&capture->lock);
+	capture->pending = 0;
+	kref_init(&capture->refs);
+	return capture;
+}
+
+void capture_get(struct capture *capture)
+{
+	kref_get(&capture->refs);
+}
+
+static void capture_release(struct kref *refs)
+{
+	struct capture *capture;
+
+	capture = container_of(refs, struct capture, refs);
+	if (capture->rings)
+		free_rings(capture->rings);
+	free_percpu(capture->countdowns);
+	wkfree(struct capture, capture);
+}
+
+void capture_put(struct capture *capture)
+{
+	kref_put(&capture->refs, capture_release);
+}
+
+/**
+ * capture_prepare - Allocates @jool's rings, if its globals enable the capture
+ * and they don't exist yet.
+ *
+ * Has to be called before an instance with new globals becomes visible to the
+ * packet path. Can sleep.
+ */
+int capture_prepare(struct xlator *jool)
+{
+	struct capture *capture;
+	struct capture_ring * __percpu *rings;
+	int error;
+
+	if (!jool->globals.capture_sample)
+		return 0;
+
+	error = capture_setup();
+	if (error)
+		return error;
+
+	capture = jool->capture;
+	mutex_lock(&capture->lock);
+	if (!capture->rings) {
+		rings = alloc_rings();
+		if (rings)
+			/* Pairs with capture_pkt()'s acquire. */
+			smp_store_release(&capture->rings, rings);
+		else
+			error = -ENOMEM;
+	}
+	mutex_unlock(&capture->lock);
+
+	return error;
+}
+
+static unsigned int copy_record(struct capture_slot *slot, void *dst)
+{
+	unsigned int len;
+	unsigned int padded;
+
+	len = sizeof(slot->hdr) + slot->hdr.caplen;
+	padded = CAPTURE_RECORD_LEN(slot->hdr.caplen);
+	memcpy(dst, slot, len);
+	memset(dst + len, 0, padded - len);
+
+	return padded;
+}
+
+static void send_records(struct xlator *jool, struct capture_ring *ring,
+		unsigned int first, unsigned int count)
+{
+	struct sk_buff *skb;
+	struct joolnlhdr *jhdr;
+	struct nlattr *attr;
+	struct capture_slot *slot;
+	void *data;
+	unsigned int len;
+	unsigned int i;
+	int error;
+
+	len = 0;
+	for (i = 0; i < count; i++) {
+		slot = &ring->slots[(first + i) & RING_MASK];
+		len += CAPTURE_RECORD_LEN(slot->hdr.caplen);
+	}
+
+	skb = genlmsg_new(sizeof(struct joolnlhdr) + nla_total_size(len),
+			GFP_KERNEL);
+	if (!skb)
+		goto drop;
+
+	jhdr = genlmsg_put(skb, 0, 0, jnl_family(), 0, 0);
+	if (WARN(!jhdr, "genlmsg_put() returned NULL"))
+		goto revert_skb;
+
+	memset(jhdr, 0, sizeof(*jhdr));
+	memcpy(jhdr->magic, JOOLNL_HDR_MAGIC, JOOLNL_HDR_MAGIC_LEN);
+	jhdr->version = cpu_to_be32(xlat_version());
+	jhdr->xt = xlator_get_type(jool);
+	memcpy(jhdr->iname, jool->iname, INAME_MAX_SIZE);
+
+	attr = nla_reserve(skb, JNLAR_CAPTURE_RECORDS, len);
+	if (WARN(!attr, "nla_reserve() returned NULL"))
+		goto revert_skb;
+
+	data = nla_data(attr);
+	for (i = 0; i < count; i++) {
+		slot = &ring->slots[(first + i) & RING_MASK];
+		data += copy_record(slot, data);
+	}
+
+	genlmsg_end(skb, jhdr);
+
+	/* The skb is consumed either way. */
+	error = genlmsg_multicast_netns(jnl_family(), jool->ns, skb, 0,
+			JNL_MCGRP_CAPTURE, GFP_KERNEL);
+	if (error) {
+		/* -ESRCH means nobody is listening; not worth a warning. */
+		if (error != -ESRCH)
+			log_warn_once("Could not multicast the packet capture (errcode %d).",
+					error);
+		goto drop;
+	}
+
+	jstat_add(jool->stats, JSTAT_CAPTURE_RECORDS_SENT, count);
+	return;
+
+revert_skb:
+	kfree_skb(skb);
+drop:
+	jstat_add(jool->stats, JSTAT_CAPTURE_RECORDS_DROPPED, count);
+}
+
+static void drain_ring(struct xlator *jool, struct capture_ring *ring)
+{
+	unsigned int head;
+	unsigned int tail;
+	unsigned int count;
+
+	tail = ring->tail;
+	/* Pairs with the producer's release; the records are visible. */
+	head = smp_load_acquire(&ring->head);
+
+	while (tail != head) {
+		count = min(head - tail, (unsigned int)RECORDS_PER_MSG);
+		send_records(jool, ring, tail, count);
+		tail += count;
+		/* Hands the slots back, now that they've been copied. */
+		smp_store_release(&ring->tail, tail);
+	}
+}
+
+static void drain_work_fn(struct work_struct *work)
+{
+	struct capture_drain *drain;
+	struct capture *capture;
+	unsigned int cpu;
+
+	drain = container_of(work, struct capture_drain, work);
+	capture = drain->jool.capture;
+
+	/*
+	 * Clear first; records queued from now on, which the drain might
+	 * miss, can schedule another one.
+	 */
+	clear_bit(CPP_DRAIN_SCHEDULED, &capture->pending);
+	smp_mb__after_atomic();
+
+	/* Somebody queued a record, so the rings exist. */
+	mutex_lock(&capture->lock);
+	for_each_possible_cpu(cpu)
+		drain_ring(&drain->jool, *per_cpu_ptr(capture->rings, cpu));
+	mutex_unlock(&capture->lock);
+
+	put_net(drain->jool.ns);
+	xlator_put(&drain->jool);
+	wkfree(struct capture_drain, drain);
+}
+
+/*
+ * Hands the drain over to capture_wq, unless it already has one pending.
+ *
+ * Unlike the NAT log, there's no timer to fall back to (SIIT doesn't have
+ * one), so every record asks.
+ */
+static void request_drain(struct xlator *jool)
+{
+	struct capture *capture;
+	struct capture_drain *drain;
+
+	capture = jool->capture;
+	if (test_and_set_bit(CPP_DRAIN_SCHEDULED, &capture->pending))
+		return;
+
+	drain = wkmalloc(struct capture_drain, GFP_ATOMIC);
+	if (!drain)
+		goto fail;
+	/* The namespace might be dying; see the note in struct xlator. */
+	if (!maybe_get_net(jool->ns)) {
+		wkfree(struct capture_drain, drain);
+		goto fail;
+	}
+
+	memcpy(&drain->jool, jool, sizeof(*jool));
+	xlator_get(&drain->jool);
+	INIT_WORK(&drain->work, drain_work_fn);
+	queue_work(capture_wq, &drain->work);
+	return;
+
+fail:
+	/* The next record will try again. */
+	clear_bit(CPP_DRAIN_SCHEDULED, &capture->pending);
+}
+
+/**
+ * __capture_sample - Returns true once every @rate calls (per CPU).
+ *
+ * Call capture_sample() instead. Packet path only.
+ */
+bool __capture_sample(struct capture *capture, __u32 rate)
+{
+	unsigned int left;
+
+	left = this_cpu_read(*capture->countdowns);
+	if (left) {
+		this_cpu_write(*capture->countdowns, left - 1);
+		return false;
+	}
+
+	this_cpu_write(*capture->countdowns, rate - 1);
+	return true;
+}
+
+/**
+ * capture_pkt - Queues the first capture-snaplen bytes of @skb (starting at the
+ * network header) for the capture multicast group.
+ *
+ * Only meant for packets capture_sample() approved.
+ */
+void capture_pkt(struct xlator *jool, struct sk_buff *skb,
+		enum capture_direction direction)
+{
+	struct capture_ring * __percpu *rings;
+	struct capture_ring *ring;
+	struct capture_slot *slot;
+	unsigned int offset;
+	unsigned int len;
+	unsigned int caplen;
+	unsigned int head;
+
+	/* Pairs with capture_prepare()'s release. */
+	rings = smp_load_acquire(&jool->capture->rings);
+	if (!rings)
+		return;
+
+	offset = skb_network_offset(skb);
+	len = skb->len - offset;
+	caplen = min_t(unsigned int, len, jool->fast.capture_snaplen);
+
+	local_bh_disable();
+	ring = *this_cpu_ptr(rings);
+	head = ring->head;
+	if (head - smp_load_acquire(&ring->tail) >= RING_SIZE)
+		goto drop;
+
+	slot = &ring->slots[head & RING_MASK];
+	if (skb_copy_bits(skb, offset, slot->data, caplen))
+		goto drop;
+	slot->hdr.timestamp = ktime_get_real_ns();
+	slot->hdr.len = len;
+	slot->hdr.caplen = caplen;
+	slot->hdr.direction = direction;
+	slot->hdr.reserved = 0;
+
+	/* Publishes the record. */
+	smp_store_release(&ring->head, head + 1);
+	local_bh_enable();
+
+	request_drain(jool);
+	return;
+
+drop:
+	local_bh_enable();
+	jstat_inc(jool->stats, JSTAT_CAPTURE_RECORDS_DROPPED);
+}
@@ -0,0 +1,46 @@
+#ifndef SRC_MOD_COMMON_CAPTURE_H_
+#define SRC_MOD_COMMON_CAPTURE_H_
+
+/**
+ * @file
+ * Sampled packet capture. (capture-sample, capture-snaplen)
+ *
+ * One in every capture-sample translations is captured twice: the packet as
+ * it arrived, and its translation, right before it's sent. The first
+ * capture-snaplen bytes of both (starting at the network header) are copied to
+ * the CPU's ring, and a worker later drains the rings into Netlink messages,
+ * which are multicasted to the JOOLNL_CAPTURE_GRP_NAME group. (`jool capture`
+ * turns them into a pcap-ng stream.)
+ *
+ * Same as the NAT log, a full ring drops the new records; nobody is made to
+ * wait. The rings are only allocated the first time the capture is enabled, so
+ * instances that never capture only pay for the capture-sample check.
+ */
+
+#include <linux/skbuff.h>
+#include "common/config.h"
+#include "mod/common/xlator.h"
+
+struct capture;
+
+/* capture_setup() not needed. */
+void capture_teardown(void);
+
+struct capture *capture_alloc(void);
+void capture_get(struct capture *capture);
+void capture_put(struct capture *capture);
+
+int capture_prepare(struct xlator *jool);
+
+bool __capture_sample(struct capture *capture, __u32 rate);
+void capture_pkt(struct xlator *jool, struct sk_buff *skb,
+		enum capture_direction direction);
+
+/* Should the current translation be captured? */
+static inline bool capture_sample(struct xlator *jool)
+{
+	__u32 rate = jool->fast.capture_sample;
+	return unlikely(rate) && __capture_sample(jool->capture, rate);
+}
+
+#endif /* SRC_MOD_COMMON_CAPTURE_H_ */
@@ -1,23 +1,39 @@
 #include "mod/common/core.h"
 
+#include <linux/netdevice.h>
 #include "common/config.h"
+#include "mod/common/capture.h"
+#include "mod/common/drop_reason.h"
+#include "mod/common/icmp_ratelimit.h"
+#include "mod/common/linux_version.h"
 #include "mod/common/log.h"
+#include "mod/common/natlog.h"
+#include "mod/common/overload.h"
+#include "mod/common/stats.h"
 #include "mod/common/trace.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/xlator.h"
+#include "mod/common/db/fragdb.h"
+#include "mod/common/rfc7915/4to6.h"
 #include "mod/common/rfc7915/core.h"
+#include "mod/common/rfc7915/inplace.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
 #include "mod/common/steps/determine_incoming_tuple.h"
 #include "mod/common/steps/filtering_and_updating.h"
+#include "mod/common/steps/handling_hairpinning.h"
 #include "mod/common/steps/send_packet.h"
 
+#if LINUX_VERSION_AT_LEAST(6, 5, 0, 9999, 0)
+#include <net/gso.h>
+#endif
+
 static verdict validate_xlator(struct xlation *state)
 {
-	struct jool_globals *cfg = &state->jool.globals;
+	struct xlator_fast const *cfg = &state->jool->fast;
 
 	if (!cfg->enabled)
 		return untranslatable(state, JSTAT_XLATOR_DISABLED);
-	if (xlation_is_nat64(state) && !cfg->pool6.set) {
+	if (xlation_is_nat64(state) && !cfg->pool6_set) {
 		log_warn_once("Cannot translate; pool6 is unset.");
 		return untranslatable(state, JSTAT_POOL6_UNSET);
 	}
@@ -25,37 +41,104 @@ static verdict validate_xlator(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
+/* Wraps @call in latency stat and latency sample bookkeeping. */
+#define TIMED(stage, call) ({						\
+	u64 __start = jlat_start();					\
+	verdict __result = call;					\
+	jlat_stop(state->jool->stats, dir, stage, __start);		\
+	natlog_latency_stamp(state, stage);				\
+	__result;							\
+})
+
+static verdict __core_6to4(struct sk_buff *skb, struct xlation *state);
+static verdict __core_4to6(struct sk_buff *skb, struct xlation *state);
+static verdict translate_segments(struct xlation *state);
+
+/*
+ * Translates the fragments that arrived before @state's packet, which was
+ * their first fragment. (See fragdb.h.)
+ */
+static void translate_held(struct xlation *state)
+{
+	struct xlation *held;
+	struct sk_buff *skb;
+	verdict result;
+
+	while ((skb = fragdb_pop(state)) != NULL) {
+		held = xlation_create(state->jool);
+		if (!held) {
+			jool_kfree_skb(skb, JSTAT_ENOMEM);
+			continue;
+		}
+
+		result = (pkt_l3_proto(&state->in) == L3PROTO_IPV6)
+				? __core_6to4(skb, held)
+				: __core_4to6(skb, held);
+		/* The hook already returned; nobody else can free it. */
+		if (result != VERDICT_STOLEN)
+			jool_kfree_skb(skb, held->latency.stat);
+
+		xlation_destroy(held);
+	}
+}
+
 static verdict core_common(struct xlation *state)
 {
+	enum jool_latency_dir dir;
 	verdict result;
 
+	dir = (pkt_l3_proto(&state->in) == L3PROTO_IPV6)
+			? JLAT_6TO4
+			: JLAT_4TO6;
+
+	state->captured = capture_sample(state->jool);
+	if (unlikely(state->captured))
+		capture_pkt(state->jool, state->in.skb, CAPTURE_IN);
+
 	if (xlation_is_nat64(state)) {
-		result = determine_in_tuple(state);
+		result = TIMED(JLAT_IN_TUPLE, determine_in_tuple(state));
+		if (result != VERDICT_CONTINUE)
+			return result;
+		result = TIMED(JLAT_FILTERING, filtering_and_updating(state));
 		if (result != VERDICT_CONTINUE)
 			return result;
-		result = filtering_and_updating(state);
+		result = TIMED(JLAT_OUT_TUPLE, compute_out_tuple(state));
 		if (result != VERDICT_CONTINUE)
 			return result;
-		result = compute_out_tuple(state);
+		fragdb_add(state);
+	}
+
+	if (pkt_l3_proto(&state->in) == L3PROTO_IPV4) {
+		if (ttp46_must_segment(state, &result))
+			return translate_segments(state);
 		if (result != VERDICT_CONTINUE)
 			return result;
 	}
-	result = translating_the_packet(state);
+
+	result = TIMED(JLAT_INPLACE, translate_inplace(state));
+	if (result != VERDICT_CONTINUE)
+		return result;
+	result = TIMED(JLAT_TRANSLATE, translating_the_packet(state));
 	if (result != VERDICT_CONTINUE)
 		return result;
 
-	if (state->jool.is_hairpin(state)) {
+	if (unlikely(state->captured))
+		capture_pkt(state->jool, state->out.skb, CAPTURE_OUT);
+
+	if (is_hairpin(state)) {
 		skb_dst_drop(state->out.skb);
-		result = state->jool.handling_hairpinning(state);
+		result = handling_hairpinning(state);
 		kfree_skb(state->out.skb); /* Put this inside of hh()? */
 	} else {
-		result = sendpkt_send(state);
+		result = TIMED(JLAT_SEND, sendpkt_send(state));
 		/* sendpkt_send() releases out's skb regardless of verdict. */
 	}
 	if (result != VERDICT_CONTINUE)
 		return result;
 
 	log_debug(state, "Success.");
+	if (xlation_is_nat64(state))
+		translate_held(state);
 	/*
 	 * The new packet was sent, so the original one can die; drop it.
 	 *
@@ -68,6 +151,45 @@ static verdict core_common(struct xlation *state)
 	return stolen(state, JSTAT_SUCCESS);
 }
 
+/*
+ * Translates @state's packet one segment at a time. (See ttp46_must_segment().)
+ *
+ * Same as the held fragments, the segments are ours; the hook only knows about
+ * the original packet. So they're consumed regardless of verdict.
+ */
+static verdict translate_segments(struct xlation *state)
+{
+	struct sk_buff *segs;
+	struct sk_buff *skb;
+	struct xlation *seg;
+	verdict result;
+
+	segs = skb_gso_segment(state->in.skb, 0);
+	if (IS_ERR_OR_NULL(segs))
+		return drop(state, JSTAT46_GSO_SEGMENT);
+
+	while (segs) {
+		skb = segs;
+		segs = skb->next;
+		skb->next = NULL;
+
+		seg = xlation_create(state->jool);
+		if (!seg) {
+			jool_kfree_skb(skb, JSTAT_ENOMEM);
+			continue;
+		}
+
+		result = __core_4to6(skb, seg);
+		if (result != VERDICT_STOLEN)
+			jool_kfree_skb(skb, seg->latency.stat);
+
+		xlation_destroy(seg);
+	}
+
+	consume_skb(state->in.skb);
+	return stolen(state, JSTAT46_GSO_SEGMENTED);
+}
+
 static void send_icmp4_error(struct xlation *state, verdict result)
 {
 	bool success;
@@ -76,20 +198,22 @@ static void send_icmp4_error(struct xlation *state, verdict result)
 		return;
 	if (result == VERDICT_UNTRANSLATABLE)
 		return; /* Linux will decide what to do. */
+	if (!icmp_ratelimit_allow4(state->jool, ip_hdr(state->in.skb)->saddr)) {
+		xlation_count(state, JSTAT_ICMP4ERR_RATELIMITED);
+		return;
+	}
 
-	success = icmp64_send4(&state->jool, state->in.skb,
+	success = icmp64_send4(state->jool, state->in.skb,
 			state->result.icmp, state->result.info);
-	jstat_inc(state->jool.stats, success
+	xlation_count(state, success
 			? JSTAT_ICMP4ERR_SUCCESS
 			: JSTAT_ICMP4ERR_FAILURE);
 }
 
-verdict core_4to6(struct sk_buff *skb, struct xlation *state)
+static verdict __core_4to6(struct sk_buff *skb, struct xlation *state)
 {
 	verdict result;
 
-	jstat_inc(state->jool.stats, JSTAT_RECEIVED4);
-
 	/*
 	 * PLEASE REFRAIN FROM READING HEADERS FROM @skb UNTIL
 	 * pkt_init_ipv4() HAS pskb_may_pull()ED THEM.
@@ -106,7 +230,7 @@ verdict core_4to6(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	if (state->jool.globals.debug)
+	if (state_debug(state))
 		pkt_trace4(state);
 
 	result = core_common(state);
@@ -117,6 +241,21 @@ end:
 	return result;
 }
 
+verdict core_4to6(struct sk_buff *skb, struct xlation *state)
+{
+	u64 start;
+	verdict result;
+
+	xlation_tally_begin(state, JSTAT_RECEIVED4, JSTAT_BYTES4, skb->len);
+	start = overload_start(state->jool);
+	natlog_latency_begin(state);
+	result = __core_4to6(skb, state);
+	natlog_latency_end(state, result);
+	overload_stop(start);
+	xlation_tally_flush(state);
+	return result;
+}
+
 static void send_icmp6_error(struct xlation *state, verdict result)
 {
 	bool success;
@@ -125,20 +264,22 @@ static void send_icmp6_error(struct xlation *state, verdict result)
 		return;
 	if (result == VERDICT_UNTRANSLATABLE)
 		return; /* Linux will decide what to do. */
+	if (!icmp_ratelimit_allow6(state->jool, &ipv6_hdr(state->in.skb)->saddr)) {
+		xlation_count(state, JSTAT_ICMP6ERR_RATELIMITED);
+		return;
+	}
 
-	success = icmp64_send6(&state->jool, state->in.skb,
+	success = icmp64_send6(state->jool, state->in.skb,
 			state->result.icmp, state->result.info);
-	jstat_inc(state->jool.stats, success
+	xlation_count(state, success
 			? JSTAT_ICMP6ERR_SUCCESS
 			: JSTAT_ICMP6ERR_FAILURE);
 }
 
-verdict core_6to4(struct sk_buff *skb, struct xlation *state)
+static verdict __core_6to4(struct sk_buff *skb, struct xlation *state)
 {
 	verdict result;
 
-	jstat_inc(state->jool.stats, JSTAT_RECEIVED6);
-
 	/*
 	 * PLEASE REFRAIN FROM READING HEADERS FROM @skb UNTIL
 	 * pkt_init_ipv6() HAS pskb_may_pull()ED THEM.
@@ -155,7 +296,7 @@ verdict core_6to4(struct sk_buff *skb, struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	if (state->jool.globals.debug)
+	if (state_debug(state))
 		pkt_trace6(state);
 
 	result = core_common(state);
@@ -165,3 +306,18 @@ end:
 	send_icmp6_error(state, result);
 	return result;
 }
+
+verdict core_6to4(struct sk_buff *skb, struct xlation *state)
+{
+	u64 start;
+	verdict result;
+
+	xlation_tally_begin(state, JSTAT_RECEIVED6, JSTAT_BYTES6, skb->len);
+	start = overload_start(state->jool);
+	natlog_latency_begin(state);
+	result = __core_6to4(skb, state);
+	natlog_latency_end(state, result);
+	overload_stop(start);
+	xlation_tally_flush(state);
+	return result;
+}
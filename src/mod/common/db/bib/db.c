@@ -1,22 +1,99 @@
 #include "mod/common/db/bib/db.h"
 
 #include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/netdevice.h>
+#include <linux/percpu_counter.h>
+#include <linux/prefetch.h>
+#include <linux/random.h>
+#include <linux/sort.h>
+#include <linux/workqueue.h>
+#include <net/ip.h>
 #include <net/ip6_checksum.h>
+#include <net/ipv6.h>
+#include <net/net_namespace.h>
+#ifdef BIB_HASH_INDEX
+#include <linux/jhash.h>
+#include <linux/rhashtable.h>
+#endif
 
 #include "common/constants.h"
 #include "mod/common/icmp_wrapper.h"
+#include "mod/common/lockstat.h"
 #include "mod/common/log.h"
+#include "mod/common/natlog.h"
+#include "mod/common/overload.h"
+#include "mod/common/reserve.h"
+#include "mod/common/rfc6052.h"
+#include "mod/common/tracepoints.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/db/rbtree.h"
+#include "mod/common/db/talkers.h"
 #include "mod/common/db/bib/pkt_queue.h"
 
 #define XGLOBALS(xlator) (xlator->globals.nat64.bib)
-#define GLOBALS(state) (state->jool.globals.nat64.bib)
+#define GLOBALS(state) (state->jool->globals.nat64.bib)
 
 /*
- * TODO (performance) Maybe pack this?
+ * Sharded mode.
+ *
+ * Each protocol table can be split into BIB_SHARDS independently locked
+ * partitions ("shards"). A BIB entry, along with all of its sessions, always
+ * lives in the shard selected by its ports:
+ *
+ * 	shard = src6.l4 % BIB_SHARDS = src4.l4 % BIB_SHARDS
+ *
+ * The 6-to-4 direction can compute this from src6, and the 4-to-6 direction
+ * can compute it from src4, so neither direction ever needs to look at (let
+ * alone lock) some other shard.
+ *
+ * The price is that dynamic masks preserve the port residue (to the extent of
+ * the shard count), and static BIB entries and joold sessions need to honor it
+ * as well.
+ *
+ * Shards are ordered by index, and then by src4 within each shard; that's the
+ * order in which the foreaches yield the entries.
+ *
+ * Build with BIB_SHARD_BITS defined (eg. `make BIB_SHARD_BITS=4`) to enable.
+ * Zero (the default) yields the traditional single-table database.
+ */
+#ifndef BIB_SHARD_BITS
+#define BIB_SHARD_BITS 0
+#endif
+#define BIB_SHARDS (1u << BIB_SHARD_BITS)
+#define BIB_SHARD_MASK (BIB_SHARDS - 1u)
+
+/* Whatever tabled_bib's flags leave of their word. */
+#define BIB_GEN_BITS 28
+#define BIB_GEN_MASK ((1u << BIB_GEN_BITS) - 1u)
+
+/*
+ * Hash index.
+ *
+ * Define BIB_HASH_INDEX at compile time (`make BIB_HASH_INDEX=1`) to index
+ * BIB entries (by src6 and src4) and sessions (by BIB entry and dst4) in
+ * resizable hash tables, on top of the trees.
+ *
+ * The hash tables only speed up exact lookups of existing entries. The trees
+ * are still needed for everything that depends on order: mask allocation
+ * (see try_next()), Address-Dependent Filtering (see find_session_slot()),
+ * the foreaches and range removals. Therefore, the trees remain the source of
+ * truth: Hash table insertions are best-effort, and a miss is always confirmed
+ * by a tree lookup.
+ */
+
+/*
+ * The layout of these two structures is meant to keep the fields that the tree
+ * walks and the expirers touch at the beginning of the object, hopefully
+ * within its first cache line. The slab caches align the objects to cache
+ * lines (see bib_setup()).
  */
 struct tabled_bib {
+	struct rb_node hook6;
+	struct rb_node hook4;
+
 	/**
 	 * src6 always belongs to the IPv6 node. dst4 always belongs to the IPv4
 	 * node.
@@ -34,30 +111,39 @@ struct tabled_bib {
 	 */
 	struct ipv6_transport_addr src6;
 	struct ipv4_transport_addr src4;
-	l4_protocol proto;
-	bool is_static;
-
-	struct rb_node hook6;
-	struct rb_node hook4;
+	/** l4_protocol. */
+	unsigned int proto:2;
+	unsigned int is_static:1;
+	/** Is the entry one of its IPv6 address's port blocks' tenants? */
+	unsigned int in_block:1;
+	/** bib->generation at insertion time. (See struct bib_reap.) */
+	unsigned int generation:BIB_GEN_BITS;
 
 	struct rb_root sessions;
-};
-
-/*
- * TODO (performance) Maybe pack this?
- */
-struct tabled_session {
+	/** Quota counters this entry is charged to. NULL if untracked. */
+	struct subscriber *subscriber;
 	/**
-	 * We don't strictly need to store @dst6; @dst6 is always @dst4 plus the
-	 * pool6 prefix. But we store it anyway so I don't have to make more
-	 * mess constatly in this module.
+	 * Traffic of the sessions this entry already lost. (session-counters)
+	 * The live ones are added when the entry is dumped.
 	 */
-	struct ipv6_transport_addr dst6;
-	struct ipv4_transport_addr dst4;
-	tcp_state state;
-	/** MUST NOT be NULL. */
-	struct tabled_bib *bib;
+	u64 packets;
+	u64 bytes;
+	/** Jiffy the entry was allocated. (For JLIFE_PORT_HOLD.) */
+	unsigned long create_time;
+#ifdef BIB_HASH_INDEX
+	struct rhash_head hash6;
+	struct rhash_head hash4;
+#endif
+
+	/*
+	 * Entries are freed after a grace period, because of the lockless
+	 * lookups.
+	 * Before that, the head doubles as the bib_delete_list hook.
+	 */
+	struct rcu_head rcu;
+};
 
+struct tabled_session {
 	/**
 	 * Sessions only need one tree. The rationale is different for TCP/UDP
 	 * vs ICMP sessions:
@@ -66,6 +152,9 @@ struct tabled_session {
 	 * pool6 prefix. Therefore, and assuming the pool6 prefix stays still
 	 * (something I'm well willing to enforce), sessions indexed by dst4
 	 * yield exactly the same tree as sessions indexed by dst6.
+	 * (Sessions of the same BIB entry headed to the same dst4 through
+	 * different pool6-tenants are the same session. This is fine; the IPv4
+	 * side can't tell them apart either.)
 	 *
 	 * In ICMP, dst4.l4 is the same as src4.l4 instead of dst6.l4. This
 	 * would normally mean that dst6 sessions would yield a different tree
@@ -85,13 +174,70 @@ struct tabled_session {
 	 */
 	struct rb_node tree_hook;
 
+	/** Last time the session was refreshed while the table was locked. */
 	unsigned long update_time;
+	/**
+	 * Last time the session was refreshed by the lockless path.
+	 * (See refresh_session6().)
+	 */
+	unsigned long refresh_time;
+	/**
+	 * Packets and bytes translated through the session. (session-counters)
+	 * Written locklessly, once per packet; they share the first cache line
+	 * with the tree hook, which every lookup reads anyway.
+	 */
+	u64 packets;
+	u64 bytes;
+	/** Jiffy the session was added to the database. */
+	unsigned long create_time;
 	/** MUST NOT be NULL. */
 	struct expire_timer *expirer;
-	struct list_head list_hook;
+	/**
+	 * Hook to the table's expiration wheel.
+	 * The wheel slot is not updated when the session is refreshed; the
+	 * cleaner reschedules the session when it finds it was refreshed.
+	 */
+	struct hlist_node wheel_hook;
+
+	/** MUST NOT be NULL. */
+	struct tabled_bib *bib;
+	struct ipv4_transport_addr dst4;
+	/**
+	 * dst6.l4. dst6.l3 is not stored; it is always dst4.l3 plus the
+	 * @pool6_index prefix. (See get_dst6().)
+	 *
+	 * In TCP and UDP this is also just dst4.l4, but ICMP sessions created
+	 * from IPv6 packets need the IPv6 identifier.
+	 */
+	__u16 dst6_l4;
+	/**
+	 * tcp_state. Not a bitfield because the lockless path needs READ_ONCE()
+	 * on it.
+	 */
+	__u8 state;
+	/**
+	 * timeout_class_find() of the session, resolved when the session is
+	 * added. Only affects the established timer.
+	 */
+	__u8 timeout_class:4;
+	/**
+	 * xlator_pool6() index of dst6's prefix. Never changes.
+	 * (Both are bitfields so they fit in the hole after @state.)
+	 */
+	__u8 pool6_index:4;
+	/**
+	 * session_entry.csum. The addresses never change, so it's computed
+	 * once, when the session is added.
+	 */
+	__wsum csum;
 
 	/** See pke_queue.h for some thoughts on stored packets. */
 	struct sk_buff *stored;
+
+#ifdef BIB_HASH_INDEX
+	struct rhash_head hash_hook;
+#endif
+	struct rcu_head rcu;
 };
 
 struct bib_session_tuple {
@@ -116,9 +262,67 @@ struct probing_session {
 };
 
 struct expire_timer {
-	struct list_head sessions;
+	l4_protocol proto;
 	session_timer_type type;
 	fate_cb decide_fate_cb;
+	/** The timeout is divided by 2^@shift. (See apply_pressure().) */
+	unsigned int shift;
+};
+
+/*
+ * Session expiration wheel.
+ *
+ * Every table schedules its sessions in a hierarchical timing wheel, so adding,
+ * moving and expiring a session are all O(1) regardless of its timeout.
+ *
+ * It's the same non-cascading design as the kernel's timer wheel: Level n has
+ * WHEEL_LVL_SIZE slots, each WHEEL_LVL_GRAN(n) jiffies wide. Sessions are
+ * queued in the lowest level that can hold their expiration date, rounded up
+ * to the level's granularity. This means sessions can die up to ~12% of their
+ * timeout late, but never early.
+ *
+ * The unit of level 0 is roughly half a second, which is plenty; the cleaner
+ * only runs every couple of seconds anyway.
+ *
+ * Sessions whose timeouts exceed the wheel's range are queued in its last slot,
+ * and rescheduled when the slot expires.
+ */
+#define WHEEL_TICK_SHIFT	ilog2(HZ)
+#define WHEEL_TICK		(1UL << WHEEL_TICK_SHIFT)
+#define WHEEL_LVL_CLK_SHIFT	3
+#define WHEEL_LVL_CLK_MASK	((1UL << WHEEL_LVL_CLK_SHIFT) - 1)
+#define WHEEL_LVL_BITS		6
+#define WHEEL_LVL_SIZE		(1UL << WHEEL_LVL_BITS)
+#define WHEEL_LVL_MASK		(WHEEL_LVL_SIZE - 1)
+#define WHEEL_LEVELS		5
+#define WHEEL_SIZE		(WHEEL_LEVELS * WHEEL_LVL_SIZE)
+#define WHEEL_LVL_SHIFT(n)	(WHEEL_TICK_SHIFT + (n) * WHEEL_LVL_CLK_SHIFT)
+#define WHEEL_LVL_GRAN(n)	(1UL << WHEEL_LVL_SHIFT(n))
+/* Smallest delta (in jiffies) that needs level @n. */
+#define WHEEL_LVL_START(n)	((WHEEL_LVL_SIZE - 1) << WHEEL_LVL_SHIFT((n) - 1))
+#define WHEEL_MAX_DELTA \
+	(WHEEL_LVL_START(WHEEL_LEVELS) - WHEEL_LVL_GRAN(WHEEL_LEVELS - 1))
+
+struct session_wheel {
+	/**
+	 * The next tick the cleaner needs to process, in jiffies.
+	 * Always a multiple of WHEEL_TICK.
+	 */
+	unsigned long clk;
+	/**
+	 * Next level the cleaner needs to collect from the tick that precedes
+	 * @clk. WHEEL_LEVELS means that tick is done.
+	 * (The cleaner can run out of budget; see session-expiry-budget.)
+	 */
+	unsigned int lvl;
+	/** Sessions collected from due slots, which haven't been visited yet. */
+	struct hlist_head expired;
+	/**
+	 * Slots the cleaner still has to revisit early, because the timeouts
+	 * shrank. (See sweep_slot().)
+	 */
+	unsigned int sweep;
+	struct hlist_head slots[WHEEL_SIZE];
 };
 
 struct bib_table {
@@ -126,8 +330,33 @@ struct bib_table {
 	struct rb_root tree6;
 	/** Indexes the entries using their IPv4 identifiers. */
 	struct rb_root tree4;
-
-	spinlock_t lock;
+#ifdef BIB_HASH_INDEX
+	/** Hashes the entries using their IPv6 identifiers. */
+	struct rhashtable hash6;
+	/** Hashes the entries using their IPv4 identifiers. */
+	struct rhashtable hash4;
+	/** Hashes the sessions using their BIB entries and dst4. */
+	struct rhashtable session_hash;
+#endif
+	/** Occupied ports, per IPv4 address. (See struct port_map.) */
+	struct rb_root port_maps;
+	/** The src4s this table might contain. (See struct bib4_filter.) */
+	struct bib4_filter *filter;
+	/** Number of BIB entries (static ones included) in this table. */
+	unsigned int bib_count;
+	/** pool4 pressure level the timers currently honor. */
+	unsigned int pressure;
+	/** Indexes the port blocks by owner, then by range. */
+	struct rb_root blocks6;
+	/** Indexes the port blocks by range. */
+	struct rb_root blocks4;
+	/** Port blocks that don't have any entries yet. (See reap_blocks().) */
+	struct list_head empty_blocks;
+
+	struct jlock lock;
+
+	/** Schedules the expiration of all of this table's sessions. */
+	struct session_wheel wheel;
 
 	/** Expires this table's established sessions. */
 	struct expire_timer est_timer;
@@ -142,8 +371,8 @@ struct bib_table {
 
 	/**
 	 * Expires this table's transitory sessions.
-	 * This is initialized in the UDP/ICMP tables, but all their operations
-	 * become no-ops.
+	 * In the UDP table, these are the udp-fast-ports sessions that have
+	 * already seen their response. It's unused in the ICMP table.
 	 */
 	struct expire_timer trans_timer;
 	/**
@@ -161,359 +390,2210 @@ struct bib_table {
 	 * This is NULL in UDP/ICMP.
 	 */
 	struct pktqueue *pkt_queue;
+	/**
+	 * V6 SYNs translated while syn-flood-threshold was exceeded.
+	 * This is NULL in UDP/ICMP.
+	 */
+	struct syn_cache *syn_cache;
+} ____cacheline_aligned_in_smp; /* Shards should not share cache lines. */
+
+/*
+ * SYN flood protection.
+ *
+ * While a TCP table sees more than syn-flood-threshold (split among the
+ * shards) V6 SYNs per second that need a new BIB entry, further ones are
+ * translated without one: The mask is chosen as usual, but only remembered
+ * in the table's SYN cache, which is small and fixed-size. The BIB entry and
+ * session are created when the V4 side answers with a SYN (normally, the
+ * SYN-ACK); that's the V6_INIT to ESTABLISHED transition anyway.
+ *
+ * So the half-open connections of a flood cost no memory and hold no pool4
+ * ports. (Port blocks already bound the ports a flooder can take, so they
+ * don't get deferred.) The price is that deferred masks are not reserved; if some other
+ * connection takes the port in the meantime, or the slot is overwritten (it's
+ * direct-mapped), the V4 SYN will be handled as if it were unsolicited, and the
+ * client will have to retry.
+ */
+
+/* Slots per TCP table. Has to be a power of two. */
+#define SYN_CACHE_SIZE 256
+
+struct syn_cache_entry {
+	bool used;
+	unsigned long time;
+	struct ipv6_transport_addr src6;
+	struct ipv4_transport_addr src4;
+	struct ipv4_transport_addr dst4;
+};
+
+struct syn_cache {
+	/** Start of the current rate measuring window. (jiffies) */
+	unsigned long window;
+	/** Connections started during the current window. */
+	unsigned int count;
+	/** Keeps the remote nodes from picking the slots. */
+	u32 seed;
+	struct syn_cache_entry entries[SYN_CACHE_SIZE];
+};
+
+/*
+ * Subscriber quotas.
+ *
+ * subscriber-max-ports and subscriber-max-sessions limit the BIB entries and
+ * sessions a single subscriber (ie. IPv6 prefix of length
+ * subscriber-prefix-length) can have at a time, so one of them cannot take all
+ * of pool4.
+ *
+ * The counters live in an instance-wide hash, and tracked BIB entries point to
+ * theirs, so checking a quota is never more than one lookup, and it happens
+ * before the pool4 search.
+ *
+ * Only BIB entries (and their sessions) created while a quota is enabled are
+ * counted. Static entries never are, and neither is anything joold adds. Since
+ * the shards are locked independently, the check and the charge are not
+ * atomic; concurrent adds can overshoot a quota by (at most) the number of
+ * CPUs.
+ *
+ * subscriber-packet-rate and subscriber-session-rate police the same
+ * subscribers with token buckets, so one of them cannot flood the translator
+ * either. Each bucket holds (at most) one second's worth of tokens. Only the
+ * IPv6 side is policed: a subscriber cannot be made to pay for the traffic the
+ * Internet sends it. Same as the quotas, a subscriber is only known from its
+ * first tracked BIB entry on, so its first packet is never policed.
+ */
+
+#define SUBSCRIBER_HASH_BITS 10
+#define SUBSCRIBER_HASH_SIZE (1u << SUBSCRIBER_HASH_BITS)
+
+/* Tokens are stored in 1/HZ units, so a jiffy refills exactly rate units. */
+struct token_bucket {
+	spinlock_t lock;
+	u64 units;
+	unsigned long last;
+};
+
+struct subscriber {
+	struct in6_addr prefix;
+	/** Tracked BIB entries. They are the references to this object. */
+	atomic_t bibs;
+	/** The tracked BIB entries' sessions. */
+	atomic_t sessions;
+	/** subscriber-packet-rate. */
+	struct token_bucket packets;
+	/** subscriber-session-rate. */
+	struct token_bucket new_sessions;
+	struct hlist_node hook;
+	struct rcu_head rcu;
+};
+
+struct subscriber_table {
+	/** Protects the lists. (Lookups are RCU.) */
+	spinlock_t lock;
+	u32 seed;
+	struct hlist_head buckets[SUBSCRIBER_HASH_SIZE];
 };
 
 struct bib {
-	/** The session table for UDP conversations. */
-	struct bib_table udp;
-	/** The session table for TCP connections. */
-	struct bib_table tcp;
-	/** The session table for ICMP conversations. */
-	struct bib_table icmp;
+	/** The session table shards for UDP conversations. */
+	struct bib_table udp[BIB_SHARDS];
+	/** The session table shards for TCP connections. */
+	struct bib_table tcp[BIB_SHARDS];
+	/** The session table shards for ICMP conversations. */
+	struct bib_table icmp[BIB_SHARDS];
+
+	/** Table the next bib_clean() should start from. */
+	unsigned int clean_cursor;
+	/** Latest pool4 pressure levels, indexed by l4_protocol. */
+	unsigned int pressure[L4PROTO_OTHER];
+
+	struct subscriber_table *subscribers;
+
+	/** Sessions in all the tables. (See make_room().) */
+	struct percpu_counter sessions;
+
+	/** Ongoing asynchronous removals. (struct bib_reap; RCU-protected.) */
+	struct list_head reaps;
+	/** Protects @reaps and @generation. */
+	spinlock_t reap_lock;
+	/** Stamped on the entries as they are added. (See struct bib_reap.) */
+	unsigned int generation;
 
 	struct kref refs;
+	/* Frees the tables once @refs is gone. (See bib_release().) */
+	struct work_struct release_work;
+	/* Entries this release still owes to release_backlog. */
+	s64 release_left;
 };
 
 static struct kmem_cache *bib_cache;
 static struct kmem_cache *session_cache;
+/* The packet path allocates from these first. (See reserve.h.) */
+static struct obj_reserve *bib_reserve;
+static struct obj_reserve *session_reserve;
+/*
+ * Frees the released BIBs. Millions of entries take seconds, and bib_release()
+ * can't sleep anyway. (Neither can rhashtable_destroy().)
+ */
+static struct workqueue_struct *release_wq;
+/* Entries freed per bib_release_work() reschedule */
+#define RELEASE_CHUNK 1024
+/* BIB entries and sessions of the released BIBs that are still allocated */
+static atomic64_t release_backlog = ATOMIC64_INIT(0);
+
+static int get_release_backlog(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%lld\n",
+			(long long)atomic64_read(&release_backlog));
+}
+
+static const struct kernel_param_ops release_backlog_ops = {
+	.get = get_release_backlog,
+};
+
+module_param_cb(bib_release_backlog, &release_backlog_ops, NULL, 0444);
+MODULE_PARM_DESC(bib_release_backlog, "BIB entries and sessions of removed instances that are still being freed in the background. (Read-only.)");
+
+/**
+ * Probes and ICMP errors the cleaner wants sent.
+ * They are handed to xmit_wq, so a mass expiration doesn't keep the cleaner
+ * (and the other instances it handles) busy.
+ */
+struct deferred_xmit {
+	/* Holds references to the instance's databases and namespace. */
+	struct xlator jool;
+	/* "struct probing_session"s. */
+	struct list_head probes;
+	/* "struct pktqueue_session"s. */
+	struct list_head icmps;
+	struct work_struct work;
+};
+
+/* Also runs the bib_reaps. */
+static struct workqueue_struct *xmit_wq;
+
+/**
+ * A removal of every BIB entry that belongs to an IPv4 range (or to the whole
+ * database), which runs in the background.
+ *
+ * Removing a busy pool4 range used to detach every affected entry in a single
+ * critical section, locking the packet path out of the table for as long as it
+ * took. The reaper instead detaches at most REAP_CHUNK entries per lock hold,
+ * and yields between chunks. Meanwhile, the packet path treats the entries the
+ * reap still has to get to as nonexistent. (See bib_doomed().)
+ *
+ * The entries that were added after the reap started must survive it, even if
+ * they collide with its range. (The user might have already added the range
+ * back to pool4, for example.) So every entry is stamped with the database's
+ * generation counter at insertion time, and every reap bumps the counter when
+ * it starts. Only the entries older than the reap are doomed.
+ */
+struct bib_reap {
+	/** Every entry of every protocol? (Otherwise @proto and @range.) */
+	bool all;
+	l4_protocol proto;
+	struct ipv4_range range;
+	/** If set, the entries also need to belong to @src6. (Not @all.) */
+	bool src6_set;
+	struct ipv6_prefix src6;
+	/** Entries stamped with an earlier generation are doomed. */
+	unsigned int generation;
+	/** Entries removed so far. */
+	unsigned long removed;
+
+	/* Holds references to the instance's databases and namespace. */
+	struct xlator jool;
+	/* struct bib.reaps hook */
+	struct list_head hook;
+	struct work_struct work;
+	struct rcu_head rcu;
+};
+
+/* Entries the reaper visits per table lock hold. */
+#define REAP_CHUNK 32
 
-#define alloc_bib(flags) wkmem_cache_alloc("bib entry", bib_cache, flags)
-#define alloc_session(flags) wkmem_cache_alloc("session", session_cache, flags)
+/* The kernel's default RSS key. (See rss_matches().) */
+static __u8 rss_key[NETDEV_RSS_KEY_LEN];
+
+/*
+ * Entries are allocated in the packet path, from the reserve of the CPU that's
+ * translating the flow (which is stocked from that CPU's node). That's as local
+ * as they can get; shards are selected by port, so any CPU might need any shard
+ * afterwards.
+ */
 #define free_bib(bib) wkmem_cache_free("bib entry", bib_cache, bib)
 #define free_session(session) wkmem_cache_free("session", session_cache, session)
 
-static struct tabled_bib *bib6_entry(const struct rb_node *node)
+static struct tabled_session *alloc_session(void)
 {
-	return node ? rb_entry(node, struct tabled_bib, hook6) : NULL;
+	struct tabled_session *session;
+
+	session = reserve_alloc(session_reserve);
+	if (session) {
+		session->packets = 0;
+		session->bytes = 0;
+	}
+
+	return session;
 }
 
-static struct tabled_bib *bib4_entry(const struct rb_node *node)
+static struct tabled_bib *alloc_bib(void)
 {
-	return node ? rb_entry(node, struct tabled_bib, hook4) : NULL;
+	struct tabled_bib *bib;
+
+	bib = reserve_alloc(bib_reserve);
+	if (bib) {
+		bib->subscriber = NULL;
+		bib->packets = 0;
+		bib->bytes = 0;
+		bib->create_time = jiffies;
+	}
+
+	return bib;
 }
 
-static struct tabled_session *node2session(const struct rb_node *node)
+/* Keeps JSTAT_BIB_ENTRIES and the BIB's memory accounting in sync. */
+static void count_bibs(struct xlator *jool, int delta)
 {
-	return node ? rb_entry(node, struct tabled_session, tree_hook) : NULL;
+	jstat_add(jool->stats, JSTAT_BIB_ENTRIES, delta);
+	jstat_add(jool->stats, JSTAT_MEM_BIB,
+			delta * (int)kmem_cache_size(bib_cache));
+	if (delta > 0)
+		jstat_add(jool->stats, JSTAT_BIB_CREATED, delta);
 }
 
-/**
- * "[Convert] tabled BIB to BIB entry"
- */
-static void tbtobe(struct tabled_bib *tabled, struct bib_entry *bib)
+/* Keeps JSTAT_SESSIONS, the session cap counter and the accounting in sync. */
+static void count_sessions(struct xlator *jool, int delta)
 {
-	if (!bib)
-		return;
-
-	bib->addr6 = tabled->src6;
-	bib->addr4 = tabled->src4;
-	bib->l4_proto = tabled->proto;
-	bib->is_static = tabled->is_static;
+	jstat_add(jool->stats, JSTAT_SESSIONS, delta);
+	jstat_add(jool->stats, JSTAT_MEM_SESSIONS,
+			delta * (int)kmem_cache_size(session_cache));
+	if (delta > 0)
+		jstat_add(jool->stats, JSTAT_SESSIONS_CREATED, delta);
+	percpu_counter_add(&jool->nat64.bib->sessions, delta);
 }
 
-static unsigned long get_timeout(struct xlator *jool,
-		struct expire_timer *expirer)
+static void bib_rcu_cb(struct rcu_head *rcu)
 {
-	struct bib *db = jool->nat64.bib;
-	__u32 msecs;
-
-	if (&db->tcp.est_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.tcp_est;
-	else if (&db->tcp.trans_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.tcp_trans;
-	else if (&db->udp.est_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.udp;
-	else if (&db->tcp.syn4_timer == expirer)
-		msecs = 1000 * TCP_INCOMING_SYN;
-	else if (&db->icmp.est_timer == expirer)
-		msecs = XGLOBALS(jool).ttl.icmp;
-	else {
-		/*
-		 * This is known to happen whenever the timer is cleaning.
-		 * It's not cause for concern.
-		 */
-		msecs = 0;
-	}
+	free_bib(container_of(rcu, struct tabled_bib, rcu));
+}
 
-	return msecs_to_jiffies(msecs);
+static void session_rcu_cb(struct rcu_head *rcu)
+{
+	free_session(container_of(rcu, struct tabled_session, rcu));
 }
 
-/**
- * "[Convert] tabled session to session entry"
+/*
+ * Use these instead of free_bib() and free_session() once the entry has been
+ * visible to lockless readers.
  */
-static void tstose(struct xlator *jool,
-		struct tabled_session *ts,
-		struct session_entry *se)
+#define free_bib_rcu(bib) call_rcu(&(bib)->rcu, bib_rcu_cb)
+#define free_session_rcu(session) call_rcu(&(session)->rcu, session_rcu_cb)
+
+static struct subscriber_table *subscriber_table_alloc(void)
 {
-	se->src6 = ts->bib->src6;
-	se->dst6 = ts->dst6;
-	se->src4 = ts->bib->src4;
-	se->dst4 = ts->dst4;
-	se->proto = ts->bib->proto;
-	se->state = ts->state;
-	se->timer_type = ts->expirer->type;
-	se->update_time = ts->update_time;
-	se->timeout = get_timeout(jool, ts->expirer);
-	se->has_stored = !!ts->stored;
+	struct subscriber_table *table;
+	unsigned int i;
+
+	table = wkmalloc(struct subscriber_table, GFP_KERNEL);
+	if (!table)
+		return NULL;
+
+	spin_lock_init(&table->lock);
+	get_random_bytes(&table->seed, sizeof(table->seed));
+	for (i = 0; i < SUBSCRIBER_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&table->buckets[i]);
+
+	return table;
 }
 
-/**
- * "[Convert] tabled BIB to bib_session"
- */
-static void tbtobs(struct tabled_bib *tabled, struct bib_session *bs)
+/* Only once the database is dead; the entries are not unlinked. */
+static void subscriber_table_free(struct subscriber_table *table)
 {
-	if (!bs)
-		return;
+	struct subscriber *sub;
+	struct hlist_node *tmp;
+	unsigned int i;
+
+	for (i = 0; i < SUBSCRIBER_HASH_SIZE; i++)
+		hlist_for_each_entry_safe(sub, tmp, &table->buckets[i], hook)
+			wkfree(struct subscriber, sub);
+	wkfree(struct subscriber_table, table);
+}
 
-	bs->bib_set = true;
-	bs->session.src6 = tabled->src6;
-	bs->session.src4 = tabled->src4;
-	bs->session.proto = tabled->proto;
+static void subscriber_rcu_cb(struct rcu_head *rcu)
+{
+	wkfree(struct subscriber, container_of(rcu, struct subscriber, rcu));
 }
 
-/**
- * [Convert] tabled session to bib_session"
- */
-static void tstobs(struct xlation *state, struct tabled_session *ts)
+static struct hlist_head *subscriber_bucket(struct subscriber_table *table,
+		struct in6_addr const *prefix)
 {
-	state->entries.bib_set = true;
-	state->entries.session_set = true;
-	tstose(&state->jool, ts, &state->entries.session);
+	return &table->buckets[jhash2(prefix->s6_addr32, 4, table->seed)
+			& (SUBSCRIBER_HASH_SIZE - 1)];
 }
 
-/**
- * One-liner to get the session table corresponding to the @proto protocol.
+/*
+ * Also returns @src6's subscriber prefix, in @prefix.
+ * Call inside an RCU read-side critical section.
  */
-static struct bib_table *get_table(struct bib *db, l4_protocol proto)
+static struct subscriber *subscriber_find(struct xlator *jool,
+		struct in6_addr const *src6, struct in6_addr *prefix)
 {
-	switch (proto) {
-	case L4PROTO_TCP:
-		return &db->tcp;
-	case L4PROTO_UDP:
-		return &db->udp;
-	case L4PROTO_ICMP:
-		return &db->icmp;
-	case L4PROTO_OTHER:
-		break;
-	}
+	struct subscriber_table *table = jool->nat64.bib->subscribers;
+	struct subscriber *sub;
+
+	ipv6_addr_prefix(prefix, src6, XGLOBALS(jool).subscriber_prefix_len);
+	hlist_for_each_entry_rcu(sub, subscriber_bucket(table, prefix), hook)
+		if (ipv6_addr_equal(&sub->prefix, prefix))
+			return sub;
 
-	WARN(true, "Unsupported transport protocol: %u.", proto);
 	return NULL;
 }
 
-static void kill_stored_pkt(struct xlator *jool, struct bib_table *table,
-		struct tabled_session *session)
+static void bucket_init(struct token_bucket *bucket, u64 units)
 {
-	if (!session->stored)
-		return;
-
-	__log_debug(jool, "Deleting stored type 2 packet.");
-	kfree_skb(session->stored);
-	session->stored = NULL;
-	table->pkt_count--;
+	spin_lock_init(&bucket->lock);
+	bucket->units = units;
+	bucket->last = jiffies;
 }
 
-static int bib_setup(void)
+/* Takes one token from @bucket, if there's one. @rate is tokens per second. */
+static bool bucket_take(struct token_bucket *bucket, unsigned int rate)
 {
-	bib_cache = kmem_cache_create("bib_nodes",
-			sizeof(struct tabled_bib),
-			0, 0, NULL);
-	if (!bib_cache)
-		return -ENOMEM;
+	u64 capacity = (u64)rate * HZ;
+	unsigned long now;
+	unsigned long elapsed;
+	bool result;
 
-	session_cache = kmem_cache_create("session_nodes",
-			sizeof(struct tabled_session),
-			0, 0, NULL);
-	if (!session_cache) {
-		kmem_cache_destroy(bib_cache);
-		bib_cache = NULL;
-		return -ENOMEM;
-	}
+	spin_lock(&bucket->lock);
 
-	return 0;
-}
+	now = jiffies;
+	elapsed = min_t(unsigned long, now - bucket->last, HZ);
+	bucket->last = now;
+	bucket->units = min_t(u64, bucket->units + (u64)elapsed * rate,
+			capacity);
 
-void bib_teardown(void)
-{
-	if (!bib_cache)
-		return;
+	result = bucket->units >= HZ;
+	if (result)
+		bucket->units -= HZ;
 
-	kmem_cache_destroy(bib_cache);
-	bib_cache = NULL;
-	kmem_cache_destroy(session_cache);
-	session_cache = NULL;
+	spin_unlock(&bucket->lock);
+	return result;
 }
 
-static enum session_fate just_die(struct session_entry *session, void *arg)
+/** Are the subscribers being counted? */
+static bool subscribers_tracked(struct xlator *jool)
 {
-	return FATE_RM;
+	return XGLOBALS(jool).subscriber_max_ports
+			|| XGLOBALS(jool).subscriber_max_sessions
+			|| XGLOBALS(jool).subscriber_packet_rate
+			|| XGLOBALS(jool).subscriber_session_rate;
 }
 
-static void init_expirer(struct expire_timer *expirer,
-		unsigned long timeout,
-		session_timer_type type,
+/**
+ * Would @sub exceed its subscriber-session-rate if it opened a new session?
+ * (@sub can be NULL; untracked subscribers are not policed.)
+ */
+static bool session_rate_exceeded(struct xlator *jool, struct subscriber *sub)
+{
+	unsigned int rate = XGLOBALS(jool).subscriber_session_rate;
+	return rate && sub && !bucket_take(&sub->new_sessions, rate);
+}
+
+/* Same as session_rate_exceeded(), for a subscriber without BIB entry yet. */
+static bool session_rate_exceeded6(struct xlator *jool,
+		struct in6_addr const *src6)
+{
+	struct in6_addr prefix;
+	bool result;
+
+	if (!XGLOBALS(jool).subscriber_session_rate)
+		return false;
+
+	rcu_read_lock();
+	result = session_rate_exceeded(jool,
+			subscriber_find(jool, src6, &prefix));
+	rcu_read_unlock();
+
+	return result;
+}
+
+/**
+ * Should @state's packet be let through, according to its subscriber's
+ * subscriber-packet-rate?
+ */
+bool bib_police6(struct xlation *state)
+{
+	struct subscriber *sub;
+	struct in6_addr prefix;
+	bool result = true;
+
+	rcu_read_lock();
+	sub = subscriber_find(state->jool, &state->in.tuple.src.addr6.l3,
+			&prefix);
+	if (sub)
+		result = bucket_take(&sub->packets,
+				state->jool->fast.subscriber_packet_rate);
+	rcu_read_unlock();
+
+	return result;
+}
+
+/**
+ * Would @src6's subscriber exceed its quotas if it got a new BIB entry (and
+ * its first session)?
+ */
+static bool port_quota_exceeded(struct xlator *jool,
+		struct in6_addr const *src6)
+{
+	struct subscriber *sub;
+	struct in6_addr prefix;
+	unsigned int max_ports;
+	unsigned int max_sessions;
+	bool result = false;
+
+	max_ports = XGLOBALS(jool).subscriber_max_ports;
+	max_sessions = XGLOBALS(jool).subscriber_max_sessions;
+	if (!max_ports && !max_sessions)
+		return false;
+
+	rcu_read_lock();
+	sub = subscriber_find(jool, src6, &prefix);
+	if (sub) {
+		result = (max_ports && atomic_read(&sub->bibs) >= max_ports)
+				|| (max_sessions
+				&& atomic_read(&sub->sessions) >= max_sessions);
+	}
+	rcu_read_unlock();
+
+	return result;
+}
+
+/**
+ * Would @bib's subscriber exceed its session quota if @bib got a new session?
+ */
+static bool session_quota_exceeded(struct xlator *jool, struct tabled_bib *bib)
+{
+	unsigned int max = XGLOBALS(jool).subscriber_max_sessions;
+	return max && bib->subscriber
+			&& atomic_read(&bib->subscriber->sessions) >= max;
+}
+
+/**
+ * Starts counting @bib (which is being added, and has no sessions yet) against
+ * its subscriber's quotas. Does nothing if the quotas are disabled.
+ */
+static void subscriber_charge(struct xlator *jool, struct tabled_bib *bib)
+{
+	struct subscriber_table *table = jool->nat64.bib->subscribers;
+	struct subscriber *sub;
+	struct in6_addr prefix;
+
+	if (!subscribers_tracked(jool))
+		return;
+
+	rcu_read_lock();
+	sub = subscriber_find(jool, &bib->src6.l3, &prefix);
+	/* Zero means it's being deleted. */
+	if (sub && atomic_inc_not_zero(&sub->bibs)) {
+		rcu_read_unlock();
+		goto end;
+	}
+	rcu_read_unlock();
+
+	spin_lock(&table->lock);
+
+	rcu_read_lock();
+	sub = subscriber_find(jool, &bib->src6.l3, &prefix);
+	rcu_read_unlock();
+	if (sub) {
+		/* Visible under the lock, so it's not being deleted. */
+		atomic_inc(&sub->bibs);
+		goto unlock;
+	}
+
+	sub = wkmalloc(struct subscriber, GFP_ATOMIC);
+	if (!sub)
+		goto unlock; /* Untracked, then. */
+	sub->prefix = prefix;
+	atomic_set(&sub->bibs, 1);
+	atomic_set(&sub->sessions, 0);
+	bucket_init(&sub->packets,
+			(u64)XGLOBALS(jool).subscriber_packet_rate * HZ);
+	/* Full, minus the session that's being added. */
+	bucket_init(&sub->new_sessions,
+			(u64)XGLOBALS(jool).subscriber_session_rate * HZ);
+	bucket_take(&sub->new_sessions, XGLOBALS(jool).subscriber_session_rate);
+	hlist_add_head_rcu(&sub->hook, subscriber_bucket(table, &prefix));
+	/* Fall through */
+
+unlock:
+	spin_unlock(&table->lock);
+end:
+	bib->subscriber = sub;
+}
+
+/* Reverts subscriber_charge(). @bib's sessions have to be uncharged already. */
+static void subscriber_uncharge(struct xlator *jool, struct tabled_bib *bib)
+{
+	struct subscriber_table *table = jool->nat64.bib->subscribers;
+	struct subscriber *sub = bib->subscriber;
+
+	if (!sub)
+		return;
+
+	bib->subscriber = NULL;
+	if (atomic_dec_and_lock(&sub->bibs, &table->lock)) {
+		hlist_del_rcu(&sub->hook);
+		spin_unlock(&table->lock);
+		call_rcu(&sub->rcu, subscriber_rcu_cb);
+	}
+}
+
+static void subscriber_add_sessions(struct tabled_bib *bib, int delta)
+{
+	if (bib->subscriber)
+		atomic_add(delta, &bib->subscriber->sessions);
+}
+
+static struct tabled_bib *bib6_entry(const struct rb_node *node)
+{
+	return node ? rb_entry(node, struct tabled_bib, hook6) : NULL;
+}
+
+static struct tabled_bib *bib4_entry(const struct rb_node *node)
+{
+	return node ? rb_entry(node, struct tabled_bib, hook4) : NULL;
+}
+
+static struct tabled_session *node2session(const struct rb_node *node)
+{
+	return node ? rb_entry(node, struct tabled_session, tree_hook) : NULL;
+}
+
+#ifdef BIB_HASH_INDEX
+
+struct session_key {
+	struct tabled_bib const *bib;
+	struct ipv4_transport_addr const *dst4;
+};
+
+static u32 hash_taddr6(struct ipv6_transport_addr const *addr, u32 seed)
+{
+	return jhash2((u32 const *)addr->l3.s6_addr32, 4, seed ^ addr->l4);
+}
+
+static u32 hash_taddr4(struct ipv4_transport_addr const *addr, u32 seed)
+{
+	return jhash_2words((__force u32)addr->l3.s_addr, addr->l4, seed);
+}
+
+static u32 hash_session(struct tabled_bib const *bib,
+		struct ipv4_transport_addr const *dst4, u32 seed)
+{
+	return jhash_3words((u32)(unsigned long)bib,
+			(__force u32)dst4->l3.s_addr, dst4->l4, seed);
+}
+
+static u32 bib6_hashfn(const void *key, u32 len, u32 seed)
+{
+	return hash_taddr6(key, seed);
+}
+
+static u32 bib6_obj_hashfn(const void *obj, u32 len, u32 seed)
+{
+	return hash_taddr6(&((struct tabled_bib const *)obj)->src6, seed);
+}
+
+static int bib6_obj_cmpfn(struct rhashtable_compare_arg *arg, const void *obj)
+{
+	return !taddr6_equals(arg->key, &((struct tabled_bib const *)obj)->src6);
+}
+
+static u32 bib4_hashfn(const void *key, u32 len, u32 seed)
+{
+	return hash_taddr4(key, seed);
+}
+
+static u32 bib4_obj_hashfn(const void *obj, u32 len, u32 seed)
+{
+	return hash_taddr4(&((struct tabled_bib const *)obj)->src4, seed);
+}
+
+static int bib4_obj_cmpfn(struct rhashtable_compare_arg *arg, const void *obj)
+{
+	return !taddr4_equals(arg->key, &((struct tabled_bib const *)obj)->src4);
+}
+
+static u32 session_hashfn(const void *key, u32 len, u32 seed)
+{
+	struct session_key const *skey = key;
+	return hash_session(skey->bib, skey->dst4, seed);
+}
+
+static u32 session_obj_hashfn(const void *obj, u32 len, u32 seed)
+{
+	struct tabled_session const *session = obj;
+	return hash_session(session->bib, &session->dst4, seed);
+}
+
+static int session_obj_cmpfn(struct rhashtable_compare_arg *arg,
+		const void *obj)
+{
+	struct session_key const *key = arg->key;
+	struct tabled_session const *session = obj;
+
+	return (key->bib != session->bib)
+			|| !taddr4_equals(key->dst4, &session->dst4);
+}
+
+static const struct rhashtable_params bib6_params = {
+	.head_offset = offsetof(struct tabled_bib, hash6),
+	.key_len = sizeof(struct ipv6_transport_addr),
+	.hashfn = bib6_hashfn,
+	.obj_hashfn = bib6_obj_hashfn,
+	.obj_cmpfn = bib6_obj_cmpfn,
+	.automatic_shrinking = true,
+};
+
+static const struct rhashtable_params bib4_params = {
+	.head_offset = offsetof(struct tabled_bib, hash4),
+	.key_len = sizeof(struct ipv4_transport_addr),
+	.hashfn = bib4_hashfn,
+	.obj_hashfn = bib4_obj_hashfn,
+	.obj_cmpfn = bib4_obj_cmpfn,
+	.automatic_shrinking = true,
+};
+
+static const struct rhashtable_params session_params = {
+	.head_offset = offsetof(struct tabled_session, hash_hook),
+	.key_len = sizeof(struct session_key),
+	.hashfn = session_hashfn,
+	.obj_hashfn = session_obj_hashfn,
+	.obj_cmpfn = session_obj_cmpfn,
+	.automatic_shrinking = true,
+};
+
+static int init_hashes(struct bib_table *table)
+{
+	int error;
+
+	error = rhashtable_init(&table->hash6, &bib6_params);
+	if (error)
+		return error;
+	error = rhashtable_init(&table->hash4, &bib4_params);
+	if (error)
+		goto fail4;
+	error = rhashtable_init(&table->session_hash, &session_params);
+	if (error)
+		goto fail_session;
+
+	return 0;
+
+fail_session:
+	rhashtable_destroy(&table->hash4);
+fail4:
+	rhashtable_destroy(&table->hash6);
+	return error;
+}
+
+static void destroy_hashes(struct bib_table *table)
+{
+	rhashtable_destroy(&table->hash6);
+	rhashtable_destroy(&table->hash4);
+	rhashtable_destroy(&table->session_hash);
+}
+
+/*
+ * The hash insertions are best-effort. (Failures only result in slower
+ * lookups.) Removing an entry that failed to be inserted is harmless.
+ */
+
+static void hash_add_bib(struct bib_table *table, struct tabled_bib *bib)
+{
+	rhashtable_insert_fast(&table->hash6, &bib->hash6, bib6_params);
+	rhashtable_insert_fast(&table->hash4, &bib->hash4, bib4_params);
+}
+
+static void hash_rm_bib(struct bib_table *table, struct tabled_bib *bib)
+{
+	rhashtable_remove_fast(&table->hash6, &bib->hash6, bib6_params);
+	rhashtable_remove_fast(&table->hash4, &bib->hash4, bib4_params);
+}
+
+static void hash_add_session(struct bib_table *table,
+		struct tabled_session *session)
+{
+	rhashtable_insert_fast(&table->session_hash, &session->hash_hook,
+			session_params);
+}
+
+static void hash_rm_session(struct bib_table *table,
+		struct tabled_session *session)
+{
+	rhashtable_remove_fast(&table->session_hash, &session->hash_hook,
+			session_params);
+}
+
+/*
+ * The hash_find*()s can be used both by lockless readers and by the table
+ * lock holder.
+ */
+
+static struct tabled_bib *hash_find_bib6(struct bib_table *table,
+		struct ipv6_transport_addr const *addr)
+{
+	return rhashtable_lookup_fast(&table->hash6, addr, bib6_params);
+}
+
+static struct tabled_bib *hash_find_bib4(struct bib_table *table,
+		struct ipv4_transport_addr const *addr)
+{
+	return rhashtable_lookup_fast(&table->hash4, addr, bib4_params);
+}
+
+static struct tabled_session *hash_find_session(struct bib_table *table,
+		struct tabled_bib const *bib,
+		struct ipv4_transport_addr const *dst4)
+{
+	struct session_key key = { .bib = bib, .dst4 = dst4 };
+	return rhashtable_lookup_fast(&table->session_hash, &key,
+			session_params);
+}
+
+#else /* BIB_HASH_INDEX */
+
+static int init_hashes(struct bib_table *table)
+{
+	return 0;
+}
+
+static void destroy_hashes(struct bib_table *table)
+{
+	/* No code. */
+}
+
+static void hash_add_bib(struct bib_table *table, struct tabled_bib *bib)
+{
+	/* No code. */
+}
+
+static void hash_rm_bib(struct bib_table *table, struct tabled_bib *bib)
+{
+	/* No code. */
+}
+
+static void hash_add_session(struct bib_table *table,
+		struct tabled_session *session)
+{
+	/* No code. */
+}
+
+static void hash_rm_session(struct bib_table *table,
+		struct tabled_session *session)
+{
+	/* No code. */
+}
+
+static struct tabled_bib *hash_find_bib6(struct bib_table *table,
+		struct ipv6_transport_addr const *addr)
+{
+	return NULL;
+}
+
+static struct tabled_bib *hash_find_bib4(struct bib_table *table,
+		struct ipv4_transport_addr const *addr)
+{
+	return NULL;
+}
+
+static struct tabled_session *hash_find_session(struct bib_table *table,
+		struct tabled_bib const *bib,
+		struct ipv4_transport_addr const *dst4)
+{
+	return NULL;
+}
+
+#endif /* BIB_HASH_INDEX */
+
+/*
+ * Port maps.
+ *
+ * A port map is a bitmap of the ports a table's BIB entries are using on a
+ * given IPv4 address. find_available_mask() uses them to jump straight to the
+ * next free port, instead of probing tree4 once per taken mask. (Which gets
+ * out of hand once pool4 is mostly used up.)
+ *
+ * Because a table only contains the ports of its own shard, bit n represents
+ * port (n << BIB_SHARD_BITS) | shard.
+ *
+ * The maps are only built (from tree4) the first time a mask allocation needs
+ * one, and are dropped once their address stops being used. Allocation failure
+ * is not fatal; the mask allocation just falls back to probing.
+ */
+
+#define PORT_MAP_BITS (65536u >> BIB_SHARD_BITS)
+
+struct port_map {
+	struct rb_node hook;
+	struct in_addr addr;
+	/** Number of bits set in @ports. */
+	unsigned int used;
+	DECLARE_BITMAP(ports, PORT_MAP_BITS);
+};
+
+static unsigned int port2bit(__u16 port)
+{
+	return port >> BIB_SHARD_BITS;
+}
+
+static struct port_map *find_port_map(struct bib_table *table,
+		struct in_addr const *addr)
+{
+	struct rb_node *node = table->port_maps.rb_node;
+	struct port_map *map;
+	int gap;
+
+	while (node) {
+		map = rb_entry(node, struct port_map, hook);
+		gap = ipv4_addr_cmp(&map->addr, addr);
+		if (gap < 0)
+			node = node->rb_right;
+		else if (gap > 0)
+			node = node->rb_left;
+		else
+			return map;
+	}
+
+	return NULL;
+}
+
+/**
+ * Returns @addr's port map, building it from tree4 if it doesn't exist yet.
+ * Returns NULL on memory allocation failure.
+ */
+static struct port_map *get_port_map(struct bib_table *table,
+		struct in_addr const *addr)
+{
+	struct rb_node **node;
+	struct rb_node *parent;
+	struct rb_node *cursor;
+	struct port_map *map;
+	struct tabled_bib *bib;
+	struct tabled_bib *first;
+	struct ipv4_transport_addr key;
+	int gap;
+
+	node = &table->port_maps.rb_node;
+	parent = NULL;
+	while (*node) {
+		map = rb_entry(*node, struct port_map, hook);
+		gap = ipv4_addr_cmp(&map->addr, addr);
+		if (gap == 0)
+			return map;
+		parent = *node;
+		node = (gap < 0) ? &parent->rb_right : &parent->rb_left;
+	}
+
+	map = __wkmalloc("port map", sizeof(struct port_map), GFP_ATOMIC);
+	if (!map)
+		return NULL;
+	map->addr = *addr;
+	map->used = 0;
+	bitmap_zero(map->ports, PORT_MAP_BITS);
+
+	/* Find @addr's first entry, then walk the rest of them. */
+	key.l3 = *addr;
+	key.l4 = 0;
+	first = NULL;
+	cursor = table->tree4.rb_node;
+	while (cursor) {
+		bib = bib4_entry(cursor);
+		if (taddr4_compare(&bib->src4, &key) < 0) {
+			cursor = cursor->rb_right;
+		} else {
+			first = bib;
+			cursor = cursor->rb_left;
+		}
+	}
+	for (bib = first; bib && addr4_equals(&bib->src4.l3, addr);
+			bib = bib4_entry(rb_next(&bib->hook4))) {
+		__set_bit(port2bit(bib->src4.l4), map->ports);
+		map->used++;
+	}
+
+	rb_link_node(&map->hook, parent, node);
+	rb_insert_color(&map->hook, &table->port_maps);
+	return map;
+}
+
+/* Call after adding @bib to tree4. */
+static void port_map_add(struct bib_table *table, struct tabled_bib *bib)
+{
+	struct port_map *map;
+
+	map = find_port_map(table, &bib->src4.l3);
+	if (map && !__test_and_set_bit(port2bit(bib->src4.l4), map->ports))
+		map->used++;
+}
+
+/* Call after removing @bib from tree4. */
+static void port_map_rm(struct bib_table *table, struct tabled_bib *bib)
+{
+	struct port_map *map;
+
+	map = find_port_map(table, &bib->src4.l3);
+	if (!map || !__test_and_clear_bit(port2bit(bib->src4.l4), map->ports))
+		return;
+
+	map->used--;
+	if (!map->used) {
+		rb_erase(&map->hook, &table->port_maps);
+		__wkfree("port map", map);
+	}
+}
+
+/**
+ * Returns the first port of @map's shard, starting from @port, that is not
+ * used. Returns 65536 (ie. an impossible port) if there is none.
+ */
+static unsigned int port_map_next_free(struct port_map *map, __u16 port)
+{
+	unsigned int bit;
+
+	bit = find_next_zero_bit(map->ports, PORT_MAP_BITS, port2bit(port));
+	if (bit >= PORT_MAP_BITS)
+		return 65536u;
+	return (bit << BIB_SHARD_BITS) | (port & BIB_SHARD_MASK);
+}
+
+static void destroy_port_maps(struct bib_table *table)
+{
+	struct port_map *map, *tmp;
+
+	rbtree_postorder_for_each_entry_safe(map, tmp, &table->port_maps, hook)
+		__wkfree("port map", map);
+	table->port_maps = RB_ROOT;
+}
+
+/*
+ * BIB4 filters.
+ *
+ * Scans and background radiation towards pool4 mostly hit transport addresses
+ * that have no BIB entry. Rather than taking the table lock and walking tree4
+ * just to reject them, the 4-to-6 direction first asks the table's filter,
+ * which is a counting Bloom filter over the src4s of the table's BIB entries:
+ * If any of the address's counters is zero, the entry cannot exist.
+ *
+ * The counters are only written by the lock holder, along with tree4, and are
+ * read locklessly. Additions happen before the entry becomes visible to
+ * anyone who could answer through it, and removals only happen after it left
+ * tree4, so a racing reader misses or finds the entry the same way it would
+ * have in the tree.
+ *
+ * Saturated counters are never decremented, so the filter never yields false
+ * negatives; a table that outgrows the filter just stops being filtered.
+ */
+
+#define BIB4_FILTER_BITS 15
+#define BIB4_FILTER_SIZE (1u << BIB4_FILTER_BITS)
+#define BIB4_FILTER_MASK (BIB4_FILTER_SIZE - 1u)
+
+struct bib4_filter {
+	/** Keeps the remote nodes from picking the counters. */
+	u32 seed;
+	u8 counters[BIB4_FILTER_SIZE];
+};
+
+static struct bib4_filter *bib4_filter_alloc(void)
+{
+	struct bib4_filter *filter;
+
+	filter = __wkvmalloc("bib4 filter", sizeof(struct bib4_filter));
+	if (filter)
+		get_random_bytes(&filter->seed, sizeof(filter->seed));
+	return filter;
+}
+
+static void bib4_filter_free(struct bib4_filter *filter)
+{
+	if (filter)
+		__wkvfree("bib4 filter", filter);
+}
+
+/* Two counters per address, both from the same hash. */
+static void bib4_filter_hash(struct bib4_filter const *filter,
+		struct ipv4_transport_addr const *addr, unsigned int *i1,
+		unsigned int *i2)
+{
+	u32 hash;
+
+	hash = jhash_2words((__force u32)addr->l3.s_addr, addr->l4,
+			filter->seed);
+	*i1 = hash & BIB4_FILTER_MASK;
+	*i2 = (hash >> BIB4_FILTER_BITS) & BIB4_FILTER_MASK;
+}
+
+static void bib4_filter_inc(u8 *counter)
+{
+	if (*counter != U8_MAX)
+		WRITE_ONCE(*counter, *counter + 1);
+}
+
+static void bib4_filter_dec(u8 *counter)
+{
+	if (*counter != U8_MAX && !WARN_ON(*counter == 0))
+		WRITE_ONCE(*counter, *counter - 1);
+}
+
+/* Call before adding @bib to tree4. */
+static void bib4_filter_add(struct bib_table *table, struct tabled_bib *bib)
+{
+	struct bib4_filter *filter = table->filter;
+	unsigned int i1, i2;
+
+	bib4_filter_hash(filter, &bib->src4, &i1, &i2);
+	bib4_filter_inc(&filter->counters[i1]);
+	bib4_filter_inc(&filter->counters[i2]);
+	/* Counters first, then the tree. */
+	smp_wmb();
+}
+
+/* Call after removing @bib from tree4. */
+static void bib4_filter_rm(struct bib_table *table, struct tabled_bib *bib)
+{
+	struct bib4_filter *filter = table->filter;
+	unsigned int i1, i2;
+
+	bib4_filter_hash(filter, &bib->src4, &i1, &i2);
+	bib4_filter_dec(&filter->counters[i1]);
+	bib4_filter_dec(&filter->counters[i2]);
+}
+
+/**
+ * Returns false if @table definitely does not contain a BIB entry whose src4
+ * is @addr. Lockless.
+ */
+static bool bib4_filter_test(struct bib_table *table,
+		struct ipv4_transport_addr const *addr)
+{
+	struct bib4_filter *filter = table->filter;
+	unsigned int i1, i2;
+
+	bib4_filter_hash(filter, addr, &i1, &i2);
+	return READ_ONCE(filter->counters[i1])
+			&& READ_ONCE(filter->counters[i2]);
+}
+
+/*
+ * Port blocks. (port-block-size)
+ *
+ * In this mode, the first dynamic BIB entry an IPv6 address (the "owner")
+ * needs reserves a block of port-block-size ports on one pool4 address. The
+ * owner's following entries are allocated from the block (a bitmap lookup)
+ * instead of the RFC 6056 iteration, and once it's full, another block is
+ * reserved. Blocks are logged (see log_block()) when they gain their first
+ * entry and when they lose their last one; their entries are not logged. (See
+ * RFC 7422 for the motivation.)
+ *
+ * Like everything else, blocks are per table. In sharded mode, a block is a
+ * range of port-block-size << BIB_SHARD_BITS ports, of which it only owns the
+ * ones that belong to its shard; the other shards can hand the rest to other
+ * owners.
+ *
+ * A block that was reserved but never received its entry (because the
+ * translation was aborted) is freed by the next bib_clean().
+ */
+
+struct port_block {
+	struct rb_node hook6;
+	struct rb_node hook4;
+	/** Hook to bib_table.empty_blocks. Self-linked if @used > 0. */
+	struct list_head list_hook;
+
+	struct in6_addr owner;
+	struct in_addr addr;
+	/** First port of the block's range. Multiple of BIB_SHARDS. */
+	unsigned int first;
+	/** Number of ports the block owns. (Bits in @ports.) */
+	unsigned int size;
+	unsigned int shard;
+	/** Number of bits set in @ports. */
+	unsigned int used;
+	/** Bit n represents port @first + (n << BIB_SHARD_BITS) + @shard. */
+	unsigned long ports[];
+};
+
+static void destroy_port_blocks(struct bib_table *table)
+{
+	struct port_block *block, *tmp;
+
+	rbtree_postorder_for_each_entry_safe(block, tmp, &table->blocks4, hook4)
+		__wkfree("port block", block);
+	table->blocks6 = RB_ROOT;
+	table->blocks4 = RB_ROOT;
+	INIT_LIST_HEAD(&table->empty_blocks);
+}
+
+/**
+ * "[Convert] tabled BIB to BIB entry"
+ */
+/* Expects the table lock. */
+static void tbtobe(struct tabled_bib *tabled, struct bib_entry *bib)
+{
+	struct tabled_session *session, *tmp;
+
+	if (!bib)
+		return;
+
+	bib->addr6 = tabled->src6;
+	bib->addr4 = tabled->src4;
+	bib->l4_proto = tabled->proto;
+	bib->is_static = tabled->is_static;
+	bib->packets = tabled->packets;
+	bib->bytes = tabled->bytes;
+	rbtree_foreach(session, tmp, &tabled->sessions, tree_hook) {
+		bib->packets += READ_ONCE(session->packets);
+		bib->bytes += READ_ONCE(session->bytes);
+	}
+}
+
+static unsigned long get_timeout(struct xlator *jool,
+		struct expire_timer *expirer)
+{
+	__u32 msecs;
+
+	switch (expirer->proto) {
+	case L4PROTO_TCP:
+		switch (expirer->type) {
+		case SESSION_TIMER_EST:
+			msecs = XGLOBALS(jool).ttl.tcp_est;
+			break;
+		case SESSION_TIMER_TRANS:
+			msecs = XGLOBALS(jool).ttl.tcp_trans;
+			break;
+		case SESSION_TIMER_SYN4:
+			msecs = 1000 * TCP_INCOMING_SYN;
+			break;
+		default:
+			msecs = 0;
+		}
+		break;
+	case L4PROTO_UDP:
+		switch (expirer->type) {
+		case SESSION_TIMER_EST:
+			msecs = XGLOBALS(jool).ttl.udp;
+			break;
+		case SESSION_TIMER_TRANS:
+			msecs = XGLOBALS(jool).ttl.udp_fast;
+			break;
+		default:
+			msecs = 0;
+		}
+		break;
+	case L4PROTO_ICMP:
+		msecs = (expirer->type == SESSION_TIMER_EST)
+				? XGLOBALS(jool).ttl.icmp
+				: 0;
+		break;
+	default:
+		/*
+		 * This is known to happen whenever the timer is cleaning.
+		 * It's not cause for concern.
+		 */
+		msecs = 0;
+	}
+
+	return msecs_to_jiffies(msecs) >> expirer->shift;
+}
+
+/* get_timeout(), honoring the session's timeout class. */
+static unsigned long get_session_timeout(struct xlator *jool,
+		struct tabled_session const *session)
+{
+	struct timeout_classes const *classes;
+
+	if (session->timeout_class
+			&& session->expirer->type == SESSION_TIMER_EST) {
+		classes = &XGLOBALS(jool).timeout_classes;
+		/* The classes might have been shrunk since. */
+		if (session->timeout_class <= classes->count)
+			return msecs_to_jiffies(classes->values[
+					session->timeout_class - 1].ttl)
+					>> session->expirer->shift;
+	}
+
+	return get_timeout(jool, session->expirer);
+}
+
+static void classify_session(struct xlator *jool, struct bib_table *table,
+		struct tabled_session *session)
+{
+	session->timeout_class = timeout_class_find(&XGLOBALS(jool),
+			table->est_timer.proto, &session->dst4);
+}
+
+/**
+ * Returns the last time @ts was refreshed, by either the locked or the lockless
+ * path.
+ */
+static unsigned long get_update_time(struct tabled_session *ts)
+{
+	unsigned long refresh_time = READ_ONCE(ts->refresh_time);
+	return time_after(refresh_time, ts->update_time)
+			? refresh_time
+			: ts->update_time;
+}
+
+/**
+ * Rebuilds @session's dst6, which is not stored in its entirety.
+ *
+ * (NAT64 Jool can't do anything without pool6, so the prefix is assumed to be
+ * set. pool6-tenants can be shrunk, in which case the orphans fall back to
+ * pool6.)
+ */
+static void get_dst6(struct xlator *jool, struct tabled_session *session,
+		struct ipv6_transport_addr *dst6)
+{
+	unsigned int index = session->pool6_index;
+
+	if (index > jool->globals.nat64.pool6_tenants.count)
+		index = 0;
+	__rfc6052_4to6(xlator_pool6(jool, index), &session->dst4.l3,
+			&dst6->l3);
+	dst6->l4 = session->dst6_l4;
+}
+
+/**
+ * "[Convert] tabled session to session entry"
+ */
+static void tstose(struct xlator *jool,
+		struct tabled_session *ts,
+		struct session_entry *se)
+{
+	se->src6 = ts->bib->src6;
+	get_dst6(jool, ts, &se->dst6);
+	se->src4 = ts->bib->src4;
+	se->dst4 = ts->dst4;
+	se->proto = ts->bib->proto;
+	se->state = ts->state;
+	se->timer_type = ts->expirer->type;
+	se->update_time = get_update_time(ts);
+	se->create_time = ts->create_time;
+	se->timeout = get_session_timeout(jool, ts);
+	se->has_stored = !!ts->stored;
+	se->csum = ts->csum;
+	se->packets = READ_ONCE(ts->packets);
+	se->bytes = READ_ONCE(ts->bytes);
+}
+
+static void trace_bib_add(struct xlator *jool, struct tabled_bib *bib)
+{
+	trace_jool_bib_create(jool, &bib->src6, &bib->src4, bib->proto,
+			bib->is_static);
+}
+
+static void trace_bib_rm(struct xlator *jool, struct tabled_bib *bib)
+{
+	trace_jool_bib_destroy(jool, &bib->src6, &bib->src4, bib->proto,
+			bib->is_static);
+}
+
+/*
+ * Like tstose(), except it only fills the addresses and protocol. (The timer
+ * might not have been attached yet.)
+ */
+static void tstotrace(struct xlator *jool, struct tabled_session *ts,
+		struct session_entry *se)
+{
+	se->src6 = ts->bib->src6;
+	get_dst6(jool, ts, &se->dst6);
+	se->src4 = ts->bib->src4;
+	se->dst4 = ts->dst4;
+	se->proto = ts->bib->proto;
+}
+
+/* Assumes @session->bib has already been set. */
+static void trace_session_add(struct xlator *jool,
+		struct tabled_session *session)
+{
+	struct session_entry tmp;
+
+	if (trace_jool_session_create_enabled()) {
+		tstotrace(jool, session, &tmp);
+		trace_jool_session_create(jool, &tmp);
+	}
+}
+
+static void trace_session_rm(struct xlator *jool,
+		struct tabled_session *session)
+{
+	struct session_entry tmp;
+
+	if (trace_jool_session_destroy_enabled()) {
+		tstotrace(jool, session, &tmp);
+		trace_jool_session_destroy(jool, &tmp);
+	}
+}
+
+/**
+ * "[Convert] tabled BIB to bib_session"
+ */
+static void tbtobs(struct tabled_bib *tabled, struct bib_session *bs)
+{
+	if (!bs)
+		return;
+
+	bs->bib_set = true;
+	bs->session.src6 = tabled->src6;
+	bs->session.src4 = tabled->src4;
+	bs->session.proto = tabled->proto;
+}
+
+/**
+ * [Convert] tabled session to bib_session"
+ */
+/*
+ * Accounts @state->in to @ts. (session-counters)
+ *
+ * Not atomic; if two CPUs translate packets of the same session at the same
+ * time, one of the updates can be lost. RSS usually keeps each direction of a
+ * flow on one CPU, and a locked add per packet would cost more than the
+ * counters are worth.
+ */
+static void count_traffic(struct xlation *state, struct tabled_session *ts)
+{
+	if (!state->jool->fast.session_counters)
+		return;
+
+	WRITE_ONCE(ts->packets, ts->packets + 1);
+	WRITE_ONCE(ts->bytes, ts->bytes + state->in.skb->len);
+}
+
+static void tstobs(struct xlation *state, struct tabled_session *ts)
+{
+	count_traffic(state, ts);
+	state->entries.bib_set = true;
+	state->entries.session_set = true;
+	tstose(state->jool, ts, &state->entries.session);
+}
+
+/**
+ * One-liner to get the session table corresponding to the @proto protocol.
+ * Returns the first shard; the rest of them follow it.
+ */
+static struct bib_table *get_table(struct bib *db, l4_protocol proto)
+{
+	switch (proto) {
+	case L4PROTO_TCP:
+		return db->tcp;
+	case L4PROTO_UDP:
+		return db->udp;
+	case L4PROTO_ICMP:
+		return db->icmp;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	WARN(true, "Unsupported transport protocol: %u.", proto);
+	return NULL;
+}
+
+static unsigned int port2shard(__u16 port)
+{
+	return port & BIB_SHARD_MASK;
+}
+
+static bool shards_match(struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4)
+{
+	return port2shard(src6->l4) == port2shard(src4->l4);
+}
+
+/**
+ * Returns the shard where the BIB entry whose IPv6 transport address is @src6
+ * is supposed to be stored.
+ */
+static struct bib_table *get_table6(struct bib *db, l4_protocol proto,
+		struct ipv6_transport_addr const *src6)
+{
+	struct bib_table *tables;
+
+	tables = get_table(db, proto);
+	return tables ? &tables[port2shard(src6->l4)] : NULL;
+}
+
+/**
+ * Returns the shard where the BIB entry whose IPv4 transport address is @src4
+ * is supposed to be stored.
+ */
+static struct bib_table *get_table4(struct bib *db, l4_protocol proto,
+		struct ipv4_transport_addr const *src4)
+{
+	struct bib_table *tables;
+
+	tables = get_table(db, proto);
+	return tables ? &tables[port2shard(src4->l4)] : NULL;
+}
+
+/**
+ * The max_stored_pkts global is a database-wide limit, so it is split evenly
+ * among the shards.
+ */
+static bool too_many_stored_pkts(struct xlation *state, struct bib_table *table)
+{
+	return table->pkt_count >= DIV_ROUND_UP(GLOBALS(state).max_stored_pkts,
+			BIB_SHARDS);
+}
+
+/* Same, for the per-source limit on type 1 packets. Zero means unlimited. */
+static unsigned int stored_pkts_per_src(struct xlation *state)
+{
+	return DIV_ROUND_UP(GLOBALS(state).max_stored_pkts_per_src, BIB_SHARDS);
+}
+
+static void kill_stored_pkt(struct xlator *jool, struct bib_table *table,
+		struct tabled_session *session)
+{
+	if (!session->stored)
+		return;
+
+	__log_debug(jool, "Deleting stored type 2 packet.");
+	kfree_skb(session->stored);
+	session->stored = NULL;
+	table->pkt_count--;
+}
+
+static int bib_setup(void)
+{
+	bib_cache = kmem_cache_create("bib_nodes",
+			sizeof(struct tabled_bib),
+			0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!bib_cache)
+		return -ENOMEM;
+
+	session_cache = kmem_cache_create("session_nodes",
+			sizeof(struct tabled_session),
+			0, SLAB_HWCACHE_ALIGN, NULL);
+	if (!session_cache)
+		goto session_fail;
+
+	bib_reserve = reserve_create("bib entry", bib_cache);
+	if (!bib_reserve)
+		goto bib_reserve_fail;
+	session_reserve = reserve_create("session", session_cache);
+	if (!session_reserve)
+		goto session_reserve_fail;
+
+	xmit_wq = alloc_workqueue("jool_xmit", WQ_UNBOUND, 0);
+	if (!xmit_wq)
+		goto xmit_wq_fail;
+
+	netdev_rss_key_fill(rss_key, sizeof(rss_key));
+
+	release_wq = alloc_workqueue("jool_bib", WQ_UNBOUND, 0);
+	if (!release_wq)
+		goto release_wq_fail;
+
+	return 0;
+
+release_wq_fail:
+	destroy_workqueue(xmit_wq);
+	xmit_wq = NULL;
+xmit_wq_fail:
+	reserve_destroy(session_reserve);
+	session_reserve = NULL;
+session_reserve_fail:
+	reserve_destroy(bib_reserve);
+	bib_reserve = NULL;
+bib_reserve_fail:
+	kmem_cache_destroy(session_cache);
+	session_cache = NULL;
+session_fail:
+	kmem_cache_destroy(bib_cache);
+	bib_cache = NULL;
+	return -ENOMEM;
+}
+
+void bib_teardown(void)
+{
+	if (!bib_cache)
+		return;
+
+	/*
+	 * Wait for the pending transmissions and reaps. (They can release
+	 * BIBs.)
+	 */
+	destroy_workqueue(xmit_wq);
+	xmit_wq = NULL;
+	/* Wait for the pending bib_release()s. */
+	destroy_workqueue(release_wq);
+	release_wq = NULL;
+	/* Wait for the pending free_*_rcu()s. */
+	rcu_barrier();
+
+	reserve_destroy(bib_reserve);
+	bib_reserve = NULL;
+	reserve_destroy(session_reserve);
+	session_reserve = NULL;
+	kmem_cache_destroy(bib_cache);
+	bib_cache = NULL;
+	kmem_cache_destroy(session_cache);
+	session_cache = NULL;
+}
+
+static enum session_fate just_die(struct session_entry *session, void *arg)
+{
+	return FATE_RM;
+}
+
+static void init_wheel(struct session_wheel *wheel)
+{
+	unsigned int i;
+
+	wheel->clk = jiffies & ~(WHEEL_TICK - 1);
+	wheel->lvl = WHEEL_LEVELS;
+	INIT_HLIST_HEAD(&wheel->expired);
+	wheel->sweep = 0;
+	for (i = 0; i < WHEEL_SIZE; i++)
+		INIT_HLIST_HEAD(&wheel->slots[i]);
+}
+
+static void init_expirer(struct expire_timer *expirer,
+		l4_protocol proto,
+		session_timer_type type,
 		fate_cb fate_cb)
 {
-	INIT_LIST_HEAD(&expirer->sessions);
+	expirer->proto = proto;
 	expirer->type = type;
 	expirer->decide_fate_cb = fate_cb;
+	expirer->shift = 0;
 }
 
-static void init_table(struct bib_table *table,
-		unsigned long est_timeout,
-		unsigned long trans_timeout,
+static void init_table(struct bib_table *table, l4_protocol proto,
 		fate_cb est_cb)
 {
 	table->tree6 = RB_ROOT;
 	table->tree4 = RB_ROOT;
-	spin_lock_init(&table->lock);
-	init_expirer(&table->est_timer, est_timeout, SESSION_TIMER_EST, est_cb);
-
-	init_expirer(&table->trans_timer, trans_timeout, SESSION_TIMER_TRANS,
+	table->port_maps = RB_ROOT;
+	table->filter = NULL;
+	table->bib_count = 0;
+	table->pressure = 0;
+	table->blocks6 = RB_ROOT;
+	table->blocks4 = RB_ROOT;
+	INIT_LIST_HEAD(&table->empty_blocks);
+	jlock_init(&table->lock);
+	init_wheel(&table->wheel);
+	init_expirer(&table->est_timer, proto, SESSION_TIMER_EST, est_cb);
+
+	init_expirer(&table->trans_timer, proto, SESSION_TIMER_TRANS,
 			just_die);
 	/* TODO (warning) "just_die"? what about the stored packet? */
-	init_expirer(&table->syn4_timer, TCP_INCOMING_SYN, SESSION_TIMER_SYN4,
+	init_expirer(&table->syn4_timer, proto, SESSION_TIMER_SYN4,
 			just_die);
 	table->pkt_count = 0;
 	table->pkt_queue = NULL;
+	table->syn_cache = NULL;
+}
+
+static int init_shard_hashes(struct bib *db, unsigned int s)
+{
+	int error;
+
+	error = init_hashes(&db->udp[s]);
+	if (error)
+		return error;
+	error = init_hashes(&db->tcp[s]);
+	if (error)
+		goto tcp_fail;
+	error = init_hashes(&db->icmp[s]);
+	if (error)
+		goto icmp_fail;
+
+	return 0;
+
+icmp_fail:
+	destroy_hashes(&db->tcp[s]);
+tcp_fail:
+	destroy_hashes(&db->udp[s]);
+	return error;
+}
+
+static void destroy_shard_hashes(struct bib *db, unsigned int s)
+{
+	destroy_hashes(&db->udp[s]);
+	destroy_hashes(&db->tcp[s]);
+	destroy_hashes(&db->icmp[s]);
+}
+
+static void release_pktqueues(struct bib *db)
+{
+	unsigned int s;
+
+	for (s = 0; s < BIB_SHARDS; s++) {
+		if (db->tcp[s].pkt_queue)
+			pktqueue_release(db->tcp[s].pkt_queue);
+		if (db->tcp[s].syn_cache)
+			wkfree(struct syn_cache, db->tcp[s].syn_cache);
+	}
+}
+
+static int alloc_filters(struct bib *db)
+{
+	unsigned int s;
+
+	for (s = 0; s < BIB_SHARDS; s++) {
+		db->udp[s].filter = bib4_filter_alloc();
+		if (!db->udp[s].filter)
+			return -ENOMEM;
+		db->tcp[s].filter = bib4_filter_alloc();
+		if (!db->tcp[s].filter)
+			return -ENOMEM;
+		db->icmp[s].filter = bib4_filter_alloc();
+		if (!db->icmp[s].filter)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void release_filters(struct bib *db)
+{
+	unsigned int s;
+
+	for (s = 0; s < BIB_SHARDS; s++) {
+		bib4_filter_free(db->udp[s].filter);
+		bib4_filter_free(db->tcp[s].filter);
+		bib4_filter_free(db->icmp[s].filter);
+	}
+}
+
+static struct syn_cache *syn_cache_alloc(void)
+{
+	struct syn_cache *cache;
+
+	cache = wkmalloc(struct syn_cache, GFP_KERNEL);
+	if (!cache)
+		return NULL;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->window = jiffies;
+	get_random_bytes(&cache->seed, sizeof(cache->seed));
+	return cache;
+}
+
+struct bib *bib_alloc(void)
+{
+	struct bib *db;
+	unsigned int s;
+	bool cache_created;
+
+	cache_created = false;
+	if (!bib_cache) {
+		if (bib_setup())
+			return NULL;
+		cache_created = true;
+	}
+
+	db = wkmalloc(struct bib, GFP_KERNEL);
+	if (!db)
+		goto db_alloc_fail;
+
+	for (s = 0; s < BIB_SHARDS; s++) {
+		init_table(&db->udp[s], L4PROTO_UDP, just_die);
+		init_table(&db->tcp[s], L4PROTO_TCP, tcp_est_expire_cb);
+		init_table(&db->icmp[s], L4PROTO_ICMP, just_die);
+	}
+
+	for (s = 0; s < BIB_SHARDS; s++)
+		if (init_shard_hashes(db, s))
+			goto hash_init_fail;
+
+	for (s = 0; s < BIB_SHARDS; s++) {
+		db->tcp[s].pkt_queue = pktqueue_alloc();
+		if (!db->tcp[s].pkt_queue)
+			goto pktqueue_alloc_fail;
+		db->tcp[s].syn_cache = syn_cache_alloc();
+		if (!db->tcp[s].syn_cache)
+			goto pktqueue_alloc_fail;
+	}
+
+	if (alloc_filters(db))
+		goto filter_alloc_fail;
+
+	db->subscribers = subscriber_table_alloc();
+	if (!db->subscribers)
+		goto filter_alloc_fail;
+	if (percpu_counter_init(&db->sessions, 0, GFP_KERNEL))
+		goto counter_fail;
+
+	db->clean_cursor = 0;
+	memset(db->pressure, 0, sizeof(db->pressure));
+	INIT_LIST_HEAD(&db->reaps);
+	spin_lock_init(&db->reap_lock);
+	db->generation = 0;
+	kref_init(&db->refs);
+
+	return db;
+
+counter_fail:
+	subscriber_table_free(db->subscribers);
+filter_alloc_fail:
+	release_filters(db);
+pktqueue_alloc_fail:
+	release_pktqueues(db);
+	s = BIB_SHARDS;
+hash_init_fail:
+	while (s-- > 0)
+		destroy_shard_hashes(db, s);
+	wkfree(struct bib, db);
+db_alloc_fail:
+	if (cache_created)
+		bib_teardown();
+	return NULL;
+}
+
+void bib_get(struct bib *db)
+{
+	kref_get(&db->refs);
+}
+
+/**
+ * Potentially includes laggy packet fetches; please do not hold spinlocks while
+ * calling this function!
+ */
+static void release_bib_entry(struct tabled_bib *bib)
+{
+	struct tabled_session *sessions, *tmp;
+
+	rbtree_foreach(sessions, tmp, &bib->sessions, tree_hook) {
+		if (sessions->stored) {
+			icmp64_send(NULL, sessions->stored,
+					ICMPERR_PORT_UNREACHABLE, 0);
+			kfree_skb(sessions->stored);
+		}
+		free_session_rcu(sessions);
+	}
+
+	free_bib_rcu(bib);
+}
+
+/* Hands @freed of @db's entries over to release_backlog. */
+static void release_progress(struct bib *db, unsigned int freed)
+{
+	s64 done = min_t(s64, freed, db->release_left);
+
+	db->release_left -= done;
+	atomic64_sub(done, &release_backlog);
+}
+
+/*
+ * Frees @bib, its sessions and their stored packets, without waiting for a
+ * grace period. (bib_release_work() already did.)
+ * Returns the number of entries freed.
+ */
+static unsigned int destroy_bib_entry(struct tabled_bib *bib)
+{
+	struct tabled_session *session, *tmp;
+	unsigned int freed = 1;
+
+	rbtree_foreach(session, tmp, &bib->sessions, tree_hook) {
+		if (session->stored) {
+			icmp64_send(NULL, session->stored,
+					ICMPERR_PORT_UNREACHABLE, 0);
+			kfree_skb(session->stored);
+		}
+		free_session(session);
+		freed++;
+	}
+
+	free_bib(bib);
+	return freed;
+}
+
+/*
+ * The trees share the entries, so only one tree of each protocol needs to be
+ * emptied.
+ */
+static void destroy_table(struct bib *db, struct bib_table *table)
+{
+	struct tabled_bib *bib, *tmp;
+	unsigned int freed = 0;
+
+	rbtree_foreach(bib, tmp, &table->tree4, hook4) {
+		freed += destroy_bib_entry(bib);
+		if (freed >= RELEASE_CHUNK) {
+			release_progress(db, freed);
+			freed = 0;
+			cond_resched();
+		}
+	}
+	release_progress(db, freed);
+
+	destroy_port_maps(table);
+	destroy_port_blocks(table);
+}
+
+static void bib_release_work(struct work_struct *work)
+{
+	struct bib *db;
+	unsigned int s;
+
+	db = container_of(work, struct bib, release_work);
+
+	/*
+	 * Nobody can reach @db anymore, but the lockless readers (and the
+	 * free_*_rcu()s) that did before the last bib_put() might still be
+	 * around. One grace period here is much cheaper than one RCU callback
+	 * per entry.
+	 */
+	synchronize_rcu();
+
+	for (s = 0; s < BIB_SHARDS; s++) {
+		destroy_table(db, &db->udp[s]);
+		destroy_table(db, &db->tcp[s]);
+		destroy_table(db, &db->icmp[s]);
+	}
+
+	release_pktqueues(db);
+	release_filters(db);
+	for (s = 0; s < BIB_SHARDS; s++)
+		destroy_shard_hashes(db, s);
+	subscriber_table_free(db->subscribers);
+	percpu_counter_destroy(&db->sessions);
+
+	/* In case the counters were off */
+	atomic64_sub(db->release_left, &release_backlog);
+	wkfree(struct bib, db);
+}
+
+/*
+ * The last reference is gone, which can happen while the instance mutex is held
+ * (xlator_rm(), namespace destruction), or in atomic context. So the tables
+ * are only detached here; bib_release_work() frees them later, in chunks.
+ */
+static void bib_release(struct kref *refs)
+{
+	struct bib *db;
+	unsigned int s;
+
+	db = container_of(refs, struct bib, refs);
+
+	db->release_left = percpu_counter_sum(&db->sessions);
+	for (s = 0; s < BIB_SHARDS; s++) {
+		db->release_left += db->udp[s].bib_count;
+		db->release_left += db->tcp[s].bib_count;
+		db->release_left += db->icmp[s].bib_count;
+	}
+	if (db->release_left < 0)
+		db->release_left = 0;
+	atomic64_add(db->release_left, &release_backlog);
+
+	INIT_WORK(&db->release_work, bib_release_work);
+	queue_work(release_wq, &db->release_work);
+}
+
+void bib_put(struct bib *db)
+{
+	kref_put(&db->refs, bib_release);
+}
+
+static void log_bib(struct xlator *jool, struct tabled_bib *bib,
+		enum natlog_event event)
+{
+	time64_t tsec;
+	struct tm time;
+
+	/* The block speaks for it. */
+	if (bib->in_block)
+		return;
+
+	natlog_add(jool, &bib->src6, &bib->src4, bib->proto, event);
+
+	if (!jool->globals.nat64.bib.bib_logging)
+		return;
+
+	tsec = ktime_get_real_seconds();
+	time64_to_tm(tsec, 0, &time);
+	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP " to " TA4PP " (%s)",
+			jool->iname,
+			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
+			time.tm_hour, time.tm_min, time.tm_sec,
+			(event == NATLOG_BIB_MAPPED) ? "Mapped" : "Forgot",
+			TA6PA(bib->src6), TA4PA(bib->src4),
+			l4proto_to_string(bib->proto));
+}
+
+static void log_new_bib(struct xlator *jool, struct tabled_bib *bib)
+{
+	return log_bib(jool, bib, NATLOG_BIB_MAPPED);
+}
+
+static void log_session(struct xlator *jool,
+		struct tabled_session *session,
+		char *action)
+{
+	struct ipv6_transport_addr dst6;
+	time64_t tsec;
+	struct tm time;
+
+	if (!jool->globals.nat64.bib.session_logging)
+		return;
+
+	get_dst6(jool, session, &dst6);
+
+	tsec = ktime_get_real_seconds();
+	time64_to_tm(tsec, 0, &time);
+
+	if (jool->fast.session_counters) {
+		log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP "|" TA6PP "|"
+				TA4PP "|" TA4PP "|%s|%llu packets|%llu bytes",
+				jool->iname,
+				1900 + time.tm_year, time.tm_mon + 1,
+				time.tm_mday, time.tm_hour, time.tm_min,
+				time.tm_sec, action,
+				TA6PA(session->bib->src6), TA6PA(dst6),
+				TA4PA(session->bib->src4), TA4PA(session->dst4),
+				l4proto_to_string(session->bib->proto),
+				session->packets, session->bytes);
+		return;
+	}
+
+	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP "|" TA6PP "|"
+			TA4PP "|" TA4PP "|%s", jool->iname,
+			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
+			time.tm_hour, time.tm_min, time.tm_sec, action,
+			TA6PA(session->bib->src6), TA6PA(dst6),
+			TA4PA(session->bib->src4), TA4PA(session->dst4),
+			l4proto_to_string(session->bib->proto));
+}
+
+static void log_new_session(struct xlator *jool, struct tabled_session *session)
+{
+	return log_session(jool, session, "Added session");
 }
 
-struct bib *bib_alloc(void)
+static struct port_block *block6_entry(const struct rb_node *node)
 {
-	struct bib *db;
-	bool cache_created;
-
-	cache_created = false;
-	if (!bib_cache) {
-		if (bib_setup())
-			return NULL;
-		cache_created = true;
-	}
+	return node ? rb_entry(node, struct port_block, hook6) : NULL;
+}
 
-	db = wkmalloc(struct bib, GFP_KERNEL);
-	if (!db)
-		goto db_alloc_fail;
+static struct port_block *block4_entry(const struct rb_node *node)
+{
+	return node ? rb_entry(node, struct port_block, hook4) : NULL;
+}
 
-	init_table(&db->udp, UDP_DEFAULT, 0, just_die);
-	init_table(&db->tcp, TCP_EST, TCP_TRANS, tcp_est_expire_cb);
-	init_table(&db->icmp, ICMP_DEFAULT, 0, just_die);
+static unsigned int block_last(struct port_block const *block)
+{
+	return block->first + (block->size << BIB_SHARD_BITS) - 1;
+}
 
-	db->tcp.pkt_queue = pktqueue_alloc();
-	if (!db->tcp.pkt_queue)
-		goto pktqueue_alloc_fail;
+static __u16 block_port(struct port_block const *block, unsigned int bit)
+{
+	return block->first + (bit << BIB_SHARD_BITS) + block->shard;
+}
 
-	kref_init(&db->refs);
+static unsigned int block_bit(struct port_block const *block, __u16 port)
+{
+	return (port - block->first) >> BIB_SHARD_BITS;
+}
 
-	return db;
+static int compare_block4(struct port_block const *block,
+		struct in_addr const *addr, unsigned int first)
+{
+	int gap;
 
-pktqueue_alloc_fail:
-	wkfree(struct bib, db);
-db_alloc_fail:
-	if (cache_created)
-		bib_teardown();
-	return NULL;
+	gap = ipv4_addr_cmp(&block->addr, addr);
+	if (gap)
+		return gap;
+	return (int)block->first - (int)first;
 }
 
-void bib_get(struct bib *db)
+static int compare_block6(struct port_block const *block,
+		struct in6_addr const *owner,
+		struct in_addr const *addr, unsigned int first)
 {
-	kref_get(&db->refs);
+	int gap;
+
+	gap = ipv6_addr_cmp(&block->owner, owner);
+	if (gap)
+		return gap;
+	return compare_block4(block, addr, first);
 }
 
 /**
- * Potentially includes laggy packet fetches; please do not hold spinlocks while
- * calling this function!
+ * Returns a block from @table whose range intersects @addr#@first-@last.
+ * (Blocks don't overlap, so usually there's only one.)
  */
-static void release_bib_entry(struct tabled_bib *bib)
+static struct port_block *find_overlap(struct bib_table *table,
+		struct in_addr const *addr, unsigned int first, unsigned int last)
 {
-	struct tabled_session *sessions, *tmp;
+	struct rb_node *node = table->blocks4.rb_node;
+	struct port_block *block;
+	struct port_block *prev = NULL;
+	struct port_block *next = NULL;
 
-	rbtree_foreach(sessions, tmp, &bib->sessions, tree_hook) {
-		if (sessions->stored) {
-			icmp64_send(NULL, sessions->stored,
-					ICMPERR_PORT_UNREACHABLE, 0);
-			kfree_skb(sessions->stored);
+	while (node) {
+		block = block4_entry(node);
+		if (compare_block4(block, addr, first) <= 0) {
+			prev = block;
+			node = node->rb_right;
+		} else {
+			next = block;
+			node = node->rb_left;
 		}
-		free_session(sessions);
 	}
 
-	free_bib(bib);
+	if (prev && addr4_equals(&prev->addr, addr) && first <= block_last(prev))
+		return prev;
+	if (next && addr4_equals(&next->addr, addr) && next->first <= last)
+		return next;
+	return NULL;
 }
 
-static void bib_release(struct kref *refs)
+/* Returns @owner's first block, in blocks6 order. */
+static struct port_block *first_block6(struct bib_table *table,
+		struct in6_addr const *owner)
 {
-	struct bib *db;
-	struct tabled_bib *bib, *tmp;
+	struct rb_node *node = table->blocks6.rb_node;
+	struct port_block *block;
+	struct port_block *first = NULL;
 
-	db = container_of(refs, struct bib, refs);
+	while (node) {
+		block = block6_entry(node);
+		if (ipv6_addr_cmp(&block->owner, owner) < 0) {
+			node = node->rb_right;
+		} else {
+			first = block;
+			node = node->rb_left;
+		}
+	}
 
-	/*
-	 * The trees share the entries, so only one tree of each protocol
-	 * needs to be emptied.
-	 */
-	rbtree_foreach(bib, tmp, &db->udp.tree4, hook4)
-		release_bib_entry(bib);
-	rbtree_foreach(bib, tmp, &db->tcp.tree4, hook4)
-		release_bib_entry(bib);
-	rbtree_foreach(bib, tmp, &db->icmp.tree4, hook4)
-		release_bib_entry(bib);
+	return (first && addr6_equals(&first->owner, owner)) ? first : NULL;
+}
 
-	pktqueue_release(db->tcp.pkt_queue);
+static struct port_block *next_block6(struct port_block *block)
+{
+	struct port_block *next;
 
-	wkfree(struct bib, db);
+	next = block6_entry(rb_next(&block->hook6));
+	return (next && addr6_equals(&next->owner, &block->owner)) ? next : NULL;
 }
 
-void bib_put(struct bib *db)
+static void insert_block(struct bib_table *table, struct port_block *block)
 {
-	kref_put(&db->refs, bib_release);
+	struct rb_node **node;
+	struct rb_node *parent;
+
+	node = &table->blocks6.rb_node;
+	parent = NULL;
+	while (*node) {
+		parent = *node;
+		node = (compare_block6(block6_entry(parent), &block->owner,
+				&block->addr, block->first) < 0)
+				? &parent->rb_right
+				: &parent->rb_left;
+	}
+	rb_link_node(&block->hook6, parent, node);
+	rb_insert_color(&block->hook6, &table->blocks6);
+
+	node = &table->blocks4.rb_node;
+	parent = NULL;
+	while (*node) {
+		parent = *node;
+		node = (compare_block4(block4_entry(parent), &block->addr,
+				block->first) < 0)
+				? &parent->rb_right
+				: &parent->rb_left;
+	}
+	rb_link_node(&block->hook4, parent, node);
+	rb_insert_color(&block->hook4, &table->blocks4);
+
+	list_add_tail(&block->list_hook, &table->empty_blocks);
 }
 
-static void log_bib(struct xlator *jool, struct tabled_bib *bib, char *action)
+static void free_block(struct bib_table *table, struct port_block *block)
+{
+	rb_erase(&block->hook6, &table->blocks6);
+	rb_erase(&block->hook4, &table->blocks4);
+	list_del(&block->list_hook);
+	__wkfree("port block", block);
+}
+
+static void log_block(struct xlator *jool, struct port_block *block,
+		l4_protocol proto, enum natlog_event event)
 {
 	time64_t tsec;
 	struct tm time;
 
+	natlog_add_block(jool, &block->owner, &block->addr, block->first,
+			block_last(block), proto, event);
+
 	if (!jool->globals.nat64.bib.bib_logging)
 		return;
 
 	tsec = ktime_get_real_seconds();
 	time64_to_tm(tsec, 0, &time);
-	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP " to " TA4PP " (%s)",
+	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s block %pI6c to %pI4#%u-%u (%s)",
 			jool->iname,
 			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
-			time.tm_hour, time.tm_min, time.tm_sec, action,
-			TA6PA(bib->src6), TA4PA(bib->src4),
-			l4proto_to_string(bib->proto));
+			time.tm_hour, time.tm_min, time.tm_sec,
+			(event == NATLOG_BLOCK_MAPPED) ? "Mapped" : "Forgot",
+			&block->owner, &block->addr, block->first,
+			block_last(block), l4proto_to_string(proto));
 }
 
-static void log_new_bib(struct xlator *jool, struct tabled_bib *bib)
+/* Call after adding @bib to tree4. */
+static void block_add_bib(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib)
 {
-	return log_bib(jool, bib, "Mapped");
+	struct port_block *block;
+
+	bib->in_block = false;
+	if (bib->is_static || RB_EMPTY_ROOT(&table->blocks4))
+		return;
+
+	block = find_overlap(table, &bib->src4.l3, bib->src4.l4, bib->src4.l4);
+	if (!block || !addr6_equals(&block->owner, &bib->src6.l3))
+		return;
+	if (__test_and_set_bit(block_bit(block, bib->src4.l4), block->ports))
+		return;
+
+	bib->in_block = true;
+	block->used++;
+	if (block->used == 1) {
+		list_del_init(&block->list_hook);
+		log_block(jool, block, bib->proto, NATLOG_BLOCK_MAPPED);
+	}
 }
 
-static void log_session(struct xlator *jool,
-		struct tabled_session *session,
-		char *action)
+/* Call after removing @bib from tree4. */
+static void block_rm_bib(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib)
 {
-	time64_t tsec;
-	struct tm time;
+	struct port_block *block;
 
-	if (!jool->globals.nat64.bib.session_logging)
+	if (!bib->in_block)
 		return;
 
-	tsec = ktime_get_real_seconds();
-	time64_to_tm(tsec, 0, &time);
-	log_info("%s %ld/%d/%d %d:%d:%d (GMT) - %s " TA6PP "|" TA6PP "|"
-			TA4PP "|" TA4PP "|%s", jool->iname,
-			1900 + time.tm_year, time.tm_mon + 1, time.tm_mday,
-			time.tm_hour, time.tm_min, time.tm_sec, action,
-			TA6PA(session->bib->src6), TA6PA(session->dst6),
-			TA4PA(session->bib->src4), TA4PA(session->dst4),
-			l4proto_to_string(session->bib->proto));
+	block = find_overlap(table, &bib->src4.l3, bib->src4.l4, bib->src4.l4);
+	if (WARN(!block, "BIB entry's port block is gone."))
+		return;
+
+	__clear_bit(block_bit(block, bib->src4.l4), block->ports);
+	block->used--;
+	if (!block->used) {
+		log_block(jool, block, bib->proto, NATLOG_BLOCK_FORGOT);
+		free_block(table, block);
+	}
 }
 
-static void log_new_session(struct xlator *jool, struct tabled_session *session)
+/* Frees the blocks whose reservations were not followed by entries. */
+static void reap_blocks(struct bib_table *table)
 {
-	return log_session(jool, session, "Added session");
+	struct port_block *block, *tmp;
+
+	list_for_each_entry_safe(block, tmp, &table->empty_blocks, list_hook)
+		free_block(table, block);
 }
 
 /**
@@ -568,6 +2648,46 @@ discard_probe:
 	kill_stored_pkt(jool, table, session);
 }
 
+static enum jool_lifetime_class lifetime_class(struct tabled_session *session)
+{
+	switch (session->bib->proto) {
+	case L4PROTO_TCP:
+		return (session->state == ESTABLISHED)
+				? JLIFE_TCP_EST
+				: JLIFE_TCP_TRANS;
+	case L4PROTO_UDP:
+		return JLIFE_UDP;
+	default:
+		return JLIFE_ICMP;
+	}
+}
+
+/*
+ * lifetime_stats: Records @session's durations, since it's about to be
+ * removed. If @bib_too, @session is also its BIB entry's last one, and the
+ * entry is going away with it.
+ */
+static void record_lifetimes(struct xlator *jool,
+		struct tabled_session *session,
+		bool bib_too)
+{
+	enum jool_lifetime_class class;
+	unsigned long now;
+
+	if (!jlife_enabled())
+		return;
+
+	class = lifetime_class(session);
+	now = jiffies;
+	jlife_record(jool->stats, JLIFE_LIFETIME, class,
+			now - session->create_time);
+	jlife_record(jool->stats, JLIFE_IDLE, class,
+			now - get_update_time(session));
+	if (bib_too)
+		jlife_record(jool->stats, JLIFE_PORT_HOLD, class,
+				now - session->bib->create_time);
+}
+
 static void rm(struct xlator *jool,
 		struct bib_table *table,
 		struct list_head *probes,
@@ -580,38 +2700,109 @@ static void rm(struct xlator *jool,
 		handle_probe(jool, table, probes, session, tmp);
 
 	rb_erase(&session->tree_hook, &bib->sessions);
-	list_del(&session->list_hook);
+	hash_rm_session(table, session);
+	hlist_del(&session->wheel_hook);
+	record_lifetimes(jool, session,
+			!bib->is_static && RB_EMPTY_ROOT(&bib->sessions));
+	trace_session_rm(jool, session);
 	log_session(jool, session, "Forgot session");
-	free_session(session);
-	jstat_dec(jool->stats, JSTAT_SESSIONS);
+	bib->packets += session->packets;
+	bib->bytes += session->bytes;
+	free_session_rcu(session);
+	count_sessions(jool, -1);
+	subscriber_add_sessions(bib, -1);
 
 	if (!bib->is_static && RB_EMPTY_ROOT(&bib->sessions)) {
 		rb_erase(&bib->hook6, &table->tree6);
 		rb_erase(&bib->hook4, &table->tree4);
-		log_bib(jool, bib, "Forgot");
-		free_bib(bib);
-		jstat_dec(jool->stats, JSTAT_BIB_ENTRIES);
+		port_map_rm(table, bib);
+		bib4_filter_rm(table, bib);
+		table->bib_count--;
+		block_rm_bib(jool, table, bib);
+		subscriber_uncharge(jool, bib);
+		hash_rm_bib(table, bib);
+		trace_bib_rm(jool, bib);
+		log_bib(jool, bib, NATLOG_BIB_FORGOT);
+		free_bib_rcu(bib);
+		count_bibs(jool, -1);
+	}
+}
+
+/**
+ * Returns the slot @expires belongs to in level @lvl.
+ * (Rounds up, so the slot never expires before @expires.)
+ */
+static unsigned int wheel_index(unsigned long expires, unsigned int lvl)
+{
+	expires = (expires + WHEEL_LVL_GRAN(lvl) - 1) >> WHEEL_LVL_SHIFT(lvl);
+	return lvl * WHEEL_LVL_SIZE + (expires & WHEEL_LVL_MASK);
+}
+
+/**
+ * Schedules @session's expiration to jiffy @expires. @session must not already
+ * be in the wheel.
+ */
+static void wheel_add(struct session_wheel *wheel,
+		struct tabled_session *session,
+		unsigned long expires)
+{
+	unsigned long delta;
+	unsigned int lvl;
+
+	if (time_before(expires, wheel->clk))
+		expires = wheel->clk;
+	delta = expires - wheel->clk;
+	if (delta > WHEEL_MAX_DELTA) {
+		delta = WHEEL_MAX_DELTA;
+		expires = wheel->clk + delta;
 	}
+
+	for (lvl = 0; lvl < WHEEL_LEVELS - 1; lvl++)
+		if (delta < WHEEL_LVL_START(lvl + 1))
+			break;
+
+	hlist_add_head(&session->wheel_hook,
+			&wheel->slots[wheel_index(expires, lvl)]);
+}
+
+/**
+ * Assigns @expirer to @session, and schedules it accordingly. @session must not
+ * already be in the wheel.
+ */
+static void schedule_session(struct xlator *jool,
+		struct bib_table *table,
+		struct tabled_session *session,
+		struct expire_timer *expirer)
+{
+	session->expirer = expirer;
+	wheel_add(&table->wheel, session, session->update_time
+			+ get_session_timeout(jool, session));
 }
 
-static void handle_fate_timer(struct tabled_session *session,
+static void handle_fate_timer(struct xlator *jool,
+		struct bib_table *table,
+		struct tabled_session *session,
 		struct expire_timer *timer)
 {
 	session->update_time = jiffies;
-	session->expirer = timer;
-	list_del(&session->list_hook);
-	list_add_tail(&session->list_hook, &timer->sessions);
+	/*
+	 * Same timer means the session expires later than it's scheduled to.
+	 * That's fine; the cleaner will notice and reschedule it.
+	 */
+	if (session->expirer == timer)
+		return;
+
+	hlist_del(&session->wheel_hook);
+	schedule_session(jool, table, session, timer);
 }
 
-static int queue_unsorted_session(struct bib_table *table,
+static int queue_unsorted_session(struct xlator *jool,
+		struct bib_table *table,
 		struct tabled_session *session,
 		session_timer_type timer_type,
 		bool remove_first)
 {
 	struct expire_timer *expirer;
-	struct list_head *list;
-	struct list_head *cursor;
-	struct tabled_session *old;
 
 	switch (timer_type) {
 	case SESSION_TIMER_EST:
@@ -629,17 +2820,9 @@ static int queue_unsorted_session(struct bib_table *table,
 		return -EINVAL;
 	}
 
-	list = &expirer->sessions;
-	for (cursor = list->prev; cursor != list; cursor = cursor->prev) {
-		old = list_entry(cursor, struct tabled_session, list_hook);
-		if (old->update_time < session->update_time)
-			break;
-	}
-
 	if (remove_first)
-		list_del(&session->list_hook);
-	list_add(&session->list_hook, cursor);
-	session->expirer = expirer;
+		hlist_del(&session->wheel_hook);
+	schedule_session(jool, table, session, expirer);
 	return 0;
 }
 
@@ -674,7 +2857,7 @@ static bool decide_fate(struct xlator *jool,
 
 	switch (fate) {
 	case FATE_TIMER_EST:
-		handle_fate_timer(session, &table->est_timer);
+		handle_fate_timer(jool, table, session, &table->est_timer);
 		break;
 
 	case FATE_PROBE:
@@ -683,15 +2866,18 @@ static bool decide_fate(struct xlator *jool,
 		 * TRANS.
 		 */
 		handle_probe(jool, table, probes, session, &tmp);
-		handle_fate_timer(session, &table->trans_timer);
+		handle_fate_timer(jool, table, session, &table->trans_timer);
 		break;
 
 	case FATE_TIMER_TRANS:
-		handle_fate_timer(session, &table->trans_timer);
+		handle_fate_timer(jool, table, session, &table->trans_timer);
 		break;
 
 	case FATE_RM:
 		rm(jool, table, probes, session, &tmp);
+		/* Only the cleaner collects probes; the rest are collisions. */
+		if (probes)
+			jstat_inc(jool->stats, JSTAT_SESSIONS_EXPIRED);
 		break;
 
 	case FATE_PRESERVE:
@@ -705,13 +2891,40 @@ static bool decide_fate(struct xlator *jool,
 		 * If timer type was invalid, well don't change the expirer.
 		 * We left a warning in the log.
 		 */
-		queue_unsorted_session(table, session, tmp.timer_type, true);
+		queue_unsorted_session(jool, table, session, tmp.timer_type,
+				true);
 		break;
 	}
 
 	return true;
 }
 
+/*
+ * decide_fate(), for a TCP packet of an existing session.
+ *
+ * Segments without SYN, FIN or RST cannot move an ESTABLISHED session out of
+ * ESTABLISHED, so they skip the state machine (and the session copy it needs),
+ * and merely reset the established timer. Most of them don't even get here;
+ * these are the ones the lockless path could not refresh. (eg. the session was
+ * still attached to another timer.)
+ */
+static bool decide_tcp_fate(struct xlation *state, struct collision_cb *cb,
+		struct bib_table *table, struct tabled_session *session)
+{
+	struct tcphdr const *hdr;
+
+	if (session->state == ESTABLISHED) {
+		hdr = pkt_tcp_hdr(&state->in);
+		if (!hdr->syn && !hdr->fin && !hdr->rst) {
+			handle_fate_timer(state->jool, table, session,
+					&table->est_timer);
+			return true;
+		}
+	}
+
+	return decide_fate(state->jool, cb, table, session, NULL);
+}
+
 /**
  * send_probe_packet - Sends a probe packet to @session's IPv6 endpoint,
  * to trigger a confirmation ACK if the connection is still alive.
@@ -777,7 +2990,6 @@ static void send_probe_packet(struct xlator *jool, struct session_entry *session
 	th->check = 0;
 	th->urg_ptr = 0;
 
-	/* TODO (performance) can't we just defer this to somebody else? */
 	th->check = csum_ipv6_magic(&iph->saddr, &iph->daddr, l4_hdr_len,
 			IPPROTO_TCP, csum_partial(th, l4_hdr_len, 0));
 	skb->ip_summed = CHECKSUM_UNNECESSARY;
@@ -794,70 +3006,310 @@ static void send_probe_packet(struct xlator *jool, struct session_entry *session
 	if (!dst)
 		goto revert;
 
-	skb_dst_set(skb, dst);
+	skb_dst_set(skb, dst);
+
+	/* Implicit kfree_skb(skb) here. */
+	error = dst_output(jool->ns, NULL, skb);
+	if (error) {
+		__log_debug(jool, "dst_output() returned errcode %d.", error);
+		goto fail;
+	}
+
+	return;
+
+revert:
+	kfree_skb(skb);
+fail:
+	__log_debug(jool, "A TCP connection will probably break.");
+}
+
+/**
+ * Sends all the probes and ICMP errors listed in @probes.
+ */
+static void post_fate(struct xlator *jool, struct list_head *probes)
+{
+	struct probing_session *probe;
+	struct probing_session *tmp;
+
+	list_for_each_entry_safe(probe, tmp, probes, list_hook) {
+		if (probe->skb) {
+			/* The "probe" is not a probe; it's an ICMP error. */
+			icmp64_send(jool, probe->skb, ICMPERR_PORT_UNREACHABLE,
+					0);
+			kfree_skb(probe->skb);
+		} else {
+			/* Actual TCP probe. */
+			send_probe_packet(jool, &probe->session);
+		}
+		wkfree(struct probing_session, probe);
+	}
+}
+
+static void xmit_work_fn(struct work_struct *work)
+{
+	struct deferred_xmit *xmit;
+
+	xmit = container_of(work, struct deferred_xmit, work);
+	post_fate(&xmit->jool, &xmit->probes);
+	pktqueue_clean(&xmit->icmps);
+
+	put_net(xmit->jool.ns);
+	xlator_put(&xmit->jool);
+	wkfree(struct deferred_xmit, xmit);
+}
+
+/**
+ * Queues the sending of @probes and @icmps (see post_fate() and
+ * pktqueue_clean()) to xmit_wq.
+ * Sends them right away if that's not possible.
+ */
+static void defer_xmit(struct xlator *jool, struct list_head *probes,
+		struct list_head *icmps)
+{
+	struct deferred_xmit *xmit;
+
+	if (list_empty(probes) && list_empty(icmps))
+		return;
+
+	xmit = wkmalloc(struct deferred_xmit, GFP_ATOMIC);
+	if (!xmit)
+		goto send_now;
+	/* The namespace might be dying; see the note in struct xlator. */
+	if (!maybe_get_net(jool->ns)) {
+		wkfree(struct deferred_xmit, xmit);
+		goto send_now;
+	}
+
+	memcpy(&xmit->jool, jool, sizeof(*jool));
+	xlator_get(&xmit->jool);
+	INIT_LIST_HEAD(&xmit->probes);
+	list_splice(probes, &xmit->probes);
+	INIT_LIST_HEAD(&xmit->icmps);
+	list_splice(icmps, &xmit->icmps);
+	INIT_WORK(&xmit->work, xmit_work_fn);
+	queue_work(xmit_wq, &xmit->work);
+	return;
+
+send_now:
+	post_fate(jool, probes);
+	pktqueue_clean(icmps);
+}
+
+struct slot_group {
+	struct tree_slot bib6;
+	struct tree_slot bib4;
+	struct tree_slot session;
+};
+
+static void commit_bib_add(struct xlator *jool, struct bib_table *table,
+		struct slot_group *slots, struct tabled_bib *bib)
+{
+	bib->generation = READ_ONCE(jool->nat64.bib->generation);
+	bib4_filter_add(table, bib);
+	treeslot_commit(&slots->bib6);
+	treeslot_commit(&slots->bib4);
+	port_map_add(table, bib);
+	table->bib_count++;
+	block_add_bib(jool, table, bib);
+	hash_add_bib(table, bib);
+	count_bibs(jool, 1);
+	trace_bib_add(jool, bib);
+}
+
+/* Assumes @session->bib has already been set. */
+/* Computes session_entry.csum. @session->bib has to be set already. */
+static __wsum compute_csum(struct xlator *jool, struct tabled_session *session)
+{
+	struct ipv6_transport_addr dst6;
+	__wsum csum6;
+
+	get_dst6(jool, session, &dst6);
+	csum6 = ~csum_unfold(csum_ipv6_magic(&session->bib->src6.l3, &dst6.l3,
+			0, 0, 0));
+	return csum_sub(csum_tcpudp_nofold(session->bib->src4.l3.s_addr,
+			session->dst4.l3.s_addr, 0, 0, 0), csum6);
+}
+
+/*
+ * Session cap. (max-sessions)
+ *
+ * Once the instance holds max-sessions sessions, each new one first evicts an
+ * old one. The victim is the least recently used of the first few sessions due
+ * to expire (as per the expiration wheel), so it's normally an idle one. UDP,
+ * ICMP and transitory TCP sessions go first; established TCP connections are
+ * only evicted when the table has nothing else to give.
+ *
+ * The counter is approximate (per-CPU batches), and the eviction happens before
+ * the new session is known to be needed, so the cap is soft: It can be
+ * overshot by about a batch per CPU.
+ */
+
+/* Sessions pick_victim() compares. */
+#define EVICT_CANDIDATES 8
+/* Sessions pick_victim() is willing to look at. */
+#define EVICT_SCAN_MAX 64
+
+struct victim_search {
+	struct bib_table *table;
+	/* Skip the table's established sessions? */
+	bool spare_est;
+	struct tabled_session *victim;
+	unsigned int candidates;
+	unsigned int scanned;
+};
+
+/* Returns true once the search is over. */
+static bool consider_victim(struct victim_search *search,
+		struct tabled_session *session)
+{
+	if (++search->scanned > EVICT_SCAN_MAX)
+		return true;
+	if (search->spare_est && session->expirer == &search->table->est_timer)
+		return false;
 
-	/* Implicit kfree_skb(skb) here. */
-	error = dst_output(jool->ns, NULL, skb);
-	if (error) {
-		__log_debug(jool, "dst_output() returned errcode %d.", error);
-		goto fail;
+	if (!search->victim || time_before(get_update_time(session),
+			get_update_time(search->victim)))
+		search->victim = session;
+	return ++search->candidates >= EVICT_CANDIDATES;
+}
+
+/* Walks @table's wheel in (roughly) expiration order. */
+static struct tabled_session *pick_victim(struct bib_table *table,
+		bool spare_est)
+{
+	struct victim_search search = { .table = table, .spare_est = spare_est };
+	struct session_wheel *wheel = &table->wheel;
+	struct tabled_session *session;
+	unsigned int lvl, base, i;
+
+	/* Already due; the cleaner just hasn't visited them yet. */
+	hlist_for_each_entry(session, &wheel->expired, wheel_hook)
+		if (consider_victim(&search, session))
+			return search.victim;
+
+	for (lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+		base = wheel_index(wheel->clk, lvl) - lvl * WHEEL_LVL_SIZE;
+		for (i = 0; i < WHEEL_LVL_SIZE; i++) {
+			hlist_for_each_entry(session, &wheel->slots[lvl
+					* WHEEL_LVL_SIZE
+					+ ((base + i) & WHEEL_LVL_MASK)],
+					wheel_hook)
+				if (consider_victim(&search, session))
+					return search.victim;
+		}
 	}
 
-	return;
+	return search.victim;
+}
 
-revert:
-	kfree_skb(skb);
-fail:
-	__log_debug(jool, "A TCP connection will probably break.");
+/* Assumes @table is locked. */
+static bool evict(struct xlator *jool, struct bib_table *table,
+		bool spare_est)
+{
+	struct tabled_session *victim;
+
+	victim = pick_victim(table, spare_est);
+	if (!victim)
+		return false;
+
+	/* rm() would want to ICMP error it, which needs a probe list. */
+	kill_stored_pkt(jool, table, victim);
+	rm(jool, table, NULL, victim, NULL);
+	jstat_inc(jool->stats, JSTAT_SESSION_EVICTED);
+	return true;
 }
 
-/**
- * Sends all the probes and ICMP errors listed in @probes.
+/*
+ * Same as evict(), for a table other than the one the caller holds. Gives up
+ * if it's busy, since the caller's lock is already taken.
  */
-static void post_fate(struct xlator *jool, struct list_head *probes)
+static bool evict_other(struct xlator *jool, struct bib_table *table,
+		bool spare_est)
 {
-	struct probing_session *probe;
-	struct probing_session *tmp;
+	bool evicted;
 
-	list_for_each_entry_safe(probe, tmp, probes, list_hook) {
-		if (probe->skb) {
-			/* The "probe" is not a probe; it's an ICMP error. */
-			icmp64_send(jool, probe->skb, ICMPERR_PORT_UNREACHABLE,
-					0);
-			kfree_skb(probe->skb);
-		} else {
-			/* Actual TCP probe. */
-			send_probe_packet(jool, &probe->session);
-		}
-		wkfree(struct probing_session, probe);
-	}
-}
+	if (!jlock_trylock(&table->lock))
+		return false;
+	evicted = evict(jool, table, spare_est);
+	jlock_unlock(&table->lock);
 
-struct slot_group {
-	struct tree_slot bib6;
-	struct tree_slot bib4;
-	struct tree_slot session;
-};
+	return evicted;
+}
 
-static void commit_bib_add(struct xlator *jool, struct slot_group *slots)
+/*
+ * Enforces max-sessions, on behalf of a session that's about to be added to
+ * @table. Call right after locking @table, before computing any tree slots;
+ * the eviction might modify the trees.
+ */
+static void make_room(struct xlator *jool, struct bib_table *table)
 {
-	treeslot_commit(&slots->bib6);
-	treeslot_commit(&slots->bib4);
-	jstat_inc(jool->stats, JSTAT_BIB_ENTRIES);
+	struct bib *db = jool->nat64.bib;
+	__u32 max = XGLOBALS(jool).max_sessions;
+	l4_protocol proto;
+	unsigned int shard;
+
+	if (!max || percpu_counter_read_positive(&db->sessions) < max)
+		return;
+
+	proto = table->est_timer.proto;
+	shard = table - get_table(db, proto);
+
+	switch (proto) {
+	case L4PROTO_TCP:
+		if (evict(jool, table, true))
+			return;
+		if (evict_other(jool, &db->udp[shard], false))
+			return;
+		if (evict_other(jool, &db->icmp[shard], false))
+			return;
+		/* Last resort. */
+		if (evict(jool, table, false))
+			return;
+		break;
+	case L4PROTO_UDP:
+		if (evict(jool, table, false))
+			return;
+		if (evict_other(jool, &db->icmp[shard], false))
+			return;
+		if (evict_other(jool, &db->tcp[shard], true))
+			return;
+		break;
+	case L4PROTO_ICMP:
+		if (evict(jool, table, false))
+			return;
+		if (evict_other(jool, &db->udp[shard], false))
+			return;
+		if (evict_other(jool, &db->tcp[shard], true))
+			return;
+		break;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	jstat_inc(jool->stats, JSTAT_SESSION_EVICT_FAILED);
 }
 
-static void commit_session_add(struct xlator *jool, struct tree_slot *slot)
+static void commit_session_add(struct xlator *jool, struct bib_table *table,
+		struct tree_slot *slot, struct tabled_session *session)
 {
+	session->csum = compute_csum(jool, session);
+	session->create_time = jiffies;
 	treeslot_commit(slot);
-	jstat_inc(jool->stats, JSTAT_SESSIONS);
+	hash_add_session(table, session);
+	count_sessions(jool, 1);
+	subscriber_add_sessions(session->bib, 1);
+	talkers_add(jool, &session->bib->src6.l3, JTALK_SESSIONS, 1);
+	trace_session_add(jool, session);
 }
 
-static void attach_timer(struct tabled_session *session,
+static void attach_timer(struct xlator *jool,
+		struct bib_table *table,
+		struct tabled_session *session,
 		struct expire_timer *expirer)
 {
 	session->update_time = jiffies;
-	session->expirer = expirer;
-	list_add_tail(&session->list_hook, &expirer->sessions);
+	session->refresh_time = session->update_time;
+	schedule_session(jool, table, session, expirer);
 }
 
 static int compare_src6(struct tabled_bib *a, struct ipv6_transport_addr *b)
@@ -886,9 +3338,21 @@ static int compare_dst4(struct tabled_session *a, struct tabled_session *b)
 	return taddr4_compare(&a->dst4, &b->dst4);
 }
 
+static int compare_dst4_addr(struct tabled_session *a,
+		struct ipv4_transport_addr *b)
+{
+	return taddr4_compare(&a->dst4, b);
+}
+
 static struct tabled_bib *find_bib6(struct bib_table *table,
 		struct ipv6_transport_addr *addr)
 {
+	struct tabled_bib *bib;
+
+	bib = hash_find_bib6(table, addr);
+	if (bib)
+		return bib;
+
 	return rbtree_find(addr, &table->tree6, compare_src6, struct tabled_bib,
 			hook6);
 }
@@ -896,6 +3360,12 @@ static struct tabled_bib *find_bib6(struct bib_table *table,
 static struct tabled_bib *find_bib4(struct bib_table *table,
 		struct ipv4_transport_addr *addr)
 {
+	struct tabled_bib *bib;
+
+	bib = hash_find_bib4(table, addr);
+	if (bib)
+		return bib;
+
 	return rbtree_find(addr, &table->tree4, compare_src4, struct tabled_bib,
 			hook4);
 }
@@ -978,11 +3448,11 @@ static struct tabled_session *find_session_slot(struct tabled_bib *bib,
 
 static int alloc_bib_session(struct bib_session_tuple *tuple)
 {
-	tuple->bib = alloc_bib(GFP_ATOMIC);
+	tuple->bib = alloc_bib();
 	if (!tuple->bib)
 		return -ENOMEM;
 
-	tuple->session = alloc_session(GFP_ATOMIC);
+	tuple->session = alloc_session();
 	if (!tuple->session) {
 		free_bib(tuple->bib);
 		return -ENOMEM;
@@ -1016,9 +3486,11 @@ static int create_bib_session6(struct bib_session_tuple *tuple,
 	tuple->bib->proto = tuple6->l4_proto;
 	tuple->bib->is_static = false;
 	tuple->bib->sessions = RB_ROOT;
-	tuple->session->dst6 = tuple6->dst.addr6;
+	tuple->session->dst6_l4 = tuple6->dst.addr6.l4;
 	tuple->session->dst4 = *dst4;
+	tuple->session->pool6_index = 0; /* See commit_add6(). */
 	tuple->session->state = state;
+	tuple->session->refresh_time = 0;
 	tuple->session->stored = NULL;
 	return 0;
 }
@@ -1029,7 +3501,7 @@ static struct tabled_session *create_session4(struct tuple *tuple4,
 {
 	struct tabled_session *session;
 
-	session = alloc_session(GFP_ATOMIC);
+	session = alloc_session();
 	if (!session)
 		return NULL;
 
@@ -1037,21 +3509,20 @@ static struct tabled_session *create_session4(struct tuple *tuple4,
 	 * Hooks, expirer fields and session->bib are left uninitialized since
 	 * they depend on database knowledge.
 	 */
-	session->dst6 = *dst6;
+	session->dst6_l4 = dst6->l4;
 	session->dst4 = tuple4->src.addr4;
+	session->pool6_index = 0;
 	session->state = state;
+	session->refresh_time = 0;
 	session->stored = NULL;
 	return session;
 }
 
-static int create_bib_session(struct session_entry *session,
+static void init_bib_session(struct xlator *jool,
+		struct session_entry *session,
 		struct bib_session_tuple *tuple)
 {
-	int error;
-
-	error = alloc_bib_session(tuple);
-	if (error)
-		return error;
+	int pool6_index;
 
 	/*
 	 * Hooks, most expirer fields and session->bib are left uninitialized
@@ -1062,11 +3533,27 @@ static int create_bib_session(struct session_entry *session,
 	tuple->bib->proto = session->proto;
 	tuple->bib->is_static = false;
 	tuple->bib->sessions = RB_ROOT;
-	tuple->session->dst6 = session->dst6;
+	tuple->session->dst6_l4 = session->dst6.l4;
 	tuple->session->dst4 = session->dst4;
+	pool6_index = xlator_pool6_find(jool, &session->dst6.l3);
+	tuple->session->pool6_index = (pool6_index > 0) ? pool6_index : 0;
 	tuple->session->state = session->state;
 	tuple->session->update_time = session->update_time;
+	tuple->session->refresh_time = session->update_time;
 	tuple->session->stored = NULL;
+}
+
+static int create_bib_session(struct xlator *jool,
+		struct session_entry *session,
+		struct bib_session_tuple *tuple)
+{
+	int error;
+
+	error = alloc_bib_session(tuple);
+	if (error)
+		return error;
+
+	init_bib_session(jool, session, tuple);
 	return 0;
 }
 
@@ -1078,21 +3565,28 @@ static int create_bib_session(struct session_entry *session,
  * supposed to be added.
  */
 static void commit_add6(struct xlation *state,
+		struct bib_table *table,
 		struct bib_session_tuple *old,
 		struct bib_session_tuple *new,
 		struct slot_group *slots,
 		struct expire_timer *expirer)
 {
+	/* Before the session; sessions are charged to their BIB's subscriber. */
+	if (!old->bib)
+		subscriber_charge(state->jool, new->bib);
+
 	new->session->bib = old->bib ? : new->bib;
-	commit_session_add(&state->jool, &slots->session);
-	attach_timer(new->session, expirer);
-	log_new_session(&state->jool, new->session);
+	new->session->pool6_index = state->pool6_index;
+	commit_session_add(state->jool, table, &slots->session, new->session);
+	classify_session(state->jool, table, new->session);
+	attach_timer(state->jool, table, new->session, expirer);
+	log_new_session(state->jool, new->session);
 	tstobs(state, new->session);
 	new->session = NULL; /* Do not free! */
 
 	if (!old->bib) {
-		commit_bib_add(&state->jool, slots);
-		log_new_bib(&state->jool, new->bib);
+		commit_bib_add(state->jool, table, slots, new->bib);
+		log_new_bib(state->jool, new->bib);
 		new->bib = NULL; /* Do not free! */
 	}
 }
@@ -1105,6 +3599,7 @@ static void commit_add6(struct xlation *state,
  * supposed to be added.
  */
 static void commit_add4(struct xlation *state,
+		struct bib_table *table,
 		struct bib_session_tuple *old,
 		struct tabled_session **new,
 		struct tree_slot *slot,
@@ -1113,9 +3608,10 @@ static void commit_add4(struct xlation *state,
 	struct tabled_session *session = *new;
 
 	session->bib = old->bib;
-	commit_session_add(&state->jool, slot);
-	attach_timer(session, expirer);
-	log_new_session(&state->jool, session);
+	commit_session_add(state->jool, table, slot, session);
+	classify_session(state->jool, table, session);
+	attach_timer(state->jool, table, session, expirer);
+	log_new_session(state->jool, session);
 	tstobs(state, session);
 	*new = NULL; /* Do not free! */
 }
@@ -1136,116 +3632,478 @@ static int commit_add(struct xlator *jool,
 {
 	int error;
 
-	error = queue_unsorted_session(table, new->session, timer_type, false);
+	classify_session(jool, table, new->session);
+	error = queue_unsorted_session(jool, table, new->session, timer_type,
+			false);
 	if (error)
 		return error;
 
 	new->session->bib = old->bib ? : new->bib;
-	commit_session_add(jool, &slots->session);
+	commit_session_add(jool, table, &slots->session, new->session);
 	log_new_session(jool, new->session);
 	new->session = NULL; /* Do not free! */
 
 	if (!old->bib) {
-		commit_bib_add(jool, slots);
+		commit_bib_add(jool, table, slots, new->bib);
 		log_new_bib(jool, new->bib);
 		new->bib = NULL; /* Do not free! */
 	}
 
-	return 0;
+	return 0;
+}
+
+static int detach_sessions(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib)
+{
+	struct tabled_session *session, *tmp;
+	int detached = 0;
+
+	rbtree_foreach(session, tmp, &bib->sessions, tree_hook) {
+		/* They all die with the entry; count its port hold once. */
+		record_lifetimes(jool, session,
+				!bib->is_static && !detached);
+		trace_session_rm(jool, session);
+		hash_rm_session(table, session);
+		hlist_del(&session->wheel_hook);
+		if (session->stored)
+			table->pkt_count--;
+		detached--;
+	}
+
+	return detached;
+}
+
+static void detach_bib(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib)
+{
+	int detached;
+
+	rb_erase(&bib->hook6, &table->tree6);
+	rb_erase(&bib->hook4, &table->tree4);
+	port_map_rm(table, bib);
+	bib4_filter_rm(table, bib);
+	table->bib_count--;
+	block_rm_bib(jool, table, bib);
+	hash_rm_bib(table, bib);
+	count_bibs(jool, -1);
+	trace_bib_rm(jool, bib);
+	/* NOTE THAT detach_sessions() RETURNS NEGATIVE. */
+	detached = detach_sessions(jool, table, bib);
+	count_sessions(jool, detached);
+	subscriber_add_sessions(bib, detached);
+	subscriber_uncharge(jool, bib);
+}
+
+/*
+ * Detached BIB entries, chained through their RCU heads.
+ * (Not their tree hooks, because lockless readers might still be traversing
+ * them.)
+ */
+struct bib_delete_list {
+	struct tabled_bib *first;
+};
+
+static void add_to_delete_list(struct bib_delete_list *bdl,
+		struct tabled_bib *bib)
+{
+	bib->rcu.next = bdl->first ? &bdl->first->rcu : NULL;
+	bdl->first = bib;
+}
+
+static void commit_delete_list(struct bib_delete_list *list)
+{
+	struct tabled_bib *bib;
+	struct tabled_bib *next;
+
+	for (bib = list->first; bib; bib = next) {
+		next = bib->rcu.next
+				? container_of(bib->rcu.next, struct tabled_bib, rcu)
+				: NULL;
+		release_bib_entry(bib);
+	}
+}
+
+/**
+ * Tests whether @predecessor's immediate succesor tree slot is a suitable
+ * placeholder for @bib. Returns the colliding node.
+ *
+ * (That is, returns NULL on success, a collision on failure.)
+ *
+ * In other words:
+ * Assumes that @predecessor belongs to @table's v4 tree and that it is @bib's
+ * predecessor. (ie. @predecessor's transport address is @bib's transport
+ * address - 1.) You want to test whether @bib can be inserted to the tree.
+ * If @predecessor's succesor collides with @bib (ie. it has @bib's v4 address),
+ * it returns the colliding succesor.
+ * If @predecessor's succesor does not collide with @bib, it returns NULL and
+ * initializes @slot so you can actually add @bib to the tree.
+ */
+static struct tabled_bib *try_next(struct bib_table *table,
+		struct tabled_bib *predecessor,
+		struct tabled_bib *bib,
+		struct tree_slot *slot)
+{
+	struct tabled_bib *next;
+
+	next = bib4_entry(rb_next(&predecessor->hook4));
+	if (!next) {
+		/* There is no succesor and therefore no collision. */
+		slot->tree = &table->tree4;
+		slot->entry = &bib->hook4;
+		slot->parent = &predecessor->hook4;
+		slot->rb_link = &slot->parent->rb_right;
+		return NULL;
+	}
+
+	if (taddr4_equals(&next->src4, &bib->src4))
+		return next; /* Next is yet another collision. */
+
+	slot->tree = &table->tree4;
+	slot->entry = &bib->hook4;
+	if (predecessor->hook4.rb_right) {
+		slot->parent = &next->hook4;
+		slot->rb_link = &slot->parent->rb_left;
+	} else {
+		slot->parent = &predecessor->hook4;
+		slot->rb_link = &slot->parent->rb_right;
+	}
+	return NULL;
+}
+
+/*
+ * cluster-nodes: The port space is dealt out to the nodes round-robin, in
+ * CLUSTER_BLOCK_PORTS-sized blocks. Does this node own @port?
+ * (Always, if the partitioning is disabled.)
+ */
+static bool cluster_owns(struct bib_config const *cfg, unsigned int port)
+{
+	if (cfg->cluster_nodes < 2)
+		return true;
+	return ((port >> CLUSTER_BLOCK_BITS) % cfg->cluster_nodes)
+			== cfg->cluster_node;
+}
+
+/*
+ * Does this node own all of [@first, @last]? Two consecutive blocks never
+ * belong to the same node, so the range has to fit in one.
+ */
+static bool cluster_owns_range(struct bib_config const *cfg,
+		unsigned int first, unsigned int last)
+{
+	if (cfg->cluster_nodes < 2)
+		return true;
+	return ((first >> CLUSTER_BLOCK_BITS) == (last >> CLUSTER_BLOCK_BITS))
+			&& cluster_owns(cfg, first);
+}
+
+/*
+ * First port after @port's block that starts a block this node owns.
+ * Might exceed 65535. Only meaningful if the partitioning is enabled.
+ */
+static unsigned int cluster_next(struct bib_config const *cfg,
+		unsigned int port)
+{
+	unsigned int nodes = cfg->cluster_nodes;
+	unsigned int block;
+
+	if (cfg->cluster_node >= nodes)
+		return 65536; /* Owns nothing. */
+
+	block = (port >> CLUSTER_BLOCK_BITS) + 1;
+	block += (cfg->cluster_node + nodes - (block % nodes)) % nodes;
+	return block << CLUSTER_BLOCK_BITS;
+}
+
+/*
+ * Tries to allocate @bib's mask from @block. Only ports that are still in
+ * @masks qualify. (pool4 might have changed since the block was reserved.)
+ */
+static int block_find_mask(struct bib_table *table,
+		struct mask_domain *masks,
+		struct port_block *block,
+		struct tabled_bib *bib,
+		struct tree_slot *slot)
+{
+	unsigned int bit;
+
+	for_each_clear_bit(bit, block->ports, block->size) {
+		bib->src4.l3 = block->addr;
+		bib->src4.l4 = block_port(block, bit);
+		if (!mask_domain_matches(masks, &bib->src4))
+			continue;
+		/* Non-block entries (eg. static ones) can still get in the way. */
+		if (!find_bibtree4_slot(table, bib, slot))
+			return 0;
+	}
+
+	return -ENOENT;
+}
+
+struct block_reservation {
+	struct bib_table *table;
+	struct bib_config const *cfg;
+	struct in6_addr const *owner;
+	unsigned int size;
+	unsigned int shard;
+	/* Output */
+	struct port_block *block;
+};
+
+/*
+ * First-fit: Reserves the first free block that fits entirely in @range.
+ * A block is free if it overlaps no other block, and none of its ports are
+ * already taken. In cluster mode, it also has to fit in one of this node's
+ * partition blocks.
+ */
+static int reserve_block_cb(struct ipv4_range const *range, void *arg)
+{
+	struct block_reservation *res = arg;
+	struct in_addr const *addr = &range->prefix.addr;
+	struct port_map *map = NULL;
+	struct port_block *overlap;
+	struct port_block *block;
+	unsigned int span;
+	unsigned int first;
+	unsigned int last;
+	unsigned int bit;
+
+	span = res->size << BIB_SHARD_BITS;
+	first = round_up((unsigned int)range->ports.min, BIB_SHARDS);
+
+	while (first + span - 1 <= range->ports.max) {
+		last = first + span - 1;
+
+		if (!cluster_owns_range(res->cfg, first, last)) {
+			first = round_up(cluster_next(res->cfg, first),
+					BIB_SHARDS);
+			continue;
+		}
+
+		overlap = find_overlap(res->table, addr, first, last);
+		if (overlap) {
+			first = block_last(overlap) + 1;
+			continue;
+		}
+
+		if (!map) {
+			map = get_port_map(res->table, addr);
+			if (!map)
+				return -ENOMEM;
+		}
+		bit = find_next_bit(map->ports, port2bit(last) + 1,
+				port2bit(first));
+		if (bit <= port2bit(last)) {
+			first = (bit + 1) << BIB_SHARD_BITS;
+			continue;
+		}
+
+		block = __wkmalloc("port block", sizeof(struct port_block)
+				+ BITS_TO_LONGS(res->size) * sizeof(unsigned long),
+				GFP_ATOMIC);
+		if (!block)
+			return -ENOMEM;
+		block->owner = *res->owner;
+		block->addr = *addr;
+		block->first = first;
+		block->size = res->size;
+		block->shard = res->shard;
+		block->used = 0;
+		bitmap_zero(block->ports, res->size);
+		insert_block(res->table, block);
+
+		res->block = block;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * find_available_mask(), port-block-size version.
+ *
+ * Allocates @bib's mask from one of its IPv6 address's blocks, reserving a new
+ * one if they're all full. Does not iterate @masks the RFC 6056 way, so the
+ * iteration limits don't apply.
+ */
+static int find_block_mask(struct bib_table *table,
+		struct bib_config const *cfg,
+		struct mask_domain *masks,
+		struct tabled_bib *bib,
+		struct tree_slot *slot,
+		unsigned int size)
+{
+	struct block_reservation res;
+	struct port_block *block;
+	int error;
+
+	for (block = first_block6(table, &bib->src6.l3);
+			block;
+			block = next_block6(block)) {
+		if (block->used < block->size
+				&& !block_find_mask(table, masks, block, bib, slot))
+			return 0;
+	}
+
+	res.table = table;
+	res.cfg = cfg;
+	res.owner = &bib->src6.l3;
+	res.size = size;
+	res.shard = bib->src6.l4 & BIB_SHARD_MASK;
+	res.block = NULL;
+	error = mask_domain_foreach_range(masks, reserve_block_cb, &res);
+	if (error < 0)
+		return error;
+	if (!res.block)
+		return -ENOENT;
+
+	return block_find_mask(table, masks, res.block, bib, slot);
 }
 
-static int detach_sessions(struct bib_table *table, struct tabled_bib *bib)
+/*
+ * Returns the port-block-size the allocation should use. (Zero if blocks are
+ * disabled.) A shard only has PORT_MAP_BITS ports, so that's the maximum.
+ */
+static unsigned int get_block_size(struct xlator *jool)
 {
-	struct tabled_session *session, *tmp;
-	int detached = 0;
+	return min(XGLOBALS(jool).port_block_size, PORT_MAP_BITS);
+}
 
-	rbtree_foreach(session, tmp, &bib->sessions, tree_hook) {
-		list_del(&session->list_hook);
-		if (session->stored)
-			table->pkt_count--;
-		detached--;
+/*
+ * Size of the indirection table rss_matches() assumes. It's the most common
+ * one; for power-of-two queue counts, the table size doesn't matter anyway.
+ */
+#define RSS_INDIR_SIZE 128
+/*
+ * Free masks find_available_mask() is willing to reject for the sake of
+ * rss-queues, per queue. (A random mask matches with probability 1/queues.)
+ */
+#define RSS_MISSES_PER_QUEUE 4
+
+/* Toeplitz hash of @input, using @rss_key. */
+static __u32 toeplitz(__u8 const *input, unsigned int len)
+{
+	__u32 result = 0;
+	__u32 window;
+	unsigned int i, b;
+
+	window = ((__u32)rss_key[0] << 24) | (rss_key[1] << 16)
+			| (rss_key[2] << 8) | rss_key[3];
+	for (i = 0; i < len; i++) {
+		for (b = 0; b < 8; b++) {
+			if (input[i] & (0x80 >> b))
+				result ^= window;
+			window = (window << 1) | ((rss_key[i + 4] >> (7 - b)) & 1);
+		}
 	}
 
-	return detached;
+	return result;
 }
 
-static void detach_bib(struct xlator *jool, struct bib_table *table,
-		struct tabled_bib *bib)
+/*
+ * Would the NIC receive the IPv4 packets from @dst4 to @src4 in queue @queue?
+ *
+ * Assumes the interface uses the kernel's default key and indirection table,
+ * and hashes by the 4-tuple. (See the rss-queues global.)
+ */
+static bool rss_matches(struct ipv4_transport_addr const *src4,
+		struct ipv4_transport_addr const *dst4,
+		unsigned int queues, unsigned int queue)
 {
-	rb_erase(&bib->hook6, &table->tree6);
-	rb_erase(&bib->hook4, &table->tree4);
-	jstat_dec(jool->stats, JSTAT_BIB_ENTRIES);
-	/* NOTE THAT detach_sessions() RETURNS NEGATIVE. */
-	jstat_add(jool->stats, JSTAT_SESSIONS, detach_sessions(table, bib));
+	__u8 input[12];
+
+	/* The reply's source, destination, source port and destination port */
+	memcpy(&input[0], &dst4->l3, 4);
+	memcpy(&input[4], &src4->l3, 4);
+	input[8] = dst4->l4 >> 8;
+	input[9] = dst4->l4 & 0xFF;
+	input[10] = src4->l4 >> 8;
+	input[11] = src4->l4 & 0xFF;
+
+	return ((toeplitz(input, sizeof(input)) & (RSS_INDIR_SIZE - 1)) % queues)
+			== queue;
 }
 
-struct bib_delete_list {
-	struct rb_node *first;
+/* Addresses preserve_port() is willing to try before giving up. */
+#define PRESERVE_MAX_ADDRS 4
+
+struct port_preservation {
+	struct bib_table *table;
+	struct tabled_bib *bib;
+	struct tree_slot *slot;
+	unsigned int tries;
 };
 
-static void add_to_delete_list(struct bib_delete_list *bdl,
-		struct rb_node *node)
+static int preserve_port_cb(struct ipv4_range const *range, void *arg)
 {
-	node->rb_right = bdl->first;
-	bdl->first = node;
-}
+	struct port_preservation *args = arg;
+	struct tabled_bib *bib = args->bib;
+	struct port_map *map;
 
-static void commit_delete_list(struct bib_delete_list *list)
-{
-	struct rb_node *node;
-	struct rb_node *next;
+	if (!port_range_contains(&range->ports, bib->src6.l4))
+		return 0;
 
-	for (node = list->first; node; node = next) {
-		next = node->rb_right;
-		release_bib_entry(bib4_entry(node));
-	}
+	bib->src4.l3 = range->prefix.addr;
+	bib->src4.l4 = bib->src6.l4;
+
+	map = get_port_map(args->table, &bib->src4.l3);
+	if (!(map && test_bit(port2bit(bib->src4.l4), map->ports))
+			&& !find_bibtree4_slot(args->table, bib, args->slot))
+		return 1;
+
+	return (++args->tries >= PRESERVE_MAX_ADDRS) ? -ENOENT : 0;
 }
 
-/**
- * Tests whether @predecessor's immediate succesor tree slot is a suitable
- * placeholder for @bib. Returns the colliding node.
- *
- * (That is, returns NULL on success, a collision on failure.)
+/*
+ * port-preservation: Tries to give @bib its IPv6 source port, on the first
+ * (few) addresses of @masks that own it. Returns true on success.
  *
- * In other words:
- * Assumes that @predecessor belongs to @table's v4 tree and that it is @bib's
- * predecessor. (ie. @predecessor's transport address is @bib's transport
- * address - 1.) You want to test whether @bib can be inserted to the tree.
- * If @predecessor's succesor collides with @bib (ie. it has @bib's v4 address),
- * it returns the colliding succesor.
- * If @predecessor's succesor does not collide with @bib, it returns NULL and
- * initializes @slot so you can actually add @bib to the tree.
+ * The preserved port always belongs to @table's shard, and each address costs
+ * a port map bit test, and maybe a tree lookup.
  */
-static struct tabled_bib *try_next(struct bib_table *table,
-		struct tabled_bib *predecessor,
-		struct tabled_bib *bib,
+static bool preserve_port(struct xlator *jool, struct bib_table *table,
+		struct mask_domain *masks, struct tabled_bib *bib,
 		struct tree_slot *slot)
 {
-	struct tabled_bib *next;
+	struct port_preservation args;
 
-	next = bib4_entry(rb_next(&predecessor->hook4));
-	if (!next) {
-		/* There is no succesor and therefore no collision. */
-		slot->tree = &table->tree4;
-		slot->entry = &bib->hook4;
-		slot->parent = &predecessor->hook4;
-		slot->rb_link = &slot->parent->rb_right;
-		return NULL;
-	}
+	if (!cluster_owns(&XGLOBALS(jool), bib->src6.l4))
+		return false;
 
-	if (taddr4_equals(&next->src4, &bib->src4))
-		return next; /* Next is yet another collision. */
+	args.table = table;
+	args.bib = bib;
+	args.slot = slot;
+	args.tries = 0;
+	if (mask_domain_foreach_range(masks, preserve_port_cb, &args) != 1)
+		return false;
 
-	slot->tree = &table->tree4;
-	slot->entry = &bib->hook4;
-	if (predecessor->hook4.rb_right) {
-		slot->parent = &next->hook4;
-		slot->rb_link = &slot->parent->rb_left;
-	} else {
-		slot->parent = &predecessor->hook4;
-		slot->rb_link = &slot->parent->rb_right;
-	}
-	return NULL;
+	jstat_inc(jool->stats, JSTAT_PORT_PRESERVED);
+	return true;
+}
+
+/* Top of range_load_cb()'s scale. */
+#define LOAD_FULL 1024u
+
+/*
+ * least-loaded-address: How much of @range's address the table (@arg) is
+ * already using, with LOAD_FULL meaning "all of its shard's ports."
+ *
+ * The port maps already count every address's entries, so they double as the
+ * occupancy counters; creating one here also spares the iteration the work.
+ */
+static unsigned int range_load_cb(struct ipv4_range const *range, void *arg)
+{
+	struct port_map *map;
+	unsigned int capacity;
+
+	map = get_port_map(arg, &range->prefix.addr);
+	if (!map)
+		return LOAD_FULL; /* Can't tell; don't prefer it. */
+
+	/* The range's ports that belong to this shard, roughly. */
+	capacity = port_range_count(&range->ports) >> BIB_SHARD_BITS;
+	if (map->used >= capacity)
+		return LOAD_FULL;
+	return (map->used * LOAD_FULL) / capacity;
 }
 
 /**
@@ -1253,22 +4111,73 @@ static struct tabled_bib *try_next(struct bib_table *table,
  *
  * 	// wraps around until offset - 1
  * 	foreach (mask in @masks starting from some offset)
- * 		if (mask is not taken by an existing BIB entry from @table)
+ * 		if (mask belongs to @table's shard)
+ * 			if (mask is taken by an existing BIB entry from @table)
+ * 				skip to the next free port of the shard (per the port map)
  * 			init the new BIB entry, @bib, using mask
  * 			init @slot as the tree slot where @bib should be added
  * 			return success (0)
  * 	return failure (-ENOENT)
  *
+ * (Masks from other shards, as well as the skipped ones, still count towards
+ * the mask domain's iteration limit.)
+ *
+ * If @block_size is nonzero, allocates from port blocks instead. (See
+ * find_block_mask().)
+ *
+ * If rss-queues is enabled, free masks whose replies (from @dst4) would land
+ * on some other CPU's queue are skipped too, up to a limit. If the limit is
+ * reached (or the domain runs out), the first free mask is used anyway.
+ *
+ * If port-preservation is enabled, @bib's IPv6 source port is tried before
+ * all of this. (It takes precedence over rss-queues.)
+ *
+ * If least-loaded-address is enabled, "some offset" is moved to the emptiest
+ * of a few addresses. (See mask_domain_balance().)
+ *
+ * If cluster-nodes is enabled, the masks other nodes own are jumped over
+ * altogether, without counting towards max-iterations.
  */
-static int find_available_mask(struct bib_table *table,
+static int find_available_mask(struct xlator *jool,
+		struct bib_table *table,
 		struct mask_domain *masks,
 		struct tabled_bib *bib,
-		struct tree_slot *slot)
+		struct ipv4_transport_addr const *dst4,
+		struct tree_slot *slot,
+		unsigned int block_size)
 {
+	struct bib_config const *cfg = &XGLOBALS(jool);
 	struct tabled_bib *collision = NULL;
+	struct port_map *map = NULL;
+	struct ipv4_transport_addr fallback;
+	unsigned int queues;
+	unsigned int queue = 0;
+	unsigned int misses = 0;
 	bool consecutive;
 	int error;
 
+	if (block_size)
+		return find_block_mask(table, cfg, masks, bib, slot,
+				block_size);
+	if (XGLOBALS(jool).port_preservation
+			&& preserve_port(jool, table, masks, bib, slot))
+		return 0;
+
+	queues = (bib->proto != L4PROTO_ICMP) ? XGLOBALS(jool).rss_queues : 0;
+	if (queues)
+		queue = smp_processor_id() % queues;
+
+	/*
+	 * The table only holds its shard's entries, and only allocates its
+	 * shard's masks, so this is its own occupancy, extrapolated.
+	 * (Entries from other marks are counted too; the estimate errs on the
+	 * crowded side.)
+	 */
+	if (mask_domain_set_occupancy(masks, table->bib_count * BIB_SHARDS))
+		jstat_inc(jool->stats, JSTAT_POOL4_CROWDED);
+	if (XGLOBALS(jool).least_loaded_address)
+		mask_domain_balance(masks, range_load_cb, table);
+
 	/*
 	 * We're going to assume the masks are generally consecutive.
 	 * I think it's a fair assumption until someone requests otherwise as a
@@ -1281,17 +4190,75 @@ static int find_available_mask(struct bib_table *table,
 		if (error)
 			goto end;
 
+		if (!cluster_owns(cfg, bib->src4.l4)) {
+			error = mask_domain_forgo(masks, &bib->src4,
+					cluster_next(cfg, bib->src4.l4));
+			if (error == -ERANGE) {
+				/* No more of our ports in this range. */
+				collision = NULL;
+				continue;
+			}
+			if (error)
+				goto end;
+			consecutive = false;
+		}
+
+		if (!shards_match(&bib->src6, &bib->src4)) {
+			/* try_next() needs an actual predecessor. */
+			collision = NULL;
+			continue;
+		}
+
+		if (!map || !addr4_equals(&map->addr, &bib->src4.l3))
+			map = get_port_map(table, &bib->src4.l3);
+		if (map && test_bit(port2bit(bib->src4.l4), map->ports)) {
+			error = mask_domain_skip(masks, &bib->src4,
+					port_map_next_free(map, bib->src4.l4));
+			if (error == -ERANGE) {
+				/* This range is full; move on to the next. */
+				collision = NULL;
+				continue;
+			}
+			if (error)
+				goto end;
+			consecutive = false;
+		}
+
 		/*
 		 * Just for the sake of clarity:
-		 * @consecutive is never true on the first iteration.
+		 * @consecutive is never true on the first iteration, and
+		 * @collision is only NULL after a shard mismatch.
+		 * (If the port map is available, the slot lookup should not
+		 * collide.)
 		 */
-		collision = consecutive
+		collision = (consecutive && collision)
 				? try_next(table, collision, bib, slot)
 				: find_bibtree4_slot(table, bib, slot);
+		if (collision)
+			continue;
 
-	} while (collision);
+		if (!queues || rss_matches(&bib->src4, dst4, queues, queue))
+			goto end;
+		if (misses == 0)
+			fallback = bib->src4;
+		if (++misses >= RSS_MISSES_PER_QUEUE * queues)
+			goto use_fallback;
+		/* The mask is free, so there's no predecessor to continue from. */
+	} while (true);
 
 end:
+	if (error == -ENOENT && misses > 0)
+		goto use_fallback;
+	mask_domain_commit(masks);
+	return error;
+
+use_fallback:
+	/* We're still holding the table's lock, so the mask is still free. */
+	bib->src4 = fallback;
+	collision = find_bibtree4_slot(table, bib, slot);
+	error = WARN(collision, "RSS fallback mask was taken.") ? -EINVAL : 0;
+	if (!error)
+		jstat_inc(jool->stats, JSTAT_RSS_FALLBACK);
 	mask_domain_commit(masks);
 	return error;
 }
@@ -1306,6 +4273,7 @@ static int upgrade_pktqueue_session(struct xlator *jool,
 	struct tabled_bib *bib;
 	struct tabled_bib *collision;
 	struct tabled_session *session;
+	struct ipv6_transport_addr dst6;
 	struct tree_slot bib_slot6;
 	struct tree_slot bib_slot4;
 	int error;
@@ -1313,7 +4281,8 @@ static int upgrade_pktqueue_session(struct xlator *jool,
 	if (new->bib->proto != L4PROTO_TCP)
 		return -ESRCH;
 
-	sos = pktqueue_find(table->pkt_queue, &new->session->dst6, masks);
+	get_dst6(jool, new->session, &dst6);
+	sos = pktqueue_find(table->pkt_queue, &dst6, masks);
 	if (!sos)
 		return -ESRCH;
 	table->pkt_count--;
@@ -1374,11 +4343,13 @@ static int upgrade_pktqueue_session(struct xlator *jool,
 	bib->is_static = false;
 	bib->sessions = RB_ROOT;
 
-	session->dst6 = sos->dst6;
+	session->dst6_l4 = sos->dst6.l4;
 	session->dst4 = sos->dst4;
 	session->state = V4_INIT;
 	session->bib = bib;
 	session->update_time = jiffies;
+	session->refresh_time = session->update_time;
+	session->create_time = session->update_time;
 	session->stored = NULL;
 
 	/*
@@ -1391,14 +4362,27 @@ static int upgrade_pktqueue_session(struct xlator *jool,
 	collision = find_bibtree4_slot(table, bib, &bib_slot4);
 	if (WARN(collision, "BIB entry was and then wasn't in the v4 tree."))
 		goto trainwreck;
+	bib->generation = READ_ONCE(jool->nat64.bib->generation);
+	bib4_filter_add(table, bib);
 	treeslot_commit(&bib_slot6);
 	treeslot_commit(&bib_slot4);
-	jstat_inc(jool->stats, JSTAT_BIB_ENTRIES);
-
-	rb_link_node(&session->tree_hook, NULL, &bib->sessions.rb_node);
+	port_map_add(table, bib);
+	table->bib_count++;
+	block_add_bib(jool, table, bib);
+	hash_add_bib(table, bib);
+	count_bibs(jool, 1);
+	trace_bib_add(jool, bib);
+	subscriber_charge(jool, bib);
+
+	rb_link_node_rcu(&session->tree_hook, NULL, &bib->sessions.rb_node);
 	rb_insert_color(&session->tree_hook, &bib->sessions);
-	attach_timer(session, &table->syn4_timer);
-	jstat_inc(jool->stats, JSTAT_SESSIONS);
+	hash_add_session(table, session);
+	classify_session(jool, table, session);
+	attach_timer(jool, table, session, &table->syn4_timer);
+	count_sessions(jool, 1);
+	subscriber_add_sessions(bib, 1);
+	talkers_add(jool, &bib->src6.l3, JTALK_SESSIONS, 1);
+	trace_session_add(jool, session);
 
 	pktqueue_put_node(jool, sos);
 
@@ -1413,15 +4397,324 @@ trainwreck:
 	return -EINVAL;
 }
 
-static bool issue216_needed(struct mask_domain *masks,
-		struct bib_session_tuple *old)
+static bool issue216_needed(struct mask_domain *masks, struct tabled_bib *bib)
 {
 	if (!masks)
 		return false;
 	return mask_domain_is_dynamic(masks)
-			&& !mask_domain_matches(masks, &old->bib->src4);
+			&& !mask_domain_matches(masks, &bib->src4);
+}
+
+/* Does generation @a precede generation @b? (Modulo BIB_GEN_BITS.) */
+static bool gen_before(unsigned int a, unsigned int b)
+{
+	unsigned int distance = (b - a) & BIB_GEN_MASK;
+	return distance != 0 && distance <= (BIB_GEN_MASK >> 1);
+}
+
+static bool reap_covers(struct bib_reap const *reap,
+		struct tabled_bib const *bib)
+{
+	if (!gen_before(bib->generation, reap->generation))
+		return false;
+	if (reap->all)
+		return true;
+	return bib->proto == reap->proto
+			&& prefix4_contains(&reap->range.prefix, &bib->src4.l3)
+			&& port_range_contains(&reap->range.ports, bib->src4.l4)
+			&& (!reap->src6_set
+			|| prefix6_contains(&reap->src6, &bib->src6.l3));
+}
+
+/**
+ * Is @bib waiting to be deleted by an ongoing reap? If so, the packet path
+ * should pretend it doesn't exist.
+ */
+static bool bib_doomed(struct bib *db, struct tabled_bib const *bib)
+{
+	struct bib_reap *reap;
+	bool doomed = false;
+
+	if (likely(list_empty(&db->reaps)))
+		return false;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(reap, &db->reaps, hook) {
+		if (reap_covers(reap, bib)) {
+			doomed = true;
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	return doomed;
+}
+
+/**
+ * Can @session be refreshed without locking the table? That is, would the locked
+ * path merely reset its established timer?
+ *
+ * Only intended for the lockless path; the fields might be changing under our
+ * feet. If we lose the race, the slow path will (eventually) sort it out.
+ */
+static bool is_refreshable(struct xlation *state, struct bib_table *table,
+		struct tabled_session *session)
+{
+	struct tcphdr const *hdr;
+
+	if (READ_ONCE(session->expirer) != &table->est_timer)
+		return false;
+	if (READ_ONCE(session->stored))
+		return false;
+	if (table->est_timer.proto != L4PROTO_TCP)
+		return true;
+
+	if (READ_ONCE(session->state) != ESTABLISHED)
+		return false;
+	hdr = pkt_tcp_hdr(&state->in);
+	return !hdr->syn && !hdr->fin && !hdr->rst;
+}
+
+/*
+ * Most packets of a busy session find its timestamp fresh enough, and leave the
+ * session's cache line alone. The cleaner takes care of the rest; it never
+ * trusts the wheel slot anyway.
+ */
+static void refresh_session(struct xlation *state,
+		struct tabled_session *session)
+{
+	unsigned long now = jiffies;
+
+	if (!time_before(now, READ_ONCE(session->refresh_time)
+			+ state->jool->fast.refresh_granularity))
+		WRITE_ONCE(session->refresh_time, now);
+	tstobs(state, session);
+}
+
+/**
+ * Lockless fast path for 6-to-4 packets that belong to existing sessions,
+ * which are most of them.
+ *
+ * Returns true if the session was found and refreshed (and @state->entries
+ * initialized), false if the caller needs to take the slow path.
+ */
+static bool refresh_session6(struct xlation *state, struct bib_table *table,
+		struct mask_domain *masks, struct tuple *tuple6,
+		struct ipv4_transport_addr *dst4)
+{
+	struct tabled_bib *bib;
+	struct tabled_session *session;
+	struct ipv4_transport_addr key;
+	bool refreshed = false;
+
+	rcu_read_lock_bh();
+
+	bib = hash_find_bib6(table, &tuple6->src.addr6);
+	if (!bib)
+		bib = rbtree_find_rcu(&tuple6->src.addr6, &table->tree6,
+				compare_src6, struct tabled_bib, hook6);
+	if (!bib || issue216_needed(masks, bib)
+			|| bib_doomed(state->jool->nat64.bib, bib))
+		goto end;
+
+	key = *dst4;
+	if (bib->proto == L4PROTO_ICMP)
+		key.l4 = bib->src4.l4;
+
+	session = hash_find_session(table, bib, &key);
+	if (!session)
+		session = rbtree_find_rcu(&key, &bib->sessions,
+				compare_dst4_addr, struct tabled_session,
+				tree_hook);
+	if (!session || !is_refreshable(state, table, session))
+		goto end;
+
+	refresh_session(state, session);
+	refreshed = true;
+	/* Fall through */
+
+end:
+	rcu_read_unlock_bh();
+	return refreshed;
+}
+
+/**
+ * 4-to-6 version of refresh_session6().
+ */
+static bool refresh_session4(struct xlation *state, struct bib_table *table,
+		struct tuple *tuple4)
+{
+	struct tabled_bib *bib;
+	struct tabled_session *session;
+	bool refreshed = false;
+
+	rcu_read_lock_bh();
+
+	bib = hash_find_bib4(table, &tuple4->dst.addr4);
+	if (!bib)
+		bib = rbtree_find_rcu(&tuple4->dst.addr4, &table->tree4,
+				compare_src4, struct tabled_bib, hook4);
+	if (!bib || bib_doomed(state->jool->nat64.bib, bib))
+		goto end;
+
+	session = hash_find_session(table, bib, &tuple4->src.addr4);
+	if (!session)
+		session = rbtree_find_rcu(&tuple4->src.addr4, &bib->sessions,
+				compare_dst4_addr, struct tabled_session,
+				tree_hook);
+	if (!session || !is_refreshable(state, table, session))
+		goto end;
+
+	refresh_session(state, session);
+	refreshed = true;
+	/* Fall through */
+
+end:
+	rcu_read_unlock_bh();
+	return refreshed;
+}
+
+#ifdef BIB_HASH_INDEX
+
+/* The lookup keys of a packet, as seen by refresh_session6/4(). */
+struct prefetch_key {
+	struct bib_table *table;
+	/* 6-to-4: the BIB entry's src6. 4-to-6: its src4 (ie. the dst). */
+	union {
+		struct ipv6_transport_addr src6;
+		struct ipv4_transport_addr src4;
+	} bib;
+	/* 4-to-6: The session's dst4 (ie. the src). */
+	struct ipv4_transport_addr dst4;
+	bool is6;
+};
+
+static bool peek_ports(struct sk_buff *skb, unsigned int offset, __u8 proto,
+		l4_protocol *l4proto, __u16 *src, __u16 *dst)
+{
+	__be16 buffer[2];
+	__be16 *ports;
+
+	switch (proto) {
+	case IPPROTO_TCP:
+		*l4proto = L4PROTO_TCP;
+		break;
+	case IPPROTO_UDP:
+		*l4proto = L4PROTO_UDP;
+		break;
+	default:
+		return false; /* ICMP, extension headers, etc. Not worth it. */
+	}
+
+	ports = skb_header_pointer(skb, offset, sizeof(buffer), buffer);
+	if (!ports)
+		return false;
+
+	*src = ntohs(ports[0]);
+	*dst = ntohs(ports[1]);
+	return true;
+}
+
+/*
+ * A lighter determine_in_tuple(). Only plain TCP and UDP packets are handled;
+ * the rest simply don't get prefetched.
+ */
+static bool get_prefetch_key(struct bib *db, struct sk_buff *skb,
+		struct prefetch_key *key)
+{
+	struct ipv6hdr _hdr6, *hdr6;
+	struct iphdr _hdr4, *hdr4;
+	unsigned int offset;
+	l4_protocol proto;
+	__u16 src, dst;
+
+	offset = skb_network_offset(skb);
+
+	if (skb->protocol == htons(ETH_P_IPV6)) {
+		hdr6 = skb_header_pointer(skb, offset, sizeof(_hdr6), &_hdr6);
+		if (!hdr6 || !peek_ports(skb, offset + sizeof(*hdr6),
+				hdr6->nexthdr, &proto, &src, &dst))
+			return false;
+		key->bib.src6.l3 = hdr6->saddr;
+		key->bib.src6.l4 = src;
+		key->table = get_table6(db, proto, &key->bib.src6);
+		key->is6 = true;
+		return true;
+	}
+
+	hdr4 = skb_header_pointer(skb, offset, sizeof(_hdr4), &_hdr4);
+	if (!hdr4 || (hdr4->frag_off & htons(IP_OFFSET)))
+		return false;
+	if (!peek_ports(skb, offset + 4 * hdr4->ihl, hdr4->protocol, &proto,
+			&src, &dst))
+		return false;
+	key->bib.src4.l3.s_addr = hdr4->daddr;
+	key->bib.src4.l4 = dst;
+	key->dst4.l3.s_addr = hdr4->saddr;
+	key->dst4.l4 = src;
+	key->table = get_table4(db, proto, &key->bib.src4);
+	key->is6 = false;
+	return true;
+}
+
+/* Prefetches the bucket @key would be found in. */
+static void prefetch_bucket(struct rhashtable *ht, void const *key,
+		const struct rhashtable_params params)
+{
+	struct bucket_table *tbl;
+
+	tbl = rht_dereference_rcu(ht->tbl, ht);
+	prefetch(rht_bucket(tbl, rht_key_hashfn(ht, tbl, key, params)));
+}
+
+/**
+ * bib_prefetch - Prefetches what the lockless path will need to look up @skb's
+ * BIB entry and session.
+ *
+ * Stage 0 prefetches the BIB hash bucket. Stage 1 (by which time the bucket
+ * has hopefully arrived) finds the BIB entry, and prefetches the first level
+ * of its sessions.
+ *
+ * The results aren't kept; the translation looks everything up again, only
+ * from the cache. Call in an RCU read-side critical section.
+ */
+void bib_prefetch(struct bib *db, struct sk_buff *skb, unsigned int stage)
+{
+	struct prefetch_key key;
+	struct tabled_bib *bib;
+	struct session_key skey;
+
+	if (!get_prefetch_key(db, skb, &key))
+		return;
+
+	if (stage == 0) {
+		if (key.is6)
+			prefetch_bucket(&key.table->hash6, &key.bib.src6,
+					bib6_params);
+		else
+			prefetch_bucket(&key.table->hash4, &key.bib.src4,
+					bib4_params);
+		return;
+	}
+
+	if (key.is6) {
+		bib = hash_find_bib6(key.table, &key.bib.src6);
+		/* dst4 needs pool6; settle for the root of the tree. */
+		if (bib)
+			prefetch(READ_ONCE(bib->sessions.rb_node));
+	} else {
+		bib = hash_find_bib4(key.table, &key.bib.src4);
+		if (bib) {
+			skey.bib = bib;
+			skey.dst4 = &key.dst4;
+			prefetch_bucket(&key.table->session_hash, &skey,
+					session_params);
+		}
+	}
 }
 
+#endif /* BIB_HASH_INDEX */
+
 /**
  * This is a find and an add at the same time, for both @new->bib and
  * @new->session.
@@ -1462,14 +4755,31 @@ static int find_bib_session6(struct xlator *jool,
 	 * See below for more stuff.
 	 */
 
-	old->bib = find_bibtree6_slot(table, new->bib, &slots->bib6);
+	/* The slot is only needed if the entry doesn't exist. */
+	old->bib = hash_find_bib6(table, &new->bib->src6);
+	if (!old->bib)
+		old->bib = find_bibtree6_slot(table, new->bib, &slots->bib6);
 	if (old->bib) {
-		if (!issue216_needed(masks, old)) {
+		if (!issue216_needed(masks, old->bib)
+				&& !bib_doomed(jool->nat64.bib, old->bib)) {
 			if (new->bib->proto == L4PROTO_ICMP)
 				new->session->dst4.l4 = old->bib->src4.l4;
 
-			old->session = find_session_slot(old->bib, new->session,
-					NULL, &slots->session);
+			old->session = hash_find_session(table, old->bib,
+					&new->session->dst4);
+			if (!old->session)
+				old->session = find_session_slot(old->bib,
+						new->session, NULL,
+						&slots->session);
+			if (!old->session && masks) {
+				if (overload_shed(jool))
+					return -EAGAIN;
+				if (session_quota_exceeded(jool, old->bib))
+					return -EDQUOT;
+				if (session_rate_exceeded(jool,
+						old->bib->subscriber))
+					return -EBUSY;
+			}
 			return 0; /* Typical happy path for existing sessions */
 		}
 
@@ -1479,10 +4789,13 @@ static int find_bib_session6(struct xlator *jool,
 		 * entry's IPv4 address is no longer a mask candidate, drop the
 		 * BIB entry and recompute it from scratch.
 		 * https://github.com/NICMx/Jool/issues/216
+		 *
+		 * Doomed entries get the same treatment; there's no point in
+		 * waiting for the reaper.
 		 */
-		__log_debug(jool, "Issue #216.");
+		__log_debug(jool, "Issue #216, or doomed BIB entry.");
 		detach_bib(jool, table, old->bib);
-		add_to_delete_list(bdl, &old->bib->hook4);
+		add_to_delete_list(bdl, old->bib);
 
 		/*
 		 * The detaching above might have involved a rebalance.
@@ -1514,8 +4827,20 @@ static int find_bib_session6(struct xlator *jool,
 	 * NULL.)
 	 */
 	if (masks) {
-		error = find_available_mask(table, masks, new->bib, &slots->bib4);
+		/* Before the pool4 search; that's the expensive part. */
+		if (overload_shed(jool))
+			return -EAGAIN;
+		if (port_quota_exceeded(jool, &new->bib->src6.l3))
+			return -EDQUOT;
+		if (session_rate_exceeded6(jool, &new->bib->src6.l3))
+			return -EBUSY;
+
+		error = find_available_mask(jool, table, masks, new->bib,
+				&new->session->dst4, &slots->bib4,
+				get_block_size(jool));
 		if (error) {
+			if (error == -ENOMEM)
+				return error;
 			if (WARN(error != -ENOENT, "Unknown error: %d", error))
 				return error;
 			/*
@@ -1531,6 +4856,9 @@ static int find_bib_session6(struct xlator *jool,
 			 * logging the offending mark.)
 			 * Might not be worth fixing since #175 is in the radar.
 			 */
+			trace_jool_pool4_exhausted(jool, &new->bib->src6,
+					new->bib->proto,
+					mask_domain_get_mark(masks));
 			log_warn_once("I'm running out of pool4 addresses for mark %u.",
 					mask_domain_get_mark(masks));
 			return error;
@@ -1557,6 +4885,36 @@ static int find_bib_session6(struct xlator *jool,
 	return 0; /* Happy path for new sessions */
 }
 
+/**
+ * bib_refresh6 - Refreshes @state's session, if it already exists and needs
+ * nothing else, without locking the table.
+ *
+ * Unlike bib_add6() and bib_add_tcp6(), this doesn't need the packet's mask
+ * domain, which is expensive to build (RFC 6056 hash, pool4 lookup, maybe an
+ * allocation), and, while pool4 is populated, pointless for existing BIB
+ * entries. So packets of established flows skip it.
+ *
+ * If this returns false, build the mask domain, and call the add function.
+ */
+bool bib_refresh6(struct xlation *state, struct ipv4_transport_addr *dst4)
+{
+	struct bib_table *table;
+
+	/*
+	 * Borrowed interface addresses can disappear, in which case the mask
+	 * domain is needed to notice the BIB entry is stale. (#216)
+	 */
+	if (pool4db_is_empty(state->jool->nat64.pool4))
+		return false;
+
+	table = get_table6(state->jool->nat64.bib, state->in.tuple.l4_proto,
+			&state->in.tuple.src.addr6);
+	if (!table)
+		return false;
+
+	return refresh_session6(state, table, NULL, &state->in.tuple, dst4);
+}
+
 /**
  * @db current BIB & session database.
  * @masks Should a BIB entry be created, its IPv4 address mask will be allocated
@@ -1580,10 +4938,16 @@ int bib_add6(struct xlation *state,
 	struct bib_delete_list bdl = { NULL };
 	int error;
 
-	table = get_table(state->jool.nat64.bib, tuple6->l4_proto);
+	table = get_table6(state->jool->nat64.bib, tuple6->l4_proto,
+			&tuple6->src.addr6);
 	if (!table)
 		return -EINVAL;
 
+	/* bib_refresh6() already tried, unless #216 was in the way. */
+	if (masks && mask_domain_is_dynamic(masks)
+			&& refresh_session6(state, table, masks, tuple6, dst4))
+		return 0;
+
 	/*
 	 * We might have a lot to do. This function may index three RB-trees
 	 * so spinlock time is tight.
@@ -1601,24 +4965,26 @@ int bib_add6(struct xlation *state,
 	if (error)
 		return error;
 
-	spin_lock_bh(&table->lock); /* Here goes... */
+	jlock_lock_bh(&table->lock); /* Here goes... */
+	make_room(state->jool, table);
 
-	error = find_bib_session6(&state->jool, table, masks, &new, &old, &slots, &bdl);
+	error = find_bib_session6(state->jool, table, masks, &new, &old, &slots, &bdl);
 	if (error)
 		goto end;
 
 	if (old.session) { /* Session already exists. */
-		handle_fate_timer(old.session, &table->est_timer);
+		handle_fate_timer(state->jool, table, old.session,
+				&table->est_timer);
 		tstobs(state, old.session);
 		goto end;
 	}
 
 	/* New connection; add the session. (And maybe the BIB entry as well) */
-	commit_add6(state, &old, &new, &slots, &table->est_timer);
+	commit_add6(state, table, &old, &new, &slots, &table->est_timer);
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
 
 	if (new.bib)
 		free_bib(new.bib);
@@ -1629,7 +4995,7 @@ end:
 	return error;
 }
 
-static void find_bib_session4(struct bib_table *table,
+static void find_bib_session4(struct bib *db, struct bib_table *table,
 		struct tuple *tuple4,
 		struct tabled_session *new,
 		struct bib_session_tuple *old,
@@ -1637,9 +5003,42 @@ static void find_bib_session4(struct bib_table *table,
 		struct tree_slot *slot)
 {
 	old->bib = find_bib4(table, &tuple4->dst.addr4);
-	old->session = old->bib
-			? find_session_slot(old->bib, new, allow, slot)
-			: NULL;
+	if (old->bib && bib_doomed(db, old->bib))
+		old->bib = NULL;
+	if (!old->bib) {
+		old->session = NULL;
+		return;
+	}
+
+	old->session = hash_find_session(table, old->bib, &new->dst4);
+	if (old->session) {
+		/* Can't be denied by ADF; the session itself is proof. */
+		if (allow)
+			*allow = true;
+		return;
+	}
+
+	old->session = find_session_slot(old->bib, new, allow, slot);
+}
+
+/*
+ * Is @tuple4 the response of a UDP transaction whose session no longer needs
+ * to hold on to its pool4 port (eg. DNS)?
+ */
+static bool is_fast_response(struct xlation *state, struct tuple *tuple4)
+{
+	struct port_list const *ports;
+	unsigned int i;
+
+	if (tuple4->l4_proto != L4PROTO_UDP)
+		return false;
+
+	ports = &GLOBALS(state).udp_fast_ports;
+	for (i = 0; i < ports->count; i++)
+		if (ports->values[i] == tuple4->src.addr4.l4)
+			return true;
+
+	return false;
 }
 
 /**
@@ -1656,22 +5055,40 @@ int bib_add4(struct xlation *state,
 	struct tabled_session *new;
 	struct tree_slot session_slot;
 	bool allow;
+	bool fast;
 	int error = 0;
 
-	table = get_table(state->jool.nat64.bib, tuple4->l4_proto);
+	table = get_table4(state->jool->nat64.bib, tuple4->l4_proto,
+			&tuple4->dst.addr4);
 	if (!table)
 		return -EINVAL;
 
+	/*
+	 * Fast responses move their sessions to the transitory timer, so they
+	 * can't take the lockless path. (Which only ever resets the established
+	 * one.) The next request will move the session back.
+	 */
+	if (!bib4_filter_test(table, &tuple4->dst.addr4))
+		return -ESRCH;
+
+	fast = is_fast_response(state, tuple4);
+	if (!fast && refresh_session4(state, table, tuple4))
+		return 0;
+
 	new = create_session4(tuple4, dst6, ESTABLISHED);
 	if (!new)
 		return -ENOMEM;
 
-	spin_lock_bh(&table->lock);
+	jlock_lock_bh(&table->lock);
+	make_room(state->jool, table);
 
-	find_bib_session4(table, tuple4, new, &old, &allow, &session_slot);
+	find_bib_session4(state->jool->nat64.bib, table, tuple4, new, &old,
+			&allow, &session_slot);
 
 	if (old.session) {
-		handle_fate_timer(old.session, &table->est_timer);
+		handle_fate_timer(state->jool, table, old.session, fast
+				? &table->trans_timer
+				: &table->est_timer);
 		tstobs(state, old.session);
 		goto end;
 	}
@@ -1687,17 +5104,149 @@ int bib_add4(struct xlation *state,
 		goto end;
 	}
 
+	if (session_quota_exceeded(state->jool, old.bib)) {
+		error = -EDQUOT;
+		goto end;
+	}
+
 	/* Ok, no issues; add the session. */
-	commit_add4(state, &old, &new, &session_slot, &table->est_timer);
+	commit_add4(state, table, &old, &new, &session_slot, &table->est_timer);
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
 	if (new)
 		free_session(new);
 	return error;
 }
 
+/**
+ * Counts a new TCP connection against @table's syn-flood-threshold share.
+ * Returns true if the threshold has been exceeded during the current second.
+ */
+static bool syn_flood(struct xlation *state, struct bib_table *table)
+{
+	struct syn_cache *cache = table->syn_cache;
+	unsigned int threshold;
+
+	threshold = GLOBALS(state).syn_flood_threshold;
+	if (!threshold || !cache)
+		return false;
+
+	if (time_after_eq(jiffies, cache->window + HZ)) {
+		cache->window = jiffies;
+		cache->count = 0;
+	}
+
+	return ++cache->count > DIV_ROUND_UP(threshold, BIB_SHARDS);
+}
+
+static struct syn_cache_entry *syn_cache_slot(struct syn_cache *cache,
+		struct ipv4_transport_addr const *src4,
+		struct ipv4_transport_addr const *dst4)
+{
+	u32 hash;
+
+	hash = jhash_3words((__force u32)src4->l3.s_addr,
+			(__force u32)dst4->l3.s_addr,
+			((u32)src4->l4 << 16) | dst4->l4, cache->seed);
+	return &cache->entries[hash & (SYN_CACHE_SIZE - 1)];
+}
+
+/**
+ * Translates the V6 SYN described by @new (whose mask has already been picked)
+ * without committing it to the database. See "SYN flood protection" above.
+ */
+static verdict defer_syn6(struct xlation *state, struct bib_table *table,
+		struct bib_session_tuple *new)
+{
+	struct syn_cache_entry *entry;
+
+	entry = syn_cache_slot(table->syn_cache, &new->bib->src4,
+			&new->session->dst4);
+	entry->used = true;
+	entry->time = jiffies;
+	entry->src6 = new->bib->src6;
+	entry->src4 = new->bib->src4;
+	entry->dst4 = new->session->dst4;
+
+	/* Only needed because tstobs() wants a full session. */
+	new->session->bib = new->bib;
+	new->session->csum = compute_csum(state->jool, new->session);
+	new->session->expirer = &table->trans_timer;
+	new->session->update_time = jiffies;
+	new->session->create_time = new->session->update_time;
+	tstobs(state, new->session);
+
+	log_debug(state, "SYN flood protection: Not storing the session.");
+	jstat_inc(state->jool->stats, JSTAT_SYN_DEFERRED);
+	return VERDICT_CONTINUE;
+}
+
+/**
+ * If the V4 SYN in @state answers a deferred V6 SYN, creates the connection's
+ * BIB entry and session (ESTABLISHED), and returns true.
+ * Returns false if the caller should handle the packet as usual.
+ */
+static bool complete_syn4(struct xlation *state, struct bib_table *table,
+		struct ipv6_transport_addr *dst6)
+{
+	struct tuple *tuple4 = &state->in.tuple;
+	struct syn_cache_entry *entry;
+	struct tuple tuple6;
+	struct bib_session_tuple new;
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	struct bib_delete_list bdl = { NULL };
+	bool success = false;
+
+	if (!table->syn_cache)
+		return false;
+
+	entry = syn_cache_slot(table->syn_cache, &tuple4->dst.addr4,
+			&tuple4->src.addr4);
+	if (!entry->used
+			|| !taddr4_equals(&entry->src4, &tuple4->dst.addr4)
+			|| !taddr4_equals(&entry->dst4, &tuple4->src.addr4))
+		return false;
+	entry->used = false;
+	if (time_after(jiffies, entry->time + msecs_to_jiffies(
+			GLOBALS(state).ttl.tcp_trans)))
+		return false;
+
+	tuple6.src.addr6 = entry->src6;
+	tuple6.dst.addr6 = *dst6;
+	tuple6.l3_proto = L3PROTO_IPV6;
+	tuple6.l4_proto = L4PROTO_TCP;
+	if (create_bib_session6(&new, &tuple6, &entry->dst4, ESTABLISHED))
+		return false;
+	new.bib->src4 = entry->src4;
+
+	/*
+	 * No masks: The mask was chosen by the V6 SYN, and is only validated
+	 * here. (Which means @bdl stays empty.)
+	 */
+	if (find_bib_session6(state->jool, table, NULL, &new, &old, &slots,
+			&bdl))
+		goto end; /* Somebody else took the port. */
+	if (old.session)
+		goto end;
+	if (old.bib && !taddr4_equals(&old.bib->src4, &entry->src4))
+		goto end;
+
+	commit_add6(state, table, &old, &new, &slots, &table->est_timer);
+	log_debug(state, "SYN flood protection: Connection established.");
+	success = true;
+	/* Fall through */
+
+end:
+	if (new.bib)
+		free_bib(new.bib);
+	if (new.session)
+		free_session(new.session);
+	return success;
+}
+
 /**
  * Note: This particular incarnation of fate_cb is not prepared to return
  * FATE_PROBE.
@@ -1714,25 +5263,47 @@ verdict bib_add_tcp6(struct xlation *state,
 	struct slot_group slots;
 	struct bib_delete_list bdl = { NULL };
 	verdict result;
+	int error;
 
 	pkt = &state->in;
 	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
 		return drop(state, JSTAT_UNKNOWN);
 
+	table = get_table6(state->jool->nat64.bib, L4PROTO_TCP,
+			&pkt->tuple.src.addr6);
+	/* bib_refresh6() already tried, unless #216 was in the way. */
+	if (masks && mask_domain_is_dynamic(masks)
+			&& refresh_session6(state, table, masks, &pkt->tuple,
+					dst4))
+		return VERDICT_CONTINUE;
+
 	if (create_bib_session6(&new, &pkt->tuple, dst4, V6_INIT))
 		return drop(state, JSTAT_ENOMEM);
 
-	table = &state->jool.nat64.bib->tcp;
-	spin_lock_bh(&table->lock);
+	jlock_lock_bh(&table->lock);
+	make_room(state->jool, table);
 
-	if (find_bib_session6(&state->jool, table, masks, &new, &old, &slots, &bdl)) {
-		result = drop(state, JSTAT_UNKNOWN);
+	error = find_bib_session6(state->jool, table, masks, &new, &old, &slots,
+			&bdl);
+	if (error) {
+		if (error == -EDQUOT) {
+			log_debug(state, "The subscriber has reached its quota.");
+			result = drop(state, JSTAT_SUBSCRIBER_QUOTA);
+		} else if (error == -EBUSY) {
+			log_debug(state, "The subscriber is opening sessions too fast.");
+			result = drop(state, JSTAT_SUBSCRIBER_SESSION_RATE);
+		} else if (error == -EAGAIN) {
+			log_debug(state, "The CPU is overloaded; refusing the new session.");
+			result = drop(state, JSTAT_OVERLOAD_SHED);
+		} else {
+			result = drop(state, JSTAT_UNKNOWN);
+		}
 		goto end;
 	}
 
 	if (old.session) {
 		/* All states except CLOSED. */
-		if (decide_fate(&state->jool, cb, table, old.session, NULL)) {
+		if (decide_tcp_fate(state, cb, table, old.session)) {
 			tstobs(state, old.session);
 			result = VERDICT_CONTINUE;
 		} else {
@@ -1757,12 +5328,18 @@ verdict bib_add_tcp6(struct xlation *state,
 
 	/* All exits up till now require @new.* to be deleted. */
 
-	commit_add6(state, &old, &new, &slots, &table->trans_timer);
+	if (!old.bib && masks && !get_block_size(state->jool)
+			&& syn_flood(state, table)) {
+		result = defer_syn6(state, table, &new);
+		goto end;
+	}
+
+	commit_add6(state, table, &old, &new, &slots, &table->trans_timer);
 	result = VERDICT_CONTINUE;
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
 
 	if (new.bib)
 		free_bib(new.bib);
@@ -1793,18 +5370,32 @@ verdict bib_add_tcp4(struct xlation *state,
 	if (WARN(pkt->tuple.l4_proto != L4PROTO_TCP, "Incorrect l4 proto in TCP handler."))
 		return drop(state, JSTAT_UNKNOWN);
 
+	table = get_table4(state->jool->nat64.bib, L4PROTO_TCP,
+			&pkt->tuple.dst.addr4);
+
+	/* SYNs might still match a deferred mask, or become type 1 packets. */
+	if (!pkt_tcp_hdr(pkt)->syn
+			&& !bib4_filter_test(table, &pkt->tuple.dst.addr4)) {
+		log_debug(state, "Packet is not SYN and lacks state.");
+		return drop(state, JSTAT_SYN4_EXPECTED);
+	}
+
+	if (refresh_session4(state, table, &pkt->tuple))
+		return VERDICT_CONTINUE;
+
 	new = create_session4(&pkt->tuple, dst6, V4_INIT);
 	if (!new)
 		return drop(state, JSTAT_ENOMEM);
 
-	table = &state->jool.nat64.bib->tcp;
-	spin_lock_bh(&table->lock);
+	jlock_lock_bh(&table->lock);
+	make_room(state->jool, table);
 
-	find_bib_session4(table, &pkt->tuple, new, &old, NULL, &session_slot);
+	find_bib_session4(state->jool->nat64.bib, table, &pkt->tuple, new,
+			&old, NULL, &session_slot);
 
 	if (old.session) {
 		/* All states except CLOSED. */
-		if (decide_fate(&state->jool, cb, table, old.session, NULL)) {
+		if (decide_tcp_fate(state, cb, table, old.session)) {
 			tstobs(state, old.session);
 			result = VERDICT_CONTINUE;
 		} else {
@@ -1827,6 +5418,12 @@ verdict bib_add_tcp4(struct xlation *state,
 		goto end;
 	}
 
+	/* Not actually external, if we deferred its V6 SYN. */
+	if (!old.bib && complete_syn4(state, table, dst6)) {
+		result = VERDICT_CONTINUE;
+		goto end;
+	}
+
 	if (GLOBALS(state).drop_external_tcp) {
 		log_debug(state, "Externally initiated TCP connections are prohibited.");
 		result = drop(state, JSTAT_V4_SYN);
@@ -1837,8 +5434,9 @@ verdict bib_add_tcp4(struct xlation *state,
 		bool too_many;
 
 		log_debug(state, "Potential Simultaneous Open; storing type 1 packet.");
-		too_many = table->pkt_count >= GLOBALS(state).max_stored_pkts;
-		error = pktqueue_add(table->pkt_queue, pkt, dst6, too_many);
+		too_many = too_many_stored_pkts(state, table);
+		error = pktqueue_add(table->pkt_queue, pkt, dst6, too_many,
+				stored_pkts_per_src(state));
 		switch (error) {
 		case 0:
 			result = stolen(state, JSTAT_TYPE1PKT);
@@ -1850,6 +5448,8 @@ verdict bib_add_tcp4(struct xlation *state,
 			goto end;
 		case -ENOSPC:
 			goto too_many_pkts;
+		case -EDQUOT:
+			goto too_many_src_pkts;
 		case -ENOMEM:
 			result = drop(state, JSTAT_ENOMEM);
 			goto end;
@@ -1860,10 +5460,16 @@ verdict bib_add_tcp4(struct xlation *state,
 		goto end;
 	}
 
+	if (session_quota_exceeded(state->jool, old.bib)) {
+		log_debug(state, "The subscriber has reached its session quota.");
+		result = drop(state, JSTAT_SUBSCRIBER_QUOTA);
+		goto end;
+	}
+
 	result = VERDICT_CONTINUE;
 
 	if (GLOBALS(state).drop_by_addr) {
-		if (table->pkt_count >= GLOBALS(state).max_stored_pkts)
+		if (too_many_stored_pkts(state, table))
 			goto too_many_pkts;
 
 		log_debug(state, "Potential Simultaneous Open; storing type 2 packet.");
@@ -1877,89 +5483,404 @@ verdict bib_add_tcp4(struct xlation *state,
 		 */
 	}
 
-	commit_add4(state, &old, &new, &session_slot,
+	commit_add4(state, table, &old, &new, &session_slot,
 			new->stored ? &table->syn4_timer : &table->trans_timer);
 	/* Fall through */
 
 end:
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
+
+	if (new)
+		free_session(new);
+
+	return result;
+
+too_many_pkts:
+	jlock_unlock_bh(&table->lock);
+	free_session(new);
+	log_debug(state, "Too many Simultaneous Opens.");
+	/* Fall back to assume there's no SO. */
+	return drop_icmp(state, JSTAT_SO_FULL, ICMPERR_PORT_UNREACHABLE, 0);
+
+too_many_src_pkts:
+	jlock_unlock_bh(&table->lock);
+	free_session(new);
+	log_debug(state, "Too many Simultaneous Opens from this source.");
+	return drop_icmp(state, JSTAT_SO_SRC_FULL, ICMPERR_PORT_UNREACHABLE, 0);
+}
+
+int bib_find(struct bib *db, struct tuple *tuple, struct bib_session *result)
+{
+	struct bib_entry tmp;
+	int error;
+
+	switch (tuple->l3_proto) {
+	case L3PROTO_IPV6:
+		error = bib_find6(db, tuple->l4_proto, &tuple->src.addr6, &tmp);
+		break;
+	case L3PROTO_IPV4:
+		error = bib_find4(db, tuple->l4_proto, &tuple->dst.addr4, &tmp);
+		break;
+	default:
+		WARN(true, "Unknown layer 3 protocol: %u", tuple->l3_proto);
+		return -EINVAL;
+	}
+
+	if (error)
+		return error;
+
+	result->bib_set = true;
+	result->session.src6 = tmp.addr6;
+	result->session.src4 = tmp.addr4;
+	result->session.proto = tmp.l4_proto;
+	return 0;
+}
+
+/**
+ * Copies the session @tuple's packet belongs to (in either direction) into
+ * @result. Unlike the packet path, it never creates or refreshes anything.
+ *
+ * Returns -ESRCH if there's no such session. Can be called from softirq.
+ */
+int bib_find_session(struct xlator *jool, struct tuple *tuple,
+		struct session_entry *result)
+{
+	struct bib_table *table;
+	struct tabled_bib *bib;
+	struct tabled_session tmp;
+	struct tabled_session *session;
+	struct tree_slot slot;
+	int pool6_index;
+
+	switch (tuple->l3_proto) {
+	case L3PROTO_IPV6:
+		/* The sessions are indexed by their IPv4 remote address. */
+		pool6_index = xlator_pool6_find(jool, &tuple->dst.addr6.l3);
+		if (pool6_index < 0)
+			return -ESRCH;
+		if (__rfc6052_6to4_nocheck(xlator_pool6(jool, pool6_index),
+				&tuple->dst.addr6.l3, &tmp.dst4.l3))
+			return -ESRCH;
+		tmp.dst4.l4 = tuple->dst.addr6.l4;
+		table = get_table6(jool->nat64.bib, tuple->l4_proto,
+				&tuple->src.addr6);
+		break;
+	case L3PROTO_IPV4:
+		tmp.dst4 = tuple->src.addr4;
+		table = get_table4(jool->nat64.bib, tuple->l4_proto,
+				&tuple->dst.addr4);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (!table)
+		return -EINVAL;
+
+	jlock_lock_bh(&table->lock);
+
+	bib = (tuple->l3_proto == L3PROTO_IPV6)
+			? find_bib6(table, &tuple->src.addr6)
+			: find_bib4(table, &tuple->dst.addr4);
+	if (!bib || bib_doomed(jool->nat64.bib, bib))
+		goto esrch;
+
+	/* 3-tuples: The identifier is the BIB entry's. */
+	if (bib->proto == L4PROTO_ICMP)
+		tmp.dst4.l4 = bib->src4.l4;
+
+	session = hash_find_session(table, bib, &tmp.dst4);
+	if (!session)
+		session = find_session_slot(bib, &tmp, NULL, &slot);
+	if (!session)
+		goto esrch;
+
+	tstose(jool, session, result);
+	jlock_unlock_bh(&table->lock);
+
+	/* Same IPv4 remote, but through a different pool6 prefix? */
+	if (tuple->l3_proto == L3PROTO_IPV6 && !addr6_equals(&result->dst6.l3,
+			&tuple->dst.addr6.l3))
+		return -ESRCH;
+	return 0;
+
+esrch:
+	jlock_unlock_bh(&table->lock);
+	return -ESRCH;
+}
+
+int bib_add_session(struct xlator *jool,
+		struct session_entry *session,
+		struct collision_cb *cb)
+{
+	struct bib_table *table;
+	struct bib_session_tuple new;
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	struct bib_delete_list bdl = { NULL };
+	int error;
+
+	if (!shards_match(&session->src6, &session->src4)) {
+		log_warn_once("Session " SEPP " does not fit in any BIB shard. (Do both instances have the same shard count?)",
+				SEPA(session));
+		return -EINVAL;
+	}
+
+	table = get_table4(jool->nat64.bib, session->proto, &session->src4);
+	if (!table)
+		return -EINVAL;
+
+	error = create_bib_session(jool, session, &new);
+	if (error)
+		return error;
+
+	jlock_lock_bh(&table->lock);
+
+	error = find_bib_session6(jool, table, NULL, &new, &old, &slots, &bdl);
+	if (error)
+		goto end;
+
+	if (old.session) {
+		/* There's no packet; ignore the verdict. */
+		decide_fate(jool, cb, table, old.session, NULL);
+		goto end;
+	}
+
+	error = commit_add(jool, table, &old, &new, &slots, session->timer_type);
+	/* Fall through */
+
+end:
+	jlock_unlock_bh(&table->lock);
+
+	if (new.bib)
+		free_bib(new.bib);
+	if (new.session)
+		free_session(new.session);
+	commit_delete_list(&bdl);
+
+	return error;
+}
+
+/* Sessions imported per lock hold, at most. */
+#define IMPORT_RUN 64
+
+/**
+ * bib_import - Adds @sessions (and the BIB entries they need) to @jool's
+ * database, in bulk. Meant for restoring snapshots.
+ *
+ * Unlike bib_add_session(), sessions that already exist are left alone, and
+ * consecutive sessions that belong to the same table are added during the same
+ * lock hold. (So @sessions should be grouped the way bib_foreach_session()
+ * returns them.)
+ *
+ * Returns the number of sessions added, or a negative error code. Sessions
+ * that don't fit (eg. because of shard count mismatches) are only skipped.
+ */
+int bib_import(struct xlator *jool, struct session_entry *sessions,
+		unsigned int count)
+{
+	struct session_entry *session;
+	struct bib_table *table, *locked;
+	struct bib_session_tuple new = { NULL, NULL };
+	struct bib_session_tuple old;
+	struct slot_group slots;
+	struct bib_delete_list bdl = { NULL };
+	unsigned int run;
+	unsigned int i;
+	int added;
+	int error;
+
+	locked = NULL;
+	run = 0;
+	added = 0;
+	error = 0;
+
+	for (i = 0; i < count; i++) {
+		session = &sessions[i];
+
+		if (!shards_match(&session->src6, &session->src4)) {
+			log_warn_once("Session " SEPP " does not fit in any BIB shard. (Do both instances have the same shard count?)",
+					SEPA(session));
+			continue;
+		}
+		table = get_table4(jool->nat64.bib, session->proto,
+				&session->src4);
+		if (!table)
+			continue;
+
+		if (table != locked || run >= IMPORT_RUN) {
+			if (locked)
+				jlock_unlock_bh(&locked->lock);
+			jlock_lock_bh(&table->lock);
+			locked = table;
+			run = 0;
+		}
+		run++;
+
+		/* Leftovers from the previous iteration can be reused. */
+		if (!new.bib)
+			new.bib = alloc_bib();
+		if (!new.session)
+			new.session = alloc_session();
+		if (!new.bib || !new.session) {
+			error = -ENOMEM;
+			break;
+		}
+		init_bib_session(jool, session, &new);
+
+		if (find_bib_session6(jool, table, NULL, &new, &old, &slots,
+				&bdl))
+			continue;
+		if (old.session)
+			continue;
+
+		error = commit_add(jool, table, &old, &new, &slots,
+				session->timer_type);
+		if (error)
+			break;
+		added++;
+	}
 
-	if (new)
-		free_session(new);
+	if (locked)
+		jlock_unlock_bh(&locked->lock);
 
-	return result;
+	if (new.bib)
+		free_bib(new.bib);
+	if (new.session)
+		free_session(new.session);
+	commit_delete_list(&bdl);
 
-too_many_pkts:
-	spin_unlock_bh(&table->lock);
-	free_session(new);
-	log_debug(state, "Too many Simultaneous Opens.");
-	/* Fall back to assume there's no SO. */
-	return drop_icmp(state, JSTAT_SO_FULL, ICMPERR_PORT_UNREACHABLE, 0);
+	return error ? error : added;
 }
 
-int bib_find(struct bib *db, struct tuple *tuple, struct bib_session *result)
+/* Sorts sessions by table, then by BIB entry, then by tree position. */
+static int compare_sync(const void *a, const void *b)
 {
-	struct bib_entry tmp;
-	int error;
-
-	switch (tuple->l3_proto) {
-	case L3PROTO_IPV6:
-		error = bib_find6(db, tuple->l4_proto, &tuple->src.addr6, &tmp);
-		break;
-	case L3PROTO_IPV4:
-		error = bib_find4(db, tuple->l4_proto, &tuple->dst.addr4, &tmp);
-		break;
-	default:
-		WARN(true, "Unknown layer 3 protocol: %u", tuple->l3_proto);
-		return -EINVAL;
-	}
+	struct session_entry const *s1 = a;
+	struct session_entry const *s2 = b;
+	int gap;
+
+	gap = (int)s1->proto - (int)s2->proto;
+	if (gap)
+		return gap;
+	gap = (int)port2shard(s1->src4.l4) - (int)port2shard(s2->src4.l4);
+	if (gap)
+		return gap;
+	gap = taddr6_compare(&s1->src6, &s2->src6);
+	if (gap)
+		return gap;
+	return taddr4_compare(&s1->dst4, &s2->dst4);
+}
 
-	if (error)
-		return error;
+struct sync_collision {
+	bib_sync_cb cb;
+	struct session_entry const *new;
+	void *arg;
+};
 
-	result->bib_set = true;
-	result->session.src6 = tmp.addr6;
-	result->session.src4 = tmp.addr4;
-	result->session.proto = tmp.l4_proto;
-	return 0;
+static enum session_fate sync_collision_cb(struct session_entry *old,
+		void *arg)
+{
+	struct sync_collision *collision = arg;
+	return collision->cb(old, collision->new, collision->arg);
 }
 
-int bib_add_session(struct xlator *jool,
-		struct session_entry *session,
-		struct collision_cb *cb)
+/**
+ * bib_sync - Batched bib_add_session(), for the sessions a joold peer sends.
+ *
+ * @sessions is sorted in place, so each table is only locked once (per
+ * IMPORT_RUN sessions), and consecutive searches walk mostly the same tree
+ * paths. Sessions that already exist are handed to @cb, along with their
+ * incoming version.
+ *
+ * Returns the number of sessions that could not be added (other than the ones
+ * that collided), or a negative error code.
+ */
+int bib_sync(struct xlator *jool, struct session_entry *sessions,
+		unsigned int count, bib_sync_cb cb, void *arg)
 {
-	struct bib_table *table;
-	struct bib_session_tuple new;
+	struct session_entry *session;
+	struct bib_table *table, *locked;
+	struct bib_session_tuple new = { NULL, NULL };
 	struct bib_session_tuple old;
 	struct slot_group slots;
 	struct bib_delete_list bdl = { NULL };
+	struct sync_collision collision;
+	struct collision_cb ccb;
+	unsigned int run;
+	unsigned int i;
+	int failed;
 	int error;
 
-	table = get_table(jool->nat64.bib, session->proto);
-	if (!table)
-		return -EINVAL;
+	sort(sessions, count, sizeof(*sessions), compare_sync, NULL);
 
-	error = create_bib_session(session, &new);
-	if (error)
-		return error;
+	collision.cb = cb;
+	collision.arg = arg;
+	ccb.cb = sync_collision_cb;
+	ccb.arg = &collision;
 
-	spin_lock_bh(&table->lock);
+	locked = NULL;
+	run = 0;
+	failed = 0;
+	error = 0;
 
-	error = find_bib_session6(jool, table, NULL, &new, &old, &slots, &bdl);
-	if (error)
-		goto end;
+	for (i = 0; i < count; i++) {
+		session = &sessions[i];
 
-	if (old.session) {
-		/* There's no packet; ignore the verdict. */
-		decide_fate(jool, cb, table, old.session, NULL);
-		goto end;
-	}
+		if (!shards_match(&session->src6, &session->src4)) {
+			log_warn_once("Session " SEPP " does not fit in any BIB shard. (Do both instances have the same shard count?)",
+					SEPA(session));
+			failed++;
+			continue;
+		}
+		table = get_table4(jool->nat64.bib, session->proto,
+				&session->src4);
+		if (!table) {
+			failed++;
+			continue;
+		}
 
-	error = commit_add(jool, table, &old, &new, &slots, session->timer_type);
-	/* Fall through */
+		if (table != locked || run >= IMPORT_RUN) {
+			if (locked)
+				jlock_unlock_bh(&locked->lock);
+			jlock_lock_bh(&table->lock);
+			locked = table;
+			run = 0;
+		}
+		run++;
+
+		/* Leftovers from the previous iteration can be reused. */
+		if (!new.bib)
+			new.bib = alloc_bib();
+		if (!new.session)
+			new.session = alloc_session();
+		if (!new.bib || !new.session) {
+			error = -ENOMEM;
+			break;
+		}
+		init_bib_session(jool, session, &new);
+
+		error = find_bib_session6(jool, table, NULL, &new, &old,
+				&slots, &bdl);
+		if (!error && old.session) {
+			collision.new = session;
+			/* There's no packet; ignore the verdict. */
+			decide_fate(jool, &ccb, table, old.session, NULL);
+			continue;
+		}
 
-end:
-	spin_unlock_bh(&table->lock);
+		if (!error)
+			error = commit_add(jool, table, &old, &new, &slots,
+					session->timer_type);
+		if (error == -ENOMEM)
+			break;
+		if (error && error != -EEXIST)
+			failed++;
+		error = 0;
+	}
+
+	if (locked)
+		jlock_unlock_bh(&locked->lock);
 
 	if (new.bib)
 		free_bib(new.bib);
@@ -1967,62 +5888,272 @@ end:
 		free_session(new.session);
 	commit_delete_list(&bdl);
 
-	return error;
+	return error ? error : failed;
+}
+
+/**
+ * Moves the next due slot of @wheel to @wheel->expired.
+ * Returns false if there are no due slots.
+ */
+static bool collect_slot(struct session_wheel *wheel, unsigned long now)
+{
+	unsigned long clk;
+
+	if (wheel->lvl >= WHEEL_LEVELS) {
+		if (time_before(now, wheel->clk))
+			return false;
+		/* Sessions rescheduled from now on belong to later ticks. */
+		wheel->clk += WHEEL_TICK;
+		wheel->lvl = 0;
+	}
+
+	clk = (wheel->clk - WHEEL_TICK) >> WHEEL_TICK_SHIFT;
+	clk >>= wheel->lvl * WHEEL_LVL_CLK_SHIFT;
+	hlist_move_list(&wheel->slots[wheel->lvl * WHEEL_LVL_SIZE
+			+ (clk & WHEEL_LVL_MASK)], &wheel->expired);
+
+	/* Upper levels are only due when the lower ones wrap around. */
+	if (clk & WHEEL_LVL_CLK_MASK)
+		wheel->lvl = WHEEL_LEVELS;
+	else
+		wheel->lvl++;
+	return true;
+}
+
+/**
+ * Moves the next slot of an ongoing sweep to @wheel->expired, so its sessions
+ * are rescheduled (or expired) according to their current timeouts. Otherwise,
+ * sessions queued before the timeouts shrank would keep their ports until
+ * their original expiration dates.
+ *
+ * Like collect_slot(), assumes @wheel->expired is empty. Returns false if there
+ * is nothing left to sweep.
+ */
+static bool sweep_slot(struct session_wheel *wheel)
+{
+	if (!wheel->sweep)
+		return false;
+
+	wheel->sweep--;
+	hlist_move_list(&wheel->slots[wheel->sweep], &wheel->expired);
+	return true;
 }
 
-static void __clean(struct xlator *jool,
-		struct expire_timer *expirer,
+/**
+ * Visits @table's collected sessions, spending up to *@budget.
+ * Returns false if the budget ran out first.
+ */
+static bool expire_sessions(struct xlator *jool,
 		struct bib_table *table,
-		struct list_head *probes)
+		struct list_head *probes,
+		unsigned int *budget)
 {
+	struct session_wheel *wheel = &table->wheel;
 	struct tabled_session *session;
-	struct tabled_session *tmp;
 	struct collision_cb cb;
-	unsigned long timeout;
+	unsigned long expires;
 
-	cb.cb = expirer->decide_fate_cb;
 	cb.arg = NULL;
-	timeout = get_timeout(jool, expirer);
 
-	list_for_each_entry_safe(session, tmp, &expirer->sessions, list_hook) {
+	while (!hlist_empty(&wheel->expired)) {
+		if (!*budget)
+			return false;
+		(*budget)--;
+
+		session = hlist_entry(wheel->expired.first,
+				struct tabled_session, wheel_hook);
+		hlist_del(&session->wheel_hook);
+
+		session->update_time = get_update_time(session);
+		expires = session->update_time
+				+ get_session_timeout(jool, session);
+		if (time_before(jiffies, expires)) {
+			/* Refreshed, or the timeout grew; reschedule. */
+			wheel_add(wheel, session, expires);
+			continue;
+		}
+
 		/*
-		 * "list" is sorted by expiration date,
-		 * so stop on the first unexpired session.
+		 * In case the fate callback decides to preserve the session,
+		 * retry on the next tick.
 		 */
-		if (time_before(jiffies, session->update_time + timeout))
-			break;
+		wheel_add(wheel, session, wheel->clk);
+		cb.cb = session->expirer->decide_fate_cb;
 		decide_fate(jool, &cb, table, session, probes);
 	}
+
+	return true;
+}
+
+/**
+ * Returns false if the budget ran out before @table was fully cleaned.
+ */
+static bool __clean(struct xlator *jool,
+		struct bib_table *table,
+		struct list_head *probes,
+		unsigned int *budget)
+{
+	unsigned long now = jiffies;
+
+	do {
+		if (!expire_sessions(jool, table, probes, budget))
+			return false;
+	} while (collect_slot(&table->wheel, now) || sweep_slot(&table->wheel));
+
+	return true;
+}
+
+/*
+ * pool4 pressure. (pool4-pressure-low and pool4-pressure-high.)
+ *
+ * Once a protocol's BIB entries take pool4-pressure-low percent of its pool4
+ * transport addresses, new flows are at risk of not finding a mask. The ports
+ * most likely to be wasted at that point are the ones held by dying TCP
+ * connections and by idle UDP flows, so the cleaner starts expiring those
+ * sooner: Every pressure level halves the TCP transitory timeout, and the UDP
+ * timeouts. There are PRESSURE_LEVELS levels, evenly spread between the two
+ * watermarks; the last one starts at pool4-pressure-high.
+ *
+ * Established TCP and ICMP sessions are left alone.
+ */
+#define PRESSURE_LEVELS 3
+
+/* Returns @proto's pressure level, according to its @tables' occupancy. */
+static unsigned int compute_pressure(struct xlator *jool,
+		struct bib_table *tables, l4_protocol proto)
+{
+	unsigned int low = XGLOBALS(jool).pressure_low;
+	unsigned int high = XGLOBALS(jool).pressure_high;
+	unsigned int capacity;
+	unsigned int percent;
+	u64 used;
+	unsigned int s;
+
+	if (!low)
+		return 0;
+	high = max(high, low);
+
+	/* Empty pool4 borrows the interface addresses; can't tell. */
+	capacity = pool4db_taddr_count(jool->nat64.pool4, proto);
+	if (!capacity)
+		return 0;
+
+	used = 0;
+	for (s = 0; s < BIB_SHARDS; s++)
+		used += READ_ONCE(tables[s].bib_count);
+	percent = div_u64(100 * used, capacity);
+
+	if (percent < low)
+		return 0;
+	if (percent >= high)
+		return PRESSURE_LEVELS;
+	return 1 + (PRESSURE_LEVELS - 1) * (percent - low) / (high - low);
+}
+
+static void update_pressure(struct xlator *jool, struct bib_table *tables,
+		l4_protocol proto, enum jool_stat_id stat)
+{
+	struct bib *db = jool->nat64.bib;
+	unsigned int level;
+
+	level = compute_pressure(jool, tables, proto);
+	if (level == db->pressure[proto])
+		return;
+
+	if (level > db->pressure[proto])
+		jstat_inc(jool->stats, JSTAT_POOL4_PRESSURE_RAISED);
+	jstat_set(jool->stats, stat, level);
+	WRITE_ONCE(db->pressure[proto], level);
+}
+
+/*
+ * Adjusts @table's timers to pressure level @level. Raising it also sweeps the
+ * wheel, since the sessions are queued according to the old timeouts.
+ * (Lowering doesn't need to; sessions found early are simply rescheduled.)
+ */
+static void apply_pressure(struct bib_table *table, unsigned int level)
+{
+	if (level == table->pressure)
+		return;
+
+	switch (table->est_timer.proto) {
+	case L4PROTO_TCP:
+		table->trans_timer.shift = level;
+		break;
+	case L4PROTO_UDP:
+		table->est_timer.shift = level;
+		table->trans_timer.shift = level;
+		break;
+	default:
+		return;
+	}
+
+	if (level > table->pressure)
+		table->wheel.sweep = WHEEL_SIZE;
+	table->pressure = level;
 }
 
-static void clean_table(struct xlator *jool, struct bib_table *table)
+static bool clean_table(struct xlator *jool, struct bib_table *table,
+		unsigned int *budget)
 {
 	LIST_HEAD(probes);
 	LIST_HEAD(icmps);
+	bool done;
 
-	spin_lock_bh(&table->lock);
-	__clean(jool, &table->est_timer, table, &probes);
-	__clean(jool, &table->trans_timer, table, &probes);
-	__clean(jool, &table->syn4_timer, table, &probes);
+	jlock_lock_bh(&table->lock);
+	reap_blocks(table);
+	apply_pressure(table, READ_ONCE(jool->nat64.bib->pressure[
+			table->est_timer.proto]));
+	done = __clean(jool, table, &probes, budget);
 	if (table->pkt_queue) {
 		table->pkt_count -= pktqueue_prepare_clean(table->pkt_queue,
 				&icmps);
 	}
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
+
+	defer_xmit(jool, &probes, &icmps);
+	return done;
+}
+
+#define BIB_TABLES (3 * BIB_SHARDS)
 
-	post_fate(jool, &probes);
-	pktqueue_clean(&icmps);
+static struct bib_table *get_nth_table(struct bib *db, unsigned int n)
+{
+	switch (n / BIB_SHARDS) {
+	case 0:
+		return &db->udp[n % BIB_SHARDS];
+	case 1:
+		return &db->tcp[n % BIB_SHARDS];
+	}
+	return &db->icmp[n % BIB_SHARDS];
 }
 
 /**
  * Forgets or downgrades (from EST to TRANS) old sessions.
+ *
+ * If the session-expiry-budget global is nonzero, this stops once it has
+ * visited that many sessions. The next call resumes from there.
  */
 void bib_clean(struct xlator *jool)
 {
 	struct bib *db = jool->nat64.bib;
-	clean_table(jool, &db->udp);
-	clean_table(jool, &db->tcp);
-	clean_table(jool, &db->icmp);
+	unsigned int budget;
+	unsigned int t;
+	unsigned int i;
+
+	update_pressure(jool, db->tcp, L4PROTO_TCP, JSTAT_POOL4_PRESSURE_TCP);
+	update_pressure(jool, db->udp, L4PROTO_UDP, JSTAT_POOL4_PRESSURE_UDP);
+
+	budget = jool->globals.nat64.bib.expiry_budget ? : UINT_MAX;
+	t = READ_ONCE(db->clean_cursor);
+
+	for (i = 0; i < BIB_TABLES; i++) {
+		if (!clean_table(jool, get_nth_table(db, t), &budget)) {
+			WRITE_ONCE(db->clean_cursor, t);
+			return;
+		}
+		t = (t + 1) % BIB_TABLES;
+	}
 }
 
 static struct rb_node *find_starting_point(struct bib_table *table,
@@ -2043,43 +6174,346 @@ static struct rb_node *find_starting_point(struct bib_table *table,
 	if (*node)
 		return include_offset ? (*node) : rb_next(*node);
 
-	if (!parent)
-		return NULL;
+	if (!parent)
+		return NULL;
+
+	/*
+	 * If offset is not found, start from offset's next anyway.
+	 * (If offset was meant to exist, it probably timed out and died while
+	 * the caller wasn't holding the spinlock; it's nothing to worry about.)
+	 */
+	bib = rb_entry(parent, struct tabled_bib, hook4);
+	return (compare_src4(bib, offset) < 0) ? rb_next(parent) : parent;
+}
+
+/*
+ * Entries the foreaches copy out of a table per lock hold. The callbacks run
+ * on the copies, after the lock is released, so a slow reader (a Netlink dump,
+ * for example) never makes the packet path wait for more than a chunk's worth
+ * of memcpy()s.
+ *
+ * The price is that the walk is only consistent within each chunk; entries
+ * that come and go between two chunks might or might not be visited. (Which
+ * is also true between two dump pages, so nobody relies on anything else.)
+ */
+#define FOREACH_CHUNK 32
+
+/*
+ * Range helpers of the foreaches. A NULL range contains everything.
+ *
+ * The trees are sorted by IPv4 transport address, so a walk restricted to a
+ * range can seek to the range's first address, and stop as soon as it leaves
+ * the prefix. Addresses in between whose ports fall outside the range still
+ * have to be stepped over.
+ */
+
+/*
+ * Returns true if the walk should seek to @range's first address (which is
+ * stored in @result), because @offset precedes it.
+ */
+static bool range_start(struct ipv4_range const *range,
+		struct ipv4_transport_addr const *offset,
+		struct ipv4_transport_addr *result)
+{
+	if (!range)
+		return false;
+
+	result->l3 = range->prefix.addr;
+	result->l4 = range->ports.min;
+	return !offset || taddr4_compare(offset, result) < 0;
+}
+
+/* The walk starts at or after @range's first address, so this means "done." */
+static bool range_ended(struct ipv4_range const *range,
+		struct ipv4_transport_addr const *addr)
+{
+	return range && !prefix4_contains(&range->prefix, &addr->l3);
+}
+
+static bool range_has_port(struct ipv4_range const *range, __u16 port)
+{
+	return !range || port_range_contains(&range->ports, port);
+}
+
+static bool range_hits_shard(struct ipv4_range const *range, unsigned int s)
+{
+	unsigned int port;
+
+	if (!range || range->ports.max - range->ports.min + 1u >= BIB_SHARDS)
+		return true;
+
+	for (port = range->ports.min; port <= range->ports.max; port++)
+		if (port2shard(port) == s)
+			return true;
+	return false;
+}
+
+static int foreach_table(struct bib_table *table,
+		bib_foreach_entry_cb cb, void *cb_arg,
+		const struct ipv4_transport_addr *offset,
+		struct ipv4_range const *range,
+		struct bib_entry *chunk)
+{
+	struct ipv4_transport_addr resume;
+	struct rb_node *node;
+	struct tabled_bib *bib;
+	unsigned int visited;
+	unsigned int count;
+	unsigned int i;
+	bool include;
+	int error;
+
+	include = range_start(range, offset, &resume);
+	if (include)
+		offset = &resume;
+
+	do {
+		visited = 0;
+		count = 0;
+
+		jlock_lock_bh(&table->lock);
+		node = find_starting_point(table, offset, include);
+		for (; node && visited < FOREACH_CHUNK;
+				node = rb_next(node), visited++) {
+			bib = bib4_entry(node);
+			if (range_ended(range, &bib->src4)) {
+				node = NULL;
+				break;
+			}
+			if (range_has_port(range, bib->src4.l4))
+				tbtobe(bib, &chunk[count++]);
+			resume = bib->src4;
+		}
+		jlock_unlock_bh(&table->lock);
+
+		for (i = 0; i < count; i++) {
+			error = cb(&chunk[i], cb_arg);
+			if (error)
+				return error;
+		}
+
+		if (visited > 0) {
+			offset = &resume;
+			include = false;
+		}
+		cond_resched();
+	} while (node);
+
+	return 0;
+}
+
+/* Can sleep. */
+int bib_foreach(struct bib *db, l4_protocol proto,
+		bib_foreach_entry_cb cb, void *cb_arg,
+		const struct ipv4_transport_addr *offset)
+{
+	return bib_foreach_range(db, proto, cb, cb_arg, offset, NULL);
+}
+
+/*
+ * Same as bib_foreach(), except it only visits the entries whose IPv4
+ * transport address belongs to @range. (NULL means all of them.)
+ *
+ * Can sleep.
+ */
+int bib_foreach_range(struct bib *db, l4_protocol proto,
+		bib_foreach_entry_cb cb, void *cb_arg,
+		const struct ipv4_transport_addr *offset,
+		struct ipv4_range const *range)
+{
+	struct bib_table *tables;
+	struct bib_entry *chunk;
+	unsigned int s;
+	int error;
+
+	tables = get_table(db, proto);
+	if (!tables)
+		return -EINVAL;
+
+	chunk = __wkmalloc("bib foreach chunk",
+			FOREACH_CHUNK * sizeof(struct bib_entry), GFP_KERNEL);
+	if (!chunk)
+		return -ENOMEM;
+
+	/* The offset's shard precedes the remaining ones. */
+	error = 0;
+	for (s = offset ? port2shard(offset->l4) : 0; s < BIB_SHARDS; s++) {
+		if (range_hits_shard(range, s)) {
+			error = foreach_table(&tables[s], cb, cb_arg, offset,
+					range, chunk);
+			if (error)
+				break;
+		}
+		offset = NULL;
+	}
+
+	__wkfree("bib foreach chunk", chunk);
+	return error;
+}
+
+/*
+ * Returns the first entry of @table that @covers rejects, or NULL.
+ * Whenever @covers accepts an entry, it also claims the ports that follow it,
+ * so the walk jumps over them instead of visiting them one by one.
+ */
+static bool find_uncovered_table(struct bib_table *table,
+		bib_covers_cb covers, void *arg, struct bib_entry *result)
+{
+	struct ipv4_transport_addr cursor;
+	struct rb_node *node;
+	struct tabled_bib *bib;
+	bool include;
+	__u16 last;
+
+	include = true;
+	cursor.l3.s_addr = 0;
+	cursor.l4 = 0;
+
+	do {
+		jlock_lock_bh(&table->lock);
+		node = find_starting_point(table, &cursor, include);
+		if (node) {
+			bib = bib4_entry(node);
+			tbtobe(bib, result);
+		}
+		jlock_unlock_bh(&table->lock);
+
+		if (!node)
+			return false;
+		if (!covers(&result->addr4, &last, arg))
+			return true;
+
+		cursor.l3 = result->addr4.l3;
+		cursor.l4 = max(last, result->addr4.l4);
+		include = false;
+		cond_resched();
+	} while (true);
+}
+
+/**
+ * bib_find_uncovered - Looks for a @proto BIB entry whose IPv4 transport
+ * address @covers rejects. Returns true (and copies it to @result) if it finds
+ * one. Can sleep.
+ *
+ * @covers should write to its second argument the last port (of the entry's
+ * address) it would also accept. So the number of visits depends on how
+ * fragmented @covers's ranges are, not on the size of the database.
+ */
+bool bib_find_uncovered(struct bib *db, l4_protocol proto,
+		bib_covers_cb covers, void *arg, struct bib_entry *result)
+{
+	struct bib_table *tables;
+	unsigned int s;
+
+	tables = get_table(db, proto);
+	if (!tables)
+		return false;
+
+	for (s = 0; s < BIB_SHARDS; s++)
+		if (find_uncovered_table(&tables[s], covers, arg, result))
+			return true;
 
-	/*
-	 * If offset is not found, start from offset's next anyway.
-	 * (If offset was meant to exist, it probably timed out and died while
-	 * the caller wasn't holding the spinlock; it's nothing to worry about.)
-	 */
-	bib = rb_entry(parent, struct tabled_bib, hook4);
-	return (compare_src4(bib, offset) < 0) ? rb_next(parent) : parent;
+	return false;
 }
 
-int bib_foreach(struct bib *db, l4_protocol proto,
-		bib_foreach_entry_cb cb, void *cb_arg,
-		const struct ipv4_transport_addr *offset)
+/*
+ * Returns the number of port map bits of @shard that represent ports of
+ * @ports, and the first one. (Zero if the range misses the shard.)
+ */
+static unsigned int shard_bits(unsigned int shard,
+		struct port_range const *ports, unsigned int *first)
 {
-	struct bib_table *table;
+	unsigned int min, max;
+
+	min = (ports->min & ~BIB_SHARD_MASK) | shard;
+	if (min < ports->min)
+		min += BIB_SHARDS;
+	max = (ports->max & ~BIB_SHARD_MASK) | shard;
+	if (max > ports->max) {
+		if (max < BIB_SHARDS)
+			return 0;
+		max -= BIB_SHARDS;
+	}
+	if (min > max)
+		return 0;
+
+	*first = port2bit(min);
+	return port2bit(max) - *first + 1;
+}
+
+/* Counts @table's entries whose src4 is @addr and whose port is in @ports. */
+static unsigned int count_addr(struct bib_table *table, struct in_addr addr,
+		struct port_range const *ports, unsigned int first,
+		unsigned int bits)
+{
+	struct port_map *map;
 	struct rb_node *node;
-	struct tabled_bib *tabled;
-	struct bib_entry bib;
-	int error = 0;
+	struct tabled_bib *bib;
+	struct ipv4_transport_addr key;
+	unsigned int count;
 
-	table = get_table(db, proto);
-	if (!table)
-		return -EINVAL;
+	map = find_port_map(table, &addr);
+	if (map) {
+		return bitmap_weight(map->ports, first + bits)
+				- bitmap_weight(map->ports, first);
+	}
+
+	/* No map; fall back to walking the range in tree4. */
+	key.l3 = addr;
+	key.l4 = ports->min;
+	count = 0;
+	node = find_starting_point(table, &key, true);
+	for (; node; node = rb_next(node)) {
+		bib = bib4_entry(node);
+		if (!addr4_equals(&bib->src4.l3, &addr)
+				|| bib->src4.l4 > ports->max)
+			break;
+		count++;
+	}
 
-	spin_lock_bh(&table->lock);
+	return count;
+}
 
-	node = find_starting_point(table, offset, false);
-	for (; node && !error; node = rb_next(node)) {
-		tabled = bib4_entry(node);
-		tbtobe(tabled, &bib);
-		error = cb(&bib, cb_arg);
+/**
+ * bib_count_range - Returns the number of @proto BIB entries (static ones
+ * included) whose IPv4 transport address belongs to @range.
+ *
+ * The addresses whose ports are being tracked by port maps are counted
+ * straight from them. The rest cost an ordered walk of their part of tree4.
+ * The table lock is held one address at a time. Can sleep.
+ */
+__u64 bib_count_range(struct bib *db, l4_protocol proto,
+		struct ipv4_range const *range)
+{
+	struct bib_table *tables;
+	struct bib_table *table;
+	struct in_addr addr;
+	unsigned int first, bits;
+	unsigned int s;
+	__u64 cursor;
+	__u64 result;
+
+	tables = get_table(db, proto);
+	if (!tables)
+		return 0;
+
+	result = 0;
+	for (s = 0; s < BIB_SHARDS; s++) {
+		table = &tables[s];
+		bits = shard_bits(s, &range->ports, &first);
+		if (!bits)
+			continue;
+
+		foreach_addr4(addr, cursor, &range->prefix) {
+			jlock_lock_bh(&table->lock);
+			result += count_addr(table, addr, &range->ports, first,
+					bits);
+			jlock_unlock_bh(&table->lock);
+			cond_resched();
+		}
 	}
 
-	spin_unlock_bh(&table->lock);
-	return error;
+	return result;
 }
 
 static struct rb_node *slot_next(struct tree_slot *slot)
@@ -2150,57 +6584,146 @@ static void find_session_offset(struct bib_table *table,
 		next_session(rb_next(&pos->session->tree_hook), pos);
 }
 
-#define foreach_bib(table, node) \
-		for (node = bib4_entry(rb_first(&(table)->tree4)); \
-				node; \
-				node = bib4_entry(rb_next(&node->hook4)))
-#define foreach_session(tree, node) \
-		for (node = node2session(rb_first(tree)); \
-				node; \
-				node = node2session(rb_next(&node->tree_hook)))
+static int foreach_session_table(struct xlator *jool, struct bib_table *table,
+		session_foreach_entry_cb cb, void *cb_arg,
+		struct session_foreach_offset *offset,
+		struct ipv4_range const *range,
+		struct session_entry *chunk)
+{
+	struct session_foreach_offset resume;
+	struct bib_session_tuple pos;
+	unsigned int visited;
+	unsigned int count;
+	unsigned int i;
+	int error;
+
+	if (range_start(range, offset ? &offset->offset.src : NULL,
+			&resume.offset.src)) {
+		resume.offset.dst.l3.s_addr = 0;
+		resume.offset.dst.l4 = 0;
+		resume.include_offset = true;
+		offset = &resume;
+	}
+
+	do {
+		visited = 0;
+		count = 0;
+
+		jlock_lock_bh(&table->lock);
+
+		if (offset) {
+			/* if pos.session != NULL, then pos.bib != NULL. */
+			find_session_offset(table, offset, &pos);
+		} else {
+			pos.bib = bib4_entry(rb_first(&table->tree4));
+			pos.session = NULL;
+		}
+
+		/* A NULL @pos.session means "from @pos.bib's first session." */
+		while (pos.bib) {
+			if (range_ended(range, &pos.bib->src4)) {
+				pos.bib = NULL;
+				break;
+			}
+
+			if (range_has_port(range, pos.bib->src4.l4)) {
+				if (!pos.session)
+					pos.session = node2session(
+						rb_first(&pos.bib->sessions));
+				for (; pos.session && visited < FOREACH_CHUNK;
+						pos.session = node2session(
+						rb_next(&pos.session->tree_hook)),
+						visited++) {
+					tstose(jool, pos.session,
+							&chunk[count]);
+					resume.offset.src = chunk[count].src4;
+					resume.offset.dst = chunk[count].dst4;
+					count++;
+				}
+			} else {
+				/* Resume after all of the BIB's sessions. */
+				resume.offset.src = pos.bib->src4;
+				resume.offset.dst.l3.s_addr = cpu_to_be32(0xFFFFFFFFu);
+				resume.offset.dst.l4 = 0xFFFFu;
+				visited++;
+			}
+
+			if (visited >= FOREACH_CHUNK)
+				break;
+			pos.bib = bib4_entry(rb_next(&pos.bib->hook4));
+			pos.session = NULL;
+		}
+
+		jlock_unlock_bh(&table->lock);
+
+		for (i = 0; i < count; i++) {
+			error = cb(&chunk[i], cb_arg);
+			if (error)
+				return error;
+		}
+
+		if (visited > 0) {
+			resume.include_offset = false;
+			offset = &resume;
+		}
+		cond_resched();
+	} while (pos.bib);
+
+	return 0;
+}
 
+/* Can sleep. */
 int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 		session_foreach_entry_cb cb, void *cb_arg,
 		struct session_foreach_offset *offset)
 {
-	struct bib_table *table;
-	struct bib_session_tuple pos;
-	struct session_entry tmp;
-	int error = 0;
+	return bib_foreach_session_range(jool, proto, cb, cb_arg, offset,
+			NULL);
+}
 
-	table = get_table(jool->nat64.bib, proto);
-	if (!table)
-		return -EINVAL;
+/*
+ * Same as bib_foreach_session(), except it only visits the sessions whose IPv4
+ * source transport address belongs to @range. (NULL means all of them.)
+ *
+ * Can sleep.
+ */
+int bib_foreach_session_range(struct xlator *jool, l4_protocol proto,
+		session_foreach_entry_cb cb, void *cb_arg,
+		struct session_foreach_offset *offset,
+		struct ipv4_range const *range)
+{
+	struct bib_table *tables;
+	struct session_entry *chunk;
+	unsigned int s;
+	int error;
 
-	spin_lock_bh(&table->lock);
+	tables = get_table(jool->nat64.bib, proto);
+	if (!tables)
+		return -EINVAL;
 
-	if (offset) {
-		find_session_offset(table, offset, &pos);
-		/* if pos.session != NULL, then pos.bib != NULL. */
-		if (pos.session)
-			goto goto_session;
-		if (pos.bib)
-			goto goto_bib;
-		goto end;
-	}
+	chunk = __wkmalloc("session foreach chunk",
+			FOREACH_CHUNK * sizeof(struct session_entry),
+			GFP_KERNEL);
+	if (!chunk)
+		return -ENOMEM;
 
-	foreach_bib(table, pos.bib) {
-goto_bib:	foreach_session(&pos.bib->sessions, pos.session) {
-goto_session:		tstose(jool, pos.session, &tmp);
-			error = cb(&tmp, cb_arg);
+	/* The offset's shard precedes the remaining ones. */
+	error = 0;
+	s = offset ? port2shard(offset->offset.src.l4) : 0;
+	for (; s < BIB_SHARDS; s++) {
+		if (range_hits_shard(range, s)) {
+			error = foreach_session_table(jool, &tables[s], cb,
+					cb_arg, offset, range, chunk);
 			if (error)
-				goto end;
+				break;
 		}
+		offset = NULL;
 	}
 
-end:
-	spin_unlock_bh(&table->lock);
+	__wkfree("session foreach chunk", chunk);
 	return error;
 }
 
-#undef foreach_session
-#undef foreach_bib
-
 int bib_find6(struct bib *db, l4_protocol proto,
 		struct ipv6_transport_addr *addr,
 		struct bib_entry *result)
@@ -2208,15 +6731,17 @@ int bib_find6(struct bib *db, l4_protocol proto,
 	struct bib_table *table;
 	struct tabled_bib *bib;
 
-	table = get_table(db, proto);
+	table = get_table6(db, proto, addr);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	jlock_lock_bh(&table->lock);
 	bib = find_bib6(table, addr);
+	if (bib && bib_doomed(db, bib))
+		bib = NULL;
 	if (bib)
 		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
 
 	return bib ? 0 : -ESRCH;
 }
@@ -2228,15 +6753,17 @@ int bib_find4(struct bib *db, l4_protocol proto,
 	struct bib_table *table;
 	struct tabled_bib *bib;
 
-	table = get_table(db, proto);
+	table = get_table4(db, proto, addr);
 	if (!table)
 		return -EINVAL;
 
-	spin_lock_bh(&table->lock);
+	jlock_lock_bh(&table->lock);
 	bib = find_bib4(table, addr);
+	if (bib && bib_doomed(db, bib))
+		bib = NULL;
 	if (bib)
 		tbtobe(bib, result);
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
 
 	return bib ? 0 : -ESRCH;
 }
@@ -2250,32 +6777,27 @@ static void bib2tabled(struct bib_entry *bib, struct tabled_bib *tabled)
 	tabled->sessions = RB_ROOT;
 }
 
-static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
-		struct bib_entry *old)
+/*
+ * Hangs @bib from @table, or upgrades @bib's dynamic twin to static.
+ * Expects @table's lock to be held.
+ *
+ * Returns 0 if @bib is now owned by @table, 1 if it wasn't needed (so the
+ * caller still has to free it), and -EEXIST if it collides with existing entry
+ * @old.
+ */
+static int add_static_locked(struct xlator *jool, struct bib_table *table,
+		struct tabled_bib *bib, struct bib_entry *old)
 {
-	struct bib_table *table;
-	struct tabled_bib *bib;
 	struct tabled_bib *collision;
 	struct tree_slot slot6;
 	struct tree_slot slot4;
 
-	__log_debug(jool, "Adding static BIB entry " BEPP ".", BEPA(new));
-
-	table = get_table(jool->nat64.bib, new->l4_proto);
-	if (!table)
-		return -EINVAL;
-
-	bib = alloc_bib(GFP_ATOMIC);
-	if (!bib)
-		return -ENOMEM;
-	bib2tabled(new, bib);
-
-	spin_lock_bh(&table->lock);
-
 	collision = find_bibtree6_slot(table, bib, &slot6);
 	if (collision) {
-		if (taddr4_equals(&bib->src4, &collision->src4))
-			goto upgrade;
+		if (taddr4_equals(&bib->src4, &collision->src4)) {
+			collision->is_static = true;
+			return 1;
+		}
 		goto eexist;
 	}
 
@@ -2283,9 +6805,16 @@ static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
 	if (collision)
 		goto eexist;
 
+	bib->generation = READ_ONCE(jool->nat64.bib->generation);
+	bib4_filter_add(table, bib);
 	treeslot_commit(&slot6);
 	treeslot_commit(&slot4);
-	jstat_inc(jool->stats, JSTAT_BIB_ENTRIES);
+	port_map_add(table, bib);
+	table->bib_count++;
+	block_add_bib(jool, table, bib);
+	hash_add_bib(table, bib);
+	count_bibs(jool, 1);
+	trace_bib_add(jool, bib);
 
 	/*
 	 * Since the BIB entry is now available, and assuming ADF is disabled,
@@ -2293,25 +6822,50 @@ static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
 	 * That's bound to be a lot of messy code though, and the v4 client is
 	 * going to retry anyway, so let's just forget the packets instead.
 	 */
-	if (new->l4_proto == L4PROTO_TCP)
-		pktqueue_rm(jool->nat64.bib->tcp.pkt_queue, &new->addr4);
-
-	spin_unlock_bh(&table->lock);
-	return 0;
+	if (bib->proto == L4PROTO_TCP)
+		table->pkt_count -= pktqueue_rm(table->pkt_queue, &bib->src4);
 
-upgrade:
-	collision->is_static = true;
-	spin_unlock_bh(&table->lock);
-	free_bib(bib);
 	return 0;
 
 eexist:
 	tbtobe(collision, old);
-	spin_unlock_bh(&table->lock);
-	free_bib(bib);
 	return -EEXIST;
 }
 
+static int __bib_add_static(struct xlator *jool, struct bib_entry *new,
+		struct bib_entry *old)
+{
+	struct bib_table *table;
+	struct tabled_bib *bib;
+	int error;
+
+	__log_debug(jool, "Adding static BIB entry " BEPP ".", BEPA(new));
+
+	if (!shards_match(&new->addr6, &new->addr4)) {
+		log_err("The BIB is split in %u shards, so the ports of static BIB entries need to be congruent modulo %u. (%u and %u are not.)",
+				BIB_SHARDS, BIB_SHARDS,
+				new->addr6.l4, new->addr4.l4);
+		return -EINVAL;
+	}
+
+	table = get_table4(jool->nat64.bib, new->l4_proto, &new->addr4);
+	if (!table)
+		return -EINVAL;
+
+	bib = alloc_bib();
+	if (!bib)
+		return -ENOMEM;
+	bib2tabled(new, bib);
+
+	jlock_lock_bh(&table->lock);
+	error = add_static_locked(jool, table, bib, old);
+	jlock_unlock_bh(&table->lock);
+
+	if (error)
+		free_bib(bib);
+	return (error > 0) ? 0 : error;
+}
+
 /* Noisy version. */
 int bib_add_static(struct xlator *jool, struct bib_entry *new)
 {
@@ -2326,6 +6880,9 @@ int bib_add_static(struct xlator *jool, struct bib_entry *new)
 		log_err("Entry " BEPP " collides with " BEPP ".",
 				BEPA(new), BEPA(&old));
 		break;
+	case -EINVAL:
+		/* Already logged. */
+		break;
 	default:
 		log_err("Unknown error code: %d", error);
 		break;
@@ -2334,6 +6891,115 @@ int bib_add_static(struct xlator *jool, struct bib_entry *new)
 	return error;
 }
 
+static int compare_static(void const *a, void const *b)
+{
+	struct bib_entry const *e1 = *(struct bib_entry * const *)a;
+	struct bib_entry const *e2 = *(struct bib_entry * const *)b;
+	int gap;
+
+	gap = (int)e1->l4_proto - (int)e2->l4_proto;
+	if (gap)
+		return gap;
+	gap = (int)port2shard(e1->addr4.l4) - (int)port2shard(e2->addr4.l4);
+	if (gap)
+		return gap;
+	return taddr4_compare(&e1->addr4, &e2->addr4);
+}
+
+/* Static entries added per lock hold, at most. */
+#define BULK_RUN 64
+
+/**
+ * bib_add_static_bulk - Quiet, batched bib_add_static().
+ *
+ * The entries are added in table and IPv4 order, so each table is locked once
+ * per run of (up to BULK_RUN) entries, and consecutive insertions walk the
+ * same tree paths.
+ *
+ * Entries that cannot be added (because they collide or don't fit in any
+ * shard) do not interrupt the operation; their bits in @failures (which needs
+ * @count bits) are set instead.
+ *
+ * Can sleep.
+ */
+int bib_add_static_bulk(struct xlator *jool, struct bib_entry *entries,
+		unsigned int count, unsigned long *failures)
+{
+	struct bib_entry **sorted;
+	struct bib_entry *entry;
+	struct bib_entry old;
+	struct bib_table *table, *locked;
+	struct tabled_bib *bib;
+	unsigned int run;
+	unsigned int i;
+	int error;
+
+	bitmap_zero(failures, count);
+	if (!count)
+		return 0;
+
+	sorted = __wkvmalloc("Static BIB sort buffer", count * sizeof(*sorted));
+	if (!sorted)
+		return -ENOMEM;
+	for (i = 0; i < count; i++)
+		sorted[i] = &entries[i];
+	sort(sorted, count, sizeof(*sorted), compare_static, NULL);
+
+	locked = NULL;
+	bib = NULL;
+	run = 0;
+	error = 0;
+
+	for (i = 0; i < count; i++) {
+		entry = sorted[i];
+
+		table = shards_match(&entry->addr6, &entry->addr4)
+				? get_table4(jool->nat64.bib, entry->l4_proto,
+						&entry->addr4)
+				: NULL;
+		if (!table) {
+			__set_bit(entry - entries, failures);
+			continue;
+		}
+
+		if (!bib) {
+			bib = alloc_bib();
+			if (!bib) {
+				error = -ENOMEM;
+				break;
+			}
+		}
+		bib2tabled(entry, bib);
+
+		if (table != locked || run >= BULK_RUN) {
+			if (locked)
+				jlock_unlock_bh(&locked->lock);
+			jlock_lock_bh(&table->lock);
+			locked = table;
+			run = 0;
+		}
+		run++;
+
+		switch (add_static_locked(jool, table, bib, &old)) {
+		case 0:
+			bib = NULL;
+			break;
+		case 1:
+			break;
+		default:
+			__set_bit(entry - entries, failures);
+		}
+	}
+
+	if (locked)
+		jlock_unlock_bh(&locked->lock);
+
+	if (bib)
+		free_bib(bib);
+	__wkvfree("Static BIB sort buffer", sorted);
+	return error;
+}
+
 int bib_rm(struct xlator *jool, struct bib_entry *entry)
 {
 	struct bib_table *table;
@@ -2341,13 +7007,13 @@ int bib_rm(struct xlator *jool, struct bib_entry *entry)
 	struct tabled_bib *bib;
 	int error = -ESRCH;
 
-	table = get_table(jool->nat64.bib, entry->l4_proto);
+	table = get_table6(jool->nat64.bib, entry->l4_proto, &entry->addr6);
 	if (!table)
 		return -EINVAL;
 
 	bib2tabled(entry, &key);
 
-	spin_lock_bh(&table->lock);
+	jlock_lock_bh(&table->lock);
 
 	bib = find_bib6(table, &key.src6);
 	if (bib && taddr4_equals(&key.src4, &bib->src4)) {
@@ -2355,7 +7021,7 @@ int bib_rm(struct xlator *jool, struct bib_entry *entry)
 		error = 0;
 	}
 
-	spin_unlock_bh(&table->lock);
+	jlock_unlock_bh(&table->lock);
 
 	if (!error)
 		release_bib_entry(bib);
@@ -2363,68 +7029,239 @@ int bib_rm(struct xlator *jool, struct bib_entry *entry)
 	return error;
 }
 
-void bib_rm_range(struct xlator *jool, l4_protocol proto,
-		struct ipv4_range *range)
+/*
+ * Detaches @reap's entries from @table, REAP_CHUNK visits per lock hold.
+ * Can sleep.
+ */
+static void reap_table(struct xlator *jool, struct bib_table *table,
+		struct bib_reap *reap)
 {
-	struct bib_table *table;
-	struct ipv4_transport_addr offset;
+	struct ipv4_transport_addr cursor;
 	struct rb_node *node;
-	struct rb_node *next;
 	struct tabled_bib *bib;
-	struct bib_delete_list delete_list = { NULL };
+	struct bib_delete_list delete_list;
+	unsigned int visited;
+	bool include;
 
-	table = get_table(jool->nat64.bib, proto);
-	if (!table)
-		return;
+	cursor.l3 = reap->range.prefix.addr;
+	cursor.l4 = reap->range.ports.min;
+	include = true;
 
-	offset.l3 = range->prefix.addr;
-	offset.l4 = range->ports.min;
+	do {
+		delete_list.first = NULL;
+		visited = 0;
+
+		jlock_lock_bh(&table->lock);
+
+		node = find_starting_point(table, &cursor, include);
+		while (node && visited < REAP_CHUNK) {
+			bib = bib4_entry(node);
+			if (!prefix4_contains(&reap->range.prefix,
+					&bib->src4.l3)) {
+				node = NULL;
+				break;
+			}
+
+			cursor = bib->src4;
+			node = rb_next(node);
+			visited++;
+
+			if (reap_covers(reap, bib)) {
+				detach_bib(jool, table, bib);
+				add_to_delete_list(&delete_list, bib);
+				reap->removed++;
+			}
+		}
 
-	spin_lock_bh(&table->lock);
+		jlock_unlock_bh(&table->lock);
 
-	node = find_starting_point(table, &offset, true);
-	for (; node; node = next) {
-		next = rb_next(node);
-		bib = bib4_entry(node);
+		commit_delete_list(&delete_list);
+		include = false;
+		cond_resched();
+	} while (node);
+}
 
-		if (!prefix4_contains(&range->prefix, &bib->src4.l3))
-			break;
-		if (port_range_contains(&range->ports, bib->src4.l4)) {
-			detach_bib(jool, table, bib);
-			add_to_delete_list(&delete_list, node);
-		}
+static void run_reap(struct xlator *jool, struct bib_reap *reap)
+{
+	struct bib_table *tables;
+	l4_protocol proto;
+	unsigned int s;
+
+	for (proto = L4PROTO_TCP; proto <= L4PROTO_ICMP; proto++) {
+		if (!reap->all && proto != reap->proto)
+			continue;
+		tables = get_table(jool->nat64.bib, proto);
+		if (!tables)
+			continue;
+		for (s = 0; s < BIB_SHARDS; s++)
+			if (range_hits_shard(&reap->range, s))
+				reap_table(jool, &tables[s], reap);
+	}
+}
+
+static void init_reap(struct bib_reap *reap, bool all, l4_protocol proto,
+		struct ipv4_range const *range)
+{
+	reap->all = all;
+	reap->proto = proto;
+	reap->src6_set = false;
+	reap->removed = 0;
+	if (range) {
+		reap->range = *range;
+	} else {
+		reap->range.prefix.addr.s_addr = 0;
+		reap->range.prefix.len = 0;
+		reap->range.ports.min = 0;
+		reap->range.ports.max = 65535;
 	}
+}
 
-	spin_unlock_bh(&table->lock);
+/* From now on, the entries that already exist are older than @reap. */
+static void start_generation(struct bib *db, struct bib_reap *reap)
+{
+	db->generation = (db->generation + 1) & BIB_GEN_MASK;
+	reap->generation = db->generation;
+}
 
-	commit_delete_list(&delete_list);
+static void reap_rcu_cb(struct rcu_head *rcu)
+{
+	wkfree(struct bib_reap, container_of(rcu, struct bib_reap, rcu));
 }
 
-static void flush_table(struct xlator *jool, struct bib_table *table)
+static void reap_work_fn(struct work_struct *work)
 {
-	struct rb_node *node;
-	struct rb_node *next;
-	struct bib_delete_list delete_list = { NULL };
+	struct bib_reap *reap;
+	struct bib *db;
+
+	reap = container_of(work, struct bib_reap, work);
+	db = reap->jool.nat64.bib;
 
-	spin_lock_bh(&table->lock);
+	run_reap(&reap->jool, reap);
 
-	for (node = rb_first(&table->tree4); node; node = next) {
-		next = rb_next(node);
-		detach_bib(jool, table, bib4_entry(node));
-		add_to_delete_list(&delete_list, node);
+	spin_lock_bh(&db->reap_lock);
+	list_del_rcu(&reap->hook);
+	spin_unlock_bh(&db->reap_lock);
+
+	put_net(reap->jool.ns);
+	xlator_put(&reap->jool);
+	/* bib_doomed() might still be looking at it. */
+	call_rcu(&reap->rcu, reap_rcu_cb);
+}
+
+/* Synchronous version of queue_reap(). Still yields between chunks. */
+static void reap_now(struct xlator *jool, bool all, l4_protocol proto,
+		struct ipv4_range const *range)
+{
+	struct bib *db = jool->nat64.bib;
+	struct bib_reap reap;
+
+	init_reap(&reap, all, proto, range);
+	spin_lock_bh(&db->reap_lock);
+	start_generation(db, &reap);
+	spin_unlock_bh(&db->reap_lock);
+
+	run_reap(jool, &reap);
+}
+
+static void queue_reap(struct xlator *jool, bool all, l4_protocol proto,
+		struct ipv4_range const *range)
+{
+	struct bib *db = jool->nat64.bib;
+	struct bib_reap *reap;
+
+	reap = wkmalloc(struct bib_reap, GFP_KERNEL);
+	if (!reap)
+		goto fallback;
+	/* The namespace might be dying; see the note in struct xlator. */
+	if (!maybe_get_net(jool->ns)) {
+		wkfree(struct bib_reap, reap);
+		goto fallback;
 	}
 
-	spin_unlock_bh(&table->lock);
+	init_reap(reap, all, proto, range);
+	memcpy(&reap->jool, jool, sizeof(*jool));
+	xlator_get(&reap->jool);
+	INIT_WORK(&reap->work, reap_work_fn);
+
+	spin_lock_bh(&db->reap_lock);
+	start_generation(db, reap);
+	list_add_tail_rcu(&reap->hook, &db->reaps);
+	spin_unlock_bh(&db->reap_lock);
 
-	commit_delete_list(&delete_list);
+	queue_work(xmit_wq, &reap->work);
+	return;
+
+fallback:
+	reap_now(jool, all, proto, range);
 }
 
-void bib_flush(struct xlator *jool)
+/**
+ * bib_rm_range - Removes the @proto BIB entries (and their sessions) whose
+ * IPv4 transport address belongs to @range. Can sleep.
+ */
+void bib_rm_range(struct xlator *jool, l4_protocol proto,
+		struct ipv4_range *range)
+{
+	reap_now(jool, false, proto, range);
+}
+
+/**
+ * bib_rm_range_async - Same as bib_rm_range(), except it returns right away,
+ * and the entries are removed in the background.
+ *
+ * The packet path treats the doomed entries as nonexistent in the meantime.
+ * Can sleep.
+ */
+void bib_rm_range_async(struct xlator *jool, l4_protocol proto,
+		struct ipv4_range *range)
+{
+	queue_reap(jool, false, proto, range);
+}
+
+/**
+ * bib_purge - Removes the @proto BIB entries (and their sessions) whose IPv4
+ * transport address belongs to @range, and whose IPv6 address belongs to @src6.
+ * Returns the number of entries removed. Can sleep.
+ *
+ * @range and @src6 can be NULL, meaning any address. Same as the other
+ * removals, the walk is confined to @range in the IPv4 tree, and only holds
+ * the table lock for REAP_CHUNK entries at a time.
+ */
+unsigned long bib_purge(struct xlator *jool, l4_protocol proto,
+		struct ipv4_range const *range, struct ipv6_prefix const *src6)
 {
 	struct bib *db = jool->nat64.bib;
-	flush_table(jool, &db->tcp);
-	flush_table(jool, &db->udp);
-	flush_table(jool, &db->icmp);
+	struct bib_reap reap;
+
+	init_reap(&reap, false, proto, range);
+	if (src6) {
+		reap.src6_set = true;
+		reap.src6 = *src6;
+	}
+
+	spin_lock_bh(&db->reap_lock);
+	start_generation(db, &reap);
+	spin_unlock_bh(&db->reap_lock);
+
+	run_reap(jool, &reap);
+	return reap.removed;
+}
+
+/**
+ * bib_flush - Removes all of the database's entries. Can sleep.
+ */
+void bib_flush(struct xlator *jool)
+{
+	reap_now(jool, true, L4PROTO_TCP, NULL);
+}
+
+/**
+ * bib_flush_async - bib_flush(), in the background. (See
+ * bib_rm_range_async().)
+ */
+void bib_flush_async(struct xlator *jool)
+{
+	queue_reap(jool, true, L4PROTO_TCP, NULL);
 }
 
 static void print_tabs(int tabs)
@@ -2444,8 +7281,8 @@ static void print_session(struct rb_node *node, int tabs, char *prefix)
 
 	session = node2session(node);
 	print_tabs(tabs);
-	pr_cont("[%s] " TA4PP " " TA6PP "\n", prefix, TA4PA(session->dst4),
-			TA6PA(session->dst6));
+	pr_cont("[%s] " TA4PP " #%u\n", prefix, TA4PA(session->dst4),
+			session->dst6_l4);
 
 	print_session(node->rb_left, tabs + 1, "L"); /* "Left" */
 	print_session(node->rb_right, tabs + 1, "R"); /* "Right" */
@@ -2468,12 +7305,53 @@ static void print_bib(struct rb_node *node, int tabs)
 	print_bib(node->rb_right, tabs + 1);
 }
 
+static unsigned int stored_pkts(struct bib_table *tables)
+{
+	unsigned int s;
+	int result;
+
+	result = 0;
+	for (s = 0; s < BIB_SHARDS; s++)
+		result += READ_ONCE(tables[s].pkt_count);
+
+	return (result > 0) ? result : 0;
+}
+
+/**
+ * bib_stored_pkts - Returns the number of packets @db is currently storing.
+ * (Of both types; see pkt_queue.h.)
+ *
+ * Reads the tables without locking them, so it's only an estimate.
+ */
+unsigned int bib_stored_pkts(struct bib *db)
+{
+	return stored_pkts(db->tcp) + stored_pkts(db->udp)
+			+ stored_pkts(db->icmp);
+}
+
+/* Adds up the contention counters of all of @db's shards. */
+void bib_lock_stats(struct bib *db, struct jlock_stats *result)
+{
+	unsigned int s;
+
+	memset(result, 0, sizeof(*result));
+	for (s = 0; s < BIB_SHARDS; s++) {
+		jlock_query(&db->tcp[s].lock, result);
+		jlock_query(&db->udp[s].lock, result);
+		jlock_query(&db->icmp[s].lock, result);
+	}
+}
+
 void bib_print(struct bib *db)
 {
-	LOG_DEBUG("TCP:");
-	print_bib(db->tcp.tree4.rb_node, 1);
-	LOG_DEBUG("UDP:");
-	print_bib(db->udp.tree4.rb_node, 1);
-	LOG_DEBUG("ICMP:");
-	print_bib(db->icmp.tree4.rb_node, 1);
+	unsigned int s;
+
+	for (s = 0; s < BIB_SHARDS; s++) {
+		LOG_DEBUG("TCP (shard %u):", s);
+		print_bib(db->tcp[s].tree4.rb_node, 1);
+		LOG_DEBUG("UDP (shard %u):", s);
+		print_bib(db->udp[s].tree4.rb_node, 1);
+		LOG_DEBUG("ICMP (shard %u):", s);
+		print_bib(db->icmp[s].tree4.rb_node, 1);
+	}
 }
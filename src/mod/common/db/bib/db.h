@@ -8,6 +8,7 @@
  */
 
 #include "common/config.h"
+#include "mod/common/lockstat.h"
 #include "mod/common/packet.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/db/pool4/db.h"
@@ -77,6 +78,7 @@ struct collision_cb {
 
 /* These are used by Filtering. */
 
+bool bib_refresh6(struct xlation *state, struct ipv4_transport_addr *dst4);
 int bib_add6(struct xlation *state,
 		struct mask_domain *masks,
 		struct tuple *tuple6,
@@ -91,13 +93,25 @@ verdict bib_add_tcp6(struct xlation *xstate,
 verdict bib_add_tcp4(struct xlation *xstate,
 		struct ipv6_transport_addr *dst6,
 		struct collision_cb *cb);
+bool bib_police6(struct xlation *state);
 
 /* These are used by other kernel submodules. */
 
 int bib_find(struct bib *db, struct tuple *tuple,
 		struct bib_session *result);
+int bib_find_session(struct xlator *jool, struct tuple *tuple,
+		struct session_entry *result);
 int bib_add_session(struct xlator *jool, struct session_entry *new,
 		struct collision_cb *cb);
+int bib_import(struct xlator *jool, struct session_entry *sessions,
+		unsigned int count);
+/*
+ * @new is the incoming version of @old. Same rules as collision_cb.cb.
+ */
+typedef enum session_fate (*bib_sync_cb)(struct session_entry *old,
+		struct session_entry const *new, void *arg);
+int bib_sync(struct xlator *jool, struct session_entry *sessions,
+		unsigned int count, bib_sync_cb cb, void *arg);
 void bib_clean(struct xlator *jool);
 
 /* These are used by userspace request handling. */
@@ -116,6 +130,20 @@ int bib_foreach(struct bib *db, l4_protocol proto,
 int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 		session_foreach_entry_cb cb, void *cb_arg,
 		struct session_foreach_offset *offset);
+int bib_foreach_range(struct bib *db, l4_protocol proto,
+		bib_foreach_entry_cb cb, void *cb_arg,
+		const struct ipv4_transport_addr *offset,
+		struct ipv4_range const *range);
+int bib_foreach_session_range(struct xlator *jool, l4_protocol proto,
+		session_foreach_entry_cb cb, void *cb_arg,
+		struct session_foreach_offset *offset,
+		struct ipv4_range const *range);
+typedef bool (*bib_covers_cb)(struct ipv4_transport_addr const *, __u16 *,
+		void *);
+bool bib_find_uncovered(struct bib *db, l4_protocol proto,
+		bib_covers_cb covers, void *arg, struct bib_entry *result);
+__u64 bib_count_range(struct bib *db, l4_protocol proto,
+		struct ipv4_range const *range);
 int bib_find6(struct bib *db, l4_protocol proto,
 		struct ipv6_transport_addr *addr,
 		struct bib_entry *result);
@@ -123,10 +151,35 @@ int bib_find4(struct bib *db, l4_protocol proto,
 		struct ipv4_transport_addr *addr,
 		struct bib_entry *result);
 int bib_add_static(struct xlator *jool, struct bib_entry *new);
+int bib_add_static_bulk(struct xlator *jool, struct bib_entry *entries,
+		unsigned int count, unsigned long *failures);
 int bib_rm(struct xlator *jool, struct bib_entry *entry);
 void bib_rm_range(struct xlator *jool, l4_protocol proto,
 		struct ipv4_range *range);
+void bib_rm_range_async(struct xlator *jool, l4_protocol proto,
+		struct ipv4_range *range);
+unsigned long bib_purge(struct xlator *jool, l4_protocol proto,
+		struct ipv4_range const *range, struct ipv6_prefix const *src6);
 void bib_flush(struct xlator *jool);
+void bib_flush_async(struct xlator *jool);
+
+/*
+ * Cache warming for batches of packets. (See translate_batch().) Call every
+ * stage on every packet of the batch before moving on to the next stage.
+ */
+#define BIB_PREFETCH_STAGES 2
+#ifdef BIB_HASH_INDEX
+void bib_prefetch(struct bib *db, struct sk_buff *skb, unsigned int stage);
+#else
+static inline void bib_prefetch(struct bib *db, struct sk_buff *skb,
+		unsigned int stage)
+{
+	/* The trees can't be prefetched much in advance. */
+}
+#endif
+
+unsigned int bib_stored_pkts(struct bib *db);
+void bib_lock_stats(struct bib *db, struct jlock_stats *result);
 
 void bib_print(struct bib *db);
 
@@ -10,3 +10,29 @@ bool session_equals(const struct session_entry *s1,
 			&& taddr4_equals(&s1->dst4, &s2->dst4)
 			&& (s1->proto == s2->proto);
 }
+
+/**
+ * Returns the index of the timeout class of the sessions towards @dst4, plus
+ * one. Zero means the sessions use the protocol's global timeouts.
+ */
+unsigned int timeout_class_find(struct bib_config const *config,
+		l4_protocol proto, struct ipv4_transport_addr const *dst4)
+{
+	struct timeout_classes const *classes = &config->timeout_classes;
+	struct timeout_class const *class;
+	unsigned int i;
+
+	for (i = 0; i < classes->count; i++) {
+		class = &classes->values[i];
+		if (class->proto != proto)
+			continue;
+		if (proto != L4PROTO_ICMP
+				&& !port_range_contains(&class->range.ports,
+						dst4->l4))
+			continue;
+		if (prefix4_contains(&class->range.prefix, &dst4->l3))
+			return i + 1;
+	}
+
+	return 0;
+}
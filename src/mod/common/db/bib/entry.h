@@ -1,6 +1,7 @@
 #ifndef SRC_MOD_NAT64_BIB_ENTRY_H_
 #define SRC_MOD_NAT64_BIB_ENTRY_H_
 
+#include "common/config.h"
 #include "common/session.h"
 #include "common/types.h"
 
@@ -53,6 +54,11 @@ struct session_entry {
 
 	/** Jiffy (from the epoch) this session was last updated/used. */
 	unsigned long update_time;
+	/**
+	 * Jiffy the session was created. Not synchronized; zero means
+	 * unknown.
+	 */
+	unsigned long create_time;
 	/*
 	 * Number of jiffies before this session is to be downgraded. (Either
 	 * deleted or changed into a transitory state.)
@@ -60,6 +66,20 @@ struct session_entry {
 	unsigned long timeout;
 
 	bool has_stored;
+
+	/** Traffic seen by the session, both directions. (session-counters) */
+	__u64 packets;
+	__u64 bytes;
+
+	/**
+	 * What translating a TCP or UDP packet from @src6/@dst6 to @src4/@dst4
+	 * adds to its layer 4 checksum. (Ie. the IPv4 pseudoheader minus the
+	 * IPv6 pseudoheader, without lengths or protocols. Negate it for the
+	 * 4-to-6 direction.)
+	 *
+	 * Only set in the sessions handed over to the translation.
+	 */
+	__wsum csum;
 };
 
 /* Session Entry Printk Pattern */
@@ -83,5 +103,7 @@ struct bib_session {
 
 bool session_equals(const struct session_entry *s1,
 		const struct session_entry *s2);
+unsigned int timeout_class_find(struct bib_config const *config,
+		l4_protocol proto, struct ipv4_transport_addr const *dst4);
 
 #endif /* SRC_MOD_NAT64_BIB_ENTRY_H_ */
@@ -1,18 +1,49 @@
 #include "pkt_queue.h"
 
+#include <linux/jhash.h>
+#include <linux/random.h>
 #include "common/constants.h"
 #include "mod/common/icmp_wrapper.h"
 #include "mod/common/log.h"
 #include "mod/common/wkmalloc.h"
-#include "mod/common/db/rbtree.h"
+
+/*
+ * Buckets per index. These are per TCP table, and the queue is normally tiny
+ * (see maximum-simultaneous-opens), so there's no point in resizing.
+ */
+#define PKTQUEUE_HASH_BITS 8
+#define PKTQUEUE_HASH_SIZE (1u << PKTQUEUE_HASH_BITS)
+#define PKTQUEUE_HASH_MASK (PKTQUEUE_HASH_SIZE - 1)
 
 struct pktqueue {
-	/** The stored packets, sorted by expiration date. (oldest to newest) */
+	/**
+	 * The stored packets, sorted by expiration date. (oldest to newest)
+	 *
+	 * They all live for the same time, so this is a FIFO; expiring a packet
+	 * is O(1), and the cleaner never looks at packets that aren't dying.
+	 */
 	struct list_head node_list;
-	/** The same packets, sorted by IPv4 identifiers. */
-	struct rb_root node_tree;
+	/** The same packets, hashed by dst6. (Lookup key.) */
+	struct hlist_head nodes[PKTQUEUE_HASH_SIZE];
+	/** The same packets, hashed by IPv4 source. (For the per-source quota.) */
+	struct hlist_head sources[PKTQUEUE_HASH_SIZE];
+	/** Keeps the remote nodes from picking the buckets. */
+	u32 seed;
 };
 
+static unsigned int hash_dst6(struct pktqueue *queue,
+		struct ipv6_transport_addr const *addr)
+{
+	return jhash2((u32 const *)addr->l3.s6_addr32, 4,
+			queue->seed ^ addr->l4) & PKTQUEUE_HASH_MASK;
+}
+
+static unsigned int hash_src(struct pktqueue *queue, struct in_addr const *addr)
+{
+	return jhash_1word((__force u32)addr->s_addr, queue->seed)
+			& PKTQUEUE_HASH_MASK;
+}
+
 static unsigned long get_timeout(void)
 {
 	return msecs_to_jiffies(1000 * TCP_INCOMING_SYN);
@@ -25,22 +56,28 @@ static void send_icmp_error(struct pktqueue_session *node)
 	wkfree(struct pktqueue_session, node);
 }
 
-static void rm(struct pktqueue *queue, struct pktqueue_session *node)
+static void rm(struct pktqueue_session *node)
 {
 	list_del(&node->list_hook);
-	rb_erase(&node->tree_hook, &queue->node_tree);
+	hlist_del(&node->hash_hook);
+	hlist_del(&node->src_hook);
 }
 
 struct pktqueue *pktqueue_alloc(void)
 {
 	struct pktqueue *result;
+	unsigned int i;
 
 	result = wkmalloc(struct pktqueue, GFP_KERNEL);
 	if (!result)
 		return NULL;
 
 	INIT_LIST_HEAD(&result->node_list);
-	result->node_tree = RB_ROOT;
+	for (i = 0; i < PKTQUEUE_HASH_SIZE; i++) {
+		INIT_HLIST_HEAD(&result->nodes[i]);
+		INIT_HLIST_HEAD(&result->sources[i]);
+	}
+	get_random_bytes(&result->seed, sizeof(result->seed));
 
 	return result;
 }
@@ -55,43 +92,60 @@ void pktqueue_release(struct pktqueue *queue)
 	wkfree(struct pktqueue, queue);
 }
 
-static struct pktqueue_session *pktqueue_entry(const struct rb_node *node)
+static struct pktqueue_session *__find(struct pktqueue *queue,
+		struct ipv6_transport_addr const *dst6)
 {
-	return rb_entry(node, struct pktqueue_session, tree_hook);
+	struct pktqueue_session *node;
+
+	hlist_for_each_entry(node, &queue->nodes[hash_dst6(queue, dst6)],
+			hash_hook)
+		if (taddr6_equals(&node->dst6, dst6))
+			return node;
+
+	return NULL;
 }
 
-static int compare_rbnode(const struct rb_node *n1, const struct rb_node *n2)
+/* Returns true if @addr has already stored @max packets. */
+static bool src_quota_exceeded(struct pktqueue *queue,
+		struct in_addr const *addr, unsigned int max)
 {
-	return taddr6_compare(&pktqueue_entry(n1)->dst6,
-			&pktqueue_entry(n2)->dst6);
+	struct pktqueue_session *node;
+	unsigned int count;
+
+	if (!max)
+		return false;
+
+	count = 0;
+	hlist_for_each_entry(node, &queue->sources[hash_src(queue, addr)],
+			src_hook)
+		if (addr4_equals(&node->dst4.l3, addr) && ++count >= max)
+			return true;
+
+	return false;
 }
 
 /**
  * On success, assumes the caller's reference to @pkt's skb is being transferred
  * to @queue.
  *
+ * @src_max is the maximum number of packets @pkt's IPv4 source can have in
+ * @queue at a time. Zero means unlimited.
+ *
  * The typical return values are
  * 0: success; packet stored.
  * -EEXIST: SO already exists; @pkt is redundant.
  * -ENOSPC: SO is valid but we're already storing too many packets. Please fail
  * gracefully somehow.
+ * -EDQUOT: SO is valid but its source is already storing too many packets.
+ * Same treatment as -ENOSPC.
  */
 int pktqueue_add(struct pktqueue *queue, struct packet *pkt,
-		struct ipv6_transport_addr *dst6, bool too_many)
+		struct ipv6_transport_addr *dst6, bool too_many,
+		unsigned int src_max)
 {
 	struct pktqueue_session *new;
-	struct rb_node *collision;
-	struct tree_slot slot;
-
-	new = wkmalloc(struct pktqueue_session, GFP_ATOMIC);
-	if (!new)
-		return -ENOMEM;
-	new->dst6 = *dst6;
 
-	collision = rbtree_find_slot(&new->tree_hook, &queue->node_tree,
-			compare_rbnode, &slot);
-	if (collision) {
-		wkfree(struct pktqueue_session, new);
+	if (__find(queue, dst6)) {
 		/*
 		 * Should we reset the timer of the existing session?
 		 * Don't know; the RFC is silent on this.
@@ -117,23 +171,39 @@ int pktqueue_add(struct pktqueue *queue, struct packet *pkt,
 	 * So if -ENOSPC is validated before, we would end up fetching lots of
 	 * misplaced ICMP errors.
 	 */
-	if (too_many) {
-		wkfree(struct pktqueue_session, new);
+	if (too_many)
 		return -ENOSPC;
-	}
+	/*
+	 * Without this, a single scanner can fill the queue, and everyone
+	 * else's legitimate SOs get -ENOSPC.
+	 */
+	if (src_quota_exceeded(queue, &pkt->tuple.src.addr4.l3, src_max))
+		return -EDQUOT;
 
+	new = wkmalloc(struct pktqueue_session, GFP_ATOMIC);
+	if (!new)
+		return -ENOMEM;
+
+	new->dst6 = *dst6;
 	new->src4 = pkt->tuple.dst.addr4;
 	new->dst4 = pkt->tuple.src.addr4;
 	new->skb = pkt_original_pkt(pkt)->skb;
 	new->update_time = jiffies;
-	treeslot_commit(&slot);
+	hlist_add_head(&new->hash_hook, &queue->nodes[hash_dst6(queue, dst6)]);
+	hlist_add_head(&new->src_hook,
+			&queue->sources[hash_src(queue, &new->dst4.l3)]);
 	list_add_tail(&new->list_hook, &queue->node_list);
 	return 0;
 }
 
-void pktqueue_rm(struct pktqueue *queue, struct ipv4_transport_addr *src4)
+/**
+ * Returns the number of packets removed.
+ */
+unsigned int pktqueue_rm(struct pktqueue *queue,
+		struct ipv4_transport_addr *src4)
 {
 	struct pktqueue_session *node, *tmp;
+	unsigned int removed = 0;
 
 	/*
 	 * Yes, full traversal. @src4 is not indexed and this is a rare
@@ -142,30 +212,14 @@ void pktqueue_rm(struct pktqueue *queue, struct ipv4_transport_addr *src4)
 	 */
 	list_for_each_entry_safe(node, tmp, &queue->node_list, list_hook) {
 		if (taddr4_equals(&node->src4, src4)) {
-			list_del(&node->list_hook);
-			rb_erase(&node->tree_hook, &queue->node_tree);
+			rm(node);
 			kfree_skb(node->skb);
 			wkfree(struct pktqueue_session, node);
+			removed++;
 		}
 	}
-}
-
-/**
- * Returns > 0 if node.session.*4 > session.*4.
- * Returns < 0 if node.session.*4 < session.*4.
- * Returns 0 if node.session.*4 == session.*4.
- */
-static int compare_simple(const struct pktqueue_session *node,
-		const struct ipv6_transport_addr *addr)
-{
-	return taddr6_compare(&node->dst6, addr);
-}
 
-static struct pktqueue_session *__tree_find(struct pktqueue *queue,
-		struct ipv6_transport_addr *addr)
-{
-	return rbtree_find(addr, &queue->node_tree, compare_simple,
-			struct pktqueue_session, tree_hook);
+	return removed;
 }
 
 struct pktqueue_session *pktqueue_find(struct pktqueue *queue,
@@ -174,14 +228,14 @@ struct pktqueue_session *pktqueue_find(struct pktqueue *queue,
 {
 	struct pktqueue_session *node;
 
-	node = __tree_find(queue, addr);
+	node = __find(queue, addr);
 	if (!node)
 		return NULL;
 
 	if (masks && !mask_domain_matches(masks, &node->src4))
 		return NULL;
 
-	rm(queue, node);
+	rm(node);
 	return node;
 }
 
@@ -211,7 +265,7 @@ unsigned int pktqueue_prepare_clean(struct pktqueue *queue,
 		if (time_before(jiffies, node->update_time + TIMEOUT))
 			break;
 
-		rm(queue, node);
+		rm(node);
 		list_add(&node->list_hook, probes);
 		removed++;
 	}
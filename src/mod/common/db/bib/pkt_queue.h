@@ -115,8 +115,10 @@ struct pktqueue_session {
 	unsigned long update_time;
 	/** Links this packet to the list. See @node_list. */
 	struct list_head list_hook;
-	/** Links this packet to the tree. See @node_tree. */
-	struct rb_node tree_hook;
+	/** Links this packet to its dst6 bucket. See @nodes. */
+	struct hlist_node hash_hook;
+	/** Links this packet to its IPv4 source's bucket. See @sources. */
+	struct hlist_node src_hook;
 };
 
 /**
@@ -132,8 +134,10 @@ void pktqueue_release(struct pktqueue *queue);
  * Stores packet @pkt.
  */
 int pktqueue_add(struct pktqueue *queue, struct packet *pkt,
-		struct ipv6_transport_addr *dst6, bool too_many);
-void pktqueue_rm(struct pktqueue *queue, struct ipv4_transport_addr *src4);
+		struct ipv6_transport_addr *dst6, bool too_many,
+		unsigned int src_max);
+unsigned int pktqueue_rm(struct pktqueue *queue,
+		struct ipv4_transport_addr *src4);
 
 struct pktqueue_session *pktqueue_find(struct pktqueue *queue,
 		struct ipv6_transport_addr *addr,
@@ -1,59 +1,83 @@
 #include "mod/common/db/denylist4.h"
 
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/sort.h>
+
 #include "mod/common/dev.h"
 #include "mod/common/address.h"
 #include "mod/common/log.h"
-#include "mod/common/rcu.h"
+#include "mod/common/rtrie.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 
-struct pool_entry {
-	struct ipv4_prefix prefix;
-	struct list_head list_hook;
+/**
+ * A snapshot of the addresses interface_contains() has to reject. (ie. the
+ * namespace's local and directed broadcast addresses.)
+ *
+ * It's an open addressing hash set. 0.0.0.0 marks empty slots, so it gets its
+ * own flag.
+ */
+struct ifa_set {
+	/* The value @ifa_generation had when the snapshot was taken. */
+	unsigned int generation;
+	unsigned int mask;
+	bool has_zero;
+	struct rcu_head rcu;
+	__be32 addrs[];
 };
 
+/**
+ * The prefixes are keyed by themselves, so lookups are longest prefix matches
+ * that never need to look at more than 32 bits.
+ */
 struct addr4_pool {
-	struct list_head __rcu *list;
+	struct rtrie trie;
+
+	/**
+	 * Rebuilt by the packet path, whenever it finds it stale.
+	 * RCU-friendly. Assign while holding @ifa_lock.
+	 */
+	struct ifa_set __rcu *ifaddrs;
+	spinlock_t ifa_lock;
+
 	struct kref refcounter;
+
+	/* See eam_table.published and denylist4_publish(). */
+	bool published;
+	char name[INAME_MAX_SIZE];
+	struct list_head published_hook;
 };
 
 /* I can't have per-pool mutexes because of the replace function. */
 static DEFINE_MUTEX(lock);
 
-static struct pool_entry *get_entry(struct list_head *node)
-{
-	return list_entry(node, struct pool_entry, list_hook);
-}
-
-static struct list_head *alloc_list(void)
-{
-	struct list_head *list;
+/* Same as the EAMT's. */
+static LIST_HEAD(published);
+static DEFINE_MUTEX(published_lock);
 
-	list = __wkmalloc("IPv4 address pool list", sizeof(*list), GFP_KERNEL);
-	if (!list)
-		return NULL;
-	INIT_LIST_HEAD(list);
-
-	return list;
-}
+/**
+ * Bumped whenever an IPv4 interface address is added or removed, in any
+ * namespace. Address changes are rare, so there's no need to be picky.
+ *
+ * Zero is never a valid generation.
+ */
+static atomic_t ifa_generation = ATOMIC_INIT(1);
 
 struct addr4_pool *denylist4_alloc(void)
 {
 	struct addr4_pool *result;
-	struct list_head *list;
 
 	result = wkmalloc(struct addr4_pool, GFP_KERNEL);
 	if (!result)
 		return NULL;
 
-	list = alloc_list();
-	if (!list) {
-		wkfree(struct addr4_pool, result);
-		return NULL;
-	}
-
-	RCU_INIT_POINTER(result->list, list);
+	rtrie_init(&result->trie, sizeof(struct ipv4_prefix), &lock);
+	RCU_INIT_POINTER(result->ifaddrs, NULL);
+	spin_lock_init(&result->ifa_lock);
 	kref_init(&result->refcounter);
+	result->published = false;
+	INIT_LIST_HEAD(&result->published_hook);
 
 	return result;
 }
@@ -63,37 +87,102 @@ void denylist4_get(struct addr4_pool *pool)
 	kref_get(&pool->refcounter);
 }
 
-static void __destroy(struct list_head *list)
+static void free_ifa_set(struct ifa_set *set)
 {
-	struct list_head *node;
-	struct list_head *tmp;
-
-	list_for_each_safe(node, tmp, list) {
-		list_del(node);
-		wkfree(struct pool_entry, get_entry(node));
-	}
+	if (set)
+		__wkfree("Interface address set", set);
+}
 
-	__wkfree("IPv4 address pool list", list);
+static void ifa_set_rcu_cb(struct rcu_head *rcu)
+{
+	free_ifa_set(container_of(rcu, struct ifa_set, rcu));
 }
 
 static void pool_release(struct kref *refcounter)
 {
 	struct addr4_pool *pool;
 	pool = container_of(refcounter, struct addr4_pool, refcounter);
-	__destroy(rcu_dereference_raw(pool->list));
+	rtrie_clean(&pool->trie);
+	/* There are no readers left, so no grace periods are needed. */
+	free_ifa_set(rcu_dereference_protected(pool->ifaddrs, true));
 	wkfree(struct addr4_pool, pool);
 }
 
+/* Called with @published_lock held; releases it. */
+static void pool_release_unlist(struct kref *refcounter)
+{
+	struct addr4_pool *pool;
+
+	pool = container_of(refcounter, struct addr4_pool, refcounter);
+	list_del(&pool->published_hook);
+	mutex_unlock(&published_lock);
+
+	pool_release(refcounter);
+}
+
+/* Can sleep. */
 void denylist4_put(struct addr4_pool *pool)
 {
-	kref_put(&pool->refcounter, pool_release);
+	kref_put_mutex(&pool->refcounter, pool_release_unlist,
+			&published_lock);
+}
+
+/* See eamt_publish(). */
+int denylist4_publish(struct addr4_pool *pool, char const *name)
+{
+	struct addr4_pool *old;
+	int error;
+
+	error = iname_validate(name, false);
+	if (error) {
+		log_err("Invalid denylist4 name: '%s'", name);
+		return error;
+	}
+
+	mutex_lock(&published_lock);
+
+	list_for_each_entry(old, &published, published_hook) {
+		if (strcmp(old->name, name) == 0) {
+			list_del_init(&old->published_hook);
+			break;
+		}
+	}
+
+	list_del(&pool->published_hook);
+	pool->published = true;
+	strcpy(pool->name, name);
+	list_add(&pool->published_hook, &published);
+
+	mutex_unlock(&published_lock);
+	return 0;
+}
+
+/* See eamt_find_published(). */
+struct addr4_pool *denylist4_find_published(char const *name)
+{
+	struct addr4_pool *pool;
+
+	mutex_lock(&published_lock);
+	list_for_each_entry(pool, &published, published_hook) {
+		if (strcmp(pool->name, name) == 0) {
+			kref_get(&pool->refcounter);
+			mutex_unlock(&published_lock);
+			return pool;
+		}
+	}
+	mutex_unlock(&published_lock);
+
+	return NULL;
+}
+
+bool denylist4_is_published(struct addr4_pool *pool)
+{
+	return pool->published;
 }
 
 int denylist4_add(struct addr4_pool *pool, struct ipv4_prefix *prefix,
-		bool force)
+		bool force, bool synchronize)
 {
-	struct list_head *list;
-	struct pool_entry *entry;
 	int error;
 
 	error = prefix4_validate(prefix);
@@ -104,64 +193,119 @@ int denylist4_add(struct addr4_pool *pool, struct ipv4_prefix *prefix,
 		return error;
 
 	mutex_lock(&lock);
-
-	entry = wkmalloc(struct pool_entry, GFP_KERNEL);
-	if (!entry) {
-		error = -ENOMEM;
-		goto end;
-	}
-	entry->prefix = *prefix;
-
-	list = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-	list_add_tail_rcu(&entry->list_hook, list);
-
-end:
+	error = rtrie_add(&pool->trie, prefix, offsetof(typeof(*prefix), addr),
+			prefix->len, synchronize);
 	mutex_unlock(&lock);
+
+	if (error == -EEXIST)
+		log_err("Prefix %pI4/%u is already denylisted.", &prefix->addr,
+				prefix->len);
 	return error;
 }
 
 int denylist4_rm(struct addr4_pool *pool, struct ipv4_prefix *prefix)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
+	struct rtrie_key key = {
+		.bytes = (__u8 *)&prefix->addr,
+		.len = prefix->len,
+	};
+	int error;
 
 	mutex_lock(&lock);
+	error = rtrie_rm(&pool->trie, &key);
+	mutex_unlock(&lock);
 
-	list = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-	list_for_each(node, list) {
-		entry = get_entry(node);
-		if (prefix4_equals(prefix, &entry->prefix)) {
-			list_del_rcu(&entry->list_hook);
-			mutex_unlock(&lock);
-			synchronize_rcu_bh();
-			wkfree(struct pool_entry, entry);
-			return 0;
-		}
-	}
+	if (error == -ESRCH)
+		log_err("Could not find the requested entry in the IPv4 pool.");
+	return error;
+}
 
-	mutex_unlock(&lock);
-	log_err("Could not find the requested entry in the IPv4 pool.");
-	return -ESRCH;
+struct clone_args {
+	struct ipv4_prefix const **prefixes;
+	unsigned int count;
+};
+
+static int count_cb(void const *prefix, void *arg)
+{
+	((struct clone_args *)arg)->count++;
+	return 0;
 }
 
-int denylist4_flush(struct addr4_pool *pool)
+static int collect_cb(void const *prefix, void *arg)
+{
+	struct clone_args *args = arg;
+	args->prefixes[args->count++] = prefix;
+	return 0;
+}
+
+static int compare_prefix(void const *a, void const *b)
 {
-	struct list_head *old;
-	struct list_head *new;
+	struct ipv4_prefix const *prefix1 = *(struct ipv4_prefix * const *)a;
+	struct ipv4_prefix const *prefix2 = *(struct ipv4_prefix * const *)b;
+	struct rtrie_key key1 = {
+		.bytes = (__u8 *)&prefix1->addr,
+		.len = prefix1->len,
+	};
+	struct rtrie_key key2 = {
+		.bytes = (__u8 *)&prefix2->addr,
+		.len = prefix2->len,
+	};
+	return rtrie_key_cmp(&key1, &key2);
+}
 
-	new = alloc_list();
-	if (!new)
+int denylist4_clone(struct addr4_pool *pool, struct addr4_pool **result)
+{
+	struct addr4_pool *clone;
+	struct clone_args args = { 0 };
+	int error;
+
+	clone = denylist4_alloc();
+	if (!clone)
 		return -ENOMEM;
 
 	mutex_lock(&lock);
-	old = rcu_dereference_protected(pool->list, lockdep_is_held(&lock));
-	rcu_assign_pointer(pool->list, new);
+
+	error = rtrie_foreach(&pool->trie, count_cb, &args, NULL);
+	if (error || !args.count)
+		goto end;
+
+	args.prefixes = __wkvmalloc("denylist4 clone buffer",
+			args.count * sizeof(*args.prefixes));
+	if (!args.prefixes) {
+		error = -ENOMEM;
+		goto end;
+	}
+	args.count = 0;
+
+	error = rtrie_foreach(&pool->trie, collect_cb, &args, NULL);
+	if (!error) {
+		sort(args.prefixes, args.count, sizeof(*args.prefixes),
+				compare_prefix, NULL);
+		error = rtrie_build(&clone->trie, (void **)args.prefixes,
+				args.count,
+				offsetof(struct ipv4_prefix, addr),
+				offsetof(struct ipv4_prefix, len));
+	}
+
+	__wkvfree("denylist4 clone buffer", args.prefixes);
+	/* Fall through */
+
+end:
 	mutex_unlock(&lock);
+	if (error) {
+		denylist4_put(clone);
+		return error;
+	}
 
-	synchronize_rcu_bh();
+	*result = clone;
+	return 0;
+}
 
-	__destroy(old);
+int denylist4_flush(struct addr4_pool *pool)
+{
+	mutex_lock(&lock);
+	rtrie_flush(&pool->trie);
+	mutex_unlock(&lock);
 	return 0;
 }
 
@@ -195,6 +339,131 @@ static int check_ifa(struct in_ifaddr *ifa, void const *arg)
 	return ALLOW_ADDRESS;
 }
 
+static int count_ifa(struct in_ifaddr *ifa, void const *arg)
+{
+	unsigned int *count = *(unsigned int * const *)arg;
+	(*count)++;
+	return 0;
+}
+
+static void ifa_set_add(struct ifa_set *set, __be32 addr)
+{
+	unsigned int i;
+
+	if (!addr) {
+		set->has_zero = true;
+		return;
+	}
+
+	/* Less than half the slots are used, so this always terminates. */
+	i = jhash_1word((__force u32)addr, 0) & set->mask;
+	while (set->addrs[i] && set->addrs[i] != addr)
+		i = (i + 1) & set->mask;
+	set->addrs[i] = addr;
+}
+
+static bool ifa_set_contains(struct ifa_set const *set, __be32 addr)
+{
+	unsigned int i;
+
+	if (!addr)
+		return set->has_zero;
+
+	i = jhash_1word((__force u32)addr, 0) & set->mask;
+	while (set->addrs[i]) {
+		if (set->addrs[i] == addr)
+			return true;
+		i = (i + 1) & set->mask;
+	}
+
+	return false;
+}
+
+struct fill_args {
+	struct ifa_set *set;
+	unsigned int room;
+};
+
+/* Mirrors check_ifa(). */
+static int fill_ifa(struct in_ifaddr *ifa, void const *arg)
+{
+	struct fill_args *args = *(struct fill_args * const *)arg;
+
+	/* The interfaces changed since they were counted. */
+	if (args->room < 2)
+		return -EAGAIN;
+	args->room -= 2;
+
+	if (ifa->ifa_prefixlen < 31)
+		ifa_set_add(args->set, ifa->ifa_local | ~ifa->ifa_mask);
+	if (ifa->ifa_prefixlen != 32)
+		ifa_set_add(args->set, ifa->ifa_local);
+
+	return 0;
+}
+
+/*
+ * Replaces @pool's interface address set with a fresh one.
+ * Call inside an RCU-bh read-side critical section. Returns NULL if somebody
+ * else is already rebuilding, or on failure; the caller should fall back to
+ * the interface walk in those cases.
+ */
+static struct ifa_set *rebuild_ifa_set(struct addr4_pool *pool,
+		struct net *ns, unsigned int generation)
+{
+	struct ifa_set *old;
+	struct ifa_set *new;
+	struct fill_args args;
+	struct fill_args *args_ptr = &args;
+	unsigned int count = 0;
+	unsigned int *count_ptr = &count;
+	unsigned int slots;
+
+	if (!spin_trylock_bh(&pool->ifa_lock))
+		return NULL;
+
+	/* Somebody might have beaten us to it. */
+	old = rcu_dereference_protected(pool->ifaddrs,
+			lockdep_is_held(&pool->ifa_lock));
+	if (old && old->generation == generation) {
+		spin_unlock_bh(&pool->ifa_lock);
+		return old;
+	}
+
+	foreach_ifa(ns, count_ifa, &count_ptr);
+
+	/* Two addresses per ifa, and at most half the slots in use. */
+	slots = roundup_pow_of_two(max(4 * count, 16u));
+	new = __wkmalloc("Interface address set",
+			sizeof(*new) + slots * sizeof(new->addrs[0]),
+			GFP_ATOMIC);
+	if (!new)
+		goto fail;
+
+	new->generation = generation;
+	new->mask = slots - 1;
+	new->has_zero = false;
+	memset(new->addrs, 0, slots * sizeof(new->addrs[0]));
+
+	args.set = new;
+	args.room = 2 * count;
+	if (foreach_ifa(ns, fill_ifa, &args_ptr)) {
+		free_ifa_set(new);
+		goto fail;
+	}
+
+	rcu_assign_pointer(pool->ifaddrs, new);
+	spin_unlock_bh(&pool->ifa_lock);
+
+	if (old)
+		call_rcu(&old->rcu, ifa_set_rcu_cb);
+	return new;
+
+fail:
+	spin_unlock_bh(&pool->ifa_lock);
+	return NULL;
+}
+
 /**
  * Is @addr *NOT* translatable, according to the interfaces?
  *
@@ -202,69 +471,117 @@ static int check_ifa(struct in_ifaddr *ifa, void const *arg)
  * non-translatable (ie. the traffic is meant for the translator box).
  *
  * Recognizable directed broadcast is also not translatable.
+ *
+ * @ns has to be @pool's instance's namespace.
  */
-bool interface_contains(struct net *ns, struct in_addr *addr)
-{
-	return foreach_ifa(ns, check_ifa, addr);
-}
-
-bool denylist4_contains(struct addr4_pool *pool, struct in_addr *addr)
+bool interface_contains(struct addr4_pool *pool, struct net *ns,
+		struct in_addr *addr)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
+	struct ifa_set *set;
+	unsigned int generation;
+	bool result;
 
 	rcu_read_lock_bh();
 
-	list = rcu_dereference_bh(pool->list);
-	list_for_each_rcu_bh(node, list) {
-		entry = get_entry(node);
-		if (prefix4_contains(&entry->prefix, addr)) {
-			rcu_read_unlock_bh();
-			return true;
-		}
+	generation = atomic_read(&ifa_generation);
+	/* Pairs with ifa_event()'s smp_wmb(). */
+	smp_rmb();
+
+	/*
+	 * A published pool is shared by several namespaces, so it can't cache
+	 * any one of them.
+	 */
+	if (pool->published) {
+		set = NULL;
+	} else {
+		set = rcu_dereference_bh(pool->ifaddrs);
+		if (!set || set->generation != generation)
+			set = rebuild_ifa_set(pool, ns, generation);
 	}
 
+	result = set
+			? ifa_set_contains(set, addr->s_addr)
+			: foreach_ifa(ns, check_ifa, addr);
+
 	rcu_read_unlock_bh();
-	return false;
+	return result;
+}
+
+static int ifa_event(struct notifier_block *nb, unsigned long event,
+		void *ptr)
+{
+	switch (event) {
+	case NETDEV_UP:
+	case NETDEV_DOWN:
+		/* The new address is already (or no longer) listed. */
+		smp_wmb();
+		if (atomic_inc_return(&ifa_generation) == 0)
+			atomic_inc(&ifa_generation);
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ifa_notifier = {
+	.notifier_call = ifa_event,
+};
+
+int denylist4_setup(void)
+{
+	return register_inetaddr_notifier(&ifa_notifier);
+}
+
+void denylist4_teardown(void)
+{
+	unregister_inetaddr_notifier(&ifa_notifier);
+	/* Wait for the pending ifa_set_rcu_cb()s. */
+	rcu_barrier();
+}
+
+bool denylist4_contains(struct addr4_pool *pool, struct in_addr *addr)
+{
+	struct rtrie_key key = {
+		.bytes = (__u8 *)addr,
+		.len = 8 * sizeof(*addr),
+	};
+	return rtrie_contains(&pool->trie, &key);
+}
+
+struct foreach_args {
+	int (*func)(struct ipv4_prefix *, void *);
+	void *arg;
+};
+
+static int foreach_cb(void const *prefix, void *arg)
+{
+	struct foreach_args *args = arg;
+	/* The callbacks don't modify the prefix; they just serialize it. */
+	return args->func((struct ipv4_prefix *)prefix, args->arg);
 }
 
 int denylist4_foreach(struct addr4_pool *pool,
 		int (*func)(struct ipv4_prefix *, void *), void *arg,
 		struct ipv4_prefix *offset)
 {
-	struct list_head *list;
-	struct list_head *node;
-	struct pool_entry *entry;
-	int error = 0;
-
-	rcu_read_lock_bh();
+	struct foreach_args args = { .func = func, .arg = arg };
+	struct rtrie_key offset_key;
+	struct rtrie_key *offset_key_ptr = NULL;
+	int error;
 
-	list = rcu_dereference_bh(pool->list);
-	list_for_each_rcu_bh(node, list) {
-		entry = get_entry(node);
-		if (!offset) {
-			error = func(&entry->prefix, arg);
-			if (error)
-				break;
-		} else if (prefix4_equals(offset, &entry->prefix)) {
-			offset = NULL;
-		}
+	if (offset) {
+		offset_key.bytes = (__u8 *)&offset->addr;
+		offset_key.len = offset->len;
+		offset_key_ptr = &offset_key;
 	}
 
-	rcu_read_unlock_bh();
-	return offset ? -ESRCH : error;
+	mutex_lock(&lock);
+	error = rtrie_foreach(&pool->trie, foreach_cb, &args, offset_key_ptr);
+	mutex_unlock(&lock);
+	return error;
 }
 
 bool denylist4_is_empty(struct addr4_pool *pool)
 {
-	struct list_head *list;
-	bool result;
-
-	rcu_read_lock_bh();
-	list = rcu_dereference_bh(pool->list);
-	result = list_empty(list);
-	rcu_read_unlock_bh();
-
-	return result;
+	return rtrie_is_empty(&pool->trie);
 }
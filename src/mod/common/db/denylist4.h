@@ -9,16 +9,27 @@
 #include <net/net_namespace.h>
 #include "mod/common/address.h"
 
+int denylist4_setup(void);
+void denylist4_teardown(void);
+
 struct addr4_pool *denylist4_alloc(void);
 void denylist4_get(struct addr4_pool *pool);
 void denylist4_put(struct addr4_pool *pool);
+/* See eamt_publish(). */
+int denylist4_publish(struct addr4_pool *pool, char const *name);
+struct addr4_pool *denylist4_find_published(char const *name);
+bool denylist4_is_published(struct addr4_pool *pool);
 
+/* See rtrie.h for info on the "synchronize" flag */
 int denylist4_add(struct addr4_pool *pool, struct ipv4_prefix *prefix,
-		bool force);
+		bool force, bool synchronize);
 int denylist4_rm(struct addr4_pool *pool, struct ipv4_prefix *prefix);
 int denylist4_flush(struct addr4_pool *pool);
+/* Creates a copy of @pool, which nothing else references. */
+int denylist4_clone(struct addr4_pool *pool, struct addr4_pool **result);
 
-bool interface_contains(struct net *ns, struct in_addr *addr);
+bool interface_contains(struct addr4_pool *pool, struct net *ns,
+		struct in_addr *addr);
 bool denylist4_contains(struct addr4_pool *pool, struct in_addr *addr);
 
 int denylist4_foreach(struct addr4_pool *pool,
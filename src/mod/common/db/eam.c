@@ -1,8 +1,15 @@
 #include "mod/common/db/eam.h"
 
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/workqueue.h>
+
 #include "common/types.h"
 #include "mod/common/address.h"
+#include "mod/common/lctrie.h"
 #include "mod/common/log.h"
+#include "mod/common/rcu.h"
+#include "mod/common/stats.h"
 #include "mod/common/wkmalloc.h"
 
 #define ADDR6_BITS		128
@@ -12,6 +19,39 @@
 #define ADDR_TO_KEY(addr)	INIT_KEY(addr, 8 * sizeof(*addr))
 #define PREFIX_TO_KEY(prefix)	INIT_KEY(&(prefix)->addr, (prefix)->len)
 
+/*
+ * How long the lctries wait for the tries to settle down before rebuilding.
+ * (Adding entries one by one, which is what the userspace client does, would
+ * otherwise rebuild them once per entry.)
+ */
+#define REBUILD_DELAY msecs_to_jiffies(200)
+
+/* Slots per CPU, per direction. Must be a power of two. */
+#define EAMT_CACHE_SIZE 64
+
+/*
+ * A recent translation (or lack thereof; @error can be -ESRCH).
+ * Only valid if @generation matches the table's.
+ */
+struct eamt_cache6_slot {
+	unsigned int generation;
+	struct in6_addr key;
+	int error;
+	struct result_addrxlat64 result;
+};
+
+struct eamt_cache4_slot {
+	unsigned int generation;
+	struct in_addr key;
+	int error;
+	struct result_addrxlat46 result;
+};
+
+struct eamt_cache {
+	struct eamt_cache6_slot v6[EAMT_CACHE_SIZE];
+	struct eamt_cache4_slot v4[EAMT_CACHE_SIZE];
+};
+
 /**
  * Well, it really goes without saying, but I'll say it anyway:
  *
@@ -32,16 +72,152 @@
 struct eam_table {
 	struct rtrie trie6;
 	struct rtrie trie4;
+
+	/**
+	 * Snapshots of @trie6 and @trie4, which serve the packet path.
+	 *
+	 * Updates to the tries unpublish them right away, and schedule
+	 * @rebuild_work to create new ones later. Lookups fall back to the
+	 * tries in the meantime. (Or if the rebuild fails.)
+	 *
+	 * RCU-friendly. Assign while holding the mutex.
+	 */
+	struct lctrie __rcu *lct6;
+	struct lctrie __rcu *lct4;
+	/**
+	 * Unpublished lctries, which might still have readers.
+	 * @rebuild_work frees them after a grace period. Touch only while
+	 * you're holding the mutex.
+	 */
+	struct lctrie *retired6;
+	struct lctrie *retired4;
+	struct delayed_work rebuild_work;
+
+	/**
+	 * Direct-mapped caches of the latest eamt_xlat_*() results.
+	 *
+	 * Updates to the tries bump @generation, which invalidates all the
+	 * slots at once. Zero is never a valid generation, so the slots start
+	 * out empty.
+	 */
+	struct eamt_cache __percpu *cache;
+	atomic_t generation;
+
+	/**
+	 * Entries queued by eamt_stage(), waiting for eamt_commit_staged().
+	 * @staged_force is only true if all of them were forced.
+	 * Touch only while you're holding the mutex.
+	 */
+	struct eamt_entry *staged;
+	unsigned int staged_count;
+	unsigned int staged_max;
+	bool staged_force;
+
 	/**
 	 * This one is not RCU-friendly. Touch only while you're holding the
 	 * mutex.
 	 */
 	u64 count;
 	struct kref refcount;
+
+	/**
+	 * Published tables are read-only, because any number of instances
+	 * might be referencing them. (See eamt_publish().) @name is only
+	 * meaningful if @published.
+	 */
+	bool published;
+	char name[INAME_MAX_SIZE];
+	/**
+	 * Hook to @published. Empty if the name has been taken over by a newer
+	 * table (or was never given). Touch only while holding @published_lock.
+	 */
+	struct list_head published_hook;
 };
 
 static DEFINE_MUTEX(lock);
 
+/*
+ * The tables that can currently be found by name. They don't hold references;
+ * a table is unlisted when its last user lets go of it. (See eamt_put().)
+ */
+static LIST_HEAD(published);
+static DEFINE_MUTEX(published_lock);
+
+#define deref_updater(ptr) \
+	rcu_dereference_protected(ptr, lockdep_is_held(&lock))
+
+/* Call while holding the mutex, after changing the tries. */
+static void invalidate_lcts(struct eam_table *eamt)
+{
+	struct lctrie *lct;
+
+	lct = deref_updater(eamt->lct6);
+	if (lct) {
+		RCU_INIT_POINTER(eamt->lct6, NULL);
+		eamt->retired6 = lct;
+	}
+
+	lct = deref_updater(eamt->lct4);
+	if (lct) {
+		RCU_INIT_POINTER(eamt->lct4, NULL);
+		eamt->retired4 = lct;
+	}
+
+	/*
+	 * Readers fetch the generation before the tries, so they won't cache
+	 * stale lookups under the new one.
+	 */
+	smp_wmb();
+	if (atomic_inc_return(&eamt->generation) == 0)
+		atomic_inc(&eamt->generation);
+
+	mod_delayed_work(system_wq, &eamt->rebuild_work, REBUILD_DELAY);
+}
+
+static void publish_lct(struct rtrie *trie, unsigned int key_len,
+		struct lctrie __rcu **lct)
+{
+	struct lctrie *new;
+	int error;
+
+	if (deref_updater(*lct))
+		return;
+
+	error = lctrie_build(trie, key_len, &new);
+	if (error) {
+		LOG_DEBUG("lctrie_build() error: %d. The EAMT will fall back to the slow lookups.",
+				error);
+		return;
+	}
+
+	rcu_assign_pointer(*lct, new);
+}
+
+static void rebuild_lcts(struct work_struct *work)
+{
+	struct eam_table *eamt;
+	struct lctrie *retired6;
+	struct lctrie *retired4;
+
+	eamt = container_of(to_delayed_work(work), struct eam_table,
+			rebuild_work);
+
+	mutex_lock(&lock);
+	publish_lct(&eamt->trie6, ADDR6_BITS, &eamt->lct6);
+	publish_lct(&eamt->trie4, ADDR4_BITS, &eamt->lct4);
+	retired6 = eamt->retired6;
+	retired4 = eamt->retired4;
+	eamt->retired6 = NULL;
+	eamt->retired4 = NULL;
+	mutex_unlock(&lock);
+
+	if (retired6 || retired4) {
+		synchronize_rcu_bh();
+		lctrie_free(retired6);
+		lctrie_free(retired4);
+	}
+}
+
 static bool eamt_entry_equals(const struct eamt_entry *eam1,
 		const struct eamt_entry *eam2)
 {
@@ -49,6 +225,34 @@ static bool eamt_entry_equals(const struct eamt_entry *eam1,
 			&& prefix4_equals(&eam1->prefix4, &eam2->prefix4);
 }
 
+/* Number of PSID bits the MAP-T rule @eam embeds after the IPv4 suffix. */
+static unsigned int psid_len(struct eamt_entry const *eam)
+{
+	return eam->ea_len - (ADDR4_BITS - eam->prefix4.len);
+}
+
+static int validate_map(struct eamt_entry *new)
+{
+	if (new->ea_len < ADDR4_BITS - new->prefix4.len) {
+		log_err("The EA-bits length (%u) cannot be shorter than the IPv4 suffix (%u).",
+				new->ea_len, ADDR4_BITS - new->prefix4.len);
+		return -EINVAL;
+	}
+	if (new->psid_offset + psid_len(new) > 16) {
+		log_err("The PSID offset (%u) plus the PSID length (%u) exceed the 16 port bits.",
+				new->psid_offset, psid_len(new));
+		return -EINVAL;
+	}
+	/* RFC 7597 section 5.2: The EA bits end before the interface ID. */
+	if (new->prefix6.len + new->ea_len > 64) {
+		log_err("The IPv6 prefix length (%u) plus the EA-bits length (%u) exceed 64.",
+				new->prefix6.len, new->ea_len);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 /**
  * validate_prefixes - check @prefix6 and @prefix4 can be joined together to
  * form a (standalone) legal EAM entry.
@@ -69,7 +273,7 @@ static int validate_prefixes(struct eamt_entry *new)
 		return -EINVAL;
 	}
 
-	return 0;
+	return new->ea_len ? validate_map(new) : 0;
 }
 
 static void msg_programming_error(void)
@@ -159,13 +363,12 @@ static int validate_overlapping(struct eam_table *eamt, struct eamt_entry *new,
 	return 0;
 }
 
-static void __revert_add6(struct eam_table *eamt, struct ipv6_prefix *prefix6,
-		bool synchronize)
+static void __revert_add6(struct eam_table *eamt, struct ipv6_prefix *prefix6)
 {
 	struct rtrie_key key = PREFIX_TO_KEY(prefix6);
 	int error;
 
-	error = rtrie_rm(&eamt->trie6, &key, synchronize);
+	error = rtrie_rm(&eamt->trie6, &key);
 	WARN(error, "Got error %d while trying to remove an EAM I just added.",
 			error);
 }
@@ -208,6 +411,29 @@ static int eamt_add4(struct eam_table *eamt, struct eamt_entry *eam,
 	return error;
 }
 
+/* Call while holding the mutex. Doesn't invalidate the lctries. */
+static int __add(struct eam_table *eamt, struct eamt_entry *new, bool force,
+		bool synchronize)
+{
+	int error;
+
+	error = validate_overlapping(eamt, new, force);
+	if (error)
+		return error;
+
+	error = eamt_add6(eamt, new, synchronize);
+	if (error)
+		return error;
+	error = eamt_add4(eamt, new, synchronize);
+	if (error) {
+		__revert_add6(eamt, &new->prefix6);
+		return error;
+	}
+
+	eamt->count++;
+	return 0;
+}
+
 int eamt_add(struct eam_table *eamt, struct eamt_entry *new, bool force,
 		bool synchronize)
 {
@@ -218,26 +444,248 @@ int eamt_add(struct eam_table *eamt, struct eamt_entry *new, bool force,
 		return error;
 
 	mutex_lock(&lock);
+	error = __add(eamt, new, force, synchronize);
+	if (!error)
+		invalidate_lcts(eamt);
+	mutex_unlock(&lock);
 
-	error = validate_overlapping(eamt, new, force);
+	return error;
+}
+
+static void free_staged(struct eam_table *eamt)
+{
+	if (eamt->staged)
+		__wkvfree("EAMT staged entries", eamt->staged);
+	eamt->staged = NULL;
+	eamt->staged_count = 0;
+	eamt->staged_max = 0;
+}
+
+int eamt_stage(struct eam_table *eamt, struct eamt_entry *new, bool force)
+{
+	struct eamt_entry *staged;
+	unsigned int max;
+	int error;
+
+	error = validate_prefixes(new);
+	if (error)
+		return error;
+
+	mutex_lock(&lock);
+
+	if (eamt->staged_count == eamt->staged_max) {
+		max = eamt->staged_max ? (2 * eamt->staged_max) : 64;
+		staged = __wkvmalloc("EAMT staged entries",
+				max * sizeof(*staged));
+		if (!staged) {
+			error = -ENOMEM;
+			goto end;
+		}
+		if (eamt->staged) {
+			memcpy(staged, eamt->staged,
+					eamt->staged_count * sizeof(*staged));
+			__wkvfree("EAMT staged entries", eamt->staged);
+		}
+		eamt->staged = staged;
+		eamt->staged_max = max;
+	}
+
+	eamt->staged_force = eamt->staged_count
+			? (eamt->staged_force && force)
+			: force;
+	eamt->staged[eamt->staged_count++] = *new;
+	/* Fall through */
+
+end:
+	mutex_unlock(&lock);
+	return error;
+}
+
+static int compare_prefix6(void const *a, void const *b)
+{
+	struct eamt_entry *eam1 = *(struct eamt_entry * const *)a;
+	struct eamt_entry *eam2 = *(struct eamt_entry * const *)b;
+	struct rtrie_key key1 = PREFIX_TO_KEY(&eam1->prefix6);
+	struct rtrie_key key2 = PREFIX_TO_KEY(&eam2->prefix6);
+	return rtrie_key_cmp(&key1, &key2);
+}
+
+static int compare_prefix4(void const *a, void const *b)
+{
+	struct eamt_entry *eam1 = *(struct eamt_entry * const *)a;
+	struct eamt_entry *eam2 = *(struct eamt_entry * const *)b;
+	struct rtrie_key key1 = PREFIX_TO_KEY(&eam1->prefix4);
+	struct rtrie_key key2 = PREFIX_TO_KEY(&eam2->prefix4);
+	return rtrie_key_cmp(&key1, &key2);
+}
+
+/*
+ * In sorted order, an entry that contains another one is always followed by
+ * an entry it contains. (Everything in between has the same prefix.) So an
+ * overlap exists if and only if two neighbors overlap.
+ */
+static int validate_sorted(struct eamt_entry **sorted6,
+		struct eamt_entry **sorted4, unsigned int count, bool force)
+{
+	unsigned int i;
+	int error;
+
+	for (i = 1; i < count; i++) {
+		if (prefix6_contains(&sorted6[i - 1]->prefix6,
+				&sorted6[i]->prefix6.addr)) {
+			error = collision6(sorted6[i], sorted6[i - 1], force);
+			if (error)
+				return error;
+		}
+		if (prefix4_contains(&sorted4[i - 1]->prefix4,
+				&sorted4[i]->prefix4.addr)) {
+			error = collision4(sorted4[i], sorted4[i - 1], force);
+			if (error)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+/* Call while holding the mutex, with empty tries. */
+static int build_staged(struct eam_table *eamt)
+{
+	struct eamt_entry **sorted6;
+	struct eamt_entry **sorted4;
+	unsigned int count = eamt->staged_count;
+	unsigned int i;
+	int error;
+
+	sorted6 = __wkvmalloc("EAMT sort buffer", count * sizeof(*sorted6));
+	if (!sorted6)
+		return -ENOMEM;
+	sorted4 = __wkvmalloc("EAMT sort buffer", count * sizeof(*sorted4));
+	if (!sorted4) {
+		error = -ENOMEM;
+		goto end;
+	}
+
+	for (i = 0; i < count; i++) {
+		sorted6[i] = &eamt->staged[i];
+		sorted4[i] = &eamt->staged[i];
+	}
+	sort(sorted6, count, sizeof(*sorted6), compare_prefix6, NULL);
+	sort(sorted4, count, sizeof(*sorted4), compare_prefix4, NULL);
+
+	error = validate_sorted(sorted6, sorted4, count, eamt->staged_force);
 	if (error)
 		goto end;
 
-	error = eamt_add6(eamt, new, synchronize);
+	error = rtrie_build(&eamt->trie6, (void **)sorted6, count,
+			offsetof(struct eamt_entry, prefix6.addr),
+			offsetof(struct eamt_entry, prefix6.len));
 	if (error)
 		goto end;
-	error = eamt_add4(eamt, new, synchronize);
+	error = rtrie_build(&eamt->trie4, (void **)sorted4, count,
+			offsetof(struct eamt_entry, prefix4.addr),
+			offsetof(struct eamt_entry, prefix4.len));
 	if (error) {
-		__revert_add6(eamt, &new->prefix6, synchronize);
+		rtrie_flush(&eamt->trie6);
 		goto end;
 	}
 
-	eamt->count++;
+	eamt->count = count;
+	/* Fall through */
+
+end:
+	if (sorted4)
+		__wkvfree("EAMT sort buffer", sorted4);
+	__wkvfree("EAMT sort buffer", sorted6);
+	return error;
+}
+
+int eamt_commit_staged(struct eam_table *eamt)
+{
+	unsigned int i;
+	int error = 0;
+
+	mutex_lock(&lock);
+
+	if (!eamt->staged_count)
+		goto end;
+
+	if (!eamt->count) {
+		error = build_staged(eamt);
+	} else {
+		/* Can't build the tries from scratch; add one by one. */
+		for (i = 0; i < eamt->staged_count; i++) {
+			error = __add(eamt, &eamt->staged[i],
+					eamt->staged_force, true);
+			if (error)
+				break;
+		}
+	}
+
+	invalidate_lcts(eamt);
+	free_staged(eamt);
+	/* Fall through */
+
 end:
 	mutex_unlock(&lock);
 	return error;
 }
 
+static int clone_cb(void const *value, void *arg)
+{
+	struct eam_table *clone = arg;
+
+	if (WARN(clone->staged_count >= clone->staged_max,
+			"The EAMT has more entries than it counts."))
+		return -EINVAL;
+
+	clone->staged[clone->staged_count++] = *(struct eamt_entry *)value;
+	return 0;
+}
+
+int eamt_clone(struct eam_table *eamt, struct eam_table **result)
+{
+	struct eam_table *clone;
+	int error = 0;
+
+	clone = eamt_alloc();
+	if (!clone)
+		return -ENOMEM;
+
+	mutex_lock(&lock);
+
+	if (!eamt->count)
+		goto end;
+
+	clone->staged = __wkvmalloc("EAMT staged entries",
+			eamt->count * sizeof(*clone->staged));
+	if (!clone->staged) {
+		error = -ENOMEM;
+		goto end;
+	}
+	clone->staged_max = eamt->count;
+	/* They already coexist, so they don't need to be validated again. */
+	clone->staged_force = true;
+
+	error = rtrie_foreach(&eamt->trie4, clone_cb, clone, NULL);
+	if (!error)
+		error = build_staged(clone);
+	if (!error)
+		invalidate_lcts(clone);
+	free_staged(clone);
+	/* Fall through */
+
+end:
+	mutex_unlock(&lock);
+	if (error) {
+		eamt_put(clone);
+		return error;
+	}
+
+	*result = clone;
+	return 0;
+}
+
 static int get_exact6(struct eam_table *eamt, struct ipv6_prefix *prefix,
 		struct eamt_entry *eam)
 {
@@ -272,13 +720,14 @@ static int __rm(struct eam_table *eamt,
 	struct rtrie_key key4 = PREFIX_TO_KEY(prefix4);
 	int error;
 
-	error = rtrie_rm(&eamt->trie6, &key6, true);
+	error = rtrie_rm(&eamt->trie6, &key6);
 	if (error)
 		goto corrupted;
-	error = rtrie_rm(&eamt->trie4, &key4, true);
+	error = rtrie_rm(&eamt->trie4, &key4);
 	if (error)
 		goto corrupted;
 	eamt->count--;
+	invalidate_lcts(eamt);
 
 	/* rtrie_print("IPv6 trie after remove", &eamt.trie6); */
 	/* rtrie_print("IPv4 trie after remove", &eamt.trie4); */
@@ -336,24 +785,60 @@ int eamt_rm(struct eam_table *eamt,
 	return error;
 }
 
+static int find6(struct eam_table *eamt, struct in6_addr *addr6,
+		struct eamt_entry *eam)
+{
+	struct rtrie_key key = ADDR_TO_KEY(addr6);
+	struct lctrie *lct;
+	int error;
+
+	rcu_read_lock_bh();
+	lct = rcu_dereference_bh(eamt->lct6);
+	if (lct) {
+		error = lctrie_find(lct, addr6->s6_addr, eam);
+		rcu_read_unlock_bh();
+		return error;
+	}
+	rcu_read_unlock_bh();
+
+	return rtrie_find(&eamt->trie6, &key, eam);
+}
+
+static int find4(struct eam_table *eamt, struct in_addr *addr4,
+		struct eamt_entry *eam)
+{
+	struct rtrie_key key = ADDR_TO_KEY(addr4);
+	struct lctrie *lct;
+	int error;
+
+	rcu_read_lock_bh();
+	lct = rcu_dereference_bh(eamt->lct4);
+	if (lct) {
+		error = lctrie_find(lct, (__u8 const *)&addr4->s_addr, eam);
+		rcu_read_unlock_bh();
+		return error;
+	}
+	rcu_read_unlock_bh();
+
+	return rtrie_find(&eamt->trie4, &key, eam);
+}
+
 bool eamt_contains6(struct eam_table *eamt, struct in6_addr *addr)
 {
-	struct rtrie_key key = ADDR_TO_KEY(addr);
-	return rtrie_contains(&eamt->trie6, &key);
+	struct eamt_entry eam;
+	return !find6(eamt, addr, &eam);
 }
 
 bool eamt_contains4(struct eam_table *eamt, __be32 addr)
 {
 	struct in_addr tmp = { .s_addr = addr };
-	struct rtrie_key key = ADDR_TO_KEY(&tmp);
-	return rtrie_contains(&eamt->trie4, &key);
+	struct eamt_entry eam;
+	return !find4(eamt, &tmp, &eam);
 }
 
-/** Contract: Returns 0 or -ESRCH. No other outcomes. */
-int eamt_xlat_6to4(struct eam_table *eamt, struct in6_addr *addr6,
+static int __xlat_6to4(struct eam_table *eamt, struct in6_addr *addr6,
 		struct result_addrxlat64 *result)
 {
-	struct rtrie_key key = ADDR_TO_KEY(addr6);
 	struct eamt_entry *eam;
 	struct in_addr *addr4;
 	unsigned int i;
@@ -363,7 +848,7 @@ int eamt_xlat_6to4(struct eam_table *eamt, struct in6_addr *addr6,
 	addr4 = &result->addr;
 
 	/* Find the entry. */
-	error = rtrie_find(&eamt->trie6, &key, eam);
+	error = find6(eamt, addr6, eam);
 	if (error)
 		return error;
 
@@ -381,11 +866,9 @@ int eamt_xlat_6to4(struct eam_table *eamt, struct in6_addr *addr6,
 	return 0;
 }
 
-/** Contract: Returns 0 or -ESRCH. No other outcomes. */
-int eamt_xlat_4to6(struct eam_table *eamt, struct in_addr *addr4,
+static int __xlat_4to6(struct eam_table *eamt, struct in_addr *addr4,
 		struct result_addrxlat46 *result)
 {
-	struct rtrie_key key = ADDR_TO_KEY(addr4);
 	struct eamt_entry *eam;
 	struct in6_addr *addr6;
 	unsigned int i;
@@ -395,7 +878,7 @@ int eamt_xlat_4to6(struct eam_table *eamt, struct in_addr *addr4,
 	addr6 = &result->addr;
 
 	/* Find the entry. */
-	error = rtrie_find(&eamt->trie4, &key, eam);
+	error = find4(eamt, addr4, eam);
 	if (error)
 		return error;
 
@@ -413,11 +896,184 @@ int eamt_xlat_4to6(struct eam_table *eamt, struct in_addr *addr4,
 	return 0;
 }
 
+/*
+ * Returns (in @psid) the Port Set @port belongs to, according to MAP-T rule
+ * @eam. Fails if @port belongs to no set. (ie. it's a system port.)
+ */
+static int port2psid(struct eamt_entry const *eam, __u16 port, __u16 *psid)
+{
+	unsigned int len = psid_len(eam);
+
+	/* RFC 7597 section 5.1: Port Set 0 excludes "i" = 0. */
+	if (eam->psid_offset && !(port >> (16 - eam->psid_offset)))
+		return -ESRCH;
+
+	*psid = len
+		? ((port >> (16 - eam->psid_offset - len)) & ((1u << len) - 1))
+		: 0;
+	return 0;
+}
+
+/**
+ * eamt_map_4to6 - Finishes the translation of @addr4 into @addr6, which the
+ * MAP-T rule @eam already did as if it were an EAM (ie. @addr6 is @eam's
+ * prefix, followed by the IPv4 suffix). Appends @port's PSID, and writes the
+ * interface identifier of RFC 7597 section 5.2.
+ *
+ * Fails (with -ESRCH) if @port doesn't belong to any of the rule's Port Sets.
+ */
+int eamt_map_4to6(struct eamt_entry const *eam, struct in_addr const *addr4,
+		__u16 port, struct in6_addr *addr6)
+{
+	unsigned int offset6;
+	unsigned int len;
+	unsigned int i;
+	__u16 psid;
+
+	if (port2psid(eam, port, &psid))
+		return -ESRCH;
+
+	offset6 = eam->prefix6.len + ADDR4_BITS - eam->prefix4.len;
+	len = psid_len(eam);
+	for (i = 0; i < len; i++)
+		addr6_set_bit(addr6, offset6 + i, (psid >> (len - i - 1)) & 1);
+
+	addr6->s6_addr16[4] = 0;
+	memcpy(&addr6->s6_addr[10], &addr4->s_addr, sizeof(addr4->s_addr));
+	addr6->s6_addr16[7] = cpu_to_be16(psid);
+	return 0;
+}
+
+/**
+ * eamt_map_port_matches - Does @port belong to the Port Set MAP-T rule @eam
+ * embedded in IPv6 address @addr6?
+ */
+bool eamt_map_port_matches(struct eamt_entry const *eam,
+		struct in6_addr const *addr6, __u16 port)
+{
+	unsigned int offset6;
+	unsigned int len;
+	unsigned int i;
+	__u16 expected;
+	__u16 psid;
+
+	if (port2psid(eam, port, &psid))
+		return false;
+
+	offset6 = eam->prefix6.len + ADDR4_BITS - eam->prefix4.len;
+	len = psid_len(eam);
+	expected = 0;
+	for (i = 0; i < len; i++)
+		expected = (expected << 1) | addr6_get_bit(addr6, offset6 + i);
+
+	return psid == expected;
+}
+
+static unsigned int cache_slot(void const *addr, size_t size)
+{
+	return jhash(addr, size, 0) & (EAMT_CACHE_SIZE - 1);
+}
+
+static unsigned int get_generation(struct eam_table *eamt)
+{
+	unsigned int generation;
+
+	generation = atomic_read(&eamt->generation);
+	/* Pairs with invalidate_lcts()'s smp_wmb(). */
+	smp_rmb();
+	return generation;
+}
+
+/** Contract: Returns 0 or -ESRCH. No other outcomes. */
+int eamt_xlat_6to4(struct eam_table *eamt, struct in6_addr *addr6,
+		struct result_addrxlat64 *result, struct jool_stats *stats)
+{
+	struct eamt_cache6_slot *slot;
+	unsigned int generation;
+	int error;
+
+	local_bh_disable();
+
+	generation = get_generation(eamt);
+	slot = &this_cpu_ptr(eamt->cache)->v6[cache_slot(addr6,
+			sizeof(*addr6))];
+	if (slot->generation == generation && addr6_equals(&slot->key, addr6)) {
+		jstat_inc(stats, JSTAT_EAMT_CACHE_HIT);
+		error = slot->error;
+		if (!error)
+			*result = slot->result;
+		goto end;
+	}
+
+	jstat_inc(stats, JSTAT_EAMT_CACHE_MISS);
+	error = __xlat_6to4(eamt, addr6, result);
+	slot->generation = generation;
+	slot->key = *addr6;
+	slot->error = error;
+	if (!error)
+		slot->result = *result;
+	/* Fall through */
+
+end:
+	local_bh_enable();
+	return error;
+}
+
+/** Contract: Returns 0 or -ESRCH. No other outcomes. */
+int eamt_xlat_4to6(struct eam_table *eamt, struct in_addr *addr4,
+		struct result_addrxlat46 *result, struct jool_stats *stats)
+{
+	struct eamt_cache4_slot *slot;
+	unsigned int generation;
+	int error;
+
+	local_bh_disable();
+
+	generation = get_generation(eamt);
+	slot = &this_cpu_ptr(eamt->cache)->v4[cache_slot(addr4,
+			sizeof(*addr4))];
+	if (slot->generation == generation && addr4_equals(&slot->key, addr4)) {
+		jstat_inc(stats, JSTAT_EAMT_CACHE_HIT);
+		error = slot->error;
+		if (!error)
+			*result = slot->result;
+		goto end;
+	}
+
+	jstat_inc(stats, JSTAT_EAMT_CACHE_MISS);
+	error = __xlat_4to6(eamt, addr4, result);
+	slot->generation = generation;
+	slot->key = *addr4;
+	slot->error = error;
+	if (!error)
+		slot->result = *result;
+	/* Fall through */
+
+end:
+	local_bh_enable();
+	return error;
+}
+
 bool eamt_is_empty(struct eam_table *eamt)
 {
 	return rtrie_is_empty(&eamt->trie6);
 }
 
+/**
+ * eamt_memory - Returns the number of nodes in @eamt's tries, and the bytes
+ * they take. (Not including the lctries, which are rebuilt from them.)
+ */
+void eamt_memory(struct eam_table *eamt, __u64 *nodes, __u64 *bytes)
+{
+	*nodes = 0;
+	*bytes = 0;
+
+	mutex_lock(&lock);
+	rtrie_memory(&eamt->trie6, nodes, bytes);
+	rtrie_memory(&eamt->trie4, nodes, bytes);
+	mutex_unlock(&lock);
+}
+
 struct foreach_args {
 	int (*cb)(struct eamt_entry const *, void *);
 	void *arg;
@@ -456,6 +1112,7 @@ void eamt_flush(struct eam_table *eamt)
 	rtrie_flush(&eamt->trie6);
 	rtrie_flush(&eamt->trie4);
 	eamt->count = 0;
+	invalidate_lcts(eamt);
 	mutex_unlock(&lock);
 }
 
@@ -467,10 +1124,29 @@ struct eam_table *eamt_alloc(void)
 	if (!result)
 		return NULL;
 
+	/* alloc_percpu() zeroes. */
+	result->cache = alloc_percpu(struct eamt_cache);
+	if (!result->cache) {
+		wkfree(struct eam_table, result);
+		return NULL;
+	}
+	atomic_set(&result->generation, 1);
+
 	rtrie_init(&result->trie6, sizeof(struct eamt_entry), &lock);
 	rtrie_init(&result->trie4, sizeof(struct eamt_entry), &lock);
+	RCU_INIT_POINTER(result->lct6, NULL);
+	RCU_INIT_POINTER(result->lct4, NULL);
+	result->retired6 = NULL;
+	result->retired4 = NULL;
+	result->staged = NULL;
+	result->staged_count = 0;
+	result->staged_max = 0;
+	result->staged_force = false;
+	INIT_DELAYED_WORK(&result->rebuild_work, rebuild_lcts);
 	result->count = 0;
 	kref_init(&result->refcount);
+	result->published = false;
+	INIT_LIST_HEAD(&result->published_hook);
 
 	return result;
 }
@@ -487,12 +1163,99 @@ static void eamt_release(struct kref *refcount)
 {
 	struct eam_table *eamt;
 	eamt = container_of(refcount, struct eam_table, refcount);
+	cancel_delayed_work_sync(&eamt->rebuild_work);
+	/* There are no readers left, so no grace periods are needed. */
+	lctrie_free(rcu_dereference_protected(eamt->lct6, true));
+	lctrie_free(rcu_dereference_protected(eamt->lct4, true));
+	lctrie_free(eamt->retired6);
+	lctrie_free(eamt->retired4);
 	rtrie_clean(&eamt->trie6);
 	rtrie_clean(&eamt->trie4);
+	free_staged(eamt);
+	free_percpu(eamt->cache);
 	wkfree(struct eam_table, eamt);
 }
 
+/* Called with @published_lock held; releases it. */
+static void eamt_release_unlist(struct kref *refcount)
+{
+	struct eam_table *eamt;
+
+	eamt = container_of(refcount, struct eam_table, refcount);
+	list_del(&eamt->published_hook);
+	mutex_unlock(&published_lock);
+
+	eamt_release(refcount);
+}
+
 void eamt_put(struct eam_table *eamt)
 {
-	kref_put(&eamt->refcount, eamt_release);
+	kref_put_mutex(&eamt->refcount, eamt_release_unlist, &published_lock);
+}
+
+/**
+ * eamt_publish - Makes @eamt read-only, and findable through
+ * eamt_find_published(@name). If another table was already published under
+ * @name, it keeps serving its current users, but can no longer be found.
+ *
+ * The caller's reference keeps @eamt alive; publishing doesn't add one.
+ */
+int eamt_publish(struct eam_table *eamt, char const *name)
+{
+	struct eam_table *old;
+	int error;
+
+	error = iname_validate(name, false);
+	if (error) {
+		log_err("Invalid EAMT name: '%s'", name);
+		return error;
+	}
+
+	mutex_lock(&published_lock);
+
+	list_for_each_entry(old, &published, published_hook) {
+		if (strcmp(old->name, name) == 0) {
+			list_del_init(&old->published_hook);
+			break;
+		}
+	}
+
+	list_del(&eamt->published_hook);
+	eamt->published = true;
+	strcpy(eamt->name, name);
+	list_add(&eamt->published_hook, &published);
+
+	mutex_unlock(&published_lock);
+	return 0;
+}
+
+/**
+ * eamt_find_published - Returns a reference to the table currently published
+ * under @name, or NULL if there's none.
+ */
+struct eam_table *eamt_find_published(char const *name)
+{
+	struct eam_table *eamt;
+
+	mutex_lock(&published_lock);
+	list_for_each_entry(eamt, &published, published_hook) {
+		if (strcmp(eamt->name, name) == 0) {
+			/* Can't be zero; eamt_put() would have unlisted it. */
+			kref_get(&eamt->refcount);
+			mutex_unlock(&published_lock);
+			return eamt;
+		}
+	}
+	mutex_unlock(&published_lock);
+
+	return NULL;
+}
+
+/**
+ * eamt_is_published - Can @eamt be modified in place? (If not, the
+ * modifications should go to an eamt_clone().)
+ */
+bool eamt_is_published(struct eam_table *eamt)
+{
+	return eamt->published;
 }
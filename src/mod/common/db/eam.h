@@ -6,6 +6,7 @@
 #include "common/config.h"
 #include "common/types.h"
 #include "mod/common/rtrie.h"
+#include "mod/common/stats.h"
 
 struct eam_table;
 
@@ -13,23 +14,64 @@ struct eam_table *eamt_alloc(void);
 void eamt_get(struct eam_table *eamt);
 void eamt_put(struct eam_table *eamt);
 
+/*
+ * Named, read-only tables, which can be referenced by any number of instances,
+ * in any namespaces.
+ */
+int eamt_publish(struct eam_table *eamt, char const *name);
+struct eam_table *eamt_find_published(char const *name);
+bool eamt_is_published(struct eam_table *eamt);
+
 /* Safe-to-use-during-packet-translation functions */
 
+/*
+ * These are served by a small per-CPU cache of recent translations; @stats
+ * counts its hits and misses.
+ */
 int eamt_xlat_4to6(struct eam_table *eamt, struct in_addr *addr4,
-		struct result_addrxlat46 *result);
+		struct result_addrxlat46 *result, struct jool_stats *stats);
 int eamt_xlat_6to4(struct eam_table *eamt, struct in6_addr *addr6,
-		struct result_addrxlat64 *result);
+		struct result_addrxlat64 *result, struct jool_stats *stats);
+
+/*
+ * MAP-T rules (RFC 7599) are EAMs whose IPv6 side also embeds a Port Set ID;
+ * the functions above only translate their address bits. These handle the
+ * rest, after the caller reads the port.
+ */
+static inline bool eamt_is_map(struct eamt_entry const *eam)
+{
+	return eam->ea_len != 0;
+}
+
+int eamt_map_4to6(struct eamt_entry const *eam, struct in_addr const *addr4,
+		__u16 port, struct in6_addr *addr6);
+bool eamt_map_port_matches(struct eamt_entry const *eam,
+		struct in6_addr const *addr6, __u16 port);
 
 bool eamt_contains6(struct eam_table *eamt, struct in6_addr *addr);
 bool eamt_contains4(struct eam_table *eamt, __be32 addr);
 
 bool eamt_is_empty(struct eam_table *eamt);
+void eamt_memory(struct eam_table *eamt, __u64 *nodes, __u64 *bytes);
 
 /* Do-not-use-when-you-can't-sleep-functions */
 
 /* See rtrie.h for info on the "synchronize" flag */
 int eamt_add(struct eam_table *jool, struct eamt_entry *new, bool force,
 		bool synchronize);
+/*
+ * Bulk loading, for atomic configuration: eamt_stage() only queues the entry.
+ * eamt_commit_staged() validates and adds all the queued entries at once,
+ * which, if the table is empty, it does by sorting them and building the tries
+ * from scratch.
+ */
+int eamt_stage(struct eam_table *eamt, struct eamt_entry *new, bool force);
+int eamt_commit_staged(struct eam_table *eamt);
+/*
+ * Creates a copy of @eamt, which nothing else references. (Built in bulk, like
+ * eamt_commit_staged() does.)
+ */
+int eamt_clone(struct eam_table *eamt, struct eam_table **result);
 int eamt_rm(struct eam_table *eamt, struct ipv6_prefix *prefix6,
 		struct ipv4_prefix *prefix4);
 void eamt_flush(struct eam_table *eamt);
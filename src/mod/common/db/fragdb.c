@@ -0,0 +1,318 @@
+#include "mod/common/db/fragdb.h"
+
+#include <linux/jhash.h>
+#include <linux/kref.h>
+#include <linux/percpu.h>
+
+#include "mod/common/log.h"
+#include "mod/common/stats.h"
+#include "mod/common/wkmalloc.h"
+
+/* Remembered datagrams per CPU. Has to be a power of two. */
+#define FRAGDB_SLOTS 64
+/* Held fragments per CPU. */
+#define FRAGDB_HELD 16
+/* Lifespan of remembered datagrams and held fragments, in jiffies. */
+#define FRAGDB_TTL (2 * HZ)
+
+/*
+ * Identifies a datagram. Always memset before filling, so it can be hashed and
+ * compared as a blob.
+ */
+struct frag_key {
+	union {
+		struct in6_addr v6;
+		struct in_addr v4;
+	} src, dst;
+	__u32 id;
+	__u8 l3_proto;
+	__u8 l4_proto;
+};
+
+/* The ports of a datagram whose first fragment was already translated. */
+struct frag_slot {
+	struct frag_key key;
+	__u16 src_port;
+	__u16 dst_port;
+	/* Zero means the slot was never used. */
+	unsigned long expires;
+};
+
+/* A subsequent fragment whose first fragment hasn't arrived yet. */
+struct frag_held {
+	struct frag_key key;
+	/* NULL means the slot is free. */
+	struct sk_buff *skb;
+	unsigned long expires;
+};
+
+struct frag_cache {
+	struct frag_slot slots[FRAGDB_SLOTS];
+	struct frag_held held[FRAGDB_HELD];
+};
+
+struct fragdb {
+	struct frag_cache __percpu *cache;
+	struct kref refs;
+};
+
+struct fragdb *fragdb_alloc(void)
+{
+	struct fragdb *db;
+
+	db = wkmalloc(struct fragdb, GFP_KERNEL);
+	if (!db)
+		return NULL;
+
+	/* alloc_percpu() zeroes. */
+	db->cache = alloc_percpu(struct frag_cache);
+	if (!db->cache) {
+		wkfree(struct fragdb, db);
+		return NULL;
+	}
+
+	kref_init(&db->refs);
+	return db;
+}
+
+void fragdb_get(struct fragdb *db)
+{
+	kref_get(&db->refs);
+}
+
+static void fragdb_release(struct kref *refs)
+{
+	struct fragdb *db;
+	struct frag_cache *cache;
+	unsigned int cpu;
+	unsigned int i;
+
+	db = container_of(refs, struct fragdb, refs);
+
+	/* There are no packets left, so nobody else is touching the queues. */
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(db->cache, cpu);
+		for (i = 0; i < FRAGDB_HELD; i++)
+			if (cache->held[i].skb)
+				kfree_skb(cache->held[i].skb);
+	}
+
+	free_percpu(db->cache);
+	wkfree(struct fragdb, db);
+}
+
+void fragdb_put(struct fragdb *db)
+{
+	kref_put(&db->refs, fragdb_release);
+}
+
+/* Is @pkt the first of several fragments? */
+static bool is_first_of_many(struct packet const *pkt)
+{
+	struct frag_hdr const *hdr6;
+	struct iphdr const *hdr4;
+
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		hdr6 = pkt_frag_hdr(pkt);
+		return hdr6 && is_first_frag6(hdr6) && is_mf_set_ipv6(hdr6);
+	case L3PROTO_IPV4:
+		hdr4 = pkt_ip4_hdr(pkt);
+		return is_first_frag4(hdr4) && is_mf_set_ipv4(hdr4);
+	}
+
+	return false;
+}
+
+/* @pkt has to be a fragment. */
+static void init_key(struct packet const *pkt, struct frag_key *key)
+{
+	struct ipv6hdr const *hdr6;
+	struct iphdr const *hdr4;
+
+	memset(key, 0, sizeof(*key));
+
+	switch (pkt_l3_proto(pkt)) {
+	case L3PROTO_IPV6:
+		hdr6 = pkt_ip6_hdr(pkt);
+		key->src.v6 = hdr6->saddr;
+		key->dst.v6 = hdr6->daddr;
+		key->id = be32_to_cpu(pkt_frag_hdr(pkt)->identification);
+		break;
+	case L3PROTO_IPV4:
+		hdr4 = pkt_ip4_hdr(pkt);
+		key->src.v4.s_addr = hdr4->saddr;
+		key->dst.v4.s_addr = hdr4->daddr;
+		key->id = be16_to_cpu(hdr4->id);
+		break;
+	}
+
+	key->l3_proto = pkt_l3_proto(pkt);
+	key->l4_proto = pkt_l4_proto(pkt);
+}
+
+static bool key_equals(struct frag_key const *a, struct frag_key const *b)
+{
+	return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+static struct frag_slot *get_slot(struct fragdb *db, struct frag_key *key)
+{
+	return &this_cpu_ptr(db->cache)->slots[jhash(key, sizeof(*key), 0)
+			& (FRAGDB_SLOTS - 1)];
+}
+
+static void set_ports(struct tuple *tuple, __u16 src, __u16 dst)
+{
+	switch (tuple->l3_proto) {
+	case L3PROTO_IPV6:
+		tuple->src.addr6.l4 = src;
+		tuple->dst.addr6.l4 = dst;
+		break;
+	case L3PROTO_IPV4:
+		tuple->src.addr4.l4 = src;
+		tuple->dst.addr4.l4 = dst;
+		break;
+	}
+}
+
+/*
+ * Queues @state's packet until its first fragment arrives. If the queue is
+ * full, the fragment that would expire soonest makes room.
+ */
+static verdict hold(struct xlation *state, struct frag_key *key)
+{
+	struct frag_held *held;
+	struct frag_held *slot;
+	unsigned int i;
+
+	held = this_cpu_ptr(state->jool->nat64.fragdb->cache)->held;
+	slot = &held[0];
+	for (i = 0; i < FRAGDB_HELD; i++) {
+		if (!held[i].skb) {
+			slot = &held[i];
+			goto store;
+		}
+		if (time_before(held[i].expires, slot->expires))
+			slot = &held[i];
+	}
+
+	kfree_skb(slot->skb);
+	jstat_inc(state->jool->stats, JSTAT_FRAG_EXPIRED);
+	/* Fall through */
+
+store:
+	slot->key = *key;
+	slot->skb = state->in.skb;
+	slot->expires = jiffies + FRAGDB_TTL;
+	log_debug(state, "Fragment is early; holding it until its first fragment arrives.");
+	return stolen(state, JSTAT_FRAG_HELD);
+}
+
+/**
+ * fragdb_find - Recovers the ports of @state's packet, which has to be a
+ * subsequent UDP fragment, from its datagram's first fragment.
+ *
+ * If the first fragment hasn't been seen yet, steals the packet. (It will be
+ * handed back to the core by fragdb_pop().)
+ */
+verdict fragdb_find(struct xlation *state)
+{
+	struct frag_key key;
+	struct frag_slot *slot;
+	verdict result;
+
+	init_key(&state->in, &key);
+
+	local_bh_disable();
+
+	slot = get_slot(state->jool->nat64.fragdb, &key);
+	if (slot->expires && time_before(jiffies, slot->expires)
+			&& key_equals(&slot->key, &key)) {
+		set_ports(&state->in.tuple, slot->src_port, slot->dst_port);
+		result = VERDICT_CONTINUE;
+	} else {
+		result = hold(state, &key);
+	}
+
+	local_bh_enable();
+	return result;
+}
+
+/**
+ * fragdb_add - If @state's packet is a first fragment, remembers its ports for
+ * the benefit of the rest of its datagram.
+ */
+void fragdb_add(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct frag_key key;
+	struct frag_slot *slot;
+
+	if (pkt_l4_proto(in) != L4PROTO_UDP || !is_first_of_many(in))
+		return;
+
+	init_key(in, &key);
+
+	local_bh_disable();
+
+	slot = get_slot(state->jool->nat64.fragdb, &key);
+	slot->key = key;
+	switch (in->tuple.l3_proto) {
+	case L3PROTO_IPV6:
+		slot->src_port = in->tuple.src.addr6.l4;
+		slot->dst_port = in->tuple.dst.addr6.l4;
+		break;
+	case L3PROTO_IPV4:
+		slot->src_port = in->tuple.src.addr4.l4;
+		slot->dst_port = in->tuple.dst.addr4.l4;
+		break;
+	}
+	slot->expires = jiffies + FRAGDB_TTL;
+
+	local_bh_enable();
+}
+
+/**
+ * fragdb_pop - If @state's packet is a first fragment, dequeues one of the
+ * fragments of its datagram that arrived earlier. Returns NULL when there are
+ * none left.
+ *
+ * The caller owns the returned packet. Expired fragments are released along
+ * the way.
+ */
+struct sk_buff *fragdb_pop(struct xlation *state)
+{
+	struct frag_key key;
+	struct frag_held *held;
+	struct sk_buff *skb;
+	unsigned int i;
+
+	if (pkt_l4_proto(&state->in) != L4PROTO_UDP
+			|| !is_first_of_many(&state->in))
+		return NULL;
+
+	init_key(&state->in, &key);
+	skb = NULL;
+
+	local_bh_disable();
+
+	held = this_cpu_ptr(state->jool->nat64.fragdb->cache)->held;
+	for (i = 0; i < FRAGDB_HELD; i++) {
+		if (!held[i].skb)
+			continue;
+
+		if (time_after_eq(jiffies, held[i].expires)) {
+			kfree_skb(held[i].skb);
+			held[i].skb = NULL;
+			jstat_inc(state->jool->stats, JSTAT_FRAG_EXPIRED);
+		} else if (key_equals(&held[i].key, &key)) {
+			skb = held[i].skb;
+			held[i].skb = NULL;
+			break;
+		}
+	}
+
+	local_bh_enable();
+	return skb;
+}
@@ -0,0 +1,34 @@
+#ifndef SRC_MOD_COMMON_DB_FRAGDB_H_
+#define SRC_MOD_COMMON_DB_FRAGDB_H_
+
+/**
+ * @file
+ * Fragment tracking. (The NAT64 module's fragment_tracking parameter.)
+ *
+ * Without nf_defrag, a NAT64 receives UDP fragments as they come. The first
+ * one carries the ports, so it's translated as usual; its datagram's ports are
+ * then remembered in a small per-CPU cache, keyed by addresses and fragment
+ * identification. Subsequent fragments recover their ports from the cache, so
+ * they find the same BIB entry and session, and are translated individually.
+ *
+ * Subsequent fragments that arrive before their first fragment are held in a
+ * bounded per-CPU queue, until the first fragment shows up or they expire.
+ *
+ * Fragments of the same datagram are expected to reach the same CPU. (RSS and
+ * RPS hash fragments by addresses only.) A datagram whose fragments get split
+ * across CPUs is not lost; its held fragments merely expire.
+ */
+
+#include "mod/common/translation_state.h"
+
+struct fragdb;
+
+struct fragdb *fragdb_alloc(void);
+void fragdb_get(struct fragdb *db);
+void fragdb_put(struct fragdb *db);
+
+verdict fragdb_find(struct xlation *state);
+void fragdb_add(struct xlation *state);
+struct sk_buff *fragdb_pop(struct xlation *state);
+
+#endif /* SRC_MOD_COMMON_DB_FRAGDB_H_ */
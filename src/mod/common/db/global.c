@@ -79,6 +79,17 @@ int globals_init(struct jool_globals *config, xlator_type type,
 	config->lowest_ipv6_mtu = DEFAULT_LOWEST_IPV6_MTU;
 	memcpy(config->plateaus.values, &PLATEAUS, sizeof(PLATEAUS));
 	config->plateaus.count = ARRAY_SIZE(PLATEAUS);
+	config->icmp_error_rate = DEFAULT_ICMP_ERROR_RATE;
+	config->icmp_error_source_rate = DEFAULT_ICMP_ERROR_SOURCE_RATE;
+	config->tcp_mss_clamp = DEFAULT_TCP_MSS_CLAMP;
+	config->netfilter_marks.set = false;
+	config->capture_sample = DEFAULT_CAPTURE_SAMPLE;
+	config->capture_snaplen = DEFAULT_CAPTURE_SNAPLEN;
+	config->ingress_devices.count = 0;
+	config->next_hop6.set = false;
+	config->next_hop4.set = false;
+	config->generate_flow_label = DEFAULT_GENERATE_FLOW_LABEL;
+	config->ipv4_id_policy = DEFAULT_IPV4_ID_POLICY;
 
 	switch (type) {
 	case XT_SIIT:
@@ -93,6 +104,11 @@ int globals_init(struct jool_globals *config, xlator_type type,
 		config->nat64.drop_icmp6_info = DEFAULT_FILTER_ICMPV6_INFO;
 		config->nat64.src_icmp6errs_better = DEFAULT_SRC_ICMP6ERRS_BETTER;
 		config->nat64.f_args = DEFAULT_F_ARGS;
+		config->nat64.f_hash = DEFAULT_F_HASH;
+		config->nat64.deterministic_prefix.set = false;
+		config->nat64.deterministic_len = DEFAULT_DETERMINISTIC_LEN;
+		config->nat64.pool6_tenants.count = 0;
+		config->nat64.latency_sample = DEFAULT_LATENCY_SAMPLE;
 		config->nat64.handle_rst_during_fin_rcv = DEFAULT_HANDLE_FIN_RCV_RST;
 
 		config->nat64.bib.ttl.tcp_est = 1000 * TCP_EST;
@@ -101,9 +117,33 @@ int globals_init(struct jool_globals *config, xlator_type type,
 		config->nat64.bib.ttl.icmp = 1000 * ICMP_DEFAULT;
 		config->nat64.bib.bib_logging = DEFAULT_BIB_LOGGING;
 		config->nat64.bib.session_logging = DEFAULT_SESSION_LOGGING;
+		config->nat64.bib.bib_logging_binary = DEFAULT_BIB_LOGGING_BINARY;
 		config->nat64.bib.drop_by_addr = DEFAULT_ADDR_DEPENDENT_FILTERING;
 		config->nat64.bib.drop_external_tcp = DEFAULT_DROP_EXTERNAL_CONNECTIONS;
 		config->nat64.bib.max_stored_pkts = DEFAULT_MAX_STORED_PKTS;
+		config->nat64.bib.max_stored_pkts_per_src = DEFAULT_MAX_STORED_PKTS_PER_SRC;
+		config->nat64.bib.expiry_budget = DEFAULT_EXPIRY_BUDGET;
+		config->nat64.bib.port_block_size = DEFAULT_PORT_BLOCK_SIZE;
+		config->nat64.bib.syn_flood_threshold = DEFAULT_SYN_FLOOD_THRESHOLD;
+		config->nat64.bib.subscriber_prefix_len = DEFAULT_SUBSCRIBER_PREFIX_LEN;
+		config->nat64.bib.subscriber_max_ports = DEFAULT_SUBSCRIBER_MAX_PORTS;
+		config->nat64.bib.subscriber_max_sessions = DEFAULT_SUBSCRIBER_MAX_SESSIONS;
+		config->nat64.bib.subscriber_packet_rate = DEFAULT_SUBSCRIBER_PACKET_RATE;
+		config->nat64.bib.subscriber_session_rate = DEFAULT_SUBSCRIBER_SESSION_RATE;
+		config->nat64.bib.overload_threshold = DEFAULT_OVERLOAD_THRESHOLD;
+		config->nat64.bib.cluster_nodes = DEFAULT_CLUSTER_NODES;
+		config->nat64.bib.cluster_node = DEFAULT_CLUSTER_NODE;
+		config->nat64.bib.pressure_low = DEFAULT_POOL4_PRESSURE_LOW;
+		config->nat64.bib.pressure_high = DEFAULT_POOL4_PRESSURE_HIGH;
+		config->nat64.bib.rss_queues = DEFAULT_RSS_QUEUES;
+		config->nat64.bib.port_preservation = DEFAULT_PORT_PRESERVATION;
+		config->nat64.bib.least_loaded_address = DEFAULT_LEAST_LOADED_ADDRESS;
+		config->nat64.bib.max_sessions = DEFAULT_MAX_SESSIONS;
+		config->nat64.bib.refresh_granularity = DEFAULT_REFRESH_GRANULARITY;
+		config->nat64.bib.session_counters = DEFAULT_SESSION_COUNTERS;
+		config->nat64.bib.ttl.udp_fast = 1000 * UDP_FAST_DEFAULT;
+		config->nat64.bib.udp_fast_ports.count = 0;
+		config->nat64.bib.timeout_classes.count = 0;
 
 		config->nat64.joold.enabled = DEFAULT_JOOLD_ENABLED;
 		config->nat64.joold.flush_asap = DEFAULT_JOOLD_FLUSH_ASAP;
@@ -111,6 +151,13 @@ int globals_init(struct jool_globals *config, xlator_type type,
 		config->nat64.joold.capacity = DEFAULT_JOOLD_CAPACITY;
 		config->nat64.joold.max_payload = DEFAULT_JOOLD_MAX_PAYLOAD;
 		config->nat64.joold.max_sessions_per_pkt = DEFAULT_JOOLD_MAX_SESSIONS_PER_PKT;
+		config->nat64.joold.max_outstanding = DEFAULT_JOOLD_MAX_OUTSTANDING;
+		config->nat64.joold.sync_tcp = DEFAULT_JOOLD_SYNC_TCP;
+		config->nat64.joold.sync_udp = DEFAULT_JOOLD_SYNC_UDP;
+		config->nat64.joold.sync_icmp = DEFAULT_JOOLD_SYNC_ICMP;
+		config->nat64.joold.min_age = DEFAULT_JOOLD_MIN_AGE;
+		config->nat64.joold.established_only = DEFAULT_JOOLD_ESTABLISHED_ONLY;
+		config->nat64.joold.flush_window = DEFAULT_JOOLD_FLUSH_WINDOW;
 		break;
 
 	default:
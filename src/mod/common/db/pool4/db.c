@@ -1,10 +1,16 @@
 #include "mod/common/db/pool4/db.h"
 
 #include <linux/hash.h>
+#include <linux/bitmap.h>
 #include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 
 #include "common/types.h"
+#include "mod/common/address.h"
 #include "mod/common/log.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/db/rbtree.h"
@@ -86,23 +92,183 @@ struct pool4_trees {
 	struct rb_root icmp;
 };
 
+/*
+ * Snapshots.
+ *
+ * The packet path doesn't read the trees, because it would need pool->lock (and,
+ * in the case of mask domains, a copy of the table; the trees can change while
+ * the domain is in use). Instead, it reads an immutable copy of every table (a
+ * "view"), published through RCU. So neither mask_domain_find() nor
+ * pool4db_contains() lock anything.
+ *
+ * The writers (which run in process context) build the new snapshot once
+ * they're done changing the trees, and replace the old one when it's ready.
+ * So allocation happens once per configuration change (outside of the
+ * spinlock, and with GFP_KERNEL), never in the packet path. Until the new
+ * snapshot is published, the packet path keeps reading the old one.
+ *
+ * If the new snapshot can't be allocated, the writer fails, and the snapshot is
+ * flagged stale until the next successful refresh. In the meantime, exact
+ * lookups (pool4db_contains() and friends) go back to the locked trees.
+ * mask_domain_find() keeps using the stale snapshot, since it can't improvise
+ * a domain without allocating.
+ */
+
+/** Read-only copy of a table. */
+struct pool4_view {
+	union {
+		__u32 mark;
+		struct in_addr addr;
+	};
+
+	unsigned int taddr_count;
+	/*
+	 * ITERATIONS_INFINITE is represented by this being zero.
+	 * (Only relevant in mark-based views.)
+	 */
+	unsigned int max_iterations;
+	/* Was @max_iterations computed by auto_max_iterations()? */
+	bool auto_iterations;
+	unsigned int range_count;
+	struct ipv4_range *ranges;
+};
+
+/** A tree's views, in tree order. */
+struct pool4_views {
+	struct pool4_view *array;
+	unsigned int count;
+
+	/*
+	 * Address views only: @array, hashed by address (linear probing,
+	 * never more than half full). Its length is 2^@bucket_bits. Because
+	 * pool4db_contains() is the first thing unsolicited IPv4 traffic
+	 * runs into, it should reject it in constant time.
+	 */
+	struct pool4_view **buckets;
+	unsigned int bucket_bits;
+};
+
+/* Bits of the snapshots' address filters. (See pool4db_may_contain().) */
+#define POOL4_FILTER_ORDER 10
+
+struct pool4_snapshot {
+	/** Copy of tree_mark. Indexed by l4_protocol. */
+	struct pool4_views mark[L4PROTO_OTHER];
+	/** Copy of tree_addr. Indexed by l4_protocol. */
+	struct pool4_views addr[L4PROTO_OTHER];
+	/**
+	 * One-hash Bloom filter of every protocol's addresses, so the
+	 * Netfilter hook can discard foreign traffic with a single bit test.
+	 */
+	DECLARE_BITMAP(filter, 1 << POOL4_FILTER_ORDER);
+	/** Bytes allocated for the snapshot, including the arrays. */
+	size_t size;
+	struct rcu_head rcu;
+
+	/*
+	 * An array of struct pool4_view hangs off here, followed by the
+	 * address views' buckets, followed by an array of struct ipv4_range.
+	 */
+};
+
+#ifdef POOL4_LEASES
+/*
+ * Per-CPU port leases.
+ *
+ * In this mode, every CPU keeps (per protocol) a "lease" of LEASE_SIZE
+ * consecutive transport addresses from the last mark-based table it needed.
+ * mask_domain_find() hands out the leased addresses as iteration starting
+ * points, without computing RFC 6056's F(). The CPU's @next_ephemeral only
+ * advances once per lease.
+ *
+ * The CPU only goes back to RFC 6056 when its lease is stale (pool4 changed,
+ * or the packet has a different mark), exhausted or has been idle for
+ * LEASE_IDLE. (Old leases are simply dropped; there's nothing to give back.)
+ *
+ * Leases are hints, not reservations. The BIB still validates every candidate,
+ * and mask_domain_next() still wraps around the whole domain once the lease
+ * runs dry. So static BIB entries, joold sessions and overlapping leases are
+ * not a problem.
+ */
+#define LEASE_SIZE 64
+#define LEASE_IDLE msecs_to_jiffies(10000)
+
+struct pool4_lease {
+	/** pool4 generation the lease was measured on. */
+	unsigned int generation;
+	/** Mark of the table the lease was measured on. */
+	__u32 mark;
+	/** Domain offset of the first leased transport address. */
+	unsigned int offset;
+	/** Number of leased transport addresses already handed out. */
+	unsigned int used;
+	/** Last time the lease was used (jiffies). */
+	unsigned long last_used;
+};
+
+struct pool4_leases {
+	/* Indexed by l4_protocol. */
+	struct pool4_lease protos[L4PROTO_OTHER];
+};
+#endif
+
 struct pool4 {
 	/** Entries indexed via mark. (Normally used in 6->4) */
 	struct pool4_trees tree_mark;
 	/** Entries indexed via address. (Normally used in 4->6) */
 	struct pool4_trees tree_addr;
 
-	spinlock_t lock;
+	struct jlock lock;
 	struct kref refcounter;
+
+	/** Never NULL. Writers need @lock. (See refresh_snapshot().) */
+	struct pool4_snapshot __rcu *snapshot;
+	/** Increases whenever the trees change. Protected by @lock. */
+	unsigned int version;
+	/**
+	 * Is @snapshot older than the trees? (Only if the last refresh failed.)
+	 * Written with @lock held.
+	 */
+	bool stale;
+
+	/**
+	 * From RFC 6056, algorithm 3. One per CPU, so that port allocations
+	 * don't bounce a shared cache line. Only touched with BHs disabled.
+	 */
+	unsigned int __percpu *next_ephemeral;
+
+#ifdef POOL4_LEASES
+	/** Increases whenever the trees change. Invalidates the leases. */
+	atomic_t generation;
+	struct pool4_leases __percpu *leases;
+#endif
 };
 
+/* Ranges a mask_domain can improvise without allocating. */
+#define DOMAIN_SCRATCH_RANGES 4
+
 struct mask_domain {
 	__u32 pool_mark;
 
 	unsigned int taddr_count;
 	unsigned int taddr_counter;
+	/** The CPU's pool4.next_ephemeral. mask_domain_commit() advances it. */
+	unsigned int *next_ephemeral;
 	/* ITERATIONS_INFINITE is represented by this being zero. */
 	unsigned int max_iterations;
+	/**
+	 * Was @max_iterations computed by auto_max_iterations()? (If so,
+	 * mask_domain_set_occupancy() is allowed to raise it.)
+	 */
+	bool auto_iterations;
+	/** See mask_domain_set_occupancy(). */
+	bool crowded;
+	/**
+	 * Masks mask_domain_skip() jumped over while @crowded, and the ones
+	 * mask_domain_forgo() jumped over. They don't count towards
+	 * @max_iterations.
+	 */
+	unsigned int skipped;
 
 	unsigned int range_count;
 	struct ipv4_range *current_range;
@@ -120,36 +286,54 @@ struct mask_domain {
 	 */
 	bool dynamic;
 
-	/*
-	 * An array of struct ipv4_range hangs off here.
-	 * (The array length is @sample_count.)
+	/**
+	 * The domain's entries. (The array length is @range_count.)
+	 * Normally, this points to a snapshot's view, or to @scratch.
 	 */
+	struct ipv4_range *ranges;
+	/** Was @ranges allocated? (Because @scratch was too small.) */
+	bool ranges_allocated;
+
+	/** Is this a CPU's domain? (See get_domain().) */
+	bool percpu;
+	/** Is the CPU's domain taken? (Only meaningful if @percpu.) */
+	bool busy;
+
+	struct ipv4_range scratch[DOMAIN_SCRATCH_RANGES];
 };
 
-/**
- * From RFC 6056, algorithm 3.
+/*
+ * Per-CPU domains.
+ *
+ * A mask domain only lives between mask_domain_find() and mask_domain_put(),
+ * which run in one go, in the same RCU read-side critical section, and with
+ * bottom halves disabled. So each CPU only needs one, and it can be reused
+ * from one packet to the next. (Its ranges are the snapshot's, so there's
+ * nothing to copy either.)
+ *
+ * In case some translation needs a second domain before putting the first one,
+ * get_domain() falls back to allocating.
+ */
+static DEFINE_PER_CPU(struct mask_domain, cpu_domains);
+
+/*
+ * About pool4.next_ephemeral:
  *
  * TODO (issue175) This is not perfect. According to the RFC, there would
  * ideally be one of these per `--f-args`-defined tuple, but since that's not
- * rational, it settles with one per pool4 table.
- * This being a global variable, we're doing one per NAT64 kernel module. (Which
- * is even farther from the ideal.)
+ * rational, it settles with one per pool4 and CPU.
  *
  * As far as the RFC is concerned, this is actually perfectly fine. (The only
  * purpose of `next_ephemeral` (as far as I can tell) is to reduce looping for
  * port allocations that share the `--f-args` fields. This implementation
- * definitely does that.) But this is only because it doesn't care about gaming
- * (see the giant note at rfc6056.c). This being a global variable puts a hamper
- * on gaming because it means unrelated traffic will separate the connections of
- * a game's client too much. This is, in fact, a natural problem of algorithm 3
- * (again, because the RFC doesn't care), but we're making it worse.
- *
- * Because @next_ephemeral is needed during mask iteration, which does not have
- * access to the pool4 for significant locking/performance reasons, this is not
- * trivial to fix. I'm hoping (though haven't actually given it much thought)
- * that it will be more feasible once issue175 is implemented.
+ * definitely does that, as long as the connections land on the same CPU,
+ * which RSS tends to ensure for a given subscriber.) But this is only because
+ * it doesn't care about gaming (see the giant note at rfc6056.c). Sharing the
+ * offset puts a hamper on gaming because it means unrelated traffic will
+ * separate the connections of a game's client too much. This is, in fact, a
+ * natural problem of algorithm 3 (again, because the RFC doesn't care). At
+ * least now, only the traffic of the same instance and CPU interferes.
  */
-static atomic_t next_ephemeral = ATOMIC_INIT(0);
 
 /**
  * Assumes @domain has at least one entry.
@@ -234,9 +418,71 @@ static struct ipv4_range *last_table_entry(struct pool4_table *table)
 
 static struct ipv4_range *first_domain_entry(struct mask_domain *domain)
 {
-	return (struct ipv4_range *)(domain + 1);
+	return domain->ranges;
+}
+
+#ifdef POOL4_LEASES
+
+static int init_leases(struct pool4 *pool)
+{
+	atomic_set(&pool->generation, 1);
+	pool->leases = alloc_percpu(struct pool4_leases);
+	return pool->leases ? 0 : -ENOMEM;
+}
+
+static void destroy_leases(struct pool4 *pool)
+{
+	free_percpu(pool->leases);
+}
+
+static void invalidate_leases(struct pool4 *pool)
+{
+	atomic_inc(&pool->generation);
+}
+
+#else
+
+static int init_leases(struct pool4 *pool)
+{
+	return 0;
+}
+
+static void destroy_leases(struct pool4 *pool)
+{
+	/* No code. */
+}
+
+static void invalidate_leases(struct pool4 *pool)
+{
+	/* No code. */
+}
+
+#endif /* POOL4_LEASES */
+
+static void snapshot_free(struct pool4_snapshot *snapshot)
+{
+	__wkkvfree("pool4 snapshot", snapshot);
+}
+
+/* bib_teardown()'s rcu_barrier() waits for these. */
+static void snapshot_rcu_cb(struct rcu_head *rcu)
+{
+	snapshot_free(container_of(rcu, struct pool4_snapshot, rcu));
+}
+
+/**
+ * Outdates the snapshot, and forces the CPUs to renew their leases. Call
+ * whenever the trees change (with pool->lock held), and refresh_snapshot()
+ * once the lock is released.
+ */
+static void trees_changed(struct pool4 *pool)
+{
+	pool->version++;
+	invalidate_leases(pool);
 }
 
+static int refresh_snapshot(struct pool4 *pool);
+
 /* Leaves table->addr and table->mark undefined! */
 static struct pool4_table *create_table(struct ipv4_range *range)
 {
@@ -263,6 +509,7 @@ static struct pool4_table *create_table(struct ipv4_range *range)
 struct pool4 *pool4db_alloc(void)
 {
 	struct pool4 *result;
+	unsigned int cpu;
 
 	result = wkmalloc(struct pool4, GFP_KERNEL);
 	if (!result)
@@ -274,10 +521,34 @@ struct pool4 *pool4db_alloc(void)
 	result->tree_addr.tcp = RB_ROOT;
 	result->tree_addr.udp = RB_ROOT;
 	result->tree_addr.icmp = RB_ROOT;
-	spin_lock_init(&result->lock);
+	jlock_init(&result->lock);
 	kref_init(&result->refcounter);
+	RCU_INIT_POINTER(result->snapshot, NULL);
+	result->version = 0;
+	result->stale = false;
+
+	result->next_ephemeral = alloc_percpu(unsigned int);
+	if (!result->next_ephemeral)
+		goto ephemeral_fail;
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(result->next_ephemeral, cpu) =
+				rfc6056_ephemeral_seed(result, cpu);
+
+	if (init_leases(result))
+		goto leases_fail;
+	/* The packet path assumes there's always a snapshot. */
+	if (refresh_snapshot(result))
+		goto snapshot_fail;
 
 	return result;
+
+snapshot_fail:
+	destroy_leases(result);
+leases_fail:
+	free_percpu(result->next_ephemeral);
+ephemeral_fail:
+	wkfree(struct pool4, result);
+	return NULL;
 }
 
 void pool4db_get(struct pool4 *pool)
@@ -312,6 +583,10 @@ static void pool4db_release(struct kref *refcounter)
 {
 	struct pool4 *pool;
 	pool = container_of(refcounter, struct pool4, refcounter);
+	destroy_leases(pool);
+	free_percpu(pool->next_ephemeral);
+	/* Nobody else holds a reference, so nobody is reading it. */
+	snapshot_free(rcu_dereference_protected(pool->snapshot, true));
 	clear_trees(pool);
 	wkfree(struct pool4, pool);
 }
@@ -534,6 +809,7 @@ int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry)
 {
 	struct ipv4_range addend = { .ports = entry->range.ports };
 	u64 tmp;
+	int refresh_error;
 	int error;
 
 	error = prefix4_validate(&entry->range.prefix);
@@ -551,22 +827,26 @@ int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry)
 
 	addend.prefix.len = 32;
 	foreach_addr4(addend.prefix.addr, tmp, &entry->range.prefix) {
-		spin_lock_bh(&pool->lock);
+		jlock_lock_bh(&pool->lock);
+		trees_changed(pool);
 		error = add_to_mark_tree(pool, entry, &addend);
 		if (!error) {
 			error = add_to_addr_tree(pool, entry, &addend);
 			if (error)
 				goto trainwreck;
 		}
-		spin_unlock_bh(&pool->lock);
+		jlock_unlock_bh(&pool->lock);
 		if (error)
-			return error;
+			break;
 	}
 
-	return 0;
+	/* (The addresses added before the error stay.) */
+	refresh_error = refresh_snapshot(pool);
+	return error ? error : refresh_error;
 
 trainwreck:
-	spin_unlock_bh(&pool->lock);
+	jlock_unlock_bh(&pool->lock);
+	refresh_snapshot(pool);
 	/*
 	 * We're in a serious conundrum.
 	 * We cannot revert the add_to_mark_tree() because of port range fusing;
@@ -581,6 +861,426 @@ trainwreck:
 	return error;
 }
 
+/*
+ * Bulk additions.
+ *
+ * pool4db_add() inserts one address range at a time, and each insertion
+ * shifts (and reallocates) the range arrays of its two tables. So loading N
+ * ranges that share a mark costs O(N^2). pool4db_add_bulk() sorts the new
+ * ranges instead, merges them with the existing ranges of each table they
+ * touch in a single linear pass, and allocates every resulting table once.
+ */
+
+struct bulk_range {
+	__u32 mark;
+	__u8 proto;
+	/* Always a single address. */
+	struct ipv4_range range;
+};
+
+/* One of the tables being rebuilt. */
+struct bulk_table {
+	struct rb_root *tree;
+	/* The table being replaced. NULL if @new is brand new. */
+	struct pool4_table *old;
+	struct pool4_table *new;
+};
+
+/* Table order; address, then first port. */
+static int cmp_range_start(struct ipv4_range const *r1,
+		struct ipv4_range const *r2)
+{
+	int gap;
+
+	gap = ipv4_addr_cmp(&r1->prefix.addr, &r2->prefix.addr);
+	if (gap)
+		return gap;
+	return (int)r1->ports.min - (int)r2->ports.min;
+}
+
+/* Groups the ranges by mark table. */
+static int cmp_bulk_mark(const void *a, const void *b)
+{
+	struct bulk_range const *r1 = a;
+	struct bulk_range const *r2 = b;
+
+	if (r1->proto != r2->proto)
+		return (int)r1->proto - (int)r2->proto;
+	if (r1->mark != r2->mark)
+		return (r1->mark < r2->mark) ? -1 : 1;
+	return cmp_range_start(&r1->range, &r2->range);
+}
+
+/* Groups the ranges by address table. */
+static int cmp_bulk_addr(const void *a, const void *b)
+{
+	struct bulk_range const *r1 = a;
+	struct bulk_range const *r2 = b;
+
+	if (r1->proto != r2->proto)
+		return (int)r1->proto - (int)r2->proto;
+	return cmp_range_start(&r1->range, &r2->range);
+}
+
+/* Returns the length of the group (of same-table ranges) @ranges starts. */
+static unsigned int group_len(struct bulk_range const *ranges,
+		unsigned int count, bool by_mark)
+{
+	unsigned int i;
+
+	for (i = 1; i < count; i++) {
+		if (ranges[i].proto != ranges[0].proto)
+			break;
+		if (by_mark && ranges[i].mark != ranges[0].mark)
+			break;
+		if (!by_mark && !addr4_equals(&ranges[i].range.prefix.addr,
+				&ranges[0].range.prefix.addr))
+			break;
+	}
+
+	return i;
+}
+
+static unsigned int count_groups(struct bulk_range const *ranges,
+		unsigned int count, bool by_mark)
+{
+	unsigned int groups;
+	unsigned int i;
+
+	for (i = 0, groups = 0; i < count; groups++)
+		i += group_len(&ranges[i], count - i, by_mark);
+	return groups;
+}
+
+/* Fuses sorted ranges as they come. If @dst is NULL, it only counts them. */
+struct range_merger {
+	struct ipv4_range *dst;
+	unsigned int count;
+	unsigned int taddr_count;
+	struct ipv4_range current;
+	bool started;
+};
+
+static void merger_flush(struct range_merger *merger)
+{
+	if (!merger->started)
+		return;
+	if (merger->dst)
+		merger->dst[merger->count] = merger->current;
+	merger->count++;
+	merger->taddr_count += port_range_count(&merger->current.ports);
+}
+
+static void merger_push(struct range_merger *merger,
+		struct ipv4_range const *range)
+{
+	struct ipv4_range tmp = *range;
+
+	if (merger->started && compare_range(&merger->current, &tmp) == 0) {
+		ipv4_range_fuse(&merger->current, &tmp);
+		return;
+	}
+
+	merger_flush(merger);
+	merger->current = tmp;
+	merger->started = true;
+}
+
+/* Feeds @old's ranges and the @count @news to @merger, in table order. */
+static void merge_ranges(struct range_merger *merger, struct pool4_table *old,
+		struct bulk_range const *news, unsigned int count)
+{
+	struct ipv4_range *olds = old ? first_table_entry(old) : NULL;
+	unsigned int old_count = old ? old->sample_count : 0;
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	while (i < old_count || j < count) {
+		if (j == count)
+			merger_push(merger, &olds[i++]);
+		else if (i < old_count
+				&& cmp_range_start(&olds[i], &news[j].range) <= 0)
+			merger_push(merger, &olds[i++]);
+		else
+			merger_push(merger, &news[j++].range);
+	}
+
+	merger_flush(merger);
+}
+
+/* Builds the table that results from adding @news to @old. */
+static struct pool4_table *build_table(struct pool4_table *old,
+		struct bulk_range const *news, unsigned int count, bool by_mark)
+{
+	struct range_merger merger = { 0 };
+	struct pool4_table *table;
+
+	merge_ranges(&merger, old, news, count);
+
+	table = __wkmalloc("pool4table", sizeof(struct pool4_table)
+			+ merger.count * sizeof(struct ipv4_range),
+			GFP_ATOMIC);
+	if (!table)
+		return NULL;
+
+	if (old) {
+		table->mark = old->mark; /* (Or addr; it's a union.) */
+		table->max_iterations_allowed = old->max_iterations_allowed;
+		table->max_iterations_flags = old->max_iterations_flags;
+	} else {
+		if (by_mark)
+			table->mark = news[0].mark;
+		else
+			table->addr = news[0].range.prefix.addr;
+		table->max_iterations_allowed = 0;
+		table->max_iterations_flags = ITERATIONS_AUTO;
+	}
+
+	memset(&merger, 0, sizeof(merger));
+	merger.dst = first_table_entry(table);
+	merge_ranges(&merger, old, news, count);
+	table->taddr_count = merger.taddr_count;
+	table->sample_count = merger.count;
+
+	return table;
+}
+
+/*
+ * Builds the replacements of the tables @ranges (already sorted and grouped)
+ * belong to, and writes them to @builds.
+ * Returns the number of tables built, or negative if allocation failed.
+ */
+static int build_tables(struct pool4 *pool, struct bulk_range const *ranges,
+		unsigned int count, bool by_mark, struct bulk_table *builds)
+{
+	struct pool4_trees *trees;
+	struct bulk_table *build;
+	unsigned int len;
+	unsigned int i;
+	int built;
+
+	trees = by_mark ? &pool->tree_mark : &pool->tree_addr;
+
+	for (i = 0, built = 0; i < count; i += len, built++) {
+		len = group_len(&ranges[i], count - i, by_mark);
+		build = &builds[built];
+
+		/* expand_entries() validated the protocols. */
+		build->tree = get_tree(trees, ranges[i].proto);
+		build->old = by_mark
+				? find_by_mark(build->tree, ranges[i].mark)
+				: find_by_addr(build->tree,
+						&ranges[i].range.prefix.addr);
+		build->new = build_table(build->old, &ranges[i], len, by_mark);
+		if (!build->new)
+			goto fail;
+	}
+
+	return built;
+
+fail:
+	while (built-- > 0)
+		destroy_table(builds[built].new);
+	return -ENOMEM;
+}
+
+/* Replaces the old tables with the @count new ones. Cannot fail. */
+static void swap_tables(struct bulk_table *builds, unsigned int count,
+		bool by_mark)
+{
+	struct bulk_table *build;
+	struct pool4_table *collision;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		build = &builds[i];
+
+		if (build->old) {
+			rb_replace_node(&build->old->tree_hook,
+					&build->new->tree_hook, build->tree);
+			destroy_table(build->old);
+			continue;
+		}
+
+		if (by_mark)
+			collision = rbtree_add(build->new, build->new->mark,
+					build->tree, cmp_mark,
+					struct pool4_table, tree_hook);
+		else
+			collision = rbtree_add(build->new, &build->new->addr,
+					build->tree, cmp_addr,
+					struct pool4_table, tree_hook);
+		/* Every group yields a different table. */
+		if (WARN(collision, "pool4 bulk groups are not unique."))
+			destroy_table(build->new);
+	}
+}
+
+/* Converts @entries into single-address ranges. */
+static int expand_entries(struct pool4_entry const *entries,
+		unsigned int count, struct bulk_range **result,
+		unsigned int *result_count)
+{
+	struct pool4_entry const *entry;
+	struct bulk_range *ranges;
+	struct bulk_range *range;
+	struct in_addr addr;
+	struct port_range ports;
+	u64 total;
+	u64 tmp;
+	unsigned int i;
+	int error;
+
+	total = 0;
+	for (i = 0; i < count; i++) {
+		entry = &entries[i];
+		error = prefix4_validate(&entry->range.prefix);
+		if (error)
+			return error;
+		error = max_iterations_validate(entry->flags,
+				entry->iterations);
+		if (error)
+			return error;
+		if (entry->proto != L4PROTO_TCP && entry->proto != L4PROTO_UDP
+				&& entry->proto != L4PROTO_ICMP) {
+			log_err("Unsupported transport protocol: %u.",
+					entry->proto);
+			return -EINVAL;
+		}
+		total += prefix4_next(&entry->range.prefix)
+				- be32_to_cpu(entry->range.prefix.addr.s_addr);
+	}
+
+	if (total > UINT_MAX / sizeof(struct bulk_range))
+		return -E2BIG;
+
+	ranges = __wkvmalloc("pool4 bulk ranges",
+			total * sizeof(struct bulk_range));
+	if (!ranges)
+		return -ENOMEM;
+
+	range = ranges;
+	for (i = 0; i < count; i++) {
+		entry = &entries[i];
+
+		/* Same normalization as pool4db_add(). */
+		ports = entry->range.ports;
+		if (ports.min > ports.max)
+			swap(ports.min, ports.max);
+		if (entry->proto == L4PROTO_TCP || entry->proto == L4PROTO_UDP)
+			if (ports.min == 0)
+				ports.min = 1;
+
+		foreach_addr4(addr, tmp, &entry->range.prefix) {
+			range->mark = entry->mark;
+			range->proto = entry->proto;
+			range->range.prefix.addr = addr;
+			range->range.prefix.len = 32;
+			range->range.ports = ports;
+			range++;
+		}
+	}
+
+	*result = ranges;
+	*result_count = total;
+	return 0;
+}
+
+/**
+ * pool4db_add_bulk - Has the same effect as pool4db_add()ing the @count
+ * @entries, in order, but costs O(n log n) instead of O(n^2).
+ *
+ * Unlike a sequence of pool4db_add()s, it either adds everything or nothing.
+ */
+int pool4db_add_bulk(struct pool4 *pool, struct pool4_entry const *entries,
+		unsigned int count)
+{
+	struct bulk_range *by_mark;
+	struct bulk_range *by_addr;
+	unsigned int range_count;
+	struct bulk_table *builds;
+	unsigned int mark_groups;
+	int mark_built;
+	int addr_built;
+	struct pool4_table *table;
+	unsigned int i;
+	int error;
+
+	if (count == 0)
+		return 0;
+
+	error = expand_entries(entries, count, &by_mark, &range_count);
+	if (error)
+		return error;
+
+	by_addr = __wkvmalloc("pool4 bulk ranges",
+			range_count * sizeof(struct bulk_range));
+	if (!by_addr) {
+		error = -ENOMEM;
+		goto end_mark;
+	}
+	memcpy(by_addr, by_mark, range_count * sizeof(struct bulk_range));
+
+	/* Sorting can take a while; do it before locking. */
+	sort(by_mark, range_count, sizeof(*by_mark), cmp_bulk_mark, NULL);
+	sort(by_addr, range_count, sizeof(*by_addr), cmp_bulk_addr, NULL);
+
+	mark_groups = count_groups(by_mark, range_count, true);
+	builds = __wkvmalloc("pool4 bulk tables", (mark_groups
+			+ count_groups(by_addr, range_count, false))
+			* sizeof(struct bulk_table));
+	if (!builds) {
+		error = -ENOMEM;
+		goto end_addr;
+	}
+
+	jlock_lock_bh(&pool->lock);
+
+	mark_built = build_tables(pool, by_mark, range_count, true, builds);
+	if (mark_built < 0) {
+		error = mark_built;
+		goto unlock;
+	}
+	addr_built = build_tables(pool, by_addr, range_count, false,
+			builds + mark_groups);
+	if (addr_built < 0) {
+		while (mark_built-- > 0)
+			destroy_table(builds[mark_built].new);
+		error = addr_built;
+		goto unlock;
+	}
+
+	trees_changed(pool);
+	swap_tables(builds, mark_built, true);
+	swap_tables(builds + mark_groups, addr_built, false);
+
+	/* As in add_to_mark_tree(), the last explicit value wins. */
+	for (i = 0; i < count; i++) {
+		if (!(entries[i].flags & ITERATIONS_SET))
+			continue;
+		table = find_by_mark(get_tree(&pool->tree_mark,
+				entries[i].proto), entries[i].mark);
+		if (table) {
+			table->max_iterations_flags = entries[i].flags;
+			table->max_iterations_allowed = entries[i].iterations;
+		}
+	}
+
+	error = 0;
+	/* Fall through. */
+
+unlock:
+	jlock_unlock_bh(&pool->lock);
+	if (!error)
+		error = refresh_snapshot(pool);
+	__wkvfree("pool4 bulk tables", builds);
+end_addr:
+	__wkvfree("pool4 bulk ranges", by_addr);
+end_mark:
+	__wkvfree("pool4 bulk ranges", by_mark);
+	return error;
+}
+
 int pool4db_update(struct pool4 *pool, const struct pool4_update *update)
 {
 	struct rb_root *tree;
@@ -591,17 +1291,17 @@ int pool4db_update(struct pool4 *pool, const struct pool4_update *update)
 	if (error)
 		return error;
 
-	spin_lock_bh(&pool->lock);
+	jlock_lock_bh(&pool->lock);
 
 	tree = get_tree(&pool->tree_mark, update->l4_proto);
 	if (!tree) {
-		spin_unlock_bh(&pool->lock);
+		jlock_unlock_bh(&pool->lock);
 		return -EINVAL;
 	}
 
 	table = find_by_mark(tree, update->mark);
 	if (!table) {
-		spin_unlock_bh(&pool->lock);
+		jlock_unlock_bh(&pool->lock);
 		log_err("No entries match mark %u (protocol %s).", update->mark,
 				l4proto_to_string(update->l4_proto));
 		return -ESRCH;
@@ -610,9 +1310,12 @@ int pool4db_update(struct pool4 *pool, const struct pool4_update *update)
 	if (update->flags & ITERATIONS_SET) {
 		table->max_iterations_flags = update->flags;
 		table->max_iterations_allowed = update->iterations;
+		trees_changed(pool);
+		jlock_unlock_bh(&pool->lock);
+		return refresh_snapshot(pool);
 	}
 
-	spin_unlock_bh(&pool->lock);
+	jlock_unlock_bh(&pool->lock);
 	return 0;
 }
 
@@ -754,6 +1457,7 @@ static int rm_from_addr_tree(struct pool4 *pool, l4_protocol proto,
 int pool4db_rm(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 		struct ipv4_range *range)
 {
+	int refresh_error;
 	int error;
 
 	error = prefix4_validate(&range->prefix);
@@ -762,14 +1466,17 @@ int pool4db_rm(struct pool4 *pool, const __u32 mark, l4_protocol proto,
 	if (range->ports.min > range->ports.max)
 		swap(range->ports.min, range->ports.max);
 
-	spin_lock_bh(&pool->lock);
+	jlock_lock_bh(&pool->lock);
 
+	trees_changed(pool);
 	error = rm_from_mark_tree(pool, mark, proto, range);
 	if (!error)
 		error = rm_from_addr_tree(pool, proto, range);
 
-	spin_unlock_bh(&pool->lock);
-	return error;
+	jlock_unlock_bh(&pool->lock);
+	/* (rm_from_mark_tree() might have removed something anyway.) */
+	refresh_error = refresh_snapshot(pool);
+	return error ? error : refresh_error;
 }
 
 int pool4db_rm_usr(struct pool4 *pool, struct pool4_entry *entry)
@@ -779,16 +1486,20 @@ int pool4db_rm_usr(struct pool4 *pool, struct pool4_entry *entry)
 
 void pool4db_flush(struct pool4 *pool)
 {
-	spin_lock_bh(&pool->lock);
+	jlock_lock_bh(&pool->lock);
+	trees_changed(pool);
 	clear_trees(pool);
-	spin_unlock_bh(&pool->lock);
+	jlock_unlock_bh(&pool->lock);
+	/* If this fails, the packet path uses the (empty) trees. */
+	refresh_snapshot(pool);
 }
 
-static struct ipv4_range *find_port_range(struct pool4_table *entry, __u16 port)
+/* Binary search. @first is an array of @count ranges, sorted by port. */
+static struct ipv4_range *find_port_range(struct ipv4_range *first,
+		unsigned int count, __u16 port)
 {
-	struct ipv4_range *first = first_table_entry(entry);
 	struct ipv4_range *middle;
-	struct ipv4_range *last = first + entry->sample_count - 1;
+	struct ipv4_range *last = first + count - 1;
 
 	do {
 		middle = first + ((last - first) / 2);
@@ -806,32 +1517,6 @@ static struct ipv4_range *find_port_range(struct pool4_table *entry, __u16 port)
 	return NULL;
 }
 
-/**
- * BTW: The reason why this doesn't care about mark is because it's an
- * inherently 4-to-6 function (it doesn't make sense otherwise).
- * Mark is only used in the 6-to-4 direction.
- */
-bool pool4db_contains(struct pool4 *pool, struct net *ns, l4_protocol proto,
-		struct ipv4_transport_addr const *addr)
-{
-	struct pool4_table *table;
-	bool found = false;
-
-	spin_lock_bh(&pool->lock);
-
-	if (is_empty(pool)) {
-		spin_unlock_bh(&pool->lock);
-		return pool4empty_contains(ns, addr);
-	}
-
-	table = find_by_addr(get_tree(&pool->tree_addr, proto), &addr->l3);
-	if (table)
-		found = find_port_range(table, addr->l4) != NULL;
-
-	spin_unlock_bh(&pool->lock);
-	return found;
-}
-
 static int find_offset(struct pool4_table *table, struct ipv4_range *offset,
 		struct ipv4_range **result)
 {
@@ -847,15 +1532,10 @@ static int find_offset(struct pool4_table *table, struct ipv4_range *offset,
 	return -ESRCH;
 }
 
-static unsigned int compute_max_iterations(const struct pool4_table *table)
+static unsigned int auto_max_iterations(unsigned int taddr_count)
 {
 	unsigned int result;
 
-	if (table->max_iterations_flags & ITERATIONS_INFINITE)
-		return 0;
-	if (!(table->max_iterations_flags & ITERATIONS_AUTO))
-		return table->max_iterations_allowed;
-
 	/*
 	 * The following heuristics are based on a few tests I ran. Keep in mind
 	 * that none of them are imposed on the user; they only define the
@@ -883,7 +1563,7 @@ static unsigned int compute_max_iterations(const struct pool4_table *table)
 	 * Integer division by 100 would be acceptable, but this is faster.
 	 * (Recall that we have a spinlock held.)
 	 */
-	result = table->taddr_count >> 7;
+	result = taddr_count >> 7;
 
 	/*
 	 * If the limit is too big, the NAT64 will iterate too much.
@@ -919,6 +1599,21 @@ static unsigned int compute_max_iterations(const struct pool4_table *table)
 	return result;
 }
 
+static bool has_auto_iterations(const struct pool4_table *table)
+{
+	return !(table->max_iterations_flags & ITERATIONS_INFINITE)
+			&& (table->max_iterations_flags & ITERATIONS_AUTO);
+}
+
+static unsigned int compute_max_iterations(const struct pool4_table *table)
+{
+	if (table->max_iterations_flags & ITERATIONS_INFINITE)
+		return 0;
+	if (!(table->max_iterations_flags & ITERATIONS_AUTO))
+		return table->max_iterations_allowed;
+	return auto_max_iterations(table->taddr_count);
+}
+
 static void __update_sample(struct pool4_entry *sample,
 		const struct pool4_table *table)
 {
@@ -947,7 +1642,7 @@ int pool4db_foreach_sample(struct pool4 *pool, l4_protocol proto,
 	struct pool4_entry sample = { .proto = proto };
 	int error = 0;
 
-	spin_lock_bh(&pool->lock);
+	jlock_lock_bh(&pool->lock);
 
 	tree = get_tree(&pool->tree_mark, proto);
 	if (!tree) {
@@ -983,15 +1678,108 @@ offset_start:; /* <- The semicolon prevents a compiler error. */
 	}
 
 end:
-	spin_unlock_bh(&pool->lock);
+	jlock_unlock_bh(&pool->lock);
 	return error;
 
 eagain:
-	spin_unlock_bh(&pool->lock);
+	jlock_unlock_bh(&pool->lock);
 	log_err("Oops. Pool4 changed while I was iterating so I lost track of where I was. Try again.");
 	return -EAGAIN;
 }
 
+struct clone_buffer {
+	struct pool4_entry *entries;
+	unsigned int capacity;
+	unsigned int count;
+};
+
+static int clone_cb(struct pool4_entry const *sample, void *arg)
+{
+	struct clone_buffer *buffer = arg;
+
+	if (buffer->count == buffer->capacity)
+		return -EAGAIN; /* Somebody is fiddling with @pool. */
+
+	buffer->entries[buffer->count] = *sample;
+	buffer->entries[buffer->count].flags |= ITERATIONS_SET;
+	buffer->count++;
+	return 0;
+}
+
+static unsigned int count_samples(struct pool4 *pool, l4_protocol proto)
+{
+	struct pool4_table *table;
+	struct rb_node *node;
+	unsigned int count = 0;
+
+	jlock_lock_bh(&pool->lock);
+	for (node = rb_first(get_tree(&pool->tree_mark, proto)); node;
+			node = rb_next(node)) {
+		table = rb_entry(node, struct pool4_table, tree_hook);
+		count += table->sample_count;
+	}
+	jlock_unlock_bh(&pool->lock);
+
+	return count;
+}
+
+/* Copies @pool's @proto samples to @clone, in one pool4db_add_bulk(). */
+static int clone_proto(struct pool4 *pool, struct pool4 *clone,
+		l4_protocol proto)
+{
+	struct clone_buffer buffer;
+	int error;
+
+	buffer.capacity = count_samples(pool, proto);
+	if (buffer.capacity == 0)
+		return 0;
+	buffer.entries = __wkvmalloc("pool4 clone buffer",
+			buffer.capacity * sizeof(struct pool4_entry));
+	if (!buffer.entries)
+		return -ENOMEM;
+	buffer.count = 0;
+
+	error = pool4db_foreach_sample(pool, proto, clone_cb, &buffer, NULL);
+	if (!error)
+		error = pool4db_add_bulk(clone, buffer.entries, buffer.count);
+
+	__wkvfree("pool4 clone buffer", buffer.entries);
+	return error;
+}
+
+/**
+ * Creates a copy of @pool, which nothing else references.
+ *
+ * @pool is only locked while it's being read, so the caller has to prevent
+ * concurrent updates. (Otherwise, this might fail with -EAGAIN.)
+ */
+int pool4db_clone(struct pool4 *pool, struct pool4 **result)
+{
+	struct pool4 *clone;
+	int error;
+
+	clone = pool4db_alloc();
+	if (!clone)
+		return -ENOMEM;
+
+	error = clone_proto(pool, clone, L4PROTO_TCP);
+	if (error)
+		goto fail;
+	error = clone_proto(pool, clone, L4PROTO_UDP);
+	if (error)
+		goto fail;
+	error = clone_proto(pool, clone, L4PROTO_ICMP);
+	if (error)
+		goto fail;
+
+	*result = clone;
+	return 0;
+
+fail:
+	pool4db_put(clone);
+	return error;
+}
+
 static void print_tree(struct rb_root *tree, bool mark)
 {
 	struct rb_node *node = rb_first(tree);
@@ -1021,6 +1809,46 @@ static void print_tree(struct rb_root *tree, bool mark)
 	}
 }
 
+static void tree_memory(struct rb_root *tree, __u64 *tables, __u64 *bytes)
+{
+	struct rb_node *node;
+
+	for (node = rb_first(tree); node; node = rb_next(node)) {
+		(*tables)++;
+		*bytes += ksize(rb_entry(node, struct pool4_table, tree_hook));
+	}
+}
+
+/**
+ * pool4db_memory - Returns the number of tables in @pool (in both of its
+ * indexes), and the bytes they and the packet path's snapshot take.
+ */
+void pool4db_memory(struct pool4 *pool, __u64 *tables, __u64 *bytes)
+{
+	struct pool4_snapshot *snapshot;
+
+	*tables = 0;
+	*bytes = 0;
+
+	jlock_lock_bh(&pool->lock);
+	tree_memory(&pool->tree_mark.tcp, tables, bytes);
+	tree_memory(&pool->tree_mark.udp, tables, bytes);
+	tree_memory(&pool->tree_mark.icmp, tables, bytes);
+	tree_memory(&pool->tree_addr.tcp, tables, bytes);
+	tree_memory(&pool->tree_addr.udp, tables, bytes);
+	tree_memory(&pool->tree_addr.icmp, tables, bytes);
+	snapshot = rcu_dereference_protected(pool->snapshot,
+			lockdep_is_held(&pool->lock.spin));
+	*bytes += snapshot->size;
+	jlock_unlock_bh(&pool->lock);
+}
+
+void pool4db_lock_stats(struct pool4 *pool, struct jlock_stats *result)
+{
+	memset(result, 0, sizeof(*result));
+	jlock_query(&pool->lock, result);
+}
+
 void pool4db_print(struct pool4 *pool)
 {
 	log_info("-------- Mark trees --------");
@@ -1040,23 +1868,607 @@ void pool4db_print(struct pool4 *pool)
 	print_tree(&pool->tree_addr.icmp, false);
 }
 
-static verdict find_empty(struct xlation *state, unsigned int offset,
-		struct mask_domain **out)
+static void build_views(struct pool4_views *views, struct rb_root *tree,
+		struct pool4_view **view, struct ipv4_range **range)
 {
-	struct mask_domain *masks;
+	struct pool4_table *table;
+	struct rb_node *node;
+
+	views->array = *view;
+	views->count = 0;
+	views->buckets = NULL;
+	views->bucket_bits = 0;
+
+	for (node = rb_first(tree); node; node = rb_next(node)) {
+		table = rb_entry(node, struct pool4_table, tree_hook);
+
+		(*view)->mark = table->mark; /* (Or addr; they're unions.) */
+		(*view)->taddr_count = table->taddr_count;
+		(*view)->max_iterations = compute_max_iterations(table);
+		(*view)->auto_iterations = has_auto_iterations(table);
+		(*view)->range_count = table->sample_count;
+		(*view)->ranges = *range;
+		memcpy(*range, first_table_entry(table),
+				table->sample_count * sizeof(struct ipv4_range));
+
+		*range += table->sample_count;
+		(*view)++;
+		views->count++;
+	}
+}
+
+static unsigned int addr_buckets(unsigned int views)
+{
+	return views ? roundup_pow_of_two(2 * views) : 0;
+}
+
+static void hash_views(struct pool4_views *views,
+		struct pool4_view ***buckets)
+{
+	struct pool4_view *view;
+	unsigned int size;
+	unsigned int mask;
+	unsigned int i;
+
+	size = addr_buckets(views->count);
+	views->buckets = *buckets;
+	views->bucket_bits = size ? ilog2(size) : 0;
+	memset(views->buckets, 0, size * sizeof(*views->buckets));
+
+	mask = size - 1;
+	for (view = views->array; view < views->array + views->count; view++) {
+		i = hash_32(view->addr.s_addr, views->bucket_bits);
+		while (views->buckets[i])
+			i = (i + 1) & mask;
+		views->buckets[i] = view;
+	}
+
+	*buckets += size;
+}
+
+static void filter_views(struct pool4_snapshot *snapshot,
+		struct pool4_views *views)
+{
+	struct pool4_view *view;
+
+	for (view = views->array; view < views->array + views->count; view++)
+		__set_bit(hash_32(view->addr.s_addr, POOL4_FILTER_ORDER),
+				snapshot->filter);
+}
+
+static void count_views(struct rb_root *tree, unsigned int *views,
+		unsigned int *ranges)
+{
+	struct pool4_table *table;
+	struct rb_node *node;
+
+	for (node = rb_first(tree); node; node = rb_next(node)) {
+		table = rb_entry(node, struct pool4_table, tree_hook);
+		(*views)++;
+		*ranges += table->sample_count;
+	}
+}
+
+/* Lengths of a snapshot's arrays. */
+struct snapshot_counts {
+	unsigned int views;
+	unsigned int buckets;
+	unsigned int ranges;
+};
+
+/*
+ * Returns the number of bytes a snapshot of the trees needs.
+ * Assumes pool->lock is held.
+ */
+static size_t snapshot_size(struct pool4 *pool, struct snapshot_counts *counts)
+{
+	unsigned int addr_count;
+	l4_protocol proto;
+
+	memset(counts, 0, sizeof(*counts));
+	for (proto = L4PROTO_TCP; proto < L4PROTO_OTHER; proto++) {
+		count_views(get_tree(&pool->tree_mark, proto), &counts->views,
+				&counts->ranges);
+		addr_count = 0;
+		count_views(get_tree(&pool->tree_addr, proto), &addr_count,
+				&counts->ranges);
+		counts->views += addr_count;
+		counts->buckets += addr_buckets(addr_count);
+	}
+
+	return sizeof(struct pool4_snapshot)
+			+ counts->views * sizeof(struct pool4_view)
+			+ counts->buckets * sizeof(struct pool4_view *)
+			+ counts->ranges * sizeof(struct ipv4_range);
+}
+
+/*
+ * Copies the trees into @snapshot, which has to have room for them.
+ * (See snapshot_size().) Assumes pool->lock is held.
+ */
+static void build_snapshot(struct pool4 *pool, struct pool4_snapshot *snapshot)
+{
+	struct snapshot_counts counts;
+	struct pool4_view *view;
+	struct pool4_view **buckets;
 	struct ipv4_range *range;
-	verdict result;
+	l4_protocol proto;
+
+	snapshot->size = snapshot_size(pool, &counts);
+	view = (struct pool4_view *)(snapshot + 1);
+	buckets = (struct pool4_view **)(view + counts.views);
+	range = (struct ipv4_range *)(buckets + counts.buckets);
+	bitmap_zero(snapshot->filter, 1 << POOL4_FILTER_ORDER);
+	for (proto = L4PROTO_TCP; proto < L4PROTO_OTHER; proto++) {
+		build_views(&snapshot->mark[proto],
+				get_tree(&pool->tree_mark, proto),
+				&view, &range);
+		build_views(&snapshot->addr[proto],
+				get_tree(&pool->tree_addr, proto),
+				&view, &range);
+		hash_views(&snapshot->addr[proto], &buckets);
+		filter_views(snapshot, &snapshot->addr[proto]);
+	}
+}
+
+/**
+ * Replaces @pool's snapshot with a copy of the current trees.
+ *
+ * Process context only. Call after every trees_changed(), once pool->lock has
+ * been released. (The allocation happens outside of it.)
+ */
+static int refresh_snapshot(struct pool4 *pool)
+{
+	struct pool4_snapshot *old;
+	struct pool4_snapshot *new;
+	struct snapshot_counts counts;
+	unsigned int version;
+	size_t size;
+
+again:
+	jlock_lock_bh(&pool->lock);
+	version = pool->version;
+	size = snapshot_size(pool, &counts);
+	jlock_unlock_bh(&pool->lock);
+
+	new = __wkkvmalloc("pool4 snapshot", size);
+
+	jlock_lock_bh(&pool->lock);
+	if (!new) {
+		WRITE_ONCE(pool->stale, true);
+		jlock_unlock_bh(&pool->lock);
+		log_err("Could not allocate pool4's packet path snapshot. Lookups will lock the pool until the next successful pool4 change.");
+		return -ENOMEM;
+	}
+	if (pool->version != version) {
+		/* Somebody else changed the trees in the meantime. */
+		jlock_unlock_bh(&pool->lock);
+		snapshot_free(new);
+		goto again;
+	}
+
+	/* Same version, same trees, so @new is big enough. */
+	build_snapshot(pool, new);
+	old = rcu_dereference_protected(pool->snapshot,
+			lockdep_is_held(&pool->lock.spin));
+	rcu_assign_pointer(pool->snapshot, new);
+	WRITE_ONCE(pool->stale, false);
+	jlock_unlock_bh(&pool->lock);
+
+	if (old)
+		call_rcu(&old->rcu, snapshot_rcu_cb);
+	return 0;
+}
+
+/**
+ * Returns @pool's current snapshot. Never NULL, but might be stale (see
+ * is_stale()).
+ *
+ * Assumes the RCU read lock is held.
+ */
+static struct pool4_snapshot *get_snapshot(struct pool4 *pool)
+{
+	return rcu_dereference(pool->snapshot);
+}
+
+/* Should the exact lookups bypass the snapshot? */
+static bool is_stale(struct pool4 *pool)
+{
+	return unlikely(READ_ONCE(pool->stale));
+}
+
+static bool snapshot_is_empty(struct pool4_snapshot *snapshot)
+{
+	return !snapshot->mark[L4PROTO_TCP].count
+			&& !snapshot->mark[L4PROTO_UDP].count
+			&& !snapshot->mark[L4PROTO_ICMP].count;
+}
+
+/*
+ * Binary search. The views are sorted the same way the tree is, so the
+ * comparison is cmp_mark()'s.
+ */
+static struct pool4_view *find_mark_view(struct pool4_snapshot *snapshot,
+		l4_protocol proto, __u32 mark)
+{
+	struct pool4_view *views;
+	unsigned int left;
+	unsigned int right;
+	unsigned int mid;
+	int comparison;
+
+	views = snapshot->mark[proto].array;
+	left = 0;
+	right = snapshot->mark[proto].count;
+
+	while (left < right) {
+		mid = left + (right - left) / 2;
+		comparison = ((int)mark) - (int)views[mid].mark;
+		if (comparison < 0)
+			left = mid + 1;
+		else if (comparison > 0)
+			right = mid;
+		else
+			return &views[mid];
+	}
+
+	return NULL;
+}
+
+static struct pool4_view *find_addr_view(struct pool4_snapshot *snapshot,
+		l4_protocol proto, struct in_addr const *addr)
+{
+	struct pool4_views *views;
+	struct pool4_view *view;
+	unsigned int mask;
+	unsigned int i;
+
+	views = &snapshot->addr[proto];
+	if (!views->count)
+		return NULL;
+
+	mask = (1u << views->bucket_bits) - 1;
+	i = hash_32(addr->s_addr, views->bucket_bits);
+	/* Terminates because there's always at least one empty bucket. */
+	while ((view = views->buckets[i]) != NULL) {
+		if (view->addr.s_addr == addr->s_addr)
+			return view;
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/* pool4db_contains() fallback, for when the snapshot is stale. */
+static bool contains_locked(struct pool4 *pool, struct net *ns,
+		l4_protocol proto, struct ipv4_transport_addr const *addr)
+{
+	struct pool4_table *table;
+	bool found = false;
+
+	jlock_lock_bh(&pool->lock);
+
+	if (is_empty(pool)) {
+		jlock_unlock_bh(&pool->lock);
+		return pool4empty_contains(ns, addr);
+	}
+
+	table = find_by_addr(get_tree(&pool->tree_addr, proto), &addr->l3);
+	if (table)
+		found = find_port_range(first_table_entry(table),
+				table->sample_count, addr->l4) != NULL;
+
+	jlock_unlock_bh(&pool->lock);
+	return found;
+}
+
+/**
+ * BTW: The reason why this doesn't care about mark is because it's an
+ * inherently 4-to-6 function (it doesn't make sense otherwise).
+ * Mark is only used in the 6-to-4 direction.
+ */
+bool pool4db_contains(struct pool4 *pool, struct net *ns, l4_protocol proto,
+		struct ipv4_transport_addr const *addr)
+{
+	struct pool4_snapshot *snapshot;
+	struct pool4_view *view;
+	bool found;
+
+	if (WARN(proto >= L4PROTO_OTHER, "Unsupported transport protocol: %u.",
+			proto))
+		return false;
+
+	if (is_stale(pool))
+		return contains_locked(pool, ns, proto, addr);
+
+	rcu_read_lock();
+	local_bh_disable();
+
+	snapshot = get_snapshot(pool);
+
+	if (snapshot_is_empty(snapshot)) {
+		local_bh_enable();
+		rcu_read_unlock();
+		return pool4empty_contains(ns, addr);
+	}
+
+	view = find_addr_view(snapshot, proto, &addr->l3);
+	found = view && find_port_range(view->ranges, view->range_count,
+			addr->l4);
+
+	local_bh_enable();
+	rcu_read_unlock();
+	return found;
+}
+
+/*
+ * @range is one of the @count sorted ranges that start at @first. Returns the
+ * last port of the run of contiguous ranges @range belongs to.
+ */
+static __u16 run_end(struct ipv4_range *first, unsigned int count,
+		struct ipv4_range *range)
+{
+	struct ipv4_range *last = first + count - 1;
+	__u16 end = range->ports.max;
+
+	for (; range < last && end != 65535; range++) {
+		if (range[1].ports.min > end + 1)
+			break;
+		end = max(end, range[1].ports.max);
+	}
+
+	return end;
+}
+
+/* pool4db_covers() fallback, for when the snapshot is stale. */
+static bool covers_locked(struct pool4 *pool, struct net *ns,
+		l4_protocol proto, struct ipv4_transport_addr const *addr,
+		__u16 *last)
+{
+	struct pool4_table *table;
+	struct ipv4_range *range = NULL;
+
+	jlock_lock_bh(&pool->lock);
+
+	if (is_empty(pool)) {
+		jlock_unlock_bh(&pool->lock);
+		*last = 65535;
+		return pool4empty_contains(ns, addr);
+	}
+
+	table = find_by_addr(get_tree(&pool->tree_addr, proto), &addr->l3);
+	if (table) {
+		range = find_port_range(first_table_entry(table),
+				table->sample_count, addr->l4);
+		if (range)
+			*last = run_end(first_table_entry(table),
+					table->sample_count, range);
+	}
+
+	jlock_unlock_bh(&pool->lock);
+	return range != NULL;
+}
+
+/**
+ * pool4db_covers - pool4db_contains(), except it also writes to @last the last
+ * port of @addr's address after @addr.l4 that @pool also contains, provided
+ * all the ports in between are in @pool too.
+ *
+ * For walks that want to skip the transport addresses they already know are
+ * in pool4.
+ */
+bool pool4db_covers(struct pool4 *pool, struct net *ns, l4_protocol proto,
+		struct ipv4_transport_addr const *addr, __u16 *last)
+{
+	struct pool4_snapshot *snapshot;
+	struct pool4_view *view;
+	struct ipv4_range *range;
+
+	if (WARN(proto >= L4PROTO_OTHER, "Unsupported transport protocol: %u.",
+			proto))
+		return false;
+
+	if (is_stale(pool))
+		return covers_locked(pool, ns, proto, addr, last);
+
+	rcu_read_lock();
+	local_bh_disable();
+
+	snapshot = get_snapshot(pool);
 
-	masks = __wkmalloc("mask_domain",
-			sizeof(struct mask_domain) * sizeof(struct ipv4_range),
+	if (snapshot_is_empty(snapshot)) {
+		local_bh_enable();
+		rcu_read_unlock();
+		/* The interface addresses always get the same ports. */
+		*last = 65535;
+		return pool4empty_contains(ns, addr);
+	}
+
+	view = find_addr_view(snapshot, proto, &addr->l3);
+	range = view ? find_port_range(view->ranges, view->range_count,
+			addr->l4) : NULL;
+	if (range)
+		*last = run_end(view->ranges, view->range_count, range);
+
+	local_bh_enable();
+	rcu_read_unlock();
+	return range != NULL;
+}
+
+/**
+ * pool4db_is_empty - Is @pool empty? (ie. is the packet path borrowing the
+ * interface addresses?)
+ */
+bool pool4db_is_empty(struct pool4 *pool)
+{
+	struct pool4_snapshot *snapshot;
+	bool result;
+
+	if (is_stale(pool)) {
+		jlock_lock_bh(&pool->lock);
+		result = is_empty(pool);
+		jlock_unlock_bh(&pool->lock);
+		return result;
+	}
+
+	rcu_read_lock();
+	local_bh_disable();
+
+	snapshot = get_snapshot(pool);
+	result = snapshot_is_empty(snapshot);
+
+	local_bh_enable();
+	rcu_read_unlock();
+	return result;
+}
+
+/**
+ * pool4db_taddr_count - Returns the number of transport addresses @pool offers
+ * to @proto, all marks included. Zero if @pool is empty.
+ */
+unsigned int pool4db_taddr_count(struct pool4 *pool, l4_protocol proto)
+{
+	struct pool4_snapshot *snapshot;
+	struct pool4_views *views;
+	struct pool4_table *table;
+	struct rb_node *node;
+	unsigned int result = 0;
+	unsigned int i;
+
+	if (is_stale(pool)) {
+		jlock_lock_bh(&pool->lock);
+		for (node = rb_first(get_tree(&pool->tree_addr, proto)); node;
+				node = rb_next(node)) {
+			table = rb_entry(node, struct pool4_table, tree_hook);
+			result += table->taddr_count;
+		}
+		jlock_unlock_bh(&pool->lock);
+		return result;
+	}
+
+	rcu_read_lock();
+	local_bh_disable();
+
+	snapshot = get_snapshot(pool);
+	views = &snapshot->addr[proto];
+	for (i = 0; i < views->count; i++)
+		result += views->array[i].taddr_count;
+
+	local_bh_enable();
+	rcu_read_unlock();
+	return result;
+}
+
+/* pool4db_may_contain() fallback, for when the snapshot is stale. */
+static bool may_contain_locked(struct pool4 *pool, __be32 addr)
+{
+	struct in_addr in = { .s_addr = addr };
+	l4_protocol proto;
+	bool result;
+
+	jlock_lock_bh(&pool->lock);
+	result = is_empty(pool);
+	for (proto = L4PROTO_TCP; !result && proto < L4PROTO_OTHER; proto++)
+		result = !!find_by_addr(get_tree(&pool->tree_addr, proto), &in);
+	jlock_unlock_bh(&pool->lock);
+
+	return result;
+}
+
+/**
+ * pool4db_may_contain - Cheap, inexact version of pool4db_contains(), which
+ * ignores ports and protocols. Returns false only if @addr is definitely not
+ * in @pool.
+ *
+ * (If @pool is empty, the interface addresses are not checked; the function
+ * just returns true.)
+ */
+bool pool4db_may_contain(struct pool4 *pool, __be32 addr)
+{
+	struct pool4_snapshot *snapshot;
+	bool result;
+
+	if (is_stale(pool))
+		return may_contain_locked(pool, addr);
+
+	rcu_read_lock();
+	local_bh_disable();
+
+	snapshot = get_snapshot(pool);
+	result = snapshot_is_empty(snapshot)
+			|| test_bit(hash_32(addr, POOL4_FILTER_ORDER),
+					snapshot->filter);
+
+	local_bh_enable();
+	rcu_read_unlock();
+	return result;
+}
+
+/**
+ * mask_domain_mark - Returns the mark @state's pool4 lookups should use.
+ *
+ * This is the packet's mark, unless the packet is headed to a pool6-tenant
+ * that overrides it.
+ */
+__u32 mask_domain_mark(struct xlation *state)
+{
+	struct pool6_tenant const *tenant;
+
+	if (state->pool6_index) {
+		tenant = &state->jool->globals.nat64.pool6_tenants.values[
+				state->pool6_index - 1];
+		if (tenant->mark_set)
+			return tenant->mark;
+	}
+
+	return state->in.skb->mark;
+}
+
+/**
+ * Starts a domain's lifetime (which ends in mask_domain_put()), and returns the
+ * domain. Returns NULL on memory allocation failure.
+ *
+ * Enters an RCU read-side critical section and disables BHs; mask_domain_put()
+ * reverts both.
+ */
+static struct mask_domain *get_domain(void)
+{
+	struct mask_domain *masks;
+
+	rcu_read_lock();
+	local_bh_disable();
+
+	masks = this_cpu_ptr(&cpu_domains);
+	if (likely(!masks->busy)) {
+		masks->busy = true;
+		masks->percpu = true;
+		masks->ranges_allocated = false;
+		return masks;
+	}
+
+	masks = __wkmalloc("mask_domain", sizeof(struct mask_domain),
 			GFP_ATOMIC);
-	if (!masks)
-		return drop(state, JSTAT_ENOMEM);
+	if (!masks) {
+		local_bh_enable();
+		rcu_read_unlock();
+		return NULL;
+	}
+
+	masks->percpu = false;
+	masks->ranges_allocated = false;
+	return masks;
+}
+
+static verdict find_empty(struct xlation *state, struct mask_domain *masks,
+		unsigned int offset, struct mask_domain **out)
+{
+	struct ipv4_range *range;
+	verdict result;
 
-	range = (struct ipv4_range *)(masks + 1);
+	range = &masks->scratch[0];
 	result = pool4empty_find(state, range);
 	if (result != VERDICT_CONTINUE) {
-		__wkfree("mask_domain", masks);
+		mask_domain_put(masks);
 		return result;
 	}
 
@@ -1064,7 +2476,11 @@ static verdict find_empty(struct xlation *state, unsigned int offset,
 	masks->taddr_count = port_range_count(&range->ports);
 	masks->taddr_counter = 0;
 	masks->max_iterations = 0;
+	masks->auto_iterations = false;
+	masks->crowded = false;
+	masks->skipped = 0;
 	masks->range_count = 1;
+	masks->ranges = range;
 	masks->current_range = range;
 	masks->current_port = range->ports.min + offset % masks->taddr_count;
 	masks->dynamic = true;
@@ -1073,49 +2489,19 @@ static verdict find_empty(struct xlation *state, unsigned int offset,
 	return VERDICT_CONTINUE;
 }
 
-verdict mask_domain_find(struct xlation *state, struct mask_domain **out)
+/**
+ * Points @masks's iteration to @offset, and hands it over as @out.
+ * Assumes @masks has been otherwise initialized.
+ */
+static verdict start_iteration(struct xlation *state, struct mask_domain *masks,
+		unsigned int offset, struct mask_domain **out)
 {
-	struct pool4 *pool;
-	struct pool4_table *table;
 	struct ipv4_range *entry;
-	struct mask_domain *masks;
-	unsigned int offset;
-
-	if (rfc6056_f(state, &offset))
-		return drop(state, JSTAT_6056_F);
-
-	offset += atomic_read(&next_ephemeral);
-
-	pool = state->jool.nat64.pool4;
-	spin_lock_bh(&pool->lock);
 
-	if (is_empty(pool)) {
-		spin_unlock_bh(&pool->lock);
-		return find_empty(state, offset, out);
-	}
-
-	table = find_by_mark(get_tree(&pool->tree_mark,
-			state->in.tuple.l4_proto),
-			state->in.skb->mark);
-	if (!table)
-		goto fail;
-
-	masks = __wkmalloc("mask_domain", sizeof(struct mask_domain)
-			+ table->sample_count * sizeof(struct ipv4_range),
-			GFP_ATOMIC);
-	if (!masks)
-		goto fail;
-
-	memcpy(masks + 1, table + 1,
-			table->sample_count * sizeof(struct ipv4_range));
-	masks->taddr_count = table->taddr_count;
-	masks->max_iterations = compute_max_iterations(table);
-	masks->range_count = table->sample_count;
-
-	spin_unlock_bh(&pool->lock);
-
-	masks->pool_mark = state->in.skb->mark;
+	masks->pool_mark = mask_domain_mark(state);
 	masks->taddr_counter = 0;
+	masks->crowded = false;
+	masks->skipped = 0;
 	masks->dynamic = false;
 	offset %= masks->taddr_count;
 
@@ -1130,17 +2516,276 @@ verdict mask_domain_find(struct xlation *state, struct mask_domain **out)
 	}
 
 	WARN(true, "Bug: pool4 entry counter does not match entry count.");
-	__wkfree("mask_domain", masks);
+	mask_domain_put(masks);
 	return drop(state, JSTAT_UNKNOWN);
+}
 
-fail:
-	spin_unlock_bh(&pool->lock);
-	return drop(state, JSTAT_MASK_DOMAIN_NOT_FOUND);
+/*
+ * Deterministic mode. (deterministic-prefix)
+ *
+ * Each deterministic-subscriber-length prefix of deterministic-prefix is a
+ * "subscriber," and subscriber n is the one whose bits (between the two
+ * lengths) spell n. The mark's pool4 table, taken as one long sequence of
+ * transport addresses (in table order), is cut into as many equal slices as
+ * there can be subscribers, and subscriber n gets slice n. (Leftovers are not
+ * used.) See RFC 7422.
+ *
+ * This means the mask of any BIB entry can be computed from its IPv6 address
+ * alone, so there's no need to log them. The domain is only the slice, and
+ * iteration starts at its beginning; rfc6056_f() is not involved.
+ *
+ * Subscriber bits beyond 32 are ignored.
+ */
+
+static unsigned int subscriber_bits(struct xlator *jool)
+{
+	unsigned int plen;
+	unsigned int slen;
+
+	plen = jool->globals.nat64.deterministic_prefix.prefix.len;
+	slen = jool->globals.nat64.deterministic_len;
+	if (slen <= plen)
+		return 0;
+	return min(slen - plen, 32u);
+}
+
+/*
+ * Returns true if @state's source address belongs to deterministic-prefix.
+ * If so, also returns its subscriber index and the number of bits indexes
+ * have.
+ */
+static bool get_subscriber(struct xlation *state, __u32 *index,
+		unsigned int *bits)
+{
+	struct config_prefix6 *prefix;
+	struct in6_addr *src6;
+	unsigned int i;
+
+	prefix = &state->jool->globals.nat64.deterministic_prefix;
+	src6 = &state->in.tuple.src.addr6.l3;
+	if (!prefix->set || !prefix6_contains(&prefix->prefix, src6))
+		return false;
+
+	*bits = subscriber_bits(state->jool);
+	*index = 0;
+	for (i = prefix->prefix.len; i < prefix->prefix.len + *bits; i++)
+		*index = (*index << 1) | !!addr6_get_bit(src6, i);
+
+	return true;
+}
+
+/* Returns the number of @view's ranges that intersect [@start, @end). */
+static unsigned int count_slice_ranges(struct pool4_view *view,
+		unsigned int start, unsigned int end)
+{
+	unsigned int r;
+	unsigned int offset;
+	unsigned int count;
+	unsigned int result;
+
+	offset = 0;
+	result = 0;
+	for (r = 0; r < view->range_count && offset < end; r++) {
+		count = port_range_count(&view->ranges[r].ports);
+		if (offset + count > start)
+			result++;
+		offset += count;
+	}
+
+	return result;
+}
+
+static verdict find_deterministic(struct xlation *state,
+		struct pool4_view *view, __u32 index, unsigned int bits,
+		struct mask_domain *masks, struct mask_domain **out)
+{
+	struct ipv4_range *entry;
+	struct ipv4_range *range;
+	unsigned int slice;
+	unsigned int start;
+	unsigned int end;
+	unsigned int offset;
+	unsigned int count;
+	unsigned int r;
+
+	slice = (bits < 32) ? (view->taddr_count >> bits) : 0;
+	if (!slice) {
+		mask_domain_put(masks);
+		log_warn_once("pool4 mark %u doesn't have enough ports for every deterministic-prefix subscriber.",
+				mask_domain_mark(state));
+		return drop(state, JSTAT_DETERMINISTIC_NO_PORTS);
+	}
+	start = index * slice;
+	end = start + slice;
+
+	/* The slice is usually small enough for the scratch ranges. */
+	count = count_slice_ranges(view, start, end);
+	if (count > ARRAY_SIZE(masks->scratch)) {
+		masks->ranges = __wkmalloc("mask_domain ranges",
+				count * sizeof(struct ipv4_range), GFP_ATOMIC);
+		if (!masks->ranges) {
+			mask_domain_put(masks);
+			return drop(state, JSTAT_ENOMEM);
+		}
+		masks->ranges_allocated = true;
+	} else {
+		masks->ranges = masks->scratch;
+	}
+
+	/* Clip the ranges that intersect [start, end). */
+	range = masks->ranges;
+	offset = 0;
+	for (r = 0; r < view->range_count; r++) {
+		entry = &view->ranges[r];
+		count = port_range_count(&entry->ports);
+		if (offset + count > start) {
+			range->prefix = entry->prefix;
+			range->ports.min = entry->ports.min
+					+ max(start, offset) - offset;
+			range->ports.max = entry->ports.min
+					+ min(end, offset + count) - offset - 1;
+			range++;
+		}
+		offset += count;
+		if (offset >= end)
+			break;
+	}
+
+	masks->taddr_count = slice;
+	masks->max_iterations = 0;
+	masks->auto_iterations = false;
+	masks->range_count = range - masks->ranges;
+	return start_iteration(state, masks, 0, out);
+}
+
+#ifdef POOL4_LEASES
+
+/*
+ * Returns the RFC 6056 offset @state's iteration should start from, one lease
+ * at a time.
+ *
+ * Assumes BHs are disabled.
+ */
+static int get_offset(struct xlation *state, unsigned int *offset)
+{
+	struct pool4 *pool;
+	struct pool4_lease *lease;
+	unsigned int *next_ephemeral;
+	unsigned int generation;
+	__u32 mark;
+
+	pool = state->jool->nat64.pool4;
+	mark = mask_domain_mark(state);
+	lease = &this_cpu_ptr(pool->leases)->protos[state->in.tuple.l4_proto];
+	generation = atomic_read(&pool->generation);
+
+	if (lease->generation != generation || lease->mark != mark
+			|| lease->used >= LEASE_SIZE
+			|| time_after(jiffies, lease->last_used + LEASE_IDLE)) {
+		if (rfc6056_f(state, offset))
+			return -EINVAL;
+		lease->generation = generation;
+		lease->mark = mark;
+		next_ephemeral = this_cpu_ptr(pool->next_ephemeral);
+		lease->offset = *offset + *next_ephemeral;
+		*next_ephemeral += LEASE_SIZE;
+		lease->used = 0;
+	}
+
+	*offset = lease->offset + lease->used++;
+	lease->last_used = jiffies;
+	return 0;
+}
+
+#else
+
+/*
+ * Returns the RFC 6056 offset @state's iteration should start from.
+ *
+ * Assumes BHs are disabled.
+ */
+static int get_offset(struct xlation *state, unsigned int *offset)
+{
+	if (rfc6056_f(state, offset))
+		return -EINVAL;
+	*offset += *this_cpu_ptr(state->jool->nat64.pool4->next_ephemeral);
+	return 0;
+}
+
+#endif /* POOL4_LEASES */
+
+/**
+ * Returns the mask domain @state's new BIB entry should be picked from.
+ *
+ * The domain's ranges belong to the pool4 snapshot (or to the domain itself),
+ * so this doesn't copy the table, and doesn't (normally) allocate either.
+ *
+ * Release it with mask_domain_put() as soon as possible; it pins the RCU read
+ * lock and keeps BHs disabled in the meantime.
+ */
+verdict mask_domain_find(struct xlation *state, struct mask_domain **out)
+{
+	struct pool4_snapshot *snapshot;
+	struct pool4_view *view;
+	struct mask_domain *masks;
+	l4_protocol proto;
+	unsigned int offset;
+	__u32 index;
+	unsigned int bits;
+	bool deterministic;
+
+	proto = state->in.tuple.l4_proto;
+	if (WARN(proto >= L4PROTO_OTHER, "Unsupported transport protocol: %u.",
+			proto))
+		return drop(state, JSTAT_UNKNOWN);
+
+	masks = get_domain();
+	if (!masks)
+		return drop(state, JSTAT_ENOMEM);
+	masks->next_ephemeral = this_cpu_ptr(
+			state->jool->nat64.pool4->next_ephemeral);
+
+	/* (get_domain() holds the RCU read lock.) */
+	snapshot = get_snapshot(state->jool->nat64.pool4);
+
+	deterministic = get_subscriber(state, &index, &bits);
+	if (!deterministic) {
+		if (get_offset(state, &offset)) {
+			mask_domain_put(masks);
+			return drop(state, JSTAT_6056_F);
+		}
+		if (snapshot_is_empty(snapshot))
+			return find_empty(state, masks, offset, out);
+	}
+
+	view = find_mark_view(snapshot, proto, mask_domain_mark(state));
+	if (!view) {
+		mask_domain_put(masks);
+		return drop(state, JSTAT_MASK_DOMAIN_NOT_FOUND);
+	}
+
+	if (deterministic)
+		return find_deterministic(state, view, index, bits, masks, out);
+
+	masks->taddr_count = view->taddr_count;
+	masks->max_iterations = view->max_iterations;
+	masks->auto_iterations = view->auto_iterations;
+	masks->range_count = view->range_count;
+	masks->ranges = view->ranges;
+	return start_iteration(state, masks, offset, out);
 }
 
 void mask_domain_put(struct mask_domain *masks)
 {
-	__wkfree("mask_domain", masks);
+	if (masks->ranges_allocated)
+		__wkfree("mask_domain ranges", masks->ranges);
+	if (masks->percpu)
+		masks->busy = false;
+	else
+		__wkfree("mask_domain", masks);
+
+	local_bh_enable();
+	rcu_read_unlock();
 }
 
 int mask_domain_next(struct mask_domain *masks,
@@ -1151,7 +2796,7 @@ int mask_domain_next(struct mask_domain *masks,
 	if (masks->taddr_counter > masks->taddr_count)
 		return -ENOENT;
 	if (masks->max_iterations)
-		if (masks->taddr_counter > masks->max_iterations)
+		if (masks->taddr_counter - masks->skipped > masks->max_iterations)
 			return -ENOENT;
 
 	masks->current_port++;
@@ -1170,20 +2815,167 @@ int mask_domain_next(struct mask_domain *masks,
 	return 0;
 }
 
-/*
- * According to the kernel, adding to an atomic integer is "much slower"
- * (https://elixir.bootlin.com/linux/v5.0/source/arch/alpha/include/asm/atomic.h#L13)
- * than adding to a normal integer. That's why this function exists: We add once
- * when the loop is over instead of every time mask_domain_next() is called.
+/**
+ * Fast-forwards @masks to @port, which is assumed to be greater than the port
+ * the last mask_domain_next() returned. The skipped masks count towards the
+ * iteration limits. (Except for max-iterations, if the domain is crowded.)
  *
- * Now, this does mean that retrievals of @next_ephemeral that happen
- * concurrent to the loop will not get the maybe intended value, but RFC 6056 is
- * silent about what is actually supposed to happen in these cases. Also, I'm
- * probably micro-optimizing at this point.
+ * If @port belongs to the current range, updates @addr and returns 0.
+ * If it doesn't, stops at the end of the range and returns -ERANGE; the next
+ * mask_domain_next() will continue from the following range.
+ * Returns -ENOENT if the iteration limits are exhausted on the way.
+ */
+static int __mask_domain_skip(struct mask_domain *masks,
+		struct ipv4_transport_addr *addr,
+		unsigned int port,
+		bool charge)
+{
+	int result = 0;
+
+	if (port > masks->current_range->ports.max) {
+		port = masks->current_range->ports.max;
+		result = -ERANGE;
+	}
+
+	masks->taddr_counter += port - masks->current_port;
+	if (!charge || masks->crowded)
+		masks->skipped += port - masks->current_port;
+	if (masks->taddr_counter > masks->taddr_count)
+		return -ENOENT;
+	if (masks->max_iterations)
+		if (masks->taddr_counter - masks->skipped > masks->max_iterations)
+			return -ENOENT;
+
+	masks->current_port = port;
+	addr->l4 = port;
+	return result;
+}
+
+int mask_domain_skip(struct mask_domain *masks,
+		struct ipv4_transport_addr *addr,
+		unsigned int port)
+{
+	return __mask_domain_skip(masks, addr, port, true);
+}
+
+/**
+ * Same as mask_domain_skip(), except the skipped masks never count towards
+ * max-iterations. Meant for masks the caller is not allowed to use at all (as
+ * opposed to taken ones), so they don't eat the probes of the ones it is.
+ * (They still count towards the domain's size, so the iteration still ends.)
+ */
+int mask_domain_forgo(struct mask_domain *masks,
+		struct ipv4_transport_addr *addr,
+		unsigned int port)
+{
+	return __mask_domain_skip(masks, addr, port, false);
+}
+
+/**
+ * Tells @masks that (roughly) @used of its transport addresses are already
+ * taken. Call before the first mask_domain_next().
+ *
+ * Once a domain is at least 7/8 full, random probing is mostly wasted: the
+ * RFC 6056 offset is likely to land on a taken mask, and so are its followers.
+ * So a "crowded" domain
+ *
+ * - does not charge mask_domain_skip()s to its max-iterations. The caller is
+ *   expected to jump to the next free mask (as seen by its port bitmap) right
+ *   away, so the offset becomes a mere starting point for the free list, and
+ *   the limit only bounds the actual probes.
+ * - if the limit is automatic, raises it to four times the expected number of
+ *   probes (taddr_count / free). auto_max_iterations() assumes a mostly empty
+ *   pool, which makes it too eager to give up near the end.
+ *
+ * Returns whether the domain is crowded.
+ */
+bool mask_domain_set_occupancy(struct mask_domain *masks, unsigned int used)
+{
+	unsigned int free;
+	unsigned int cap;
+
+	/* "used >= 7/8 * taddr_count," without overflows. */
+	if (used < masks->taddr_count - (masks->taddr_count >> 3))
+		return false;
+
+	masks->crowded = true;
+	if (!masks->auto_iterations)
+		return true;
+
+	free = (used < masks->taddr_count) ? (masks->taddr_count - used) : 1;
+	cap = masks->taddr_count / free;
+	cap = (cap > masks->taddr_count >> 2) ? masks->taddr_count : (cap << 2);
+	if (cap > masks->max_iterations)
+		masks->max_iterations = cap;
+	return true;
+}
+
+/* Ranges mask_domain_balance() compares. */
+#define BALANCE_CANDIDATES 8
+
+/**
+ * Moves the start of @masks's iteration to the least loaded (according to
+ * @load; lower is better) of the (at most BALANCE_CANDIDATES) ranges that
+ * follow the RFC 6056 offset. The offset's position within its range is kept,
+ * modulo the size of the new range.
+ *
+ * So the search still starts somewhere random, but a full address no longer
+ * drags it across all of its taken ports. Only a few addresses are sampled,
+ * so the cost stays bounded no matter how big the table is. (Sampling several
+ * random candidates is known to spread nearly as evenly as always picking the
+ * global minimum.)
+ *
+ * Call before the first mask_domain_next().
+ */
+void mask_domain_balance(struct mask_domain *masks, mask_domain_load_cb load,
+		void *arg)
+{
+	struct ipv4_range *first;
+	struct ipv4_range *end;
+	struct ipv4_range *range;
+	struct ipv4_range *best;
+	unsigned int best_load;
+	unsigned int current;
+	unsigned int i;
+	unsigned int rel;
+
+	first = first_domain_entry(masks);
+	end = first + masks->range_count;
+	range = best = masks->current_range;
+	best_load = load(range, arg);
+
+	for (i = 1; i < BALANCE_CANDIDATES && i < masks->range_count; i++) {
+		if (best_load == 0)
+			break;
+		range++;
+		if (range >= end)
+			range = first;
+		current = load(range, arg);
+		if (current < best_load) {
+			best = range;
+			best_load = current;
+		}
+	}
+
+	if (best == masks->current_range)
+		return;
+
+	rel = (masks->current_port + 1 - masks->current_range->ports.min)
+			% port_range_count(&best->ports);
+	masks->current_range = best;
+	masks->current_port = best->ports.min + rel - 1;
+}
+
+/*
+ * Advances the CPU's next_ephemeral once the loop is over, instead of every
+ * time mask_domain_next() is called. Has to happen before mask_domain_put(),
+ * since that's what keeps the CPU's counter private.
  */
 void mask_domain_commit(struct mask_domain *masks)
 {
-	atomic_add(masks->taddr_counter, &next_ephemeral);
+#ifndef POOL4_LEASES /* Leases advance next_ephemeral on their own. */
+	*masks->next_ephemeral += masks->taddr_counter;
+#endif
 }
 
 bool mask_domain_matches(struct mask_domain *masks,
@@ -1201,6 +2993,28 @@ bool mask_domain_matches(struct mask_domain *masks,
 	return false;
 }
 
+/**
+ * Calls @cb on each of @masks's ranges (one address, and some of its ports), in
+ * domain order, until it returns nonzero. Returns whatever @cb returned last.
+ *
+ * This does not start from the RFC 6056 offset, nor count towards any limits;
+ * it's for callers that allocate their masks by other means. (port-block-size)
+ */
+int mask_domain_foreach_range(struct mask_domain *masks,
+		mask_domain_range_cb cb, void *arg)
+{
+	struct ipv4_range *entry;
+	int error;
+
+	foreach_domain_range(entry, masks) {
+		error = cb(entry, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 bool mask_domain_is_dynamic(struct mask_domain *masks)
 {
 	return masks->dynamic;
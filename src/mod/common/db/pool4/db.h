@@ -9,6 +9,7 @@
 
 #include <linux/net.h>
 #include "common/config.h"
+#include "mod/common/lockstat.h"
 #include "mod/common/route.h"
 #include "mod/common/translation_state.h"
 #include "mod/common/types.h"
@@ -24,11 +25,14 @@ void pool4db_get(struct pool4 *pool);
 void pool4db_put(struct pool4 *pool);
 
 int pool4db_add(struct pool4 *pool, const struct pool4_entry *entry);
+int pool4db_add_bulk(struct pool4 *pool, struct pool4_entry const *entries,
+		unsigned int count);
 int pool4db_update(struct pool4 *pool, const struct pool4_update *update);
 int pool4db_rm(struct pool4 *pool, const __u32 mark, enum l4_protocol proto,
 		struct ipv4_range *range);
 int pool4db_rm_usr(struct pool4 *pool, struct pool4_entry *entry);
 void pool4db_flush(struct pool4 *pool);
+int pool4db_clone(struct pool4 *pool, struct pool4 **result);
 
 /*
  * Read functions (Legal to use anywhere)
@@ -36,6 +40,11 @@ void pool4db_flush(struct pool4 *pool);
 
 bool pool4db_contains(struct pool4 *pool, struct net *ns, l4_protocol proto,
 		struct ipv4_transport_addr const *addr);
+bool pool4db_covers(struct pool4 *pool, struct net *ns, l4_protocol proto,
+		struct ipv4_transport_addr const *addr, __u16 *last);
+bool pool4db_may_contain(struct pool4 *pool, __be32 addr);
+bool pool4db_is_empty(struct pool4 *pool);
+unsigned int pool4db_taddr_count(struct pool4 *pool, l4_protocol proto);
 
 typedef int (*pool4db_foreach_entry_cb)(struct pool4_entry const *, void *);
 int pool4db_foreach_sample(struct pool4 *pool, l4_protocol proto,
@@ -44,17 +53,34 @@ int pool4db_foreach_sample(struct pool4 *pool, l4_protocol proto,
 
 struct mask_domain;
 
+__u32 mask_domain_mark(struct xlation *state);
 verdict mask_domain_find(struct xlation *state, struct mask_domain **out);
 void mask_domain_put(struct mask_domain *masks);
 int mask_domain_next(struct mask_domain *masks,
 		struct ipv4_transport_addr *addr,
 		bool *consecutive);
+int mask_domain_skip(struct mask_domain *masks,
+		struct ipv4_transport_addr *addr,
+		unsigned int port);
+int mask_domain_forgo(struct mask_domain *masks,
+		struct ipv4_transport_addr *addr,
+		unsigned int port);
+bool mask_domain_set_occupancy(struct mask_domain *masks, unsigned int used);
+typedef unsigned int (*mask_domain_load_cb)(struct ipv4_range const *, void *);
+void mask_domain_balance(struct mask_domain *masks, mask_domain_load_cb load,
+		void *arg);
 void mask_domain_commit(struct mask_domain *masks);
 bool mask_domain_matches(struct mask_domain *masks,
 		struct ipv4_transport_addr *addr);
+typedef int (*mask_domain_range_cb)(struct ipv4_range const *, void *);
+int mask_domain_foreach_range(struct mask_domain *masks,
+		mask_domain_range_cb cb, void *arg);
 bool mask_domain_is_dynamic(struct mask_domain *masks);
 __u32 mask_domain_get_mark(struct mask_domain *masks);
 
+void pool4db_memory(struct pool4 *pool, __u64 *tables, __u64 *bytes);
+void pool4db_lock_stats(struct pool4 *pool, struct jlock_stats *result);
+
 /*
  * Test functions (Illegal in production code)
  */
@@ -42,7 +42,9 @@ verdict pool4empty_find(struct xlation *state, struct ipv4_range *range)
 {
 	verdict result;
 
-	if (__rfc6052_6to4(&state->jool.globals.pool6.prefix,
+	/* Filtering already validated the destination against pool6. */
+	if (__rfc6052_6to4_nocheck(
+			xlator_pool6(state->jool, state->pool6_index),
 			&state->in.tuple.dst.addr6.l3,
 			&state->out.tuple.dst.addr4.l3))
 		return untranslatable(state, JSTAT_UNTRANSLATABLE_DST6);
@@ -1,6 +1,7 @@
 #include "mod/common/db/pool4/rfc6056.h"
 
 #include <crypto/hash.h>
+#include <linux/siphash.h>
 #include "mod/common/linux_version.h"
 #include "mod/common/log.h"
 #include "mod/common/wkmalloc.h"
@@ -68,6 +69,8 @@
  */
 static unsigned char *secret_key;
 static size_t secret_key_len;
+/* Same thing, reshaped for siphash(). (Copied from @secret_key.) */
+static siphash_key_t siphash_key;
 
 /*
  * It looks like this does not require a spinlock either:
@@ -90,6 +93,7 @@ int rfc6056_setup(void)
 	if (!secret_key)
 		return -ENOMEM;
 	get_random_bytes(secret_key, secret_key_len);
+	memcpy(&siphash_key, secret_key, sizeof(siphash_key));
 
 	/* TFC stuff */
 	shash = crypto_alloc_shash("md5", 0, CRYPTO_ALG_ASYNC);
@@ -143,14 +147,7 @@ static int hash_tuple(struct shash_desc *desc, __u8 fields,
 	return crypto_shash_update(desc, secret_key, secret_key_len);
 }
 
-/**
- * RFC 6056, Algorithm 3. Returns a hash out of some of @tuple's fields.
- *
- * Just to clarify: Because our port pool is a somewhat complex data structure
- * (rather than a simple range), ephemerals are now handled by pool4. This
- * function has been stripped now to only consist of F(). (Hence the name.)
- */
-int rfc6056_f(struct xlation *state, unsigned int *result)
+static int md5_f(struct xlation *state, unsigned int *result)
 {
 	union {
 		__be32 as32[4];
@@ -176,7 +173,7 @@ int rfc6056_f(struct xlation *state, unsigned int *result)
 		goto end;
 	}
 
-	error = hash_tuple(desc, state->jool.globals.nat64.f_args,
+	error = hash_tuple(desc, state->jool->globals.nat64.f_args,
 			&state->in.tuple);
 	if (error) {
 		log_debug(state, "crypto_hash_update() error: %d", error);
@@ -196,3 +193,67 @@ end:
 	__wkfree("shash desc", desc);
 	return error;
 }
+
+/*
+ * Same as md5_f(), except it never allocates (nor fails), and is a lot cheaper.
+ *
+ * The secret key is already part of the siphash, so it's not appended to the
+ * fields.
+ */
+static int siphash_f(struct xlation *state, unsigned int *result)
+{
+	struct tuple *tuple6 = &state->in.tuple;
+	__u8 fields = state->jool->globals.nat64.f_args;
+	/* Large enough to contain all the fields. */
+	__u8 buffer[2 * (sizeof(struct in6_addr) + sizeof(__u16))] __aligned(8);
+	size_t len = 0;
+
+	if (fields & F_ARGS_SRC_ADDR) {
+		memcpy(buffer + len, &tuple6->src.addr6.l3,
+				sizeof(tuple6->src.addr6.l3));
+		len += sizeof(tuple6->src.addr6.l3);
+	}
+	if (fields & F_ARGS_SRC_PORT) {
+		memcpy(buffer + len, &tuple6->src.addr6.l4,
+				sizeof(tuple6->src.addr6.l4));
+		len += sizeof(tuple6->src.addr6.l4);
+	}
+	if (fields & F_ARGS_DST_ADDR) {
+		memcpy(buffer + len, &tuple6->dst.addr6.l3,
+				sizeof(tuple6->dst.addr6.l3));
+		len += sizeof(tuple6->dst.addr6.l3);
+	}
+	if (fields & F_ARGS_DST_PORT) {
+		memcpy(buffer + len, &tuple6->dst.addr6.l4,
+				sizeof(tuple6->dst.addr6.l4));
+		len += sizeof(tuple6->dst.addr6.l4);
+	}
+
+	*result = (unsigned int)siphash(buffer, len, &siphash_key);
+	return 0;
+}
+
+/**
+ * RFC 6056, Algorithm 3. Returns a hash out of some of @tuple's fields.
+ *
+ * Just to clarify: Because our port pool is a somewhat complex data structure
+ * (rather than a simple range), ephemerals are now handled by pool4. This
+ * function has been stripped now to only consist of F(). (Hence the name.)
+ */
+int rfc6056_f(struct xlation *state, unsigned int *result)
+{
+	return (state->jool->globals.nat64.f_hash == F_HASH_SIPHASH)
+			? siphash_f(state, result)
+			: md5_f(state, result);
+}
+
+/**
+ * rfc6056_ephemeral_seed - Initial `next_ephemeral` of @owner's @cpu.
+ *
+ * Keyed by the secret, so the offsets can't be predicted from the outside, and
+ * spread out so the CPUs don't all start probing from the same ports.
+ */
+unsigned int rfc6056_ephemeral_seed(void const *owner, unsigned int cpu)
+{
+	return siphash_2u64((u64)(uintptr_t)owner, cpu, &siphash_key);
+}
@@ -8,5 +8,6 @@ int rfc6056_setup(void);
 void rfc6056_teardown(void);
 
 int rfc6056_f(struct xlation *state, unsigned int *result);
+unsigned int rfc6056_ephemeral_seed(void const *owner, unsigned int cpu);
 
 #endif /* SRC_MOD_NAT64_POOL4_RFC6056_H_ */
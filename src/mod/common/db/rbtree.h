@@ -9,6 +9,7 @@
  */
 
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 
 /**
  * rbtree_find - Stock search on a Red-Black tree.
@@ -42,6 +43,39 @@
 		result; \
 	})
 
+/**
+ * rbtree_find_rcu - rbtree_find(), for lockless readers.
+ *
+ * The caller must be inside an RCU read-side critical section, and the tree's
+ * writers must publish nodes through treeslot_commit() (or rb_link_node_rcu())
+ * and free them only after a grace period.
+ *
+ * Concurrent rebalances can yield false negatives (but never false positives),
+ * so a miss should be confirmed by a locked lookup.
+ */
+#define rbtree_find_rcu(expected, root, compare_fn, type, hook_name) \
+	({ \
+		type *result = NULL; \
+		struct rb_node *node; \
+		\
+		node = rcu_dereference_raw((root)->rb_node); \
+		while (node) { \
+			type *entry = rb_entry(node, type, hook_name); \
+			int comparison = compare_fn(entry, expected); \
+			\
+			if (comparison < 0) { \
+				node = rcu_dereference_raw(node->rb_right); \
+			} else if (comparison > 0) { \
+				node = rcu_dereference_raw(node->rb_left); \
+			} else { \
+				result = entry; \
+				break; \
+			} \
+		} \
+		\
+		result; \
+	})
+
 /**
  * rbtree_add - Add a node to a Red-Black tree.
  *
@@ -130,7 +164,10 @@ struct tree_slot {
 void treeslot_init(struct tree_slot *slot,
 		struct rb_root *tree,
 		struct rb_node *entry);
-/** Adds @slot's node to the tree. Also rebalances while it's at it. */
+/**
+ * Adds @slot's node to the tree. Also rebalances while it's at it.
+ * The node is published in a way that is safe for rbtree_find_rcu() readers.
+ */
 void treeslot_commit(struct tree_slot *slot);
 
 /**
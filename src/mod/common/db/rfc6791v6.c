@@ -1,5 +1,6 @@
 #include "mod/common/db/rfc6791v6.h"
 
+#include "mod/common/fast_random.h"
 #include "mod/common/log.h"
 
 /**
@@ -13,12 +14,11 @@ static int get_pool_address(struct xlation *state, struct in6_addr *result)
 	unsigned int modulus;
 	unsigned int offset;
 	size_t host_bytes_num;
-	__u8 randomized_byte;
 
-	if (!state->jool.globals.siit.rfc6791_prefix6.set)
+	if (!state->jool->globals.siit.rfc6791_prefix6.set)
 		return -EINVAL;
 
-	prefix = &state->jool.globals.siit.rfc6791_prefix6.prefix;
+	prefix = &state->jool->globals.siit.rfc6791_prefix6.prefix;
 
 	segment_bytes_num = prefix->len >> 3; /* >> 3 = / 8 */
 	modulus = prefix->len & 7; /* & 7 = % 8 */
@@ -26,17 +26,16 @@ static int get_pool_address(struct xlation *state, struct in6_addr *result)
 	host_bytes_num = 16 - segment_bytes_num;
 
 	(*result) = prefix->addr;
-
-	if (modulus == 0) {
-		get_random_bytes(((__u8*)result) + offset, host_bytes_num);
+	if (host_bytes_num == 0)
 		return 0;
-	}
 
-	get_random_bytes(((__u8*)result) + offset + 1, host_bytes_num - 1);
-	get_random_bytes(&randomized_byte, sizeof(randomized_byte));
-
-	randomized_byte &= (1 << (8 - modulus)) - 1;
-	result->s6_addr[segment_bytes_num] |= randomized_byte;
+	fast_random_bytes(((__u8*)result) + offset, host_bytes_num);
+	if (modulus != 0) {
+		/* The first random byte is shared with the prefix. */
+		result->s6_addr[segment_bytes_num] &= (1 << (8 - modulus)) - 1;
+		result->s6_addr[segment_bytes_num] |=
+				prefix->addr.s6_addr[segment_bytes_num];
+	}
 
 	return 0;
 }
@@ -0,0 +1,264 @@
+#include "mod/common/db/talkers.h"
+
+#include <linux/kref.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/sort.h>
+#include <net/ipv6.h>
+
+#include "mod/common/wkmalloc.h"
+
+/* Period of the decay, in jiffies. */
+#define TALKERS_HALF_LIFE (60 * HZ)
+
+/* One metric's summary, in one CPU. */
+struct talker_summary {
+	/* Only contended during queries and decays. */
+	spinlock_t lock;
+	/* Zero count means the slot is free. */
+	struct talker slots[JTALK_MAX];
+};
+
+struct talker_cache {
+	struct talker_summary metrics[JTALK_METRIC_COUNT];
+};
+
+struct talkers {
+	struct talker_cache __percpu *cache;
+	/* Last decay. Only touched by the (single) cleaner of the instance. */
+	unsigned long decayed;
+	struct kref refs;
+};
+
+DEFINE_STATIC_KEY_FALSE(talkers_key);
+
+static bool top_talkers;
+
+static int set_top_talkers(const char *val, const struct kernel_param *kp)
+{
+	int error;
+
+	error = param_set_bool(val, kp);
+	if (error)
+		return error;
+
+	if (top_talkers)
+		static_branch_enable(&talkers_key);
+	else
+		static_branch_disable(&talkers_key);
+	return 0;
+}
+
+static const struct kernel_param_ops top_talkers_ops = {
+	.set = set_top_talkers,
+	.get = param_get_bool,
+};
+
+module_param_cb(top_talkers, &top_talkers_ops, &top_talkers, 0644);
+MODULE_PARM_DESC(top_talkers, "Track the subscribers that create the most sessions and move the most bytes. (See `jool stats talkers`.)");
+
+struct talkers *talkers_alloc(void)
+{
+	struct talkers *talkers;
+	struct talker_cache *cache;
+	unsigned int cpu;
+	unsigned int m;
+
+	talkers = wkmalloc(struct talkers, GFP_KERNEL);
+	if (!talkers)
+		return NULL;
+
+	/* alloc_percpu() zeroes. */
+	talkers->cache = alloc_percpu(struct talker_cache);
+	if (!talkers->cache) {
+		wkfree(struct talkers, talkers);
+		return NULL;
+	}
+
+	for_each_possible_cpu(cpu) {
+		cache = per_cpu_ptr(talkers->cache, cpu);
+		for (m = 0; m < JTALK_METRIC_COUNT; m++)
+			spin_lock_init(&cache->metrics[m].lock);
+	}
+
+	talkers->decayed = jiffies;
+	kref_init(&talkers->refs);
+	return talkers;
+}
+
+void talkers_get(struct talkers *talkers)
+{
+	kref_get(&talkers->refs);
+}
+
+static void talkers_release(struct kref *refs)
+{
+	struct talkers *talkers;
+	talkers = container_of(refs, struct talkers, refs);
+
+	free_percpu(talkers->cache);
+	wkfree(struct talkers, talkers);
+}
+
+void talkers_put(struct talkers *talkers)
+{
+	kref_put(&talkers->refs, talkers_release);
+}
+
+/*
+ * Space-Saving update. The scan for @prefix also finds the slot that should
+ * host it, if it's not tracked yet.
+ */
+static void summary_add(struct talker_summary *summary,
+		struct in6_addr const *prefix, __u64 weight)
+{
+	struct talker *slot;
+	struct talker *free;
+	struct talker *min;
+	unsigned int i;
+
+	free = NULL;
+	min = &summary->slots[0];
+	for (i = 0; i < JTALK_MAX; i++) {
+		slot = &summary->slots[i];
+		if (!slot->count) {
+			if (!free)
+				free = slot;
+			continue;
+		}
+		if (ipv6_addr_equal(&slot->prefix, prefix)) {
+			slot->count += weight;
+			return;
+		}
+		if (slot->count < min->count || !min->count)
+			min = slot;
+	}
+
+	if (free) {
+		free->prefix = *prefix;
+		free->count = weight;
+		free->error = 0;
+		return;
+	}
+
+	/* The newcomer might have been the evictee all along. */
+	min->prefix = *prefix;
+	min->error = min->count;
+	min->count += weight;
+}
+
+void __talkers_add(struct xlator *jool, struct in6_addr const *src6,
+		enum jool_talker_metric metric, __u64 weight)
+{
+	struct talker_summary *summary;
+	struct in6_addr prefix;
+
+	ipv6_addr_prefix(&prefix, src6,
+			jool->globals.nat64.bib.subscriber_prefix_len);
+
+	local_bh_disable();
+	summary = &this_cpu_ptr(jool->nat64.talkers->cache)->metrics[metric];
+	spin_lock(&summary->lock);
+	summary_add(summary, &prefix, weight);
+	spin_unlock(&summary->lock);
+	local_bh_enable();
+}
+
+/**
+ * talkers_clean - Halves the counts if a half-life has elapsed since the last
+ * time. Meant to be called by the timer.
+ */
+void talkers_clean(struct xlator *jool)
+{
+	struct talkers *talkers = jool->nat64.talkers;
+	struct talker_summary *summary;
+	struct talker *slot;
+	unsigned int cpu, m, i;
+
+	if (time_before(jiffies, talkers->decayed + TALKERS_HALF_LIFE))
+		return;
+	talkers->decayed = jiffies;
+
+	for_each_possible_cpu(cpu) {
+		for (m = 0; m < JTALK_METRIC_COUNT; m++) {
+			summary = &per_cpu_ptr(talkers->cache, cpu)->metrics[m];
+			spin_lock_bh(&summary->lock);
+			for (i = 0; i < JTALK_MAX; i++) {
+				slot = &summary->slots[i];
+				slot->count >>= 1;
+				slot->error >>= 1;
+			}
+			spin_unlock_bh(&summary->lock);
+		}
+	}
+}
+
+static int compare_prefix(const void *a, const void *b)
+{
+	struct talker const *ta = a;
+	struct talker const *tb = b;
+	return memcmp(&ta->prefix, &tb->prefix, sizeof(ta->prefix));
+}
+
+/* Sorts by count, descending. */
+static int compare_count(const void *a, const void *b)
+{
+	struct talker const *ta = a;
+	struct talker const *tb = b;
+
+	if (ta->count != tb->count)
+		return (ta->count < tb->count) ? 1 : -1;
+	return 0;
+}
+
+/**
+ * talkers_query - Merges the CPUs' @metric summaries, and copies the (at most
+ * JTALK_MAX) biggest talkers into @result, biggest first.
+ *
+ * Returns the number of talkers copied, or zero if there are none (or there's
+ * no memory). Can sleep.
+ */
+unsigned int talkers_query(struct talkers *talkers,
+		enum jool_talker_metric metric, struct talker *result)
+{
+	struct talker_summary *summary;
+	struct talker *all;
+	unsigned int count;
+	unsigned int cpu, i, j;
+
+	all = __wkvmalloc("talkers merge buffer",
+			nr_cpu_ids * JTALK_MAX * sizeof(*all));
+	if (!all)
+		return 0;
+
+	count = 0;
+	for_each_possible_cpu(cpu) {
+		summary = &per_cpu_ptr(talkers->cache, cpu)->metrics[metric];
+		spin_lock_bh(&summary->lock);
+		for (i = 0; i < JTALK_MAX; i++)
+			if (summary->slots[i].count)
+				all[count++] = summary->slots[i];
+		spin_unlock_bh(&summary->lock);
+	}
+
+	/* A subscriber can be tracked by several CPUs; add them up. */
+	sort(all, count, sizeof(*all), compare_prefix, NULL);
+	for (i = 0, j = 0; i < count; i++) {
+		if (j > 0 && ipv6_addr_equal(&all[j - 1].prefix,
+				&all[i].prefix)) {
+			all[j - 1].count += all[i].count;
+			all[j - 1].error += all[i].error;
+		} else {
+			all[j++] = all[i];
+		}
+	}
+	count = j;
+
+	sort(all, count, sizeof(*all), compare_count, NULL);
+	if (count > JTALK_MAX)
+		count = JTALK_MAX;
+	memcpy(result, all, count * sizeof(*all));
+
+	__wkvfree("talkers merge buffer", all);
+	return count;
+}
@@ -0,0 +1,56 @@
+#ifndef SRC_MOD_COMMON_DB_TALKERS_H_
+#define SRC_MOD_COMMON_DB_TALKERS_H_
+
+/**
+ * @file
+ * Top talkers. (The jool_common module's top_talkers parameter.)
+ *
+ * Finds the subscribers (IPv6 prefixes of length subscriber-prefix-length)
+ * that create the most sessions, and the ones that move the most bytes,
+ * without having to dump the session table.
+ *
+ * Each CPU keeps a Space-Saving summary of JTALK_MAX talkers per metric. A
+ * packet from an untracked subscriber replaces the smallest talker, and
+ * inherits its count (which then becomes the newcomer's error), so heavy
+ * hitters can't be missed, but counts are overestimated by (at most) their
+ * errors. Queries merge the CPUs' summaries.
+ *
+ * Counts are halved every minute, so the summaries follow the current heavy
+ * hitters, not the all-time ones.
+ */
+
+#include <linux/jump_label.h>
+#include "mod/common/translation_state.h"
+
+struct talkers;
+
+struct talkers *talkers_alloc(void);
+void talkers_get(struct talkers *talkers);
+void talkers_put(struct talkers *talkers);
+
+DECLARE_STATIC_KEY_FALSE(talkers_key);
+
+void __talkers_add(struct xlator *jool, struct in6_addr const *src6,
+		enum jool_talker_metric metric, __u64 weight);
+
+/* Charges @weight to @src6's subscriber, if tracking is enabled. */
+static inline void talkers_add(struct xlator *jool,
+		struct in6_addr const *src6, enum jool_talker_metric metric,
+		__u64 weight)
+{
+	if (static_branch_unlikely(&talkers_key))
+		__talkers_add(jool, src6, metric, weight);
+}
+
+void talkers_clean(struct xlator *jool);
+
+struct talker {
+	struct in6_addr prefix;
+	__u64 count;
+	__u64 error;
+};
+
+unsigned int talkers_query(struct talkers *talkers,
+		enum jool_talker_metric metric, struct talker *result);
+
+#endif /* SRC_MOD_COMMON_DB_TALKERS_H_ */
@@ -0,0 +1,76 @@
+#include "mod/common/drop_reason.h"
+
+#ifdef JOOL_DROP_REASONS
+
+/*
+ * Stats that don't fit any generic reason (most of the NAT64 state handling,
+ * the quotas and the policies) are reported as Netfilter drops, which is what
+ * they are.
+ */
+enum skb_drop_reason jstat_drop_reason(enum jool_stat_id stat)
+{
+	switch (stat) {
+	case JSTAT_ENOMEM:
+	case JSTAT64_PSKB_COPY:
+	case JSTAT46_PSKB_COPY:
+		return SKB_DROP_REASON_NOMEM;
+	case JSTAT_THREADED_RING_FULL:
+		return SKB_DROP_REASON_FULL_RING;
+
+	case JSTAT_SKB_TRUNCATED:
+		return SKB_DROP_REASON_PKT_TOO_SMALL;
+	case JSTAT_SKB_SHARED:
+	case JSTAT_L3HDR_OFFSET:
+	case JSTAT_HDR6:
+	case JSTAT_HDR4:
+	case JSTAT64_TTL:
+	case JSTAT46_TTL:
+	case JSTAT64_2XFRAG:
+	case JSTAT64_FRAG_THEN_EXT:
+	case JSTAT64_SEGMENTS_LEFT:
+	case JSTAT46_SRC_ROUTE:
+		return SKB_DROP_REASON_IP_INHDR;
+
+	case JSTAT_UNKNOWN_L4_PROTO:
+	case JSTAT_UNKNOWN_PROTO_INNER:
+		return SKB_DROP_REASON_IP_NOPROTO;
+	case JSTAT_UNKNOWN_ICMP6_TYPE:
+	case JSTAT_UNKNOWN_ICMP4_TYPE:
+	case JSTAT_DOUBLE_ICMP6_ERROR:
+	case JSTAT_DOUBLE_ICMP4_ERROR:
+	case JSTAT64_FRAGMENTED_ICMP:
+	case JSTAT46_FRAGMENTED_ICMP:
+	case JSTAT64_UNTRANSLATABLE_PARAM_PROB_PTR:
+	case JSTAT46_UNTRANSLATABLE_PARAM_PROBLEM_PTR:
+		return SKB_DROP_REASON_UNHANDLED_PROTO;
+
+	case JSTAT64_ICMP_CSUM:
+	case JSTAT46_ICMP_CSUM:
+		return SKB_DROP_REASON_ICMP_CSUM;
+	case JSTAT46_FRAGMENTED_ZERO_CSUM:
+		return SKB_DROP_REASON_UDP_CSUM;
+
+	case JSTAT_UNTRANSLATABLE_DST6:
+	case JSTAT_UNTRANSLATABLE_DST4:
+	case JSTAT64_SRC:
+	case JSTAT64_DST:
+	case JSTAT46_SRC:
+	case JSTAT46_DST:
+	case JSTAT64_6791_ENOENT:
+	case JSTAT46_6791_ENOENT:
+		return SKB_DROP_REASON_IP_INADDRERRORS;
+
+	case JSTAT_FAILED_ROUTES:
+		return SKB_DROP_REASON_IP_OUTNOROUTES;
+	case JSTAT_PKT_TOO_BIG:
+	case JSTAT46_BAD_MTU:
+		return SKB_DROP_REASON_PKT_TOO_BIG;
+	case JSTAT46_GSO_SEGMENT:
+		return SKB_DROP_REASON_SKB_GSO_SEG;
+
+	default:
+		return SKB_DROP_REASON_NETFILTER_DROP;
+	}
+}
+
+#endif /* JOOL_DROP_REASONS */
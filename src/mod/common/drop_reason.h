@@ -0,0 +1,53 @@
+#ifndef SRC_MOD_COMMON_DROP_REASON_H_
+#define SRC_MOD_COMMON_DROP_REASON_H_
+
+/**
+ * @file
+ * Tells the kernel's drop monitors (the skb:kfree_skb tracepoint, dropwatch,
+ * perf trace, etc.) why Jool dropped a packet, instead of letting every drop
+ * look like a generic Netfilter one.
+ *
+ * Out-of-tree modules cannot register their own drop reason subsystem, so the
+ * stats are mapped to the closest generic reasons. The jool_verdict
+ * tracepoint still reports the exact stat.
+ */
+
+#include <linux/netfilter.h>
+#include <linux/skbuff.h>
+#include "common/stats.h"
+#include "mod/common/linux_version.h"
+
+#if LINUX_VERSION_AT_LEAST(6, 2, 0, 9999, 0)
+#define JOOL_DROP_REASONS
+enum skb_drop_reason jstat_drop_reason(enum jool_stat_id stat);
+#endif
+
+/* kfree_skb(), for a packet Jool is dropping because of @stat. */
+static inline void jool_kfree_skb(struct sk_buff *skb, enum jool_stat_id stat)
+{
+#ifdef JOOL_DROP_REASONS
+	kfree_skb_reason(skb, jstat_drop_reason(stat));
+#else
+	kfree_skb(skb);
+#endif
+}
+
+/*
+ * NF_DROP, for a packet Jool is dropping because of @stat.
+ *
+ * Netfilter would free the packet with a generic reason, so the hook frees it
+ * instead, and steals it. (It's what NF_DROP_REASON() does.) Jool only hooks
+ * pre-routing and ingress, whose callers don't care about the error code.
+ */
+static inline unsigned int jool_nf_drop(struct sk_buff *skb,
+		enum jool_stat_id stat)
+{
+#ifdef JOOL_DROP_REASONS
+	jool_kfree_skb(skb, stat);
+	return NF_STOLEN;
+#else
+	return NF_DROP;
+#endif
+}
+
+#endif /* SRC_MOD_COMMON_DROP_REASON_H_ */
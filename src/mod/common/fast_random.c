@@ -0,0 +1,56 @@
+#include "mod/common/fast_random.h"
+
+#include <linux/jiffies.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include "mod/common/linux_version.h"
+
+#if LINUX_VERSION_AT_LEAST(5, 8, 0, 9, 0)
+#include <linux/prandom.h>
+#endif
+
+/* Lifespan of a seed, in jiffies. */
+#define FAST_RANDOM_RESEED_INTERVAL (60 * HZ)
+
+struct fast_random {
+	struct rnd_state state;
+	/* Zero means the state was never seeded. */
+	unsigned long expires;
+};
+
+static DEFINE_PER_CPU(struct fast_random, prngs);
+
+/* Requires BHs disabled. */
+static struct rnd_state *get_state(void)
+{
+	struct fast_random *prng;
+
+	prng = this_cpu_ptr(&prngs);
+	if (unlikely(!prng->expires || time_after_eq(jiffies, prng->expires))) {
+		prandom_seed_state(&prng->state, get_random_u64());
+		prng->expires = jiffies + FAST_RANDOM_RESEED_INTERVAL;
+		/* In the unlikely event it overlapped the "never seeded" value */
+		if (!prng->expires)
+			prng->expires = 1;
+	}
+
+	return &prng->state;
+}
+
+__u32 fast_random_u32(void)
+{
+	__u32 result;
+
+	local_bh_disable();
+	result = prandom_u32_state(get_state());
+	local_bh_enable();
+
+	return result;
+}
+
+void fast_random_bytes(void *buf, size_t len)
+{
+	local_bh_disable();
+	prandom_bytes_state(get_state(), buf, len);
+	local_bh_enable();
+}
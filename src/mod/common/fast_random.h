@@ -0,0 +1,20 @@
+#ifndef SRC_MOD_COMMON_FAST_RANDOM_H_
+#define SRC_MOD_COMMON_FAST_RANDOM_H_
+
+/**
+ * @file
+ * Cheap random numbers for the packet path.
+ *
+ * Each CPU owns a non-cryptographic PRNG, seeded (and periodically reseeded)
+ * from the kernel's CSPRNG. Meant for values that need to be unpredictable
+ * enough to spread traffic, but whose cost matters more than their secrecy.
+ * (eg. the RFC 6791 addresses of ICMP errors, which can be generated in
+ * bursts.) Do not use it for anything an attacker must not be able to guess.
+ */
+
+#include <linux/types.h>
+
+__u32 fast_random_u32(void);
+void fast_random_bytes(void *buf, size_t len);
+
+#endif /* SRC_MOD_COMMON_FAST_RANDOM_H_ */
@@ -0,0 +1,155 @@
+#include "mod/common/icmp_ratelimit.h"
+
+#include <linux/jhash.h>
+#include <linux/kref.h>
+#include <linux/percpu.h>
+#include "mod/common/wkmalloc.h"
+
+/* Source buckets per CPU. Has to be a power of two. */
+#define ICMP_RL_SLOTS 64
+
+/*
+ * Credit is measured in 1/HZ tokens: every jiffy adds "rate" of them, and every
+ * error costs HZ. The bucket holds up to a second's worth of errors.
+ */
+struct icmp_bucket {
+	unsigned long stamp;
+	u64 credit;
+};
+
+struct icmp_source {
+	/* The /24 or /64, left-aligned. */
+	u64 prefix;
+	/* AF_INET or AF_INET6. Zero means the slot was never used. */
+	u8 family;
+	struct icmp_bucket bucket;
+};
+
+struct icmp_buckets {
+	struct icmp_bucket instance;
+	struct icmp_source sources[ICMP_RL_SLOTS];
+};
+
+struct icmp_ratelimit {
+	struct icmp_buckets __percpu *buckets;
+	struct kref refs;
+};
+
+struct icmp_ratelimit *icmp_ratelimit_alloc(void)
+{
+	struct icmp_ratelimit *rl;
+
+	rl = wkmalloc(struct icmp_ratelimit, GFP_KERNEL);
+	if (!rl)
+		return NULL;
+
+	/* alloc_percpu() zeroes. */
+	rl->buckets = alloc_percpu(struct icmp_buckets);
+	if (!rl->buckets) {
+		wkfree(struct icmp_ratelimit, rl);
+		return NULL;
+	}
+
+	kref_init(&rl->refs);
+	return rl;
+}
+
+void icmp_ratelimit_get(struct icmp_ratelimit *rl)
+{
+	kref_get(&rl->refs);
+}
+
+static void icmp_ratelimit_release(struct kref *refs)
+{
+	struct icmp_ratelimit *rl;
+
+	rl = container_of(refs, struct icmp_ratelimit, refs);
+	free_percpu(rl->buckets);
+	wkfree(struct icmp_ratelimit, rl);
+}
+
+void icmp_ratelimit_put(struct icmp_ratelimit *rl)
+{
+	kref_put(&rl->refs, icmp_ratelimit_release);
+}
+
+/* Zero @rate means unlimited. */
+static bool refill(struct icmp_bucket *bucket, __u32 rate, unsigned long now)
+{
+	unsigned long elapsed;
+
+	if (!rate)
+		return true;
+
+	/* A second fills the bucket, so don't bother overflowing. */
+	elapsed = min_t(unsigned long, now - bucket->stamp, HZ);
+	bucket->credit = min_t(u64, bucket->credit + (u64)elapsed * rate,
+			(u64)rate * HZ);
+	bucket->stamp = now;
+
+	return bucket->credit >= HZ;
+}
+
+static void consume(struct icmp_bucket *bucket, __u32 rate)
+{
+	if (rate)
+		bucket->credit -= HZ;
+}
+
+static bool allow(struct xlator *jool, u64 prefix, u8 family)
+{
+	__u32 instance_rate = jool->globals.icmp_error_rate;
+	__u32 source_rate = jool->globals.icmp_error_source_rate;
+	struct icmp_buckets *buckets;
+	struct icmp_source *source;
+	unsigned long now;
+	bool result;
+
+	if (!instance_rate && !source_rate)
+		return true;
+
+	local_bh_disable();
+
+	buckets = this_cpu_ptr(jool->icmp_ratelimit->buckets);
+	source = &buckets->sources[jhash_2words(prefix >> 32, prefix, family)
+			& (ICMP_RL_SLOTS - 1)];
+	now = jiffies;
+
+	/* Newcomers (and collisions) start with a full bucket. */
+	if (source->family != family || source->prefix != prefix) {
+		source->prefix = prefix;
+		source->family = family;
+		source->bucket.stamp = now - HZ;
+		source->bucket.credit = 0;
+	}
+
+	result = refill(&buckets->instance, instance_rate, now);
+	result &= refill(&source->bucket, source_rate, now);
+	if (result) {
+		consume(&buckets->instance, instance_rate);
+		consume(&source->bucket, source_rate);
+	}
+
+	local_bh_enable();
+	return result;
+}
+
+/**
+ * icmp_ratelimit_allow6 - Returns whether @jool's rates allow it to send an
+ * ICMPv6 error to @dst now. If they do, the error is charged.
+ */
+bool icmp_ratelimit_allow6(struct xlator *jool, struct in6_addr const *dst)
+{
+	return allow(jool, ((u64)be32_to_cpu(dst->s6_addr32[0]) << 32)
+			| be32_to_cpu(dst->s6_addr32[1]), AF_INET6);
+}
+
+/**
+ * icmp_ratelimit_allow4 - Returns whether @jool's rates allow it to send an
+ * ICMPv4 error to @dst now. If they do, the error is charged.
+ */
+bool icmp_ratelimit_allow4(struct xlator *jool, __be32 dst)
+{
+	return allow(jool, (u64)(be32_to_cpu(dst) & 0xFFFFFF00u) << 32,
+			AF_INET);
+}
@@ -0,0 +1,25 @@
+#ifndef SRC_MOD_COMMON_ICMP_RATELIMIT_H_
+#define SRC_MOD_COMMON_ICMP_RATELIMIT_H_
+
+/**
+ * @file
+ * Token buckets that limit the ICMP errors an instance generates. (The
+ * icmp-error-rate and icmp-error-source-rate globals.)
+ *
+ * There's one bucket for the whole instance, and a small hashed table of
+ * buckets for the sources (IPv4 /24s and IPv6 /64s) the errors are addressed
+ * to. Both are per-CPU, so the rates are enforced by every CPU on its own.
+ */
+
+#include "mod/common/xlator.h"
+
+struct icmp_ratelimit;
+
+struct icmp_ratelimit *icmp_ratelimit_alloc(void);
+void icmp_ratelimit_get(struct icmp_ratelimit *rl);
+void icmp_ratelimit_put(struct icmp_ratelimit *rl);
+
+bool icmp_ratelimit_allow6(struct xlator *jool, struct in6_addr const *dst);
+bool icmp_ratelimit_allow4(struct xlator *jool, __be32 dst);
+
+#endif /* SRC_MOD_COMMON_ICMP_RATELIMIT_H_ */
@@ -3,11 +3,19 @@
 #include <linux/module.h>
 
 #include "mod/common/atomic_config.h"
+#include "mod/common/bpf_iter.h"
+#include "mod/common/bpf_xlat.h"
+#include "mod/common/capture.h"
 #include "mod/common/joold.h"
+#include "mod/common/joold_ring.h"
+#include "mod/common/natlog.h"
 #include "mod/common/log.h"
+#include "mod/common/stats.h"
+#include "mod/common/threaded.h"
 #include "mod/common/timer.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
+#include "mod/common/db/denylist4.h"
 #include "mod/common/db/bib/db.h"
 #include "mod/common/db/pool4/rfc6056.h"
 #include "mod/common/nl/nl_handler.h"
@@ -19,6 +27,8 @@ MODULE_VERSION(JOOL_VERSION_STR);
 
 static unsigned int siit_refs = 0;
 static unsigned int nat64_refs = 0;
+/* NAT64 instances in the database. (See jool_nat64_machinery_get().) */
+static unsigned int nat64_instances = 0;
 static DEFINE_MUTEX(lock);
 
 static int setup_common_modules(void)
@@ -28,19 +38,12 @@ static int setup_common_modules(void)
 	LOG_DEBUG("Initializing common modules.");
 	/* Careful with the order. */
 
-	/* NAT64 */
-	error = rfc6056_setup();
-	if (error)
-		goto rfc6056_fail;
-	/* TODO (performance) SIIT-only shouldn't need to pay for this; move. */
-	error = jtimer_setup();
-	if (error)
-		goto jtimer_fail;
-
-	/* Common */
 	error = xlation_setup();
 	if (error)
 		goto xlation_fail;
+	error = denylist4_setup();
+	if (error)
+		goto denylist4_fail;
 	/*
 	 * In kernel < 4.13, this opens the Netfilter packet gate, so all
 	 * submodules needed for translation need to be up by now.
@@ -51,18 +54,23 @@ static int setup_common_modules(void)
 	error = nlhandler_setup();
 	if (error)
 		goto nlhandler_fail;
+	error = joold_ring_setup();
+	if (error)
+		goto joold_ring_fail;
+	bpfiter_setup();
+	bpfxlat_setup();
 
 	return 0;
 
+joold_ring_fail:
+	nlhandler_teardown();
 nlhandler_fail:
 	xlator_teardown();
 xlator_fail:
+	denylist4_teardown();
+denylist4_fail:
 	xlation_teardown();
 xlation_fail:
-	jtimer_teardown();
-jtimer_fail:
-	rfc6056_teardown();
-rfc6056_fail:
 	return error;
 }
 
@@ -74,15 +82,21 @@ static void teardown_common_modules(void)
 	/* (iptables packet handler already stopped by jool.ko/jool_siit.ko) */
 
 	/* Common */
+	joold_ring_teardown(); /* joold can no longer attach rings now */
 	nlhandler_teardown(); /* Userspace requests no longer handled now */
 	xlator_teardown(); /* Packets no longer handled by Netfilter now */
+	threaded_teardown(); /* Translates the queued packets */
+	jstat_teardown(); /* The stats files died with the instances */
+	denylist4_teardown();
 	xlation_teardown();
 	atomconfig_teardown();
+	capture_teardown();
 
-	/* NAT64 */
-	jtimer_teardown();
-	rfc6056_teardown();
+	/* NAT64 (The timer and RFC 6056 died with the last instance.) */
+	WARN(nat64_instances, "%u NAT64 instances survived the flush.",
+			nat64_instances);
 	joold_teardown();
+	natlog_teardown();
 	bib_teardown();
 }
 
@@ -124,6 +138,75 @@ void jool_nat64_put(void)
 }
 EXPORT_SYMBOL_GPL(jool_nat64_put);
 
+/*
+ * The NAT64 machinery: the RFC 6056 transform and the session timer. SIIT-only
+ * hosts never need them, so they only exist while there are NAT64 instances.
+ * (This also keeps the timer from waking up on idle hosts.)
+ */
+
+static int setup_nat64_modules(void)
+{
+	int error;
+
+	LOG_DEBUG("Initializing NAT64 modules.");
+
+	error = rfc6056_setup();
+	if (error)
+		return error;
+	error = jtimer_setup();
+	if (error) {
+		rfc6056_teardown();
+		return error;
+	}
+
+	return 0;
+}
+
+static void teardown_nat64_modules(void)
+{
+	LOG_DEBUG("Tearing down NAT64 modules.");
+
+	jtimer_teardown(); /* Waits for the cleaners. */
+	rfc6056_teardown();
+}
+
+/**
+ * Called whenever a NAT64 instance is added to the database. The first one
+ * sets up the NAT64 machinery.
+ *
+ * Process context only.
+ */
+int jool_nat64_machinery_get(void)
+{
+	int error = 0;
+
+	mutex_lock(&lock);
+	if (nat64_instances == 0)
+		error = setup_nat64_modules();
+	if (!error)
+		nat64_instances++;
+	mutex_unlock(&lock);
+
+	return error;
+}
+
+/**
+ * Reverts jool_nat64_machinery_get(). The last NAT64 instance tears the
+ * machinery down, so it must no longer be reachable by packets or cleaners.
+ *
+ * Process context only.
+ */
+void jool_nat64_machinery_put(void)
+{
+	mutex_lock(&lock);
+	if (!WARN(nat64_instances == 0, "Too many jool_nat64_machinery_put()s!")) {
+		nat64_instances--;
+		if (nat64_instances == 0)
+			teardown_nat64_modules();
+	}
+	mutex_unlock(&lock);
+}
+
 bool is_siit_enabled(void)
 {
 	int refs;
@@ -153,8 +236,11 @@ static int __init jool_init(void)
 	LOG_DEBUG("Inserting Core Jool...");
 
 	error = setup_common_modules();
-	if (error)
+	if (error) {
+		/* The threaded parameter was set before this. */
+		threaded_teardown();
 		return error;
+	}
 
 	log_info("Core Jool v" JOOL_VERSION_STR " module inserted.");
 	return 0;
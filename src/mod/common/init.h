@@ -8,6 +8,9 @@ void jool_siit_put(void);
 int jool_nat64_get(void (*defrag_enable)(struct net *ns));
 void jool_nat64_put(void);
 
+int jool_nat64_machinery_get(void);
+void jool_nat64_machinery_put(void);
+
 bool is_siit_enabled(void);
 bool is_nat64_enabled(void);
 
@@ -1,9 +1,20 @@
 #include "mod/common/joold.h"
 
+#include <linux/hrtimer.h>
 #include <linux/inet.h>
+#include <linux/jhash.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/wait_bit.h>
+#include <linux/workqueue.h>
 
 #include "common/constants.h"
+#include "mod/common/address.h"
+#include "mod/common/joold_ring.h"
+#include "mod/common/linux_version.h"
 #include "mod/common/log.h"
+#include "mod/common/reserve.h"
+#include "mod/common/rfc6052.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 #include "mod/common/nl/attribute.h"
@@ -19,33 +30,116 @@ struct counted_list {
 	unsigned int count;
 };
 
+#define JQF_AD_ONGOING (1 << 1) /** Advertisement requested by user? */
+
+/** Bit of joold_queue.pending: Is there a flush waiting in joold_wq? */
+#define JQP_FLUSH_SCHEDULED 0
+/** Bit of joold_queue.pending: Is somebody walking the BIB for the ad? */
+#define JQP_AD_PULLING 1
 /**
- * Can we send our packet yet?
- * (We need to wait for ACKs because the kernel can't handle too many
- * Netlink messages at once.)
+ * Bit of joold_queue.pending: Has ss-flush-window expired for the queued
+ * sessions? (Ie. can incomplete packets be sent?) Cleared when the queue
+ * empties.
  */
-#define JQF_ACK_RECEIVED (1 << 0)
-#define JQF_AD_ONGOING (1 << 1) /** Advertisement requested by user? */
+#define JQP_WINDOW_DUE 2
+
+/* ss-flush-window is capped to this; longer waits are the deadline's job. */
+#define JOOLD_MAX_WINDOW USEC_PER_SEC
+
+/* Buckets of the deferred session indexes. Has to be a power of two. */
+#define JOOLD_INDEX_SLOTS 64
+
+/**
+ * Sessions queued by a single CPU, not yet merged into joold_queue.deferred.
+ * The packet path only ever touches its own CPU's; the flush (which takes
+ * joold_queue.lock first) is the only one who visits the others.
+ */
+struct joold_local {
+	struct counted_list deferred;
+	/**
+	 * @deferred, hashed by session. A session updated several times before
+	 * the merge only gets one record; the latest one.
+	 */
+	struct hlist_head index[JOOLD_INDEX_SLOTS];
+	spinlock_t lock;
+};
+
+/**
+ * Position of an advertisement in the session database. The advertisement
+ * walks the tables a little at a time, so it resumes from here.
+ */
+struct ad_cursor {
+	/** Table being walked. Past L4PROTO_ICMP once the walk is over. */
+	l4_protocol proto;
+	/** Last session queued from @proto, if @resume. */
+	struct session_foreach_offset offset;
+	bool resume;
+	/** Bumped by every advertise and cancel; stale walks are discarded. */
+	unsigned int gen;
+};
 
 struct joold_queue {
 	unsigned int flags; /** JQF */
+	/** Protected by @lock. */
+	struct ad_cursor ad;
+
+	/** Queued sessions, merged from @local. Protected by @lock. */
+	struct counted_list deferred;
+	/** @deferred, hashed by session. (Advertised sessions aren't.) */
+	struct hlist_head index[JOOLD_INDEX_SLOTS];
+	struct joold_local __percpu *local;
+	/** JQP; atomic bitops only. */
+	unsigned long pending;
 
-	struct counted_list deferred; /** Queued sessions */
+	/**
+	 * Number of packets sent to userspace whose ACK hasn't arrived yet.
+	 * We can't have more than `ss-max-outstanding` of these at a time,
+	 * because the kernel can't handle too many Netlink messages at once.
+	 */
+	unsigned int outstanding;
 
 	/**
 	 * Jiffy at which the last batch of sessions was sent.
-	 * If the ACK was lost for some reason, this should get us back on
+	 * If the ACKs were lost for some reason, this should get us back on
 	 * track.
 	 */
 	unsigned long last_flush_time;
 
-	spinlock_t lock;
+	/**
+	 * The kernel transport, if the sessions are not going through joold.
+	 * Protected by @udp_lock, since every flush can sleep.
+	 */
+	struct joold_udp *udp;
+	/**
+	 * The shared memory joold is reading the sessions from, instead of the
+	 * multicast. (If not NULL.) Owned by joold's file; also protected by
+	 * @udp_lock.
+	 */
+	struct joold_ring *ring;
+	/*
+	 * The instance is gone, so no more UDP sockets. (See
+	 * joold_stop_transport().) Also protected by @udp_lock.
+	 */
+	bool stopped;
+	struct mutex udp_lock;
+
+	/** Expires when ss-flush-window does. Only armed along with @armed. */
+	struct hrtimer window;
+	/**
+	 * The flush @window will hand over to joold_wq. (Owns the
+	 * JQP_FLUSH_SCHEDULED bit.)
+	 */
+	struct joold_flush *armed;
+
+	struct jlock lock;
 	struct kref refs;
 };
 
 struct ad_arg {
-	struct joold_queue *queue;
-	struct list_head *ready;
+	struct counted_list chunk;
+	/** Maximum length of @chunk. */
+	unsigned int room;
+	struct ad_cursor cursor;
 };
 
 /**
@@ -56,12 +150,32 @@ struct deferred_session {
 	struct session_entry session;
 	/** List hook to joold_queue.deferred.  */
 	struct list_head lh;
+	/**
+	 * Hook to joold_local.index, then to joold_queue.index. (The former
+	 * is abandoned, not unhooked, during the merge.)
+	 */
+	struct hlist_node hh;
+};
+
+/**
+ * A request to flush a queue, from the packet path. (Which doesn't want to do
+ * it itself.)
+ */
+struct joold_flush {
+	/* Copy of the xlator, because the original is usually on the stack. */
+	struct xlator jool;
+	struct work_struct work;
 };
 
 static struct kmem_cache *deferred_cache;
+/* Sessions are deferred from the packet path. (See reserve.h.) */
+static struct obj_reserve *deferred_reserve;
+static struct workqueue_struct *joold_wq;
+/* Windows whose timer hasn't fired yet. joold_wq has to outlive them. */
+static atomic_t armed_windows = ATOMIC_INIT(0);
 
 #define ALLOC_DEFERRED \
-	wkmem_cache_alloc("joold session", deferred_cache, GFP_ATOMIC)
+	((struct deferred_session *)reserve_alloc(deferred_reserve))
 #define FREE_DEFERRED(deferred) \
 	wkmem_cache_free("joold session", deferred_cache, deferred)
 
@@ -74,11 +188,40 @@ static int joold_setup(void)
 {
 	deferred_cache = kmem_cache_create("joold_sessions",
 			sizeof(struct deferred_session), 0, 0, NULL);
-	return deferred_cache ? 0 : -EINVAL;
+	if (!deferred_cache)
+		return -EINVAL;
+
+	deferred_reserve = reserve_create("joold session", deferred_cache);
+	if (!deferred_reserve)
+		goto reserve_fail;
+
+	joold_wq = alloc_workqueue("jool_joold", WQ_UNBOUND, 0);
+	if (!joold_wq)
+		goto wq_fail;
+
+	return 0;
+
+wq_fail:
+	reserve_destroy(deferred_reserve);
+	deferred_reserve = NULL;
+reserve_fail:
+	kmem_cache_destroy(deferred_cache);
+	deferred_cache = NULL;
+	return -ENOMEM;
 }
 
 void joold_teardown(void)
 {
+	wait_var_event(&armed_windows, !atomic_read(&armed_windows));
+	if (joold_wq) {
+		/* Waits for (and drops the references of) pending flushes. */
+		destroy_workqueue(joold_wq);
+		joold_wq = NULL;
+	}
+	if (deferred_reserve) {
+		reserve_destroy(deferred_reserve);
+		deferred_reserve = NULL;
+	}
 	if (deferred_cache) {
 		kmem_cache_destroy(deferred_cache);
 		deferred_cache = NULL;
@@ -98,26 +241,51 @@ static void delete_sessions(struct list_head *sessions)
 /* "advertise session," not "add session." Although we're adding it too. */
 static int ad_session(struct session_entry const *_session, void *arg)
 {
-	struct counted_list *list;
+	struct ad_arg *ad = arg;
 	struct deferred_session *session;
 
+	/* Positive; stops the walk without looking like an error. */
+	if (ad->chunk.count >= ad->room)
+		return 1;
+
 	session = ALLOC_DEFERRED;
 	if (!session)
 		return -ENOMEM;
 	session->session = *_session;
+	INIT_HLIST_NODE(&session->hh);
+
+	list_add_tail(&session->lh, &ad->chunk.list);
+	ad->chunk.count++;
 
-	list = arg;
-	list_add_tail(&session->lh, &list->list);
-	list->count++;
+	ad->cursor.offset.offset.src = _session->src4;
+	ad->cursor.offset.offset.dst = _session->dst4;
+	ad->cursor.offset.include_offset = false;
+	ad->cursor.resume = true;
 	return 0;
 }
 
-static bool should_send(struct xlator *jool)
+/* Maximum number of packets we're allowed to have on the fly. */
+static unsigned int get_window(struct xlator *jool)
+{
+	return max(GLOBALS(jool).max_outstanding, 1u);
+}
+
+static unsigned int get_sessions_per_pkt(struct xlator *jool)
+{
+	return max(GLOBALS(jool).max_sessions_per_pkt, 1u);
+}
+
+/**
+ * Returns true if (at least) one packet should be sent now.
+ * @partial will tell whether the last packet is allowed to be incomplete.
+ */
+static bool should_send(struct xlator *jool, bool *partial)
 {
 	struct joold_queue *queue;
 	unsigned long deadline;
 
 	queue = jool->nat64.joold;
+	*partial = true;
 
 	if (queue->deferred.count == 0) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_EMPTY);
@@ -127,10 +295,12 @@ static bool should_send(struct xlator *jool)
 	deadline = msecs_to_jiffies(GLOBALS(jool).flush_deadline);
 	if (time_before(queue->last_flush_time + deadline, jiffies)) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_TIMEOUT);
+		/* The ACKs are probably never coming; reclaim the window. */
+		queue->outstanding = 0;
 		return true;
 	}
 
-	if (!(queue->flags & JQF_ACK_RECEIVED)) {
+	if (queue->outstanding >= get_window(jool)) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_MISSING_ACK);
 		return false;
 	}
@@ -140,13 +310,19 @@ static bool should_send(struct xlator *jool)
 		return true;
 	}
 
-	if (GLOBALS(jool).flush_asap) {
+	if (GLOBALS(jool).flush_window) {
+		if (test_bit(JQP_WINDOW_DUE, &queue->pending)) {
+			jstat_inc(jool->stats, JSTAT_JOOLD_WINDOW);
+			return true;
+		}
+	} else if (GLOBALS(jool).flush_asap) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_FLUSH_ASAP);
 		return true;
 	}
 
-	if (queue->deferred.count >= GLOBALS(jool).max_sessions_per_pkt) {
+	if (queue->deferred.count >= get_sessions_per_pkt(jool)) {
 		jstat_inc(jool->stats, JSTAT_JOOLD_PKT_FULL);
+		*partial = false;
 		return true;
 	}
 
@@ -156,54 +332,150 @@ static bool should_send(struct xlator *jool)
 
 static bool too_many_sessions(struct xlator *jool)
 {
-	struct joold_queue *queue = jool->nat64.joold;
+	return jool->nat64.joold->deferred.count >= GLOBALS(jool).capacity;
+}
 
-	if (queue->flags & JQF_AD_ONGOING)
-		return false;
+static void report_drop(struct xlator *jool)
+{
+	log_warn_once("joold: Too many sessions deferred! I need to drop some; sorry.");
+	jstat_inc(jool->stats, JSTAT_JOOLD_SSS_ENOSPC);
+}
+
+static void drop_session(struct xlator *jool, struct deferred_session *session)
+{
+	report_drop(jool);
+	FREE_DEFERRED(session);
+}
+
+/*
+ * Sessions are unique by IPv4 addresses and protocol, so there's no need to
+ * hash the IPv6 side.
+ */
+static struct hlist_head *get_bucket(struct hlist_head *index,
+		struct session_entry const *session)
+{
+	__u32 hash;
+
+	hash = jhash_3words(session->src4.l3.s_addr, session->dst4.l3.s_addr,
+			(session->src4.l4 << 16) | session->dst4.l4,
+			session->proto);
+	return &index[hash & (JOOLD_INDEX_SLOTS - 1)];
+}
+
+static struct deferred_session *find_deferred(struct hlist_head *index,
+		struct session_entry const *session)
+{
+	struct deferred_session *deferred;
+
+	hlist_for_each_entry(deferred, get_bucket(index, session), hh)
+		if (session_equals(&deferred->session, session))
+			return deferred;
+
+	return NULL;
+}
 
-	return queue->deferred.count >= GLOBALS(jool).capacity;
+static void reset_index(struct hlist_head *index)
+{
+	unsigned int i;
+
+	for (i = 0; i < JOOLD_INDEX_SLOTS; i++)
+		INIT_HLIST_HEAD(&index[i]);
 }
 
 /**
- * Always swallows @session, can be NULL.
- * Assumes the lock is held.
- * You have to send_to_userspace(@jool, @prepared) after releasing the spinlock.
+ * Moves the sessions queued by the CPUs to the main list. Updates of sessions
+ * the main list already has overwrite them.
+ * Assumes the queue lock is held.
  */
-static void send_to_userspace_prepare(struct xlator *jool,
-		struct deferred_session *session,
-		struct list_head *prepared)
+static void merge_local_sessions(struct xlator *jool)
 {
 	struct joold_queue *queue;
-	struct list_head *cut;
-	unsigned int d;
+	struct joold_local *local;
+	struct deferred_session *session;
+	struct deferred_session *queued;
+	struct list_head sessions;
+	unsigned int coalesced;
+	unsigned int cpu;
 
 	queue = jool->nat64.joold;
+	INIT_LIST_HEAD(&sessions);
+
+	for_each_possible_cpu(cpu) {
+		local = per_cpu_ptr(queue->local, cpu);
+		spin_lock(&local->lock);
+		list_splice_tail_init(&local->deferred.list, &sessions);
+		local->deferred.count = 0;
+		reset_index(local->index);
+		spin_unlock(&local->lock);
+	}
 
-	if (session) {
-		if (too_many_sessions(jool)) {
-			log_warn_once("joold: Too many sessions deferred! I need to drop some; sorry.");
-			jstat_inc(jool->stats, JSTAT_JOOLD_SSS_ENOSPC);
+	coalesced = 0;
+	while (!list_empty(&sessions)) {
+		session = first_deferred(&sessions);
+		list_del(&session->lh);
+
+		queued = find_deferred(queue->index, &session->session);
+		if (queued) {
+			queued->session = session->session;
 			FREE_DEFERRED(session);
+			coalesced++;
+		} else if (too_many_sessions(jool)) {
+			drop_session(jool, session);
 		} else {
 			list_add_tail(&session->lh, &queue->deferred.list);
+			hlist_add_head(&session->hh, get_bucket(queue->index,
+					&session->session));
 			queue->deferred.count++;
 		}
 	}
 
-	if (!should_send(jool))
-		return;
+	if (coalesced)
+		jstat_add(jool->stats, JSTAT_JOOLD_SSS_COALESCED, coalesced);
+}
+
+/**
+ * Assumes the lock is held.
+ * You have to send_to_userspace(@jool, @prepared) after releasing the spinlock.
+ */
+static void send_to_userspace_prepare(struct xlator *jool,
+		struct list_head *prepared)
+{
+	struct joold_queue *queue;
+	struct deferred_session *session;
+	struct list_head *cut;
+	unsigned int per_pkt;
+	unsigned int total;
+	unsigned int d;
+	bool partial;
+
+	queue = jool->nat64.joold;
+
+	merge_local_sessions(jool);
+
+	if (!should_send(jool, &partial))
+		goto end;
+
+	/* Fill as much of the window as we can. */
+	per_pkt = get_sessions_per_pkt(jool);
+	total = (get_window(jool) - queue->outstanding) * per_pkt;
+	if (queue->deferred.count < total)
+		total = queue->deferred.count;
+	if (!partial)
+		total -= total % per_pkt;
 
-	if (queue->deferred.count <= GLOBALS(jool).max_sessions_per_pkt) {
+	if (total == queue->deferred.count) {
 		cut = queue->deferred.list.prev;
-		d = queue->deferred.count;
 	} else {
 		cut = &queue->deferred.list;
-		for (d = 0; d < GLOBALS(jool).max_sessions_per_pkt; d++)
+		for (d = 0; d < total; d++)
 			cut = cut->next;
 	}
 
 	list_cut_position(prepared, &queue->deferred.list, cut);
-	queue->deferred.count -= d;
+	queue->deferred.count -= total;
+	/* Further updates of these sessions need to be sent again. */
+	list_for_each_entry(session, prepared, lh)
+		hlist_del_init(&session->hh);
 
 	/*
 	 * BTW: This sucks.
@@ -212,28 +484,84 @@ static void send_to_userspace_prepare(struct xlator *jool,
 	 * But the alternative is to do the nlcore_send_multicast_message()
 	 * with the lock held, and I don't have the stomach for that.
 	 */
-	queue->flags &= ~JQF_ACK_RECEIVED;
-	if (queue->deferred.count == 0)
-		queue->flags &= ~JQF_AD_ONGOING;
-	queue->last_flush_time = jiffies;
+	queue->outstanding += DIV_ROUND_UP(total, per_pkt);
+	WRITE_ONCE(queue->last_flush_time, jiffies);
+
+end:
+	if (queue->deferred.count == 0) {
+		/* The next session gets a fresh window. */
+		clear_bit(JQP_WINDOW_DUE, &queue->pending);
+		/*
+		 * The advertisement is over once the walk is, and its tail is
+		 * gone.
+		 */
+		if (queue->ad.proto > L4PROTO_ICMP)
+			queue->flags &= ~JQF_AD_ONGOING;
+	}
 }
 
 /*
+ * Can the batch carry dst4 instead of dst6? (It usually should, in NAT64; dst6
+ * is pool6 + dst4, unless the session belongs to a pool6-tenant.)
+ */
+static bool can_elide_dst6(struct xlator *jool, struct list_head *sessions)
+{
+	struct deferred_session *session;
+	struct in6_addr dst6;
+
+	if (!jool->globals.pool6.set)
+		return false;
+
+	list_for_each_entry(session, sessions, lh) {
+		if (__rfc6052_4to6(&jool->globals.pool6.prefix,
+				&session->session.dst4.l3, &dst6))
+			return false;
+		if (!addr6_equals(&dst6, &session->session.dst6.l3))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Writes @sessions (@count of them) as a JNLAL_SESSION_BATCH's payload.
  * Swallows ownership of the sessions.
  */
-static void send_to_userspace(struct xlator *jool, struct list_head *sessions)
+static void write_batch(struct xlator *jool, struct list_head *sessions,
+		unsigned int count, bool elide_dst6, __u8 *buffer)
+{
+	struct deferred_session *session;
+
+	jnla_write_session_batch_hdr(buffer, count, elide_dst6);
+	buffer += jnla_session_batch_size(0, elide_dst6);
+	while (!list_empty(sessions)) {
+		session = first_deferred(sessions);
+		buffer += jnla_write_session_record(buffer, &session->session,
+				elide_dst6);
+		list_del(&session->lh);
+		FREE_DEFERRED(session);
+	}
+
+	jstat_add(jool->stats, JSTAT_JOOLD_SSS_SENT, count);
+	jstat_inc(jool->stats, JSTAT_JOOLD_PKT_SENT);
+}
+
+/*
+ * Multicasts @sessions to joold, in a single Netlink message.
+ */
+static void send_batch_nl(struct xlator *jool, struct list_head *sessions,
+		unsigned int count, bool elide_dst6)
 {
 	struct sk_buff *skb;
 	struct joolnlhdr *jhdr;
 	struct nlattr *root;
-	struct deferred_session *session;
-	int count;
-	int error;
+	struct nlattr *batch;
+	size_t size;
 
-	if (list_empty(sessions))
-		return;
+	size = jnla_session_batch_size(count, elide_dst6);
 
-	skb = genlmsg_new(1500, GFP_ATOMIC);
+	skb = genlmsg_new(sizeof(struct joolnlhdr)
+			+ nla_total_size(nla_total_size(size)), GFP_ATOMIC);
 	if (!skb)
 		goto revert_list;
 
@@ -250,20 +578,11 @@ static void send_to_userspace(struct xlator *jool, struct list_head *sessions)
 	root = nla_nest_start(skb, JNLAR_SESSION_ENTRIES);
 	if (WARN(!root, "nla_nest_start() returned NULL"))
 		goto revert_skb;
+	batch = nla_reserve(skb, JNLAL_SESSION_BATCH, size);
+	if (WARN(!batch, "nla_reserve() returned NULL"))
+		goto revert_skb;
 
-	count = 0;
-	while (!list_empty(sessions)) {
-		session = first_deferred(sessions);
-		error = jnla_put_session_joold(skb, JNLAL_ENTRY, &session->session);
-		if (WARN(error, "jnla_put_session() returned %d", error))
-			goto revert_skb;
-		list_del(&session->lh);
-		FREE_DEFERRED(session);
-		count++;
-	}
-
-	jstat_add(jool->stats, JSTAT_JOOLD_SSS_SENT, count);
-	jstat_inc(jool->stats, JSTAT_JOOLD_PKT_SENT);
+	write_batch(jool, sessions, count, elide_dst6, nla_data(batch));
 
 	nla_nest_end(skb, root);
 	genlmsg_end(skb, jhdr);
@@ -276,12 +595,195 @@ revert_list:
 	delete_sessions(sessions);
 }
 
+/*
+ * Writes @sessions as a standalone JNLAL_SESSION_BATCH, whose payload is @size
+ * bytes long. It's the joold datagram: the content of the Netlink message's
+ * JNLAR_SESSION_ENTRIES. Swallows ownership of the sessions.
+ */
+static void write_datagram(struct xlator *jool, struct list_head *sessions,
+		unsigned int count, bool elide_dst6, struct nlattr *batch,
+		size_t size)
+{
+	batch->nla_type = JNLAL_SESSION_BATCH;
+	batch->nla_len = nla_attr_size(size);
+	memset((__u8 *)batch + nla_attr_size(size), 0,
+			nla_padlen(nla_attr_size(size)));
+	write_batch(jool, sessions, count, elide_dst6, nla_data(batch));
+}
+
+/*
+ * Sends @sessions to the peer, through the kernel transport. The datagram is
+ * the same joold would have sent.
+ */
+static void send_batch_udp(struct xlator *jool, struct joold_udp *udp,
+		struct list_head *sessions, unsigned int count, bool elide_dst6)
+{
+	struct nlattr *batch;
+	size_t size;
+	int error;
+
+	size = jnla_session_batch_size(count, elide_dst6);
+	batch = __wkmalloc("joold datagram", nla_total_size(size), GFP_KERNEL);
+	if (!batch) {
+		delete_sessions(sessions);
+		return;
+	}
+
+	write_datagram(jool, sessions, count, elide_dst6, batch, size);
+
+	error = joold_udp_send(udp, batch, nla_total_size(size));
+	if (error)
+		log_warn_once("joold: Cannot send sessions to the peer (error %d).",
+				error);
+
+	__wkfree("joold datagram", batch);
+}
+
+/*
+ * Writes @sessions' datagram straight into joold's ring. Returns false if it
+ * didn't fit. (In which case the sessions are lost, as if the network had
+ * dropped them.)
+ */
+static bool send_batch_ring(struct xlator *jool, struct joold_ring *ring,
+		struct list_head *sessions, unsigned int count, bool elide_dst6)
+{
+	struct nlattr *batch;
+	size_t size;
+
+	size = jnla_session_batch_size(count, elide_dst6);
+	batch = joold_ring_reserve(ring, nla_total_size(size));
+	if (!batch) {
+		jstat_inc(jool->stats, JSTAT_JOOLD_RING_FULL);
+		delete_sessions(sessions);
+		return false;
+	}
+
+	write_datagram(jool, sessions, count, elide_dst6, batch, size);
+	joold_ring_commit(ring);
+	return true;
+}
+
+/*
+ * Sends @sessions in a single packet. Swallows ownership of the sessions.
+ * Returns true if nobody is going to ACK the packet.
+ */
+static bool send_batch(struct xlator *jool, struct joold_queue *queue,
+		struct list_head *sessions)
+{
+	struct deferred_session *session;
+	unsigned int count;
+	bool elide_dst6;
+
+	if (list_empty(sessions))
+		return false;
+
+	count = 0;
+	list_for_each_entry(session, sessions, lh)
+		count++;
+	elide_dst6 = can_elide_dst6(jool, sessions);
+
+	if (queue->udp) {
+		send_batch_udp(jool, queue->udp, sessions, count, elide_dst6);
+		return true;
+	}
+	if (queue->ring)
+		return !send_batch_ring(jool, queue->ring, sessions, count,
+				elide_dst6);
+
+	send_batch_nl(jool, sessions, count, elide_dst6);
+	return false;
+}
+
+/*
+ * Sends @sessions in as many packets as they need. Swallows ownership of the
+ * sessions.
+ *
+ * Returns the number of packets that will never be ACKed. (The ones that went
+ * through the kernel transport, and the ones that didn't fit in the ring.)
+ */
+static unsigned int send_to_userspace(struct xlator *jool,
+		struct list_head *sessions)
+{
+	struct joold_queue *queue;
+	struct list_head batch;
+	struct list_head *cut;
+	unsigned int per_pkt;
+	unsigned int unacked;
+	unsigned int d;
+
+	if (list_empty(sessions))
+		return 0;
+
+	queue = jool->nat64.joold;
+	per_pkt = get_sessions_per_pkt(jool);
+	unacked = 0;
+
+	mutex_lock(&queue->udp_lock);
+	while (!list_empty(sessions)) {
+		cut = sessions;
+		for (d = 0; d < per_pkt; d++) {
+			if (cut->next == sessions)
+				break;
+			cut = cut->next;
+		}
+
+		INIT_LIST_HEAD(&batch);
+		list_cut_position(&batch, sessions, cut);
+		if (send_batch(jool, queue, &batch))
+			unacked++;
+	}
+	/* One wake-up for all the batches. */
+	if (!queue->udp && queue->ring)
+		joold_ring_wake(queue->ring);
+	mutex_unlock(&queue->udp_lock);
+
+	return unacked;
+}
+
+static void window_done(void)
+{
+	if (atomic_dec_and_test(&armed_windows))
+		wake_up_var(&armed_windows);
+}
+
+/* Lets the queued sessions out, and hands the armed flush to joold_wq. */
+static void fire_window(struct joold_queue *queue)
+{
+	struct joold_flush *flush;
+
+	set_bit(JQP_WINDOW_DUE, &queue->pending);
+	flush = xchg(&queue->armed, NULL);
+	if (flush)
+		queue_work(joold_wq, &flush->work);
+	window_done();
+}
+
+static enum hrtimer_restart window_fn(struct hrtimer *timer)
+{
+	fire_window(container_of(timer, struct joold_queue, window));
+	return HRTIMER_NORESTART;
+}
+
+static void init_window(struct joold_queue *queue)
+{
+	/* Soft; queueing the flush has no business in hardirq context. */
+#if LINUX_VERSION_AT_LEAST(6, 13, 0, 9999, 0)
+	hrtimer_setup(&queue->window, window_fn, CLOCK_MONOTONIC,
+			HRTIMER_MODE_REL_SOFT);
+#else
+	hrtimer_init(&queue->window, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	queue->window.function = window_fn;
+#endif
+}
+
 /**
  * joold_create - Constructor for joold_queue structs.
  */
 struct joold_queue *joold_alloc(void)
 {
 	struct joold_queue *queue;
+	struct joold_local *local;
+	unsigned int cpu;
 	bool cache_created;
 
 	cache_created = false;
@@ -292,20 +794,47 @@ struct joold_queue *joold_alloc(void)
 	}
 
 	queue = wkmalloc(struct joold_queue, GFP_KERNEL);
-	if (!queue) {
-		if (cache_created)
-			joold_teardown();
-		return NULL;
+	if (!queue)
+		goto queue_fail;
+	queue->local = alloc_percpu(struct joold_local);
+	if (!queue->local)
+		goto local_fail;
+
+	for_each_possible_cpu(cpu) {
+		local = per_cpu_ptr(queue->local, cpu);
+		INIT_LIST_HEAD(&local->deferred.list);
+		local->deferred.count = 0;
+		reset_index(local->index);
+		spin_lock_init(&local->lock);
 	}
 
-	queue->flags = JQF_ACK_RECEIVED;
+	queue->flags = 0;
+	queue->ad.proto = L4PROTO_OTHER;
+	queue->ad.resume = false;
+	queue->ad.gen = 0;
 	INIT_LIST_HEAD(&queue->deferred.list);
 	queue->deferred.count = 0;
+	reset_index(queue->index);
+	queue->pending = 0;
+	queue->outstanding = 0;
 	queue->last_flush_time = jiffies;
-	spin_lock_init(&queue->lock);
+	queue->udp = NULL;
+	queue->ring = NULL;
+	queue->stopped = false;
+	mutex_init(&queue->udp_lock);
+	init_window(queue);
+	queue->armed = NULL;
+	jlock_init(&queue->lock);
 	kref_init(&queue->refs);
 
 	return queue;
+
+local_fail:
+	wkfree(struct joold_queue, queue);
+queue_fail:
+	if (cache_created)
+		joold_teardown();
+	return NULL;
 }
 
 void joold_get(struct joold_queue *queue)
@@ -316,7 +845,14 @@ void joold_get(struct joold_queue *queue)
 static void joold_release(struct kref *refs)
 {
 	struct joold_queue *queue;
+	unsigned int cpu;
+
 	queue = container_of(refs, struct joold_queue, refs);
+	if (queue->udp)
+		joold_udp_stop(queue->udp);
+	for_each_possible_cpu(cpu)
+		delete_sessions(&per_cpu_ptr(queue->local, cpu)->deferred.list);
+	free_percpu(queue->local);
 	delete_sessions(&queue->deferred.list);
 	wkfree(struct joold_queue, queue);
 }
@@ -327,87 +863,490 @@ void joold_put(struct joold_queue *queue)
 }
 
 /**
- * joold_add - Add @session to @jool->nat64.joold.
+ * joold_memory - Returns the number of sessions @queue (and its CPUs) have yet
+ * to send, and the bytes they take.
  *
- * This is the function that gets called whenever a packet translation
- * successfully triggers the creation of a session entry. @session will be sent
- * to the joold daemon.
+ * Reads the counts without locking, so it's only an estimate.
  */
-void joold_add(struct xlator *jool, struct session_entry *_session)
+void joold_memory(struct joold_queue *queue, __u64 *sessions, __u64 *bytes)
 {
-	struct joold_queue *queue;
-	struct deferred_session *session;
-	struct list_head prepared;
-
-	if (!GLOBALS(jool).enabled)
-		return;
+	unsigned int cpu;
 
-	session = ALLOC_DEFERRED;
-	if (!session)
-		return;
-	session->session = *_session;
-	queue = jool->nat64.joold;
-	INIT_LIST_HEAD(&prepared);
+	*sessions = READ_ONCE(queue->deferred.count);
+	for_each_possible_cpu(cpu)
+		*sessions += READ_ONCE(per_cpu_ptr(queue->local, cpu)
+				->deferred.count);
 
-	spin_lock_bh(&queue->lock);
-	send_to_userspace_prepare(jool, session, &prepared);
-	spin_unlock_bh(&queue->lock);
+	*bytes = *sessions * kmem_cache_size(deferred_cache);
+}
 
-	send_to_userspace(jool, &prepared);
-	jstat_inc(jool->stats, JSTAT_JOOLD_SSS_QUEUED);
+void joold_lock_stats(struct joold_queue *queue, struct jlock_stats *result)
+{
+	memset(result, 0, sizeof(*result));
+	jlock_query(&queue->lock, result);
 }
 
-struct add_params {
-	struct session_entry new;
+/*
+ * How many advertised sessions can be queued right now; as many as the window
+ * can send right away, minus whatever is already waiting.
+ * Assumes the queue lock is held.
+ */
+static unsigned int get_ad_room(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	unsigned int window;
+	unsigned int budget;
+
+	queue = jool->nat64.joold;
+	if (!(queue->flags & JQF_AD_ONGOING) || queue->ad.proto > L4PROTO_ICMP)
+		return 0;
+
+	window = get_window(jool);
+	if (queue->outstanding >= window)
+		return 0;
+
+	budget = (window - queue->outstanding) * get_sessions_per_pkt(jool);
+	return (budget > queue->deferred.count)
+			? (budget - queue->deferred.count)
+			: 0;
+}
+
+/*
+ * Queues the next stretch of the advertisement, resuming the walk from the
+ * cursor. The advertisement is therefore paced by the ACKs, and never needs
+ * more memory than one window's worth of sessions.
+ *
+ * Walks the BIB, so the queue lock must not be held.
+ */
+static void ad_pull(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	struct ad_arg arg;
+	struct session_foreach_offset offset;
+	bool stale;
+	int error;
+
+	queue = jool->nat64.joold;
+	/* Somebody else is already walking; they will fill the window. */
+	if (test_and_set_bit(JQP_AD_PULLING, &queue->pending))
+		return;
+
+again:
+	jlock_lock_bh(&queue->lock);
+	arg.room = get_ad_room(jool);
+	arg.cursor = queue->ad;
+	jlock_unlock_bh(&queue->lock);
+
+	if (arg.room == 0)
+		goto end;
+
+	INIT_LIST_HEAD(&arg.chunk.list);
+	arg.chunk.count = 0;
+
+	while (arg.chunk.count < arg.room && arg.cursor.proto <= L4PROTO_ICMP) {
+		/* ad_session() moves the cursor during the walk. */
+		offset = arg.cursor.offset;
+		error = bib_foreach_session(jool, arg.cursor.proto, ad_session,
+				&arg, arg.cursor.resume ? &offset : NULL);
+		if (error > 0)
+			break; /* Chunk full */
+		if (error < 0) {
+			log_err("joold advertisement interrupted: error %d",
+					error);
+			arg.cursor.proto = L4PROTO_OTHER;
+			break;
+		}
+
+		arg.cursor.proto++;
+		arg.cursor.resume = false;
+	}
+
+	jlock_lock_bh(&queue->lock);
+	/* Was the advertisement cancelled or restarted during the walk? */
+	stale = queue->ad.gen != arg.cursor.gen;
+	if (!stale) {
+		queue->ad = arg.cursor;
+		list_splice_tail_init(&arg.chunk.list, &queue->deferred.list);
+		queue->deferred.count += arg.chunk.count;
+	}
+	jlock_unlock_bh(&queue->lock);
+
+	if (stale) {
+		delete_sessions(&arg.chunk.list);
+		goto again;
+	}
+
+end:
+	clear_bit(JQP_AD_PULLING, &queue->pending);
+}
+
+/*
+ * Merges the CPUs' sessions, resumes the advertisement if there's one, and
+ * sends whatever is ready.
+ */
+/* Can sleep. */
+static void joold_flush(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	struct list_head prepared;
+	unsigned int self_acked;
+	bool more;
+
+	queue = jool->nat64.joold;
+
+	do {
+		INIT_LIST_HEAD(&prepared);
+
+		ad_pull(jool);
+
+		jlock_lock_bh(&queue->lock);
+		send_to_userspace_prepare(jool, &prepared);
+		jlock_unlock_bh(&queue->lock);
+
+		/*
+		 * Nobody ACKs the kernel transport's packets, so they're
+		 * ACKed here; the window paces the loop, not the peer.
+		 */
+		self_acked = send_to_userspace(jool, &prepared);
+		if (!self_acked)
+			return;
+
+		jlock_lock_bh(&queue->lock);
+		queue->outstanding -= min(queue->outstanding, self_acked);
+		more = queue->deferred.count > 0
+				|| (queue->flags & JQF_AD_ONGOING);
+		jlock_unlock_bh(&queue->lock);
+
+		cond_resched();
+	} while (more);
+}
+
+#ifdef UNIT_TESTING
+
+/*
+ * The unit tests want to see the effects of every joold_add() right away, so
+ * they don't get the workqueue.
+ */
+static bool flush_wanted(struct xlator *jool, unsigned int local_count)
+{
+	return true;
+}
+
+static void request_flush(struct xlator *jool)
+{
+	joold_flush(jool);
+}
+
+static void request_window_flush(struct xlator *jool)
+{
+	set_bit(JQP_WINDOW_DUE, &jool->nat64.joold->pending);
+	joold_flush(jool);
+}
+
+#else
+
+/*
+ * Called from the packet path, so it's only a hint. It's not a big deal if it
+ * misses, as the ACKs and the timer will also flush.
+ */
+static bool flush_wanted(struct xlator *jool, unsigned int local_count)
+{
+	struct joold_queue *queue;
+	unsigned long deadline;
+
+	queue = jool->nat64.joold;
+
+	/* Nothing can be sent until an ACK arrives, and it will flush. */
+	if (READ_ONCE(queue->outstanding) >= get_window(jool))
+		return false;
+
+	if (local_count >= get_sessions_per_pkt(jool))
+		return true;
+	/* request_window_flush() will take care of it. */
+	if (GLOBALS(jool).flush_window)
+		return false;
+	if (GLOBALS(jool).flush_asap)
+		return true;
+
+	deadline = msecs_to_jiffies(GLOBALS(jool).flush_deadline);
+	return time_before(READ_ONCE(queue->last_flush_time) + deadline,
+			jiffies);
+}
+
+static void flush_work_fn(struct work_struct *work)
+{
+	struct joold_flush *flush;
+
+	flush = container_of(work, struct joold_flush, work);
+
+	/*
+	 * Clear first; sessions queued from now on, which the flush might
+	 * miss, can schedule another one.
+	 */
+	clear_bit(JQP_FLUSH_SCHEDULED, &flush->jool.nat64.joold->pending);
+	smp_mb__after_atomic();
+
+	joold_flush(&flush->jool);
+
+	put_net(flush->jool.ns);
+	xlator_put(&flush->jool);
+	wkfree(struct joold_flush, flush);
+}
+
+static struct joold_flush *alloc_flush(struct xlator *jool)
+{
+	struct joold_flush *flush;
+
+	flush = wkmalloc(struct joold_flush, GFP_ATOMIC);
+	if (!flush)
+		return NULL;
+	/* The namespace might be dying; see the note in struct xlator. */
+	if (!maybe_get_net(jool->ns)) {
+		wkfree(struct joold_flush, flush);
+		return NULL;
+	}
+
+	memcpy(&flush->jool, jool, sizeof(*jool));
+	xlator_get(&flush->jool);
+	INIT_WORK(&flush->work, flush_work_fn);
+	return flush;
+}
+
+/* Hands the flush over to joold_wq, unless it already has one pending. */
+static void request_flush(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	struct joold_flush *flush;
+
+	queue = jool->nat64.joold;
+	if (test_and_set_bit(JQP_FLUSH_SCHEDULED, &queue->pending)) {
+		/* If the pending one is waiting for a window, cut it short. */
+		if (READ_ONCE(queue->armed)
+				&& hrtimer_try_to_cancel(&queue->window) == 1)
+			fire_window(queue);
+		return;
+	}
+
+	flush = alloc_flush(jool);
+	if (!flush)
+		goto fail;
+	queue_work(joold_wq, &flush->work);
+	return;
+
+fail:
+	/* The timer will get to the sessions eventually. */
+	clear_bit(JQP_FLUSH_SCHEDULED, &queue->pending);
+}
+
+/*
+ * Same as request_flush(), except the flush waits ss-flush-window
+ * microseconds for more sessions. If a flush is already pending, the sessions
+ * will just join it.
+ */
+static void request_window_flush(struct xlator *jool)
+{
+	struct joold_queue *queue;
+	struct joold_flush *flush;
+	u64 window;
+
+	queue = jool->nat64.joold;
+	if (test_and_set_bit(JQP_FLUSH_SCHEDULED, &queue->pending))
+		return;
+
+	flush = alloc_flush(jool);
+	if (!flush) {
+		clear_bit(JQP_FLUSH_SCHEDULED, &queue->pending);
+		return;
+	}
+
+	atomic_inc(&armed_windows);
+	WRITE_ONCE(queue->armed, flush);
+	window = min_t(__u32, GLOBALS(jool).flush_window, JOOLD_MAX_WINDOW);
+	hrtimer_start(&queue->window, ns_to_ktime(window * NSEC_PER_USEC),
+			HRTIMER_MODE_REL_SOFT);
+}
+
+#endif
+
+/* Do the sync policies allow @session to be synchronized? */
+static bool should_sync(struct xlator *jool, struct session_entry *session)
+{
+	unsigned long min_age;
+
+	switch (session->proto) {
+	case L4PROTO_TCP:
+		if (!GLOBALS(jool).sync_tcp)
+			return false;
+		if (GLOBALS(jool).established_only
+				&& session->state != ESTABLISHED)
+			return false;
+		break;
+	case L4PROTO_UDP:
+		if (!GLOBALS(jool).sync_udp)
+			return false;
+		break;
+	case L4PROTO_ICMP:
+		if (!GLOBALS(jool).sync_icmp)
+			return false;
+		break;
+	case L4PROTO_OTHER:
+		return false;
+	}
+
+	min_age = msecs_to_jiffies(GLOBALS(jool).min_age);
+	return !min_age || !session->create_time
+			|| !time_before(jiffies, session->create_time + min_age);
+}
+
+/**
+ * joold_add - Add @session to @jool->nat64.joold.
+ *
+ * This is the function that gets called whenever a packet translation
+ * successfully triggers the creation of a session entry. @session will be sent
+ * to the joold daemon.
+ *
+ * The session is queued on the current CPU; the merge and the packet building
+ * happen later, during a flush. If the CPU still has an older update of the
+ * same session queued, the new one replaces it.
+ */
+void joold_add(struct xlator *jool, struct session_entry *_session)
+{
+	struct joold_local *local;
+	struct deferred_session *session;
+	bool coalesced;
+	bool full;
+	unsigned int count;
+
+	if (!GLOBALS(jool).enabled)
+		return;
+	if (!should_sync(jool, _session)) {
+		jstat_inc(jool->stats, JSTAT_JOOLD_SSS_FILTERED);
+		return;
+	}
+
+	coalesced = false;
+	full = false;
+	count = 0;
+
+	local_bh_disable();
+	local = this_cpu_ptr(jool->nat64.joold->local);
+	spin_lock(&local->lock);
+
+	session = find_deferred(local->index, _session);
+	if (session) {
+		session->session = *_session;
+		coalesced = true;
+	} else if (local->deferred.count < GLOBALS(jool).capacity) {
+		/*
+		 * Give the CPU the whole capacity; the merge will enforce the
+		 * total.
+		 */
+		session = ALLOC_DEFERRED;
+		if (session) {
+			session->session = *_session;
+			list_add_tail(&session->lh, &local->deferred.list);
+			hlist_add_head(&session->hh,
+					get_bucket(local->index, _session));
+			count = ++local->deferred.count;
+		}
+	} else {
+		full = true;
+	}
+
+	spin_unlock(&local->lock);
+	local_bh_enable();
+
+	if (coalesced) {
+		jstat_inc(jool->stats, JSTAT_JOOLD_SSS_COALESCED);
+		return;
+	}
+	if (!count) {
+		if (full)
+			report_drop(jool);
+		return;
+	}
+
+	jstat_inc(jool->stats, JSTAT_JOOLD_SSS_QUEUED);
+	if (flush_wanted(jool, count))
+		request_flush(jool);
+	else if (GLOBALS(jool).flush_window)
+		request_window_flush(jool);
+}
+
+/* Sessions handed to bib_sync() at a time. */
+#define SYNC_CHUNK 256
+
+struct sync_args {
+	struct xlator *jool;
+	/* Decoded, but not yet added. */
+	struct session_entry *sessions;
+	unsigned int count;
+	/* Length of @sessions. */
+	unsigned int capacity;
+	int rcvd;
 	bool success;
 };
 
-static enum session_fate collision_cb(struct session_entry *old, void *arg)
+static enum session_fate collision_cb(struct session_entry *old,
+		struct session_entry const *new, void *arg)
 {
-	struct add_params *params = arg;
-	struct session_entry *new = &params->new;
+	struct sync_args *args = arg;
 
 	if (session_equals(old, new)) { /* It's the same session; update it. */
 		old->state = new->state;
 		old->timer_type = new->timer_type;
 		old->update_time = new->update_time;
-		params->success = true;
 		return FATE_TIMER_SLOW;
 	}
 
 	log_warn_once("We're out of sync: Incoming session entry " SEPP
 			" collides with DB entry " SEPP ".",
 			SEPA(new), SEPA(old));
-	params->success = false;
+	args->success = false;
 	return FATE_PRESERVE;
 }
 
-static bool add_new_session(struct xlator *jool, struct nlattr *attr)
+static void flush_synced(struct sync_args *args)
 {
-	struct add_params params;
-	struct collision_cb cb;
-	int error;
+	int failed;
 
-	__log_debug(jool, "Adding session!");
+	if (!args->count)
+		return;
 
-	error = jnla_get_session_joold(attr, "joold session",
-			&jool->globals.nat64.bib, &params.new);
-	if (error)
-		return false;
+	__log_debug(args->jool, "Adding %u sessions!", args->count);
+	failed = bib_sync(args->jool, args->sessions, args->count,
+			collision_cb, args);
+	if (failed < 0)
+		log_err("bib_sync() threw error code %d.", failed);
+	if (failed)
+		args->success = false;
+
+	args->count = 0;
+}
 
-	params.success = true;
-	cb.cb = collision_cb;
-	cb.arg = &params;
+static int sync_session(struct session_entry *session, void *arg)
+{
+	struct sync_args *args = arg;
 
-	error = bib_add_session(jool, &params.new, &cb);
-	if (error == -EEXIST)
-		return params.success;
-	if (error) {
-		log_err("sessiondb_add() threw unknown error code %d.", error);
-		return false;
-	}
+	args->sessions[args->count++] = *session;
+	args->rcvd++;
+	if (args->count == args->capacity)
+		flush_synced(args);
+	return 0;
+}
 
-	return true;
+/* Old style: One nested attribute per session. */
+static int sync_legacy_session(struct sync_args *args, struct nlattr *attr)
+{
+	struct session_entry session;
+	int error;
+
+	error = jnla_get_session_joold(attr, "joold session",
+			&args->jool->globals.nat64.bib, &session);
+	if (error)
+		return error;
+
+	return sync_session(&session, args);
 }
 
 static bool joold_disabled(struct xlator *jool)
@@ -420,6 +1359,33 @@ static bool joold_disabled(struct xlator *jool)
 	return false;
 }
 
+/* Adds the sessions from the @len bytes of attributes that start at @head. */
+static void sync_attrs(struct sync_args *args, struct nlattr *head, int len)
+{
+	struct xlator *jool = args->jool;
+	struct nlattr *attr;
+	int rem;
+
+	args->count = 0;
+	args->rcvd = 0;
+	args->success = true;
+
+	nla_for_each_attr(attr, head, len, rem) {
+		if (nla_type(attr) == JNLAL_SESSION_BATCH) {
+			args->success &= !jnla_get_session_batch(attr,
+					&jool->globals.nat64.bib,
+					&jool->globals.pool6.prefix,
+					sync_session, args);
+		} else {
+			args->success &= !sync_legacy_session(args, attr);
+		}
+	}
+	flush_synced(args);
+
+	jstat_add(jool->stats, JSTAT_JOOLD_SSS_RCVD, args->rcvd);
+	jstat_inc(jool->stats, JSTAT_JOOLD_PKT_RCVD);
+}
+
 /**
  * joold_sync - Parses a bunch of sessions out of @data and adds them to @jool's
  * session database.
@@ -429,98 +1395,240 @@ static bool joold_disabled(struct xlator *jool)
  */
 int joold_sync(struct xlator *jool, struct nlattr *root)
 {
-	struct nlattr *attr;
-	int rem;
-	int rcvd;
-	bool success;
+	struct sync_args args;
 
 	if (joold_disabled(jool))
 		return -EINVAL;
 
-	success = true;
-	rcvd = 0;
-	nla_for_each_nested(attr, root, rem) {
-		success &= add_new_session(jool, attr);
-		rcvd++;
-	}
+	args.jool = jool;
+	args.sessions = __wkmalloc("joold sync buffer",
+			SYNC_CHUNK * sizeof(*args.sessions), GFP_KERNEL);
+	if (!args.sessions)
+		return -ENOMEM;
+	args.capacity = SYNC_CHUNK;
 
-	jstat_add(jool->stats, JSTAT_JOOLD_SSS_RCVD, rcvd);
-	jstat_inc(jool->stats, JSTAT_JOOLD_PKT_RCVD);
+	sync_attrs(&args, nla_data(root), nla_len(root));
+
+	__wkfree("joold sync buffer", args.sessions);
 
 	__log_debug(jool, "Done.");
-	return success ? 0 : -EINVAL;
+	return args.success ? 0 : -EINVAL;
 }
 
+/**
+ * joold_sync_datagram - Same as joold_sync(), except the sessions are the
+ * payload of a datagram the kernel transport received from the peer.
+ *
+ * Runs in softirq context, so the caller provides the decoding buffer.
+ */
+void joold_sync_datagram(struct xlator *jool, void *data, int len,
+		struct session_entry *buffer, unsigned int capacity)
+{
+	struct sync_args args;
+
+	/* Not joold_disabled(); nobody would read the error, 1000 times. */
+	if (!GLOBALS(jool).enabled)
+		return;
+
+	args.jool = jool;
+	args.sessions = buffer;
+	args.capacity = capacity;
+	sync_attrs(&args, data, len);
+}
+
+/**
+ * Starts advertising the whole session database. It happens in the background;
+ * the tables are walked as the window frees up. (See ad_pull().)
+ */
 int joold_advertise(struct xlator *jool)
 {
-	l4_protocol proto;
 	struct joold_queue *queue;
-	struct counted_list sessions;
-	struct list_head prepared;
-	int error;
 
 	if (joold_disabled(jool))
 		return -EINVAL;
 
-	/* Collect the current sessions */
-	INIT_LIST_HEAD(&sessions.list);
-	sessions.count = 0;
-	for (proto = L4PROTO_TCP; proto <= L4PROTO_ICMP; proto++) {
-		error = bib_foreach_session(jool, proto, ad_session, &sessions,
-				NULL);
-		if (error) {
-			log_err("joold advertisement interrupted.");
-			delete_sessions(&sessions.list);
-			return error;
-		}
-	}
-
-	if (sessions.count == 0)
-		return 0;
-
 	queue = jool->nat64.joold;
-	INIT_LIST_HEAD(&prepared);
-
-	spin_lock_bh(&queue->lock);
 
+	jlock_lock_bh(&queue->lock);
 	if (queue->flags & JQF_AD_ONGOING) {
-		spin_unlock_bh(&queue->lock);
-		delete_sessions(&sessions.list);
+		jlock_unlock_bh(&queue->lock);
 		log_err("joold advertisement already in progress.");
 		return -EINVAL;
 	}
 	queue->flags |= JQF_AD_ONGOING;
+	queue->ad.proto = L4PROTO_TCP;
+	queue->ad.resume = false;
+	queue->ad.gen++;
+	jlock_unlock_bh(&queue->lock);
+
+	joold_flush(jool);
+	jstat_inc(jool->stats, JSTAT_JOOLD_ADS);
+	return 0;
+}
 
-	list_move_all(&sessions.list, &queue->deferred.list);
-	queue->deferred.count += sessions.count;
+/**
+ * Stops the ongoing advertisement. Advertised sessions that are already queued
+ * are still sent, but the walk does not continue.
+ */
+int joold_advertise_cancel(struct xlator *jool)
+{
+	struct joold_queue *queue;
 
-	send_to_userspace_prepare(jool, NULL, &prepared);
+	if (joold_disabled(jool))
+		return -EINVAL;
 
-	spin_unlock_bh(&queue->lock);
+	queue = jool->nat64.joold;
+
+	jlock_lock_bh(&queue->lock);
+	if (!(queue->flags & JQF_AD_ONGOING)) {
+		jlock_unlock_bh(&queue->lock);
+		log_err("There is no joold advertisement in progress.");
+		return -EINVAL;
+	}
+	queue->flags &= ~JQF_AD_ONGOING;
+	queue->ad.proto = L4PROTO_OTHER;
+	queue->ad.resume = false;
+	queue->ad.gen++;
+	jlock_unlock_bh(&queue->lock);
 
-	send_to_userspace(jool, &prepared);
-	jstat_inc(jool->stats, JSTAT_JOOLD_ADS);
 	return 0;
 }
 
-void joold_ack(struct xlator *jool)
+/**
+ * joold_set_transport - Sends (and receives) @jool's sessions through a kernel
+ * UDP socket connected to @cfg's peer, instead of joold. If @cfg is NULL,
+ * returns the sessions to joold.
+ *
+ * Can sleep.
+ */
+int joold_set_transport(struct xlator *jool, struct joold_udp_cfg *cfg)
+{
+	struct joold_queue *queue;
+	struct joold_udp *udp;
+	int error;
+
+	if (joold_disabled(jool))
+		return -EINVAL;
+
+	queue = jool->nat64.joold;
+	udp = NULL;
+	error = 0;
+
+	mutex_lock(&queue->udp_lock);
+
+	if (queue->stopped) {
+		log_err("The instance is being deleted.");
+		error = -ESRCH;
+		goto end;
+	}
+
+	/* Release the port first, in case the new socket wants it. */
+	if (queue->udp) {
+		joold_udp_stop(queue->udp);
+		queue->udp = NULL;
+	}
+	if (cfg) {
+		error = joold_udp_start(jool, cfg, &udp);
+		if (!error)
+			queue->udp = udp;
+	}
+
+end:
+	mutex_unlock(&queue->udp_lock);
+	return error;
+}
+
+/**
+ * joold_stop_transport - Closes @queue's kernel UDP socket (if any), for good.
+ *
+ * The socket doesn't hold its namespace, and the queue can outlive the
+ * instance (and the namespace) by an arbitrary amount of time, so the instance
+ * removals call this before they let go of the instance.
+ *
+ * Can sleep.
+ */
+void joold_stop_transport(struct joold_queue *queue)
+{
+	mutex_lock(&queue->udp_lock);
+	if (queue->udp) {
+		joold_udp_stop(queue->udp);
+		queue->udp = NULL;
+	}
+	queue->stopped = true;
+	mutex_unlock(&queue->udp_lock);
+}
+
+/**
+ * joold_attach_ring - Writes @jool's sessions into @ring, instead of
+ * multicasting them. (Unless the kernel transport is also enabled, which wins.)
+ */
+int joold_attach_ring(struct xlator *jool, struct joold_ring *ring)
+{
+	struct joold_queue *queue;
+	int error;
+
+	if (joold_disabled(jool))
+		return -EINVAL;
+
+	queue = jool->nat64.joold;
+	error = 0;
+
+	mutex_lock(&queue->udp_lock);
+	if (queue->ring) {
+		log_err("Another joold is already reading this instance's ring.");
+		error = -EBUSY;
+	} else {
+		queue->ring = ring;
+	}
+	mutex_unlock(&queue->udp_lock);
+
+	return error;
+}
+
+/**
+ * joold_detach_ring - Returns @jool's sessions to the multicast, if @ring is
+ * still the one attached.
+ */
+void joold_detach_ring(struct xlator *jool, struct joold_ring *ring)
+{
+	struct joold_queue *queue = jool->nat64.joold;
+	bool detached;
+
+	mutex_lock(&queue->udp_lock);
+	detached = (queue->ring == ring);
+	if (detached)
+		queue->ring = NULL;
+	mutex_unlock(&queue->udp_lock);
+
+	/* Nobody is going to ACK the batches joold didn't read. */
+	if (detached) {
+		jlock_lock_bh(&queue->lock);
+		queue->outstanding = 0;
+		jlock_unlock_bh(&queue->lock);
+	}
+}
+
+/* Same as joold_ack(), for @count packets at once. */
+void joold_ack_batches(struct xlator *jool, unsigned int count)
 {
 	struct joold_queue *queue;
-	struct list_head prepared;
 
 	if (joold_disabled(jool))
 		return;
 
 	queue = jool->nat64.joold;
-	INIT_LIST_HEAD(&prepared);
 
-	spin_lock_bh(&queue->lock);
-	queue->flags |= JQF_ACK_RECEIVED;
-	send_to_userspace_prepare(jool, NULL, &prepared);
-	spin_unlock_bh(&queue->lock);
+	jlock_lock_bh(&queue->lock);
+	queue->outstanding -= min(queue->outstanding, count);
+	jlock_unlock_bh(&queue->lock);
+
+	joold_flush(jool);
+	jstat_add(jool->stats, JSTAT_JOOLD_ACKS, count);
+}
 
-	send_to_userspace(jool, &prepared);
-	jstat_inc(jool->stats, JSTAT_JOOLD_ACKS);
+void joold_ack(struct xlator *jool)
+{
+	joold_ack_batches(jool, 1);
 }
 
 /**
@@ -531,18 +1639,9 @@ void joold_ack(struct xlator *jool)
  */
 void joold_clean(struct xlator *jool)
 {
-	spinlock_t *lock;
-	struct list_head prepared;
-
 	if (!GLOBALS(jool).enabled)
 		return;
 
-	lock = &jool->nat64.joold->lock;
-	INIT_LIST_HEAD(&prepared);
-
-	spin_lock_bh(lock);
-	send_to_userspace_prepare(jool, NULL, &prepared);
-	spin_unlock_bh(lock);
-
-	send_to_userspace(jool, &prepared);
+	/* We're in RCU; the flush might need to sleep. */
+	request_flush(jool);
 }
@@ -2,10 +2,13 @@
 #define SRC_MOD_NAT64_JOOLD_H_
 
 #include "common/config.h"
+#include "mod/common/joold_udp.h"
+#include "mod/common/lockstat.h"
 #include "mod/common/xlator.h"
 #include "mod/common/db/bib/entry.h"
 
 struct joold_queue;
+struct joold_ring;
 
 /*
  * Note: "flush" in this context means "send sessions to userspace." The queue
@@ -18,13 +21,24 @@ void joold_teardown(void);
 struct joold_queue *joold_alloc(void);
 void joold_get(struct joold_queue *queue);
 void joold_put(struct joold_queue *queue);
+void joold_memory(struct joold_queue *queue, __u64 *sessions, __u64 *bytes);
+void joold_lock_stats(struct joold_queue *queue, struct jlock_stats *result);
 
 int joold_sync(struct xlator *jool, struct nlattr *root);
+void joold_sync_datagram(struct xlator *jool, void *data, int len,
+		struct session_entry *buffer, unsigned int capacity);
 void joold_add(struct xlator *jool, struct session_entry *entry);
 
 int joold_advertise(struct xlator *jool);
+int joold_advertise_cancel(struct xlator *jool);
+int joold_set_transport(struct xlator *jool, struct joold_udp_cfg *cfg);
+void joold_stop_transport(struct joold_queue *queue);
 void joold_ack(struct xlator *jool);
 
+int joold_attach_ring(struct xlator *jool, struct joold_ring *ring);
+void joold_detach_ring(struct xlator *jool, struct joold_ring *ring);
+void joold_ack_batches(struct xlator *jool, unsigned int count);
+
 void joold_clean(struct xlator *jool);
 
 #endif /* SRC_MOD_NAT64_JOOLD_H_ */
@@ -0,0 +1,265 @@
+#include "mod/common/joold_ring.h"
+
+#include <linux/capability.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "common/joold_ring.h"
+#include "mod/common/joold.h"
+#include "mod/common/linux_version.h"
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/xlator.h"
+
+#define DATA_MASK (JOOLD_RING_DATA_SIZE - 1)
+
+struct joold_ring {
+	/* The mapping: a page of struct joold_ring_hdr, then the records. */
+	void *area;
+	struct joold_ring_hdr *hdr;
+	__u8 *data;
+
+	/*
+	 * End of the last reserved record. The commit publishes it as
+	 * @hdr->producer, which is never read back, since joold can write it.
+	 */
+	__u32 pending;
+
+	wait_queue_head_t wait;
+
+	/* The instance the ring belongs to, if @attached. Holds a reference. */
+	struct xlator jool;
+	bool attached;
+	/* Protects @jool and @attached. */
+	struct mutex lock;
+};
+
+static size_t rec_size(size_t len)
+{
+	return ALIGN(sizeof(struct joold_ring_rec) + len, JOOLD_RING_ALIGN);
+}
+
+/**
+ * joold_ring_reserve - Returns room for a @len-byte record, or NULL if the
+ * ring is full. Has to be followed by joold_ring_commit() once the payload
+ * is written.
+ */
+void *joold_ring_reserve(struct joold_ring *ring, size_t len)
+{
+	struct joold_ring_rec *rec;
+	__u32 producer;
+	__u32 consumer;
+	__u32 pos;
+	__u32 tail;
+	size_t size;
+
+	size = rec_size(len);
+	if (size > JOOLD_RING_DATA_SIZE / 2)
+		return NULL;
+
+	producer = ring->pending;
+	consumer = smp_load_acquire(&ring->hdr->consumer);
+	pos = producer & DATA_MASK;
+	tail = JOOLD_RING_DATA_SIZE - pos;
+
+	/* (If joold wrote nonsense, this also means "full.") */
+	if (producer - consumer + size + (tail < size ? tail : 0)
+			> JOOLD_RING_DATA_SIZE)
+		return NULL;
+
+	if (tail < size) {
+		/* @tail is aligned, so there's room for the header. */
+		rec = (struct joold_ring_rec *)(ring->data + pos);
+		rec->len = JOOLD_RING_PAD;
+		rec->reserved = 0;
+		producer += tail;
+		pos = 0;
+	}
+
+	rec = (struct joold_ring_rec *)(ring->data + pos);
+	rec->len = len;
+	rec->reserved = 0;
+	ring->pending = producer + size;
+	return rec + 1;
+}
+
+/* Hands the last reserved record to joold. */
+void joold_ring_commit(struct joold_ring *ring)
+{
+	smp_store_release(&ring->hdr->producer, ring->pending);
+}
+
+/* Wakes joold up. Call once per flush, not once per record. */
+void joold_ring_wake(struct joold_ring *ring)
+{
+	wake_up_interruptible(&ring->wait);
+}
+
+static int ring_open(struct inode *inode, struct file *file)
+{
+	struct joold_ring *ring;
+
+	ring = wkmalloc(struct joold_ring, GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	/* vmalloc_user() zeroes. */
+	ring->area = vmalloc_user(PAGE_SIZE + JOOLD_RING_DATA_SIZE);
+	if (!ring->area) {
+		wkfree(struct joold_ring, ring);
+		return -ENOMEM;
+	}
+
+	ring->hdr = ring->area;
+	ring->data = ring->area + PAGE_SIZE;
+	ring->hdr->data_offset = PAGE_SIZE;
+	ring->hdr->data_size = JOOLD_RING_DATA_SIZE;
+	ring->pending = 0;
+	init_waitqueue_head(&ring->wait);
+	ring->attached = false;
+	mutex_init(&ring->lock);
+
+	file->private_data = ring;
+	return 0;
+}
+
+/* The mappings hold the file, so this only happens once they're all gone. */
+static int ring_release(struct inode *inode, struct file *file)
+{
+	struct joold_ring *ring = file->private_data;
+
+	if (ring->attached) {
+		joold_detach_ring(&ring->jool, ring);
+		xlator_put(&ring->jool);
+	}
+
+	vfree(ring->area);
+	wkfree(struct joold_ring, ring);
+	return 0;
+}
+
+static long attach(struct joold_ring *ring, char __user *arg)
+{
+	char iname[INAME_MAX_SIZE];
+	int error;
+
+	if (copy_from_user(iname, arg, sizeof(iname)))
+		return -EFAULT;
+	iname[INAME_MAX_SIZE - 1] = '\0';
+
+	if (ring->attached)
+		return -EBUSY;
+
+	error = xlator_find_current(iname, XF_ANY | XT_NAT64, &ring->jool);
+	if (error)
+		return error;
+
+	if (!ns_capable(ring->jool.ns->user_ns, CAP_NET_ADMIN)) {
+		error = -EPERM;
+		goto fail;
+	}
+
+	error = joold_attach_ring(&ring->jool, ring);
+	if (error)
+		goto fail;
+
+	ring->attached = true;
+	return 0;
+
+fail:
+	xlator_put(&ring->jool);
+	return error;
+}
+
+static long ack(struct joold_ring *ring, __u32 __user *arg)
+{
+	__u32 count;
+
+	if (get_user(count, arg))
+		return -EFAULT;
+	if (!ring->attached)
+		return -EINVAL;
+
+	joold_ack_batches(&ring->jool, count);
+	return 0;
+}
+
+static long ring_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct joold_ring *ring = file->private_data;
+	long error;
+
+	mutex_lock(&ring->lock);
+	switch (cmd) {
+	case JOOLD_RING_ATTACH:
+		error = attach(ring, (char __user *)arg);
+		break;
+	case JOOLD_RING_ACK:
+		error = ack(ring, (__u32 __user *)arg);
+		break;
+	default:
+		error = -ENOTTY;
+	}
+	mutex_unlock(&ring->lock);
+
+	return error;
+}
+
+static int ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct joold_ring *ring = file->private_data;
+
+	if (vma->vm_pgoff != 0)
+		return -EINVAL;
+	if (vma->vm_end - vma->vm_start > PAGE_SIZE + JOOLD_RING_DATA_SIZE)
+		return -EINVAL;
+
+	return remap_vmalloc_range(vma, ring->area, 0);
+}
+
+static __poll_t ring_poll(struct file *file, poll_table *wait)
+{
+	struct joold_ring *ring = file->private_data;
+
+	poll_wait(file, &ring->wait, wait);
+	if (READ_ONCE(ring->hdr->producer) == READ_ONCE(ring->hdr->consumer))
+		return 0;
+	return EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations ring_fops = {
+	.owner = THIS_MODULE,
+	.open = ring_open,
+	.release = ring_release,
+	.unlocked_ioctl = ring_ioctl,
+#if LINUX_VERSION_AT_LEAST(5, 5, 0, 9999, 0)
+	.compat_ioctl = compat_ptr_ioctl,
+#endif
+	.mmap = ring_mmap,
+	.poll = ring_poll,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice ring_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = JOOLD_RING_NAME,
+	.fops = &ring_fops,
+	.mode = 0600,
+};
+
+int joold_ring_setup(void)
+{
+	return misc_register(&ring_dev);
+}
+
+void joold_ring_teardown(void)
+{
+	misc_deregister(&ring_dev);
+}
@@ -0,0 +1,29 @@
+#ifndef SRC_MOD_COMMON_JOOLD_RING_H_
+#define SRC_MOD_COMMON_JOOLD_RING_H_
+
+/**
+ * @file
+ * The kernel side of the session ring. (See common/joold_ring.h.)
+ *
+ * Each open file of the JOOLD_RING_PATH device is a ring. Once attached to an
+ * instance, the instance writes its session batches straight into the ring,
+ * instead of allocating a Netlink message for each of them. joold reads them
+ * out of its mapping, so they are also never copied into a socket buffer.
+ */
+
+#include <linux/types.h>
+
+struct joold_ring;
+
+int joold_ring_setup(void);
+void joold_ring_teardown(void);
+
+/*
+ * The producer. (The instance's joold queue.) Only one caller at a time;
+ * joold.c serializes them with its transport mutex.
+ */
+void *joold_ring_reserve(struct joold_ring *ring, size_t len);
+void joold_ring_commit(struct joold_ring *ring);
+void joold_ring_wake(struct joold_ring *ring);
+
+#endif /* SRC_MOD_COMMON_JOOLD_RING_H_ */
@@ -0,0 +1,206 @@
+#include "mod/common/joold_udp.h"
+
+#include <linux/percpu.h>
+#include <net/ipv6.h>
+#include <net/udp_tunnel.h>
+
+#include "mod/common/joold.h"
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
+
+/* Sessions decoded at a time, out of a received datagram. */
+#define RX_CHUNK 64
+
+struct rx_buffer {
+	struct session_entry sessions[RX_CHUNK];
+};
+
+struct joold_udp {
+	struct socket *sock;
+	struct joold_udp_cfg cfg;
+	union {
+		struct sockaddr_in6 v6;
+		struct sockaddr_in v4;
+	} peer;
+	int peer_len;
+
+	/*
+	 * The instance the received sessions are synchronized into. (It's
+	 * looked up again every time, because the transport doesn't hold it.)
+	 */
+	struct net *ns;
+	char iname[INAME_MAX_SIZE];
+	/* joold_udp_rcv() can't sleep, so it can't allocate this. */
+	struct rx_buffer __percpu *rx;
+};
+
+/* Anybody can send datagrams to the port; only the peer's are wanted. */
+static bool from_peer(struct joold_udp *udp, struct sk_buff *skb)
+{
+	switch (udp->cfg.proto) {
+	case L3PROTO_IPV6:
+		return ipv6_addr_equal(&ipv6_hdr(skb)->saddr,
+				&udp->cfg.peer.v6.l3);
+	case L3PROTO_IPV4:
+		return ip_hdr(skb)->saddr == udp->cfg.peer.v4.l3.s_addr;
+	}
+
+	return false;
+}
+
+/*
+ * The socket's encapsulation hook; receives the peer's datagrams, in softirq
+ * context. @skb->data points to the UDP header. Always consumes @skb.
+ */
+static int joold_udp_rcv(struct sock *sk, struct sk_buff *skb)
+{
+	struct joold_udp *udp;
+	struct xlator *jool;
+
+	udp = rcu_dereference_sk_user_data(sk);
+	if (!udp || !from_peer(udp, skb))
+		goto end;
+	if (skb_linearize(skb))
+		goto end;
+
+	rcu_read_lock_bh();
+	if (!xlator_find_rcu(udp->ns, XF_ANY | XT_NAT64, udp->iname, &jool)) {
+		joold_sync_datagram(jool, skb->data + sizeof(struct udphdr),
+				skb->len - sizeof(struct udphdr),
+				this_cpu_ptr(udp->rx)->sessions, RX_CHUNK);
+	}
+	rcu_read_unlock_bh();
+
+end:
+	kfree_skb(skb);
+	return 0;
+}
+
+static int init_peer(struct joold_udp *udp, struct udp_port_cfg *port_cfg)
+{
+	switch (udp->cfg.proto) {
+	case L3PROTO_IPV6:
+		port_cfg->family = AF_INET6;
+		port_cfg->local_ip6 = in6addr_any;
+		port_cfg->local_udp_port = cpu_to_be16(udp->cfg.peer.v6.l4);
+		port_cfg->ipv6_v6only = 1;
+
+		udp->peer.v6.sin6_family = AF_INET6;
+		udp->peer.v6.sin6_addr = udp->cfg.peer.v6.l3;
+		udp->peer.v6.sin6_port = cpu_to_be16(udp->cfg.peer.v6.l4);
+		udp->peer_len = sizeof(udp->peer.v6);
+		return 0;
+
+	case L3PROTO_IPV4:
+		port_cfg->family = AF_INET;
+		port_cfg->local_ip.s_addr = cpu_to_be32(INADDR_ANY);
+		port_cfg->local_udp_port = cpu_to_be16(udp->cfg.peer.v4.l4);
+
+		udp->peer.v4.sin_family = AF_INET;
+		udp->peer.v4.sin_addr = udp->cfg.peer.v4.l3;
+		udp->peer.v4.sin_port = cpu_to_be16(udp->cfg.peer.v4.l4);
+		udp->peer_len = sizeof(udp->peer.v4);
+		return 0;
+	}
+
+	log_err("Unknown L3 protocol: %u", udp->cfg.proto);
+	return -EINVAL;
+}
+
+/**
+ * joold_udp_start - Opens the socket @jool will exchange sessions with @cfg's
+ * peer through. It listens on the peer's port.
+ */
+int joold_udp_start(struct xlator *jool, struct joold_udp_cfg *cfg,
+		struct joold_udp **result)
+{
+	struct joold_udp *udp;
+	struct udp_port_cfg port_cfg;
+	struct udp_tunnel_sock_cfg tunnel_cfg;
+	int error;
+
+	udp = wkmalloc(struct joold_udp, GFP_KERNEL);
+	if (!udp)
+		return -ENOMEM;
+	memset(udp, 0, sizeof(*udp));
+
+	udp->rx = alloc_percpu(struct rx_buffer);
+	if (!udp->rx) {
+		error = -ENOMEM;
+		goto rx_fail;
+	}
+
+	udp->cfg = *cfg;
+	udp->ns = jool->ns;
+	memcpy(udp->iname, jool->iname, INAME_MAX_SIZE);
+
+	memset(&port_cfg, 0, sizeof(port_cfg));
+	error = init_peer(udp, &port_cfg);
+	if (error)
+		goto sock_fail;
+
+	error = udp_sock_create(jool->ns, &port_cfg, &udp->sock);
+	if (error) {
+		log_err("Cannot create the session synchronization socket. (error %d)",
+				error);
+		goto sock_fail;
+	}
+
+	memset(&tunnel_cfg, 0, sizeof(tunnel_cfg));
+	tunnel_cfg.sk_user_data = udp;
+	tunnel_cfg.encap_type = 1; /* Anything nonzero */
+	tunnel_cfg.encap_rcv = joold_udp_rcv;
+	setup_udp_tunnel_sock(jool->ns, udp->sock, &tunnel_cfg);
+
+	*result = udp;
+	return 0;
+
+sock_fail:
+	free_percpu(udp->rx);
+rx_fail:
+	wkfree(struct joold_udp, udp);
+	return error;
+}
+
+/**
+ * joold_udp_stop - Closes @udp's socket, and releases it.
+ *
+ * The socket doesn't hold a reference to its namespace, so this has to happen
+ * before the namespace dies. That's the caller's job (see
+ * joold_stop_transport()); this is only synchronous with the receptions.
+ */
+void joold_udp_stop(struct joold_udp *udp)
+{
+	/* Unhooks joold_udp_rcv()... */
+	udp_tunnel_sock_release(udp->sock);
+	/* ...and waits until the ongoing ones are done with @udp. */
+	synchronize_net();
+
+	free_percpu(udp->rx);
+	wkfree(struct joold_udp, udp);
+}
+
+/**
+ * joold_udp_send - Sends @data (the payload of one joold datagram) to the
+ * peer. Can sleep.
+ *
+ * The socket doesn't wait for buffer space; if there's none, the datagram is
+ * dropped, same as if the network had lost it.
+ */
+int joold_udp_send(struct joold_udp *udp, void *data, size_t len)
+{
+	struct msghdr msg;
+	struct kvec iov;
+	int error;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &udp->peer;
+	msg.msg_namelen = udp->peer_len;
+	msg.msg_flags = MSG_DONTWAIT;
+
+	iov.iov_base = data;
+	iov.iov_len = len;
+
+	error = kernel_sendmsg(udp->sock, &msg, &iov, 1, len);
+	return (error < 0) ? error : 0;
+}
@@ -0,0 +1,36 @@
+#ifndef SRC_MOD_COMMON_JOOLD_UDP_H_
+#define SRC_MOD_COMMON_JOOLD_UDP_H_
+
+/**
+ * @file
+ * The kernel transport of the session synchronization.
+ *
+ * Normally, the sessions travel kernel -> Netlink -> joold -> network -> joold
+ * -> Netlink -> kernel. With this transport, the instance sends its datagrams
+ * to its peer through a kernel UDP socket instead, and receives the peer's
+ * through the same socket's encapsulation hook. The datagrams are the same
+ * ones joold exchanges, so the peer can be either a daemon or another kernel
+ * transport.
+ */
+
+#include "mod/common/xlator.h"
+
+struct joold_udp;
+
+/* The peer. The socket listens on the same port. */
+struct joold_udp_cfg {
+	l3_protocol proto;
+	union {
+		struct ipv6_transport_addr v6;
+		struct ipv4_transport_addr v4;
+	} peer;
+};
+
+/* Both of these can sleep. */
+int joold_udp_start(struct xlator *jool, struct joold_udp_cfg *cfg,
+		struct joold_udp **result);
+void joold_udp_stop(struct joold_udp *udp);
+
+int joold_udp_send(struct joold_udp *udp, void *data, size_t len);
+
+#endif /* SRC_MOD_COMMON_JOOLD_UDP_H_ */
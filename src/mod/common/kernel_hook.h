@@ -13,10 +13,19 @@ unsigned int hook_ipv6(void *priv, struct sk_buff *skb,
 		const struct nf_hook_state *nhs);
 unsigned int hook_ipv4(void *priv, struct sk_buff *skb,
 		const struct nf_hook_state *nhs);
+unsigned int hook_ingress(void *priv, struct sk_buff *skb,
+		const struct nf_hook_state *nhs);
+
+/* struct nf_hook_state's okfn. (Resumes the packet's trip past the hook.) */
+typedef int (*hook_okfn)(struct net *, struct sock *, struct sk_buff *);
+
+void hook_deferred(struct sk_buff *skb, hook_okfn okfn);
+void hook_prefetch(struct sk_buff *skb, unsigned int stage);
 
 #ifndef XTABLES_DISABLED
 
 int target_checkentry(const struct xt_tgchk_param *param);
+void target_destroy(const struct xt_tgdtor_param *param);
 unsigned int target_ipv6(struct sk_buff *skb,
 		const struct xt_action_param *param);
 unsigned int target_ipv4(struct sk_buff *skb,
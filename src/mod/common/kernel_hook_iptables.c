@@ -5,15 +5,74 @@
 #include "common/iptables.h"
 #include "mod/common/core.h"
 #include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 
+/*
+ * The instance the rule's packets were last handed to. Saves the per-packet
+ * name validation, hashing and comparison of xlator_find_rcu().
+ */
+struct target_cache {
+	/* Serializes the refills. */
+	spinlock_t lock;
+	/* Keeps the readers from pairing an instance with a foreign generation. */
+	seqcount_t seq;
+	/* NULL if the instance was never found. */
+	struct xlator *jool;
+	/* xlator_generation() at the time @jool was found. */
+	unsigned int generation;
+};
+
+static bool cache_get(struct target_cache *cache, unsigned int generation,
+		struct xlator **result)
+{
+	struct xlator *jool;
+	unsigned int cached;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&cache->seq);
+		jool = cache->jool;
+		cached = cache->generation;
+	} while (read_seqcount_retry(&cache->seq, seq));
+
+	if (!jool || cached != generation)
+		return false;
+
+	*result = jool;
+	return true;
+}
+
+static void cache_set(struct target_cache *cache, unsigned int generation,
+		struct xlator *jool)
+{
+	spin_lock(&cache->lock);
+	write_seqcount_begin(&cache->seq);
+	cache->jool = jool;
+	cache->generation = generation;
+	write_seqcount_end(&cache->seq);
+	spin_unlock(&cache->lock);
+}
+
+/*
+ * Assumes the caller is inside a RCU-bh read-side critical section; see
+ * xlator_find_rcu().
+ */
 static verdict find_instance(struct net *ns, const struct target_info *info,
-		struct xlator *result)
+		struct xlator **result)
 {
+	unsigned int generation;
 	int error;
 
-	error = xlator_find(ns, XF_IPTABLES | info->type, info->iname, result);
+	/* Has to be read before the lookup; see xlator_generation(). */
+	generation = xlator_generation();
+	if (cache_get(info->cache, generation, result))
+		return VERDICT_CONTINUE;
+
+	error = xlator_find_rcu(ns, XF_IPTABLES | info->type, info->iname,
+			result);
 	switch (error) {
 	case 0:
+		cache_set(info->cache, generation, *result);
 		return VERDICT_CONTINUE;
 	case -ESRCH:
 		log_warn_once("Some iptables rule linked to Jool instance '%s' sent me a packet,\n"
@@ -37,6 +96,7 @@ static verdict find_instance(struct net *ns, const struct target_info *info,
 int target_checkentry(const struct xt_tgchk_param *param)
 {
 	struct target_info *info = param->targinfo;
+	struct target_cache *cache;
 	int error;
 
 	error = iname_validate(info->iname, false);
@@ -50,6 +110,15 @@ int target_checkentry(const struct xt_tgchk_param *param)
 		return error;
 	}
 
+	cache = wkmalloc(struct target_cache, GFP_KERNEL);
+	if (!cache)
+		return -ENOMEM;
+	spin_lock_init(&cache->lock);
+	seqcount_init(&cache->seq);
+	cache->jool = NULL;
+	cache->generation = 0;
+	info->cache = cache;
+
 	return 0;
 
 	/*
@@ -61,6 +130,17 @@ int target_checkentry(const struct xt_tgchk_param *param)
 }
 EXPORT_SYMBOL_GPL(target_checkentry);
 
+/**
+ * This is the function that the kernel calls whenever the user removes an
+ * iptables/ip6tables rule that involves the Jool target.
+ */
+void target_destroy(const struct xt_tgdtor_param *param)
+{
+	struct target_info *info = param->targinfo;
+	wkfree(struct target_cache, info->cache);
+}
+EXPORT_SYMBOL_GPL(target_destroy);
+
 static struct net *action_param_net(const struct xt_action_param *param)
 {
 	return param->state->net;
@@ -98,20 +178,22 @@ unsigned int target_ipv6(struct sk_buff *skb,
 	verdict result;
 	bool enable_debug = false;
 
-	state = xlation_create(NULL);
+	state = xlation_acquire();
 	if (!state)
 		return NF_DROP;
 
+	rcu_read_lock_bh();
+
 	result = find_instance(action_param_net(param), param->targinfo,
 			&state->jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
+	enable_debug = xlator_debug(state->jool);
 
 	result = core_6to4(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
+end:	rcu_read_unlock_bh();
+	xlation_release(state);
 	return verdict2iptables(result, enable_debug);
 }
 EXPORT_SYMBOL_GPL(target_ipv6);
@@ -127,20 +209,22 @@ unsigned int target_ipv4(struct sk_buff *skb,
 	verdict result;
 	bool enable_debug = false;
 
-	state = xlation_create(NULL);
+	state = xlation_acquire();
 	if (!state)
 		return NF_DROP;
 
+	rcu_read_lock_bh();
+
 	result = find_instance(action_param_net(param), param->targinfo,
 			&state->jool);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	enable_debug = state->jool.globals.debug;
+	enable_debug = xlator_debug(state->jool);
 
 	result = core_4to6(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
+end:	rcu_read_unlock_bh();
+	xlation_release(state);
 	return verdict2iptables(result, enable_debug);
 }
 EXPORT_SYMBOL_GPL(target_ipv4);
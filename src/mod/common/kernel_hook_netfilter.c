@@ -1,15 +1,35 @@
 #include "mod/common/kernel_hook.h"
 
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/icmp.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+
+#include "mod/common/address.h"
+#include "mod/common/address_xlat.h"
 #include "mod/common/log.h"
 #include "mod/common/core.h"
+#include "mod/common/drop_reason.h"
+#include "mod/common/threaded.h"
+#include "mod/common/db/eam.h"
+#include "mod/common/db/bib/db.h"
+#include "mod/common/db/pool4/db.h"
 
 /* #pragma GCC diagnostic error "-Wframe-larger-than=1" */
 
-static verdict find_instance(struct sk_buff *skb, struct xlator *result)
+/*
+ * Assumes the caller is inside a RCU-bh read-side critical section; see
+ * xlator_find_netfilter().
+ */
+static verdict find_instance(struct sk_buff *skb, struct xlator **result)
 {
 	int error;
 
-	error = xlator_find_netfilter(dev_net(skb->dev), result);
+	error = xlator_find_netfilter(dev_net(skb->dev), skb->mark, result);
 	switch (error) {
 	case 0:
 		return VERDICT_CONTINUE;
@@ -30,7 +50,113 @@ static verdict find_instance(struct sk_buff *skb, struct xlator *result)
 	return VERDICT_UNTRANSLATABLE;
 }
 
-static unsigned int verdict2netfilter(verdict result, bool enable_debug)
+/*
+ * Netfilter instances see all of the namespace's traffic, most of which is
+ * usually not meant to be translated. These weed out the packets whose
+ * destination addresses are clearly out of the instance's jurisdiction, before
+ * any translation state is built.
+ *
+ * They can return false positives (the core will reject them later, as
+ * usual), but not false negatives.
+ */
+
+static bool is_candidate6(struct xlator *jool, struct sk_buff *skb)
+{
+	struct in6_addr *daddr = &ipv6_hdr(skb)->daddr;
+
+	if (xlator_is_nat64(jool))
+		return xlator_pool6_find(jool, daddr) >= 0;
+
+	if (jool->fast.pool6_set
+			&& prefix6_contains(&jool->fast.pool6, daddr))
+		return true;
+
+	return xlator_is_siit(jool) && !eamt_is_empty(jool->siit.eamt)
+			&& eamt_contains6(jool->siit.eamt, daddr);
+}
+
+static bool is_candidate4(struct xlator *jool, struct sk_buff *skb)
+{
+	__be32 daddr = ip_hdr(skb)->daddr;
+
+	if (xlator_is_nat64(jool))
+		return pool4db_may_contain(jool->nat64.pool4, daddr);
+
+	/* Every IPv4 address can be translated using pool6. */
+	return jool->fast.pool6_set
+			|| eamt_contains4(jool->siit.eamt, daddr);
+}
+
+/*
+ * Threaded mode steals the packet before translating it, so it can't return it
+ * to the kernel the inline way. (See threaded.h.) This runs, before the hook
+ * queues it, the exact destination checks with which the translation tells its
+ * own packets apart from the host's: the interface, denylist4, EAMT and pool6
+ * ones in SIIT, pool4db_contains() in NAT64. is_candidate4() alone is not
+ * enough; SIIT with pool6 and empty pool4 let most of the host's traffic
+ * through.
+ *
+ * Returns false for the packets that should be translated inline instead.
+ * (Including the ones it can't classify cheaply.)
+ */
+static bool threaded_wants4(struct xlator *jool, struct sk_buff *skb)
+{
+	struct iphdr *hdr = ip_hdr(skb);
+	struct ipv4_transport_addr dst;
+	unsigned int offset;
+	l4_protocol proto;
+	union {
+		struct tcphdr tcp;
+		struct udphdr udp;
+		struct icmphdr icmp;
+	} buffer, *l4;
+
+	if (!jool->fast.enabled)
+		return false;
+	if (xlator_is_siit(jool))
+		return addrxlat_siit46_wants(jool, hdr->daddr);
+	if (!jool->fast.pool6_set || ip_is_fragment(hdr))
+		return false;
+
+	offset = skb_network_offset(skb) + ip_hdrlen(skb);
+	switch (hdr->protocol) {
+	case IPPROTO_TCP:
+		l4 = skb_header_pointer(skb, offset, sizeof(buffer.tcp),
+				&buffer);
+		if (!l4)
+			return false;
+		proto = L4PROTO_TCP;
+		dst.l4 = be16_to_cpu(l4->tcp.dest);
+		break;
+	case IPPROTO_UDP:
+		l4 = skb_header_pointer(skb, offset, sizeof(buffer.udp),
+				&buffer);
+		if (!l4)
+			return false;
+		proto = L4PROTO_UDP;
+		dst.l4 = be16_to_cpu(l4->udp.dest);
+		break;
+	case IPPROTO_ICMP:
+		/* Errors carry their port in the inner packet; not worth it. */
+		l4 = skb_header_pointer(skb, offset, sizeof(buffer.icmp),
+				&buffer);
+		if (!l4 || (l4->icmp.type != ICMP_ECHO
+				&& l4->icmp.type != ICMP_ECHOREPLY))
+			return false;
+		proto = L4PROTO_ICMP;
+		dst.l4 = be16_to_cpu(l4->icmp.un.echo.id);
+		break;
+	default:
+		return false;
+	}
+
+	dst.l3.s_addr = hdr->daddr;
+	return pool4db_contains(jool->nat64.pool4, jool->ns, proto, &dst);
+}
+
+/* @stat is the stat that explains @result. (For drop monitoring.) */
+static unsigned int verdict2netfilter(struct sk_buff *skb, verdict result,
+		enum jool_stat_id stat, bool enable_debug)
 {
 	switch (result) {
 	case VERDICT_STOLEN:
@@ -40,7 +166,7 @@ static unsigned int verdict2netfilter(verdict result, bool enable_debug)
 		return NF_ACCEPT;
 	case VERDICT_DROP:
 		____log_debug(enable_debug, "Dropping packet.");
-		return NF_DROP;
+		return jool_nf_drop(skb, stat);
 	case VERDICT_CONTINUE:
 		WARN(true, "At time of writing, Jool core is not supposed to return CONTINUE after the packet is handled.\n"
 				"Please report this to the Jool devs.");
@@ -51,6 +177,42 @@ static unsigned int verdict2netfilter(verdict result, bool enable_debug)
 	return NF_DROP;
 }
 
+/*
+ * When the core returns a packet to the kernel from hook_ingress(), the packet
+ * continues to the IP layer and reaches pre-routing. The tag tells the
+ * pre-routing hooks it's already been through the core, so it doesn't get
+ * counted, captured and sampled twice.
+ *
+ * The tag has to survive ip_rcv() and ipv6_rcv(), so it's the last word of the
+ * control buffer, which the IP layer's control blocks don't reach. (It's the
+ * skb's own address, so whatever else might be left there won't pass as one.)
+ */
+static unsigned long *ingress_tag(struct sk_buff *skb)
+{
+	return (unsigned long *)(skb->cb + sizeof(skb->cb)
+			- sizeof(unsigned long));
+}
+
+static void ingress_tag_set(struct sk_buff *skb)
+{
+	BUILD_BUG_ON(sizeof(struct inet_skb_parm)
+			> sizeof(skb->cb) - sizeof(unsigned long));
+	BUILD_BUG_ON(sizeof(struct inet6_skb_parm)
+			> sizeof(skb->cb) - sizeof(unsigned long));
+	*ingress_tag(skb) = (unsigned long)skb;
+}
+
+/* Returns (and clears) whether hook_ingress() already tried @skb. */
+static bool ingress_tag_test_and_clear(struct sk_buff *skb)
+{
+	unsigned long *tag = ingress_tag(skb);
+
+	if (*tag != (unsigned long)skb)
+		return false;
+	*tag = 0;
+	return true;
+}
+
 /**
  * This is the function that the kernel calls whenever a packet reaches Jool's
  * IPv6 Netfilter hook.
@@ -58,24 +220,47 @@ static unsigned int verdict2netfilter(verdict result, bool enable_debug)
 unsigned int hook_ipv6(void *priv, struct sk_buff *skb,
 		const struct nf_hook_state *nhs)
 {
+	struct xlator *jool;
 	struct xlation *state;
 	verdict result;
-	bool enable_debug = false;
+	enum jool_stat_id stat;
+	bool enable_debug;
 
-	state = xlation_create(NULL);
-	if (!state)
-		return NF_DROP;
+	if (ingress_tag_test_and_clear(skb))
+		return NF_ACCEPT;
 
-	result = find_instance(skb, &state->jool);
-	if (result != VERDICT_CONTINUE)
-		goto end;
-	enable_debug = state->jool.globals.debug;
+	rcu_read_lock_bh();
 
+	result = find_instance(skb, &jool);
+	if (result != VERDICT_CONTINUE || !is_candidate6(jool, skb)) {
+		rcu_read_unlock_bh();
+		return NF_ACCEPT;
+	}
+
+	/* (is_candidate6() already is pool6's exact check.) */
+	if (threaded_enabled() && jool->fast.enabled) {
+		result = threaded_enqueue(jool, skb, nhs->okfn)
+				? VERDICT_STOLEN
+				: VERDICT_DROP;
+		rcu_read_unlock_bh();
+		return verdict2netfilter(skb, result, JSTAT_THREADED_RING_FULL,
+				false);
+	}
+
+	state = xlation_acquire();
+	if (!state) {
+		rcu_read_unlock_bh();
+		return jool_nf_drop(skb, JSTAT_ENOMEM);
+	}
+
+	state->jool = jool;
+	enable_debug = xlator_debug(jool);
 	result = core_6to4(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
-	return verdict2netfilter(result, enable_debug);
+	stat = state->latency.stat;
+	xlation_release(state);
+	rcu_read_unlock_bh();
+	return verdict2netfilter(skb, result, stat, enable_debug);
 }
 EXPORT_SYMBOL_GPL(hook_ipv6);
 
@@ -86,23 +271,267 @@ EXPORT_SYMBOL_GPL(hook_ipv6);
 unsigned int hook_ipv4(void *priv, struct sk_buff *skb,
 		const struct nf_hook_state *nhs)
 {
+	struct xlator *jool;
 	struct xlation *state;
 	verdict result;
-	bool enable_debug = false;
+	enum jool_stat_id stat;
+	bool enable_debug;
 
-	state = xlation_create(NULL);
-	if (!state)
-		return NF_DROP;
+	if (ingress_tag_test_and_clear(skb))
+		return NF_ACCEPT;
 
-	result = find_instance(skb, &state->jool);
-	if (result != VERDICT_CONTINUE)
-		goto end;
-	enable_debug = state->jool.globals.debug;
+	rcu_read_lock_bh();
 
+	result = find_instance(skb, &jool);
+	if (result != VERDICT_CONTINUE || !is_candidate4(jool, skb)) {
+		rcu_read_unlock_bh();
+		return NF_ACCEPT;
+	}
+
+	if (threaded_enabled() && threaded_wants4(jool, skb)) {
+		result = threaded_enqueue(jool, skb, nhs->okfn)
+				? VERDICT_STOLEN
+				: VERDICT_DROP;
+		rcu_read_unlock_bh();
+		return verdict2netfilter(skb, result, JSTAT_THREADED_RING_FULL,
+				false);
+	}
+
+	state = xlation_acquire();
+	if (!state) {
+		rcu_read_unlock_bh();
+		return jool_nf_drop(skb, JSTAT_ENOMEM);
+	}
+
+	state->jool = jool;
+	enable_debug = xlator_debug(jool);
 	result = core_4to6(skb, state);
 
-	xlator_put(&state->jool);
-end:	xlation_destroy(state);
-	return verdict2netfilter(result, enable_debug);
+	stat = state->latency.stat;
+	xlation_release(state);
+	rcu_read_unlock_bh();
+	return verdict2netfilter(skb, result, stat, enable_debug);
 }
 EXPORT_SYMBOL_GPL(hook_ipv4);
+
+/*
+ * Returns @skb to the kernel, past Jool's hook. Same as nf_reinject() does
+ * with a NF_ACCEPT verdict, minus the following (lower priority) hooks.
+ */
+static void reinject(struct sk_buff *skb, hook_okfn okfn)
+{
+	rcu_read_lock();
+	okfn(dev_net(skb->dev), NULL, skb);
+	rcu_read_unlock();
+}
+
+/**
+ * Translates @skb, which hook_ipv6() or hook_ipv4() queued earlier. (See
+ * threaded.h.) Consumes @skb, regardless of outcome; @okfn is the hook's, and
+ * receives @skb if it's untranslatable.
+ *
+ * Call with bottom halves disabled.
+ */
+void hook_deferred(struct sk_buff *skb, hook_okfn okfn)
+{
+	struct xlator *jool;
+	struct xlation *state;
+	verdict result;
+	enum jool_stat_id stat;
+
+	rcu_read_lock_bh();
+
+	/* The instance might have died (or changed) in the meantime. */
+	result = find_instance(skb, &jool);
+	if (result != VERDICT_CONTINUE)
+		goto accept;
+
+	state = xlation_acquire();
+	if (!state) {
+		rcu_read_unlock_bh();
+		jool_kfree_skb(skb, JSTAT_ENOMEM);
+		return;
+	}
+
+	state->jool = jool;
+	result = (skb->protocol == htons(ETH_P_IPV6))
+			? core_6to4(skb, state)
+			: core_4to6(skb, state);
+	stat = state->latency.stat;
+	xlation_release(state);
+
+	rcu_read_unlock_bh();
+	switch (result) {
+	case VERDICT_STOLEN:
+		break;
+	case VERDICT_UNTRANSLATABLE:
+		reinject(skb, okfn);
+		break;
+	default:
+		jool_kfree_skb(skb, stat);
+	}
+	return;
+
+accept:
+	rcu_read_unlock_bh();
+	reinject(skb, okfn);
+}
+
+/**
+ * Warms up the cache for @skb's eventual hook_deferred(). (See
+ * bib_prefetch().) Does not consume @skb.
+ *
+ * Call with bottom halves disabled.
+ */
+void hook_prefetch(struct sk_buff *skb, unsigned int stage)
+{
+	struct xlator *jool;
+
+	rcu_read_lock_bh();
+	if (find_instance(skb, &jool) == VERDICT_CONTINUE
+			&& xlator_is_nat64(jool))
+		bib_prefetch(jool->nat64.bib, skb, stage);
+	rcu_read_unlock_bh();
+}
+
+/*
+ * The netdev ingress hook runs before ip_rcv() and ipv6_rcv(), so these do the
+ * part of their validation the core relies on. They return false if the packet
+ * should be left to the IP layer (and pre-routing) instead.
+ *
+ * NAT64 needs the kernel's defragmenter, which hasn't seen the packet yet, so
+ * fragments are left to pre-routing as well.
+ */
+
+static bool ingress_prepare6(struct xlator *jool, struct sk_buff *skb)
+{
+	struct ipv6hdr *hdr;
+	unsigned int len;
+	unsigned int offset = 0;
+
+	if (!pskb_may_pull(skb, sizeof(struct ipv6hdr)))
+		return false;
+	hdr = ipv6_hdr(skb);
+	if (hdr->version != 6 || hdr->payload_len == 0) /* 0 = Jumbogram */
+		return false;
+
+	len = ntohs(hdr->payload_len) + sizeof(struct ipv6hdr);
+	if (len > skb->len)
+		return false;
+	if (xlator_is_nat64(jool)
+			&& ipv6_find_hdr(skb, &offset, NEXTHDR_FRAGMENT,
+					NULL, NULL) >= 0)
+		return false;
+	if (pskb_trim_rcsum(skb, len))
+		return false;
+
+	skb_set_transport_header(skb, sizeof(struct ipv6hdr));
+	return true;
+}
+
+static bool ingress_prepare4(struct xlator *jool, struct sk_buff *skb)
+{
+	struct iphdr *hdr;
+	unsigned int len;
+
+	if (!pskb_may_pull(skb, sizeof(struct iphdr)))
+		return false;
+	hdr = ip_hdr(skb);
+	if (hdr->version != 4 || hdr->ihl < 5)
+		return false;
+	if (!pskb_may_pull(skb, hdr->ihl << 2))
+		return false;
+	hdr = ip_hdr(skb);
+	if (ip_fast_csum((u8 *)hdr, hdr->ihl))
+		return false;
+
+	len = ntohs(hdr->tot_len);
+	if (len > skb->len || len < (hdr->ihl << 2))
+		return false;
+	if (xlator_is_nat64(jool) && ip_is_fragment(hdr))
+		return false;
+	if (pskb_trim_rcsum(skb, len))
+		return false;
+
+	skb_set_transport_header(skb, hdr->ihl << 2);
+	return true;
+}
+
+static bool ingress_wants(struct xlator *jool, struct net_device *dev)
+{
+	struct ingress_devices *devices = &jool->globals.ingress_devices;
+	unsigned int i;
+
+	for (i = 0; i < devices->count; i++)
+		if (strncmp(devices->names[i], dev->name,
+				IFNAME_MAX_SIZE) == 0)
+			return true;
+	return false;
+}
+
+/**
+ * This is the function that the kernel calls whenever a packet reaches one of
+ * Jool's netdev ingress hooks. (See ingress-devices.)
+ *
+ * Whatever is not translated here is accepted, so it continues to the IP layer
+ * and also goes through hook_ipv6() or hook_ipv4(). Those only translate what
+ * this declined before reaching the core (NAT64 fragments, packets that failed
+ * ingress_prepare*(), non-candidates); the rest is tagged.
+ */
+unsigned int hook_ingress(void *priv, struct sk_buff *skb,
+		const struct nf_hook_state *nhs)
+{
+	struct xlator *jool;
+	struct xlation *state;
+	verdict result;
+	enum jool_stat_id stat;
+	bool enable_debug;
+	bool candidate;
+
+	if (skb_shared(skb) || skb->pkt_type != PACKET_HOST)
+		return NF_ACCEPT;
+
+	rcu_read_lock_bh();
+
+	result = find_instance(skb, &jool);
+	if (result != VERDICT_CONTINUE || !ingress_wants(jool, skb->dev))
+		goto accept;
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IPV6):
+		candidate = ingress_prepare6(jool, skb)
+				&& is_candidate6(jool, skb);
+		break;
+	case htons(ETH_P_IP):
+		candidate = ingress_prepare4(jool, skb)
+				&& is_candidate4(jool, skb);
+		break;
+	default:
+		candidate = false;
+	}
+	if (!candidate)
+		goto accept;
+
+	state = xlation_acquire();
+	if (!state) {
+		rcu_read_unlock_bh();
+		return jool_nf_drop(skb, JSTAT_ENOMEM);
+	}
+
+	state->jool = jool;
+	enable_debug = xlator_debug(jool);
+	result = (skb->protocol == htons(ETH_P_IPV6))
+			? core_6to4(skb, state)
+			: core_4to6(skb, state);
+	if (result == VERDICT_UNTRANSLATABLE)
+		ingress_tag_set(skb);
+
+	stat = state->latency.stat;
+	xlation_release(state);
+	rcu_read_unlock_bh();
+	return verdict2netfilter(skb, result, stat, enable_debug);
+
+accept:
+	rcu_read_unlock_bh();
+	return NF_ACCEPT;
+}
@@ -0,0 +1,286 @@
+#include "mod/common/lctrie.h"
+
+#include <linux/sort.h>
+
+#include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
+
+/*
+ * A slot is either empty (0), the index of a value plus one, or LCT_NODE plus
+ * the index of a child node.
+ */
+typedef __u32 lct_slot;
+#define LCT_NODE (1u << 31)
+
+#define NODE_BITS 8
+#define NODE_SLOTS (1u << NODE_BITS)
+/* Tables this big get a 16-bit root; smaller ones make do with 8 bits. */
+#define BIG_TABLE 256
+
+struct lctrie {
+	/* Leading bytes all the keys share. Checked, but not indexed. */
+	__u8 skip[16];
+	unsigned int skip_len;
+
+	/* Bits consumed by @root; 8 or 16. */
+	unsigned int root_bits;
+	lct_slot *root;
+
+	/* The levels below the root; NODE_BITS each. */
+	lct_slot (*nodes)[NODE_SLOTS];
+	unsigned int node_count;
+	unsigned int node_max;
+
+	/* Copies of the rtrie's values. */
+	__u8 *values;
+	size_t value_size;
+};
+
+static int compare_key_len(void const *a, void const *b)
+{
+	struct rtrie_node const *node1 = *(struct rtrie_node * const *)a;
+	struct rtrie_node const *node2 = *(struct rtrie_node * const *)b;
+	return (int)node1->key.len - (int)node2->key.len;
+}
+
+/**
+ * Returns the number of leading bytes covered by all of @nodes' keys.
+ * @nodes is sorted by key length, and is not empty.
+ */
+static unsigned int compute_skip(struct rtrie_node **nodes, unsigned int count,
+		unsigned int key_len)
+{
+	unsigned int skip;
+	unsigned int i, j;
+
+	/* Leave at least two bytes for the root. */
+	skip = min(key_len / 8 - 2, nodes[0]->key.len / 8u);
+
+	for (i = 1; i < count; i++) {
+		for (j = 0; j < skip; j++) {
+			if (nodes[i]->key.bytes[j] != nodes[0]->key.bytes[j]) {
+				skip = j;
+				break;
+			}
+		}
+	}
+
+	return skip;
+}
+
+/* Reads @bits (8 or 16) bits from @key, starting at byte @pos. */
+static unsigned int get_chunk(__u8 const *key, unsigned int pos,
+		unsigned int bits)
+{
+	return (bits == 16) ? ((key[pos] << 8) | key[pos + 1]) : key[pos];
+}
+
+static int grow_nodes(struct lctrie *lct)
+{
+	lct_slot (*nodes)[NODE_SLOTS];
+	unsigned int max;
+
+	max = lct->node_max ? (2 * lct->node_max) : 16;
+	if (max > LCT_NODE)
+		return -ENOMEM;
+
+	nodes = __wkvmalloc("lctrie nodes", max * sizeof(*nodes));
+	if (!nodes)
+		return -ENOMEM;
+
+	if (lct->nodes) {
+		memcpy(nodes, lct->nodes, lct->node_count * sizeof(*nodes));
+		__wkvfree("lctrie nodes", lct->nodes);
+	}
+	lct->nodes = nodes;
+	lct->node_max = max;
+	return 0;
+}
+
+/*
+ * Appends a node whose slots all inherit @parent_slot (ie. the best match found
+ * so far), and returns a slot pointing to it.
+ * Might move @lct->nodes.
+ */
+static int add_node(struct lctrie *lct, lct_slot parent_slot, lct_slot *result)
+{
+	lct_slot *node;
+	unsigned int i;
+	int error;
+
+	if (lct->node_count == lct->node_max) {
+		error = grow_nodes(lct);
+		if (error)
+			return error;
+	}
+
+	node = lct->nodes[lct->node_count];
+	for (i = 0; i < NODE_SLOTS; i++)
+		node[i] = parent_slot;
+
+	*result = LCT_NODE | lct->node_count;
+	lct->node_count++;
+	return 0;
+}
+
+static lct_slot *get_slots(struct lctrie *lct, lct_slot parent)
+{
+	return (parent & LCT_NODE) ? lct->nodes[parent & ~LCT_NODE] : lct->root;
+}
+
+/*
+ * Expands @key's prefix over the slots it covers, so they all point to @value.
+ *
+ * Keys have to be inserted shortest first. That way, longer prefixes override
+ * the shorter ones they're contained by, and the nodes they create inherit the
+ * latter's values.
+ */
+static int insert(struct lctrie *lct, struct rtrie_key const *key,
+		lct_slot value)
+{
+	lct_slot parent = 0; /* ie. the root */
+	lct_slot *slots = lct->root;
+	unsigned int bits = lct->root_bits;
+	unsigned int pos = lct->skip_len;
+	unsigned int remaining = key->len - 8 * lct->skip_len;
+	unsigned int chunk;
+	unsigned int span;
+	unsigned int i;
+	lct_slot child;
+	int error;
+
+	while (remaining > bits) {
+		chunk = get_chunk(key->bytes, pos, bits);
+		child = slots[chunk];
+		if (!(child & LCT_NODE)) {
+			error = add_node(lct, child, &child);
+			if (error)
+				return error;
+			slots = get_slots(lct, parent);
+			slots[chunk] = child;
+		}
+
+		parent = child;
+		slots = get_slots(lct, parent);
+		pos += bits >> 3;
+		remaining -= bits;
+		bits = NODE_BITS;
+	}
+
+	span = 1u << (bits - remaining);
+	chunk = get_chunk(key->bytes, pos, bits) & ~(span - 1);
+	for (i = 0; i < span; i++) {
+		if (WARN(slots[chunk + i] & LCT_NODE,
+				"lctrie keys were not sorted by length."))
+			return -EINVAL;
+		slots[chunk + i] = value;
+	}
+
+	return 0;
+}
+
+void lctrie_free(struct lctrie *lct)
+{
+	if (!lct)
+		return;
+
+	__wkvfree("lctrie root", lct->root);
+	__wkvfree("lctrie nodes", lct->nodes);
+	__wkvfree("lctrie values", lct->values);
+	wkfree(struct lctrie, lct);
+}
+
+int lctrie_build(struct rtrie *trie, unsigned int key_len,
+		struct lctrie **result)
+{
+	struct lctrie *lct;
+	struct rtrie_node **sorted;
+	struct rtrie_node *node;
+	unsigned int count;
+	unsigned int i;
+	int error;
+
+	count = 0;
+	list_for_each_entry(node, &trie->list, list_hook)
+		if (node->color == COLOR_WHITE)
+			count++;
+
+	sorted = __wkvmalloc("lctrie sort buffer",
+			max(count, 1u) * sizeof(*sorted));
+	if (!sorted)
+		return -ENOMEM;
+
+	i = 0;
+	list_for_each_entry(node, &trie->list, list_hook)
+		if (node->color == COLOR_WHITE)
+			sorted[i++] = node;
+	sort(sorted, count, sizeof(*sorted), compare_key_len, NULL);
+
+	lct = wkmalloc(struct lctrie, GFP_KERNEL);
+	if (!lct) {
+		error = -ENOMEM;
+		goto end;
+	}
+	memset(lct, 0, sizeof(*lct));
+
+	if (count) {
+		lct->skip_len = compute_skip(sorted, count, key_len);
+		memcpy(lct->skip, sorted[0]->key.bytes, lct->skip_len);
+	}
+	lct->root_bits = (count >= BIG_TABLE) ? 16 : 8;
+	lct->value_size = trie->value_size;
+
+	lct->root = __wkvmalloc("lctrie root",
+			sizeof(lct_slot) << lct->root_bits);
+	lct->values = __wkvmalloc("lctrie values",
+			max(count, 1u) * lct->value_size);
+	if (!lct->root || !lct->values) {
+		error = -ENOMEM;
+		goto fail;
+	}
+
+	for (i = 0; i < count; i++) {
+		memcpy(lct->values + i * lct->value_size, sorted[i] + 1,
+				lct->value_size);
+		error = insert(lct, &sorted[i]->key, i + 1);
+		if (error)
+			goto fail;
+	}
+
+	LOG_DEBUG("Built a %u-entry lctrie (%u nodes, %u skipped bytes).",
+			count, lct->node_count, lct->skip_len);
+	*result = lct;
+	error = 0;
+	goto end;
+
+fail:
+	lctrie_free(lct);
+end:
+	__wkvfree("lctrie sort buffer", sorted);
+	return error;
+}
+
+int lctrie_find(struct lctrie const *lct, __u8 const *key, void *result)
+{
+	unsigned int pos;
+	lct_slot slot;
+
+	if (memcmp(key, lct->skip, lct->skip_len) != 0)
+		return -ESRCH;
+
+	pos = lct->skip_len;
+	slot = lct->root[get_chunk(key, pos, lct->root_bits)];
+	pos += lct->root_bits >> 3;
+
+	while (slot & LCT_NODE) {
+		slot = lct->nodes[slot & ~LCT_NODE][key[pos]];
+		pos++;
+	}
+
+	if (!slot)
+		return -ESRCH;
+
+	memcpy(result, lct->values + (slot - 1) * lct->value_size,
+			lct->value_size);
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef SRC_MOD_COMMON_LCTRIE_H_
+#define SRC_MOD_COMMON_LCTRIE_H_
+
+/**
+ * @file
+ * A level-compressed, read-only snapshot of a struct rtrie.
+ *
+ * The rtrie is a binary trie; longest prefix matching it costs one node (and
+ * usually one cache miss) per bit that distinguishes the entries. The lctrie
+ * consumes 16 bits in its root and 8 bits per level below it, and skips the
+ * leading bytes all its keys share. Values are pushed to the leaves, so a
+ * lookup is a handful of array accesses, the last of which finds the best
+ * match.
+ *
+ * It cannot be updated; it's meant to be rebuilt from its rtrie whenever the
+ * latter changes, and then published via RCU.
+ */
+
+#include <linux/types.h>
+#include "mod/common/rtrie.h"
+
+struct lctrie;
+
+/*
+ * Creates a snapshot of @trie. @key_len is the length (in bits) of the
+ * addresses that will be queried.
+ * Call with @trie's lock held. Can sleep.
+ */
+int lctrie_build(struct rtrie *trie, unsigned int key_len,
+		struct lctrie **result);
+/* Can sleep. */
+void lctrie_free(struct lctrie *lct);
+
+/*
+ * Finds the value whose key best matches @key (which has to be @key_len bits
+ * long) and copies it to @result.
+ * Safe to use during packet translation.
+ */
+int lctrie_find(struct lctrie const *lct, __u8 const *key, void *result);
+
+#endif /* SRC_MOD_COMMON_LCTRIE_H_ */
@@ -0,0 +1,83 @@
+#include "mod/common/lockstat.h"
+
+#include <linux/moduleparam.h>
+#include <linux/sched/clock.h>
+
+DEFINE_STATIC_KEY_FALSE(jlock_key);
+
+/* Hold time is measured in one of every lock_stats acquisitions. */
+static unsigned int lock_stats;
+
+static int set_lock_stats(const char *val, const struct kernel_param *kp)
+{
+	int error;
+
+	error = param_set_uint(val, kp);
+	if (error)
+		return error;
+
+	if (lock_stats)
+		static_branch_enable(&jlock_key);
+	else
+		static_branch_disable(&jlock_key);
+	return 0;
+}
+
+static const struct kernel_param_ops lock_stats_ops = {
+	.set = set_lock_stats,
+	.get = param_get_uint,
+};
+
+module_param_cb(lock_stats, &lock_stats_ops, &lock_stats, 0644);
+MODULE_PARM_DESC(lock_stats, "Count the acquisitions and contentions of the BIB, pool4 and joold locks, and measure the hold time of one in every lock_stats acquisitions. 0 disables. (See JSTAT_LOCK_* in `jool stats display`.)");
+
+void jlock_init(struct jlock *lock)
+{
+	spin_lock_init(&lock->spin);
+	lock->acquired = 0;
+	lock->contended = 0;
+	lock->sampled = 0;
+	lock->hold_ns = 0;
+	lock->since = 0;
+}
+
+void __jlock_lock(struct jlock *lock)
+{
+	bool contended;
+
+	contended = !spin_trylock(&lock->spin);
+	if (contended)
+		spin_lock(&lock->spin);
+	__jlock_acquired(lock, contended);
+}
+
+void __jlock_acquired(struct jlock *lock, bool contended)
+{
+	/* Might have been disabled after the key check. */
+	unsigned int rate = READ_ONCE(lock_stats);
+
+	lock->acquired++;
+	if (contended)
+		lock->contended++;
+	if (rate && (lock->acquired % rate) == 0)
+		lock->since = local_clock();
+}
+
+void __jlock_release(struct jlock *lock)
+{
+	u64 now = local_clock();
+
+	if (now > lock->since) {
+		lock->hold_ns += now - lock->since;
+		lock->sampled++;
+	}
+	lock->since = 0;
+}
+
+void jlock_query(struct jlock *lock, struct jlock_stats *result)
+{
+	result->acquired += READ_ONCE(lock->acquired);
+	result->contended += READ_ONCE(lock->contended);
+	result->sampled += READ_ONCE(lock->sampled);
+	result->hold_ns += READ_ONCE(lock->hold_ns);
+}
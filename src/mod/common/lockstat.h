@@ -0,0 +1,99 @@
+#ifndef SRC_MOD_COMMON_LOCKSTAT_H_
+#define SRC_MOD_COMMON_LOCKSTAT_H_
+
+/**
+ * @file
+ * Contention counters for the hot spinlocks. (The jool_common module's
+ * lock_stats parameter.)
+ *
+ * lockstat is too heavy to leave enabled in production, so this is much
+ * cruder: Every acquisition is counted, and tried first, so the ones that had
+ * to wait can be counted as contended. Hold time is only measured in one of
+ * every lock_stats acquisitions, since it needs two clock reads.
+ *
+ * The counters live next to the spinlock, and are only written while it's
+ * held, so they don't need atomics, and they don't dirty any other cache line.
+ *
+ * Disabled (lock_stats = 0) by default. Until then, a jlock only costs a
+ * static key check over the spinlock.
+ */
+
+#include <linux/jump_label.h>
+#include <linux/spinlock.h>
+
+struct jlock {
+	spinlock_t spin;
+
+	/* Everything below is protected by @spin. */
+
+	unsigned long acquired;
+	/** Acquisitions that found the lock taken. */
+	unsigned long contended;
+	/** Acquisitions whose hold time was measured. */
+	unsigned long sampled;
+	/** Sum of the measured hold times, in nanoseconds. */
+	u64 hold_ns;
+	/** When the current holder took the lock, if it's being measured. */
+	u64 since;
+};
+
+struct jlock_stats {
+	__u64 acquired;
+	__u64 contended;
+	__u64 sampled;
+	__u64 hold_ns;
+};
+
+DECLARE_STATIC_KEY_FALSE(jlock_key);
+
+void jlock_init(struct jlock *lock);
+
+void __jlock_lock(struct jlock *lock);
+void __jlock_acquired(struct jlock *lock, bool contended);
+void __jlock_release(struct jlock *lock);
+
+static inline void jlock_lock(struct jlock *lock)
+{
+	if (static_branch_unlikely(&jlock_key))
+		__jlock_lock(lock);
+	else
+		spin_lock(&lock->spin);
+}
+
+static inline void jlock_lock_bh(struct jlock *lock)
+{
+	local_bh_disable();
+	jlock_lock(lock);
+}
+
+/* Failures are not counted; the caller did not wait. */
+static inline bool jlock_trylock(struct jlock *lock)
+{
+	if (!spin_trylock(&lock->spin))
+		return false;
+	if (static_branch_unlikely(&jlock_key))
+		__jlock_acquired(lock, false);
+	return true;
+}
+
+static inline void jlock_unlock(struct jlock *lock)
+{
+	/*
+	 * Not the key; it might have been toggled since the lock was taken.
+	 * @since is only set by measured acquisitions, and always cleared here.
+	 */
+	if (unlikely(lock->since))
+		__jlock_release(lock);
+	spin_unlock(&lock->spin);
+}
+
+static inline void jlock_unlock_bh(struct jlock *lock)
+{
+	jlock_unlock(lock);
+	local_bh_enable();
+}
+
+/* Adds @lock's counters to @result. Lockless, so it can lag a little. */
+void jlock_query(struct jlock *lock, struct jlock_stats *result);
+
+#endif /* SRC_MOD_COMMON_LOCKSTAT_H_ */
@@ -22,6 +22,22 @@
  *    the error message cannot be sent to userspace.
  */
 
+DEFINE_STATIC_KEY_FALSE(debug_key);
+
+/*
+ * Static keys can only be flipped from process context, which is fine; the
+ * debug global only changes through instance addition and replacement.
+ */
+void debug_key_get(void)
+{
+	static_branch_inc(&debug_key);
+}
+
+void debug_key_put(void)
+{
+	static_branch_dec(&debug_key);
+}
+
 static bool is_packet_context(void)
 {
 	return in_softirq();
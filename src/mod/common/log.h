@@ -1,17 +1,47 @@
 #ifndef SRC_MOD_COMMON_LOG_H_
 #define SRC_MOD_COMMON_LOG_H_
 
+#include <linux/jump_label.h>
 #include <linux/printk.h>
 #include "mod/common/translation_state.h"
 
-static inline bool state_debug(struct xlation const *state)
+#ifdef UNIT_TESTING
+
+static inline void debug_key_get(void) {}
+static inline void debug_key_put(void) {}
+
+static inline bool xlator_debug(struct xlator const *instance)
 {
-	return state && state->jool.globals.debug;
+	return instance && instance->fast.debug;
 }
 
+#else
+
+/*
+ * Enabled while at least one instance has the debug global on. Spares the
+ * packet path the debug checks (and the argument evaluations) otherwise.
+ */
+DECLARE_STATIC_KEY_FALSE(debug_key);
+
+void debug_key_get(void);
+void debug_key_put(void);
+
 static inline bool xlator_debug(struct xlator const *instance)
 {
-	return instance && instance->globals.debug;
+#ifdef JOOL_NO_DEBUG
+	/* The debug global is accepted, but does nothing. */
+	return false;
+#else
+	return static_branch_unlikely(&debug_key)
+			&& instance && instance->fast.debug;
+#endif
+}
+
+#endif
+
+static inline bool state_debug(struct xlation const *state)
+{
+	return state && xlator_debug(state->jool);
 }
 
 /**
@@ -37,7 +67,7 @@ static inline bool xlator_debug(struct xlator const *instance)
 #define log_debug(state, text, ...)					\
 	do {								\
 		if (state_debug(state))					\
-			JOOL_DEBUG(&state->jool, text, ##__VA_ARGS__);	\
+			JOOL_DEBUG(state->jool, text, ##__VA_ARGS__);	\
 	} while (0)
 #define __log_debug(jool, text, ...)					\
 	do {								\
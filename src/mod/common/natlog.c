@@ -0,0 +1,511 @@
+#include "mod/common/natlog.h"
+
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/timekeeping.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+
+#include "common/xlat.h"
+#include "mod/common/log.h"
+#include "mod/common/stats.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/nl/nl_handler.h"
+
+/* Records per CPU. Has to be a power of two. */
+#define RING_SIZE 1024
+#define RING_MASK (RING_SIZE - 1)
+/* Records per Netlink message. Keeps them well within a page. */
+#define RECORDS_PER_MSG 64
+/* Same, for the latency samples. (Rarer, and bigger.) */
+#define LATENCY_RING_SIZE 128
+#define LATENCY_RING_MASK (LATENCY_RING_SIZE - 1)
+#define LATENCY_PER_MSG 32
+
+/** Bit of natlog.pending: Is there a drain waiting in natlog_wq? */
+#define NLP_DRAIN_SCHEDULED 0
+
+/**
+ * Single producer (the CPU that owns the ring, with bottom halves disabled),
+ * single consumer (natlog_drain(), which holds natlog.lock). Both indexes only
+ * ever grow; they're masked on access.
+ */
+struct natlog_ring {
+	/** Next slot the producer will write. Only the producer writes it. */
+	unsigned int head;
+	/** Next slot the consumer will read. Only the consumer writes it. */
+	unsigned int tail;
+	struct natlog_record records[RING_SIZE];
+
+	/* Same rules as @head, @tail and @records. */
+	unsigned int latency_head;
+	unsigned int latency_tail;
+	struct natlog_latency latency[LATENCY_RING_SIZE];
+};
+
+struct natlog {
+	struct natlog_ring * __percpu *rings;
+	/** Translations each CPU has to skip before it samples another one. */
+	unsigned int __percpu *countdowns;
+	/** Serializes the consumers. */
+	struct mutex lock;
+	/** NLP; atomic bitops only. */
+	unsigned long pending;
+	struct kref refs;
+};
+
+/* A request to drain the rings, from the packet path. */
+struct natlog_drain {
+	/* Copy of the xlator, because the original is usually on the stack. */
+	struct xlator jool;
+	struct work_struct work;
+};
+
+static struct workqueue_struct *natlog_wq;
+
+static int natlog_setup(void)
+{
+	natlog_wq = alloc_workqueue("jool_natlog", WQ_UNBOUND, 0);
+	return natlog_wq ? 0 : -ENOMEM;
+}
+
+void natlog_teardown(void)
+{
+	if (natlog_wq) {
+		/* Waits for (and drops the references of) pending drains. */
+		destroy_workqueue(natlog_wq);
+		natlog_wq = NULL;
+	}
+}
+
+static void free_rings(struct natlog *log)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		__wkvfree("natlog ring", *per_cpu_ptr(log->rings, cpu));
+	free_percpu(log->rings);
+	free_percpu(log->countdowns);
+}
+
+struct natlog *natlog_alloc(void)
+{
+	struct natlog *log;
+	struct natlog_ring *ring;
+	unsigned int cpu;
+	bool wq_created;
+
+	BUILD_BUG_ON(sizeof(struct natlog_record) != 40);
+	BUILD_BUG_ON(sizeof(struct natlog_latency) != 80);
+	BUILD_BUG_ON(NATLOG_LATENCY_STAGES != JLAT_STAGE_COUNT);
+
+	wq_created = false;
+	if (!natlog_wq) {
+		if (natlog_setup())
+			return NULL;
+		wq_created = true;
+	}
+
+	log = wkmalloc(struct natlog, GFP_KERNEL);
+	if (!log)
+		goto log_fail;
+	log->rings = alloc_percpu(struct natlog_ring *);
+	if (!log->rings)
+		goto rings_fail;
+	log->countdowns = alloc_percpu(unsigned int);
+	if (!log->countdowns)
+		goto ring_fail;
+
+	for_each_possible_cpu(cpu) {
+		ring = __wkvmalloc("natlog ring", sizeof(struct natlog_ring));
+		if (!ring)
+			goto ring_fail;
+		*per_cpu_ptr(log->rings, cpu) = ring;
+	}
+
+	mutex_init(&log->lock);
+	log->pending = 0;
+	kref_init(&log->refs);
+	return log;
+
+ring_fail:
+	/*
+	 * alloc_percpu() zeroes; __wkvfree(NULL) and free_percpu(NULL) are
+	 * fine.
+	 */
+	free_rings(log);
+rings_fail:
+	wkfree(struct natlog, log);
+log_fail:
+	if (wq_created)
+		natlog_teardown();
+	return NULL;
+}
+
+void natlog_get(struct natlog *log)
+{
+	kref_get(&log->refs);
+}
+
+static void natlog_release(struct kref *refs)
+{
+	struct natlog *log;
+
+	log = container_of(refs, struct natlog, refs);
+	free_rings(log);
+	wkfree(struct natlog, log);
+}
+
+void natlog_put(struct natlog *log)
+{
+	kref_put(&log->refs, natlog_release);
+}
+
+/*
+ * Allocates a multicast message with room for a @len bytes long @attrtype
+ * attribute. Returns the attribute's payload through @data.
+ */
+static struct sk_buff *new_msg(struct xlator *jool, int attrtype, size_t len,
+		struct joolnlhdr **jhdr, void **data)
+{
+	struct sk_buff *skb;
+	struct nlattr *attr;
+
+	skb = genlmsg_new(sizeof(struct joolnlhdr) + nla_total_size(len),
+			GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	*jhdr = genlmsg_put(skb, 0, 0, jnl_family(), 0, 0);
+	if (WARN(!*jhdr, "genlmsg_put() returned NULL"))
+		goto revert_skb;
+
+	memset(*jhdr, 0, sizeof(**jhdr));
+	memcpy((*jhdr)->magic, JOOLNL_HDR_MAGIC, JOOLNL_HDR_MAGIC_LEN);
+	(*jhdr)->version = cpu_to_be32(xlat_version());
+	(*jhdr)->xt = XT_NAT64;
+	memcpy((*jhdr)->iname, jool->iname, INAME_MAX_SIZE);
+
+	attr = nla_reserve(skb, attrtype, len);
+	if (WARN(!attr, "nla_reserve() returned NULL"))
+		goto revert_skb;
+
+	*data = nla_data(attr);
+	return skb;
+
+revert_skb:
+	kfree_skb(skb);
+	return NULL;
+}
+
+/* Sends new_msg()'s @skb, which contains @count records. */
+static void send_msg(struct xlator *jool, struct sk_buff *skb,
+		struct joolnlhdr *jhdr, unsigned int count)
+{
+	int error;
+
+	genlmsg_end(skb, jhdr);
+
+	/* The skb is consumed either way. */
+	error = genlmsg_multicast_netns(jnl_family(), jool->ns, skb, 0,
+			JNL_MCGRP_NATLOG, GFP_KERNEL);
+	if (error) {
+		/* -ESRCH means nobody is listening; not worth a warning. */
+		if (error != -ESRCH)
+			log_warn_once("Could not multicast the NAT log (errcode %d).",
+					error);
+		jstat_add(jool->stats, JSTAT_NATLOG_RECORDS_DROPPED, count);
+		return;
+	}
+
+	jstat_add(jool->stats, JSTAT_NATLOG_RECORDS_SENT, count);
+}
+
+static void send_records(struct xlator *jool, struct natlog_ring *ring,
+		unsigned int first, unsigned int count)
+{
+	struct sk_buff *skb;
+	struct joolnlhdr *jhdr;
+	struct natlog_record *records;
+	unsigned int i;
+
+	skb = new_msg(jool, JNLAR_NATLOG_RECORDS, count * sizeof(*records),
+			&jhdr, (void **)&records);
+	if (!skb) {
+		jstat_add(jool->stats, JSTAT_NATLOG_RECORDS_DROPPED, count);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		records[i] = ring->records[(first + i) & RING_MASK];
+
+	send_msg(jool, skb, jhdr, count);
+}
+
+static void send_latency(struct xlator *jool, struct natlog_ring *ring,
+		unsigned int first, unsigned int count)
+{
+	struct sk_buff *skb;
+	struct joolnlhdr *jhdr;
+	struct natlog_latency *samples;
+	unsigned int i;
+
+	skb = new_msg(jool, JNLAR_NATLOG_LATENCY, count * sizeof(*samples),
+			&jhdr, (void **)&samples);
+	if (!skb) {
+		jstat_add(jool->stats, JSTAT_NATLOG_RECORDS_DROPPED, count);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		samples[i] = ring->latency[(first + i) & LATENCY_RING_MASK];
+
+	send_msg(jool, skb, jhdr, count);
+}
+
+static void drain_ring(struct xlator *jool, struct natlog_ring *ring)
+{
+	unsigned int head;
+	unsigned int tail;
+	unsigned int count;
+
+	tail = ring->tail;
+	/* Pairs with the producer's release; the records are visible. */
+	head = smp_load_acquire(&ring->head);
+
+	while (tail != head) {
+		count = min(head - tail, (unsigned int)RECORDS_PER_MSG);
+		send_records(jool, ring, tail, count);
+		tail += count;
+		/* Hands the slots back, now that they've been copied. */
+		smp_store_release(&ring->tail, tail);
+	}
+
+	tail = ring->latency_tail;
+	head = smp_load_acquire(&ring->latency_head);
+
+	while (tail != head) {
+		count = min(head - tail, (unsigned int)LATENCY_PER_MSG);
+		send_latency(jool, ring, tail, count);
+		tail += count;
+		smp_store_release(&ring->latency_tail, tail);
+	}
+}
+
+/* Sends everything the CPUs have queued. Can sleep. */
+static void natlog_drain(struct xlator *jool)
+{
+	struct natlog *log;
+	unsigned int cpu;
+
+	log = jool->nat64.natlog;
+
+	mutex_lock(&log->lock);
+	for_each_possible_cpu(cpu)
+		drain_ring(jool, *per_cpu_ptr(log->rings, cpu));
+	mutex_unlock(&log->lock);
+}
+
+static void drain_work_fn(struct work_struct *work)
+{
+	struct natlog_drain *drain;
+
+	drain = container_of(work, struct natlog_drain, work);
+
+	/*
+	 * Clear first; records queued from now on, which the drain might
+	 * miss, can schedule another one.
+	 */
+	clear_bit(NLP_DRAIN_SCHEDULED, &drain->jool.nat64.natlog->pending);
+	smp_mb__after_atomic();
+
+	natlog_drain(&drain->jool);
+
+	put_net(drain->jool.ns);
+	xlator_put(&drain->jool);
+	wkfree(struct natlog_drain, drain);
+}
+
+/* Hands the drain over to natlog_wq, unless it already has one pending. */
+static void request_drain(struct xlator *jool)
+{
+	struct natlog *log;
+	struct natlog_drain *drain;
+
+	log = jool->nat64.natlog;
+	if (test_and_set_bit(NLP_DRAIN_SCHEDULED, &log->pending))
+		return;
+
+	drain = wkmalloc(struct natlog_drain, GFP_ATOMIC);
+	if (!drain)
+		goto fail;
+	/* The namespace might be dying; see the note in struct xlator. */
+	if (!maybe_get_net(jool->ns)) {
+		wkfree(struct natlog_drain, drain);
+		goto fail;
+	}
+
+	memcpy(&drain->jool, jool, sizeof(*jool));
+	xlator_get(&drain->jool);
+	INIT_WORK(&drain->work, drain_work_fn);
+	queue_work(natlog_wq, &drain->work);
+	return;
+
+fail:
+	/* The timer will get to the records eventually. */
+	clear_bit(NLP_DRAIN_SCHEDULED, &log->pending);
+}
+
+/*
+ * Called from the packet path. The ring is drained when it's half full, and
+ * also by the timer, so records don't linger when traffic is light.
+ */
+static void queue_record(struct xlator *jool,
+		struct in6_addr const *src6, __u16 src6_port,
+		struct in_addr const *src4, __u16 src4_port, __u16 src4_port_max,
+		l4_protocol proto, enum natlog_event event)
+{
+	struct natlog_ring *ring;
+	struct natlog_record *record;
+	unsigned int head;
+	unsigned int used;
+
+	local_bh_disable();
+	ring = *this_cpu_ptr(jool->nat64.natlog->rings);
+	head = ring->head;
+	used = head - smp_load_acquire(&ring->tail);
+	if (used >= RING_SIZE) {
+		local_bh_enable();
+		jstat_inc(jool->stats, JSTAT_NATLOG_RECORDS_DROPPED);
+		return;
+	}
+
+	record = &ring->records[head & RING_MASK];
+	record->timestamp = ktime_get_real_ns();
+	memcpy(record->src6, src6, sizeof(record->src6));
+	memcpy(record->src4, src4, sizeof(record->src4));
+	record->src6_port = src6_port;
+	record->src4_port = src4_port;
+	record->src4_port_max = src4_port_max;
+	record->event = event;
+	record->proto = proto;
+	memset(record->reserved, 0, sizeof(record->reserved));
+
+	/* Publishes the record. */
+	smp_store_release(&ring->head, head + 1);
+	local_bh_enable();
+
+	if (used + 1 >= RING_SIZE / 2)
+		request_drain(jool);
+}
+
+/**
+ * natlog_add - Queues a BIB event for the natlog multicast group.
+ */
+void natlog_add(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4, l4_protocol proto,
+		enum natlog_event event)
+{
+	if (jool->globals.nat64.bib.bib_logging_binary)
+		queue_record(jool, &src6->l3, src6->l4, &src4->l3, src4->l4,
+				src4->l4, proto, event);
+}
+
+/**
+ * natlog_add_block - Queues a port block event for the natlog multicast group.
+ *
+ * The block is @src4's ports @min through @max. (Both included.)
+ */
+void natlog_add_block(struct xlator *jool, struct in6_addr const *src6,
+		struct in_addr const *src4, __u16 min, __u16 max,
+		l4_protocol proto, enum natlog_event event)
+{
+	if (jool->globals.nat64.bib.bib_logging_binary)
+		queue_record(jool, src6, 0, src4, min, max, proto, event);
+}
+
+static void copy_tuple(struct natlog_latency *sample, struct tuple *tuple)
+{
+	if (tuple->l3_proto == L3PROTO_IPV6) {
+		memcpy(sample->src, &tuple->src.addr6.l3, 16);
+		memcpy(sample->dst, &tuple->dst.addr6.l3, 16);
+		sample->src_port = tuple->src.addr6.l4;
+		sample->dst_port = tuple->dst.addr6.l4;
+	} else {
+		memcpy(sample->src, &tuple->src.addr4.l3, 4);
+		memcpy(sample->dst, &tuple->dst.addr4.l3, 4);
+		sample->src_port = tuple->src.addr4.l4;
+		sample->dst_port = tuple->dst.addr4.l4;
+	}
+	sample->l3_proto = tuple->l3_proto;
+	sample->l4_proto = tuple->l4_proto;
+}
+
+bool __natlog_latency_sample(struct natlog *log, __u32 rate)
+{
+	unsigned int left;
+
+	left = this_cpu_read(*log->countdowns);
+	if (left) {
+		this_cpu_write(*log->countdowns, left - 1);
+		return false;
+	}
+
+	this_cpu_write(*log->countdowns, rate - 1);
+	return true;
+}
+
+/**
+ * natlog_add_latency - Queues @state's timeline (started by
+ * natlog_latency_begin()) for the natlog multicast group.
+ *
+ * The tuple is the incoming one, since it's the only one every translation
+ * that gets past the packet's initialization has.
+ */
+void natlog_add_latency(struct xlation *state, verdict result)
+{
+	struct xlator *jool;
+	struct xlation_latency *latency;
+	struct natlog_ring *ring;
+	struct natlog_latency *sample;
+	unsigned int head;
+	unsigned int used;
+
+	jool = state->jool;
+	latency = &state->latency;
+
+	local_bh_disable();
+	ring = *this_cpu_ptr(jool->nat64.natlog->rings);
+	head = ring->latency_head;
+	used = head - smp_load_acquire(&ring->latency_tail);
+	if (used >= LATENCY_RING_SIZE) {
+		local_bh_enable();
+		jstat_inc(jool->stats, JSTAT_NATLOG_RECORDS_DROPPED);
+		return;
+	}
+
+	sample = &ring->latency[head & LATENCY_RING_MASK];
+	memset(sample, 0, sizeof(*sample));
+	sample->timestamp = latency->timestamp;
+	memcpy(sample->stages, latency->stages, sizeof(sample->stages));
+	if (latency->stages[JLAT_IN_TUPLE] != NATLOG_LATENCY_SKIPPED)
+		copy_tuple(sample, &state->in.tuple);
+	sample->verdict = result;
+	sample->stat = latency->stat;
+
+	smp_store_release(&ring->latency_head, head + 1);
+	local_bh_enable();
+
+	if (used + 1 >= LATENCY_RING_SIZE / 2)
+		request_drain(jool);
+}
+
+/**
+ * Called by the timer. Sends whatever the packet path hasn't, even if the
+ * global was disabled in the meantime.
+ */
+void natlog_clean(struct xlator *jool)
+{
+	natlog_drain(jool);
+}
@@ -0,0 +1,85 @@
+#ifndef SRC_MOD_COMMON_NATLOG_H_
+#define SRC_MOD_COMMON_NATLOG_H_
+
+/**
+ * @file
+ * Binary BIB and port block logging. (logging-bib-binary)
+ *
+ * The packet path writes fixed-size records (struct natlog_record) to its
+ * CPU's ring; a worker later drains the rings into Netlink messages, which are
+ * multicasted to the JOOLNL_NATLOG_GRP_NAME group. No text is formatted, and
+ * nothing is printk'd.
+ *
+ * Records that don't fit in a full ring are dropped and counted; nobody is
+ * made to wait.
+ *
+ * The same rings and messages also carry the latency samples
+ * (latency-sample): one in every latency-sample translations records the time
+ * at which each of its stages ended, along with its tuple and verdict. (See
+ * struct natlog_latency.)
+ */
+
+#include <linux/sched/clock.h>
+#include <linux/timekeeping.h>
+#include "common/config.h"
+#include "mod/common/translation_state.h"
+#include "mod/common/xlator.h"
+
+struct natlog;
+
+/* natlog_setup() not needed. */
+void natlog_teardown(void);
+
+struct natlog *natlog_alloc(void);
+void natlog_get(struct natlog *log);
+void natlog_put(struct natlog *log);
+
+void natlog_add(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4, l4_protocol proto,
+		enum natlog_event event);
+void natlog_add_block(struct xlator *jool, struct in6_addr const *src6,
+		struct in_addr const *src4, __u16 min, __u16 max,
+		l4_protocol proto, enum natlog_event event);
+
+bool __natlog_latency_sample(struct natlog *log, __u32 rate);
+void natlog_add_latency(struct xlation *state, verdict result);
+
+/* Decides whether @state's translation is sampled; starts its clock if so. */
+static inline void natlog_latency_begin(struct xlation *state)
+{
+	struct xlator *jool = state->jool;
+	__u32 rate = jool->fast.latency_sample;
+	struct xlation_latency *latency = &state->latency;
+	unsigned int i;
+
+	latency->sampled = unlikely(rate)
+			&& __natlog_latency_sample(jool->nat64.natlog, rate);
+	if (likely(!latency->sampled))
+		return;
+
+	latency->stat = 0;
+	latency->start = local_clock();
+	latency->timestamp = ktime_get_real_ns();
+	for (i = 0; i < JLAT_STAGE_COUNT; i++)
+		latency->stages[i] = NATLOG_LATENCY_SKIPPED;
+}
+
+/* Records the end of @stage, if @state is being sampled. */
+static inline void natlog_latency_stamp(struct xlation *state,
+		enum jool_latency_stage stage)
+{
+	if (unlikely(state->latency.sampled))
+		state->latency.stages[stage] =
+				local_clock() - state->latency.start;
+}
+
+/* Queues @state's sample, if it's being sampled. */
+static inline void natlog_latency_end(struct xlation *state, verdict result)
+{
+	if (unlikely(state->latency.sampled))
+		natlog_add_latency(state, result);
+}
+
+void natlog_clean(struct xlator *jool);
+
+#endif /* SRC_MOD_COMMON_NATLOG_H_ */
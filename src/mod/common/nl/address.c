@@ -136,3 +136,163 @@ revert_start:
 	request_handle_end(&jool);
 	return error;
 }
+
+static void bulk_put_entry(struct addrxlat_bulk_result *out,
+		struct address_translation_entry *entry)
+{
+	out->method = entry->method;
+	switch (entry->method) {
+	case AXM_RFC6052:
+		memcpy(out->prefix6, &entry->prefix6052.addr, 16);
+		out->prefix6_len = entry->prefix6052.len;
+		break;
+	case AXM_EAMT:
+		memcpy(out->prefix6, &entry->eam.prefix6.addr, 16);
+		out->prefix6_len = entry->eam.prefix6.len;
+		memcpy(out->prefix4, &entry->eam.prefix4.addr, 4);
+		out->prefix4_len = entry->eam.prefix4.len;
+		break;
+	case AXM_RFC6791:
+		break;
+	}
+}
+
+static void bulk_xlat64(struct xlator *jool, void const *query,
+		struct addrxlat_bulk_result *out)
+{
+	struct in6_addr addr;
+	struct result_addrxlat64 result;
+	struct addrxlat_result verdict;
+
+	memcpy(&addr, query, sizeof(addr));
+	verdict = addrxlat_siit64(jool, &addr, &result, true);
+	if (verdict.verdict != ADDRXLAT_CONTINUE)
+		return;
+
+	memcpy(out->addr, &result.addr, sizeof(result.addr));
+	bulk_put_entry(out, &result.entry);
+}
+
+static void bulk_xlat46(struct xlator *jool, void const *query,
+		struct addrxlat_bulk_result *out)
+{
+	__be32 addr;
+	struct result_addrxlat46 result;
+	struct addrxlat_result verdict;
+
+	memcpy(&addr, query, sizeof(addr));
+	verdict = addrxlat_siit46(jool, addr, &result, true, true);
+	if (verdict.verdict != ADDRXLAT_CONTINUE)
+		return;
+
+	memcpy(out->addr, &result.addr, sizeof(result.addr));
+	bulk_put_entry(out, &result.entry);
+}
+
+typedef void (*bulk_xlat_fn)(struct xlator *, void const *,
+		struct addrxlat_bulk_result *);
+
+/*
+ * Translates the @addr_len-byte addresses of the request's JNLAR_ADDR_QUERY
+ * array, in order, and answers as many of them as fit in the response.
+ * Untranslatable addresses don't fail the request; their results are marked
+ * ADDRXLAT_BULK_FAILED instead.
+ */
+static int handle_address_query_bulk(struct genl_info *info, size_t addr_len,
+		bulk_xlat_fn xlat)
+{
+	struct xlator jool;
+	struct nlattr *attr;
+	struct jool_response response;
+	struct addrxlat_bulk_result *results;
+	__u8 const *queries;
+	unsigned int count;
+	unsigned int room;
+	unsigned int i;
+	int error;
+
+	error = request_handle_start(info, XT_SIIT, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	/* Parse request */
+	attr = info->attrs[JNLAR_ADDR_QUERY];
+	if (!attr) {
+		log_err("The request lacks the addresses.");
+		error = -EINVAL;
+		goto revert_start;
+	}
+	if (nla_len(attr) == 0 || nla_len(attr) % addr_len) {
+		log_err("The request's address array has an invalid length: %d",
+				nla_len(attr));
+		error = -EINVAL;
+		goto revert_start;
+	}
+	count = nla_len(attr) / addr_len;
+	if (count > JOOLNL_BULK_MAX) {
+		log_err("Too many addresses in one request: %u > %u", count,
+				JOOLNL_BULK_MAX);
+		error = -EINVAL;
+		goto revert_start;
+	}
+	queries = nla_data(attr);
+
+	__log_debug(&jool, "Handling %u bulk address translation queries.",
+			count);
+
+	/* Build response */
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+
+	room = skb_tailroom(response.skb);
+	room = (room > NLA_HDRLEN)
+			? ((room - NLA_HDRLEN) / sizeof(*results))
+			: 0;
+	if (count > room)
+		count = room;
+	if (count == 0) {
+		report_put_failure();
+		error = -EMSGSIZE;
+		goto drop_response;
+	}
+
+	attr = nla_reserve(response.skb, JNLAR_ADDR_RESULTS,
+			count * sizeof(*results));
+	if (!attr) {
+		report_put_failure();
+		error = -EMSGSIZE;
+		goto drop_response;
+	}
+	results = nla_data(attr);
+	memset(results, 0, count * sizeof(*results));
+
+	/* Perform queries */
+	for (i = 0; i < count; i++) {
+		results[i].method = ADDRXLAT_BULK_FAILED;
+		xlat(&jool, queries + i * addr_len, &results[i]);
+	}
+
+	/* Send response */
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+drop_response:
+	jresponse_cleanup(&response);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+int handle_address_query64_bulk(struct sk_buff *skb, struct genl_info *info)
+{
+	return handle_address_query_bulk(info, sizeof(struct in6_addr),
+			bulk_xlat64);
+}
+
+int handle_address_query46_bulk(struct sk_buff *skb, struct genl_info *info)
+{
+	return handle_address_query_bulk(info, sizeof(struct in_addr),
+			bulk_xlat46);
+}
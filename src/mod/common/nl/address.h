@@ -6,5 +6,7 @@
 
 int handle_address_query64(struct sk_buff *skb, struct genl_info *info);
 int handle_address_query46(struct sk_buff *skb, struct genl_info *info);
+int handle_address_query64_bulk(struct sk_buff *skb, struct genl_info *info);
+int handle_address_query46_bulk(struct sk_buff *skb, struct genl_info *info);
 
 #endif /* SRC_MOD_COMMON_NL_ADDRESS_H_ */
@@ -18,3 +18,17 @@ int handle_atomconfig_request(struct sk_buff *skb, struct genl_info *info)
 
 	return jresponse_send_simple(NULL, info, error);
 }
+
+int handle_atomconfig_commit_batch(struct sk_buff *skb, struct genl_info *info)
+{
+	int error;
+
+	LOG_DEBUG("Handling atomic configuration batch commit.");
+
+	error = request_handle_start(info, XT_ANY, NULL, true);
+	if (!error)
+		error = atomconfig_commit_batch();
+	request_handle_end(NULL);
+
+	return jresponse_send_simple(NULL, info, error);
+}
@@ -4,5 +4,7 @@
 #include <net/genetlink.h>
 
 int handle_atomconfig_request(struct sk_buff *skb, struct genl_info *info);
+int handle_atomconfig_commit_batch(struct sk_buff *skb,
+		struct genl_info *info);
 
 #endif /* SRC_MOD_COMMON_NL_ATOMIC_CONFIG_H_ */
@@ -2,7 +2,9 @@
 
 #include <linux/sort.h>
 #include "common/constants.h"
+#include "mod/common/address.h"
 #include "mod/common/log.h"
+#include "mod/common/rfc6052.h"
 
 #define SERIALIZED_SESSION_SIZE (2 * sizeof(struct in6_addr) \
 		+ sizeof(struct in_addr) + sizeof(__be32) + 4 * sizeof(__be16))
@@ -218,6 +220,42 @@ int jnla_get_prefix4_optional(struct nlattr *attr, char const *name,
 			&out->prefix.addr);
 }
 
+int jnla_get_mark_range(struct nlattr *attr, char const *name,
+		struct config_mark_range *out)
+{
+	struct nlattr *attrs[JNLAMR_COUNT];
+	int error;
+
+	error = validate_null(attr, name);
+	if (error)
+		return error;
+
+	error = jnla_parse_nested(attrs, JNLAMR_MAX, attr,
+			joolnl_mark_range_policy, name);
+	if (error)
+		return error;
+
+	if (!attrs[JNLAMR_FIRST] && !attrs[JNLAMR_LAST]) {
+		out->set = false;
+		return 0;
+	}
+	if (!attrs[JNLAMR_FIRST] || !attrs[JNLAMR_LAST]) {
+		log_err("Malformed %s: one of the bounds is missing", name);
+		return -EINVAL;
+	}
+
+	out->set = true;
+	out->first = nla_get_u32(attrs[JNLAMR_FIRST]);
+	out->last = nla_get_u32(attrs[JNLAMR_LAST]);
+	if (out->first > out->last) {
+		log_err("The %s range is inverted. (%u > %u)", name,
+				out->first, out->last);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int jnla_get_port(struct nlattr *attr, __u16 *out)
 {
 	int error;
@@ -230,6 +268,76 @@ static int jnla_get_port(struct nlattr *attr, __u16 *out)
 	return 0;
 }
 
+/* Returns 1 if @attr is an empty nest ("unset"). */
+static int get_next_hop(struct nlattr *attr, char const *name,
+		const struct nla_policy *policy, struct nlattr **attrs,
+		char *dev)
+{
+	int error;
+
+	error = validate_null(attr, name);
+	if (error)
+		return error;
+
+	error = jnla_parse_nested(attrs, JNLANH_MAX, attr, policy, name);
+	if (error)
+		return error;
+
+	if (!attrs[JNLANH_GATEWAY] && !attrs[JNLANH_DEV])
+		return 1;
+	if (!attrs[JNLANH_GATEWAY] || !attrs[JNLANH_DEV]) {
+		log_err("Malformed %s: the gateway or the device is missing",
+				name);
+		return -EINVAL;
+	}
+
+	error = jnla_get_str(attrs[JNLANH_DEV], name, IFNAME_MAX_SIZE, dev);
+	if (error)
+		return error;
+	if (dev[0] == '\0') {
+		log_err("The %s device name is empty.", name);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int jnla_get_next_hop6(struct nlattr *attr, char const *name,
+		struct config_next_hop6 *out)
+{
+	struct nlattr *attrs[JNLANH_COUNT];
+	int error;
+
+	error = get_next_hop(attr, name, joolnl_next_hop6_policy, attrs,
+			out->dev);
+	if (error < 0)
+		return error;
+
+	out->set = !error;
+	return out->set
+			? jnla_get_addr6(attrs[JNLANH_GATEWAY], name,
+					&out->gateway)
+			: 0;
+}
+
+int jnla_get_next_hop4(struct nlattr *attr, char const *name,
+		struct config_next_hop4 *out)
+{
+	struct nlattr *attrs[JNLANH_COUNT];
+	int error;
+
+	error = get_next_hop(attr, name, joolnl_next_hop4_policy, attrs,
+			out->dev);
+	if (error < 0)
+		return error;
+
+	out->set = !error;
+	return out->set
+			? jnla_get_addr4(attrs[JNLANH_GATEWAY], name,
+					&out->gateway)
+			: 0;
+}
+
 int jnla_get_taddr6(struct nlattr *attr, char const *name,
 		struct ipv6_transport_addr *out)
 {
@@ -286,10 +394,18 @@ int jnla_get_eam(struct nlattr *attr, char const *name, struct eamt_entry *eam)
 		return error;
 
 	error = jnla_get_prefix6(attrs[JNLAE_PREFIX6], "IPv6 prefix", &eam->prefix6);
+	if (error)
+		return error;
+	error = jnla_get_prefix4(attrs[JNLAE_PREFIX4], "IPv4 prefix", &eam->prefix4);
 	if (error)
 		return error;
 
-	return jnla_get_prefix4(attrs[JNLAE_PREFIX4], "IPv4 prefix", &eam->prefix4);
+	/* Plain EAMs don't send the MAP-T fields. */
+	eam->ea_len = attrs[JNLAE_EA_LEN] ? nla_get_u8(attrs[JNLAE_EA_LEN]) : 0;
+	eam->psid_offset = attrs[JNLAE_PSID_OFFSET]
+			? nla_get_u8(attrs[JNLAE_PSID_OFFSET])
+			: 0;
+	return 0;
 }
 
 int jnla_get_pool4(struct nlattr *attr, char const *name,
@@ -364,9 +480,102 @@ int jnla_get_bib(struct nlattr *attr, char const *name, struct bib_entry *entry)
 	return 0;
 }
 
+/*
+ * Parses a JNLAR_FILTER. @bib means the query is a BIB one, which only knows
+ * the IPv6 and IPv4 source addresses.
+ */
+int jnla_get_filter(struct nlattr *attr, char const *name, bool bib,
+		struct query_filter *out)
+{
+	struct nlattr *attrs[JNLAF_COUNT];
+	int error;
+
+	error = validate_null(attr, name);
+	if (error)
+		return error;
+
+	error = jnla_parse_nested(attrs, JNLAF_MAX, attr, joolnl_filter_policy,
+			name);
+	if (error)
+		return error;
+
+	memset(out, 0, sizeof(*out));
+
+	if (attrs[JNLAF_SRC6]) {
+		error = jnla_get_prefix6(attrs[JNLAF_SRC6], "IPv6 source prefix",
+				&out->src6);
+		if (error)
+			return error;
+		error = prefix6_validate(&out->src6);
+		if (error)
+			return error;
+		out->flags |= QF_SRC6;
+	}
+	if (attrs[JNLAF_SRC4]) {
+		error = jnla_get_prefix4(attrs[JNLAF_SRC4], "IPv4 source prefix",
+				&out->src4);
+		if (error)
+			return error;
+		error = prefix4_validate(&out->src4);
+		if (error)
+			return error;
+		out->flags |= QF_SRC4;
+	}
+	if (attrs[JNLAF_PORT_MIN] || attrs[JNLAF_PORT_MAX]) {
+		out->ports.min = 0;
+		out->ports.max = 65535;
+		if (attrs[JNLAF_PORT_MIN])
+			out->ports.min = nla_get_u16(attrs[JNLAF_PORT_MIN]);
+		if (attrs[JNLAF_PORT_MAX])
+			out->ports.max = nla_get_u16(attrs[JNLAF_PORT_MAX]);
+		if (out->ports.min > out->ports.max) {
+			log_err("The filter's port range is empty: %u-%u",
+					out->ports.min, out->ports.max);
+			return -EINVAL;
+		}
+		out->flags |= QF_PORTS;
+	}
+
+	if (bib && (attrs[JNLAF_DST4] || attrs[JNLAF_STATE]
+			|| attrs[JNLAF_MIN_AGE])) {
+		log_err("BIB entries can only be filtered by source address and port.");
+		return -EINVAL;
+	}
+
+	if (attrs[JNLAF_DST4]) {
+		error = jnla_get_prefix4(attrs[JNLAF_DST4],
+				"IPv4 destination prefix", &out->dst4);
+		if (error)
+			return error;
+		error = prefix4_validate(&out->dst4);
+		if (error)
+			return error;
+		out->flags |= QF_DST4;
+	}
+	if (attrs[JNLAF_STATE]) {
+		out->state = nla_get_u8(attrs[JNLAF_STATE]);
+		out->flags |= QF_STATE;
+	}
+	if (attrs[JNLAF_MIN_AGE]) {
+		out->min_age = nla_get_u32(attrs[JNLAF_MIN_AGE]);
+		out->flags |= QF_MIN_AGE;
+	}
+
+	return 0;
+}
+
 static int get_timeout(struct bib_config *config, struct session_entry *entry)
 {
 	unsigned long timeout;
+	unsigned int class;
+
+	if (entry->timer_type == SESSION_TIMER_EST) {
+		class = timeout_class_find(config, entry->proto, &entry->dst4);
+		if (class) {
+			timeout = config->timeout_classes.values[class - 1].ttl;
+			goto end;
+		}
+	}
 
 	switch (entry->proto) {
 	case L4PROTO_TCP:
@@ -386,7 +595,9 @@ static int get_timeout(struct bib_config *config, struct session_entry *entry)
 		}
 		break;
 	case L4PROTO_UDP:
-		timeout = config->ttl.udp;
+		timeout = (entry->timer_type == SESSION_TIMER_TRANS)
+				? config->ttl.udp_fast
+				: config->ttl.udp;
 		break;
 	case L4PROTO_ICMP:
 		timeout = config->ttl.icmp;
@@ -396,6 +607,7 @@ static int get_timeout(struct bib_config *config, struct session_entry *entry)
 		return -EINVAL;
 	}
 
+end:
 	entry->timeout = msecs_to_jiffies(timeout);
 	return 0;
 }
@@ -461,6 +673,138 @@ int jnla_get_session_joold(struct nlattr *attr, char const *name,
 	return 0;
 }
 
+/*
+ * joold session batches (JNLAL_SESSION_BATCH) are a header followed by
+ * fixed-width records, with no Netlink overhead per session:
+ *
+ *	header: version (8 bits), flags (8 bits), session count (16 bits)
+ *	record: src6.l3 (128 bits), dst6.l3 (128 bits), src4.l3 (32 bits),
+ *		expiration in milliseconds (32 bits), src6.l4, dst6.l4, src4.l4
+ *		and proto/state/timer (16 bits each)
+ *
+ * If the header's JOOLD_BATCH_ELIDE_DST6 flag is set, dst6.l3 is replaced by
+ * dst4.l3 (32 bits), and the receiver rebuilds dst6 by prepending its own
+ * pool6 to it.
+ */
+static size_t record_size(bool elide_dst6)
+{
+	BUILD_BUG_ON(JOOLD_BATCH_RECORD_SIZE != SERIALIZED_SESSION_SIZE);
+	BUILD_BUG_ON(JOOLD_BATCH_RECORD_SIZE_ELIDED != SERIALIZED_SESSION_SIZE
+			- sizeof(struct in6_addr) + sizeof(struct in_addr));
+	return elide_dst6
+			? JOOLD_BATCH_RECORD_SIZE_ELIDED
+			: JOOLD_BATCH_RECORD_SIZE;
+}
+
+size_t jnla_session_batch_size(unsigned int count, bool elide_dst6)
+{
+	return JOOLD_BATCH_HDR_SIZE + count * record_size(elide_dst6);
+}
+
+static int read_record(__u8 *serialized, bool elide_dst6,
+		struct bib_config *config, struct ipv6_prefix const *pool6,
+		struct session_entry *entry)
+{
+	__be32 tmp32;
+	__be16 tmp16;
+	__u16 __tmp16;
+	int error;
+
+	memset(entry, 0, sizeof(*entry));
+
+	READ_RAW(serialized, entry->src6.l3);
+	if (elide_dst6) {
+		READ_RAW(serialized, entry->dst4.l3);
+		error = __rfc6052_4to6(pool6, &entry->dst4.l3,
+				&entry->dst6.l3);
+		if (error)
+			return error;
+	} else {
+		READ_RAW(serialized, entry->dst6.l3);
+		error = __rfc6052_6to4(pool6, &entry->dst6.l3,
+				&entry->dst4.l3);
+		if (error) {
+			log_err("Session destination %pI6c lacks the pool6 prefix.",
+					&entry->dst6.l3);
+			return error;
+		}
+	}
+	READ_RAW(serialized, entry->src4.l3);
+	READ_RAW(serialized, tmp32);
+
+	READ_RAW(serialized, tmp16);
+	entry->src6.l4 = ntohs(tmp16);
+	READ_RAW(serialized, tmp16);
+	entry->dst6.l4 = ntohs(tmp16);
+	READ_RAW(serialized, tmp16);
+	entry->src4.l4 = ntohs(tmp16);
+
+	READ_RAW(serialized, tmp16);
+	__tmp16 = ntohs(tmp16);
+	entry->proto = (__tmp16 >> 5) & 3;
+	entry->state = (__tmp16 >> 2) & 7;
+	entry->timer_type = __tmp16 & 3;
+
+	entry->dst4.l4 = (entry->proto == L4PROTO_ICMP)
+			? entry->src4.l4
+			: entry->dst6.l4;
+
+	error = get_timeout(config, entry);
+	if (error)
+		return error;
+
+	entry->update_time = jiffies + msecs_to_jiffies(ntohl(tmp32))
+			- entry->timeout;
+	entry->has_stored = false;
+	return 0;
+}
+
+int jnla_get_session_batch(struct nlattr *attr, struct bib_config *config,
+		struct ipv6_prefix const *pool6, jnla_session_cb cb, void *arg)
+{
+	__u8 *serialized;
+	unsigned int count;
+	unsigned int i;
+	bool elide_dst6;
+	struct session_entry entry;
+	int result;
+	int error;
+
+	if (nla_len(attr) < JOOLD_BATCH_HDR_SIZE) {
+		log_err("Invalid request: Session batch is truncated.");
+		return -EINVAL;
+	}
+
+	serialized = nla_data(attr);
+	if (serialized[0] != JOOLD_BATCH_VERSION) {
+		log_err("Unknown session batch version: %u. (Expected %u.)",
+				serialized[0], JOOLD_BATCH_VERSION);
+		return -EINVAL;
+	}
+	elide_dst6 = serialized[1] & JOOLD_BATCH_ELIDE_DST6;
+	count = (serialized[2] << 8) | serialized[3];
+
+	if (nla_len(attr) != jnla_session_batch_size(count, elide_dst6)) {
+		log_err("Invalid request: Session batch length (%d) doesn't match its session count (%u).",
+				nla_len(attr), count);
+		return -EINVAL;
+	}
+
+	result = 0;
+	serialized += JOOLD_BATCH_HDR_SIZE;
+	for (i = 0; i < count; i++) {
+		error = read_record(serialized, elide_dst6, config, pool6,
+				&entry);
+		if (!error)
+			error = cb(&entry, arg);
+		if (error)
+			result = error;
+		serialized += record_size(elide_dst6);
+	}
+
+	return result;
+}
+
 static int u16_compare(const void *a, const void *b)
 {
 	return *(__u16 *)b - *(__u16 *)a;
@@ -502,13 +846,14 @@ static int validate_plateaus(struct mtu_plateaus *plateaus)
 }
 
 
-int jnla_get_plateaus(struct nlattr *root, struct mtu_plateaus *out)
+static int get_u16_list(struct nlattr *root, char const *what,
+		__u16 *values, __u16 *count, unsigned int max)
 {
 	struct nlattr *attr;
 	int rem;
 	int error;
 
-	error = validate_null(root, "MTU plateaus");
+	error = validate_null(root, what);
 	if (error)
 		return error;
 	error = nla_validate(nla_data(root), nla_len(root), JNLAL_MAX,
@@ -516,93 +861,356 @@ int jnla_get_plateaus(struct nlattr *root, struct mtu_plateaus *out)
 	if (error)
 		return error;
 
-	out->count = 0;
+	*count = 0;
 	nla_for_each_nested(attr, root, rem) {
-		if (out->count >= PLATEAUS_MAX) {
-			log_err("Too many plateaus.");
+		if (*count >= max) {
+			log_err("Too many %s. (max: %u)", what, max);
 			return -EINVAL;
 		}
 
-		out->values[out->count] = nla_get_u16(attr);
-		out->count++;
+		values[*count] = nla_get_u16(attr);
+		(*count)++;
 	}
 
-	return validate_plateaus(out);
+	return 0;
 }
 
-int jnla_put_addr6(struct sk_buff *skb, int attrtype,
-		struct in6_addr const *addr)
+int jnla_get_plateaus(struct nlattr *root, struct mtu_plateaus *out)
 {
-	return nla_put(skb, attrtype, sizeof(*addr), addr);
+	int error;
+
+	error = get_u16_list(root, "MTU plateaus", out->values, &out->count,
+			PLATEAUS_MAX);
+	return error ? error : validate_plateaus(out);
 }
 
-int jnla_put_addr4(struct sk_buff *skb, int attrtype,
-		struct in_addr const *addr)
+int jnla_get_ports(struct nlattr *root, struct port_list *out)
 {
-	return nla_put(skb, attrtype, sizeof(*addr), addr);
+	return get_u16_list(root, "ports", out->values, &out->count,
+			PORT_LIST_MAX);
 }
 
-int jnla_put_prefix6(struct sk_buff *skb, int attrtype,
-		struct ipv6_prefix const *prefix)
+int jnla_get_ingress_devices(struct nlattr *root, struct ingress_devices *out)
 {
-	struct nlattr *root;
+	struct nlattr *attr;
+	int rem;
 	int error;
 
-	root = nla_nest_start(skb, attrtype);
-	if (!root)
-		return -EMSGSIZE;
+	error = validate_null(root, "ingress devices");
+	if (error)
+		return error;
+	error = nla_validate(nla_data(root), nla_len(root), JNLAL_MAX,
+			joolnl_ifname_list_policy, NULL);
+	if (error)
+		return error;
 
-	if (prefix) {
-		error = jnla_put_addr6(skb, JNLAP_ADDR, &prefix->addr);
-		if (error)
-			goto cancel;
-		error = nla_put_u8(skb, JNLAP_LEN, prefix->len);
-		if (error)
-			goto cancel;
-	} else {
-		error = nla_put_u8(skb, JNLAP_LEN, 0);
+	out->count = 0;
+	nla_for_each_nested(attr, root, rem) {
+		if (out->count >= INGRESS_DEVICES_MAX) {
+			log_err("Too many ingress devices. (max: %u)",
+					INGRESS_DEVICES_MAX);
+			return -EINVAL;
+		}
+
+		error = jnla_get_str(attr, "interface name",
+				IFNAME_MAX_SIZE, out->names[out->count]);
 		if (error)
-			goto cancel;
+			return error;
+		if (out->names[out->count][0] == '\0') {
+			log_err("Interface names cannot be empty.");
+			return -EINVAL;
+		}
+		out->count++;
 	}
 
-	nla_nest_end(skb, root);
 	return 0;
-
-cancel:
-	nla_nest_cancel(skb, root);
-	return error;
 }
 
-int jnla_put_prefix4(struct sk_buff *skb, int attrtype,
-		struct ipv4_prefix const *prefix)
+static int jnla_get_timeout_class(struct nlattr *attr,
+		struct timeout_class *out)
 {
-	struct nlattr *root;
+	struct nlattr *attrs[JNLATC_COUNT];
 	int error;
 
-	root = nla_nest_start(skb, attrtype);
-	if (!root)
-		return -EMSGSIZE;
-
-	if (prefix) {
-		error = jnla_put_addr4(skb, JNLAP_ADDR, &prefix->addr);
-		if (error)
-			goto cancel;
-		error = nla_put_u8(skb, JNLAP_LEN, prefix->len);
-		if (error)
-			goto cancel;
-	} else {
-		error = nla_put_u8(skb, JNLAP_LEN, 0);
-		if (error)
-			goto cancel;
-	}
-
-	nla_nest_end(skb, root);
-	return 0;
-
-cancel:
-	nla_nest_cancel(skb, root);
-	return error;
-}
+	error = jnla_parse_nested(attrs, JNLATC_MAX, attr,
+			joolnl_timeout_class_policy, "timeout class");
+	if (error)
+		return error;
+
+	error = jnla_get_u8(attrs[JNLATC_PROTO], "Protocol", &out->proto);
+	if (error)
+		return error;
+	error = jnla_get_prefix4(attrs[JNLATC_PREFIX], "IPv4 prefix",
+			&out->range.prefix);
+	if (error)
+		return error;
+	error = jnla_get_u16(attrs[JNLATC_PORT_MIN], "Minimum port",
+			&out->range.ports.min);
+	if (error)
+		return error;
+	error = jnla_get_u16(attrs[JNLATC_PORT_MAX], "Maximum port",
+			&out->range.ports.max);
+	if (error)
+		return error;
+	error = jnla_get_u32(attrs[JNLATC_TTL], "Timeout", &out->ttl);
+	if (error)
+		return error;
+	error = prefix4_validate(&out->range.prefix);
+	if (error)
+		return error;
+
+	if (out->proto != L4PROTO_TCP && out->proto != L4PROTO_UDP
+			&& out->proto != L4PROTO_ICMP) {
+		log_err("Unknown timeout class protocol: %u", out->proto);
+		return -EINVAL;
+	}
+	if (out->range.ports.min > out->range.ports.max) {
+		log_err("Timeout class port range is inverted: %u-%u",
+				out->range.ports.min, out->range.ports.max);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int jnla_get_pool6_tenant(struct nlattr *attr,
+		struct pool6_tenant *out)
+{
+	struct nlattr *attrs[JNLAPT_COUNT];
+	int error;
+
+	error = jnla_parse_nested(attrs, JNLAPT_MAX, attr,
+			joolnl_pool6_tenant_policy, "pool6 tenant");
+	if (error)
+		return error;
+
+	error = jnla_get_prefix6(attrs[JNLAPT_PREFIX], "IPv6 prefix",
+			&out->prefix);
+	if (error)
+		return error;
+
+	out->mark_set = !!attrs[JNLAPT_MARK];
+	out->mark = out->mark_set ? nla_get_u32(attrs[JNLAPT_MARK]) : 0;
+	return 0;
+}
+
+int jnla_get_pool6_tenants(struct nlattr *root, struct pool6_tenants *out)
+{
+	struct nlattr *attr;
+	int rem;
+	int error;
+
+	error = validate_null(root, "pool6 tenants");
+	if (error)
+		return error;
+	error = nla_validate(nla_data(root), nla_len(root), JNLAL_MAX,
+			joolnl_struct_list_policy, NULL);
+	if (error)
+		return error;
+
+	out->count = 0;
+	nla_for_each_nested(attr, root, rem) {
+		if (out->count >= POOL6_TENANTS_MAX) {
+			log_err("Too many pool6 tenants. (max: %u)",
+					POOL6_TENANTS_MAX);
+			return -EINVAL;
+		}
+
+		error = jnla_get_pool6_tenant(attr, &out->values[out->count]);
+		if (error)
+			return error;
+		out->count++;
+	}
+
+	return 0;
+}
+
+int jnla_get_timeout_classes(struct nlattr *root, struct timeout_classes *out)
+{
+	struct nlattr *attr;
+	int rem;
+	int error;
+
+	error = validate_null(root, "timeout classes");
+	if (error)
+		return error;
+	error = nla_validate(nla_data(root), nla_len(root), JNLAL_MAX,
+			joolnl_struct_list_policy, NULL);
+	if (error)
+		return error;
+
+	out->count = 0;
+	nla_for_each_nested(attr, root, rem) {
+		if (out->count >= TIMEOUT_CLASSES_MAX) {
+			log_err("Too many timeout classes. (max: %u)",
+					TIMEOUT_CLASSES_MAX);
+			return -EINVAL;
+		}
+
+		error = jnla_get_timeout_class(attr,
+				&out->values[out->count]);
+		if (error)
+			return error;
+		out->count++;
+	}
+
+	return 0;
+}
+
+int jnla_put_addr6(struct sk_buff *skb, int attrtype,
+		struct in6_addr const *addr)
+{
+	return nla_put(skb, attrtype, sizeof(*addr), addr);
+}
+
+int jnla_put_addr4(struct sk_buff *skb, int attrtype,
+		struct in_addr const *addr)
+{
+	return nla_put(skb, attrtype, sizeof(*addr), addr);
+}
+
+int jnla_put_prefix6(struct sk_buff *skb, int attrtype,
+		struct ipv6_prefix const *prefix)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	if (prefix) {
+		error = jnla_put_addr6(skb, JNLAP_ADDR, &prefix->addr);
+		if (error)
+			goto cancel;
+		error = nla_put_u8(skb, JNLAP_LEN, prefix->len);
+		if (error)
+			goto cancel;
+	} else {
+		error = nla_put_u8(skb, JNLAP_LEN, 0);
+		if (error)
+			goto cancel;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+
+cancel:
+	nla_nest_cancel(skb, root);
+	return error;
+}
+
+int jnla_put_prefix4(struct sk_buff *skb, int attrtype,
+		struct ipv4_prefix const *prefix)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	if (prefix) {
+		error = jnla_put_addr4(skb, JNLAP_ADDR, &prefix->addr);
+		if (error)
+			goto cancel;
+		error = nla_put_u8(skb, JNLAP_LEN, prefix->len);
+		if (error)
+			goto cancel;
+	} else {
+		error = nla_put_u8(skb, JNLAP_LEN, 0);
+		if (error)
+			goto cancel;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+
+cancel:
+	nla_nest_cancel(skb, root);
+	return error;
+}
+
+int jnla_put_mark_range(struct sk_buff *skb, int attrtype,
+		struct config_mark_range const *range)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	if (range->set) {
+		error = nla_put_u32(skb, JNLAMR_FIRST, range->first);
+		if (error)
+			goto cancel;
+		error = nla_put_u32(skb, JNLAMR_LAST, range->last);
+		if (error)
+			goto cancel;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+
+cancel:
+	nla_nest_cancel(skb, root);
+	return error;
+}
+
+int jnla_put_next_hop6(struct sk_buff *skb, int attrtype,
+		struct config_next_hop6 const *hop)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	if (hop->set) {
+		error = jnla_put_addr6(skb, JNLANH_GATEWAY, &hop->gateway);
+		if (error)
+			goto cancel;
+		error = nla_put_string(skb, JNLANH_DEV, hop->dev);
+		if (error)
+			goto cancel;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+
+cancel:
+	nla_nest_cancel(skb, root);
+	return error;
+}
+
+int jnla_put_next_hop4(struct sk_buff *skb, int attrtype,
+		struct config_next_hop4 const *hop)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	if (hop->set) {
+		error = jnla_put_addr4(skb, JNLANH_GATEWAY, &hop->gateway);
+		if (error)
+			goto cancel;
+		error = nla_put_string(skb, JNLANH_DEV, hop->dev);
+		if (error)
+			goto cancel;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+
+cancel:
+	nla_nest_cancel(skb, root);
+	return error;
+}
 
 int jnla_put_taddr6(struct sk_buff *skb, int attrtype,
 		struct ipv6_transport_addr const *taddr)
@@ -670,6 +1278,14 @@ int jnla_put_eam(struct sk_buff *skb, int attrtype,
 	error = jnla_put_prefix4(skb, JNLAE_PREFIX4, &eam->prefix4);
 	if (error)
 		goto cancel;
+	if (eam->ea_len) {
+		error = nla_put_u8(skb, JNLAE_EA_LEN, eam->ea_len);
+		if (error)
+			goto cancel;
+		error = nla_put_u8(skb, JNLAE_PSID_OFFSET, eam->psid_offset);
+		if (error)
+			goto cancel;
+	}
 
 	nla_nest_end(skb, root);
 	return 0;
@@ -679,6 +1295,18 @@ cancel:
 	return error;
 }
 
+static int put_pool4_fields(struct sk_buff *skb,
+		struct pool4_entry const *entry)
+{
+	return nla_put_u32(skb, JNLAP4_MARK, entry->mark)
+		|| nla_put_u32(skb, JNLAP4_ITERATIONS, entry->iterations)
+		|| nla_put_u8(skb, JNLAP4_FLAGS, entry->flags)
+		|| nla_put_u8(skb, JNLAP4_PROTO, entry->proto)
+		|| jnla_put_prefix4(skb, JNLAP4_PREFIX, &entry->range.prefix)
+		|| nla_put_u16(skb, JNLAP4_PORT_MIN, entry->range.ports.min)
+		|| nla_put_u16(skb, JNLAP4_PORT_MAX, entry->range.ports.max);
+}
+
 int jnla_put_pool4(struct sk_buff *skb, int attrtype,
 		struct pool4_entry const *entry)
 {
@@ -689,13 +1317,29 @@ int jnla_put_pool4(struct sk_buff *skb, int attrtype,
 	if (!root)
 		return -EMSGSIZE;
 
-	error = nla_put_u32(skb, JNLAP4_MARK, entry->mark)
-		|| nla_put_u32(skb, JNLAP4_ITERATIONS, entry->iterations)
-		|| nla_put_u8(skb, JNLAP4_FLAGS, entry->flags)
-		|| nla_put_u8(skb, JNLAP4_PROTO, entry->proto)
-		|| jnla_put_prefix4(skb, JNLAP4_PREFIX, &entry->range.prefix)
-		|| nla_put_u16(skb, JNLAP4_PORT_MIN, entry->range.ports.min)
-		|| nla_put_u16(skb, JNLAP4_PORT_MAX, entry->range.ports.max);
+	error = put_pool4_fields(skb, entry);
+	if (error) {
+		nla_nest_cancel(skb, root);
+		return error;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+/* Same as jnla_put_pool4(), plus the number of BIB entries using @entry. */
+int jnla_put_pool4_usage(struct sk_buff *skb, int attrtype,
+		struct pool4_entry const *entry, __u64 used)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	error = put_pool4_fields(skb, entry)
+		|| nla_put_u64_64bit(skb, JNLAP4_USED, used, JNLAP4_PAD);
 	if (error) {
 		nla_nest_cancel(skb, root);
 		return error;
@@ -717,7 +1361,10 @@ int jnla_put_bib(struct sk_buff *skb, int attrtype, struct bib_entry const *bib)
 	error = jnla_put_taddr6(skb, JNLAB_SRC6, &bib->addr6)
 		|| jnla_put_taddr4(skb, JNLAB_SRC4, &bib->addr4)
 		|| nla_put_u8(skb, JNLAB_PROTO, bib->l4_proto)
-		|| nla_put_u8(skb, JNLAB_STATIC, bib->is_static);
+		|| nla_put_u8(skb, JNLAB_STATIC, bib->is_static)
+		|| nla_put_u64_64bit(skb, JNLAB_PACKETS, bib->packets,
+				JNLAB_PAD)
+		|| nla_put_u64_64bit(skb, JNLAB_BYTES, bib->bytes, JNLAB_PAD);
 	if (error) {
 		nla_nest_cancel(skb, root);
 		return -EMSGSIZE;
@@ -752,7 +1399,11 @@ int jnla_put_session(struct sk_buff *skb, int attrtype,
 		|| nla_put_u8(skb, JNLASE_PROTO, entry->proto)
 		|| nla_put_u8(skb, JNLASE_STATE, entry->state)
 		|| nla_put_u8(skb, JNLASE_TIMER, entry->timer_type)
-		|| nla_put_u32(skb, JNLASE_EXPIRATION, dying_time);
+		|| nla_put_u32(skb, JNLASE_EXPIRATION, dying_time)
+		|| nla_put_u64_64bit(skb, JNLASE_PACKETS, entry->packets,
+				JNLASE_PAD)
+		|| nla_put_u64_64bit(skb, JNLASE_BYTES, entry->bytes,
+				JNLASE_PAD);
 	if (error) {
 		nla_nest_cancel(skb, root);
 		return error;
@@ -821,8 +1472,186 @@ int jnla_put_session_joold(struct sk_buff *skb, int attrtype,
 	return nla_put(skb, attrtype, sizeof(buffer), buffer);
 }
 
+void jnla_write_session_batch_hdr(__u8 *buffer, unsigned int count,
+		bool elide_dst6)
+{
+	buffer[0] = JOOLD_BATCH_VERSION;
+	buffer[1] = elide_dst6 ? JOOLD_BATCH_ELIDE_DST6 : 0;
+	buffer[2] = count >> 8;
+	buffer[3] = count & 0xFF;
+}
+
+size_t jnla_write_session_record(__u8 *buffer,
+		struct session_entry const *entry, bool elide_dst6)
+{
+	size_t offset;
+	unsigned long dying_time;
+	__be32 tmp32;
+	__be16 tmp16;
+
+	offset = 0;
+
+	ADD_RAW(buffer, offset, entry->src6.l3);
+	if (elide_dst6) {
+		ADD_RAW(buffer, offset, entry->dst4.l3);
+	} else {
+		ADD_RAW(buffer, offset, entry->dst6.l3);
+	}
+	ADD_RAW(buffer, offset, entry->src4.l3);
+
+	dying_time = entry->update_time + entry->timeout;
+	dying_time = (dying_time > jiffies)
+			? jiffies_to_msecs(dying_time - jiffies)
+			: 0;
+	if (dying_time > MAX_U32)
+		dying_time = MAX_U32;
+
+	tmp32 = htonl(dying_time);
+	ADD_RAW(buffer, offset, tmp32);
+
+	tmp16 = htons(entry->src6.l4);
+	ADD_RAW(buffer, offset, tmp16);
+	tmp16 = htons(entry->dst6.l4);
+	ADD_RAW(buffer, offset, tmp16);
+	tmp16 = htons(entry->src4.l4);
+	ADD_RAW(buffer, offset, tmp16);
+	tmp16 = htons((entry->proto << 5)
+			| (entry->state << 2)
+			| entry->timer_type);
+	ADD_RAW(buffer, offset, tmp16);
+
+	return offset;
+}
+
+static int put_u16_list(struct sk_buff *skb, int attrtype,
+		__u16 const *values, unsigned int count)
+{
+	struct nlattr *root;
+	unsigned int i;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	for (i = 0; i < count; i++) {
+		error = nla_put_u16(skb, JNLAL_ENTRY, values[i]);
+		if (error) {
+			nla_nest_cancel(skb, root);
+			return error;
+		}
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
 int jnla_put_plateaus(struct sk_buff *skb, int attrtype,
 		struct mtu_plateaus const *plateaus)
+{
+	return put_u16_list(skb, attrtype, plateaus->values, plateaus->count);
+}
+
+int jnla_put_ports(struct sk_buff *skb, int attrtype,
+		struct port_list const *ports)
+{
+	return put_u16_list(skb, attrtype, ports->values, ports->count);
+}
+
+int jnla_put_ingress_devices(struct sk_buff *skb, int attrtype,
+		struct ingress_devices const *devices)
+{
+	struct nlattr *root;
+	unsigned int i;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	for (i = 0; i < devices->count; i++) {
+		error = nla_put_string(skb, JNLAL_ENTRY, devices->names[i]);
+		if (error) {
+			nla_nest_cancel(skb, root);
+			return error;
+		}
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+static int jnla_put_timeout_class(struct sk_buff *skb,
+		struct timeout_class const *class)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, JNLAL_ENTRY);
+	if (!root)
+		return -EMSGSIZE;
+
+	error = nla_put_u8(skb, JNLATC_PROTO, class->proto)
+		|| jnla_put_prefix4(skb, JNLATC_PREFIX, &class->range.prefix)
+		|| nla_put_u16(skb, JNLATC_PORT_MIN, class->range.ports.min)
+		|| nla_put_u16(skb, JNLATC_PORT_MAX, class->range.ports.max)
+		|| nla_put_u32(skb, JNLATC_TTL, class->ttl);
+	if (error) {
+		nla_nest_cancel(skb, root);
+		return error;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+static int jnla_put_pool6_tenant(struct sk_buff *skb,
+		struct pool6_tenant const *tenant)
+{
+	struct nlattr *root;
+	int error;
+
+	root = nla_nest_start(skb, JNLAL_ENTRY);
+	if (!root)
+		return -EMSGSIZE;
+
+	error = jnla_put_prefix6(skb, JNLAPT_PREFIX, &tenant->prefix);
+	if (!error && tenant->mark_set)
+		error = nla_put_u32(skb, JNLAPT_MARK, tenant->mark);
+	if (error) {
+		nla_nest_cancel(skb, root);
+		return error;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+int jnla_put_pool6_tenants(struct sk_buff *skb, int attrtype,
+		struct pool6_tenants const *tenants)
+{
+	struct nlattr *root;
+	unsigned int i;
+	int error;
+
+	root = nla_nest_start(skb, attrtype);
+	if (!root)
+		return -EMSGSIZE;
+
+	for (i = 0; i < tenants->count; i++) {
+		error = jnla_put_pool6_tenant(skb, &tenants->values[i]);
+		if (error) {
+			nla_nest_cancel(skb, root);
+			return error;
+		}
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+int jnla_put_timeout_classes(struct sk_buff *skb, int attrtype,
+		struct timeout_classes const *classes)
 {
 	struct nlattr *root;
 	unsigned int i;
@@ -832,8 +1661,8 @@ int jnla_put_plateaus(struct sk_buff *skb, int attrtype,
 	if (!root)
 		return -EMSGSIZE;
 
-	for (i = 0; i < plateaus->count; i++) {
-		error = nla_put_u16(skb, JNLAL_ENTRY, plateaus->values[i]);
+	for (i = 0; i < classes->count; i++) {
+		error = jnla_put_timeout_class(skb, &classes->values[i]);
 		if (error) {
 			nla_nest_cancel(skb, root);
 			return error;
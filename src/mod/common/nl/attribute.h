@@ -15,27 +15,51 @@ int jnla_get_prefix6(struct nlattr *attr, char const *name, struct ipv6_prefix *
 int jnla_get_prefix6_optional(struct nlattr *attr, char const *name, struct config_prefix6 *out);
 int jnla_get_prefix4(struct nlattr *attr, char const *name, struct ipv4_prefix *out);
 int jnla_get_prefix4_optional(struct nlattr *attr, char const *name, struct config_prefix4 *out);
+int jnla_get_mark_range(struct nlattr *attr, char const *name, struct config_mark_range *out);
+int jnla_get_next_hop6(struct nlattr *attr, char const *name, struct config_next_hop6 *out);
+int jnla_get_next_hop4(struct nlattr *attr, char const *name, struct config_next_hop4 *out);
 int jnla_get_taddr6(struct nlattr *attr, char const *name, struct ipv6_transport_addr *out);
 int jnla_get_taddr4(struct nlattr *attr, char const *name, struct ipv4_transport_addr *out);
 int jnla_get_eam(struct nlattr *attr, char const *name, struct eamt_entry *eam);
 int jnla_get_pool4(struct nlattr *attr, char const *name, struct pool4_entry *entry);
 int jnla_get_bib(struct nlattr *attr, char const *name, struct bib_entry *entry);
+int jnla_get_filter(struct nlattr *attr, char const *name, bool bib, struct query_filter *out);
 int jnla_get_session_joold(struct nlattr *attr, char const *name, struct bib_config *config, struct session_entry *entry);
 int jnla_get_plateaus(struct nlattr *attr, struct mtu_plateaus *out);
+int jnla_get_ports(struct nlattr *attr, struct port_list *out);
+int jnla_get_ingress_devices(struct nlattr *attr, struct ingress_devices *out);
+int jnla_get_timeout_classes(struct nlattr *attr, struct timeout_classes *out);
+int jnla_get_pool6_tenants(struct nlattr *attr, struct pool6_tenants *out);
+
+/* Session batches. (See attribute.c.) */
+typedef int (*jnla_session_cb)(struct session_entry *, void *);
+size_t jnla_session_batch_size(unsigned int count, bool elide_dst6);
+int jnla_get_session_batch(struct nlattr *attr, struct bib_config *config, struct ipv6_prefix const *pool6, jnla_session_cb cb, void *arg);
+void jnla_write_session_batch_hdr(__u8 *buffer, unsigned int count, bool elide_dst6);
+size_t jnla_write_session_record(__u8 *buffer, struct session_entry const *entry, bool elide_dst6);
 
 /* Note: None of these print error messages. */
 int jnla_put_addr6(struct sk_buff *skb, int attrtype, struct in6_addr const *addr);
 int jnla_put_addr4(struct sk_buff *skb, int attrtype, struct in_addr const *addr);
 int jnla_put_prefix6(struct sk_buff *skb, int attrtype, struct ipv6_prefix const *prefix);
 int jnla_put_prefix4(struct sk_buff *skb, int attrtype, struct ipv4_prefix const *prefix);
+int jnla_put_mark_range(struct sk_buff *skb, int attrtype, struct config_mark_range const *range);
+int jnla_put_next_hop6(struct sk_buff *skb, int attrtype, struct config_next_hop6 const *hop);
+int jnla_put_next_hop4(struct sk_buff *skb, int attrtype, struct config_next_hop4 const *hop);
 int jnla_put_taddr6(struct sk_buff *skb, int attrtype, struct ipv6_transport_addr const *prefix);
 int jnla_put_taddr4(struct sk_buff *skb, int attrtype, struct ipv4_transport_addr const *prefix);
 int jnla_put_eam(struct sk_buff *skb, int attrtype, struct eamt_entry const *eam);
 int jnla_put_pool4(struct sk_buff *skb, int attrtype, struct pool4_entry const *bib);
+int jnla_put_pool4_usage(struct sk_buff *skb, int attrtype,
+		struct pool4_entry const *entry, __u64 used);
 int jnla_put_bib(struct sk_buff *skb, int attrtype, struct bib_entry const *bib);
 int jnla_put_session(struct sk_buff *skb, int attrtype, struct session_entry const *entry);
 int jnla_put_session_joold(struct sk_buff *skb, int attrtype, struct session_entry const *entry);
 int jnla_put_plateaus(struct sk_buff *skb, int attrtype, struct mtu_plateaus const *plateaus);
+int jnla_put_ports(struct sk_buff *skb, int attrtype, struct port_list const *ports);
+int jnla_put_ingress_devices(struct sk_buff *skb, int attrtype, struct ingress_devices const *devices);
+int jnla_put_timeout_classes(struct sk_buff *skb, int attrtype, struct timeout_classes const *classes);
+int jnla_put_pool6_tenants(struct sk_buff *skb, int attrtype, struct pool6_tenants const *tenants);
 
 int jnla_parse_nested(struct nlattr *tb[], int maxtype,
 		const struct nlattr *nla, const struct nla_policy *policy,
@@ -1,22 +1,41 @@
 #include "mod/common/nl/bib.h"
 
+#include "mod/common/error_pool.h"
 #include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 #include "mod/common/nl/attribute.h"
+#include "mod/common/nl/filter.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/db/pool4/db.h"
 #include "mod/common/db/bib/db.h"
 
-static int serialize_bib_entry(struct bib_entry const *entry, void *arg)
+struct bib_dump_page {
+	struct sk_buff *skb;
+	struct nl_filter filter;
+	/* The last BIB entry sent */
+	struct ipv4_transport_addr last;
+};
+
+static int dump_bib_entry(struct bib_entry const *entry, void *arg)
 {
-	return jnla_put_bib(arg, JNLAL_ENTRY, entry) ? 1 : 0;
+	struct bib_dump_page *page = arg;
+
+	if (!nl_filter_bib(&page->filter, entry))
+		return 0;
+	if (jnla_put_bib(page->skb, JNLAL_ENTRY, entry))
+		return 1;
+
+	page->last = entry->addr4;
+	return 0;
 }
 
 int handle_bib_foreach(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
 	struct jool_response response;
+	struct bib_dump_page page;
 	struct bib_entry offset, *offset_ptr;
 	int error;
 
@@ -45,8 +64,15 @@ int handle_bib_foreach(struct sk_buff *skb, struct genl_info *info)
 		goto revert_response;
 	}
 
-	error = bib_foreach(jool.nat64.bib, offset.l4_proto, serialize_bib_entry,
-			response.skb, offset_ptr ? &offset_ptr->addr4 : NULL);
+	error = nl_filter_init(info->attrs[JNLAR_FILTER], true, &page.filter);
+	if (error)
+		goto revert_response;
+
+	page.skb = response.skb;
+	error = bib_foreach_range(jool.nat64.bib, offset.l4_proto,
+			dump_bib_entry, &page,
+			offset_ptr ? &offset_ptr->addr4 : NULL,
+			nl_filter_range(&page.filter));
 
 	error = jresponse_send_array(&jool, &response, error);
 	if (error)
@@ -63,6 +89,90 @@ revert_start:
 	return error;
 }
 
+/* Dump cursor; the last BIB entry sent. (cb->args[0] belongs to jdump.) */
+enum bib_dump_args {
+	BDA_ADDR = 1,
+	BDA_PORT,
+};
+
+/*
+ * Same as handle_bib_foreach(), except the kernel calls it back to back, one
+ * page at a time, until it returns 0. The client doesn't have to request each
+ * page.
+ */
+int handle_bib_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *attrs[JNLAR_COUNT];
+	struct xlator jool;
+	struct jool_dump dump;
+	struct bib_dump_page page;
+	struct bib_entry offset;
+	struct ipv4_transport_addr *offset_ptr;
+	int error;
+
+	if (cb->args[0] == JDUMP_DONE)
+		return 0;
+
+	error_pool_activate();
+
+	error = jdump_init(&dump, skb, cb);
+	if (error)
+		goto end;
+
+	error = dump_handle_start(cb, XT_NAT64, attrs, &jool);
+	if (error) {
+		error = jdump_end(NULL, &dump, error);
+		goto end;
+	}
+
+	if (attrs[JNLAR_OFFSET]) {
+		error = jnla_get_bib(attrs[JNLAR_OFFSET], "Iteration offset", &offset);
+		if (error)
+			goto revert_start;
+		offset_ptr = &offset.addr4;
+	} else if (attrs[JNLAR_PROTO]) {
+		offset.l4_proto = nla_get_u8(attrs[JNLAR_PROTO]);
+		offset_ptr = NULL;
+	} else {
+		log_err("The request is missing a protocol.");
+		error = -EINVAL;
+		goto revert_start;
+	}
+
+	if (cb->args[0] == JDUMP_CONTINUE) {
+		offset.addr4.l3.s_addr = (__force __be32)cb->args[BDA_ADDR];
+		offset.addr4.l4 = cb->args[BDA_PORT];
+		offset_ptr = &offset.addr4;
+	}
+
+	if (offset_ptr)
+		__log_debug(&jool, "Dumping BIB from " TA4PP ".", TA4PA(*offset_ptr));
+	else
+		__log_debug(&jool, "Dumping BIB.");
+
+	error = nl_filter_init(attrs[JNLAR_FILTER], true, &page.filter);
+	if (error)
+		goto revert_start;
+
+	page.skb = skb;
+	memset(&page.last, 0, sizeof(page.last));
+	error = bib_foreach_range(jool.nat64.bib, offset.l4_proto,
+			dump_bib_entry, &page, offset_ptr,
+			nl_filter_range(&page.filter));
+	if (error > 0) {
+		cb->args[BDA_ADDR] = (__force u32)page.last.l3.s_addr;
+		cb->args[BDA_PORT] = page.last.l4;
+	}
+	/* Fall through. */
+
+revert_start:
+	error = jdump_end(&jool, &dump, error);
+	request_handle_end(&jool);
+end:
+	error_pool_deactivate();
+	return error;
+}
+
 int handle_bib_add(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
@@ -93,6 +203,133 @@ revert_start:
 	return error;
 }
 
+static int parse_bulk(struct nlattr *root, struct bib_entry **result,
+		unsigned int *count)
+{
+	struct bib_entry *entries;
+	struct nlattr *attr;
+	unsigned int i;
+	int rem;
+	int error;
+
+	i = 0;
+	nla_for_each_nested(attr, root, rem)
+		i++;
+	if (i > JOOLNL_BULK_MAX) {
+		log_err("The request contains %u entries; the maximum is %u.",
+				i, JOOLNL_BULK_MAX);
+		return -EINVAL;
+	}
+
+	entries = __wkvmalloc("BIB bulk", max(i, 1u) * sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	i = 0;
+	nla_for_each_nested(attr, root, rem) {
+		error = jnla_get_bib(attr, "BIB entry", &entries[i]);
+		if (error) {
+			__wkvfree("BIB bulk", entries);
+			return error;
+		}
+		i++;
+	}
+
+	*result = entries;
+	*count = i;
+	return 0;
+}
+
+/* Bit i of the attribute is bit (i % 8) of byte (i / 8). */
+static int put_failures(struct sk_buff *skb, unsigned long *failures,
+		unsigned int count)
+{
+	struct nlattr *attr;
+	__u8 *bytes;
+	unsigned int i;
+
+	attr = nla_reserve(skb, JNLAR_BULK_FAILURES, DIV_ROUND_UP(count, 8));
+	if (!attr)
+		return -EMSGSIZE;
+
+	bytes = nla_data(attr);
+	memset(bytes, 0, nla_len(attr));
+	for_each_set_bit(i, failures, count)
+		bytes[i >> 3] |= 1 << (i & 7);
+
+	return 0;
+}
+
+/*
+ * Adds several static BIB entries at once. Entries that cannot be added do not
+ * fail the request; they are reported in the response's JNLAR_BULK_FAILURES
+ * bitmap instead. (Which is omitted if everything went in.)
+ */
+int handle_bib_add_bulk(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jool_response response;
+	struct bib_entry *entries;
+	unsigned long *failures;
+	unsigned int count;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	if (!info->attrs[JNLAR_BIB_ENTRIES]) {
+		log_err("The request lacks a BIB entry container.");
+		error = -EINVAL;
+		goto revert_start;
+	}
+
+	error = parse_bulk(info->attrs[JNLAR_BIB_ENTRIES], &entries, &count);
+	if (error)
+		goto revert_start;
+	__log_debug(&jool, "Adding %u static BIB entries.", count);
+
+	failures = __wkmalloc("BIB bulk failures",
+			BITS_TO_LONGS(max(count, 1u)) * sizeof(unsigned long),
+			GFP_KERNEL);
+	if (!failures) {
+		error = -ENOMEM;
+		goto revert_entries;
+	}
+
+	error = bib_add_static_bulk(&jool, entries, count, failures);
+	if (error)
+		goto revert_failures;
+
+	if (bitmap_empty(failures, count))
+		goto revert_failures; /* Just ACK. */
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_failures;
+	error = put_failures(response.skb, failures, count);
+	if (error) {
+		report_put_failure();
+		jresponse_cleanup(&response);
+		goto revert_failures;
+	}
+	error = jresponse_send(&response);
+
+	__wkfree("BIB bulk failures", failures);
+	__wkvfree("BIB bulk", entries);
+	request_handle_end(&jool);
+	return error;
+
+revert_failures:
+	__wkfree("BIB bulk failures", failures);
+revert_entries:
+	__wkvfree("BIB bulk", entries);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
 int handle_bib_rm(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
@@ -160,3 +397,73 @@ esrch:
 	log_err("The entry wasn't in the database.");
 	goto revert_start;
 }
+
+#define ALL_PROTOS \
+	((1 << L4PROTO_TCP) | (1 << L4PROTO_UDP) | (1 << L4PROTO_ICMP))
+
+/*
+ * Removes every BIB entry (and its sessions) of the JNLAR_PROTOS protocols that
+ * matches the JNLAR_FILTER. The response's JNLAR_PURGED says how many were
+ * removed.
+ *
+ * Only the filter's src6, src4 and ports are honored.
+ */
+int handle_bib_purge(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jool_response response;
+	struct nl_filter filter;
+	__u8 protos;
+	l4_protocol proto;
+	unsigned long removed;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	protos = info->attrs[JNLAR_PROTOS]
+			? nla_get_u8(info->attrs[JNLAR_PROTOS])
+			: ALL_PROTOS;
+	if (!protos || (protos & ~ALL_PROTOS)) {
+		log_err("Protocol bitmap 0x%x is invalid.", protos);
+		error = -EINVAL;
+		goto revert_start;
+	}
+
+	error = nl_filter_init(info->attrs[JNLAR_FILTER], true, &filter);
+	if (error)
+		goto revert_start;
+
+	__log_debug(&jool, "Purging BIB.");
+
+	removed = 0;
+	for (proto = L4PROTO_TCP; proto <= L4PROTO_ICMP; proto++) {
+		if (!(protos & (1 << proto)))
+			continue;
+		removed += bib_purge(&jool, proto, nl_filter_range(&filter),
+				(filter.query.flags & QF_SRC6)
+						? &filter.query.src6
+						: NULL);
+	}
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+	error = nla_put_u32(response.skb, JNLAR_PURGED,
+			min_t(unsigned long, removed, U32_MAX));
+	if (error) {
+		report_put_failure();
+		jresponse_cleanup(&response);
+		goto revert_start;
+	}
+
+	error = jresponse_send(&response);
+	request_handle_end(&jool);
+	return error;
+
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
@@ -8,6 +8,33 @@
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/db/denylist4.h"
 
+/* See unpublish_eamt(). */
+static int unpublish_denylist4(struct xlator *jool, bool copy, bool *replaced)
+{
+	struct addr4_pool *pool;
+	int error;
+
+	*replaced = false;
+	if (!denylist4_is_published(jool->siit.denylist4))
+		return 0;
+
+	if (copy) {
+		error = denylist4_clone(jool->siit.denylist4, &pool);
+		if (error)
+			return error;
+	} else {
+		pool = denylist4_alloc();
+		if (!pool)
+			return -ENOMEM;
+	}
+
+	__log_debug(jool, "denylist4 is published; copying it.");
+	denylist4_put(jool->siit.denylist4);
+	jool->siit.denylist4 = pool;
+	*replaced = true;
+	return 0;
+}
+
 static int serialize_bl4_entry(struct ipv4_prefix *prefix, void *arg)
 {
 	return jnla_put_prefix4(arg, JNLAL_ENTRY, prefix) ? 1 : 0;
@@ -63,6 +90,7 @@ int handle_denylist4_add(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
 	struct ipv4_prefix operand;
+	bool replaced;
 	int error;
 
 	error = request_handle_start(info, XT_SIIT, &jool, true);
@@ -75,8 +103,15 @@ int handle_denylist4_add(struct sk_buff *skb, struct genl_info *info)
 	if (error)
 		goto revert_start;
 
+	error = unpublish_denylist4(&jool, true, &replaced);
+	if (error)
+		goto revert_start;
+
 	error = denylist4_add(jool.siit.denylist4, &operand,
-			get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_FORCE);
+			get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_FORCE,
+			!replaced);
+	if (!error && replaced)
+		error = xlator_replace(&jool);
 	/* Fall through */
 
 revert_start:
@@ -89,6 +124,7 @@ int handle_denylist4_rm(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
 	struct ipv4_prefix operand;
+	bool replaced;
 	int error;
 
 	error = request_handle_start(info, XT_SIIT, &jool, true);
@@ -101,7 +137,13 @@ int handle_denylist4_rm(struct sk_buff *skb, struct genl_info *info)
 	if (error)
 		goto revert_start;
 
+	error = unpublish_denylist4(&jool, true, &replaced);
+	if (error)
+		goto revert_start;
+
 	error = denylist4_rm(jool.siit.denylist4, &operand);
+	if (!error && replaced)
+		error = xlator_replace(&jool);
 revert_start:
 	error = jresponse_send_simple(&jool, info, error);
 	request_handle_end(&jool);
@@ -111,6 +153,7 @@ revert_start:
 int handle_denylist4_flush(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
+	bool replaced;
 	int error;
 
 	error = request_handle_start(info, XT_SIIT, &jool, true);
@@ -119,7 +162,13 @@ int handle_denylist4_flush(struct sk_buff *skb, struct genl_info *info)
 
 	__log_debug(&jool, "Flushing the denylist4...");
 
-	error = denylist4_flush(jool.siit.denylist4);
+	error = unpublish_denylist4(&jool, false, &replaced);
+	if (!error) {
+		error = replaced
+				? xlator_replace(&jool)
+				: denylist4_flush(jool.siit.denylist4);
+	}
+
 	error = jresponse_send_simple(&jool, info, error);
 	request_handle_end(&jool);
 	return error;
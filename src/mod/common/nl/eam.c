@@ -8,6 +8,37 @@
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/db/eam.h"
 
+/*
+ * Published EAMTs are read-only, so if @jool's is one, @jool gets its own copy
+ * (or, if @copy is false, a new empty table) first. (The copy only reaches the
+ * packet path through xlator_replace().)
+ */
+static int unpublish_eamt(struct xlator *jool, bool copy, bool *replaced)
+{
+	struct eam_table *eamt;
+	int error;
+
+	*replaced = false;
+	if (!eamt_is_published(jool->siit.eamt))
+		return 0;
+
+	if (copy) {
+		error = eamt_clone(jool->siit.eamt, &eamt);
+		if (error)
+			return error;
+	} else {
+		eamt = eamt_alloc();
+		if (!eamt)
+			return -ENOMEM;
+	}
+
+	__log_debug(jool, "The EAMT is published; copying it.");
+	eamt_put(jool->siit.eamt);
+	jool->siit.eamt = eamt;
+	*replaced = true;
+	return 0;
+}
+
 static int serialize_eam_entry(struct eamt_entry const *entry, void *arg)
 {
 	return jnla_put_eam(arg, JNLAL_ENTRY, entry) ? 1 : 0;
@@ -67,6 +98,7 @@ int handle_eamt_add(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
 	struct eamt_entry addend;
+	bool replaced;
 	int error;
 
 	error = request_handle_start(info, XT_SIIT, &jool, true);
@@ -79,8 +111,16 @@ int handle_eamt_add(struct sk_buff *skb, struct genl_info *info)
 	if (error)
 		goto revert_start;
 
+	error = unpublish_eamt(&jool, true, &replaced);
+	if (error)
+		goto revert_start;
+
+	/* The copy is not visible yet, so no need to sync. */
 	error = eamt_add(jool.siit.eamt, &addend,
-			get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_FORCE, true);
+			get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_FORCE,
+			!replaced);
+	if (!error && replaced)
+		error = xlator_replace(&jool);
 revert_start:
 	error = jresponse_send_simple(&jool, info, error);
 	request_handle_end(&jool);
@@ -93,6 +133,7 @@ int handle_eamt_rm(struct sk_buff *skb, struct genl_info *info)
 	struct nlattr *attrs[JNLAE_COUNT];
 	struct ipv6_prefix prefix6, *prefix6_ptr;
 	struct ipv4_prefix prefix4, *prefix4_ptr;
+	bool replaced;
 	int error;
 
 	error = request_handle_start(info, XT_SIIT, &jool, true);
@@ -130,7 +171,13 @@ int handle_eamt_rm(struct sk_buff *skb, struct genl_info *info)
 		prefix4_ptr = &prefix4;
 	}
 
+	error = unpublish_eamt(&jool, true, &replaced);
+	if (error)
+		goto revert_start;
+
 	error = eamt_rm(jool.siit.eamt, prefix6_ptr, prefix4_ptr);
+	if (!error && replaced)
+		error = xlator_replace(&jool);
 revert_start:
 	error = jresponse_send_simple(&jool, info, error);
 	request_handle_end(&jool);
@@ -140,6 +187,7 @@ revert_start:
 int handle_eamt_flush(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
+	bool replaced;
 	int error;
 
 	error = request_handle_start(info, XT_SIIT, &jool, true);
@@ -148,7 +196,13 @@ int handle_eamt_flush(struct sk_buff *skb, struct genl_info *info)
 
 	__log_debug(&jool, "Flushing the EAMT.");
 
-	eamt_flush(jool.siit.eamt);
+	error = unpublish_eamt(&jool, false, &replaced);
+	if (!error) {
+		if (replaced)
+			error = xlator_replace(&jool);
+		else
+			eamt_flush(jool.siit.eamt);
+	}
 
 	error = jresponse_send_simple(&jool, info, error);
 	request_handle_end(&jool);
@@ -0,0 +1,83 @@
+#include "mod/common/nl/filter.h"
+
+#include <linux/jiffies.h>
+#include "mod/common/address.h"
+#include "mod/common/nl/attribute.h"
+
+/**
+ * nl_filter_init - Prepares @attr (a JNLAR_FILTER) for use. A NULL @attr
+ * matches everything.
+ *
+ * @bib means the query is a BIB one.
+ */
+int nl_filter_init(struct nlattr *attr, bool bib, struct nl_filter *filter)
+{
+	int error;
+
+	memset(filter, 0, sizeof(*filter));
+	if (!attr)
+		return 0;
+
+	error = jnla_get_filter(attr, "Filter", bib, &filter->query);
+	if (error)
+		return error;
+
+	if (filter->query.flags & QF_SRC4)
+		filter->range.prefix = filter->query.src4;
+	/* Otherwise 0.0.0.0/0 */
+
+	if (filter->query.flags & QF_PORTS) {
+		filter->range.ports = filter->query.ports;
+	} else {
+		filter->range.ports.min = 0;
+		filter->range.ports.max = 65535;
+	}
+
+	filter->ranged = !!(filter->query.flags & (QF_SRC4 | QF_PORTS));
+	return 0;
+}
+
+/* Returns the range the table walk should be restricted to, or NULL. */
+struct ipv4_range *nl_filter_range(struct nl_filter *filter)
+{
+	return filter->ranged ? &filter->range : NULL;
+}
+
+/*
+ * The foreaches already confine the walk to nl_filter_range(), so these don't
+ * need to check it again.
+ */
+
+bool nl_filter_bib(struct nl_filter const *filter,
+		struct bib_entry const *entry)
+{
+	return !(filter->query.flags & QF_SRC6)
+			|| prefix6_contains(&filter->query.src6,
+					&entry->addr6.l3);
+}
+
+bool nl_filter_session(struct nl_filter const *filter,
+		struct session_entry const *entry)
+{
+	struct query_filter const *query = &filter->query;
+
+	if ((query->flags & QF_SRC6)
+			&& !prefix6_contains(&query->src6, &entry->src6.l3))
+		return false;
+	if ((query->flags & QF_DST4)
+			&& !prefix4_contains(&query->dst4, &entry->dst4.l3))
+		return false;
+	if ((query->flags & QF_STATE) && (entry->proto != L4PROTO_TCP
+			|| entry->state != query->state))
+		return false;
+	if (query->flags & QF_MIN_AGE) {
+		/* Sessions of unknown age (synchronized ones) never qualify. */
+		if (!entry->create_time)
+			return false;
+		if (jiffies_to_msecs(jiffies - entry->create_time)
+				< query->min_age)
+			return false;
+	}
+
+	return true;
+}
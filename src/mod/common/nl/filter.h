@@ -0,0 +1,30 @@
+#ifndef SRC_MOD_COMMON_NL_FILTER_H_
+#define SRC_MOD_COMMON_NL_FILTER_H_
+
+/**
+ * @file
+ * Server-side filters of the BIB and session queries. (JNLAR_FILTER.)
+ *
+ * The IPv4 source prefix and port range are handed to the table walk, which
+ * seeks to them instead of visiting the whole table. The rest of the fields
+ * are checked entry by entry, before serialization.
+ */
+
+#include <net/genetlink.h>
+#include "mod/common/db/bib/entry.h"
+
+struct nl_filter {
+	struct query_filter query;
+	struct ipv4_range range;
+	bool ranged;
+};
+
+int nl_filter_init(struct nlattr *attr, bool bib, struct nl_filter *filter);
+struct ipv4_range *nl_filter_range(struct nl_filter *filter);
+
+bool nl_filter_bib(struct nl_filter const *filter,
+		struct bib_entry const *entry);
+bool nl_filter_session(struct nl_filter const *filter,
+		struct session_entry const *entry);
+
+#endif /* SRC_MOD_COMMON_NL_FILTER_H_ */
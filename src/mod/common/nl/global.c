@@ -99,6 +99,9 @@ int handle_global_update(struct sk_buff *skb, struct genl_info *info)
 	 * during this operation. Which is not a recurrent operation at all.
 	 *
 	 * So let's STFU and do that.
+	 *
+	 * (Since only the globals change, the new xlator can inherit the old
+	 * one's databases as they are. See xlator_update_globals().)
 	 */
 
 	error = request_handle_start(info, XT_ANY, &jool, true);
@@ -123,7 +126,7 @@ int handle_global_update(struct sk_buff *skb, struct genl_info *info)
 	 * Notice that this @jool is also a clone and we're the only thread
 	 * with access to it.
 	 */
-	error = xlator_replace(&jool);
+	error = xlator_update_globals(&jool);
 
 revert_start:
 	error = jresponse_send_simple(&jool, info, error);
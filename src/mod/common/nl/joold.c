@@ -1,6 +1,7 @@
 #include "mod/common/nl/joold.h"
 
 #include "mod/common/log.h"
+#include "mod/common/nl/attribute.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/joold.h"
@@ -51,6 +52,59 @@ int handle_joold_advertise(struct sk_buff *skb, struct genl_info *info)
 	return error;
 }
 
+int handle_joold_advertise_cancel(struct sk_buff *skb,
+		struct genl_info *info)
+{
+	struct xlator jool;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Handling joold advertise cancel.");
+
+	error = joold_advertise_cancel(&jool);
+
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+int handle_joold_transport(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct joold_udp_cfg cfg;
+	struct joold_udp_cfg *peer;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Handling joold transport.");
+
+	peer = &cfg;
+	if (info->attrs[JNLAR_JOOLD_PEER6]) {
+		cfg.proto = L3PROTO_IPV6;
+		error = jnla_get_taddr6(info->attrs[JNLAR_JOOLD_PEER6],
+				"Peer", &cfg.peer.v6);
+	} else if (info->attrs[JNLAR_JOOLD_PEER4]) {
+		cfg.proto = L3PROTO_IPV4;
+		error = jnla_get_taddr4(info->attrs[JNLAR_JOOLD_PEER4],
+				"Peer", &cfg.peer.v4);
+	} else {
+		peer = NULL;
+	}
+
+	if (!error)
+		error = joold_set_transport(&jool, peer);
+
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
 int handle_joold_ack(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
@@ -4,12 +4,18 @@
 #include "mod/common/init.h"
 #include "mod/common/log.h"
 #include "mod/common/nl/nl_core.h"
+#include "mod/common/nl/nl_handler.h"
+
+static char *hdr_iname(struct joolnlhdr *hdr)
+{
+	return (hdr->iname[0] != 0) ? hdr->iname : INAME_DEFAULT;
+}
 
 char *get_iname(struct genl_info *info)
 {
 	struct joolnlhdr *hdr;
 	hdr = get_jool_hdr(info);
-	return (hdr->iname[0] != 0) ? hdr->iname : INAME_DEFAULT;
+	return hdr_iname(hdr);
 }
 
 struct joolnlhdr *get_jool_hdr(struct genl_info *info)
@@ -65,10 +71,9 @@ static int validate_version(struct joolnlhdr *hdr)
 	return -EINVAL;
 }
 
-int request_handle_start(struct genl_info *info, xlator_type xt,
+static int validate_request(struct joolnlhdr *hdr, xlator_type xt,
 		struct xlator *jool, bool require_net_admin)
 {
-	struct joolnlhdr *hdr;
 	int error;
 
 	if (require_net_admin && !capable(CAP_NET_ADMIN)) {
@@ -76,12 +81,6 @@ int request_handle_start(struct genl_info *info, xlator_type xt,
 		return -EPERM;
 	}
 
-	if (!info->attrs) {
-		log_err("Userspace request lacks Netlink attributes.");
-		return -EINVAL;
-	}
-
-	hdr = get_jool_hdr(info);
 	if (!hdr) {
 		log_err("Userspace request lacks a Jool header.");
 		return -EINVAL;
@@ -102,9 +101,9 @@ int request_handle_start(struct genl_info *info, xlator_type xt,
 	}
 
 	if (jool) {
-		error = xlator_find_current(get_iname(info), XF_ANY | hdr->xt, jool);
+		error = xlator_find_current(hdr_iname(hdr), XF_ANY | hdr->xt, jool);
 		if (error == -ESRCH)
-			log_err("This namespace lacks an instance named '%s'.", get_iname(info));
+			log_err("This namespace lacks an instance named '%s'.", hdr_iname(hdr));
 		if (error)
 			return error;
 	}
@@ -112,6 +111,47 @@ int request_handle_start(struct genl_info *info, xlator_type xt,
 	return 0;
 }
 
+int request_handle_start(struct genl_info *info, xlator_type xt,
+		struct xlator *jool, bool require_net_admin)
+{
+	if (!info->attrs) {
+		log_err("Userspace request lacks Netlink attributes.");
+		return -EINVAL;
+	}
+
+	return validate_request(get_jool_hdr(info), xt, jool, require_net_admin);
+}
+
+struct joolnlhdr *get_dump_hdr(struct netlink_callback *cb)
+{
+	return (struct joolnlhdr *)((u8 *)nlmsg_data(cb->nlh) + GENL_HDRLEN);
+}
+
+/*
+ * request_handle_start(), for dumpits.
+ *
+ * Dumps don't get a genl_info, so the request's attributes are parsed here,
+ * into @attrs (which needs JNLAR_COUNT slots). This happens again during every
+ * dumpit call, as does the instance lookup; @cb->nlh outlives the dump, but the
+ * instance reference does not.
+ */
+int dump_handle_start(struct netlink_callback *cb, xlator_type xt,
+		struct nlattr **attrs, struct xlator *jool)
+{
+	struct netlink_ext_ack extack;
+	int error;
+
+	memset(&extack, 0, sizeof(extack));
+	error = nlmsg_parse(cb->nlh, GENL_HDRLEN + sizeof(struct joolnlhdr),
+			attrs, JNLAR_MAX, jnl_policy(), &extack);
+	if (error) {
+		log_err("The request is malformed: %s", extack._msg);
+		return error;
+	}
+
+	return validate_request(get_dump_hdr(cb), xt, jool, true);
+}
+
 void request_handle_end(struct xlator *jool)
 {
 	if (jool)
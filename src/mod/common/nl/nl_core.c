@@ -23,7 +23,13 @@
 int jresponse_init(struct jool_response *response, struct genl_info *info)
 {
 	response->info = info;
-	response->skb = genlmsg_new(GENLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	response->skb = NULL;
+	/* Large buffers are a luxury; fall back to the default if needed. */
+	if (get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_LARGE)
+		response->skb = genlmsg_new(JOOLNL_LARGE_MSG_SIZE,
+				GFP_KERNEL | __GFP_NOWARN);
+	if (!response->skb)
+		response->skb = genlmsg_new(GENLMSG_DEFAULT_SIZE, GFP_KERNEL);
 	if (!response->skb) {
 		pr_err("genlmsg_new() failed.\n");
 		return -ENOMEM;
@@ -95,10 +101,9 @@ cancel:
 	return error;
 }
 
-int jresponse_send_simple(struct xlator *jool, struct genl_info *info,
-		int error_code)
+static int put_error(struct xlator *jool, struct sk_buff *skb,
+		struct joolnlhdr *hdr, int error_code)
 {
-	struct jool_response response;
 	int error;
 	char *error_msg;
 	size_t error_msg_size;
@@ -112,38 +117,113 @@ int jresponse_send_simple(struct xlator *jool, struct genl_info *info,
 	if (error)
 		return error; /* Error msg already printed. */
 
-	error = jresponse_init(&response, info);
-	if (error)
-		goto revert_msg;
-
 	if (error_code) {
-		response.hdr->flags |= JOOLNLHDR_FLAGS_ERROR;
+		hdr->flags |= JOOLNLHDR_FLAGS_ERROR;
 
-		error = nla_put_u16(response.skb, JNLAERR_CODE, error_code);
+		error = nla_put_u16(skb, JNLAERR_CODE, error_code);
 		if (error)
-			goto revert_response;
+			goto end;
 
-		error = nla_put_string(response.skb, JNLAERR_MSG, error_msg);
+		error = nla_put_string(skb, JNLAERR_MSG, error_msg);
 		if (error) {
 			error_msg[128] = '\0';
-			error = nla_put_string(response.skb, JNLAERR_MSG,
-					error_msg);
+			error = nla_put_string(skb, JNLAERR_MSG, error_msg);
 			if (error)
-				goto revert_response;
+				goto end;
 		}
 		__log_debug(jool, "Sending error code %d to userspace.",
 				error_code);
 	} else {
 		__log_debug(jool, "Sending ACK to userspace.");
 	}
-
-	error = jresponse_send(&response);
 	/* Fall through. */
 
+end:
+	__wkfree("Error msg out", error_msg);
+	return error;
+}
+
+int jresponse_send_simple(struct xlator *jool, struct genl_info *info,
+		int error_code)
+{
+	struct jool_response response;
+	int error;
+
+	error = jresponse_init(&response, info);
+	if (error)
+		return error;
+
+	error = put_error(jool, response.skb, response.hdr, error_code);
+	if (error)
+		goto revert_response;
+
+	return jresponse_send(&response);
+
 revert_response:
 	jresponse_cleanup(&response);
-revert_msg:
-	__wkfree("Error msg out", error_msg);
 	return error;
 }
 
+int jdump_init(struct jool_dump *dump, struct sk_buff *skb,
+		struct netlink_callback *cb)
+{
+	struct genlmsghdr *ghdr = nlmsg_data(cb->nlh);
+
+	dump->cb = cb;
+	dump->skb = skb;
+	dump->hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+			cb->nlh->nlmsg_seq, jnl_family(), NLM_F_MULTI,
+			ghdr->cmd);
+	if (!dump->hdr) {
+		pr_err("genlmsg_put() failed.\n");
+		return -EMSGSIZE;
+	}
+
+	memcpy(dump->hdr, get_dump_hdr(cb), sizeof(*dump->hdr));
+	dump->initial_len = skb->len;
+	return 0;
+}
+
+/*
+ * Closes @dump's page. @error is the result of the foreach: negative means
+ * the dump failed, and positive means the page filled up and there's more to
+ * send. (In which case the caller is expected to have recorded its cursor.)
+ *
+ * Errors are sent to userspace as a regular Jool error message, in place of
+ * the page, so the client gets the friendly string. Either way, the result is
+ * meant to be returned by the dumpit.
+ */
+int jdump_end(struct xlator *jool, struct jool_dump *dump, int error)
+{
+	struct netlink_callback *cb = dump->cb;
+	int error2;
+
+	if (error > 0 && dump->skb->len == dump->initial_len) {
+		report_put_failure();
+		error = -EINVAL;
+	}
+
+	if (error < 0) {
+		genlmsg_cancel(dump->skb, dump->hdr);
+		cb->args[0] = JDUMP_DONE;
+
+		error2 = jdump_init(dump, dump->skb, cb);
+		if (error2)
+			return error2;
+		error2 = put_error(jool, dump->skb, dump->hdr, error);
+		if (error2) {
+			genlmsg_cancel(dump->skb, dump->hdr);
+			return error2;
+		}
+
+	} else if (error > 0) {
+		cb->args[0] = JDUMP_CONTINUE;
+		dump->hdr->flags |= JOOLNLHDR_FLAGS_M;
+
+	} else {
+		cb->args[0] = JDUMP_DONE;
+	}
+
+	genlmsg_end(dump->skb, dump->hdr);
+	return dump->skb->len;
+}
@@ -22,5 +22,31 @@ int jresponse_send_array(struct xlator *jool, struct jool_response *response,
 int jresponse_send_simple(struct xlator *jool, struct genl_info *info,
 		int error);
 
+/*
+ * A page of a dumpit's response. All the pages of a dump share their request's
+ * sequence number, and are flagged NLM_F_MULTI; the kernel closes the dump
+ * with a NLMSG_DONE once the dumpit returns 0.
+ *
+ * The dumpit's progress (ie. its cursor) has to be stored in
+ * netlink_callback.args; jdump reserves args[0] (see enum jdump_state), and the
+ * rest belong to the dumpit.
+ */
+struct jool_dump {
+	struct netlink_callback *cb; /* Request */
+	struct sk_buff *skb; /* Page */
+	struct joolnlhdr *hdr; /* Quick access to @skb's Jool header */
+	unsigned int initial_len;
+};
+
+enum jdump_state {
+	JDUMP_START = 0,
+	JDUMP_CONTINUE,
+	JDUMP_DONE,
+};
+
+int jdump_init(struct jool_dump *dump, struct sk_buff *skb,
+		struct netlink_callback *cb);
+int jdump_end(struct xlator *jool, struct jool_dump *dump, int error);
+
 
 #endif /* SRC_MOD_COMMON_NL_CORE_H_ */
@@ -55,6 +55,17 @@ static struct nla_policy const jool_policy[JNLAR_COUNT] = {
 	[JNLAR_PROTO] = { .type = NLA_U8 },
 	[JNLAR_ATOMIC_INIT] = { .type = NLA_U8 },
 	[JNLAR_ATOMIC_END] = { .type = NLA_BINARY, .len = 0 },
+	[JNLAR_BULK_FAILURES] = { .type = NLA_BINARY },
+	[JNLAR_NATLOG_RECORDS] = { .type = NLA_BINARY },
+	[JNLAR_STATS_FILTER] = { .type = NLA_BINARY },
+	[JNLAR_JOOLD_PEER6] = { .type = NLA_NESTED },
+	[JNLAR_JOOLD_PEER4] = { .type = NLA_NESTED },
+	[JNLAR_FILTER] = { .type = NLA_NESTED },
+	[JNLAR_SHARE] = { .type = NLA_NESTED },
+	[JNLAR_CAPTURE_RECORDS] = { .type = NLA_BINARY },
+	[JNLAR_PROTOS] = { .type = NLA_U8 },
+	[JNLAR_PURGED] = { .type = NLA_U32 },
+	[JNLAR_ADDR_RESULTS] = { .type = NLA_BINARY },
 };
 
 #if LINUX_VERSION_AT_LEAST(5, 2, 0, 8, 0)
@@ -155,6 +166,7 @@ static const struct genl_ops ops[] = {
 	}, {
 		.cmd = JNLOP_BIB_FOREACH,
 		.doit = handle_bib_foreach,
+		.dumpit = handle_bib_dump,
 		JOOL_POLICY
 	}, {
 		.cmd = JNLOP_BIB_ADD,
@@ -167,6 +179,7 @@ static const struct genl_ops ops[] = {
 	}, {
 		.cmd = JNLOP_SESSION_FOREACH,
 		.doit = handle_session_foreach,
+		.dumpit = handle_session_dump,
 		JOOL_POLICY
 	}, {
 		.cmd = JNLOP_FILE_HANDLE,
@@ -184,12 +197,81 @@ static const struct genl_ops ops[] = {
 		.cmd = JNLOP_JOOLD_ACK,
 		.doit = handle_joold_ack,
 		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_SESSION_EXPORT,
+		.dumpit = handle_session_export,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_SESSION_IMPORT,
+		.doit = handle_session_import,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_BIB_ADD_BULK,
+		.doit = handle_bib_add_bulk,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_LATENCY,
+		.doit = handle_stats_latency,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_DUMP,
+		.dumpit = handle_stats_dump,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_TALKERS,
+		.doit = handle_stats_talkers,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_JOOLD_ADVERTISE_CANCEL,
+		.doit = handle_joold_advertise_cancel,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_JOOLD_TRANSPORT,
+		.doit = handle_joold_transport,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_PERCPU,
+		.doit = handle_stats_percpu,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_BIB_PURGE,
+		.doit = handle_bib_purge,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_POOL4_USAGE,
+		.doit = handle_pool4_usage,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_ADDRESS_QUERY64_BULK,
+		.doit = handle_address_query64_bulk,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_ADDRESS_QUERY46_BULK,
+		.doit = handle_address_query46_bulk,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_FILE_COMMIT_BATCH,
+		.doit = handle_atomconfig_commit_batch,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_LIFETIMES,
+		.doit = handle_stats_lifetimes,
+		JOOL_POLICY
+	}, {
+		.cmd = JNLOP_STATS_RATES,
+		.doit = handle_stats_rates,
+		JOOL_POLICY
 	}
 };
 
+/* Indexed by enum jnl_mcgrp. */
 static struct genl_multicast_group mc_groups[] = {
 	{
 		.name = JOOLNL_MULTICAST_GRP_NAME,
+	}, {
+		.name = JOOLNL_NATLOG_GRP_NAME,
+	}, {
+		.name = JOOLNL_CAPTURE_GRP_NAME,
 	},
 };
 
@@ -257,3 +339,8 @@ struct genl_family *jnl_family(void)
 {
 	return &jool_family;
 }
+
+struct nla_policy const *jnl_policy(void)
+{
+	return jool_policy;
+}
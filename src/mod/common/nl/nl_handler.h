@@ -10,6 +10,13 @@
 #include <linux/skbuff.h>
 #include <net/genetlink.h>
 
+/* Offsets of the family's multicast groups. */
+enum jnl_mcgrp {
+	JNL_MCGRP_JOOLD = 0,
+	JNL_MCGRP_NATLOG,
+	JNL_MCGRP_CAPTURE,
+};
+
 int nlhandler_setup(void);
 void nlhandler_teardown(void);
 
@@ -17,5 +24,6 @@ int handle_jool_message(struct sk_buff *skb, struct genl_info *info);
 
 u32 jnl_gid(void);
 struct genl_family *jnl_family(void);
+struct nla_policy const *jnl_policy(void);
 
 #endif /* SRC_MOD_COMMON_NL_HANDLER_H_ */
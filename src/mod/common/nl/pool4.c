@@ -1,6 +1,7 @@
 #include "mod/common/nl/pool4.h"
 
 #include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 #include "mod/common/nl/attribute.h"
 #include "mod/common/nl/nl_common.h"
@@ -13,6 +14,43 @@ static int serialize_pool4_entry(struct pool4_entry const *entry, void *arg)
 	return jnla_put_pool4(arg, JNLAL_ENTRY, entry) ? 1 : 0;
 }
 
+/*
+ * Reads the iteration offset of a foreach request. Otherwise, the protocol of
+ * its first request.
+ */
+static int get_offset(struct xlator *jool, struct genl_info *info,
+		struct pool4_entry *offset, struct pool4_entry **offset_ptr)
+{
+	int error;
+
+	if (info->attrs[JNLAR_OFFSET]) {
+		error = jnla_get_pool4(info->attrs[JNLAR_OFFSET],
+				"Iteration offset", offset);
+		if (error)
+			return error;
+		*offset_ptr = offset;
+		__log_debug(jool, "Offset: [%pI4/%u %u-%u %u %u %u %u]",
+				&offset->range.prefix.addr,
+				offset->range.prefix.len,
+				offset->range.ports.min,
+				offset->range.ports.max,
+				offset->mark,
+				offset->iterations,
+				offset->flags,
+				offset->proto);
+		return 0;
+	}
+
+	if (info->attrs[JNLAR_PROTO]) {
+		offset->proto = nla_get_u8(info->attrs[JNLAR_PROTO]);
+		*offset_ptr = NULL;
+		return 0;
+	}
+
+	log_err("The request is missing a protocol.");
+	return -EINVAL;
+}
+
 int handle_pool4_foreach(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
@@ -30,29 +68,9 @@ int handle_pool4_foreach(struct sk_buff *skb, struct genl_info *info)
 	if (error)
 		goto revert_start;
 
-	if (info->attrs[JNLAR_OFFSET]) {
-		error = jnla_get_pool4(info->attrs[JNLAR_OFFSET],
-				"Iteration offset", &offset);
-		if (error)
-			goto revert_response;
-		offset_ptr = &offset;
-		__log_debug(&jool, "Offset: [%pI4/%u %u-%u %u %u %u %u]",
-				&offset.range.prefix.addr,
-				offset.range.prefix.len,
-				offset.range.ports.min,
-				offset.range.ports.max,
-				offset.mark,
-				offset.iterations,
-				offset.flags,
-				offset.proto);
-	} else if (info->attrs[JNLAR_PROTO]) {
-		offset.proto = nla_get_u8(info->attrs[JNLAR_PROTO]);
-		offset_ptr = NULL;
-	} else {
-		log_err("The request is missing a protocol.");
-		error = -EINVAL;
+	error = get_offset(&jool, info, &offset, &offset_ptr);
+	if (error)
 		goto revert_response;
-	}
 
 	error = pool4db_foreach_sample(jool.nat64.pool4,
 			offset.proto, serialize_pool4_entry, response.skb,
@@ -73,6 +91,87 @@ revert_start:
 	return error;
 }
 
+/* Samples (and therefore, BIB counts) per JNLOP_POOL4_USAGE response. */
+#define USAGE_CHUNK 64
+
+struct usage_chunk {
+	struct pool4_entry samples[USAGE_CHUNK];
+	unsigned int count;
+};
+
+static int collect_sample(struct pool4_entry const *sample, void *arg)
+{
+	struct usage_chunk *chunk = arg;
+
+	chunk->samples[chunk->count++] = *sample;
+	return (chunk->count == USAGE_CHUNK) ? 1 : 0;
+}
+
+/* Like handle_pool4_foreach(), except each sample comes with its BIB count. */
+int handle_pool4_usage(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct jool_response response;
+	struct pool4_entry offset, *offset_ptr;
+	struct usage_chunk *chunk;
+	struct pool4_entry *sample;
+	__u64 used;
+	unsigned int i;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Sending pool4 usage to userspace.");
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+
+	error = get_offset(&jool, info, &offset, &offset_ptr);
+	if (error)
+		goto revert_response;
+
+	chunk = __wkmalloc("pool4 usage chunk", sizeof(*chunk), GFP_KERNEL);
+	if (!chunk) {
+		error = -ENOMEM;
+		goto revert_response;
+	}
+
+	chunk->count = 0;
+	error = pool4db_foreach_sample(jool.nat64.pool4, offset.proto,
+			collect_sample, chunk, offset_ptr);
+
+	/* pool4's lock is released; the counts will lock the BIB tables. */
+	for (i = 0; error >= 0 && i < chunk->count; i++) {
+		sample = &chunk->samples[i];
+		used = bib_count_range(jool.nat64.bib, sample->proto,
+				&sample->range);
+		if (jnla_put_pool4_usage(response.skb, JNLAL_ENTRY, sample,
+				used)) {
+			error = 1; /* Full; the rest go in the next response. */
+			break;
+		}
+	}
+
+	__wkfree("pool4 usage chunk", chunk);
+
+	error = jresponse_send_array(&jool, &response, error);
+	if (error)
+		goto revert_response;
+
+	request_handle_end(&jool);
+	return 0;
+
+revert_response:
+	jresponse_cleanup(&response);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
 int handle_pool4_add(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
@@ -122,7 +221,7 @@ int handle_pool4_rm(struct sk_buff *skb, struct genl_info *info)
 
 	error = pool4db_rm_usr(jool.nat64.pool4, &entry);
 	if (xlator_is_nat64(&jool) && !(get_jool_hdr(info)->flags & JOOLNLHDR_FLAGS_QUICK))
-		bib_rm_range(&jool, entry.proto, &entry.range);
+		bib_rm_range_async(&jool, entry.proto, &entry.range);
 
 revert_start:
 	error = jresponse_send_simple(&jool, info, error);
@@ -148,7 +247,7 @@ int handle_pool4_flush(struct sk_buff *skb, struct genl_info *info)
 		 * that "not quick" generally means "please clean up," this is
 		 * more likely what people wants.
 		 */
-		bib_flush(&jool);
+		bib_flush_async(&jool);
 	}
 
 	error = jresponse_send_simple(&jool, info, error);
@@ -4,6 +4,7 @@
 #include <net/genetlink.h>
 
 int handle_pool4_foreach(struct sk_buff *skb, struct genl_info *info);
+int handle_pool4_usage(struct sk_buff *skb, struct genl_info *info);
 int handle_pool4_add(struct sk_buff *skb, struct genl_info *info);
 int handle_pool4_rm(struct sk_buff *skb, struct genl_info *info);
 int handle_pool4_flush(struct sk_buff *skb, struct genl_info *info);
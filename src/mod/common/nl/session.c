@@ -1,8 +1,11 @@
 #include "mod/common/nl/session.h"
 
+#include "mod/common/error_pool.h"
 #include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 #include "mod/common/nl/attribute.h"
+#include "mod/common/nl/filter.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
 #include "mod/common/db/bib/db.h"
@@ -33,15 +36,32 @@ static int parse_offset(struct nlattr *root, struct session_foreach_offset *entr
 	return 0;
 }
 
-static int serialize_session_entry(struct session_entry const *entry, void *arg)
+struct session_dump_page {
+	struct sk_buff *skb;
+	struct nl_filter filter;
+	/* The last session sent */
+	struct session_foreach_offset last;
+};
+
+static int dump_session_entry(struct session_entry const *entry, void *arg)
 {
-	return jnla_put_session(arg, JNLAL_ENTRY, entry) ? 1 : 0;
+	struct session_dump_page *page = arg;
+
+	if (!nl_filter_session(&page->filter, entry))
+		return 0;
+	if (jnla_put_session(page->skb, JNLAL_ENTRY, entry))
+		return 1;
+
+	page->last.offset.src = entry->src4;
+	page->last.offset.dst = entry->dst4;
+	return 0;
 }
 
 int handle_session_foreach(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
 	struct jool_response response;
+	struct session_dump_page page;
 	struct session_foreach_offset offset, *offset_ptr;
 	l4_protocol proto;
 	int error;
@@ -76,8 +96,13 @@ int handle_session_foreach(struct sk_buff *skb, struct genl_info *info)
 				&offset.offset.dst.l3, offset.offset.dst.l4);
 	}
 
-	error = bib_foreach_session(&jool, proto, serialize_session_entry,
-			response.skb, offset_ptr);
+	error = nl_filter_init(info->attrs[JNLAR_FILTER], false, &page.filter);
+	if (error)
+		goto revert_response;
+
+	page.skb = response.skb;
+	error = bib_foreach_session_range(&jool, proto, dump_session_entry,
+			&page, offset_ptr, nl_filter_range(&page.filter));
 
 	error = jresponse_send_array(&jool, &response, error);
 	if (error)
@@ -93,3 +118,343 @@ revert_start:
 	request_handle_end(&jool);
 	return error;
 }
+
+/* Dump cursor; the last session sent. (cb->args[0] belongs to jdump.) */
+enum session_dump_args {
+	SDA_SRC_ADDR = 1,
+	SDA_SRC_PORT,
+	SDA_DST_ADDR,
+	SDA_DST_PORT,
+};
+
+static void load_cursor(struct netlink_callback *cb,
+		struct session_foreach_offset *offset)
+{
+	offset->offset.src.l3.s_addr = (__force __be32)cb->args[SDA_SRC_ADDR];
+	offset->offset.src.l4 = cb->args[SDA_SRC_PORT];
+	offset->offset.dst.l3.s_addr = (__force __be32)cb->args[SDA_DST_ADDR];
+	offset->offset.dst.l4 = cb->args[SDA_DST_PORT];
+	offset->include_offset = false;
+}
+
+static void save_cursor(struct netlink_callback *cb,
+		struct session_foreach_offset *offset)
+{
+	cb->args[SDA_SRC_ADDR] = (__force u32)offset->offset.src.l3.s_addr;
+	cb->args[SDA_SRC_PORT] = offset->offset.src.l4;
+	cb->args[SDA_DST_ADDR] = (__force u32)offset->offset.dst.l3.s_addr;
+	cb->args[SDA_DST_PORT] = offset->offset.dst.l4;
+}
+
+/*
+ * Same as handle_session_foreach(), except the kernel calls it back to back,
+ * one page at a time, until it returns 0. The client doesn't have to request
+ * each page.
+ */
+int handle_session_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *attrs[JNLAR_COUNT];
+	struct xlator jool;
+	struct jool_dump dump;
+	struct session_dump_page page;
+	struct session_foreach_offset offset, *offset_ptr;
+	l4_protocol proto;
+	int error;
+
+	if (cb->args[0] == JDUMP_DONE)
+		return 0;
+
+	error_pool_activate();
+
+	error = jdump_init(&dump, skb, cb);
+	if (error)
+		goto end;
+
+	error = dump_handle_start(cb, XT_NAT64, attrs, &jool);
+	if (error) {
+		error = jdump_end(NULL, &dump, error);
+		goto end;
+	}
+
+	if (!attrs[JNLAR_PROTO]) {
+		log_err("The request is missing a transport protocol.");
+		error = -EINVAL;
+		goto revert_start;
+	}
+	proto = nla_get_u8(attrs[JNLAR_PROTO]);
+
+	if (cb->args[0] == JDUMP_CONTINUE) {
+		load_cursor(cb, &offset);
+		offset_ptr = &offset;
+	} else if (attrs[JNLAR_OFFSET]) {
+		error = parse_offset(attrs[JNLAR_OFFSET], &offset);
+		if (error)
+			goto revert_start;
+		offset_ptr = &offset;
+	} else {
+		offset_ptr = NULL;
+	}
+
+	if (offset_ptr) {
+		__log_debug(&jool, "Dumping session from [%pI4/%u %pI4/%u].",
+				&offset.offset.src.l3, offset.offset.src.l4,
+				&offset.offset.dst.l3, offset.offset.dst.l4);
+	} else {
+		__log_debug(&jool, "Dumping session.");
+	}
+
+	error = nl_filter_init(attrs[JNLAR_FILTER], false, &page.filter);
+	if (error)
+		goto revert_start;
+
+	page.skb = skb;
+	memset(&page.last, 0, sizeof(page.last));
+	error = bib_foreach_session_range(&jool, proto, dump_session_entry,
+			&page, offset_ptr, nl_filter_range(&page.filter));
+	if (error > 0)
+		save_cursor(cb, &page.last);
+	/* Fall through. */
+
+revert_start:
+	error = jdump_end(&jool, &dump, error);
+	request_handle_end(&jool);
+end:
+	error_pool_deactivate();
+	return error;
+}
+
+/* Export cursor. (cb->args[0] belongs to jdump.) */
+enum session_export_args {
+	SEA_PROTO = 1,
+	SEA_SRC_ADDR,
+	SEA_SRC_PORT,
+	SEA_DST_ADDR,
+	SEA_DST_PORT,
+};
+
+struct session_export_page {
+	__u8 *records; /* Where the next record goes */
+	unsigned int count;
+	unsigned int max;
+	struct session_foreach_offset last;
+};
+
+static int export_session_entry(struct session_entry const *entry, void *arg)
+{
+	struct session_export_page *page = arg;
+
+	if (page->count >= page->max)
+		return 1;
+
+	page->records += jnla_write_session_record(page->records, entry, false);
+	page->count++;
+	page->last.offset.src = entry->src4;
+	page->last.offset.dst = entry->dst4;
+	return 0;
+}
+
+/*
+ * Dumps all of the instance's sessions, as JNLAL_SESSION_BATCHes. (One per
+ * page, as large as the page allows.) This is the snapshot
+ * handle_session_import() restores.
+ *
+ * Destinations are not elided, because the importing instance's pool6 might
+ * not be known yet.
+ */
+int handle_session_export(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *attrs[JNLAR_COUNT];
+	struct xlator jool;
+	struct jool_dump dump;
+	struct session_export_page page;
+	struct session_foreach_offset offset, *offset_ptr;
+	struct nlattr *batch;
+	l4_protocol proto;
+	int room;
+	int error;
+
+	if (cb->args[0] == JDUMP_DONE)
+		return 0;
+
+	error_pool_activate();
+
+	error = jdump_init(&dump, skb, cb);
+	if (error)
+		goto end;
+
+	error = dump_handle_start(cb, XT_NAT64, attrs, &jool);
+	if (error) {
+		error = jdump_end(NULL, &dump, error);
+		goto end;
+	}
+
+	if (cb->args[0] == JDUMP_CONTINUE) {
+		proto = cb->args[SEA_PROTO];
+		offset.offset.src.l3.s_addr = (__force __be32)cb->args[SEA_SRC_ADDR];
+		offset.offset.src.l4 = cb->args[SEA_SRC_PORT];
+		offset.offset.dst.l3.s_addr = (__force __be32)cb->args[SEA_DST_ADDR];
+		offset.offset.dst.l4 = cb->args[SEA_DST_PORT];
+		offset.include_offset = false;
+		offset_ptr = &offset;
+	} else {
+		__log_debug(&jool, "Exporting sessions.");
+		proto = L4PROTO_TCP;
+		offset_ptr = NULL;
+	}
+
+	room = skb_tailroom(skb) - nla_total_size(JOOLD_BATCH_HDR_SIZE);
+	page.max = (room > 0) ? (room / JOOLD_BATCH_RECORD_SIZE) : 0;
+	page.max = min(page.max, 0xFFFFu);
+	page.count = 0;
+	memset(&page.last, 0, sizeof(page.last));
+
+	batch = nla_reserve(skb, JNLAL_SESSION_BATCH,
+			jnla_session_batch_size(page.max, false));
+	if (!batch) {
+		error = 1; /* Page full; jdump_end() will complain. */
+		goto revert_start;
+	}
+	page.records = (__u8 *)nla_data(batch) + JOOLD_BATCH_HDR_SIZE;
+
+	for (; proto <= L4PROTO_ICMP; proto++) {
+		error = bib_foreach_session(&jool, proto, export_session_entry,
+				&page, offset_ptr);
+		if (error)
+			break;
+		offset_ptr = NULL;
+	}
+
+	if (page.count) {
+		/* Shrink the batch down to the records that were written */
+		jnla_write_session_batch_hdr(nla_data(batch), page.count,
+				false);
+		batch->nla_len = nla_attr_size(
+				jnla_session_batch_size(page.count, false));
+		nlmsg_trim(skb, page.records);
+	} else {
+		nlmsg_trim(skb, batch);
+	}
+
+	if (error > 0) {
+		cb->args[SEA_PROTO] = proto;
+		cb->args[SEA_SRC_ADDR] = (__force u32)page.last.offset.src.l3.s_addr;
+		cb->args[SEA_SRC_PORT] = page.last.offset.src.l4;
+		cb->args[SEA_DST_ADDR] = (__force u32)page.last.offset.dst.l3.s_addr;
+		cb->args[SEA_DST_PORT] = page.last.offset.dst.l4;
+	}
+	/* Fall through. */
+
+revert_start:
+	error = jdump_end(&jool, &dump, error);
+	request_handle_end(&jool);
+end:
+	error_pool_deactivate();
+	return error;
+}
+
+/* Sessions handed to bib_import() at a time. */
+#define IMPORT_CHUNK 256
+
+struct session_import_args {
+	struct xlator *jool;
+	struct session_entry *sessions;
+	unsigned int count;
+	unsigned int imported;
+	int error;
+};
+
+static int flush_imported(struct session_import_args *args)
+{
+	int added;
+
+	if (args->error || !args->count)
+		return args->error;
+
+	added = bib_import(args->jool, args->sessions, args->count);
+	args->count = 0;
+	if (added < 0) {
+		args->error = added;
+		return added;
+	}
+
+	args->imported += added;
+	return 0;
+}
+
+static int import_session(struct session_entry *session, void *arg)
+{
+	struct session_import_args *args = arg;
+
+	if (args->error)
+		return args->error;
+
+	args->sessions[args->count++] = *session;
+	return (args->count == IMPORT_CHUNK) ? flush_imported(args) : 0;
+}
+
+/*
+ * Restores the sessions handle_session_export() dumped. The request carries any
+ * number of JNLAL_SESSION_BATCHes in a JNLAR_SESSION_ENTRIES container.
+ *
+ * Sessions that already exist are kept. Those that cannot be added (because
+ * their addresses collide with existing BIB entries, for example) are skipped.
+ */
+int handle_session_import(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct session_import_args args;
+	struct nlattr *attr;
+	int rem;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, true);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	if (!jool.globals.pool6.set) {
+		log_err("Sessions cannot be imported until pool6 is configured.");
+		error = -EINVAL;
+		goto revert_start;
+	}
+	if (!info->attrs[JNLAR_SESSION_ENTRIES]) {
+		log_err("The request lacks a session container.");
+		error = -EINVAL;
+		goto revert_start;
+	}
+
+	args.jool = &jool;
+	args.sessions = __wkmalloc("Session import buffer",
+			IMPORT_CHUNK * sizeof(*args.sessions), GFP_KERNEL);
+	if (!args.sessions) {
+		error = -ENOMEM;
+		goto revert_start;
+	}
+	args.count = 0;
+	args.imported = 0;
+	args.error = 0;
+
+	nla_for_each_nested(attr, info->attrs[JNLAR_SESSION_ENTRIES], rem) {
+		if (nla_type(attr) != JNLAL_SESSION_BATCH) {
+			log_err("Session imports only accept session batches.");
+			error = -EINVAL;
+			goto revert_buffer;
+		}
+
+		error = jnla_get_session_batch(attr, &jool.globals.nat64.bib,
+				&jool.globals.pool6.prefix, import_session,
+				&args);
+		if (error)
+			goto revert_buffer;
+	}
+
+	error = flush_imported(&args);
+	__log_debug(&jool, "Imported %u sessions.", args.imported);
+	/* Fall through. */
+
+revert_buffer:
+	__wkfree("Session import buffer", args.sessions);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
@@ -1,11 +1,61 @@
 #include "mod/common/nl/stats.h"
 
+#include "mod/common/error_pool.h"
+#include "mod/common/joold.h"
 #include "mod/common/log.h"
 #include "mod/common/stats.h"
+#include "mod/common/wkmalloc.h"
+#include "mod/common/xlator.h"
+#include "mod/common/db/eam.h"
+#include "mod/common/db/talkers.h"
+#include "mod/common/db/bib/db.h"
+#include "mod/common/db/pool4/db.h"
 #include "mod/common/nl/attribute.h"
 #include "mod/common/nl/nl_common.h"
 #include "mod/common/nl/nl_core.h"
 
+/*
+ * Computes the memory gauges the databases can tell without help from the
+ * packet path, and stores them in @jool's counters. Can sleep.
+ */
+static void set_lock_stats(struct xlator *jool, enum jool_stat_id first,
+		struct jlock_stats *lock)
+{
+	jstat_set(jool->stats, first, lock->acquired);
+	jstat_set(jool->stats, first + 1, lock->contended);
+	jstat_set(jool->stats, first + 2, lock->sampled);
+	jstat_set(jool->stats, first + 3, lock->hold_ns);
+}
+
+static void refresh_gauges(struct xlator *jool)
+{
+	struct jlock_stats lock;
+	__u64 objects, bytes;
+
+	if (xlator_is_siit(jool)) {
+		eamt_memory(jool->siit.eamt, &objects, &bytes);
+		jstat_set(jool->stats, JSTAT_EAMT_NODES, objects);
+		jstat_set(jool->stats, JSTAT_MEM_EAMT, bytes);
+		return;
+	}
+
+	jstat_set(jool->stats, JSTAT_STORED_PKTS,
+			bib_stored_pkts(jool->nat64.bib));
+	joold_memory(jool->nat64.joold, &objects, &bytes);
+	jstat_set(jool->stats, JSTAT_JOOLD_QUEUED, objects);
+	jstat_set(jool->stats, JSTAT_MEM_JOOLD, bytes);
+	pool4db_memory(jool->nat64.pool4, &objects, &bytes);
+	jstat_set(jool->stats, JSTAT_POOL4_TABLES, objects);
+	jstat_set(jool->stats, JSTAT_MEM_POOL4, bytes);
+
+	bib_lock_stats(jool->nat64.bib, &lock);
+	set_lock_stats(jool, JSTAT_LOCK_BIB_ACQUIRED, &lock);
+	pool4db_lock_stats(jool->nat64.pool4, &lock);
+	set_lock_stats(jool, JSTAT_LOCK_POOL4_ACQUIRED, &lock);
+	joold_lock_stats(jool->nat64.joold, &lock);
+	set_lock_stats(jool, JSTAT_LOCK_JOOLD_ACQUIRED, &lock);
+}
+
 int handle_stats_foreach(struct sk_buff *skb, struct genl_info *info)
 {
 	struct xlator jool;
@@ -28,6 +78,7 @@ int handle_stats_foreach(struct sk_buff *skb, struct genl_info *info)
 	}
 
 	/* Perform query */
+	refresh_gauges(&jool);
 	stats = jstat_query(jool.stats);
 	if (!stats) {
 		error = -ENOMEM;
@@ -67,3 +118,411 @@ revert_start:
 	request_handle_end(&jool);
 	return error;
 }
+
+/*
+ * Each histogram is sent as a binary array of @buckets __u64s, in an attribute
+ * whose type is the histogram's index plus one.
+ */
+static int handle_histograms(struct genl_info *info, xlator_type xt,
+		char const *what, __u64 *(*query)(struct jool_stats *),
+		unsigned int count, unsigned int buckets)
+{
+	struct xlator jool;
+	__u64 *histograms;
+	struct jool_response response;
+	unsigned int h;
+	unsigned int written;
+	int error;
+
+	error = request_handle_start(info, xt, &jool, false);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Returning %s stats.", what);
+
+	h = 0;
+	if (info->attrs[JNLAR_OFFSET_U8]) {
+		h = nla_get_u8(info->attrs[JNLAR_OFFSET_U8]);
+		__log_debug(&jool, "Offset: [%u]", h);
+	}
+
+	histograms = query(jool.stats);
+	if (!histograms) {
+		error = -ENOMEM;
+		goto revert_start;
+	}
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_query;
+
+	written = 0;
+	for (; h < count; h++) {
+		error = nla_put(response.skb, h + 1, buckets * sizeof(__u64),
+				&histograms[h * buckets]);
+		if (error) {
+			if (!written)
+				goto revert_response;
+			jresponse_enable_m(&response);
+			break;
+		}
+
+		written++;
+	}
+
+	kfree(histograms);
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+revert_response:
+	report_put_failure();
+	jresponse_cleanup(&response);
+revert_query:
+	kfree(histograms);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+int handle_stats_latency(struct sk_buff *skb, struct genl_info *info)
+{
+	return handle_histograms(info, XT_ANY, "latency", jstat_query_latency,
+			JLAT_HISTOGRAM_COUNT, JLAT_BUCKETS);
+}
+
+int handle_stats_lifetimes(struct sk_buff *skb, struct genl_info *info)
+{
+	return handle_histograms(info, XT_NAT64, "lifetime",
+			jstat_query_lifetimes, JLIFE_HISTOGRAM_COUNT,
+			JLIFE_BUCKETS);
+}
+
+/*
+ * The rates always fit in one message. Each one is sent as a __u64, in an
+ * attribute whose type is its enum jool_rate_id plus one.
+ */
+int handle_stats_rates(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	__u64 rates[JRATE_COUNT];
+	struct jool_response response;
+	unsigned int i;
+	int error;
+
+	error = request_handle_start(info, XT_ANY, &jool, false);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Returning rates.");
+
+	jstat_query_rates(jool.stats, rates);
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_start;
+
+	for (i = 0; i < JRATE_COUNT; i++) {
+		error = nla_put_u64_64bit(response.skb, i + 1, rates[i],
+				JRATE_PADDING);
+		if (error)
+			goto revert_response;
+	}
+
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+revert_response:
+	report_put_failure();
+	jresponse_cleanup(&response);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+static int put_talker(struct sk_buff *skb, struct xlator *jool,
+		enum jool_talker_metric metric, struct talker const *talker)
+{
+	struct nlattr *root;
+	struct ipv6_prefix prefix;
+
+	root = nla_nest_start(skb, JNLAL_ENTRY);
+	if (!root)
+		return -EMSGSIZE;
+
+	prefix.addr = talker->prefix;
+	prefix.len = jool->globals.nat64.bib.subscriber_prefix_len;
+
+	if (nla_put_u8(skb, JNLATK_METRIC, metric)
+			|| jnla_put_prefix6(skb, JNLATK_PREFIX, &prefix)
+			|| nla_put_u64_64bit(skb, JNLATK_COUNT, talker->count,
+					JNLATK_PAD)
+			|| nla_put_u64_64bit(skb, JNLATK_ERROR, talker->error,
+					JNLATK_PAD)) {
+		nla_nest_cancel(skb, root);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, root);
+	return 0;
+}
+
+/*
+ * Sends the top talkers of every metric, biggest first. They're few enough to
+ * always fit in one message.
+ */
+int handle_stats_talkers(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	struct talker *talkers;
+	struct jool_response response;
+	enum jool_talker_metric metric;
+	unsigned int count, i;
+	int error;
+
+	error = request_handle_start(info, XT_NAT64, &jool, false);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Returning top talkers.");
+
+	talkers = __wkmalloc("top talkers", JTALK_MAX * sizeof(*talkers),
+			GFP_KERNEL);
+	if (!talkers) {
+		error = -ENOMEM;
+		goto revert_start;
+	}
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_query;
+
+	for (metric = 0; metric < JTALK_METRIC_COUNT; metric++) {
+		count = talkers_query(jool.nat64.talkers, metric, talkers);
+		for (i = 0; i < count; i++) {
+			error = put_talker(response.skb, &jool, metric,
+					&talkers[i]);
+			if (error)
+				goto revert_response;
+		}
+	}
+
+	__wkfree("top talkers", talkers);
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+revert_response:
+	report_put_failure();
+	jresponse_cleanup(&response);
+revert_query:
+	__wkfree("top talkers", talkers);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
+
+/* Dump cursor; instances already sent. (cb->args[0] belongs to jdump.) */
+enum stats_dump_args {
+	SDA_SENT = 1,
+};
+
+struct stats_dump_page {
+	struct sk_buff *skb;
+	struct net *ns;
+	/* JNLAR_STATS_FILTER; NULL means all the counters. */
+	__u8 const *filter;
+	int filter_len;
+	/* Instances that belong to earlier pages. */
+	unsigned long skip;
+	unsigned long sent;
+};
+
+static bool is_requested(__u8 const *filter, int filter_len,
+		enum jool_stat_id id)
+{
+	if (!filter)
+		return true;
+	if (id / 8 >= filter_len)
+		return false;
+	return filter[id / 8] & (1u << (id % 8));
+}
+
+static int dump_instance_stats(struct xlator *jool, void *arg)
+{
+	struct stats_dump_page *page = arg;
+	struct nlattr *root, *counters;
+	enum jool_stat_id id;
+	__u64 value;
+
+	if (jool->ns != page->ns)
+		return 0;
+	if (page->skip) {
+		page->skip--;
+		return 0;
+	}
+
+	root = nla_nest_start(page->skb, JNLAL_ENTRY);
+	if (!root)
+		return 1;
+	if (nla_put_string(page->skb, JNLASTE_INAME, jool->iname))
+		goto cancel;
+
+	counters = nla_nest_start(page->skb, JNLASTE_COUNTERS);
+	if (!counters)
+		goto cancel;
+	for (id = 1; id <= JSTAT_UNKNOWN; id++) {
+		if (!is_requested(page->filter, page->filter_len, id))
+			continue;
+		value = jstat_query_one(jool->stats, id);
+		if (!value)
+			continue;
+		if (nla_put_u64_64bit(page->skb, id, value, JSTAT_PADDING))
+			goto cancel;
+	}
+	nla_nest_end(page->skb, counters);
+
+	nla_nest_end(page->skb, root);
+	page->sent++;
+	return 0;
+
+cancel:
+	nla_nest_cancel(page->skb, root);
+	return 1;
+}
+
+/*
+ * Dumps the counters of every instance (of the request's type) in the
+ * requester's namespace, so monitors don't need one request per instance.
+ *
+ * Counters are folded one at a time, straight into the page. The cursor is the
+ * number of instances already sent; an instance added or removed between pages
+ * can shift the rest by one, which is fine for monitoring.
+ */
+int handle_stats_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct nlattr *attrs[JNLAR_COUNT];
+	struct jool_dump dump;
+	struct stats_dump_page page;
+	int error;
+
+	if (cb->args[0] == JDUMP_DONE)
+		return 0;
+
+	error_pool_activate();
+
+	error = jdump_init(&dump, skb, cb);
+	if (error)
+		goto end;
+
+	error = dump_handle_start(cb, XT_ANY, attrs, NULL);
+	if (error)
+		goto revert_start;
+
+	page.skb = skb;
+	page.ns = sock_net(skb->sk);
+	page.filter = NULL;
+	page.filter_len = 0;
+	if (attrs[JNLAR_STATS_FILTER]) {
+		page.filter = nla_data(attrs[JNLAR_STATS_FILTER]);
+		page.filter_len = nla_len(attrs[JNLAR_STATS_FILTER]);
+	}
+	page.skip = cb->args[SDA_SENT];
+	page.sent = page.skip;
+
+	LOG_DEBUG("Dumping stats, from instance #%lu.", page.skip);
+
+	error = xlator_foreach(get_dump_hdr(cb)->xt, dump_instance_stats,
+			&page, NULL);
+	if (error > 0)
+		cb->args[SDA_SENT] = page.sent;
+	/* Fall through. */
+
+revert_start:
+	error = jdump_end(NULL, &dump, error);
+end:
+	error_pool_deactivate();
+	return error;
+}
+
+/*
+ * Sends the requested counters without summing them up, so CPU imbalances can
+ * be seen. Each counter is a binary array of nr_cpu_ids __u64s (CPU i's value
+ * first), in an attribute whose type is the counter's ID.
+ */
+int handle_stats_percpu(struct sk_buff *skb, struct genl_info *info)
+{
+	struct xlator jool;
+	__u8 const *filter;
+	int filter_len;
+	__u64 *values;
+	size_t size;
+	struct jool_response response;
+	enum jool_stat_id id;
+	unsigned int written;
+	int error;
+
+	error = request_handle_start(info, XT_ANY, &jool, false);
+	if (error)
+		return jresponse_send_simple(NULL, info, error);
+
+	__log_debug(&jool, "Returning per-CPU stats.");
+
+	id = 0;
+	if (info->attrs[JNLAR_OFFSET_U8]) {
+		id = nla_get_u8(info->attrs[JNLAR_OFFSET_U8]);
+		__log_debug(&jool, "Offset: [%u]", id);
+	}
+
+	filter = NULL;
+	filter_len = 0;
+	if (info->attrs[JNLAR_STATS_FILTER]) {
+		filter = nla_data(info->attrs[JNLAR_STATS_FILTER]);
+		filter_len = nla_len(info->attrs[JNLAR_STATS_FILTER]);
+	}
+
+	refresh_gauges(&jool);
+
+	size = nr_cpu_ids * sizeof(*values);
+	values = __wkmalloc("per-CPU stats", size, GFP_KERNEL);
+	if (!values) {
+		error = -ENOMEM;
+		goto revert_start;
+	}
+
+	error = jresponse_init(&response, info);
+	if (error)
+		goto revert_query;
+
+	written = 0;
+	for (id++; id <= JSTAT_UNKNOWN; id++) {
+		if (!is_requested(filter, filter_len, id))
+			continue;
+
+		jstat_query_percpu(jool.stats, id, values);
+		error = nla_put(response.skb, id, size, values);
+		if (error) {
+			if (!written)
+				goto revert_response;
+			jresponse_enable_m(&response);
+			break;
+		}
+
+		written++;
+	}
+
+	__wkfree("per-CPU stats", values);
+	request_handle_end(&jool);
+	return jresponse_send(&response);
+
+revert_response:
+	report_put_failure();
+	jresponse_cleanup(&response);
+revert_query:
+	__wkfree("per-CPU stats", values);
+revert_start:
+	error = jresponse_send_simple(&jool, info, error);
+	request_handle_end(&jool);
+	return error;
+}
@@ -4,5 +4,11 @@
 #include <net/genetlink.h>
 
 int handle_stats_foreach(struct sk_buff *jool, struct genl_info *info);
+int handle_stats_latency(struct sk_buff *jool, struct genl_info *info);
+int handle_stats_lifetimes(struct sk_buff *skb, struct genl_info *info);
+int handle_stats_rates(struct sk_buff *skb, struct genl_info *info);
+int handle_stats_dump(struct sk_buff *skb, struct netlink_callback *cb);
+int handle_stats_talkers(struct sk_buff *skb, struct genl_info *info);
+int handle_stats_percpu(struct sk_buff *skb, struct genl_info *info);
 
 #endif /* SRC_MOD_COMMON_NL_STATS_H_ */
@@ -0,0 +1,74 @@
+#include "mod/common/overload.h"
+
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+
+#include "mod/common/fast_random.h"
+
+/* Length of the measurement windows, in jiffies. */
+#define OVERLOAD_WINDOW DIV_ROUND_UP(HZ, 100)
+
+struct overload_window {
+	/* When the current window started. */
+	unsigned long start;
+	/* Time spent translating during the current window, in nanoseconds. */
+	u64 busy;
+	/* The last window's load, in percentage points. */
+	unsigned int load;
+};
+
+static DEFINE_PER_CPU(struct overload_window, windows);
+
+/* Closes the current window, if it's over. */
+static void window_update(struct overload_window *window, unsigned long now)
+{
+	unsigned long elapsed = now - window->start;
+	u64 load;
+
+	if (elapsed < OVERLOAD_WINDOW)
+		return;
+
+	/* The windows skipped by idleness are averaged in. */
+	load = div64_u64(100 * window->busy, jiffies_to_nsecs(elapsed));
+	window->load = min_t(u64, load, 100);
+	window->busy = 0;
+	window->start = now;
+}
+
+/* Call with bottom halves disabled. */
+void __overload_account(u64 start)
+{
+	struct overload_window *window = this_cpu_ptr(&windows);
+	u64 now = local_clock();
+
+	window_update(window, jiffies);
+	if (now > start)
+		window->busy += now - start;
+}
+
+/**
+ * overload_shed - Should the current CPU refuse the new session @jool is about
+ * to create?
+ *
+ * Call with bottom halves disabled.
+ */
+bool overload_shed(struct xlator *jool)
+{
+	struct overload_window *window = this_cpu_ptr(&windows);
+	unsigned int threshold = jool->fast.overload_threshold;
+	unsigned int load;
+
+	if (!threshold || threshold >= 100)
+		return false;
+
+	/* The load of a window nobody closed is stale; the CPU went idle. */
+	load = (jiffies - window->start < 2 * OVERLOAD_WINDOW)
+			? window->load
+			: 0;
+	if (load <= threshold)
+		return false;
+
+	/* (load - threshold) / (100 - threshold) of them. */
+	return (fast_random_u32() % (100 - threshold)) < (load - threshold);
+}
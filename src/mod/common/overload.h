@@ -0,0 +1,40 @@
+#ifndef SRC_MOD_COMMON_OVERLOAD_H_
+#define SRC_MOD_COMMON_OVERLOAD_H_
+
+/**
+ * @file
+ * The overload governor. (overload-threshold)
+ *
+ * Every CPU measures how much of its time it spends translating, in windows of
+ * OVERLOAD_WINDOW. Once the last window's load exceeds an instance's
+ * overload-threshold, the CPU starts refusing the instance's new 6->4 BIB
+ * entries and sessions (ie. the expensive part of NAT64), so the established
+ * ones keep flowing. The refusals are progressive: None at the threshold, all
+ * of them at 100% load.
+ *
+ * Only the translations of the instances that enable the governor are timed,
+ * so the ones that don't are not refused anything, and don't count towards the
+ * load either.
+ */
+
+#include <linux/sched/clock.h>
+#include "mod/common/xlator.h"
+
+void __overload_account(u64 start);
+
+/* Call right before a translation. */
+static inline u64 overload_start(struct xlator *jool)
+{
+	return jool->fast.overload_threshold ? local_clock() : 0;
+}
+
+/* Call right after the translation that started at @start. */
+static inline void overload_stop(u64 start)
+{
+	if (start)
+		__overload_account(start);
+}
+
+bool overload_shed(struct xlator *jool);
+
+#endif /* SRC_MOD_COMMON_OVERLOAD_H_ */
@@ -29,6 +29,13 @@ struct pkt_metadata {
 	unsigned int l4_offset;
 	/* Offset is from skb->data. */
 	unsigned int payload_offset;
+
+	/*
+	 * ICMP errors only: protocol and offset (from skb->data) of the inner
+	 * packet's layer 4 header. Zero offset means there's no inner packet.
+	 */
+	enum l4_protocol inner_l4_proto;
+	unsigned int inner_l4_offset;
 };
 
 #define skb_hdr_ptr(skb, offset, buffer) \
@@ -163,6 +170,7 @@ static verdict summarize_skb6(struct xlation *state,
 	offset = hdr6_offset + sizeof(struct ipv6hdr);
 
 	meta->fhdr_offset = 0;
+	meta->inner_l4_offset = 0;
 
 	do {
 		switch (nexthdr) {
@@ -243,7 +251,7 @@ static verdict summarize_skb6(struct xlation *state,
 }
 
 static verdict validate_inner6(struct xlation *state,
-		struct pkt_metadata const *outer_meta)
+		struct pkt_metadata *outer_meta)
 {
 	union {
 		struct ipv6hdr ip6;
@@ -293,10 +301,12 @@ static verdict validate_inner6(struct xlation *state,
 		return truncated(state, "inner headers");
 	}
 
+	outer_meta->inner_l4_proto = meta.l4_proto;
+	outer_meta->inner_l4_offset = meta.l4_offset;
 	return VERDICT_CONTINUE;
 }
 
-static verdict handle_icmp6(struct xlation *state, struct pkt_metadata const *meta)
+static verdict handle_icmp6(struct xlation *state, struct pkt_metadata *meta)
 {
 	union {
 		struct icmp6hdr icmp;
@@ -328,6 +338,68 @@ static verdict handle_icmp6(struct xlation *state, struct pkt_metadata const *me
 			: VERDICT_CONTINUE;
 }
 
+/*
+ * Reads the ports (or ICMP identifier) out of the @proto header at @l4.
+ * Leaves them alone if @proto has none.
+ */
+static void get_ports(enum l4_protocol proto, void const *l4,
+		__u16 *src, __u16 *dst)
+{
+	switch (proto) {
+	case L4PROTO_TCP:
+		*src = be16_to_cpu(((struct tcphdr const *)l4)->source);
+		*dst = be16_to_cpu(((struct tcphdr const *)l4)->dest);
+		break;
+	case L4PROTO_UDP:
+		*src = be16_to_cpu(((struct udphdr const *)l4)->source);
+		*dst = be16_to_cpu(((struct udphdr const *)l4)->dest);
+		break;
+	case L4PROTO_ICMP:
+		/* ICMPv4's and ICMPv6's echo identifiers share an offset. */
+		*src = be16_to_cpu(((struct icmp6hdr const *)l4)->icmp6_identifier);
+		*dst = *src;
+		break;
+	case L4PROTO_OTHER:
+		break;
+	}
+}
+
+/*
+ * NAT64 only. Fills @state->in.tuple out of the (already pulled) headers the
+ * summarization found, so determine_in_tuple() doesn't have to find them again.
+ *
+ * ICMP errors get the tuple of their inner packet, reversed. Subsequent
+ * fragments get no ports; determine_in_tuple() takes care of them.
+ */
+static void summarize_tuple6(struct xlation *state,
+		struct pkt_metadata const *meta)
+{
+	struct sk_buff *skb = state->in.skb;
+	struct tuple *tuple = &state->in.tuple;
+	struct ipv6hdr const *hdr6;
+
+	tuple->l3_proto = L3PROTO_IPV6;
+
+	if (meta->inner_l4_offset) {
+		hdr6 = (struct ipv6hdr const *)(skb->data + meta->payload_offset);
+		tuple->src.addr6.l3 = hdr6->daddr;
+		tuple->dst.addr6.l3 = hdr6->saddr;
+		tuple->l4_proto = meta->inner_l4_proto;
+		get_ports(meta->inner_l4_proto, skb->data + meta->inner_l4_offset,
+				&tuple->dst.addr6.l4, &tuple->src.addr6.l4);
+		return;
+	}
+
+	hdr6 = ipv6_hdr(skb);
+	tuple->src.addr6.l3 = hdr6->saddr;
+	tuple->dst.addr6.l3 = hdr6->daddr;
+	tuple->l4_proto = meta->l4_proto;
+	if (!meta->fhdr_offset || is_first_frag6((struct frag_hdr const *)
+			(skb->data + meta->fhdr_offset)))
+		get_ports(meta->l4_proto, skb->data + meta->l4_offset,
+				&tuple->src.addr6.l4, &tuple->dst.addr6.l4);
+}
+
 verdict pkt_init_ipv6(struct xlation *state, struct sk_buff *skb)
 {
 	struct pkt_metadata meta;
@@ -378,6 +450,9 @@ verdict pkt_init_ipv6(struct xlation *state, struct sk_buff *skb)
 	state->in.payload_offset = meta.payload_offset;
 	state->in.original_pkt = &state->in;
 
+	if (xlation_is_nat64(state))
+		summarize_tuple6(state, &meta);
+
 	return VERDICT_CONTINUE;
 }
 
@@ -412,22 +487,28 @@ static verdict validate_inner4(struct xlation *state, struct pkt_metadata *meta)
 
 	switch (ptr.ip4->protocol) {
 	case IPPROTO_TCP:
+		meta->inner_l4_proto = L4PROTO_TCP;
 		ptr.tcp = skb_hdr_ptr(state->in.skb, offset, buffer.tcp);
 		if (!ptr.tcp)
 			return truncated(state, "inner TCP header");
 		offset += tcp_hdr_len(ptr.tcp);
 		break;
 	case IPPROTO_UDP:
+		meta->inner_l4_proto = L4PROTO_UDP;
 		offset += sizeof(struct udphdr);
 		break;
 	case IPPROTO_ICMP:
+		meta->inner_l4_proto = L4PROTO_ICMP;
 		offset += sizeof(struct icmphdr);
 		break;
+	default:
+		meta->inner_l4_proto = L4PROTO_OTHER;
 	}
 
 	if (!pskb_may_pull(state->in.skb, offset))
 		return truncated(state, "inner headers");
 
+	meta->inner_l4_offset = meta->payload_offset + ihl;
 	return VERDICT_CONTINUE;
 }
 
@@ -438,7 +519,8 @@ static verdict handle_icmp4(struct xlation *state, struct pkt_metadata *meta)
 	/*
 	 * If fragmented:
 	 * 	If NAT64:
-	 * 		Impossible (because nf_defrag_ipv4)
+	 * 		Impossible (because nf_defrag_ipv4), unless fragment_tracking;
+	 * 		then same as SIIT.
 	 * 	Else (ie. SIIT):
 	 * 		If ICMP error:
 	 * 			Drop (because illegal)
@@ -474,6 +556,7 @@ static verdict summarize_skb4(struct xlation *state, struct pkt_metadata *meta)
 	meta->fhdr_offset = 0;
 	meta->l4_offset = offset;
 	meta->payload_offset = offset;
+	meta->inner_l4_offset = 0;
 
 	switch (hdr4->protocol) {
 	case IPPROTO_TCP:
@@ -504,6 +587,35 @@ static verdict summarize_skb4(struct xlation *state, struct pkt_metadata *meta)
 	return VERDICT_CONTINUE;
 }
 
+/* IPv4 version of summarize_tuple6(). */
+static void summarize_tuple4(struct xlation *state,
+		struct pkt_metadata const *meta)
+{
+	struct sk_buff *skb = state->in.skb;
+	struct tuple *tuple = &state->in.tuple;
+	struct iphdr const *hdr4;
+
+	tuple->l3_proto = L3PROTO_IPV4;
+
+	if (meta->inner_l4_offset) {
+		hdr4 = (struct iphdr const *)(skb->data + meta->payload_offset);
+		tuple->src.addr4.l3.s_addr = hdr4->daddr;
+		tuple->dst.addr4.l3.s_addr = hdr4->saddr;
+		tuple->l4_proto = meta->inner_l4_proto;
+		get_ports(meta->inner_l4_proto, skb->data + meta->inner_l4_offset,
+				&tuple->dst.addr4.l4, &tuple->src.addr4.l4);
+		return;
+	}
+
+	hdr4 = ip_hdr(skb);
+	tuple->src.addr4.l3.s_addr = hdr4->saddr;
+	tuple->dst.addr4.l3.s_addr = hdr4->daddr;
+	tuple->l4_proto = meta->l4_proto;
+	if (is_first_frag4(hdr4))
+		get_ports(meta->l4_proto, skb->data + meta->l4_offset,
+				&tuple->src.addr4.l4, &tuple->dst.addr4.l4);
+}
+
 verdict pkt_init_ipv4(struct xlation *state, struct sk_buff *skb)
 {
 	struct pkt_metadata meta;
@@ -546,6 +658,9 @@ verdict pkt_init_ipv4(struct xlation *state, struct sk_buff *skb)
 	state->in.payload_offset = meta.payload_offset;
 	state->in.original_pkt = &state->in;
 
+	if (xlation_is_nat64(state))
+		summarize_tuple4(state, &meta);
+
 	return VERDICT_CONTINUE;
 }
 
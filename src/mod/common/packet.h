@@ -41,7 +41,7 @@
  *
  * - Subsequent fragment: Packet with fragment offset nonzero.
  *   (These only show up when nf_defrag_ipv* is disabled; ie. stateless
- *   translators only.)
+ *   translators, and NAT64 in fragment_tracking mode.)
  */
 
 #include <linux/skbuff.h>
@@ -0,0 +1,126 @@
+#include "mod/common/pmtu_cache.h"
+
+#include <linux/jhash.h>
+#include <linux/kref.h>
+#include <linux/seqlock.h>
+#include <net/ipv6.h>
+#include "mod/common/wkmalloc.h"
+
+/* Has to be a power of two. */
+#define PMTU_SLOTS 128
+/*
+ * Learned MTUs are forgotten after this, so the path gets a chance to prove
+ * it grew. Same as the kernel's default (net.ipv6.route.mtu_expires), which in
+ * turn follows RFC 8201, section 4.
+ */
+#define PMTU_TIMEOUT (10 * 60 * HZ)
+
+struct pmtu_slot {
+	seqlock_t lock;
+	/* The destination's /64. */
+	u64 prefix;
+	/* Zero means the slot was never used. */
+	unsigned int mtu;
+	unsigned long expires;
+};
+
+struct pmtu_cache {
+	struct pmtu_slot slots[PMTU_SLOTS];
+	struct kref refs;
+};
+
+struct pmtu_cache *pmtu_cache_alloc(void)
+{
+	struct pmtu_cache *cache;
+	unsigned int i;
+
+	cache = wkmalloc(struct pmtu_cache, GFP_KERNEL);
+	if (!cache)
+		return NULL;
+
+	memset(cache, 0, sizeof(*cache));
+	for (i = 0; i < PMTU_SLOTS; i++)
+		seqlock_init(&cache->slots[i].lock);
+	kref_init(&cache->refs);
+
+	return cache;
+}
+
+void pmtu_cache_get(struct pmtu_cache *cache)
+{
+	kref_get(&cache->refs);
+}
+
+static void pmtu_cache_release(struct kref *refs)
+{
+	wkfree(struct pmtu_cache, container_of(refs, struct pmtu_cache, refs));
+}
+
+void pmtu_cache_put(struct pmtu_cache *cache)
+{
+	kref_put(&cache->refs, pmtu_cache_release);
+}
+
+static u64 prefix64(struct in6_addr const *addr)
+{
+	return ((u64)be32_to_cpu(addr->s6_addr32[0]) << 32)
+			| be32_to_cpu(addr->s6_addr32[1]);
+}
+
+static struct pmtu_slot *get_slot(struct pmtu_cache *cache, u64 prefix)
+{
+	return &cache->slots[jhash_2words(prefix >> 32, prefix, 0)
+			& (PMTU_SLOTS - 1)];
+}
+
+/**
+ * pmtu_cache_learn - Remembers that a Packet Too Big reported @mtu as the MTU
+ * of the path towards @dst.
+ *
+ * Only ever lowers the known MTU, until it expires. (Reports below IPv6's
+ * minimum are raised to it; the 4->6 direction never goes below 1280 anyway.)
+ */
+void pmtu_cache_learn(struct xlator *jool, struct in6_addr const *dst,
+		unsigned int mtu)
+{
+	u64 prefix = prefix64(dst);
+	struct pmtu_slot *slot = get_slot(jool->pmtu, prefix);
+	unsigned long now = jiffies;
+
+	if (mtu < IPV6_MIN_MTU)
+		mtu = IPV6_MIN_MTU;
+
+	write_seqlock_bh(&slot->lock);
+	if (slot->mtu == 0 || slot->prefix != prefix
+			|| time_after_eq(now, slot->expires)
+			|| mtu < slot->mtu) {
+		/* Newcomers (and collisions) simply replace the old entry. */
+		slot->prefix = prefix;
+		slot->mtu = mtu;
+		slot->expires = now + PMTU_TIMEOUT;
+	}
+	write_sequnlock_bh(&slot->lock);
+}
+
+/**
+ * pmtu_cache_limit - Returns @mtu, lowered to the MTU learned for the path
+ * towards @dst, if there's one.
+ */
+unsigned int pmtu_cache_limit(struct xlator *jool, struct in6_addr const *dst,
+		unsigned int mtu)
+{
+	u64 prefix = prefix64(dst);
+	struct pmtu_slot *slot = get_slot(jool->pmtu, prefix);
+	unsigned int learned;
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&slot->lock);
+		learned = (slot->mtu != 0 && slot->prefix == prefix
+				&& time_before(jiffies, slot->expires))
+				? slot->mtu
+				: 0;
+	} while (read_seqretry(&slot->lock, seq));
+
+	return (learned != 0) ? min(mtu, learned) : mtu;
+}
@@ -0,0 +1,35 @@
+#ifndef SRC_MOD_COMMON_PMTU_CACHE_H_
+#define SRC_MOD_COMMON_PMTU_CACHE_H_
+
+/**
+ * @file
+ * The Path MTUs an instance has learned towards IPv6 destinations.
+ *
+ * The kernel learns Path MTUs out of the Packet Too Bigs addressed to itself,
+ * and the routes of the 4->6 direction reflect them. But the PTBs that reach
+ * Jool are addressed to IPv4 nodes (through translated addresses), so the
+ * kernel never finds out about them, and the 4->6 direction ends up sizing
+ * its packets out of the next hop MTU and lowest-ipv6-mtu alone. Non-DF
+ * traffic is fragmented to lowest-ipv6-mtu, and DF traffic that doesn't fit
+ * the path has to bounce off the network every time.
+ *
+ * This remembers the MTUs the translated PTBs report, per destination /64,
+ * for a while. Unlike the other packet path caches, it's shared by all CPUs,
+ * since the PTBs and the traffic they're about rarely land on the same one.
+ * (It's written seldom enough for this not to matter.)
+ */
+
+#include "mod/common/xlator.h"
+
+struct pmtu_cache;
+
+struct pmtu_cache *pmtu_cache_alloc(void);
+void pmtu_cache_get(struct pmtu_cache *cache);
+void pmtu_cache_put(struct pmtu_cache *cache);
+
+void pmtu_cache_learn(struct xlator *jool, struct in6_addr const *dst,
+		unsigned int mtu);
+unsigned int pmtu_cache_limit(struct xlator *jool, struct in6_addr const *dst,
+		unsigned int mtu);
+
+#endif /* SRC_MOD_COMMON_PMTU_CACHE_H_ */
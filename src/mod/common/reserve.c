@@ -0,0 +1,156 @@
+#include "mod/common/reserve.h"
+
+#include <linux/percpu.h>
+#include <linux/topology.h>
+#include <linux/workqueue.h>
+
+#include "mod/common/wkmalloc.h"
+
+/* Objects stocked per CPU. */
+#define RESERVE_DEPTH 32
+/* A stock that drops below this many objects gets refilled. */
+#define RESERVE_LOW (RESERVE_DEPTH / 4)
+
+struct reserve_stock {
+	/* Only contended by the refill work. */
+	spinlock_t lock;
+	unsigned int count;
+	void *objs[RESERVE_DEPTH];
+};
+
+struct obj_reserve {
+	/* wkmalloc name of the objects. */
+	char const *name;
+	struct kmem_cache *cache;
+	struct reserve_stock __percpu *stocks;
+	struct work_struct refill;
+};
+
+/*
+ * Process context only. The objects come from @cpu's node, so they are as
+ * local as the ones the packet path would have allocated itself.
+ */
+static void refill_stock(struct obj_reserve *reserve, unsigned int cpu)
+{
+	struct reserve_stock *stock = per_cpu_ptr(reserve->stocks, cpu);
+	void *obj;
+	bool full;
+
+	do {
+		spin_lock_bh(&stock->lock);
+		full = stock->count >= RESERVE_DEPTH;
+		spin_unlock_bh(&stock->lock);
+		if (full)
+			return;
+
+		obj = wkmem_cache_alloc_node(reserve->name, reserve->cache,
+				GFP_KERNEL, cpu_to_node(cpu));
+		if (!obj)
+			return;
+
+		spin_lock_bh(&stock->lock);
+		full = stock->count >= RESERVE_DEPTH;
+		if (!full)
+			stock->objs[stock->count++] = obj;
+		spin_unlock_bh(&stock->lock);
+	} while (!full);
+
+	/* Somebody else filled the hole while we were allocating. */
+	wkmem_cache_free(reserve->name, reserve->cache, obj);
+}
+
+static void refill_all(struct obj_reserve *reserve)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		refill_stock(reserve, cpu);
+}
+
+static void refill_work(struct work_struct *work)
+{
+	refill_all(container_of(work, struct obj_reserve, refill));
+}
+
+/**
+ * reserve_create - Returns a reserve of @cache objects, already stocked.
+ *
+ * @name is the wkmalloc name the rest of the code uses to allocate and release
+ * them. Can sleep.
+ */
+struct obj_reserve *reserve_create(char const *name, struct kmem_cache *cache)
+{
+	struct obj_reserve *reserve;
+	unsigned int cpu;
+
+	reserve = wkmalloc(struct obj_reserve, GFP_KERNEL);
+	if (!reserve)
+		return NULL;
+
+	/* alloc_percpu() zeroes. */
+	reserve->stocks = alloc_percpu(struct reserve_stock);
+	if (!reserve->stocks) {
+		wkfree(struct obj_reserve, reserve);
+		return NULL;
+	}
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(reserve->stocks, cpu)->lock);
+
+	reserve->name = name;
+	reserve->cache = cache;
+	INIT_WORK(&reserve->refill, refill_work);
+
+	/* Best effort; the packet path falls back to the slab anyway. */
+	refill_all(reserve);
+	return reserve;
+}
+
+/**
+ * reserve_destroy - Returns the stocked objects to the slab. Nobody can be
+ * allocating from @reserve anymore. Can sleep.
+ */
+void reserve_destroy(struct obj_reserve *reserve)
+{
+	struct reserve_stock *stock;
+	unsigned int cpu;
+
+	cancel_work_sync(&reserve->refill);
+
+	for_each_possible_cpu(cpu) {
+		stock = per_cpu_ptr(reserve->stocks, cpu);
+		while (stock->count > 0)
+			wkmem_cache_free(reserve->name, reserve->cache,
+					stock->objs[--stock->count]);
+	}
+
+	free_percpu(reserve->stocks);
+	wkfree(struct obj_reserve, reserve);
+}
+
+/**
+ * reserve_alloc - Atomic allocation. Pops an object from the running CPU's
+ * stock, and only asks the slab (GFP_ATOMIC) if the stock is empty.
+ *
+ * The object is not zeroed. Release it through wkmem_cache_free().
+ */
+void *reserve_alloc(struct obj_reserve *reserve)
+{
+	struct reserve_stock *stock;
+	void *obj;
+	bool low;
+
+	local_bh_disable();
+	stock = this_cpu_ptr(reserve->stocks);
+	spin_lock(&stock->lock);
+	obj = (stock->count > 0) ? stock->objs[--stock->count] : NULL;
+	low = stock->count < RESERVE_LOW;
+	spin_unlock(&stock->lock);
+	local_bh_enable();
+
+	/* No-op if the refill is already pending. */
+	if (low)
+		schedule_work(&reserve->refill);
+
+	return obj ? obj : wkmem_cache_alloc(reserve->name, reserve->cache,
+			GFP_ATOMIC);
+}
@@ -0,0 +1,29 @@
+#ifndef SRC_MOD_COMMON_RESERVE_H_
+#define SRC_MOD_COMMON_RESERVE_H_
+
+/**
+ * @file
+ * Object reserves: small per-CPU stocks of preallocated slab objects, for the
+ * allocations of the packet path.
+ *
+ * GFP_ATOMIC allocations cannot reclaim, so they fail whenever the slab needs
+ * a fresh page and the free lists happen to be short, even if the system has
+ * plenty of memory. A reserve is topped up from process context (GFP_KERNEL,
+ * so it can wait for reclaim), which means an atomic allocation succeeds as
+ * long as its CPU's stock is not exhausted. The slab is only asked directly
+ * once it is.
+ *
+ * The objects are returned to the slab (through wkmem_cache_free(), with the
+ * same name) rather than to the reserve; the refill work brings them back.
+ */
+
+#include <linux/slab.h>
+
+struct obj_reserve;
+
+struct obj_reserve *reserve_create(char const *name, struct kmem_cache *cache);
+void reserve_destroy(struct obj_reserve *reserve);
+
+void *reserve_alloc(struct obj_reserve *reserve);
+
+#endif /* SRC_MOD_COMMON_RESERVE_H_ */
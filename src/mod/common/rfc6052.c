@@ -10,14 +10,11 @@ union ipv4_address {
 	__u8 as8[4];
 };
 
-int __rfc6052_6to4(struct ipv6_prefix const *prefix, struct in6_addr const *src,
-		struct in_addr *dst)
+int __rfc6052_6to4_nocheck(struct ipv6_prefix const *prefix,
+		struct in6_addr const *src, struct in_addr *dst)
 {
 	union ipv4_address dst_aux;
 
-	if (!prefix6_contains(prefix, src))
-		return -EINVAL;
-
 	switch (prefix->len) {
 	case 32:
 		dst_aux.as32 = src->s6_addr32[1];
@@ -62,6 +59,14 @@ int __rfc6052_6to4(struct ipv6_prefix const *prefix, struct in6_addr const *src,
 	return 0;
 }
 
+int __rfc6052_6to4(struct ipv6_prefix const *prefix, struct in6_addr const *src,
+		struct in_addr *dst)
+{
+	if (!prefix6_contains(prefix, src))
+		return -EINVAL;
+	return __rfc6052_6to4_nocheck(prefix, src, dst);
+}
+
 int rfc6052_6to4(struct ipv6_prefix const *prefix, struct in6_addr const *src,
 		struct result_addrxlat64 *dst)
 {
@@ -20,6 +20,14 @@
  */
 int __rfc6052_6to4(struct ipv6_prefix const *prefix, struct in6_addr const *src,
 		struct in_addr *dst);
+/**
+ * Same as __rfc6052_6to4(), except it assumes @src belongs to @prefix.
+ *
+ * Meant for callers that have already validated that, so the packet doesn't
+ * pay for the prefix comparison twice.
+ */
+int __rfc6052_6to4_nocheck(struct ipv6_prefix const *prefix,
+		struct in6_addr const *src, struct in_addr *dst);
 
 /**
  * Translates @src into an IPv6 address and returns it as @dst.
@@ -1,10 +1,12 @@
 #include "mod/common/rfc7915/4to6.h"
 
+#include <linux/netdevice.h>
 #include <net/addrconf.h>
 #include <net/ip6_checksum.h>
 
 #include "common/constants.h"
 #include "mod/common/log.h"
+#include "mod/common/pmtu_cache.h"
 #include "mod/common/rfc6052.h"
 #include "mod/common/route.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
@@ -19,14 +21,14 @@ static __u8 xlat_nexthdr(__u8 protocol)
 
 static int generate_saddr6_nat64(struct xlation *state)
 {
-	struct jool_globals *cfg;
+	struct xlator_fast const *cfg;
 	struct in_addr tmp;
 
-	cfg = &state->jool.globals;
-	if (cfg->nat64.src_icmp6errs_better && pkt_is_icmp4_error(&state->in)) {
+	cfg = &state->jool->fast;
+	if (cfg->src_icmp6errs_better && pkt_is_icmp4_error(&state->in)) {
 		/* Issue #132 behaviour. */
 		tmp.s_addr = pkt_ip4_hdr(&state->in)->saddr;
-		return __rfc6052_4to6(&cfg->pool6.prefix, &tmp,
+		return __rfc6052_4to6(&cfg->pool6, &tmp,
 				&state->flowx.v6.flowi.saddr);
 	}
 
@@ -37,7 +39,7 @@ static int generate_saddr6_nat64(struct xlation *state)
 
 static verdict xlat46_external_addresses(struct xlation *state)
 {
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		if (generate_saddr6_nat64(state))
 			return drop(state, JSTAT46_SRC);
@@ -51,7 +53,7 @@ static verdict xlat46_external_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -63,7 +65,7 @@ static verdict xlat46_internal_addresses(struct xlation *state)
 	if (pkt_is_inner(&state->in))
 		return VERDICT_CONTINUE; /* Called from xlat46_icmp_type() */
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		state->flowx.v6.inner_src = state->out.tuple.dst.addr6.l3;
 		state->flowx.v6.inner_dst = state->out.tuple.src.addr6.l3;
@@ -82,7 +84,7 @@ static verdict xlat46_internal_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -93,7 +95,7 @@ static verdict xlat46_tcp_ports(struct xlation *state)
 	struct tcphdr const *hdr;
 
 	flow6 = &state->flowx.v6.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow6->fl6_sport = cpu_to_be16(state->out.tuple.src.addr6.l4);
 		flow6->fl6_dport = cpu_to_be16(state->out.tuple.dst.addr6.l4);
@@ -117,7 +119,7 @@ static verdict xlat46_udp_ports(struct xlation *state)
 	struct udphdr const *udp;
 
 	flow6 = &state->flowx.v6.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow6->fl6_sport = cpu_to_be16(state->out.tuple.src.addr6.l4);
 		flow6->fl6_dport = cpu_to_be16(state->out.tuple.dst.addr6.l4);
@@ -224,6 +226,8 @@ static verdict compute_flowix46(struct xlation *state)
 
 	flow6 = &state->flowx.v6.flowi;
 
+	/* xlation_acquire() does not clear this. */
+	memset(&state->flowx.v6, 0, sizeof(state->flowx.v6));
 	flow6->flowi6_mark = state->in.skb->mark;
 	flow6->flowi6_scope = RT_SCOPE_UNIVERSE;
 	flow6->flowi6_proto = xlat_nexthdr(pkt_ip4_hdr(&state->in)->protocol);
@@ -246,7 +250,7 @@ static verdict compute_flowix46(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
-static verdict predict_route46(struct xlation *state)
+static verdict __predict_route46(struct xlation *state)
 {
 	struct flowi6 *flow6;
 
@@ -256,19 +260,19 @@ static verdict predict_route46(struct xlation *state)
 
 	flow6 = &state->flowx.v6.flowi;
 	log_debug(state, "Routing: %pI6c->%pI6c", &flow6->saddr, &flow6->daddr);
-	state->dst = route6(&state->jool, flow6);
+	state->dst = route6(state->jool, flow6);
 	if (!state->dst)
 		return untranslatable(state, JSTAT_FAILED_ROUTES);
 
 	if (ipv6_addr_any(&flow6->saddr)) { /* empty pool6791v6 */
-		if (WARN(!xlator_is_siit(&state->jool),
+		if (WARN(!xlator_is_siit(state->jool),
 			 "Zero source address on not SIIT!"))
 			goto panic;
 		if (WARN(!pkt_is_icmp4_error(&state->in),
 			 "Zero source on not ICMP error!"))
 			goto panic;
 
-		if (ipv6_dev_get_saddr(state->jool.ns, NULL, &flow6->daddr,
+		if (ipv6_dev_get_saddr(state->jool->ns, NULL, &flow6->daddr,
 				       IPV6_PREFER_SRC_PUBLIC, &flow6->saddr)) {
 			log_warn_once("Can't find a sufficiently scoped primary source address to reach %pI6.",
 					&flow6->daddr);
@@ -286,6 +290,26 @@ panic:
 	return drop(state, JSTAT_UNKNOWN);
 }
 
+verdict predict_route46(struct xlation *state)
+{
+	verdict result;
+
+	if (!state->flowx_set) {
+		result = compute_flowix46(state);
+		if (result != VERDICT_CONTINUE)
+			return result;
+		state->flowx_set = true;
+	}
+
+	if (!state->dst) {
+		result = __predict_route46(state);
+		if (result != VERDICT_CONTINUE)
+			return result;
+	}
+
+	return VERDICT_CONTINUE;
+}
+
 static int iphdr_delta(struct iphdr *hdr4)
 {
 	return sizeof(struct ipv6hdr) - (hdr4->ihl << 2);
@@ -447,8 +471,12 @@ static verdict allocate_fast(struct xlation *state, bool ignore_df,
 	out->protocol = htons(ETH_P_IPV6);
 
 	shinfo = skb_shinfo(out);
-	if (shinfo->gso_size && gso_size)
+	if (shinfo->gso_size && gso_size && shinfo->gso_size != gso_size) {
 		shinfo->gso_size = gso_size;
+		shinfo->gso_segs = DIV_ROUND_UP(in->skb->len - pkt_hdrs_len(in),
+				gso_size);
+	}
+	/* SKB_GSO_UDP_L4 is the same in both families. */
 	if (shinfo->gso_type & SKB_GSO_TCPV4) {
 		shinfo->gso_type &= ~SKB_GSO_TCPV4;
 		shinfo->gso_type |= SKB_GSO_TCPV6;
@@ -541,7 +569,62 @@ static void autofill_dst(struct xlation *state)
 	state->dst = NULL;
 }
 
-static verdict ttp46_alloc_skb(struct xlation *state)
+/*
+ * @nexthop_mtu: Not really the next hop's, but the path's (if a PTB told us
+ *	about it). This way, DF packets that wouldn't make it get their
+ *	Fragmentation Needed right away, and the others are fragmented to what
+ *	the path can actually take.
+ * @mpl: Same, further limited by lowest-ipv6-mtu.
+ */
+static void compute_mpl(struct xlation *state, unsigned int *nexthop_mtu,
+		unsigned int *mpl)
+{
+	unsigned int mtu;
+
+#ifndef UNIT_TESTING
+	mtu = dst_mtu(state->dst);
+#else
+	mtu = 1500;
+#endif
+	mtu = pmtu_cache_limit(state->jool, &state->flowx.v6.flowi.daddr, mtu);
+
+	*nexthop_mtu = mtu;
+	*mpl = min(mtu, state->jool->fast.lowest_ipv6_mtu);
+}
+
+/**
+ * ttp46_must_segment - Is @state->in a UDP GSO train that has to be broken up
+ * before it can be translated?
+ *
+ * The segments of a UDP GSO packet are independent datagrams, so (unlike
+ * TCP's) they can't be resized to fit the IPv6 MTU. If they lack DF and don't
+ * fit, they need to be fragmented one at a time.
+ *
+ * This routes @state->in (if it hasn't been already). @result is the verdict of
+ * that.
+ */
+bool ttp46_must_segment(struct xlation *state, verdict *result)
+{
+	struct packet *in = &state->in;
+	unsigned int nexthop_mtu;
+	unsigned int mpl;
+
+	*result = VERDICT_CONTINUE;
+
+	if (!skb_is_gso(in->skb) || pkt_l4_proto(in) != L4PROTO_UDP)
+		return false;
+	if (is_df_set(pkt_ip4_hdr(in)))
+		return false;
+
+	*result = predict_route46(state);
+	if (*result != VERDICT_CONTINUE)
+		return false;
+
+	compute_mpl(state, &nexthop_mtu, &mpl);
+	return mpl >= 1280 && fragment_exceeds_mtu46(in, mpl);
+}
+
+verdict ttp46_alloc_skb(struct xlation *state)
 {
 	/*
 	 * Glossary:
@@ -653,8 +736,11 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 	 * the Fragmentation ID, which AFAIK, is impossible through the kernel
 	 * API. Therefore, Slow Path.
 	 *
-	 * (Note: GRO enabled on !DF suggests there might exist some potential
-	 * optimization I could be missing somewhere.)
+	 * Except GSO packets are never fragmented (GRO doesn't merge
+	 * fragments), so TCP trains can simply be resegmented to LIM instead.
+	 * UDP GSO (SKB_GSO_UDP_L4) trains can't, because their segments are
+	 * independent datagrams. They're broken up before getting here. (See
+	 * ttp46_must_segment().)
 	 *
 	 * Therefore: If users want performance, they need to enable DF or GTFO.
 	 *
@@ -674,25 +760,15 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 
 	struct packet *in;
 	unsigned int nexthop_mtu;
-	unsigned int lim;
 	unsigned int mpl;
 	verdict result;
 
-	result = compute_flowix46(state);
-	if (result != VERDICT_CONTINUE)
-		return result;
 	result = predict_route46(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
 
 	in = &state->in;
-#ifndef UNIT_TESTING
-	nexthop_mtu = dst_mtu(state->dst);
-#else
-	nexthop_mtu = 1500;
-#endif
-	lim = state->jool.globals.lowest_ipv6_mtu;
-	mpl = min(nexthop_mtu, lim);
+	compute_mpl(state, &nexthop_mtu, &mpl);
 	if (mpl < 1280) {
 		result = drop(state, JSTAT46_BAD_MTU);
 		goto fail;
@@ -720,11 +796,18 @@ static verdict ttp46_alloc_skb(struct xlation *state)
 		}
 
 	} else if (fragment_exceeds_mtu46(in, mpl)) {
-		/*
-		 * Force LIM and Fragmentation ID preservation through manual
-		 * fragmentation.
-		 */
-		result = allocate_slow(state, mpl);
+		if (skb_is_gso(in->skb) && pkt_l4_proto(in) == L4PROTO_TCP) {
+			/* Not fragmented; just shrink the segments. */
+			result = allocate_fast(state, false, mpl
+					- sizeof(struct ipv6hdr)
+					- pkt_l4hdr_len(in));
+		} else {
+			/*
+			 * Force LIM and Fragmentation ID preservation through
+			 * manual fragmentation.
+			 */
+			result = allocate_slow(state, mpl);
+		}
 
 	} else {
 		/*
@@ -843,7 +926,7 @@ static verdict ttcp46_ipv6_common(struct xlation *state)
 	struct frag_hdr *frag_header;
 
 	hdr6->version = 6;
-	if (state->jool.globals.reset_traffic_class) {
+	if (state->jool->fast.reset_traffic_class) {
 		hdr6->priority = 0;
 		hdr6->flow_lbl[0] = 0;
 	} else {
@@ -852,6 +935,8 @@ static verdict ttcp46_ipv6_common(struct xlation *state)
 	}
 	hdr6->flow_lbl[1] = 0;
 	hdr6->flow_lbl[2] = 0;
+	if (pkt_is_outer(in))
+		ttpcomm_set_flow_label(state, hdr6, will_need_frag_hdr(hdr4));
 	/* hdr6->payload_len */
 	/* hdr6->nexthdr */
 	if (pkt_is_outer(in) && !state->is_hairpin) {
@@ -881,15 +966,22 @@ static verdict ttcp46_ipv6_common(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
-/* RFC 7915, section 4.1. */
-static verdict ttp46_ipv6_external(struct xlation *state)
+/*
+ * RFC 7915, section 4.1.
+ *
+ * @plain: @state->in is known to have no options. (See ttp46_plain().) It's a
+ *	constant, so the compiler drops the source route walk.
+ */
+static __always_inline verdict __ttp46_ipv6_external(struct xlation *state,
+		bool plain)
 {
 	struct packet *in = &state->in;
 	struct packet *out = &state->out;
 	struct ipv6hdr *hdr6 = pkt_ip6_hdr(out);
 	verdict result;
 
-	if (pkt_is_outer(in) && has_unexpired_src_route(pkt_ip4_hdr(in))) {
+	if (!plain && pkt_is_outer(in)
+			&& has_unexpired_src_route(pkt_ip4_hdr(in))) {
 		log_debug(state, "Packet has an unexpired source route.");
 		return drop_icmp(state, JSTAT46_SRC_ROUTE, ICMPERR_SRC_ROUTE, 0);
 	}
@@ -915,7 +1007,12 @@ static verdict ttp46_ipv6_external(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
-static verdict ttp46_ipv6_internal(struct xlation *state)
+verdict ttp46_ipv6_external(struct xlation *state)
+{
+	return __ttp46_ipv6_external(state, false);
+}
+
+verdict ttp46_ipv6_internal(struct xlation *state)
 {
 	struct packet *in = &state->in;
 	struct packet *out = &state->out;
@@ -960,8 +1057,8 @@ static __be32 icmp6_minimum_mtu(struct xlation *state,
 		 * Got to determine a likely path MTU.
 		 * See RFC 1191 sections 5, 7 and 7.1.
 		 */
-		__u16 *plateaus = state->jool.globals.plateaus.values;
-		__u16 count = state->jool.globals.plateaus.count;
+		__u16 *plateaus = state->jool->globals.plateaus.values;
+		__u16 count = state->jool->globals.plateaus.count;
 		int i;
 
 		for (i = 0; i < count; i++) {
@@ -980,23 +1077,25 @@ static __be32 icmp6_minimum_mtu(struct xlation *state,
 	return cpu_to_be32(result);
 }
 
-static verdict compute_mtu6(struct xlation *state)
+/**
+ * ttp46_ptb_mtu - Returns the MTU field of the Packet Too Big that
+ * Fragmentation Needed @state->in translates into, assuming it's going to leave
+ * through @out_dst.
+ */
+__be32 ttp46_ptb_mtu(struct xlation *state, struct dst_entry const *out_dst)
 {
 	/* Meant for hairpinning and unit tests. */
 	static const unsigned int INFINITE = 0xffffffff;
 	struct net_device *in_dev;
-	struct dst_entry *out_dst;
 	struct icmphdr *in_icmp;
-	struct icmp6hdr *out_icmp;
 	struct iphdr *hdr4;
 	unsigned int in_mtu;
 	unsigned int out_mtu;
+	__be32 result;
 
 	in_icmp = pkt_icmp4_hdr(&state->in);
-	out_icmp = pkt_icmp6_hdr(&state->out);
 	in_dev = state->in.skb->dev;
 	in_mtu = in_dev ? in_dev->mtu : INFINITE;
-	out_dst = skb_dst(state->out.skb);
 	out_mtu = out_dst ? dst_mtu(out_dst) : INFINITE;
 
 	log_debug(state, "Packet MTU: %u", be16_to_cpu(in_icmp->un.frag.mtu));
@@ -1008,13 +1107,20 @@ static verdict compute_mtu6(struct xlation *state)
 	 * not the truncated one.
 	 */
 	hdr4 = pkt_payload(&state->in);
-	out_icmp->icmp6_mtu = icmp6_minimum_mtu(state,
+	result = icmp6_minimum_mtu(state,
 			be16_to_cpu(in_icmp->un.frag.mtu),
 			out_mtu,
 			in_mtu,
 			be16_to_cpu(hdr4->tot_len));
-	log_debug(state, "Resulting MTU: %u", be32_to_cpu(out_icmp->icmp6_mtu));
+	log_debug(state, "Resulting MTU: %u", be32_to_cpu(result));
+
+	return result;
+}
 
+static verdict compute_mtu6(struct xlation *state)
+{
+	pkt_icmp6_hdr(&state->out)->icmp6_mtu = ttp46_ptb_mtu(state,
+			skb_dst(state->out.skb));
 	return VERDICT_CONTINUE;
 }
 
@@ -1247,7 +1353,7 @@ static verdict post_icmp6error(struct xlation *state)
 	if (result != VERDICT_CONTINUE)
 		return result;
 
-	result = ttpcomm_translate_inner_packet(state, &ttp46_steps);
+	result = ttpcomm_translate_inner_packet(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
 
@@ -1267,7 +1373,7 @@ static verdict post_icmp6error(struct xlation *state)
  * Translates in's icmp4 header and payload into out's icmp6 header and payload.
  * This is the RFC 7915 sections 4.2 and 4.3, except checksum (See post_icmp6()).
  */
-static verdict ttp46_icmp(struct xlation *state)
+verdict ttp46_icmp(struct xlation *state)
 {
 	struct icmphdr *icmpv4_hdr = pkt_icmp4_hdr(&state->in);
 	struct icmp6hdr *icmpv6_hdr = pkt_icmp6_hdr(&state->out);
@@ -1410,7 +1516,7 @@ static bool can_compute_csum(struct xlation *state)
 	 * don't like it: https://github.com/NICMx/Jool/pull/129
 	 */
 	hdr4 = pkt_ip4_hdr(&state->in);
-	amend_csum0 = state->jool.globals.siit.compute_udp_csum_zero;
+	amend_csum0 = state->jool->fast.compute_udp_csum_zero;
 	if (is_mf_set_ipv4(hdr4) || !amend_csum0) {
 		hdr_udp = pkt_udp_hdr(&state->in);
 		log_debug(state, "Dropping zero-checksum UDP packet: %pI4#%u->%pI4#%u",
@@ -1422,7 +1528,37 @@ static bool can_compute_csum(struct xlation *state)
 	return true;
 }
 
-static verdict ttp46_tcp(struct xlation *state)
+/*
+ * Will the device @out is headed to finish its checksum?
+ * (GSO packets need CHECKSUM_PARTIAL regardless; the GSO code will finish it
+ * if the device can't.)
+ */
+static bool can_offload_csum(struct sk_buff *out)
+{
+	struct dst_entry const *dst;
+
+	if (skb_is_gso(out))
+		return true;
+
+	dst = skb_dst(out);
+	if (!dst || !dst->dev)
+		return false;
+	return can_checksum_protocol(dst->dev->features, htons(ETH_P_IPV6));
+}
+
+/* The IPv6 MTU the connection's segments have to fit in. */
+static unsigned int mss_mtu46(struct xlation *state)
+{
+	struct dst_entry const *out_dst;
+	unsigned int mtu;
+
+	mtu = pmtu_cache_limit(state->jool, &pkt_ip6_hdr(&state->out)->daddr,
+			state->jool->fast.lowest_ipv6_mtu);
+	out_dst = skb_dst(state->out.skb);
+	return out_dst ? min(mtu, dst_mtu(out_dst)) : mtu;
+}
+
+verdict ttp46_tcp(struct xlation *state)
 {
 	struct packet *in = &state->in;
 	struct packet *out = &state->out;
@@ -1459,10 +1595,13 @@ static verdict ttp46_tcp(struct xlation *state)
 		partialize_skb(out->skb, offsetof(struct tcphdr, check));
 	}
 
+	if (ttpcomm_wants_mss_clamp(state))
+		ttpcomm_clamp_mss(state, mss_mtu46(state));
+
 	return VERDICT_CONTINUE;
 }
 
-static verdict ttp46_udp(struct xlation *state)
+verdict ttp46_udp(struct xlation *state)
 {
 	struct packet *in = &state->in;
 	struct packet *out = &state->out;
@@ -1479,11 +1618,14 @@ static verdict ttp46_udp(struct xlation *state)
 
 	/* Header.checksum */
 	if (udp_in->check == 0) {
-		if (can_compute_csum(state))
-			goto partial;
+		if (!can_compute_csum(state))
+			return drop_icmp(state, JSTAT46_FRAGMENTED_ZERO_CSUM,
+					ICMPERR_FILTER, 0);
 
-		return drop_icmp(state, JSTAT46_FRAGMENTED_ZERO_CSUM,
-				ICMPERR_FILTER, 0);
+		/* Prefer leaving the payload pass to the NIC */
+		if (out->skb->next || !can_offload_csum(out->skb))
+			goto full;
+		goto partial;
 
 	} else if (in->skb->ip_summed != CHECKSUM_PARTIAL) {
 		memcpy(&udp_copy, udp_in, sizeof(*udp_in));
@@ -1496,8 +1638,7 @@ static verdict ttp46_udp(struct xlation *state)
 				sizeof(*udp_out));
 
 	} else if (out->skb->next) {
-		udp_out->check = 0;
-		udp_out->check = skb_list_csum(out->skb, NEXTHDR_UDP);
+		goto full;
 
 	} else {
 		goto partial;
@@ -1505,6 +1646,13 @@ static verdict ttp46_udp(struct xlation *state)
 
 	return VERDICT_CONTINUE;
 
+full:
+	udp_out->check = 0;
+	udp_out->check = skb_list_csum(out->skb, NEXTHDR_UDP);
+	if (udp_out->check == 0)
+		udp_out->check = CSUM_MANGLED_0;
+	return VERDICT_CONTINUE;
+
 partial:
 	udp_out->check = ~udp_v6_check(pkt_datagram_len(out),
 			&pkt_ip6_hdr(out)->saddr,
@@ -1513,11 +1661,23 @@ partial:
 	return VERDICT_CONTINUE;
 }
 
-const struct translation_steps ttp46_steps = {
-	.skb_alloc = ttp46_alloc_skb,
-	.xlat_outer_l3 = ttp46_ipv6_external,
-	.xlat_inner_l3 = ttp46_ipv6_internal,
-	.xlat_tcp = ttp46_tcp,
-	.xlat_udp = ttp46_udp,
-	.xlat_icmp = ttp46_icmp,
-};
+/**
+ * ttp46_plain - Translates the headers of @state->in, which has to be an
+ * unfragmented IPv4 TCP or UDP packet with no options, into the already
+ * allocated @state->out.
+ *
+ * Same as ttp46_ipv6_external() followed by ttp46_tcp() or ttp46_udp(), minus
+ * the options walk.
+ */
+verdict ttp46_plain(struct xlation *state)
+{
+	verdict result;
+
+	result = __ttp46_ipv6_external(state, true);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	return (state->in.l4_proto == L4PROTO_TCP)
+			? ttp46_tcp(state)
+			: ttp46_udp(state);
+}
@@ -10,6 +10,18 @@
 
 #include "mod/common/rfc7915/common.h"
 
-extern const struct translation_steps ttp46_steps;
+verdict predict_route46(struct xlation *state);
+bool ttp46_must_segment(struct xlation *state, verdict *result);
+__be32 ttp46_ptb_mtu(struct xlation *state, struct dst_entry const *out_dst);
+
+/* See "translation steps" in common.h. */
+verdict ttp46_alloc_skb(struct xlation *state);
+verdict ttp46_ipv6_external(struct xlation *state);
+verdict ttp46_ipv6_internal(struct xlation *state);
+verdict ttp46_tcp(struct xlation *state);
+verdict ttp46_udp(struct xlation *state);
+verdict ttp46_icmp(struct xlation *state);
+
+verdict ttp46_plain(struct xlation *state);
 
 #endif /* SRC_MOD_COMMON_RFC7915_4TO6_H_ */
@@ -8,10 +8,11 @@
 #include "mod/common/ipv6_hdr_iterator.h"
 #include "mod/common/linux_version.h"
 #include "mod/common/log.h"
+#include "mod/common/pmtu_cache.h"
 #include "mod/common/route.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
 
-static __u8 xlat_tos(struct jool_globals const *config, struct ipv6hdr const *hdr)
+static __u8 xlat_tos(struct xlator_fast const *config, struct ipv6hdr const *hdr)
 {
 	return config->reset_tos ? config->new_tos : get_traffic_class(hdr);
 }
@@ -32,7 +33,7 @@ static verdict xlat64_external_addresses(struct xlation *state)
 {
 	struct flowi4 *flow = &state->flowx.v4.flowi;
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow->saddr = state->out.tuple.src.addr4.l3.s_addr;
 		flow->daddr = state->out.tuple.dst.addr4.l3.s_addr;
@@ -43,7 +44,7 @@ static verdict xlat64_external_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -55,7 +56,7 @@ static verdict xlat64_internal_addresses(struct xlation *state)
 	if (pkt_is_inner(&state->in))
 		return VERDICT_CONTINUE; /* Called from xlat64_icmp_type() */
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		state->flowx.v4.inner_src = state->out.tuple.dst.addr4.l3;
 		state->flowx.v4.inner_dst = state->out.tuple.src.addr4.l3;
@@ -74,7 +75,7 @@ static verdict xlat64_internal_addresses(struct xlation *state)
 	}
 
 	WARN(1, "xlator type is not SIIT nor NAT64: %u",
-			xlator_get_type(&state->jool));
+			xlator_get_type(state->jool));
 	return drop(state, JSTAT_UNKNOWN);
 }
 
@@ -85,7 +86,7 @@ static verdict xlat64_tcp_ports(struct xlation *state)
 	struct tcphdr const *hdr;
 
 	flow4 = &state->flowx.v4.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow4->fl4_sport = cpu_to_be16(state->out.tuple.src.addr4.l4);
 		flow4->fl4_dport = cpu_to_be16(state->out.tuple.dst.addr4.l4);
@@ -109,7 +110,7 @@ static verdict xlat64_udp_ports(struct xlation *state)
 	struct udphdr const *udp;
 
 	flow4 = &state->flowx.v4.flowi;
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		flow4->fl4_sport = cpu_to_be16(state->out.tuple.src.addr4.l4);
 		flow4->fl4_dport = cpu_to_be16(state->out.tuple.dst.addr4.l4);
@@ -202,8 +203,10 @@ static verdict compute_flowix64(struct xlation *state)
 	flow4 = &state->flowx.v4.flowi;
 	hdr6 = pkt_ip6_hdr(&state->in);
 
+	/* xlation_acquire() does not clear this. */
+	memset(&state->flowx.v4, 0, sizeof(state->flowx.v4));
 	flow4->flowi4_mark = state->in.skb->mark;
-	flow4->flowi4_tos = xlat_tos(&state->jool.globals, hdr6);
+	flow4->flowi4_tos = xlat_tos(&state->jool->fast, hdr6);
 	flow4->flowi4_scope = RT_SCOPE_UNIVERSE;
 	flow4->flowi4_proto = xlat_proto(hdr6);
 	/*
@@ -254,7 +257,7 @@ static verdict select_any_saddr(struct xlation *state)
 #endif
 
 	rcu_read_lock();
-	for_each_netdev_rcu(state->jool.ns, dev) {
+	for_each_netdev_rcu(state->jool->ns, dev) {
 		in_dev = __in_dev_get_rcu(dev);
 		if (!in_dev)
 			continue;
@@ -307,7 +310,7 @@ static verdict __predict_route64(struct xlation *state)
 		log_debug(state, "Packet is hairpinning; skipping routing.");
 	} else {
 		log_debug(state, "Routing: %pI4->%pI4", &flow4->saddr, &flow4->daddr);
-		state->dst = route4(&state->jool, flow4);
+		state->dst = route4(state->jool, flow4);
 		if (!state->dst)
 			return untranslatable(state, JSTAT_FAILED_ROUTES);
 	}
@@ -360,6 +363,7 @@ static int fragment_exceeds_mtu64(struct packet const *in, unsigned int mtu)
 {
 	struct sk_buff *iter;
 	unsigned short gso_size;
+	unsigned int frag_max_size;
 	int delta;
 
 	/*
@@ -390,11 +394,23 @@ static int fragment_exceeds_mtu64(struct packet const *in, unsigned int mtu)
 	if (skb_headlen(in->skb) + delta > mtu)
 		goto generic_too_big;
 
+	mtu -= sizeof(struct iphdr);
+
 	/*
-	 * TODO (performance) This loop could probably be optimized away by
-	 * querying IP6CB(skb)->frag_max_size. You'll have to test it.
+	 * nf_defrag_ipv6 leaves the length of the largest original fragment
+	 * (IPv6 header included) in frag_max_size. Every original fragment
+	 * had at least an IPv6 header and a fragment header, so none of the
+	 * frag_list payloads can be longer than that minus both. If that
+	 * already fits, the walk below is pointless.
+	 *
+	 * (The bound is loose when the fragments also had other extension
+	 * headers, in which case the walk gets the last word.)
 	 */
-	mtu -= sizeof(struct iphdr);
+	frag_max_size = IP6CB(in->skb)->frag_max_size;
+	if (frag_max_size && frag_max_size
+			<= sizeof(struct ipv6hdr) + sizeof(struct frag_hdr) + mtu)
+		return 0;
+
 	skb_walk_frags(in->skb, iter)
 		if (iter->len > mtu)
 			return 2;
@@ -427,7 +443,7 @@ static verdict validate_size(struct xlation *state)
 	return drop(state, JSTAT_UNKNOWN);
 }
 
-static verdict ttp64_alloc_skb(struct xlation *state)
+verdict ttp64_alloc_skb(struct xlation *state)
 {
 	struct packet const *in = &state->in;
 	struct sk_buff *out;
@@ -502,6 +518,7 @@ static verdict ttp64_alloc_skb(struct xlation *state)
 	out->protocol = htons(ETH_P_IP);
 
 	shinfo = skb_shinfo(out);
+	/* SKB_GSO_UDP_L4 is the same in both families. */
 	if (shinfo->gso_type & SKB_GSO_TCPV6) {
 		shinfo->gso_type &= ~SKB_GSO_TCPV6;
 		shinfo->gso_type |= SKB_GSO_TCPV4;
@@ -523,15 +540,15 @@ revert:
 
 /**
  * One-liner for creating the IPv4 header's Identification field.
+ * @hdr4->frag_off must already be in place.
  */
 static void generate_ipv4_id(struct xlation const *state, struct iphdr *hdr4,
     struct frag_hdr const *hdr_frag)
 {
-	if (hdr_frag) {
+	if (hdr_frag)
 		hdr4->id = cpu_to_be16(be32_to_cpu(hdr_frag->identification));
-	} else {
-		__ip_select_ident(state->jool.ns, hdr4, 1);
-	}
+	else
+		ttpcomm_select_ipv4_id(state, state->out.skb, hdr4);
 }
 
 static bool generate_df_flag(struct xlation const *state)
@@ -556,11 +573,12 @@ static bool generate_df_flag(struct xlation const *state)
 		return false;
 	}
 	if (skb_is_gso(in->skb)) {
-		if (pkt_l4_proto(in) != L4PROTO_TCP) {
-			/* UDP fragmented, ICMP & OTHER undefined */
+		if (!(skb_shinfo(in->skb)->gso_type
+				& (SKB_GSO_TCPV6 | SKB_GSO_UDP_L4))) {
+			/* UFO fragmented, ICMP & OTHER undefined */
 			return false;
 		}
-		/* TCP not fragmented */
+		/* TCP and UDP L4 segments, not fragmented */
 		return pkt_hdrs_len(out) + skb_shinfo(in->skb)->gso_size > 1260;
 	}
 
@@ -618,8 +636,12 @@ static bool has_nonzero_segments_left(struct ipv6hdr const *hdr6,
  * Translates @state->in's IPv6 header into @state->out's IPv4 header.
  * Only used for external IPv6 headers. (ie. not enclosed in ICMP errors.)
  * RFC 7915 sections 5.1 and 5.1.1.
+ *
+ * @plain: @state->in is known to have no extension headers. (See
+ *	ttp64_plain().) It's a constant, so the compiler drops the header walks.
  */
-static verdict ttp64_ipv4_external(struct xlation *state)
+static __always_inline verdict __ttp64_ipv4_external(struct xlation *state,
+		bool plain)
 {
 	struct ipv6hdr const *hdr6;
 	struct iphdr *hdr4;
@@ -633,22 +655,22 @@ static verdict ttp64_ipv4_external(struct xlation *state)
 		log_debug(state, "Packet's hop limit <= 1.");
 		return drop_icmp(state, JSTAT64_TTL, ICMPERR_TTL, 0);
 	}
-	if (has_nonzero_segments_left(hdr6, &nonzero_location)) {
+	if (!plain && has_nonzero_segments_left(hdr6, &nonzero_location)) {
 		log_debug(state, "Packet's segments left field is nonzero.");
 		return drop_icmp(state, JSTAT64_SEGMENTS_LEFT,
 				ICMPERR_HDR_FIELD, nonzero_location);
 	}
 
 	hdr4 = pkt_ip4_hdr(&state->out);
-	hdr_frag = pkt_frag_hdr(&state->in);
+	hdr_frag = plain ? NULL : pkt_frag_hdr(&state->in);
 	flow4 = &state->flowx.v4.flowi;
 
 	hdr4->version = 4;
 	hdr4->ihl = 5;
 	hdr4->tos = flow4->flowi4_tos;
 	hdr4->tot_len = cpu_to_be16(state->out.skb->len);
-	generate_ipv4_id(state, hdr4, hdr_frag);
 	hdr4->frag_off = xlat_frag_off(hdr_frag, state);
+	generate_ipv4_id(state, hdr4, hdr_frag);
 	hdr4->ttl = hdr6->hop_limit - 1;
 	hdr4->protocol = flow4->flowi4_proto;
 	/* ip4_hdr->check is set later; please scroll down. */
@@ -660,10 +682,15 @@ static verdict ttp64_ipv4_external(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
+verdict ttp64_ipv4_external(struct xlation *state)
+{
+	return __ttp64_ipv4_external(state, false);
+}
+
 /**
  * Same as ttp64_ipv4_external(), except only used on internal headers.
  */
-static verdict ttp64_ipv4_internal(struct xlation *state)
+verdict ttp64_ipv4_internal(struct xlation *state)
 {
 	struct packet const *in = &state->in;
 	struct packet *out = &state->out;
@@ -673,11 +700,11 @@ static verdict ttp64_ipv4_internal(struct xlation *state)
 
 	hdr4->version = 4;
 	hdr4->ihl = 5;
-	hdr4->tos = xlat_tos(&state->jool.globals, hdr6);
+	hdr4->tos = xlat_tos(&state->jool->fast, hdr6);
 	hdr4->tot_len = cpu_to_be16(get_tot_len_ipv6(in->skb) - pkt_hdrs_len(in)
 			+ pkt_hdrs_len(out));
-	generate_ipv4_id(state, hdr4, hdr_frag);
 	hdr4->frag_off = xlat_frag_off(hdr_frag, state);
+	generate_ipv4_id(state, hdr4, hdr_frag);
 	hdr4->ttl = hdr6->hop_limit;
 	hdr4->protocol = xlat_proto(hdr6);
 	hdr4->saddr = state->flowx.v4.inner_src.s_addr;
@@ -705,6 +732,7 @@ static verdict compute_mtu4(struct xlation const *state)
 	struct icmp6hdr const *in_icmp;
 	struct net_device const *in_dev;
 	struct dst_entry const *out_dst;
+	struct ipv6hdr const *inner6;
 	unsigned int in_mtu;
 	unsigned int out_mtu;
 
@@ -724,6 +752,11 @@ static verdict compute_mtu4(struct xlation const *state)
 			in_mtu - 20);
 	log_debug(state, "Resulting MTU: %u", be16_to_cpu(out_icmp->un.frag.mtu));
 
+	/* The kernel won't learn this one; the PTB is not addressed to it. */
+	inner6 = pkt_payload(&state->in);
+	pmtu_cache_learn(state->jool, &inner6->daddr,
+			be32_to_cpu(in_icmp->icmp6_mtu));
+
 	return VERDICT_CONTINUE;
 }
 
@@ -962,7 +995,7 @@ static verdict post_icmp4error(struct xlation *state, bool handle_extensions)
 	if (result != VERDICT_CONTINUE)
 		return result;
 
-	result = ttpcomm_translate_inner_packet(state, &ttp64_steps);
+	result = ttpcomm_translate_inner_packet(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
 
@@ -985,7 +1018,7 @@ static verdict post_icmp4error(struct xlation *state, bool handle_extensions)
  * This is the core of RFC 7915 sections 5.2 and 5.3, except checksum (See
  * post_icmp4*()).
  */
-static verdict ttp64_icmp(struct xlation *state)
+verdict ttp64_icmp(struct xlation *state)
 {
 	struct icmp6hdr const *icmpv6_hdr = pkt_icmp6_hdr(&state->in);
 	struct icmphdr *icmpv4_hdr = pkt_icmp4_hdr(&state->out);
@@ -1095,7 +1128,19 @@ static __sum16 update_csum_6to4(__sum16 csum16,
 	return csum_fold(csum);
 }
 
-static verdict ttp64_tcp(struct xlation *state)
+/* The IPv6 MTU the connection's segments have to fit in. */
+static unsigned int mss_mtu64(struct xlation *state)
+{
+	struct net_device const *in_dev;
+	unsigned int mtu;
+
+	mtu = pmtu_cache_limit(state->jool, &pkt_ip6_hdr(&state->in)->saddr,
+			state->jool->fast.lowest_ipv6_mtu);
+	in_dev = state->in.skb->dev;
+	return in_dev ? min(mtu, in_dev->mtu) : mtu;
+}
+
+verdict ttp64_tcp(struct xlation *state)
 {
 	struct packet const *in = &state->in;
 	struct packet *out = &state->out;
@@ -1128,10 +1173,13 @@ static verdict ttp64_tcp(struct xlation *state)
 		partialize_skb(out->skb, offsetof(struct tcphdr, check));
 	}
 
+	if (ttpcomm_wants_mss_clamp(state))
+		ttpcomm_clamp_mss(state, mss_mtu64(state));
+
 	return VERDICT_CONTINUE;
 }
 
-static verdict ttp64_udp(struct xlation *state)
+verdict ttp64_udp(struct xlation *state)
 {
 	struct packet const *in = &state->in;
 	struct packet *out = &state->out;
@@ -1169,11 +1217,23 @@ static verdict ttp64_udp(struct xlation *state)
 	return VERDICT_CONTINUE;
 }
 
-const struct translation_steps ttp64_steps = {
-	.skb_alloc = ttp64_alloc_skb,
-	.xlat_outer_l3 = ttp64_ipv4_external,
-	.xlat_inner_l3 = ttp64_ipv4_internal,
-	.xlat_tcp = ttp64_tcp,
-	.xlat_udp = ttp64_udp,
-	.xlat_icmp = ttp64_icmp,
-};
+/**
+ * ttp64_plain - Translates the headers of @state->in, which has to be an IPv6
+ * TCP or UDP packet with no extension headers, into the already allocated
+ * @state->out.
+ *
+ * Same as ttp64_ipv4_external() followed by ttp64_tcp() or ttp64_udp(), minus
+ * the extension header walks.
+ */
+verdict ttp64_plain(struct xlation *state)
+{
+	verdict result;
+
+	result = __ttp64_ipv4_external(state, true);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
+	return (state->in.l4_proto == L4PROTO_TCP)
+			? ttp64_tcp(state)
+			: ttp64_udp(state);
+}
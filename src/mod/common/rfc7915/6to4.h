@@ -11,8 +11,16 @@
 
 #include "mod/common/rfc7915/common.h"
 
-extern const struct translation_steps ttp64_steps;
-
 verdict predict_route64(struct xlation *state);
 
+/* See "translation steps" in common.h. */
+verdict ttp64_alloc_skb(struct xlation *state);
+verdict ttp64_ipv4_external(struct xlation *state);
+verdict ttp64_ipv4_internal(struct xlation *state);
+verdict ttp64_tcp(struct xlation *state);
+verdict ttp64_udp(struct xlation *state);
+verdict ttp64_icmp(struct xlation *state);
+
+verdict ttp64_plain(struct xlation *state);
+
 #endif /* SRC_MOD_COMMON_RFC7915_6TO4_H_ */
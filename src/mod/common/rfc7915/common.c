@@ -1,6 +1,12 @@
 #include "mod/common/rfc7915/common.h"
 
 #include <linux/icmp.h>
+#include <linux/jhash.h>
+#include <linux/net.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/tcp.h>
+#include <asm/unaligned.h>
 #include "common/config.h"
 #include "mod/common/ipv6_hdr_iterator.h"
 #include "mod/common/linux_version.h"
@@ -8,6 +14,8 @@
 #include "mod/common/packet.h"
 #include "mod/common/stats.h"
 #include "mod/common/db/denylist4.h"
+#include "mod/common/rfc7915/4to6.h"
+#include "mod/common/rfc7915/6to4.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
 
 /**
@@ -26,6 +34,154 @@ bool will_need_frag_hdr(const struct iphdr *hdr)
 	return is_fragmented_ipv4(hdr);
 }
 
+/*
+ * Is @state->in a SYN (or SYN-ACK) whose MSS the instance wants clamped?
+ * @state->in must have a TCP header (ie. it's not a subsequent fragment).
+ */
+bool ttpcomm_wants_mss_clamp(struct xlation *state)
+{
+	return state->jool->fast.tcp_mss_clamp
+			&& pkt_is_outer(&state->in)
+			&& pkt_tcp_hdr(&state->in)->syn;
+}
+
+/**
+ * ttpcomm_set_flow_label - If the instance wants it (generate-flow-label),
+ * writes a flow label derived from the translated packet's flow into @hdr6.
+ * @hdr6's Traffic Class must already be in place.
+ *
+ * Packets of the same session always get the same label. The fragments of a
+ * datagram are hashed only by their addresses and protocol, since only the
+ * first one has ports; otherwise they'd get different labels, and ECMP could
+ * take them through different paths.
+ */
+void ttpcomm_set_flow_label(struct xlation *state, struct ipv6hdr *hdr6,
+		bool fragment)
+{
+	static u32 seed __read_mostly;
+	struct flowi6 const *flow = &state->flowx.v6.flowi;
+	u32 label;
+
+	if (!state->jool->fast.generate_flow_label)
+		return;
+
+	net_get_random_once(&seed, sizeof(seed));
+
+	label = __ipv6_addr_jhash(&flow->saddr, seed ^ flow->flowi6_proto);
+	label = __ipv6_addr_jhash(&flow->daddr, label);
+	if (!fragment)
+		label = jhash_2words((__force u32)flow->fl6_sport,
+				(__force u32)flow->fl6_dport, label);
+
+	label &= 0xFFFFF;
+	if (label == 0) /* Zero means "unlabeled." (RFC 6437) */
+		label = 1;
+
+	hdr6->flow_lbl[0] = (hdr6->flow_lbl[0] & 0xF0) | (label >> 16);
+	hdr6->flow_lbl[1] = label >> 8;
+	hdr6->flow_lbl[2] = label;
+}
+
+static DEFINE_PER_CPU(u16, ipv4_ids);
+
+/**
+ * ttpcomm_select_ipv4_id - Writes the Identification of @hdr4, which is not a
+ * fragment, and whose frag_off must already be in place. @skb is the packet
+ * @hdr4 belongs to.
+ *
+ * RFC 6864: The ID only needs to be unique in datagrams that might be
+ * fragmented, so atomic datagrams (DF set) can skip __ip_select_ident()'s
+ * shared state if the instance wants it (ipv4-id-policy).
+ */
+void ttpcomm_select_ipv4_id(struct xlation const *state, struct sk_buff *skb,
+		struct iphdr *hdr4)
+{
+	struct skb_shared_info *shinfo = skb_shinfo(skb);
+	/* GSO increments it for every segment. */
+	unsigned int segs = skb_is_gso(skb) ? shinfo->gso_segs : 1;
+
+	if (hdr4->frag_off & cpu_to_be16(IP_DF)) {
+		switch (state->jool->fast.ipv4_id_policy) {
+		case IIP_ZERO:
+			hdr4->id = 0;
+			/* Otherwise, TSO would still count from zero. */
+			if (shinfo->gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6))
+				shinfo->gso_type |= SKB_GSO_TCP_FIXEDID;
+			return;
+		case IIP_COUNTER:
+			hdr4->id = cpu_to_be16(this_cpu_add_return(ipv4_ids,
+					segs) - segs);
+			return;
+		}
+	}
+
+	__ip_select_ident(state->jool->ns, hdr4, segs);
+}
+
+/**
+ * ttpcomm_clamp_mss - Lowers the MSS option of @state->out's TCP header, so
+ * the segments the peer sends back fit in @ipv6_mtu once they're on the IPv6
+ * side. (The IPv4 side's segments grow by 20 bytes during translation, and
+ * the IPv6 ones are sized after the IPv6 MTU anyway.)
+ *
+ * Only call if ttpcomm_wants_mss_clamp(), and once the checksum is done; it's
+ * updated incrementally, unless it's partial.
+ */
+void ttpcomm_clamp_mss(struct xlation *state, unsigned int ipv6_mtu)
+{
+	struct sk_buff *skb = state->out.skb;
+	struct tcphdr *hdr;
+	unsigned char *opt, *end, *field;
+	unsigned int mss;
+	__wsum csum;
+
+	mss = max(ipv6_mtu, 1280u) - sizeof(struct ipv6hdr)
+			- sizeof(struct tcphdr);
+
+	hdr = pkt_tcp_hdr(&state->out);
+	opt = (unsigned char *)(hdr + 1);
+	end = ((unsigned char *)hdr) + tcp_hdr_len(hdr);
+
+	while (opt < end) {
+		if (opt[0] == TCPOPT_EOL)
+			return;
+		if (opt[0] == TCPOPT_NOP) {
+			opt++;
+			continue;
+		}
+		if (end - opt < 2 || opt[1] < 2 || end - opt < opt[1])
+			return; /* Malformed; leave it to the endpoints */
+		if (opt[0] == TCPOPT_MSS && opt[1] == TCPOLEN_MSS)
+			break;
+		opt += opt[1];
+	}
+	if (opt >= end)
+		return;
+
+	/* Options are not aligned, so neither is the field. */
+	field = opt + 2;
+	if (get_unaligned_be16(field) <= mss)
+		return;
+
+	log_debug(state, "Clamping MSS %u to %u.", get_unaligned_be16(field),
+			mss);
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		put_unaligned_be16(mss, field);
+	} else {
+		/* csum_block_*() compensate for odd offsets. */
+		csum = ~csum_unfold(hdr->check);
+		csum = csum_block_sub(csum, csum_partial(field, 2, 0),
+				field - (unsigned char *)hdr);
+		put_unaligned_be16(mss, field);
+		csum = csum_block_add(csum, csum_partial(field, 2, 0),
+				field - (unsigned char *)hdr);
+		hdr->check = csum_fold(csum);
+	}
+
+	jstat_inc(state->jool->stats, JSTAT_MSS_CLAMPED);
+}
+
 static int move_pointers_in(struct packet *pkt, __u8 protocol,
 		unsigned int l3hdr_len)
 {
@@ -164,16 +320,15 @@ void restore_outer_packet(struct xlation *state, struct bkp_skb_tuple *bkp,
 		restore_pointers(&state->out, &bkp->out);
 }
 
-verdict xlat_l4_function(struct xlation *state,
-		struct translation_steps const *steps)
+static verdict xlat_l4_64(struct xlation *state)
 {
 	switch (state->in.l4_proto) {
 	case L4PROTO_TCP:
-		return steps->xlat_tcp(state);
+		return ttp64_tcp(state);
 	case L4PROTO_UDP:
-		return steps->xlat_udp(state);
+		return ttp64_udp(state);
 	case L4PROTO_ICMP:
-		return steps->xlat_icmp(state);
+		return ttp64_icmp(state);
 	case L4PROTO_OTHER:
 		return VERDICT_CONTINUE;
 	}
@@ -182,8 +337,31 @@ verdict xlat_l4_function(struct xlation *state,
 	return drop(state, JSTAT_UNKNOWN);
 }
 
-verdict ttpcomm_translate_inner_packet(struct xlation *state,
-		struct translation_steps const *steps)
+static verdict xlat_l4_46(struct xlation *state)
+{
+	switch (state->in.l4_proto) {
+	case L4PROTO_TCP:
+		return ttp46_tcp(state);
+	case L4PROTO_UDP:
+		return ttp46_udp(state);
+	case L4PROTO_ICMP:
+		return ttp46_icmp(state);
+	case L4PROTO_OTHER:
+		return VERDICT_CONTINUE;
+	}
+
+	WARN(1, "Unknown l4 proto: %u", state->in.l4_proto);
+	return drop(state, JSTAT_UNKNOWN);
+}
+
+verdict xlat_l4_function(struct xlation *state)
+{
+	return (pkt_l3_proto(&state->in) == L3PROTO_IPV6)
+			? xlat_l4_64(state)
+			: xlat_l4_46(state);
+}
+
+verdict ttpcomm_translate_inner_packet(struct xlation *state)
 {
 	struct bkp_skb_tuple bkp;
 	verdict result;
@@ -192,7 +370,10 @@ verdict ttpcomm_translate_inner_packet(struct xlation *state,
 	if (result != VERDICT_CONTINUE)
 		return result;
 
-	result = steps->xlat_inner_l3(state);
+	/* (The inner packet has the same family as the outer one.) */
+	result = (pkt_l3_proto(&state->in) == L3PROTO_IPV6)
+			? ttp64_ipv4_internal(state)
+			: ttp46_ipv6_internal(state);
 	if (result == VERDICT_UNTRANSLATABLE) {
 		/*
 		 * Accepting because of an inner packet doesn't make sense.
@@ -204,7 +385,7 @@ verdict ttpcomm_translate_inner_packet(struct xlation *state,
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	result = xlat_l4_function(state, steps);
+	result = xlat_l4_function(state);
 	if (result == VERDICT_UNTRANSLATABLE)
 		result = VERDICT_DROP;
 
@@ -245,6 +426,8 @@ void partialize_skb(struct sk_buff *out_skb, __u16 csum_offset)
 	out_skb->csum_offset = csum_offset;
 }
 
+#ifndef JOOL_NO_ICMP_EXTENSIONS
+
 static verdict fix_ie(struct xlation *state, size_t in_ie_offset,
 		size_t ipl, size_t pad, size_t iel)
 {
@@ -404,6 +587,8 @@ verdict handle_icmp_extension(struct xlation *state,
 			out_pad, out_iel);
 }
 
+#endif /* !JOOL_NO_ICMP_EXTENSIONS */
+
 void skb_cleanup_copy(struct sk_buff *skb)
 {
 	/* https://github.com/NICMx/Jool/issues/289 */
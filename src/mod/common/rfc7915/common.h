@@ -12,48 +12,43 @@
  */
 #define icmp4_unused un.gateway
 
-typedef verdict (*skb_alloc_fn)(struct xlation *);
-typedef verdict (*header_xlat_fn)(struct xlation *);
-
-struct translation_steps {
-	/**
-	 * Routes the outgoing packet, allocates it, then copies dst_entry and
-	 * layer 4 payload into it. Ensures there's enough headroom (bytes
-	 * between skb->head and skb->data) for translated headers.
-	 * (In other words, it does everything except for headers.)
-	 *
-	 * "Why do we need this? Why don't we simply override the headers of the
-	 * incoming packet? This would avoid lots of allocation and copying."
-	 *
-	 * Because we can't afford to completely lose the original headers until
-	 * we've fetched the translated packet successfully. Even after the
-	 * RFC7915 code ends, there is still stuff we might need the original
-	 * packet for, such as replying an ICMP error or NF_ACCEPTing.
-	 *
-	 * There's also the issue that the incoming packet might not have enough
-	 * room for the header length expansion from v4 to v6.
-	 */
-	skb_alloc_fn skb_alloc;
-	/** The function that will translate the external IP header. */
-	header_xlat_fn xlat_outer_l3;
-	/**
-	 * The function that will translate the internal IP header.
-	 * (ICMP errors only.)
-	 */
-	header_xlat_fn xlat_inner_l3;
-	/**
-	 * Translates everything between the external IP header and the L4
-	 * payload.
-	 */
-	header_xlat_fn xlat_tcp;
-	header_xlat_fn xlat_udp;
-	header_xlat_fn xlat_icmp;
-};
+/*
+ * Translation steps.
+ *
+ * Each direction (6to4.c and 4to6.c) implements the following. They're called
+ * directly (dispatched by switch, never through function pointers), because
+ * retpolines make indirect calls expensive in the packet path.
+ *
+ * - alloc_skb: Routes the outgoing packet, allocates it, then copies
+ *   dst_entry and layer 4 payload into it. Ensures there's enough headroom
+ *   (bytes between skb->head and skb->data) for translated headers.
+ *   (In other words, it does everything except for headers.)
+ *
+ *   "Why do we need this? Why don't we simply override the headers of the
+ *   incoming packet? This would avoid lots of allocation and copying."
+ *
+ *   Because we can't afford to completely lose the original headers until
+ *   we've fetched the translated packet successfully. Even after the RFC7915
+ *   code ends, there is still stuff we might need the original packet for,
+ *   such as replying an ICMP error or NF_ACCEPTing.
+ *
+ *   There's also the issue that the incoming packet might not have enough
+ *   room for the header length expansion from v4 to v6.
+ * - *_external: Translates the external IP header.
+ * - *_internal: Translates the internal IP header. (ICMP errors only.)
+ * - tcp, udp, icmp: Translate everything between the external IP header and
+ *   the L4 payload.
+ */
 
 void partialize_skb(struct sk_buff *skb, __u16 csum_offset);
 bool will_need_frag_hdr(const struct iphdr *hdr);
-verdict ttpcomm_translate_inner_packet(struct xlation *state,
-		struct translation_steps const *steps);
+bool ttpcomm_wants_mss_clamp(struct xlation *state);
+void ttpcomm_set_flow_label(struct xlation *state, struct ipv6hdr *hdr6,
+		bool fragment);
+void ttpcomm_select_ipv4_id(struct xlation const *state, struct sk_buff *skb,
+		struct iphdr *hdr4);
+void ttpcomm_clamp_mss(struct xlation *state, unsigned int ipv6_mtu);
+verdict ttpcomm_translate_inner_packet(struct xlation *state);
 
 struct bkp_skb {
 	unsigned int pulled;
@@ -75,8 +70,7 @@ verdict become_inner_packet(struct xlation *state, struct bkp_skb_tuple *bkp,
 void restore_outer_packet(struct xlation *state, struct bkp_skb_tuple *bkp,
 		bool do_out);
 
-verdict xlat_l4_function(struct xlation *state,
-		struct translation_steps const *steps);
+verdict xlat_l4_function(struct xlation *state);
 
 bool must_not_translate(struct in_addr *addr, struct net *ns);
 
@@ -94,8 +88,21 @@ struct icmpext_args {
 	bool force_remove_ie; /* Force removal of ICMP Extension? */
 };
 
+#ifdef JOOL_NO_ICMP_EXTENSIONS
+/*
+ * The extensions are left inside the internal packet (as if the original
+ * router hadn't used RFC 4884), and trimmed along with it.
+ */
+static inline verdict handle_icmp_extension(struct xlation *state,
+		struct icmpext_args *args)
+{
+	args->ipl = 0;
+	return VERDICT_CONTINUE;
+}
+#else
 verdict handle_icmp_extension(struct xlation *state,
 		struct icmpext_args *args);
+#endif
 
 void skb_cleanup_copy(struct sk_buff *skb);
 
@@ -19,6 +19,30 @@ static bool has_l4_hdr(struct xlation *state)
 	return false;
 }
 
+/*
+ * Is @state->in a TCP or UDP packet with no IPv6 extension headers, IPv4
+ * options or fragmentation? These are the vast majority, and they get a
+ * translator that skips everything they can't contain.
+ */
+static bool is_plain(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct iphdr const *hdr4;
+
+	if (in->l4_proto != L4PROTO_TCP && in->l4_proto != L4PROTO_UDP)
+		return false;
+
+	switch (pkt_l3_proto(in)) {
+	case L3PROTO_IPV6:
+		return pkt_l3hdr_len(in) == sizeof(struct ipv6hdr);
+	case L3PROTO_IPV4:
+		hdr4 = pkt_ip4_hdr(in);
+		return hdr4->ihl == 5 && !is_fragmented_ipv4(hdr4);
+	}
+
+	return false;
+}
+
 static bool has_null_page(struct sk_buff *skb)
 {
 	struct skb_shared_info *shinfo;
@@ -54,10 +78,10 @@ static void __kfree_skb_list(struct xlation *state)
 
 verdict translating_the_packet(struct xlation *state)
 {
-	struct translation_steps const *steps;
+	bool is64;
 	verdict result;
 
-	switch (xlator_get_type(&state->jool)) {
+	switch (xlator_get_type(state->jool)) {
 	case XT_NAT64:
 		log_debug(state, "Step 4: Translating the Packet");
 		break;
@@ -68,28 +92,39 @@ verdict translating_the_packet(struct xlation *state)
 
 	switch (pkt_l3_proto(&state->in)) {
 	case L3PROTO_IPV6:
-		steps = &ttp64_steps;
+		is64 = true;
 		break;
 	case L3PROTO_IPV4:
-		steps = &ttp46_steps;
+		is64 = false;
 		break;
 	default:
 		WARN(1, "Unknown l3 proto: %u", pkt_l3_proto(&state->in));
 		return drop(state, JSTAT_UNKNOWN);
 	}
 
-	result = steps->skb_alloc(state);
+	result = is64 ? ttp64_alloc_skb(state) : ttp46_alloc_skb(state);
 	if (result != VERDICT_CONTINUE)
 		return result;
-	result = steps->xlat_outer_l3(state);
+
+	if (is_plain(state)) {
+		result = is64 ? ttp64_plain(state) : ttp46_plain(state);
+		if (result != VERDICT_CONTINUE)
+			goto revert;
+		goto end;
+	}
+
+	result = is64
+			? ttp64_ipv4_external(state)
+			: ttp46_ipv6_external(state);
 	if (result != VERDICT_CONTINUE)
 		goto revert;
 	if (has_l4_hdr(state)) {
-		result = xlat_l4_function(state, steps);
+		result = xlat_l4_function(state);
 		if (result != VERDICT_CONTINUE)
 			goto revert;
 	}
 
+end:
 	if (xlation_is_nat64(state))
 		log_debug(state, "Done step 4.");
 	return VERDICT_CONTINUE;
@@ -0,0 +1,902 @@
+#include "mod/common/rfc7915/inplace.h"
+
+#include <net/ip.h>
+#include <net/ip6_checksum.h>
+
+#include "mod/common/log.h"
+#include "mod/common/pmtu_cache.h"
+#include "mod/common/rfc7915/4to6.h"
+#include "mod/common/rfc7915/6to4.h"
+#include "mod/common/steps/handling_hairpinning.h"
+#include "mod/common/steps/send_packet.h"
+
+/*
+ * The regular path keeps the incoming packet intact until the translated copy
+ * is complete, because it might still need to answer with an ICMP error or
+ * return the packet to the kernel. (See "alloc_skb" in rfc7915/common.h.)
+ *
+ * This one gets around that by limiting itself to packets whose translation
+ * can no longer fail once routing has succeeded. Everything that could
+ * require the original packet is checked before the headers are touched.
+ */
+
+/* GSO flags that survive the translation unchanged. */
+#define GSO_TCP_FLAGS (SKB_GSO_TCP_ECN | SKB_GSO_DODGY)
+/* UDP segmentation doesn't depend on the family, so it survives whole. */
+#define GSO_UDP_FLAGS (SKB_GSO_UDP_L4 | SKB_GSO_DODGY)
+
+/*
+ * Conditions shared by both directions.
+ * @gso_tcp is the TCP GSO type of @in's family.
+ */
+static bool skb_is_eligible(struct packet const *in, unsigned int gso_tcp)
+{
+	struct sk_buff *skb = in->skb;
+	struct skb_shared_info *shinfo;
+
+	/* We're going to write on the packet, so it has to be ours. */
+	if (skb_shared(skb) || skb_cloned(skb) || skb->sk)
+		return false;
+	/* Already fragmented somewhere; wants the regular path's care. */
+	if (skb_has_frag_list(skb))
+		return false;
+
+	if (skb_is_gso(skb)) {
+		/*
+		 * GRO train. It's translated whole; the egress device (or the
+		 * GSO code) will segment it later.
+		 */
+		shinfo = skb_shinfo(skb);
+		switch (pkt_l4_proto(in)) {
+		case L4PROTO_TCP:
+			if (!(shinfo->gso_type & gso_tcp))
+				return false;
+			if (shinfo->gso_type & ~(gso_tcp | GSO_TCP_FLAGS))
+				return false;
+			break;
+		case L4PROTO_UDP:
+			if (!(shinfo->gso_type & SKB_GSO_UDP_L4))
+				return false;
+			if (shinfo->gso_type & ~GSO_UDP_FLAGS)
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	/* Partial checksums are only defined for TCP and UDP here. */
+	return skb->ip_summed != CHECKSUM_PARTIAL
+			|| pkt_l4_proto(in) != L4PROTO_ICMP;
+}
+
+/*
+ * Returns the length the packet's segments will have once translated, or the
+ * length of the packet itself if it's not a GRO train.
+ */
+static unsigned int out_segment_len(struct packet const *in,
+		unsigned int out_l3hdr_len)
+{
+	struct sk_buff *skb = in->skb;
+
+	if (skb_is_gso(skb)) {
+		return out_l3hdr_len + pkt_l4hdr_len(in)
+				+ skb_shinfo(skb)->gso_size;
+	}
+
+	return skb->len - pkt_l3hdr_len(in) + out_l3hdr_len;
+}
+
+/*
+ * NAT64 only bothers with conversations that have settled down. Handshakes and
+ * teardowns are few, and they're better off in the well-trodden path.
+ */
+static bool session_is_eligible(struct xlation *state)
+{
+	struct bib_session const *entries = &state->entries;
+
+	if (xlation_is_siit(state))
+		return true;
+	if (!entries->session_set)
+		return false;
+	return entries->session.proto != L4PROTO_TCP
+			|| entries->session.state == ESTABLISHED;
+}
+
+/*
+ * Only SIIT qualifies. NAT64 normally sees fragments defragmented, and the
+ * ones fragment tracking lets through take the slow path.
+ *
+ * Their layer 4 checksums cover the whole datagram, so only TCP and UDP
+ * qualify. (Their pseudoheader deltas don't depend on the datagram's length.)
+ */
+static bool frag_is_eligible(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+
+	if (!xlation_is_siit(state))
+		return false;
+	if (skb_is_gso(in->skb) || in->skb->ip_summed == CHECKSUM_PARTIAL)
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+	case L4PROTO_UDP:
+		return true;
+	case L4PROTO_ICMP:
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return false;
+}
+
+static bool is_eligible64(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct frag_hdr const *hdr_frag;
+	unsigned int l3hdr_len;
+	__u8 type;
+
+	if (!skb_is_eligible(in, SKB_GSO_TCPV6))
+		return false;
+	if (!session_is_eligible(state))
+		return false;
+
+	hdr_frag = pkt_frag_hdr(in);
+	l3hdr_len = sizeof(struct ipv6hdr);
+	if (hdr_frag) {
+		if (!frag_is_eligible(state))
+			return false;
+		l3hdr_len += sizeof(struct frag_hdr);
+	}
+	/* Extension headers other than the fragment header */
+	if (pkt_l3hdr_len(in) != l3hdr_len)
+		return false;
+	/* Wants an ICMP error */
+	if (pkt_ip6_hdr(in)->hop_limit <= 1)
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		/* This path doesn't touch options; SYNs are few anyway */
+		return !is_first_frag6(hdr_frag)
+				|| !ttpcomm_wants_mss_clamp(state);
+	case L4PROTO_UDP:
+		return true;
+	case L4PROTO_ICMP:
+		type = pkt_icmp6_hdr(in)->icmp6_type;
+		return type == ICMPV6_ECHO_REQUEST || type == ICMPV6_ECHO_REPLY;
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return false;
+}
+
+/*
+ * 4->6 ICMP errors whose translation only changes the headers' lengths by a
+ * known amount. (See inplace46_error().)
+ */
+static bool icmp4_error_is_eligible(struct packet const *in)
+{
+	struct icmphdr const *icmp4 = pkt_icmp4_hdr(in);
+	struct iphdr const *inner4;
+
+	switch (icmp4->type) {
+	case ICMP_DEST_UNREACH:
+	case ICMP_TIME_EXCEEDED:
+		break;
+	default: /* Parameter Problem pointers might not translate */
+		return false;
+	}
+	/* ICMP extensions need to be moved around */
+	if (icmp4_length(icmp4) != 0)
+		return false;
+
+	inner4 = pkt_payload(in);
+	/* Options and fragment headers change the inner header's growth */
+	if (inner4->ihl != 5 || will_need_frag_hdr(inner4))
+		return false;
+
+	switch (inner4->protocol) {
+	case IPPROTO_UDP:
+		/* Zero checksums aren't defined in IPv6 */
+		return ((struct udphdr *)(inner4 + 1))->check != 0;
+	case IPPROTO_ICMP:
+		/* Would need to be retyped */
+		return false;
+	}
+
+	return true;
+}
+
+static bool is_eligible46(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct iphdr const *hdr4;
+	__u8 type;
+
+	if (!skb_is_eligible(in, SKB_GSO_TCPV4))
+		return false;
+	if (!session_is_eligible(state))
+		return false;
+
+	hdr4 = pkt_ip4_hdr(in);
+	/* Options (including source routes) */
+	if (hdr4->ihl != 5)
+		return false;
+	if (is_fragmented_ipv4(hdr4) && !frag_is_eligible(state))
+		return false;
+	/* Wants an ICMP error */
+	if (hdr4->ttl <= 1)
+		return false;
+	/* Trains without DF would need lowest-ipv6-mtu fragmentation */
+	if (skb_is_gso(in->skb) && !is_df_set(hdr4))
+		return false;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		/* SYNs might need clamping; see is_eligible64() */
+		return !is_first_frag4(hdr4)
+				|| !ttpcomm_wants_mss_clamp(state);
+	case L4PROTO_UDP:
+		/* Zero checksums need amending (or an ICMP error) */
+		return !is_first_frag4(hdr4) || pkt_udp_hdr(in)->check != 0;
+	case L4PROTO_ICMP:
+		type = pkt_icmp4_hdr(in)->type;
+		if (type == ICMP_ECHO || type == ICMP_ECHOREPLY)
+			return true;
+		return pkt_is_icmp4_error(in) && icmp4_error_is_eligible(in);
+	case L4PROTO_OTHER:
+		break;
+	}
+
+	return false;
+}
+
+/*
+ * Bytes of the layer 4 header the translation might change: Ports, or ICMP
+ * type, code and identifier. (Plus the checksum itself, when it's in there.)
+ */
+#define L4_XLAT_LEN 8
+
+static __sum16 *l4_csum(struct packet const *in)
+{
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		return &pkt_tcp_hdr(in)->check;
+	case L4PROTO_UDP:
+		return &pkt_udp_hdr(in)->check;
+	default: /* ICMP; both versions keep it in the same place */
+		return &pkt_icmp4_hdr(in)->checksum;
+	}
+}
+
+static void xlat64_l4(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct flowi4 *flow4 = &state->flowx.v4.flowi;
+	struct tcphdr *tcp;
+	struct udphdr *udp;
+	struct icmphdr *icmp4;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		if (xlation_is_nat64(state)) {
+			tcp = pkt_tcp_hdr(in);
+			tcp->source = cpu_to_be16(
+					state->out.tuple.src.addr4.l4);
+			tcp->dest = cpu_to_be16(
+					state->out.tuple.dst.addr4.l4);
+		}
+		break;
+	case L4PROTO_UDP:
+		if (xlation_is_nat64(state)) {
+			udp = pkt_udp_hdr(in);
+			udp->source = cpu_to_be16(
+					state->out.tuple.src.addr4.l4);
+			udp->dest = cpu_to_be16(
+					state->out.tuple.dst.addr4.l4);
+		}
+		break;
+	default: /* ICMP echo; see is_eligible64() */
+		icmp4 = pkt_icmp4_hdr(in);
+		icmp4->type = flow4->fl4_icmp_type;
+		icmp4->code = flow4->fl4_icmp_code;
+		if (xlation_is_nat64(state))
+			icmp4->un.echo.id =
+					cpu_to_be16(state->out.tuple.icmp4_id);
+	}
+}
+
+static void xlat46_l4(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct flowi6 *flow6 = &state->flowx.v6.flowi;
+	struct tcphdr *tcp;
+	struct udphdr *udp;
+	struct icmp6hdr *icmp6;
+
+	switch (pkt_l4_proto(in)) {
+	case L4PROTO_TCP:
+		if (xlation_is_nat64(state)) {
+			tcp = pkt_tcp_hdr(in);
+			tcp->source = cpu_to_be16(
+					state->out.tuple.src.addr6.l4);
+			tcp->dest = cpu_to_be16(
+					state->out.tuple.dst.addr6.l4);
+		}
+		break;
+	case L4PROTO_UDP:
+		if (xlation_is_nat64(state)) {
+			udp = pkt_udp_hdr(in);
+			udp->source = cpu_to_be16(
+					state->out.tuple.src.addr6.l4);
+			udp->dest = cpu_to_be16(
+					state->out.tuple.dst.addr6.l4);
+		}
+		break;
+	default: /* ICMP echo; see is_eligible46() */
+		icmp6 = (struct icmp6hdr *)pkt_icmp4_hdr(in);
+		icmp6->icmp6_type = flow6->fl6_icmp_type;
+		icmp6->icmp6_code = flow6->fl6_icmp_code;
+		if (xlation_is_nat64(state))
+			icmp6->icmp6_identifier =
+					cpu_to_be16(state->out.tuple.icmp6_id);
+	}
+}
+
+/*
+ * Translates @state->in's layer 4 header in place, updating its checksum
+ * incrementally.
+ *
+ * @pseudo_delta is the sum of the pseudoheader the checksum should cover,
+ * minus the one it currently covers. (See pseudohdr_delta64() and
+ * pseudohdr_delta46().)
+ */
+static void xlat_l4(struct xlation *state, void (*xlat)(struct xlation *),
+		__wsum pseudo_delta)
+{
+	struct packet const *in = &state->in;
+	void *hdr = skb_transport_header(in->skb);
+	__sum16 *check = l4_csum(in);
+	__wsum csum;
+
+	csum = ~csum_unfold(*check);
+	*check = 0;
+	csum = csum_sub(csum, csum_partial(hdr, L4_XLAT_LEN, 0));
+
+	xlat(state);
+
+	csum = csum_add(csum, csum_partial(hdr, L4_XLAT_LEN, 0));
+	csum = csum_add(csum, pseudo_delta);
+	*check = csum_fold(csum);
+	if (pkt_l4_proto(in) == L4PROTO_UDP && *check == 0)
+		*check = CSUM_MANGLED_0;
+}
+
+/*
+ * Same as xlat_l4(), for packets whose checksum is going to be finished by the
+ * NIC (or the GSO code). Their checksum fields only carry the pseudoheader.
+ */
+static void xlat_l4_partial(struct xlation *state,
+		void (*xlat)(struct xlation *), __sum16 pseudo)
+{
+	xlat(state);
+	*l4_csum(&state->in) = pseudo;
+}
+
+static __wsum pseudohdr6_csum(struct in6_addr const *saddr,
+		struct in6_addr const *daddr, struct packet const *in)
+{
+	/* Lengths and protocols cancel each other out, except in ICMP. */
+	return (pkt_l4_proto(in) == L4PROTO_ICMP)
+			? ~csum_unfold(csum_ipv6_magic(saddr, daddr,
+					pkt_datagram_len(in), NEXTHDR_ICMP, 0))
+			: ~csum_unfold(csum_ipv6_magic(saddr, daddr, 0, 0, 0));
+}
+
+static __wsum pseudohdr4_csum(__be32 saddr, __be32 daddr,
+		struct packet const *in)
+{
+	/* ICMPv4 does not have a pseudoheader. */
+	return (pkt_l4_proto(in) == L4PROTO_ICMP)
+			? 0
+			: csum_tcpudp_nofold(saddr, daddr, 0, 0, 0);
+}
+
+/*
+ * NAT64 TCP and UDP packets get it from their session, which computed it when
+ * it was created. (See session_entry.csum.) The rest depend on their addresses
+ * (and, in ICMP, length), so they have to compute it themselves.
+ */
+static bool has_session_csum(struct xlation *state)
+{
+	return xlation_is_nat64(state)
+			&& pkt_l4_proto(&state->in) != L4PROTO_ICMP;
+}
+
+static __wsum pseudohdr_delta64(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct ipv6hdr const *hdr6;
+	struct flowi4 const *flow4;
+
+	if (has_session_csum(state))
+		return state->entries.session.csum;
+
+	hdr6 = pkt_ip6_hdr(in);
+	flow4 = &state->flowx.v4.flowi;
+	return csum_sub(pseudohdr4_csum(flow4->saddr, flow4->daddr, in),
+			pseudohdr6_csum(&hdr6->saddr, &hdr6->daddr, in));
+}
+
+static __wsum pseudohdr_delta46(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct iphdr const *hdr4;
+	struct flowi6 const *flow6;
+
+	/* The session's delta goes the other way */
+	if (has_session_csum(state))
+		return csum_sub(0, state->entries.session.csum);
+
+	hdr4 = pkt_ip4_hdr(in);
+	flow6 = &state->flowx.v6.flowi;
+	return csum_sub(pseudohdr6_csum(&flow6->saddr, &flow6->daddr, in),
+			pseudohdr4_csum(hdr4->saddr, hdr4->daddr, in));
+}
+
+/*
+ * Packet is ready; hand it over to the IP layer.
+ * @skb's new network header (and @hdr_frag, if any) has already been written.
+ */
+static verdict send_inplace(struct xlation *state, struct sk_buff *skb,
+		l3_protocol l3_proto, __be16 protocol,
+		struct frag_hdr *hdr_frag)
+{
+	struct packet const *in = &state->in;
+
+	skb_reset_mac_header(skb);
+	skb_cleanup_copy(skb);
+	memset(skb->cb, 0, sizeof(skb->cb));
+	skb->protocol = protocol;
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		partialize_skb(skb, (unsigned char *)l4_csum(in)
+				- skb_transport_header(skb));
+	} else {
+		/* The incoming checksum state no longer describes the data. */
+		skb->ip_summed = CHECKSUM_NONE;
+	}
+
+	skb_dst_drop(skb);
+	skb_dst_set(skb, state->dst);
+	state->dst = NULL;
+
+	pkt_fill(&state->out, skb, l3_proto, pkt_l4_proto(in), hdr_frag,
+			skb_transport_header(skb) + pkt_l4hdr_len(in),
+			pkt_original_pkt(in));
+
+	/*
+	 * The incoming packet is the outgoing packet, and sendpkt_send()
+	 * consumes it regardless of verdict. There's nothing left to return
+	 * to the kernel, so we have to steal it even on failure.
+	 * (In that case, sendpkt_send() already counted the drop.)
+	 */
+	if (sendpkt_send(state) != VERDICT_CONTINUE)
+		return VERDICT_STOLEN;
+
+	log_debug(state, "Success (in place).");
+	return stolen(state, JSTAT_SUCCESS);
+}
+
+static verdict inplace64(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct sk_buff *skb = in->skb;
+	struct flowi4 *flow4 = &state->flowx.v4.flowi;
+	struct ipv6hdr *hdr6;
+	struct frag_hdr *hdr_frag;
+	struct iphdr *hdr4;
+	unsigned int seg_len;
+	__be16 frag_off;
+	__be16 id;
+	__u8 hop_limit;
+	verdict result;
+
+	result = predict_route64(state);
+	if (result != VERDICT_CONTINUE)
+		return result;
+	if (!state->dst || is_hairpin(state))
+		return VERDICT_CONTINUE;
+	/* Wants a Fragmentation Needed */
+	seg_len = out_segment_len(in, sizeof(struct iphdr));
+	if (seg_len > dst_mtu(state->dst))
+		return VERDICT_CONTINUE;
+
+	/* Point of no return; start trashing the incoming packet. */
+
+	hdr6 = pkt_ip6_hdr(in);
+	hdr_frag = pkt_frag_hdr(in);
+	hop_limit = hdr6->hop_limit;
+	/* Same as generate_ipv4_id() and xlat_frag_off() */
+	if (hdr_frag) {
+		id = cpu_to_be16(be32_to_cpu(hdr_frag->identification));
+		frag_off = build_ipv4_frag_off_field(0,
+				is_mf_set_ipv6(hdr_frag),
+				get_fragment_offset_ipv6(hdr_frag));
+	} else {
+		id = 0;
+		frag_off = build_ipv4_frag_off_field(seg_len > 1260, 0, 0);
+	}
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		xlat_l4_partial(state, xlat64_l4, ~csum_tcpudp_magic(
+				flow4->saddr, flow4->daddr,
+				pkt_datagram_len(in), flow4->flowi4_proto, 0));
+	} else if (is_first_frag6(hdr_frag)) {
+		xlat_l4(state, xlat64_l4, pseudohdr_delta64(state));
+	} /* else no layer 4 header */
+
+	/*
+	 * The IPv4 header overlaps the tail of the IPv6 header (or the
+	 * fragment header).
+	 */
+	__skb_pull(skb, pkt_l3hdr_len(in) - sizeof(struct iphdr));
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(struct iphdr));
+
+	hdr4 = ip_hdr(skb);
+	hdr4->version = 4;
+	hdr4->ihl = 5;
+	hdr4->tos = flow4->flowi4_tos;
+	hdr4->tot_len = cpu_to_be16(skb->len);
+	hdr4->frag_off = frag_off;
+	hdr4->ttl = hop_limit - 1;
+	hdr4->protocol = flow4->flowi4_proto;
+	hdr4->saddr = flow4->saddr;
+	hdr4->daddr = flow4->daddr;
+	if (hdr_frag)
+		hdr4->id = id;
+	else
+		ttpcomm_select_ipv4_id(state, skb, hdr4);
+	hdr4->check = 0;
+	hdr4->check = ip_fast_csum(hdr4, hdr4->ihl);
+
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_TCPV6) {
+		skb_shinfo(skb)->gso_type &= ~SKB_GSO_TCPV6;
+		skb_shinfo(skb)->gso_type |= SKB_GSO_TCPV4;
+	}
+
+	return send_inplace(state, skb, L3PROTO_IPV4, htons(ETH_P_IP), NULL);
+}
+
+static void write_hdr6(struct xlation *state, struct ipv6hdr *hdr6,
+		__u8 tos, __u8 hop_limit, unsigned int payload_len,
+		__u8 nexthdr, struct in6_addr const *saddr,
+		struct in6_addr const *daddr)
+{
+	hdr6->version = 6;
+	if (state->jool->fast.reset_traffic_class) {
+		hdr6->priority = 0;
+		hdr6->flow_lbl[0] = 0;
+	} else {
+		hdr6->priority = tos >> 4;
+		hdr6->flow_lbl[0] = tos << 4;
+	}
+	hdr6->flow_lbl[1] = 0;
+	hdr6->flow_lbl[2] = 0;
+	hdr6->payload_len = cpu_to_be16(payload_len);
+	hdr6->nexthdr = nexthdr;
+	hdr6->hop_limit = hop_limit;
+	hdr6->saddr = *saddr;
+	hdr6->daddr = *daddr;
+}
+
+static verdict inplace46(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct sk_buff *skb = in->skb;
+	struct flowi6 *flow6 = &state->flowx.v6.flowi;
+	struct xlator_fast const *cfg = &state->jool->fast;
+	struct iphdr *hdr4;
+	struct ipv6hdr *hdr6;
+	struct frag_hdr *hdr_frag;
+	unsigned int l3hdr_len;
+	unsigned int mpl;
+	__be16 frag_off;
+	__be16 id;
+	__u8 tos;
+	__u8 ttl;
+	bool df;
+	verdict result;
+
+	result = predict_route46(state);
+	if (result != VERDICT_CONTINUE)
+		return result;
+	if (!state->dst || is_hairpin(state))
+		return VERDICT_CONTINUE;
+
+	hdr4 = pkt_ip4_hdr(in);
+	l3hdr_len = sizeof(struct ipv6hdr);
+	if (will_need_frag_hdr(hdr4))
+		l3hdr_len += sizeof(struct frag_hdr);
+
+	/* Not enough room for the bigger header; let the copy reallocate */
+	if (skb_headroom(skb) < l3hdr_len - sizeof(struct iphdr)
+			+ LL_RESERVED_SPACE(state->dst->dev))
+		return VERDICT_CONTINUE;
+	/* Wants a Fragmentation Needed, lowest-ipv6-mtu or a bad MTU drop */
+	mpl = min(pmtu_cache_limit(state->jool, &flow6->daddr,
+			dst_mtu(state->dst)), cfg->lowest_ipv6_mtu);
+	if (mpl < 1280 || out_segment_len(in, l3hdr_len) > mpl)
+		return VERDICT_CONTINUE;
+
+	/* Point of no return; start trashing the incoming packet. */
+
+	tos = hdr4->tos;
+	ttl = hdr4->ttl;
+	df = is_df_set(hdr4);
+	/* Same as ttcp46_ipv6_common() */
+	frag_off = build_ipv6_frag_off_field(get_fragment_offset_ipv4(hdr4),
+			is_mf_set_ipv4(hdr4));
+	id = hdr4->id;
+
+	if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		xlat_l4_partial(state, xlat46_l4, ~csum_ipv6_magic(
+				&flow6->saddr, &flow6->daddr,
+				pkt_datagram_len(in), flow6->flowi6_proto, 0));
+	} else if (is_first_frag4(hdr4)) {
+		xlat_l4(state, xlat46_l4, pseudohdr_delta46(state));
+	} /* else no layer 4 header */
+
+	/*
+	 * The IPv4 header becomes the tail of the IPv6 header (or the fragment
+	 * header).
+	 */
+	__skb_push(skb, l3hdr_len - sizeof(struct iphdr));
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, l3hdr_len);
+
+	hdr6 = ipv6_hdr(skb);
+	write_hdr6(state, hdr6, tos, ttl - 1,
+			skb->len - sizeof(struct ipv6hdr),
+			(l3hdr_len != sizeof(struct ipv6hdr))
+					? NEXTHDR_FRAGMENT
+					: flow6->flowi6_proto,
+			&flow6->saddr, &flow6->daddr);
+	ttpcomm_set_flow_label(state, hdr6,
+			l3hdr_len != sizeof(struct ipv6hdr));
+
+	if (l3hdr_len != sizeof(struct ipv6hdr)) {
+		hdr_frag = (struct frag_hdr *)(hdr6 + 1);
+		hdr_frag->nexthdr = flow6->flowi6_proto;
+		hdr_frag->reserved = 0;
+		hdr_frag->frag_off = frag_off;
+		hdr_frag->identification = cpu_to_be32(be16_to_cpu(id));
+	} else {
+		hdr_frag = NULL;
+	}
+
+	/* Same as allocate_fast() */
+	if (!df)
+		skb->ignore_df = false;
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_TCPV4) {
+		skb_shinfo(skb)->gso_type &= ~SKB_GSO_TCPV4;
+		skb_shinfo(skb)->gso_type |= SKB_GSO_TCPV6;
+	}
+
+	return send_inplace(state, skb, L3PROTO_IPV6, htons(ETH_P_IPV6),
+			hdr_frag);
+}
+
+/*
+ * Both the outer and the inner IPv4 headers become IPv6 headers.
+ * (icmp4_error_is_eligible() ruled out options and fragment headers.)
+ */
+#define ERROR_GROWTH (2 * (sizeof(struct ipv6hdr) - sizeof(struct iphdr)))
+
+/*
+ * Bytes of the inner packet's layer 4 header the translation might change:
+ * Ports and checksum.
+ */
+static unsigned int inner_l4_xlat_len(__u8 protocol)
+{
+	switch (protocol) {
+	case IPPROTO_TCP:
+		return offsetofend(struct tcphdr, check);
+	case IPPROTO_UDP:
+		return sizeof(struct udphdr);
+	}
+
+	return 0;
+}
+
+/*
+ * Translates the inner packet's layer 4 header (@l4), the same way
+ * ttp46_tcp() and ttp46_udp() do.
+ */
+static void xlat46_inner_l4(struct xlation *state, struct iphdr const *inner4,
+		void *l4)
+{
+	__be16 *ports = l4;
+	__sum16 *check;
+	__wsum csum;
+
+	switch (inner4->protocol) {
+	case IPPROTO_TCP:
+		check = &((struct tcphdr *)l4)->check;
+		break;
+	case IPPROTO_UDP:
+		check = &((struct udphdr *)l4)->check;
+		break;
+	default:
+		return;
+	}
+
+	csum = ~csum_unfold(*check);
+	csum = csum_sub(csum, csum_tcpudp_nofold(inner4->saddr, inner4->daddr,
+			0, 0, 0));
+	csum = csum_add(csum, ~csum_unfold(csum_ipv6_magic(
+			&state->flowx.v6.inner_src, &state->flowx.v6.inner_dst,
+			0, 0, 0)));
+
+	if (xlation_is_nat64(state)) {
+		/* The inner packet goes the other way; both ports */
+		csum = csum_sub(csum, csum_partial(ports, 4, 0));
+		ports[0] = cpu_to_be16(state->out.tuple.dst.addr6.l4);
+		ports[1] = cpu_to_be16(state->out.tuple.src.addr6.l4);
+		csum = csum_add(csum, csum_partial(ports, 4, 0));
+	}
+
+	*check = csum_fold(csum);
+}
+
+/* The second word of the ICMPv6 header. Same as ttp46_icmp(). */
+static __be32 xlat46_icmp_rest(struct xlation *state)
+{
+	struct icmphdr const *icmp4 = pkt_icmp4_hdr(&state->in);
+
+	if (icmp4->type != ICMP_DEST_UNREACH)
+		return 0; /* Time Exceeded */
+
+	switch (icmp4->code) {
+	case ICMP_PROT_UNREACH:
+		return cpu_to_be32(offsetof(struct ipv6hdr, nexthdr));
+	case ICMP_FRAG_NEEDED:
+		return ttp46_ptb_mtu(state, state->dst);
+	}
+
+	return 0;
+}
+
+/*
+ * Same as inplace46(), for ICMP errors.
+ *
+ * The regular path translates the inner packet separately, then truncates the
+ * result and computes its checksum over the whole message. This one grows the
+ * headers in front of the inner packet's layer 4 header, trims the tail to the
+ * final length (known in advance), and updates the checksum with the bytes
+ * that changed.
+ *
+ * The ICMP checksum is not validated; the incremental update carries any
+ * corruption over to the ICMPv6 checksum, which will fail just the same.
+ */
+static verdict inplace46_error(struct xlation *state)
+{
+	struct packet const *in = &state->in;
+	struct sk_buff *skb = in->skb;
+	struct flowi6 *flow6 = &state->flowx.v6.flowi;
+	struct xlator_fast const *cfg = &state->jool->fast;
+	struct icmphdr *icmp4;
+	struct icmp6hdr *icmp6;
+	struct iphdr hdr4;
+	struct iphdr inner4;
+	void *inner_l4;
+	unsigned int xlat_len;
+	unsigned int new_len;
+	unsigned int mpl;
+	__be32 rest;
+	__wsum csum;
+	int error;
+	verdict result;
+
+	result = predict_route46(state);
+	if (result != VERDICT_CONTINUE)
+		return result;
+	if (!state->dst || is_hairpin(state))
+		return VERDICT_CONTINUE;
+
+	if (skb_headroom(skb) < ERROR_GROWTH
+			+ LL_RESERVED_SPACE(state->dst->dev))
+		return VERDICT_CONTINUE;
+	/* ICMPv6 errors never exceed the minimum MTU, so they always fit */
+	mpl = min(pmtu_cache_limit(state->jool, &flow6->daddr,
+			dst_mtu(state->dst)), cfg->lowest_ipv6_mtu);
+	if (mpl < IPV6_MIN_MTU)
+		return VERDICT_CONTINUE;
+
+	rest = xlat46_icmp_rest(state);
+
+	/* Point of no return; start trashing the incoming packet. */
+
+	/* The new headers are going to overlap the old ones */
+	memcpy(&hdr4, pkt_ip4_hdr(in), sizeof(hdr4));
+	memcpy(&inner4, pkt_payload(in), sizeof(inner4));
+
+	/* Remove the bytes that are going to change from the checksum */
+	icmp4 = pkt_icmp4_hdr(in);
+	xlat_len = sizeof(struct icmphdr) + sizeof(struct iphdr)
+			+ inner_l4_xlat_len(inner4.protocol);
+	csum = ~csum_unfold(icmp4->checksum);
+	icmp4->checksum = 0;
+	csum = csum_sub(csum, csum_partial(icmp4, xlat_len, 0));
+
+	/* Same as trim_1280(); also remove the bytes that won't make it */
+	new_len = min_t(unsigned int, skb->len + ERROR_GROWTH, IPV6_MIN_MTU);
+	if (skb->len + ERROR_GROWTH > new_len) {
+		/* The headers grow by an even amount, so parity holds */
+		csum = csum_block_sub(csum, skb_checksum(skb,
+				new_len - ERROR_GROWTH,
+				skb->len + ERROR_GROWTH - new_len, 0),
+				new_len - ERROR_GROWTH - pkt_l3hdr_len(in));
+		error = pskb_trim(skb, new_len - ERROR_GROWTH);
+		if (error) {
+			log_debug(state, "pskb_trim() error: %d", error);
+			return drop(state, JSTAT_ENOMEM);
+		}
+	}
+
+	inner_l4 = pkt_payload(in) + sizeof(struct iphdr);
+	xlat46_inner_l4(state, &inner4, inner_l4);
+
+	__skb_push(skb, ERROR_GROWTH);
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, sizeof(struct ipv6hdr));
+
+	write_hdr6(state, ipv6_hdr(skb), hdr4.tos, hdr4.ttl - 1,
+			skb->len - sizeof(struct ipv6hdr), NEXTHDR_ICMP,
+			&flow6->saddr, &flow6->daddr);
+	ttpcomm_set_flow_label(state, ipv6_hdr(skb), false);
+
+	icmp6 = icmp6_hdr(skb);
+	icmp6->icmp6_type = flow6->fl6_icmp_type;
+	icmp6->icmp6_code = flow6->fl6_icmp_code;
+	icmp6->icmp6_cksum = 0;
+	icmp6->icmp6_dataun.un_data32[0] = rest;
+
+	/* Same as ttp46_ipv6_internal() */
+	write_hdr6(state, (struct ipv6hdr *)(icmp6 + 1), inner4.tos,
+			inner4.ttl,
+			be16_to_cpu(inner4.tot_len) - sizeof(struct iphdr),
+			inner4.protocol,
+			&state->flowx.v6.inner_src, &state->flowx.v6.inner_dst);
+
+	/* Add the translated bytes */
+	csum = csum_add(csum, csum_partial(icmp6, xlat_len
+			+ sizeof(struct ipv6hdr) - sizeof(struct iphdr), 0));
+	icmp6->icmp6_cksum = csum_ipv6_magic(&flow6->saddr, &flow6->daddr,
+			skb->len - sizeof(struct ipv6hdr), IPPROTO_ICMPV6,
+			csum);
+
+	return send_inplace(state, skb, L3PROTO_IPV6, htons(ETH_P_IPV6), NULL);
+}
+
+verdict translate_inplace(struct xlation *state)
+{
+	switch (pkt_l3_proto(&state->in)) {
+	case L3PROTO_IPV6:
+		return is_eligible64(state)
+				? inplace64(state)
+				: VERDICT_CONTINUE;
+	case L3PROTO_IPV4:
+		if (!is_eligible46(state))
+			return VERDICT_CONTINUE;
+		return pkt_is_icmp4_error(&state->in)
+				? inplace46_error(state)
+				: inplace46(state);
+	}
+
+	return VERDICT_CONTINUE;
+}
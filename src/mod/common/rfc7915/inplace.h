@@ -0,0 +1,41 @@
+#ifndef SRC_MOD_COMMON_RFC7915_INPLACE_H_
+#define SRC_MOD_COMMON_RFC7915_INPLACE_H_
+
+/**
+ * @file
+ * Shortcut for the common case: Translates outer-only TCP, UDP and ICMP echo
+ * packets by rewriting the incoming skb's headers, instead of building a
+ * translated copy through translating_the_packet().
+ *
+ * In SIIT, this applies to any such packet. In NAT64, only to packets whose
+ * session has already been established; filtering_and_updating() has done the
+ * lookup and refreshed the session (usually without locking, see
+ * refresh_session6()), so all that's left is the header rewrite.
+ *
+ * TCP and UDP GRO trains are also handled, as a single packet; segmentation is
+ * left to the egress device.
+ *
+ * TCP and UDP fragments are also handled in SIIT; the fragment header is added
+ * or removed in place.
+ *
+ * So are the common 4->6 ICMP errors (Destination Unreachable and Time
+ * Exceeded, about non-ICMP packets without IPv4 options); both headers grow in
+ * place, and the checksum is updated incrementally.
+ *
+ * Anything it doesn't recognize (other ICMP errors, ICMP fragments, options,
+ * IPv6 extension headers, frag_lists, hairpinning, MTU trouble, etc.) is left
+ * untouched, for the regular translation path to handle.
+ */
+
+#include "mod/common/translation_state.h"
+
+/**
+ * Returns VERDICT_CONTINUE if @state's packet needs to go through the regular
+ * path. (Any routing results are cached in @state, for it to reuse.)
+ *
+ * Any other verdict means the packet was handled; if it was VERDICT_STOLEN,
+ * the incoming packet was sent (and is gone).
+ */
+verdict translate_inplace(struct xlation *state);
+
+#endif /* SRC_MOD_COMMON_RFC7915_INPLACE_H_ */
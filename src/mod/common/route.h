@@ -2,10 +2,26 @@
 #define SRC_MOD_COMMON_ROUTE_H_
 
 #include <linux/bug.h> /* Needed by flow.h in some old kernels (~4.9) */
+#include <linux/netdevice.h>
 #include <net/flow.h>
 #include "mod/common/xlator.h"
 
-/* Wrappers for the kernel's routing functions. */
+struct route_cache *route_cache_alloc(void);
+void route_cache_get(struct route_cache *cache);
+void route_cache_put(struct route_cache *cache);
+
+/*
+ * Resolves @jool's static next hops (next-hop6, next-hop4) again, unless they
+ * are still current. @gone is a device that's being unregistered, or NULL.
+ * Requires the xlator mutex.
+ */
+void route_next_hops_sync(struct xlator *jool, struct net_device *gone);
+
+/*
+ * Wrappers for the kernel's routing functions.
+ * They reuse @jool's cached routes when possible, and skip the lookup
+ * altogether when @jool has a static next hop.
+ */
 struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow);
 struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow);
 
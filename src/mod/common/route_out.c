@@ -1,10 +1,387 @@
 #include "mod/common/route.h"
 
+#include <linux/jhash.h>
+#include <net/addrconf.h>
+#include <net/ip6_fib.h>
 #include <net/ip6_route.h>
 #include <net/route.h>
+#include "mod/common/linux_version.h"
 #include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 
-struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow)
+/*
+ * Per-CPU route cache.
+ *
+ * The routing table lookup is one of the most expensive per-packet steps, and
+ * its result rarely changes between consecutive packets of a flow. So each
+ * instance remembers, per CPU, the last few dst_entries it obtained, indexed
+ * by the (whole) flow that was used to request them.
+ *
+ * Since Jool zeroes its flows before filling them (see compute_flowix64() and
+ * compute_flowix46()), the flows can be compared byte by byte. This also
+ * covers the ports; fib rules are allowed to look at them.
+ *
+ * Cached entries are validated through dst_check(), the same way sockets
+ * validate theirs: IPv4 routes become obsolete whenever the FIB changes, and
+ * IPv6 routes are validated against their fib6 serial number (the "cookie").
+ *
+ * The cache holds a reference to each of its dsts. Current kernels detach
+ * dsts from their devices when the latter go away (dst_dev_put()), so this
+ * does not prevent interfaces from being removed. The references are
+ * released when the slot is reused, or when the instance dies.
+ *
+ * Instances with a static next hop (next-hop6, next-hop4) skip all of this.
+ * Their dsts are built once, by hand (they don't come from the FIB), and
+ * attached to every packet. Since the kernel doesn't know about them, it can't
+ * detach them from their devices either, so the xlator's netdevice notifier
+ * rebuilds them (see route_next_hops_sync()) whenever devices come, go, or
+ * change names. They don't need dst_check(); FIB changes are irrelevant to
+ * them by definition.
+ */
+
+#define ROUTE_CACHE_BITS 4
+#define ROUTE_CACHE_SIZE (1 << ROUTE_CACHE_BITS)
+
+struct route4_slot {
+	/* The flow as requested; the key. */
+	struct flowi4 key;
+	/* The flow as left by the routing code. */
+	struct flowi4 flow;
+	struct dst_entry *dst;
+};
+
+struct route6_slot {
+	struct flowi6 key;
+	struct flowi6 flow;
+	struct dst_entry *dst;
+	u32 cookie;
+};
+
+struct route_slots {
+	struct route4_slot v4[ROUTE_CACHE_SIZE];
+	struct route6_slot v6[ROUTE_CACHE_SIZE];
+};
+
+struct route_cache {
+	struct route_slots __percpu *slots;
+
+	/* The static next hops. NULL if unset, or their devices are missing. */
+	struct dst_entry __rcu *next_hop6;
+	struct dst_entry __rcu *next_hop4;
+	/* What they were built from. Protected by the xlator mutex. */
+	struct config_next_hop6 next_hop6_cfg;
+	struct config_next_hop4 next_hop4_cfg;
+
+	struct kref refs;
+};
+
+struct route_cache *route_cache_alloc(void)
+{
+	struct route_cache *result;
+
+	result = wkmalloc(struct route_cache, GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	/* alloc_percpu() zeroes. */
+	result->slots = alloc_percpu(struct route_slots);
+	if (!result->slots) {
+		wkfree(struct route_cache, result);
+		return NULL;
+	}
+	RCU_INIT_POINTER(result->next_hop6, NULL);
+	RCU_INIT_POINTER(result->next_hop4, NULL);
+	result->next_hop6_cfg.set = false;
+	result->next_hop4_cfg.set = false;
+	kref_init(&result->refs);
+
+	return result;
+}
+
+void route_cache_get(struct route_cache *cache)
+{
+	kref_get(&cache->refs);
+}
+
+/*
+ * By the time the last reference dies, the instance is unreachable from the
+ * packet path (see __flush_delete()), so nobody else can be touching the slots.
+ */
+static void route_cache_release(struct kref *refs)
+{
+	struct route_cache *cache;
+	struct route_slots *slots;
+	struct dst_entry *dst;
+	unsigned int cpu;
+	unsigned int i;
+
+	cache = container_of(refs, struct route_cache, refs);
+
+	dst = rcu_dereference_protected(cache->next_hop6, true);
+	if (dst)
+		dst_release(dst);
+	dst = rcu_dereference_protected(cache->next_hop4, true);
+	if (dst)
+		dst_release(dst);
+
+	for_each_possible_cpu(cpu) {
+		slots = per_cpu_ptr(cache->slots, cpu);
+		for (i = 0; i < ROUTE_CACHE_SIZE; i++) {
+			if (slots->v4[i].dst)
+				dst_release(slots->v4[i].dst);
+			if (slots->v6[i].dst)
+				dst_release(slots->v6[i].dst);
+		}
+	}
+
+	free_percpu(cache->slots);
+	wkfree(struct route_cache, cache);
+}
+
+void route_cache_put(struct route_cache *cache)
+{
+	kref_put(&cache->refs, route_cache_release);
+}
+
+static unsigned int flow_slot(void const *flow, size_t size)
+{
+	return jhash(flow, size, 0) & (ROUTE_CACHE_SIZE - 1);
+}
+
+/*
+ * Returns a reference to @slot's dst if it was routed from @flow and it's still
+ * valid. Also restores the routing code's changes to @flow, in that case.
+ *
+ * These need to run with BHs disabled, because the slots are per-CPU and also
+ * used by the packet path.
+ */
+static struct dst_entry *cache_get4(struct route4_slot *slot,
+		struct flowi4 *flow)
+{
+	if (!slot->dst || memcmp(&slot->key, flow, sizeof(*flow)) != 0)
+		return NULL;
+
+	if (!dst_check(slot->dst, 0)) {
+		dst_release(slot->dst);
+		slot->dst = NULL;
+		return NULL;
+	}
+
+	*flow = slot->flow;
+	dst_hold(slot->dst);
+	return slot->dst;
+}
+
+static void cache_set4(struct route4_slot *slot, struct flowi4 const *key,
+		struct flowi4 const *flow, struct dst_entry *dst)
+{
+	if (slot->dst)
+		dst_release(slot->dst);
+
+	slot->key = *key;
+	slot->flow = *flow;
+	dst_hold(dst);
+	slot->dst = dst;
+}
+
+static struct dst_entry *cache_get6(struct route6_slot *slot,
+		struct flowi6 *flow)
+{
+	if (!slot->dst || memcmp(&slot->key, flow, sizeof(*flow)) != 0)
+		return NULL;
+
+	if (!dst_check(slot->dst, slot->cookie)) {
+		dst_release(slot->dst);
+		slot->dst = NULL;
+		return NULL;
+	}
+
+	*flow = slot->flow;
+	dst_hold(slot->dst);
+	return slot->dst;
+}
+
+static void cache_set6(struct route6_slot *slot, struct flowi6 const *key,
+		struct flowi6 const *flow, struct dst_entry *dst)
+{
+	if (slot->dst)
+		dst_release(slot->dst);
+
+	slot->key = *key;
+	slot->flow = *flow;
+	dst_hold(dst);
+	slot->dst = dst;
+	slot->cookie = rt6_get_cookie((struct rt6_info *)dst);
+}
+
+static struct dst_entry *next_hop6_alloc(struct net_device *dev,
+		struct in6_addr const *gateway)
+{
+	struct rt6_info *rt;
+
+	rt = ip6_dst_alloc(dev_net(dev), dev, 0);
+	if (!rt)
+		return NULL;
+
+	rt->rt6i_idev = in6_dev_get(dev);
+	if (!rt->rt6i_idev) {
+		dst_release(&rt->dst);
+		return NULL;
+	}
+
+	rt->dst.output = ip6_output;
+	rt->rt6i_gateway = *gateway;
+	rt->rt6i_flags = RTF_GATEWAY;
+	return &rt->dst;
+}
+
+static struct dst_entry *next_hop4_alloc(struct net_device *dev,
+		struct in_addr const *gateway)
+{
+	struct rtable *rt;
+
+#if LINUX_VERSION_AT_LEAST(5, 19, 0, 9999, 0)
+	rt = rt_dst_alloc(dev, 0, RTN_UNICAST, false);
+#elif LINUX_VERSION_AT_LEAST(5, 10, 0, 9, 0)
+	rt = rt_dst_alloc(dev, 0, RTN_UNICAST, false, false);
+#else
+	rt = rt_dst_alloc(dev, 0, RTN_UNICAST, false, false, false);
+#endif
+	if (!rt)
+		return NULL;
+
+#if LINUX_VERSION_AT_LEAST(5, 2, 0, 9, 0)
+	rt->rt_gw_family = AF_INET;
+	rt->rt_gw4 = gateway->s_addr;
+#else
+	rt->rt_gateway = gateway->s_addr;
+#endif
+	rt->rt_uses_gateway = 1;
+	return &rt->dst;
+}
+
+/* Is @slot's dst still attached to the @dev_name device? */
+static bool next_hop_current(struct dst_entry __rcu **slot,
+		char const *dev_name, struct net_device *gone)
+{
+	struct dst_entry *dst;
+
+	dst = rcu_dereference_protected(*slot, true);
+	return dst && dst->dev != gone && strncmp(dst->dev->name, dev_name,
+			IFNAME_MAX_SIZE) == 0;
+}
+
+static void next_hop_replace(struct dst_entry __rcu **slot,
+		struct dst_entry *dst)
+{
+	struct dst_entry *old;
+
+	old = rcu_dereference_protected(*slot, true);
+	rcu_assign_pointer(*slot, dst);
+	/* The packet path only takes references through dst_hold_safe(). */
+	if (old)
+		dst_release(old);
+}
+
+/* Returns a held reference to @dev_name, unless it's missing or @gone. */
+static struct net_device *next_hop_dev(struct xlator *jool,
+		char const *dev_name, struct net_device *gone)
+{
+	struct net_device *dev;
+
+	dev = dev_get_by_name(jool->ns, dev_name);
+	if (dev && dev == gone) {
+		dev_put(dev);
+		return NULL;
+	}
+
+	return dev;
+}
+
+static void next_hop6_sync(struct xlator *jool, struct net_device *gone)
+{
+	struct route_cache *cache = jool->routes;
+	struct config_next_hop6 *hop = &jool->globals.next_hop6;
+	struct config_next_hop6 *old = &cache->next_hop6_cfg;
+	struct net_device *dev;
+	struct dst_entry *dst = NULL;
+
+	if (!hop->set && !old->set)
+		return;
+	if (hop->set && old->set
+			&& ipv6_addr_equal(&hop->gateway, &old->gateway)
+			&& next_hop_current(&cache->next_hop6, hop->dev, gone))
+		return;
+
+	*old = *hop;
+	if (hop->set) {
+		dev = next_hop_dev(jool, hop->dev, gone);
+		if (dev) {
+			dst = next_hop6_alloc(dev, &hop->gateway);
+			if (!dst)
+				log_warn("Cannot build the next-hop6 route; the IPv6 packets will not be routable.");
+			dev_put(dev);
+		}
+	}
+
+	next_hop_replace(&cache->next_hop6, dst);
+}
+
+static void next_hop4_sync(struct xlator *jool, struct net_device *gone)
+{
+	struct route_cache *cache = jool->routes;
+	struct config_next_hop4 *hop = &jool->globals.next_hop4;
+	struct config_next_hop4 *old = &cache->next_hop4_cfg;
+	struct net_device *dev;
+	struct dst_entry *dst = NULL;
+
+	if (!hop->set && !old->set)
+		return;
+	if (hop->set && old->set
+			&& hop->gateway.s_addr == old->gateway.s_addr
+			&& next_hop_current(&cache->next_hop4, hop->dev, gone))
+		return;
+
+	*old = *hop;
+	if (hop->set) {
+		dev = next_hop_dev(jool, hop->dev, gone);
+		if (dev) {
+			dst = next_hop4_alloc(dev, &hop->gateway);
+			if (!dst)
+				log_warn("Cannot build the next-hop4 route; the IPv4 packets will not be routable.");
+			dev_put(dev);
+		}
+	}
+
+	next_hop_replace(&cache->next_hop4, dst);
+}
+
+void route_next_hops_sync(struct xlator *jool, struct net_device *gone)
+{
+	next_hop6_sync(jool, gone);
+	next_hop4_sync(jool, gone);
+}
+
+static struct dst_entry *next_hop_get(struct xlator *jool,
+		struct dst_entry __rcu **slot)
+{
+	struct dst_entry *dst;
+
+	rcu_read_lock();
+	dst = rcu_dereference(*slot);
+	if (dst && !dst_hold_safe(dst))
+		dst = NULL; /* Being replaced */
+	rcu_read_unlock();
+
+	if (dst)
+		__log_debug(jool, "Packet routed via device '%s' (static).",
+				dst->dev->name);
+	else
+		__log_debug(jool, "The static next hop's device is missing. Cannot route packet.");
+	return dst;
+}
+
+static struct dst_entry *__route4(struct xlator *jool, struct flowi4 *flow)
 {
 	struct rtable *table;
 	struct dst_entry *dst;
@@ -40,7 +417,7 @@ revert:
 	return NULL;
 }
 
-struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow)
+static struct dst_entry *__route6(struct xlator *jool, struct flowi6 *flow)
 {
 	struct dst_entry *dst;
 
@@ -59,3 +436,65 @@ struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow)
 	__log_debug(jool, "Packet routed via device '%s'.", dst->dev->name);
 	return dst;
 }
+
+struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow)
+{
+	struct route4_slot *slot;
+	struct flowi4 key;
+	struct dst_entry *dst;
+
+	if (jool->globals.next_hop4.set)
+		return next_hop_get(jool, &jool->routes->next_hop4);
+
+	local_bh_disable();
+
+	slot = &this_cpu_ptr(jool->routes->slots)->v4[
+			flow_slot(flow, sizeof(*flow))];
+	dst = cache_get4(slot, flow);
+	if (dst) {
+		__log_debug(jool, "Packet routed via device '%s' (cached).",
+				dst->dev->name);
+		goto end;
+	}
+
+	key = *flow;
+	dst = __route4(jool, flow);
+	if (dst)
+		cache_set4(slot, &key, flow, dst);
+	/* Fall through */
+
+end:
+	local_bh_enable();
+	return dst;
+}
+
+struct dst_entry *route6(struct xlator *jool, struct flowi6 *flow)
+{
+	struct route6_slot *slot;
+	struct flowi6 key;
+	struct dst_entry *dst;
+
+	if (jool->globals.next_hop6.set)
+		return next_hop_get(jool, &jool->routes->next_hop6);
+
+	local_bh_disable();
+
+	slot = &this_cpu_ptr(jool->routes->slots)->v6[
+			flow_slot(flow, sizeof(*flow))];
+	dst = cache_get6(slot, flow);
+	if (dst) {
+		__log_debug(jool, "Packet routed via device '%s' (cached).",
+				dst->dev->name);
+		goto end;
+	}
+
+	key = *flow;
+	dst = __route6(jool, flow);
+	if (dst)
+		cache_set6(slot, &key, flow, dst);
+	/* Fall through */
+
+end:
+	local_bh_enable();
+	return dst;
+}
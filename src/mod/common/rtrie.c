@@ -25,7 +25,99 @@ static __u8 bits_to_bytes(__u8 bits)
 	return (bits != 0u) ? (((bits - 1u) >> 3) + 1u) : 0u;
 }
 
-static struct rtrie_node *create_inode(struct rtrie_key *key,
+/*
+ * The nodes of one rtrie_build(), allocated as a single page-backed block
+ * instead of one kmalloc() each.
+ *
+ * The block is released along with its last node. The nodes that replace
+ * them later (rtrie_add(), rtrie_rm()) are allocated individually.
+ */
+struct rtrie_arena {
+	/* Nodes allocated from the arena and not yet released, +1 (builder). */
+	atomic_t live;
+	/* Size of every node; the largest the trie can need. */
+	size_t slot;
+	unsigned int used;
+	unsigned int capacity;
+	/* The slots follow. */
+};
+
+static __u8 *arena_slots(struct rtrie_arena *arena)
+{
+	return (__u8 *)arena + ALIGN(sizeof(*arena), sizeof(void *));
+}
+
+static struct rtrie_node *slot_node(struct rtrie_arena *arena, unsigned int i)
+{
+	return (struct rtrie_node *)(arena_slots(arena) + i * arena->slot);
+}
+
+static unsigned int slot_index(struct rtrie_arena *arena,
+		struct rtrie_node *node)
+{
+	return ((__u8 *)node - arena_slots(arena)) / arena->slot;
+}
+
+/*
+ * Inode keys are prefixes of leaf keys, and leaf keys are part of their
+ * values; a slot that fits a leaf fits any node.
+ */
+static struct rtrie_arena *arena_alloc(size_t value_size, unsigned int nodes)
+{
+	struct rtrie_arena *arena;
+	size_t slot;
+
+	slot = ALIGN(sizeof(struct rtrie_node) + value_size, sizeof(void *));
+	arena = __wkvmalloc("Rtrie arena",
+			ALIGN(sizeof(*arena), sizeof(void *)) + nodes * slot);
+	if (!arena)
+		return NULL;
+
+	atomic_set(&arena->live, 1);
+	arena->slot = slot;
+	arena->used = 0;
+	arena->capacity = nodes;
+	return arena;
+}
+
+static void arena_put(struct rtrie_arena *arena)
+{
+	if (atomic_dec_and_test(&arena->live))
+		__wkvfree("Rtrie arena", arena);
+}
+
+/* If @arena is NULL, the node is kmalloc()ed. */
+static struct rtrie_node *alloc_node(struct rtrie_arena *arena, size_t size)
+{
+	struct rtrie_node *node;
+
+	if (!arena) {
+		node = __wkmalloc("Rtrie node", size, GFP_ATOMIC);
+		if (node)
+			node->arena = NULL;
+		return node;
+	}
+
+	if (WARN(arena->used >= arena->capacity || size > arena->slot,
+			"Rtrie arena overflow."))
+		return NULL;
+
+	node = slot_node(arena, arena->used++);
+	node->arena = arena;
+	atomic_inc(&arena->live);
+	return node;
+}
+
+static void free_node(struct rtrie_node *node)
+{
+	if (node->arena)
+		arena_put(node->arena);
+	else
+		__wkfree("Rtrie node", node);
+}
+
+static struct rtrie_node *create_inode(struct rtrie_arena *arena,
+		struct rtrie_key *key,
 		struct rtrie_node *left_child,
 		struct rtrie_node *right_child)
 {
@@ -33,7 +125,7 @@ static struct rtrie_node *create_inode(struct rtrie_key *key,
 	__u8 key_len;
 
 	key_len = bits_to_bytes(key->len);
-	inode = __wkmalloc("Rtrie node", sizeof(*inode) + key_len, GFP_ATOMIC);
+	inode = alloc_node(arena, sizeof(*inode) + key_len);
 	if (!inode)
 		return NULL;
 
@@ -49,12 +141,13 @@ static struct rtrie_node *create_inode(struct rtrie_key *key,
 	return inode;
 }
 
-static struct rtrie_node *create_leaf(void *content, size_t content_len,
+static struct rtrie_node *create_leaf(struct rtrie_arena *arena,
+		void *content, size_t content_len,
 		size_t key_offset, __u8 key_len)
 {
 	struct rtrie_node *leaf;
 
-	leaf = __wkmalloc("Rtrie node", sizeof(*leaf) + content_len, GFP_ATOMIC);
+	leaf = alloc_node(arena, sizeof(*leaf) + content_len);
 	if (!leaf)
 		return NULL;
 
@@ -139,6 +232,22 @@ static bool key_equals(struct rtrie_key *key1, struct rtrie_key *key2)
 			: false;
 }
 
+int rtrie_key_cmp(struct rtrie_key *key1, struct rtrie_key *key2)
+{
+	unsigned int len;
+	unsigned int match;
+	unsigned int byte;
+
+	len = min(key1->len, key2->len);
+	match = __key_match(key1, key2, len);
+	if (match == len)
+		return (int)key1->len - (int)key2->len;
+
+	byte = match >> 3;
+	return (int)get_bit(key1->bytes[byte], match & 7u)
+			- (int)get_bit(key2->bytes[byte], match & 7u);
+}
+
 void rtrie_init(struct rtrie *trie, size_t size, struct mutex *lock)
 {
 	trie->root = NULL;
@@ -155,7 +264,7 @@ void rtrie_clean(struct rtrie *trie)
 	/* rtrie_print("Destroying trie", trie); */
 	list_for_each_entry_safe(node, tmp_node, &trie->list, list_hook) {
 		list_del(&node->list_hook);
-		__wkfree("Rtrie node", node);
+		free_node(node);
 	}
 
 	/* rtrie_print("Trie after", trie); */
@@ -235,7 +344,7 @@ static void swap_nodes(struct rtrie *trie, struct rtrie_node *old,
 	list_add(&new->list_hook, &trie->list);
 	list_del(&old->list_hook);
 
-	__wkfree("Rtrie node", old);
+	free_node(old);
 }
 
 static int add_to_root(struct rtrie *trie, struct rtrie_node *new)
@@ -261,7 +370,7 @@ static int add_to_root(struct rtrie *trie, struct rtrie_node *new)
 	key.bytes = new->key.bytes;
 	key.len = key_match(&root->key, &new->key);
 
-	inode = create_inode(&key, root, new);
+	inode = create_inode(NULL, &key, root, new);
 	if (!inode)
 		return -ENOMEM;
 
@@ -336,7 +445,8 @@ static int add_full_collision(struct rtrie *trie, struct rtrie_node *parent,
 	}
 	inode_prefix.bytes = higher_prefix1->key.bytes;
 
-	inode = create_inode(&inode_prefix, higher_prefix1, higher_prefix2);
+	inode = create_inode(NULL, &inode_prefix, higher_prefix1,
+			higher_prefix2);
 	if (!inode)
 		return -ENOMEM;
 
@@ -366,7 +476,8 @@ int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len,
 	bool contains_left;
 	bool contains_right;
 
-	new = create_leaf(value, trie->value_size, key_offset, key_len);
+	new = create_leaf(NULL, value, trie->value_size, key_offset,
+			key_len);
 	if (!new)
 		return -ENOMEM;
 
@@ -379,7 +490,7 @@ int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len,
 			swap_nodes(trie, parent, new);
 			return 0;
 		}
-		__wkfree("Rtrie node", new);
+		free_node(new);
 		return -EEXIST;
 	}
 
@@ -482,7 +593,38 @@ bool rtrie_is_empty(struct rtrie *trie)
 	return result;
 }
 
-int rtrie_rm(struct rtrie *trie, struct rtrie_key *key, bool synchronize)
+/**
+ * rtrie_memory - Adds @trie's nodes (black and white) and the bytes they take
+ * to @nodes and @bytes.
+ *
+ * Caller needs to hold the trie's lock.
+ */
+void rtrie_memory(struct rtrie *trie, __u64 *nodes, __u64 *bytes)
+{
+	struct rtrie_node *node;
+
+	list_for_each_entry(node, &trie->list, list_hook) {
+		(*nodes)++;
+		*bytes += node->arena ? node->arena->slot : ksize(node);
+	}
+}
+
+static void node_rcu_cb(struct rcu_head *rcu)
+{
+	free_node(container_of(rcu, struct rtrie_node, rcu));
+}
+
+/*
+ * Releases @node once the readers that might still be traversing it are done.
+ * Removals don't wait for grace periods, so they can be issued in bulk without
+ * holding the mutex for a grace period each.
+ */
+static void free_node_rcu(struct rtrie_node *node)
+{
+	call_rcu_bh(&node->rcu, node_rcu_cb);
+}
+
+int rtrie_rm(struct rtrie *trie, struct rtrie_key *key)
 {
 	struct rtrie_node *node;
 	struct rtrie_node *new;
@@ -494,7 +636,7 @@ int rtrie_rm(struct rtrie *trie, struct rtrie_key *key, bool synchronize)
 		return -ESRCH;
 
 	if (node->left && node->right) {
-		new = create_inode(&node->key,
+		new = create_inode(NULL, &node->key,
 				deref_updater(trie, node->left),
 				deref_updater(trie, node->right));
 		if (!new)
@@ -504,14 +646,12 @@ int rtrie_rm(struct rtrie *trie, struct rtrie_key *key, bool synchronize)
 		parent_ptr = get_parent_ptr(trie, node);
 
 		rcu_assign_pointer(*parent_ptr, new);
-		if (synchronize)
-			synchronize_rcu_bh();
 
 		deref_updater(trie, new->left)->parent = new;
 		deref_updater(trie, new->right)->parent = new;
 		list_add(&new->list_hook, &trie->list);
 		list_del(&node->list_hook);
-		__wkfree("Rtrie node", node);
+		free_node_rcu(node);
 		return 0;
 	}
 
@@ -526,29 +666,23 @@ int rtrie_rm(struct rtrie *trie, struct rtrie_key *key, bool synchronize)
 
 		if (node->left) {
 			rcu_assign_pointer(*parent_ptr, node->left);
-			if (synchronize)
-				synchronize_rcu_bh();
 			deref_updater(trie, node->left)->parent = parent;
 			list_del(&node->list_hook);
-			__wkfree("Rtrie node", node);
+			free_node_rcu(node);
 			return 0;
 		}
 
 		if (node->right) {
 			rcu_assign_pointer(*parent_ptr, node->right);
-			if (synchronize)
-				synchronize_rcu_bh();
 			deref_updater(trie, node->right)->parent = parent;
 			list_del(&node->list_hook);
-			__wkfree("Rtrie node", node);
+			free_node_rcu(node);
 			return 0;
 		}
 
 		rcu_assign_pointer(*parent_ptr, NULL);
-		if (synchronize)
-			synchronize_rcu_bh();
 		list_del(&node->list_hook);
-		__wkfree("Rtrie node", node);
+		free_node_rcu(node);
 
 		node = parent;
 	} while (node && node->color == COLOR_BLACK);
@@ -574,12 +708,236 @@ void rtrie_flush(struct rtrie *trie)
 
 	list_for_each_entry_safe(node, tmp_node, &tmp_list, list_hook) {
 		list_del(&node->list_hook);
-		__wkfree("Rtrie node", node);
+		free_node(node);
 	}
 }
 
+static void attach(struct rtrie_node *parent, struct rtrie_node *child)
+{
+	if (!parent->left)
+		RCU_INIT_POINTER(parent->left, child);
+	else
+		RCU_INIT_POINTER(parent->right, child);
+	child->parent = parent;
+}
+
+/* Returns @node's counterpart in @to. (See relocate().) */
+static struct rtrie_node *moved(struct rtrie_arena *from,
+		struct rtrie_arena *to, unsigned int *positions,
+		struct rtrie_node *node)
+{
+	return node ? slot_node(to, positions[slot_index(from, node)]) : NULL;
+}
+
+/*
+ * Moves the tree rtrie_build() left in *@arena (rooted at @root, and listed in
+ * @nodes) to a new arena, in breadth-first order. Returns the new root.
+ *
+ * The build order is depth-first, so the top of the tree would end up spread
+ * over the whole block otherwise. This is an optimization only; if it can't be
+ * done, the tree stays where it is.
+ */
+static struct rtrie_node *relocate(struct rtrie *trie, struct rtrie_node *root,
+		struct list_head *nodes, struct rtrie_arena **arena)
+{
+	struct rtrie_arena *from = *arena;
+	struct rtrie_arena *to;
+	unsigned int *queue; /* Old indexes, in breadth-first order. */
+	unsigned int *positions; /* New index of every old index. */
+	struct rtrie_node *node;
+	struct rtrie_node *child;
+	struct rtrie_node *copy;
+	struct list_head list;
+	unsigned int head, tail;
+	unsigned int i;
+
+	queue = __wkvmalloc("Rtrie relocation",
+			2 * from->used * sizeof(*queue));
+	if (!queue)
+		return root;
+	positions = queue + from->used;
+	to = arena_alloc(trie->value_size, from->used);
+	if (!to)
+		goto end;
+
+	queue[0] = slot_index(from, root);
+	for (head = 0, tail = 1; head < tail; head++) {
+		positions[queue[head]] = head;
+		node = slot_node(from, queue[head]);
+		child = deref_updater(trie, node->left);
+		if (child && tail < from->used)
+			queue[tail++] = slot_index(from, child);
+		child = deref_updater(trie, node->right);
+		if (child && tail < from->used)
+			queue[tail++] = slot_index(from, child);
+	}
+	if (WARN(tail != from->used, "Rtrie build left unattached nodes.")) {
+		arena_put(to);
+		goto end;
+	}
+
+	for (i = 0; i < from->used; i++) {
+		node = slot_node(from, i);
+		copy = slot_node(to, positions[i]);
+		memcpy(copy, node, from->slot);
+		RCU_INIT_POINTER(copy->left, moved(from, to, positions,
+				deref_updater(trie, node->left)));
+		RCU_INIT_POINTER(copy->right, moved(from, to, positions,
+				deref_updater(trie, node->right)));
+		copy->parent = moved(from, to, positions, node->parent);
+		copy->key.bytes = (__u8 *)copy
+				+ (node->key.bytes - (__u8 *)node);
+		copy->arena = to;
+	}
+
+	/* Same list order, so the foreaches don't change. */
+	INIT_LIST_HEAD(&list);
+	list_for_each_entry(node, nodes, list_hook) {
+		copy = moved(from, to, positions, node);
+		list_add_tail(&copy->list_hook, &list);
+	}
+	list_replace(&list, nodes);
+
+	to->used = from->used;
+	atomic_add(to->used, &to->live);
+	root = slot_node(to, 0);
+	/* Nothing was published; nobody can be reading the old nodes. */
+	__wkvfree("Rtrie arena", from);
+	*arena = to;
+	/* Fall through */
+
+end:
+	__wkvfree("Rtrie relocation", queue);
+	return root;
+}
+
+/*
+ * Builds the tree from left to right, keeping the path from the root to the
+ * latest leaf in @stack. Each new key only needs to be compared to the previous
+ * one: the length of their common prefix tells how much of the path is done
+ * (and can be attached to its parent), and where the new leaf branches off.
+ *
+ * Since shorter prefixes come first, no leaf ever needs to replace an inode.
+ */
+int rtrie_build(struct rtrie *trie, void **values, unsigned int count,
+		size_t key_offset, size_t len_offset)
+{
+	struct rtrie_node **stack;
+	unsigned int top; /* Number of nodes in @stack. */
+	struct rtrie_node *prev;
+	struct rtrie_node *leaf;
+	struct rtrie_node *last;
+	struct rtrie_node *node;
+	struct rtrie_node *tmp;
+	struct rtrie_key key;
+	struct list_head nodes;
+	struct rtrie_arena *arena;
+	unsigned int i;
+	int error;
+
+	if (WARN(deref_updater(trie, trie->root),
+			"rtrie_build() needs an empty trie."))
+		return -EINVAL;
+	if (!count)
+		return 0;
+
+	/* Each node in the path has a longer key than its parent. */
+	stack = __wkmalloc("Rtrie build stack", 256 * sizeof(*stack),
+			GFP_KERNEL);
+	if (!stack)
+		return -ENOMEM;
+	/* @count leaves, and at most @count - 1 inodes. */
+	arena = arena_alloc(trie->value_size, 2 * count - 1);
+	if (!arena) {
+		__wkfree("Rtrie build stack", stack);
+		return -ENOMEM;
+	}
+	INIT_LIST_HEAD(&nodes);
+	top = 0;
+	prev = NULL;
+
+	for (i = 0; i < count; i++) {
+		leaf = create_leaf(arena, values[i], trie->value_size,
+				key_offset, *((__u8 *)values[i] + len_offset));
+		if (!leaf) {
+			error = -ENOMEM;
+			goto fail;
+		}
+		list_add_tail(&leaf->list_hook, &nodes);
+
+		if (!prev) {
+			stack[top++] = leaf;
+			prev = leaf;
+			continue;
+		}
+
+		if (WARN(rtrie_key_cmp(&prev->key, &leaf->key) >= 0,
+				"rtrie_build() keys are not sorted, or repeated.")) {
+			error = -EINVAL;
+			goto fail;
+		}
+
+		key.bytes = leaf->key.bytes;
+		key.len = key_match(&prev->key, &leaf->key);
+
+		last = NULL;
+		while (top && stack[top - 1]->key.len > key.len) {
+			node = stack[--top];
+			if (last)
+				attach(node, last);
+			last = node;
+		}
+
+		if (top && stack[top - 1]->key.len == key.len) {
+			if (last)
+				attach(stack[top - 1], last);
+		} else {
+			node = create_inode(arena, &key, NULL, NULL);
+			if (!node) {
+				error = -ENOMEM;
+				goto fail;
+			}
+			list_add_tail(&node->list_hook, &nodes);
+			if (last)
+				attach(node, last);
+			stack[top++] = node;
+		}
+
+		stack[top++] = leaf;
+		prev = leaf;
+	}
+
+	last = NULL;
+	while (top) {
+		node = stack[--top];
+		if (last)
+			attach(node, last);
+		last = node;
+	}
+
+	last = relocate(trie, last, &nodes, &arena);
+	list_splice(&nodes, &trie->list);
+	rcu_assign_pointer(trie->root, last);
+	arena_put(arena);
+	__wkfree("Rtrie build stack", stack);
+	return 0;
+
+fail:
+	list_for_each_entry_safe(node, tmp, &nodes, list_hook) {
+		list_del(&node->list_hook);
+		free_node(node);
+	}
+	arena_put(arena);
+	__wkfree("Rtrie build stack", stack);
+	return error;
+}
+
 /**
- * TODO (performance) find offset using a normal trie find.
+ * Calls @cb for every value in @trie, in the order of @trie->list.
+ *
+ * If @offset is present, the iteration starts right after the node keyed
+ * @offset. That node is found through a regular trie search, so paginated
+ * dumps don't need to rewalk the list up to the offset.
  */
 int rtrie_foreach(struct rtrie *trie,
 		rtrie_foreach_cb cb, void *arg,
@@ -591,18 +949,23 @@ int rtrie_foreach(struct rtrie *trie,
 	if (list_empty(&trie->list))
 		return 0;
 
-	list_for_each_entry(node, &trie->list, list_hook) {
-		if (offset) {
-			if (key_equals(offset, &node->key))
-				offset = NULL;
-		} else if (node->color == COLOR_WHITE) {
+	if (offset) {
+		node = find_longest_common_prefix(trie, offset, true);
+		if (!node || !key_equals(offset, &node->key))
+			return -ESRCH;
+	} else {
+		node = list_entry(&trie->list, struct rtrie_node, list_hook);
+	}
+
+	list_for_each_entry_continue(node, &trie->list, list_hook) {
+		if (node->color == COLOR_WHITE) {
 			error = cb(node + 1, arg);
 			if (error)
 				return error;
 		}
 	}
 
-	return offset ? -ESRCH : 0;
+	return 0;
 }
 
 static char *color2str(enum rtrie_color color)
@@ -11,6 +11,7 @@
 
 #include <linux/types.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
 
 struct rtrie_key {
 	__u8 *bytes;
@@ -18,6 +19,8 @@ struct rtrie_key {
 	__u8 len;
 };
 
+struct rtrie_arena;
+
 enum rtrie_color {
 	COLOR_BLACK,
 	COLOR_WHITE,
@@ -60,6 +63,15 @@ struct rtrie_node {
 	 * NOT RCU-friendly.
 	 */
 	struct list_head list_hook;
+	/** Defers the node's release once it's removed. (See rtrie_rm().) */
+	struct rcu_head rcu;
+	/**
+	 * The block the node was allocated from, or NULL if it was allocated
+	 * on its own. (See rtrie_build().)
+	 *
+	 * NOT RCU-friendly.
+	 */
+	struct rtrie_arena *arena;
 
 	/* The value hangs off end. RCU-friendly. */
 };
@@ -88,6 +100,7 @@ void rtrie_clean(struct rtrie *trie);
 int rtrie_find(struct rtrie *trie, struct rtrie_key *key, void *result);
 bool rtrie_contains(struct rtrie *trie, struct rtrie_key *key);
 bool rtrie_is_empty(struct rtrie *trie);
+void rtrie_memory(struct rtrie *trie, __u64 *nodes, __u64 *bytes);
 void rtrie_print(char const *prefix, struct rtrie *trie);
 
 /* Lock-before-using functions. */
@@ -102,9 +115,34 @@ void rtrie_print(char const *prefix, struct rtrie *trie);
 
 int rtrie_add(struct rtrie *trie, void *value, size_t key_offset, __u8 key_len,
 		bool synchronize);
-int rtrie_rm(struct rtrie *trie, struct rtrie_key *key, bool synchronize);
+/*
+ * rtrie_rm() never waits for the readers; the nodes it removes are released
+ * by call_rcu_bh() instead. Whoever unloads the module needs to
+ * rcu_barrier_bh() before that.
+ */
+int rtrie_rm(struct rtrie *trie, struct rtrie_key *key);
 void rtrie_flush(struct rtrie *trie);
 
+/*
+ * Orders keys the way rtrie_build() wants them: by their bits, and shorter
+ * keys first when one is a prefix of the other.
+ */
+int rtrie_key_cmp(struct rtrie_key *key1, struct rtrie_key *key2);
+/*
+ * Fills empty @trie with the @count values pointed by @values, in O(n).
+ * @values needs to be sorted by rtrie_key_cmp(), and lack duplicate keys.
+ * @len_offset is the offset of the key's length (a __u8) within each value.
+ *
+ * The tree is built off to the side, and published with a single pointer
+ * assignment, so this never needs RCU synchronization.
+ *
+ * The nodes are allocated from a single block, in breadth-first order, so the
+ * top of the tree (which every lookup visits) is packed into a few pages. Can
+ * sleep.
+ */
+int rtrie_build(struct rtrie *trie, void **values, unsigned int count,
+		size_t key_offset, size_t len_offset);
+
 typedef int (*rtrie_foreach_cb)(void const *, void *);
 int rtrie_foreach(struct rtrie *trie,
 		rtrie_foreach_cb cb, void *arg,
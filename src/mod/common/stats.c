@@ -1,19 +1,140 @@
 #include "mod/common/stats.h"
 
+#include <linux/jiffies.h>
 #include <linux/kref.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/proc_fs.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <net/ip.h>
 #include <net/snmp.h>
+#include "mod/common/linux_version.h"
 #include "mod/common/wkmalloc.h"
 
+/*
+ * The per-CPU counters aren't laid out in enum jool_stat_id order. The few
+ * that nearly every packet increases share the first cacheline, and everything
+ * else (mostly error counters that are hardly ever hit) follows it. That way,
+ * the translation path only ever dirties one line of the MIB.
+ *
+ * (The IDs are ABI, so the remapping stays in here. Use slot() to find a
+ * counter.)
+ */
+#define JSTAT_HOT_SLOTS 8
+
+/* Hot counter's slot + 1. Zero means cold. */
+static const __u8 hot_slots[JSTAT_COUNT] = {
+	[JSTAT_RECEIVED6] = 1,
+	[JSTAT_RECEIVED4] = 2,
+	[JSTAT_BYTES6] = 3,
+	[JSTAT_BYTES4] = 4,
+	[JSTAT_SUCCESS] = 5,
+	[JSTAT_ICMP6ERR_SUCCESS] = 6,
+	[JSTAT_ICMP4ERR_SUCCESS] = 7,
+	[JSTAT_JOOLD_SSS_QUEUED] = 8,
+};
+
 struct jool_mib {
-	unsigned long mibs[JSTAT_COUNT];
+	/* Hot slots first, then one slot per ID. (The hot IDs' are unused.) */
+	unsigned long mibs[JSTAT_HOT_SLOTS + JSTAT_COUNT];
+} ____cacheline_aligned;
+
+static unsigned int slot(enum jool_stat_id stat)
+{
+	return hot_slots[stat]
+			? (hot_slots[stat] - 1)
+			: (JSTAT_HOT_SLOTS + stat);
+}
+
+struct jool_latency {
+	unsigned long buckets[JLAT_HISTOGRAM_COUNT][JLAT_BUCKETS];
+};
+
+struct jool_lifetimes {
+	unsigned long buckets[JLIFE_HISTOGRAM_COUNT][JLIFE_BUCKETS];
+};
+
+/* See jstat_rates_update(). */
+struct jool_rates {
+	spinlock_t lock;
+	/* Updates so far; the first one only takes the counters. */
+	unsigned int updates;
+	/* Jiffy of the last update. */
+	unsigned long time;
+	/* The jrate_sources, as of the last update. */
+	__u64 counters[JRATE_COUNT];
+	/* EWMAs, in units of 2^-JRATE_SHIFT per second. */
+	__u64 rates[JRATE_COUNT];
 };
 
 struct jool_stats {
 	DEFINE_SNMP_STAT(struct jool_mib, mib);
+	struct jool_latency __percpu *latency;
+	struct jool_lifetimes __percpu *lifetimes;
+	struct jool_rates rates;
 	struct kref refcounter;
 };
 
+DEFINE_STATIC_KEY_FALSE(jstat_latency_key);
+
+static bool latency_stats;
+
+static int set_latency_stats(const char *val, const struct kernel_param *kp)
+{
+	int error;
+
+	error = param_set_bool(val, kp);
+	if (error)
+		return error;
+
+	if (latency_stats)
+		static_branch_enable(&jstat_latency_key);
+	else
+		static_branch_disable(&jstat_latency_key);
+	return 0;
+}
+
+static const struct kernel_param_ops latency_stats_ops = {
+	.set = set_latency_stats,
+	.get = param_get_bool,
+};
+
+module_param_cb(latency_stats, &latency_stats_ops, &latency_stats, 0644);
+MODULE_PARM_DESC(latency_stats, "Record per-stage translation latency histograms. (See `jool stats latency`.)");
+
+DEFINE_STATIC_KEY_FALSE(jstat_lifetime_key);
+
+static bool lifetime_stats;
+
+static int set_lifetime_stats(const char *val, const struct kernel_param *kp)
+{
+	int error;
+
+	error = param_set_bool(val, kp);
+	if (error)
+		return error;
+
+	if (lifetime_stats)
+		static_branch_enable(&jstat_lifetime_key);
+	else
+		static_branch_disable(&jstat_lifetime_key);
+	return 0;
+}
+
+static const struct kernel_param_ops lifetime_stats_ops = {
+	.set = set_lifetime_stats,
+	.get = param_get_bool,
+};
+
+module_param_cb(lifetime_stats, &lifetime_stats_ops, &lifetime_stats, 0644);
+MODULE_PARM_DESC(lifetime_stats, "Record session lifetime, idle time and port hold time histograms. (See `jool stats lifetimes`.)");
+
 struct jool_stats *jstat_alloc(void)
 {
 	struct jool_stats *result;
@@ -23,13 +144,30 @@ struct jool_stats *jstat_alloc(void)
 		return NULL;
 
 	result->mib = alloc_percpu(struct jool_mib);
-	if (!result->mib) {
-		wkfree(struct jool_stats, result);
-		return NULL;
-	}
+	if (!result->mib)
+		goto mib_fail;
+	result->latency = alloc_percpu(struct jool_latency);
+	if (!result->latency)
+		goto latency_fail;
+	result->lifetimes = alloc_percpu(struct jool_lifetimes);
+	if (!result->lifetimes)
+		goto lifetimes_fail;
+	memset(&result->rates, 0, sizeof(result->rates));
+	spin_lock_init(&result->rates.lock);
+	/* The counters start at zero, so the first update can measure. */
+	result->rates.updates = 1;
+	result->rates.time = jiffies;
 	kref_init(&result->refcounter);
 
 	return result;
+
+lifetimes_fail:
+	free_percpu(result->latency);
+latency_fail:
+	free_percpu(result->mib);
+mib_fail:
+	wkfree(struct jool_stats, result);
+	return NULL;
 }
 
 void jstat_get(struct jool_stats *stats)
@@ -42,6 +180,8 @@ static void jstat_release(struct kref *refcount)
 	struct jool_stats *stats;
 	stats = container_of(refcount, struct jool_stats, refcounter);
 
+	free_percpu(stats->lifetimes);
+	free_percpu(stats->latency);
 	free_percpu(stats->mib);
 	wkfree(struct jool_stats, stats);
 }
@@ -53,17 +193,52 @@ void jstat_put(struct jool_stats *stats)
 
 void jstat_inc(struct jool_stats *stats, enum jool_stat_id stat)
 {
-	SNMP_INC_STATS(stats->mib, stat);
+	SNMP_INC_STATS(stats->mib, slot(stat));
 }
 
 void jstat_dec(struct jool_stats *stats, enum jool_stat_id stat)
 {
-	SNMP_DEC_STATS(stats->mib, stat);
+	SNMP_DEC_STATS(stats->mib, slot(stat));
 }
 
 void jstat_add(struct jool_stats *stats, enum jool_stat_id stat, int addend)
 {
-	SNMP_ADD_STATS(stats->mib, stat, addend);
+	SNMP_ADD_STATS(stats->mib, slot(stat), addend);
+}
+
+/**
+ * jstat_flush - Adds a packet's counters to @stats, all at once.
+ * (See struct xlation_tally.)
+ *
+ * Increases each of the @count stats in @ids, and adds @bytes to @bytes_id.
+ */
+void jstat_flush(struct jool_stats *stats, __u16 const *ids,
+		unsigned int count, enum jool_stat_id bytes_id,
+		unsigned int bytes)
+{
+	unsigned int i;
+
+	SNMP_ADD_STATS(stats->mib, slot(bytes_id), bytes);
+	for (i = 0; i < count; i++)
+		SNMP_INC_STATS(stats->mib, slot(ids[i]));
+}
+
+/**
+ * Overrides counter @stat, so it sums up to @value.
+ *
+ * Meant for the gauges that are computed at query time (because the databases
+ * already know them), which nobody increases or decreases. Process context
+ * only.
+ */
+void jstat_set(struct jool_stats *stats, enum jool_stat_id stat, __u64 value)
+{
+	unsigned int s;
+	int cpu;
+
+	s = slot(stat);
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(stats->mib, cpu)->mibs[s] = 0;
+	per_cpu_ptr(stats->mib, raw_smp_processor_id())->mibs[s] = value;
 }
 
 /**
@@ -80,11 +255,456 @@ __u64 *jstat_query(struct jool_stats *stats)
 		return NULL;
 
 	for (i = 0; i < JSTAT_COUNT; i++)
-		result[i] = snmp_fold_field(stats->mib, i);
+		result[i] = jstat_query_one(stats, i);
+
+	return result;
+}
+
+/* Same as jstat_query(), except only sums up counter @id. */
+__u64 jstat_query_one(struct jool_stats *stats, enum jool_stat_id id)
+{
+	return snmp_fold_field(stats->mib, slot(id));
+}
+
+/**
+ * Same as jstat_query_one(), except the counter isn't summed up. @result has
+ * to have room for nr_cpu_ids values; CPU i's goes to @result[i]. (And the
+ * impossible CPUs' are zero.)
+ */
+void jstat_query_percpu(struct jool_stats *stats, enum jool_stat_id id,
+		__u64 *result)
+{
+	unsigned int s;
+	int cpu;
+
+	s = slot(id);
+	memset(result, 0, nr_cpu_ids * sizeof(*result));
+	for_each_possible_cpu(cpu)
+		result[cpu] = per_cpu_ptr(stats->mib, cpu)->mibs[s];
+}
+
+void __jlat_stop(struct jool_stats *stats, enum jool_latency_dir dir,
+		enum jool_latency_stage stage, u64 start)
+{
+	u64 delta;
+	unsigned int bucket;
+
+	delta = local_clock() - start;
+	bucket = (delta > 1) ? ilog2(delta) : 0;
+	if (bucket >= JLAT_BUCKETS)
+		bucket = JLAT_BUCKETS - 1;
+
+	this_cpu_inc(stats->latency->buckets[dir * JLAT_STAGE_COUNT + stage][bucket]);
+}
+
+__u64 *jstat_query_latency(struct jool_stats *stats)
+{
+	struct jool_latency *latency;
+	__u64 *result;
+	unsigned int h, b;
+	int cpu;
+
+	result = kcalloc(JLAT_HISTOGRAM_COUNT * JLAT_BUCKETS, sizeof(__u64),
+			GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		latency = per_cpu_ptr(stats->latency, cpu);
+		for (h = 0; h < JLAT_HISTOGRAM_COUNT; h++)
+			for (b = 0; b < JLAT_BUCKETS; b++)
+				result[h * JLAT_BUCKETS + b] +=
+						latency->buckets[h][b];
+	}
+
+	return result;
+}
+
+/* The counter each rate is estimated from. */
+static const enum jool_stat_id jrate_sources[] = {
+	[JRATE_RECEIVED6] = JSTAT_RECEIVED6,
+	[JRATE_RECEIVED4] = JSTAT_RECEIVED4,
+	[JRATE_TRANSLATED] = JSTAT_SUCCESS,
+	[JRATE_BYTES6] = JSTAT_BYTES6,
+	[JRATE_BYTES4] = JSTAT_BYTES4,
+	[JRATE_BIB_CREATED] = JSTAT_BIB_CREATED,
+	[JRATE_SESSIONS_CREATED] = JSTAT_SESSIONS_CREATED,
+	[JRATE_SESSIONS_EXPIRED] = JSTAT_SESSIONS_EXPIRED,
+	[JRATE_JOOLD_SENT] = JSTAT_JOOLD_SSS_SENT,
+	[JRATE_JOOLD_RCVD] = JSTAT_JOOLD_SSS_RCVD,
+};
+
+/*
+ * Every JRATE_PERIOD, the averages move 1/2^JRATE_EWMA_LOG of the way towards
+ * the latest measurements. That's a time constant of about 8 seconds.
+ *
+ * The updates don't have to be that regular (the cleaning timer only exists
+ * while there are NAT64 instances, so SIIT's rates are updated when they're
+ * queried), so an update that comes after several periods takes that many
+ * steps at once.
+ */
+#define JRATE_EWMA_LOG 2
+#define JRATE_PERIOD (2 * HZ)
+/* After this many steps, the old average is negligible. */
+#define JRATE_MAX_STEPS 32
+/* Updates closer than this to the previous one are ignored. */
+#define JRATE_MIN_INTERVAL (HZ / 2)
+
+static __u64 ewma(__u64 average, __u64 sample, unsigned long steps)
+{
+	if (steps > JRATE_MAX_STEPS)
+		return sample;
+
+	for (; steps > 0; steps--) {
+		if (sample >= average)
+			average += (sample - average) >> JRATE_EWMA_LOG;
+		else
+			average -= (average - sample) >> JRATE_EWMA_LOG;
+	}
+	return average;
+}
+
+/**
+ * jstat_rates_update - Folds the counters the rates are estimated from, and
+ * moves the rates accordingly.
+ *
+ * Called periodically by the cleaning timer (if there is one), and by
+ * jstat_query_rates(). The elapsed time is measured, so the period doesn't
+ * need to be exact, or even regular.
+ */
+void jstat_rates_update(struct jool_stats *stats)
+{
+	struct jool_rates *rates = &stats->rates;
+	unsigned long now;
+	unsigned long elapsed;
+	unsigned long steps;
+	__u64 counter;
+	__u64 sample;
+	unsigned int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(jrate_sources) != JRATE_COUNT);
+
+	spin_lock_bh(&rates->lock);
+
+	now = jiffies;
+	elapsed = now - rates->time;
+	if (rates->updates && elapsed < JRATE_MIN_INTERVAL)
+		goto end; /* Too soon to measure anything; skip */
+
+	steps = max(DIV_ROUND_CLOSEST(elapsed, JRATE_PERIOD), 1ul);
+	for (i = 0; i < JRATE_COUNT; i++) {
+		counter = jstat_query_one(stats, jrate_sources[i]);
+		if (rates->updates) {
+			sample = div64_u64((counter - rates->counters[i])
+					* HZ << JRATE_SHIFT, elapsed);
+			rates->rates[i] = (rates->updates > 1)
+					? ewma(rates->rates[i], sample, steps)
+					: sample;
+		}
+		rates->counters[i] = counter;
+	}
+
+	rates->time = now;
+	if (rates->updates < 2)
+		rates->updates++;
+
+end:
+	spin_unlock_bh(&rates->lock);
+}
+
+/*
+ * Copies the JRATE_COUNT rates (2^-JRATE_SHIFT units per second) to @result.
+ * Brings them up to date first.
+ */
+void jstat_query_rates(struct jool_stats *stats, __u64 *result)
+{
+	jstat_rates_update(stats);
+
+	spin_lock_bh(&stats->rates.lock);
+	memcpy(result, stats->rates.rates, sizeof(stats->rates.rates));
+	spin_unlock_bh(&stats->rates.lock);
+}
+
+/*
+ * Returns rate @id, in whole units per second, as of the last update. (Cheap,
+ * but stale if nobody updates the rates; see jstat_rates_update().)
+ */
+__u64 jstat_rate(struct jool_stats *stats, enum jool_rate_id id)
+{
+	return READ_ONCE(stats->rates.rates[id]) >> JRATE_SHIFT;
+}
+
+void jlife_record(struct jool_stats *stats, enum jool_lifetime_metric metric,
+		enum jool_lifetime_class class, unsigned long duration)
+{
+	unsigned int msecs;
+	unsigned int bucket;
+
+	msecs = jiffies_to_msecs(duration);
+	bucket = (msecs > 1) ? ilog2(msecs) : 0;
+	if (bucket >= JLIFE_BUCKETS)
+		bucket = JLIFE_BUCKETS - 1;
+
+	this_cpu_inc(stats->lifetimes->buckets
+			[metric * JLIFE_CLASS_COUNT + class][bucket]);
+}
+
+__u64 *jstat_query_lifetimes(struct jool_stats *stats)
+{
+	struct jool_lifetimes *lifetimes;
+	__u64 *result;
+	unsigned int h, b;
+	int cpu;
+
+	result = kcalloc(JLIFE_HISTOGRAM_COUNT * JLIFE_BUCKETS, sizeof(__u64),
+			GFP_KERNEL);
+	if (!result)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		lifetimes = per_cpu_ptr(stats->lifetimes, cpu);
+		for (h = 0; h < JLIFE_HISTOGRAM_COUNT; h++)
+			for (b = 0; b < JLIFE_BUCKETS; b++)
+				result[h * JLIFE_BUCKETS + b] +=
+						lifetimes->buckets[h][b];
+	}
 
 	return result;
 }
 
+/*
+ * Mapped counters. (See struct jstat_snapshot.)
+ *
+ * Folding the per-CPU counters is the expensive part, so it only happens once
+ * per refresh period, and only for the files somebody has mapped. Everyone
+ * else pays nothing.
+ */
+
+#define JSTAT_REFRESH_PERIOD HZ
+
+struct jstat_file {
+	/* vmalloc_user()'d; this is what gets mapped. */
+	struct jstat_snapshot *snapshot;
+	struct proc_dir_entry *pde;
+	struct kref refs;
+
+	/* The following are protected by @files_lock. */
+
+	/* Changes during atomic configuration. */
+	struct jool_stats *stats;
+	/* Number of VMAs mapping @snapshot. */
+	unsigned int mappings;
+	/* Hook to @mapped_files; only listed while @mappings > 0. */
+	struct list_head hook;
+};
+
+static LIST_HEAD(mapped_files);
+static DEFINE_MUTEX(files_lock);
+
+static void refresh_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(refresh_work, refresh_fn);
+
+/* Requires @files_lock. */
+static void refresh(struct jstat_file *file)
+{
+	struct jstat_snapshot *snapshot = file->snapshot;
+	unsigned int i;
+
+	WRITE_ONCE(snapshot->seq, snapshot->seq + 1);
+	smp_wmb();
+
+	for (i = 0; i < JSTAT_COUNT; i++)
+		snapshot->counters[i] = jstat_query_one(file->stats, i);
+	snapshot->timestamp = ktime_get_ns();
+
+	smp_wmb();
+	WRITE_ONCE(snapshot->seq, snapshot->seq + 1);
+}
+
+static void refresh_fn(struct work_struct *work)
+{
+	struct jstat_file *file;
+
+	mutex_lock(&files_lock);
+	list_for_each_entry(file, &mapped_files, hook)
+		refresh(file);
+	if (!list_empty(&mapped_files))
+		schedule_delayed_work(&refresh_work, JSTAT_REFRESH_PERIOD);
+	mutex_unlock(&files_lock);
+}
+
+static void release_file(struct kref *refs)
+{
+	struct jstat_file *file;
+	file = container_of(refs, struct jstat_file, refs);
+
+	jstat_put(file->stats);
+	vfree(file->snapshot);
+	wkfree(struct jstat_file, file);
+}
+
+static void file_map(struct jstat_file *file)
+{
+	kref_get(&file->refs);
+
+	mutex_lock(&files_lock);
+	if (file->mappings++ == 0) {
+		/* Otherwise the first sample would be a second old. */
+		refresh(file);
+		if (list_empty(&mapped_files))
+			schedule_delayed_work(&refresh_work,
+					JSTAT_REFRESH_PERIOD);
+		list_add(&file->hook, &mapped_files);
+	}
+	mutex_unlock(&files_lock);
+}
+
+static void file_unmap(struct jstat_file *file)
+{
+	mutex_lock(&files_lock);
+	if (--file->mappings == 0)
+		list_del(&file->hook);
+	mutex_unlock(&files_lock);
+
+	kref_put(&file->refs, release_file);
+}
+
+/* Also called when the VMA is split or copied (fork). */
+static void vma_open(struct vm_area_struct *vma)
+{
+	__module_get(THIS_MODULE);
+	file_map(vma->vm_private_data);
+}
+
+static void vma_close(struct vm_area_struct *vma)
+{
+	file_unmap(vma->vm_private_data);
+	module_put(THIS_MODULE);
+}
+
+static const struct vm_operations_struct jstat_vm_ops = {
+	.open = vma_open,
+	.close = vma_close,
+};
+
+static int jstat_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct jstat_file *file;
+	int error;
+
+#if LINUX_VERSION_AT_LEAST(5, 17, 0, 9, 2)
+	file = pde_data(file_inode(filp));
+#else
+	file = PDE_DATA(file_inode(filp));
+#endif
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	/*
+	 * Writable opens are the only way to get a shared mapping. (Private
+	 * mappings can be written to, but only their copies change.)
+	 */
+	if (vma->vm_flags & VM_SHARED)
+		return -EPERM;
+
+	if (!try_module_get(THIS_MODULE))
+		return -ENODEV;
+
+	error = remap_vmalloc_range(vma, file->snapshot, 0);
+	if (error) {
+		module_put(THIS_MODULE);
+		return error;
+	}
+
+	vma->vm_private_data = file;
+	vma->vm_ops = &jstat_vm_ops;
+	file_map(file);
+	return 0;
+}
+
+#if LINUX_VERSION_AT_LEAST(5, 6, 0, 9, 0)
+static const struct proc_ops jstat_fops = {
+	.proc_mmap = jstat_mmap,
+};
+#else
+static const struct file_operations jstat_fops = {
+	.owner = THIS_MODULE,
+	.mmap = jstat_mmap,
+};
+#endif
+
+/**
+ * jstat_file_create - Exposes @stats as file @name, in @parent.
+ * (See struct jstat_snapshot.)
+ */
+struct jstat_file *jstat_file_create(struct jool_stats *stats,
+		char const *name, struct proc_dir_entry *parent)
+{
+	struct jstat_file *file;
+
+	BUILD_BUG_ON(sizeof(struct jstat_snapshot) > PAGE_SIZE);
+
+	file = wkmalloc(struct jstat_file, GFP_KERNEL);
+	if (!file)
+		return NULL;
+	/* Zeroes. */
+	file->snapshot = vmalloc_user(PAGE_SIZE);
+	if (!file->snapshot)
+		goto snapshot_fail;
+	file->snapshot->count = JSTAT_COUNT;
+	kref_init(&file->refs);
+	file->stats = stats;
+	jstat_get(stats);
+	file->mappings = 0;
+
+	file->pde = proc_create_data(name, 0444, parent, &jstat_fops, file);
+	if (!file->pde)
+		goto pde_fail;
+
+	return file;
+
+pde_fail:
+	jstat_put(stats);
+	vfree(file->snapshot);
+snapshot_fail:
+	wkfree(struct jstat_file, file);
+	return NULL;
+}
+
+/* Makes @file show @stats from now on. (Atomic configuration resets them.) */
+void jstat_file_retarget(struct jstat_file *file, struct jool_stats *stats)
+{
+	struct jool_stats *old;
+
+	jstat_get(stats);
+
+	mutex_lock(&files_lock);
+	old = file->stats;
+	file->stats = stats;
+	if (file->mappings)
+		refresh(file);
+	mutex_unlock(&files_lock);
+
+	jstat_put(old);
+}
+
+/*
+ * Removes @file from procfs. Existing mappings survive, but their counters
+ * freeze along with the dead instance's.
+ */
+void jstat_file_destroy(struct jstat_file *file)
+{
+	/* Waits for the ongoing mmap()s. */
+	proc_remove(file->pde);
+	kref_put(&file->refs, release_file);
+}
+
+/* Mappings hold the module, so none are left by now. */
+void jstat_teardown(void)
+{
+	cancel_delayed_work_sync(&refresh_work);
+}
+
 #ifdef UNIT_TESTING
 int jstat_refcount(struct jool_stats *stats)
 {
@@ -1,6 +1,8 @@
 #ifndef SRC_MOD_COMMON_STATS_H_
 #define SRC_MOD_COMMON_STATS_H_
 
+#include <linux/jump_label.h>
+#include <linux/sched/clock.h>
 #include "common/stats.h"
 #include "mod/common/packet.h"
 
@@ -13,8 +15,90 @@ void jstat_put(struct jool_stats *stats);
 void jstat_inc(struct jool_stats *stats, enum jool_stat_id stat);
 void jstat_dec(struct jool_stats *stats, enum jool_stat_id stat);
 void jstat_add(struct jool_stats *stats, enum jool_stat_id stat, int addend);
+void jstat_set(struct jool_stats *stats, enum jool_stat_id stat, __u64 value);
+void jstat_flush(struct jool_stats *stats, __u16 const *ids,
+		unsigned int count, enum jool_stat_id bytes_id,
+		unsigned int bytes);
 
 __u64 *jstat_query(struct jool_stats *stats);
+__u64 jstat_query_one(struct jool_stats *stats, enum jool_stat_id id);
+void jstat_query_percpu(struct jool_stats *stats, enum jool_stat_id id,
+		__u64 *result);
+
+/*
+ * Latency histograms.
+ *
+ * They are off by default, because they need two clock reads per stage. They
+ * are enabled (for all instances) through the latency_stats module parameter;
+ * until then, each stage only pays for a static key check.
+ */
+
+DECLARE_STATIC_KEY_FALSE(jstat_latency_key);
+
+/* Returns the time a stage started, or zero if latency stats are disabled. */
+static inline u64 jlat_start(void)
+{
+	return static_branch_unlikely(&jstat_latency_key) ? local_clock() : 0;
+}
+
+void __jlat_stop(struct jool_stats *stats, enum jool_latency_dir dir,
+		enum jool_latency_stage stage, u64 start);
+
+/* Records the latency of a stage that started at @start. */
+static inline void jlat_stop(struct jool_stats *stats,
+		enum jool_latency_dir dir, enum jool_latency_stage stage,
+		u64 start)
+{
+	/* @start is zero if the key was enabled halfway through. */
+	if (static_branch_unlikely(&jstat_latency_key) && start)
+		__jlat_stop(stats, dir, stage, start);
+}
+
+/*
+ * Returns the histograms as an array of JLAT_HISTOGRAM_COUNT * JLAT_BUCKETS
+ * counters; histogram (dir * JLAT_STAGE_COUNT + stage) first. You will have to
+ * free it.
+ */
+__u64 *jstat_query_latency(struct jool_stats *stats);
+
+/*
+ * Session lifetime histograms.
+ *
+ * Also off by default (lifetime_stats module parameter), so the session
+ * removals only pay for a static key check.
+ */
+
+DECLARE_STATIC_KEY_FALSE(jstat_lifetime_key);
+
+static inline bool jlife_enabled(void)
+{
+	return static_branch_unlikely(&jstat_lifetime_key);
+}
+
+/* Records a @duration-jiffy @metric. Call only if jlife_enabled(). */
+void jlife_record(struct jool_stats *stats, enum jool_lifetime_metric metric,
+		enum jool_lifetime_class class, unsigned long duration);
+
+/*
+ * Returns the histograms as an array of JLIFE_HISTOGRAM_COUNT * JLIFE_BUCKETS
+ * counters; histogram (metric * JLIFE_CLASS_COUNT + class) first. You will
+ * have to free it.
+ */
+__u64 *jstat_query_lifetimes(struct jool_stats *stats);
+
+/* Rate estimators. (See enum jool_rate_id.) */
+void jstat_rates_update(struct jool_stats *stats);
+void jstat_query_rates(struct jool_stats *stats, __u64 *result);
+__u64 jstat_rate(struct jool_stats *stats, enum jool_rate_id id);
+
+struct jstat_file;
+struct proc_dir_entry;
+
+struct jstat_file *jstat_file_create(struct jool_stats *stats,
+		char const *name, struct proc_dir_entry *parent);
+void jstat_file_retarget(struct jstat_file *file, struct jool_stats *stats);
+void jstat_file_destroy(struct jstat_file *file);
+void jstat_teardown(void);
 
 #ifdef UNIT_TESTING
 int jstat_refcount(struct jool_stats *stats);
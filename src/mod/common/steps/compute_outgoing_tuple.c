@@ -15,7 +15,7 @@ static verdict find_bib(struct xlation *state)
 	if (state->entries.bib_set)
 		return VERDICT_CONTINUE;
 
-	error = bib_find(state->jool.nat64.bib, &state->in.tuple,
+	error = bib_find(state->jool->nat64.bib, &state->in.tuple,
 			&state->entries);
 	if (error) {
 		/*
@@ -35,7 +35,7 @@ static int xlat_addr64(struct xlation *state, struct ipv4_transport_addr *addr4)
 	struct ipv6_transport_addr *d = &state->in.tuple.dst.addr6;
 
 	addr4->l4 = d->l4;
-	return __rfc6052_6to4(&state->jool.globals.pool6.prefix,
+	return __rfc6052_6to4(xlator_pool6(state->jool, state->pool6_index),
 			&d->l3, &addr4->l3);
 }
 
@@ -45,7 +45,7 @@ static int xlat_addr46(struct xlation *state, struct ipv6_transport_addr *addr6)
 	struct ipv4_transport_addr *s = &state->in.tuple.src.addr4;
 
 	addr6->l4 = s->l4;
-	return __rfc6052_4to6(&state->jool.globals.pool6.prefix,
+	return __rfc6052_4to6(&state->jool->fast.pool6,
 			&s->l3, &addr6->l3);
 }
 
@@ -64,12 +64,19 @@ verdict compute_out_tuple(struct xlation *state)
 	in = &state->in.tuple;
 	out = &state->out.tuple;
 
+	/*
+	 * If filtering found the session, its copy already has the translated
+	 * addresses; the RFC 6052 translations below would only rebuild them.
+	 * (ICMP errors only get the BIB entry.)
+	 */
 	switch (in->l3_proto) {
 	case L3PROTO_IPV6:
 		out->l3_proto = L3PROTO_IPV4;
 		out->l4_proto = in->l4_proto;
 		out->src.addr4 = state->entries.session.src4;
-		if (xlat_addr64(state, &out->dst.addr4))
+		if (state->entries.session_set)
+			out->dst.addr4 = state->entries.session.dst4;
+		else if (xlat_addr64(state, &out->dst.addr4))
 			return untranslatable(state, JSTAT_UNTRANSLATABLE_DST6);
 
 		if (is_3_tuple(out))
@@ -79,7 +86,9 @@ verdict compute_out_tuple(struct xlation *state)
 	case L3PROTO_IPV4:
 		out->l3_proto = L3PROTO_IPV6;
 		out->l4_proto = in->l4_proto;
-		if (xlat_addr46(state, &out->src.addr6))
+		if (state->entries.session_set)
+			out->src.addr6 = state->entries.session.dst6;
+		else if (xlat_addr46(state, &out->src.addr6))
 			return untranslatable(state, JSTAT_UNTRANSLATABLE_DST4);
 		out->dst.addr6 = state->entries.session.src6;
 
@@ -1,20 +1,138 @@
 #include "mod/common/steps/compute_outgoing_tuple.h"
 
 #include "mod/common/address_xlat.h"
+#include "mod/common/ipv6_hdr_iterator.h"
 #include "mod/common/log.h"
 #include "mod/common/db/eam.h"
 #include "mod/common/db/rfc6791v4.h"
 #include "mod/common/db/rfc6791v6.h"
 
+/*
+ * MAP-T rules need the port (or ICMP identifier) that travels with the
+ * translated address. SIIT doesn't summarize tuples, so these read it from the
+ * headers. They fail if there's none (eg. subsequent fragments).
+ */
+
+static bool read_port(__u8 proto, void const *l4, bool src, __u16 *port)
+{
+	switch (proto) {
+	case IPPROTO_TCP:
+		*port = be16_to_cpu(src
+				? ((struct tcphdr const *)l4)->source
+				: ((struct tcphdr const *)l4)->dest);
+		return true;
+	case IPPROTO_UDP:
+		*port = be16_to_cpu(src
+				? ((struct udphdr const *)l4)->source
+				: ((struct udphdr const *)l4)->dest);
+		return true;
+	case IPPROTO_ICMP:
+	case NEXTHDR_ICMP:
+		/* ICMPv4's and ICMPv6's echo identifiers share an offset. */
+		*port = be16_to_cpu(((struct icmp6hdr const *)l4)->icmp6_identifier);
+		return true;
+	}
+
+	return false;
+}
+
+static bool read_port6(struct ipv6hdr const *hdr6, bool src, __u16 *port)
+{
+	struct hdr_iterator iterator = HDR_ITERATOR_INIT(hdr6);
+
+	if (!is_first_frag6(hdr_iterator_find(hdr6, NEXTHDR_FRAGMENT)))
+		return false;
+
+	hdr_iterator_last(&iterator);
+	return read_port(iterator.hdr_type, iterator.data, src, port);
+}
+
+static bool read_port4(struct iphdr const *hdr4, bool src, __u16 *port)
+{
+	if (!is_first_frag4(hdr4))
+		return false;
+	return read_port(hdr4->protocol, (void const *)hdr4 + 4 * hdr4->ihl,
+			src, port);
+}
+
+/*
+ * ICMP errors borrow the port from their inner packet, whose addresses are
+ * the outer ones, swapped.
+ */
+static bool get_port6(struct packet *in, bool src, __u16 *port)
+{
+	return pkt_is_icmp6_error(in)
+			? read_port6(pkt_payload(in), !src, port)
+			: read_port6(pkt_ip6_hdr(in), src, port);
+}
+
+static bool get_port4(struct packet *in, bool src, __u16 *port)
+{
+	return pkt_is_icmp4_error(in)
+			? read_port4(pkt_payload(in), !src, port)
+			: read_port4(pkt_ip4_hdr(in), src, port);
+}
+
+/*
+ * If @addr6 was translated by a MAP-T rule, drops the packet unless the port
+ * belongs to the Port Set the address embeds.
+ *
+ * Packets without ports are let through, since they cannot be validated
+ * without state.
+ */
+static verdict map64(struct xlation *state, struct in6_addr const *addr6,
+		struct result_addrxlat64 *result, bool src)
+{
+	__u16 port;
+
+	if (result->entry.method != AXM_EAMT || !eamt_is_map(&result->entry.eam))
+		return VERDICT_CONTINUE;
+	if (!get_port6(&state->in, src, &port))
+		return VERDICT_CONTINUE;
+
+	if (!eamt_map_port_matches(&result->entry.eam, addr6, port)) {
+		log_debug(state, "Port %u is outside of %pI6c's Port Set.",
+				port, addr6);
+		return drop(state, JSTAT_MAP_PORT);
+	}
+
+	return VERDICT_CONTINUE;
+}
+
+/*
+ * If @addr4 was translated by a MAP-T rule, embeds the Port Set ID of its port
+ * into @result.
+ */
+static verdict map46(struct xlation *state, __be32 addr4,
+		struct result_addrxlat46 *result, bool src)
+{
+	struct in_addr tmp = { .s_addr = addr4 };
+	__u16 port;
+
+	if (result->entry.method != AXM_EAMT || !eamt_is_map(&result->entry.eam))
+		return VERDICT_CONTINUE;
+
+	if (!get_port4(&state->in, src, &port)
+			|| eamt_map_4to6(&result->entry.eam, &tmp, port,
+					&result->addr)) {
+		log_debug(state, "%pI4 matches a MAP-T rule, but its port is missing or outside of the rule's Port Sets.",
+				&tmp);
+		return drop(state, JSTAT_MAP_PORT);
+	}
+
+	return VERDICT_CONTINUE;
+}
+
 verdict translate_addrs64_siit(struct xlation *state, __be32 *src_out,
 		__be32 *dst_out)
 {
 	struct ipv6hdr *hdr6 = pkt_ip6_hdr(&state->in);
 	struct result_addrxlat64 src, dst;
 	struct addrxlat_result addr_result;
+	verdict result;
 
 	/* Dst address. (SRC DEPENDS CON DST, SO WE NEED TO XLAT DST FIRST!) */
-	addr_result = addrxlat_siit64(&state->jool, &hdr6->daddr, &dst, true);
+	addr_result = addrxlat_siit64(state->jool, &hdr6->daddr, &dst, true);
 	if (addr_result.reason) {
 		log_debug(state, "Unable to translate %pI6c: %s", &hdr6->daddr,
 				addr_result.reason);
@@ -33,7 +151,7 @@ verdict translate_addrs64_siit(struct xlation *state, __be32 *src_out,
 	}
 
 	/* Src address. */
-	addr_result = addrxlat_siit64(&state->jool, &hdr6->saddr, &src,
+	addr_result = addrxlat_siit64(state->jool, &hdr6->saddr, &src,
 			!pkt_is_icmp6_error(&state->in));
 	if (addr_result.reason) {
 		log_debug(state, "Unable to translate %pI6c: %s", &hdr6->saddr,
@@ -56,6 +174,11 @@ verdict translate_addrs64_siit(struct xlation *state, __be32 *src_out,
 		return drop(state, JSTAT_UNKNOWN);
 	}
 
+	/* Only the source; it's the one the CE could be spoofing. */
+	result = map64(state, &hdr6->saddr, &src, true);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
 	*src_out = src.addr.s_addr;
 
 	/*
@@ -63,8 +186,8 @@ verdict translate_addrs64_siit(struct xlation *state, __be32 *src_out,
 	 * Why here? It's the only place where we know whether RFC 6052 was
 	 * involved.
 	 */
-	if (state->jool.globals.siit.eam_hairpin_mode == EHM_INTRINSIC) {
-		struct eam_table *eamt = state->jool.siit.eamt;
+	if (state->jool->fast.eam_hairpin_mode == EHM_INTRINSIC) {
+		struct eam_table *eamt = state->jool->siit.eamt;
 		/* Condition set A */
 		if (pkt_is_outer(&state->in) && !pkt_is_icmp6_error(&state->in)
 				&& (dst.entry.method == AXM_RFC6052)
@@ -109,13 +232,14 @@ verdict translate_addrs46_siit(struct xlation *state, struct in6_addr *src_out,
 	bool is_hairpin;
 	struct result_addrxlat46 addr6;
 	struct addrxlat_result addr_result;
+	verdict result;
 
-	is_hairpin = (state->jool.globals.siit.eam_hairpin_mode == EHM_SIMPLE)
+	is_hairpin = (state->jool->fast.eam_hairpin_mode == EHM_SIMPLE)
 			|| state->is_hairpin;
 
 	/* Dst address. (SRC DEPENDS CON DST, SO WE NEED TO XLAT DST FIRST!) */
 
-	addr_result = addrxlat_siit46(&state->jool, hdr4->daddr, &addr6,
+	addr_result = addrxlat_siit46(state->jool, hdr4->daddr, &addr6,
 			!disable_dst_eam(in, is_hairpin), true);
 	if (addr_result.reason) {
 		log_debug(state, "Unable to translate %pI4: %s", &hdr4->daddr,
@@ -124,6 +248,9 @@ verdict translate_addrs46_siit(struct xlation *state, struct in6_addr *src_out,
 
 	switch (addr_result.verdict) {
 	case ADDRXLAT_CONTINUE:
+		result = map46(state, hdr4->daddr, &addr6, false);
+		if (result != VERDICT_CONTINUE)
+			return result;
 		*dst_out = addr6.addr;
 		break;
 	case ADDRXLAT_TRY_SOMETHING_ELSE:
@@ -134,7 +261,7 @@ verdict translate_addrs46_siit(struct xlation *state, struct in6_addr *src_out,
 	}
 
 	/* Src address. */
-	addr_result = addrxlat_siit46(&state->jool, hdr4->saddr, &addr6,
+	addr_result = addrxlat_siit46(state->jool, hdr4->saddr, &addr6,
 			!disable_src_eam(in, is_hairpin),
 			!pkt_is_icmp4_error(in));
 	if (addr_result.reason) {
@@ -158,6 +285,10 @@ verdict translate_addrs46_siit(struct xlation *state, struct in6_addr *src_out,
 		return drop(state, JSTAT_UNKNOWN);
 	}
 
+	result = map46(state, hdr4->saddr, &addr6, true);
+	if (result != VERDICT_CONTINUE)
+		return result;
+
 	*src_out = addr6.addr;
 
 	log_debug(state, "Result: %pI6c->%pI6c", src_out, dst_out);
@@ -1,9 +1,9 @@
 #include "mod/common/steps/determine_incoming_tuple.h"
 
 #include "mod/common/icmp_wrapper.h"
-#include "mod/common/ipv6_hdr_iterator.h"
 #include "mod/common/log.h"
 #include "mod/common/stats.h"
+#include "mod/common/db/fragdb.h"
 
 /*
  * There are several points in this module where the RFC says "drop the packet",
@@ -37,103 +37,67 @@ static void const *ipv4_extract_l4_hdr(struct iphdr const *hdr_ipv4)
  * garbage.
  * Either way, Linux should be the one who decides the fate of the ICMP error.
  */
-static verdict unknown_inner_proto(struct xlation *state, __u8 proto)
+static verdict unknown_inner_proto(struct xlation *state)
 {
-	log_debug(state, "Packet's inner packet is not UDP, TCP or ICMP (%u).",
-			proto);
+	log_debug(state, "Packet's inner packet is not UDP, TCP or ICMP.");
 	return untranslatable(state, JSTAT_UNKNOWN_PROTO_INNER);
 }
 
-static void ipv4_udp(struct xlation *state)
+/*
+ * Subsequent fragments only reach NAT64 in fragment tracking mode. They don't
+ * carry ports, so only the UDP ones the fragment cache knows can be handled.
+ * (TCP would also need the flags for the state machine.)
+ */
+static verdict not_udp_fragment(struct xlation *state)
 {
-	struct packet *pkt = &state->in;
-	struct tuple *tuple4 = &pkt->tuple;
-
-	tuple4->src.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->saddr;
-	tuple4->src.addr4.l4 = be16_to_cpu(pkt_udp_hdr(pkt)->source);
-	tuple4->dst.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->daddr;
-	tuple4->dst.addr4.l4 = be16_to_cpu(pkt_udp_hdr(pkt)->dest);
-	tuple4->l3_proto = L3PROTO_IPV4;
-	tuple4->l4_proto = L4PROTO_UDP;
+	log_debug(state, "Subsequent fragment is not UDP; cannot track it.");
+	return drop(state, JSTAT_FRAG_NOT_UDP);
 }
 
-static void ipv4_tcp(struct xlation *state)
-{
-	struct packet *pkt = &state->in;
-	struct tuple *tuple4 = &pkt->tuple;
+/*
+ * Note: pkt_init_ipv4() and pkt_init_ipv6() already filled the tuple while
+ * summarizing the packet; these functions only deal with the cases it can't.
+ */
 
-	tuple4->src.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->saddr;
-	tuple4->src.addr4.l4 = be16_to_cpu(pkt_tcp_hdr(pkt)->source);
-	tuple4->dst.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->daddr;
-	tuple4->dst.addr4.l4 = be16_to_cpu(pkt_tcp_hdr(pkt)->dest);
-	tuple4->l3_proto = L3PROTO_IPV4;
-	tuple4->l4_proto = L4PROTO_TCP;
+static verdict ipv4_udp(struct xlation *state)
+{
+	return is_first_frag4(pkt_ip4_hdr(&state->in))
+			? VERDICT_CONTINUE
+			: fragdb_find(state);
 }
 
-static verdict ipv4_icmp_info(struct xlation *state)
+static verdict ipv4_tcp(struct xlation *state)
 {
-	struct packet *pkt = &state->in;
-	struct tuple *tuple4 = &pkt->tuple;
-
-	tuple4->src.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->saddr;
-	tuple4->src.addr4.l4 = be16_to_cpu(pkt_icmp4_hdr(pkt)->un.echo.id);
-	tuple4->dst.addr4.l3.s_addr = pkt_ip4_hdr(pkt)->daddr;
-	tuple4->dst.addr4.l4 = tuple4->src.addr4.l4;
-	tuple4->l3_proto = L3PROTO_IPV4;
-	tuple4->l4_proto = L4PROTO_ICMP;
-
-	return VERDICT_CONTINUE;
+	return is_first_frag4(pkt_ip4_hdr(&state->in))
+			? VERDICT_CONTINUE
+			: not_udp_fragment(state);
 }
 
 static verdict ipv4_icmp_err(struct xlation *state)
 {
-	struct tuple *tuple4 = &state->in.tuple;
-	union {
-		struct iphdr const *ip4;
-		struct udphdr const *udp;
-		struct tcphdr const *tcp;
-		struct icmphdr const *icmp;
-	} inner;
-
-	inner.ip4 = (struct iphdr *)(pkt_icmp4_hdr(&state->in) + 1);
-	tuple4->src.addr4.l3.s_addr = inner.ip4->daddr;
-	tuple4->dst.addr4.l3.s_addr = inner.ip4->saddr;
+	struct iphdr const *inner4;
+	struct icmphdr const *icmp;
 
-	switch (inner.ip4->protocol) {
-	case IPPROTO_UDP:
-		inner.udp = ipv4_extract_l4_hdr(inner.ip4);
-		tuple4->src.addr4.l4 = be16_to_cpu(inner.udp->dest);
-		tuple4->dst.addr4.l4 = be16_to_cpu(inner.udp->source);
-		tuple4->l4_proto = L4PROTO_UDP;
-		break;
-
-	case IPPROTO_TCP:
-		inner.tcp = ipv4_extract_l4_hdr(inner.ip4);
-		tuple4->src.addr4.l4 = be16_to_cpu(inner.tcp->dest);
-		tuple4->dst.addr4.l4 = be16_to_cpu(inner.tcp->source);
-		tuple4->l4_proto = L4PROTO_TCP;
-		break;
+	inner4 = (struct iphdr *)(pkt_icmp4_hdr(&state->in) + 1);
 
-	case IPPROTO_ICMP:
-		inner.icmp = ipv4_extract_l4_hdr(inner.ip4);
+	switch (state->in.tuple.l4_proto) {
+	case L4PROTO_UDP:
+	case L4PROTO_TCP:
+		return VERDICT_CONTINUE;
 
-		if (is_icmp4_error(inner.icmp->type)) {
+	case L4PROTO_ICMP:
+		icmp = ipv4_extract_l4_hdr(inner4);
+		if (is_icmp4_error(icmp->type)) {
 			log_debug(state, "Bogus pkt: ICMP error inside ICMP error.");
 			return drop(state, JSTAT_DOUBLE_ICMP4_ERROR);
 		}
+		return VERDICT_CONTINUE;
 
-		tuple4->src.addr4.l4 = be16_to_cpu(inner.icmp->un.echo.id);
-		tuple4->dst.addr4.l4 = tuple4->src.addr4.l4;
-		tuple4->l4_proto = L4PROTO_ICMP;
+	case L4PROTO_OTHER:
 		break;
-
-	default:
-		return unknown_inner_proto(state, inner.ip4->protocol);
 	}
 
-	tuple4->l3_proto = L3PROTO_IPV4;
-
-	return VERDICT_CONTINUE;
+	return unknown_inner_proto(state);
 }
 
 static verdict ipv4_icmp(struct xlation *state)
@@ -141,7 +105,7 @@ static verdict ipv4_icmp(struct xlation *state)
 	__u8 type = pkt_icmp4_hdr(&state->in)->type;
 
 	if (is_icmp4_info(type))
-		return ipv4_icmp_info(state);
+		return VERDICT_CONTINUE;
 	if (is_icmp4_error(type))
 		return ipv4_icmp_err(state);
 
@@ -153,104 +117,29 @@ static verdict ipv4_icmp(struct xlation *state)
 	return untranslatable(state, JSTAT_UNKNOWN_ICMP4_TYPE);
 }
 
-static void ipv6_udp(struct xlation *state)
+static verdict ipv6_udp(struct xlation *state)
 {
-	struct packet *pkt = &state->in;
-	struct tuple *tuple6 = &pkt->tuple;
-
-	tuple6->src.addr6.l3 = pkt_ip6_hdr(pkt)->saddr;
-	tuple6->src.addr6.l4 = be16_to_cpu(pkt_udp_hdr(pkt)->source);
-	tuple6->dst.addr6.l3 = pkt_ip6_hdr(pkt)->daddr;
-	tuple6->dst.addr6.l4 = be16_to_cpu(pkt_udp_hdr(pkt)->dest);
-	tuple6->l3_proto = L3PROTO_IPV6;
-	tuple6->l4_proto = L4PROTO_UDP;
-}
-
-static void ipv6_tcp(struct xlation *state)
-{
-	struct packet *pkt = &state->in;
-	struct tuple *tuple6 = &pkt->tuple;
-
-	tuple6->src.addr6.l3 = pkt_ip6_hdr(pkt)->saddr;
-	tuple6->src.addr6.l4 = be16_to_cpu(pkt_tcp_hdr(pkt)->source);
-	tuple6->dst.addr6.l3 = pkt_ip6_hdr(pkt)->daddr;
-	tuple6->dst.addr6.l4 = be16_to_cpu(pkt_tcp_hdr(pkt)->dest);
-	tuple6->l3_proto = L3PROTO_IPV6;
-	tuple6->l4_proto = L4PROTO_TCP;
+	return is_first_frag6(pkt_frag_hdr(&state->in))
+			? VERDICT_CONTINUE
+			: fragdb_find(state);
 }
 
-static verdict ipv6_icmp_info(struct xlation *state)
+static verdict ipv6_tcp(struct xlation *state)
 {
-	struct packet *pkt = &state->in;
-	struct tuple *tuple6 = &pkt->tuple;
-	__u16 id = be16_to_cpu(pkt_icmp6_hdr(pkt)->icmp6_identifier);
-
-	tuple6->src.addr6.l3 = pkt_ip6_hdr(pkt)->saddr;
-	tuple6->src.addr6.l4 = id;
-	tuple6->dst.addr6.l3 = pkt_ip6_hdr(pkt)->daddr;
-	tuple6->dst.addr6.l4 = id;
-	tuple6->l3_proto = L3PROTO_IPV6;
-	tuple6->l4_proto = L4PROTO_ICMP;
-
-	return VERDICT_CONTINUE;
+	return is_first_frag6(pkt_frag_hdr(&state->in))
+			? VERDICT_CONTINUE
+			: not_udp_fragment(state);
 }
 
+/*
+ * ICMPv6 errors inside ICMPv6 errors never get this far; pkt_init_ipv6()
+ * already rejected them while validating the inner packet.
+ */
 static verdict ipv6_icmp_err(struct xlation *state)
 {
-	struct packet *pkt = &state->in;
-	struct tuple *tuple6 = &pkt->tuple;
-	struct hdr_iterator iterator;
-	union {
-		struct ipv6hdr const *ip6;
-		struct udphdr const *udp;
-		struct tcphdr const *tcp;
-		struct icmp6hdr const *icmp;
-	} inner;
-	__u16 id;
-
-	inner.ip6 = (struct ipv6hdr *)(pkt_icmp6_hdr(pkt) + 1);
-	tuple6->src.addr6.l3 = inner.ip6->daddr;
-	tuple6->dst.addr6.l3 = inner.ip6->saddr;
-
-	hdr_iterator_init(&iterator, inner.ip6);
-	hdr_iterator_last(&iterator);
-
-	switch (iterator.hdr_type) {
-	case NEXTHDR_UDP:
-		inner.udp = iterator.data;
-		tuple6->src.addr6.l4 = be16_to_cpu(inner.udp->dest);
-		tuple6->dst.addr6.l4 = be16_to_cpu(inner.udp->source);
-		tuple6->l4_proto = L4PROTO_UDP;
-		break;
-
-	case NEXTHDR_TCP:
-		inner.tcp = iterator.data;
-		tuple6->src.addr6.l4 = be16_to_cpu(inner.tcp->dest);
-		tuple6->dst.addr6.l4 = be16_to_cpu(inner.tcp->source);
-		tuple6->l4_proto = L4PROTO_TCP;
-		break;
-
-	case NEXTHDR_ICMP:
-		inner.icmp = iterator.data;
-
-		if (is_icmp6_error(inner.icmp->icmp6_type)) {
-			log_debug(state, "Bogus pkt: ICMP error inside ICMP error.");
-			return drop(state, JSTAT_DOUBLE_ICMP6_ERROR);
-		}
-
-		id = be16_to_cpu(inner.icmp->icmp6_identifier);
-		tuple6->src.addr6.l4 = id;
-		tuple6->dst.addr6.l4 = id;
-		tuple6->l4_proto = L4PROTO_ICMP;
-		break;
-
-	default:
-		return unknown_inner_proto(state, iterator.hdr_type);
-	}
-
-	tuple6->l3_proto = L3PROTO_IPV6;
-
-	return VERDICT_CONTINUE;
+	return (state->in.tuple.l4_proto != L4PROTO_OTHER)
+			? VERDICT_CONTINUE
+			: unknown_inner_proto(state);
 }
 
 static verdict ipv6_icmp(struct xlation *state)
@@ -258,7 +147,7 @@ static verdict ipv6_icmp(struct xlation *state)
 	__u8 type = pkt_icmp6_hdr(&state->in)->icmp6_type;
 
 	if (is_icmp6_info(type))
-		return ipv6_icmp_info(state);
+		return VERDICT_CONTINUE;
 	if (is_icmp6_error(type))
 		return ipv6_icmp_err(state);
 
@@ -274,10 +163,9 @@ static verdict ipv6_icmp(struct xlation *state)
 }
 
 /**
- * Extracts relevant data from "skb" and stores it in the "tuple" tuple.
+ * Validates the tuple pkt_init_ipv4() or pkt_init_ipv6() extracted from
+ * @state->in, and completes it if the packet is a subsequent fragment.
  *
- * @param skb packet the data will be extracted from.
- * @param tuple this function will populate this value using "skb"'s contents.
  * @return whether packet processing should continue.
  */
 verdict determine_in_tuple(struct xlation *state)
@@ -290,10 +178,10 @@ verdict determine_in_tuple(struct xlation *state)
 	case L3PROTO_IPV4:
 		switch (pkt_l4_proto(&state->in)) {
 		case L4PROTO_UDP:
-			ipv4_udp(state);
+			result = ipv4_udp(state);
 			break;
 		case L4PROTO_TCP:
-			ipv4_tcp(state);
+			result = ipv4_tcp(state);
 			break;
 		case L4PROTO_ICMP:
 			result = ipv4_icmp(state);
@@ -306,10 +194,10 @@ verdict determine_in_tuple(struct xlation *state)
 	case L3PROTO_IPV6:
 		switch (pkt_l4_proto(&state->in)) {
 		case L4PROTO_UDP:
-			ipv6_udp(state);
+			result = ipv6_udp(state);
 			break;
 		case L4PROTO_TCP:
-			ipv6_tcp(state);
+			result = ipv6_tcp(state);
 			break;
 		case L4PROTO_ICMP:
 			result = ipv6_icmp(state);
@@ -15,6 +15,7 @@
 #include "mod/common/rfc7915/6to4.h"
 #include "mod/common/joold.h"
 #include "mod/common/db/pool4/db.h"
+#include "mod/common/db/talkers.h"
 #include "mod/common/db/bib/db.h"
 
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
@@ -92,19 +93,23 @@ static verdict succeed(struct xlation *state)
 	 * So let's simplify everything by just joold_add()ing here.
 	 */
 	if (state->entries.session_set)
-		joold_add(&state->jool, &state->entries.session);
+		joold_add(state->jool, &state->entries.session);
 
 	return VERDICT_CONTINUE;
 }
 
 /**
  * This is just a wrapper. Its sole intent is to minimize mess below.
+ *
+ * filtering_and_updating() already made sure the destination address belongs
+ * to one of the pool6 prefixes, and ICMP errors don't make it this far.
  */
 static int xlat_dst_6to4(struct xlation *state,
 		struct ipv4_transport_addr *dst4)
 {
 	dst4->l4 = state->in.tuple.dst.addr6.l4;
-	return __rfc6052_6to4(&state->jool.globals.pool6.prefix,
+	return __rfc6052_6to4_nocheck(
+			xlator_pool6(state->jool, state->pool6_index),
 			&state->in.tuple.dst.addr6.l3, &dst4->l3);
 }
 
@@ -126,10 +131,12 @@ static verdict ipv6_simple(struct xlation *state)
 
 	if (xlat_dst_6to4(state, &dst4))
 		return drop(state, JSTAT_UNTRANSLATABLE_DST6);
+	if (bib_refresh6(state, &dst4))
+		return succeed(state);
 	result = mask_domain_find(state, &masks);
 	if (result != VERDICT_CONTINUE) {
 		log_debug(state, "There is no mask domain mapped to mark %u.",
-				state->in.skb->mark);
+				mask_domain_mark(state));
 		return result;
 	}
 
@@ -140,6 +147,15 @@ static verdict ipv6_simple(struct xlation *state)
 	switch (error) {
 	case 0:
 		return succeed(state);
+	case -EDQUOT:
+		log_debug(state, "The subscriber has reached its quota.");
+		return drop(state, JSTAT_SUBSCRIBER_QUOTA);
+	case -EBUSY:
+		log_debug(state, "The subscriber is opening sessions too fast.");
+		return drop(state, JSTAT_SUBSCRIBER_SESSION_RATE);
+	case -EAGAIN:
+		log_debug(state, "The CPU is overloaded; refusing the new session.");
+		return drop(state, JSTAT_OVERLOAD_SHED);
 	default:
 		/*
 		 * Error msg already printed, but since bib_add6() sprawls
@@ -171,7 +187,7 @@ static verdict ipv4_simple(struct xlation *state)
 	struct ipv6_transport_addr dst6;
 	int error;
 
-	if (__rfc6052_4to6(&state->jool.globals.pool6.prefix,
+	if (__rfc6052_4to6(&state->jool->fast.pool6,
 			&dst4->l3, &dst6.l3))
 		return drop(state, JSTAT_UNTRANSLATABLE_DST4);
 	dst6.l4 = dst4->l4;
@@ -188,6 +204,9 @@ static verdict ipv4_simple(struct xlation *state)
 	case -EPERM:
 		log_debug(state, "Packet was blocked by Address-Dependent Filtering.");
 		return drop_icmp(state, JSTAT_ADF, ICMPERR_FILTER, 0);
+	case -EDQUOT:
+		log_debug(state, "The subscriber has reached its session quota.");
+		return drop(state, JSTAT_SUBSCRIBER_QUOTA);
 	default:
 		log_debug(state, "Errcode %d while finding a BIB entry.", error);
 		return drop(state, JSTAT_UNKNOWN);
@@ -331,7 +350,7 @@ static enum session_fate tcp_established_state(struct session_entry *session,
 
 static bool handle_rst_during_fin_rcv(struct xlation *state)
 {
-	return state->jool.globals.nat64.handle_rst_during_fin_rcv;
+	return state->jool->fast.handle_rst_during_fin_rcv;
 }
 
 /**
@@ -443,10 +462,12 @@ static verdict ipv6_tcp(struct xlation *state)
 
 	if (xlat_dst_6to4(state, &dst4))
 		return drop(state, JSTAT_UNTRANSLATABLE_DST6);
+	if (bib_refresh6(state, &dst4))
+		return succeed(state);
 	result = mask_domain_find(state, &masks);
 	if (result != VERDICT_CONTINUE) {
 		log_debug(state, "There is no mask domain mapped to mark %u.",
-				state->in.skb->mark);
+				mask_domain_mark(state));
 		return result;
 	}
 
@@ -469,7 +490,7 @@ static verdict ipv4_tcp(struct xlation *state)
 	struct collision_cb cb;
 	verdict result;
 
-	if (__rfc6052_4to6(&state->jool.globals.pool6.prefix,
+	if (__rfc6052_4to6(&state->jool->fast.pool6,
 			&dst4->l3, &dst6.l3))
 		return drop(state, JSTAT_UNTRANSLATABLE_DST4);
 	dst6.l4 = dst4->l4;
@@ -481,9 +502,6 @@ static verdict ipv4_tcp(struct xlation *state)
 	return (result == VERDICT_CONTINUE) ? succeed(state) : result;
 }
 
-#define pool6_contains(state, addr) \
-	prefix6_contains(&(state)->jool.globals.pool6.prefix, addr)
-
 /**
  * filtering_and_updating - Main F&U routine. Decides if "skb" should be
  * processed, updating binding and session information.
@@ -492,6 +510,7 @@ verdict filtering_and_updating(struct xlation *state)
 {
 	struct packet *in = &state->in;
 	struct ipv6hdr *hdr_ip6;
+	int pool6_index;
 	verdict result = VERDICT_CONTINUE;
 
 	log_debug(state, "Step 2: Filtering and Updating");
@@ -500,14 +519,23 @@ verdict filtering_and_updating(struct xlation *state)
 	case L3PROTO_IPV6:
 		/* Get rid of hairpinning loops and unwanted packets. */
 		hdr_ip6 = pkt_ip6_hdr(in);
-		if (pool6_contains(state, &hdr_ip6->saddr)) {
+		if (xlator_pool6_find(state->jool, &hdr_ip6->saddr) >= 0) {
 			log_debug(state, "Hairpinning loop. Dropping...");
 			return drop(state, JSTAT_HAIRPIN_LOOP);
 		}
-		if (!pool6_contains(state, &hdr_ip6->daddr)) {
+		pool6_index = xlator_pool6_find(state->jool, &hdr_ip6->daddr);
+		if (pool6_index < 0) {
 			log_debug(state, "Packet does not belong to pool6.");
 			return untranslatable(state, JSTAT_POOL6_MISMATCH);
 		}
+		state->pool6_index = pool6_index;
+
+		/* Before anything else has a chance to spend CPU on it. */
+		if (state->jool->fast.subscriber_packet_rate
+				&& !bib_police6(state)) {
+			log_debug(state, "The subscriber exceeded its packet rate.");
+			return drop(state, JSTAT_SUBSCRIBER_PACKET_RATE);
+		}
 
 		/* ICMP errors should not be filtered nor affect the tables. */
 		if (pkt_is_icmp6_error(in)) {
@@ -517,7 +545,7 @@ verdict filtering_and_updating(struct xlation *state)
 		break;
 	case L3PROTO_IPV4:
 		/* Get rid of unexpected packets */
-		if (!pool4db_contains(state->jool.nat64.pool4, state->jool.ns,
+		if (!pool4db_contains(state->jool->nat64.pool4, state->jool->ns,
 				in->tuple.l4_proto, &in->tuple.dst.addr4)) {
 			log_debug(state, "Packet does not belong to pool4.");
 			return untranslatable(state, JSTAT_POOL4_MISMATCH);
@@ -564,7 +592,7 @@ verdict filtering_and_updating(struct xlation *state)
 	case L4PROTO_ICMP:
 		switch (pkt_l3_proto(in)) {
 		case L3PROTO_IPV6:
-			if (state->jool.globals.nat64.drop_icmp6_info) {
+			if (state->jool->fast.drop_icmp6_info) {
 				log_debug(state, "Packet is ICMPv6 info (ping); dropping due to policy.");
 				return drop(state, JSTAT_ICMP6_FILTER);
 			}
@@ -582,6 +610,11 @@ verdict filtering_and_updating(struct xlation *state)
 		return drop(state, JSTAT_UNKNOWN_L4_PROTO);
 	}
 
+	/* Both directions count against the subscriber. */
+	if (result == VERDICT_CONTINUE && state->entries.bib_set)
+		talkers_add(state->jool, &state->entries.session.src6.l3,
+				JTALK_BYTES, state->in.skb->len);
+
 	log_debug(state, "Done: Step 2.");
 	return result;
 }
@@ -0,0 +1,33 @@
+#ifndef SRC_MOD_COMMON_STEPS_HANDLING_HAIRPINNING_H_
+#define SRC_MOD_COMMON_STEPS_HANDLING_HAIRPINNING_H_
+
+/**
+ * @file
+ * Picks the instance type's hairpinning functions. (Direct calls, because
+ * retpolines make indirect ones expensive in the packet path.)
+ */
+
+#include "mod/common/translation_state.h"
+#include "mod/common/steps/handling_hairpinning_nat64.h"
+#include "mod/common/steps/handling_hairpinning_siit.h"
+
+static inline bool is_hairpin(struct xlation *state)
+{
+#ifdef JOOL_NO_HAIRPINNING
+	/* Hairpinned packets are sent as they are; Linux routes them back. */
+	return false;
+#else
+	return xlation_is_nat64(state)
+			? is_hairpin_nat64(state)
+			: is_hairpin_siit(state);
+#endif
+}
+
+static inline verdict handling_hairpinning(struct xlation *state)
+{
+	return xlation_is_nat64(state)
+			? handling_hairpinning_nat64(state)
+			: handling_hairpinning_siit(state);
+}
+
+#endif /* SRC_MOD_COMMON_STEPS_HANDLING_HAIRPINNING_H_ */
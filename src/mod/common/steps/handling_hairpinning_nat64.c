@@ -28,7 +28,7 @@ bool is_hairpin_nat64(struct xlation *state)
 	 * for its node. It might take a miracle for these packets to exist,
 	 * but hey, why the hell not.
 	 */
-	return pool4db_contains(state->jool.nat64.pool4, state->jool.ns,
+	return pool4db_contains(state->jool->nat64.pool4, state->jool->ns,
 			state->out.tuple.l4_proto, &state->out.tuple.dst.addr4);
 }
 
@@ -40,33 +40,29 @@ bool is_hairpin_nat64(struct xlation *state)
  * @param tuple_in skb_in's tuple.
  * @return whether we managed to U-turn the packet successfully.
  */
-verdict handling_hairpinning_nat64(struct xlation *old)
+verdict handling_hairpinning_nat64(struct xlation *state)
 {
-	struct xlation *new;
+	struct xlation_hairpin bkp;
 	verdict result;
 
-	log_debug(old, "Step 5: Handling Hairpinning...");
+	log_debug(state, "Step 5: Handling Hairpinning...");
 
-	new = xlation_create(&old->jool);
-	if (!new)
-		return VERDICT_DROP;
-	new->in = old->out;
-	new->is_hairpin = true;
+	xlation_hairpin_begin(state, &bkp);
 
-	result = filtering_and_updating(new);
+	result = filtering_and_updating(state);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	result = compute_out_tuple(new);
+	result = compute_out_tuple(state);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	result = translating_the_packet(new);
+	result = translating_the_packet(state);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	result = sendpkt_send(new);
+	result = sendpkt_send(state);
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	log_debug(old, "Done step 5.");
-end:	xlation_destroy(new);
+	log_debug(state, "Done step 5.");
+end:	xlation_hairpin_end(state, &bkp);
 	return result;
 }
@@ -10,27 +10,23 @@ bool is_hairpin_siit(struct xlation *state)
 	return state->is_hairpin;
 }
 
-verdict handling_hairpinning_siit(struct xlation *old)
+verdict handling_hairpinning_siit(struct xlation *state)
 {
-	struct xlation *new;
+	struct xlation_hairpin bkp;
 	verdict result;
 
-	log_debug(old, "Packet is hairpinning. U-turning...");
+	log_debug(state, "Packet is hairpinning. U-turning...");
 
-	new = xlation_create(&old->jool);
-	if (!new)
-		return VERDICT_DROP;
-	new->in = old->out;
-	new->is_hairpin = true;
+	xlation_hairpin_begin(state, &bkp);
 
-	result = translating_the_packet(new);
+	result = translating_the_packet(state);
 	if (result != VERDICT_CONTINUE)
 		goto end;
-	result = sendpkt_send(new);
+	result = sendpkt_send(state);
 	if (result != VERDICT_CONTINUE)
 		goto end;
 
-	log_debug(old, "Done hairpinning.");
-end:	xlation_destroy(new);
+	log_debug(state, "Done hairpinning.");
+end:	xlation_hairpin_end(state, &bkp);
 	return result;
 }
@@ -5,44 +5,54 @@
 #include "mod/common/nl/nl_handler.h"
 /* #include "mod/common/skbuff.h" */
 
-static verdict __sendpkt_send(struct xlation *state, struct sk_buff *out)
+/*
+ * Prepares the whole list before anything is sent, so a broken fragment drops
+ * the packet, instead of leaving the destination with an incomplete one.
+ */
+static bool prepare_batch(struct sk_buff *skb)
 {
 	struct dst_entry *dst;
-	int error;
-
-	dst = skb_dst(out);
-	if (WARN(!dst, "dst is NULL!"))
-		return drop(state, JSTAT_UNKNOWN);
-
-	out->dev = dst->dev;
-	log_debug(state, "Sending packet.");
-
-	/* skb_log(out, "Translated packet"); */
 
-	/* Implicit kfree_skb(out) here. */
-	error = dst_output(state->jool.ns, NULL, out);
-	if (error) {
-		log_debug(state, "dst_output() returned errcode %d.", error);
-		return drop(state, JSTAT_DST_OUTPUT);
+	for (; skb != NULL; skb = skb->next) {
+		dst = skb_dst(skb);
+		if (WARN(!dst, "dst is NULL!"))
+			return false;
+		skb->dev = dst->dev;
 	}
 
-	return VERDICT_CONTINUE;
+	return true;
 }
 
 verdict sendpkt_send(struct xlation *state)
 {
 	struct sk_buff *skb;
 	struct sk_buff *next;
-	verdict result;
+	int error;
+
+	skb = state->out.skb;
+	if (!prepare_batch(skb)) {
+		kfree_skb_list(skb);
+		return drop(state, JSTAT_UNKNOWN);
+	}
 
-	for (skb = state->out.skb; skb != NULL; skb = next) {
+	log_debug(state, "Sending packet.");
+	/* skb_log(skb, "Translated packet"); */
+
+	/*
+	 * Back to back, so the fragments reach the device's queue together,
+	 * and it can dequeue them as a bulk. (Which is what sets xmit_more.)
+	 */
+	for (; skb != NULL; skb = next) {
 		next = skb->next;
 		skb->next = NULL;
 
-		result = __sendpkt_send(state, skb);
-		if (result != VERDICT_CONTINUE) {
+		/* Implicit kfree_skb(skb) here. */
+		error = dst_output(state->jool->ns, NULL, skb);
+		if (error) {
+			log_debug(state, "dst_output() returned errcode %d.",
+					error);
 			kfree_skb_list(next);
-			return result;
+			return drop(state, JSTAT_DST_OUTPUT);
 		}
 	}
 
@@ -16,7 +16,8 @@
 #include "mod/common/translation_state.h"
 
 /**
- * Puts @state's outgoing skb on the network.
+ * Puts @state's outgoing skb (and its fragments, if it was fragmented) on the
+ * network, one after the other.
  *
  * Note that this function inherits from ip_local_out() and ip6_local_out() the
  * annoying side effect of freeing "out_skb", EVEN IF IT COULD NOT BE SENT.
@@ -0,0 +1,211 @@
+#include "mod/common/threaded.h"
+
+#include <linux/moduleparam.h>
+#include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/smpboot.h>
+
+#include "mod/common/kernel_hook.h"
+#include "mod/common/stats.h"
+#include "mod/common/db/bib/db.h"
+
+/* Packets per CPU. Has to be a power of two. */
+#define RING_SIZE 512
+#define RING_MASK (RING_SIZE - 1)
+/* Packets translated per bottom half disable. (Same as NAPI's weight.) */
+#define BATCH_SIZE 64
+
+struct threaded_pkt {
+	/* Holds a reference to its device. */
+	struct sk_buff *skb;
+	/* Where the packet goes if it turns out to be untranslatable. */
+	hook_okfn okfn;
+};
+
+struct threaded_ring {
+	/* Next slot the hook will write. */
+	unsigned int head;
+	/* Next slot the kthread will read. */
+	unsigned int tail;
+	struct threaded_pkt pkts[RING_SIZE];
+};
+
+DEFINE_STATIC_KEY_FALSE(threaded_key);
+
+static bool threaded;
+/* Only exists while @threaded. */
+static struct threaded_ring __percpu *rings;
+static DEFINE_PER_CPU(struct task_struct *, threads);
+
+static int thread_should_run(unsigned int cpu)
+{
+	struct threaded_ring *ring = per_cpu_ptr(rings, cpu);
+	return READ_ONCE(ring->head) != READ_ONCE(ring->tail);
+}
+
+/* Returns the number of packets translated. */
+static unsigned int translate_batch(struct threaded_ring *ring)
+{
+	struct threaded_pkt *pkt;
+	struct net_device *dev;
+	unsigned int end;
+	unsigned int stage;
+	unsigned int i;
+
+	local_bh_disable();
+
+	/*
+	 * Look every packet's BIB entry up before translating the first one, so
+	 * the cache misses overlap instead of adding up.
+	 */
+	end = READ_ONCE(ring->head);
+	if (end - ring->tail > BATCH_SIZE)
+		end = ring->tail + BATCH_SIZE;
+	for (stage = 0; stage < BIB_PREFETCH_STAGES; stage++)
+		for (i = ring->tail; i != end; i++)
+			hook_prefetch(ring->pkts[i & RING_MASK].skb, stage);
+
+	for (i = 0; i < BATCH_SIZE; i++) {
+		if (ring->tail == READ_ONCE(ring->head))
+			break;
+
+		pkt = &ring->pkts[ring->tail & RING_MASK];
+		WRITE_ONCE(ring->tail, ring->tail + 1);
+
+		dev = pkt->skb->dev;
+		hook_deferred(pkt->skb, pkt->okfn);
+		dev_put(dev);
+	}
+	local_bh_enable();
+
+	return i;
+}
+
+static void thread_fn(unsigned int cpu)
+{
+	translate_batch(per_cpu_ptr(rings, cpu));
+}
+
+/* The hooks can't queue while this runs; the CPU is leaving, or dying. */
+static void thread_drain(unsigned int cpu)
+{
+	struct threaded_ring *ring = per_cpu_ptr(rings, cpu);
+
+	while (translate_batch(ring))
+		cond_resched();
+}
+
+static void thread_cleanup(unsigned int cpu, bool online)
+{
+	thread_drain(cpu);
+}
+
+static struct smp_hotplug_thread threads_desc = {
+	.store = &threads,
+	.thread_should_run = thread_should_run,
+	.thread_fn = thread_fn,
+	.park = thread_drain,
+	.cleanup = thread_cleanup,
+	.thread_comm = "jool/%u",
+};
+
+static int threaded_start(void)
+{
+	int error;
+
+	/* alloc_percpu() zeroes. */
+	rings = alloc_percpu(struct threaded_ring);
+	if (!rings)
+		return -ENOMEM;
+
+	error = smpboot_register_percpu_thread(&threads_desc);
+	if (error) {
+		free_percpu(rings);
+		rings = NULL;
+		return error;
+	}
+
+	static_branch_enable(&threaded_key);
+	return 0;
+}
+
+static void threaded_stop(void)
+{
+	static_branch_disable(&threaded_key);
+	/* Wait for the hooks that are still queueing. */
+	synchronize_net();
+	/* Drains the rings. */
+	smpboot_unregister_percpu_thread(&threads_desc);
+
+	free_percpu(rings);
+	rings = NULL;
+}
+
+static int set_threaded(const char *val, const struct kernel_param *kp)
+{
+	bool old = threaded;
+	int error;
+
+	error = param_set_bool(val, kp);
+	if (error || threaded == old)
+		return error;
+
+	if (threaded) {
+		error = threaded_start();
+		if (error)
+			threaded = false;
+	} else {
+		threaded_stop();
+	}
+
+	return error;
+}
+
+static const struct kernel_param_ops threaded_ops = {
+	.set = set_threaded,
+	.get = param_get_bool,
+};
+
+module_param_cb(threaded, &threaded_ops, &threaded, 0644);
+MODULE_PARM_DESC(threaded, "Translate the packets of the Netfilter hooks in per-CPU kthreads, instead of in the softirq that received them.");
+
+/* Only once the hooks are gone. */
+void threaded_teardown(void)
+{
+	if (threaded) {
+		threaded_stop();
+		threaded = false;
+	}
+}
+
+/**
+ * threaded_enqueue - Queues @skb (which belongs to @jool) in the current CPU's
+ * ring, so its kthread translates it later. @okfn is the hook's; the packet
+ * resumes there if the translation returns it.
+ *
+ * If this returns true, @skb has been stolen. Otherwise the ring was full, and
+ * @skb should be dropped.
+ *
+ * Call with bottom halves disabled.
+ */
+bool threaded_enqueue(struct xlator *jool, struct sk_buff *skb,
+		hook_okfn okfn)
+{
+	struct threaded_ring *ring = this_cpu_ptr(rings);
+	unsigned int head = ring->head;
+
+	if (head - ring->tail >= RING_SIZE) {
+		jstat_inc(jool->stats, JSTAT_THREADED_RING_FULL);
+		return false;
+	}
+
+	dev_hold(skb->dev);
+	ring->pkts[head & RING_MASK].skb = skb;
+	ring->pkts[head & RING_MASK].okfn = okfn;
+	WRITE_ONCE(ring->head, head + 1);
+
+	/* The kthread might have already drained the rest; wake it up. */
+	if (head == ring->tail)
+		wake_up_process(__this_cpu_read(threads));
+	return true;
+}
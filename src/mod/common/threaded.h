@@ -0,0 +1,47 @@
+#ifndef SRC_MOD_COMMON_THREADED_H_
+#define SRC_MOD_COMMON_THREADED_H_
+
+/**
+ * @file
+ * Threaded translation. (The jool_common module's threaded parameter.)
+ *
+ * Normally, the Netfilter hooks translate in the softirq that received the
+ * packet, so the expensive translations (new BIB entries, ICMP errors,
+ * hairpinning) delay all of the CPU's other traffic. In threaded mode, the
+ * hooks only classify the packet, and queue it in their CPU's ring instead.
+ * A per-CPU kthread (jool/<cpu>, same as ksoftirqd) later translates the ring
+ * in batches, so the translations can be scheduled, prioritized and isolated
+ * like any other task.
+ *
+ * A CPU's ring is only touched by that CPU, with bottom halves disabled, so it
+ * needs no locks nor atomics.
+ *
+ * Once queued, the hook has already told the kernel the packet was stolen. So
+ * the hooks only queue the packets that pass the same address and pool4
+ * checks the translation would run (the rest are translated inline), and the
+ * queued packets that still turn out to be untranslatable are handed to the
+ * hook's okfn, the way nf_reinject() does. (So, unlike in inline mode, they
+ * skip the pre-routing hooks that have a lower priority than Jool's.)
+ *
+ * Only the Netfilter hooks queue; ingress-devices and iptables rules always
+ * translate inline.
+ */
+
+#include <linux/jump_label.h>
+#include <linux/skbuff.h>
+#include "mod/common/kernel_hook.h"
+#include "mod/common/xlator.h"
+
+DECLARE_STATIC_KEY_FALSE(threaded_key);
+
+void threaded_teardown(void);
+
+bool threaded_enqueue(struct xlator *jool, struct sk_buff *skb,
+		hook_okfn okfn);
+
+static inline bool threaded_enabled(void)
+{
+	return static_branch_unlikely(&threaded_key);
+}
+
+#endif /* SRC_MOD_COMMON_THREADED_H_ */
@@ -1,8 +1,16 @@
 #include "mod/common/timer.h"
 
+#include <linux/jhash.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <net/netns/hash.h>
 #include "mod/common/linux_version.h"
+#include "mod/common/wkmalloc.h"
 #include "mod/common/xlator.h"
 #include "mod/common/joold.h"
+#include "mod/common/natlog.h"
+#include "mod/common/stats.h"
+#include "mod/common/db/talkers.h"
 #include "mod/common/db/bib/db.h"
 
 /*
@@ -22,13 +30,58 @@
 
 static struct timer_list timer;
 
-static int clean_state(struct xlator *jool, void *args)
+/*
+ * The timer itself doesn't clean anything; it just kicks the cleaners, which
+ * run in an unbound workqueue. The instances are split among the cleaners by
+ * a hash of their namespace and name, so the work is spread across CPUs, and
+ * out of the timer softirq.
+ *
+ * (The split depends on nothing but the instance, so adding or removing other
+ * instances while the cleaners run can't make one skip or repeat an instance.)
+ *
+ * cleaner_count is decided once, during setup, and ignores CPU hotplug. That's
+ * fine; it only determines how finely the work is split, and the workqueue
+ * runs the cleaners wherever there are CPUs.
+ */
+struct cleaner {
+	struct work_struct work;
+	unsigned int index;
+};
+
+static struct workqueue_struct *cleaner_wq;
+static struct cleaner *cleaners;
+static unsigned int cleaner_count;
+
+static unsigned int cleaner_of(struct xlator *jool)
 {
+	return jhash(jool->iname, strlen(jool->iname), net_hash_mix(jool->ns))
+			% cleaner_count;
+}
+
+static int clean_state(struct xlator *jool, void *arg)
+{
+	struct cleaner *cleaner = arg;
+
+	if (cleaner_of(jool) != cleaner->index)
+		return 0;
+
+	jstat_rates_update(jool->stats);
+	if (!xlator_is_nat64(jool))
+		return 0;
+
 	bib_clean(jool);
 	joold_clean(jool);
+	natlog_clean(jool);
+	talkers_clean(jool);
 	return 0;
 }
 
+static void cleaner_function(struct work_struct *work)
+{
+	xlator_foreach(XT_ANY, clean_state,
+			container_of(work, struct cleaner, work), NULL);
+}
+
 static void timer_function(
 #if LINUX_VERSION_AT_LEAST(4, 15, 0, 8, 0)
 		struct timer_list *arg
@@ -37,7 +90,10 @@ static void timer_function(
 #endif
 		)
 {
-	xlator_foreach(XT_NAT64, clean_state, NULL, NULL);
+	unsigned int i;
+
+	for (i = 0; i < cleaner_count; i++)
+		queue_work(cleaner_wq, &cleaners[i].work);
 	mod_timer(&timer, jiffies + TIMER_PERIOD);
 }
 
@@ -46,6 +102,24 @@ static void timer_function(
  */
 int jtimer_setup(void)
 {
+	unsigned int i;
+
+	cleaner_wq = alloc_workqueue("jool_cleaner", WQ_UNBOUND, 0);
+	if (!cleaner_wq)
+		return -ENOMEM;
+
+	cleaner_count = num_online_cpus();
+	cleaners = __wkmalloc("cleaners", cleaner_count * sizeof(*cleaners),
+			GFP_KERNEL);
+	if (!cleaners) {
+		destroy_workqueue(cleaner_wq);
+		return -ENOMEM;
+	}
+	for (i = 0; i < cleaner_count; i++) {
+		INIT_WORK(&cleaners[i].work, cleaner_function);
+		cleaners[i].index = i;
+	}
+
 #if LINUX_VERSION_AT_LEAST(4, 15, 0, 8, 0)
 	timer_setup(&timer, timer_function, 0);
 #else
@@ -64,4 +138,7 @@ int jtimer_setup(void)
 void jtimer_teardown(void)
 {
 	del_timer_sync(&timer);
+	/* Waits for the pending cleaners. */
+	destroy_workqueue(cleaner_wq);
+	__wkfree("cleaners", cleaners);
 }
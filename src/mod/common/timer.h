@@ -7,6 +7,9 @@
  * long as Jool is modprobed. At time of writing, this induces session and
  * fragment expiration.
  *
+ * The actual work is done by a workqueue the timer kicks, not by the timer
+ * itself.
+ *
  * Why don't the session and fragment code manage their own timers?
  * Because that's more code and I don't see how it would improve anything.
  */
@@ -0,0 +1,196 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM jool
+
+#if !defined(SRC_MOD_COMMON_TRACEPOINTS_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define SRC_MOD_COMMON_TRACEPOINTS_H_
+
+/**
+ * @file
+ * Tracepoints for the events that are too frequent for printk: BIB and session
+ * lifecycle, pool4 exhaustion and translation verdicts.
+ *
+ * They are always compiled in; a disabled tracepoint costs a static key check.
+ * Enable them through tracefs (events/jool/) or attach perf or eBPF to them.
+ *
+ * Unlike bib_logging and session_logging, these don't depend on any global.
+ */
+
+#include <linux/tracepoint.h>
+#include "common/stats.h"
+#include "mod/common/types.h"
+#include "mod/common/xlator.h"
+#include "mod/common/db/bib/entry.h"
+
+TRACE_DEFINE_ENUM(L4PROTO_TCP);
+TRACE_DEFINE_ENUM(L4PROTO_UDP);
+TRACE_DEFINE_ENUM(L4PROTO_ICMP);
+TRACE_DEFINE_ENUM(L4PROTO_OTHER);
+TRACE_DEFINE_ENUM(VERDICT_CONTINUE);
+TRACE_DEFINE_ENUM(VERDICT_DROP);
+TRACE_DEFINE_ENUM(VERDICT_UNTRANSLATABLE);
+TRACE_DEFINE_ENUM(VERDICT_STOLEN);
+
+#define jool_show_proto(proto) __print_symbolic(proto,			\
+		{ L4PROTO_TCP, "TCP" },					\
+		{ L4PROTO_UDP, "UDP" },					\
+		{ L4PROTO_ICMP, "ICMP" },				\
+		{ L4PROTO_OTHER, "Other" })
+
+#define jool_show_verdict(verdict) __print_symbolic(verdict,		\
+		{ VERDICT_CONTINUE, "continue" },			\
+		{ VERDICT_DROP, "drop" },				\
+		{ VERDICT_UNTRANSLATABLE, "untranslatable" },		\
+		{ VERDICT_STOLEN, "stolen" })
+
+DECLARE_EVENT_CLASS(jool_bib,
+	TP_PROTO(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4, l4_protocol proto,
+		bool is_static),
+	TP_ARGS(jool, src6, src4, proto, is_static),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__array(__u8, src6, 16)
+		__field(__u16, port6)
+		__field(__be32, src4)
+		__field(__u16, port4)
+		__field(__u8, proto)
+		__field(bool, is_static)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, jool->iname, INAME_MAX_SIZE);
+		memcpy(__entry->src6, &src6->l3, 16);
+		__entry->port6 = src6->l4;
+		__entry->src4 = src4->l3.s_addr;
+		__entry->port4 = src4->l4;
+		__entry->proto = proto;
+		__entry->is_static = is_static;
+	),
+
+	TP_printk("%s [%pI6c]:%u %pI4:%u %s%s",
+		__entry->iname, __entry->src6, __entry->port6,
+		&__entry->src4, __entry->port4,
+		jool_show_proto(__entry->proto),
+		__entry->is_static ? " static" : "")
+);
+
+DEFINE_EVENT(jool_bib, jool_bib_create,
+	TP_PROTO(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4, l4_protocol proto,
+		bool is_static),
+	TP_ARGS(jool, src6, src4, proto, is_static)
+);
+
+DEFINE_EVENT(jool_bib, jool_bib_destroy,
+	TP_PROTO(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4, l4_protocol proto,
+		bool is_static),
+	TP_ARGS(jool, src6, src4, proto, is_static)
+);
+
+DECLARE_EVENT_CLASS(jool_session,
+	TP_PROTO(struct xlator *jool, struct session_entry const *session),
+	TP_ARGS(jool, session),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__array(__u8, src6, 16)
+		__array(__u8, dst6, 16)
+		__field(__be32, src4)
+		__field(__be32, dst4)
+		__field(__u16, src6_port)
+		__field(__u16, dst6_port)
+		__field(__u16, src4_port)
+		__field(__u16, dst4_port)
+		__field(__u8, proto)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, jool->iname, INAME_MAX_SIZE);
+		memcpy(__entry->src6, &session->src6.l3, 16);
+		memcpy(__entry->dst6, &session->dst6.l3, 16);
+		__entry->src4 = session->src4.l3.s_addr;
+		__entry->dst4 = session->dst4.l3.s_addr;
+		__entry->src6_port = session->src6.l4;
+		__entry->dst6_port = session->dst6.l4;
+		__entry->src4_port = session->src4.l4;
+		__entry->dst4_port = session->dst4.l4;
+		__entry->proto = session->proto;
+	),
+
+	TP_printk("%s [%pI6c]:%u [%pI6c]:%u %pI4:%u %pI4:%u %s",
+		__entry->iname,
+		__entry->src6, __entry->src6_port,
+		__entry->dst6, __entry->dst6_port,
+		&__entry->src4, __entry->src4_port,
+		&__entry->dst4, __entry->dst4_port,
+		jool_show_proto(__entry->proto))
+);
+
+DEFINE_EVENT(jool_session, jool_session_create,
+	TP_PROTO(struct xlator *jool, struct session_entry const *session),
+	TP_ARGS(jool, session)
+);
+
+DEFINE_EVENT(jool_session, jool_session_destroy,
+	TP_PROTO(struct xlator *jool, struct session_entry const *session),
+	TP_ARGS(jool, session)
+);
+
+/* A BIB entry could not be created because the mark's pool4 ran out. */
+TRACE_EVENT(jool_pool4_exhausted,
+	TP_PROTO(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		l4_protocol proto, __u32 mark),
+	TP_ARGS(jool, src6, proto, mark),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__array(__u8, src6, 16)
+		__field(__u16, port6)
+		__field(__u8, proto)
+		__field(__u32, mark)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, jool->iname, INAME_MAX_SIZE);
+		memcpy(__entry->src6, &src6->l3, 16);
+		__entry->port6 = src6->l4;
+		__entry->proto = proto;
+		__entry->mark = mark;
+	),
+
+	TP_printk("%s [%pI6c]:%u %s mark %u", __entry->iname,
+		__entry->src6, __entry->port6,
+		jool_show_proto(__entry->proto), __entry->mark)
+);
+
+/* A packet's fate, and the stat it was accounted to. */
+TRACE_EVENT(jool_verdict,
+	TP_PROTO(struct xlator *jool, verdict result, enum jool_stat_id stat),
+	TP_ARGS(jool, result, stat),
+
+	TP_STRUCT__entry(
+		__array(char, iname, INAME_MAX_SIZE)
+		__field(int, result)
+		__field(int, stat)
+	),
+
+	TP_fast_assign(
+		memcpy(__entry->iname, jool->iname, INAME_MAX_SIZE);
+		__entry->result = result;
+		__entry->stat = stat;
+	),
+
+	TP_printk("%s %s stat %d", __entry->iname,
+		jool_show_verdict(__entry->result), __entry->stat)
+);
+
+#endif /* SRC_MOD_COMMON_TRACEPOINTS_H_ */
+
+/* This part must be outside the include guard. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH mod/common
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tracepoints
+#include <trace/define_trace.h>
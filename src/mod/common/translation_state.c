@@ -1,18 +1,42 @@
 #include "mod/common/translation_state.h"
 
+#include <linux/percpu.h>
+#include "mod/common/tracepoints.h"
 #include "mod/common/wkmalloc.h"
 
 static struct kmem_cache *xlation_cache;
 
+/*
+ * Preallocated states for the packets that reach the hooks. (See
+ * xlation_acquire().)
+ */
+struct xlation_scratch {
+	struct xlation state;
+	/** Is @state currently being used by some translation? */
+	bool busy;
+};
+
+static struct xlation_scratch __percpu *scratches;
+
 int xlation_setup(void)
 {
 	xlation_cache = kmem_cache_create("jool_xlations",
 			sizeof(struct xlation), 0, 0, NULL);
-	return xlation_cache? 0 : -ENOMEM;
+	if (!xlation_cache)
+		return -ENOMEM;
+
+	scratches = alloc_percpu(struct xlation_scratch);
+	if (!scratches) {
+		kmem_cache_destroy(xlation_cache);
+		return -ENOMEM;
+	}
+
+	return 0;
 }
 
 void xlation_teardown(void)
 {
+	free_percpu(scratches);
 	kmem_cache_destroy(xlation_cache);
 }
 
@@ -31,8 +55,7 @@ struct xlation *xlation_create(struct xlator *jool)
 void xlation_init(struct xlation *state, struct xlator *jool)
 {
 	memset(state, 0, sizeof(*state));
-	if (jool)
-		memcpy(&state->jool, jool, sizeof(*jool));
+	state->jool = jool;
 }
 
 void xlation_destroy(struct xlation *state)
@@ -42,16 +65,190 @@ void xlation_destroy(struct xlation *state)
 	wkmem_cache_free("xlation", xlation_cache, state);
 }
 
+/*
+ * Cheaper version of xlation_init(), meant for recycled states.
+ *
+ * Skips the fields that are always written before they're read:
+ * @flowx (see compute_flowix64() and compute_flowix46()) and
+ * @entries.session (which is guarded by @entries' flags).
+ */
+static void xlation_reset(struct xlation *state)
+{
+	state->jool = NULL;
+	memset(&state->in, 0, sizeof(state->in));
+	memset(&state->out, 0, sizeof(state->out));
+	state->flowx_set = false;
+	state->dst = NULL;
+	state->entries.bib_set = false;
+	state->entries.session_set = false;
+	state->is_hairpin = false;
+	state->pool6_index = 0;
+	state->captured = false;
+	state->latency.sampled = false;
+	state->tally.batching = false;
+	memset(&state->result, 0, sizeof(state->result));
+}
+
+/**
+ * Returns a state for a packet that just reached one of Jool's hooks.
+ * @jool is left NULL; the caller is expected to initialize it.
+ *
+ * Normally, this is the CPU's scratch state, which spares the packet a memory
+ * allocation and most of the initialization. If the scratch is already taken
+ * (ie. the hook was somehow reentered), this falls back to xlation_create().
+ *
+ * BHs remain disabled until you xlation_release() the state.
+ */
+struct xlation *xlation_acquire(void)
+{
+	struct xlation_scratch *scratch;
+	struct xlation *state;
+
+	local_bh_disable();
+
+	scratch = this_cpu_ptr(scratches);
+	if (unlikely(scratch->busy)) {
+		state = xlation_create(NULL);
+		if (!state)
+			local_bh_enable();
+		return state;
+	}
+
+	scratch->busy = true;
+	xlation_reset(&scratch->state);
+	return &scratch->state;
+}
+
+/**
+ * Reverts xlation_acquire().
+ */
+void xlation_release(struct xlation *state)
+{
+	struct xlation_scratch *scratch;
+
+	scratch = this_cpu_ptr(scratches);
+	if (likely(state == &scratch->state)) {
+		if (state->dst)
+			dst_release(state->dst);
+		scratch->busy = false;
+	} else {
+		xlation_destroy(state);
+	}
+
+	local_bh_enable();
+}
+
+/**
+ * Turns @state into the state of its own hairpin: @state's outgoing packet
+ * becomes its incoming packet, and everything the translation of the latter
+ * would overwrite is moved to @bkp.
+ *
+ * This spares hairpins a second state, which would otherwise need to be
+ * allocated and initialized from scratch. @flowx is not backed up, because
+ * nothing reads it once the packet has been translated.
+ *
+ * The incoming packet's original packet remains @state's original packet, so
+ * whatever is stored during the second leg (eg. simultaneous open SYNs) is the
+ * one that reached the hook. (The intermediate one dies right after the
+ * hairpin.)
+ */
+void xlation_hairpin_begin(struct xlation *state, struct xlation_hairpin *bkp)
+{
+	bkp->in = state->in;
+	bkp->out = state->out;
+	bkp->dst = state->dst;
+	bkp->entries = state->entries;
+	bkp->is_hairpin = state->is_hairpin;
+	bkp->result = state->result;
+
+	state->in = bkp->out;
+	state->in.original_pkt = &bkp->in;
+	memset(&state->out, 0, sizeof(state->out));
+	state->flowx_set = false;
+	state->dst = NULL;
+	state->entries.bib_set = false;
+	state->entries.session_set = false;
+	state->is_hairpin = true;
+	memset(&state->result, 0, sizeof(state->result));
+}
+
+/**
+ * Reverts xlation_hairpin_begin(). Whatever the second leg left in @state
+ * (including its ICMP error, if any) is discarded.
+ */
+void xlation_hairpin_end(struct xlation *state, struct xlation_hairpin *bkp)
+{
+	if (state->dst)
+		dst_release(state->dst);
+
+	state->in = bkp->in;
+	state->out = bkp->out;
+	state->dst = bkp->dst;
+	state->entries = bkp->entries;
+	state->is_hairpin = bkp->is_hairpin;
+	state->result = bkp->result;
+}
+
+/**
+ * Starts holding @state's counters back, until xlation_tally_flush().
+ * @received and @bytes_id are the packet's JSTAT_RECEIVED* and JSTAT_BYTES*.
+ */
+void xlation_tally_begin(struct xlation *state, enum jool_stat_id received,
+		enum jool_stat_id bytes_id, unsigned int bytes)
+{
+	struct xlation_tally *tally = &state->tally;
+
+	tally->batching = true;
+	tally->ids[0] = received;
+	tally->count = 1;
+	tally->bytes_id = bytes_id;
+	tally->bytes = bytes;
+}
+
+/**
+ * Increases counter @stat on behalf of @state's packet. Waits for the flush if
+ * the tally is batching, and there's room.
+ */
+void xlation_count(struct xlation *state, enum jool_stat_id stat)
+{
+	struct xlation_tally *tally = &state->tally;
+
+	if (tally->batching && tally->count < XLATION_TALLY_MAX)
+		tally->ids[tally->count++] = stat;
+	else
+		jstat_inc(state->jool->stats, stat);
+}
+
+/**
+ * Hands the pending counters over to the instance's stats, and stops
+ * batching.
+ */
+void xlation_tally_flush(struct xlation *state)
+{
+	struct xlation_tally *tally = &state->tally;
+
+	if (!tally->batching)
+		return;
+
+	jstat_flush(state->jool->stats, tally->ids, tally->count,
+			tally->bytes_id, tally->bytes);
+	tally->batching = false;
+}
+
 verdict untranslatable(struct xlation *state, enum jool_stat_id stat)
 {
-	jstat_inc(state->jool.stats, stat);
+	xlation_count(state, stat);
+	state->latency.stat = stat;
+	trace_jool_verdict(state->jool, VERDICT_UNTRANSLATABLE, stat);
 	return VERDICT_UNTRANSLATABLE;
 }
 
 verdict untranslatable_icmp(struct xlation *state, enum jool_stat_id stat,
 		enum icmp_errcode icmp, __u32 info)
 {
-	jstat_inc(state->jool.stats, stat);
+	xlation_count(state, stat);
+	state->latency.stat = stat;
+	trace_jool_verdict(state->jool, VERDICT_UNTRANSLATABLE, stat);
 	state->result.icmp = icmp;
 	state->result.info = info;
 	return VERDICT_UNTRANSLATABLE;
@@ -59,14 +256,18 @@ verdict untranslatable_icmp(struct xlation *state, enum jool_stat_id stat,
 
 verdict drop(struct xlation *state, enum jool_stat_id stat)
 {
-	jstat_inc(state->jool.stats, stat);
+	xlation_count(state, stat);
+	state->latency.stat = stat;
+	trace_jool_verdict(state->jool, VERDICT_DROP, stat);
 	return VERDICT_DROP;
 }
 
 verdict drop_icmp(struct xlation *state, enum jool_stat_id stat,
 		enum icmp_errcode icmp, __u32 info)
 {
-	jstat_inc(state->jool.stats, stat);
+	xlation_count(state, stat);
+	state->latency.stat = stat;
+	trace_jool_verdict(state->jool, VERDICT_DROP, stat);
 	state->result.icmp = icmp;
 	state->result.info = info;
 	return VERDICT_DROP;
@@ -74,6 +275,8 @@ verdict drop_icmp(struct xlation *state, enum jool_stat_id stat,
 
 verdict stolen(struct xlation *state, enum jool_stat_id stat)
 {
-	jstat_inc(state->jool.stats, stat);
+	xlation_count(state, stat);
+	state->latency.stat = stat;
+	trace_jool_verdict(state->jool, VERDICT_STOLEN, stat);
 	return VERDICT_STOLEN;
 }
@@ -33,6 +33,44 @@ struct xlation_result {
 	__u32 info;
 };
 
+/**
+ * A translation's timeline, as measured for latency-sample. (See natlog.h.)
+ * Only meaningful while @sampled.
+ */
+struct xlation_latency {
+	bool sampled;
+	/** enum jool_stat_id of the last verdict. */
+	__u16 stat;
+	/** local_clock() at the hook. */
+	u64 start;
+	/** ktime_get_real_ns() at the hook. */
+	u64 timestamp;
+	/** Nanoseconds between @start and the end of each stage. */
+	__u32 stages[JLAT_STAGE_COUNT];
+};
+
+/**
+ * Up to this many counters can wait in a struct xlation_tally. (The packet,
+ * its verdict, its ICMP error, and a hairpin's second verdict.)
+ */
+#define XLATION_TALLY_MAX 4
+
+/**
+ * The counters a translation has increased, but not yet added to the
+ * instance's stats. core_6to4() and core_4to6() flush them all at once
+ * (see xlation_tally_flush()), so each packet only touches the MIB once.
+ * Only meaningful while @batching; otherwise, xlation_count() does not wait.
+ */
+struct xlation_tally {
+	bool batching;
+	__u8 count;
+	/** enum jool_stat_ids to increase. */
+	__u16 ids[XLATION_TALLY_MAX];
+	/** JSTAT_BYTES6 or JSTAT_BYTES4. */
+	__u16 bytes_id;
+	__u32 bytes;
+};
+
 /**
  * State of the current translation.
  */
@@ -40,8 +78,12 @@ struct xlation {
 	/**
 	 * The instance of Jool that's in charge of carrying out this
 	 * translation.
+	 *
+	 * In the packet path, this points to the database's own instance, and
+	 * is protected by RCU-bh. (See xlator_find_rcu().) It's only valid
+	 * until the hook returns, and must not be modified.
 	 */
-	struct xlator jool;
+	struct xlator *jool;
 
 	/** The original packet. */
 	struct packet in;
@@ -70,6 +112,33 @@ struct xlation {
 	 */
 	bool is_hairpin;
 
+	/**
+	 * NAT64 only. Index of the pool6 prefix (see xlator_pool6()) the
+	 * IPv6 packet's destination address belongs to. Set by
+	 * filtering_and_updating().
+	 */
+	__u8 pool6_index;
+
+	/** Was this translation sampled by capture-sample? */
+	bool captured;
+	/** Timeline, if this translation was sampled by latency-sample. */
+	struct xlation_latency latency;
+	/** Counters that haven't reached the stats yet. */
+	struct xlation_tally tally;
+
+	struct xlation_result result;
+};
+
+/**
+ * The fields of a state that the second leg of a hairpin overrides. (See
+ * xlation_hairpin_begin().)
+ */
+struct xlation_hairpin {
+	struct packet in;
+	struct packet out;
+	struct dst_entry *dst;
+	struct bib_session entries;
+	bool is_hairpin;
 	struct xlation_result result;
 };
 
@@ -81,6 +150,17 @@ void xlation_init(struct xlation *state, struct xlator *jool);
 /* xlation_cleanup() not needed. */
 void xlation_destroy(struct xlation *state);
 
+struct xlation *xlation_acquire(void);
+void xlation_release(struct xlation *state);
+
+void xlation_hairpin_begin(struct xlation *state, struct xlation_hairpin *bkp);
+void xlation_hairpin_end(struct xlation *state, struct xlation_hairpin *bkp);
+
+void xlation_tally_begin(struct xlation *state, enum jool_stat_id received,
+		enum jool_stat_id bytes_id, unsigned int bytes);
+void xlation_count(struct xlation *state, enum jool_stat_id stat);
+void xlation_tally_flush(struct xlation *state);
+
 verdict untranslatable(struct xlation *state, enum jool_stat_id stat);
 verdict untranslatable_icmp(struct xlation *state, enum jool_stat_id stat,
 		enum icmp_errcode icmp, __u32 info);
@@ -89,7 +169,7 @@ verdict drop_icmp(struct xlation *state, enum jool_stat_id stat,
 		enum icmp_errcode icmp, __u32 info);
 verdict stolen(struct xlation *state, enum jool_stat_id stat);
 
-#define xlation_is_siit(state) xlator_is_siit(&(state)->jool)
-#define xlation_is_nat64(state) xlator_is_nat64(&(state)->jool)
+#define xlation_is_siit(state) xlator_is_siit((state)->jool)
+#define xlation_is_nat64(state) xlator_is_nat64((state)->jool)
 
 #endif /* SRC_MOD_COMMON_TRANSLATION_STATE_H_ */
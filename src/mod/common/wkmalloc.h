@@ -1,8 +1,11 @@
 #ifndef SRC_MOD_COMMON_WKMALLOC_H_
 #define SRC_MOD_COMMON_WKMALLOC_H_
 
+#include <linux/mm.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include "common/types.h"
+#include "mod/common/linux_version.h"
 
 void wkmalloc_add(const char *name);
 void wkmalloc_rm(const char *name, void *obj);
@@ -37,6 +40,61 @@ static inline void __wkfree(const char *name, void *obj)
 
 #define wkfree(type, obj) __wkfree(#type, obj)
 
+/**
+ * Same as __wkmalloc(), for big, zeroed, not necessarily contiguous buffers.
+ * (vzalloc.) Can sleep.
+ */
+static inline void *__wkvmalloc(const char *name, size_t size)
+{
+	void *result;
+
+	result = vzalloc(size);
+#ifdef JKMEMLEAK
+	if (result)
+		wkmalloc_add(name);
+#endif
+
+	return result;
+}
+
+static inline void __wkvfree(const char *name, void *obj)
+{
+	vfree(obj);
+#ifdef JKMEMLEAK
+	wkmalloc_rm(name, obj);
+#endif
+}
+
+/**
+ * Same as __wkvmalloc(), except it tries kmalloc() first, and doesn't zero.
+ * (kvmalloc.) For buffers that are usually small, but can get big. Can sleep.
+ */
+static inline void *__wkkvmalloc(const char *name, size_t size)
+{
+	void *result;
+
+#if LINUX_VERSION_AT_LEAST(4, 12, 0, 8, 0)
+	result = kvmalloc(size, GFP_KERNEL);
+#else
+	result = vmalloc(size);
+#endif
+#ifdef JKMEMLEAK
+	if (result)
+		wkmalloc_add(name);
+#endif
+
+	return result;
+}
+
+/* Also fine from softirq context (eg. RCU callbacks). */
+static inline void __wkkvfree(const char *name, void *obj)
+{
+	kvfree(obj);
+#ifdef JKMEMLEAK
+	wkmalloc_rm(name, obj);
+#endif
+}
+
 static inline void *wkmem_cache_alloc(const char *name,
 		struct kmem_cache *cache, gfp_t flags)
 {
@@ -51,6 +109,20 @@ static inline void *wkmem_cache_alloc(const char *name,
 	return result;
 }
 
+static inline void *wkmem_cache_alloc_node(const char *name,
+		struct kmem_cache *cache, gfp_t flags, int node)
+{
+	void *result;
+
+	result = kmem_cache_alloc_node(cache, flags, node);
+#ifdef JKMEMLEAK
+	if (result)
+		wkmalloc_add(name);
+#endif
+
+	return result;
+}
+
 static inline void wkmem_cache_free(const char *name, struct kmem_cache *cache,
 		void *obj)
 {
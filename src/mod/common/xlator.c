@@ -1,23 +1,36 @@
 #include "mod/common/xlator.h"
 
-#include <linux/hashtable.h>
+#include <linux/hash.h>
+#include <linux/netdevice.h>
+#include <linux/proc_fs.h>
+#include <linux/rhashtable.h>
 #include <linux/sched.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
 
 #include "common/types.h"
 #include "common/xlat.h"
 #include "db/global.h"
+#include "mod/common/address.h"
 #include "mod/common/atomic_config.h"
+#include "mod/common/capture.h"
+#include "mod/common/icmp_ratelimit.h"
+#include "mod/common/init.h"
 #include "mod/common/joold.h"
+#include "mod/common/natlog.h"
+#include "mod/common/pmtu_cache.h"
 #include "mod/common/kernel_hook.h"
 #include "mod/common/log.h"
 #include "mod/common/rcu.h"
+#include "mod/common/route.h"
 #include "mod/common/wkmalloc.h"
 #include "mod/common/db/denylist4.h"
 #include "mod/common/db/eam.h"
+#include "mod/common/db/fragdb.h"
 #include "mod/common/db/pool4/db.h"
+#include "mod/common/db/talkers.h"
 #include "mod/common/db/bib/db.h"
-#include "mod/common/steps/handling_hairpinning_nat64.h"
-#include "mod/common/steps/handling_hairpinning_siit.h"
 
 /** Netfilter module registration object */
 static struct nf_hook_ops netfilter_hooks[] = {
@@ -39,42 +52,179 @@ static struct nf_hook_ops netfilter_hooks[] = {
  */
 struct jool_instance {
 	/**
-	 * The actual xlator. The other modules will actually receive a shallow
-	 * clone of it.
+	 * The actual xlator. Most modules will actually receive a shallow clone
+	 * of it, but the packet path reads it directly. (See
+	 * xlator_find_rcu().) Therefore, it must not change after it's
+	 * published; atomic configuration replaces the whole node instead.
 	 *
 	 * TODO (fine) maybe turn this into a const.
 	 */
 	struct xlator jool;
 
-	struct hlist_node table_hook;
-	bool hash_set;
-	u32 hash;
+	/** Hook to the global @instances table. */
+	struct rhash_head table_hook;
+	/** Hook to @siit_instances or @nat64_instances. */
+	struct list_head type_hook;
+	/** Hook to the namespace's jool_pernet.instances list. */
+	struct list_head ns_hook;
 
+	/* Hook to the namespace's jool_pernet.netfilter list. */
 	struct list_head list_hook;
+	/** Is this instance holding a reference to the debug key? */
+	bool debug_key;
+	/** Is this instance holding a reference to the NAT64 machinery? */
+	bool nat64_machinery;
+	/** The instance's mmappable stats; NULL if procfs couldn't help. */
+	struct jstat_file *stats_file;
+
+	/* Deferred destruction; see __xlator_rm(). */
+	struct rcu_head rcu;
+	struct work_struct destroy_work;
+};
+
+/*
+ * All the instances. The identifier is (ns, xt, iname).
+ * Resizable, because some users run one instance per customer namespace.
+ */
+static struct rhashtable instances;
+/*
+ * Also all the instances, split by type. Only used to iterate, so the timer
+ * doesn't have to wade through the SIIT instances.
+ */
+static LIST_HEAD(siit_instances);
+static LIST_HEAD(nat64_instances);
+static DEFINE_MUTEX(lock);
+/*
+ * Bumped (with @lock held) whenever @instances changes, so pointers cached
+ * outside of the table can tell they might be stale. (See xlator_generation().)
+ */
+static unsigned int generation;
+/* Destroys the removed instances, once their grace periods end. */
+static struct workqueue_struct *destroy_wq;
+
+struct nf_dispatch_entry {
+	__u32 first;
+	__u32 last;
+	struct xlator *jool;
+};
+
+/**
+ * A namespace's Netfilter instances, as the packet path sees them. (See
+ * xlator_find_netfilter().) Never modified once published; rebuilt from
+ * scratch whenever the namespace's Netfilter list changes.
+ */
+struct nf_dispatch {
+	/** The instance without netfilter-marks, if any. */
+	struct xlator *fallback;
+	/** The instances with netfilter-marks, sorted and disjoint. */
+	unsigned int count;
+	struct rcu_head rcu;
+	struct nf_dispatch_entry entries[];
+};
+
+/**
+ * Jool's per-namespace data. Lets the packet path find its instance without
+ * having to wade through every other namespace's instances.
+ */
+struct jool_pernet {
+	/** The namespace's instances. Only walked with the mutex locked. */
+	struct list_head instances;
+	/** The namespace's Netfilter instances. Same as @instances. */
+	struct list_head netfilter;
+	/** @netfilter, for the packet path. NULL if @netfilter is empty. */
+	struct nf_dispatch __rcu *dispatch;
 	/**
-	 * This points to a copy of the netfilter_hooks array.
-	 *
-	 * It needs to be a pointer to an array and not an array because the
-	 * ops needs to survive atomic configuration; the jool_instance needs to
-	 * be replaced but the ops needs to survive.
-	 *
-	 * This is only set if @jool.flags matches FW_NETFILTER.
+	 * A copy of the netfilter_hooks array, registered while @netfilter is
+	 * not empty. One per namespace, no matter how many Netfilter instances
+	 * it has, so each packet only goes through the dispatch once.
 	 */
 	struct nf_hook_ops *nf_ops;
+	/**
+	 * The netdev ingress hooks (struct ingress_hook) of the devices the
+	 * Netfilter instances listed in their ingress-devices. Only walked with
+	 * the mutex locked.
+	 */
+	struct list_head ingress;
+	/**
+	 * /proc/net/jool, and its siit and nat64 subdirectories, where the
+	 * instances' stats files live. NULL if they could not be created.
+	 */
+	struct proc_dir_entry *proc;
+	struct proc_dir_entry *proc_siit;
+	struct proc_dir_entry *proc_nat64;
 };
 
-static DEFINE_HASHTABLE(instances, 6); /* The identifier is (ns, xt, iname). */
-static struct list_head __rcu *netfilter_instances;
-static DEFINE_MUTEX(lock);
+static unsigned int jool_net_id __read_mostly;
+
+/*
+ * Must be called after the change is visible to the packet path, and before
+ * any removed instances start waiting for their grace periods.
+ */
+static void bump_generation(void)
+{
+	smp_store_release(&generation, generation + 1);
+}
+
+static struct jool_pernet *get_pernet(struct net *ns)
+{
+	return net_generic(ns, jool_net_id);
+}
+
+static int __net_init xlator_net_init(struct net *ns)
+{
+	struct jool_pernet *pernet = get_pernet(ns);
+
+	INIT_LIST_HEAD(&pernet->instances);
+	INIT_LIST_HEAD(&pernet->netfilter);
+	RCU_INIT_POINTER(pernet->dispatch, NULL);
+	pernet->nf_ops = NULL;
+	INIT_LIST_HEAD(&pernet->ingress);
+
+	/* The stats files are a convenience; translation doesn't need them. */
+	pernet->proc = proc_mkdir("jool", ns->proc_net);
+	pernet->proc_siit = NULL;
+	pernet->proc_nat64 = NULL;
+	if (pernet->proc) {
+		pernet->proc_siit = proc_mkdir("siit", pernet->proc);
+		pernet->proc_nat64 = proc_mkdir("nat64", pernet->proc);
+	}
+
+	return 0;
+}
+
+static void __net_exit xlator_net_exit(struct net *ns)
+{
+	/* jool.ko and jool_siit.ko are supposed to have flushed @ns already. */
+	WARN(!list_empty(&get_pernet(ns)->instances),
+			"There are elements in a namespace's xlator table after a cleanup.");
+	WARN(!list_empty(&get_pernet(ns)->ingress),
+			"There are ingress hooks in a namespace after a cleanup.");
+	proc_remove(get_pernet(ns)->proc);
+}
+
+static struct pernet_operations xlator_net_ops = {
+	.init = xlator_net_init,
+	.exit = xlator_net_exit,
+	.id = &jool_net_id,
+	.size = sizeof(struct jool_pernet),
+};
 
 static void (*defrag_enable)(struct net *ns);
 
-static u32 get_hash(struct net *ns, xlator_type xt, char const *iname)
+/* The @instances key. */
+struct instance_key {
+	struct net *ns;
+	xlator_type xt;
+	char const *iname;
+};
+
+static u32 get_hash(struct net *ns, xlator_type xt, char const *iname,
+		u32 seed)
 {
 	u32 hash;
 	unsigned int i;
 
-	hash = hash_ptr(ns, 32);
+	hash = hash_ptr(ns, 32) ^ seed;
 	hash = 31 * hash + xt;
 	for (i = 0; iname[i]; i++)
 		hash = 31 * hash + iname[i];
@@ -82,53 +232,130 @@ static u32 get_hash(struct net *ns, xlator_type xt, char const *iname)
 	return hash;
 }
 
-static u32 get_instance_hash(struct jool_instance *instance)
+static u32 instance_hashfn(const void *key, u32 len, u32 seed)
 {
-	if (instance->hash_set)
-		return instance->hash;
+	struct instance_key const *ikey = key;
+	return get_hash(ikey->ns, ikey->xt, ikey->iname, seed);
+}
 
-	instance->hash_set = true;
-	instance->hash = get_hash(instance->jool.ns,
+static u32 instance_obj_hashfn(const void *obj, u32 len, u32 seed)
+{
+	struct jool_instance const *instance = obj;
+	return get_hash(instance->jool.ns,
 			xlator_flags2xt(instance->jool.flags),
-			instance->jool.iname);
-	return instance->hash;
+			instance->jool.iname, seed);
+}
+
+static int instance_obj_cmpfn(struct rhashtable_compare_arg *arg,
+		const void *obj)
+{
+	struct instance_key const *key = arg->key;
+	struct jool_instance const *instance = obj;
+
+	return (key->ns != instance->jool.ns)
+			|| !(key->xt & instance->jool.flags)
+			|| (strcmp(key->iname, instance->jool.iname) != 0);
+}
+
+static const struct rhashtable_params instance_params = {
+	.head_offset = offsetof(struct jool_instance, table_hook),
+	.key_len = sizeof(struct instance_key),
+	.hashfn = instance_hashfn,
+	.obj_hashfn = instance_obj_hashfn,
+	.obj_cmpfn = instance_obj_cmpfn,
+	.automatic_shrinking = true,
+};
+
+static struct list_head *get_type_list(xlator_type xt)
+{
+	return (xt == XT_NAT64) ? &nat64_instances : &siit_instances;
 }
 
 static struct jool_instance *find_instance(struct net *ns, xlator_type xt,
 		char const *iname)
 {
-	struct jool_instance *instance;
-	u32 hash;
+	struct instance_key key;
+
+	key.ns = ns;
+	key.xt = xt;
+	key.iname = iname;
+	return rhashtable_lookup_fast(&instances, &key, instance_params);
+}
 
-	hash = get_hash(ns, xt, iname);
-	hash_for_each_possible_rcu(instances, instance, table_hook, hash)
-		if ((ns == instance->jool.ns)
-				&& (xt & instance->jool.flags)
-				&& (strcmp(iname, instance->jool.iname) == 0))
-			return instance;
+/* Requires the mutex, so the file name is not taken by a replacement yet. */
+static void create_stats_file(struct jool_instance *instance)
+{
+	struct jool_pernet *pernet;
+	struct proc_dir_entry *dir;
+
+	pernet = get_pernet(instance->jool.ns);
+	dir = xlator_is_nat64(&instance->jool)
+			? pernet->proc_nat64
+			: pernet->proc_siit;
+	if (!dir)
+		return;
 
-	return NULL;
+	instance->stats_file = jstat_file_create(instance->jool.stats,
+			instance->jool.iname, dir);
+	if (!instance->stats_file)
+		log_warn_once("Could not create the stats file of instance '%s'.",
+				instance->jool.iname);
 }
 
-static void destroy_jool_instance(struct jool_instance *instance, bool unhook)
+/* Same as create_stats_file(). */
+static void destroy_stats_file(struct jool_instance *instance)
 {
-	if (xlator_is_netfilter(&instance->jool)) {
-		if (unhook) {
-			nf_unregister_net_hooks(instance->jool.ns,
-					instance->nf_ops,
-					ARRAY_SIZE(netfilter_hooks));
-		}
-		__wkfree("nf_hook_ops", instance->nf_ops);
+	if (instance->stats_file) {
+		jstat_file_destroy(instance->stats_file);
+		instance->stats_file = NULL;
 	}
+}
 
+static void destroy_jool_instance(struct jool_instance *instance)
+{
+	destroy_stats_file(instance);
+	if (instance->debug_key)
+		debug_key_put();
 	xlator_put(&instance->jool);
+	if (instance->nat64_machinery)
+		jool_nat64_machinery_put();
 	log_info("Deleted instance '%s'.", instance->jool.iname);
 	wkfree(struct jool_instance, instance);
 }
 
-static void xlator_get(struct xlator *jool)
+/*
+ * Has to happen during the removal itself, because the namespace might die
+ * before the deferred destruction runs. Can sleep.
+ */
+static void stop_transports(struct jool_instance *instance)
+{
+	if (xlator_is_nat64(&instance->jool) && instance->jool.nat64.joold)
+		joold_stop_transport(instance->jool.nat64.joold);
+}
+
+static void destroy_work_fn(struct work_struct *work)
+{
+	destroy_jool_instance(container_of(work, struct jool_instance,
+			destroy_work));
+}
+
+/* RCU callbacks run in softirq context, but destruction might sleep. */
+static void destroy_rcu_cb(struct rcu_head *rcu)
+{
+	struct jool_instance *instance;
+
+	instance = container_of(rcu, struct jool_instance, rcu);
+	INIT_WORK(&instance->destroy_work, destroy_work_fn);
+	queue_work(destroy_wq, &instance->destroy_work);
+}
+
+void xlator_get(struct xlator *jool)
 {
 	jstat_get(jool->stats);
+	route_cache_get(jool->routes);
+	icmp_ratelimit_get(jool->icmp_ratelimit);
+	pmtu_cache_get(jool->pmtu);
+	capture_get(jool->capture);
 
 	switch (xlator_get_type(jool)) {
 	case XT_SIIT:
@@ -139,46 +366,338 @@ static void xlator_get(struct xlator *jool)
 		pool4db_get(jool->nat64.pool4);
 		bib_get(jool->nat64.bib);
 		joold_get(jool->nat64.joold);
+		natlog_get(jool->nat64.natlog);
+		fragdb_get(jool->nat64.fragdb);
+		talkers_get(jool->nat64.talkers);
 		break;
 	}
 }
 
+static void nf_dispatch_free_cb(struct rcu_head *rcu)
+{
+	__wkfree("nf_dispatch", container_of(rcu, struct nf_dispatch, rcu));
+}
+
+/*
+ * Allocates a dispatch big enough for @pernet's Netfilter instances, plus
+ * @extra. Requires the mutex.
+ */
+static struct nf_dispatch *nf_dispatch_alloc(struct jool_pernet *pernet,
+		unsigned int extra)
+{
+	struct jool_instance *instance;
+	unsigned int count = extra;
+
+	list_for_each_entry(instance, &pernet->netfilter, list_hook)
+		count++;
+
+	return __wkmalloc("nf_dispatch", sizeof(struct nf_dispatch)
+			+ count * sizeof(struct nf_dispatch_entry), GFP_KERNEL);
+}
+
+/*
+ * Fills @new (see nf_dispatch_alloc()) out of @pernet's current Netfilter list,
+ * and hands it over to the packet path. Requires the mutex.
+ *
+ * @new can be NULL only if allocation failed during a flush; the namespace's
+ * remaining Netfilter instances will stop translating until the next change.
+ */
+static void nf_dispatch_commit(struct jool_pernet *pernet,
+		struct nf_dispatch *new)
+{
+	struct nf_dispatch *old;
+	struct jool_instance *instance;
+	struct config_mark_range *marks;
+	unsigned int i;
+
+	if (list_empty(&pernet->netfilter)) {
+		if (new)
+			__wkfree("nf_dispatch", new);
+		new = NULL;
+	} else if (!new) {
+		log_err("Memory allocation failure; the namespace's Netfilter instances are disabled.");
+	} else {
+		new->fallback = NULL;
+		new->count = 0;
+
+		list_for_each_entry(instance, &pernet->netfilter, list_hook) {
+			marks = &instance->jool.globals.netfilter_marks;
+			if (!marks->set) {
+				new->fallback = &instance->jool;
+				continue;
+			}
+
+			/* Insertion sort; there are few of them. */
+			for (i = new->count; i > 0; i--) {
+				if (new->entries[i - 1].first < marks->first)
+					break;
+				new->entries[i] = new->entries[i - 1];
+			}
+			new->entries[i].first = marks->first;
+			new->entries[i].last = marks->last;
+			new->entries[i].jool = &instance->jool;
+			new->count++;
+		}
+	}
+
+	old = rcu_dereference_protected(pernet->dispatch,
+			lockdep_is_held(&lock));
+	rcu_assign_pointer(pernet->dispatch, new);
+	if (old)
+		call_rcu_bh(&old->rcu, nf_dispatch_free_cb);
+}
+
+/* Registers @ns's hooks, unless they already are. Requires the mutex. */
+static int nf_hooks_get(struct net *ns, struct jool_pernet *pernet)
+{
+	struct nf_hook_ops *ops;
+	int error;
+
+	if (pernet->nf_ops)
+		return 0;
+
+	ops = __wkmalloc("nf_hook_ops", sizeof(netfilter_hooks), GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+	memcpy(ops, netfilter_hooks, sizeof(netfilter_hooks));
+
+	error = nf_register_net_hooks(ns, ops, ARRAY_SIZE(netfilter_hooks));
+	if (error) {
+		__wkfree("nf_hook_ops", ops);
+		return error;
+	}
+
+	pernet->nf_ops = ops;
+	return 0;
+}
+
+/*
+ * Unregisters @ns's hooks, if it no longer has Netfilter instances. Requires
+ * the mutex.
+ */
+static void nf_hooks_put(struct net *ns, struct jool_pernet *pernet)
+{
+	if (!pernet->nf_ops || !list_empty(&pernet->netfilter))
+		return;
+
+	nf_unregister_net_hooks(ns, pernet->nf_ops,
+			ARRAY_SIZE(netfilter_hooks));
+	__wkfree("nf_hook_ops", pernet->nf_ops);
+	pernet->nf_ops = NULL;
+}
+
+/*
+ * Netdev ingress hooks. (ingress-devices)
+ *
+ * They're additions; the pre-routing hooks stay registered, and handle
+ * whatever hook_ingress() declines. Same as those, they belong to the
+ * namespace: each device gets one hook, as long as one of the namespace's
+ * Netfilter instances wants it, and the hook dispatches the packet as usual.
+ */
+struct ingress_hook {
+	/** .dev holds a reference to the device. */
+	struct nf_hook_ops ops;
+	struct list_head list_hook;
+};
+
+/* Does any of @pernet's Netfilter instances want @name? Requires the mutex. */
+static bool ingress_wanted(struct jool_pernet *pernet, char const *name)
+{
+	struct jool_instance *instance;
+	struct ingress_devices *devices;
+	unsigned int i;
+
+	list_for_each_entry(instance, &pernet->netfilter, list_hook) {
+		devices = &instance->jool.globals.ingress_devices;
+		for (i = 0; i < devices->count; i++)
+			if (strncmp(devices->names[i], name,
+					IFNAME_MAX_SIZE) == 0)
+				return true;
+	}
+
+	return false;
+}
+
+static bool ingress_hooked(struct jool_pernet *pernet, struct net_device *dev)
+{
+	struct ingress_hook *hook;
+
+	list_for_each_entry(hook, &pernet->ingress, list_hook)
+		if (hook->ops.dev == dev)
+			return true;
+	return false;
+}
+
+static void ingress_hook_add(struct net *ns, struct jool_pernet *pernet,
+		struct net_device *dev)
+{
+	struct ingress_hook *hook;
+	int error;
+
+	hook = wkmalloc(struct ingress_hook, GFP_KERNEL);
+	if (!hook) {
+		error = -ENOMEM;
+		goto fail;
+	}
+
+	memset(&hook->ops, 0, sizeof(hook->ops));
+	hook->ops.hook = hook_ingress;
+	hook->ops.pf = NFPROTO_NETDEV;
+	hook->ops.hooknum = NF_NETDEV_INGRESS;
+	/* After the usual filter chains, same as pre-routing. */
+	hook->ops.priority = 25;
+	hook->ops.dev = dev;
+
+	error = nf_register_net_hook(ns, &hook->ops);
+	if (error) {
+		wkfree(struct ingress_hook, hook);
+		goto fail;
+	}
+
+	list_add_tail(&hook->list_hook, &pernet->ingress);
+	return;
+
+fail:
+	/* Not fatal; pre-routing will translate the device's packets. */
+	log_warn("Cannot hook the ingress of %s (error code %d); its packets will be translated at pre-routing.",
+			dev->name, error);
+	dev_put(dev);
+}
+
+static void ingress_hook_rm(struct net *ns, struct ingress_hook *hook)
+{
+	nf_unregister_net_hook(ns, &hook->ops);
+	dev_put(hook->ops.dev);
+	list_del(&hook->list_hook);
+	wkfree(struct ingress_hook, hook);
+}
+
+/*
+ * Makes @ns's ingress hooks match what its Netfilter instances want.
+ * @gone is a device that's being unregistered, or NULL. Requires the mutex.
+ */
+static void ingress_hooks_sync(struct net *ns, struct jool_pernet *pernet,
+		struct net_device *gone)
+{
+	struct ingress_hook *hook;
+	struct ingress_hook *tmp;
+	struct jool_instance *instance;
+	struct ingress_devices *devices;
+	struct net_device *dev;
+	unsigned int i;
+
+	list_for_each_entry_safe(hook, tmp, &pernet->ingress, list_hook)
+		if (hook->ops.dev == gone
+				|| !ingress_wanted(pernet, hook->ops.dev->name))
+			ingress_hook_rm(ns, hook);
+
+	list_for_each_entry(instance, &pernet->netfilter, list_hook) {
+		devices = &instance->jool.globals.ingress_devices;
+		for (i = 0; i < devices->count; i++) {
+			dev = dev_get_by_name(ns, devices->names[i]);
+			if (!dev)
+				continue; /* The notifier will catch it. */
+			if (dev == gone || ingress_hooked(pernet, dev))
+				dev_put(dev);
+			else
+				ingress_hook_add(ns, pernet, dev);
+		}
+	}
+}
+
+/*
+ * Devices can show up, leave and be renamed after the instances name them, so
+ * this keeps the ingress hooks and the static next hops up to date.
+ */
+static int netdev_event(struct notifier_block *nb, unsigned long event,
+		void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+	struct net_device *gone;
+	struct jool_pernet *pernet;
+	struct jool_instance *instance;
+
+	switch (event) {
+	case NETDEV_REGISTER:
+	case NETDEV_UNREGISTER:
+	case NETDEV_CHANGENAME:
+		break;
+	default:
+		return NOTIFY_DONE;
+	}
+
+	pernet = get_pernet(dev_net(dev));
+	if (!pernet)
+		return NOTIFY_DONE; /* xlator_net_init() hasn't run yet. */
+
+	gone = (event == NETDEV_UNREGISTER) ? dev : NULL;
+
+	mutex_lock(&lock);
+	ingress_hooks_sync(dev_net(dev), pernet, gone);
+	list_for_each_entry(instance, &pernet->instances, ns_hook)
+		route_next_hops_sync(&instance->jool, gone);
+	mutex_unlock(&lock);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block netdev_notifier = {
+	.notifier_call = netdev_event,
+};
+
 /**
  * Moves the jool_instance nodes from the database (that match the @ns
  * namespace and the @xt type) to the @detached list.
  */
 static void __flush_detach(struct net *ns, xlator_type xt,
-		struct hlist_head *detached)
+		struct list_head *detached)
 {
+	struct jool_pernet *pernet = get_pernet(ns);
 	struct jool_instance *instance;
-	struct hlist_node *tmp;
-	size_t i;
-
-	hash_for_each_safe(instances, i, tmp, instance, table_hook) {
-		if (instance->jool.ns == ns && (instance->jool.flags & xt)) {
-			hash_del_rcu(&instance->table_hook);
-			hlist_add_head(&instance->table_hook, detached);
-			if (instance->jool.flags & XF_NETFILTER)
+	struct jool_instance *tmp;
+	bool netfilter = false;
+
+	list_for_each_entry_safe(instance, tmp, &pernet->instances, ns_hook) {
+		if (instance->jool.flags & xt) {
+			rhashtable_remove_fast(&instances, &instance->table_hook,
+					instance_params);
+			list_del_rcu(&instance->type_hook);
+			list_move(&instance->ns_hook, detached);
+			if (instance->jool.flags & XF_NETFILTER) {
 				list_del_rcu(&instance->list_hook);
+				netfilter = true;
+			}
+			destroy_stats_file(instance);
+			bump_generation();
 		}
 	}
+
+	if (netfilter) {
+		nf_dispatch_commit(pernet, nf_dispatch_alloc(pernet, 0));
+		ingress_hooks_sync(ns, pernet, NULL);
+		nf_hooks_put(ns, pernet);
+	}
 }
 
 /**
  * Actually deletes all of the jool_instance nodes listed in @detached.
+ * (Their hooks, if any, are already gone.)
  */
-static void __flush_delete(struct hlist_head *detached)
+static void __flush_delete(struct list_head *detached)
 {
 	struct jool_instance *instance;
-	struct hlist_node *tmp;
+	struct jool_instance *tmp;
 
-	if (hlist_empty(detached))
+	if (list_empty(detached))
 		return; /* Calling synchronize_rcu_bh() for no reason is bad. */
 
+	list_for_each_entry(instance, detached, ns_hook)
+		stop_transports(instance);
+
 	synchronize_rcu_bh();
 
-	hlist_for_each_entry_safe(instance, tmp, detached, table_hook)
-		destroy_jool_instance(instance, true);
+	list_for_each_entry_safe(instance, tmp, detached, ns_hook)
+		destroy_jool_instance(instance);
 }
 
 /**
@@ -189,7 +708,7 @@ static void __flush_delete(struct hlist_head *detached)
  */
 void jool_xlator_flush_net(struct net *ns, xlator_type xt)
 {
-	HLIST_HEAD(detached);
+	LIST_HEAD(detached);
 
 	mutex_lock(&lock);
 	__flush_detach(ns, xt, &detached);
@@ -210,7 +729,7 @@ EXPORT_SYMBOL_GPL(jool_xlator_flush_net);
 void jool_xlator_flush_batch(struct list_head *net_exit_list, xlator_type xt)
 {
 	struct net *ns;
-	HLIST_HEAD(detached);
+	LIST_HEAD(detached);
 
 	mutex_lock(&lock);
 	list_for_each_entry(ns, net_exit_list, exit_list)
@@ -226,15 +745,35 @@ EXPORT_SYMBOL_GPL(jool_xlator_flush_batch);
  */
 int xlator_setup(void)
 {
-	struct list_head *list;
+	int error;
 
-	list = __wkmalloc("xlator DB", sizeof(struct list_head), GFP_KERNEL);
-	if (!list)
-		return -ENOMEM;
-	INIT_LIST_HEAD(list);
-	RCU_INIT_POINTER(netfilter_instances, list);
+	error = rhashtable_init(&instances, &instance_params);
+	if (error)
+		return error;
+
+	destroy_wq = alloc_workqueue("jool_xlator", 0, 0);
+	if (!destroy_wq) {
+		error = -ENOMEM;
+		goto wq_fail;
+	}
+
+	error = register_pernet_subsys(&xlator_net_ops);
+	if (error)
+		goto pernet_fail;
+
+	error = register_netdevice_notifier(&netdev_notifier);
+	if (error)
+		goto notifier_fail;
 
 	return 0;
+
+notifier_fail:
+	unregister_pernet_subsys(&xlator_net_ops);
+pernet_fail:
+	destroy_workqueue(destroy_wq);
+wq_fail:
+	rhashtable_destroy(&instances);
+	return error;
 }
 
 void xlator_set_defrag(void (*_defrag_enable)(struct net *ns))
@@ -248,12 +787,17 @@ void xlator_set_defrag(void (*_defrag_enable)(struct net *ns))
  */
 void xlator_teardown(void)
 {
-	struct list_head *ni;
-
-	WARN(!hash_empty(instances), "There are elements in the xlator table after a cleanup.");
-	ni = rcu_dereference_raw(netfilter_instances);
-	WARN(!list_empty(ni), "There are elements in the xlator list after a cleanup.");
-	__wkfree("xlator DB", ni);
+	WARN(!list_empty(&siit_instances) || !list_empty(&nat64_instances),
+			"There are elements in the xlator table after a cleanup.");
+	unregister_netdevice_notifier(&netdev_notifier);
+	unregister_pernet_subsys(&xlator_net_ops);
+	/*
+	 * Wait for the pending removals. The callbacks queue the work.
+	 * (This also waits for the trie nodes that rtrie_rm() released.)
+	 */
+	rcu_barrier_bh();
+	destroy_workqueue(destroy_wq);
+	rhashtable_destroy(&instances);
 }
 
 static int init_siit(struct xlator *jool, struct ipv6_prefix *pool6)
@@ -263,10 +807,23 @@ static int init_siit(struct xlator *jool, struct ipv6_prefix *pool6)
 	error = globals_init(&jool->globals, XT_SIIT, pool6);
 	if (error)
 		return error;
+	xlator_sync_fast(jool);
 
 	jool->stats = jstat_alloc();
 	if (!jool->stats)
 		goto stats_fail;
+	jool->routes = route_cache_alloc();
+	if (!jool->routes)
+		goto routes_fail;
+	jool->icmp_ratelimit = icmp_ratelimit_alloc();
+	if (!jool->icmp_ratelimit)
+		goto icmp_ratelimit_fail;
+	jool->pmtu = pmtu_cache_alloc();
+	if (!jool->pmtu)
+		goto pmtu_fail;
+	jool->capture = capture_alloc();
+	if (!jool->capture)
+		goto capture_fail;
 	jool->siit.eamt = eamt_alloc();
 	if (!jool->siit.eamt)
 		goto eamt_fail;
@@ -274,13 +831,19 @@ static int init_siit(struct xlator *jool, struct ipv6_prefix *pool6)
 	if (!jool->siit.denylist4)
 		goto denylist4_fail;
 
-	jool->is_hairpin = is_hairpin_siit;
-	jool->handling_hairpinning = handling_hairpinning_siit;
 	return 0;
 
 denylist4_fail:
 	eamt_put(jool->siit.eamt);
 eamt_fail:
+	capture_put(jool->capture);
+capture_fail:
+	pmtu_cache_put(jool->pmtu);
+pmtu_fail:
+	icmp_ratelimit_put(jool->icmp_ratelimit);
+icmp_ratelimit_fail:
+	route_cache_put(jool->routes);
+routes_fail:
 	jstat_put(jool->stats);
 stats_fail:
 	return -ENOMEM;
@@ -293,10 +856,23 @@ static int init_nat64(struct xlator *jool, struct ipv6_prefix *pool6)
 	error = globals_init(&jool->globals, XT_NAT64, pool6);
 	if (error)
 		return error;
+	xlator_sync_fast(jool);
 
 	jool->stats = jstat_alloc();
 	if (!jool->stats)
 		goto stats_fail;
+	jool->routes = route_cache_alloc();
+	if (!jool->routes)
+		goto routes_fail;
+	jool->icmp_ratelimit = icmp_ratelimit_alloc();
+	if (!jool->icmp_ratelimit)
+		goto icmp_ratelimit_fail;
+	jool->pmtu = pmtu_cache_alloc();
+	if (!jool->pmtu)
+		goto pmtu_fail;
+	jool->capture = capture_alloc();
+	if (!jool->capture)
+		goto capture_fail;
 	jool->nat64.pool4 = pool4db_alloc();
 	if (!jool->nat64.pool4)
 		goto pool4_fail;
@@ -306,16 +882,37 @@ static int init_nat64(struct xlator *jool, struct ipv6_prefix *pool6)
 	jool->nat64.joold = joold_alloc();
 	if (!jool->nat64.joold)
 		goto joold_fail;
+	jool->nat64.natlog = natlog_alloc();
+	if (!jool->nat64.natlog)
+		goto natlog_fail;
+	jool->nat64.fragdb = fragdb_alloc();
+	if (!jool->nat64.fragdb)
+		goto fragdb_fail;
+	jool->nat64.talkers = talkers_alloc();
+	if (!jool->nat64.talkers)
+		goto talkers_fail;
 
-	jool->is_hairpin = is_hairpin_nat64;
-	jool->handling_hairpinning = handling_hairpinning_nat64;
 	return 0;
 
+talkers_fail:
+	fragdb_put(jool->nat64.fragdb);
+fragdb_fail:
+	natlog_put(jool->nat64.natlog);
+natlog_fail:
+	joold_put(jool->nat64.joold);
 joold_fail:
 	bib_put(jool->nat64.bib);
 bib_fail:
 	pool4db_put(jool->nat64.pool4);
 pool4_fail:
+	capture_put(jool->capture);
+capture_fail:
+	pmtu_cache_put(jool->pmtu);
+pmtu_fail:
+	icmp_ratelimit_put(jool->icmp_ratelimit);
+icmp_ratelimit_fail:
+	route_cache_put(jool->routes);
+routes_fail:
 	jstat_put(jool->stats);
 stats_fail:
 	return -ENOMEM;
@@ -331,6 +928,12 @@ int xlator_init(struct xlator *jool, struct net *ns, char *iname,
 		log_err(XF_VALIDATE_ERRMSG);
 		return error;
 	}
+#ifdef JOOL_SIIT_ONLY
+	if (flags & XT_NAT64) {
+		log_err("This build of Jool only supports SIIT instances. (It was compiled with JOOL_SIIT_ONLY.)");
+		return -EINVAL;
+	}
+#endif
 
 	jool->ns = ns;
 	strcpy(jool->iname, iname);
@@ -396,23 +999,48 @@ static int basic_add_validations(char *iname, xlator_flags flags,
  * Assumes the DB mutex is locked.
  */
 static int validate_collision(struct net *ns, char *iname, xlator_flags flags)
+{
+	if (find_instance(ns, xlator_flags2xt(flags), iname)) {
+		log_err("This namespace already has a Jool instance named '%s'.",
+				iname);
+		return -EEXIST;
+	}
+
+	return 0;
+}
+
+/*
+ * Makes sure the packet path will be able to tell @jool apart from @ns's other
+ * Netfilter instances. (Except @old, which @jool is replacing, if not NULL.)
+ * Assumes the DB mutex is locked.
+ */
+static int validate_marks(struct net *ns, struct xlator const *jool,
+		struct jool_instance const *old)
 {
 	struct jool_instance *instance;
-	size_t i;
+	struct config_mark_range const *mine;
+	struct config_mark_range const *theirs;
 
-	hash_for_each(instances, i, instance, table_hook) {
-		if (instance->jool.ns != ns)
-			continue;
-		if (xlator_flags2xt(instance->jool.flags) != xlator_flags2xt(flags))
+	if (!xlator_is_netfilter(jool))
+		return 0;
+
+	mine = &jool->globals.netfilter_marks;
+	list_for_each_entry(instance, &get_pernet(ns)->netfilter, list_hook) {
+		if (instance == old)
 			continue;
-		if (strcmp(instance->jool.iname, iname) == 0) {
-			log_err("This namespace already has a Jool instance named '%s'.",
-					iname);
+
+		theirs = &instance->jool.globals.netfilter_marks;
+		if (!mine->set && !theirs->set) {
+			log_err("Netfilter instance '%s' already takes the marks the other Netfilter instances don't; please assign netfilter-marks to one of them.",
+					instance->jool.iname);
 			return -EEXIST;
 		}
-
-		if ((flags & XF_NETFILTER) && xlator_is_netfilter(&instance->jool)) {
-			log_err("This namespace already has a Netfilter Jool instance.");
+		if (mine->set && theirs->set && mine->first <= theirs->last
+				&& theirs->first <= mine->last) {
+			log_err("netfilter-marks %u-%u overlap with the ones of Netfilter instance '%s' (%u-%u).",
+					mine->first, mine->last,
+					instance->jool.iname,
+					theirs->first, theirs->last);
 			return -EEXIST;
 		}
 	}
@@ -425,42 +1053,68 @@ static int validate_collision(struct net *ns, char *iname, xlator_flags flags)
  */
 static int __xlator_add(struct jool_instance *new, struct xlator *result)
 {
-	struct list_head *list;
+	struct jool_pernet *pernet;
+	struct nf_dispatch *dispatch = NULL;
+	int error;
 
-	if (xlator_is_netfilter(&new->jool)) {
-		struct nf_hook_ops *ops;
-		int error;
+	/* Before the hooks; packets will need it right away. */
+	if (xlator_is_nat64(&new->jool)) {
+		error = jool_nat64_machinery_get();
+		if (error)
+			return error;
+		/* destroy_jool_instance() will return it from now on. */
+		new->nat64_machinery = true;
+	}
 
-		ops = __wkmalloc("nf_hook_ops",
-		    ARRAY_SIZE(netfilter_hooks) * sizeof(struct nf_hook_ops),
-		    GFP_KERNEL);
-		if (!ops)
-			return -ENOMEM;
+	pernet = get_pernet(new->jool.ns);
 
-		/* All error roads from now need to free @ops. */
+	if (xlator_is_netfilter(&new->jool)) {
+		dispatch = nf_dispatch_alloc(pernet, 1);
+		if (!dispatch)
+			return -ENOMEM;
 
-		memcpy(ops, netfilter_hooks, sizeof(netfilter_hooks));
+		/* All error roads from now need to free @dispatch. */
 
-		error = nf_register_net_hooks(new->jool.ns, ops,
-				ARRAY_SIZE(netfilter_hooks));
+		error = nf_hooks_get(new->jool.ns, pernet);
 		if (error) {
-			__wkfree("nf_hook_ops", ops);
+			__wkfree("nf_dispatch", dispatch);
 			return error;
 		}
+	}
 
-		new->nf_ops = ops;
+	/* Also before the hooks; it's for the packet path as well. */
+	route_next_hops_sync(&new->jool, NULL);
+
+	error = rhashtable_insert_fast(&instances, &new->table_hook,
+			instance_params);
+	if (error) {
+		if (dispatch) {
+			nf_hooks_put(new->jool.ns, pernet);
+			__wkfree("nf_dispatch", dispatch);
+		}
+		return error;
 	}
+	bump_generation();
 
-	hash_add_rcu(instances, &new->table_hook, get_instance_hash(new));
+	list_add_tail_rcu(&new->type_hook,
+			get_type_list(xlator_get_type(&new->jool)));
+	list_add_tail(&new->ns_hook, &pernet->instances);
 	if (new->jool.flags & XF_NETFILTER) {
-		list = rcu_dereference_protected(netfilter_instances,
-				lockdep_is_held(&lock));
-		list_add_tail_rcu(&new->list_hook, list);
+		list_add_tail_rcu(&new->list_hook, &pernet->netfilter);
+		nf_dispatch_commit(pernet, dispatch);
+		ingress_hooks_sync(new->jool.ns, pernet, NULL);
 	}
 
 	if (new->jool.flags & XT_NAT64)
 		defrag_enable(new->jool.ns);
 
+	if (new->jool.globals.debug) {
+		debug_key_get();
+		new->debug_key = true;
+	}
+
+	create_stats_file(new);
+
 	if (result) {
 		xlator_get(&new->jool);
 		memcpy(result, &new->jool, sizeof(new->jool));
@@ -508,9 +1162,9 @@ int xlator_add(xlator_flags flags, char *iname, struct ipv6_prefix *pool6,
 		put_net(ns);
 		return error;
 	}
-	instance->hash_set = false;
-	instance->hash = 0;
-	instance->nf_ops = NULL;
+	instance->debug_key = false;
+	instance->nat64_machinery = false;
+	instance->stats_file = NULL;
 
 	/* Error roads from now no longer need to free @instance. */
 	/* Error roads from now need to properly destroy @instance. */
@@ -520,6 +1174,9 @@ int xlator_add(xlator_flags flags, char *iname, struct ipv6_prefix *pool6,
 	/* All roads from now on must unlock the mutex. */
 
 	error = validate_collision(ns, iname, flags);
+	if (error)
+		goto mutex_fail;
+	error = validate_marks(ns, &instance->jool, NULL);
 	if (error)
 		goto mutex_fail;
 
@@ -534,14 +1191,16 @@ int xlator_add(xlator_flags flags, char *iname, struct ipv6_prefix *pool6,
 
 mutex_fail:
 	mutex_unlock(&lock);
-	destroy_jool_instance(instance, false);
+	destroy_jool_instance(instance);
 	put_net(ns);
 	return error;
 }
 
 static int __xlator_rm(struct net *ns, char *iname, xlator_type xt)
 {
+	struct jool_pernet *pernet = get_pernet(ns);
 	struct jool_instance *instance;
+	struct nf_dispatch *dispatch = NULL;
 
 	mutex_lock(&lock);
 
@@ -552,23 +1211,42 @@ static int __xlator_rm(struct net *ns, char *iname, xlator_type xt)
 		return -ESRCH;
 	}
 
-	hash_del_rcu(&instance->table_hook);
-	if (instance->jool.flags & XF_NETFILTER)
+	if (instance->jool.flags & XF_NETFILTER) {
+		dispatch = nf_dispatch_alloc(pernet, 0);
+		if (!dispatch) {
+			mutex_unlock(&lock);
+			return -ENOMEM;
+		}
+	}
+
+	rhashtable_remove_fast(&instances, &instance->table_hook,
+			instance_params);
+	list_del_rcu(&instance->type_hook);
+	list_del(&instance->ns_hook);
+	if (instance->jool.flags & XF_NETFILTER) {
 		list_del_rcu(&instance->list_hook);
+		nf_dispatch_commit(pernet, dispatch);
+		ingress_hooks_sync(ns, pernet, NULL);
+		/* The last one takes the hooks with it. */
+		nf_hooks_put(ns, pernet);
+	}
+	destroy_stats_file(instance);
+	bump_generation();
 
 	mutex_unlock(&lock);
-	synchronize_rcu_bh();
+
+	stop_transports(instance);
 
 	/*
-	 * Nobody can kref_get the databases now:
+	 * Nobody can kref_get the databases after the grace period:
 	 * Other code should not do it because of the
 	 * xlator_find() contract, and xlator_find()'s
 	 * xlator_get() already happened. Other xlator_find()'s
 	 * xlator_get()s are not going to get in the way either
 	 * because the instance is no longer listed.
-	 * So finally return everything.
+	 * So return everything then, without making the user wait for it.
 	 */
-	destroy_jool_instance(instance, true);
+	call_rcu_bh(&instance->rcu, destroy_rcu_cb);
 	return 0;
 }
 
@@ -602,49 +1280,55 @@ int xlator_rm(xlator_type xt, char *iname)
 
 struct check_bib_arg {
 	struct xlator *jool;
-	struct bib_entry badbib;
+	l4_protocol proto;
 };
 
-static int check_bib(struct bib_entry const *bib, void *_arg)
+static bool bib_in_pool4(struct ipv4_transport_addr const *addr, __u16 *last,
+		void *_arg)
 {
 	struct check_bib_arg *arg = _arg;
-
-	if (!pool4db_contains(arg->jool->nat64.pool4, arg->jool->ns,
-			bib->l4_proto, &bib->addr4)) {
-		arg->badbib = *bib;
-		return -EINVAL;
-	}
-
-	return 0;
+	return pool4db_covers(arg->jool->nat64.pool4, arg->jool->ns, arg->proto,
+			addr, last);
 }
 
+/*
+ * Every BIB entry must belong to pool4. The pool4 ranges are usually much
+ * coarser than the BIB, so the walk skips each range's entries as a block.
+ */
 static int basic_replace_validations(struct xlator *jool)
 {
 	struct check_bib_arg arg;
+	struct bib_entry badbib;
+	l4_protocol protos[] = { L4PROTO_TCP, L4PROTO_UDP, L4PROTO_ICMP };
+	unsigned int i;
 
 	if (!xlator_is_nat64(jool))
 		return 0; // Nothing to validate for SIIT.
 
 	arg.jool = jool;
-	if (bib_foreach(jool->nat64.bib, L4PROTO_TCP, check_bib, &arg, NULL) ||
-	    bib_foreach(jool->nat64.bib, L4PROTO_UDP, check_bib, &arg, NULL) ||
-	    bib_foreach(jool->nat64.bib, L4PROTO_ICMP, check_bib, &arg, NULL)) {
-		log_err("%s BIB transport address '" TA4PP
-				"' does not belong to pool4.\n"
-				"Please add it there first.",
-				l4proto_to_string(arg.badbib.l4_proto),
-				TA4PA(arg.badbib.addr4));
-		return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(protos); i++) {
+		arg.proto = protos[i];
+		if (bib_find_uncovered(jool->nat64.bib, arg.proto,
+				bib_in_pool4, &arg, &badbib)) {
+			log_err("%s BIB transport address '" TA4PP
+					"' does not belong to pool4.\n"
+					"Please add it there first.",
+					l4proto_to_string(badbib.l4_proto),
+					TA4PA(badbib.addr4));
+			return -EINVAL;
+		}
 	}
 
 	return 0;
 }
 
-int xlator_replace(struct xlator *jool)
+/*
+ * First stage of xlator_replace(): The validations and allocations that don't
+ * need the mutex. Returns the new node in @result.
+ */
+static int replace_prepare(struct xlator *jool, struct jool_instance **result)
 {
-	struct jool_instance *old;
 	struct jool_instance *new;
-	struct list_head *list;
 	int error;
 
 	error = basic_add_validations(jool->iname, jool->flags,
@@ -661,76 +1345,362 @@ int xlator_replace(struct xlator *jool)
 	if (!new)
 		return -ENOMEM;
 	memcpy(&new->jool, jool, sizeof(*jool));
+	/* The globals might have changed since the clone. */
+	xlator_sync_fast(&new->jool);
 	xlator_get(&new->jool);
-	new->hash_set = false;
-	new->nf_ops = NULL;
+	new->debug_key = false;
+	new->nat64_machinery = false;
+	new->stats_file = NULL;
 
-	mutex_lock(&lock);
+	error = capture_prepare(&new->jool);
+	if (error) {
+		destroy_jool_instance(new);
+		return error;
+	}
 
-	old = find_instance(jool->ns, xlator_flags2xt(jool->flags), jool->iname);
-	if (!old) {
-		/* Not found, hence not replacing. Add it instead. */
-		error = __xlator_add(new, NULL);
-		if (error)
-			destroy_jool_instance(new, false);
+	*result = new;
+	return 0;
+}
 
-		mutex_unlock(&lock);
+/*
+ * Second stage of xlator_replace(): Lists @new, in place of the instance it
+ * replaces (which is returned in @old), or as a new one (and @old is NULL).
+ * On success, @new belongs to the database. On failure, it's still the
+ * caller's.
+ *
+ * Requires the mutex to be locked.
+ */
+static int replace_locked(struct jool_instance *new, struct jool_instance **old)
+{
+	struct xlator *jool = &new->jool;
+	struct jool_instance *prev;
+	struct nf_dispatch *dispatch = NULL;
+	int error;
+
+	prev = find_instance(jool->ns, xlator_flags2xt(jool->flags),
+			jool->iname);
+	if (!prev) {
+		/* Not found, hence not replacing. Add it instead. */
+		error = validate_marks(jool->ns, jool, NULL);
+		if (!error)
+			error = __xlator_add(new, NULL);
+		*old = NULL;
 		return error;
 	}
 
-	if (xlator_get_framework(&old->jool) != xlator_get_framework(&new->jool)) {
+	if (xlator_get_framework(&prev->jool) != xlator_get_framework(jool)) {
 		log_err("Sorry; you can't change an instance's framework for now.");
-		goto abort;
+		return -EINVAL;
 	}
-	if (xlator_is_nat64(&new->jool) && !prefix6_equals(
-			&old->jool.globals.pool6.prefix,
-			&new->jool.globals.pool6.prefix)) {
+	if (xlator_is_nat64(jool) && !prefix6_equals(
+			&prev->jool.globals.pool6.prefix,
+			&jool->globals.pool6.prefix)) {
 		log_err("Sorry; you can't change a NAT64 instance's pool6 for now.");
-		goto abort;
+		return -EINVAL;
+	}
+	error = validate_marks(jool->ns, jool, prev);
+	if (error)
+		return error;
+	if (xlator_is_netfilter(jool)) {
+		dispatch = nf_dispatch_alloc(get_pernet(jool->ns), 0);
+		if (!dispatch)
+			return -ENOMEM;
 	}
 
-	new->hash_set = old->hash_set;
-	new->hash = old->hash;
-	new->nf_ops = old->nf_ops;
+	/* The mappings must survive too, but the counters are new. */
+	new->stats_file = prev->stats_file;
+	prev->stats_file = NULL;
+	if (new->stats_file)
+		jstat_file_retarget(new->stats_file, jool->stats);
 
 	/*
-	 * The old BIB and joold must survive,
-	 * because they shouldn't be reset by atomic configuration.
+	 * The old BIB, joold, NAT log, fragment cache and top talkers must
+	 * survive, because they shouldn't be reset by atomic configuration.
 	 */
-	if (xlator_is_nat64(&new->jool)) {
-		bib_put(new->jool.nat64.bib);
-		joold_put(new->jool.nat64.joold);
-		new->jool.nat64.bib = old->jool.nat64.bib;
-		new->jool.nat64.joold = old->jool.nat64.joold;
+	if (xlator_is_nat64(jool)) {
+		bib_put(jool->nat64.bib);
+		joold_put(jool->nat64.joold);
+		natlog_put(jool->nat64.natlog);
+		fragdb_put(jool->nat64.fragdb);
+		talkers_put(jool->nat64.talkers);
+		jool->nat64.bib = prev->jool.nat64.bib;
+		jool->nat64.joold = prev->jool.nat64.joold;
+		jool->nat64.natlog = prev->jool.nat64.natlog;
+		jool->nat64.fragdb = prev->jool.nat64.fragdb;
+		jool->nat64.talkers = prev->jool.nat64.talkers;
+		new->nat64_machinery = prev->nat64_machinery;
+		prev->nat64_machinery = false;
 	}
 
-	hash_del(&old->table_hook);
-	hash_add(instances, &new->table_hook, get_instance_hash(new));
-	if (old->jool.flags & XF_NETFILTER) {
-		list = rcu_dereference_protected(netfilter_instances,
-						lockdep_is_held(&lock));
-		list_del_rcu(&old->list_hook);
-		list_add_rcu(&new->list_hook, list);
+	route_next_hops_sync(jool, NULL);
+
+	/* Same key, and the mutex guarantees @prev is listed. */
+	rhashtable_replace_fast(&instances, &prev->table_hook, &new->table_hook,
+			instance_params);
+	list_replace_rcu(&prev->type_hook, &new->type_hook);
+	list_replace(&prev->ns_hook, &new->ns_hook);
+	if (prev->jool.flags & XF_NETFILTER) {
+		list_replace_rcu(&prev->list_hook, &new->list_hook);
+		nf_dispatch_commit(get_pernet(jool->ns), dispatch);
+		ingress_hooks_sync(jool->ns, get_pernet(jool->ns), NULL);
+	}
+	bump_generation();
+	/* Before the old one lets go, so the key doesn't toggle needlessly. */
+	if (jool->globals.debug) {
+		debug_key_get();
+		new->debug_key = true;
 	}
-	mutex_unlock(&lock);
-
-	synchronize_rcu_bh();
 
-	old->nf_ops = NULL;
+	*old = prev;
+	return 0;
+}
 
+/*
+ * Last stage of xlator_replace(): Destroys the @old node replace_locked()
+ * unlisted. A grace period must have elapsed since.
+ */
+static void replace_finish(struct jool_instance *old)
+{
 	if (xlator_is_nat64(&old->jool)) {
 		old->jool.nat64.bib = NULL;
 		old->jool.nat64.joold = NULL;
+		old->jool.nat64.natlog = NULL;
+		old->jool.nat64.fragdb = NULL;
+		old->jool.nat64.talkers = NULL;
+	}
+
+	log_info("Replaced instance '%s'.", old->jool.iname);
+	destroy_jool_instance(old);
+}
+
+int xlator_replace(struct xlator *jool)
+{
+	struct jool_instance *old;
+	struct jool_instance *new;
+	int error;
+
+	error = replace_prepare(jool, &new);
+	if (error)
+		return error;
+
+	mutex_lock(&lock);
+	error = replace_locked(new, &old);
+	mutex_unlock(&lock);
+	if (error) {
+		destroy_jool_instance(new);
+		return error;
+	}
+
+	if (old) {
+		synchronize_rcu_bh();
+		replace_finish(old);
+	}
+	return 0;
+}
+
+/**
+ * xlator_replace_batch - Same as calling xlator_replace() on each of the
+ * @count @jools, but the mutex is only taken once, and the replaced instances
+ * share a single grace period.
+ *
+ * The instances are validated and allocated first; if any of them fails that,
+ * nothing is committed. Afterwards, they are listed in order, and the first
+ * failure stops the batch. (The instances before it remain committed.)
+ * @committed returns how many were.
+ */
+int xlator_replace_batch(struct xlator **jools, unsigned int count,
+		unsigned int *committed)
+{
+	struct jool_instance **nodes;
+	unsigned int prepared;
+	unsigned int listed;
+	unsigned int olds;
+	unsigned int i;
+	int error;
+
+	*committed = 0;
+	if (count == 0)
+		return 0;
+
+	/* One array; the new nodes, then the old ones. */
+	nodes = __wkvmalloc("instance batch", 2 * count * sizeof(*nodes),
+			GFP_KERNEL);
+	if (!nodes)
+		return -ENOMEM;
+
+	for (prepared = 0; prepared < count; prepared++) {
+		error = replace_prepare(jools[prepared], &nodes[prepared]);
+		if (error) {
+			log_err("Instance '%s' cannot be committed. Errcode %d",
+					jools[prepared]->iname, error);
+			goto revert_prepared;
+		}
+	}
+
+	olds = 0;
+	mutex_lock(&lock);
+	for (listed = 0; listed < count; listed++) {
+		error = replace_locked(nodes[listed], &nodes[count + olds]);
+		if (error) {
+			log_err("Instance '%s' cannot be committed. Errcode %d",
+					jools[listed]->iname, error);
+			break;
+		}
+		if (nodes[count + olds])
+			olds++;
+	}
+	mutex_unlock(&lock);
+
+	/* The ones that were not listed are still ours. */
+	for (i = listed; i < count; i++)
+		destroy_jool_instance(nodes[i]);
+
+	if (olds) {
+		synchronize_rcu_bh();
+		for (i = 0; i < olds; i++)
+			replace_finish(nodes[count + i]);
+	}
+
+	*committed = listed;
+	__wkvfree("instance batch", nodes);
+	return error;
+
+revert_prepared:
+	for (i = 0; i < prepared; i++)
+		destroy_jool_instance(nodes[i]);
+	__wkvfree("instance batch", nodes);
+	return error;
+}
+
+static bool same_databases(struct xlator const *a, struct xlator const *b)
+{
+	if (a->stats != b->stats || a->routes != b->routes
+			|| a->icmp_ratelimit != b->icmp_ratelimit
+			|| a->pmtu != b->pmtu
+			|| a->capture != b->capture)
+		return false;
+
+	return xlator_is_nat64(a)
+			? (a->nat64.pool4 == b->nat64.pool4
+				&& a->nat64.bib == b->nat64.bib
+				&& a->nat64.joold == b->nat64.joold
+				&& a->nat64.natlog == b->nat64.natlog
+				&& a->nat64.fragdb == b->nat64.fragdb
+				&& a->nat64.talkers == b->nat64.talkers)
+			: (a->siit.eamt == b->siit.eamt
+				&& a->siit.denylist4 == b->siit.denylist4);
+}
+
+static void free_instance_rcu_cb(struct rcu_head *rcu)
+{
+	wkfree(struct jool_instance,
+			container_of(rcu, struct jool_instance, rcu));
+}
+
+/**
+ * xlator_update_globals - Publishes @jool, which is a clone of one of the
+ * listed instances, in which only the globals have changed.
+ *
+ * Much lighter than xlator_replace(): Since the databases are the same, the
+ * BIB needs no validation, and the new node simply inherits the old one's
+ * references. The old node is released after a grace period, but nobody waits
+ * for it.
+ *
+ * If the instance was replaced since @jool was cloned, this falls back to
+ * xlator_replace().
+ */
+int xlator_update_globals(struct xlator *jool)
+{
+	struct jool_instance *old;
+	struct jool_instance *new;
+	struct nf_dispatch *dispatch = NULL;
+	int error;
+
+	error = basic_add_validations(jool->iname, jool->flags,
+			jool->globals.pool6.set
+					? &jool->globals.pool6.prefix
+					: NULL);
+	if (error)
+		return error;
+
+	new = wkmalloc(struct jool_instance, GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	memcpy(&new->jool, jool, sizeof(*jool));
+	xlator_sync_fast(&new->jool);
+	new->debug_key = false;
+	new->nat64_machinery = false;
+	new->stats_file = NULL;
+
+	error = capture_prepare(&new->jool);
+	if (error) {
+		wkfree(struct jool_instance, new);
+		return error;
+	}
+
+	mutex_lock(&lock);
+
+	old = find_instance(jool->ns, xlator_flags2xt(jool->flags), jool->iname);
+	if (!old || !same_databases(&old->jool, &new->jool)) {
+		mutex_unlock(&lock);
+		wkfree(struct jool_instance, new);
+		return xlator_replace(jool);
+	}
+
+	error = -EINVAL;
+	if (xlator_is_nat64(&new->jool) && !prefix6_equals(
+			&old->jool.globals.pool6.prefix,
+			&new->jool.globals.pool6.prefix)) {
+		log_err("Sorry; you can't change a NAT64 instance's pool6 for now.");
+		goto abort;
+	}
+	error = validate_marks(jool->ns, &new->jool, old);
+	if (error)
+		goto abort;
+	if (xlator_is_netfilter(&new->jool)) {
+		dispatch = nf_dispatch_alloc(get_pernet(jool->ns), 0);
+		if (!dispatch) {
+			error = -ENOMEM;
+			goto abort;
+		}
 	}
 
-	destroy_jool_instance(old, false);
-	log_info("Replaced instance '%s'.", jool->iname);
+	/* Everything @old owned is @new's now. */
+	new->stats_file = old->stats_file;
+	new->nat64_machinery = old->nat64_machinery;
+	old->stats_file = NULL;
+	old->nat64_machinery = false;
+
+	route_next_hops_sync(&new->jool, NULL);
+
+	rhashtable_replace_fast(&instances, &old->table_hook, &new->table_hook,
+			instance_params);
+	list_replace_rcu(&old->type_hook, &new->type_hook);
+	list_replace(&old->ns_hook, &new->ns_hook);
+	if (old->jool.flags & XF_NETFILTER) {
+		list_replace_rcu(&old->list_hook, &new->list_hook);
+		nf_dispatch_commit(get_pernet(jool->ns), dispatch);
+		ingress_hooks_sync(jool->ns, get_pernet(jool->ns), NULL);
+	}
+	bump_generation();
+	/* The key is only an optimization, so the readers don't care. */
+	if (new->jool.globals.debug) {
+		debug_key_get();
+		new->debug_key = true;
+	}
+	if (old->debug_key) {
+		debug_key_put();
+		old->debug_key = false;
+	}
+	mutex_unlock(&lock);
+
+	call_rcu_bh(&old->rcu, free_instance_rcu_cb);
 	return 0;
 
 abort:
 	mutex_unlock(&lock);
-	destroy_jool_instance(new, false);
-	return -EINVAL;
+	wkfree(struct jool_instance, new);
+	return error;
 }
 
 int xlator_flush(xlator_type xt)
@@ -774,6 +1744,31 @@ int xlator_flush(xlator_type xt)
  */
 int xlator_find(struct net *ns, xlator_flags flags, char const *iname,
 		struct xlator *result)
+{
+	struct xlator *jool;
+	int error;
+
+	rcu_read_lock_bh();
+
+	error = xlator_find_rcu(ns, flags, iname, &jool);
+	if (!error && result) {
+		xlator_get(jool);
+		memcpy(result, jool, sizeof(*result));
+	}
+
+	rcu_read_unlock_bh();
+	return error;
+}
+
+/**
+ * Same as xlator_find(), except the result is a pointer to the instance itself.
+ * (The packet path uses this to skip the copy and the reference counting.)
+ *
+ * Must be called inside a RCU-bh read-side critical section. @result is only
+ * valid until the end of that section, and must not be modified.
+ */
+int xlator_find_rcu(struct net *ns, xlator_flags flags, char const *iname,
+		struct xlator **result)
 {
 	struct jool_instance *instance;
 	int error;
@@ -786,25 +1781,28 @@ int xlator_find(struct net *ns, xlator_flags flags, char const *iname,
 	if (error)
 		return error;
 
-	rcu_read_lock_bh();
-
 	instance = find_instance(ns, xlator_flags2xt(flags), iname);
 	if (!instance)
-		goto not_found;
+		return -ESRCH;
 	if ((instance->jool.flags & xlator_flags2xf(flags)) == 0)
-		goto not_found;
-
-	if (result) {
-		xlator_get(&instance->jool);
-		memcpy(result, &instance->jool, sizeof(*result));
-	}
+		return -ESRCH;
 
-	rcu_read_unlock_bh();
+	*result = &instance->jool;
 	return 0;
+}
 
-not_found:
-	rcu_read_unlock_bh();
-	return -ESRCH;
+/**
+ * xlator_generation - Returns a number that changes whenever an instance is
+ * added, removed or replaced.
+ *
+ * A pointer returned by xlator_find_rcu() can be kept beyond its RCU-bh
+ * read-side critical section, as long as this number is read before the
+ * lookup, and the pointer is only used again (in other critical sections)
+ * while the number stays the same.
+ */
+unsigned int xlator_generation(void)
+{
+	return smp_load_acquire(&generation);
 }
 
 /**
@@ -831,25 +1829,45 @@ int xlator_find_current(const char *iname, xlator_flags flags,
 	return error;
 }
 
-int xlator_find_netfilter(struct net *ns, struct xlator *result)
+/**
+ * Retrieves the @ns Netfilter instance in charge of @mark. (See
+ * netfilter-marks.)
+ *
+ * Same contract as xlator_find_rcu(): Call it inside a RCU-bh read-side
+ * critical section, and do not use nor modify @result after the section ends.
+ * (No references are taken.)
+ */
+int xlator_find_netfilter(struct net *ns, __u32 mark, struct xlator **result)
 {
-	struct list_head *list;
-	struct jool_instance *instance;
+	struct nf_dispatch *dispatch;
+	struct nf_dispatch_entry *entry;
+	unsigned int lo, hi, mid;
 
-	rcu_read_lock_bh();
+	dispatch = rcu_dereference_bh(get_pernet(ns)->dispatch);
+	if (!dispatch)
+		return -ESRCH;
 
-	list = rcu_dereference_bh(netfilter_instances);
-	list_for_each_entry_rcu(instance, list, list_hook) {
-		if (ns == instance->jool.ns) {
-			xlator_get(&instance->jool);
-			memcpy(result, &instance->jool, sizeof(*result));
-			rcu_read_unlock_bh();
+	/* Usually empty, so the common case is just the fallback. */
+	lo = 0;
+	hi = dispatch->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		entry = &dispatch->entries[mid];
+		if (mark < entry->first) {
+			hi = mid;
+		} else if (mark > entry->last) {
+			lo = mid + 1;
+		} else {
+			*result = entry->jool;
 			return 0;
 		}
 	}
 
-	rcu_read_unlock_bh();
-	return -ESRCH;
+	if (!dispatch->fallback)
+		return -ESRCH;
+
+	*result = dispatch->fallback;
+	return 0;
 }
 
 /*
@@ -864,6 +1882,10 @@ int xlator_find_netfilter(struct net *ns, struct xlator *result)
 void xlator_put(struct xlator *jool)
 {
 	jstat_put(jool->stats);
+	route_cache_put(jool->routes);
+	icmp_ratelimit_put(jool->icmp_ratelimit);
+	pmtu_cache_put(jool->pmtu);
+	capture_put(jool->capture);
 
 	switch (xlator_get_type(jool)) {
 	case XT_SIIT:
@@ -881,6 +1903,12 @@ void xlator_put(struct xlator *jool)
 			bib_put(jool->nat64.bib);
 		if (jool->nat64.joold)
 			joold_put(jool->nat64.joold);
+		if (jool->nat64.natlog)
+			natlog_put(jool->nat64.natlog);
+		if (jool->nat64.fragdb)
+			fragdb_put(jool->nat64.fragdb);
+		if (jool->nat64.talkers)
+			talkers_put(jool->nat64.talkers);
 		return;
 	}
 
@@ -894,29 +1922,38 @@ static bool offset_equals(struct instance_entry_usr *offset,
 			&& (strcmp(offset->iname, instance->jool.iname) == 0);
 }
 
-int xlator_foreach(xlator_type xt, xlator_foreach_cb cb, void *args,
-		struct instance_entry_usr *offset)
+static int foreach_type(struct list_head *list, xlator_foreach_cb cb,
+		void *args, struct instance_entry_usr **offset)
 {
 	struct jool_instance *instance;
-	unsigned int i;
-	int error = 0;
-
-	rcu_read_lock_bh();
-
-	hash_for_each(instances, i, instance, table_hook) {
-		if (!(xlator_flags2xt(instance->jool.flags) & xt))
-			continue;
+	int error;
 
-		if (offset) {
-			if (offset_equals(offset, instance))
-				offset = NULL;
+	list_for_each_entry_rcu(instance, list, type_hook) {
+		if (*offset) {
+			if (offset_equals(*offset, instance))
+				*offset = NULL;
 		} else {
 			error = cb(&instance->jool, args);
 			if (error)
-				break;
+				return error;
 		}
 	}
 
+	return 0;
+}
+
+int xlator_foreach(xlator_type xt, xlator_foreach_cb cb, void *args,
+		struct instance_entry_usr *offset)
+{
+	int error = 0;
+
+	rcu_read_lock_bh();
+
+	if (xt & XT_SIIT)
+		error = foreach_type(&siit_instances, cb, args, &offset);
+	if (!error && (xt & XT_NAT64))
+		error = foreach_type(&nat64_instances, cb, args, &offset);
+
 	rcu_read_unlock_bh();
 
 	if (error)
@@ -935,3 +1972,26 @@ xlator_framework xlator_get_framework(struct xlator const *instance)
 {
 	return xlator_is_netfilter(instance) ? XF_NETFILTER : XF_IPTABLES;
 }
+
+/**
+ * xlator_pool6_find - Returns the index of the pool6 prefix (see
+ * xlator_pool6()) that contains @addr, or -ESRCH if there's none.
+ *
+ * There are at most POOL6_TENANTS_MAX + 1 prefixes, so a linear scan is both
+ * smaller and faster than any sort of tree.
+ */
+int xlator_pool6_find(struct xlator const *jool, struct in6_addr const *addr)
+{
+	struct pool6_tenants const *tenants;
+	unsigned int i;
+
+	if (jool->fast.pool6_set && prefix6_contains(&jool->fast.pool6, addr))
+		return 0;
+
+	tenants = &jool->globals.nat64.pool6_tenants;
+	for (i = 0; i < tenants->count; i++)
+		if (prefix6_contains(&tenants->values[i].prefix, addr))
+			return i + 1;
+
+	return -ESRCH;
+}
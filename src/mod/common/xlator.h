@@ -1,10 +1,62 @@
 #ifndef SRC_MOD_COMMON_XLATOR_H_
 #define SRC_MOD_COMMON_XLATOR_H_
 
+#include <linux/cache.h>
+#include <linux/jiffies.h>
 #include "common/config.h"
 #include "mod/common/stats.h"
 #include "mod/common/types.h"
 
+struct route_cache;
+struct icmp_ratelimit;
+struct pmtu_cache;
+struct capture;
+
+/**
+ * The globals the translating code reads on every packet, packed into a single
+ * cache line. (struct jool_globals spans several, mostly because of the
+ * plateaus and the joold tuning, which are rarely needed.)
+ *
+ * Derived from xlator.globals by xlator_sync_fast(), which has to be called
+ * whenever the globals change. Never written otherwise. The rest of the globals
+ * should still be read from xlator.globals.
+ */
+struct xlator_fast {
+	struct ipv6_prefix pool6;
+	__u32 lowest_ipv6_mtu;
+
+	bool enabled;
+	bool debug;
+	bool pool6_set;
+	bool reset_traffic_class;
+	bool generate_flow_label;
+	bool reset_tos;
+	__u8 new_tos;
+	__u8 ipv4_id_policy;
+	bool tcp_mss_clamp;
+	/* Zero means no capture. See capture.h. */
+	__u32 capture_sample;
+	__u16 capture_snaplen;
+
+	/* SIIT only. */
+	bool compute_udp_csum_zero;
+	__u8 eam_hairpin_mode;
+
+	/* NAT64 only. */
+	bool drop_icmp6_info;
+	bool src_icmp6errs_better;
+	bool handle_rst_during_fin_rcv;
+	bool session_counters;
+	/* Zero means no packet policing. See bib_police6(). */
+	__u32 subscriber_packet_rate;
+	/* Zero means no overload shedding. See overload.h. */
+	__u8 overload_threshold;
+	/* bib.refresh_granularity, in jiffies. */
+	unsigned long refresh_granularity;
+	/* Zero means no latency sampling. See natlog.h. */
+	__u32 latency_sample;
+} ____cacheline_aligned;
+
 /**
  * A Jool translator "instance". The point is that each network namespace has
  * a separate instance (if Jool has been loaded there).
@@ -13,6 +65,9 @@
  * should use to handle a packet in the respective namespace.
  */
 struct xlator {
+	/** Per-packet subset of @globals. See struct xlator_fast. */
+	struct xlator_fast fast;
+
 	/*
 	 * Note: This xlator must not increase @ns's kref counter.
 	 * Quite the opposite: The @ns has to reference count the xlator.
@@ -32,6 +87,14 @@ struct xlator {
 	xlator_flags flags;
 
 	struct jool_stats *stats;
+	/** See route_out.c. */
+	struct route_cache *routes;
+	/** See icmp_ratelimit.h. */
+	struct icmp_ratelimit *icmp_ratelimit;
+	/** See pmtu_cache.h. */
+	struct pmtu_cache *pmtu;
+	/** See capture.h. */
+	struct capture *capture;
 	struct jool_globals globals;
 	union {
 		struct {
@@ -42,11 +105,12 @@ struct xlator {
 			struct pool4 *pool4;
 			struct bib *bib;
 			struct joold_queue *joold;
+			struct natlog *natlog;
+			struct fragdb *fragdb;
+			/** See talkers.h. */
+			struct talkers *talkers;
 		} nat64;
 	};
-
-	bool (*is_hairpin)(struct xlation *);
-	verdict (*handling_hairpinning)(struct xlation *);
 };
 
 /* User context (reads and writes) */
@@ -65,6 +129,9 @@ void jool_xlator_flush_batch(struct list_head *net_exit_list, xlator_type xt);
 int xlator_init(struct xlator *jool, struct net *ns, char *iname,
 		xlator_flags flags, struct ipv6_prefix *pool6);
 int xlator_replace(struct xlator *jool);
+int xlator_replace_batch(struct xlator **jools, unsigned int count,
+		unsigned int *committed);
+int xlator_update_globals(struct xlator *jool);
 
 /* Any context (reads) */
 
@@ -72,7 +139,11 @@ int xlator_find(struct net *ns, xlator_flags flags, const char *iname,
 		struct xlator *result);
 int xlator_find_current(const char *iname, xlator_flags flags,
 		struct xlator *result);
-int xlator_find_netfilter(struct net *ns, struct xlator *result);
+int xlator_find_rcu(struct net *ns, xlator_flags flags, char const *iname,
+		struct xlator **result);
+int xlator_find_netfilter(struct net *ns, __u32 mark, struct xlator **result);
+unsigned int xlator_generation(void);
+void xlator_get(struct xlator *instance);
 void xlator_put(struct xlator *instance);
 
 typedef int (*xlator_foreach_cb)(struct xlator *, void *);
@@ -82,6 +153,80 @@ int xlator_foreach(xlator_type xt, xlator_foreach_cb cb, void *args,
 xlator_type xlator_get_type(struct xlator const *instance);
 xlator_framework xlator_get_framework(struct xlator const *instance);
 
+int xlator_pool6_find(struct xlator const *jool, struct in6_addr const *addr);
+
+/*
+ * Returns the pool6 prefix known as @index. Zero is pool6 itself; the rest are
+ * the pool6-tenants, in order. (NAT64 only.)
+ */
+static inline struct ipv6_prefix const *xlator_pool6(struct xlator const *jool,
+		unsigned int index)
+{
+	struct pool6_tenants const *tenants = &jool->globals.nat64.pool6_tenants;
+	return index ? &tenants->values[index - 1].prefix : &jool->fast.pool6;
+}
+
+/*
+ * Refreshes @jool->fast out of @jool->globals. The instance must not be visible
+ * to the packet path yet. (Globals are only ever changed on clones; see
+ * handle_global_update().)
+ */
+static inline void xlator_sync_fast(struct xlator *jool)
+{
+	struct jool_globals const *cfg = &jool->globals;
+	struct xlator_fast *fast = &jool->fast;
+
+	memset(fast, 0, sizeof(*fast));
+	fast->pool6 = cfg->pool6.prefix;
+	fast->lowest_ipv6_mtu = cfg->lowest_ipv6_mtu;
+	fast->enabled = cfg->enabled;
+	fast->debug = cfg->debug;
+	fast->pool6_set = cfg->pool6.set;
+	fast->reset_traffic_class = cfg->reset_traffic_class;
+	fast->generate_flow_label = cfg->generate_flow_label;
+	fast->ipv4_id_policy = cfg->ipv4_id_policy;
+	fast->reset_tos = cfg->reset_tos;
+	fast->new_tos = cfg->new_tos;
+	fast->tcp_mss_clamp = cfg->tcp_mss_clamp;
+	fast->capture_sample = cfg->capture_sample;
+	fast->capture_snaplen = cfg->capture_snaplen;
+
+	if (jool->flags & XT_SIIT) {
+		fast->compute_udp_csum_zero = cfg->siit.compute_udp_csum_zero;
+		fast->eam_hairpin_mode = cfg->siit.eam_hairpin_mode;
+	} else {
+		fast->drop_icmp6_info = cfg->nat64.drop_icmp6_info;
+		fast->src_icmp6errs_better = cfg->nat64.src_icmp6errs_better;
+		fast->handle_rst_during_fin_rcv =
+				cfg->nat64.handle_rst_during_fin_rcv;
+		fast->session_counters = cfg->nat64.bib.session_counters;
+		fast->subscriber_packet_rate =
+				cfg->nat64.bib.subscriber_packet_rate;
+		fast->overload_threshold = cfg->nat64.bib.overload_threshold;
+		fast->refresh_granularity = msecs_to_jiffies(
+				cfg->nat64.bib.refresh_granularity);
+		fast->latency_sample = cfg->nat64.latency_sample;
+	}
+}
+
+/*
+ * JOOL_SIIT_ONLY builds refuse NAT64 instances, so the compiler can drop the
+ * NAT64 branches (BIB, joold, pktqueue, fragdb) out of the packet path.
+ */
+#ifdef JOOL_SIIT_ONLY
+
+static inline bool xlator_is_siit(struct xlator const *instance)
+{
+	return true;
+}
+
+static inline bool xlator_is_nat64(struct xlator const *instance)
+{
+	return false;
+}
+
+#else
+
 static inline bool xlator_is_siit(struct xlator const *instance)
 {
 	return instance->flags & XT_SIIT;
@@ -92,6 +237,8 @@ static inline bool xlator_is_nat64(struct xlator const *instance)
 	return instance->flags & XT_NAT64;
 }
 
+#endif
+
 static inline bool xlator_is_netfilter(struct xlator const *instance)
 {
 	return instance->flags & XF_NETFILTER;
@@ -7,6 +7,7 @@
 #include "common/iptables.h"
 #include "mod/common/log.h"
 #include "mod/common/kernel_hook.h"
+#include "mod/common/linux_version.h"
 #include "mod/common/xlator.h"
 
 MODULE_LICENSE(JOOL_LICENSE);
@@ -43,7 +44,11 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV6,
 		.target     = target_ipv6,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+#if LINUX_VERSION_AT_LEAST(4, 11, 0, 8, 0)
+		.usersize   = TARGET_INFO_USERSIZE,
+#endif
 		.me         = THIS_MODULE,
 	}, {
 		.name       = IPTABLES_NAT64_MODULE_NAME,
@@ -51,7 +56,11 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV4,
 		.target     = target_ipv4,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+#if LINUX_VERSION_AT_LEAST(4, 11, 0, 8, 0)
+		.usersize   = TARGET_INFO_USERSIZE,
+#endif
 		.me         = THIS_MODULE,
 	},
 };
@@ -74,8 +83,16 @@ static struct pernet_operations joolns_ops = {
 	.exit_batch = flush_batch,
 };
 
+static bool fragment_tracking;
+module_param(fragment_tracking, bool, 0444);
+MODULE_PARM_DESC(fragment_tracking, "Translate UDP fragments individually, instead of having nf_defrag_ipv4 and nf_defrag_ipv6 reassemble them.");
+
 static void defrag_enable(struct net *ns)
 {
+	/* Fragments will be tracked by the fragment cache. (See fragdb.h.) */
+	if (fragment_tracking)
+		return;
+
 	nf_defrag_ipv4_enable(ns);
 	nf_defrag_ipv6_enable(ns);
 }
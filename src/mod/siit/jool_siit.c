@@ -3,6 +3,7 @@
 #include <linux/module.h>
 #include "common/iptables.h"
 #include "mod/common/kernel_hook.h"
+#include "mod/common/linux_version.h"
 #include "mod/common/log.h"
 #include "mod/common/xlator.h"
 
@@ -22,7 +23,11 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV6,
 		.target     = target_ipv6,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+#if LINUX_VERSION_AT_LEAST(4, 11, 0, 8, 0)
+		.usersize   = TARGET_INFO_USERSIZE,
+#endif
 		.me         = THIS_MODULE,
 	}, {
 		.name       = IPTABLES_SIIT_MODULE_NAME,
@@ -30,7 +35,11 @@ static struct xt_target targets[] = {
 		.family     = NFPROTO_IPV4,
 		.target     = target_ipv4,
 		.checkentry = target_checkentry,
+		.destroy    = target_destroy,
 		.targetsize = XT_ALIGN(sizeof(struct target_info)),
+#if LINUX_VERSION_AT_LEAST(4, 11, 0, 8, 0)
+		.usersize   = TARGET_INFO_USERSIZE,
+#endif
 		.me         = THIS_MODULE,
 	},
 };
@@ -0,0 +1,293 @@
+#include "usr/argp/export.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+
+#include "usr/nl/stats.h"
+#include "usr/argp/log.h"
+#include "usr/argp/xlator_type.h"
+
+/* Serializes the threads' writes, so the chunks don't mix. */
+static pthread_mutex_t stdout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int parse_format(void *void_field, int key, char *str)
+{
+	enum export_format *field = void_field;
+
+	if (strcasecmp(str, "text") == 0) {
+		*field = EXPORT_TEXT;
+		return 0;
+	}
+	if (strcasecmp(str, "csv") == 0) {
+		*field = EXPORT_CSV;
+		return 0;
+	}
+	if (strcasecmp(str, "binary") == 0) {
+		*field = EXPORT_BINARY;
+		return 0;
+	}
+
+	pr_err("Unknown format: '%s'. (Expected text, csv or binary.)", str);
+	return -EINVAL;
+}
+
+struct wargp_type wt_export_format = {
+	.argument = "<format>",
+	.parse = parse_format,
+	.candidates = "text csv binary",
+};
+
+void export_str(struct export_buffer *out, char const *str)
+{
+	size_t len = strlen(str);
+	memcpy(out->data + out->len, str, len);
+	out->len += len;
+}
+
+void export_char(struct export_buffer *out, char chara)
+{
+	out->data[out->len++] = chara;
+}
+
+void export_u64(struct export_buffer *out, unsigned long long value)
+{
+	char digits[20];
+	unsigned int i = 0;
+
+	do {
+		digits[i++] = '0' + (value % 10);
+		value /= 10;
+	} while (value);
+
+	while (i > 0)
+		out->data[out->len++] = digits[--i];
+}
+
+/* "<address>,<port>" */
+void export_addr6(struct export_buffer *out,
+		struct ipv6_transport_addr const *addr)
+{
+	inet_ntop(AF_INET6, &addr->l3, out->data + out->len, INET6_ADDRSTRLEN);
+	out->len += strlen(out->data + out->len);
+	export_char(out, ',');
+	export_u64(out, addr->l4);
+}
+
+/* "<address>,<port>" */
+void export_addr4(struct export_buffer *out,
+		struct ipv4_transport_addr const *addr)
+{
+	inet_ntop(AF_INET, &addr->l3, out->data + out->len, INET_ADDRSTRLEN);
+	out->len += strlen(out->data + out->len);
+	export_char(out, ',');
+	export_u64(out, addr->l4);
+}
+
+void export_be8(struct export_buffer *out, __u8 value)
+{
+	out->data[out->len++] = value;
+}
+
+void export_be16(struct export_buffer *out, __u16 value)
+{
+	export_be8(out, value >> 8);
+	export_be8(out, value);
+}
+
+void export_be32(struct export_buffer *out, __u32 value)
+{
+	export_be16(out, value >> 16);
+	export_be16(out, value);
+}
+
+void export_be64(struct export_buffer *out, __u64 value)
+{
+	export_be32(out, value >> 32);
+	export_be32(out, value);
+}
+
+/* 16-byte address, then 2-byte port. */
+void export_bin6(struct export_buffer *out,
+		struct ipv6_transport_addr const *addr)
+{
+	memcpy(out->data + out->len, &addr->l3, sizeof(addr->l3));
+	out->len += sizeof(addr->l3);
+	export_be16(out, addr->l4);
+}
+
+/* 4-byte address, then 2-byte port. */
+void export_bin4(struct export_buffer *out,
+		struct ipv4_transport_addr const *addr)
+{
+	memcpy(out->data + out->len, &addr->l3, sizeof(addr->l3));
+	out->len += sizeof(addr->l3);
+	export_be16(out, addr->l4);
+}
+
+static struct jool_result flush(struct export_buffer *out)
+{
+	size_t written;
+
+	if (out->len == 0)
+		return result_success();
+
+	pthread_mutex_lock(&stdout_lock);
+	written = fwrite(out->data, 1, out->len, stdout);
+	pthread_mutex_unlock(&stdout_lock);
+
+	if (written != out->len)
+		return result_from_error(-EIO, "Cannot write the output: %s",
+				strerror(errno));
+
+	out->len = 0;
+	return result_success();
+}
+
+/*
+ * Call after every row or record. Writes the buffer once there might not be
+ * room for another one.
+ */
+struct jool_result export_row_end(struct export_buffer *out)
+{
+	return (out->len > EXPORT_BUFFER_SIZE - EXPORT_ROW_MAX)
+			? flush(out)
+			: result_success();
+}
+
+struct export_job {
+	char const *iname;
+	l4_protocol proto;
+	export_dump_fn dump;
+	void *arg;
+	struct jool_result result;
+};
+
+static void *run_job(void *arg)
+{
+	struct export_job *job = arg;
+	struct export_buffer out;
+	struct joolnl_socket sk;
+
+	out.data = malloc(EXPORT_BUFFER_SIZE);
+	if (!out.data) {
+		job->result = result_from_enomem();
+		return NULL;
+	}
+	out.len = 0;
+
+	job->result = joolnl_setup(&sk, xt_get());
+	if (job->result.error)
+		goto end;
+
+	job->result = job->dump(&sk, job->iname, job->proto, &out, job->arg);
+	if (!job->result.error)
+		job->result = flush(&out);
+
+	joolnl_teardown(&sk);
+end:
+	free(out.data);
+	return NULL;
+}
+
+/**
+ * Dumps the @count @protos tables, one thread (and socket) per table.
+ * Returns the first error; the others are discarded.
+ */
+struct jool_result export_tables(char const *iname, l4_protocol const *protos,
+		unsigned int count, export_dump_fn dump, void *arg)
+{
+	struct export_job jobs[EXPORT_MAX_TABLES];
+	pthread_t threads[EXPORT_MAX_TABLES];
+	bool started[EXPORT_MAX_TABLES];
+	struct jool_result result;
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < count; i++) {
+		jobs[i].iname = iname;
+		jobs[i].proto = protos[i];
+		jobs[i].dump = dump;
+		jobs[i].arg = arg;
+		jobs[i].result = result_success();
+	}
+
+	if (count == 1) {
+		run_job(&jobs[0]);
+		goto flush;
+	}
+
+	for (i = 0; i < count; i++) {
+		error = pthread_create(&threads[i], NULL, run_job, &jobs[i]);
+		started[i] = !error;
+		if (error) {
+			/* Do it here instead. */
+			run_job(&jobs[i]);
+		}
+	}
+	for (i = 0; i < count; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+flush:
+	if (fflush(stdout)) {
+		result = result_from_error(-EIO, "Cannot write the output: %s",
+				strerror(errno));
+	} else {
+		result = result_success();
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!jobs[i].result.error)
+			continue;
+		if (result.error)
+			result_cleanup(&jobs[i].result);
+		else
+			result = jobs[i].result;
+	}
+
+	return result;
+}
+
+struct gauge {
+	enum jool_stat_id id;
+	__u64 value;
+};
+
+static struct jool_result find_gauge(struct joolnl_stat const *stat,
+		void *arg)
+{
+	struct gauge *gauge = arg;
+
+	if (stat->meta.id == gauge->id)
+		gauge->value = stat->value;
+	return result_success();
+}
+
+/*
+ * --count: Prints @iname's @gauge stat, which is supposed to be the size of
+ * some table. It's kept up to date by the kernel, so this doesn't need a dump.
+ */
+int export_count(char const *iname, enum jool_stat_id gauge_id)
+{
+	struct joolnl_socket sk;
+	struct gauge gauge;
+	struct jool_result result;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	gauge.id = gauge_id;
+	gauge.value = 0; /* The kernel might skip the zeroes. */
+	result = joolnl_stats_foreach(&sk, iname, find_gauge, &gauge);
+	if (!result.error)
+		printf("%llu\n", (unsigned long long)gauge.value);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
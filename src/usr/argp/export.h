@@ -0,0 +1,77 @@
+#ifndef SRC_USR_ARGP_EXPORT_H_
+#define SRC_USR_ARGP_EXPORT_H_
+
+/**
+ * @file
+ * Bulk output of the BIB and session tables. (`--format csv|binary`.)
+ *
+ * The regular display formats each entry through printf(), and resolves its
+ * names, which is fine for a few screens, but takes minutes for millions of
+ * entries. The export formats are always numeric, are written by hand into
+ * large buffers, and each protocol can be dumped by its own thread, through
+ * its own socket.
+ *
+ * Each thread only writes whole rows (or records) to stdout, so, with several
+ * protocols, the output is interleaved by chunks. (Every row says which
+ * protocol it belongs to.)
+ */
+
+#include <stddef.h>
+#include "common/stats.h"
+#include "common/types.h"
+#include "usr/nl/core.h"
+#include "usr/argp/wargp.h"
+
+enum export_format {
+	/* The regular display; see --csv and --numeric. */
+	EXPORT_TEXT = 0,
+	EXPORT_CSV,
+	EXPORT_BINARY,
+};
+
+/* Parses a `--format` into an enum export_format. */
+extern struct wargp_type wt_export_format;
+
+/* TCP, UDP and ICMP. */
+#define EXPORT_MAX_TABLES 3
+
+/* Bytes a thread accumulates before it writes them. */
+#define EXPORT_BUFFER_SIZE (1024 * 1024)
+/* A row or record is never longer than this. */
+#define EXPORT_ROW_MAX 512
+
+struct export_buffer {
+	char *data;
+	size_t len;
+};
+
+void export_str(struct export_buffer *out, char const *str);
+void export_char(struct export_buffer *out, char chara);
+void export_u64(struct export_buffer *out, unsigned long long value);
+void export_addr6(struct export_buffer *out,
+		struct ipv6_transport_addr const *addr);
+void export_addr4(struct export_buffer *out,
+		struct ipv4_transport_addr const *addr);
+
+void export_be8(struct export_buffer *out, __u8 value);
+void export_be16(struct export_buffer *out, __u16 value);
+void export_be32(struct export_buffer *out, __u32 value);
+void export_be64(struct export_buffer *out, __u64 value);
+void export_bin6(struct export_buffer *out,
+		struct ipv6_transport_addr const *addr);
+void export_bin4(struct export_buffer *out,
+		struct ipv4_transport_addr const *addr);
+
+struct jool_result export_row_end(struct export_buffer *out);
+
+/* Dumps @proto's table, through @sk, into @out. */
+typedef struct jool_result (*export_dump_fn)(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto,
+		struct export_buffer *out, void *arg);
+
+struct jool_result export_tables(char const *iname, l4_protocol const *protos,
+		unsigned int count, export_dump_fn dump, void *arg);
+
+int export_count(char const *iname, enum jool_stat_id gauge_id);
+
+#endif /* SRC_USR_ARGP_EXPORT_H_ */
@@ -19,6 +19,7 @@
 #include "usr/argp/xlator_type.h"
 #include "usr/argp/wargp/address.h"
 #include "usr/argp/wargp/bib.h"
+#include "usr/argp/wargp/capture.h"
 #include "usr/argp/wargp/denylist4.h"
 #include "usr/argp/wargp/eamt.h"
 #include "usr/argp/wargp/file.h"
@@ -73,6 +74,26 @@ static struct cmd_option stats_ops[] = {
 			.xt = XT_ANY,
 			.handler = handle_stats_display,
 			.handle_autocomplete = autocomplete_stats_display,
+		}, {
+			.label = "latency",
+			.xt = XT_ANY,
+			.handler = handle_stats_latency,
+			.handle_autocomplete = autocomplete_stats_latency,
+		}, {
+			.label = "lifetimes",
+			.xt = XT_NAT64,
+			.handler = handle_stats_lifetimes,
+			.handle_autocomplete = autocomplete_stats_lifetimes,
+		}, {
+			.label = "rates",
+			.xt = XT_ANY,
+			.handler = handle_stats_rates,
+			.handle_autocomplete = autocomplete_stats_rates,
+		}, {
+			.label = "talkers",
+			.xt = XT_NAT64,
+			.handler = handle_stats_talkers,
+			.handle_autocomplete = autocomplete_stats_talkers,
 		},
 		{ 0 },
 };
@@ -217,6 +238,11 @@ static struct cmd_option bib_ops[] = {
 			.xt = XT_NAT64,
 			.handler = handle_bib_remove,
 			.handle_autocomplete = autocomplete_bib_remove,
+		}, {
+			.label = FLUSH,
+			.xt = XT_NAT64,
+			.handler = handle_bib_flush,
+			.handle_autocomplete = autocomplete_bib_flush,
 		},
 		{ 0 },
 };
@@ -227,6 +253,16 @@ static struct cmd_option session_ops[] = {
 			.xt = XT_NAT64,
 			.handler = handle_session_display,
 			.handle_autocomplete = autocomplete_session_display,
+		}, {
+			.label = "export",
+			.xt = XT_NAT64,
+			.handler = handle_session_export,
+			.handle_autocomplete = autocomplete_session_export,
+		}, {
+			.label = "import",
+			.xt = XT_NAT64,
+			.handler = handle_session_import,
+			.handle_autocomplete = autocomplete_session_import,
 		},
 		{ 0 },
 };
@@ -247,6 +283,16 @@ static struct cmd_option joold_ops[] = {
 			.xt = XT_NAT64,
 			.handler = handle_joold_advertise,
 			.handle_autocomplete = autocomplete_joold_advertise,
+		}, {
+			.label = "cancel-advertise",
+			.xt = XT_NAT64,
+			.handler = handle_joold_advertise_cancel,
+			.handle_autocomplete = autocomplete_joold_advertise_cancel,
+		}, {
+			.label = "transport",
+			.xt = XT_NAT64,
+			.handler = handle_joold_transport,
+			.handle_autocomplete = autocomplete_joold_transport,
 		},
 		{ 0 },
 };
@@ -300,6 +346,11 @@ struct cmd_option tree[] = {
 			.label = "joold",
 			.xt = XT_NAT64,
 			.children = joold_ops,
+		}, {
+			.label = "capture",
+			.xt = XT_ANY,
+			.handler = handle_capture,
+			.handle_autocomplete = autocomplete_capture,
 		}, {
 			/* See files jool.bash and jool_siit.bash. */
 			.label = "autocomplete",
@@ -18,6 +18,7 @@ int wargp_parse_string(void *input, int key, char *str);
 int wargp_parse_addr(void *void_field, int key, char *str);
 int wargp_parse_prefix6(void *input, int key, char *str);
 int wargp_parse_prefix4(void *input, int key, char *str);
+int wargp_parse_port_range(void *input, int key, char *str);
 
 struct wargp_type wt_bool = {
 	/* Boolean opts need no argument; absence is false, presence is true. */
@@ -61,6 +62,11 @@ struct wargp_type wt_prefix4 = {
 	.parse = wargp_parse_prefix4,
 };
 
+struct wargp_type wt_port_range = {
+	.argument = "<port>[-<port>]",
+	.parse = wargp_parse_port_range,
+};
+
 struct wargp_args {
 	struct wargp_option *opts;
 	unsigned char *input;
@@ -164,6 +170,24 @@ int wargp_parse_prefix4(void *void_field, int key, char *str)
 	return 0;
 }
 
+int wargp_parse_port_range(void *void_field, int key, char *str)
+{
+	struct wargp_port_range *field = void_field;
+	struct jool_result result;
+
+	field->set = true;
+	result = str_to_port_range(str, &field->range);
+	if (result.error)
+		return pr_result(&result);
+
+	if (field->range.min > field->range.max) {
+		pr_err("Port range '%s' is empty.", str);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int adapt_options(struct argp *argp, struct wargp_option *wopts,
 		struct argp_option **result)
 {
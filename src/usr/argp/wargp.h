@@ -41,6 +41,7 @@ extern struct wargp_type wt_string;
 extern struct wargp_type wt_addr;
 extern struct wargp_type wt_prefix6;
 extern struct wargp_type wt_prefix4;
+extern struct wargp_type wt_port_range;
 
 struct wargp_option {
 	const char *name;
@@ -81,6 +82,11 @@ struct wargp_prefix4 {
 	struct ipv4_prefix prefix;
 };
 
+struct wargp_port_range {
+	bool set;
+	struct port_range range;
+};
+
 #define ARGP_TCP 't'
 #define ARGP_UDP 'u'
 #define ARGP_ICMP 'i'
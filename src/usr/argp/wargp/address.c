@@ -1,5 +1,7 @@
 #include "usr/argp/wargp/address.h"
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include "common/types.h"
 #include "usr/util/str_utils.h"
@@ -10,9 +12,12 @@
 #include "usr/argp/wargp.h"
 #include "usr/argp/xlator_type.h"
 
+#define ARGP_FILE 3000
+
 struct query_args {
 	struct wargp_bool verbose;
 	struct wargp_addr addr;
+	struct wargp_string file;
 };
 
 static struct wargp_option query_opts[] = {
@@ -28,6 +33,12 @@ static struct wargp_option query_opts[] = {
 		.doc = "IP Address you want to translate. Can be v6 or v4.",
 		.offset = offsetof(struct query_args, addr),
 		.type = &wt_addr,
+	}, {
+		.name = "file",
+		.key = ARGP_FILE,
+		.doc = "Translate the addresses listed in this file instead. (One per line; \"-\" is stdin.)",
+		.offset = offsetof(struct query_args, file),
+		.type = &wt_string,
 	},
 	{ 0 },
 };
@@ -166,6 +177,239 @@ end:	print_addr6(&dst->addr);
 	printf("\n");
 }
 
+/* One line of a `query --file` file. */
+struct bulk_query {
+	unsigned int proto; /* 6 or 4 */
+	union {
+		struct in6_addr v6;
+		struct in_addr v4;
+	} addr;
+};
+
+struct bulk_queries {
+	struct bulk_query *entries;
+	unsigned int count;
+	unsigned int count6;
+	unsigned int count4;
+};
+
+static struct jool_result parse_bulk_line(char *line, struct bulk_query *out)
+{
+	char *token, *save;
+
+	token = strtok_r(line, " \t\r\n", &save);
+	if (strtok_r(NULL, " \t\r\n", &save)) {
+		return result_from_error(
+			-EINVAL,
+			"Lines need exactly one IP address."
+		);
+	}
+
+	if (strchr(token, ':')) {
+		out->proto = 6;
+		return str_to_addr6(token, &out->addr.v6);
+	}
+
+	out->proto = 4;
+	return str_to_addr4(token, &out->addr.v4);
+}
+
+static struct jool_result read_bulk_file(char const *file_name,
+		struct bulk_queries *result)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t line_len = 0;
+	struct bulk_query *tmp;
+	unsigned int max = 0;
+	unsigned int line_num = 0;
+	char *cursor;
+	struct jool_result jresult;
+
+	memset(result, 0, sizeof(*result));
+
+	if (strcmp(file_name, "-") == 0) {
+		file = stdin;
+	} else {
+		file = fopen(file_name, "r");
+		if (!file) {
+			return result_from_error(
+				errno,
+				"Cannot open %s: %s", file_name, strerror(errno)
+			);
+		}
+	}
+
+	jresult = result_success();
+	while (getline(&line, &line_len, file) != -1) {
+		line_num++;
+		for (cursor = line; *cursor == ' ' || *cursor == '\t'; cursor++)
+			;
+		if (*cursor == '#' || *cursor == '\n' || *cursor == '\r'
+				|| *cursor == '\0')
+			continue;
+
+		if (result->count == max) {
+			max = max ? (2 * max) : 1024;
+			tmp = realloc(result->entries, max * sizeof(*tmp));
+			if (!tmp) {
+				jresult = result_from_enomem();
+				break;
+			}
+			result->entries = tmp;
+		}
+
+		jresult = parse_bulk_line(cursor,
+				&result->entries[result->count]);
+		if (jresult.error) {
+			pr_err("%s, line %u:", file_name, line_num);
+			break;
+		}
+
+		if (result->entries[result->count].proto == 6)
+			result->count6++;
+		else
+			result->count4++;
+		result->count++;
+	}
+
+	free(line);
+	if (file != stdin)
+		fclose(file);
+
+	if (jresult.error) {
+		free(result->entries);
+		result->entries = NULL;
+	}
+	return jresult;
+}
+
+static void print_bulk_addr(unsigned int proto, __u8 const *addr)
+{
+	char str[INET6_ADDRSTRLEN];
+	inet_ntop((proto == 6) ? AF_INET6 : AF_INET, addr, str, sizeof(str));
+	printf("%s", str);
+}
+
+static void print_bulk_prefix(unsigned int proto, __u8 const *addr,
+		__u8 len)
+{
+	print_bulk_addr(proto, addr);
+	printf("/%u", len);
+}
+
+/*
+ * "<query> <result>", or "<query> -" if the query could not be translated.
+ * @verbose appends the scheme, and the prefixes it used.
+ */
+static void print_bulk_result(struct bulk_query *query,
+		struct addrxlat_bulk_result *result, bool verbose)
+{
+	print_bulk_addr(query->proto, (__u8 const *)&query->addr);
+	printf(" ");
+
+	if (result->method == ADDRXLAT_BULK_FAILED) {
+		printf("-\n");
+		return;
+	}
+
+	print_bulk_addr((query->proto == 6) ? 4 : 6, result->addr);
+	if (!verbose)
+		goto end;
+
+	switch (result->method) {
+	case AXM_RFC6052:
+		printf(" RFC6052 ");
+		print_bulk_prefix(6, result->prefix6, result->prefix6_len);
+		break;
+	case AXM_EAMT:
+		printf(" EAMT ");
+		print_bulk_prefix(6, result->prefix6, result->prefix6_len);
+		printf(" ");
+		print_bulk_prefix(4, result->prefix4, result->prefix4_len);
+		break;
+	}
+
+end:	printf("\n");
+}
+
+/*
+ * Translates the file's addresses in two bulk queries (one per direction),
+ * then prints the results in the file's order.
+ */
+static int handle_address_query_file(char *iname, struct query_args *qargs)
+{
+	struct bulk_queries queries;
+	struct in6_addr *addrs6 = NULL;
+	struct in_addr *addrs4 = NULL;
+	struct addrxlat_bulk_result *results = NULL;
+	struct addrxlat_bulk_result *results6;
+	struct addrxlat_bulk_result *results4;
+	struct joolnl_socket sk;
+	unsigned int i, i6, i4;
+	struct jool_result result;
+
+	result = read_bulk_file(qargs->file.value, &queries);
+	if (result.error)
+		return pr_result(&result);
+	if (queries.count == 0)
+		goto end;
+
+	if (queries.count6)
+		addrs6 = malloc(queries.count6 * sizeof(*addrs6));
+	if (queries.count4)
+		addrs4 = malloc(queries.count4 * sizeof(*addrs4));
+	results = malloc(queries.count * sizeof(*results));
+	if ((queries.count6 && !addrs6) || (queries.count4 && !addrs4)
+			|| !results) {
+		result = result_from_enomem();
+		goto end;
+	}
+
+	for (i = 0, i6 = 0, i4 = 0; i < queries.count; i++) {
+		if (queries.entries[i].proto == 6)
+			addrs6[i6++] = queries.entries[i].addr.v6;
+		else
+			addrs4[i4++] = queries.entries[i].addr.v4;
+	}
+	results6 = results;
+	results4 = results + queries.count6;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		goto end;
+
+	if (queries.count6) {
+		result = joolnl_address_query64_bulk(&sk, iname, addrs6,
+				queries.count6, results6);
+		if (result.error)
+			goto teardown;
+	}
+	if (queries.count4) {
+		result = joolnl_address_query46_bulk(&sk, iname, addrs4,
+				queries.count4, results4);
+		if (result.error)
+			goto teardown;
+	}
+
+	for (i = 0, i6 = 0, i4 = 0; i < queries.count; i++) {
+		print_bulk_result(&queries.entries[i],
+				(queries.entries[i].proto == 6)
+						? &results6[i6++]
+						: &results4[i4++],
+				qargs->verbose.value);
+	}
+
+teardown:
+	joolnl_teardown(&sk);
+end:
+	free(results);
+	free(addrs4);
+	free(addrs6);
+	free(queries.entries);
+	return pr_result(&result);
+}
+
 int handle_address_query(char *iname, int argc, char **argv, void const *arg)
 {
 	struct query_args qargs = { 0 };
@@ -181,6 +425,14 @@ int handle_address_query(char *iname, int argc, char **argv, void const *arg)
 	if (result.error)
 		return result.error;
 
+	if (qargs.file.value) {
+		if (qargs.addr.proto) {
+			pr_err("--file and the IP address are mutually exclusive.");
+			return -EINVAL;
+		}
+		return handle_address_query_file(iname, &qargs);
+	}
+
 	if (!qargs.addr.proto) {
 		struct requirement reqs[] = {
 			{ false, "an IP address" },
@@ -1,8 +1,13 @@
 #include "usr/argp/wargp/bib.h"
 
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "usr/argp/dns.h"
+#include "usr/argp/export.h"
 #include "usr/argp/log.h"
 #include "usr/argp/requirements.h"
 #include "usr/argp/userspace-types.h"
@@ -12,11 +17,28 @@
 #include "usr/nl/core.h"
 #include "usr/util/str_utils.h"
 
+#define ARGP_SRC6 3001
+#define ARGP_SRC4 3002
+#define ARGP_PORTS 3003
+#define ARGP_COUNTERS 3004
+#define ARGP_FORMAT 3005
+#define ARGP_ALL 3006
+#define ARGP_COUNT 3007
+
 struct display_args {
 	struct wargp_l4proto proto;
 	struct wargp_bool no_headers;
 	struct wargp_bool csv;
 	struct wargp_bool numeric;
+
+	struct wargp_prefix6 src6;
+	struct wargp_prefix4 src4;
+	struct wargp_port_range ports;
+	struct wargp_bool counters;
+
+	enum export_format format;
+	struct wargp_bool all;
+	struct wargp_bool count;
 };
 
 static struct wargp_option display_opts[] = {
@@ -26,9 +48,76 @@ static struct wargp_option display_opts[] = {
 	WARGP_NO_HEADERS(struct display_args, no_headers),
 	WARGP_CSV(struct display_args, csv),
 	WARGP_NUMERIC(struct display_args, numeric),
+	{
+		.name = "src6",
+		.key = ARGP_SRC6,
+		.doc = "Only print the entries whose IPv6 address belongs to this prefix",
+		.offset = offsetof(struct display_args, src6),
+		.type = &wt_prefix6,
+	}, {
+		.name = "src4",
+		.key = ARGP_SRC4,
+		.doc = "Only print the entries whose IPv4 address belongs to this prefix",
+		.offset = offsetof(struct display_args, src4),
+		.type = &wt_prefix4,
+	}, {
+		.name = "ports",
+		.key = ARGP_PORTS,
+		.doc = "Only print the entries whose IPv4 L4-ID belongs to this range",
+		.offset = offsetof(struct display_args, ports),
+		.type = &wt_port_range,
+	}, {
+		.name = "counters",
+		.key = ARGP_COUNTERS,
+		.doc = "Also print the packets and bytes of the entries' sessions (see session-counters)",
+		.offset = offsetof(struct display_args, counters),
+		.type = &wt_bool,
+	}, {
+		.name = "format",
+		.key = ARGP_FORMAT,
+		.doc = "Output format: text (default), csv (numeric, buffered) or binary (fixed-size records)",
+		.offset = offsetof(struct display_args, format),
+		.type = &wt_export_format,
+	}, {
+		.name = "all",
+		.key = ARGP_ALL,
+		.doc = "Dump the TCP, UDP and ICMP tables, in parallel (csv and binary formats only)",
+		.offset = offsetof(struct display_args, all),
+		.type = &wt_bool,
+	}, {
+		.name = "count",
+		.key = ARGP_COUNT,
+		.doc = "Only print the number of BIB entries (of all protocols), without dumping them",
+		.offset = offsetof(struct display_args, count),
+		.type = &wt_bool,
+	},
 	{ 0 },
 };
 
+/* Returns NULL if the user didn't ask for any filtering. */
+static struct query_filter *build_filter(struct wargp_prefix6 const *src6,
+		struct wargp_prefix4 const *src4,
+		struct wargp_port_range const *ports,
+		struct query_filter *filter)
+{
+	memset(filter, 0, sizeof(*filter));
+
+	if (src6->set) {
+		filter->flags |= QF_SRC6;
+		filter->src6 = src6->prefix;
+	}
+	if (src4->set) {
+		filter->flags |= QF_SRC4;
+		filter->src4 = src4->prefix;
+	}
+	if (ports->set) {
+		filter->flags |= QF_PORTS;
+		filter->ports = ports->range;
+	}
+
+	return filter->flags ? filter : NULL;
+}
+
 static struct jool_result print_entry(struct bib_entry const *entry, void *args)
 {
 	struct display_args *dargs = args;
@@ -39,26 +128,132 @@ static struct jool_result print_entry(struct bib_entry const *entry, void *args)
 		print_addr6(&entry->addr6, dargs->numeric.value, ",", proto);
 		printf(",");
 		print_addr4(&entry->addr4, true, ",", proto);
-		printf(",%u\n", entry->is_static);
+		printf(",%u", entry->is_static);
+		if (dargs->counters.value)
+			printf(",%llu,%llu", entry->packets, entry->bytes);
+		printf("\n");
 	} else {
 		printf("[%s %s] ", entry->is_static ? "Static" : "Dynamic",
 				l4proto_to_string(proto));
 		print_addr4(&entry->addr4, true, "#", proto);
 		printf(" - ");
 		print_addr6(&entry->addr6, dargs->numeric.value, "#", proto);
+		if (dargs->counters.value)
+			printf(" (%llu packets, %llu bytes)", entry->packets,
+					entry->bytes);
 		printf("\n");
 	}
 
 	return result_success();
 }
 
+static void print_csv_header(struct display_args const *dargs)
+{
+	printf("Protocol,IPv6 Address,IPv6 L4-ID,IPv4 Address,IPv4 L4-ID,Static?");
+	if (dargs->counters.value)
+		printf(",Packets,Bytes");
+	printf("\n");
+}
+
+struct bib_export {
+	struct display_args *dargs;
+	struct export_buffer *out;
+};
+
+/* Same columns as print_entry()'s CSV, always numeric. */
+static struct jool_result export_csv(struct bib_entry const *entry, void *arg)
+{
+	struct bib_export *export = arg;
+	struct export_buffer *out = export->out;
+
+	export_str(out, l4proto_to_string(entry->l4_proto));
+	export_char(out, ',');
+	export_addr6(out, &entry->addr6);
+	export_char(out, ',');
+	export_addr4(out, &entry->addr4);
+	export_char(out, ',');
+	export_u64(out, entry->is_static);
+	if (export->dargs->counters.value) {
+		export_char(out, ',');
+		export_u64(out, entry->packets);
+		export_char(out, ',');
+		export_u64(out, entry->bytes);
+	}
+	export_char(out, '\n');
+
+	return export_row_end(out);
+}
+
+/* 42 bytes; see the BIB documentation. */
+static struct jool_result export_binary(struct bib_entry const *entry,
+		void *arg)
+{
+	struct bib_export *export = arg;
+	struct export_buffer *out = export->out;
+
+	export_be8(out, entry->l4_proto);
+	export_be8(out, entry->is_static);
+	export_bin6(out, &entry->addr6);
+	export_bin4(out, &entry->addr4);
+	export_be64(out, entry->packets);
+	export_be64(out, entry->bytes);
+
+	return export_row_end(out);
+}
+
+static struct jool_result dump_bib(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto,
+		struct export_buffer *out, void *arg)
+{
+	struct bib_export export;
+	struct display_args *dargs = arg;
+	struct query_filter filter;
+
+	export.dargs = dargs;
+	export.out = out;
+
+	return joolnl_bib_foreach(sk, iname, proto,
+			build_filter(&dargs->src6, &dargs->src4, &dargs->ports,
+					&filter),
+			(dargs->format == EXPORT_BINARY)
+					? export_binary
+					: export_csv,
+			&export);
+}
+
+static int export_bib(char *iname, struct display_args *dargs)
+{
+	static const l4_protocol ALL[EXPORT_MAX_TABLES] = {
+		L4PROTO_TCP, L4PROTO_UDP, L4PROTO_ICMP
+	};
+	struct jool_result result;
+
+	if (dargs->format == EXPORT_BINARY) {
+		if (isatty(STDOUT_FILENO)) {
+			pr_err("The binary format is, well, binary; please redirect it to a file.");
+			return -EINVAL;
+		}
+	} else if (!dargs->no_headers.value) {
+		print_csv_header(dargs);
+	}
+
+	if (dargs->all.value)
+		result = export_tables(iname, ALL, EXPORT_MAX_TABLES,
+				dump_bib, dargs);
+	else
+		result = export_tables(iname, &dargs->proto.proto, 1,
+				dump_bib, dargs);
+	return pr_result(&result);
+}
+
 /*
- * BTW: This thing is not thread-safe because of the address-to-string v4
- * function.
+ * BTW: The text format is not thread-safe because of the address-to-string v4
+ * function. The export formats don't use it.
  */
 int handle_bib_display(char *iname, int argc, char **argv, void const *arg)
 {
 	struct display_args dargs = { 0 };
+	struct query_filter filter;
 	struct joolnl_socket sk;
 	struct jool_result result;
 
@@ -66,14 +261,36 @@ int handle_bib_display(char *iname, int argc, char **argv, void const *arg)
 	if (result.error)
 		return result.error;
 
+	if (dargs.count.value) {
+		if (build_filter(&dargs.src6, &dargs.src4, &dargs.ports,
+				&filter) || dargs.proto.set || dargs.all.value
+				|| dargs.format != EXPORT_TEXT) {
+			pr_err("--count can only count all the BIB entries. (It doesn't dump them.)");
+			return -EINVAL;
+		}
+		return export_count(iname, JSTAT_BIB_ENTRIES);
+	}
+	if (dargs.all.value && dargs.proto.set) {
+		pr_err("--all already includes every protocol.");
+		return -EINVAL;
+	}
+	if (dargs.format != EXPORT_TEXT)
+		return export_bib(iname, &dargs);
+	if (dargs.all.value) {
+		pr_err("--all requires --format csv or binary.");
+		return -EINVAL;
+	}
+
 	result = joolnl_setup(&sk, xt_get());
 	if (result.error)
 		return pr_result(&result);
 
 	if (show_csv_header(dargs.no_headers.value, dargs.csv.value))
-		printf("Protocol,IPv6 Address,IPv6 L4-ID,IPv4 Address,IPv4 L4-ID,Static?\n");
+		print_csv_header(&dargs);
 
 	result = joolnl_bib_foreach(&sk, iname, dargs.proto.proto,
+			build_filter(&dargs.src6, &dargs.src4, &dargs.ports,
+					&filter),
 			print_entry, &dargs);
 
 	joolnl_teardown(&sk);
@@ -114,8 +331,11 @@ static int parse_taddr(void *void_field, int key, char *str)
 struct add_args {
 	struct wargp_l4proto proto;
 	struct taddr_tuple taddrs;
+	struct wargp_string file;
 };
 
+#define ARGP_BIB_FILE 3000
+
 struct wargp_type wt_taddr = {
 	.argument = "<IPv6 transport address> <IPv4 transport address>",
 	.parse = parse_taddr,
@@ -131,10 +351,166 @@ static struct wargp_option add_opts[] = {
 		.doc = "Transport addresses that shape the BIB entry you want to add",
 		.offset = offsetof(struct add_args, taddrs),
 		.type = &wt_taddr,
+	}, {
+		.name = "file",
+		.key = ARGP_BIB_FILE,
+		.doc = "Add the entries listed in this file instead. (One pair of transport addresses per line.)",
+		.offset = offsetof(struct add_args, file),
+		.type = &wt_string,
 	},
 	{ 0 },
 };
 
+/* Parses a line of a `bib add --file` file. */
+static struct jool_result parse_bulk_line(char *line, l4_protocol proto,
+		struct bib_entry *entry)
+{
+	char *token, *save;
+	struct taddr_tuple taddrs = { 0 };
+	struct jool_result result;
+
+	for (token = strtok_r(line, " \t\r\n", &save);
+			token;
+			token = strtok_r(NULL, " \t\r\n", &save)) {
+		if (strchr(token, ':')) {
+			taddrs.addr6_set = true;
+			result = str_to_addr6_port(token, &taddrs.addr6);
+		} else {
+			taddrs.addr4_set = true;
+			result = str_to_addr4_port(token, &taddrs.addr4);
+		}
+		if (result.error)
+			return result;
+	}
+
+	if (!taddrs.addr6_set || !taddrs.addr4_set) {
+		return result_from_error(
+			-EINVAL,
+			"Lines need an IPv6 transport address and an IPv4 transport address."
+		);
+	}
+
+	entry->addr6 = taddrs.addr6;
+	entry->addr4 = taddrs.addr4;
+	entry->l4_proto = proto;
+	entry->is_static = true;
+	return result_success();
+}
+
+static struct jool_result read_bulk_file(char const *file_name,
+		l4_protocol proto, struct bib_entry **result,
+		unsigned int *count)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t line_len = 0;
+	struct bib_entry *entries = NULL;
+	struct bib_entry *tmp;
+	unsigned int max = 0;
+	unsigned int n = 0;
+	unsigned int line_num = 0;
+	char *cursor;
+	struct jool_result jresult;
+
+	file = fopen(file_name, "r");
+	if (!file) {
+		return result_from_error(
+			errno,
+			"Cannot open %s: %s", file_name, strerror(errno)
+		);
+	}
+
+	jresult = result_success();
+	while (getline(&line, &line_len, file) != -1) {
+		line_num++;
+		for (cursor = line; *cursor == ' ' || *cursor == '\t'; cursor++)
+			;
+		if (*cursor == '#' || *cursor == '\n' || *cursor == '\0')
+			continue;
+
+		if (n == max) {
+			max = max ? (2 * max) : 1024;
+			tmp = realloc(entries, max * sizeof(*entries));
+			if (!tmp) {
+				jresult = result_from_enomem();
+				break;
+			}
+			entries = tmp;
+		}
+
+		jresult = parse_bulk_line(cursor, proto, &entries[n]);
+		if (jresult.error) {
+			pr_err("%s, line %u:", file_name, line_num);
+			break;
+		}
+		n++;
+	}
+
+	free(line);
+	fclose(file);
+
+	if (jresult.error) {
+		free(entries);
+		return jresult;
+	}
+
+	*result = entries;
+	*count = n;
+	return result_success();
+}
+
+static struct jool_result print_bulk_failure(struct bib_entry const *failed,
+		void *args)
+{
+	unsigned int *failures = args;
+	char addr6[INET6_ADDRSTRLEN];
+	char addr4[INET_ADDRSTRLEN];
+
+	inet_ntop(AF_INET6, &failed->addr6.l3, addr6, sizeof(addr6));
+	inet_ntop(AF_INET, &failed->addr4.l3, addr4, sizeof(addr4));
+	pr_err("Could not add %s#%u %s#%u. (It collides with an existing entry, or its ports are not congruent modulo the BIB's shard count.)",
+			addr6, failed->addr6.l4, addr4, failed->addr4.l4);
+
+	(*failures)++;
+	return result_success();
+}
+
+static int handle_bib_add_file(char *iname, struct add_args *aargs)
+{
+	struct joolnl_socket sk;
+	struct bib_entry *entries = NULL;
+	unsigned int count = 0;
+	unsigned int failures;
+	struct jool_result result;
+
+	result = read_bulk_file(aargs->file.value, aargs->proto.proto,
+			&entries, &count);
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error) {
+		free(entries);
+		return pr_result(&result);
+	}
+
+	failures = 0;
+	result = joolnl_bib_add_bulk(&sk, iname, entries, count,
+			print_bulk_failure, &failures);
+
+	joolnl_teardown(&sk);
+	free(entries);
+
+	if (!result.error && failures) {
+		result = result_from_error(
+			-EEXIST,
+			"%u out of %u entries could not be added.",
+			failures, count
+		);
+	}
+	return pr_result(&result);
+}
+
 int handle_bib_add(char *iname, int argc, char **argv, void const *arg)
 {
 	struct add_args aargs = { 0 };
@@ -145,6 +521,14 @@ int handle_bib_add(char *iname, int argc, char **argv, void const *arg)
 	if (result.error)
 		return result.error;
 
+	if (aargs.file.value) {
+		if (aargs.taddrs.addr6_set || aargs.taddrs.addr4_set) {
+			pr_err("--file and the transport addresses are mutually exclusive.");
+			return -EINVAL;
+		}
+		return handle_bib_add_file(iname, &aargs);
+	}
+
 	if (!aargs.taddrs.addr6_set || !aargs.taddrs.addr4_set) {
 		struct requirement reqs[] = {
 			{ aargs.taddrs.addr6_set, "an IPv6 transport address" },
@@ -226,3 +610,96 @@ void autocomplete_bib_remove(void const *args)
 {
 	print_wargp_opts(remove_opts);
 }
+
+struct flush_args {
+	struct wargp_bool tcp;
+	struct wargp_bool udp;
+	struct wargp_bool icmp;
+
+	struct wargp_prefix6 src6;
+	struct wargp_prefix4 src4;
+	struct wargp_port_range ports;
+};
+
+static struct wargp_option flush_opts[] = {
+	{
+		.name = "tcp",
+		.key = ARGP_TCP,
+		.doc = "Flush the TCP table",
+		.offset = offsetof(struct flush_args, tcp),
+		.type = &wt_bool,
+	}, {
+		.name = "udp",
+		.key = ARGP_UDP,
+		.doc = "Flush the UDP table",
+		.offset = offsetof(struct flush_args, udp),
+		.type = &wt_bool,
+	}, {
+		.name = "icmp",
+		.key = ARGP_ICMP,
+		.doc = "Flush the ICMP table",
+		.offset = offsetof(struct flush_args, icmp),
+		.type = &wt_bool,
+	}, {
+		.name = "src6",
+		.key = ARGP_SRC6,
+		.doc = "Only remove the entries whose IPv6 address belongs to this prefix",
+		.offset = offsetof(struct flush_args, src6),
+		.type = &wt_prefix6,
+	}, {
+		.name = "src4",
+		.key = ARGP_SRC4,
+		.doc = "Only remove the entries whose IPv4 address belongs to this prefix",
+		.offset = offsetof(struct flush_args, src4),
+		.type = &wt_prefix4,
+	}, {
+		.name = "ports",
+		.key = ARGP_PORTS,
+		.doc = "Only remove the entries whose IPv4 L4-ID belongs to this range",
+		.offset = offsetof(struct flush_args, ports),
+		.type = &wt_port_range,
+	},
+	{ 0 },
+};
+
+int handle_bib_flush(char *iname, int argc, char **argv, void const *arg)
+{
+	struct flush_args fargs = { 0 };
+	struct query_filter filter;
+	struct joolnl_socket sk;
+	__u8 protos;
+	__u32 removed;
+	struct jool_result result;
+
+	result.error = wargp_parse(flush_opts, argc, argv, &fargs);
+	if (result.error)
+		return result.error;
+
+	/* None means all of them. */
+	protos = 0;
+	if (fargs.tcp.value)
+		protos |= 1 << L4PROTO_TCP;
+	if (fargs.udp.value)
+		protos |= 1 << L4PROTO_UDP;
+	if (fargs.icmp.value)
+		protos |= 1 << L4PROTO_ICMP;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_bib_purge(&sk, iname, protos,
+			build_filter(&fargs.src6, &fargs.src4, &fargs.ports,
+					&filter),
+			&removed);
+	if (!result.error)
+		printf("Removed %u BIB entries.\n", removed);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_bib_flush(void const *args)
+{
+	print_wargp_opts(flush_opts);
+}
@@ -4,9 +4,11 @@
 int handle_bib_display(char *iname, int argc, char **argv, void const *arg);
 int handle_bib_add(char *iname, int argc, char **argv, void const *arg);
 int handle_bib_remove(char *iname, int argc, char **argv, void const *arg);
+int handle_bib_flush(char *iname, int argc, char **argv, void const *arg);
 
 void autocomplete_bib_display(void const *args);
 void autocomplete_bib_add(void const *args);
 void autocomplete_bib_remove(void const *args);
+void autocomplete_bib_flush(void const *args);
 
 #endif /* SRC_USR_ARGP_WARGP_BIB_H_ */
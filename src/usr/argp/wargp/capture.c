@@ -0,0 +1,296 @@
+#include "usr/argp/wargp/capture.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+
+#include "common/config.h"
+#include "usr/nl/core.h"
+#include "usr/argp/log.h"
+#include "usr/argp/wargp.h"
+#include "usr/argp/xlator_type.h"
+
+/*
+ * pcap-ng. (draft-ietf-opsawg-pcapng)
+ * Everything is written in host byte order; the Byte-Order Magic says which.
+ */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_IF_TSRESOL 9
+#define PCAPNG_EPB_FLAGS 2
+
+/* epb_flags' direction bits. */
+#define PCAPNG_INBOUND 1
+#define PCAPNG_OUTBOUND 2
+
+/* Packets start at the IP header; version is sniffed from the first nibble. */
+#define LINKTYPE_RAW 101
+
+/* The kernel sends bursts; don't make it drop them. */
+#define RCVBUF_SIZE (4 * 1024 * 1024)
+
+#define PAD4(len) (((len) + 3) & ~3)
+
+struct capture_args {
+	__u32 count;
+};
+
+static struct wargp_option capture_opts[] = {
+	{
+		.name = "count",
+		.key = 'c',
+		.doc = "Exit after this many packets (0 = never)",
+		.offset = offsetof(struct capture_args, count),
+		.type = &wt_u32,
+	},
+	{ 0 },
+};
+
+struct capture_state {
+	char const *iname;
+	__u32 count;
+	__u32 written;
+};
+
+static void write_u16(__u16 value)
+{
+	fwrite(&value, sizeof(value), 1, stdout);
+}
+
+static void write_u32(__u32 value)
+{
+	fwrite(&value, sizeof(value), 1, stdout);
+}
+
+static void write_padding(size_t len)
+{
+	static const unsigned char zeroes[4] = { 0 };
+	fwrite(zeroes, 1, PAD4(len) - len, stdout);
+}
+
+/* Block header and footer: 12 bytes. Option: 4 + data (padded). */
+static void write_headers(char const *iname)
+{
+	size_t name_len;
+	__u32 len;
+
+	/* Section Header Block */
+	write_u32(PCAPNG_SHB);
+	write_u32(28);
+	write_u32(PCAPNG_BYTE_ORDER_MAGIC);
+	write_u16(1); /* Major version */
+	write_u16(0); /* Minor version */
+	write_u32(0xFFFFFFFF); /* Section length: unknown */
+	write_u32(0xFFFFFFFF);
+	write_u32(28);
+
+	/* Interface Description Block; the instance. */
+	name_len = strnlen(iname, INAME_MAX_SIZE);
+	len = 12 + 8 + (4 + PAD4(name_len)) + (4 + 4) + 4;
+	write_u32(PCAPNG_IDB);
+	write_u32(len);
+	write_u16(LINKTYPE_RAW);
+	write_u16(0); /* Reserved */
+	write_u32(CAPTURE_SNAPLEN_MAX);
+
+	write_u16(PCAPNG_IF_NAME);
+	write_u16(name_len);
+	fwrite(iname, 1, name_len, stdout);
+	write_padding(name_len);
+
+	write_u16(PCAPNG_IF_TSRESOL);
+	write_u16(1);
+	fputc(9, stdout); /* Nanoseconds */
+	write_padding(1);
+
+	write_u16(PCAPNG_OPT_END);
+	write_u16(0);
+	write_u32(len);
+}
+
+/* Enhanced Packet Block */
+static void write_packet(struct capture_record *record, void *data)
+{
+	__u32 len;
+
+	len = 12 + 20 + PAD4(record->caplen) + (4 + 4) + 4;
+	write_u32(PCAPNG_EPB);
+	write_u32(len);
+	write_u32(0); /* Interface ID */
+	write_u32(record->timestamp >> 32);
+	write_u32(record->timestamp & 0xFFFFFFFF);
+	write_u32(record->caplen);
+	write_u32(record->len);
+	fwrite(data, 1, record->caplen, stdout);
+	write_padding(record->caplen);
+
+	write_u16(PCAPNG_EPB_FLAGS);
+	write_u16(4);
+	write_u32((record->direction == CAPTURE_IN)
+			? PCAPNG_INBOUND
+			: PCAPNG_OUTBOUND);
+
+	write_u16(PCAPNG_OPT_END);
+	write_u16(0);
+	write_u32(len);
+}
+
+/* Called when the kernel sends a batch of packets. */
+static int capture_cb(struct nl_msg *msg, void *arg)
+{
+	struct capture_state *state = arg;
+	struct nlmsghdr *nhdr;
+	struct genlmsghdr *ghdr;
+	struct joolnlhdr *jhdr;
+	struct nlattr *root;
+	struct capture_record *record;
+	unsigned char *data;
+	unsigned int offset, len, recsize;
+	struct jool_result result;
+
+	nhdr = nlmsg_hdr(msg);
+	if (!genlmsg_valid_hdr(nhdr, sizeof(struct joolnlhdr))) {
+		pr_err("Kernel sent invalid data: Message too short to contain headers");
+		return NL_SKIP;
+	}
+
+	ghdr = genlmsg_hdr(nhdr);
+
+	jhdr = genlmsg_user_hdr(ghdr);
+	result = validate_joolnlhdr(jhdr, xt_get());
+	if (result.error) {
+		/* Other translator type; not for us. */
+		result_cleanup(&result);
+		return NL_SKIP;
+	}
+	if (strncmp(jhdr->iname, state->iname, INAME_MAX_SIZE))
+		return NL_SKIP; /* Some other instance's. */
+
+	root = genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr));
+	if (nla_type(root) != JNLAR_CAPTURE_RECORDS) {
+		pr_err("Kernel sent invalid data: Message lacks a record sequence");
+		return NL_SKIP;
+	}
+
+	data = nla_data(root);
+	len = nla_len(root);
+	for (offset = 0; offset + sizeof(*record) <= len; offset += recsize) {
+		record = (struct capture_record *)(data + offset);
+		recsize = CAPTURE_RECORD_LEN(record->caplen);
+		if (offset + recsize > len) {
+			pr_err("Kernel sent invalid data: Truncated record");
+			break;
+		}
+
+		write_packet(record, record + 1);
+		state->written++;
+		if (state->count && state->written >= state->count)
+			break;
+	}
+
+	fflush(stdout);
+	return (state->count && state->written >= state->count)
+			? NL_STOP
+			: NL_OK;
+}
+
+static struct jool_result subscribe(struct joolnl_socket *sk,
+		struct capture_state *state)
+{
+	int group;
+	int error;
+
+	/* Multicasts aren't answers to anything. */
+	nl_socket_disable_seq_check(sk->sk);
+
+	error = nl_socket_modify_cb(sk->sk, NL_CB_VALID, NL_CB_CUSTOM,
+			capture_cb, state);
+	if (error)
+		return result_from_error(error,
+				"Couldn't modify the socket's callbacks: %s",
+				nl_geterror(error));
+
+	error = nl_socket_set_buffer_size(sk->sk, RCVBUF_SIZE, 0);
+	if (error)
+		return result_from_error(error,
+				"Couldn't resize the socket's buffer: %s",
+				nl_geterror(error));
+
+	group = genl_ctrl_resolve_grp(sk->sk, JOOLNL_FAMILY,
+			JOOLNL_CAPTURE_GRP_NAME);
+	if (group < 0)
+		return result_from_error(group,
+				"Unable to resolve the capture multicast group: %s",
+				nl_geterror(group));
+
+	error = nl_socket_add_membership(sk->sk, group);
+	if (error)
+		return result_from_error(error,
+				"Can't register to the capture multicast group: %s",
+				nl_geterror(error));
+
+	return result_success();
+}
+
+int handle_capture(char *iname, int argc, char **argv, void const *arg)
+{
+	struct capture_args cargs = { 0 };
+	struct capture_state state;
+	struct joolnl_socket sk;
+	struct jool_result result;
+	int error;
+
+	result.error = wargp_parse(capture_opts, argc, argv, &cargs);
+	if (result.error)
+		return result.error;
+
+	if (isatty(STDOUT_FILENO)) {
+		pr_err("pcap-ng is binary; please redirect the output to a file or pipe.");
+		pr_err("(eg. `jool capture > trace.pcapng`, or `jool capture | wireshark -k -i -`)");
+		return -EINVAL;
+	}
+
+	state.iname = iname ? iname : INAME_DEFAULT;
+	state.count = cargs.count;
+	state.written = 0;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = subscribe(&sk, &state);
+	if (result.error)
+		goto end;
+
+	write_headers(state.iname);
+	fflush(stdout);
+
+	do {
+		error = nl_recvmsgs_default(sk.sk);
+		if (error == -NLE_NOMEM) {
+			pr_warn("The socket overflowed; some packets were lost.");
+		} else if (error < 0) {
+			result = result_from_error(error,
+					"Error receiving the capture: %s",
+					nl_geterror(error));
+			goto end;
+		}
+	} while (!state.count || state.written < state.count);
+
+end:
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_capture(void const *args)
+{
+	print_wargp_opts(capture_opts);
+}
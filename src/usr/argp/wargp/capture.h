@@ -0,0 +1,7 @@
+#ifndef SRC_USR_ARGP_WARGP_CAPTURE_H_
+#define SRC_USR_ARGP_WARGP_CAPTURE_H_
+
+int handle_capture(char *iname, int argc, char **argv, void const *arg);
+void autocomplete_capture(void const *args);
+
+#endif /* SRC_USR_ARGP_WARGP_CAPTURE_H_ */
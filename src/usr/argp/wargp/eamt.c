@@ -1,5 +1,6 @@
 #include "usr/argp/wargp/eamt.h"
 
+#include "common/constants.h"
 #include "usr/argp/log.h"
 #include "usr/argp/requirements.h"
 #include "usr/argp/userspace-types.h"
@@ -9,6 +10,9 @@
 #include "usr/nl/eamt.h"
 #include "usr/util/str_utils.h"
 
+#define ARGP_EA_LEN 3000
+#define ARGP_PSID_OFFSET 3001
+
 struct display_args {
 	struct wargp_bool no_headers;
 	struct wargp_bool csv;
@@ -22,7 +26,7 @@ static struct wargp_option display_opts[] = {
 
 static void print_separator(void)
 {
-	print_table_separator(0, 43, 18, 0);
+	print_table_separator(0, 43, 18, 7, 11, 0);
 }
 
 static struct jool_result print_entry(struct eamt_entry const *entry, void *args)
@@ -35,13 +39,22 @@ static struct jool_result print_entry(struct eamt_entry const *entry, void *args
 	ipv4_str = inet_ntoa(entry->prefix4.addr);
 
 	if (dargs->csv.value) {
-		printf("%s/%u,%s/%u\n",
+		printf("%s/%u,%s/%u,",
 				ipv6_str, entry->prefix6.len,
 				ipv4_str, entry->prefix4.len);
+		if (entry->ea_len)
+			printf("%u,%u\n", entry->ea_len, entry->psid_offset);
+		else
+			printf(",\n");
 	} else {
-		printf("| %39s/%-3u | %15s/%-2u |\n",
+		printf("| %39s/%-3u | %15s/%-2u | ",
 				ipv6_str, entry->prefix6.len,
 				ipv4_str, entry->prefix4.len);
+		if (entry->ea_len)
+			printf("%7u | %11u |\n", entry->ea_len,
+					entry->psid_offset);
+		else
+			printf("%7s | %11s |\n", "-", "-");
 	}
 
 	return result_success();
@@ -64,11 +77,14 @@ int handle_eamt_display(char *iname, int argc, char **argv, void const *arg)
 	if (!dargs.no_headers.value) {
 		static char const *const th1 = "IPv6 Prefix";
 		static char const *const th2 = "IPv4 Prefix";
+		static char const *const th3 = "EA Bits";
+		static char const *const th4 = "PSID Offset";
 		if (dargs.csv.value)
-			printf("%s,%s\n", th1, th2);
+			printf("%s,%s,%s,%s\n", th1, th2, th3, th4);
 		else {
 			print_separator();
-			printf("| %43s | %18s |\n", th1, th2);
+			printf("| %43s | %18s | %7s | %11s |\n",
+					th1, th2, th3, th4);
 			print_separator();
 		}
 	}
@@ -96,8 +112,15 @@ struct wargp_eamt_entry {
 	struct eamt_entry value;
 };
 
+struct wargp_u8 {
+	bool set;
+	__u8 value;
+};
+
 struct add_args {
 	struct wargp_eamt_entry entry;
+	struct wargp_u8 ea_len;
+	struct wargp_u8 psid_offset;
 	bool force;
 };
 
@@ -125,8 +148,37 @@ struct wargp_type wt_prefixes = {
 	.parse = parse_eamt_column,
 };
 
+/* EA bits and PSID offsets are both bit counts, and never exceed 64. */
+static int parse_bits(void *void_field, int key, char *str)
+{
+	struct wargp_u8 *field = void_field;
+	struct jool_result result;
+
+	field->set = true;
+	result = str_to_u8(str, &field->value, 64);
+	return pr_result(&result);
+}
+
+static struct wargp_type wt_bits = {
+	.argument = "<bits>",
+	.parse = parse_bits,
+};
+
 static struct wargp_option add_opts[] = {
 	WARGP_FORCE(struct add_args, force),
+	{
+		.name = "ea-bits-length",
+		.key = ARGP_EA_LEN,
+		.doc = "Turn the entry into a MAP-T rule: the IPv6 addresses embed this many bits of IPv4 suffix and Port Set ID",
+		.offset = offsetof(struct add_args, ea_len),
+		.type = &wt_bits,
+	}, {
+		.name = "psid-offset",
+		.key = ARGP_PSID_OFFSET,
+		.doc = "MAP-T rules only: number of port bits that precede the Port Set ID (default: 6)",
+		.offset = offsetof(struct add_args, psid_offset),
+		.type = &wt_bits,
+	},
 	{
 		.name = "Prefixes",
 		.key = ARGP_KEY_ARG,
@@ -156,14 +208,21 @@ int handle_eamt_add(char *iname, int argc, char **argv, void const *arg)
 		return requirement_print(reqs);
 	}
 
+	if (aargs.ea_len.set) {
+		aargs.entry.value.ea_len = aargs.ea_len.value;
+		aargs.entry.value.psid_offset = aargs.psid_offset.set
+				? aargs.psid_offset.value
+				: DEFAULT_PSID_OFFSET;
+	} else if (aargs.psid_offset.set) {
+		pr_err("--psid-offset requires --ea-bits-length.");
+		return -EINVAL;
+	}
+
 	result = joolnl_setup(&sk, xt_get());
 	if (result.error)
 		return pr_result(&result);
 
-	result = joolnl_eamt_add(&sk, iname,
-			&aargs.entry.value.prefix6,
-			&aargs.entry.value.prefix4,
-			aargs.force);
+	result = joolnl_eamt_add(&sk, iname, &aargs.entry.value, aargs.force);
 
 	joolnl_teardown(&sk);
 	return pr_result(&result);
@@ -9,14 +9,23 @@
 #include "usr/nl/core.h"
 #include "usr/nl/file.h"
 
+#define ARGP_DIFF 'd'
+
 struct update_args {
 	struct wargp_string file_name;
 	struct wargp_bool force;
+	struct wargp_bool diff;
 };
 
 static struct wargp_option update_opts[] = {
 	WARGP_FORCE(struct update_args, force),
 	{
+		.name = "diff",
+		.key = ARGP_DIFF,
+		.doc = "Only upload the differences between the file and the running configuration",
+		.offset = offsetof(struct update_args, diff),
+		.type = &wt_bool,
+	}, {
 		.name = "File name",
 		.key = ARGP_KEY_ARG,
 		.doc = "Path to a JSON file containing Jool's configuration.",
@@ -49,7 +58,7 @@ int handle_file_update(char *iname, int argc, char **argv, void const *arg)
 		return pr_result(&result);
 
 	result = joolnl_file_parse(&sk, xt_get(), iname, uargs.file_name.value,
-			uargs.force.value);
+			uargs.force.value, uargs.diff.value);
 
 	joolnl_teardown(&sk);
 	return pr_result(&result);
@@ -2,6 +2,8 @@
 
 #include "usr/nl/joold.h"
 #include "usr/argp/log.h"
+#include "usr/argp/requirements.h"
+#include "usr/argp/wargp.h"
 #include "usr/argp/xlator_type.h"
 
 int handle_joold_advertise(char *iname, int argc, char **argv, void const *arg)
@@ -23,3 +25,95 @@ void autocomplete_joold_advertise(void const *args)
 {
 	/* joold advertise has no arguments. */
 }
+
+int handle_joold_advertise_cancel(char *iname, int argc, char **argv,
+		void const *arg)
+{
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_joold_advertise_cancel(&sk, iname);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_joold_advertise_cancel(void const *args)
+{
+	/* joold cancel-advertise has no arguments. */
+}
+
+struct transport_args {
+	struct wargp_addr peer;
+	__u32 port;
+};
+
+static struct wargp_option transport_opts[] = {
+	{
+		.name = "Peer",
+		.key = ARGP_KEY_ARG,
+		.doc = "Address of the other Jool instance. (Absent means back to joold.) Can be v6 or v4.",
+		.offset = offsetof(struct transport_args, peer),
+		.type = &wt_addr,
+	}, {
+		.name = "port",
+		.key = 'p',
+		.doc = "UDP port the sessions are exchanged through, on both ends",
+		.offset = offsetof(struct transport_args, port),
+		.type = &wt_u32,
+	},
+	{ 0 },
+};
+
+int handle_joold_transport(char *iname, int argc, char **argv,
+		void const *arg)
+{
+	struct transport_args targs = { 0 };
+	struct ipv6_transport_addr peer6;
+	struct ipv4_transport_addr peer4;
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(transport_opts, argc, argv, &targs);
+	if (result.error)
+		return result.error;
+
+	if (targs.peer.proto && (targs.port == 0 || targs.port > 0xFFFF)) {
+		struct requirement reqs[] = {
+			{ false, "a --port between 1 and 65535" },
+			{ 0 },
+		};
+		return requirement_print(reqs);
+	}
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	switch (targs.peer.proto) {
+	case 6:
+		peer6.l3 = targs.peer.addr.v6;
+		peer6.l4 = targs.port;
+		result = joolnl_joold_transport(&sk, iname, &peer6, NULL);
+		break;
+	case 4:
+		peer4.l3 = targs.peer.addr.v4;
+		peer4.l4 = targs.port;
+		result = joolnl_joold_transport(&sk, iname, NULL, &peer4);
+		break;
+	default:
+		result = joolnl_joold_transport(&sk, iname, NULL, NULL);
+	}
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_joold_transport(void const *args)
+{
+	print_wargp_opts(transport_opts);
+}
@@ -3,5 +3,11 @@
 
 int handle_joold_advertise(char *iname, int argc, char **argv, void const *arg);
 void autocomplete_joold_advertise(void const *args);
+int handle_joold_advertise_cancel(char *iname, int argc, char **argv,
+		void const *arg);
+void autocomplete_joold_advertise_cancel(void const *args);
+int handle_joold_transport(char *iname, int argc, char **argv,
+		void const *arg);
+void autocomplete_joold_transport(void const *args);
 
 #endif /* SRC_USR_ARGP_WARGP_JOOLD_H_ */
@@ -11,12 +11,14 @@
 
 #define ARGP_MARK 3000
 #define ARGP_MAX_ITERATIONS 3001
+#define ARGP_USAGE 3002
 #define ARGP_QUICK 'q'
 
 struct display_args {
 	struct wargp_l4proto proto;
 	struct wargp_bool no_headers;
 	struct wargp_bool csv;
+	struct wargp_bool usage;
 
 	struct {
 		bool initialized;
@@ -33,6 +35,13 @@ static struct wargp_option display_opts[] = {
 	WARGP_ICMP(struct display_args, proto, "Print the ICMP table"),
 	WARGP_NO_HEADERS(struct display_args, no_headers),
 	WARGP_CSV(struct display_args, csv),
+	{
+		.name = "usage",
+		.key = ARGP_USAGE,
+		.doc = "Print how many BIB entries are using each entry, instead of the max iterations",
+		.offset = offsetof(struct display_args, usage),
+		.type = &wt_bool,
+	},
 	{ 0 },
 };
 
@@ -41,6 +50,11 @@ static void print_separator(void)
 	print_table_separator(0, 10, 5, 18, 15, 11, 0);
 }
 
+static void print_usage_separator(void)
+{
+	print_table_separator(0, 10, 5, 18, 11, 10, 10, 6, 0);
+}
+
 static void display_entry_csv(struct pool4_entry const *entry,
 		struct display_args *args)
 {
@@ -110,6 +124,85 @@ static struct jool_result handle_display_response(struct pool4_entry const *entr
 	return result_success();
 }
 
+/* Transport addresses in @entry. */
+static __u64 entry_capacity(struct pool4_entry const *entry)
+{
+	return (1ull << (32 - entry->range.prefix.len))
+			* (entry->range.ports.max - entry->range.ports.min + 1);
+}
+
+static struct jool_result handle_usage_response(
+		struct pool4_entry const *entry, __u64 used, void *args)
+{
+	struct display_args *dargs = args;
+	__u64 capacity = entry_capacity(entry);
+
+	if (dargs->csv.value) {
+		printf("%u,%s,%s", entry->mark,
+				l4proto_to_string(entry->proto),
+				inet_ntoa(entry->range.prefix.addr));
+		if (entry->range.prefix.len != 32)
+			printf("/%u", entry->range.prefix.len);
+		printf(",%u,%u,%llu,%llu\n",
+				entry->range.ports.min, entry->range.ports.max,
+				used, capacity);
+	} else {
+		if (print_common_values(entry, dargs)) {
+			print_usage_separator();
+			printf("| %10u | %5s |", entry->mark,
+					l4proto_to_string(entry->proto));
+		} else {
+			printf("| %10s | %5s |", "", "");
+		}
+
+		printf(" %15s", inet_ntoa(entry->range.prefix.addr));
+		if (entry->range.prefix.len != 32)
+			printf("/%-2u", entry->range.prefix.len);
+		else
+			printf("   ");
+		printf(" | %5u-%5u | %10llu | %10llu | %5.1f%% |\n",
+				entry->range.ports.min, entry->range.ports.max,
+				used, capacity, 100.0 * used / capacity);
+
+		dargs->last.initialized = true;
+		dargs->last.mark = entry->mark;
+		dargs->last.proto = entry->proto;
+	}
+
+	dargs->count++;
+	return result_success();
+}
+
+static int display_usage(struct joolnl_socket *sk, char *iname,
+		struct display_args *dargs)
+{
+	struct jool_result result;
+
+	if (!dargs->no_headers.value) {
+		if (dargs->csv.value)
+			printf("Mark,Protocol,Address,Min port,Max port,Used,Total\n");
+		else {
+			print_usage_separator();
+			printf("| %10s | %5s | %18s | %11s | %10s | %10s | %6s |\n",
+					"Mark", "Proto", "Address", "Ports",
+					"Used", "Total", "Usage");
+		}
+	}
+
+	dargs->count = 0;
+	result = joolnl_pool4_usage(sk, iname, dargs->proto.proto,
+			handle_usage_response, dargs);
+	if (result.error)
+		return pr_result(&result);
+
+	if (!dargs->csv.value) {
+		if (dargs->count == 0)
+			print_usage_separator(); /* Header border */
+		print_usage_separator(); /* Table border */
+	}
+	return 0;
+}
+
 int handle_pool4_display(char *iname, int argc, char **argv, void const *arg)
 {
 	struct display_args dargs = { 0 };
@@ -124,6 +217,12 @@ int handle_pool4_display(char *iname, int argc, char **argv, void const *arg)
 	if (result.error)
 		return pr_result(&result);
 
+	if (dargs.usage.value) {
+		result.error = display_usage(&sk, iname, &dargs);
+		joolnl_teardown(&sk);
+		return result.error;
+	}
+
 	if (!dargs.no_headers.value) {
 		if (dargs.csv.value)
 			printf("Mark,Protocol,Address,Min port,Max port,Iterations,Iterations fixed\n");
@@ -1,5 +1,8 @@
 #include "usr/argp/wargp/session.h"
 
+#include <strings.h>
+#include <unistd.h>
+
 #include "common/config.h"
 #include "common/constants.h"
 #include "common/session.h"
@@ -7,26 +10,45 @@
 #include "usr/nl/core.h"
 #include "usr/nl/session.h"
 #include "usr/argp/dns.h"
+#include "usr/argp/export.h"
 #include "usr/argp/log.h"
 #include "usr/argp/userspace-types.h"
 #include "usr/argp/wargp.h"
 #include "usr/argp/xlator_type.h"
 
+#define ARGP_SRC6 3000
+#define ARGP_SRC4 3001
+#define ARGP_PORTS 3002
+#define ARGP_DST4 3003
+#define ARGP_STATE 3004
+#define ARGP_MIN_AGE 3005
+#define ARGP_COUNTERS 3006
+#define ARGP_FORMAT 3007
+#define ARGP_ALL 3008
+#define ARGP_COUNT 3009
+
+struct wargp_tcp_state {
+	bool set;
+	tcp_state state;
+};
+
 struct display_args {
 	struct wargp_bool no_headers;
 	struct wargp_bool csv;
 	struct wargp_bool numeric;
 	struct wargp_l4proto proto;
-};
 
-static struct wargp_option display_opts[] = {
-	WARGP_TCP(struct display_args, proto, "Print the TCP table (default)"),
-	WARGP_UDP(struct display_args, proto, "Print the UDP table"),
-	WARGP_ICMP(struct display_args, proto, "Print the ICMP table"),
-	WARGP_NO_HEADERS(struct display_args, no_headers),
-	WARGP_CSV(struct display_args, csv),
-	WARGP_NUMERIC(struct display_args, numeric),
-	{ 0 },
+	struct wargp_prefix6 src6;
+	struct wargp_prefix4 src4;
+	struct wargp_port_range ports;
+	struct wargp_prefix4 dst4;
+	struct wargp_tcp_state state;
+	__u32 min_age;
+	struct wargp_bool counters;
+
+	enum export_format format;
+	struct wargp_bool all;
+	struct wargp_bool count;
 };
 
 static char *tcp_state_to_string(tcp_state state)
@@ -51,6 +73,134 @@ static char *tcp_state_to_string(tcp_state state)
 	return "UNKNOWN";
 }
 
+static int parse_tcp_state(void *void_field, int key, char *str)
+{
+	struct wargp_tcp_state *field = void_field;
+	tcp_state state;
+
+	for (state = ESTABLISHED; state <= TRANS; state++) {
+		if (strcasecmp(str, tcp_state_to_string(state)) == 0) {
+			field->set = true;
+			field->state = state;
+			return 0;
+		}
+	}
+
+	pr_err("Unknown TCP state: '%s'", str);
+	return -EINVAL;
+}
+
+static struct wargp_type wt_tcp_state = {
+	.argument = "<state>",
+	.parse = parse_tcp_state,
+	.candidates = "ESTABLISHED V4_INIT V6_INIT V4_FIN_RCV V6_FIN_RCV V4_FIN_V6_FIN_RCV TRANS",
+};
+
+static struct wargp_option display_opts[] = {
+	WARGP_TCP(struct display_args, proto, "Print the TCP table (default)"),
+	WARGP_UDP(struct display_args, proto, "Print the UDP table"),
+	WARGP_ICMP(struct display_args, proto, "Print the ICMP table"),
+	WARGP_NO_HEADERS(struct display_args, no_headers),
+	WARGP_CSV(struct display_args, csv),
+	WARGP_NUMERIC(struct display_args, numeric),
+	{
+		.name = "src6",
+		.key = ARGP_SRC6,
+		.doc = "Only print the sessions whose IPv6 remote address belongs to this prefix",
+		.offset = offsetof(struct display_args, src6),
+		.type = &wt_prefix6,
+	}, {
+		.name = "src4",
+		.key = ARGP_SRC4,
+		.doc = "Only print the sessions whose IPv4 local address belongs to this prefix",
+		.offset = offsetof(struct display_args, src4),
+		.type = &wt_prefix4,
+	}, {
+		.name = "ports",
+		.key = ARGP_PORTS,
+		.doc = "Only print the sessions whose IPv4 local L4-ID belongs to this range",
+		.offset = offsetof(struct display_args, ports),
+		.type = &wt_port_range,
+	}, {
+		.name = "dst4",
+		.key = ARGP_DST4,
+		.doc = "Only print the sessions whose IPv4 remote address belongs to this prefix",
+		.offset = offsetof(struct display_args, dst4),
+		.type = &wt_prefix4,
+	}, {
+		.name = "state",
+		.key = ARGP_STATE,
+		.doc = "Only print the TCP sessions in this state",
+		.offset = offsetof(struct display_args, state),
+		.type = &wt_tcp_state,
+	}, {
+		.name = "min-age",
+		.key = ARGP_MIN_AGE,
+		.doc = "Only print the sessions that are at least this old (in milliseconds)",
+		.offset = offsetof(struct display_args, min_age),
+		.type = &wt_u32,
+	}, {
+		.name = "counters",
+		.key = ARGP_COUNTERS,
+		.doc = "Also print the packets and bytes of the sessions (see session-counters)",
+		.offset = offsetof(struct display_args, counters),
+		.type = &wt_bool,
+	}, {
+		.name = "format",
+		.key = ARGP_FORMAT,
+		.doc = "Output format: text (default), csv (numeric, buffered) or binary (fixed-size records)",
+		.offset = offsetof(struct display_args, format),
+		.type = &wt_export_format,
+	}, {
+		.name = "all",
+		.key = ARGP_ALL,
+		.doc = "Dump the TCP, UDP and ICMP tables, in parallel (csv and binary formats only)",
+		.offset = offsetof(struct display_args, all),
+		.type = &wt_bool,
+	}, {
+		.name = "count",
+		.key = ARGP_COUNT,
+		.doc = "Only print the number of sessions (of all protocols), without dumping them",
+		.offset = offsetof(struct display_args, count),
+		.type = &wt_bool,
+	},
+	{ 0 },
+};
+
+/* Returns NULL if the user didn't ask for any filtering. */
+static struct query_filter *build_filter(struct display_args *dargs,
+		struct query_filter *filter)
+{
+	memset(filter, 0, sizeof(*filter));
+
+	if (dargs->src6.set) {
+		filter->flags |= QF_SRC6;
+		filter->src6 = dargs->src6.prefix;
+	}
+	if (dargs->src4.set) {
+		filter->flags |= QF_SRC4;
+		filter->src4 = dargs->src4.prefix;
+	}
+	if (dargs->ports.set) {
+		filter->flags |= QF_PORTS;
+		filter->ports = dargs->ports.range;
+	}
+	if (dargs->dst4.set) {
+		filter->flags |= QF_DST4;
+		filter->dst4 = dargs->dst4.prefix;
+	}
+	if (dargs->state.set) {
+		filter->flags |= QF_STATE;
+		filter->state = dargs->state.state;
+	}
+	if (dargs->min_age) {
+		filter->flags |= QF_MIN_AGE;
+		filter->min_age = dargs->min_age;
+	}
+
+	return filter->flags ? filter : NULL;
+}
+
 static struct jool_result handle_display_response(
 		struct session_entry_usr const *entry, void *args)
 {
@@ -73,6 +223,10 @@ static struct jool_result handle_display_response(
 		printf("%s", timeout);
 		if (proto == L4PROTO_TCP)
 			printf(",%s", tcp_state_to_string(entry->state));
+		else if (dargs->counters.value)
+			printf(","); /* Keep the columns aligned. */
+		if (dargs->counters.value)
+			printf(",%llu,%llu", entry->packets, entry->bytes);
 		printf("\n");
 	} else {
 		if (proto == L4PROTO_TCP)
@@ -92,15 +246,140 @@ static struct jool_result handle_display_response(
 		print_addr6(&entry->dst6, true, "#", proto);
 		printf("\n");
 
+		if (dargs->counters.value)
+			printf("Traffic: %llu packets, %llu bytes\n",
+					entry->packets, entry->bytes);
+
 		printf("---------------------------------\n");
 	}
 
 	return result_success();
 }
 
+static void print_csv_header(struct display_args const *dargs)
+{
+	printf("Protocol,");
+	printf("IPv6 Remote Address,IPv6 Remote L4-ID,");
+	printf("IPv6 Local Address,IPv6 Local L4-ID,");
+	printf("IPv4 Local Address,IPv4 Local L4-ID,");
+	printf("IPv4 Remote Address,IPv4 Remote L4-ID,");
+	printf("Expires in,State");
+	if (dargs->counters.value)
+		printf(",Packets,Bytes");
+	printf("\n");
+}
+
+struct session_export {
+	struct display_args *dargs;
+	l4_protocol proto;
+	struct export_buffer *out;
+};
+
+/* Same columns as handle_display_response()'s CSV, always numeric. */
+static struct jool_result export_csv(struct session_entry_usr const *entry,
+		void *arg)
+{
+	struct session_export *export = arg;
+	struct export_buffer *out = export->out;
+	char timeout[TIMEOUT_BUFLEN];
+
+	export_str(out, l4proto_to_string(export->proto));
+	export_char(out, ',');
+	export_addr6(out, &entry->src6);
+	export_char(out, ',');
+	export_addr6(out, &entry->dst6);
+	export_char(out, ',');
+	export_addr4(out, &entry->src4);
+	export_char(out, ',');
+	export_addr4(out, &entry->dst4);
+	export_char(out, ',');
+	timeout2str(entry->dying_time, timeout);
+	export_str(out, timeout);
+	if (export->proto == L4PROTO_TCP) {
+		export_char(out, ',');
+		export_str(out, tcp_state_to_string(entry->state));
+	} else if (export->dargs->counters.value) {
+		export_char(out, ',');
+	}
+	if (export->dargs->counters.value) {
+		export_char(out, ',');
+		export_u64(out, entry->packets);
+		export_char(out, ',');
+		export_u64(out, entry->bytes);
+	}
+	export_char(out, '\n');
+
+	return export_row_end(out);
+}
+
+/* 70 bytes; see the session documentation. */
+static struct jool_result export_binary(struct session_entry_usr const *entry,
+		void *arg)
+{
+	struct session_export *export = arg;
+	struct export_buffer *out = export->out;
+
+	export_be8(out, export->proto);
+	export_be8(out, entry->state);
+	export_bin6(out, &entry->src6);
+	export_bin6(out, &entry->dst6);
+	export_bin4(out, &entry->src4);
+	export_bin4(out, &entry->dst4);
+	export_be32(out, entry->dying_time);
+	export_be64(out, entry->packets);
+	export_be64(out, entry->bytes);
+
+	return export_row_end(out);
+}
+
+static struct jool_result dump_sessions(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto,
+		struct export_buffer *out, void *arg)
+{
+	struct session_export export;
+	struct query_filter filter;
+
+	export.dargs = arg;
+	export.proto = proto;
+	export.out = out;
+
+	return joolnl_session_foreach(sk, iname, proto,
+			build_filter(export.dargs, &filter),
+			(export.dargs->format == EXPORT_BINARY)
+					? export_binary
+					: export_csv,
+			&export);
+}
+
+static int export_sessions(char *iname, struct display_args *dargs)
+{
+	static const l4_protocol ALL[EXPORT_MAX_TABLES] = {
+		L4PROTO_TCP, L4PROTO_UDP, L4PROTO_ICMP
+	};
+	struct jool_result result;
+
+	if (dargs->format == EXPORT_BINARY) {
+		if (isatty(STDOUT_FILENO)) {
+			pr_err("The binary format is, well, binary; please redirect it to a file.");
+			return -EINVAL;
+		}
+	} else if (!dargs->no_headers.value) {
+		print_csv_header(dargs);
+	}
+
+	if (dargs->all.value)
+		result = export_tables(iname, ALL, EXPORT_MAX_TABLES,
+				dump_sessions, dargs);
+	else
+		result = export_tables(iname, &dargs->proto.proto, 1,
+				dump_sessions, dargs);
+	return pr_result(&result);
+}
+
 int handle_session_display(char *iname, int argc, char **argv, void const *arg)
 {
 	struct display_args dargs = { 0 };
+	struct query_filter filter;
 	struct joolnl_socket sk;
 	struct jool_result result;
 
@@ -108,23 +387,44 @@ int handle_session_display(char *iname, int argc, char **argv, void const *arg)
 	if (result.error)
 		return result.error;
 
+	if (dargs.state.set && (dargs.all.value
+			|| dargs.proto.proto != L4PROTO_TCP)) {
+		pr_err("--state only applies to TCP sessions.");
+		return -EINVAL;
+	}
+
+	if (dargs.count.value) {
+		if (build_filter(&dargs, &filter) || dargs.proto.set
+				|| dargs.all.value
+				|| dargs.format != EXPORT_TEXT) {
+			pr_err("--count can only count all the sessions. (It doesn't dump them.)");
+			return -EINVAL;
+		}
+		return export_count(iname, JSTAT_SESSIONS);
+	}
+	if (dargs.all.value && dargs.proto.set) {
+		pr_err("--all already includes every protocol.");
+		return -EINVAL;
+	}
+	if (dargs.format != EXPORT_TEXT)
+		return export_sessions(iname, &dargs);
+	if (dargs.all.value) {
+		pr_err("--all requires --format csv or binary.");
+		return -EINVAL;
+	}
+
 	result = joolnl_setup(&sk, xt_get());
 	if (result.error)
 		return pr_result(&result);
 
-	if (!dargs.csv.value) {
+	if (!dargs.csv.value)
 		printf("---------------------------------\n");
-	} else if (show_csv_header(dargs.no_headers.value, dargs.csv.value)) {
-		printf("Protocol,");
-		printf("IPv6 Remote Address,IPv6 Remote L4-ID,");
-		printf("IPv6 Local Address,IPv6 Local L4-ID,");
-		printf("IPv4 Local Address,IPv4 Local L4-ID,");
-		printf("IPv4 Remote Address,IPv4 Remote L4-ID,");
-		printf("Expires in,State\n");
-	}
+	else if (show_csv_header(dargs.no_headers.value, dargs.csv.value))
+		print_csv_header(&dargs);
 
 	result = joolnl_session_foreach(&sk, iname, dargs.proto.proto,
-			handle_display_response, &dargs);
+			build_filter(&dargs, &filter), handle_display_response,
+			&dargs);
 
 	joolnl_teardown(&sk);
 
@@ -135,3 +435,56 @@ void autocomplete_session_display(void const *args)
 {
 	print_wargp_opts(display_opts);
 }
+
+int handle_session_export(char *iname, int argc, char **argv, void const *arg)
+{
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(NULL, argc, argv, NULL);
+	if (result.error)
+		return result.error;
+
+	if (isatty(STDOUT_FILENO)) {
+		pr_err("The snapshot is binary; please redirect it to a file.");
+		return -EINVAL;
+	}
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_session_export(&sk, iname, stdout);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_session_export(void const *args)
+{
+	/* Nothing needed here. */
+}
+
+int handle_session_import(char *iname, int argc, char **argv, void const *arg)
+{
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(NULL, argc, argv, NULL);
+	if (result.error)
+		return result.error;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	result = joolnl_session_import(&sk, iname, stdin);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_session_import(void const *args)
+{
+	/* Nothing needed here. */
+}
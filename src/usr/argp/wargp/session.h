@@ -4,4 +4,9 @@
 int handle_session_display(char *iname, int argc, char **argv, void const *arg);
 void autocomplete_session_display(void const *args);
 
+int handle_session_export(char *iname, int argc, char **argv, void const *arg);
+void autocomplete_session_export(void const *args);
+int handle_session_import(char *iname, int argc, char **argv, void const *arg);
+void autocomplete_session_import(void const *args);
+
 #endif /* SRC_USR_ARGP_WARGP_SESSION_H_ */
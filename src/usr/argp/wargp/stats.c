@@ -1,5 +1,7 @@
 #include "usr/argp/wargp/stats.h"
 
+#include <unistd.h>
+#include <arpa/inet.h>
 #include "usr/nl/core.h"
 #include "usr/nl/stats.h"
 #include "usr/argp/log.h"
@@ -12,6 +14,7 @@ struct display_args {
 	struct wargp_bool explain;
 	struct wargp_bool no_headers;
 	struct wargp_bool csv;
+	struct wargp_bool per_cpu;
 };
 
 static struct wargp_option display_opts[] = {
@@ -27,6 +30,12 @@ static struct wargp_option display_opts[] = {
 		.doc = "Print a description of what each stat means",
 		.offset = offsetof(struct display_args, explain),
 		.type = &wt_bool,
+	}, {
+		.name = "per-cpu",
+		.key = 'p',
+		.doc = "Break the traffic counters down by CPU",
+		.offset = offsetof(struct display_args, per_cpu),
+		.type = &wt_bool,
 	},
 	WARGP_NO_HEADERS(struct display_args, no_headers),
 	WARGP_CSV(struct display_args, csv),
@@ -54,6 +63,91 @@ static struct jool_result handle_jstat(struct joolnl_stat const *stat, void *arg
 	return result_success();
 }
 
+/* The counters --per-cpu shows; the ones that follow the RSS spread. */
+static enum jool_stat_id const percpu_stats[] = {
+	JSTAT_RECEIVED6,
+	JSTAT_RECEIVED4,
+	JSTAT_SUCCESS,
+	JSTAT_SESSIONS_CREATED,
+};
+
+/*
+ * Prints every CPU's share of the counter, and the busiest CPU's load relative
+ * to the average online CPU's ("imbalance"; 1.00 means perfectly even).
+ */
+static struct jool_result handle_jstat_percpu(
+		struct joolnl_stat_percpu const *stat, void *args)
+{
+	struct display_args *dargs = args;
+	unsigned long long total, max;
+	unsigned int cpu, cpus;
+	long online;
+
+	total = 0;
+	max = 0;
+	cpus = 0;
+	for (cpu = 0; cpu < stat->cpus; cpu++) {
+		total += stat->values[cpu];
+		if (stat->values[cpu] > max)
+			max = stat->values[cpu];
+		if (stat->values[cpu])
+			cpus++;
+	}
+
+	if (total == 0) {
+		if (dargs->all.value && !dargs->csv.value)
+			printf("%s: 0\n\n", stat->meta.name);
+		return result_success();
+	}
+
+	online = sysconf(_SC_NPROCESSORS_ONLN);
+	if (online < 1 || online > stat->cpus)
+		online = stat->cpus;
+
+	if (!dargs->csv.value) {
+		printf("%s: %llu (%u CPUs, imbalance %.2f)\n", stat->meta.name,
+				total, cpus, (double)max * online / total);
+		if (dargs->explain.value)
+			printf("%s\n", stat->meta.doc);
+	}
+
+	for (cpu = 0; cpu < stat->cpus; cpu++) {
+		if (!dargs->all.value && stat->values[cpu] == 0)
+			continue;
+
+		if (dargs->csv.value)
+			printf("%s,%u,%llu\n", stat->meta.name, cpu,
+					(unsigned long long)stat->values[cpu]);
+		else
+			printf("\tCPU %u: %llu (%.1f%%)\n", cpu,
+					(unsigned long long)stat->values[cpu],
+					100.0 * stat->values[cpu] / total);
+	}
+
+	if (!dargs->csv.value)
+		printf("\n");
+
+	return result_success();
+}
+
+static int display_percpu(struct joolnl_socket *sk, char *iname,
+		struct display_args *dargs)
+{
+	__u8 filter[JSTAT_FILTER_SIZE] = { 0 };
+	struct jool_result result;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(percpu_stats) / sizeof(percpu_stats[0]); i++)
+		filter[percpu_stats[i] / 8] |= 1u << (percpu_stats[i] % 8);
+
+	if (show_csv_header(dargs->no_headers.value, dargs->csv.value))
+		printf("Stat,CPU,Value\n");
+
+	result = joolnl_stats_percpu_foreach(sk, iname, filter,
+			handle_jstat_percpu, dargs);
+	return pr_result(&result);
+}
+
 int handle_stats_display(char *iname, int argc, char **argv, void const *arg)
 {
 	struct display_args dargs = { 0 };
@@ -68,6 +162,12 @@ int handle_stats_display(char *iname, int argc, char **argv, void const *arg)
 	if (result.error)
 		return pr_result(&result);
 
+	if (dargs.per_cpu.value) {
+		result.error = display_percpu(&sk, iname, &dargs);
+		joolnl_teardown(&sk);
+		return result.error;
+	}
+
 	if (show_csv_header(dargs.no_headers.value, dargs.csv.value)) {
 		printf("Stat,Value");
 		if (dargs.explain.value)
@@ -85,3 +185,314 @@ void autocomplete_stats_display(void const *args)
 {
 	print_wargp_opts(display_opts);
 }
+
+struct latency_args {
+	struct wargp_bool all;
+	struct wargp_bool no_headers;
+	struct wargp_bool csv;
+	bool printed;
+};
+
+static struct wargp_option latency_opts[] = {
+	{
+		.name = "all",
+		.key = 'a',
+		.doc = "Do not filter out empty histograms and buckets",
+		.offset = offsetof(struct latency_args, all),
+		.type = &wt_bool,
+	},
+	WARGP_NO_HEADERS(struct latency_args, no_headers),
+	WARGP_CSV(struct latency_args, csv),
+	{ 0 },
+};
+
+static struct jool_result handle_histogram(
+		struct joolnl_latency const *histogram, void *args)
+{
+	struct latency_args *largs = args;
+	unsigned long long samples;
+	unsigned int b;
+
+	samples = 0;
+	for (b = 0; b < JLAT_BUCKETS; b++)
+		samples += histogram->buckets[b];
+	if (!largs->all.value && samples == 0)
+		return result_success();
+
+	if (!largs->csv.value)
+		printf("%s %s: %llu samples\n", histogram->dir_name,
+				histogram->stage_name, samples);
+
+	for (b = 0; b < JLAT_BUCKETS; b++) {
+		if (!largs->all.value && histogram->buckets[b] == 0)
+			continue;
+
+		if (largs->csv.value)
+			printf("%s,%s,%llu,%llu\n", histogram->dir_name,
+					histogram->stage_name,
+					b ? (1ull << b) : 0ull,
+					histogram->buckets[b]);
+		else if (b < JLAT_BUCKETS - 1)
+			printf("\t[%llu, %llu) ns: %llu\n",
+					b ? (1ull << b) : 0ull, 2ull << b,
+					histogram->buckets[b]);
+		else
+			printf("\t[%llu, inf) ns: %llu\n", 1ull << b,
+					histogram->buckets[b]);
+	}
+
+	if (!largs->csv.value)
+		printf("\n");
+
+	largs->printed = true;
+	return result_success();
+}
+
+int handle_stats_latency(char *iname, int argc, char **argv, void const *arg)
+{
+	struct latency_args largs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(latency_opts, argc, argv, &largs);
+	if (result.error)
+		return result.error;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	if (show_csv_header(largs.no_headers.value, largs.csv.value))
+		printf("Direction,Stage,Nanoseconds (at least),Samples\n");
+
+	result = joolnl_stats_latency_foreach(&sk, iname, handle_histogram,
+			&largs);
+
+	joolnl_teardown(&sk);
+
+	if (!result.error && !largs.printed && !largs.csv.value)
+		printf("No samples. (Latency stats are enabled through the jool_common module's latency_stats parameter.)\n");
+
+	return pr_result(&result);
+}
+
+void autocomplete_stats_latency(void const *args)
+{
+	print_wargp_opts(latency_opts);
+}
+
+struct lifetimes_args {
+	struct wargp_bool all;
+	struct wargp_bool no_headers;
+	struct wargp_bool csv;
+	bool printed;
+};
+
+static struct wargp_option lifetimes_opts[] = {
+	{
+		.name = "all",
+		.key = 'a',
+		.doc = "Do not filter out empty histograms and buckets",
+		.offset = offsetof(struct lifetimes_args, all),
+		.type = &wt_bool,
+	},
+	WARGP_NO_HEADERS(struct lifetimes_args, no_headers),
+	WARGP_CSV(struct lifetimes_args, csv),
+	{ 0 },
+};
+
+static struct jool_result handle_lifetime(
+		struct joolnl_lifetime const *histogram, void *args)
+{
+	struct lifetimes_args *largs = args;
+	unsigned long long samples;
+	unsigned int b;
+
+	samples = 0;
+	for (b = 0; b < JLIFE_BUCKETS; b++)
+		samples += histogram->buckets[b];
+	if (!largs->all.value && samples == 0)
+		return result_success();
+
+	if (!largs->csv.value)
+		printf("%s %s: %llu samples\n", histogram->class_name,
+				histogram->metric_name, samples);
+
+	for (b = 0; b < JLIFE_BUCKETS; b++) {
+		if (!largs->all.value && histogram->buckets[b] == 0)
+			continue;
+
+		if (largs->csv.value)
+			printf("%s,%s,%llu,%llu\n", histogram->class_name,
+					histogram->metric_name,
+					b ? (1ull << b) : 0ull,
+					histogram->buckets[b]);
+		else if (b < JLIFE_BUCKETS - 1)
+			printf("\t[%llu, %llu) ms: %llu\n",
+					b ? (1ull << b) : 0ull, 2ull << b,
+					histogram->buckets[b]);
+		else
+			printf("\t[%llu, inf) ms: %llu\n", 1ull << b,
+					histogram->buckets[b]);
+	}
+
+	if (!largs->csv.value)
+		printf("\n");
+
+	largs->printed = true;
+	return result_success();
+}
+
+int handle_stats_lifetimes(char *iname, int argc, char **argv,
+		void const *arg)
+{
+	struct lifetimes_args largs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(lifetimes_opts, argc, argv, &largs);
+	if (result.error)
+		return result.error;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	if (show_csv_header(largs.no_headers.value, largs.csv.value))
+		printf("Timeout,Metric,Milliseconds (at least),Samples\n");
+
+	result = joolnl_stats_lifetime_foreach(&sk, iname, handle_lifetime,
+			&largs);
+
+	joolnl_teardown(&sk);
+
+	if (!result.error && !largs.printed && !largs.csv.value)
+		printf("No samples. (Lifetime stats are enabled through the jool_common module's lifetime_stats parameter.)\n");
+
+	return pr_result(&result);
+}
+
+void autocomplete_stats_lifetimes(void const *args)
+{
+	print_wargp_opts(lifetimes_opts);
+}
+
+struct rates_args {
+	struct wargp_bool no_headers;
+	struct wargp_bool csv;
+};
+
+static struct wargp_option rates_opts[] = {
+	WARGP_NO_HEADERS(struct rates_args, no_headers),
+	WARGP_CSV(struct rates_args, csv),
+	{ 0 },
+};
+
+static struct jool_result print_rate(struct joolnl_rate const *rate,
+		void *args)
+{
+	struct rates_args *rargs = args;
+
+	if (rargs->csv.value)
+		printf("%s,%.3f\n", rate->name, rate->value);
+	else
+		printf("%s: %.3f/s\n", rate->name, rate->value);
+
+	return result_success();
+}
+
+int handle_stats_rates(char *iname, int argc, char **argv, void const *arg)
+{
+	struct rates_args rargs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(rates_opts, argc, argv, &rargs);
+	if (result.error)
+		return result.error;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	if (show_csv_header(rargs.no_headers.value, rargs.csv.value))
+		printf("Rate,Per second\n");
+
+	result = joolnl_stats_rates_foreach(&sk, iname, print_rate, &rargs);
+
+	joolnl_teardown(&sk);
+	return pr_result(&result);
+}
+
+void autocomplete_stats_rates(void const *args)
+{
+	print_wargp_opts(rates_opts);
+}
+
+struct talkers_args {
+	struct wargp_bool no_headers;
+	struct wargp_bool csv;
+	bool printed;
+};
+
+static struct wargp_option talkers_opts[] = {
+	WARGP_NO_HEADERS(struct talkers_args, no_headers),
+	WARGP_CSV(struct talkers_args, csv),
+	{ 0 },
+};
+
+static struct jool_result print_talker(struct joolnl_talker const *talker,
+		void *args)
+{
+	struct talkers_args *targs = args;
+	char prefix_str[INET6_ADDRSTRLEN];
+
+	inet_ntop(AF_INET6, &talker->prefix.addr, prefix_str,
+			sizeof(prefix_str));
+
+	if (targs->csv.value)
+		printf("%s,%s/%u,%llu,%llu\n", talker->metric_name, prefix_str,
+				talker->prefix.len,
+				(unsigned long long)talker->count,
+				(unsigned long long)talker->error);
+	else
+		printf("%s: %s/%u: %llu (+/- %llu)\n", talker->metric_name,
+				prefix_str, talker->prefix.len,
+				(unsigned long long)talker->count,
+				(unsigned long long)talker->error);
+
+	targs->printed = true;
+	return result_success();
+}
+
+int handle_stats_talkers(char *iname, int argc, char **argv, void const *arg)
+{
+	struct talkers_args targs = { 0 };
+	struct joolnl_socket sk;
+	struct jool_result result;
+
+	result.error = wargp_parse(talkers_opts, argc, argv, &targs);
+	if (result.error)
+		return result.error;
+
+	result = joolnl_setup(&sk, xt_get());
+	if (result.error)
+		return pr_result(&result);
+
+	if (show_csv_header(targs.no_headers.value, targs.csv.value))
+		printf("Metric,Subscriber,Count,Error\n");
+
+	result = joolnl_stats_talkers_foreach(&sk, iname, print_talker, &targs);
+
+	joolnl_teardown(&sk);
+
+	if (!result.error && !targs.printed && !targs.csv.value)
+		printf("No talkers. (Top talkers are enabled through the jool_common module's top_talkers parameter.)\n");
+
+	return pr_result(&result);
+}
+
+void autocomplete_stats_talkers(void const *args)
+{
+	print_wargp_opts(talkers_opts);
+}
@@ -3,5 +3,14 @@
 
 int handle_stats_display(char *iname, int argc, char **argv, void const *arg);
 void autocomplete_stats_display(void const *args);
+int handle_stats_latency(char *iname, int argc, char **argv, void const *arg);
+void autocomplete_stats_latency(void const *args);
+int handle_stats_lifetimes(char *iname, int argc, char **argv,
+		void const *arg);
+void autocomplete_stats_lifetimes(void const *args);
+int handle_stats_rates(char *iname, int argc, char **argv, void const *arg);
+void autocomplete_stats_rates(void const *args);
+int handle_stats_talkers(char *iname, int argc, char **argv, void const *arg);
+void autocomplete_stats_talkers(void const *args);
 
 #endif /* SRC_USR_ARGP_WARGP_STATS_H_ */
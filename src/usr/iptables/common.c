@@ -100,7 +100,7 @@ static struct xtables_target targets[] = {
 		.revision      = 0,
 		.family        = PF_INET6,
 		.size          = XT_ALIGN(sizeof(struct target_info)),
-		.userspacesize = XT_ALIGN(sizeof(struct target_info)),
+		.userspacesize = TARGET_INFO_USERSIZE,
 		.help          = jool_tg_help,
 		.init          = jool_tg_init,
 		.parse         = jool_tg_parse,
@@ -113,7 +113,7 @@ static struct xtables_target targets[] = {
 		.revision      = 0,
 		.family        = PF_INET,
 		.size          = XT_ALIGN(sizeof(struct target_info)),
-		.userspacesize = XT_ALIGN(sizeof(struct target_info)),
+		.userspacesize = TARGET_INFO_USERSIZE,
 		.help          = jool_tg_help,
 		.init          = jool_tg_init,
 		.parse         = jool_tg_parse,
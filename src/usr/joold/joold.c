@@ -1,11 +1,16 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <syslog.h>
 #include "log.h"
 #include "common/types.h"
 #include "common/xlat.h"
+#include "usr/joold/journal.h"
+#include "usr/joold/metrics.h"
 #include "usr/joold/modsocket.h"
+#include "usr/joold/multi.h"
+#include "usr/joold/natlog.h"
 #include "usr/joold/netsocket.h"
 #include "usr/joold/statsocket.h"
 
@@ -24,10 +29,45 @@ static void cancel_thread(pthread_t thread)
 	 */
 }
 
+/*
+ * Each direction is a pipeline of two threads: one reads its socket and fills
+ * a ring, the other drains the ring into the other socket.
+ */
+static struct {
+	char *name;
+	void *(*fn)(void *);
+	pthread_t thread;
+} threads[] = {
+	{ .name = "Module listener", .fn = modsocket_listen },
+	{ .name = "Network transmitter", .fn = netsocket_transmit },
+	{ .name = "Network listener", .fn = netsocket_listen },
+	{ .name = "Module transmitter", .fn = modsocket_transmit },
+};
+
+#define THREAD_COUNT (sizeof(threads) / sizeof(threads[0]))
+
+static int start_threads(void)
+{
+	unsigned int t;
+	int error;
+
+	for (t = 0; t < THREAD_COUNT; t++) {
+		error = pthread_create(&threads[t].thread, NULL, threads[t].fn,
+				NULL);
+		if (error) {
+			pr_perror(threads[t].name, error);
+			while (t > 0)
+				cancel_thread(threads[--t].thread);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
 int main(int argc, char **argv)
 {
-	pthread_t mod2net_thread;
-	pthread_t net2mod_thread;
+	unsigned int t;
 	int error;
 
 	printf("Remember that joold is intended as a daemon, so it outputs straight to syslog.\n");
@@ -37,6 +77,16 @@ int main(int argc, char **argv)
 
 	openlog("joold", 0, LOG_DAEMON);
 
+	if (argc >= 2 && strcmp(argv[1], "--instances") == 0) {
+		if (argc != 3) {
+			syslog(LOG_ERR, "Usage: joold --instances <file>");
+			error = -EINVAL;
+			goto end;
+		}
+		error = multi_run(argv[2]);
+		goto end;
+	}
+
 	error = netsocket_setup(argc, argv);
 	if (error)
 		goto end;
@@ -48,24 +98,26 @@ int main(int argc, char **argv)
 	error = statsocket_start(argc, argv);
 	if (error)
 		goto clean;
-
-	error = pthread_create(&mod2net_thread, NULL, modsocket_listen, NULL);
-	if (error) {
-		pr_perror("Module-to-network thread initialization", error);
+	error = metrics_start(argc, argv);
+	if (error)
 		goto clean;
-	}
-	error = pthread_create(&net2mod_thread, NULL, netsocket_listen, NULL);
-	if (error) {
-		pr_perror("Network-to-module thread initialization", error);
-		cancel_thread(mod2net_thread);
+	error = natlog_start(argc, argv);
+	if (error)
+		goto clean;
+	error = journal_start(argc, argv);
+	if (error)
+		goto clean;
+
+	error = start_threads();
+	if (error)
 		goto clean;
-	}
 
-	pthread_join(net2mod_thread, NULL);
-	pthread_join(mod2net_thread, NULL);
+	for (t = 0; t < THREAD_COUNT; t++)
+		pthread_join(threads[t].thread, NULL);
 	/* Fall through. */
 
 clean:
+	journal_teardown();
 	modsocket_teardown();
 	netsocket_teardown();
 	/* Fall through. */
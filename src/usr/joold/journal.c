@@ -0,0 +1,536 @@
+#include "usr/joold/journal.h"
+
+#include <endian.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netlink/attr.h>
+
+#include "log.h"
+#include "common/config.h"
+#include "usr/nl/core.h"
+#include "usr/nl/session.h"
+#include "usr/util/cJSON.h"
+#include "usr/util/file.h"
+#include "usr/joold/modsocket.h"
+
+#define DEFAULT_COMPACT_INTERVAL 300
+/* The journal is fdatasync()ed at least this often. (Seconds) */
+#define SYNC_INTERVAL 1
+/* Sessions per compacted batch. It has to fit in an import request. */
+#define COMPACT_BATCH_SESSIONS 1024
+
+/*
+ * The journal is a sequence of entries. Each of them is the time it was
+ * written (Unix time, in milliseconds, 64-bit big endian), followed by a
+ * session batch. (The JNLAL_SESSION_BATCH payload the kernel sent; see the
+ * kernel's jnla_get_session_batch().)
+ */
+#define STAMP_SIZE 8
+
+/*
+ * What identifies a session: src6.l3, dst6.l3 (or dst4.l3, if elided), src6.l4,
+ * dst6.l4 and proto.
+ */
+#define KEY_SIZE (16 + 16 + 2 + 2 + 1)
+
+struct journal_config {
+	char *file;
+	unsigned int compact_interval; /* In seconds */
+};
+
+struct journal_session {
+	__u8 key[KEY_SIZE];
+	__u8 record[JOOLD_BATCH_RECORD_SIZE];
+	bool elided;
+	/* Unix time, in milliseconds. */
+	__u64 expiration;
+	/* Position in the journal; later entries override earlier ones. */
+	size_t seq;
+};
+
+struct journal_state {
+	struct journal_session *sessions;
+	size_t count;
+	size_t capacity;
+};
+
+static struct journal_config cfg;
+static char *tmp_file;
+static FILE *out;
+static time_t sync_time;
+static time_t compact_time;
+
+static __u64 now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (__u64)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static size_t record_size(bool elided)
+{
+	return elided
+			? JOOLD_BATCH_RECORD_SIZE_ELIDED
+			: JOOLD_BATCH_RECORD_SIZE;
+}
+
+/* Offset of the expiration (milliseconds, 32 bits) within a record. */
+static size_t expiration_offset(bool elided)
+{
+	return 16 + (elided ? 4 : 16) + 4;
+}
+
+static int add_session(struct journal_state *state, __u8 *record,
+		bool elided, __u64 stamp)
+{
+	struct journal_session *session;
+	size_t exp_offset;
+	size_t size;
+	__u32 expiration;
+
+	if (state->count == state->capacity) {
+		state->capacity = state->capacity
+				? (2 * state->capacity)
+				: 1024;
+		session = realloc(state->sessions,
+				state->capacity * sizeof(*session));
+		if (!session)
+			return -ENOMEM;
+		state->sessions = session;
+	}
+
+	session = &state->sessions[state->count];
+	size = record_size(elided);
+	exp_offset = expiration_offset(elided);
+
+	memset(session->key, 0, KEY_SIZE);
+	memcpy(session->key, record, 16 + (elided ? 4 : 16));
+	memcpy(session->key + 32, record + exp_offset + 4, 4);
+	session->key[36] = (record[size - 1] >> 5) & 3;
+
+	memcpy(session->record, record, size);
+	session->elided = elided;
+	memcpy(&expiration, record + exp_offset, sizeof(expiration));
+	session->expiration = stamp + ntohl(expiration);
+	session->seq = state->count;
+
+	state->count++;
+	return 0;
+}
+
+/*
+ * Adds the sessions of the journal @in to @state. A truncated or unreadable
+ * tail (such as the one a crash can leave) is ignored; the state is the one of
+ * the last complete entry.
+ */
+static int load(FILE *in, struct journal_state *state)
+{
+	__u8 *batch;
+	__u64 stamp;
+	size_t count;
+	size_t i;
+	bool elided;
+	int error;
+
+	batch = malloc(JOOLD_BATCH_HDR_SIZE + 0xFFFF * JOOLD_BATCH_RECORD_SIZE);
+	if (!batch)
+		return -ENOMEM;
+
+	error = 0;
+	do {
+		if (fread(&stamp, STAMP_SIZE, 1, in) != 1)
+			break;
+		if (fread(batch, JOOLD_BATCH_HDR_SIZE, 1, in) != 1)
+			goto truncated;
+		if (batch[0] != JOOLD_BATCH_VERSION)
+			goto truncated;
+
+		elided = batch[1] & JOOLD_BATCH_ELIDE_DST6;
+		count = (batch[2] << 8) | batch[3];
+		if (fread(batch + JOOLD_BATCH_HDR_SIZE, record_size(elided),
+				count, in) != count)
+			goto truncated;
+
+		for (i = 0; i < count; i++) {
+			error = add_session(state, batch + JOOLD_BATCH_HDR_SIZE
+					+ i * record_size(elided), elided,
+					be64toh(stamp));
+			if (error)
+				goto end;
+		}
+	} while (true);
+
+	if (ferror(in)) {
+		error = errno;
+		pr_perror("Cannot read the session journal", error);
+		error = -error;
+	}
+	goto end;
+
+truncated:
+	syslog(LOG_WARNING, "The session journal's tail is truncated or unreadable; ignoring it.");
+end:
+	free(batch);
+	return error;
+}
+
+static int session_cmp(const void *a, const void *b)
+{
+	struct journal_session const *s1 = a;
+	struct journal_session const *s2 = b;
+	int result;
+
+	if (s1->elided != s2->elided)
+		return s1->elided ? 1 : -1;
+	result = memcmp(s1->key, s2->key, KEY_SIZE);
+	if (result)
+		return result;
+	return (s1->seq > s2->seq) - (s1->seq < s2->seq);
+}
+
+/* Leaves the latest version of every session, minus the expired ones. */
+static void merge(struct journal_state *state, __u64 now)
+{
+	struct journal_session *sessions = state->sessions;
+	size_t last;
+	size_t i;
+
+	qsort(sessions, state->count, sizeof(*sessions), session_cmp);
+
+	last = 0;
+	for (i = 0; i < state->count; i++) {
+		if (i + 1 < state->count
+				&& sessions[i].elided == sessions[i + 1].elided
+				&& !memcmp(sessions[i].key, sessions[i + 1].key,
+						KEY_SIZE))
+			continue;
+		if (sessions[i].expiration <= now)
+			continue;
+		sessions[last++] = sessions[i];
+	}
+
+	state->count = last;
+}
+
+/*
+ * Writes @state to @out, as session batches whose expirations are relative to
+ * @now. If @stamp, each batch is preceded by @now, as in the journal;
+ * otherwise, it's the format of joolnl_session_import().
+ */
+static int write_state(FILE *out, struct journal_state *state, __u64 now,
+		bool stamp)
+{
+	struct journal_session *session;
+	__u8 hdr[JOOLD_BATCH_HDR_SIZE];
+	__u64 be_now;
+	__u32 expiration;
+	size_t start;
+	size_t count;
+	size_t i;
+
+	be_now = htobe64(now);
+
+	for (start = 0; start < state->count; start += count) {
+		count = 1;
+		while (start + count < state->count
+				&& count < COMPACT_BATCH_SESSIONS
+				&& state->sessions[start + count].elided
+				== state->sessions[start].elided)
+			count++;
+
+		hdr[0] = JOOLD_BATCH_VERSION;
+		hdr[1] = state->sessions[start].elided
+				? JOOLD_BATCH_ELIDE_DST6 : 0;
+		hdr[2] = count >> 8;
+		hdr[3] = count & 0xFF;
+		if (stamp && fwrite(&be_now, STAMP_SIZE, 1, out) != 1)
+			return -EIO;
+		if (fwrite(hdr, sizeof(hdr), 1, out) != 1)
+			return -EIO;
+
+		for (i = start; i < start + count; i++) {
+			session = &state->sessions[i];
+			expiration = htonl(session->expiration - now);
+			memcpy(session->record
+					+ expiration_offset(session->elided),
+					&expiration, sizeof(expiration));
+			if (fwrite(session->record,
+					record_size(session->elided), 1,
+					out) != 1)
+				return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Rewrites the journal, leaving only its surviving sessions. If @state isn't
+ * NULL, they are also returned there.
+ */
+static int compact(struct journal_state *state, __u64 now)
+{
+	struct journal_state tmp = { 0 };
+	FILE *file;
+	int error;
+
+	if (!state)
+		state = &tmp;
+
+	file = fopen(cfg.file, "rb");
+	if (file) {
+		error = load(file, state);
+		fclose(file);
+		if (error)
+			goto end;
+	} else if (errno != ENOENT) {
+		error = errno;
+		pr_perror("Cannot open the session journal", error);
+		error = -error;
+		goto end;
+	}
+
+	merge(state, now);
+
+	file = fopen(tmp_file, "wb");
+	if (!file) {
+		error = errno;
+		pr_perror("Cannot create the compacted session journal", error);
+		error = -error;
+		goto end;
+	}
+	error = write_state(file, state, now, true);
+	if (!error && (fflush(file) || fsync(fileno(file))))
+		error = -errno;
+	fclose(file);
+	if (!error && rename(tmp_file, cfg.file))
+		error = -errno;
+	if (error) {
+		pr_perror("Cannot write the compacted session journal", -error);
+		remove(tmp_file);
+		goto end;
+	}
+
+	syslog(LOG_INFO, "Compacted the session journal; %zu sessions left.",
+			state->count);
+	/* Fall through. */
+
+end:
+	free(tmp.sessions);
+	return error;
+}
+
+/* Hands the sessions that survived the last shutdown to the instance. */
+static void recover(struct journal_state *state, __u64 now)
+{
+	struct joolnl_socket jsocket;
+	struct jool_result result;
+	FILE *file;
+
+	if (state->count == 0)
+		return;
+
+	file = tmpfile();
+	if (!file) {
+		pr_perror("Cannot recover the journaled sessions", errno);
+		return;
+	}
+	if (write_state(file, state, now, false) || fflush(file)) {
+		pr_perror("Cannot recover the journaled sessions", EIO);
+		goto end;
+	}
+	rewind(file);
+
+	result = joolnl_setup(&jsocket, XT_NAT64);
+	if (result.error) {
+		pr_result(&result);
+		goto end;
+	}
+	result = joolnl_session_import(&jsocket, modsocket_instance(), file);
+	joolnl_teardown(&jsocket);
+	if (result.error) {
+		pr_result(&result);
+		goto end;
+	}
+
+	syslog(LOG_INFO, "Recovered %zu sessions from the journal.",
+			state->count);
+	/* Fall through. */
+
+end:
+	fclose(file);
+}
+
+static int open_journal(void)
+{
+	int error;
+
+	out = fopen(cfg.file, "ab");
+	if (!out) {
+		error = errno;
+		pr_perror("Cannot open the session journal", error);
+		return -error;
+	}
+
+	return 0;
+}
+
+/* Called whenever the instance sends sessions to joold. */
+void journal_append(void *data, size_t len)
+{
+	struct nlattr *attr;
+	__u64 stamp;
+	time_t now;
+	int rem;
+
+	if (!out)
+		return;
+
+	stamp = htobe64(now_ms());
+	nla_for_each_attr(attr, data, len, rem) {
+		if (nla_type(attr) != JNLAL_SESSION_BATCH)
+			continue;
+		if (fwrite(&stamp, STAMP_SIZE, 1, out) != 1
+				|| fwrite(nla_data(attr), nla_len(attr), 1,
+						out) != 1)
+			goto fail;
+	}
+	if (fflush(out))
+		goto fail;
+
+	now = time(NULL);
+	if (now >= sync_time) {
+		if (fdatasync(fileno(out)))
+			goto fail;
+		sync_time = now + SYNC_INTERVAL;
+	}
+
+	if (now >= compact_time) {
+		fclose(out);
+		out = NULL;
+		compact(NULL, now_ms());
+		open_journal();
+		compact_time = now + cfg.compact_interval;
+	}
+
+	return;
+
+fail:
+	pr_perror("Cannot write the session journal", errno);
+}
+
+static int read_json(char const *file_name)
+{
+	char *file;
+	cJSON *json, *child;
+	struct jool_result result;
+	int error;
+
+	syslog(LOG_INFO, "Opening file %s...", file_name);
+	result = file_to_string(file_name, &file);
+	if (result.error)
+		return pr_result(&result);
+
+	json = cJSON_Parse(file);
+	if (!json) {
+		syslog(LOG_ERR, "JSON syntax error.");
+		syslog(LOG_ERR, "The JSON parser got confused around about here:");
+		syslog(LOG_ERR, "%s", cJSON_GetErrorPtr());
+		free(file);
+		return 1;
+	}
+
+	free(file);
+
+	error = -EINVAL;
+
+	child = cJSON_GetObjectItem(json, "file");
+	if (!child || child->type != cJSON_String) {
+		syslog(LOG_ERR, "The journal config file lacks a file name.");
+		goto end;
+	}
+	cfg.file = strdup(child->valuestring);
+	tmp_file = malloc(strlen(child->valuestring) + sizeof(".tmp"));
+	if (!cfg.file || !tmp_file) {
+		error = -ENOMEM;
+		goto end;
+	}
+	sprintf(tmp_file, "%s.tmp", cfg.file);
+
+	child = cJSON_GetObjectItem(json, "compact interval");
+	if (child && !(child->numflags & VALUENUM_UINT)) {
+		syslog(LOG_ERR, "The journal compact interval is not a positive integer.");
+		goto end;
+	}
+	cfg.compact_interval = child ? child->valueuint
+			: DEFAULT_COMPACT_INTERVAL;
+	if (cfg.compact_interval == 0) {
+		syslog(LOG_ERR, "The journal compact interval cannot be zero.");
+		goto end;
+	}
+
+	error = 0;
+	/* Fall through. */
+
+end:
+	cJSON_Delete(json);
+	return error;
+}
+
+int journal_start(int argc, char **argv)
+{
+	struct journal_state state = { 0 };
+	__u64 now;
+	int error;
+
+	if (argc < 7) {
+		syslog(LOG_INFO, "Journal config file unavailable; sessions will not be journaled.");
+		return 0;
+	}
+
+	error = read_json(argv[6]);
+	if (error)
+		goto fail;
+
+	now = now_ms();
+	error = compact(&state, now);
+	if (error)
+		goto fail;
+	recover(&state, now);
+	free(state.sessions);
+
+	error = open_journal();
+	if (error)
+		goto fail;
+	sync_time = time(NULL) + SYNC_INTERVAL;
+	compact_time = time(NULL) + cfg.compact_interval;
+	return 0;
+
+fail:
+	free(cfg.file);
+	free(tmp_file);
+	cfg.file = NULL;
+	tmp_file = NULL;
+	return error;
+}
+
+void journal_teardown(void)
+{
+	if (!out)
+		return;
+
+	fflush(out);
+	fdatasync(fileno(out));
+	fclose(out);
+	out = NULL;
+	free(cfg.file);
+	free(tmp_file);
+}
@@ -0,0 +1,20 @@
+#ifndef SRC_USR_JOOLD_JOURNAL_H_
+#define SRC_USR_JOOLD_JOURNAL_H_
+
+#include <stddef.h>
+
+/**
+ * The session journal: a local file where joold appends every session batch
+ * its instance sends it, so the instance can get its sessions back after a
+ * crash (or reboot) instead of starting empty.
+ *
+ * The file is compacted (down to the sessions that haven't expired, once each)
+ * every now and then, and when joold starts. Right after the startup
+ * compaction, the surviving sessions are imported into the instance.
+ */
+
+int journal_start(int argc, char **argv);
+void journal_append(void *data, size_t len);
+void journal_teardown(void);
+
+#endif /* SRC_USR_JOOLD_JOURNAL_H_ */
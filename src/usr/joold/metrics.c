@@ -0,0 +1,695 @@
+#include "usr/joold/metrics.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "log.h"
+#include "modsocket.h"
+#include "netsocket.h"
+#include "ring.h"
+#include "usr/nl/core.h"
+#include "usr/nl/stats.h"
+#include "usr/util/cJSON.h"
+#include "usr/util/file.h"
+
+#define DEFAULT_INTERVAL 5000
+#define MIN_INTERVAL 100
+/* Slow clients are dropped after this many seconds. */
+#define CLIENT_TIMEOUT 2
+#define REQUEST_MAX 2048
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+struct metrics_config {
+	char *address; /* NULL means "any." */
+	char *port;
+	unsigned int interval; /* In milliseconds */
+};
+
+/* A growable string. */
+struct text {
+	char *str;
+	size_t len;
+	size_t max;
+};
+
+static struct metrics_config cfg;
+
+/* The latest rendition of the kernel's stats. Guarded by @snapshot_mutex. */
+static struct text snapshot;
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+extern atomic_int modsocket_pkts_sent;
+extern atomic_int modsocket_bytes_sent;
+extern atomic_ullong modsocket_batches;
+extern atomic_ullong modsocket_batch_items;
+extern atomic_int netsocket_pkts_rcvd;
+extern atomic_int netsocket_bytes_rcvd;
+extern atomic_int netsocket_pkts_sent;
+extern atomic_int netsocket_bytes_sent;
+extern atomic_ullong netsocket_rx_batches;
+extern atomic_ullong netsocket_rx_batch_items;
+extern atomic_ullong netsocket_tx_batches;
+extern atomic_ullong netsocket_tx_batch_items;
+extern atomic_int netsocket_pkts_compressed;
+extern atomic_int netsocket_pkts_decompressed;
+
+static int text_printf(struct text *text, char const *fmt, ...)
+{
+	va_list args;
+	char *str;
+	size_t max;
+	int len;
+
+	if (!text->str) {
+		text->str = malloc(4096);
+		if (!text->str)
+			return -ENOMEM;
+		text->max = 4096;
+	}
+
+	do {
+		va_start(args, fmt);
+		len = vsnprintf(text->str + text->len, text->max - text->len,
+				fmt, args);
+		va_end(args);
+		if (len < 0)
+			return -EINVAL;
+		if (text->len + len < text->max) {
+			text->len += len;
+			return 0;
+		}
+
+		max = 2 * text->max;
+		while (max <= text->len + len)
+			max *= 2;
+		str = realloc(text->str, max);
+		if (!str)
+			return -ENOMEM;
+		text->str = str;
+		text->max = max;
+	} while (true);
+}
+
+static void text_clean(struct text *text)
+{
+	free(text->str);
+	memset(text, 0, sizeof(*text));
+}
+
+/* Instance names are free-form; quote them the way OpenMetrics wants. */
+static int print_label(struct text *text, char const *value)
+{
+	int error;
+
+	for (; *value; value++) {
+		switch (*value) {
+		case '\\':
+			error = text_printf(text, "\\\\");
+			break;
+		case '"':
+			error = text_printf(text, "\\\"");
+			break;
+		case '\n':
+			error = text_printf(text, "\\n");
+			break;
+		default:
+			error = text_printf(text, "%c", *value);
+		}
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+/* -- Kernel stats -- */
+
+struct stat_args {
+	char const *type;
+	struct text *text;
+};
+
+static struct jool_result print_stat(char const *iname,
+		struct joolnl_stat const *stat, void *_args)
+{
+	struct stat_args *args = _args;
+	struct text *text = args->text;
+	int error;
+
+	error = text_printf(text, "jool_stat{instance=\"");
+	if (!error)
+		error = print_label(text, iname);
+	if (!error)
+		error = text_printf(text, "\",type=\"%s\",stat=\"%s\"} %llu\n",
+				args->type, stat->meta.name,
+				(unsigned long long)stat->value);
+
+	return error ? result_from_enomem() : result_success();
+}
+
+/*
+ * Appends the stats of every @xt instance to @text.
+ * A missing module is not an error; it just doesn't have instances.
+ */
+static void print_xlator_type(struct text *text, xlator_type xt,
+		char const *type)
+{
+	struct joolnl_socket sk;
+	struct stat_args args;
+	struct jool_result result;
+
+	result = joolnl_setup(&sk, xt);
+	if (result.error) {
+		result_cleanup(&result);
+		return;
+	}
+
+	args.type = type;
+	args.text = text;
+	result = joolnl_stats_dump(&sk, NULL, print_stat, &args);
+	if (result.error)
+		pr_result(&result);
+
+	joolnl_teardown(&sk);
+}
+
+static void poll_kernel(void)
+{
+	struct text text = { 0 };
+	struct text tmp;
+	int error;
+
+	error = text_printf(&text, "# TYPE jool_stat unknown\n"
+			"# HELP jool_stat Translator stats, as printed by `jool stats display`.\n");
+	if (error)
+		goto fail;
+
+	print_xlator_type(&text, XT_SIIT, "siit");
+	print_xlator_type(&text, XT_NAT64, "nat64");
+
+	error = text_printf(&text, "# TYPE jool_stats_poll_timestamp_seconds gauge\n"
+			"# UNIT jool_stats_poll_timestamp_seconds seconds\n"
+			"# HELP jool_stats_poll_timestamp_seconds When the translator stats were last retrieved.\n"
+			"jool_stats_poll_timestamp_seconds %lld\n",
+			(long long)time(NULL));
+	if (error)
+		goto fail;
+
+	pthread_mutex_lock(&snapshot_mutex);
+	tmp = snapshot;
+	snapshot = text;
+	pthread_mutex_unlock(&snapshot_mutex);
+
+	text_clean(&tmp);
+	return;
+
+fail:
+	syslog(LOG_ERR, "Out of memory; cannot update the metrics.");
+	text_clean(&text);
+}
+
+static void *metrics_poll(void *arg)
+{
+	struct timespec delay;
+
+	delay.tv_sec = cfg.interval / 1000;
+	delay.tv_nsec = (cfg.interval % 1000) * 1000000L;
+
+	do {
+		poll_kernel();
+		nanosleep(&delay, NULL);
+	} while (true);
+
+	return NULL;
+}
+
+/* -- Daemon stats -- */
+
+static int print_counter(struct text *text, char const *name,
+		char const *help, unsigned long long value)
+{
+	return text_printf(text, "# TYPE %s counter\n# HELP %s %s\n"
+			"%s_total %llu\n", name, name, help, name, value);
+}
+
+static int print_threads(struct text *text)
+{
+	static const struct {
+		char const *thread;
+		atomic_ullong *batches;
+		atomic_ullong *items;
+	} batches[] = {
+		{
+			"netsocket_listen",
+			&netsocket_rx_batches,
+			&netsocket_rx_batch_items
+		}, {
+			"netsocket_transmit",
+			&netsocket_tx_batches,
+			&netsocket_tx_batch_items
+		}, {
+			"modsocket_transmit",
+			&modsocket_batches,
+			&modsocket_batch_items
+		},
+	};
+	unsigned int i;
+	int error;
+
+	error = text_printf(text, "# TYPE joold_queue_depth gauge\n"
+			"# HELP joold_queue_depth Messages waiting for the thread.\n"
+			"joold_queue_depth{thread=\"netsocket_transmit\"} %u\n"
+			"joold_queue_depth{thread=\"modsocket_transmit\"} %u\n"
+			"# TYPE joold_queue_capacity gauge\n"
+			"# HELP joold_queue_capacity Messages that fit in the thread's queue.\n"
+			"joold_queue_capacity{thread=\"netsocket_transmit\"} %u\n"
+			"joold_queue_capacity{thread=\"modsocket_transmit\"} %u\n",
+			netsocket_queue_depth(), modsocket_queue_depth(),
+			RING_CAPACITY, RING_CAPACITY);
+	if (error)
+		return error;
+
+	error = text_printf(text, "# TYPE joold_batches counter\n"
+			"# HELP joold_batches Socket calls that moved at least one message.\n");
+	for (i = 0; i < ARRAY_SIZE(batches) && !error; i++)
+		error = text_printf(text,
+				"joold_batches_total{thread=\"%s\"} %llu\n",
+				batches[i].thread, *batches[i].batches);
+	if (error)
+		return error;
+
+	error = text_printf(text, "# TYPE joold_batch_items counter\n"
+			"# HELP joold_batch_items Messages moved by the batches. (Divide by joold_batches_total for the average batch size.)\n");
+	for (i = 0; i < ARRAY_SIZE(batches) && !error; i++)
+		error = text_printf(text,
+				"joold_batch_items_total{thread=\"%s\"} %llu\n",
+				batches[i].thread, *batches[i].items);
+	return error;
+}
+
+static int print_daemon(struct text *text)
+{
+	struct seq_counters *seq = netsocket_seq_counters();
+	int error;
+
+	error = print_counter(text, "joold_kernel_sent_packets",
+			"Packets sent to the kernel module.",
+			(unsigned int)modsocket_pkts_sent);
+	if (!error)
+		error = print_counter(text, "joold_kernel_sent_bytes",
+				"Session bytes sent to the kernel module.",
+				(unsigned int)modsocket_bytes_sent);
+	if (!error)
+		error = print_counter(text, "joold_net_received_packets",
+				"Packets received from the network.",
+				(unsigned int)netsocket_pkts_rcvd);
+	if (!error)
+		error = print_counter(text, "joold_net_received_bytes",
+				"Session bytes received from the network.",
+				(unsigned int)netsocket_bytes_rcvd);
+	if (!error)
+		error = print_counter(text, "joold_net_sent_packets",
+				"Packets sent to the network.",
+				(unsigned int)netsocket_pkts_sent);
+	if (!error)
+		error = print_counter(text, "joold_net_sent_bytes",
+				"Session bytes sent to the network.",
+				(unsigned int)netsocket_bytes_sent);
+	if (!error)
+		error = print_counter(text, "joold_net_compressed_packets",
+				"Packets deflated before they were sent to the network.",
+				(unsigned int)netsocket_pkts_compressed);
+	if (!error)
+		error = print_counter(text, "joold_net_decompressed_packets",
+				"Deflated packets received from the network.",
+				(unsigned int)netsocket_pkts_decompressed);
+	if (!error)
+		error = print_counter(text, "joold_net_seq_missing_packets",
+				"Packets found missing from the peers' sequences.",
+				seq->missing);
+	if (!error)
+		error = print_counter(text, "joold_net_seq_recovered_packets",
+				"Missing packets that arrived later.",
+				seq->recovered);
+	if (!error)
+		error = print_counter(text, "joold_net_seq_unrecoverable_packets",
+				"Missing packets that were given up on.",
+				seq->unrecoverable);
+	if (!error)
+		error = print_counter(text, "joold_net_seq_nacks",
+				"NACKs sent to the peers.",
+				seq->nacks);
+	if (!error)
+		error = print_counter(text, "joold_net_seq_resent_packets",
+				"Packets resent because of the peers' NACKs.",
+				seq->resent);
+	if (!error)
+		error = print_threads(text);
+	return error;
+}
+
+/* -- HTTP -- */
+
+static int build_body(struct text *body)
+{
+	int error;
+
+	pthread_mutex_lock(&snapshot_mutex);
+	error = snapshot.str ? text_printf(body, "%s", snapshot.str) : 0;
+	pthread_mutex_unlock(&snapshot_mutex);
+
+	if (!error)
+		error = print_daemon(body);
+	if (!error)
+		error = text_printf(body, "# EOF\n");
+	return error;
+}
+
+static void send_all(int fd, char const *buffer, size_t len)
+{
+	ssize_t bytes;
+
+	while (len > 0) {
+		bytes = send(fd, buffer, len, MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			return; /* The client will notice. */
+		}
+		buffer += bytes;
+		len -= bytes;
+	}
+}
+
+static void send_status(int fd, char const *status)
+{
+	char buffer[128];
+	int len;
+
+	len = snprintf(buffer, sizeof(buffer), "HTTP/1.1 %s\r\n"
+			"Content-Length: 0\r\n"
+			"Connection: close\r\n\r\n", status);
+	send_all(fd, buffer, len);
+}
+
+/*
+ * Reads the request line (and as many headers as arrive with it).
+ * Returns the length of the request, or -1 if the client gave up.
+ */
+static int read_request(int fd, char *request)
+{
+	ssize_t bytes;
+	int len = 0;
+
+	do {
+		bytes = recv(fd, request + len, REQUEST_MAX - 1 - len, 0);
+		if (bytes <= 0)
+			return -1;
+		len += bytes;
+		request[len] = '\0';
+	} while (!strstr(request, "\r\n\r\n") && len < REQUEST_MAX - 1);
+
+	return len;
+}
+
+static bool is_metrics_path(char const *path)
+{
+	size_t len = strcspn(path, " ?");
+	return (len == 1 && path[0] == '/')
+			|| (len == 8 && strncmp(path, "/metrics", 8) == 0);
+}
+
+static void serve_client(int fd)
+{
+	char request[REQUEST_MAX];
+	struct text body = { 0 };
+	char header[256];
+	int len;
+
+	if (read_request(fd, request) < 0)
+		return;
+
+	if (strncmp(request, "GET ", 4) != 0) {
+		send_status(fd, "405 Method Not Allowed");
+		return;
+	}
+	if (!is_metrics_path(request + 4)) {
+		send_status(fd, "404 Not Found");
+		return;
+	}
+
+	if (build_body(&body)) {
+		syslog(LOG_ERR, "Out of memory; cannot serve the metrics.");
+		send_status(fd, "500 Internal Server Error");
+		goto end;
+	}
+
+	len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+			"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", body.len);
+	send_all(fd, header, len);
+	send_all(fd, body.str, body.len);
+
+end:
+	text_clean(&body);
+}
+
+static void set_timeouts(int fd)
+{
+	struct timeval timeout = { .tv_sec = CLIENT_TIMEOUT };
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)))
+		pr_perror("Cannot set the metrics client's receive timeout", errno);
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)))
+		pr_perror("Cannot set the metrics client's send timeout", errno);
+}
+
+static void *metrics_serve(void *arg)
+{
+	int sk;
+	int fd;
+
+	sk = *((int *)arg);
+	free(arg);
+
+	do {
+		fd = accept(sk, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR)
+				pr_perror("Cannot accept a metrics client", errno);
+			continue;
+		}
+
+		/* Scrapers are few and quick; one at a time is plenty. */
+		set_timeouts(fd);
+		serve_client(fd);
+		close(fd);
+	} while (true);
+
+	return NULL;
+}
+
+/* -- Setup -- */
+
+static bool check_string(cJSON *json, char const *field)
+{
+	if (json->type == cJSON_String)
+		return true;
+
+	syslog(LOG_ERR, "The metrics '%s' is not a string.", field);
+	return false;
+}
+
+static int read_json(char const *file_name)
+{
+	char *file;
+	cJSON *json, *child;
+	struct jool_result result;
+	int error;
+
+	syslog(LOG_INFO, "Opening file %s...", file_name);
+	result = file_to_string(file_name, &file);
+	if (result.error)
+		return pr_result(&result);
+
+	json = cJSON_Parse(file);
+	if (!json) {
+		syslog(LOG_ERR, "JSON syntax error.");
+		syslog(LOG_ERR, "The JSON parser got confused around about here:");
+		syslog(LOG_ERR, "%s", cJSON_GetErrorPtr());
+		free(file);
+		return 1;
+	}
+
+	free(file);
+
+	error = -ENOMEM;
+
+	child = cJSON_GetObjectItem(json, "address");
+	if (child && !check_string(child, "address")) {
+		error = -EINVAL;
+		goto end;
+	}
+	if (child) {
+		cfg.address = strdup(child->valuestring);
+		if (!cfg.address)
+			goto end;
+	}
+
+	child = cJSON_GetObjectItem(json, "port");
+	if (!child) {
+		syslog(LOG_ERR, "The metrics config file lacks a port.");
+		error = -EINVAL;
+		goto end;
+	}
+	if (!check_string(child, "port")) {
+		error = -EINVAL;
+		goto end;
+	}
+	cfg.port = strdup(child->valuestring);
+	if (!cfg.port)
+		goto end;
+
+	child = cJSON_GetObjectItem(json, "interval");
+	if (child && !(child->numflags & VALUENUM_UINT)) {
+		syslog(LOG_ERR, "The metrics interval is not a positive integer.");
+		error = -EINVAL;
+		goto end;
+	}
+	cfg.interval = child ? child->valueuint : DEFAULT_INTERVAL;
+	if (cfg.interval < MIN_INTERVAL) {
+		syslog(LOG_ERR, "Metrics interval %u is too short. (Minimum: %u ms)",
+				cfg.interval, MIN_INTERVAL);
+		error = -EINVAL;
+		goto end;
+	}
+
+	error = 0;
+	/* Fall through. */
+
+end:
+	cJSON_Delete(json);
+	return error;
+}
+
+static int create_socket(int *fd)
+{
+	int sk;
+	int yes = 1;
+	struct addrinfo hints = { 0 };
+	struct addrinfo *ais, *ai;
+	int err;
+
+	syslog(LOG_INFO, "Setting up the metrics server (port %s)...",
+			cfg.port);
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags |= AI_PASSIVE;
+
+	err = getaddrinfo(cfg.address, cfg.port, &hints, &ais);
+	if (err) {
+		syslog(LOG_ERR, "getaddrinfo() failed: %s", gai_strerror(err));
+		return err;
+	}
+
+	for (ai = ais; ai; ai = ai->ai_next) {
+		syslog(LOG_INFO, "Trying an address candidate...");
+
+		sk = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (sk < 0) {
+			pr_perror("socket() failed", errno);
+			continue;
+		}
+
+		if (setsockopt(sk, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)))
+			pr_perror("Cannot set SO_REUSEADDR", errno);
+
+		if (bind(sk, ai->ai_addr, ai->ai_addrlen)) {
+			pr_perror("bind() failed", errno);
+			close(sk);
+			continue;
+		}
+
+		if (listen(sk, 16)) {
+			pr_perror("listen() failed", errno);
+			close(sk);
+			continue;
+		}
+
+		syslog(LOG_INFO, "Metrics server created successfully.");
+		freeaddrinfo(ais);
+		*fd = sk;
+		return 0;
+	}
+
+	syslog(LOG_ERR, "None of the candidates yielded a valid metrics server.");
+	freeaddrinfo(ais);
+	return 1;
+}
+
+int metrics_start(int argc, char **argv)
+{
+	int sk, *sk2;
+	pthread_t thread;
+	int error;
+
+	/* "-" is a placeholder, for when the NAT log config file is wanted. */
+	if (argc < 5 || strcmp(argv[4], "-") == 0) {
+		syslog(LOG_INFO, "Metrics config file unavailable; skipping metrics server.");
+		return 0;
+	}
+
+	error = read_json(argv[4]);
+	if (error)
+		goto fail;
+
+	error = create_socket(&sk);
+	if (error)
+		goto fail;
+
+	sk2 = malloc(sizeof(int));
+	if (!sk2) {
+		error = -ENOMEM;
+		goto close_sk;
+	}
+	*sk2 = sk;
+
+	error = pthread_create(&thread, NULL, metrics_serve, sk2);
+	if (error) {
+		free(sk2);
+		goto close_sk;
+	}
+	pthread_detach(thread);
+
+	/* If this fails, the server keeps running; it just won't have kernel stats. */
+	error = pthread_create(&thread, NULL, metrics_poll, NULL);
+	if (error)
+		pr_perror("Cannot start the metrics poller", error);
+	else
+		pthread_detach(thread);
+
+	return 0;
+
+close_sk:
+	close(sk);
+fail:
+	free(cfg.address);
+	free(cfg.port);
+	return error;
+}
@@ -0,0 +1,14 @@
+#ifndef SRC_USR_JOOLD_METRICS_H_
+#define SRC_USR_JOOLD_METRICS_H_
+
+/**
+ * An HTTP server that serves the translators' stats and joold's own counters
+ * in OpenMetrics format, so Prometheus-like collectors can scrape them.
+ *
+ * The kernel is polled on a timer, not on every scrape; scrapes are cheap and
+ * do not reach the kernel.
+ */
+
+int metrics_start(int argc, char **argv);
+
+#endif /* SRC_USR_JOOLD_METRICS_H_ */
@@ -1,30 +1,117 @@
 #include "modsocket.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <string.h>
 #include <syslog.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <netlink/genl/ctrl.h>
 #include <netlink/genl/genl.h>
 
+#include "common/joold_ring.h"
 #include "usr/util/cJSON.h"
 #include "usr/util/file.h"
 #include "usr/nl/joold.h"
+#include "usr/joold/journal.h"
 #include "usr/joold/log.h"
 #include "usr/joold/netsocket.h"
+#include "usr/joold/ring.h"
 
 static struct joolnl_socket jsocket;
 static char *iname;
+/** Network datagrams waiting to be sent to the kernel. */
+static struct ring rx_ring;
+
+/*
+ * The kernel's session ring. (See common/joold_ring.h.) If @use_shm is false,
+ * the sessions arrive through the Netlink multicast instead.
+ */
+static bool use_shm;
+static int shm_fd = -1;
+static void *shm_area;
+static size_t shm_len;
 
 atomic_int modsocket_pkts_sent;
 atomic_int modsocket_bytes_sent;
+/* Netlink requests sent to the kernel, and the datagrams they carried. */
+atomic_ullong modsocket_batches;
+atomic_ullong modsocket_batch_items;
 
 /* Called by the net socket whenever joold receives data from the network. */
 void modsocket_send(void *request, size_t request_len)
 {
+	int error;
+
+	error = ring_push(&rx_ring, request, request_len);
+	if (error)
+		pr_perror("Cannot queue sessions for the kernel", -error);
+}
+
+/*
+ * Can @len more bytes be appended to a @total-long Netlink message?
+ * Datagrams that don't end in an attribute boundary (ie. garbage) are not
+ * mixed with the others, so they can't corrupt them.
+ */
+bool modsocket_fits(size_t total, size_t len)
+{
+	if (total == 0)
+		return true;
+	if (total % NLA_ALIGNTO || len % NLA_ALIGNTO)
+		return false;
+	return total + len <= MAX_COALESCED_PAYLOAD;
+}
+
+void *modsocket_transmit(void *arg)
+{
+	static unsigned char buffer[MAX_COALESCED_PAYLOAD];
+	struct ring_slot *slot;
 	struct jool_result result;
-	result = joolnl_joold_add(&jsocket, iname, request, request_len);
-	pr_result(&result);
+	size_t len;
+	unsigned int items;
+
+	do {
+		len = 0;
+		items = 0;
+		slot = ring_peek(&rx_ring, true);
+		while (slot && modsocket_fits(len, slot->len)) {
+			memcpy(buffer + len, slot->data, slot->len);
+			len += slot->len;
+			items++;
+			ring_release(&rx_ring);
+			slot = ring_peek(&rx_ring, false);
+		}
+
+		result = joolnl_joold_add(&jsocket, iname, buffer, len);
+		pr_result(&result);
+		modsocket_batches++;
+		modsocket_batch_items += items;
+	} while (true);
+
+	return NULL;
+}
+
+char const *modsocket_instance(void)
+{
+	return iname;
+}
+
+unsigned int modsocket_queue_depth(void)
+{
+	return ring_count(&rx_ring);
+}
+
+void modsocket_advertise(void)
+{
+	struct jool_result result;
+
+	result = joolnl_joold_advertise(&jsocket, iname);
+	if (result.error)
+		pr_result(&result);
 }
 
 static void do_ack(void)
@@ -37,46 +124,73 @@ static void do_ack(void)
 }
 
 /**
- * Called when joold receives data from kernelspace.
- * This data can be either sessions that should be multicasted to other joolds
- * or a response to something sent by modsocket_send().
+ * Validates @msg, a message the kernel sent to joold. On success, @sessions is
+ * its session container.
+ *
+ * @jhdr is the message's Jool header, or NULL if even that is unusable. (In
+ * which case the message can't be attributed to an instance.) On failure, the
+ * message should only be acknowledged.
  */
-static int updated_entries_cb(struct nl_msg *msg, void *arg)
+int modsocket_parse(struct nl_msg *msg, struct joolnlhdr **jhdr,
+		struct nlattr **sessions)
 {
 	struct nlmsghdr *nhdr;
 	struct genlmsghdr *ghdr;
-	struct joolnlhdr *jhdr;
 	struct nlattr *root;
 	struct jool_result result;
 
-	syslog(LOG_DEBUG, "Received a packet from kernelspace.");
+	*jhdr = NULL;
 
 	nhdr = nlmsg_hdr(msg);
 	if (!genlmsg_valid_hdr(nhdr, sizeof(struct joolnlhdr))) {
 		syslog(LOG_ERR, "Kernel sent invalid data: Message too short to contain headers");
-		goto einval;
+		return -EINVAL;
 	}
 
 	ghdr = genlmsg_hdr(nhdr);
 
-	jhdr = genlmsg_user_hdr(ghdr);
-	result = validate_joolnlhdr(jhdr, XT_NAT64);
+	result = validate_joolnlhdr(genlmsg_user_hdr(ghdr), XT_NAT64);
 	if (result.error) {
 		pr_result(&result);
-		goto fail;
+		return (result.error < 0) ? result.error : -result.error;
 	}
-	if (strcasecmp(jhdr->iname, iname) != 0)
-		return 0; /* Packet is not intended for us. */
-	if (jhdr->flags & JOOLNLHDR_FLAGS_ERROR) {
+	*jhdr = genlmsg_user_hdr(ghdr);
+
+	if ((*jhdr)->flags & JOOLNLHDR_FLAGS_ERROR) {
 		result = joolnl_msg2result(msg);
 		pr_result(&result);
-		goto fail;
+		return (result.error < 0) ? result.error : -result.error;
 	}
 
 	root = genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr));
 	if (nla_type(root) != JNLAR_SESSION_ENTRIES) {
 		syslog(LOG_ERR, "Kernel sent invalid data: Message lacks a session container");
-		goto einval;
+		return -EINVAL;
+	}
+
+	*sessions = root;
+	return 0;
+}
+
+/**
+ * Called when joold receives data from kernelspace.
+ * This data can be either sessions that should be multicasted to other joolds
+ * or a response to something sent by modsocket_send().
+ */
+static int updated_entries_cb(struct nl_msg *msg, void *arg)
+{
+	struct joolnlhdr *jhdr;
+	struct nlattr *root;
+	int error;
+
+	syslog(LOG_DEBUG, "Received a packet from kernelspace.");
+
+	error = modsocket_parse(msg, &jhdr, &root);
+	if (jhdr && strcasecmp(jhdr->iname, iname) != 0)
+		return 0; /* Packet is not intended for us. */
+	if (error) {
+		do_ack(); /* Tell kernel to flush the packet queue anyway. */
+		return error;
 	}
 
 	/*
@@ -85,17 +199,12 @@ static int updated_entries_cb(struct nl_msg *msg, void *arg)
 	 * (See modsocket_send())
 	 */
 	netsocket_send(nla_data(root), nla_len(root));
+	journal_append(nla_data(root), nla_len(root));
 	do_ack();
 
 	modsocket_pkts_sent++;
 	modsocket_bytes_sent += nla_len(root);
 	return 0;
-
-einval:
-	result.error = -EINVAL;
-fail:
-	do_ack(); /* Tell kernel to flush the packet queue anyway. */
-	return (result.error < 0) ? result.error : -result.error;
 }
 
 static int read_json(int argc, char **argv)
@@ -125,6 +234,14 @@ static int read_json(int argc, char **argv)
 
 	free(file);
 
+	child = cJSON_GetObjectItem(json, "ring");
+	if (child && child->type != cJSON_True && child->type != cJSON_False) {
+		syslog(LOG_ERR, "'ring' is not a boolean.");
+		cJSON_Delete(json);
+		return 1;
+	}
+	use_shm = child && (child->type == cJSON_True);
+
 	child = cJSON_GetObjectItem(json, "instance");
 	iname = strdup(child ? child->valuestring : INAME_DEFAULT);
 	if (!iname) {
@@ -136,23 +253,74 @@ static int read_json(int argc, char **argv)
 	return 0;
 }
 
-static int create_socket(void)
+/* Opens the kernel's session ring, and attaches it to @iname. */
+static int shm_open_ring(void)
+{
+	char name[INAME_MAX_SIZE] = { 0 };
+	int error;
+
+	shm_fd = open(JOOLD_RING_PATH, O_RDWR | O_CLOEXEC);
+	if (shm_fd < 0) {
+		error = errno;
+		pr_perror("Cannot open " JOOLD_RING_PATH, error);
+		return error;
+	}
+
+	strncpy(name, iname, INAME_MAX_SIZE - 1);
+	if (ioctl(shm_fd, JOOLD_RING_ATTACH, name) < 0) {
+		error = errno;
+		pr_perror("Cannot attach the session ring to the instance", error);
+		goto fail;
+	}
+
+	shm_len = sysconf(_SC_PAGESIZE) + JOOLD_RING_DATA_SIZE;
+	shm_area = mmap(NULL, shm_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			shm_fd, 0);
+	if (shm_area == MAP_FAILED) {
+		error = errno;
+		pr_perror("Cannot map the session ring", error);
+		goto fail;
+	}
+
+	syslog(LOG_INFO, "Reading the sessions from the kernel's ring.");
+	return 0;
+
+fail:
+	close(shm_fd);
+	shm_fd = -1;
+	return error;
+}
+
+static void shm_close_ring(void)
+{
+	if (shm_fd < 0)
+		return;
+	munmap(shm_area, shm_len);
+	close(shm_fd);
+	shm_fd = -1;
+}
+
+/*
+ * Opens @sk, and subscribes it to the kernel's joold multicast group. @cb will
+ * receive the messages.
+ */
+int modsocket_open(struct joolnl_socket *sk, nl_recvmsg_msg_cb_t cb)
 {
 	int family_mc_grp;
 	struct jool_result result;
 
-	result = joolnl_setup(&jsocket, XT_NAT64);
+	result = joolnl_setup(sk, XT_NAT64);
 	if (result.error)
 		return pr_result(&result);
 
-	result.error = nl_socket_modify_cb(jsocket.sk, NL_CB_VALID,
-			NL_CB_CUSTOM, updated_entries_cb, NULL);
+	result.error = nl_socket_modify_cb(sk->sk, NL_CB_VALID,
+			NL_CB_CUSTOM, cb, NULL);
 	if (result.error) {
 		syslog(LOG_ERR, "Couldn't modify receiver socket's callbacks.");
 		goto fail;
 	}
 
-	family_mc_grp = genl_ctrl_resolve_grp(jsocket.sk, JOOLNL_FAMILY,
+	family_mc_grp = genl_ctrl_resolve_grp(sk->sk, JOOLNL_FAMILY,
 			JOOLNL_MULTICAST_GRP_NAME);
 	if (family_mc_grp < 0) {
 		syslog(LOG_ERR, "Unable to resolve the Netlink multicast group.");
@@ -160,7 +328,7 @@ static int create_socket(void)
 		goto fail;
 	}
 
-	result.error = nl_socket_add_membership(jsocket.sk, family_mc_grp);
+	result.error = nl_socket_add_membership(sk->sk, family_mc_grp);
 	if (result.error) {
 		syslog(LOG_ERR, "Can't register to the Netlink multicast group.");
 		goto fail;
@@ -169,32 +337,135 @@ static int create_socket(void)
 	return 0;
 
 fail:
-	joolnl_teardown(&jsocket);
+	joolnl_teardown(sk);
 	syslog(LOG_ERR, "Netlink error message: %s", nl_geterror(result.error));
 	return result.error;
 }
 
 int modsocket_setup(int argc, char **argv)
 {
+	struct jool_result result;
 	int error;
 
 	error = read_json(argc, argv);
 	if (error)
 		return error;
 
-	return create_socket();
+	error = ring_init(&rx_ring, RING_CAPACITY);
+	if (error) {
+		pr_perror("Cannot allocate the kernel transmission queue",
+				-error);
+		goto ring_fail;
+	}
+
+	if (use_shm) {
+		/* Only needed for the requests; no multicast. */
+		result = joolnl_setup(&jsocket, XT_NAT64);
+		if (result.error) {
+			error = pr_result(&result);
+			goto socket_fail;
+		}
+		error = shm_open_ring();
+		if (error) {
+			joolnl_teardown(&jsocket);
+			goto socket_fail;
+		}
+	} else {
+		error = modsocket_open(&jsocket, updated_entries_cb);
+		if (error)
+			goto socket_fail;
+	}
+
+	return 0;
+
+socket_fail:
+	ring_destroy(&rx_ring);
+ring_fail:
+	free(iname);
+	return error;
 }
 
 void modsocket_teardown(void)
 {
+	shm_close_ring();
+	ring_destroy(&rx_ring);
 	free(iname);
 	joolnl_teardown(&jsocket);
 }
 
+/*
+ * Hands the records between @consumer and @producer to the network, and
+ * returns the new consumer. @count is the number of datagrams.
+ */
+static __u32 shm_consume(struct joold_ring_hdr *hdr, __u32 consumer,
+		__u32 producer, __u32 *count)
+{
+	unsigned char *data = (unsigned char *)hdr + hdr->data_offset;
+	struct joold_ring_rec *rec;
+	__u32 pos;
+
+	*count = 0;
+	while (consumer != producer) {
+		pos = consumer & (JOOLD_RING_DATA_SIZE - 1);
+		rec = (struct joold_ring_rec *)(data + pos);
+
+		if (rec->len == JOOLD_RING_PAD) {
+			consumer += JOOLD_RING_DATA_SIZE - pos;
+			continue;
+		}
+		if (rec->len > JOOLD_RING_DATA_SIZE - pos - sizeof(*rec)) {
+			syslog(LOG_ERR, "Kernel sent invalid data: Session ring record overflows the ring");
+			return producer;
+		}
+
+		netsocket_send(rec + 1, rec->len);
+		journal_append(rec + 1, rec->len);
+		modsocket_pkts_sent++;
+		modsocket_bytes_sent += rec->len;
+		(*count)++;
+
+		consumer += (sizeof(*rec) + rec->len + JOOLD_RING_ALIGN - 1)
+				& ~(JOOLD_RING_ALIGN - 1);
+	}
+
+	return consumer;
+}
+
+/* modsocket_listen(), for the ring. */
+static void shm_listen(void)
+{
+	struct joold_ring_hdr *hdr = shm_area;
+	struct pollfd pfd = { .fd = shm_fd, .events = POLLIN };
+	__u32 producer, consumer;
+	__u32 count;
+
+	consumer = hdr->consumer;
+	do {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno != EINTR)
+				pr_perror("Cannot poll the session ring", errno);
+			continue;
+		}
+
+		producer = __atomic_load_n(&hdr->producer, __ATOMIC_ACQUIRE);
+		consumer = shm_consume(hdr, consumer, producer, &count);
+		__atomic_store_n(&hdr->consumer, consumer, __ATOMIC_RELEASE);
+
+		/* One ACK for all of them; the kernel refills the window. */
+		if (count > 0 && ioctl(shm_fd, JOOLD_RING_ACK, &count) < 0)
+			pr_perror("Cannot ACK the session ring", errno);
+	} while (true);
+}
+
 void *modsocket_listen(void *arg)
 {
 	int error;
 
+	if (use_shm) {
+		shm_listen();
+		return 0;
+	}
+
 	do {
 		error = nl_recvmsgs_default(jsocket.sk);
 		if (error < 0) {
@@ -5,12 +5,41 @@
  * This is the socket we use to talk to the kernel module.
  */
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <netlink/msg.h>
+#include <netlink/handlers.h>
+#include "common/config.h"
+#include "usr/nl/core.h"
+
+/*
+ * Maximum number of network bytes bundled into a single Netlink message.
+ * (nlmsg_alloc() allocates a page, and it needs some room for the headers.)
+ */
+#define MAX_COALESCED_PAYLOAD 3072
 
 int modsocket_setup(int argc, char **argv);
 void modsocket_teardown(void);
 
+/* Module to ring to network */
 void *modsocket_listen(void *arg);
+/* Network to ring to module */
 void modsocket_send(void *buffer, size_t size);
+void *modsocket_transmit(void *arg);
+/* Asks the kernel to send its entire session table. */
+void modsocket_advertise(void);
+
+/* Building blocks; the multi-instance loop uses them too. */
+int modsocket_open(struct joolnl_socket *sk, nl_recvmsg_msg_cb_t cb);
+/* Can @len more bytes be appended to a @total-long JNLOP_JOOLD_ADD payload? */
+bool modsocket_fits(size_t total, size_t len);
+/* Extracts the session container of a kernel joold message. */
+int modsocket_parse(struct nl_msg *msg, struct joolnlhdr **jhdr,
+		struct nlattr **sessions);
+
+/* Number of network datagrams waiting to be sent to the kernel. */
+unsigned int modsocket_queue_depth(void);
+/* Name of the instance the daemon is synchronizing. */
+char const *modsocket_instance(void);
 
 #endif /* SRC_USR_JOOLD_MODSOCKET_H_ */
@@ -0,0 +1,584 @@
+#define _GNU_SOURCE /* recvmmsg() */
+#include "usr/joold/multi.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netlink/genl/genl.h>
+
+#include "log.h"
+#include "modsocket.h"
+#include "netsocket.h"
+#include "statsocket.h"
+#include "usr/nl/joold.h"
+#include "usr/util/cJSON.h"
+#include "usr/util/file.h"
+
+/*
+ * Reads per readiness event, at most. The rest waits for the next epoll_wait(),
+ * so a busy socket can't starve the others.
+ */
+#define MAX_ROUNDS 16
+#define MAX_EVENTS 64
+/* Every instance's sessions arrive through the same Netlink socket. */
+#define NL_RCVBUF_SIZE (4 * 1024 * 1024)
+
+enum endpoint_type {
+	EP_KERNEL,
+	EP_NET,
+	EP_STATS,
+};
+
+/* What an epoll event points to. */
+struct endpoint {
+	enum endpoint_type type;
+	/* NULL if @type is EP_KERNEL. */
+	struct instance *instance;
+};
+
+struct instance {
+	char *iname;
+
+	struct mcast_socket net;
+	struct endpoint net_ep;
+	/* -1 if the instance has no stats port. */
+	int stats_fd;
+	struct endpoint stats_ep;
+	struct statsocket_counters counters;
+
+	/*
+	 * Kernel to network. Datagrams being packed; only the last one can
+	 * still take more messages.
+	 */
+	struct mmsghdr *tx;
+	unsigned int tx_count;
+
+	/* Network to kernel. */
+	struct mmsghdr *rx;
+	unsigned char add[MAX_COALESCED_PAYLOAD];
+	size_t add_len;
+};
+
+static struct instance *instances;
+static unsigned int instance_count;
+static struct joolnl_socket jsocket;
+static struct endpoint kernel_ep = { .type = EP_KERNEL };
+static int epfd;
+
+static struct instance *find_instance(char const *iname)
+{
+	unsigned int i;
+
+	for (i = 0; i < instance_count; i++)
+		if (strcasecmp(instances[i].iname, iname) == 0)
+			return &instances[i];
+	return NULL;
+}
+
+static void ack(struct instance *instance)
+{
+	struct jool_result result;
+
+	result = joolnl_joold_ack(&jsocket, instance->iname);
+	if (result.error)
+		pr_result(&result);
+}
+
+static void tx_flush(struct instance *instance)
+{
+	struct iovec *iov;
+	unsigned int i;
+	size_t bytes;
+
+	for (i = 0; i < instance->tx_count; i++) {
+		iov = instance->tx[i].msg_hdr.msg_iov;
+		iov->iov_len = mcast_compress(&instance->net, iov->iov_base,
+				iov->iov_len);
+		iov->iov_len = seq_stamp(&instance->net.seq, iov->iov_base,
+				iov->iov_len);
+	}
+
+	syslog(LOG_DEBUG, "%s: Sending %u datagram(s) to the network...",
+			instance->iname, instance->tx_count);
+	instance->counters.net_pkts_sent += mcast_send(&instance->net,
+			instance->tx, instance->tx_count, &bytes);
+	instance->counters.net_bytes_sent += bytes;
+	instance->tx_count = 0;
+}
+
+/*
+ * Appends a kernel message to the datagram being packed, or starts a new one.
+ * (Same as coalesce() in netsocket.c.)
+ */
+static void tx_append(struct instance *instance, void *data, size_t len)
+{
+	struct iovec *iov;
+
+	if (len > JOOLD_MAX_PAYLOAD) {
+		syslog(LOG_ERR, "%s: Dropping a %zu-byte kernel message.",
+				instance->iname, len);
+		return;
+	}
+
+	if (instance->tx_count > 0) {
+		iov = instance->tx[instance->tx_count - 1].msg_hdr.msg_iov;
+		if (iov->iov_len + len <= instance->net.max_datagram_size)
+			goto append;
+	}
+
+	if (instance->tx_count == instance->net.batch_size)
+		tx_flush(instance);
+	iov = instance->tx[instance->tx_count++].msg_hdr.msg_iov;
+	iov->iov_len = 0;
+
+append:
+	memcpy((unsigned char *)iov->iov_base + iov->iov_len, data, len);
+	iov->iov_len += len;
+}
+
+static int kernel_cb(struct nl_msg *msg, void *arg)
+{
+	struct joolnlhdr *jhdr;
+	struct nlattr *root;
+	struct instance *instance;
+	int error;
+
+	error = modsocket_parse(msg, &jhdr, &root);
+	if (!jhdr)
+		return 0; /* Can't tell whose it is; already logged. */
+	instance = find_instance(jhdr->iname);
+	if (!instance)
+		return 0; /* Not one of ours. */
+
+	if (!error) {
+		tx_append(instance, nla_data(root), nla_len(root));
+		instance->counters.kernel_pkts_sent++;
+		instance->counters.kernel_bytes_sent += nla_len(root);
+	}
+
+	/* Tell the kernel to flush the packet queue, even on errors. */
+	ack(instance);
+	/* Don't drop the other instances' messages over this one. */
+	return 0;
+}
+
+static void handle_kernel(void)
+{
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < MAX_ROUNDS; i++) {
+		error = nl_recvmsgs_default(jsocket.sk);
+		if (error == -NLE_AGAIN)
+			break;
+		if (error == -NLE_NOMEM) {
+			syslog(LOG_WARNING, "The Netlink socket overflowed; some sessions were lost.");
+		} else if (error < 0) {
+			syslog(LOG_ERR, "Error receiving packet from kernelspace: %s",
+					nl_geterror(error));
+			break;
+		}
+	}
+
+	/* One sendmmsg() per instance, for everything this round yielded. */
+	for (i = 0; i < instance_count; i++)
+		if (instances[i].tx_count > 0)
+			tx_flush(&instances[i]);
+}
+
+static void rx_flush(struct instance *instance)
+{
+	struct jool_result result;
+
+	if (instance->add_len == 0)
+		return;
+
+	result = joolnl_joold_add(&jsocket, instance->iname, instance->add,
+			instance->add_len);
+	pr_result(&result);
+	instance->add_len = 0;
+}
+
+/* Same as modsocket_transmit(). */
+static void rx_append(struct instance *instance, unsigned char *data,
+		size_t len)
+{
+	if (!modsocket_fits(instance->add_len, len))
+		rx_flush(instance);
+	memcpy(instance->add + instance->add_len, data, len);
+	instance->add_len += len;
+}
+
+static void handle_net(struct instance *instance)
+{
+	struct mmsghdr *msgs = instance->rx;
+	unsigned char *datagram;
+	size_t len;
+	unsigned char *plain;
+	size_t plain_len;
+	unsigned int r;
+	int count;
+	int i;
+
+	for (r = 0; r < MAX_ROUNDS; r++) {
+		count = recvmmsg(instance->net.fd, msgs,
+				instance->net.batch_size, MSG_DONTWAIT, NULL);
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+					&& errno != EINTR)
+				pr_perror("Error receiving packets from the network",
+						errno);
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				syslog(LOG_ERR, "%s: Dropping a datagram that exceeds %d bytes.",
+						instance->iname,
+						MCAST_BUFFER_SIZE);
+				continue;
+			}
+
+			instance->counters.net_pkts_rcvd++;
+			instance->counters.net_bytes_rcvd += msgs[i].msg_len;
+
+			datagram = msgs[i].msg_hdr.msg_iov->iov_base;
+			len = msgs[i].msg_len;
+			if (!seq_receive(&instance->net, &datagram, &len))
+				continue;
+			if (mcast_inflate(datagram, len, &plain,
+					&plain_len) < 0)
+				continue;
+			rx_append(instance, plain, plain_len);
+		}
+
+		if ((unsigned int)count < instance->net.batch_size)
+			break;
+	}
+
+	rx_flush(instance);
+}
+
+static void handle_stats(struct instance *instance)
+{
+	struct statsocket_request request;
+	struct seq_counters *seq = &instance->net.seq.counters;
+	unsigned int r;
+
+	for (r = 0; r < MAX_ROUNDS; r++) {
+		if (!statsocket_recv(instance->stats_fd, &request))
+			break;
+		instance->counters.net_seq_missing = seq->missing;
+		instance->counters.net_seq_recovered = seq->recovered;
+		instance->counters.net_seq_unrecoverable = seq->unrecoverable;
+		statsocket_reply(instance->stats_fd, &request,
+				&instance->counters);
+	}
+}
+
+static int set_nonblocking(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		pr_perror("Cannot make a socket nonblocking", errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int watch(int fd, struct endpoint *endpoint)
+{
+	struct epoll_event event = { 0 };
+
+	event.events = EPOLLIN;
+	event.data.ptr = endpoint;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event)) {
+		pr_perror("epoll_ctl() failed", errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void instance_teardown(struct instance *instance)
+{
+	if (instance->stats_fd != -1)
+		close(instance->stats_fd);
+	mcast_free_msgs(instance->rx);
+	mcast_free_msgs(instance->tx);
+	mcast_socket_close(&instance->net);
+	free(instance->iname);
+}
+
+static int instance_setup(cJSON *json, struct instance *instance)
+{
+	cJSON *name, *child;
+	int error;
+
+	memset(instance, 0, sizeof(*instance));
+	instance->stats_fd = -1;
+
+	name = cJSON_GetObjectItem(json, "instance");
+	if (!name || !name->valuestring) {
+		syslog(LOG_ERR, "Every element of 'instances' needs an 'instance' name.");
+		return -EINVAL;
+	}
+	if (find_instance(name->valuestring)) {
+		syslog(LOG_ERR, "Instance '%s' is listed more than once.",
+				name->valuestring);
+		return -EINVAL;
+	}
+
+	child = cJSON_GetObjectItem(json, "network");
+	if (!child || child->type != cJSON_Object) {
+		syslog(LOG_ERR, "Every element of 'instances' needs a 'network' object.");
+		return -EINVAL;
+	}
+
+	instance->iname = strdup(name->valuestring);
+	if (!instance->iname)
+		return -ENOMEM;
+
+	syslog(LOG_INFO, "Setting up instance '%s'...", instance->iname);
+
+	error = mcast_socket_open(child, &instance->net);
+	if (error)
+		goto revert_iname;
+	error = set_nonblocking(instance->net.fd);
+	if (error)
+		goto revert_net;
+
+	instance->tx = mcast_alloc_msgs(instance->net.batch_size);
+	if (!instance->tx) {
+		error = -ENOMEM;
+		goto revert_net;
+	}
+	mcast_address_msgs(&instance->net, instance->tx,
+			instance->net.batch_size);
+	instance->rx = mcast_alloc_msgs(instance->net.batch_size);
+	if (!instance->rx) {
+		error = -ENOMEM;
+		goto revert_tx;
+	}
+
+	child = cJSON_GetObjectItem(json, "stats port");
+	if (child) {
+		if (!child->valuestring) {
+			syslog(LOG_ERR, "'stats port' is not a string.");
+			error = -EINVAL;
+			goto revert_rx;
+		}
+		error = statsocket_open(child->valuestring,
+				&instance->stats_fd);
+		if (error)
+			goto revert_rx;
+		error = set_nonblocking(instance->stats_fd);
+		if (error)
+			goto revert_stats;
+	}
+
+	return 0;
+
+revert_stats:
+	close(instance->stats_fd);
+revert_rx:
+	mcast_free_msgs(instance->rx);
+revert_tx:
+	mcast_free_msgs(instance->tx);
+revert_net:
+	mcast_socket_close(&instance->net);
+revert_iname:
+	free(instance->iname);
+	return error;
+}
+
+static int instances_setup(char const *file_name)
+{
+	char *file;
+	cJSON *json, *list, *child;
+	struct jool_result result;
+	int error;
+
+	syslog(LOG_INFO, "Opening file %s...", file_name);
+	result = file_to_string(file_name, &file);
+	if (result.error)
+		return pr_result(&result);
+
+	json = cJSON_Parse(file);
+	if (!json) {
+		syslog(LOG_ERR, "JSON syntax error.");
+		syslog(LOG_ERR, "The JSON parser got confused around about here:");
+		syslog(LOG_ERR, "%s", cJSON_GetErrorPtr());
+		free(file);
+		return 1;
+	}
+
+	free(file);
+
+	list = cJSON_GetObjectItem(json, "instances");
+	if (!list || list->type != cJSON_Array || !cJSON_GetArraySize(list)) {
+		syslog(LOG_ERR, "The file needs a nonempty 'instances' array.");
+		error = -EINVAL;
+		goto end;
+	}
+
+	instances = calloc(cJSON_GetArraySize(list), sizeof(*instances));
+	if (!instances) {
+		error = -ENOMEM;
+		goto end;
+	}
+
+	error = 0;
+	for (child = list->child; child; child = child->next) {
+		error = instance_setup(child, &instances[instance_count]);
+		if (error)
+			break;
+		instance_count++;
+	}
+
+end:
+	cJSON_Delete(json);
+	return error;
+}
+
+static void instances_teardown(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < instance_count; i++)
+		instance_teardown(&instances[i]);
+	free(instances);
+}
+
+static int kernel_setup(void)
+{
+	int error;
+
+	error = modsocket_open(&jsocket, kernel_cb);
+	if (error)
+		return error;
+
+	error = nl_socket_set_buffer_size(jsocket.sk, NL_RCVBUF_SIZE, 0);
+	if (error)
+		goto fail;
+	error = nl_socket_set_nonblocking(jsocket.sk);
+	if (error)
+		goto fail;
+
+	return 0;
+
+fail:
+	syslog(LOG_ERR, "Cannot configure the Netlink socket: %s",
+			nl_geterror(error));
+	joolnl_teardown(&jsocket);
+	return error;
+}
+
+static int watch_all(void)
+{
+	struct instance *instance;
+	unsigned int i;
+	int error;
+
+	error = watch(nl_socket_get_fd(jsocket.sk), &kernel_ep);
+	if (error)
+		return error;
+
+	for (i = 0; i < instance_count; i++) {
+		instance = &instances[i];
+
+		instance->net_ep.type = EP_NET;
+		instance->net_ep.instance = instance;
+		error = watch(instance->net.fd, &instance->net_ep);
+		if (error)
+			return error;
+
+		if (instance->stats_fd == -1)
+			continue;
+		instance->stats_ep.type = EP_STATS;
+		instance->stats_ep.instance = instance;
+		error = watch(instance->stats_fd, &instance->stats_ep);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static void loop(void)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct endpoint *endpoint;
+	int count;
+	int i;
+
+	syslog(LOG_INFO, "Serving %u instances.", instance_count);
+
+	do {
+		count = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (count < 0) {
+			if (errno != EINTR)
+				pr_perror("epoll_wait() failed", errno);
+			continue;
+		}
+
+		for (i = 0; i < count; i++) {
+			endpoint = events[i].data.ptr;
+			switch (endpoint->type) {
+			case EP_KERNEL:
+				handle_kernel();
+				break;
+			case EP_NET:
+				handle_net(endpoint->instance);
+				break;
+			case EP_STATS:
+				handle_stats(endpoint->instance);
+				break;
+			}
+		}
+	} while (true);
+}
+
+int multi_run(char const *file_name)
+{
+	int error;
+
+	error = instances_setup(file_name);
+	if (error)
+		goto revert_instances;
+
+	error = kernel_setup();
+	if (error)
+		goto revert_instances;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		pr_perror("epoll_create1() failed", errno);
+		error = -errno;
+		goto revert_kernel;
+	}
+
+	error = watch_all();
+	if (error)
+		goto revert_epoll;
+
+	loop();
+	/* Unreachable, for now. */
+
+revert_epoll:
+	close(epfd);
+revert_kernel:
+	joolnl_teardown(&jsocket);
+revert_instances:
+	instances_teardown();
+	return error;
+}
@@ -0,0 +1,20 @@
+#ifndef SRC_USR_JOOLD_MULTI_H_
+#define SRC_USR_JOOLD_MULTI_H_
+
+/**
+ * Multi-instance mode. (`joold --instances <file>`.)
+ *
+ * Serves every instance listed in the file from a single thread. There is one
+ * Netlink socket for all of them (the kernel multicasts every instance's
+ * sessions to the same group anyway), plus each instance's own UDP multicast
+ * socket and, optionally, its own stats socket. All of them are nonblocking,
+ * and driven by one epoll loop.
+ *
+ * Each instance still packs its own datagrams and Netlink requests, and counts
+ * its own stats. TCP peers, the metrics server and the NAT log are only
+ * available in single-instance mode.
+ */
+
+int multi_run(char const *file_name);
+
+#endif /* SRC_USR_JOOLD_MULTI_H_ */
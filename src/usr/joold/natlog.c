@@ -0,0 +1,554 @@
+#include "usr/joold/natlog.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netlink/genl/ctrl.h>
+#include <netlink/genl/genl.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "log.h"
+#include "common/config.h"
+#include "common/types.h"
+#include "usr/nl/core.h"
+#include "usr/nl/stats.h"
+#include "usr/util/cJSON.h"
+#include "usr/util/file.h"
+
+#define DEFAULT_ROTATE_INTERVAL 3600
+/* Buffered lines are written out at least this often. (Seconds) */
+#define FLUSH_INTERVAL 1
+/* The kernel sends bursts; don't make it drop them. */
+#define RCVBUF_SIZE (4 * 1024 * 1024)
+#define LINE_MAX_LEN 256
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+struct natlog_config {
+	char *directory;
+	char *iname; /* NULL means "every instance." */
+	unsigned int rotate_interval; /* In seconds */
+	bool compress;
+};
+
+/* The file currently being written. */
+struct output {
+	FILE *file;
+#ifdef HAVE_ZLIB
+	gzFile gz;
+#endif
+	/* The current file has to be closed at this time. */
+	time_t rotate_time;
+	time_t flush_time;
+};
+
+static struct natlog_config cfg;
+static struct joolnl_socket jsocket;
+static struct output out;
+
+static bool out_is_open(void)
+{
+#ifdef HAVE_ZLIB
+	if (out.gz)
+		return true;
+#endif
+	return out.file != NULL;
+}
+
+static void out_close(void)
+{
+#ifdef HAVE_ZLIB
+	if (out.gz) {
+		gzclose(out.gz);
+		out.gz = NULL;
+	}
+#endif
+	if (out.file) {
+		fclose(out.file);
+		out.file = NULL;
+	}
+}
+
+/* Appends, so a restart within the same second doesn't lose the old lines. */
+static int out_open(time_t now)
+{
+	char path[4096];
+	char date[32];
+	struct tm tm;
+	int len;
+	int error;
+
+	gmtime_r(&now, &tm);
+	strftime(date, sizeof(date), "%Y%m%dT%H%M%SZ", &tm);
+	len = snprintf(path, sizeof(path), "%s/natlog-%s.csv%s", cfg.directory,
+			date, cfg.compress ? ".gz" : "");
+	if (len < 0 || len >= sizeof(path)) {
+		syslog(LOG_ERR, "NAT log path is too long.");
+		return -ENAMETOOLONG;
+	}
+
+#ifdef HAVE_ZLIB
+	if (cfg.compress) {
+		out.gz = gzopen(path, "ab");
+		if (!out.gz) {
+			error = errno;
+			pr_perror("Cannot open the NAT log file", error);
+			return -error;
+		}
+		goto success;
+	}
+#endif
+
+	out.file = fopen(path, "a");
+	if (!out.file) {
+		error = errno;
+		pr_perror("Cannot open the NAT log file", error);
+		return -error;
+	}
+
+#ifdef HAVE_ZLIB
+success:
+#endif
+	syslog(LOG_INFO, "Writing the NAT log to %s.", path);
+	out.rotate_time = now - (now % cfg.rotate_interval)
+			+ cfg.rotate_interval;
+	out.flush_time = now + FLUSH_INTERVAL;
+	return 0;
+}
+
+static void out_write(char const *line, size_t len)
+{
+#ifdef HAVE_ZLIB
+	if (out.gz) {
+		gzwrite(out.gz, line, len);
+		return;
+	}
+#endif
+	fwrite(line, 1, len, out.file);
+}
+
+static void out_flush(void)
+{
+#ifdef HAVE_ZLIB
+	if (out.gz) {
+		gzflush(out.gz, Z_SYNC_FLUSH);
+		return;
+	}
+#endif
+	fflush(out.file);
+}
+
+/* Closes the file if its interval is over, and opens the next one if needed. */
+static int out_prepare(time_t now)
+{
+	if (out_is_open() && now < out.rotate_time)
+		return 0;
+
+	out_close();
+	return out_open(now);
+}
+
+static char const *event_to_string(__u8 event)
+{
+	switch (event) {
+	case NATLOG_BIB_MAPPED:
+		return "mapped";
+	case NATLOG_BIB_FORGOT:
+		return "forgot";
+	case NATLOG_BLOCK_MAPPED:
+		return "block-mapped";
+	case NATLOG_BLOCK_FORGOT:
+		return "block-forgot";
+	}
+
+	return "unknown";
+}
+
+/*
+ * Blocks print their ports as a range ("min-max"), and leave the IPv6 port
+ * empty, since they belong to the whole address.
+ */
+static void write_record(char const *iname, struct natlog_record *record)
+{
+	char line[LINE_MAX_LEN];
+	char date[32];
+	char src6[INET6_ADDRSTRLEN];
+	char src4[INET_ADDRSTRLEN];
+	char port6[8];
+	char port4[16];
+	struct tm tm;
+	time_t sec;
+	bool block;
+	int len;
+
+	sec = record->timestamp / 1000000000ull;
+	gmtime_r(&sec, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+	inet_ntop(AF_INET6, record->src6, src6, sizeof(src6));
+	inet_ntop(AF_INET, record->src4, src4, sizeof(src4));
+
+	block = record->event == NATLOG_BLOCK_MAPPED
+			|| record->event == NATLOG_BLOCK_FORGOT;
+	if (block) {
+		port6[0] = '\0';
+		snprintf(port4, sizeof(port4), "%u-%u", record->src4_port,
+				record->src4_port_max);
+	} else {
+		snprintf(port6, sizeof(port6), "%u", record->src6_port);
+		snprintf(port4, sizeof(port4), "%u", record->src4_port);
+	}
+
+	len = snprintf(line, sizeof(line), "%s.%09lluZ,%.*s,%s,%s,%s,%s,%s,%s\n",
+			date,
+			(unsigned long long)(record->timestamp % 1000000000ull),
+			INAME_MAX_SIZE, iname,
+			event_to_string(record->event),
+			l4proto_to_string(record->proto),
+			src6, port6, src4, port4);
+	if (len < 0 || len >= sizeof(line))
+		return;
+
+	out_write(line, len);
+}
+
+/* Same order as the kernel's enum verdict. */
+static char const *const verdict_names[] = {
+	"continue",
+	"drop",
+	"untranslatable",
+	"stolen",
+};
+
+static int print_stage(char *buf, size_t size, __u32 ns)
+{
+	return (ns == NATLOG_LATENCY_SKIPPED)
+			? snprintf(buf, size, ",")
+			: snprintf(buf, size, ",%u", ns);
+}
+
+/*
+ * Latency samples reuse the BIB records' first three columns; the rest are
+ * the incoming tuple (empty if it was never computed), the verdict, the
+ * counter the verdict was counted in, and the nanoseconds between the
+ * packet's arrival and the end of each stage (empty if it never ran).
+ */
+static void write_latency(char const *iname, struct natlog_latency *sample)
+{
+	char line[LINE_MAX_LEN];
+	char date[32];
+	char src[INET6_ADDRSTRLEN];
+	char dst[INET6_ADDRSTRLEN];
+	char sport[8];
+	char dport[8];
+	struct joolnl_stat_metadata const *stat;
+	char const *proto;
+	char const *verdict;
+	struct tm tm;
+	time_t sec;
+	int af;
+	int len;
+	int i;
+
+	sec = sample->timestamp / 1000000000ull;
+	gmtime_r(&sec, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+	if (sample->stages[JLAT_IN_TUPLE] != NATLOG_LATENCY_SKIPPED) {
+		af = (sample->l3_proto == L3PROTO_IPV6) ? AF_INET6 : AF_INET;
+		inet_ntop(af, sample->src, src, sizeof(src));
+		inet_ntop(af, sample->dst, dst, sizeof(dst));
+		snprintf(sport, sizeof(sport), "%u", sample->src_port);
+		snprintf(dport, sizeof(dport), "%u", sample->dst_port);
+		proto = l4proto_to_string(sample->l4_proto);
+	} else {
+		src[0] = dst[0] = sport[0] = dport[0] = '\0';
+		proto = "";
+	}
+
+	verdict = (sample->verdict < ARRAY_SIZE(verdict_names))
+			? verdict_names[sample->verdict]
+			: "unknown";
+	stat = joolnl_stat_metadata(sample->stat);
+
+	len = snprintf(line, sizeof(line), "%s.%09lluZ,%.*s,latency,%s,%s,%s,%s,%s,%s,%s",
+			date,
+			(unsigned long long)(sample->timestamp % 1000000000ull),
+			INAME_MAX_SIZE, iname, proto, src, sport, dst, dport,
+			verdict, stat ? stat->name : "");
+	if (len < 0 || len >= sizeof(line))
+		return;
+
+	for (i = 0; i < NATLOG_LATENCY_STAGES; i++) {
+		len += print_stage(line + len, sizeof(line) - len,
+				sample->stages[i]);
+		if (len >= sizeof(line))
+			return;
+	}
+
+	if (len + 1 >= sizeof(line))
+		return;
+	line[len++] = '\n';
+
+	out_write(line, len);
+}
+
+/* Called when the kernel sends a batch of records. */
+static int natlog_cb(struct nl_msg *msg, void *arg)
+{
+	struct nlmsghdr *nhdr;
+	struct genlmsghdr *ghdr;
+	struct joolnlhdr *jhdr;
+	struct nlattr *root;
+	struct natlog_record *records;
+	struct natlog_latency *samples;
+	struct jool_result result;
+	unsigned int count, i;
+	time_t now;
+
+	nhdr = nlmsg_hdr(msg);
+	if (!genlmsg_valid_hdr(nhdr, sizeof(struct joolnlhdr))) {
+		syslog(LOG_ERR, "Kernel sent invalid data: Message too short to contain headers");
+		return -EINVAL;
+	}
+
+	ghdr = genlmsg_hdr(nhdr);
+
+	jhdr = genlmsg_user_hdr(ghdr);
+	result = validate_joolnlhdr(jhdr, XT_NAT64);
+	if (result.error)
+		return pr_result(&result);
+	if (cfg.iname && strncasecmp(jhdr->iname, cfg.iname, INAME_MAX_SIZE))
+		return 0; /* Packet is not intended for us. */
+
+	root = genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr));
+	if (nla_type(root) != JNLAR_NATLOG_RECORDS
+			&& nla_type(root) != JNLAR_NATLOG_LATENCY) {
+		syslog(LOG_ERR, "Kernel sent invalid data: Message lacks a record array");
+		return -EINVAL;
+	}
+
+	now = time(NULL);
+	if (out_prepare(now))
+		return 0; /* Already logged; maybe the next file will work. */
+
+	if (nla_type(root) == JNLAR_NATLOG_RECORDS) {
+		records = nla_data(root);
+		count = nla_len(root) / sizeof(*records);
+		for (i = 0; i < count; i++)
+			write_record(jhdr->iname, &records[i]);
+	} else {
+		samples = nla_data(root);
+		count = nla_len(root) / sizeof(*samples);
+		for (i = 0; i < count; i++)
+			write_latency(jhdr->iname, &samples[i]);
+	}
+
+	if (now >= out.flush_time) {
+		out_flush();
+		out.flush_time = now + FLUSH_INTERVAL;
+	}
+
+	return 0;
+}
+
+static void *natlog_listen(void *arg)
+{
+	int error;
+
+	do {
+		error = nl_recvmsgs_default(jsocket.sk);
+		if (error == -NLE_NOMEM) {
+			syslog(LOG_ERR, "The NAT log socket overflowed; some records were lost.");
+		} else if (error < 0) {
+			syslog(LOG_ERR, "Error receiving the NAT log: %s",
+					nl_geterror(error));
+		}
+	} while (true);
+
+	return NULL;
+}
+
+static int create_socket(void)
+{
+	int family_mc_grp;
+	struct jool_result result;
+
+	result = joolnl_setup(&jsocket, XT_NAT64);
+	if (result.error)
+		return pr_result(&result);
+
+	/* Multicasts aren't answers to anything. */
+	nl_socket_disable_seq_check(jsocket.sk);
+
+	result.error = nl_socket_modify_cb(jsocket.sk, NL_CB_VALID,
+			NL_CB_CUSTOM, natlog_cb, NULL);
+	if (result.error) {
+		syslog(LOG_ERR, "Couldn't modify the NAT log socket's callbacks.");
+		goto fail;
+	}
+
+	result.error = nl_socket_set_buffer_size(jsocket.sk, RCVBUF_SIZE, 0);
+	if (result.error) {
+		syslog(LOG_ERR, "Couldn't resize the NAT log socket's buffer.");
+		goto fail;
+	}
+
+	family_mc_grp = genl_ctrl_resolve_grp(jsocket.sk, JOOLNL_FAMILY,
+			JOOLNL_NATLOG_GRP_NAME);
+	if (family_mc_grp < 0) {
+		syslog(LOG_ERR, "Unable to resolve the NAT log multicast group.");
+		result.error = family_mc_grp;
+		goto fail;
+	}
+
+	result.error = nl_socket_add_membership(jsocket.sk, family_mc_grp);
+	if (result.error) {
+		syslog(LOG_ERR, "Can't register to the NAT log multicast group.");
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	joolnl_teardown(&jsocket);
+	syslog(LOG_ERR, "Netlink error message: %s", nl_geterror(result.error));
+	return result.error;
+}
+
+static bool check_string(cJSON *json, char const *field)
+{
+	if (json->type == cJSON_String)
+		return true;
+
+	syslog(LOG_ERR, "The NAT log '%s' is not a string.", field);
+	return false;
+}
+
+static int read_json(char const *file_name)
+{
+	char *file;
+	cJSON *json, *child;
+	struct jool_result result;
+	int error;
+
+	syslog(LOG_INFO, "Opening file %s...", file_name);
+	result = file_to_string(file_name, &file);
+	if (result.error)
+		return pr_result(&result);
+
+	json = cJSON_Parse(file);
+	if (!json) {
+		syslog(LOG_ERR, "JSON syntax error.");
+		syslog(LOG_ERR, "The JSON parser got confused around about here:");
+		syslog(LOG_ERR, "%s", cJSON_GetErrorPtr());
+		free(file);
+		return 1;
+	}
+
+	free(file);
+
+	error = -ENOMEM;
+
+	child = cJSON_GetObjectItem(json, "directory");
+	if (!child) {
+		syslog(LOG_ERR, "The NAT log config file lacks a directory.");
+		error = -EINVAL;
+		goto end;
+	}
+	if (!check_string(child, "directory")) {
+		error = -EINVAL;
+		goto end;
+	}
+	cfg.directory = strdup(child->valuestring);
+	if (!cfg.directory)
+		goto end;
+
+	child = cJSON_GetObjectItem(json, "instance");
+	if (child && !check_string(child, "instance")) {
+		error = -EINVAL;
+		goto end;
+	}
+	if (child) {
+		cfg.iname = strdup(child->valuestring);
+		if (!cfg.iname)
+			goto end;
+	}
+
+	child = cJSON_GetObjectItem(json, "rotate interval");
+	if (child && !(child->numflags & VALUENUM_UINT)) {
+		syslog(LOG_ERR, "The NAT log rotate interval is not a positive integer.");
+		error = -EINVAL;
+		goto end;
+	}
+	cfg.rotate_interval = child ? child->valueuint : DEFAULT_ROTATE_INTERVAL;
+	if (cfg.rotate_interval == 0) {
+		syslog(LOG_ERR, "The NAT log rotate interval cannot be zero.");
+		error = -EINVAL;
+		goto end;
+	}
+
+	child = cJSON_GetObjectItem(json, "compress");
+	if (child && child->type != cJSON_True && child->type != cJSON_False) {
+		syslog(LOG_ERR, "The NAT log 'compress' is not a boolean.");
+		error = -EINVAL;
+		goto end;
+	}
+#ifdef HAVE_ZLIB
+	cfg.compress = child ? (child->type == cJSON_True) : true;
+#else
+	if (child && child->type == cJSON_True)
+		syslog(LOG_WARNING, "joold was built without zlib; the NAT log will not be compressed.");
+	cfg.compress = false;
+#endif
+
+	error = 0;
+	/* Fall through. */
+
+end:
+	cJSON_Delete(json);
+	return error;
+}
+
+int natlog_start(int argc, char **argv)
+{
+	pthread_t thread;
+	int error;
+
+	/* "-" is a placeholder, for when the journal config file is wanted. */
+	if (argc < 6 || strcmp(argv[5], "-") == 0) {
+		syslog(LOG_INFO, "NAT log config file unavailable; skipping NAT log collector.");
+		return 0;
+	}
+
+	error = read_json(argv[5]);
+	if (error)
+		goto fail;
+
+	error = create_socket();
+	if (error)
+		goto fail;
+
+	error = pthread_create(&thread, NULL, natlog_listen, NULL);
+	if (error) {
+		pr_perror("Cannot start the NAT log collector", error);
+		joolnl_teardown(&jsocket);
+		goto fail;
+	}
+	pthread_detach(thread);
+
+	return 0;
+
+fail:
+	free(cfg.directory);
+	free(cfg.iname);
+	return error;
+}
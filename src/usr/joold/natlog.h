@@ -0,0 +1,12 @@
+#ifndef SRC_USR_JOOLD_NATLOG_H_
+#define SRC_USR_JOOLD_NATLOG_H_
+
+/**
+ * Collects the kernel's binary BIB log (logging-bib-binary) from the natlog
+ * multicast group, and writes it to rotating (and, if joold was built with
+ * zlib, gzipped) CSV files.
+ */
+
+int natlog_start(int argc, char **argv);
+
+#endif /* SRC_USR_JOOLD_NATLOG_H_ */
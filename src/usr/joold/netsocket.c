@@ -1,7 +1,9 @@
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
 #include "usr/joold/netsocket.h"
 
 #include <errno.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -11,10 +13,17 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "log.h"
 #include "modsocket.h"
+#include "ring.h"
+#include "sequence.h"
+#include "streamsocket.h"
 #include "common/config.h"
+#include "common/constants.h"
 #include "common/types.h"
 #include "usr/util/cJSON.h"
 #include "usr/util/file.h"
@@ -41,18 +50,52 @@ struct netsocket_config {
 
 	int ttl;
 	bool ttl_set;
+
+	/** Maximum number of datagrams per recvmmsg() and sendmmsg(). */
+	unsigned int batch_size;
+	/**
+	 * Outgoing datagrams carry as many kernel messages as fit in this many
+	 * bytes.
+	 */
+	unsigned int max_datagram_size;
+	/** Deflate outgoing datagrams? */
+	bool compress;
+	/** Sent datagrams kept for the NACKs. Zero disables sequencing. */
+	unsigned int history;
 };
 
-static int sk;
-/** Processed version of the configuration's hostname and service. */
-static struct addrinfo *addr_candidates;
-/** Candidate from @addr_candidates that we managed to bind the socket with. */
-static struct addrinfo *bound_address;
+#define DEFAULT_BATCH_SIZE 16
+#define MAX_BATCH_SIZE 1024
+
+/*
+ * Compressed datagrams start with this. Read as a Netlink attribute header,
+ * it's a 65535-byte attribute, which can't fit in a datagram; a plain
+ * datagram can't start with it, and a receiver that doesn't know about
+ * compression (the kernel module can't tell) will drop it as truncated.
+ */
+static unsigned char const ZHDR[] = { 0xFF, 0xFF, 'J', 'Z' };
+#define ZHDR_LEN sizeof(ZHDR)
+
+static struct mcast_socket msk;
+
+/** Are we using TCP peers (streamsocket) instead of multicast? */
+static bool stream;
+/** Kernel messages waiting to be sent to the network. */
+static struct ring tx_ring;
 
 atomic_int netsocket_pkts_rcvd;
 atomic_int netsocket_bytes_rcvd;
 atomic_int netsocket_pkts_sent;
 atomic_int netsocket_bytes_sent;
+/* recvmmsg()s that returned something, and the datagrams they returned. */
+atomic_ullong netsocket_rx_batches;
+atomic_ullong netsocket_rx_batch_items;
+/* Trips to the network, and the datagrams (or stream frames) they carried. */
+atomic_ullong netsocket_tx_batches;
+atomic_ullong netsocket_tx_batch_items;
+/* Datagrams deflated, and received deflated. */
+atomic_int netsocket_pkts_compressed;
+atomic_int netsocket_pkts_decompressed;
 
 static struct in_addr *get_addr4(struct addrinfo *addr)
 {
@@ -84,6 +127,23 @@ static int validate_valueint(cJSON *json, char *field)
 	return -EINVAL;
 }
 
+static int validate_range(cJSON *json, char *field, int min, int max)
+{
+	int error;
+
+	error = validate_valueint(json, field);
+	if (error)
+		return error;
+
+	if (json->valueint < min || max < json->valueint) {
+		syslog(LOG_ERR, "%s %d is out of range (%d-%d).", field,
+				json->valueint, min, max);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static int json_to_config(cJSON *json, struct netsocket_config *cfg)
 {
 	char *missing;
@@ -91,6 +151,8 @@ static int json_to_config(cJSON *json, struct netsocket_config *cfg)
 	int error;
 
 	memset(cfg, 0, sizeof(*cfg));
+	cfg->batch_size = DEFAULT_BATCH_SIZE;
+	cfg->max_datagram_size = DEFAULT_JOOLD_MAX_PAYLOAD;
 
 	child = cJSON_GetObjectItem(json, "multicast address");
 	if (!child) {
@@ -130,6 +192,46 @@ static int json_to_config(cJSON *json, struct netsocket_config *cfg)
 		cfg->ttl = child->valueint;
 	}
 
+	child = cJSON_GetObjectItem(json, "batch size");
+	if (child) {
+		error = validate_range(child, "batch size", 1, MAX_BATCH_SIZE);
+		if (error)
+			return error;
+		cfg->batch_size = child->valueint;
+	}
+
+	child = cJSON_GetObjectItem(json, "max datagram size");
+	if (child) {
+		error = validate_range(child, "max datagram size", 1,
+				JOOLD_MAX_PAYLOAD);
+		if (error)
+			return error;
+		cfg->max_datagram_size = child->valueint;
+	}
+
+	child = cJSON_GetObjectItem(json, "compress");
+	if (child) {
+		if (child->type != cJSON_True && child->type != cJSON_False) {
+			syslog(LOG_ERR, "'compress' is not a boolean.");
+			return -EINVAL;
+		}
+#ifdef HAVE_ZLIB
+		cfg->compress = (child->type == cJSON_True);
+#else
+		if (child->type == cJSON_True)
+			syslog(LOG_WARNING, "joold was built without zlib; the datagrams will not be compressed.");
+#endif
+	}
+
+	child = cJSON_GetObjectItem(json, "retransmission history");
+	if (child) {
+		error = validate_range(child, "retransmission history", 0,
+				SEQ_MAX_HISTORY);
+		if (error)
+			return error;
+		cfg->history = child->valueint;
+	}
+
 	return 0;
 
 fail:
@@ -165,8 +267,12 @@ int read_json(int argc, char **argv, cJSON **out)
 	return 0;
 }
 
-static int try_address(struct netsocket_config *config)
+static int try_address(struct mcast_socket *ms,
+		struct netsocket_config *config)
 {
+	struct addrinfo *bound_address = ms->bound;
+	int sk;
+
 	sk = socket(bound_address->ai_family, bound_address->ai_socktype,
 			bound_address->ai_protocol);
 	if (sk < 0) {
@@ -182,20 +288,24 @@ static int try_address(struct netsocket_config *config)
 		if (setsockopt(sk, SOL_SOCKET, SO_REUSEADDR, &config->reuseaddr,
 				sizeof(config->reuseaddr))) {
 			pr_perror("setsockopt(SO_REUSEADDR) failed", errno);
+			close(sk);
 			return 1;
 		}
 	}
 
 	if (bind(sk, bound_address->ai_addr, bound_address->ai_addrlen)) {
 		pr_perror("bind() failed", errno);
+		close(sk);
 		return 1;
 	}
 
 	syslog(LOG_INFO, "The socket to the network was created.");
+	ms->fd = sk;
 	return 0;
 }
 
-static int create_socket(struct netsocket_config *config)
+static int create_socket(struct mcast_socket *ms,
+		struct netsocket_config *config)
 {
 	struct addrinfo hints = { 0 };
 	int err;
@@ -206,32 +316,33 @@ static int create_socket(struct netsocket_config *config)
 
 	hints.ai_socktype = SOCK_DGRAM;
 	err = getaddrinfo(config->mcast_addr, config->mcast_port, &hints,
-			&addr_candidates);
+			&ms->candidates);
 	if (err) {
 		syslog(LOG_ERR, "getaddrinfo() failed: %s", gai_strerror(err));
 		return err;
 	}
 
-	bound_address = addr_candidates;
-	while (bound_address) {
+	ms->bound = ms->candidates;
+	while (ms->bound) {
 		syslog(LOG_INFO, "Trying an address candidate...");
-		err = try_address(config);
+		err = try_address(ms, config);
 		if (!err)
 			return 0;
-		bound_address = bound_address->ai_next;
+		ms->bound = ms->bound->ai_next;
 	}
 
 	syslog(LOG_ERR, "None of the candidates yielded a valid socket.");
-	freeaddrinfo(addr_candidates);
+	freeaddrinfo(ms->candidates);
 	return 1;
 }
 
-static int mcast4opt_add_membership(struct netsocket_config *cfg)
+static int mcast4opt_add_membership(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	struct ip_mreq mreq;
 	struct jool_result result;
 
-	mreq.imr_multiaddr = *get_addr4(bound_address);
+	mreq.imr_multiaddr = *get_addr4(ms->bound);
 	if (cfg->in_interface) {
 		result = str_to_addr4(cfg->in_interface, &mreq.imr_interface);
 		if (result.error) {
@@ -242,7 +353,7 @@ static int mcast4opt_add_membership(struct netsocket_config *cfg)
 		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
 	}
 
-	if (setsockopt(sk, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+	if (setsockopt(ms->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
 			sizeof(mreq))) {
 		pr_perror("-> setsockopt(IP_ADD_MEMBERSHIP) failed", errno);
 		return 1;
@@ -252,11 +363,11 @@ static int mcast4opt_add_membership(struct netsocket_config *cfg)
 	return 0;
 }
 
-static int mcast4opt_disable_loopback(void)
+static int mcast4opt_disable_loopback(struct mcast_socket *ms)
 {
 	int loop = 0;
 
-	if (setsockopt(sk, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+	if (setsockopt(ms->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
 			sizeof(loop))) {
 		pr_perror("-> setsockopt(IP_MULTICAST_LOOP) failed", errno);
 		return 1;
@@ -266,12 +377,13 @@ static int mcast4opt_disable_loopback(void)
 	return 0;
 }
 
-static int mcast4opt_set_ttl(struct netsocket_config *cfg)
+static int mcast4opt_set_ttl(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	if (!cfg->ttl_set)
 		return 0;
 
-	if (setsockopt(sk, IPPROTO_IP, IP_MULTICAST_TTL, &cfg->ttl,
+	if (setsockopt(ms->fd, IPPROTO_IP, IP_MULTICAST_TTL, &cfg->ttl,
 			sizeof(cfg->ttl))) {
 		pr_perror("-> setsockopt(IP_MULTICAST_TTL) failed", errno);
 		return 1;
@@ -281,7 +393,8 @@ static int mcast4opt_set_ttl(struct netsocket_config *cfg)
 	return 0;
 }
 
-static int mcast4opt_set_out_interface(struct netsocket_config *cfg)
+static int mcast4opt_set_out_interface(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	struct in_addr addr;
 	struct jool_result result;
@@ -295,7 +408,8 @@ static int mcast4opt_set_out_interface(struct netsocket_config *cfg)
 		return 1;
 	}
 
-	if (setsockopt(sk, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr))) {
+	if (setsockopt(ms->fd, IPPROTO_IP, IP_MULTICAST_IF, &addr,
+			sizeof(addr))) {
 		pr_perror("-> setsockopt(IP_MULTICAST_IF) failed", errno);
 		return 1;
 	}
@@ -304,30 +418,32 @@ static int mcast4opt_set_out_interface(struct netsocket_config *cfg)
 	return 0;
 }
 
-static int handle_mcast4_opts(struct netsocket_config *cfg)
+static int handle_mcast4_opts(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	int error;
 
-	error = mcast4opt_add_membership(cfg);
+	error = mcast4opt_add_membership(ms, cfg);
 	if (error)
 		return error;
 
-	error = mcast4opt_disable_loopback();
+	error = mcast4opt_disable_loopback(ms);
 	if (error)
 		return error;
 
-	error = mcast4opt_set_ttl(cfg);
+	error = mcast4opt_set_ttl(ms, cfg);
 	if (error)
 		return error;
 
-	return mcast4opt_set_out_interface(cfg);
+	return mcast4opt_set_out_interface(ms, cfg);
 }
 
-static int mcast6opt_add_membership(struct netsocket_config *cfg)
+static int mcast6opt_add_membership(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	struct ipv6_mreq mreq;
 
-	mreq.ipv6mr_multiaddr = *get_addr6(bound_address);
+	mreq.ipv6mr_multiaddr = *get_addr6(ms->bound);
 	if (cfg->in_interface) {
 		mreq.ipv6mr_interface = if_nametoindex(cfg->in_interface);
 		if (!mreq.ipv6mr_interface) {
@@ -339,7 +455,7 @@ static int mcast6opt_add_membership(struct netsocket_config *cfg)
 		mreq.ipv6mr_interface = 0; /* Any interface. */
 	}
 
-	if (setsockopt(sk, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &mreq,
+	if (setsockopt(ms->fd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &mreq,
 			sizeof(mreq))) {
 		pr_perror("setsockopt(IPV6_ADD_MEMBERSHIP) failed", errno);
 		return 1;
@@ -349,11 +465,11 @@ static int mcast6opt_add_membership(struct netsocket_config *cfg)
 	return 0;
 }
 
-static int mcast6opt_disable_loopback(void)
+static int mcast6opt_disable_loopback(struct mcast_socket *ms)
 {
 	int loop = 0;
 
-	if (setsockopt(sk, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop,
+	if (setsockopt(ms->fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop,
 			sizeof(loop))) {
 		pr_perror("setsockopt(IP_MULTICAST_LOOP) failed", errno);
 		return 1;
@@ -363,12 +479,13 @@ static int mcast6opt_disable_loopback(void)
 	return 0;
 }
 
-static int mcast6opt_set_ttl(struct netsocket_config *cfg)
+static int mcast6opt_set_ttl(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	if (!cfg->ttl_set)
 		return 0;
 
-	if (setsockopt(sk, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &cfg->ttl,
+	if (setsockopt(ms->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &cfg->ttl,
 			sizeof(cfg->ttl))) {
 		pr_perror("setsockopt(IPV6_MULTICAST_HOPS) failed", errno);
 		return 1;
@@ -378,7 +495,8 @@ static int mcast6opt_set_ttl(struct netsocket_config *cfg)
 	return 0;
 }
 
-static int mcast6opt_set_out_interface(struct netsocket_config *cfg)
+static int mcast6opt_set_out_interface(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	unsigned int interface;
 
@@ -391,7 +509,7 @@ static int mcast6opt_set_out_interface(struct netsocket_config *cfg)
 		return 1;
 	}
 
-	if (setsockopt(sk, IPPROTO_IPV6, IPV6_MULTICAST_IF, &interface,
+	if (setsockopt(ms->fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &interface,
 			sizeof(interface))) {
 		pr_perror("setsockopt(IP_MULTICAST_IF) failed", errno);
 		return 1;
@@ -401,66 +519,153 @@ static int mcast6opt_set_out_interface(struct netsocket_config *cfg)
 	return 0;
 }
 
-static int handle_mcast6_opts(struct netsocket_config *cfg)
+static int handle_mcast6_opts(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	int error;
 
-	error = mcast6opt_add_membership(cfg);
+	error = mcast6opt_add_membership(ms, cfg);
 	if (error)
 		return error;
 
-	error = mcast6opt_disable_loopback();
+	error = mcast6opt_disable_loopback(ms);
 	if (error)
 		return error;
 
-	error = mcast6opt_set_ttl(cfg);
+	error = mcast6opt_set_ttl(ms, cfg);
 	if (error)
 		return error;
 
-	return mcast6opt_set_out_interface(cfg);
+	return mcast6opt_set_out_interface(ms, cfg);
 }
 
-static int adjust_mcast_opts(struct netsocket_config *cfg)
+static int adjust_mcast_opts(struct mcast_socket *ms,
+		struct netsocket_config *cfg)
 {
 	syslog(LOG_INFO, "Configuring multicast options on the socket...");
 
-	switch (bound_address->ai_family) {
+	switch (ms->bound->ai_family) {
 	case AF_INET:
-		return handle_mcast4_opts(cfg);
+		return handle_mcast4_opts(ms, cfg);
 	case AF_INET6:
-		return handle_mcast6_opts(cfg);
+		return handle_mcast6_opts(ms, cfg);
 	}
 
 	syslog(LOG_INFO, "I don't know how to tweak multicast socket options for address family %d.",
-			bound_address->ai_family);
+			ms->bound->ai_family);
 	return 1;
 }
 
+static int is_stream(cJSON *json, bool *result)
+{
+	cJSON *child;
+
+	child = cJSON_GetObjectItem(json, "protocol");
+	if (!child) {
+		*result = false;
+		return 0;
+	}
+	if (child->valuestring) {
+		if (strcasecmp(child->valuestring, "udp") == 0) {
+			*result = false;
+			return 0;
+		}
+		if (strcasecmp(child->valuestring, "tcp") == 0) {
+			*result = true;
+			return 0;
+		}
+	}
+
+	syslog(LOG_ERR, "The protocol is supposed to be either 'udp' or 'tcp'.");
+	return -EINVAL;
+}
+
+/**
+ * Creates and configures @ms out of @json, which is a netsocket configuration
+ * in multicast (UDP) mode.
+ */
+int mcast_socket_open(cJSON *json, struct mcast_socket *ms)
+{
+	struct netsocket_config cfg;
+	bool tcp;
+	int error;
+
+	error = is_stream(json, &tcp);
+	if (error)
+		return error;
+	if (tcp) {
+		syslog(LOG_ERR, "Only the UDP protocol is supported here.");
+		return -EINVAL;
+	}
+
+	error = json_to_config(json, &cfg);
+	if (error)
+		return error;
+
+	error = seq_init(&ms->seq, cfg.history, MCAST_BUFFER_SIZE);
+	if (error)
+		return error;
+
+	error = create_socket(ms, &cfg);
+	if (error) {
+		seq_destroy(&ms->seq);
+		return error;
+	}
+
+	error = adjust_mcast_opts(ms, &cfg);
+	if (error) {
+		mcast_socket_close(ms);
+		return error;
+	}
+
+	ms->batch_size = cfg.batch_size;
+	ms->max_datagram_size = cfg.max_datagram_size;
+	ms->compress = cfg.compress;
+	return 0;
+}
+
+void mcast_socket_close(struct mcast_socket *ms)
+{
+	close(ms->fd);
+	freeaddrinfo(ms->candidates);
+	seq_destroy(&ms->seq);
+}
+
 int netsocket_setup(int argc, char **argv)
 {
 	cJSON *json;
-	struct netsocket_config cfg;
 	int error;
 
 	error = read_json(argc, argv, &json);
 	if (error)
 		return error;
 
-	error = json_to_config(json, &cfg);
+	error = is_stream(json, &stream);
 	if (error)
 		goto end;
+	if (stream) {
+		error = streamsocket_setup(json);
+		if (error)
+			goto end;
+		error = ring_init(&tx_ring, RING_CAPACITY);
+		if (error) {
+			pr_perror("Cannot allocate the network transmission queue",
+					-error);
+			streamsocket_teardown();
+		}
+		goto end;
+	}
 
-	error = create_socket(&cfg);
+	error = mcast_socket_open(json, &msk);
 	if (error)
 		goto end;
 
-	error = adjust_mcast_opts(&cfg);
+	error = ring_init(&tx_ring, RING_CAPACITY);
 	if (error) {
-		close(sk);
-		freeaddrinfo(addr_candidates);
-		goto end;
+		pr_perror("Cannot allocate the network transmission queue",
+				-error);
+		mcast_socket_close(&msk);
 	}
-	/* Fall through. */
 
 end:
 	cJSON_Delete(json);
@@ -469,48 +674,363 @@ end:
 
 void netsocket_teardown(void)
 {
-	close(sk);
-	freeaddrinfo(addr_candidates);
+	ring_destroy(&tx_ring);
+	if (stream) {
+		streamsocket_teardown();
+		return;
+	}
+	mcast_socket_close(&msk);
+}
+
+/*
+ * Allocates @count datagram headers, each pointing to its own
+ * MCAST_BUFFER_SIZE-sized buffer.
+ */
+struct mmsghdr *mcast_alloc_msgs(unsigned int count)
+{
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	unsigned char *buffers;
+	unsigned int i;
+
+	msgs = calloc(count, sizeof(*msgs));
+	iovs = calloc(count, sizeof(*iovs));
+	buffers = malloc(count * MCAST_BUFFER_SIZE);
+	if (!msgs || !iovs || !buffers) {
+		free(msgs);
+		free(iovs);
+		free(buffers);
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		iovs[i].iov_base = buffers + i * MCAST_BUFFER_SIZE;
+		iovs[i].iov_len = MCAST_BUFFER_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return msgs;
+}
+
+void mcast_free_msgs(struct mmsghdr *msgs)
+{
+	free(msgs[0].msg_hdr.msg_iov->iov_base);
+	free(msgs[0].msg_hdr.msg_iov);
+	free(msgs);
+}
+
+static void free_msgs_cb(void *msgs)
+{
+	mcast_free_msgs(msgs);
+}
+
+static bool is_compressed(unsigned char const *datagram, size_t len)
+{
+	return len >= ZHDR_LEN && memcmp(datagram, ZHDR, ZHDR_LEN) == 0;
+}
+
+/**
+ * Undoes mcast_compress(). Points @plain to the kernel messages carried by the
+ * @len-byte @datagram.
+ *
+ * Returns 0 if @datagram was plain, 1 if it had to be inflated, and a negative
+ * error code if it has to be dropped. (Not thread-safe; the inflated messages
+ * live in a static buffer until the next call.)
+ */
+int mcast_inflate(unsigned char *datagram, size_t len,
+		unsigned char **plain, size_t *plain_len)
+{
+#ifdef HAVE_ZLIB
+	static unsigned char buffer[JOOLD_MAX_PAYLOAD];
+	uLongf buffer_len;
+	int error;
+#endif
+
+	if (!is_compressed(datagram, len)) {
+		*plain = datagram;
+		*plain_len = len;
+		return 0;
+	}
+
+#ifdef HAVE_ZLIB
+	buffer_len = sizeof(buffer);
+	error = uncompress(buffer, &buffer_len, datagram + ZHDR_LEN,
+			len - ZHDR_LEN);
+	if (error != Z_OK) {
+		syslog(LOG_ERR, "Dropping a compressed datagram that cannot be inflated: %s",
+				zError(error));
+		return -EINVAL;
+	}
+
+	*plain = buffer;
+	*plain_len = buffer_len;
+	return 1;
+#else
+	syslog(LOG_ERR, "Dropping a compressed datagram; joold was built without zlib.");
+	return -ENOTSUP;
+#endif
+}
+
+/* Hands a datagram from the network over to the kernel. */
+static void rcv_datagram(unsigned char *datagram, size_t len)
+{
+	unsigned char *plain;
+	size_t plain_len;
+	int result;
+
+	if (!seq_receive(&msk, &datagram, &len))
+		return;
+
+	result = mcast_inflate(datagram, len, &plain, &plain_len);
+	if (result < 0)
+		return;
+	if (result > 0)
+		netsocket_pkts_decompressed++;
+	modsocket_send(plain, plain_len);
 }
 
 void *netsocket_listen(void *arg)
 {
-	char buffer[JOOLD_MAX_PAYLOAD];
-	int bytes;
+	struct mmsghdr *msgs;
+	int count;
+	int i;
+
+	if (stream) {
+		streamsocket_listen();
+		return NULL;
+	}
+
+	msgs = mcast_alloc_msgs(msk.batch_size);
+	if (!msgs) {
+		syslog(LOG_ERR, "Out of memory; cannot listen to the network.");
+		return NULL;
+	}
+	pthread_cleanup_push(free_msgs_cb, msgs);
 
 	syslog(LOG_INFO, "Listening...");
 
 	do {
-		bytes = recv(sk, buffer, sizeof(buffer), 0);
-		if (bytes < 0) {
-			pr_perror("Error receiving packet from the network",
+		count = recvmmsg(msk.fd, msgs, msk.batch_size, MSG_WAITFORONE,
+				NULL);
+		if (count < 0) {
+			pr_perror("Error receiving packets from the network",
 					errno);
 			continue;
 		}
 
-		netsocket_pkts_rcvd++;
-		netsocket_bytes_rcvd += bytes;
+		if (count > 0) {
+			netsocket_rx_batches++;
+			netsocket_rx_batch_items += count;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+				syslog(LOG_ERR, "Dropping a datagram that exceeds %d bytes.",
+						MCAST_BUFFER_SIZE);
+				continue;
+			}
 
-		syslog(LOG_DEBUG, "Received %d bytes from the network.", bytes);
-		modsocket_send(buffer, bytes);
+			netsocket_pkts_rcvd++;
+			netsocket_bytes_rcvd += msgs[i].msg_len;
+
+			syslog(LOG_DEBUG, "Received %u bytes from the network.",
+					msgs[i].msg_len);
+			rcv_datagram(msgs[i].msg_hdr.msg_iov->iov_base,
+					msgs[i].msg_len);
+		}
 	} while (true);
 
+	pthread_cleanup_pop(1);
 	return NULL;
 }
 
+unsigned int netsocket_queue_depth(void)
+{
+	return ring_count(&tx_ring);
+}
+
+struct seq_counters *netsocket_seq_counters(void)
+{
+	return &msk.seq.counters;
+}
+
+/* Called by the mod socket whenever the kernel sends sessions. */
 void netsocket_send(void *buffer, size_t size)
 {
-	int bytes;
-
-	syslog(LOG_DEBUG, "Sending %zu bytes to the network...", size);
-	bytes = sendto(sk, buffer, size, 0,
-			bound_address->ai_addr,
-			bound_address->ai_addrlen);
-	if (bytes < 0)
-		pr_perror("Could not send a packet to the network", errno);
-	else {
-		syslog(LOG_DEBUG, "Sent %d bytes to the network.\n", bytes);
-		netsocket_pkts_sent++;
-		netsocket_bytes_sent += bytes;
+	int error;
+
+	error = ring_push(&tx_ring, buffer, size);
+	if (error)
+		pr_perror("Cannot queue sessions for the network", -error);
+}
+
+/*
+ * Packs the queued kernel messages into a datagram, then releases them.
+ * (Kernel messages are streams of Netlink attributes, so the receiving
+ * kernel doesn't mind them being concatenated.)
+ * Returns the length of the datagram.
+ */
+static size_t coalesce(struct ring_slot *slot, unsigned char *buffer)
+{
+	size_t len = 0;
+
+	do {
+		/* A lone oversized message goes out as is. */
+		if (len > 0 && len + slot->len > msk.max_datagram_size)
+			break;
+		memcpy(buffer + len, slot->data, slot->len);
+		len += slot->len;
+		ring_release(&tx_ring);
+		slot = ring_peek(&tx_ring, false);
+	} while (slot);
+
+	return len;
+}
+
+/*
+ * Deflates the @len-byte @datagram in place, if @ms wants it and that makes it
+ * smaller. Returns the new length.
+ */
+size_t mcast_compress(struct mcast_socket const *ms, unsigned char *datagram,
+		size_t len)
+{
+#ifdef HAVE_ZLIB
+	static unsigned char buffer[ZHDR_LEN + JOOLD_MAX_PAYLOAD];
+	uLongf zlen;
+
+	if (!ms->compress)
+		return len;
+
+	/* Whatever doesn't fit in the original's space isn't worth it. */
+	zlen = sizeof(buffer) - ZHDR_LEN;
+	if (compress2(buffer + ZHDR_LEN, &zlen, datagram, len, Z_BEST_SPEED)
+			!= Z_OK)
+		return len;
+	if (ZHDR_LEN + zlen >= len)
+		return len;
+
+	memcpy(buffer, ZHDR, ZHDR_LEN);
+	memcpy(datagram, buffer, ZHDR_LEN + zlen);
+	return ZHDR_LEN + zlen;
+#else
+	return len;
+#endif
+}
+
+static size_t compress_datagram(unsigned char *datagram, size_t len)
+{
+	size_t result;
+
+	result = mcast_compress(&msk, datagram, len);
+	if (result != len)
+		netsocket_pkts_compressed++;
+	return result;
+}
+
+/**
+ * Sends the first @count datagrams of @msgs through @ms, retrying the partial
+ * sends. Returns the number of datagrams that made it; @bytes is their length.
+ */
+unsigned int mcast_send(struct mcast_socket *ms, struct mmsghdr *msgs,
+		unsigned int count, size_t *bytes)
+{
+	unsigned int sent;
+	unsigned int delivered;
+	unsigned int i;
+	int result;
+
+	delivered = 0;
+	*bytes = 0;
+	for (sent = 0; sent < count; sent += result) {
+		result = sendmmsg(ms->fd, msgs + sent, count - sent, 0);
+		if (result < 0) {
+			if (errno == EINTR) {
+				result = 0;
+				continue;
+			}
+			/* Only the first one failed; skip it. */
+			pr_perror("Could not send a packet to the network",
+					errno);
+			result = 1;
+			continue;
+		}
+
+		for (i = sent; i < sent + result; i++) {
+			syslog(LOG_DEBUG, "Sent %u bytes to the network.",
+					msgs[i].msg_len);
+			delivered++;
+			*bytes += msgs[i].msg_len;
+		}
+	}
+
+	return delivered;
+}
+
+/* Points the @count headers of @msgs to @ms's multicast group. */
+void mcast_address_msgs(struct mcast_socket const *ms, struct mmsghdr *msgs,
+		unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		msgs[i].msg_hdr.msg_name = ms->bound->ai_addr;
+		msgs[i].msg_hdr.msg_namelen = ms->bound->ai_addrlen;
+	}
+}
+
+void *netsocket_transmit(void *arg)
+{
+	struct mmsghdr *msgs;
+	struct ring_slot *slot;
+	struct iovec *iov;
+	unsigned int count;
+	size_t bytes;
+
+	if (stream) {
+		/* A stream doesn't need datagram packing. */
+		do {
+			slot = ring_peek(&tx_ring, true);
+			if (!slot)
+				continue;
+			streamsocket_send(slot->data, slot->len);
+			ring_release(&tx_ring);
+			netsocket_tx_batches++;
+			netsocket_tx_batch_items++;
+		} while (true);
+		return NULL;
 	}
+
+	msgs = mcast_alloc_msgs(msk.batch_size);
+	if (!msgs) {
+		syslog(LOG_ERR, "Out of memory; cannot send to the network.");
+		return NULL;
+	}
+	pthread_cleanup_push(free_msgs_cb, msgs);
+
+	mcast_address_msgs(&msk, msgs, msk.batch_size);
+
+	do {
+		/* Sleep until the kernel sends something... */
+		slot = ring_peek(&tx_ring, true);
+		/* ...then send everything it has queued so far. */
+		for (count = 0; slot && count < msk.batch_size; count++) {
+			iov = msgs[count].msg_hdr.msg_iov;
+			iov->iov_len = compress_datagram(iov->iov_base,
+					coalesce(slot, iov->iov_base));
+			iov->iov_len = seq_stamp(&msk.seq, iov->iov_base,
+					iov->iov_len);
+			slot = ring_peek(&tx_ring, false);
+		}
+
+		syslog(LOG_DEBUG, "Sending %u datagram(s) to the network...",
+				count);
+		netsocket_pkts_sent += mcast_send(&msk, msgs, count, &bytes);
+		netsocket_bytes_sent += bytes;
+		netsocket_tx_batches++;
+		netsocket_tx_batch_items += count;
+	} while (true);
+
+	pthread_cleanup_pop(1);
+	return NULL;
 }
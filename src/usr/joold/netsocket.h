@@ -5,12 +5,66 @@
  * This is the socket we use to talk to other joold instances in the network.
  */
 
+#include <stdbool.h>
 #include <stddef.h>
+#include "common/config.h"
+#include "usr/joold/sequence.h"
+#include "usr/util/cJSON.h"
 
 int netsocket_setup(int argc, char **argv);
 void netsocket_teardown(void);
 
+/* Network to ring to module */
 void *netsocket_listen(void *arg);
+/* Module to ring to network */
 void netsocket_send(void *buffer, size_t size);
+void *netsocket_transmit(void *arg);
+
+/* Number of kernel messages waiting to be sent to the network. */
+unsigned int netsocket_queue_depth(void);
+/* The multicast socket's loss recovery counters. */
+struct seq_counters *netsocket_seq_counters(void);
+
+/*
+ * The multicast (UDP) socket itself, so the multi-instance loop can run several
+ * of them.
+ */
+
+/* Size of the datagram buffers. (Payload, plus the sequence header.) */
+#define MCAST_BUFFER_SIZE (JOOLD_MAX_PAYLOAD + SEQ_HDR_LEN)
+
+struct mcast_socket {
+	int fd;
+	/** Processed version of the configuration's hostname and service. */
+	struct addrinfo *candidates;
+	/** Candidate from @candidates that the socket was bound to. */
+	struct addrinfo *bound;
+
+	/** Maximum number of datagrams per recvmmsg() and sendmmsg(). */
+	unsigned int batch_size;
+	/** Outgoing datagrams carry as many kernel messages as fit in this. */
+	unsigned int max_datagram_size;
+	/** Deflate outgoing datagrams? */
+	bool compress;
+	/** Sequence numbers and retransmissions. */
+	struct seq_state seq;
+};
+
+struct mmsghdr;
+
+int mcast_socket_open(cJSON *json, struct mcast_socket *ms);
+void mcast_socket_close(struct mcast_socket *ms);
+
+struct mmsghdr *mcast_alloc_msgs(unsigned int count);
+void mcast_free_msgs(struct mmsghdr *msgs);
+void mcast_address_msgs(struct mcast_socket const *ms, struct mmsghdr *msgs,
+		unsigned int count);
+
+size_t mcast_compress(struct mcast_socket const *ms, unsigned char *datagram,
+		size_t len);
+int mcast_inflate(unsigned char *datagram, size_t len,
+		unsigned char **plain, size_t *plain_len);
+unsigned int mcast_send(struct mcast_socket *ms, struct mmsghdr *msgs,
+		unsigned int count, size_t *bytes);
 
 #endif /* SRC_USR_JOOLD_NETSOCKET_H_ */
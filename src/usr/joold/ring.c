@@ -0,0 +1,113 @@
+#include "usr/joold/ring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+int ring_init(struct ring *ring, unsigned int capacity)
+{
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+		return -EINVAL;
+
+	ring->slots = malloc(capacity * sizeof(*ring->slots));
+	if (!ring->slots)
+		return -ENOMEM;
+
+	if (sem_init(&ring->items, 0, 0))
+		goto items_fail;
+	if (sem_init(&ring->space, 0, capacity))
+		goto space_fail;
+
+	ring->mask = capacity - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	ring->peeked = false;
+	return 0;
+
+space_fail:
+	sem_destroy(&ring->items);
+items_fail:
+	free(ring->slots);
+	return -errno;
+}
+
+void ring_destroy(struct ring *ring)
+{
+	sem_destroy(&ring->space);
+	sem_destroy(&ring->items);
+	free(ring->slots);
+}
+
+/* Restarts sem_wait() on signals; returns nonzero only if @sem is broken. */
+static int wait_sem(sem_t *sem)
+{
+	while (sem_wait(sem)) {
+		if (errno != EINTR)
+			return -errno;
+	}
+	return 0;
+}
+
+int ring_push(struct ring *ring, void const *data, size_t len)
+{
+	struct ring_slot *slot;
+	unsigned int tail;
+	int error;
+
+	if (len > sizeof(slot->data))
+		return -EMSGSIZE;
+
+	error = wait_sem(&ring->space);
+	if (error)
+		return error;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	slot = &ring->slots[tail & ring->mask];
+	memcpy(slot->data, data, len);
+	slot->len = len;
+	/* Publish the slot's content before the index. */
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	sem_post(&ring->items);
+	return 0;
+}
+
+struct ring_slot *ring_peek(struct ring *ring, bool wait)
+{
+	unsigned int head;
+
+	if (!ring->peeked) {
+		if (wait) {
+			if (wait_sem(&ring->items))
+				return NULL;
+		} else if (sem_trywait(&ring->items)) {
+			return NULL;
+		}
+		ring->peeked = true;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	/* Pairs with ring_push()'s release. */
+	atomic_load_explicit(&ring->tail, memory_order_acquire);
+	return &ring->slots[head & ring->mask];
+}
+
+void ring_release(struct ring *ring)
+{
+	unsigned int head;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	ring->peeked = false;
+
+	sem_post(&ring->space);
+}
+
+unsigned int ring_count(struct ring *ring)
+{
+	unsigned int head, tail;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	return tail - head;
+}
@@ -0,0 +1,59 @@
+#ifndef SRC_USR_JOOLD_RING_H_
+#define SRC_USR_JOOLD_RING_H_
+
+/**
+ * A bounded queue of joold payloads, between one producer thread and one
+ * consumer thread.
+ *
+ * The indexes are atomics; the threads never lock each other out. The
+ * semaphores are only there so they can sleep when there's nothing to do.
+ */
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/config.h"
+
+/* Default number of slots. Each one is JOOLD_MAX_PAYLOAD bytes long. */
+#define RING_CAPACITY 256
+
+struct ring_slot {
+	size_t len;
+	unsigned char data[JOOLD_MAX_PAYLOAD];
+};
+
+struct ring {
+	struct ring_slot *slots;
+	unsigned int mask;
+
+	/* Next slot the consumer will read. Only the consumer writes it. */
+	atomic_uint head;
+	/* Next slot the producer will write. Only the producer writes it. */
+	atomic_uint tail;
+
+	sem_t items; /* Occupied slots */
+	sem_t space; /* Free slots */
+
+	/* Has the consumer already claimed (but not released) the head? */
+	bool peeked;
+};
+
+/* @capacity has to be a power of two. */
+int ring_init(struct ring *ring, unsigned int capacity);
+void ring_destroy(struct ring *ring);
+
+/* Producer only. Waits until there's room for the copy of @data. */
+int ring_push(struct ring *ring, void const *data, size_t len);
+
+/*
+ * Consumer only. Returns the oldest slot; it stays in the ring until
+ * ring_release(). If @wait is false and the ring is empty, returns NULL.
+ */
+struct ring_slot *ring_peek(struct ring *ring, bool wait);
+void ring_release(struct ring *ring);
+
+/* Number of occupied slots. Any thread; it's only a snapshot. */
+unsigned int ring_count(struct ring *ring);
+
+#endif /* SRC_USR_JOOLD_RING_H_ */
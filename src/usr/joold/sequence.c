@@ -0,0 +1,371 @@
+#include "usr/joold/sequence.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "netsocket.h"
+
+/*
+ * Sequenced datagrams start with SHDR, NACKs with NHDR. Read as Netlink
+ * attribute headers, they're 65535-byte attributes. (See ZHDR.)
+ */
+static unsigned char const SHDR[] = { 0xFF, 0xFF, 'J', 'S' };
+static unsigned char const NHDR[] = { 0xFF, 0xFF, 'J', 'N' };
+#define MAGIC_LEN 4
+/* Magic, NACKer's ID, sender's ID, first missing number, count. */
+#define NACK_LEN 20
+
+/*
+ * A datagram is not resent again this soon. Every receiver that lost it NACKs
+ * it, and one (multicast) retransmission serves them all.
+ */
+#define RESEND_INTERVAL_MS 20
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+#define WINDOW_WORDS (SEQ_WINDOW / BITS_PER_WORD)
+
+static void put_be32(unsigned char *buffer, __u32 value)
+{
+	value = htonl(value);
+	memcpy(buffer, &value, sizeof(value));
+}
+
+static __u32 get_be32(unsigned char const *buffer)
+{
+	__u32 value;
+	memcpy(&value, buffer, sizeof(value));
+	return ntohl(value);
+}
+
+static unsigned long long now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+}
+
+static bool is_missing(struct seq_peer const *peer, __u32 seq)
+{
+	unsigned int bit = seq % SEQ_WINDOW;
+	return peer->missing[bit / BITS_PER_WORD]
+			& (1ul << (bit % BITS_PER_WORD));
+}
+
+static void set_missing(struct seq_peer *peer, __u32 seq)
+{
+	unsigned int bit = seq % SEQ_WINDOW;
+	peer->missing[bit / BITS_PER_WORD] |= 1ul << (bit % BITS_PER_WORD);
+}
+
+static void clear_missing(struct seq_peer *peer, __u32 seq)
+{
+	unsigned int bit = seq % SEQ_WINDOW;
+	peer->missing[bit / BITS_PER_WORD] &= ~(1ul << (bit % BITS_PER_WORD));
+}
+
+static struct seq_datagram *get_slot(struct seq_state *seq, __u32 number)
+{
+	return (struct seq_datagram *)(seq->history
+			+ (number % seq->history_size) * seq->slot_size);
+}
+
+/*
+ * @max_datagram_size is the size of the largest datagram seq_stamp() will
+ * return. (Header included.)
+ */
+int seq_init(struct seq_state *seq, unsigned int history_size,
+		size_t max_datagram_size)
+{
+	int error;
+
+	memset(seq, 0, sizeof(*seq));
+
+	/* The receiver needs an ID too; it signs the NACKs. */
+	if (getrandom(&seq->id, sizeof(seq->id), 0) != sizeof(seq->id))
+		seq->id = time(NULL) ^ getpid();
+
+	error = pthread_mutex_init(&seq->lock, NULL);
+	if (error) {
+		pr_perror("Cannot initialize the retransmission history's mutex",
+				error);
+		return -error;
+	}
+
+	if (history_size == 0)
+		return 0;
+
+	seq->slot_size = sizeof(struct seq_datagram) + max_datagram_size;
+	seq->slot_size = (seq->slot_size + 7) & ~(size_t)7;
+	seq->history = calloc(history_size, seq->slot_size);
+	if (!seq->history) {
+		syslog(LOG_ERR, "Out of memory; cannot allocate the retransmission history.");
+		pthread_mutex_destroy(&seq->lock);
+		return -ENOMEM;
+	}
+
+	seq->history_size = history_size;
+	return 0;
+}
+
+void seq_destroy(struct seq_state *seq)
+{
+	free(seq->history);
+	pthread_mutex_destroy(&seq->lock);
+}
+
+/**
+ * Prefixes the @len-byte @datagram with its sequence header, and keeps a copy
+ * in the history. @datagram needs room for SEQ_HDR_LEN more bytes.
+ * Returns the new length. (If sequencing is disabled, @datagram is untouched.)
+ *
+ * Transmitter only.
+ */
+size_t seq_stamp(struct seq_state *seq, unsigned char *datagram, size_t len)
+{
+	struct seq_datagram *slot;
+	__u32 number;
+
+	if (seq->history_size == 0)
+		return len;
+
+	number = seq->next++;
+	memmove(datagram + SEQ_HDR_LEN, datagram, len);
+	memcpy(datagram, SHDR, MAGIC_LEN);
+	put_be32(datagram + 4, seq->id);
+	put_be32(datagram + 8, number);
+	len += SEQ_HDR_LEN;
+
+	pthread_mutex_lock(&seq->lock);
+	slot = get_slot(seq, number);
+	slot->seq = number;
+	slot->valid = true;
+	slot->resent = 0;
+	slot->len = len;
+	memcpy(slot->data, datagram, len);
+	pthread_mutex_unlock(&seq->lock);
+
+	return len;
+}
+
+static void send_to_group(struct mcast_socket *ms, void const *data,
+		size_t len)
+{
+	if (sendto(ms->fd, data, len, 0, ms->bound->ai_addr,
+			ms->bound->ai_addrlen) < 0)
+		pr_perror("Could not send a packet to the network", errno);
+}
+
+/* Resends the datagrams @nack asks for, if they're ours and still kept. */
+static void handle_nack(struct mcast_socket *ms, unsigned char const *nack,
+		size_t len)
+{
+	struct seq_state *seq = &ms->seq;
+	struct seq_datagram *slot;
+	unsigned long long now;
+	__u32 first;
+	__u32 count;
+	__u32 i;
+
+	if (len < NACK_LEN || seq->history_size == 0)
+		return;
+	if (get_be32(nack + 8) != seq->id)
+		return; /* Somebody else's datagrams. */
+
+	first = get_be32(nack + 12);
+	count = get_be32(nack + 16);
+	/* The older ones are gone anyway. */
+	if (count > seq->history_size) {
+		first += count - seq->history_size;
+		count = seq->history_size;
+	}
+
+	now = now_ms();
+
+	pthread_mutex_lock(&seq->lock);
+	for (i = 0; i < count; i++) {
+		slot = get_slot(seq, first + i);
+		if (!slot->valid || slot->seq != first + i)
+			continue; /* Overridden, or never sent. */
+		if (slot->resent && now - slot->resent < RESEND_INTERVAL_MS)
+			continue;
+
+		slot->resent = now;
+		send_to_group(ms, slot->data, slot->len);
+		seq->counters.resent++;
+	}
+	pthread_mutex_unlock(&seq->lock);
+}
+
+static void send_nack(struct mcast_socket *ms, __u32 sender, __u32 first,
+		__u32 count)
+{
+	unsigned char nack[NACK_LEN];
+
+	memcpy(nack, NHDR, MAGIC_LEN);
+	put_be32(nack + 4, ms->seq.id);
+	put_be32(nack + 8, sender);
+	put_be32(nack + 12, first);
+	put_be32(nack + 16, count);
+
+	syslog(LOG_DEBUG, "Asking peer %08x for %u datagram(s) starting at #%u.",
+			sender, count, first);
+	send_to_group(ms, nack, sizeof(nack));
+	ms->seq.counters.nacks++;
+}
+
+/*
+ * Returns @id's state. If we weren't following @id, recycles the peer that's
+ * been quiet the longest, and sets @fresh.
+ */
+static struct seq_peer *get_peer(struct seq_state *seq, __u32 id, bool *fresh)
+{
+	struct seq_peer *peer;
+	struct seq_peer *victim = NULL;
+	time_t now = time(NULL);
+	unsigned int i;
+
+	for (i = 0; i < SEQ_MAX_PEERS; i++) {
+		peer = &seq->peers[i];
+		if (!peer->used) {
+			if (!victim || victim->used)
+				victim = peer;
+			continue;
+		}
+		if (peer->id == id) {
+			peer->last_seen = now;
+			*fresh = false;
+			return peer;
+		}
+		if (!victim || (victim->used
+				&& peer->last_seen < victim->last_seen))
+			victim = peer;
+	}
+
+	memset(victim, 0, sizeof(*victim));
+	victim->used = true;
+	victim->id = id;
+	victim->last_seen = now;
+	*fresh = true;
+	return victim;
+}
+
+/*
+ * @number is ahead of @peer's latest. Moves the window forward, marking the
+ * skipped numbers as missing, and writing off the ones that fall off the back.
+ * Returns the number of datagrams skipped.
+ */
+static __u32 advance(struct seq_state *seq, struct seq_peer *peer,
+		__u32 number)
+{
+	__u32 skipped = number - peer->next;
+	unsigned long long lost = 0;
+	unsigned int i;
+	__u32 q;
+
+	if (skipped >= SEQ_WINDOW) {
+		/* The whole window is new, and most of it is missing. */
+		for (i = 0; i < WINDOW_WORDS; i++) {
+			lost += __builtin_popcountl(peer->missing[i]);
+			peer->missing[i] = ~0ul;
+		}
+		lost += skipped - (SEQ_WINDOW - 1);
+	} else {
+		/* Each bit is recycled into the number SEQ_WINDOW ahead. */
+		for (q = peer->next; q != number; q++) {
+			if (is_missing(peer, q))
+				lost++;
+			set_missing(peer, q);
+		}
+		if (is_missing(peer, number))
+			lost++;
+	}
+
+	clear_missing(peer, number);
+	peer->next = number + 1;
+
+	seq->counters.missing += skipped;
+	if (lost) {
+		seq->counters.unrecoverable += lost;
+		syslog(LOG_WARNING, "%llu datagram(s) from peer %08x were lost for good. (Consider `jool joold advertise`.)",
+				lost, peer->id);
+	}
+
+	return skipped;
+}
+
+/**
+ * Receives the @len-byte datagram @ms got from the network.
+ *
+ * If it's a NACK, serves it. If it's sequenced, updates the sender's window,
+ * NACKs whatever it skipped, and points @datagram and @len to the payload.
+ *
+ * Returns whether the payload should be handed to the kernel. (False for
+ * NACKs, duplicates, our own datagrams looped back, and the ones too old to
+ * tell.)
+ *
+ * Listener only.
+ */
+bool seq_receive(struct mcast_socket *ms, unsigned char **datagram,
+		size_t *len)
+{
+	struct seq_state *seq = &ms->seq;
+	unsigned char *hdr = *datagram;
+	struct seq_peer *peer;
+	__u32 id, number;
+	__u32 first, skipped;
+	bool fresh;
+
+	if (*len < MAGIC_LEN)
+		return true;
+	if (memcmp(hdr, NHDR, MAGIC_LEN) == 0) {
+		handle_nack(ms, hdr, *len);
+		return false;
+	}
+	if (memcmp(hdr, SHDR, MAGIC_LEN) != 0)
+		return true; /* Unsequenced; eg. from a kernel transport. */
+	if (*len < SEQ_HDR_LEN)
+		return false;
+
+	id = get_be32(hdr + 4);
+	number = get_be32(hdr + 8);
+	*datagram += SEQ_HDR_LEN;
+	*len -= SEQ_HDR_LEN;
+
+	if (id == seq->id)
+		return false;
+
+	peer = get_peer(seq, id, &fresh);
+	if (fresh) {
+		/* Whatever it sent before we met is not our business. */
+		peer->next = number + 1;
+		return true;
+	}
+
+	if ((__s32)(number - peer->next) >= 0) {
+		first = peer->next;
+		skipped = advance(seq, peer, number);
+		if (skipped >= SEQ_WINDOW)
+			send_nack(ms, id, number - (SEQ_WINDOW - 1),
+					SEQ_WINDOW - 1);
+		else if (skipped > 0)
+			send_nack(ms, id, first, skipped);
+		return true;
+	}
+
+	if (peer->next - number > SEQ_WINDOW)
+		return false; /* Too old; already written off, if missing. */
+	if (!is_missing(peer, number))
+		return false; /* Duplicate */
+
+	clear_missing(peer, number);
+	seq->counters.recovered++;
+	return true;
+}
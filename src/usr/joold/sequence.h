@@ -0,0 +1,97 @@
+#ifndef SRC_USR_JOOLD_SEQUENCE_H_
+#define SRC_USR_JOOLD_SEQUENCE_H_
+
+/**
+ * Loss recovery for the multicast (UDP) transport.
+ *
+ * If the "retransmission history" is nonzero, each outgoing datagram is
+ * prefixed with the sender's ID and a sequence number, and the last "history"
+ * datagrams are kept. Receivers follow every sender's sequence; when one
+ * skips, they multicast a NACK naming the missing numbers, and the sender
+ * resends them, if it still has them. Missing datagrams that fall out of the
+ * receiver's window before they arrive are written off as unrecoverable.
+ *
+ * Both headers start with 0xFFFF, like the compression header, so they can't
+ * be mistaken for Netlink attributes. Unsequenced datagrams are still accepted.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <linux/types.h>
+
+/* Magic, sender ID, sequence number. */
+#define SEQ_HDR_LEN 12
+/* How far behind a sender's latest datagram a receiver still waits for one. */
+#define SEQ_WINDOW 1024
+/* Senders a receiver can follow at once. */
+#define SEQ_MAX_PEERS 32
+#define SEQ_MAX_HISTORY 65536
+
+struct seq_counters {
+	/** Datagrams found missing from the peers' sequences. */
+	atomic_ullong missing;
+	/** Missing datagrams that arrived later. (Usually, retransmitted.) */
+	atomic_ullong recovered;
+	/** Missing datagrams that fell out of the window. */
+	atomic_ullong unrecoverable;
+	/** NACKs sent. */
+	atomic_ullong nacks;
+	/** Datagrams resent because of the peers' NACKs. */
+	atomic_ullong resent;
+};
+
+struct seq_datagram {
+	__u32 seq;
+	bool valid;
+	/** When it was last resent, in milliseconds. Zero if never. */
+	unsigned long long resent;
+	size_t len;
+	unsigned char data[];
+};
+
+/* A sender, as seen by a receiver. */
+struct seq_peer {
+	bool used;
+	__u32 id;
+	/** Latest sequence number received, plus one. */
+	__u32 next;
+	/** Bit (seq % SEQ_WINDOW) is set if seq hasn't arrived yet. */
+	unsigned long missing[SEQ_WINDOW / (8 * sizeof(unsigned long))];
+	time_t last_seen;
+};
+
+struct seq_state {
+	/** Identifies us among the senders. Random; changes on restart. */
+	__u32 id;
+
+	/*
+	 * Sender. Zero @history_size means the datagrams are not sequenced.
+	 * @next only belongs to the transmitter; the history is shared with
+	 * the listener (which serves the NACKs), so it's protected by @lock.
+	 */
+	unsigned int history_size;
+	size_t slot_size;
+	__u32 next;
+	unsigned char *history;
+	pthread_mutex_t lock;
+
+	/* Receiver. Only the listener touches these. */
+	struct seq_peer peers[SEQ_MAX_PEERS];
+
+	struct seq_counters counters;
+};
+
+struct mcast_socket;
+
+int seq_init(struct seq_state *seq, unsigned int history_size,
+		size_t max_datagram_size);
+void seq_destroy(struct seq_state *seq);
+
+size_t seq_stamp(struct seq_state *seq, unsigned char *datagram, size_t len);
+bool seq_receive(struct mcast_socket *ms, unsigned char **datagram,
+		size_t *len);
+
+#endif /* SRC_USR_JOOLD_SEQUENCE_H_ */
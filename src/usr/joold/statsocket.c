@@ -14,8 +14,9 @@
 #include <sys/socket.h>
 
 #include "log.h"
+#include "netsocket.h"
 
-static int create_socket(char const *port, int *fd)
+int statsocket_open(char const *port, int *fd)
 {
 	int sk;
 	struct addrinfo hints = { 0 };
@@ -69,40 +70,70 @@ extern atomic_int netsocket_bytes_sent;
 
 #define BUFFER_SIZE 1024
 
+/* Waits for a request. (Unless @sk is nonblocking.) */
+bool statsocket_recv(int sk, struct statsocket_request *request)
+{
+	char buffer[BUFFER_SIZE];
+
+	request->addr_len = sizeof(request->addr);
+	return recvfrom(sk, buffer, BUFFER_SIZE, 0,
+			(struct sockaddr *) &request->addr,
+			&request->addr_len) != -1;
+}
+
+void statsocket_reply(int sk, struct statsocket_request const *request,
+		struct statsocket_counters const *counters)
+{
+	int nstr, nwritten;
+	char buffer[BUFFER_SIZE];
+
+	nstr = snprintf(buffer, BUFFER_SIZE,
+			"KERNEL_SENT_PKTS,%d\nKERNEL_SENT_BYTES,%d\n"
+			"NET_RCVD_PKTS,%d\nNET_RCVD_BYTES,%d\n"
+			"NET_SENT_PKTS,%d\nNET_SENT_BYTES,%d\n"
+			"NET_SEQ_MISSING,%llu\nNET_SEQ_RECOVERED,%llu\n"
+			"NET_SEQ_UNRECOVERABLE,%llu\n",
+			counters->kernel_pkts_sent,
+			counters->kernel_bytes_sent,
+			counters->net_pkts_rcvd, counters->net_bytes_rcvd,
+			counters->net_pkts_sent, counters->net_bytes_sent,
+			counters->net_seq_missing, counters->net_seq_recovered,
+			counters->net_seq_unrecoverable);
+	if (nstr >= BUFFER_SIZE)
+		snprintf(buffer, BUFFER_SIZE, "Bug!");
+
+	nwritten = sendto(sk, buffer, nstr, 0,
+			(struct sockaddr *) &request->addr,
+			request->addr_len);
+	if (nwritten != nstr)
+		syslog(LOG_ERR, "statsocket error: %s\n", strerror(errno));
+}
+
 void *serve_stats(void *arg)
 {
 	int sk;
-	struct sockaddr_storage peer_addr;
-	socklen_t peer_addr_len;
-	int nread, nstr, nwritten;
-	char buffer[BUFFER_SIZE];
+	struct statsocket_request request;
+	struct statsocket_counters counters;
+	struct seq_counters *seq;
 
 	sk = *((int *)arg);
+	seq = netsocket_seq_counters();
 	free(arg);
 
 	while (true) {
-		peer_addr_len = sizeof(peer_addr);
-		nread = recvfrom(sk, buffer, BUFFER_SIZE, 0,
-				(struct sockaddr *) &peer_addr,
-				&peer_addr_len);
-		if (nread == -1)
+		if (!statsocket_recv(sk, &request))
 			continue; /* Ignore failed request */
 
-		nstr = snprintf(buffer, BUFFER_SIZE,
-				"KERNEL_SENT_PKTS,%d\nKERNEL_SENT_BYTES,%d\n"
-				"NET_RCVD_PKTS,%d\nNET_RCVD_BYTES,%d\n"
-				"NET_SENT_PKTS,%d\nNET_SENT_BYTES,%d\n",
-				modsocket_pkts_sent, modsocket_bytes_sent,
-				netsocket_pkts_rcvd, netsocket_bytes_rcvd,
-				netsocket_pkts_sent, netsocket_bytes_sent);
-		if (nstr >= BUFFER_SIZE)
-			snprintf(buffer, BUFFER_SIZE, "Bug!");
-
-		nwritten = sendto(sk, buffer, nstr, 0,
-				(struct sockaddr *) &peer_addr,
-				peer_addr_len);
-		if (nwritten != nstr)
-			syslog(LOG_ERR, "statsocket error: %s\n", strerror(errno));
+		counters.kernel_pkts_sent = modsocket_pkts_sent;
+		counters.kernel_bytes_sent = modsocket_bytes_sent;
+		counters.net_pkts_rcvd = netsocket_pkts_rcvd;
+		counters.net_bytes_rcvd = netsocket_bytes_rcvd;
+		counters.net_pkts_sent = netsocket_pkts_sent;
+		counters.net_bytes_sent = netsocket_bytes_sent;
+		counters.net_seq_missing = seq->missing;
+		counters.net_seq_recovered = seq->recovered;
+		counters.net_seq_unrecoverable = seq->unrecoverable;
+		statsocket_reply(sk, &request, &counters);
 	}
 }
 
@@ -116,8 +147,13 @@ int statsocket_start(int argc, char **argv)
 		syslog(LOG_INFO, "statsocket port unavailable; skipping statsocket.");
 		return 0;
 	}
+	/* Lets the metrics config file be provided without the statsocket. */
+	if (strcmp(argv[3], "0") == 0) {
+		syslog(LOG_INFO, "statsocket port is zero; skipping statsocket.");
+		return 0;
+	}
 
-	error = create_socket(argv[3], &sk);
+	error = statsocket_open(argv[3], &sk);
 	if (error)
 		return error;
 
@@ -1,6 +1,34 @@
 #ifndef SRC_USR_JOOLD_STATSOCKET_H_
 #define SRC_USR_JOOLD_STATSOCKET_H_
 
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/* What the statsocket answers. */
+struct statsocket_counters {
+	int kernel_pkts_sent;
+	int kernel_bytes_sent;
+	int net_pkts_rcvd;
+	int net_bytes_rcvd;
+	int net_pkts_sent;
+	int net_bytes_sent;
+	/* See struct seq_counters. */
+	unsigned long long net_seq_missing;
+	unsigned long long net_seq_recovered;
+	unsigned long long net_seq_unrecoverable;
+};
+
+/* Whoever asked. */
+struct statsocket_request {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+};
+
 int statsocket_start(int argc, char **argv);
 
+int statsocket_open(char const *port, int *fd);
+bool statsocket_recv(int sk, struct statsocket_request *request);
+void statsocket_reply(int sk, struct statsocket_request const *request,
+		struct statsocket_counters const *counters);
+
 #endif /* SRC_USR_JOOLD_STATSOCKET_H_ */
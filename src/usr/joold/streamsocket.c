@@ -0,0 +1,437 @@
+#include "usr/joold/streamsocket.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "log.h"
+#include "modsocket.h"
+#include "common/config.h"
+
+/* Peers beyond this number are turned down. */
+#define MAX_PEERS 16
+/* Each message is prefixed by its length, as a big endian 16-bit integer. */
+#define FRAME_HDR_LEN 2
+/* Seconds between attempts to reach the peer, if it's not connected. */
+#define RETRY_INTERVAL 5
+
+struct streamsocket_config {
+	/** Address to listen on. Defaults to NULL, which means "any." */
+	char *listen_addr;
+	/** TCP port to listen on. Defaults to NULL: Don't listen. */
+	char *listen_port;
+	/** Node to connect to. Defaults to NULL: Don't connect. */
+	char *peer_addr;
+	char *peer_port;
+};
+
+struct peer {
+	int fd;
+	/** Did we start the connection? (Do we need to restart it?) */
+	bool outgoing;
+	/** The transmitter found the connection broken; please close it. */
+	bool dead;
+
+	/** Bytes received, but not yet processed. */
+	unsigned char buffer[FRAME_HDR_LEN + JOOLD_MAX_PAYLOAD];
+	size_t len;
+};
+
+/*
+ * Only the listener thread adds or removes peers. It needs to hold the lock
+ * to do so, but not to read them.
+ * The transmitter thread always needs the lock.
+ */
+static struct peer peers[MAX_PEERS];
+static unsigned int peer_count;
+static pthread_mutex_t peers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int listener = -1;
+static struct addrinfo *peer_candidates;
+static bool outgoing_connected;
+static time_t next_attempt;
+
+extern atomic_int netsocket_pkts_rcvd;
+extern atomic_int netsocket_bytes_rcvd;
+extern atomic_int netsocket_pkts_sent;
+extern atomic_int netsocket_bytes_sent;
+
+static char *get_string(cJSON *json, char *field)
+{
+	cJSON *child = cJSON_GetObjectItem(json, field);
+	return child ? child->valuestring : NULL;
+}
+
+static int json_to_config(cJSON *json, struct streamsocket_config *cfg)
+{
+	cfg->listen_addr = get_string(json, "listen address");
+	cfg->listen_port = get_string(json, "listen port");
+	cfg->peer_addr = get_string(json, "peer address");
+	cfg->peer_port = get_string(json, "peer port");
+
+	if (!cfg->listen_port && !cfg->peer_addr) {
+		syslog(LOG_ERR, "The TCP protocol needs a 'listen port', a 'peer address', or both.");
+		return 1;
+	}
+	if (cfg->peer_addr && !cfg->peer_port) {
+		syslog(LOG_ERR, "The field 'peer port' is mandatory when there's a 'peer address'.");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int create_listener(struct streamsocket_config *cfg)
+{
+	struct addrinfo hints = { 0 };
+	struct addrinfo *ais, *ai;
+	int yes = 1;
+	int err;
+
+	syslog(LOG_INFO, "Getting address info of %s#%s...",
+			cfg->listen_addr ? cfg->listen_addr : "(any)",
+			cfg->listen_port);
+
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	err = getaddrinfo(cfg->listen_addr, cfg->listen_port, &hints, &ais);
+	if (err) {
+		syslog(LOG_ERR, "getaddrinfo() failed: %s", gai_strerror(err));
+		return err;
+	}
+
+	for (ai = ais; ai; ai = ai->ai_next) {
+		syslog(LOG_INFO, "Trying an address candidate...");
+
+		listener = socket(ai->ai_family, ai->ai_socktype,
+				ai->ai_protocol);
+		if (listener < 0) {
+			pr_perror("socket() failed", errno);
+			continue;
+		}
+
+		if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes,
+				sizeof(yes))) {
+			pr_perror("setsockopt(SO_REUSEADDR) failed", errno);
+			goto next;
+		}
+		if (bind(listener, ai->ai_addr, ai->ai_addrlen)) {
+			pr_perror("bind() failed", errno);
+			goto next;
+		}
+		if (listen(listener, MAX_PEERS)) {
+			pr_perror("listen() failed", errno);
+			goto next;
+		}
+
+		syslog(LOG_INFO, "Listening for joold peers.");
+		freeaddrinfo(ais);
+		return 0;
+
+next:
+		close(listener);
+		listener = -1;
+	}
+
+	syslog(LOG_ERR, "None of the candidates yielded a valid socket.");
+	freeaddrinfo(ais);
+	return 1;
+}
+
+static int resolve_peer(struct streamsocket_config *cfg)
+{
+	struct addrinfo hints = { 0 };
+	int err;
+
+	hints.ai_socktype = SOCK_STREAM;
+	err = getaddrinfo(cfg->peer_addr, cfg->peer_port, &hints,
+			&peer_candidates);
+	if (err) {
+		syslog(LOG_ERR, "getaddrinfo() failed: %s", gai_strerror(err));
+		return err;
+	}
+
+	return 0;
+}
+
+int streamsocket_setup(cJSON *json)
+{
+	struct streamsocket_config cfg;
+	int error;
+
+	error = json_to_config(json, &cfg);
+	if (error)
+		return error;
+
+	if (cfg.listen_port) {
+		error = create_listener(&cfg);
+		if (error)
+			return error;
+	}
+
+	if (cfg.peer_addr) {
+		error = resolve_peer(&cfg);
+		if (error) {
+			if (listener >= 0)
+				close(listener);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+void streamsocket_teardown(void)
+{
+	unsigned int p;
+
+	for (p = 0; p < peer_count; p++)
+		close(peers[p].fd);
+	peer_count = 0;
+	if (listener >= 0)
+		close(listener);
+	if (peer_candidates)
+		freeaddrinfo(peer_candidates);
+}
+
+static void add_peer(int fd, bool outgoing)
+{
+	struct peer *peer;
+
+	if (peer_count >= MAX_PEERS) {
+		syslog(LOG_ERR, "Too many joold peers; rejecting connection.");
+		close(fd);
+		return;
+	}
+
+	pthread_mutex_lock(&peers_lock);
+	peer = &peers[peer_count];
+	peer->fd = fd;
+	peer->outgoing = outgoing;
+	peer->dead = false;
+	peer->len = 0;
+	peer_count++;
+	pthread_mutex_unlock(&peers_lock);
+
+	if (outgoing)
+		outgoing_connected = true;
+
+	/* The peer might be starting from scratch. Bring it up to date. */
+	syslog(LOG_INFO, "Peer connected; sending it the session table.");
+	modsocket_advertise();
+}
+
+static void rm_peer(unsigned int p)
+{
+	pthread_mutex_lock(&peers_lock);
+	close(peers[p].fd);
+	if (peers[p].outgoing) {
+		outgoing_connected = false;
+		next_attempt = time(NULL) + RETRY_INTERVAL;
+	}
+	peer_count--;
+	if (p != peer_count)
+		peers[p] = peers[peer_count];
+	pthread_mutex_unlock(&peers_lock);
+
+	syslog(LOG_INFO, "A joold peer disconnected.");
+}
+
+static void try_connect(void)
+{
+	struct addrinfo *ai;
+	struct timeval timeout = { .tv_sec = RETRY_INTERVAL };
+	int fd;
+
+	next_attempt = time(NULL) + RETRY_INTERVAL;
+
+	for (ai = peer_candidates; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			pr_perror("socket() failed", errno);
+			continue;
+		}
+
+		/* Bounds connect()'s wait. */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+				sizeof(timeout));
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			add_peer(fd, true);
+			return;
+		}
+
+		syslog(LOG_DEBUG, "Could not reach the joold peer: %s",
+				strerror(errno));
+		close(fd);
+	}
+}
+
+/* Hands the complete messages in @peer's buffer over to the kernel. */
+static int process_frames(struct peer *peer)
+{
+	unsigned char *frame;
+	size_t frame_len;
+	size_t offset;
+
+	offset = 0;
+	while (peer->len - offset >= FRAME_HDR_LEN) {
+		frame = peer->buffer + offset;
+		frame_len = (frame[0] << 8) | frame[1];
+		if (frame_len > JOOLD_MAX_PAYLOAD) {
+			syslog(LOG_ERR, "joold peer sent a %zu-byte message; the maximum is %d.",
+					frame_len, JOOLD_MAX_PAYLOAD);
+			return -EINVAL;
+		}
+		if (peer->len - offset < FRAME_HDR_LEN + frame_len)
+			break;
+
+		netsocket_pkts_rcvd++;
+		netsocket_bytes_rcvd += frame_len;
+		modsocket_send(frame + FRAME_HDR_LEN, frame_len);
+		offset += FRAME_HDR_LEN + frame_len;
+	}
+
+	peer->len -= offset;
+	memmove(peer->buffer, peer->buffer + offset, peer->len);
+	return 0;
+}
+
+static int read_peer(struct peer *peer)
+{
+	ssize_t bytes;
+
+	bytes = recv(peer->fd, peer->buffer + peer->len,
+			sizeof(peer->buffer) - peer->len, 0);
+	if (bytes < 0) {
+		if (errno == EINTR)
+			return 0;
+		pr_perror("Error receiving from a joold peer", errno);
+		return -errno;
+	}
+	if (bytes == 0)
+		return -ECONNRESET;
+
+	peer->len += bytes;
+	return process_frames(peer);
+}
+
+void streamsocket_listen(void)
+{
+	struct pollfd fds[MAX_PEERS + 1];
+	struct pollfd *peer_fds;
+	unsigned int polled;
+	unsigned int nfds;
+	unsigned int p;
+	int fd;
+
+	syslog(LOG_INFO, "Listening...");
+
+	do {
+		if (peer_candidates && !outgoing_connected
+				&& time(NULL) >= next_attempt)
+			try_connect();
+
+		nfds = 0;
+		if (listener >= 0) {
+			fds[nfds].fd = listener;
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+		peer_fds = &fds[nfds];
+		polled = peer_count;
+		for (p = 0; p < polled; p++) {
+			peer_fds[p].fd = peers[p].fd;
+			peer_fds[p].events = POLLIN;
+		}
+		nfds += polled;
+
+		if (poll(fds, nfds, 1000 * RETRY_INTERVAL) < 0) {
+			if (errno != EINTR)
+				pr_perror("poll() failed", errno);
+			continue;
+		}
+
+		/*
+		 * Backwards, because rm_peer() moves the last peer to the
+		 * removed one's slot.
+		 */
+		for (p = polled; p-- > 0;) {
+			if (peers[p].dead || ((peer_fds[p].revents
+					& (POLLIN | POLLHUP | POLLERR))
+					&& read_peer(&peers[p])))
+				rm_peer(p);
+		}
+
+		if (listener >= 0 && (fds[0].revents & POLLIN)) {
+			fd = accept(listener, NULL, NULL);
+			if (fd >= 0)
+				add_peer(fd, false);
+			else
+				pr_perror("accept() failed", errno);
+		}
+	} while (true);
+}
+
+static int send_all(int fd, unsigned char const *buffer, size_t len)
+{
+	ssize_t bytes;
+
+	while (len > 0) {
+		bytes = send(fd, buffer, len, MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buffer += bytes;
+		len -= bytes;
+	}
+
+	return 0;
+}
+
+void streamsocket_send(void const *buffer, size_t size)
+{
+	static unsigned char frame[FRAME_HDR_LEN + JOOLD_MAX_PAYLOAD];
+	unsigned int p;
+	int error;
+
+	if (size > JOOLD_MAX_PAYLOAD) {
+		syslog(LOG_ERR, "Kernel message is too big (%zu bytes); dropping.",
+				size);
+		return;
+	}
+
+	frame[0] = size >> 8;
+	frame[1] = size & 0xFF;
+	memcpy(frame + FRAME_HDR_LEN, buffer, size);
+
+	pthread_mutex_lock(&peers_lock);
+	for (p = 0; p < peer_count; p++) {
+		if (peers[p].dead)
+			continue;
+
+		error = send_all(peers[p].fd, frame, FRAME_HDR_LEN + size);
+		if (error) {
+			pr_perror("Could not send sessions to a joold peer",
+					-error);
+			/* Wake the listener up, so it closes it. */
+			peers[p].dead = true;
+			shutdown(peers[p].fd, SHUT_RDWR);
+			continue;
+		}
+
+		netsocket_pkts_sent++;
+		netsocket_bytes_sent += size;
+	}
+	pthread_mutex_unlock(&peers_lock);
+}
@@ -0,0 +1,26 @@
+#ifndef SRC_USR_JOOLD_STREAMSOCKET_H_
+#define SRC_USR_JOOLD_STREAMSOCKET_H_
+
+/**
+ * The alternative to the multicast net socket: TCP connections to specific
+ * peers.
+ *
+ * Every kernel message is sent to every connected peer, prefixed by its
+ * length. Whenever a connection is established, the local kernel module is
+ * asked to advertise its entire session table through it, so a freshly started
+ * peer converges right away, instead of waiting for traffic to refresh its
+ * sessions. Incremental updates follow.
+ */
+
+#include <stddef.h>
+#include "usr/util/cJSON.h"
+
+int streamsocket_setup(cJSON *json);
+void streamsocket_teardown(void);
+
+/* Accepts connections and receives; meant to run in its own thread. */
+void streamsocket_listen(void);
+/* Sends @size bytes from @buffer to every connected peer. */
+void streamsocket_send(void const *buffer, size_t size);
+
+#endif /* SRC_USR_JOOLD_STREAMSOCKET_H_ */
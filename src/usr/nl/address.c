@@ -1,6 +1,7 @@
 #include "usr/nl/address.h"
 
 #include <errno.h>
+#include <string.h>
 #include "usr/nl/common.h"
 #include "usr/nl/attribute.h"
 
@@ -121,3 +122,124 @@ struct jool_result joolnl_address_query46(struct joolnl_socket *sk,
 nla_put_failure:
 	return joolnl_err_msgsize();
 }
+
+/*
+ * Queries per _BULK request; as many results as a large response can hold.
+ * (Minus the headers.)
+ */
+#define BULK_BATCH ((JOOLNL_LARGE_MSG_SIZE - 256) \
+		/ sizeof(struct addrxlat_bulk_result))
+
+struct bulk_args {
+	/* Where the current request's results go */
+	struct addrxlat_bulk_result *results;
+	/* Queries of the current request; also, results received. */
+	unsigned int count;
+};
+
+static struct jool_result handle_bulk_response(struct nl_msg *response,
+		void *arg)
+{
+	static struct nla_policy bulk_policy[JNLAR_COUNT] = {
+		[JNLAR_ADDR_RESULTS] = { .type = NLA_UNSPEC },
+	};
+	struct bulk_args *args = arg;
+	struct nlattr *attrs[JNLAR_COUNT];
+	unsigned int received;
+	struct jool_result result;
+
+	result = jnla_parse_msg(response, attrs, JNLAR_MAX, bulk_policy, false);
+	if (result.error)
+		return result;
+	if (!attrs[JNLAR_ADDR_RESULTS])
+		goto empty;
+
+	received = nla_len(attrs[JNLAR_ADDR_RESULTS]) / sizeof(*args->results);
+	if (received == 0)
+		goto empty;
+	if (received > args->count)
+		received = args->count;
+
+	memcpy(args->results, nla_data(attrs[JNLAR_ADDR_RESULTS]),
+			received * sizeof(*args->results));
+	args->count = received;
+	return result_success();
+
+empty:
+	return result_from_error(
+		-ESRCH,
+		"The kernel's response lacks the results."
+	);
+}
+
+static struct jool_result query_bulk(struct joolnl_socket *sk,
+		char const *iname, enum joolnl_operation op,
+		__u8 const *addrs, size_t addr_len, unsigned int count,
+		struct addrxlat_bulk_result *results)
+{
+	struct nl_msg *msg;
+	struct bulk_args args;
+	unsigned int done;
+	unsigned int n;
+	int error;
+	struct jool_result result;
+
+	/* libnl's default send buffer is too small for these requests. */
+	error = nl_socket_set_buffer_size(sk->sk, 0, 2 * JOOLNL_LARGE_MSG_SIZE);
+	if (error < 0) {
+		return result_from_error(
+			error,
+			"Cannot resize the Netlink socket's send buffer: %s",
+			nl_geterror(error)
+		);
+	}
+	nlmsg_set_default_size(JOOLNL_LARGE_MSG_SIZE);
+
+	for (done = 0; done < count; done += args.count) {
+		result = joolnl_alloc_msg(sk, iname, op, JOOLNLHDR_FLAGS_LARGE,
+				&msg);
+		if (result.error)
+			return result;
+
+		n = count - done;
+		if (n > BULK_BATCH)
+			n = BULK_BATCH;
+		if (nla_put(msg, JNLAR_ADDR_QUERY, n * addr_len,
+				addrs + done * addr_len) < 0) {
+			nlmsg_free(msg);
+			return joolnl_err_msgsize();
+		}
+
+		/* The kernel might answer fewer; the rest go again. */
+		args.results = &results[done];
+		args.count = n;
+		result = joolnl_request(sk, msg, handle_bulk_response, &args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+/**
+ * Translates the @count @addrs, thousands per request, into @results. (Which
+ * needs room for @count entries, and ends up in the same order.) Addresses
+ * that cannot be translated don't stop the operation; their results' method is
+ * ADDRXLAT_BULK_FAILED instead.
+ */
+struct jool_result joolnl_address_query64_bulk(struct joolnl_socket *sk,
+		char const *iname, struct in6_addr const *addrs,
+		unsigned int count, struct addrxlat_bulk_result *results)
+{
+	return query_bulk(sk, iname, JNLOP_ADDRESS_QUERY64_BULK,
+			(__u8 const *)addrs, sizeof(*addrs), count, results);
+}
+
+/* Same as joolnl_address_query64_bulk(), in the 4->6 direction. */
+struct jool_result joolnl_address_query46_bulk(struct joolnl_socket *sk,
+		char const *iname, struct in_addr const *addrs,
+		unsigned int count, struct addrxlat_bulk_result *results)
+{
+	return query_bulk(sk, iname, JNLOP_ADDRESS_QUERY46_BULK,
+			(__u8 const *)addrs, sizeof(*addrs), count, results);
+}
@@ -17,4 +17,20 @@ struct jool_result joolnl_address_query46(
 	struct result_addrxlat46 *result
 );
 
+struct jool_result joolnl_address_query64_bulk(
+	struct joolnl_socket *sk,
+	char const *iname,
+	struct in6_addr const *addrs,
+	unsigned int count,
+	struct addrxlat_bulk_result *results
+);
+
+struct jool_result joolnl_address_query46_bulk(
+	struct joolnl_socket *sk,
+	char const *iname,
+	struct in_addr const *addrs,
+	unsigned int count,
+	struct addrxlat_bulk_result *results
+);
+
 #endif /* SRC_USR_NL_ADDRESS_H_ */
@@ -1,6 +1,7 @@
 #include "usr/nl/attribute.h"
 
 #include <errno.h>
+#include <string.h>
 #include <netlink/errno.h>
 #include <netlink/msg.h>
 #include <netlink/genl/genl.h>
@@ -185,6 +186,67 @@ struct jool_result nla_get_prefix4(struct nlattr *root, struct ipv4_prefix *out)
 	return result_success();
 }
 
+struct jool_result nla_get_mark_range(struct nlattr *root,
+		struct config_mark_range *out)
+{
+	struct nlattr *attrs[JNLAMR_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLAMR_MAX, root,
+			joolnl_mark_range_policy);
+	if (result.error)
+		return result;
+
+	out->set = attrs[JNLAMR_FIRST] && attrs[JNLAMR_LAST];
+	out->first = out->set ? nla_get_u32(attrs[JNLAMR_FIRST]) : 0;
+	out->last = out->set ? nla_get_u32(attrs[JNLAMR_LAST]) : 0;
+	return result_success();
+}
+
+static void nla_get_next_hop_dev(struct nlattr *attr, char *dev)
+{
+	strncpy(dev, nla_get_string(attr), IFNAME_MAX_SIZE - 1);
+	dev[IFNAME_MAX_SIZE - 1] = '\0';
+}
+
+struct jool_result nla_get_next_hop6(struct nlattr *root,
+		struct config_next_hop6 *out)
+{
+	struct nlattr *attrs[JNLANH_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLANH_MAX, root,
+			joolnl_next_hop6_policy);
+	if (result.error)
+		return result;
+
+	out->set = attrs[JNLANH_GATEWAY] && attrs[JNLANH_DEV];
+	if (out->set) {
+		nla_get_addr6(attrs[JNLANH_GATEWAY], &out->gateway);
+		nla_get_next_hop_dev(attrs[JNLANH_DEV], out->dev);
+	}
+	return result_success();
+}
+
+struct jool_result nla_get_next_hop4(struct nlattr *root,
+		struct config_next_hop4 *out)
+{
+	struct nlattr *attrs[JNLANH_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLANH_MAX, root,
+			joolnl_next_hop4_policy);
+	if (result.error)
+		return result;
+
+	out->set = attrs[JNLANH_GATEWAY] && attrs[JNLANH_DEV];
+	if (out->set) {
+		nla_get_addr4(attrs[JNLANH_GATEWAY], &out->gateway);
+		nla_get_next_hop_dev(attrs[JNLANH_DEV], out->dev);
+	}
+	return result_success();
+}
+
 struct jool_result nla_get_taddr6(struct nlattr *root, struct ipv6_transport_addr *out)
 {
 	struct nlattr *attrs[JNLAT_COUNT];
@@ -223,13 +285,22 @@ struct jool_result nla_get_eam(struct nlattr *root, struct eamt_entry *out)
 		return result;
 
 	result = nla_get_prefix6(attrs[JNLAE_PREFIX6], &out->prefix6);
+	if (result.error)
+		return result;
+	result = nla_get_prefix4(attrs[JNLAE_PREFIX4], &out->prefix4);
 	if (result.error)
 		return result;
 
-	return nla_get_prefix4(attrs[JNLAE_PREFIX4], &out->prefix4);
+	out->ea_len = attrs[JNLAE_EA_LEN] ? nla_get_u8(attrs[JNLAE_EA_LEN]) : 0;
+	out->psid_offset = attrs[JNLAE_PSID_OFFSET]
+			? nla_get_u8(attrs[JNLAE_PSID_OFFSET])
+			: 0;
+	return result_success();
 }
 
-struct jool_result nla_get_pool4(struct nlattr *root, struct pool4_entry *out)
+/* @used is optional; it's only present in JNLOP_POOL4_USAGE responses. */
+static struct jool_result __nla_get_pool4(struct nlattr *root,
+		struct pool4_entry *out, __u64 *used)
 {
 	struct nlattr *attrs[JNLAP4_COUNT];
 	struct jool_result result;
@@ -238,6 +309,12 @@ struct jool_result nla_get_pool4(struct nlattr *root, struct pool4_entry *out)
 	if (result.error)
 		return result;
 
+	if (used) {
+		if (!attrs[JNLAP4_USED])
+			return result_from_error(-ESRCH, "The kernel's response lacks the BIB count.");
+		*used = nla_get_u64(attrs[JNLAP4_USED]);
+	}
+
 	out->mark = nla_get_u32(attrs[JNLAP4_MARK]);
 	out->iterations = nla_get_u32(attrs[JNLAP4_ITERATIONS]);
 	out->flags = nla_get_u8(attrs[JNLAP4_FLAGS]);
@@ -247,6 +324,17 @@ struct jool_result nla_get_pool4(struct nlattr *root, struct pool4_entry *out)
 	return nla_get_prefix4(attrs[JNLAP4_PREFIX], &out->range.prefix);
 }
 
+struct jool_result nla_get_pool4(struct nlattr *root, struct pool4_entry *out)
+{
+	return __nla_get_pool4(root, out, NULL);
+}
+
+struct jool_result nla_get_pool4_usage(struct nlattr *root,
+		struct pool4_entry *out, __u64 *used)
+{
+	return __nla_get_pool4(root, out, used);
+}
+
 struct jool_result nla_get_bib(struct nlattr *root, struct bib_entry *out)
 {
 	struct nlattr *attrs[JNLAB_COUNT];
@@ -264,6 +352,10 @@ struct jool_result nla_get_bib(struct nlattr *root, struct bib_entry *out)
 		return result;
 	out->l4_proto = nla_get_u8(attrs[JNLAB_PROTO]);
 	out->is_static = nla_get_u8(attrs[JNLAB_STATIC]);
+	out->packets = attrs[JNLAB_PACKETS]
+			? nla_get_u64(attrs[JNLAB_PACKETS])
+			: 0;
+	out->bytes = attrs[JNLAB_BYTES] ? nla_get_u64(attrs[JNLAB_BYTES]) : 0;
 	return result_success();
 }
 
@@ -291,30 +383,169 @@ struct jool_result nla_get_session(struct nlattr *root, struct session_entry_usr
 	out->proto = nla_get_u8(attrs[JNLASE_PROTO]);
 	out->state = nla_get_u8(attrs[JNLASE_STATE]);
 	out->dying_time = nla_get_u32(attrs[JNLASE_EXPIRATION]);
+	out->packets = attrs[JNLASE_PACKETS]
+			? nla_get_u64(attrs[JNLASE_PACKETS])
+			: 0;
+	out->bytes = attrs[JNLASE_BYTES] ? nla_get_u64(attrs[JNLASE_BYTES]) : 0;
+	return result_success();
+}
+
+static struct jool_result get_u16_list(struct nlattr *root, char const *what,
+		__u16 *values, __u16 *count, unsigned int max)
+{
+	struct nlattr *attr;
+	int rem;
+	struct jool_result result;
+
+	result = jnla_validate_list(nla_data(root), nla_len(root), what,
+			joolnl_plateau_list_policy);
+	if (result.error)
+		return result;
+
+	*count = 0;
+	nla_for_each_nested(attr, root, rem) {
+		if (*count >= max) {
+			return result_from_error(
+				-EINVAL,
+				"The kernel's response has too many %s.",
+				what
+			);
+		}
+		values[*count] = nla_get_u16(attr);
+		(*count)++;
+	}
+
 	return result_success();
 }
 
 struct jool_result nla_get_plateaus(struct nlattr *root,
 		struct mtu_plateaus *out)
+{
+	return get_u16_list(root, "plateaus", out->values, &out->count,
+			PLATEAUS_MAX);
+}
+
+struct jool_result nla_get_ports(struct nlattr *root, struct port_list *out)
+{
+	return get_u16_list(root, "ports", out->values, &out->count,
+			PORT_LIST_MAX);
+}
+
+struct jool_result nla_get_ingress_devices(struct nlattr *root,
+		struct ingress_devices *out)
 {
 	struct nlattr *attr;
 	int rem;
 	struct jool_result result;
 
-	result = jnla_validate_list(nla_data(root), nla_len(root), "plateus",
-			joolnl_plateau_list_policy);
+	result = jnla_validate_list(nla_data(root), nla_len(root),
+			"ingress devices", joolnl_ifname_list_policy);
 	if (result.error)
 		return result;
 
 	out->count = 0;
 	nla_for_each_nested(attr, root, rem) {
-		if (out->count >= PLATEAUS_MAX) {
+		if (out->count >= INGRESS_DEVICES_MAX) {
 			return result_from_error(
 				-EINVAL,
-				"The kernel's response has too many plateaus."
+				"The kernel's response has too many ingress devices."
 			);
 		}
-		out->values[out->count] = nla_get_u16(attr);
+		strncpy(out->names[out->count], nla_get_string(attr),
+				IFNAME_MAX_SIZE - 1);
+		out->names[out->count][IFNAME_MAX_SIZE - 1] = '\0';
+		out->count++;
+	}
+
+	return result_success();
+}
+
+static struct jool_result nla_get_timeout_class(struct nlattr *root,
+		struct timeout_class *out)
+{
+	struct nlattr *attrs[JNLATC_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLATC_MAX, root,
+			joolnl_timeout_class_policy);
+	if (result.error)
+		return result;
+
+	out->proto = nla_get_u8(attrs[JNLATC_PROTO]);
+	out->range.ports.min = nla_get_u16(attrs[JNLATC_PORT_MIN]);
+	out->range.ports.max = nla_get_u16(attrs[JNLATC_PORT_MAX]);
+	out->ttl = nla_get_u32(attrs[JNLATC_TTL]);
+	return nla_get_prefix4(attrs[JNLATC_PREFIX], &out->range.prefix);
+}
+
+static struct jool_result nla_get_pool6_tenant(struct nlattr *root,
+		struct pool6_tenant *out)
+{
+	struct nlattr *attrs[JNLAPT_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLAPT_MAX, root,
+			joolnl_pool6_tenant_policy);
+	if (result.error)
+		return result;
+
+	out->mark_set = !!attrs[JNLAPT_MARK];
+	out->mark = out->mark_set ? nla_get_u32(attrs[JNLAPT_MARK]) : 0;
+	return nla_get_prefix6(attrs[JNLAPT_PREFIX], &out->prefix);
+}
+
+struct jool_result nla_get_pool6_tenants(struct nlattr *root,
+		struct pool6_tenants *out)
+{
+	struct nlattr *attr;
+	int rem;
+	struct jool_result result;
+
+	result = jnla_validate_list(nla_data(root), nla_len(root),
+			"pool6 tenants", joolnl_struct_list_policy);
+	if (result.error)
+		return result;
+
+	out->count = 0;
+	nla_for_each_nested(attr, root, rem) {
+		if (out->count >= POOL6_TENANTS_MAX) {
+			return result_from_error(
+				-EINVAL,
+				"The kernel's response has too many pool6 tenants."
+			);
+		}
+		result = nla_get_pool6_tenant(attr, &out->values[out->count]);
+		if (result.error)
+			return result;
+		out->count++;
+	}
+
+	return result_success();
+}
+
+struct jool_result nla_get_timeout_classes(struct nlattr *root,
+		struct timeout_classes *out)
+{
+	struct nlattr *attr;
+	int rem;
+	struct jool_result result;
+
+	result = jnla_validate_list(nla_data(root), nla_len(root),
+			"timeout classes", joolnl_struct_list_policy);
+	if (result.error)
+		return result;
+
+	out->count = 0;
+	nla_for_each_nested(attr, root, rem) {
+		if (out->count >= TIMEOUT_CLASSES_MAX) {
+			return result_from_error(
+				-EINVAL,
+				"The kernel's response has too many timeout classes."
+			);
+		}
+		result = nla_get_timeout_class(attr, &out->values[out->count]);
+		if (result.error)
+			return result;
 		out->count++;
 	}
 
@@ -383,7 +614,77 @@ cancel:	nla_nest_cancel(msg, root);
 abort:	return -NLE_NOMEM;
 }
 
-static int nla_put_taddr6(struct nl_msg *msg, int attrtype, struct ipv6_transport_addr const *taddr)
+int nla_put_mark_range(struct nl_msg *msg, int attrtype,
+		struct config_mark_range const *range)
+{
+	struct nlattr *root;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	/* An empty nest means "unset." */
+	if (range->set) {
+		NLA_PUT_U32(msg, JNLAMR_FIRST, range->first);
+		NLA_PUT_U32(msg, JNLAMR_LAST, range->last);
+	}
+
+	nla_nest_end(msg, root);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
+
+int nla_put_next_hop6(struct nl_msg *msg, int attrtype,
+		struct config_next_hop6 const *hop)
+{
+	struct nlattr *root;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	/* An empty nest means "unset." */
+	if (hop->set) {
+		if (nla_put_addr6(msg, JNLANH_GATEWAY, &hop->gateway) < 0)
+			goto nla_put_failure;
+		NLA_PUT_STRING(msg, JNLANH_DEV, hop->dev);
+	}
+
+	nla_nest_end(msg, root);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
+
+int nla_put_next_hop4(struct nl_msg *msg, int attrtype,
+		struct config_next_hop4 const *hop)
+{
+	struct nlattr *root;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	if (hop->set) {
+		if (nla_put_addr4(msg, JNLANH_GATEWAY, &hop->gateway) < 0)
+			goto nla_put_failure;
+		NLA_PUT_STRING(msg, JNLANH_DEV, hop->dev);
+	}
+
+	nla_nest_end(msg, root);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
+
+int nla_put_taddr6(struct nl_msg *msg, int attrtype, struct ipv6_transport_addr const *taddr)
 {
 	struct nlattr *root;
 
@@ -404,7 +705,7 @@ cancel:
 	return -NLE_NOMEM;
 }
 
-static int nla_put_taddr4(struct nl_msg *msg, int attrtype, struct ipv4_transport_addr const *taddr)
+int nla_put_taddr4(struct nl_msg *msg, int attrtype, struct ipv4_transport_addr const *taddr)
 {
 	struct nlattr *root;
 
@@ -425,7 +726,39 @@ cancel:
 	return -NLE_NOMEM;
 }
 
+static int put_u16_list(struct nl_msg *msg, int attrtype,
+		__u16 const *values, unsigned int count)
+{
+	struct nlattr *root;
+	unsigned int i;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	for (i = 0; i < count; i++) {
+		if (nla_put_u16(msg, JNLAL_ENTRY, values[i]) < 0) {
+			nla_nest_cancel(msg, root);
+			return -NLE_NOMEM;
+		}
+	}
+
+	nla_nest_end(msg, root);
+	return 0;
+}
+
 int nla_put_plateaus(struct nl_msg *msg, int attrtype, struct mtu_plateaus const *plateaus)
+{
+	return put_u16_list(msg, attrtype, plateaus->values, plateaus->count);
+}
+
+int nla_put_ports(struct nl_msg *msg, int attrtype, struct port_list const *ports)
+{
+	return put_u16_list(msg, attrtype, ports->values, ports->count);
+}
+
+int nla_put_ingress_devices(struct nl_msg *msg, int attrtype,
+		struct ingress_devices const *devices)
 {
 	struct nlattr *root;
 	unsigned int i;
@@ -434,8 +767,96 @@ int nla_put_plateaus(struct nl_msg *msg, int attrtype, struct mtu_plateaus const
 	if (!root)
 		return -NLE_NOMEM;
 
-	for (i = 0; i < plateaus->count; i++) {
-		if (nla_put_u16(msg, JNLAL_ENTRY, plateaus->values[i]) < 0) {
+	for (i = 0; i < devices->count; i++) {
+		if (nla_put_string(msg, JNLAL_ENTRY, devices->names[i]) < 0) {
+			nla_nest_cancel(msg, root);
+			return -NLE_NOMEM;
+		}
+	}
+
+	nla_nest_end(msg, root);
+	return 0;
+}
+
+static int nla_put_timeout_class(struct nl_msg *msg,
+		struct timeout_class const *class)
+{
+	struct nlattr *root;
+
+	root = jnla_nest_start(msg, JNLAL_ENTRY);
+	if (!root)
+		return -NLE_NOMEM;
+
+	NLA_PUT_U8(msg, JNLATC_PROTO, class->proto);
+	if (nla_put_prefix4(msg, JNLATC_PREFIX, &class->range.prefix) < 0)
+		goto nla_put_failure;
+	NLA_PUT_U16(msg, JNLATC_PORT_MIN, class->range.ports.min);
+	NLA_PUT_U16(msg, JNLATC_PORT_MAX, class->range.ports.max);
+	NLA_PUT_U32(msg, JNLATC_TTL, class->ttl);
+
+	nla_nest_end(msg, root);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
+
+static int nla_put_pool6_tenant(struct nl_msg *msg,
+		struct pool6_tenant const *tenant)
+{
+	struct nlattr *root;
+
+	root = jnla_nest_start(msg, JNLAL_ENTRY);
+	if (!root)
+		return -NLE_NOMEM;
+
+	if (nla_put_prefix6(msg, JNLAPT_PREFIX, &tenant->prefix) < 0)
+		goto nla_put_failure;
+	if (tenant->mark_set)
+		NLA_PUT_U32(msg, JNLAPT_MARK, tenant->mark);
+
+	nla_nest_end(msg, root);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
+
+int nla_put_pool6_tenants(struct nl_msg *msg, int attrtype,
+		struct pool6_tenants const *tenants)
+{
+	struct nlattr *root;
+	unsigned int i;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	for (i = 0; i < tenants->count; i++) {
+		if (nla_put_pool6_tenant(msg, &tenants->values[i]) < 0) {
+			nla_nest_cancel(msg, root);
+			return -NLE_NOMEM;
+		}
+	}
+
+	nla_nest_end(msg, root);
+	return 0;
+}
+
+int nla_put_timeout_classes(struct nl_msg *msg, int attrtype,
+		struct timeout_classes const *classes)
+{
+	struct nlattr *root;
+	unsigned int i;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	for (i = 0; i < classes->count; i++) {
+		if (nla_put_timeout_class(msg, &classes->values[i]) < 0) {
 			nla_nest_cancel(msg, root);
 			return -NLE_NOMEM;
 		}
@@ -457,6 +878,12 @@ int nla_put_eam(struct nl_msg *msg, int attrtype, struct eamt_entry const *entry
 		goto cancel;
 	if (nla_put_prefix4(msg, JNLAE_PREFIX4, &entry->prefix4) < 0)
 		goto cancel;
+	if (entry->ea_len) {
+		if (nla_put_u8(msg, JNLAE_EA_LEN, entry->ea_len) < 0)
+			goto cancel;
+		if (nla_put_u8(msg, JNLAE_PSID_OFFSET, entry->psid_offset) < 0)
+			goto cancel;
+	}
 
 	nla_nest_end(msg, root);
 	return 0;
@@ -551,3 +978,38 @@ nla_put_failure:
 	nla_nest_cancel(msg, root);
 	return -NLE_NOMEM;
 }
+
+int nla_put_filter(struct nl_msg *msg, int attrtype,
+		struct query_filter const *filter)
+{
+	struct nlattr *root;
+
+	root = jnla_nest_start(msg, attrtype);
+	if (!root)
+		return -NLE_NOMEM;
+
+	if ((filter->flags & QF_SRC6)
+			&& nla_put_prefix6(msg, JNLAF_SRC6, &filter->src6) < 0)
+		goto nla_put_failure;
+	if ((filter->flags & QF_SRC4)
+			&& nla_put_prefix4(msg, JNLAF_SRC4, &filter->src4) < 0)
+		goto nla_put_failure;
+	if (filter->flags & QF_PORTS) {
+		NLA_PUT_U16(msg, JNLAF_PORT_MIN, filter->ports.min);
+		NLA_PUT_U16(msg, JNLAF_PORT_MAX, filter->ports.max);
+	}
+	if ((filter->flags & QF_DST4)
+			&& nla_put_prefix4(msg, JNLAF_DST4, &filter->dst4) < 0)
+		goto nla_put_failure;
+	if (filter->flags & QF_STATE)
+		NLA_PUT_U8(msg, JNLAF_STATE, filter->state);
+	if (filter->flags & QF_MIN_AGE)
+		NLA_PUT_U32(msg, JNLAF_MIN_AGE, filter->min_age);
+
+	nla_nest_end(msg, root);
+	return 0;
+
+nla_put_failure:
+	nla_nest_cancel(msg, root);
+	return -NLE_NOMEM;
+}
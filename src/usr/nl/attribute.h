@@ -28,13 +28,22 @@ void nla_get_addr6(struct nlattr const *attr, struct in6_addr *addr);
 void nla_get_addr4(struct nlattr const *attr, struct in_addr *addr);
 struct jool_result nla_get_prefix6(struct nlattr *attr, struct ipv6_prefix *out);
 struct jool_result nla_get_prefix4(struct nlattr *attr, struct ipv4_prefix *out);
+struct jool_result nla_get_mark_range(struct nlattr *attr, struct config_mark_range *out);
+struct jool_result nla_get_next_hop6(struct nlattr *attr, struct config_next_hop6 *out);
+struct jool_result nla_get_next_hop4(struct nlattr *attr, struct config_next_hop4 *out);
 struct jool_result nla_get_taddr6(struct nlattr *attr, struct ipv6_transport_addr *out);
 struct jool_result nla_get_taddr4(struct nlattr *attr, struct ipv4_transport_addr *out);
 struct jool_result nla_get_eam(struct nlattr *attr, struct eamt_entry *out);
 struct jool_result nla_get_pool4(struct nlattr *attr, struct pool4_entry *out);
+struct jool_result nla_get_pool4_usage(struct nlattr *attr,
+		struct pool4_entry *out, __u64 *used);
 struct jool_result nla_get_bib(struct nlattr *attr, struct bib_entry *out);
 struct jool_result nla_get_session(struct nlattr *attr, struct session_entry_usr *out);
 struct jool_result nla_get_plateaus(struct nlattr *attr, struct mtu_plateaus *out);
+struct jool_result nla_get_ports(struct nlattr *attr, struct port_list *out);
+struct jool_result nla_get_ingress_devices(struct nlattr *attr, struct ingress_devices *out);
+struct jool_result nla_get_timeout_classes(struct nlattr *attr, struct timeout_classes *out);
+struct jool_result nla_get_pool6_tenants(struct nlattr *attr, struct pool6_tenants *out);
 
 /*
  * Implementation notes:
@@ -60,9 +69,18 @@ struct jool_result nla_get_plateaus(struct nlattr *attr, struct mtu_plateaus *ou
  * packet too small. No other outcomes.
  */
 
+int nla_put_taddr6(struct nl_msg *msg, int attrtype, struct ipv6_transport_addr const *taddr);
+int nla_put_taddr4(struct nl_msg *msg, int attrtype, struct ipv4_transport_addr const *taddr);
 int nla_put_prefix6(struct nl_msg *msg, int attrtype, struct ipv6_prefix const *prefix);
 int nla_put_prefix4(struct nl_msg *msg, int attrtype, struct ipv4_prefix const *prefix);
+int nla_put_mark_range(struct nl_msg *msg, int attrtype, struct config_mark_range const *range);
+int nla_put_next_hop6(struct nl_msg *msg, int attrtype, struct config_next_hop6 const *hop);
+int nla_put_next_hop4(struct nl_msg *msg, int attrtype, struct config_next_hop4 const *hop);
 int nla_put_plateaus(struct nl_msg *msg, int attrtype, struct mtu_plateaus const *plateaus);
+int nla_put_ports(struct nl_msg *msg, int attrtype, struct port_list const *ports);
+int nla_put_ingress_devices(struct nl_msg *msg, int attrtype, struct ingress_devices const *devices);
+int nla_put_timeout_classes(struct nl_msg *msg, int attrtype, struct timeout_classes const *classes);
+int nla_put_pool6_tenants(struct nl_msg *msg, int attrtype, struct pool6_tenants const *tenants);
 int nla_put_eam(struct nl_msg *msg, int attrtype, struct eamt_entry const *entry);
 int nla_put_pool4(struct nl_msg *msg, int attrtype, struct pool4_entry const *entry);
 int nla_put_bib(struct nl_msg *msg, int attrtype, struct bib_entry const *entry);
@@ -72,5 +90,6 @@ int nla_put_bib_attrs(struct nl_msg *msg, int attrtype,
 		l4_protocol proto,
 		bool is_static);
 int nla_put_session(struct nl_msg *msg, int attrtype, struct session_entry_usr const *entry);
+int nla_put_filter(struct nl_msg *msg, int attrtype, struct query_filter const *filter);
 
 #endif /* SRC_USR_NL_ATTRIBUTE_H_ */
@@ -8,8 +8,6 @@
 struct foreach_args {
 	joolnl_bib_foreach_cb cb;
 	void *args;
-	bool done;
-	struct bib_entry last;
 };
 
 static struct jool_result handle_foreach_response(struct nl_msg *response,
@@ -20,8 +18,9 @@ static struct jool_result handle_foreach_response(struct nl_msg *response,
 	int rem;
 	struct bib_entry entry;
 	struct jool_result result;
+	bool done; /* Dumps end with NLMSG_DONE instead */
 
-	result = joolnl_init_foreach_list(response, "bib", &args->done);
+	result = joolnl_init_foreach_list(response, "bib", &done);
 	if (result.error)
 		return result;
 
@@ -33,49 +32,35 @@ static struct jool_result handle_foreach_response(struct nl_msg *response,
 		result = args->cb(&entry, args->args);
 		if (result.error)
 			return result;
-
-		memcpy(&args->last, &entry, sizeof(entry));
 	}
 
 	return result_success();
 }
 
+/* @filter can be NULL. (Meaning all the entries.) */
 struct jool_result joolnl_bib_foreach(struct joolnl_socket *sk, char const *iname,
-	l4_protocol proto, joolnl_bib_foreach_cb cb, void *_args)
+	l4_protocol proto, struct query_filter const *filter,
+	joolnl_bib_foreach_cb cb, void *_args)
 {
 	struct nl_msg *msg;
 	struct foreach_args args;
 	struct jool_result result;
-	bool first_request;
 
 	args.cb = cb;
 	args.args = _args;
-	args.done = true;
-	memset(&args.last, 0, sizeof(args.last));
-	first_request = true;
-
-	do {
-		result = joolnl_alloc_msg(sk, iname, JNLOP_BIB_FOREACH, 0, &msg);
-		if (result.error)
-			return result;
-
-		if (first_request) {
-			if (nla_put_u8(msg, JNLAR_PROTO, proto) < 0)
-				goto cancel;
-			first_request = false;
 
-		} else if (nla_put_bib(msg, JNLAR_OFFSET, &args.last) < 0) {
-			goto cancel;
-		}
+	result = joolnl_alloc_msg(sk, iname, JNLOP_BIB_FOREACH, 0, &msg);
+	if (result.error)
+		return result;
 
-		result = joolnl_request(sk, msg, handle_foreach_response, &args);
-		if (result.error)
-			return result;
-	} while (!args.done);
+	if (nla_put_u8(msg, JNLAR_PROTO, proto) < 0)
+		goto nla_put_failure;
+	if (filter && nla_put_filter(msg, JNLAR_FILTER, filter) < 0)
+		goto nla_put_failure;
 
-	return result_success();
+	return joolnl_dump(sk, msg, handle_foreach_response, &args);
 
-cancel:
+nla_put_failure:
 	nlmsg_free(msg);
 	return joolnl_err_msgsize();
 }
@@ -119,3 +104,164 @@ struct jool_result joolnl_bib_rm(struct joolnl_socket *sk,
 {
 	return __update(sk, iname, JNLOP_BIB_RM, a6, a4, proto);
 }
+
+/* Bulk requests are this big, at most. */
+#define BULK_MSG_SIZE (64 * 1024)
+
+struct bulk_args {
+	/* The entries of the current request */
+	struct bib_entry const *entries;
+	unsigned int count;
+
+	joolnl_bib_bulk_cb cb;
+	void *args;
+};
+
+static struct jool_result handle_bulk_response(struct nl_msg *response,
+		void *arg)
+{
+	static struct nla_policy bulk_policy[JNLAR_COUNT] = {
+		[JNLAR_BULK_FAILURES] = { .type = NLA_UNSPEC },
+	};
+	struct bulk_args *args = arg;
+	struct nlattr *attrs[JNLAR_COUNT];
+	__u8 *failures;
+	unsigned int max;
+	unsigned int i;
+	struct jool_result result;
+
+	result = jnla_parse_msg(response, attrs, JNLAR_MAX, bulk_policy, false);
+	if (result.error)
+		return result;
+	if (!attrs[JNLAR_BULK_FAILURES])
+		return result_success();
+
+	failures = nla_data(attrs[JNLAR_BULK_FAILURES]);
+	max = 8 * nla_len(attrs[JNLAR_BULK_FAILURES]);
+	if (max > args->count)
+		max = args->count;
+
+	for (i = 0; i < max; i++) {
+		if (!(failures[i >> 3] & (1 << (i & 7))))
+			continue;
+		result = args->cb(&args->entries[i], args->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+/**
+ * Adds @count static BIB entries, several per request. Entries that cannot be
+ * added don't stop the operation; @cb is called on each of them instead.
+ */
+struct jool_result joolnl_bib_add_bulk(struct joolnl_socket *sk,
+		char const *iname, struct bib_entry const *entries,
+		unsigned int count, joolnl_bib_bulk_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct nlattr *root;
+	struct bulk_args args;
+	unsigned int sent;
+	unsigned int n;
+	int error;
+	struct jool_result result;
+
+	/* libnl's default send buffer is too small for these requests. */
+	error = nl_socket_set_buffer_size(sk->sk, 0, 2 * BULK_MSG_SIZE);
+	if (error < 0) {
+		return result_from_error(
+			error,
+			"Cannot resize the Netlink socket's send buffer: %s",
+			nl_geterror(error)
+		);
+	}
+	nlmsg_set_default_size(BULK_MSG_SIZE);
+
+	args.cb = cb;
+	args.args = _args;
+
+	for (sent = 0; sent < count; sent += n) {
+		result = joolnl_alloc_msg(sk, iname, JNLOP_BIB_ADD_BULK, 0,
+				&msg);
+		if (result.error)
+			return result;
+
+		root = jnla_nest_start(msg, JNLAR_BIB_ENTRIES);
+		if (!root)
+			goto cancel;
+
+		for (n = 0; sent + n < count && n < JOOLNL_BULK_MAX; n++)
+			if (nla_put_bib(msg, JNLAL_ENTRY, &entries[sent + n]) < 0)
+				break;
+		if (n == 0)
+			goto cancel;
+
+		nla_nest_end(msg, root);
+
+		args.entries = &entries[sent];
+		args.count = n;
+		result = joolnl_request(sk, msg, handle_bulk_response, &args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+
+cancel:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
+static struct jool_result handle_purge_response(struct nl_msg *response,
+		void *arg)
+{
+	static struct nla_policy purge_policy[JNLAR_COUNT] = {
+		[JNLAR_PURGED] = { .type = NLA_U32 },
+	};
+	struct nlattr *attrs[JNLAR_COUNT];
+	struct jool_result result;
+
+	result = jnla_parse_msg(response, attrs, JNLAR_MAX, purge_policy,
+			false);
+	if (result.error)
+		return result;
+	if (!attrs[JNLAR_PURGED])
+		return result_from_error(-ENOENT,
+				"The kernel's response lacks a removal count.");
+
+	*((__u32 *)arg) = nla_get_u32(attrs[JNLAR_PURGED]);
+	return result_success();
+}
+
+/**
+ * Removes the BIB entries (and their sessions) of the @protos protocols (bit i
+ * is enum l4_protocol i; 0 means all of them) that match @filter. Only the
+ * filter's src6, src4 and ports are honored. @filter can be NULL.
+ *
+ * @removed will be the number of BIB entries removed.
+ */
+struct jool_result joolnl_bib_purge(struct joolnl_socket *sk,
+		char const *iname, __u8 protos,
+		struct query_filter const *filter, __u32 *removed)
+{
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_BIB_PURGE, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (protos && nla_put_u8(msg, JNLAR_PROTOS, protos) < 0)
+		goto nla_put_failure;
+	if (filter && nla_put_filter(msg, JNLAR_FILTER, filter) < 0)
+		goto nla_put_failure;
+
+	*removed = 0;
+	return joolnl_request(sk, msg, handle_purge_response, removed);
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
@@ -12,6 +12,7 @@ struct jool_result joolnl_bib_foreach(
 	struct joolnl_socket *sk,
 	char const *iname,
 	l4_protocol proto,
+	struct query_filter const *filter,
 	joolnl_bib_foreach_cb cb,
 	void *args
 );
@@ -24,6 +25,19 @@ struct jool_result joolnl_bib_add(
 	l4_protocol proto
 );
 
+typedef struct jool_result (*joolnl_bib_bulk_cb)(
+	struct bib_entry const *failed, void *args
+);
+
+struct jool_result joolnl_bib_add_bulk(
+	struct joolnl_socket *sk,
+	char const *iname,
+	struct bib_entry const *entries,
+	unsigned int count,
+	joolnl_bib_bulk_cb cb,
+	void *args
+);
+
 struct jool_result joolnl_bib_rm(
 	struct joolnl_socket *sk,
 	char const *iname,
@@ -32,4 +46,12 @@ struct jool_result joolnl_bib_rm(
 	l4_protocol proto
 );
 
+struct jool_result joolnl_bib_purge(
+	struct joolnl_socket *sk,
+	char const *iname,
+	__u8 protos,
+	struct query_filter const *filter,
+	__u32 *removed
+);
+
 #endif /* SRC_USR_NL_BIB_H_ */
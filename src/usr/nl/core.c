@@ -166,6 +166,28 @@ struct jool_result joolnl_msg2result(struct nl_msg *response)
 	);
 }
 
+/*
+ * The kernel module reports its errors in Jool messages, but if the dump fails
+ * before one can be built, the NLMSG_DONE carries the error code instead.
+ */
+static struct jool_result done2result(struct nlmsghdr *nhdr)
+{
+	int error;
+
+	if (nhdr->nlmsg_len < NLMSG_LENGTH(sizeof(error)))
+		return result_success();
+
+	memcpy(&error, nlmsg_data(nhdr), sizeof(error));
+	if (error >= 0)
+		return result_success();
+
+	return result_from_error(
+		error,
+		"The kernel module aborted the dump: %s",
+		strerror(-error)
+	);
+}
+
 /*
  * Heads up:
  * Netlink wants this function to return either a negative error code or an enum
@@ -184,6 +206,11 @@ static int response_handler(struct nl_msg *response, void *_args)
 
 	args = _args;
 	nhdr = nlmsg_hdr(response);
+	if (nhdr->nlmsg_type == NLMSG_DONE) {
+		/* End of a dump. The pages were already handled. */
+		args->result = done2result(nhdr);
+		goto end;
+	}
 	if (!genlmsg_valid_hdr(nhdr, sizeof(struct joolnlhdr))) {
 		args->result = result_from_error(
 			-NLE_MSG_TOOSHORT,
@@ -211,32 +238,21 @@ end:
 	return (error < 0) ? error : -error;
 }
 
-/**
- * @iname can be NULL. The kernel module will assume that the instance name is
- * "" (empty string).
- *
- * Consumes @msg, even on error.
- *
- * WARNING: This function is essentially userspace client boilerplate. It
- * assumes nobody else is editing the socket's callback handlers, and it waits
- * for an ACK. In particular, never use it from joold code.
+/*
+ * Waits for the kernel module's response to the oldest pending request, and
+ * feeds it to @callback.
  */
-struct jool_result joolnl_request(struct joolnl_socket *socket,
-		struct nl_msg *msg, joolnl_response_cb cb, void *cb_arg)
+static struct jool_result receive_response(struct joolnl_socket *socket,
+		struct response_cb *callback)
 {
-	struct response_cb callback;
 	int error;
 
-	callback.xt = socket->xt;
-	callback.cb = cb;
-	callback.arg = cb_arg;
 	/* Clear out JRF_INITIALIZED and error code */
-	memset(&callback.result, 0, sizeof(callback.result));
+	memset(&callback->result, 0, sizeof(callback->result));
 
 	error = nl_socket_modify_cb(socket->sk, NL_CB_MSG_IN, NL_CB_CUSTOM,
-			response_handler, &callback);
+			response_handler, callback);
 	if (error < 0) {
-		nlmsg_free(msg);
 		return result_from_error(
 			error,
 			"Could not register response handler: %s\n",
@@ -244,22 +260,12 @@ struct jool_result joolnl_request(struct joolnl_socket *socket,
 		);
 	}
 
-	error = nl_send_auto(socket->sk, msg);
-	nlmsg_free(msg);
-	if (error < 0) {
-		return result_from_error(
-			error,
-			"Could not dispatch the request to kernelspace: %s",
-			nl_geterror(error)
-		);
-	}
-
 	error = nl_recvmsgs_default(socket->sk);
 	if (error < 0) {
-		if ((callback.result.flags & JRF_INITIALIZED)
-				&& callback.result.error) {
+		if ((callback->result.flags & JRF_INITIALIZED)
+				&& callback->result.error) {
 			/* nl_recvmsgs_default() failed during our callback */
-			return callback.result;
+			return callback->result;
 		}
 
 		/* nl_recvmsgs_default() failed before or after our callback */
@@ -273,6 +279,225 @@ struct jool_result joolnl_request(struct joolnl_socket *socket,
 	return result_success();
 }
 
+static struct jool_result send_error(int error)
+{
+	return result_from_error(
+		error,
+		"Could not dispatch the request to kernelspace: %s",
+		nl_geterror(error)
+	);
+}
+
+/**
+ * @iname can be NULL. The kernel module will assume that the instance name is
+ * "" (empty string).
+ *
+ * Consumes @msg, even on error.
+ *
+ * WARNING: This function is essentially userspace client boilerplate. It
+ * assumes nobody else is editing the socket's callback handlers, and it waits
+ * for an ACK. In particular, never use it from joold code.
+ */
+struct jool_result joolnl_request(struct joolnl_socket *socket,
+		struct nl_msg *msg, joolnl_response_cb cb, void *cb_arg)
+{
+	struct response_cb callback;
+	int error;
+
+	callback.xt = socket->xt;
+	callback.cb = cb;
+	callback.arg = cb_arg;
+
+	error = nl_send_auto(socket->sk, msg);
+	nlmsg_free(msg);
+	if (error < 0)
+		return send_error(error);
+
+	return receive_response(socket, &callback);
+}
+
+/*
+ * Pipelined requests.
+ *
+ * The kernel module handles a socket's requests in order, and answers each of
+ * them with exactly one message, so the responses can be collected in bulk.
+ * Small requests are also packed together, so several of them share a single
+ * sendmsg().
+ */
+
+/*
+ * Maximum number of requests whose responses haven't been read yet. The
+ * kernel drops responses that don't fit in the socket's receive buffer, and
+ * each of them can occupy a page or so. (libnl's default buffer is 32 KB,
+ * which the kernel doubles.)
+ */
+#define PIPELINE_WINDOW 8
+
+void joolnl_pipeline_init(struct joolnl_pipeline *pipeline,
+		struct joolnl_socket *socket, joolnl_response_cb cb,
+		void *cb_arg)
+{
+	pipeline->socket = socket;
+	pipeline->cb = cb;
+	pipeline->cb_arg = cb_arg;
+	pipeline->batch_len = 0;
+	pipeline->batched = 0;
+	pipeline->outstanding = 0;
+}
+
+static struct jool_result send_batch(struct joolnl_pipeline *pipeline)
+{
+	int error;
+
+	if (pipeline->batch_len == 0)
+		return result_success();
+
+	error = nl_sendto(pipeline->socket->sk, pipeline->batch,
+			pipeline->batch_len);
+	if (error < 0)
+		return send_error(error);
+
+	pipeline->outstanding += pipeline->batched;
+	pipeline->batch_len = 0;
+	pipeline->batched = 0;
+	return result_success();
+}
+
+static struct jool_result receive_one(struct joolnl_pipeline *pipeline)
+{
+	struct response_cb callback;
+
+	callback.xt = pipeline->socket->xt;
+	callback.cb = pipeline->cb;
+	callback.arg = pipeline->cb_arg;
+
+	pipeline->outstanding--;
+	return receive_response(pipeline->socket, &callback);
+}
+
+/**
+ * Drops the requests that haven't been sent yet, and discards the responses
+ * of the ones that have, so the socket can be reused.
+ */
+void joolnl_pipeline_abort(struct joolnl_pipeline *pipeline)
+{
+	struct jool_result result;
+
+	pipeline->batch_len = 0;
+	pipeline->batched = 0;
+
+	while (pipeline->outstanding > 0) {
+		result = receive_one(pipeline);
+		result_cleanup(&result);
+	}
+}
+
+static struct jool_result queue_msg(struct joolnl_pipeline *pipeline,
+		struct nl_msg *msg)
+{
+	struct nlmsghdr *hdr;
+	size_t len;
+	int error;
+	struct jool_result result;
+
+	nl_complete_msg(pipeline->socket->sk, msg);
+	hdr = nlmsg_hdr(msg);
+	len = NLMSG_ALIGN(hdr->nlmsg_len);
+
+	if (pipeline->batch_len + len > sizeof(pipeline->batch)) {
+		result = send_batch(pipeline);
+		if (result.error)
+			return result;
+	}
+
+	while (pipeline->outstanding + pipeline->batched >= PIPELINE_WINDOW) {
+		if (pipeline->outstanding == 0) {
+			result = send_batch(pipeline);
+			if (result.error)
+				return result;
+		}
+		result = receive_one(pipeline);
+		if (result.error)
+			return result;
+	}
+
+	if (len <= sizeof(pipeline->batch)) {
+		memcpy(pipeline->batch + pipeline->batch_len, hdr, len);
+		pipeline->batch_len += len;
+		pipeline->batched++;
+		return result_success();
+	}
+
+	/* Too big to share; the batch is already empty. */
+	error = nl_sendto(pipeline->socket->sk, hdr, hdr->nlmsg_len);
+	if (error < 0)
+		return send_error(error);
+	pipeline->outstanding++;
+	return result_success();
+}
+
+/**
+ * Queues @msg, which must not be a dump request.
+ *
+ * The request might not reach the kernel module until later, and its response
+ * might be handled (by the pipeline's callback) during any later send, or
+ * during joolnl_pipeline_flush().
+ *
+ * Consumes @msg, even on error. On error, the pipeline has already been
+ * aborted; otherwise, it has to be joolnl_pipeline_flush()ed (or aborted)
+ * eventually.
+ */
+struct jool_result joolnl_pipeline_send(struct joolnl_pipeline *pipeline,
+		struct nl_msg *msg)
+{
+	struct jool_result result;
+
+	result = queue_msg(pipeline, msg);
+	nlmsg_free(msg);
+	if (result.error)
+		joolnl_pipeline_abort(pipeline);
+	return result;
+}
+
+/**
+ * Sends the queued requests, and waits for every pending response.
+ * Returns the first error.
+ */
+struct jool_result joolnl_pipeline_flush(struct joolnl_pipeline *pipeline)
+{
+	struct jool_result result;
+
+	result = send_batch(pipeline);
+	if (result.error)
+		goto fail;
+
+	while (pipeline->outstanding > 0) {
+		result = receive_one(pipeline);
+		if (result.error)
+			goto fail;
+	}
+
+	return result_success();
+
+fail:
+	joolnl_pipeline_abort(pipeline);
+	return result;
+}
+
+/**
+ * Same as joolnl_request(), except @msg is sent as a dump request. The kernel
+ * module answers with several pages back to back (@cb is called once per page),
+ * so the caller doesn't have to iterate.
+ *
+ * Consumes @msg, even on error.
+ */
+struct jool_result joolnl_dump(struct joolnl_socket *socket,
+		struct nl_msg *msg, joolnl_response_cb cb, void *cb_arg)
+{
+	nlmsg_hdr(msg)->nlmsg_flags |= NLM_F_DUMP;
+	return joolnl_request(socket, msg, cb, cb_arg);
+}
+
 /**
  * Contract: The result will contain 0 on success, -ESRCH on module likely not
  * modprobed, else -EINVAL.
@@ -304,6 +529,21 @@ struct jool_result joolnl_setup(struct joolnl_socket *socket, xlator_type xt)
 	 */
 	nl_socket_disable_auto_ack(socket->sk);
 
+	/*
+	 * Room for JOOLNLHDR_FLAGS_LARGE responses. (Recent libnls peek
+	 * anyway, but older ones settle for a page.)
+	 */
+	error = nl_socket_set_msg_buf_size(socket->sk,
+			NLMSG_SPACE(JOOLNL_LARGE_MSG_SIZE));
+	if (error) {
+		nl_socket_free(socket->sk);
+		return result_from_error(
+			-EINVAL,
+			"Could not resize the Netlink socket's receive buffer: %s",
+			nl_geterror(error)
+		);
+	}
+
 	error = genl_connect(socket->sk);
 	if (error) {
 		nl_socket_free(socket->sk);
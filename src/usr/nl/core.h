@@ -21,6 +21,35 @@ struct jool_result joolnl_alloc_msg(struct joolnl_socket *socket,
 typedef struct jool_result (*joolnl_response_cb)(struct nl_msg *, void *);
 struct jool_result joolnl_request(struct joolnl_socket *sk, struct nl_msg *msg,
 		joolnl_response_cb cb, void *cb_arg);
+struct jool_result joolnl_dump(struct joolnl_socket *sk, struct nl_msg *msg,
+		joolnl_response_cb cb, void *cb_arg);
+
+/* Bytes of small requests that can share a sendmsg(). */
+#define JOOLNL_BATCH_SIZE 16384
+
+/*
+ * Several requests in flight at once. @cb is called on each response, in
+ * order. (Same socket caveats as joolnl_request().)
+ */
+struct joolnl_pipeline {
+	struct joolnl_socket *socket;
+	joolnl_response_cb cb;
+	void *cb_arg;
+
+	/* Requests not sent yet. */
+	unsigned char batch[JOOLNL_BATCH_SIZE];
+	size_t batch_len;
+	unsigned int batched;
+	/* Requests sent, whose responses haven't been read yet. */
+	unsigned int outstanding;
+};
+
+void joolnl_pipeline_init(struct joolnl_pipeline *pipeline,
+		struct joolnl_socket *sk, joolnl_response_cb cb, void *cb_arg);
+struct jool_result joolnl_pipeline_send(struct joolnl_pipeline *pipeline,
+		struct nl_msg *msg);
+struct jool_result joolnl_pipeline_flush(struct joolnl_pipeline *pipeline);
+void joolnl_pipeline_abort(struct joolnl_pipeline *pipeline);
 
 struct jool_result validate_joolnlhdr(struct joolnlhdr *hdr, xlator_type xt);
 struct jool_result joolnl_msg2result(struct nl_msg *response);
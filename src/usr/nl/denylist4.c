@@ -55,7 +55,8 @@ struct jool_result joolnl_denylist4_foreach(struct joolnl_socket *sk,
 	first_request = true;
 
 	do {
-		result = joolnl_alloc_msg(sk, iname, JNLOP_BL4_FOREACH, 0, &msg);
+		result = joolnl_alloc_msg(sk, iname, JNLOP_BL4_FOREACH,
+				JOOLNLHDR_FLAGS_LARGE, &msg);
 		if (result.error)
 			return result;
 
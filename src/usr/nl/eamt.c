@@ -55,7 +55,8 @@ struct jool_result joolnl_eamt_foreach(struct joolnl_socket *sk,
 	first_request = true;
 
 	do {
-		result = joolnl_alloc_msg(sk, iname, JNLOP_EAMT_FOREACH, 0, &msg);
+		result = joolnl_alloc_msg(sk, iname, JNLOP_EAMT_FOREACH,
+				JOOLNLHDR_FLAGS_LARGE, &msg);
 		if (result.error)
 			return result;
 
@@ -106,11 +107,22 @@ nla_put_failure:
 }
 
 struct jool_result joolnl_eamt_add(struct joolnl_socket *sk, char const *iname,
-		struct ipv6_prefix const *p6, struct ipv4_prefix const *p4,
-		bool force)
+		struct eamt_entry const *entry, bool force)
 {
-	return __update(sk, iname, JNLOP_EAMT_ADD, p6, p4,
-			force ? JOOLNLHDR_FLAGS_FORCE : 0);
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_EAMT_ADD,
+			force ? JOOLNLHDR_FLAGS_FORCE : 0, &msg);
+	if (result.error)
+		return result;
+
+	if (nla_put_eam(msg, JNLAR_OPERAND, entry) < 0) {
+		nlmsg_free(msg);
+		return joolnl_err_msgsize();
+	}
+
+	return joolnl_request(sk, msg, NULL, NULL);
 }
 
 struct jool_result joolnl_eamt_rm(struct joolnl_socket *sk, char const *iname,
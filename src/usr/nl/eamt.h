@@ -18,8 +18,7 @@ struct jool_result joolnl_eamt_foreach(
 struct jool_result joolnl_eamt_add(
 	struct joolnl_socket *sk,
 	char const *iname,
-	struct ipv6_prefix const *p6,
-	struct ipv4_prefix const *p4,
+	struct eamt_entry const *entry,
 	bool force
 );
 
@@ -10,9 +10,13 @@
 #include "usr/util/file.h"
 #include "usr/util/str_utils.h"
 #include "usr/nl/attribute.h"
+#include "usr/nl/bib.h"
 #include "usr/nl/common.h"
+#include "usr/nl/denylist4.h"
+#include "usr/nl/eamt.h"
 #include "usr/nl/global.h"
 #include "usr/nl/json.h"
+#include "usr/nl/pool4.h"
 
 #define OPTNAME_INAME 			"instance"
 #define OPTNAME_FW			"framework"
@@ -22,6 +26,8 @@
 #define OPTNAME_DENYLIST		"denylist4"
 #define OPTNAME_POOL4			"pool4"
 #define OPTNAME_BIB			"bib"
+#define OPTNAME_EAMT_SHARE		"eamt-share"
+#define OPTNAME_DENYLIST_SHARE		"denylist4-share"
 #define OPTNAME_MAX_ITERATIONS		"max-iterations"
 
 /* TODO (warning) These variables prevent this module from being thread-safe. */
@@ -29,6 +35,9 @@ static struct joolnl_socket sk;
 static char const *iname;
 static xlator_flags flags;
 static __u8 force;
+static bool diff;
+/* The file is an array of instances; commit them together. */
+static bool batch;
 
 struct json_meta {
 	char const *name; /* This being NULL signals the end of the array. */
@@ -79,6 +88,14 @@ static bool tagname_equals(cJSON const *json, char const *name)
 	return strcasecmp(json->string, name) == 0;
 }
 
+static bool has_child(cJSON const *json, char const *name)
+{
+	for (json = json->child; json; json = json->next)
+		if (tagname_equals(json, name))
+			return true;
+	return false;
+}
+
 /*
  * ==================================
  * ===== Generic object handlers ====
@@ -127,63 +144,145 @@ static struct jool_result handle_object(cJSON *obj, struct json_meta *metadata)
 	return result_success();
 }
 
+/*
+ * Walks the elements of an array, whether it was parsed whole or lazily.
+ * (See is_lazy_table().)
+ */
+struct array_iterator {
+	cJSON *array;
+	/* Current element. NULL means the array ended. */
+	cJSON *item;
+	/* Lazy arrays only. */
+	char const *cursor;
+};
+
+static struct jool_result parse_error(void)
+{
+	return result_from_error(
+		-EINVAL,
+		"The JSON parser got confused around the beginning of this string:\n"
+		"%s", cJSON_GetErrorPtr()
+	);
+}
+
+static struct jool_result array_next(struct array_iterator *iter)
+{
+	if (!iter->array->lazy) {
+		iter->item = iter->item->next;
+		return result_success();
+	}
+
+	if (iter->item)
+		cJSON_Delete(iter->item);
+	iter->item = cJSON_ParseLazyItem(iter->array, &iter->cursor);
+	if (!iter->item && cJSON_GetErrorPtr())
+		return parse_error();
+	return result_success();
+}
+
+static struct jool_result array_first(struct array_iterator *iter,
+		cJSON *json, char const *name)
+{
+	if (json->type != cJSON_Array)
+		return type_mismatch(name, json, "Array");
+
+	iter->array = json;
+	iter->item = NULL;
+	iter->cursor = NULL;
+
+	if (json->lazy)
+		return array_next(iter);
+
+	iter->item = json->child;
+	return result_success();
+}
+
+/* Releases the iteration's leftovers, in case it was interrupted. */
+static void array_end(struct array_iterator *iter)
+{
+	if (iter->array->lazy && iter->item)
+		cJSON_Delete(iter->item);
+	iter->item = NULL;
+}
+
 static struct jool_result handle_array(cJSON *json, int attrtype, char *name,
 		struct jool_result (*entry_handler)(cJSON *, struct nl_msg *))
 {
+	struct array_iterator iter;
+	struct joolnl_pipeline pipeline;
 	struct nl_msg *msg;
 	struct nlattr *root;
 	unsigned int entries_written;
 	struct jool_result result;
 
-	if (json->type != cJSON_Array)
-		return type_mismatch(name, json, "Array");
+	result = array_first(&iter, json, name);
+	if (result.error)
+		return result;
 
+	joolnl_pipeline_init(&pipeline, &sk, NULL, NULL);
 	msg = NULL;
 	root = NULL;
 	entries_written = 0;
-	for (json = json->child; json; json = json->next) {
+	while (iter.item) {
 		if (msg == NULL) {
 			result = joolnl_alloc_msg(&sk, iname, JNLOP_FILE_HANDLE,
 					force, &msg);
 			if (result.error)
-				return result;
+				goto abort;
 
 			root = jnla_nest_start(msg, attrtype);
 			if (!root)
 				goto too_small;
 		}
 
-		result = entry_handler(json, msg);
+		result = entry_handler(iter.item, msg);
 		if (result.error) {
-			if (result.error != -NLE_NOMEM)
-				return result;
+			if (result.error != -NLE_NOMEM) {
+				nlmsg_free(msg);
+				goto abort;
+			}
 			result_cleanup(&result);
 
 			if (entries_written == 0)
 				goto too_small;
 
 			nla_nest_end(msg, root);
-			result = joolnl_request(&sk, msg, NULL, NULL);
+			result = joolnl_pipeline_send(&pipeline, msg);
 			if (result.error)
-				return result;
+				goto end;
 
+			/* Retry the same entry in a new message. */
 			msg = NULL;
-			json = json->prev;
 			entries_written = 0;
-		} else {
-			entries_written++;
+			continue;
+		}
+
+		entries_written++;
+		result = array_next(&iter);
+		if (result.error) {
+			nlmsg_free(msg);
+			goto abort;
 		}
 	}
 
 	if (entries_written == 0)
-		return result_success();
+		return joolnl_pipeline_flush(&pipeline);
 
 	nla_nest_end(msg, root);
-	return joolnl_request(&sk, msg, NULL, NULL);
+	result = joolnl_pipeline_send(&pipeline, msg);
+	if (result.error)
+		return result;
+	return joolnl_pipeline_flush(&pipeline);
 
 too_small:
 	nlmsg_free(msg);
-	return joolnl_err_msgsize();
+	result = joolnl_err_msgsize();
+	/* Fall through */
+abort:
+	joolnl_pipeline_abort(&pipeline);
+end:
+	array_end(&iter);
+	return result;
 }
 
 static struct jool_result write_global(struct cJSON *json, void const *meta,
@@ -286,6 +385,18 @@ static struct jool_result json2mark(cJSON *json, void const *arg1, void *arg2)
 	return result;
 }
 
+static struct jool_result json2bits(cJSON *json, void const *arg1, void *arg2)
+{
+	struct jool_result result;
+
+	result = validate_uint(json->string, json, 0, 64);
+	if (result.error)
+		return result;
+
+	*((__u8 *)arg2) = json->valueint;
+	return result;
+}
+
 static struct jool_result json2port_range(cJSON *json, void const *arg1, void *arg2)
 {
 	return (json->type == cJSON_String)
@@ -369,20 +480,81 @@ static struct jool_result json2proto(cJSON *json, void const *arg1, void *arg2)
  * =================================
  */
 
-static struct jool_result handle_eam_entry(cJSON *json, struct nl_msg *msg)
+static struct jool_result json2eam(cJSON *json, void *arg)
 {
-	struct eamt_entry eam;
+	struct eamt_entry *eam = arg;
 	struct json_meta meta[] = {
-		{ "ipv6 prefix", json2prefix6, NULL, &eam.prefix6, true },
-		{ "ipv4 prefix", json2prefix4, NULL, &eam.prefix4, true },
+		{ "ipv6 prefix", json2prefix6, NULL, &eam->prefix6, true },
+		{ "ipv4 prefix", json2prefix4, NULL, &eam->prefix4, true },
+		{ "ea bits length", json2bits, NULL, &eam->ea_len, false },
+		{ "psid offset", json2bits, NULL, &eam->psid_offset, false },
 		{ NULL },
 	};
 	struct jool_result result;
 
+	eam->ea_len = 0;
+	eam->psid_offset = DEFAULT_PSID_OFFSET;
+
 	result = handle_object(json, meta);
 	if (result.error)
 		return result;
 
+	if (!eam->ea_len)
+		eam->psid_offset = 0;
+	return result_success();
+}
+
+static struct jool_result json2denylist(cJSON *json, void *arg)
+{
+	if (json->type != cJSON_String)
+		return string_expected("denylist entry", json);
+	return str_to_prefix4(json->valuestring, arg);
+}
+
+static struct jool_result json2pool4(cJSON *json, void *arg)
+{
+	struct pool4_entry *entry = arg;
+	struct json_meta meta[] = {
+		{ "mark", json2mark, NULL, &entry->mark, false },
+		{ "protocol", json2proto, NULL, &entry->proto, true },
+		{ "prefix", json2prefix4, NULL, &entry->range.prefix, true },
+		{ "port range", json2port_range, NULL, &entry->range.ports, false },
+		{ OPTNAME_MAX_ITERATIONS, json2max_iterations, NULL, entry, false },
+		{ NULL },
+	};
+
+	entry->mark = 0;
+	entry->range.ports.min = DEFAULT_POOL4_MIN_PORT;
+	entry->range.ports.max = DEFAULT_POOL4_MAX_PORT;
+	entry->iterations = 0;
+	entry->flags = 0;
+
+	return handle_object(json, meta);
+}
+
+static struct jool_result json2bib(cJSON *json, void *arg)
+{
+	struct bib_entry *entry = arg;
+	struct json_meta meta[] = {
+		{ "ipv6 address", json2taddr6, NULL, &entry->addr6, true },
+		{ "ipv4 address", json2taddr4, NULL, &entry->addr4, true },
+		{ "protocol", json2proto, NULL, &entry->l4_proto, true },
+		{ NULL },
+	};
+
+	entry->is_static = true;
+	return handle_object(json, meta);
+}
+
+static struct jool_result handle_eam_entry(cJSON *json, struct nl_msg *msg)
+{
+	struct eamt_entry eam;
+	struct jool_result result;
+
+	result = json2eam(json, &eam);
+	if (result.error)
+		return result;
+
 	return (nla_put_eam(msg, JNLAL_ENTRY, &eam) < 0)
 			? joolnl_err_msgsize()
 			: result_success();
@@ -393,10 +565,7 @@ static struct jool_result handle_denylist_entry(cJSON *json, struct nl_msg *msg)
 	struct ipv4_prefix prefix;
 	struct jool_result result;
 
-	if (json->type != cJSON_String)
-		return string_expected("denylist entry", json);
-
-	result = str_to_prefix4(json->valuestring, &prefix);
+	result = json2denylist(json, &prefix);
 	if (result.error)
 		return result;
 
@@ -408,23 +577,9 @@ static struct jool_result handle_denylist_entry(cJSON *json, struct nl_msg *msg)
 static struct jool_result handle_pool4_entry(cJSON *json, struct nl_msg *msg)
 {
 	struct pool4_entry entry;
-	struct json_meta meta[] = {
-		{ "mark", json2mark, NULL, &entry.mark, false },
-		{ "protocol", json2proto, NULL, &entry.proto, true },
-		{ "prefix", json2prefix4, NULL, &entry.range.prefix, true },
-		{ "port range", json2port_range, NULL, &entry.range.ports, false },
-		{ OPTNAME_MAX_ITERATIONS, json2max_iterations, NULL, &entry, false },
-		{ NULL },
-	};
 	struct jool_result result;
 
-	entry.mark = 0;
-	entry.range.ports.min = DEFAULT_POOL4_MIN_PORT;
-	entry.range.ports.max = DEFAULT_POOL4_MAX_PORT;
-	entry.iterations = 0;
-	entry.flags = 0;
-
-	result = handle_object(json, meta);
+	result = json2pool4(json, &entry);
 	if (result.error)
 		return result;
 
@@ -436,17 +591,9 @@ static struct jool_result handle_pool4_entry(cJSON *json, struct nl_msg *msg)
 static struct jool_result handle_bib_entry(cJSON *json, struct nl_msg *msg)
 {
 	struct bib_entry entry;
-	struct json_meta meta[] = {
-		{ "ipv6 address", json2taddr6, NULL, &entry.addr6, true },
-		{ "ipv4 address", json2taddr4, NULL, &entry.addr4, true },
-		{ "protocol", json2proto, NULL, &entry.l4_proto, true },
-		{ NULL },
-	};
 	struct jool_result result;
 
-	entry.is_static = true;
-
-	result = handle_object(json, meta);
+	result = json2bib(json, &entry);
 	if (result.error)
 		return result;
 
@@ -455,6 +602,508 @@ static struct jool_result handle_bib_entry(cJSON *json, struct nl_msg *msg)
 			: result_success();
 }
 
+/*
+ * =================================
+ * =========== Diff mode ===========
+ * =================================
+ *
+ * Instead of uploading the tables, compare them to the running ones, and only
+ * upload the differences. (Removals first.) The kernel only copies the tables
+ * that change, and leaves the rest alone.
+ */
+
+struct entry_list {
+	unsigned char *entries;
+	unsigned int count;
+	unsigned int max;
+	size_t entry_size;
+};
+
+struct diff_table {
+	char const *name;
+	int attrtype;
+	size_t entry_size;
+	/* Parses one of the file's entries. Might append more than one. */
+	struct jool_result (*parse)(cJSON *, struct entry_list *);
+	/* Appends all of the running table's entries to the list. */
+	struct jool_result (*fetch)(struct entry_list *);
+	int (*compare)(void const *, void const *);
+	int (*put)(struct nl_msg *, int, void const *);
+};
+
+static void *entry_at(struct entry_list *list, unsigned int i)
+{
+	return list->entries + i * list->entry_size;
+}
+
+static struct jool_result list_append(struct entry_list *list,
+		void const *entry)
+{
+	unsigned char *tmp;
+	unsigned int max;
+
+	if (list->count == list->max) {
+		max = list->max ? (2 * list->max) : 64;
+		tmp = realloc(list->entries, max * list->entry_size);
+		if (!tmp)
+			return result_from_enomem();
+		list->entries = tmp;
+		list->max = max;
+	}
+
+	memcpy(entry_at(list, list->count), entry, list->entry_size);
+	list->count++;
+	return result_success();
+}
+
+static int compare_prefix4(struct ipv4_prefix const *p1,
+		struct ipv4_prefix const *p2)
+{
+	int gap;
+
+	gap = memcmp(&p1->addr, &p2->addr, sizeof(p1->addr));
+	return gap ? gap : ((int)p1->len - (int)p2->len);
+}
+
+static int compare_taddr6(struct ipv6_transport_addr const *a1,
+		struct ipv6_transport_addr const *a2)
+{
+	int gap;
+
+	gap = memcmp(&a1->l3, &a2->l3, sizeof(a1->l3));
+	return gap ? gap : ((int)a1->l4 - (int)a2->l4);
+}
+
+static int compare_taddr4(struct ipv4_transport_addr const *a1,
+		struct ipv4_transport_addr const *a2)
+{
+	int gap;
+
+	gap = memcmp(&a1->l3, &a2->l3, sizeof(a1->l3));
+	return gap ? gap : ((int)a1->l4 - (int)a2->l4);
+}
+
+/* EAMT */
+
+static struct jool_result parse_eam(cJSON *json, struct entry_list *list)
+{
+	struct eamt_entry eam;
+	struct jool_result result;
+
+	result = json2eam(json, &eam);
+	return result.error ? result : list_append(list, &eam);
+}
+
+static struct jool_result append_eam_cb(struct eamt_entry const *eam,
+		void *list)
+{
+	return list_append(list, eam);
+}
+
+static struct jool_result fetch_eamt(struct entry_list *list)
+{
+	return joolnl_eamt_foreach(&sk, iname, append_eam_cb, list);
+}
+
+static int compare_eam(void const *a, void const *b)
+{
+	struct eamt_entry const *eam1 = a;
+	struct eamt_entry const *eam2 = b;
+	int gap;
+
+	gap = memcmp(&eam1->prefix6.addr, &eam2->prefix6.addr,
+			sizeof(eam1->prefix6.addr));
+	if (gap)
+		return gap;
+	gap = (int)eam1->prefix6.len - (int)eam2->prefix6.len;
+	if (gap)
+		return gap;
+	gap = compare_prefix4(&eam1->prefix4, &eam2->prefix4);
+	if (gap)
+		return gap;
+	gap = (int)eam1->ea_len - (int)eam2->ea_len;
+	if (gap)
+		return gap;
+	return (int)eam1->psid_offset - (int)eam2->psid_offset;
+}
+
+static int put_eam(struct nl_msg *msg, int attrtype, void const *eam)
+{
+	return nla_put_eam(msg, attrtype, eam);
+}
+
+/* denylist4 */
+
+static struct jool_result parse_denylist(cJSON *json, struct entry_list *list)
+{
+	struct ipv4_prefix prefix;
+	struct jool_result result;
+
+	result = json2denylist(json, &prefix);
+	return result.error ? result : list_append(list, &prefix);
+}
+
+static struct jool_result append_denylist_cb(struct ipv4_prefix const *prefix,
+		void *list)
+{
+	return list_append(list, prefix);
+}
+
+static struct jool_result fetch_denylist(struct entry_list *list)
+{
+	return joolnl_denylist4_foreach(&sk, iname, append_denylist_cb, list);
+}
+
+static int compare_denylist(void const *a, void const *b)
+{
+	return compare_prefix4(a, b);
+}
+
+static int put_denylist(struct nl_msg *msg, int attrtype, void const *prefix)
+{
+	return nla_put_prefix4(msg, attrtype, prefix);
+}
+
+/* pool4 */
+
+/*
+ * The kernel stores pool4 one address at a time, so the file's entries are
+ * split the same way. (Otherwise, they would never match the running ones.)
+ */
+static struct jool_result parse_pool4(cJSON *json, struct entry_list *list)
+{
+	struct pool4_entry entry;
+	__u32 addr, last;
+	__u16 tmp;
+	struct jool_result result;
+
+	result = json2pool4(json, &entry);
+	if (result.error)
+		return result;
+
+	/* Same normalization as the kernel's. */
+	if (entry.range.ports.min > entry.range.ports.max) {
+		tmp = entry.range.ports.min;
+		entry.range.ports.min = entry.range.ports.max;
+		entry.range.ports.max = tmp;
+	}
+	if (entry.proto != L4PROTO_ICMP && entry.range.ports.min == 0)
+		entry.range.ports.min = 1;
+
+	addr = ntohl(entry.range.prefix.addr.s_addr);
+	last = addr | ((entry.range.prefix.len < 32)
+			? (0xFFFFFFFFu >> entry.range.prefix.len)
+			: 0);
+	entry.range.prefix.len = 32;
+	do {
+		entry.range.prefix.addr.s_addr = htonl(addr);
+		result = list_append(list, &entry);
+		if (result.error)
+			return result;
+	} while (addr++ != last);
+
+	return result_success();
+}
+
+static struct jool_result append_pool4_cb(struct pool4_entry const *entry,
+		void *list)
+{
+	return list_append(list, entry);
+}
+
+static struct jool_result fetch_pool4(struct entry_list *list)
+{
+	struct jool_result result;
+
+	result = joolnl_pool4_foreach(&sk, iname, L4PROTO_TCP,
+			append_pool4_cb, list);
+	if (result.error)
+		return result;
+	result = joolnl_pool4_foreach(&sk, iname, L4PROTO_UDP,
+			append_pool4_cb, list);
+	if (result.error)
+		return result;
+	return joolnl_pool4_foreach(&sk, iname, L4PROTO_ICMP,
+			append_pool4_cb, list);
+}
+
+/* Entries that don't set max-iterations default to automatic. */
+static __u8 iterations_mode(struct pool4_entry const *entry)
+{
+	if (entry->flags & ITERATIONS_INFINITE)
+		return ITERATIONS_INFINITE;
+	if ((entry->flags & ITERATIONS_AUTO) || !(entry->flags & ITERATIONS_SET))
+		return ITERATIONS_AUTO;
+	return ITERATIONS_SET;
+}
+
+static int compare_pool4(void const *a, void const *b)
+{
+	struct pool4_entry const *e1 = a;
+	struct pool4_entry const *e2 = b;
+	int gap;
+
+	if (e1->mark != e2->mark)
+		return (e1->mark < e2->mark) ? -1 : 1;
+	gap = (int)e1->proto - (int)e2->proto;
+	if (gap)
+		return gap;
+	gap = compare_prefix4(&e1->range.prefix, &e2->range.prefix);
+	if (gap)
+		return gap;
+	gap = (int)e1->range.ports.min - (int)e2->range.ports.min;
+	if (gap)
+		return gap;
+	gap = (int)e1->range.ports.max - (int)e2->range.ports.max;
+	if (gap)
+		return gap;
+	gap = (int)iterations_mode(e1) - (int)iterations_mode(e2);
+	if (gap)
+		return gap;
+	if (iterations_mode(e1) == ITERATIONS_SET
+			&& e1->iterations != e2->iterations)
+		return (e1->iterations < e2->iterations) ? -1 : 1;
+	return 0;
+}
+
+static int put_pool4(struct nl_msg *msg, int attrtype, void const *entry)
+{
+	return nla_put_pool4(msg, attrtype, entry);
+}
+
+/* BIB */
+
+static struct jool_result parse_bib(cJSON *json, struct entry_list *list)
+{
+	struct bib_entry entry;
+	struct jool_result result;
+
+	result = json2bib(json, &entry);
+	return result.error ? result : list_append(list, &entry);
+}
+
+/* Only the static entries belong to the configuration. */
+static struct jool_result append_static_cb(struct bib_entry const *entry,
+		void *list)
+{
+	return entry->is_static ? list_append(list, entry) : result_success();
+}
+
+static struct jool_result fetch_bib(struct entry_list *list)
+{
+	struct jool_result result;
+
+	result = joolnl_bib_foreach(&sk, iname, L4PROTO_TCP, NULL,
+			append_static_cb, list);
+	if (result.error)
+		return result;
+	result = joolnl_bib_foreach(&sk, iname, L4PROTO_UDP, NULL,
+			append_static_cb, list);
+	if (result.error)
+		return result;
+	return joolnl_bib_foreach(&sk, iname, L4PROTO_ICMP, NULL,
+			append_static_cb, list);
+}
+
+static int compare_bib(void const *a, void const *b)
+{
+	struct bib_entry const *e1 = a;
+	struct bib_entry const *e2 = b;
+	int gap;
+
+	gap = (int)e1->l4_proto - (int)e2->l4_proto;
+	if (gap)
+		return gap;
+	gap = compare_taddr6(&e1->addr6, &e2->addr6);
+	if (gap)
+		return gap;
+	return compare_taddr4(&e1->addr4, &e2->addr4);
+}
+
+static int put_bib(struct nl_msg *msg, int attrtype, void const *entry)
+{
+	return nla_put_bib(msg, attrtype, entry);
+}
+
+static struct diff_table const eamt_table = {
+	.name = OPTNAME_EAMT,
+	.attrtype = JNLAR_EAMT_ENTRIES,
+	.entry_size = sizeof(struct eamt_entry),
+	.parse = parse_eam,
+	.fetch = fetch_eamt,
+	.compare = compare_eam,
+	.put = put_eam,
+};
+
+static struct diff_table const denylist_table = {
+	.name = OPTNAME_DENYLIST,
+	.attrtype = JNLAR_BL4_ENTRIES,
+	.entry_size = sizeof(struct ipv4_prefix),
+	.parse = parse_denylist,
+	.fetch = fetch_denylist,
+	.compare = compare_denylist,
+	.put = put_denylist,
+};
+
+static struct diff_table const pool4_table = {
+	.name = OPTNAME_POOL4,
+	.attrtype = JNLAR_POOL4_ENTRIES,
+	.entry_size = sizeof(struct pool4_entry),
+	.parse = parse_pool4,
+	.fetch = fetch_pool4,
+	.compare = compare_pool4,
+	.put = put_pool4,
+};
+
+static struct diff_table const bib_table = {
+	.name = OPTNAME_BIB,
+	.attrtype = JNLAR_BIB_ENTRIES,
+	.entry_size = sizeof(struct bib_entry),
+	.parse = parse_bib,
+	.fetch = fetch_bib,
+	.compare = compare_bib,
+	.put = put_bib,
+};
+
+/* Sends @list's entries as @listtype attributes, in as few messages as possible. */
+static struct jool_result send_list(struct diff_table const *table,
+		int listtype, struct entry_list *list)
+{
+	struct joolnl_pipeline pipeline;
+	struct nl_msg *msg;
+	struct nlattr *root;
+	unsigned int i;
+	unsigned int entries_written;
+	struct jool_result result;
+
+	joolnl_pipeline_init(&pipeline, &sk, NULL, NULL);
+	msg = NULL;
+	root = NULL;
+	entries_written = 0;
+	for (i = 0; i < list->count; i++) {
+		if (msg == NULL) {
+			result = joolnl_alloc_msg(&sk, iname, JNLOP_FILE_HANDLE,
+					force, &msg);
+			if (result.error)
+				goto abort;
+
+			root = jnla_nest_start(msg, table->attrtype);
+			if (!root)
+				goto too_small;
+		}
+
+		if (table->put(msg, listtype, entry_at(list, i)) < 0) {
+			if (entries_written == 0)
+				goto too_small;
+
+			nla_nest_end(msg, root);
+			result = joolnl_pipeline_send(&pipeline, msg);
+			if (result.error)
+				return result;
+
+			msg = NULL;
+			i--;
+			entries_written = 0;
+		} else {
+			entries_written++;
+		}
+	}
+
+	if (entries_written == 0)
+		return joolnl_pipeline_flush(&pipeline);
+
+	nla_nest_end(msg, root);
+	result = joolnl_pipeline_send(&pipeline, msg);
+	if (result.error)
+		return result;
+	return joolnl_pipeline_flush(&pipeline);
+
+too_small:
+	nlmsg_free(msg);
+	joolnl_pipeline_abort(&pipeline);
+	return joolnl_err_msgsize();
+abort:
+	joolnl_pipeline_abort(&pipeline);
+	return result;
+}
+
+/*
+ * @json is the file's version of @table; NULL means the file doesn't define
+ * it. (Which means it's supposed to be emptied.)
+ */
+static struct jool_result handle_diff(cJSON *json,
+		struct diff_table const *table)
+{
+	struct entry_list file = { .entry_size = table->entry_size };
+	struct entry_list running = { .entry_size = table->entry_size };
+	struct entry_list adds = { .entry_size = table->entry_size };
+	struct entry_list rms = { .entry_size = table->entry_size };
+	struct array_iterator iter;
+	unsigned int f, r;
+	int gap;
+	struct jool_result result;
+
+	if (json) {
+		result = array_first(&iter, json, table->name);
+		if (result.error)
+			return result;
+		while (iter.item) {
+			result = table->parse(iter.item, &file);
+			if (result.error) {
+				array_end(&iter);
+				goto end;
+			}
+			result = array_next(&iter);
+			if (result.error)
+				goto end;
+		}
+	}
+
+	result = table->fetch(&running);
+	if (result.error)
+		goto end;
+
+	qsort(file.entries, file.count, file.entry_size, table->compare);
+	qsort(running.entries, running.count, running.entry_size,
+			table->compare);
+
+	f = r = 0;
+	while (f < file.count || r < running.count) {
+		if (f == file.count)
+			gap = 1;
+		else if (r == running.count)
+			gap = -1;
+		else
+			gap = table->compare(entry_at(&file, f),
+					entry_at(&running, r));
+
+		if (gap < 0)
+			result = list_append(&adds, entry_at(&file, f++));
+		else if (gap > 0)
+			result = list_append(&rms, entry_at(&running, r++));
+		else {
+			f++;
+			r++;
+			continue;
+		}
+		if (result.error)
+			goto end;
+	}
+
+	result = send_list(table, JNLAL_RM_ENTRY, &rms);
+	if (result.error)
+		goto end;
+	result = send_list(table, JNLAL_ENTRY, &adds);
+	/* Fall through */
+
+end:
+	free(file.entries);
+	free(running.entries);
+	free(adds.entries);
+	free(rms.entries);
+	return result;
+}
+
 /*
  * ==========================================
  * = Second level tag handlers, second pass =
@@ -473,27 +1122,115 @@ static struct jool_result handle_global_tag(cJSON *json, void const *arg1, void
 
 static struct jool_result handle_eamt_tag(cJSON *json, void const *arg1, void *arg2)
 {
-	return handle_array(json, JNLAR_EAMT_ENTRIES, OPTNAME_EAMT, handle_eam_entry);
+	return diff
+		? handle_diff(json, &eamt_table)
+		: handle_array(json, JNLAR_EAMT_ENTRIES, OPTNAME_EAMT, handle_eam_entry);
 }
 
 static struct jool_result handle_bl4_tag(cJSON *json, void const *arg1, void *arg2)
 {
-	return handle_array(json, JNLAR_BL4_ENTRIES, OPTNAME_BLACKLIST, handle_denylist_entry);
+	return diff
+		? handle_diff(json, &denylist_table)
+		: handle_array(json, JNLAR_BL4_ENTRIES, OPTNAME_BLACKLIST, handle_denylist_entry);
 }
 
 static struct jool_result handle_dl4_tag(cJSON *json, void const *arg1, void *arg2)
 {
-	return handle_array(json, JNLAR_BL4_ENTRIES, OPTNAME_DENYLIST, handle_denylist_entry);
+	return diff
+		? handle_diff(json, &denylist_table)
+		: handle_array(json, JNLAR_BL4_ENTRIES, OPTNAME_DENYLIST, handle_denylist_entry);
+}
+
+/* Stores the name in @name, which is a char const **; see send_share(). */
+static struct jool_result handle_share_tag(cJSON *json, void const *arg1,
+		void *name)
+{
+	if (json->type != cJSON_String)
+		return string_expected(json->string, json);
+	if (iname_validate(json->valuestring, false)) {
+		return result_from_error(
+			-EINVAL,
+			"'%s' is not a valid table name. (Same rules as instance names.)",
+			json->valuestring
+		);
+	}
+
+	*((char const **)name) = json->valuestring;
+	return result_success();
 }
 
 static struct jool_result handle_pool4_tag(cJSON *json, void const *arg1, void *arg2)
 {
-	return handle_array(json, JNLAR_POOL4_ENTRIES, OPTNAME_POOL4, handle_pool4_entry);
+	return diff
+		? handle_diff(json, &pool4_table)
+		: handle_array(json, JNLAR_POOL4_ENTRIES, OPTNAME_POOL4, handle_pool4_entry);
 }
 
 static struct jool_result handle_bib_tag(cJSON *json, void const *arg1, void *arg2)
 {
-	return handle_array(json, JNLAR_BIB_ENTRIES, OPTNAME_BIB, handle_bib_entry);
+	return diff
+		? handle_diff(json, &bib_table)
+		: handle_array(json, JNLAR_BIB_ENTRIES, OPTNAME_BIB, handle_bib_entry);
+}
+
+static bool tag_found(struct json_meta const *meta, char const *name)
+{
+	for (; meta->name; meta++)
+		if (strcmp(meta->name, name) == 0)
+			return meta->already_found;
+	return false;
+}
+
+/* Diff mode: Tables the file doesn't mention have to be emptied. */
+static struct jool_result diff_missing(struct json_meta const *meta,
+		char const *name, struct diff_table const *table)
+{
+	return tag_found(meta, name)
+			? result_success()
+			: handle_diff(NULL, table);
+}
+
+/*
+ * The tables the file names, but doesn't define, are the published ones. The
+ * ones it both names and defines are published, once the file is committed.
+ */
+static struct jool_result send_share(struct json_meta const *meta,
+		char const *eamt, char const *denylist4)
+{
+	struct nl_msg *msg;
+	struct nlattr *root;
+	__u8 publish;
+	struct jool_result result;
+
+	if (!eamt && !denylist4)
+		return result_success();
+
+	publish = 0;
+	if (eamt && tag_found(meta, OPTNAME_EAMT))
+		publish |= JNLASH_PUBLISH_EAMT;
+	if (denylist4 && (tag_found(meta, OPTNAME_DENYLIST)
+			|| tag_found(meta, OPTNAME_BLACKLIST)))
+		publish |= JNLASH_PUBLISH_DENYLIST4;
+
+	result = joolnl_alloc_msg(&sk, iname, JNLOP_FILE_HANDLE, 0, &msg);
+	if (result.error)
+		return result;
+
+	root = jnla_nest_start(msg, JNLAR_SHARE);
+	if (!root)
+		goto nla_put_failure;
+	if (eamt)
+		NLA_PUT_STRING(msg, JNLASH_EAMT, eamt);
+	if (denylist4)
+		NLA_PUT_STRING(msg, JNLASH_DENYLIST4, denylist4);
+	NLA_PUT_U8(msg, JNLASH_PUBLISH, publish);
+	nla_nest_end(msg, root);
+
+	return joolnl_request(&sk, msg, NULL, NULL);
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
 }
 
 /*
@@ -504,6 +1241,8 @@ static struct jool_result handle_bib_tag(cJSON *json, void const *arg1, void *ar
 
 static struct jool_result parse_siit_json(cJSON *json)
 {
+	char const *eamt_share = NULL;
+	char const *denylist_share = NULL;
 	struct json_meta meta[] = {
 		/* instance and framework were already handled. */
 		{ OPTNAME_INAME, do_nothing, NULL, NULL, true },
@@ -512,10 +1251,37 @@ static struct jool_result parse_siit_json(cJSON *json)
 		{ OPTNAME_EAMT, handle_eamt_tag, NULL, NULL, false },
 		{ OPTNAME_BLACKLIST, handle_bl4_tag, NULL, NULL, false },
 		{ OPTNAME_DENYLIST, handle_dl4_tag, NULL, NULL, false },
+		{ OPTNAME_EAMT_SHARE, handle_share_tag, NULL, &eamt_share, false },
+		{ OPTNAME_DENYLIST_SHARE, handle_share_tag, NULL, &denylist_share, false },
 		{ NULL },
 	};
+	struct jool_result result;
 
-	return handle_object(json, meta);
+	if (diff && has_child(json, OPTNAME_BLACKLIST)
+			&& has_child(json, OPTNAME_DENYLIST)) {
+		return result_from_error(
+			-EINVAL,
+			"Diff mode cannot merge '%s' and '%s'; please use only '%s'.",
+			OPTNAME_BLACKLIST, OPTNAME_DENYLIST, OPTNAME_DENYLIST
+		);
+	}
+
+	result = handle_object(json, meta);
+	if (result.error)
+		return result;
+	result = send_share(meta, eamt_share, denylist_share);
+	if (result.error || !diff)
+		return result;
+
+	/* The published tables replace the running ones wholesale. */
+	if (!eamt_share) {
+		result = diff_missing(meta, OPTNAME_EAMT, &eamt_table);
+		if (result.error)
+			return result;
+	}
+	if (!denylist_share && !tag_found(meta, OPTNAME_BLACKLIST))
+		result = diff_missing(meta, OPTNAME_DENYLIST, &denylist_table);
+	return result;
 }
 
 static struct jool_result parse_nat64_json(cJSON *json)
@@ -529,8 +1295,16 @@ static struct jool_result parse_nat64_json(cJSON *json)
 		{ OPTNAME_BIB, handle_bib_tag, NULL, NULL, false },
 		{ NULL },
 	};
+	struct jool_result result;
 
-	return handle_object(json, meta);
+	result = handle_object(json, meta);
+	if (result.error || !diff)
+		return result;
+
+	result = diff_missing(meta, OPTNAME_POOL4, &pool4_table);
+	if (result.error)
+		return result;
+	return diff_missing(meta, OPTNAME_BIB, &bib_table);
 }
 
 /*
@@ -604,6 +1378,8 @@ static struct jool_result prepare_instance(char const *_iname, cJSON *json)
 		{ OPTNAME_DENYLIST, do_nothing },
 		{ OPTNAME_POOL4, do_nothing },
 		{ OPTNAME_BIB, do_nothing },
+		{ OPTNAME_EAMT_SHARE, do_nothing },
+		{ OPTNAME_DENYLIST_SHARE, do_nothing },
 		{ NULL },
 	};
 	struct jool_result result;
@@ -643,9 +1419,16 @@ static struct jool_result prepare_instance(char const *_iname, cJSON *json)
 static struct jool_result send_ctrl_msg(bool init)
 {
 	struct nl_msg *msg;
+	__u8 hdr_flags;
 	struct jool_result result;
 
-	result = joolnl_alloc_msg(&sk, iname, JNLOP_FILE_HANDLE, 0, &msg);
+	if (init)
+		hdr_flags = diff ? JOOLNLHDR_FLAGS_DIFF : 0;
+	else
+		hdr_flags = batch ? JOOLNLHDR_FLAGS_BATCH : 0;
+
+	result = joolnl_alloc_msg(&sk, iname, JNLOP_FILE_HANDLE, hdr_flags,
+			&msg);
 	if (result.error)
 		return result;
 
@@ -665,27 +1448,31 @@ nla_put_failure:
 	return result;
 }
 
-static struct jool_result do_parsing(char const *iname, char *buffer)
+/*
+ * The tables can be huge, so they're parsed (and sent) one entry at a time,
+ * instead of being loaded whole.
+ */
+static int is_lazy_table(char const *name)
 {
-	cJSON *json;
-	struct jool_result result;
+	return strcasecmp(name, OPTNAME_EAMT) == 0
+			|| strcasecmp(name, OPTNAME_BLACKLIST) == 0
+			|| strcasecmp(name, OPTNAME_DENYLIST) == 0
+			|| strcasecmp(name, OPTNAME_POOL4) == 0
+			|| strcasecmp(name, OPTNAME_BIB) == 0;
+}
 
-	json = cJSON_Parse(buffer);
-	if (!json) {
-		return result_from_error(
-			-EINVAL,
-			"The JSON parser got confused around the beginning of this string:\n"
-			"%s", cJSON_GetErrorPtr()
-		);
-	}
+/* Uploads the instance @json describes. */
+static struct jool_result handle_instance(char const *iname, cJSON *json)
+{
+	struct jool_result result;
 
 	result = prepare_instance(iname, json);
 	if (result.error)
-		goto fail;
+		return result;
 
 	result = send_ctrl_msg(true);
 	if (result.error)
-		goto fail;
+		return result;
 
 	switch (xlator_flags2xt(flags)) {
 	case XT_SIIT:
@@ -702,30 +1489,104 @@ static struct jool_result do_parsing(char const *iname, char *buffer)
 	}
 
 	if (result.error)
-		goto fail;
+		return result;
 
-	/*
-	 * Send the control message before deleting, because @iname might point
-	 * to the json object, and send_ctrl_msg() needs @iname.
-	 */
-	result = send_ctrl_msg(false);
-	cJSON_Delete(json);
-	return result;
+	/* (@iname might point to the json object.) */
+	return send_ctrl_msg(false);
+}
+
+static struct jool_result send_batch_commit(void)
+{
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(&sk, NULL, JNLOP_FILE_COMMIT_BATCH, 0, &msg);
+	if (result.error)
+		return result;
+
+	return joolnl_request(&sk, msg, NULL, NULL);
+}
+
+/*
+ * Each element of the @json array is an instance. They are uploaded and
+ * validated one by one, but committed together, in a single kernel
+ * transaction.
+ */
+static struct jool_result handle_instance_array(char const *iname,
+		cJSON *json)
+{
+	xlator_flags xt = flags;
+	cJSON *child;
+	unsigned int i;
+	struct jool_result result;
+	struct jool_result wrapped;
+
+	if (iname) {
+		return result_from_error(
+			-EINVAL,
+			"The file contains several instances; their names have to be defined in the file, not through -i."
+		);
+	}
+
+	batch = true;
+	for (child = json->child, i = 0; child; child = child->next, i++) {
+		flags = xt;
+		result = handle_instance(NULL, child);
+		if (result.error) {
+			wrapped = result_from_error(result.error,
+					"Instance #%u: %s", i, result.msg
+							? result.msg
+							: "Unknown error");
+			result_cleanup(&result);
+			return wrapped;
+		}
+	}
+
+	if (i == 0)
+		return result_success();
+	return send_batch_commit();
+}
+
+static struct jool_result do_parsing(char const *iname, char *buffer)
+{
+	cJSON *json;
+	struct jool_result result;
+
+	json = cJSON_ParseLazy(buffer, is_lazy_table);
+	if (!json)
+		return parse_error();
+
+	result = (json->type == cJSON_Array)
+			? handle_instance_array(iname, json)
+			: handle_instance(iname, json);
 
-fail:
 	cJSON_Delete(json);
 	return result;
 }
 
 struct jool_result joolnl_file_parse(struct joolnl_socket *_sk, xlator_type xt,
-		char const *iname, char const *file_name, bool _force)
+		char const *iname, char const *file_name, bool _force, bool _diff)
 {
 	char *buffer;
+	int error;
 	struct jool_result result;
 
 	sk = *_sk;
 	flags = xt;
 	force = _force ? JOOLNLHDR_FLAGS_FORCE : 0;
+	diff = _diff;
+	batch = false;
+
+	/* Fewer, larger chunks. libnl's default send buffer is too small. */
+	error = nl_socket_set_buffer_size(sk.sk, 0, 2 * JOOLNL_LARGE_MSG_SIZE);
+	if (error < 0) {
+		return result_from_error(
+			error,
+			"Cannot resize the Netlink socket's send buffer: %s",
+			nl_geterror(error)
+		);
+	}
+	nlmsg_set_default_size(JOOLNL_LARGE_MSG_SIZE);
 
 	result = file_to_string(file_name, &buffer);
 	if (result.error)
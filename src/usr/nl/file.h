@@ -9,7 +9,8 @@ struct jool_result joolnl_file_parse(
 	xlator_type xt,
 	char const *iname,
 	char const *file_name,
-	bool force
+	bool force,
+	bool diff
 );
 
 struct jool_result joolnl_file_get_iname(
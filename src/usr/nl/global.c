@@ -74,7 +74,8 @@ struct jool_result joolnl_global_foreach(struct joolnl_socket *sk,
 	args.last = 0;
 
 	do {
-		result = joolnl_alloc_msg(sk, iname, JNLOP_GLOBAL_FOREACH, 0, &msg);
+		result = joolnl_alloc_msg(sk, iname, JNLOP_GLOBAL_FOREACH,
+				JOOLNLHDR_FLAGS_LARGE, &msg);
 		if (result.error)
 			return result;
 
@@ -92,7 +92,8 @@ struct jool_result joolnl_instance_foreach(struct joolnl_socket *sk,
 	first_request = true;
 
 	do {
-		result = joolnl_alloc_msg(sk, NULL, JNLOP_INSTANCE_FOREACH, 0, &msg);
+		result = joolnl_alloc_msg(sk, NULL, JNLOP_INSTANCE_FOREACH,
+				JOOLNLHDR_FLAGS_LARGE, &msg);
 		if (result.error)
 			return result;
 
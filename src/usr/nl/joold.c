@@ -3,6 +3,8 @@
 #include <stddef.h>
 #include <netlink/msg.h>
 #include "common/config.h"
+#include "usr/nl/attribute.h"
+#include "usr/nl/common.h"
 
 static struct jool_result send_to_kernel(struct joolnl_socket *sk,
 		struct nl_msg *msg)
@@ -62,6 +64,48 @@ struct jool_result joolnl_joold_advertise(struct joolnl_socket *sk,
 	return send_to_kernel(sk, msg);
 }
 
+struct jool_result joolnl_joold_advertise_cancel(struct joolnl_socket *sk,
+		char const *iname)
+{
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_JOOLD_ADVERTISE_CANCEL, 0,
+			&msg);
+	if (result.error)
+		return result;
+
+	return send_to_kernel(sk, msg);
+}
+
+/*
+ * @peer6 and @peer4 are mutually exclusive. If both are NULL, the sessions go
+ * back to joold.
+ */
+struct jool_result joolnl_joold_transport(struct joolnl_socket *sk,
+		char const *iname, struct ipv6_transport_addr const *peer6,
+		struct ipv4_transport_addr const *peer4)
+{
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_JOOLD_TRANSPORT, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (peer6 && nla_put_taddr6(msg, JNLAR_JOOLD_PEER6, peer6) < 0)
+		goto nla_put_failure;
+	if (peer4 && nla_put_taddr4(msg, JNLAR_JOOLD_PEER4, peer4) < 0)
+		goto nla_put_failure;
+
+	/* Unlike the daemon's requests, this one waits for the verdict. */
+	return joolnl_request(sk, msg, NULL, NULL);
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
 struct jool_result joolnl_joold_ack(struct joolnl_socket *sk, char const *iname)
 {
 	struct nl_msg *msg;
@@ -15,6 +15,18 @@ struct jool_result joolnl_joold_advertise(
 	char const *iname
 );
 
+struct jool_result joolnl_joold_advertise_cancel(
+	struct joolnl_socket *sk,
+	char const *iname
+);
+
+struct jool_result joolnl_joold_transport(
+	struct joolnl_socket *sk,
+	char const *iname,
+	struct ipv6_transport_addr const *peer6,
+	struct ipv4_transport_addr const *peer4
+);
+
 struct jool_result joolnl_joold_ack(
 	struct joolnl_socket *sk,
 	char const *iname
@@ -7,6 +7,7 @@
 
 struct foreach_args {
 	joolnl_pool4_foreach_cb cb;
+	joolnl_pool4_usage_cb usage_cb;
 	void *args;
 	bool done;
 	struct pool4_entry last;
@@ -19,6 +20,7 @@ static struct jool_result handle_foreach_response(struct nl_msg *response,
 	struct nlattr *attr;
 	int rem;
 	struct pool4_entry entry;
+	__u64 used;
 	struct jool_result result;
 
 	result = joolnl_init_foreach_list(response, "pool4", &args->done);
@@ -26,11 +28,17 @@ static struct jool_result handle_foreach_response(struct nl_msg *response,
 		return result;
 
 	foreach_entry(attr, genlmsg_hdr(nlmsg_hdr(response)), rem) {
-		result = nla_get_pool4(attr, &entry);
-		if (result.error)
-			return result;
-
-		result = args->cb(&entry, args->args);
+		if (args->usage_cb) {
+			result = nla_get_pool4_usage(attr, &entry, &used);
+			if (result.error)
+				return result;
+			result = args->usage_cb(&entry, used, args->args);
+		} else {
+			result = nla_get_pool4(attr, &entry);
+			if (result.error)
+				return result;
+			result = args->cb(&entry, args->args);
+		}
 		if (result.error)
 			return result;
 
@@ -40,23 +48,21 @@ static struct jool_result handle_foreach_response(struct nl_msg *response,
 	return result_success();
 }
 
-struct jool_result joolnl_pool4_foreach(struct joolnl_socket *sk,
-		char const *iname, l4_protocol proto,
-		joolnl_pool4_foreach_cb cb, void *_args)
+static struct jool_result __foreach(struct joolnl_socket *sk,
+		char const *iname, enum joolnl_operation operation,
+		l4_protocol proto, struct foreach_args *args)
 {
 	struct nl_msg *msg;
-	struct foreach_args args;
 	struct jool_result result;
 	bool first_request;
 
-	args.cb = cb;
-	args.args = _args;
-	args.done = true;
-	memset(&args.last, 0, sizeof(args.last));
+	args->done = true;
+	memset(&args->last, 0, sizeof(args->last));
 	first_request = true;
 
 	do {
-		result = joolnl_alloc_msg(sk, iname, JNLOP_POOL4_FOREACH, 0, &msg);
+		result = joolnl_alloc_msg(sk, iname, operation,
+				JOOLNLHDR_FLAGS_LARGE, &msg);
 		if (result.error)
 			return result;
 
@@ -65,14 +71,14 @@ struct jool_result joolnl_pool4_foreach(struct joolnl_socket *sk,
 				goto cancel;
 			first_request = false;
 
-		} else if (nla_put_pool4(msg, JNLAR_OFFSET, &args.last) < 0) {
+		} else if (nla_put_pool4(msg, JNLAR_OFFSET, &args->last) < 0) {
 			goto cancel;
 		}
 
-		result = joolnl_request(sk, msg, handle_foreach_response, &args);
+		result = joolnl_request(sk, msg, handle_foreach_response, args);
 		if (result.error)
 			return result;
-	} while (!args.done);
+	} while (!args->done);
 
 	return result_success();
 
@@ -81,6 +87,35 @@ cancel:
 	return joolnl_err_msgsize();
 }
 
+struct jool_result joolnl_pool4_foreach(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto,
+		joolnl_pool4_foreach_cb cb, void *_args)
+{
+	struct foreach_args args;
+
+	args.cb = cb;
+	args.usage_cb = NULL;
+	args.args = _args;
+	return __foreach(sk, iname, JNLOP_POOL4_FOREACH, proto, &args);
+}
+
+/*
+ * Same as joolnl_pool4_foreach(), except the kernel also counts the BIB
+ * entries (of the entry's protocol) whose IPv4 transport address belongs to
+ * each entry.
+ */
+struct jool_result joolnl_pool4_usage(struct joolnl_socket *sk,
+		char const *iname, l4_protocol proto,
+		joolnl_pool4_usage_cb cb, void *_args)
+{
+	struct foreach_args args;
+
+	args.cb = NULL;
+	args.usage_cb = cb;
+	args.args = _args;
+	return __foreach(sk, iname, JNLOP_POOL4_USAGE, proto, &args);
+}
+
 static struct jool_result __update(struct joolnl_socket *sk, char const *iname,
 		enum joolnl_operation operation, struct pool4_entry const *entry,
 		bool quick)
@@ -1,6 +1,8 @@
 #include "usr/nl/session.h"
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <netlink/genl/genl.h>
 #include "usr/nl/attribute.h"
 #include "usr/nl/common.h"
@@ -8,8 +10,6 @@
 struct foreach_args {
 	joolnl_session_foreach_cb cb;
 	void *args;
-	bool done;
-	struct session_entry_usr last;
 };
 
 static struct jool_result handle_foreach_response(struct nl_msg *response,
@@ -20,8 +20,9 @@ static struct jool_result handle_foreach_response(struct nl_msg *response,
 	int rem;
 	struct session_entry_usr entry;
 	struct jool_result result;
+	bool done; /* Dumps end with NLMSG_DONE instead */
 
-	result = joolnl_init_foreach_list(response, "session", &args->done);
+	result = joolnl_init_foreach_list(response, "session", &done);
 	if (result.error)
 		return result;
 
@@ -33,50 +34,246 @@ static struct jool_result handle_foreach_response(struct nl_msg *response,
 		result = args->cb(&entry, args->args);
 		if (result.error)
 			return result;
-
-		memcpy(&args->last, &entry, sizeof(entry));
 	}
 
 	return result_success();
 }
 
+/* @filter can be NULL. (Meaning all the sessions.) */
 struct jool_result joolnl_session_foreach(struct joolnl_socket *sk,
 		char const *iname, l4_protocol proto,
+		struct query_filter const *filter,
 		joolnl_session_foreach_cb cb, void *_args)
 {
 	struct nl_msg *msg;
 	struct foreach_args args;
 	struct jool_result result;
-	bool first_request;
 
 	args.cb = cb;
 	args.args = _args;
-	args.done = true;
-	memset(&args.last, 0, sizeof(args.last));
-	first_request = true;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_FOREACH, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (nla_put_u8(msg, JNLAR_PROTO, proto) < 0)
+		goto nla_put_failure;
+	if (filter && nla_put_filter(msg, JNLAR_FILTER, filter) < 0)
+		goto nla_put_failure;
+
+	return joolnl_dump(sk, msg, handle_foreach_response, &args);
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
+
+/* Import requests are this big, at most. */
+#define IMPORT_MSG_SIZE (64 * 1024)
+
+static struct jool_result handle_export_response(struct nl_msg *response,
+		void *arg)
+{
+	FILE *out = arg;
+	struct genlmsghdr *ghdr;
+	struct nlattr *attr;
+	int rem;
+
+	ghdr = genlmsg_hdr(nlmsg_hdr(response));
+	nla_for_each_attr(attr,
+			genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr)),
+			genlmsg_attrlen(ghdr, sizeof(struct joolnlhdr)),
+			rem) {
+		if (nla_type(attr) != JNLAL_SESSION_BATCH)
+			continue;
+		if (fwrite(nla_data(attr), nla_len(attr), 1, out) != 1) {
+			return result_from_error(
+				-EIO,
+				"Cannot write the snapshot: %s",
+				strerror(errno)
+			);
+		}
+	}
+
+	return result_success();
+}
+
+/**
+ * Writes all of @iname's sessions to @out, as a sequence of session batches.
+ * (See JNLAL_SESSION_BATCH.)
+ */
+struct jool_result joolnl_session_export(struct joolnl_socket *sk,
+		char const *iname, FILE *out)
+{
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_EXPORT, 0, &msg);
+	if (result.error)
+		return result;
+
+	result = joolnl_dump(sk, msg, handle_export_response, out);
+	if (result.error)
+		return result;
+
+	if (fflush(out)) {
+		return result_from_error(
+			-EIO,
+			"Cannot write the snapshot: %s",
+			strerror(errno)
+		);
+	}
+
+	return result_success();
+}
+
+/*
+ * Reads the next session batch from @in. Its length is returned in @len; 0
+ * means the file ended.
+ */
+static struct jool_result read_batch(FILE *in, __u8 *batch, size_t max,
+		size_t *len)
+{
+	size_t record_size;
+	size_t count;
+
+	*len = fread(batch, 1, JOOLD_BATCH_HDR_SIZE, in);
+	if (*len == 0 && feof(in))
+		return result_success();
+	if (*len != JOOLD_BATCH_HDR_SIZE)
+		goto truncated;
+
+	if (batch[0] != JOOLD_BATCH_VERSION) {
+		return result_from_error(
+			-EINVAL,
+			"Unknown session batch version: %u. (Expected %u.)",
+			batch[0], JOOLD_BATCH_VERSION
+		);
+	}
+
+	record_size = (batch[1] & JOOLD_BATCH_ELIDE_DST6)
+			? JOOLD_BATCH_RECORD_SIZE_ELIDED
+			: JOOLD_BATCH_RECORD_SIZE;
+	count = (batch[2] << 8) | batch[3];
+	*len = JOOLD_BATCH_HDR_SIZE + count * record_size;
+	if (*len > max) {
+		return result_from_error(
+			-EINVAL,
+			"The snapshot contains a %zu-byte session batch, which is too big to import.",
+			*len
+		);
+	}
+
+	if (fread(batch + JOOLD_BATCH_HDR_SIZE, record_size, count, in) != count)
+		goto truncated;
+
+	return result_success();
+
+truncated:
+	return result_from_error(
+		-EINVAL,
+		"The snapshot is truncated or unreadable."
+	);
+}
+
+static struct jool_result alloc_import_msg(struct joolnl_socket *sk,
+		char const *iname, struct nl_msg **msg, struct nlattr **root)
+{
+	struct jool_result result;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_IMPORT, 0, msg);
+	if (result.error)
+		return result;
+
+	*root = jnla_nest_start(*msg, JNLAR_SESSION_ENTRIES);
+	if (!*root) {
+		nlmsg_free(*msg);
+		return joolnl_err_msgsize();
+	}
+
+	return result_success();
+}
+
+static struct jool_result send_import_msg(struct joolnl_socket *sk,
+		struct nl_msg *msg, struct nlattr *root)
+{
+	nla_nest_end(msg, root);
+	return joolnl_request(sk, msg, NULL, NULL);
+}
+
+/**
+ * Adds the sessions joolnl_session_export() wrote to @in to @iname.
+ * Several batches are packed in each request.
+ */
+struct jool_result joolnl_session_import(struct joolnl_socket *sk,
+		char const *iname, FILE *in)
+{
+	struct nl_msg *msg;
+	struct nlattr *root;
+	__u8 *batch;
+	size_t len;
+	bool empty;
+	int error;
+	struct jool_result result;
+
+	/* libnl's default send buffer is too small for these requests. */
+	error = nl_socket_set_buffer_size(sk->sk, 0, 2 * IMPORT_MSG_SIZE);
+	if (error < 0) {
+		return result_from_error(
+			error,
+			"Cannot resize the Netlink socket's send buffer: %s",
+			nl_geterror(error)
+		);
+	}
+
+	batch = malloc(IMPORT_MSG_SIZE);
+	if (!batch)
+		return result_from_enomem();
+
+	nlmsg_set_default_size(IMPORT_MSG_SIZE + NLMSG_HDRLEN + GENL_HDRLEN
+			+ NLMSG_ALIGN(sizeof(struct joolnlhdr)) + NLA_HDRLEN);
+	result = alloc_import_msg(sk, iname, &msg, &root);
+	if (result.error)
+		goto end;
+	empty = true;
 
 	do {
-		result = joolnl_alloc_msg(sk, iname, JNLOP_SESSION_FOREACH, 0, &msg);
+		result = read_batch(in, batch, IMPORT_MSG_SIZE - NLA_HDRLEN,
+				&len);
 		if (result.error)
-			return result;
-
-		if (nla_put_u8(msg, JNLAR_PROTO, proto) < 0)
 			goto cancel;
+		if (len == 0)
+			break;
 
-		if (first_request)
-			first_request = false;
-		else if (nla_put_session(msg, JNLAR_OFFSET, &args.last) < 0)
-			goto cancel;
+		if (nla_put(msg, JNLAL_SESSION_BATCH, len, batch) < 0) {
+			/* Request full; send it and start another one. */
+			result = send_import_msg(sk, msg, root);
+			if (result.error)
+				goto end;
+			result = alloc_import_msg(sk, iname, &msg, &root);
+			if (result.error)
+				goto end;
 
-		result = joolnl_request(sk, msg, handle_foreach_response, &args);
-		if (result.error)
-			return result;
-	} while (!args.done);
+			if (nla_put(msg, JNLAL_SESSION_BATCH, len, batch) < 0) {
+				result = joolnl_err_msgsize();
+				goto cancel;
+			}
+		}
+		empty = false;
+	} while (true);
 
-	return result_success();
+	if (empty) {
+		nlmsg_free(msg);
+		goto end;
+	}
+
+	result = send_import_msg(sk, msg, root);
+	goto end;
 
 cancel:
 	nlmsg_free(msg);
-	return joolnl_err_msgsize();
+end:
+	free(batch);
+	return result;
 }
-
@@ -1,6 +1,7 @@
 #ifndef SRC_USR_NL_SESSION_H_
 #define SRC_USR_NL_SESSION_H_
 
+#include <stdio.h>
 #include "common/config.h"
 #include "usr/nl/core.h"
 
@@ -20,6 +21,8 @@ struct session_entry_usr {
 	__u8 proto;
 	__u8 state;
 	__u32 dying_time;
+	__u64 packets;
+	__u64 bytes;
 };
 
 typedef struct jool_result (*joolnl_session_foreach_cb)(
@@ -30,8 +33,14 @@ struct jool_result joolnl_session_foreach(
 	struct joolnl_socket *sk,
 	char const *iname,
 	l4_protocol proto,
+	struct query_filter const *filter,
 	joolnl_session_foreach_cb cb,
 	void *args
 );
 
+struct jool_result joolnl_session_export(struct joolnl_socket *sk,
+		char const *iname, FILE *out);
+struct jool_result joolnl_session_import(struct joolnl_socket *sk,
+		char const *iname, FILE *in);
+
 #endif /* SRC_USR_NL_SESSION_H_ */
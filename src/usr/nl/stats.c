@@ -1,6 +1,7 @@
 #include "usr/nl/stats.h"
 
 #include <errno.h>
+#include <string.h>
 #include <netlink/genl/genl.h>
 #include "usr/nl/attribute.h"
 #include "usr/nl/common.h"
@@ -15,12 +16,13 @@
 #define TC "Translations cancelled: "
 
 static struct joolnl_stat_metadata const jstat_metadatas[] = {
-	DEFINE_STAT(JSTAT_RECEIVED6, "Total IPv6 packets received by the instance so far."),
-	DEFINE_STAT(JSTAT_RECEIVED4, "Total IPv4 packets received by the instance so far."),
+	DEFINE_STAT(JSTAT_RECEIVED6, "Total IPv6 packets received by the instance so far. (Netfilter instances do not count the packets whose destination addresses are obviously untranslatable.)"),
+	DEFINE_STAT(JSTAT_RECEIVED4, "Total IPv4 packets received by the instance so far. (Netfilter instances do not count the packets whose destination addresses are obviously untranslatable.)"),
 	DEFINE_STAT(JSTAT_SUCCESS, "Successful translations. (Note: 'Successful translation' does not imply that the packet was actually delivered.)"),
 	DEFINE_STAT(JSTAT_BIB_ENTRIES, "Number of BIB entries currently held in the BIB."),
 	DEFINE_STAT(JSTAT_SESSIONS, "Number of session entries currently held in the BIB."),
 	DEFINE_STAT(JSTAT_ENOMEM, "Memory allocation failures."),
+	DEFINE_STAT(JSTAT_THREADED_RING_FULL, "Packet was dropped because its CPU's translation queue was full. (See the `threaded` parameter of the jool_common module.)"),
 	DEFINE_STAT(JSTAT_XLATOR_DISABLED, TC "Translator was manually disabled."),
 	DEFINE_STAT(JSTAT_POOL6_UNSET, TC "pool6 was unset."),
 	DEFINE_STAT(JSTAT_SKB_SHARED, TC "Packet was shared. (In the kernel, when packets are 'shared', they cannot be modified.)"),
@@ -39,7 +41,7 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 			"Either change the client's address or fix your pool6 so it represents a unique network."),
 	DEFINE_STAT(JSTAT_POOL6_MISMATCH, TC "IPv6 packet's destination address did not match pool6. (ie. Packet was not meant to be translated.)"),
 	DEFINE_STAT(JSTAT_POOL4_MISMATCH, TC "IPv4 packet's destination address and transport protocol did not match pool4. (ie. Packet was not meant to be translated.)\n"
-			"If the instance is a Netfilter translator, this counter increases randomly from normal operation, and is harmless.\n"
+			"If the instance is a Netfilter translator, this counter can increase from normal operation, and is harmless.\n"
 			"If the instance is an iptables translator, this counter being positive suggests a mismatch between the IPv4 iptables rule(s) and the instance's configuration."),
 	DEFINE_STAT(JSTAT_ICMP6_FILTER, "Packets filtered by `drop-icmpv6-info` policy."),
 	/* TODO (warning) This one might signal a programming error. */
@@ -47,6 +49,8 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_UNTRANSLATABLE_DST4, TC "IPv4 packet's source address could not be translated with the given pool6."),
 	DEFINE_STAT(JSTAT_6056_F, TC "Unable to hash packet fields; cannot compute source port. (From my reading of the 4.15 kernel, this can only happen due to memory allocation failures, but YMMV.)"),
 	DEFINE_STAT(JSTAT_MASK_DOMAIN_NOT_FOUND, TC "There was no pool4 entry whose protocol and mark matched the incoming IPv6 packet."),
+	DEFINE_STAT(JSTAT_DETERMINISTIC_NO_PORTS, TC "The IPv6 packet's source belonged to deterministic-prefix, but pool4 didn't have enough ports for every subscriber to get at least one."),
+	DEFINE_STAT(JSTAT_POOL4_CROWDED, "A pool4 transport address was requested while the BIB had already taken at least 7/8 of the packet's mark's. (Port allocation switched to the exhaustion strategy. If this keeps climbing, pool4 needs more addresses.)"),
 	DEFINE_STAT(JSTAT_BIB6_NOT_FOUND, TC "IPv6 packet did not match a BIB entry from the database, and one could not be created."),
 	DEFINE_STAT(JSTAT_BIB4_NOT_FOUND, TC "IPv4 packet did not match a BIB entry from the database."),
 	DEFINE_STAT(JSTAT_SESSION_NOT_FOUND, TC "Packet was an ICMP error, but did not match a session entry from the database. (Which means that the original packet couldn't have been translated.)"),
@@ -58,6 +62,12 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_TYPE2PKT, "Total number of Type 2 packets stored. (See https://github.com/NICMx/Jool/blob/584a846d09e891a0cd6342426b7a25c6478c90d6/src/mod/nat64/bib/pkt_queue.h#L77) (This counter is not decremented when a packet leaves the queue.)"),
 	DEFINE_STAT(JSTAT_SO_EXISTS, TC "Packet was a Simultaneous Open retry. (Client was trying to punch a hole, and was being unnecessarily greedy.)"),
 	DEFINE_STAT(JSTAT_SO_FULL, TC "Packet queue was full, so the Simultaneous Open attempt was denied. (Too many clients were trying to punch holes.)"),
+	DEFINE_STAT(JSTAT_SO_SRC_FULL, TC "The source already had too many Simultaneous Opens in the packet queue, so this one was denied. (It was probably scanning.)"),
+	DEFINE_STAT(JSTAT_SYN_DEFERRED, "IPv6 SYN was translated, but its BIB entry and session were deferred until the IPv4 answer, because `syn-flood-threshold` was exceeded."),
+	DEFINE_STAT(JSTAT_SUBSCRIBER_QUOTA, "Packet needed a new BIB entry or session, but its subscriber had already reached `subscriber-max-ports` or `subscriber-max-sessions`."),
+	DEFINE_STAT(JSTAT_SUBSCRIBER_PACKET_RATE, "IPv6 packet's subscriber had exceeded `subscriber-packet-rate`."),
+	DEFINE_STAT(JSTAT_SUBSCRIBER_SESSION_RATE, "IPv6 packet needed a new session, but its subscriber had exceeded `subscriber-session-rate`."),
+	DEFINE_STAT(JSTAT_OVERLOAD_SHED, "IPv6 packet needed a new session, but its CPU was spending more than `overload-threshold` of its time translating."),
 	DEFINE_STAT(JSTAT64_SRC, TC "IPv6 packet's source address did not match pool6 nor any EAMT entries, or the resulting address was denylist4ed."),
 	DEFINE_STAT(JSTAT64_DST, TC "IPv6 packet's destination address did not match pool6 nor any EAMT entries, or the resulting address was denylist4ed."),
 	DEFINE_STAT(JSTAT64_PSKB_COPY, TC "It was not possible to allocate the IPv4 counterpart of the IPv6 packet. (The kernel's pskb_copy() function failed.)"),
@@ -107,6 +117,66 @@ static struct joolnl_stat_metadata const jstat_metadatas[] = {
 	DEFINE_STAT(JSTAT_JOOLD_ADS, "Joold: Total advertises queued."),
 	DEFINE_STAT(JSTAT_JOOLD_ACKS, "Joold: Total ACKs received from userspace."),
 
+	DEFINE_STAT(JSTAT_NATLOG_RECORDS_SENT, "NAT log: BIB events sent to the natlog multicast group."),
+	DEFINE_STAT(JSTAT_NATLOG_RECORDS_DROPPED, "NAT log: BIB events lost because a ring was full, or because the message could not be sent."),
+	DEFINE_STAT(JSTAT_CAPTURE_RECORDS_SENT, "Packet capture: Packets sent to the capture multicast group."),
+	DEFINE_STAT(JSTAT_CAPTURE_RECORDS_DROPPED, "Packet capture: Packets lost because a ring was full, or because the message could not be sent."),
+	DEFINE_STAT(JSTAT_SESSIONS_CREATED, "Session entries created so far. (Unlike JSTAT_SESSIONS, this one never decreases.)"),
+	DEFINE_STAT(JSTAT_MEM_BIB, "Memory: Bytes taken by the BIB entries. (The entries themselves are counted by JSTAT_BIB_ENTRIES.)"),
+	DEFINE_STAT(JSTAT_MEM_SESSIONS, "Memory: Bytes taken by the session entries. (The entries themselves are counted by JSTAT_SESSIONS.)"),
+	DEFINE_STAT(JSTAT_STORED_PKTS, "Memory: Packets currently stored by the session table, waiting for simultaneous opens. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_JOOLD_QUEUED, "Memory: Sessions currently queued for joold. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_MEM_JOOLD, "Memory: Bytes taken by the sessions queued for joold. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_EAMT_NODES, "Memory: Nodes in the EAMT's tries. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_MEM_EAMT, "Memory: Bytes taken by the EAMT's tries. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_POOL4_TABLES, "Memory: Tables in pool4. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_MEM_POOL4, "Memory: Bytes taken by pool4's tables and their packet path snapshot. (Computed when queried.)"),
+
+	DEFINE_STAT(JSTAT_EAMT_CACHE_HIT, "EAMT lookups served by the per-CPU cache."),
+	DEFINE_STAT(JSTAT_EAMT_CACHE_MISS, "EAMT lookups that missed the per-CPU cache, and had to query the table."),
+
+	DEFINE_STAT(JSTAT_FRAG_HELD, "Fragment tracking: Subsequent fragments that arrived before their first fragment, and had to wait for it."),
+	DEFINE_STAT(JSTAT_FRAG_EXPIRED, TC "Held fragment's first fragment did not arrive in time, or the fragment was pushed out of a full hold queue. (Fragment tracking.)"),
+	DEFINE_STAT(JSTAT_FRAG_NOT_UDP, TC "Subsequent fragment was not UDP. (Fragment tracking only supports UDP.)"),
+	DEFINE_STAT(JSTAT_ICMP6ERR_RATELIMITED, "ICMPv6 errors (created by Jool, not translated) suppressed by icmp-error-rate or icmp-error-source-rate."),
+	DEFINE_STAT(JSTAT_ICMP4ERR_RATELIMITED, "ICMPv4 errors (created by Jool, not translated) suppressed by icmp-error-rate or icmp-error-source-rate."),
+	DEFINE_STAT(JSTAT_RSS_FALLBACK, "rss-queues could not find a free mask whose IPv4 traffic would land on the creating CPU, and settled for some other one."),
+	DEFINE_STAT(JSTAT_PORT_PRESERVED, "port-preservation gave a new BIB entry its IPv6 source port."),
+	DEFINE_STAT(JSTAT_SESSION_EVICTED, "A session was forgotten early, to make room for a new one. (max-sessions was reached.)"),
+	DEFINE_STAT(JSTAT_SESSION_EVICT_FAILED, "max-sessions was reached, but no session could be evicted in time, so the new session overshot the limit."),
+	DEFINE_STAT(JSTAT_JOOLD_SSS_COALESCED, "Joold: Session updates that overwrote an update of the same session that was still queued."),
+	DEFINE_STAT(JSTAT_JOOLD_SSS_FILTERED, "Joold: Session updates not synchronized because of the ss-sync-*, ss-min-age or ss-established-only policies."),
+	DEFINE_STAT(JSTAT_JOOLD_WINDOW, "Joold packet sent; ss-flush-window expired."),
+
+	DEFINE_STAT(JSTAT_MAP_PORT, TC "Packet matched a MAP-T rule, but its port (or ICMP identifier) was missing (eg. subsequent fragment) or fell outside of the rule's port sets."),
+
+	DEFINE_STAT(JSTAT_MSS_CLAMPED, "TCP SYN translated; its MSS was lowered to fit the IPv6 MTU (tcp-mss-clamp)."),
+
+	DEFINE_STAT(JSTAT46_GSO_SEGMENTED, "UDP GSO packet lacked DF and exceeded the IPv6 MTU, so its datagrams were translated (and fragmented) separately."),
+	DEFINE_STAT(JSTAT46_GSO_SEGMENT, TC "UDP GSO packet lacked DF and exceeded the IPv6 MTU, but it could not be segmented. (The kernel's skb_gso_segment() function failed.)"),
+
+	DEFINE_STAT(JSTAT_LOCK_BIB_ACQUIRED, "Locks (if lock_stats): Times the lock of the BIB/session table shards was taken. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_BIB_CONTENDED, "Locks (if lock_stats): Times the lock of the BIB/session table shards was found taken, and had to be waited for. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_BIB_SAMPLED, "Locks (if lock_stats): Times the lock of the BIB/session table shards was held while its hold time was being measured. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_BIB_HOLD_NS, "Locks (if lock_stats): Nanoseconds the lock of the BIB/session table shards was held, during the JSTAT_LOCK_BIB_SAMPLED measured acquisitions. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_POOL4_ACQUIRED, "Locks (if lock_stats): Times the lock of pool4 was taken. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_POOL4_CONTENDED, "Locks (if lock_stats): Times the lock of pool4 was found taken, and had to be waited for. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_POOL4_SAMPLED, "Locks (if lock_stats): Times the lock of pool4 was held while its hold time was being measured. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_POOL4_HOLD_NS, "Locks (if lock_stats): Nanoseconds the lock of pool4 was held, during the JSTAT_LOCK_POOL4_SAMPLED measured acquisitions. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_JOOLD_ACQUIRED, "Locks (if lock_stats): Times the lock of the joold queue was taken. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_JOOLD_CONTENDED, "Locks (if lock_stats): Times the lock of the joold queue was found taken, and had to be waited for. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_JOOLD_SAMPLED, "Locks (if lock_stats): Times the lock of the joold queue was held while its hold time was being measured. (Computed when queried.)"),
+	DEFINE_STAT(JSTAT_LOCK_JOOLD_HOLD_NS, "Locks (if lock_stats): Nanoseconds the lock of the joold queue was held, during the JSTAT_LOCK_JOOLD_SAMPLED measured acquisitions. (Computed when queried.)"),
+
+	DEFINE_STAT(JSTAT_BYTES6, "Bytes received from IPv6. (Layer 3 and up.)"),
+	DEFINE_STAT(JSTAT_BYTES4, "Bytes received from IPv4. (Layer 3 and up.)"),
+	DEFINE_STAT(JSTAT_BIB_CREATED, "BIB entries created so far. (Unlike JSTAT_BIB_ENTRIES, this one never decreases.)"),
+	DEFINE_STAT(JSTAT_SESSIONS_EXPIRED, "Sessions removed because their timeouts ran out."),
+	DEFINE_STAT(JSTAT_POOL4_PRESSURE_TCP, "Current pool4 pressure level of TCP (0-3). Each level halves the transitory timeout."),
+	DEFINE_STAT(JSTAT_POOL4_PRESSURE_UDP, "Current pool4 pressure level of UDP (0-3). Each level halves the UDP timeouts."),
+	DEFINE_STAT(JSTAT_POOL4_PRESSURE_RAISED, "Times a protocol's pool4 pressure level went up."),
+	DEFINE_STAT(JSTAT_JOOLD_RING_FULL, "Joold packet dropped; joold's session ring was full."),
+
 	DEFINE_STAT(JSTAT_UNKNOWN, TC "Programming error found. The module recovered, but the packet was dropped."),
 	DEFINE_STAT(JSTAT_PADDING, "Dummy; ignore this one."),
 };
@@ -134,6 +204,11 @@ failure:
 	);
 }
 
+struct joolnl_stat_metadata const *joolnl_stat_metadata(enum jool_stat_id id)
+{
+	return (id < JSTAT_COUNT) ? &jstat_metadatas[id] : NULL;
+}
+
 struct query_args {
 	joolnl_stats_foreach_cb cb;
 	void *args;
@@ -197,7 +272,8 @@ struct jool_result joolnl_stats_foreach(struct joolnl_socket *sk,
 	qargs.last = 0;
 
 	do {
-		result = joolnl_alloc_msg(sk, iname, JNLOP_STATS_FOREACH, 0, &msg);
+		result = joolnl_alloc_msg(sk, iname, JNLOP_STATS_FOREACH,
+				JOOLNLHDR_FLAGS_LARGE, &msg);
 		if (result.error)
 			return result;
 
@@ -213,3 +289,565 @@ struct jool_result joolnl_stats_foreach(struct joolnl_socket *sk,
 
 	return result_success();
 }
+
+struct dump_args {
+	__u8 const *filter;
+	joolnl_stats_dump_cb cb;
+	void *args;
+};
+
+static bool is_requested(__u8 const *filter, enum jool_stat_id id)
+{
+	return !filter || (filter[id / 8] & (1u << (id % 8)));
+}
+
+/* The kernel omits zero counters; this puts them back. */
+static struct jool_result handle_dump_entry(struct nlattr *root,
+		struct dump_args *args)
+{
+	struct nlattr *attrs[JNLASTE_COUNT];
+	struct nlattr *attr;
+	int rem;
+	__u64 values[JSTAT_COUNT];
+	char const *iname;
+	struct joolnl_stat stat;
+	int id;
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLASTE_MAX, root,
+			joolnl_stats_entry_policy);
+	if (result.error)
+		return result;
+
+	iname = nla_get_string(attrs[JNLASTE_INAME]);
+	memset(values, 0, sizeof(values));
+	nla_for_each_nested(attr, attrs[JNLASTE_COUNTERS], rem) {
+		id = nla_type(attr);
+		if (id == JSTAT_PADDING)
+			continue;
+		if (id < 1 || id > JSTAT_UNKNOWN)
+			goto bad_id;
+		values[id] = nla_get_u64(attr);
+	}
+
+	for (id = 1; id <= JSTAT_UNKNOWN; id++) {
+		if (!is_requested(args->filter, id))
+			continue;
+		stat.meta = jstat_metadatas[id];
+		stat.value = values[id];
+		result = args->cb(iname, &stat, args->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+
+bad_id:
+	return result_from_error(
+		-EINVAL,
+		"The kernel module returned an unknown stat counter."
+	);
+}
+
+static struct jool_result stats_dump_response(struct nl_msg *response,
+		void *arg)
+{
+	struct nlattr *attr;
+	int rem;
+	struct jool_result result;
+	bool done; /* Dumps end with NLMSG_DONE instead */
+
+	result = joolnl_init_foreach_list(response, "stats", &done);
+	if (result.error)
+		return result;
+
+	foreach_entry(attr, genlmsg_hdr(nlmsg_hdr(response)), rem) {
+		result = handle_dump_entry(attr, arg);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+struct jool_result joolnl_stats_dump(struct joolnl_socket *sk,
+		__u8 const *filter, joolnl_stats_dump_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct dump_args args;
+	struct jool_result result;
+
+	result = validate_stats();
+	if (result.error)
+		return result;
+
+	args.filter = filter;
+	args.cb = cb;
+	args.args = _args;
+
+	result = joolnl_alloc_msg(sk, NULL, JNLOP_STATS_DUMP, 0, &msg);
+	if (result.error)
+		return result;
+
+	if (filter && nla_put(msg, JNLAR_STATS_FILTER, JSTAT_FILTER_SIZE,
+			filter) < 0) {
+		nlmsg_free(msg);
+		return joolnl_err_msgsize();
+	}
+
+	return joolnl_dump(sk, msg, stats_dump_response, &args);
+}
+
+struct percpu_args {
+	joolnl_stats_percpu_cb cb;
+	void *args;
+	bool done;
+	enum jool_stat_id last;
+};
+
+static struct jool_result percpu_query_response(struct nl_msg *response,
+		void *args)
+{
+	struct genlmsghdr *ghdr;
+	struct nlattr *head, *attr;
+	int len, rem;
+	struct joolnl_stat_percpu stat;
+	struct percpu_args *pargs = args;
+	struct jool_result result;
+
+	result = joolnl_init_foreach(response, &pargs->done);
+	if (result.error)
+		return result;
+
+	ghdr = nlmsg_data(nlmsg_hdr(response));
+	head = genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr));
+	len = genlmsg_attrlen(ghdr, sizeof(struct joolnlhdr));
+
+	nla_for_each_attr(attr, head, len, rem) {
+		pargs->last = nla_type(attr);
+		if (pargs->last < 1 || pargs->last > JSTAT_UNKNOWN)
+			goto bad_attr;
+		if (nla_len(attr) % sizeof(__u64) != 0)
+			goto bad_attr;
+
+		stat.meta = jstat_metadatas[pargs->last];
+		stat.cpus = nla_len(attr) / sizeof(__u64);
+		stat.values = nla_data(attr);
+
+		result = pargs->cb(&stat, pargs->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+
+bad_attr:
+	return result_from_error(
+		-EINVAL,
+		"The kernel module returned an unknown per-CPU stat."
+	);
+}
+
+struct jool_result joolnl_stats_percpu_foreach(struct joolnl_socket *sk,
+		char const *iname, __u8 const *filter,
+		joolnl_stats_percpu_cb cb, void *args)
+{
+	struct nl_msg *msg;
+	struct percpu_args pargs;
+	struct jool_result result;
+
+	result = validate_stats();
+	if (result.error)
+		return result;
+
+	pargs.cb = cb;
+	pargs.args = args;
+	pargs.done = true;
+	pargs.last = 0;
+
+	do {
+		result = joolnl_alloc_msg(sk, iname, JNLOP_STATS_PERCPU,
+				JOOLNLHDR_FLAGS_LARGE, &msg);
+		if (result.error)
+			return result;
+
+		if (filter && nla_put(msg, JNLAR_STATS_FILTER,
+				JSTAT_FILTER_SIZE, filter) < 0)
+			goto too_big;
+		if (pargs.last && nla_put_u8(msg, JNLAR_OFFSET_U8,
+				pargs.last) < 0)
+			goto too_big;
+
+		result = joolnl_request(sk, msg, percpu_query_response, &pargs);
+		if (result.error)
+			return result;
+	} while (!pargs.done);
+
+	return result_success();
+
+too_big:
+	nlmsg_free(msg);
+	return joolnl_err_msgsize();
+}
+
+static char const *const jlat_dir_names[] = {
+	[JLAT_6TO4] = "6to4",
+	[JLAT_4TO6] = "4to6",
+};
+
+static char const *const jlat_stage_names[] = {
+	[JLAT_IN_TUPLE] = "determine_in_tuple",
+	[JLAT_FILTERING] = "filtering_and_updating",
+	[JLAT_OUT_TUPLE] = "compute_out_tuple",
+	[JLAT_INPLACE] = "translate_inplace",
+	[JLAT_TRANSLATE] = "translating_the_packet",
+	[JLAT_SEND] = "sendpkt_send",
+};
+
+/*
+ * JNLOP_STATS_LATENCY and JNLOP_STATS_LIFETIMES both send @count histograms of
+ * @size bytes each. (See handle_histograms() in the kernel module.)
+ */
+struct histogram_args {
+	unsigned int count;
+	size_t size;
+	/* @index is the histogram's, starting from zero. */
+	struct jool_result (*handle)(unsigned int index, void const *buckets,
+			void *args);
+	void *args;
+	bool done;
+	unsigned int last;
+};
+
+static struct jool_result histogram_query_response(struct nl_msg *response,
+		void *args)
+{
+	struct genlmsghdr *ghdr;
+	struct nlattr *head, *attr;
+	int len, rem;
+	struct histogram_args *hargs = args;
+	struct jool_result result;
+
+	result = joolnl_init_foreach(response, &hargs->done);
+	if (result.error)
+		return result;
+
+	ghdr = nlmsg_data(nlmsg_hdr(response));
+	head = genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr));
+	len = genlmsg_attrlen(ghdr, sizeof(struct joolnlhdr));
+
+	nla_for_each_attr(attr, head, len, rem) {
+		hargs->last = nla_type(attr);
+		if (hargs->last < 1 || hargs->last > hargs->count)
+			goto bad_attr;
+		if (nla_len(attr) != hargs->size)
+			goto bad_attr;
+
+		result = hargs->handle(hargs->last - 1, nla_data(attr),
+				hargs->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+
+bad_attr:
+	return result_from_error(
+		-EINVAL,
+		"The kernel module returned an unknown histogram."
+	);
+}
+
+static struct jool_result histograms_foreach(struct joolnl_socket *sk,
+		char const *iname, enum joolnl_operation op,
+		struct histogram_args *hargs)
+{
+	struct nl_msg *msg;
+	struct jool_result result;
+
+	hargs->done = true;
+	hargs->last = 0;
+
+	do {
+		result = joolnl_alloc_msg(sk, iname, op, 0, &msg);
+		if (result.error)
+			return result;
+
+		if (hargs->last && (nla_put_u8(msg, JNLAR_OFFSET_U8,
+				hargs->last) < 0)) {
+			nlmsg_free(msg);
+			return joolnl_err_msgsize();
+		}
+
+		result = joolnl_request(sk, msg, histogram_query_response,
+				hargs);
+		if (result.error)
+			return result;
+	} while (!hargs->done);
+
+	return result_success();
+}
+
+struct latency_args {
+	joolnl_latency_foreach_cb cb;
+	void *args;
+};
+
+static struct jool_result handle_latency(unsigned int index,
+		void const *buckets, void *args)
+{
+	struct latency_args *largs = args;
+	struct joolnl_latency histogram;
+
+	histogram.dir = index / JLAT_STAGE_COUNT;
+	histogram.stage = index % JLAT_STAGE_COUNT;
+	histogram.dir_name = jlat_dir_names[histogram.dir];
+	histogram.stage_name = jlat_stage_names[histogram.stage];
+	memcpy(histogram.buckets, buckets, sizeof(histogram.buckets));
+
+	return largs->cb(&histogram, largs->args);
+}
+
+struct jool_result joolnl_stats_latency_foreach(struct joolnl_socket *sk,
+		char const *iname, joolnl_latency_foreach_cb cb, void *args)
+{
+	struct latency_args largs;
+	struct histogram_args hargs;
+
+	if (ARRAY_SIZE(jlat_stage_names) != JLAT_STAGE_COUNT
+			|| ARRAY_SIZE(jlat_dir_names) != JLAT_DIR_COUNT) {
+		return result_from_error(
+			-EINVAL,
+			"Programming error: The latency name arrays do not match their enums."
+		);
+	}
+
+	largs.cb = cb;
+	largs.args = args;
+	hargs.count = JLAT_HISTOGRAM_COUNT;
+	hargs.size = JLAT_BUCKETS * sizeof(__u64);
+	hargs.handle = handle_latency;
+	hargs.args = &largs;
+
+	return histograms_foreach(sk, iname, JNLOP_STATS_LATENCY, &hargs);
+}
+
+static char const *const jlife_metric_names[] = {
+	[JLIFE_LIFETIME] = "lifetime",
+	[JLIFE_IDLE] = "idle",
+	[JLIFE_PORT_HOLD] = "port-hold",
+};
+
+static char const *const jlife_class_names[] = {
+	[JLIFE_UDP] = "udp",
+	[JLIFE_TCP_EST] = "tcp-est",
+	[JLIFE_TCP_TRANS] = "tcp-trans",
+	[JLIFE_ICMP] = "icmp",
+};
+
+struct lifetime_args {
+	joolnl_lifetime_foreach_cb cb;
+	void *args;
+};
+
+static struct jool_result handle_lifetime(unsigned int index,
+		void const *buckets, void *args)
+{
+	struct lifetime_args *largs = args;
+	struct joolnl_lifetime histogram;
+
+	histogram.metric = index / JLIFE_CLASS_COUNT;
+	histogram.class = index % JLIFE_CLASS_COUNT;
+	histogram.metric_name = jlife_metric_names[histogram.metric];
+	histogram.class_name = jlife_class_names[histogram.class];
+	memcpy(histogram.buckets, buckets, sizeof(histogram.buckets));
+
+	return largs->cb(&histogram, largs->args);
+}
+
+struct jool_result joolnl_stats_lifetime_foreach(struct joolnl_socket *sk,
+		char const *iname, joolnl_lifetime_foreach_cb cb, void *args)
+{
+	struct lifetime_args largs;
+	struct histogram_args hargs;
+
+	if (ARRAY_SIZE(jlife_metric_names) != JLIFE_METRIC_COUNT
+			|| ARRAY_SIZE(jlife_class_names) != JLIFE_CLASS_COUNT) {
+		return result_from_error(
+			-EINVAL,
+			"Programming error: The lifetime name arrays do not match their enums."
+		);
+	}
+
+	largs.cb = cb;
+	largs.args = args;
+	hargs.count = JLIFE_HISTOGRAM_COUNT;
+	hargs.size = JLIFE_BUCKETS * sizeof(__u64);
+	hargs.handle = handle_lifetime;
+	hargs.args = &largs;
+
+	return histograms_foreach(sk, iname, JNLOP_STATS_LIFETIMES, &hargs);
+}
+
+static char const *const jrate_names[] = {
+	[JRATE_RECEIVED6] = "received6",
+	[JRATE_RECEIVED4] = "received4",
+	[JRATE_TRANSLATED] = "translated",
+	[JRATE_BYTES6] = "bytes6",
+	[JRATE_BYTES4] = "bytes4",
+	[JRATE_BIB_CREATED] = "bib-created",
+	[JRATE_SESSIONS_CREATED] = "sessions-created",
+	[JRATE_SESSIONS_EXPIRED] = "sessions-expired",
+	[JRATE_JOOLD_SENT] = "joold-sent",
+	[JRATE_JOOLD_RCVD] = "joold-received",
+};
+
+struct rates_args {
+	joolnl_rates_foreach_cb cb;
+	void *args;
+};
+
+static struct jool_result rates_query_response(struct nl_msg *response,
+		void *args)
+{
+	struct genlmsghdr *ghdr;
+	struct nlattr *head, *attr;
+	int len, rem;
+	struct joolnl_rate rate;
+	struct rates_args *rargs = args;
+	struct jool_result result;
+	bool done; /* The kernel always sends everything in one message */
+
+	result = joolnl_init_foreach(response, &done);
+	if (result.error)
+		return result;
+
+	ghdr = nlmsg_data(nlmsg_hdr(response));
+	head = genlmsg_attrdata(ghdr, sizeof(struct joolnlhdr));
+	len = genlmsg_attrlen(ghdr, sizeof(struct joolnlhdr));
+
+	nla_for_each_attr(attr, head, len, rem) {
+		if (nla_type(attr) == JRATE_PADDING)
+			continue;
+		if (nla_type(attr) < 1 || nla_type(attr) > JRATE_COUNT)
+			continue; /* From a newer kernel module */
+
+		rate.id = nla_type(attr) - 1;
+		rate.name = jrate_names[rate.id];
+		rate.value = (double)nla_get_u64(attr) / (1 << JRATE_SHIFT);
+
+		result = rargs->cb(&rate, rargs->args);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+struct jool_result joolnl_stats_rates_foreach(struct joolnl_socket *sk,
+		char const *iname, joolnl_rates_foreach_cb cb, void *args)
+{
+	struct nl_msg *msg;
+	struct rates_args rargs;
+	struct jool_result result;
+
+	if (ARRAY_SIZE(jrate_names) != JRATE_COUNT) {
+		return result_from_error(
+			-EINVAL,
+			"Programming error: The rate name array does not match its enum."
+		);
+	}
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_STATS_RATES, 0, &msg);
+	if (result.error)
+		return result;
+
+	rargs.cb = cb;
+	rargs.args = args;
+	return joolnl_request(sk, msg, rates_query_response, &rargs);
+}
+
+static char const *const jtalk_metric_names[] = {
+	[JTALK_SESSIONS] = "sessions",
+	[JTALK_BYTES] = "bytes",
+};
+
+struct talkers_args {
+	joolnl_talkers_foreach_cb cb;
+	void *args;
+};
+
+static struct jool_result handle_talker(struct nlattr *root,
+		struct talkers_args *args)
+{
+	struct nlattr *attrs[JNLATK_ATTR_COUNT];
+	struct joolnl_talker talker;
+	struct jool_result result;
+
+	result = jnla_parse_nested(attrs, JNLATK_MAX, root,
+			joolnl_talker_policy);
+	if (result.error)
+		return result;
+
+	talker.metric = nla_get_u8(attrs[JNLATK_METRIC]);
+	if (talker.metric >= JTALK_METRIC_COUNT) {
+		return result_from_error(
+			-EINVAL,
+			"The kernel module returned an unknown talker metric."
+		);
+	}
+	talker.metric_name = jtalk_metric_names[talker.metric];
+
+	result = nla_get_prefix6(attrs[JNLATK_PREFIX], &talker.prefix);
+	if (result.error)
+		return result;
+	talker.count = nla_get_u64(attrs[JNLATK_COUNT]);
+	talker.error = nla_get_u64(attrs[JNLATK_ERROR]);
+
+	return args->cb(&talker, args->args);
+}
+
+static struct jool_result talkers_query_response(struct nl_msg *response,
+		void *arg)
+{
+	struct nlattr *attr;
+	int rem;
+	struct jool_result result;
+	bool done; /* The kernel always sends everything in one message */
+
+	result = joolnl_init_foreach_list(response, "talker", &done);
+	if (result.error)
+		return result;
+
+	foreach_entry(attr, genlmsg_hdr(nlmsg_hdr(response)), rem) {
+		result = handle_talker(attr, arg);
+		if (result.error)
+			return result;
+	}
+
+	return result_success();
+}
+
+struct jool_result joolnl_stats_talkers_foreach(struct joolnl_socket *sk,
+		char const *iname, joolnl_talkers_foreach_cb cb, void *_args)
+{
+	struct nl_msg *msg;
+	struct talkers_args args;
+	struct jool_result result;
+
+	if (ARRAY_SIZE(jtalk_metric_names) != JTALK_METRIC_COUNT) {
+		return result_from_error(
+			-EINVAL,
+			"Programming error: The talker metric names do not match their enum."
+		);
+	}
+
+	args.cb = cb;
+	args.args = _args;
+
+	result = joolnl_alloc_msg(sk, iname, JNLOP_STATS_TALKERS, 0, &msg);
+	if (result.error)
+		return result;
+
+	return joolnl_request(sk, msg, talkers_query_response, &args);
+}
@@ -15,6 +15,9 @@ struct joolnl_stat {
 	__u64 value;
 };
 
+/* Returns @id's metadata, or NULL if @id is not a known counter. */
+struct joolnl_stat_metadata const *joolnl_stat_metadata(enum jool_stat_id id);
+
 typedef struct jool_result (*joolnl_stats_foreach_cb)(
 	struct joolnl_stat const *entry, void *args
 );
@@ -25,4 +28,130 @@ struct jool_result joolnl_stats_foreach(
 	void *args
 );
 
+typedef struct jool_result (*joolnl_stats_dump_cb)(
+	char const *iname, struct joolnl_stat const *entry, void *args
+);
+/*
+ * Same as joolnl_stats_foreach(), except for every instance of @sk's type in
+ * the current namespace, in a single dump.
+ * If @filter is not NULL, it's a JSTAT_FILTER_SIZE-byte bitmap of the counters
+ * to retrieve. (See JNLAR_STATS_FILTER.)
+ */
+struct jool_result joolnl_stats_dump(
+	struct joolnl_socket *sk,
+	__u8 const *filter,
+	joolnl_stats_dump_cb cb,
+	void *args
+);
+
+struct joolnl_stat_percpu {
+	struct joolnl_stat_metadata meta;
+	/* Number of entries in @values. (The kernel's nr_cpu_ids.) */
+	unsigned int cpus;
+	/* CPU i's share of the counter is @values[i]. */
+	__u64 const *values;
+};
+
+typedef struct jool_result (*joolnl_stats_percpu_cb)(
+	struct joolnl_stat_percpu const *stat, void *args
+);
+/*
+ * Same as joolnl_stats_foreach(), except the counters are not summed up;
+ * they're returned per CPU. If @filter is not NULL, it's a
+ * JSTAT_FILTER_SIZE-byte bitmap of the counters to retrieve.
+ */
+struct jool_result joolnl_stats_percpu_foreach(
+	struct joolnl_socket *sk,
+	char const *iname,
+	__u8 const *filter,
+	joolnl_stats_percpu_cb cb,
+	void *args
+);
+
+struct joolnl_latency {
+	enum jool_latency_dir dir;
+	enum jool_latency_stage stage;
+	/* "6to4" or "4to6" */
+	char const *dir_name;
+	/* Name of the function that implements the stage */
+	char const *stage_name;
+	/* See JLAT_BUCKETS. */
+	__u64 buckets[JLAT_BUCKETS];
+};
+
+typedef struct jool_result (*joolnl_latency_foreach_cb)(
+	struct joolnl_latency const *histogram, void *args
+);
+struct jool_result joolnl_stats_latency_foreach(
+	struct joolnl_socket *sk,
+	char const *iname,
+	joolnl_latency_foreach_cb cb,
+	void *args
+);
+
+struct joolnl_lifetime {
+	enum jool_lifetime_metric metric;
+	enum jool_lifetime_class class;
+	/* "lifetime", "idle" or "port-hold" */
+	char const *metric_name;
+	/* "udp", "tcp-est", "tcp-trans" or "icmp" */
+	char const *class_name;
+	/* See JLIFE_BUCKETS. */
+	__u64 buckets[JLIFE_BUCKETS];
+};
+
+typedef struct jool_result (*joolnl_lifetime_foreach_cb)(
+	struct joolnl_lifetime const *histogram, void *args
+);
+struct jool_result joolnl_stats_lifetime_foreach(
+	struct joolnl_socket *sk,
+	char const *iname,
+	joolnl_lifetime_foreach_cb cb,
+	void *args
+);
+
+struct joolnl_rate {
+	enum jool_rate_id id;
+	/* eg. "received6" or "sessions-created" */
+	char const *name;
+	/* Per second, averaged over the last few seconds. */
+	double value;
+};
+
+typedef struct jool_result (*joolnl_rates_foreach_cb)(
+	struct joolnl_rate const *rate, void *args
+);
+struct jool_result joolnl_stats_rates_foreach(
+	struct joolnl_socket *sk,
+	char const *iname,
+	joolnl_rates_foreach_cb cb,
+	void *args
+);
+
+struct joolnl_talker {
+	enum jool_talker_metric metric;
+	/* "sessions" or "bytes" */
+	char const *metric_name;
+	/* The subscriber. */
+	struct ipv6_prefix prefix;
+	/* Estimated sessions created, or bytes moved. Might be overestimated. */
+	__u64 count;
+	/* Maximum overestimation of @count. */
+	__u64 error;
+};
+
+typedef struct jool_result (*joolnl_talkers_foreach_cb)(
+	struct joolnl_talker const *talker, void *args
+);
+/*
+ * Iterates over @iname's top talkers, per metric, biggest first. (Requires the
+ * top_talkers module parameter.)
+ */
+struct jool_result joolnl_stats_talkers_foreach(
+	struct joolnl_socket *sk,
+	char const *iname,
+	joolnl_talkers_foreach_cb cb,
+	void *args
+);
+
 #endif /* SRC_USR_NL_STATS_H_ */
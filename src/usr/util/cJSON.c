@@ -318,6 +318,10 @@ static const char *parse_string(cJSON *item, const char *str)
 	return ptr;
 }
 
+/* cJSON_ParseLazy() state. */
+static cJSON *lazy_root;
+static int (*lazy_fn)(const char *name);
+
 /* Predeclare these prototypes. */
 static const char *parse_value(cJSON *item, const char *value);
 static const char *parse_array(cJSON *item, const char *value);
@@ -369,6 +373,65 @@ cJSON *cJSON_Parse(const char *value)
 	return cJSON_ParseWithOpts(value, 0, 0);
 }
 
+cJSON *cJSON_ParseLazy(const char *value, int (*is_lazy)(const char *name))
+{
+	const char *end;
+	cJSON *c = cJSON_New_Item();
+	ep = 0;
+	if (!c)
+		return 0; /* memory fail */
+
+	lazy_root = c;
+	lazy_fn = is_lazy;
+	end = parse_value(c, skip(value));
+	lazy_root = 0;
+	lazy_fn = 0;
+
+	if (!end) {
+		cJSON_Delete(c);
+		return 0;
+	} /* parse failure. ep is set. */
+	return c;
+}
+
+cJSON *cJSON_ParseLazyItem(cJSON *array, const char **cursor)
+{
+	const char *value = *cursor;
+	cJSON *item;
+	ep = 0;
+
+	if (!value) {
+		value = skip(array->lazy + 1);
+		if (*value == ']') {
+			*cursor = value;
+			return 0; /* empty array. */
+		}
+	} else {
+		if (*value == ']')
+			return 0; /* end of array */
+		value = skip(value + 1); /* skip the comma. */
+	}
+
+	item = cJSON_New_Item();
+	if (!item) {
+		ep = value;
+		return 0; /* memory fail */
+	}
+	value = skip(parse_value(item, value));
+	if (!value) {
+		cJSON_Delete(item);
+		return 0;
+	}
+	if (*value != ',' && *value != ']') {
+		ep = value;
+		cJSON_Delete(item);
+		return 0; /* malformed. */
+	}
+
+	*cursor = value;
+	return item;
+}
+
 /* Parser core - when encountering text, process appropriately. */
 static const char *parse_value(cJSON *item, const char *value)
 {
@@ -439,6 +502,51 @@ static const char *parse_array(cJSON *item, const char *value)
 	return 0; /* malformed. */
 }
 
+/*
+ * Skips a lazy array. Only the brackets and strings are checked; the elements
+ * will be validated as they are parsed.
+ */
+static const char *skip_lazy_array(cJSON *item, const char *value)
+{
+	int depth = 0;
+
+	item->type = cJSON_Array;
+	item->lazy = value;
+
+	for (; *value; value++) {
+		switch (*value) {
+		case '\"':
+			for (value++; *value && *value != '\"'; value++)
+				if (*value == '\\' && value[1])
+					value++;
+			if (!*value)
+				goto fail;
+			break;
+		case '[':
+		case '{':
+			depth++;
+			break;
+		case ']':
+		case '}':
+			if (--depth == 0)
+				return value + 1;
+			break;
+		}
+	}
+
+fail:
+	ep = value;
+	return 0; /* malformed. */
+}
+
+static const char *parse_member_value(cJSON *parent, cJSON *child,
+		const char *value)
+{
+	if (parent == lazy_root && *value == '[' && lazy_fn(child->string))
+		return skip_lazy_array(child, value);
+	return parse_value(child, value);
+}
+
 /* Build an object from the text. */
 static const char *parse_object(cJSON *item, const char *value)
 {
@@ -465,7 +573,7 @@ static const char *parse_object(cJSON *item, const char *value)
 		ep = value;
 		return 0;
 	} /* fail! */
-	value = skip(parse_value(child, skip(value + 1))); /* skip any spacing, get the value. */
+	value = skip(parse_member_value(item, child, skip(value + 1))); /* skip any spacing, get the value. */
 	if (!value)
 		return 0;
 
@@ -485,7 +593,7 @@ static const char *parse_object(cJSON *item, const char *value)
 			ep = value;
 			return 0;
 		} /* fail! */
-		value = skip(parse_value(child, skip(value + 1))); /* skip any spacing, get the value. */
+		value = skip(parse_member_value(item, child, skip(value + 1))); /* skip any spacing, get the value. */
 		if (!value)
 			return 0;
 	}
@@ -70,6 +70,12 @@ typedef struct cJSON {
 	 * or is in the list of subitems of an object.
 	 */
 	char *string;
+
+	/*
+	 * If this is a lazy array (see cJSON_ParseLazy()), the unparsed array.
+	 * Points to the source text.
+	 */
+	const char *lazy;
 } cJSON;
 
 /*
@@ -101,4 +107,22 @@ const char *cJSON_GetErrorPtr(void);
 cJSON *cJSON_ParseWithOpts(const char *value,
 		const char **return_parse_end, int require_null_terminated);
 
+/*
+ * Same as cJSON_Parse(), except the arrays that are members of the root object
+ * and whose names satisfy @is_lazy are only skipped over; they come out with
+ * no children, and have to be read one element at a time through
+ * cJSON_ParseLazyItem(). @value has to outlive the result.
+ *
+ * Meant for huge tables, which would otherwise need one node per value.
+ */
+cJSON *cJSON_ParseLazy(const char *value, int (*is_lazy)(const char *name));
+/*
+ * Parses the next element of lazy array @array. @cursor is the iteration
+ * state; start with NULL.
+ * Returns NULL when the array ends, or on failure. (In which case
+ * cJSON_GetErrorPtr() returns nonzero.) Call cJSON_Delete() on each element
+ * when you're done with it.
+ */
+cJSON *cJSON_ParseLazyItem(cJSON *array, const char **cursor);
+
 #endif /* SRC_USR_UTIL_CJSON_H_ */
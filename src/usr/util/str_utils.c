@@ -232,6 +232,38 @@ struct jool_result str_to_port_range(char *str, struct port_range *range)
 	return result;
 }
 
+struct jool_result str_to_mark_range(const char *str, __u32 *first,
+		__u32 *last)
+{
+	unsigned long long int tmp;
+	char *endptr = NULL;
+	struct jool_result result;
+
+	result = str_to_ull(str, &endptr, 0, MAX_U32, &tmp);
+	if (result.error)
+		return result;
+	*first = tmp;
+
+	if (*endptr != '-') {
+		*last = *first;
+		return result_success();
+	}
+
+	result = str_to_ull(endptr + 1, NULL, 0, MAX_U32, &tmp);
+	if (result.error)
+		return result;
+	*last = tmp;
+
+	if (*first > *last) {
+		return result_from_error(
+			-EINVAL,
+			"Mark range '%s' is inverted.", str
+		);
+	}
+
+	return result_success();
+}
+
 struct jool_result str_to_addr4(const char *str, struct in_addr *addr)
 {
 	if (!inet_pton(AF_INET, str, addr)) {
@@ -480,6 +512,378 @@ struct jool_result str_to_plateaus_array(const char *str, struct mtu_plateaus *p
 	return result_success();
 }
 
+/* "null" and the empty string both stand for the empty list. */
+struct jool_result str_to_port_list(const char *str, struct port_list *ports)
+{
+	char *str_copy;
+	char *token;
+	struct jool_result result;
+
+	ports->count = 0;
+	if (strcmp(str, "null") == 0)
+		return result_success();
+
+	str_copy = malloc(strlen(str) + 1);
+	if (!str_copy)
+		return result_from_enomem();
+	strcpy(str_copy, str);
+
+	for (token = strtok(str_copy, ","); token; token = strtok(NULL, ",")) {
+		if (ports->count >= PORT_LIST_MAX) {
+			free(str_copy);
+			return result_from_error(
+				-EINVAL,
+				"Too many ports. The current max is %u.",
+				PORT_LIST_MAX
+			);
+		}
+
+		result = str_to_u16(token, &ports->values[ports->count]);
+		if (result.error) {
+			free(str_copy);
+			return result;
+		}
+		ports->count++;
+	}
+
+	free(str_copy);
+	return result_success();
+}
+
+struct jool_result str_to_ifname(const char *str, char *name)
+{
+	size_t len;
+
+	len = strlen(str);
+	if (len == 0)
+		return result_from_error(-EINVAL, "Interface names cannot be empty.");
+	if (len >= IFNAME_MAX_SIZE) {
+		return result_from_error(
+			-EINVAL,
+			"Interface name '%s' is too long. (max: %u characters)",
+			str, IFNAME_MAX_SIZE - 1
+		);
+	}
+
+	strcpy(name, str);
+	return result_success();
+}
+
+struct jool_result str_to_ingress_devices(const char *str,
+		struct ingress_devices *devices)
+{
+	char *str_copy;
+	char *token;
+	struct jool_result result;
+
+	devices->count = 0;
+	if (strcmp(str, "null") == 0)
+		return result_success();
+
+	str_copy = malloc(strlen(str) + 1);
+	if (!str_copy)
+		return result_from_enomem();
+	strcpy(str_copy, str);
+
+	for (token = strtok(str_copy, ","); token; token = strtok(NULL, ",")) {
+		if (devices->count >= INGRESS_DEVICES_MAX) {
+			free(str_copy);
+			return result_from_error(
+				-EINVAL,
+				"Too many ingress devices. The current max is %u.",
+				INGRESS_DEVICES_MAX
+			);
+		}
+
+		result = str_to_ifname(token,
+				devices->names[devices->count]);
+		if (result.error) {
+			free(str_copy);
+			return result;
+		}
+		devices->count++;
+	}
+
+	free(str_copy);
+	return result_success();
+}
+
+/*
+ * Splits @str, a <gateway>%<interface> next hop, into a NULL-terminated copy of
+ * the address (@addr) and @dev.
+ */
+static struct jool_result str_to_next_hop(const char *str, char const *format,
+		char *addr, char *dev)
+{
+	char const *separator;
+	size_t addr_len;
+
+	separator = strchr(str, '%');
+	if (!separator) {
+		return result_from_error(
+			-EINVAL,
+			"'%s' does not seem to contain an interface (format: %s).",
+			str, format
+		);
+	}
+
+	addr_len = separator - str;
+	if (addr_len >= INET6_ADDRSTRLEN) {
+		return result_from_error(
+			-EINVAL,
+			"Cannot parse '%s' as a %s.", str, format
+		);
+	}
+	memcpy(addr, str, addr_len);
+	addr[addr_len] = '\0';
+
+	return str_to_ifname(separator + 1, dev);
+}
+
+struct jool_result str_to_next_hop6(const char *str,
+		struct in6_addr *gateway, char *dev)
+{
+	char addr[INET6_ADDRSTRLEN];
+	struct jool_result result;
+
+	result = str_to_next_hop(str,
+			"<IPv6 address>%<interface> (eg. fe80::1%eth0)",
+			addr, dev);
+	if (result.error)
+		return result;
+
+	return str_to_addr6(addr, gateway);
+}
+
+struct jool_result str_to_next_hop4(const char *str,
+		struct in_addr *gateway, char *dev)
+{
+	char addr[INET6_ADDRSTRLEN];
+	struct jool_result result;
+
+	result = str_to_next_hop(str,
+			"<IPv4 address>%<interface> (eg. 192.0.2.1%eth1)",
+			addr, dev);
+	if (result.error)
+		return result;
+
+	return str_to_addr4(addr, gateway);
+}
+
+static struct jool_result __str_to_timeout_class(char *str,
+		struct timeout_class *class)
+{
+	char *ports;
+	char *prefix;
+	char *ttl;
+	struct jool_result result;
+
+	ttl = strchr(str, '=');
+	if (!ttl) {
+		return result_from_error(
+			-EINVAL,
+			"Timeout class '%s' lacks a timeout. (Expected '<protocol>[:<ports>][@<prefix>]=<timeout>')",
+			str
+		);
+	}
+	*ttl = '\0';
+	ttl++;
+
+	prefix = strchr(str, '@');
+	if (prefix) {
+		*prefix = '\0';
+		prefix++;
+	}
+
+	ports = strchr(str, ':');
+	if (ports) {
+		*ports = '\0';
+		ports++;
+	}
+
+	class->proto = str_to_l4proto(str);
+	if (class->proto == L4PROTO_OTHER) {
+		return result_from_error(
+			-EINVAL,
+			"Unknown protocol: '%s'",
+			str
+		);
+	}
+
+	if (ports) {
+		result = str_to_port_range(ports, &class->range.ports);
+		if (result.error)
+			return result;
+	} else {
+		class->range.ports.min = 0;
+		class->range.ports.max = 65535;
+	}
+
+	if (prefix) {
+		result = str_to_prefix4(prefix, &class->range.prefix);
+		if (result.error)
+			return result;
+	} else {
+		class->range.prefix.addr.s_addr = 0;
+		class->range.prefix.len = 0;
+	}
+
+	return str_to_timeout(ttl, &class->ttl);
+}
+
+/* "<protocol>[:<min port>[-<max port>]][@<IPv4 prefix>]=<timeout>" */
+struct jool_result str_to_timeout_class(const char *str,
+		struct timeout_class *class)
+{
+	char *str_copy;
+	struct jool_result result;
+
+	str_copy = malloc(strlen(str) + 1);
+	if (!str_copy)
+		return result_from_enomem();
+	strcpy(str_copy, str);
+
+	result = __str_to_timeout_class(str_copy, class);
+
+	free(str_copy);
+	return result;
+}
+
+/* Comma-separated str_to_timeout_class()es. "null" means none. */
+struct jool_result str_to_timeout_classes(const char *str,
+		struct timeout_classes *classes)
+{
+	char *str_copy;
+	char *token;
+	char *next;
+	struct jool_result result;
+
+	classes->count = 0;
+	if (strcmp(str, "null") == 0 || str[0] == '\0')
+		return result_success();
+
+	str_copy = malloc(strlen(str) + 1);
+	if (!str_copy)
+		return result_from_enomem();
+	strcpy(str_copy, str);
+
+	/* Not strtok(); str_to_prefix4() uses it. */
+	for (token = str_copy; token; token = next) {
+		next = strchr(token, ',');
+		if (next) {
+			*next = '\0';
+			next++;
+		}
+
+		if (classes->count >= TIMEOUT_CLASSES_MAX) {
+			free(str_copy);
+			return result_from_error(
+				-EINVAL,
+				"Too many timeout classes. The current max is %u.",
+				TIMEOUT_CLASSES_MAX
+			);
+		}
+
+		result = __str_to_timeout_class(token,
+				&classes->values[classes->count]);
+		if (result.error) {
+			free(str_copy);
+			return result;
+		}
+		classes->count++;
+	}
+
+	free(str_copy);
+	return result_success();
+}
+
+static struct jool_result __str_to_pool6_tenant(char *str,
+		struct pool6_tenant *tenant)
+{
+	char *mark;
+	struct jool_result result;
+
+	mark = strchr(str, '=');
+	if (mark) {
+		*mark = '\0';
+		mark++;
+	}
+
+	result = str_to_prefix6(str, &tenant->prefix);
+	if (result.error)
+		return result;
+
+	tenant->mark_set = !!mark;
+	tenant->mark = 0;
+	return mark ? str_to_u32(mark, &tenant->mark) : result_success();
+}
+
+/* "<IPv6 prefix>[=<mark>]" */
+struct jool_result str_to_pool6_tenant(const char *str,
+		struct pool6_tenant *tenant)
+{
+	char *str_copy;
+	struct jool_result result;
+
+	str_copy = malloc(strlen(str) + 1);
+	if (!str_copy)
+		return result_from_enomem();
+	strcpy(str_copy, str);
+
+	result = __str_to_pool6_tenant(str_copy, tenant);
+
+	free(str_copy);
+	return result;
+}
+
+/* Comma-separated str_to_pool6_tenant()s. "null" means none. */
+struct jool_result str_to_pool6_tenants(const char *str,
+		struct pool6_tenants *tenants)
+{
+	char *str_copy;
+	char *token;
+	char *next;
+	struct jool_result result;
+
+	tenants->count = 0;
+	if (strcmp(str, "null") == 0 || str[0] == '\0')
+		return result_success();
+
+	str_copy = malloc(strlen(str) + 1);
+	if (!str_copy)
+		return result_from_enomem();
+	strcpy(str_copy, str);
+
+	/* Not strtok(); str_to_prefix6() uses it. */
+	for (token = str_copy; token; token = next) {
+		next = strchr(token, ',');
+		if (next) {
+			*next = '\0';
+			next++;
+		}
+
+		if (tenants->count >= POOL6_TENANTS_MAX) {
+			free(str_copy);
+			return result_from_error(
+				-EINVAL,
+				"Too many pool6 tenants. The current max is %u.",
+				POOL6_TENANTS_MAX
+			);
+		}
+
+		result = __str_to_pool6_tenant(token,
+				&tenants->values[tenants->count]);
+		if (result.error) {
+			free(str_copy);
+			return result;
+		}
+		tenants->count++;
+	}
+
+	free(str_copy);
+	return result_success();
+}
+
 void timeout2str(unsigned int millis, char *buffer)
 {
 	static const unsigned int MILLIS_PER_SECOND = 1000;
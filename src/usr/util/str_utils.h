@@ -22,6 +22,8 @@ struct jool_result str_to_u32(const char *str, __u32 *out);
 
 struct jool_result str_to_timeout(const char *str, __u32 *out);
 struct jool_result str_to_port_range(char *str, struct port_range *range);
+struct jool_result str_to_mark_range(const char *str, __u32 *first,
+		__u32 *last);
 
 /**
  * Converts "str" to a IPv4 address. Stores the result in "result".
@@ -63,6 +65,26 @@ struct jool_result str_to_prefix4(const char *str, struct ipv4_prefix *out);
  * going to be copied to @count.
  */
 struct jool_result str_to_plateaus_array(const char *str, struct mtu_plateaus *plateaus);
+struct jool_result str_to_port_list(const char *str, struct port_list *ports);
+struct jool_result str_to_ifname(const char *str, char *name);
+struct jool_result str_to_ingress_devices(const char *str,
+		struct ingress_devices *devices);
+/**
+ * Parses @str as a <gateway>%<interface> next hop. @dev is assumed to length
+ * IFNAME_MAX_SIZE.
+ */
+struct jool_result str_to_next_hop6(const char *str, struct in6_addr *gateway,
+		char *dev);
+struct jool_result str_to_next_hop4(const char *str, struct in_addr *gateway,
+		char *dev);
+struct jool_result str_to_timeout_class(const char *str,
+		struct timeout_class *class);
+struct jool_result str_to_timeout_classes(const char *str,
+		struct timeout_classes *classes);
+struct jool_result str_to_pool6_tenant(const char *str,
+		struct pool6_tenant *tenant);
+struct jool_result str_to_pool6_tenants(const char *str,
+		struct pool6_tenants *tenants);
 
 /**
  * Converts the @millis amount of milliseconds to a string.
@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# Runs the benchmark modules, and prints their results as CSV.
+#
+# Usage: ./bench.sh [<suite> [<module parameters>...]]
+# Example: ./bench.sh bib max_entries=10000000 > bib.csv
+
+if [ -z "$1" ]; then
+	BENCHES=`ls */*.ko`
+else
+	BENCHES=$1/bench_$1.ko
+	shift
+fi
+
+sudo dmesg -C
+
+echo "suite,case,param,ops,total,per_op"
+for i in $BENCHES; do
+	echo "Running benchmark '$i'." >&2
+	sudo insmod $i "$@" && sudo rmmod $i
+	# Warnings and failures go to stderr, so they can't be mistaken for
+	# results, but can't go unnoticed either.
+	sudo dmesg -ct | tee >(grep -v "^jool_bench," >&2) \
+		| grep "^jool_bench," | cut -d, -f2-
+done
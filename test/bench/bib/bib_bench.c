@@ -0,0 +1,112 @@
+#include <linux/module.h>
+
+#include "framework/bench.h"
+#include "framework/nat64.h"
+#include "mod/common/db/bib/db.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("BIB DB microbenchmarks");
+
+static unsigned long max_entries = 1000000;
+module_param(max_entries, ulong, 0444);
+MODULE_PARM_DESC(max_entries, "Largest BIB to measure. (Sizes grow from 1000 in powers of 10.)");
+
+static struct xlator jool;
+
+static bool bench_size(unsigned long size)
+{
+	struct xlation state;
+	struct bib_session result;
+	unsigned long i;
+	u64 start;
+	int error;
+
+	if (bench_nat64_state(&jool, &state, L4PROTO_UDP))
+		return false;
+
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		bench_nat64_client(&state, i);
+		error = bench_nat64_add6(&state);
+		if (error) {
+			log_err("Add #%lu failed: %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+	bench_report("bib", "add6", size, size, start);
+
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		bench_nat64_client(&state, bench_shuffle(i, size));
+		error = bib_find(jool.nat64.bib, &state.in.tuple, &result);
+		if (error) {
+			log_err("Lookup #%lu failed: %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+	bench_report("bib", "find6", size, size, start);
+
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		bench_nat64_client(&state, size + i);
+		error = bib_find(jool.nat64.bib, &state.in.tuple, &result);
+		if (error != -ESRCH) {
+			log_err("Miss #%lu returned %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+	bench_report("bib", "find6_miss", size, size, start);
+
+	bib_flush(&jool);
+	return true;
+}
+
+static bool bench_bib(void)
+{
+	unsigned long size;
+
+	for (size = 1000; size <= max_entries; size *= 10)
+		if (!bench_size(size))
+			return false;
+
+	return true;
+}
+
+static int init(void)
+{
+	/* 65536 addresses; plenty of room for 10 million mappings. */
+	return bench_nat64_init(&jool, L4PROTO_UDP, "198.18.0.0", 16,
+			1024, 65535);
+}
+
+static void clean(void)
+{
+	bench_nat64_clean(&jool);
+}
+
+int init_module(void)
+{
+	struct test_group test = {
+		.name = "BIB benchmarks",
+		.setup_fn = bench_nat64_setup,
+		.teardown_fn = bench_nat64_teardown,
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, bench_bib, "bib_add6() and bib_find()");
+
+	return test_group_end(&test);
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
@@ -0,0 +1,326 @@
+#include <linux/kthread.h>
+#include <linux/module.h>
+
+#include "framework/bench.h"
+#include "framework/nat64.h"
+#include "mod/common/db/bib/db.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("BIB session churn stress test");
+
+static unsigned int threads;
+module_param(threads, uint, 0444);
+MODULE_PARM_DESC(threads, "Flow creating kthreads, one per CPU. (Default: one per online CPU)");
+static unsigned int duration_ms = 10000;
+module_param(duration_ms, uint, 0444);
+MODULE_PARM_DESC(duration_ms, "Length of the storm.");
+static unsigned int rate;
+module_param(rate, uint, 0444);
+MODULE_PARM_DESC(rate, "New flows per second, per thread. (Default: 0, which means as many as possible)");
+static unsigned int ttl_ms = 1000;
+module_param(ttl_ms, uint, 0444);
+MODULE_PARM_DESC(ttl_ms, "Session lifetime. (All protocols and states.)");
+static unsigned int clean_ms = 100;
+module_param(clean_ms, uint, 0444);
+MODULE_PARM_DESC(clean_ms, "Period of the cleaner. (The real one runs every 2000.)");
+static bool tcp;
+module_param(tcp, bool, 0444);
+MODULE_PARM_DESC(tcp, "Send TCP SYNs instead of UDP packets.");
+
+#define SUITE "churn"
+/* Power-of-two nanosecond buckets. */
+#define LAT_BUCKETS 64
+
+struct histogram {
+	unsigned long buckets[LAT_BUCKETS];
+	unsigned long count;
+	u64 max;
+};
+
+/* A flow creating thread. Its fields are only read once it's stopped. */
+struct churner {
+	struct task_struct *task;
+	unsigned int id;
+	unsigned long failures;
+	/* Duration of each bib_add6() or bib_add_tcp6() call. */
+	struct histogram latency;
+};
+
+static struct xlator jool;
+static struct churner *churners;
+static unsigned int churner_count;
+
+static void histogram_add(struct histogram *histogram, u64 ns)
+{
+	unsigned int bucket;
+
+	bucket = (ns > 1) ? ilog2(ns) : 0;
+	if (bucket >= LAT_BUCKETS)
+		bucket = LAT_BUCKETS - 1;
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	if (ns > histogram->max)
+		histogram->max = ns;
+}
+
+static void histogram_merge(struct histogram *dst, struct histogram *src)
+{
+	unsigned int b;
+
+	for (b = 0; b < LAT_BUCKETS; b++)
+		dst->buckets[b] += src->buckets[b];
+	dst->count += src->count;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/* Returns the upper bound of the bucket the @percent'th sample fell in. */
+static u64 histogram_percentile(struct histogram *histogram,
+		unsigned int percent)
+{
+	unsigned long seen;
+	unsigned int b;
+
+	seen = 0;
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += histogram->buckets[b];
+		if (100 * (u64)seen >= (u64)percent * histogram->count)
+			return 2ull << b;
+	}
+
+	return 0;
+}
+
+static void report_histogram(char const *name, struct histogram *histogram)
+{
+	char buffer[64];
+
+	snprintf(buffer, sizeof(buffer), "%s_p50_ns", name);
+	bench_report_gauge(SUITE, buffer, churner_count,
+			histogram_percentile(histogram, 50));
+	snprintf(buffer, sizeof(buffer), "%s_p99_ns", name);
+	bench_report_gauge(SUITE, buffer, churner_count,
+			histogram_percentile(histogram, 99));
+	snprintf(buffer, sizeof(buffer), "%s_max_ns", name);
+	bench_report_gauge(SUITE, buffer, churner_count, histogram->max);
+}
+
+/* Sleeps until the thread is allowed another flow by @rate. */
+static void throttle(u64 start, unsigned long done)
+{
+	while (!kthread_should_stop()) {
+		if ((u64)done * NSEC_PER_SEC <= (u64)rate * (bench_now() - start))
+			return;
+		usleep_range(50, 100);
+	}
+}
+
+static int churn(void *arg)
+{
+	struct churner *churner = arg;
+	struct xlation state;
+	unsigned long flows;
+	u64 start;
+	u64 before;
+	int error;
+
+	error = bench_nat64_state(&jool, &state,
+			tcp ? L4PROTO_TCP : L4PROTO_UDP);
+	if (error) {
+		log_err("Thread %u could not create its packet: %d",
+				churner->id, error);
+		churner->failures++;
+		goto idle;
+	}
+	/* Every thread gets its own /96; every flow, its own address. */
+	state.in.tuple.src.addr6.l3.s6_addr32[2] = cpu_to_be32(churner->id);
+
+	start = bench_now();
+	for (flows = 0; !kthread_should_stop(); flows++) {
+		if (rate)
+			throttle(start, flows);
+
+		bench_nat64_client(&state, flows);
+		before = bench_now();
+		if (bench_nat64_add6(&state))
+			churner->failures++;
+		histogram_add(&churner->latency, bench_now() - before);
+
+		bench_yield(flows);
+	}
+
+	bench_nat64_state_clean(&state);
+	return 0;
+
+idle:
+	/* kthread_stop() needs us around. */
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(HZ / 10);
+	return 0;
+}
+
+struct cleaner_stats {
+	/* Duration of each clean_table() call; ie. table lock hold time. */
+	struct histogram latency;
+	__u64 peak_bibs;
+	__u64 peak_sessions;
+};
+
+/* bib_clean(), except timed per table, and without a budget. */
+static void clean(struct cleaner_stats *stats)
+{
+	unsigned int budget;
+	unsigned int t;
+	u64 before;
+
+	for (t = 0; t < BIB_TABLES; t++) {
+		budget = UINT_MAX;
+		before = bench_now();
+		clean_table(&jool, get_nth_table(jool.nat64.bib, t), &budget);
+		histogram_add(&stats->latency, bench_now() - before);
+	}
+}
+
+static void sample(struct cleaner_stats *stats)
+{
+	__u64 *values;
+
+	values = jstat_query(jool.stats);
+	if (!values)
+		return;
+
+	if (values[JSTAT_BIB_ENTRIES] > stats->peak_bibs)
+		stats->peak_bibs = values[JSTAT_BIB_ENTRIES];
+	if (values[JSTAT_SESSIONS] > stats->peak_sessions)
+		stats->peak_sessions = values[JSTAT_SESSIONS];
+
+	kfree(values);
+}
+
+static bool spawn_churners(void)
+{
+	struct churner *churner;
+	unsigned int wanted;
+	unsigned int cpu;
+
+	wanted = threads ? min(threads, num_online_cpus()) : num_online_cpus();
+	churners = kcalloc(wanted, sizeof(*churners), GFP_KERNEL);
+	if (!churners)
+		return false;
+
+	churner_count = 0;
+	for_each_online_cpu(cpu) {
+		if (churner_count >= wanted)
+			break;
+
+		churner = &churners[churner_count];
+		churner->id = churner_count;
+		churner->task = kthread_create_on_node(churn, churner,
+				cpu_to_node(cpu), "jool_churn/%u", cpu);
+		if (IS_ERR(churner->task)) {
+			log_err("Could not create thread %u: %ld",
+					churner_count, PTR_ERR(churner->task));
+			break;
+		}
+		kthread_bind(churner->task, cpu);
+		churner_count++;
+	}
+
+	return churner_count > 0;
+}
+
+static bool bench_churn(void)
+{
+	struct cleaner_stats cleaner = { 0 };
+	struct histogram latency = { 0 };
+	unsigned long failures;
+	unsigned long deadline;
+	unsigned int i;
+	u64 start;
+
+	if (!spawn_churners()) {
+		kfree(churners);
+		return false;
+	}
+
+	start = bench_now();
+	for (i = 0; i < churner_count; i++)
+		wake_up_process(churners[i].task);
+
+	deadline = jiffies + msecs_to_jiffies(duration_ms);
+	while (time_before(jiffies, deadline)) {
+		msleep(clean_ms);
+		clean(&cleaner);
+		sample(&cleaner);
+	}
+
+	failures = 0;
+	for (i = 0; i < churner_count; i++) {
+		kthread_stop(churners[i].task);
+		histogram_merge(&latency, &churners[i].latency);
+		failures += churners[i].failures;
+	}
+
+	bench_report(SUITE, tcp ? "add_tcp6" : "add6", churner_count,
+			latency.count, start);
+	report_histogram(tcp ? "add_tcp6" : "add6", &latency);
+	bench_report_gauge(SUITE, "failures", churner_count, failures);
+	report_histogram("clean_table", &cleaner.latency);
+	bench_report_gauge(SUITE, "peak_bib_entries", churner_count,
+			cleaner.peak_bibs);
+	bench_report_gauge(SUITE, "peak_sessions", churner_count,
+			cleaner.peak_sessions);
+	/* Doesn't include the port maps and blocks. */
+	bench_report_gauge(SUITE, "peak_bytes", churner_count,
+			cleaner.peak_bibs * kmem_cache_size(bib_cache)
+			+ cleaner.peak_sessions * kmem_cache_size(session_cache));
+
+	kfree(churners);
+	return true;
+}
+
+static int init(void)
+{
+	int error;
+
+	error = bench_nat64_init(&jool, tcp ? L4PROTO_TCP : L4PROTO_UDP,
+			"198.18.0.0", 16, 1024, 65535);
+	if (error)
+		return error;
+
+	jool.globals.nat64.bib.ttl.tcp_est = ttl_ms;
+	jool.globals.nat64.bib.ttl.tcp_trans = ttl_ms;
+	jool.globals.nat64.bib.ttl.udp = ttl_ms;
+	jool.globals.nat64.bib.ttl.icmp = ttl_ms;
+	return 0;
+}
+
+static void clean_instance(void)
+{
+	bench_nat64_clean(&jool);
+}
+
+int init_module(void)
+{
+	struct test_group test = {
+		.name = "Session churn",
+		.setup_fn = bench_nat64_setup,
+		.teardown_fn = bench_nat64_teardown,
+		.init_fn = init,
+		.clean_fn = clean_instance,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, bench_churn, "create/expire storm");
+
+	return test_group_end(&test);
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
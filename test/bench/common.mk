@@ -0,0 +1,29 @@
+#CC=cgcc
+
+ifndef KERNEL_DIR
+	KERNEL_DIR := /lib/modules/$(shell uname -r)/build
+endif
+
+# No -DDEBUG; the benchmarks want log_debug() compiled out, like in production.
+EXTRA_CFLAGS += -DUNIT_TESTING
+
+ccflags-y := -I$(src)/../../../src
+ccflags-y += -I$(src)/..
+ccflags-y += -I$(src)/../../unit
+# Same switches as src/mod/common/Kbuild, so the designs can be compared.
+ifdef BIB_SHARD_BITS
+ccflags-y += -DBIB_SHARD_BITS=$(BIB_SHARD_BITS)
+endif
+ifdef BIB_HASH_INDEX
+ccflags-y += -DBIB_HASH_INDEX
+endif
+ifdef POOL4_LEASES
+ccflags-y += -DPOOL4_LEASES
+endif
+
+MIN_REQS = ../../../src/common/types.o \
+	../../../src/mod/common/types.o \
+	../../../src/mod/common/address.o \
+	../../../src/mod/common/tracepoints.o \
+	../../unit/framework/unit_test.o \
+	../framework/bench.o
@@ -0,0 +1,167 @@
+#include <linux/module.h>
+
+#include "framework/bench.h"
+#include "mod/common/db/eam.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("EAMT microbenchmarks");
+
+static unsigned long max_entries = 1000000;
+module_param(max_entries, ulong, 0444);
+MODULE_PARM_DESC(max_entries, "Largest EAMT to measure. (Sizes grow from 1000 in powers of 10.)");
+
+static struct eam_table *eamt;
+static struct jool_stats *stats;
+
+/* Entry @i is 2001:db8::@i/128 <-> 10.0.0.0 + @i/32. */
+static void init_entry(struct eamt_entry *entry, unsigned int i)
+{
+	entry->prefix6.addr.s6_addr32[0] = cpu_to_be32(0x20010db8);
+	entry->prefix6.addr.s6_addr32[1] = 0;
+	entry->prefix6.addr.s6_addr32[2] = 0;
+	entry->prefix6.addr.s6_addr32[3] = cpu_to_be32(i);
+	entry->prefix6.len = 128;
+	entry->prefix4.addr.s_addr = cpu_to_be32(0x0a000000U + i);
+	entry->prefix4.len = 32;
+	entry->ea_len = 0;
+	entry->psid_offset = 0;
+}
+
+static bool bench_lookups(unsigned long size)
+{
+	struct eamt_entry entry;
+	struct result_addrxlat64 result64;
+	struct result_addrxlat46 result46;
+	unsigned long i;
+	u64 start;
+	int error;
+
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		init_entry(&entry, bench_shuffle(i, size));
+		error = eamt_xlat_6to4(eamt, &entry.prefix6.addr, &result64,
+				stats);
+		if (error) {
+			log_err("6->4 lookup #%lu failed: %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+	bench_report("eamt", "xlat_6to4", size, size, start);
+
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		init_entry(&entry, bench_shuffle(i, size));
+		error = eamt_xlat_4to6(eamt, &entry.prefix4.addr, &result46,
+				stats);
+		if (error) {
+			log_err("4->6 lookup #%lu failed: %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+	bench_report("eamt", "xlat_4to6", size, size, start);
+
+	/* Same address over and over; this is mostly the per-CPU cache. */
+	init_entry(&entry, 0);
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		eamt_xlat_6to4(eamt, &entry.prefix6.addr, &result64, stats);
+		bench_yield(i);
+	}
+	bench_report("eamt", "xlat_6to4_hot", size, size, start);
+
+	return true;
+}
+
+static bool bench_size(unsigned long size)
+{
+	struct eamt_entry entry;
+	unsigned long i;
+	u64 start;
+	int error;
+
+	/* No synchronize_rcu() per entry; nobody else is reading the table. */
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		init_entry(&entry, i);
+		error = eamt_add(eamt, &entry, true, false);
+		if (error) {
+			log_err("Add #%lu failed: %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+	bench_report("eamt", "add", size, size, start);
+
+	if (!bench_lookups(size))
+		return false;
+	eamt_flush(eamt);
+
+	start = bench_now();
+	for (i = 0; i < size; i++) {
+		init_entry(&entry, i);
+		error = eamt_stage(eamt, &entry, true);
+		if (error) {
+			log_err("Stage #%lu failed: %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+	error = eamt_commit_staged(eamt);
+	if (error) {
+		log_err("Commit failed: %d", error);
+		return false;
+	}
+	bench_report("eamt", "bulk_load", size, size, start);
+
+	eamt_flush(eamt);
+	return true;
+}
+
+static bool bench_eamt(void)
+{
+	unsigned long size;
+
+	for (size = 1000; size <= max_entries; size *= 10)
+		if (!bench_size(size))
+			return false;
+
+	return true;
+}
+
+static int init(void)
+{
+	eamt = eamt_alloc();
+	if (!eamt)
+		return -ENOMEM;
+	stats = jstat_alloc();
+	return 0;
+}
+
+static void clean(void)
+{
+	eamt_put(eamt);
+}
+
+int init_module(void)
+{
+	struct test_group test = {
+		.name = "EAMT benchmarks",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, bench_eamt, "eamt_add() and eamt_xlat_*()");
+
+	return test_group_end(&test);
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
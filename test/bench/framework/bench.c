@@ -0,0 +1,25 @@
+#include "framework/bench.h"
+
+#include <linux/math64.h>
+
+void bench_report(char const *suite, char const *name, unsigned long param,
+		unsigned long ops, u64 start)
+{
+	u64 total;
+	u64 centis;
+	u32 rem;
+
+	total = bench_now() - start;
+	centis = ops ? div64_u64(100 * total, ops) : 0;
+	centis = div_u64_rem(centis, 100, &rem);
+
+	pr_info(BENCH_PREFIX ",%s,%s,%lu,%lu,%llu,%llu.%02u\n", suite, name,
+			param, ops, total, centis, rem);
+}
+
+void bench_report_gauge(char const *suite, char const *name,
+		unsigned long param, u64 value)
+{
+	pr_info(BENCH_PREFIX ",%s,%s,%lu,1,%llu,%llu.00\n", suite, name, param,
+			value, value);
+}
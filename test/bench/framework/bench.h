@@ -0,0 +1,51 @@
+#ifndef _JOOL_BENCH_H
+#define _JOOL_BENCH_H
+
+/**
+ * @file
+ * Microbenchmark helpers, on top of the unit test framework.
+ *
+ * Each benchmark is a test of a struct test_group. It times its loop with
+ * bench_now() and bench_report(), and the latter prints the result as a single
+ * kernel log line meant for machines (bench.sh collects them):
+ *
+ *	jool_bench,<suite>,<case>,<param>,<ops>,<total>,<per op>
+ *
+ * Timings are in nanoseconds. The meaning of <param> depends on the case.
+ * (Table size, pool4 utilization, etc.)
+ */
+
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include "framework/unit_test.h"
+
+#define BENCH_PREFIX "jool_bench"
+
+static inline u64 bench_now(void)
+{
+	return ktime_get_ns();
+}
+
+void bench_report(char const *suite, char const *name, unsigned long param,
+		unsigned long ops, u64 start);
+/* For results that aren't timed loops (sizes, maximums); one op of @value. */
+void bench_report_gauge(char const *suite, char const *name,
+		unsigned long param, u64 value);
+
+/*
+ * Module init runs in process context; this keeps long loops from tripping the
+ * soft lockup detector. It's cheap enough to leave inside the timed loops.
+ */
+static inline void bench_yield(unsigned long i)
+{
+	if ((i & 1023) == 0)
+		cond_resched();
+}
+
+/* Scatters @i over [0, @n), repeatably, so lookups don't walk in order. */
+static inline unsigned int bench_shuffle(unsigned int i, unsigned int n)
+{
+	return (u32)(((u64)i * 2654435761U) % n);
+}
+
+#endif /* _JOOL_BENCH_H */
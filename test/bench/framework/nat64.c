@@ -0,0 +1,172 @@
+#include "framework/nat64.h"
+
+#include <linux/skbuff.h>
+#include "framework/skb_generator.h"
+#include "mod/common/db/bib/db.h"
+#include "mod/common/db/pool4/db.h"
+#include "mod/common/db/pool4/rfc6056.h"
+
+/* Only lends its mark (zero) to mask_domain_find(). (UDP) */
+static struct sk_buff *skb;
+
+static void defrag_dummy(struct net *ns)
+{
+	/* No code */
+}
+
+int bench_nat64_setup(void)
+{
+	int error;
+
+	skb = alloc_skb(0, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+	error = rfc6056_setup();
+	if (error)
+		goto rfc6056_fail;
+	error = xlator_setup();
+	if (error)
+		goto xlator_fail;
+	xlator_set_defrag(defrag_dummy);
+
+	return 0;
+
+xlator_fail:
+	rfc6056_teardown();
+rfc6056_fail:
+	kfree_skb(skb);
+	return error;
+}
+
+void bench_nat64_teardown(void)
+{
+	xlator_teardown();
+	rfc6056_teardown();
+	bib_teardown();
+	kfree_skb(skb);
+}
+
+int bench_nat64_init(struct xlator *jool, l4_protocol proto, char *addr,
+		__u8 len, __u16 min, __u16 max)
+{
+	struct ipv6_prefix pool6;
+	struct pool4_entry entry;
+	int error;
+
+	pool6.len = 96;
+	error = str_to_addr6("64:ff9b::", &pool6.addr);
+	if (error)
+		return error;
+
+	error = xlator_add(XF_NETFILTER | XT_NAT64, INAME_DEFAULT, &pool6,
+			jool);
+	if (error)
+		return error;
+
+	entry.mark = 0;
+	entry.iterations = 0;
+	entry.flags = ITERATIONS_SET | ITERATIONS_INFINITE;
+	entry.proto = proto;
+	error = str_to_addr4(addr, &entry.range.prefix.addr);
+	if (error)
+		goto fail;
+	entry.range.prefix.len = len;
+	entry.range.ports.min = min;
+	entry.range.ports.max = max;
+
+	error = pool4db_add(jool->nat64.pool4, &entry);
+	if (error)
+		goto fail;
+
+	return 0;
+
+fail:
+	bench_nat64_clean(jool);
+	return error;
+}
+
+void bench_nat64_clean(struct xlator *jool)
+{
+	xlator_put(jool);
+	xlator_rm(XT_NAT64, INAME_DEFAULT);
+}
+
+int bench_nat64_state(struct xlator *jool, struct xlation *state,
+		l4_protocol proto)
+{
+	struct tuple *tuple;
+	struct sk_buff *syn;
+	int error;
+
+	xlation_init(state, jool);
+	if (proto == L4PROTO_TCP) {
+		error = create_tcp_packet(&syn, L3PROTO_IPV6, true, false,
+				false);
+		if (error)
+			return error;
+		/* The tuple is ours; only the TCP flags are read from here. */
+		if (pkt_init_ipv6(state, syn) != VERDICT_CONTINUE) {
+			kfree_skb(syn);
+			return -EINVAL;
+		}
+	} else {
+		state->in.skb = skb;
+	}
+
+	tuple = &state->in.tuple;
+	tuple->src.addr6.l3.s6_addr32[0] = cpu_to_be32(0x20010db8);
+	tuple->src.addr6.l3.s6_addr32[1] = 0;
+	tuple->src.addr6.l3.s6_addr32[2] = 0;
+	tuple->src.addr6.l3.s6_addr32[3] = 0;
+	tuple->src.addr6.l4 = 5000;
+	tuple->dst.addr6.l3.s6_addr32[0] = cpu_to_be32(0x0064ff9b);
+	tuple->dst.addr6.l3.s6_addr32[1] = 0;
+	tuple->dst.addr6.l3.s6_addr32[2] = 0;
+	tuple->dst.addr6.l3.s6_addr32[3] = cpu_to_be32(0xc6336401);
+	tuple->dst.addr6.l4 = 80;
+	tuple->l3_proto = L3PROTO_IPV6;
+	tuple->l4_proto = proto;
+	return 0;
+}
+
+void bench_nat64_state_clean(struct xlation *state)
+{
+	if (state->in.skb != skb)
+		kfree_skb(state->in.skb);
+}
+
+void bench_nat64_client(struct xlation *state, unsigned int client)
+{
+	state->in.tuple.src.addr6.l3.s6_addr32[3] = cpu_to_be32(client);
+}
+
+static enum session_fate preserve(struct session_entry *session, void *arg)
+{
+	return FATE_PRESERVE;
+}
+
+int bench_nat64_add6(struct xlation *state)
+{
+	struct ipv4_transport_addr dst4;
+	struct mask_domain *masks;
+	struct collision_cb cb;
+	int error;
+
+	dst4.l3.s_addr = state->in.tuple.dst.addr6.l3.s6_addr32[3];
+	dst4.l4 = state->in.tuple.dst.addr6.l4;
+
+	if (mask_domain_find(state, &masks) != VERDICT_CONTINUE)
+		return -ESRCH;
+
+	if (state->in.tuple.l4_proto == L4PROTO_TCP) {
+		cb.cb = preserve;
+		cb.arg = NULL;
+		error = (bib_add_tcp6(state, masks, &dst4, &cb)
+				== VERDICT_CONTINUE) ? 0 : -EINVAL;
+	} else {
+		error = bib_add6(state, masks, &state->in.tuple, &dst4);
+	}
+
+	mask_domain_put(masks);
+	return error;
+}
@@ -0,0 +1,36 @@
+#ifndef _JOOL_BENCH_NAT64_H
+#define _JOOL_BENCH_NAT64_H
+
+/**
+ * @file
+ * A NAT64 instance with a real pool4 and BIB, for the benchmarks that need
+ * them. Clients are numbered; client @i is 2001:db8::@i#5000, and talks to
+ * 64:ff9b::198.51.100.1#80.
+ */
+
+#include "mod/common/translation_state.h"
+
+int bench_nat64_setup(void);
+void bench_nat64_teardown(void);
+
+/* pool4 will be @addr/@len (@min-@max), @proto only. */
+int bench_nat64_init(struct xlator *jool, l4_protocol proto, char *addr,
+		__u8 len, __u16 min, __u16 max);
+void bench_nat64_clean(struct xlator *jool);
+
+/*
+ * UDP clients share a dummy packet. TCP ones need a SYN, so @state gets its
+ * own; release it with bench_nat64_state_clean().
+ */
+int bench_nat64_state(struct xlator *jool, struct xlation *state,
+		l4_protocol proto);
+void bench_nat64_state_clean(struct xlation *state);
+void bench_nat64_client(struct xlation *state, unsigned int client);
+
+/*
+ * What Filtering does to IPv6 UDP and TCP SYNs: mask_domain_find(), then
+ * bib_add6() or bib_add_tcp6().
+ */
+int bench_nat64_add6(struct xlation *state);
+
+#endif /* _JOOL_BENCH_NAT64_H */
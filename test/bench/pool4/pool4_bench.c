@@ -0,0 +1,133 @@
+#include <linux/module.h>
+
+#include "framework/bench.h"
+#include "framework/nat64.h"
+#include "mod/common/db/bib/db.h"
+#include "mod/common/db/pool4/db.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("pool4 microbenchmarks");
+
+static unsigned long iterations = 10000;
+module_param(iterations, ulong, 0444);
+MODULE_PARM_DESC(iterations, "mask_domain_find() calls per utilization level.");
+
+/* pool4 is 192.0.2.1 (1024-65535). */
+#define POOL4_SIZE (65535U - 1024U + 1U)
+/* The most allocations timed per utilization level. */
+#define ALLOCS 1000U
+
+static unsigned int const utilizations[] = { 0, 50, 75, 90, 95, 99 };
+
+static struct xlator jool;
+
+static bool fill(struct xlation *state, unsigned int count)
+{
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < count; i++) {
+		bench_nat64_client(state, i);
+		error = bench_nat64_add6(state);
+		if (error) {
+			log_err("Fill #%u failed: %d", i, error);
+			return false;
+		}
+		bench_yield(i);
+	}
+
+	return true;
+}
+
+static bool bench_utilization(unsigned int percent)
+{
+	struct xlation state;
+	struct mask_domain *masks;
+	unsigned int used;
+	unsigned int allocs;
+	unsigned long i;
+	u64 start;
+	int error;
+
+	if (bench_nat64_state(&jool, &state, L4PROTO_UDP))
+		return false;
+
+	used = POOL4_SIZE * percent / 100;
+	if (!fill(&state, used))
+		return false;
+
+	/* Clients that don't have a mask yet. */
+	start = bench_now();
+	for (i = 0; i < iterations; i++) {
+		bench_nat64_client(&state, used + (i % ALLOCS));
+		if (mask_domain_find(&state, &masks) != VERDICT_CONTINUE) {
+			log_err("mask_domain_find() #%lu failed.", i);
+			return false;
+		}
+		mask_domain_put(masks);
+		bench_yield(i);
+	}
+	bench_report("pool4", "mask_domain_find", percent, iterations, start);
+
+	/* Includes find_available_mask(), which is where utilization hurts. */
+	allocs = min(ALLOCS, (POOL4_SIZE - used) / 2);
+	start = bench_now();
+	for (i = 0; i < allocs; i++) {
+		bench_nat64_client(&state, used + i);
+		error = bench_nat64_add6(&state);
+		if (error) {
+			log_err("Allocation #%lu failed: %d", i, error);
+			return false;
+		}
+	}
+	bench_report("pool4", "add6", percent, allocs, start);
+
+	bib_flush(&jool);
+	return true;
+}
+
+static bool bench_pool4(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(utilizations); i++)
+		if (!bench_utilization(utilizations[i]))
+			return false;
+
+	return true;
+}
+
+static int init(void)
+{
+	return bench_nat64_init(&jool, L4PROTO_UDP, "192.0.2.1", 32,
+			1024, 65535);
+}
+
+static void clean(void)
+{
+	bench_nat64_clean(&jool);
+}
+
+int init_module(void)
+{
+	struct test_group test = {
+		.name = "pool4 benchmarks",
+		.setup_fn = bench_nat64_setup,
+		.teardown_fn = bench_nat64_teardown,
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, bench_pool4, "mask_domain_find() and find_available_mask()");
+
+	return test_group_end(&test);
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
@@ -0,0 +1,147 @@
+#include <linux/module.h>
+
+#include "framework/bench.h"
+#include "framework/skb_generator.h"
+#include "mod/common/packet.h"
+#include "mod/common/translation_state.h"
+#include "mod/common/xlator.h"
+#include "mod/common/rfc7915/core.h"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("translating_the_packet() microbenchmarks");
+
+static unsigned long iterations = 100000;
+module_param(iterations, ulong, 0444);
+MODULE_PARM_DESC(iterations, "Translations per packet shape.");
+static unsigned int payload = 100;
+module_param(payload, uint, 0444);
+MODULE_PARM_DESC(payload, "Layer 4 payload length of the test packets.");
+
+#define SADDR6 "2001:db8::192.0.2.1"
+#define DADDR6 "2001:db8::203.0.113.2"
+#define SADDR4 "192.0.2.1"
+#define DADDR4 "203.0.113.8"
+
+static struct xlator jool;
+
+/* Translates @skb over and over. It's never consumed, so it can be reused. */
+static bool bench_skb(char const *name, struct sk_buff *skb, int error)
+{
+	struct xlation state;
+	unsigned long i;
+	u64 start;
+	verdict result;
+	bool success = false;
+
+	if (error) {
+		log_err("Could not create the %s packet: %d", name, error);
+		return false;
+	}
+
+	xlation_init(&state, &jool);
+	result = (skb->protocol == htons(ETH_P_IPV6))
+			? pkt_init_ipv6(&state, skb)
+			: pkt_init_ipv4(&state, skb);
+	if (result != VERDICT_CONTINUE) {
+		log_err("The %s packet is invalid.", name);
+		goto end;
+	}
+
+	start = bench_now();
+	for (i = 0; i < iterations; i++) {
+		/* Otherwise, only the first iteration would compute the flow. */
+		state.flowx_set = false;
+		result = translating_the_packet(&state);
+		if (result != VERDICT_CONTINUE) {
+			log_err("Translation #%lu of the %s packet failed.",
+					i, name);
+			goto end;
+		}
+		kfree_skb(state.out.skb);
+		bench_yield(i);
+	}
+	bench_report("translate", name, payload, iterations, start);
+	success = true;
+
+end:
+	kfree_skb(skb);
+	return success;
+}
+
+static bool bench_6to4(void)
+{
+	struct sk_buff *skb;
+	bool success = true;
+	int error;
+
+	error = create_skb6_udp(SADDR6, 5000, DADDR6, 80, payload, 64, &skb);
+	success &= bench_skb("udp6", skb, error);
+	error = create_skb6_tcp(SADDR6, 5000, DADDR6, 80, payload, 64, &skb);
+	success &= bench_skb("tcp6", skb, error);
+	error = create_skb6_icmp_info(SADDR6, DADDR6, 5000, payload, 64, &skb);
+	success &= bench_skb("icmp6_info", skb, error);
+	error = create_skb6_icmp_error(SADDR6, DADDR6, payload, 64, &skb);
+	success &= bench_skb("icmp6_error", skb, error);
+
+	return success;
+}
+
+static bool bench_4to6(void)
+{
+	struct sk_buff *skb;
+	bool success = true;
+	int error;
+
+	error = create_skb4_udp(SADDR4, 5000, DADDR4, 80, payload, 64, &skb);
+	success &= bench_skb("udp4", skb, error);
+	error = create_skb4_tcp(SADDR4, 5000, DADDR4, 80, payload, 64, &skb);
+	success &= bench_skb("tcp4", skb, error);
+	error = create_skb4_icmp_info(SADDR4, DADDR4, 5000, payload, 64, &skb);
+	success &= bench_skb("icmp4_info", skb, error);
+	error = create_skb4_icmp_error(SADDR4, DADDR4, payload, 64, &skb);
+	success &= bench_skb("icmp4_error", skb, error);
+
+	return success;
+}
+
+static int init(void)
+{
+	struct ipv6_prefix pool6;
+	int error;
+
+	pool6.len = 96;
+	error = str_to_addr6("2001:db8::", &pool6.addr);
+	if (error)
+		return error;
+
+	return xlator_add(XF_NETFILTER | XT_SIIT, INAME_DEFAULT, &pool6, &jool);
+}
+
+static void clean(void)
+{
+	xlator_put(&jool);
+	xlator_rm(XT_SIIT, INAME_DEFAULT);
+}
+
+int init_module(void)
+{
+	struct test_group test = {
+		.name = "Translation benchmarks",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, bench_6to4, "IPv6 -> IPv4");
+	test_group_test(&test, bench_4to6, "IPv4 -> IPv6");
+
+	return test_group_end(&test);
+}
+
+void cleanup_module(void)
+{
+	/* No code. */
+}
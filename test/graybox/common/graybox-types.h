@@ -9,6 +9,10 @@ enum graybox_command {
 	COMMAND_SEND,
 	COMMAND_STATS_DISPLAY,
 	COMMAND_STATS_FLUSH,
+	COMMAND_BENCH_ADD,
+	COMMAND_BENCH_START,
+	COMMAND_BENCH_STOP,
+	COMMAND_BENCH_DISPLAY,
 };
 
 enum graybox_attribute {
@@ -16,10 +20,14 @@ enum graybox_attribute {
 	ATTR_FILENAME = 1,
 	ATTR_PKT,
 	ATTR_EXCEPTIONS,
+	ATTR_BENCH_RATE,
+	ATTR_BENCH_FLOWS,
+	ATTR_BENCH_COUNT,
 
 	/* Response fields */
 	ATTR_ERROR_CODE,
 	ATTR_STATS,
+	ATTR_BENCH_STATS,
 
 	__ATTR_MAX,
 };
@@ -35,4 +43,21 @@ struct graybox_stats {
 	struct graybox_proto_stats ipv4;
 };
 
+/* Latencies and durations are in nanoseconds. */
+struct graybox_bench_stats {
+	/* Packets put on the network. */
+	__u64 sent;
+	/* Packets the network refused. (dst_output() errors.) */
+	__u64 send_failures;
+	/* Translated packets that made it back. */
+	__u64 received;
+	__u64 latency_min;
+	__u64 latency_max;
+	__u64 latency_total;
+	/* Since the start of the run, until now or until the last packet. */
+	__u64 duration;
+	/* Packets still scheduled to be sent. */
+	__u64 pending;
+};
+
 #endif /* TEST_GRAYBOX_COMMON_GRAYBOX_TYPES_H_ */
@@ -0,0 +1,544 @@
+#include "bench.h"
+
+#include <linux/delay.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/ip.h>
+#include <linux/kthread.h>
+#include <linux/percpu.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/checksum.h>
+#include <net/ipv6.h>
+#include <asm/unaligned.h>
+
+#include "mod/common/ipv6_hdr_iterator.h"
+#include "expecter.h"
+#include "log.h"
+#include "sender.h"
+#include "util.h"
+
+#define BENCH_TEMPLATES_MAX 64
+#define BENCH_MAGIC 0x6762656eu /* "gben" */
+
+/* Written at the beginning of every benchmark packet's payload. */
+struct bench_stamp {
+	__be32 magic;
+	/* Tells this run's packets apart from stragglers of previous ones. */
+	__be32 run;
+	/* Sending time. (ktime_get(), in nanoseconds.) */
+	__be32 time_hi;
+	__be32 time_lo;
+};
+
+struct bench_template {
+	unsigned char *bytes;
+	size_t len;
+	/* Offset of the source port or ICMP identifier. */
+	unsigned int port_offset;
+	/* Offset of the layer 4 checksum. Zero if there's none to update. */
+	unsigned int csum_offset;
+	/* Offset of the struct bench_stamp. */
+	unsigned int stamp_offset;
+};
+
+/* Written by the packet path only. Added up by bench_stat(). */
+struct bench_rx {
+	u64 received;
+	u64 latency_min;
+	u64 latency_max;
+	u64 latency_total;
+};
+
+static struct bench_template templates[BENCH_TEMPLATES_MAX];
+static unsigned int template_count;
+
+/*
+ * The current (or latest) run. Only the thread writes the counters while the
+ * run is sending; everything else is protected by the Netlink handler's mutex.
+ */
+static struct {
+	struct net *ns;
+	struct task_struct *thread;
+	u32 id;
+	u32 rate;
+	u32 flows;
+	u64 count;
+
+	bool sending;
+	u64 sent;
+	u64 send_failures;
+	u64 start;
+	u64 end;
+} run;
+
+static DEFINE_PER_CPU(struct bench_rx, rx);
+/* Do the packet path's counters belong to @run? */
+static bool listening;
+
+static u64 now_ns(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static int parse_l4(struct bench_template *tpl, unsigned int l4_offset,
+		__u8 proto, bool is_ipv4)
+{
+	unsigned char *l4 = tpl->bytes + l4_offset;
+	struct tcphdr *tcp;
+	struct icmphdr *icmp;
+	unsigned int hdr_len;
+
+	switch (proto) {
+	case IPPROTO_TCP:
+		if (l4_offset + sizeof(struct tcphdr) > tpl->len)
+			goto truncated;
+		tcp = (struct tcphdr *)l4;
+		hdr_len = tcp->doff << 2;
+		if (hdr_len < sizeof(struct tcphdr))
+			goto truncated;
+		tpl->port_offset = l4_offset + offsetof(struct tcphdr, source);
+		tpl->csum_offset = l4_offset + offsetof(struct tcphdr, check);
+		break;
+
+	case IPPROTO_UDP:
+		if (l4_offset + sizeof(struct udphdr) > tpl->len)
+			goto truncated;
+		hdr_len = sizeof(struct udphdr);
+		tpl->port_offset = l4_offset + offsetof(struct udphdr, source);
+		tpl->csum_offset = l4_offset + offsetof(struct udphdr, check);
+		/* Zero means "no checksum" in IPv4. */
+		if (is_ipv4 && !((struct udphdr *)l4)->check)
+			tpl->csum_offset = 0;
+		break;
+
+	case IPPROTO_ICMP:
+	case NEXTHDR_ICMP:
+		if (l4_offset + sizeof(struct icmphdr) > tpl->len)
+			goto truncated;
+		icmp = (struct icmphdr *)l4;
+		if (is_ipv4 ? (icmp->type != ICMP_ECHO
+				&& icmp->type != ICMP_ECHOREPLY)
+				: (icmp->type != ICMPV6_ECHO_REQUEST
+				&& icmp->type != ICMPV6_ECHO_REPLY))
+			goto unsupported;
+		/* Echoes of both protocols look the same. */
+		hdr_len = sizeof(struct icmphdr);
+		tpl->port_offset = l4_offset + offsetof(struct icmphdr,
+				un.echo.id);
+		tpl->csum_offset = l4_offset + offsetof(struct icmphdr,
+				checksum);
+		break;
+
+	default:
+		goto unsupported;
+	}
+
+	tpl->stamp_offset = l4_offset + hdr_len;
+	if (tpl->stamp_offset + sizeof(struct bench_stamp) > tpl->len) {
+		log_err("Benchmark templates need at least %zu bytes of payload.",
+				sizeof(struct bench_stamp));
+		return -EINVAL;
+	}
+
+	return 0;
+
+truncated:
+	log_err("The template's layer 4 header is truncated.");
+	return -EINVAL;
+unsupported:
+	log_err("Benchmark templates need to be TCP, UDP or ICMP echo packets.");
+	return -EINVAL;
+}
+
+static int parse_template(struct bench_template *tpl)
+{
+	struct iphdr *hdr4;
+	struct ipv6hdr *hdr6;
+	struct hdr_iterator iterator;
+
+	switch (get_l3_proto(tpl->bytes)) {
+	case 4:
+		hdr4 = (struct iphdr *)tpl->bytes;
+		if (tpl->len < sizeof(*hdr4) || tpl->len < (hdr4->ihl << 2))
+			break;
+		if (hdr4->frag_off & htons(IP_MF | IP_OFFSET))
+			goto fragment;
+		return parse_l4(tpl, hdr4->ihl << 2, hdr4->protocol, true);
+
+	case 6:
+		hdr6 = (struct ipv6hdr *)tpl->bytes;
+		if (tpl->len < sizeof(*hdr6))
+			break;
+		if (hdr_iterator_find(hdr6, NEXTHDR_FRAGMENT))
+			goto fragment;
+		hdr_iterator_init(&iterator, hdr6);
+		hdr_iterator_last(&iterator);
+		if (iterator.data - (void *)tpl->bytes > tpl->len)
+			break;
+		return parse_l4(tpl, iterator.data - (void *)tpl->bytes,
+				iterator.hdr_type, false);
+	}
+
+	log_err("The template is not a valid IPv4 or IPv6 packet.");
+	return -EINVAL;
+
+fragment:
+	log_err("Benchmark templates cannot be fragments.");
+	return -EINVAL;
+}
+
+int bench_add(unsigned char *pkt, size_t pkt_len)
+{
+	struct bench_template *tpl;
+	int error;
+
+	if (run.sending) {
+		log_err("Can't change the templates while a benchmark is running.");
+		return -EBUSY;
+	}
+	if (template_count >= BENCH_TEMPLATES_MAX) {
+		log_err("Too many benchmark templates. (Max: %u)",
+				BENCH_TEMPLATES_MAX);
+		return -EINVAL;
+	}
+	if (pkt_len == 0) {
+		log_err("The packet is zero bytes long.");
+		return -EINVAL;
+	}
+
+	tpl = &templates[template_count];
+	tpl->bytes = kmalloc(pkt_len, GFP_KERNEL);
+	if (!tpl->bytes)
+		return -ENOMEM;
+	memcpy(tpl->bytes, pkt, pkt_len);
+	tpl->len = pkt_len;
+
+	error = parse_template(tpl);
+	if (error) {
+		kfree(tpl->bytes);
+		return error;
+	}
+
+	template_count++;
+	return 0;
+}
+
+/* Replaces a 32-bit word of @pkt, and fixes the checksum accordingly. */
+static void put_word(unsigned char *pkt, struct bench_template *tpl,
+		unsigned int offset, __be32 value)
+{
+	__be32 old = get_unaligned((__be32 *)(pkt + offset));
+
+	put_unaligned(value, (__be32 *)(pkt + offset));
+	if (tpl->csum_offset)
+		csum_replace4((__sum16 *)(pkt + tpl->csum_offset), old, value);
+}
+
+static int send_one(struct bench_template *tpl, unsigned int flow)
+{
+	struct sk_buff *skb;
+	unsigned char *pkt;
+	__be16 old_port;
+	__be16 new_port;
+	unsigned int offset;
+	u64 now;
+
+	skb = sender_create_skb(tpl->bytes, tpl->len, GFP_KERNEL);
+	if (!skb)
+		return -ENOMEM;
+	pkt = skb_network_header(skb);
+
+	old_port = get_unaligned((__be16 *)(pkt + tpl->port_offset));
+	new_port = htons(ntohs(old_port) + flow);
+	put_unaligned(new_port, (__be16 *)(pkt + tpl->port_offset));
+	if (tpl->csum_offset)
+		csum_replace2((__sum16 *)(pkt + tpl->csum_offset),
+				old_port, new_port);
+
+	offset = tpl->stamp_offset;
+	now = now_ns();
+	put_word(pkt, tpl, offset + offsetof(struct bench_stamp, magic),
+			htonl(BENCH_MAGIC));
+	put_word(pkt, tpl, offset + offsetof(struct bench_stamp, run),
+			htonl(run.id));
+	put_word(pkt, tpl, offset + offsetof(struct bench_stamp, time_hi),
+			htonl(now >> 32));
+	put_word(pkt, tpl, offset + offsetof(struct bench_stamp, time_lo),
+			htonl(now & 0xFFFFFFFFu));
+
+	return sender_xmit(run.ns, skb);
+}
+
+/* Returns the number of packets that should have been sent by now. */
+static u64 get_due(void)
+{
+	u64 elapsed_us;
+
+	if (!run.rate)
+		return run.count;
+
+	elapsed_us = div_u64(now_ns() - run.start, NSEC_PER_USEC);
+	return div_u64(elapsed_us * run.rate, USEC_PER_SEC) + 1;
+}
+
+static int bench_thread(void *arg)
+{
+	unsigned int tpl = 0;
+	unsigned int flow = 0;
+	u64 i = 0;
+	u64 due = 0;
+	int error;
+
+	while (i < run.count && !kthread_should_stop()) {
+		if (i >= due) {
+			due = get_due();
+			if (i >= due) {
+				/* Ahead of schedule; nap for a tick. */
+				usleep_range(100, 200);
+				continue;
+			}
+		}
+
+		error = send_one(&templates[tpl], flow);
+		if (error == -ENETUNREACH) {
+			log_err("Benchmark packets cannot be routed; aborting the run.");
+			run.send_failures++;
+			break;
+		}
+		if (error)
+			run.send_failures++;
+		else
+			run.sent++;
+
+		i++;
+		if (++tpl == template_count) {
+			tpl = 0;
+			if (++flow == run.flows)
+				flow = 0;
+		}
+		if (!(i & 63))
+			cond_resched();
+	}
+
+	run.end = now_ns();
+	/* Publishes the final counters. */
+	smp_store_release(&run.sending, false);
+	log_info("Benchmark: done sending.");
+
+	/* Wait for bench_stop(), so it never races against our exit. */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void stop_thread(void)
+{
+	if (run.thread) {
+		kthread_stop(run.thread);
+		run.thread = NULL;
+	}
+}
+
+int bench_start(__u32 rate, __u32 flows, __u32 count)
+{
+	struct task_struct *thread;
+	struct net *ns;
+	unsigned int cpu;
+	int error;
+
+	if (READ_ONCE(run.sending)) {
+		log_err("A benchmark is already running.");
+		return -EBUSY;
+	}
+	if (!template_count) {
+		log_err("There are no benchmark templates; add some first.");
+		return -EINVAL;
+	}
+	if (!flows || !count) {
+		log_err("The flow and packet counts need to be positive.");
+		return -EINVAL;
+	}
+
+	ns = get_net_ns_by_pid(task_pid_vnr(current));
+	if (IS_ERR(ns)) {
+		log_err("Could not retrieve the current namespace: %ld",
+				PTR_ERR(ns));
+		return PTR_ERR(ns);
+	}
+	/* The translated packets come back through the expecter's hooks. */
+	error = expecter_listen();
+	if (error) {
+		put_net(ns);
+		return error;
+	}
+
+	stop_thread();
+	WRITE_ONCE(listening, false);
+	if (run.ns)
+		put_net(run.ns);
+
+	run.ns = ns;
+	run.id++;
+	run.rate = rate;
+	run.flows = flows;
+	run.count = count;
+	run.sent = 0;
+	run.send_failures = 0;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&rx, cpu), 0, sizeof(struct bench_rx));
+
+	run.sending = true;
+	run.start = now_ns();
+	WRITE_ONCE(listening, true);
+
+	thread = kthread_run(bench_thread, NULL, "graybox-bench");
+	if (IS_ERR(thread)) {
+		log_err("Could not start the benchmark thread: %ld",
+				PTR_ERR(thread));
+		run.sending = false;
+		run.end = run.start;
+		return PTR_ERR(thread);
+	}
+
+	run.thread = thread;
+	log_info("Benchmark: sending %u packets at %u pps, over %u flows.",
+			count, rate, flows);
+	return 0;
+}
+
+void bench_stop(void)
+{
+	unsigned int i;
+
+	stop_thread();
+	WRITE_ONCE(listening, false);
+	if (run.ns) {
+		put_net(run.ns);
+		run.ns = NULL;
+	}
+
+	for (i = 0; i < template_count; i++)
+		kfree(templates[i].bytes);
+	template_count = 0;
+}
+
+void bench_stat(struct graybox_bench_stats *result)
+{
+	struct bench_rx *cpu_rx;
+	unsigned int cpu;
+	bool sending;
+
+	memset(result, 0, sizeof(*result));
+
+	for_each_possible_cpu(cpu) {
+		cpu_rx = per_cpu_ptr(&rx, cpu);
+		if (!cpu_rx->received)
+			continue;
+		if (!result->received
+				|| cpu_rx->latency_min < result->latency_min)
+			result->latency_min = cpu_rx->latency_min;
+		if (cpu_rx->latency_max > result->latency_max)
+			result->latency_max = cpu_rx->latency_max;
+		result->received += cpu_rx->received;
+		result->latency_total += cpu_rx->latency_total;
+	}
+
+	sending = smp_load_acquire(&run.sending);
+	result->sent = run.sent;
+	result->send_failures = run.send_failures;
+	result->pending = run.count - run.sent - run.send_failures;
+	if (run.start)
+		result->duration = (sending ? now_ns() : run.end) - run.start;
+}
+
+void bench_teardown(void)
+{
+	bench_stop();
+}
+
+static unsigned int get_l4_hdr_len(struct sk_buff *skb, unsigned int offset,
+		__u8 proto)
+{
+	struct tcphdr buffer;
+	struct tcphdr *tcp;
+
+	switch (proto) {
+	case IPPROTO_TCP:
+		tcp = skb_header_pointer(skb, offset, sizeof(buffer), &buffer);
+		return tcp ? (tcp->doff << 2) : 0;
+	case IPPROTO_UDP:
+		return sizeof(struct udphdr);
+	case IPPROTO_ICMP:
+	case NEXTHDR_ICMP:
+		return sizeof(struct icmphdr);
+	}
+
+	return 0;
+}
+
+bool bench_handle_pkt(struct sk_buff *skb)
+{
+	struct bench_stamp buffer;
+	struct bench_stamp *stamp;
+	struct iphdr *hdr4;
+	struct bench_rx *cpu_rx;
+	unsigned int offset;
+	unsigned int hdr_len;
+	__be16 frag_off;
+	__u8 proto;
+	int l4_offset;
+	u64 latency;
+
+	if (!READ_ONCE(listening))
+		return false;
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP):
+		hdr4 = ip_hdr(skb);
+		if (hdr4->frag_off & htons(IP_OFFSET))
+			return false;
+		offset = skb_network_offset(skb) + (hdr4->ihl << 2);
+		proto = hdr4->protocol;
+		break;
+	case htons(ETH_P_IPV6):
+		proto = ipv6_hdr(skb)->nexthdr;
+		frag_off = 0;
+		l4_offset = ipv6_skip_exthdr(skb, skb_network_offset(skb)
+				+ sizeof(struct ipv6hdr), &proto, &frag_off);
+		if (l4_offset < 0 || (frag_off & htons(IP6_OFFSET)))
+			return false;
+		offset = l4_offset;
+		break;
+	default:
+		return false;
+	}
+
+	hdr_len = get_l4_hdr_len(skb, offset, proto);
+	if (!hdr_len)
+		return false;
+
+	stamp = skb_header_pointer(skb, offset + hdr_len, sizeof(buffer),
+			&buffer);
+	if (!stamp || stamp->magic != htonl(BENCH_MAGIC)
+			|| stamp->run != htonl(READ_ONCE(run.id)))
+		return false;
+
+	latency = now_ns() - (((u64)ntohl(stamp->time_hi) << 32)
+			| ntohl(stamp->time_lo));
+
+	/* Netfilter hooks run with bottom halves disabled. */
+	cpu_rx = this_cpu_ptr(&rx);
+	if (!cpu_rx->received || latency < cpu_rx->latency_min)
+		cpu_rx->latency_min = latency;
+	if (latency > cpu_rx->latency_max)
+		cpu_rx->latency_max = latency;
+	cpu_rx->latency_total += latency;
+	cpu_rx->received++;
+
+	return true;
+}
@@ -0,0 +1,28 @@
+#ifndef _GRAYBOX_MOD_BENCH_H
+#define _GRAYBOX_MOD_BENCH_H
+
+/**
+ * @file
+ * Benchmark mode. Replays a set of template packets at a configured rate,
+ * varying their source ports (or ICMP identifiers) to simulate several flows,
+ * and measures the translated packets that come back.
+ *
+ * Each packet carries a stamp (struct bench_stamp) at the beginning of its
+ * payload, which is how the returning packets are recognized and timed. So the
+ * templates need to be unfragmented TCP, UDP or ICMP echo packets, with enough
+ * payload to hold the stamp.
+ */
+
+#include <linux/skbuff.h>
+#include "common/graybox-types.h"
+
+int bench_add(unsigned char *pkt, size_t pkt_len);
+int bench_start(__u32 rate, __u32 flows, __u32 count);
+void bench_stop(void);
+void bench_stat(struct graybox_bench_stats *result);
+void bench_teardown(void);
+
+/* Packet path. Returns true if @skb was one of ours. */
+bool bench_handle_pkt(struct sk_buff *skb);
+
+#endif
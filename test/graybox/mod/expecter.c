@@ -7,6 +7,7 @@
 #include <linux/sort.h>
 #include "common/types.h"
 #include "mod/common/address.h"
+#include "bench.h"
 #include "diff.h"
 #include "log.h"
 #include "util.h"
@@ -195,6 +196,12 @@ static struct netfilter_hook *get_hook(void)
 	return hook;
 }
 
+/* Makes sure the current namespace's packets reach the hooks. */
+int expecter_listen(void)
+{
+	return get_hook() ? 0 : -ENOMEM;
+}
+
 int expecter_add(struct expected_packet *pkt)
 {
 	struct netfilter_hook *hook;
@@ -392,6 +399,9 @@ static int expecter_handle_pkt(struct sk_buff *actual)
 
 	log_intro(actual);
 
+	if (bench_handle_pkt(actual))
+		return NF_DROP;
+
 	hook = __get_hook(dev_net(actual->dev));
 	if (!hook || list_empty(&hook->nodes)) {
 		log_debug("No packets queued.");
@@ -16,6 +16,7 @@ int expecter_setup(void);
 void expecter_teardown(void);
 
 int expecter_add(struct expected_packet *pkt);
+int expecter_listen(void);
 void expecter_flush(void);
 
 void expecter_stat(struct graybox_stats *result);
@@ -4,6 +4,7 @@
 #include "common/types.h"
 #include "common/xlat.h"
 
+#include "bench.h"
 #include "expecter.h"
 #include "log.h"
 #include "nl_handler.h"
@@ -39,6 +40,7 @@ static int graybox_init(void)
 
 static void graybox_exit(void)
 {
+	bench_teardown();
 	expecter_teardown();
 	nlhandler_teardown();
 
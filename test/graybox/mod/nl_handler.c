@@ -1,5 +1,6 @@
 #include "nl_handler.h"
 
+#include "bench.h"
 #include "expecter.h"
 #include "genetlink.h"
 #include "log.h"
@@ -117,6 +118,65 @@ static int handle_stats_flush(struct genl_info *info)
 	return genl_respond(info, 0);
 }
 
+static int handle_bench_add(struct genl_info *info)
+{
+	struct nlattr *attr;
+
+	log_debug("========= Bench Add =========");
+
+	if (verify_superpriv())
+		return genl_respond(info, -EPERM);
+
+	attr = info->attrs[ATTR_PKT];
+	if (!attr) {
+		log_err("Request lacks a packet.");
+		return genl_respond(info, -EINVAL);
+	}
+
+	return genl_respond(info, bench_add(nla_data(attr), nla_len(attr)));
+}
+
+static int handle_bench_start(struct genl_info *info)
+{
+	log_debug("========= Bench Start =========");
+
+	if (verify_superpriv())
+		return genl_respond(info, -EPERM);
+
+	if (!info->attrs[ATTR_BENCH_RATE] || !info->attrs[ATTR_BENCH_FLOWS]
+			|| !info->attrs[ATTR_BENCH_COUNT]) {
+		log_err("Request lacks the rate, flow count or packet count.");
+		return genl_respond(info, -EINVAL);
+	}
+
+	return genl_respond(info, bench_start(
+			nla_get_u32(info->attrs[ATTR_BENCH_RATE]),
+			nla_get_u32(info->attrs[ATTR_BENCH_FLOWS]),
+			nla_get_u32(info->attrs[ATTR_BENCH_COUNT])));
+}
+
+static int handle_bench_stop(struct genl_info *info)
+{
+	log_debug("========= Bench Stop =========");
+
+	if (verify_superpriv())
+		return genl_respond(info, -EPERM);
+
+	bench_stop();
+	return genl_respond(info, 0);
+}
+
+static int handle_bench_display(struct genl_info *info)
+{
+	struct graybox_bench_stats stats;
+
+	log_debug("========= Bench Display =========");
+
+	bench_stat(&stats);
+	return genl_respond_attr(info, ATTR_BENCH_STATS, &stats,
+			sizeof(stats));
+}
+
 static int handle_userspace_msg(struct sk_buff *skb, struct genl_info *info)
 {
 	int error;
@@ -139,6 +199,18 @@ static int handle_userspace_msg(struct sk_buff *skb, struct genl_info *info)
 	case COMMAND_STATS_FLUSH:
 		error = handle_stats_flush(info);
 		break;
+	case COMMAND_BENCH_ADD:
+		error = handle_bench_add(info);
+		break;
+	case COMMAND_BENCH_START:
+		error = handle_bench_start(info);
+		break;
+	case COMMAND_BENCH_STOP:
+		error = handle_bench_stop(info);
+		break;
+	case COMMAND_BENCH_DISPLAY:
+		error = handle_bench_display(info);
+		break;
 	default:
 		log_err("Unknown command code: %d", info->genlhdr->cmd);
 		return genl_respond(info, -EINVAL);
@@ -153,8 +225,12 @@ static struct nla_policy const graybox_policy[__ATTR_MAX] = {
 	[ATTR_FILENAME] = { .type = NLA_STRING },
 	[ATTR_PKT] = { .type = NLA_BINARY },
 	[ATTR_EXCEPTIONS] = { .type = NLA_NESTED },
+	[ATTR_BENCH_RATE] = { .type = NLA_U32 },
+	[ATTR_BENCH_FLOWS] = { .type = NLA_U32 },
+	[ATTR_BENCH_COUNT] = { .type = NLA_U32 },
 	[ATTR_ERROR_CODE] = { .type = NLA_U16 },
 	[ATTR_STATS] = { .type = NLA_BINARY },
+	[ATTR_BENCH_STATS] = { .type = NLA_BINARY },
 };
 
 #if LINUX_VERSION_AT_LEAST(5, 2, 0, 8, 0)
@@ -189,6 +265,26 @@ static struct genl_ops ops[] = {
 		.doit = handle_userspace_msg,
 		GRAYBOX_POLICY
 	},
+	{
+		.cmd = COMMAND_BENCH_ADD,
+		.doit = handle_userspace_msg,
+		GRAYBOX_POLICY
+	},
+	{
+		.cmd = COMMAND_BENCH_START,
+		.doit = handle_userspace_msg,
+		GRAYBOX_POLICY
+	},
+	{
+		.cmd = COMMAND_BENCH_STOP,
+		.doit = handle_userspace_msg,
+		GRAYBOX_POLICY
+	},
+	{
+		.cmd = COMMAND_BENCH_DISPLAY,
+		.doit = handle_userspace_msg,
+		GRAYBOX_POLICY
+	},
 };
 
 static struct genl_family family = {
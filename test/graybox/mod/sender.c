@@ -166,24 +166,27 @@ static struct dst_entry *route_ipv6(struct net *ns, struct sk_buff *skb)
 	return dst;
 }
 
-int sender_send(char *pkt_name, void *pkt, size_t pkt_len)
+struct sk_buff *sender_create_skb(void *pkt, size_t pkt_len, gfp_t flags)
 {
-	struct net *ns;
 	struct sk_buff *skb;
-	struct dst_entry *dst;
-	int error;
+	__be16 protocol;
 
-	log_info("Sending packet %s (length %zu)...", pkt_name, pkt_len);
-
-	if (pkt_len == 0) {
-		log_err("The packet is zero bytes long.");
-		return -EINVAL;
+	switch (get_l3_proto(pkt)) {
+	case 6:
+		protocol = htons(ETH_P_IPV6);
+		break;
+	case 4:
+		protocol = htons(ETH_P_IP);
+		break;
+	default:
+		log_err("Invalid mode: %u.", get_l3_proto(pkt));
+		return NULL;
 	}
 
-	skb = alloc_skb(LL_MAX_HEADER + pkt_len, GFP_KERNEL);
+	skb = alloc_skb(LL_MAX_HEADER + pkt_len, flags);
 	if (!skb) {
 		log_err("Could not allocate a skb.");
-		return -ENOMEM;
+		return NULL;
 	}
 
 	skb_reserve(skb, LL_MAX_HEADER);
@@ -195,37 +198,54 @@ int sender_send(char *pkt_name, void *pkt, size_t pkt_len)
 
 	memcpy(skb_network_header(skb), pkt, pkt_len);
 
-	ns = find_current_namespace();
-	if (!ns) {
+	skb->ip_summed = CHECKSUM_NONE;
+	skb->protocol = protocol;
+	return skb;
+}
+
+int sender_xmit(struct net *ns, struct sk_buff *skb)
+{
+	struct dst_entry *dst;
+
+	dst = (skb->protocol == htons(ETH_P_IPV6))
+			? route_ipv6(ns, skb)
+			: route_ipv4(ns, skb);
+	if (!dst) {
 		kfree_skb(skb);
+		return -ENETUNREACH;
+	}
+
+	return dst_output(ns, NULL, skb);
+}
+
+int sender_send(char *pkt_name, void *pkt, size_t pkt_len)
+{
+	struct net *ns;
+	struct sk_buff *skb;
+	int error;
+
+	log_info("Sending packet %s (length %zu)...", pkt_name, pkt_len);
+
+	if (pkt_len == 0) {
+		log_err("The packet is zero bytes long.");
 		return -EINVAL;
 	}
 
-	skb->ip_summed = CHECKSUM_NONE;
-	switch (get_l3_proto(pkt)) {
-	case 6:
-		skb->protocol = htons(ETH_P_IPV6);
-		dst = route_ipv6(ns, skb);
-		break;
-	case 4:
-		skb->protocol = htons(ETH_P_IP);
-		dst = route_ipv4(ns, skb);
-		break;
-	default:
-		log_err("Invalid mode: %u.", get_l3_proto(pkt));
-		dst = NULL;
-		break;
+	ns = find_current_namespace();
+	if (!ns)
+		return -EINVAL;
+
+	skb = sender_create_skb(pkt, pkt_len, GFP_KERNEL);
+	if (!skb) {
+		put_net(ns);
+		return -ENOMEM;
 	}
 
-	if (dst) {
-		error = dst_output(ns, NULL, skb);
-		if (error)
-			log_err("dst_output() returned %d.", error);
-	} else {
+	error = sender_xmit(ns, skb);
+	if (error == -ENETUNREACH)
 		log_err("The packet could not be routed.");
-		error = -ENETUNREACH;
-		kfree_skb(skb);
-	}
+	else if (error)
+		log_err("dst_output() returned %d.", error);
 
 	put_net(ns);
 	return error;
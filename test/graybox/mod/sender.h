@@ -1,8 +1,14 @@
 #ifndef _GRAYBOX_MOD_SENDER_H
 #define _GRAYBOX_MOD_SENDER_H
 
-#include <linux/types.h>
+#include <linux/skbuff.h>
+#include <net/net_namespace.h>
 
 int sender_send(char *pkt_name, void *pkt, size_t pkt_len);
 
+/* Building blocks of sender_send(), for the benchmark. */
+struct sk_buff *sender_create_skb(void *pkt, size_t pkt_len, gfp_t flags);
+/* Consumes @skb, whether it succeeds or not. */
+int sender_xmit(struct net *ns, struct sk_buff *skb);
+
 #endif
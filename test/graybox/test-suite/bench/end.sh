@@ -0,0 +1,14 @@
+#!/bin/sh
+
+# Reverts the setup-*.sh scripts.
+# Does not destroy the namespaces.
+
+ip netns exec joolns modprobe -rq jool_siit
+ip netns exec joolns modprobe -rq jool
+ip netns exec joolns ip route del 203.0.113.0/24 via 192.0.2.5
+ip netns exec joolns ip addr flush dev to_client_v6 scope global
+ip netns exec joolns ip addr flush dev to_client_v4 scope global
+ip netns exec client6ns ip route del 64:ff9b::/96 via 2001:db8::1
+ip netns exec client6ns ip addr flush dev to_jool_v6 scope global
+ip netns exec client4ns ip route del 198.51.100.0/24 via 192.0.2.2
+ip netns exec client4ns ip addr flush dev to_jool_v4 scope global
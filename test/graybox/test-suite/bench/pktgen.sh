@@ -0,0 +1,94 @@
+#!/bin/sh
+
+# Configures pktgen in the current namespace. (Meant for client6ns.)
+# Does not start it.
+#
+# Usage: pktgen.sh <dst MAC> <threads> <flows> <pps> <size> <imix> <new flows/s>
+#
+# Threads 0 to <threads> - 1 share the <flows> long-lived flows: thread t is
+# 2001:db8::(10 + t), and cycles through its share of the source ports.
+# If <new flows/s> is nonzero, one more thread sends that many packets per
+# second from random ports to random 203.0.113.0/24 hosts, which are nearly
+# always new sessions.
+# <pps> 0 means as fast as possible. <imix> "-" means every packet is <size>
+# bytes long.
+
+PG=/proc/net/pktgen
+DEV=to_jool_v6
+
+MAC=$1
+THREADS=$2
+FLOWS=$3
+PPS=$4
+SIZE=$5
+IMIX=$6
+NEW=$7
+
+pgset() {
+	echo "$2" > "$1"
+	if ! grep -q "^Result: OK" "$1"; then
+		echo "pktgen rejected '$2':" >&2
+		grep "^Result:" "$1" >&2
+		exit 1
+	fi
+}
+
+# Configures the packets of $PG/$DEV@$1; $2 is the source address.
+pgcommon() {
+	D=$PG/$DEV@$1
+	pgset $PG/kpktgend_$1 "rem_device_all"
+	pgset $PG/kpktgend_$1 "add_device $DEV@$1"
+	pgset $D "count 0"
+	pgset $D "clone_skb 0"
+	pgset $D "burst 1"
+	pgset $D "dst_mac $MAC"
+	pgset $D "src6 $2"
+	pgset $D "udp_dst_min 80"
+	pgset $D "udp_dst_max 80"
+	if [ "$IMIX" = "-" ]; then
+		pgset $D "pkt_size $SIZE"
+	else
+		pgset $D "imix_weights $IMIX"
+	fi
+}
+
+if [ ! -d $PG ]; then
+	echo "pktgen is not loaded." >&2
+	exit 1
+fi
+
+MAX_THREAD=$(($(ls -d $PG/kpktgend_* | wc -l) - 1))
+LAST=$((THREADS - 1))
+[ "$NEW" -gt 0 ] && LAST=$THREADS
+if [ $LAST -gt $MAX_THREAD ]; then
+	echo "pktgen only has $((MAX_THREAD + 1)) threads (one per CPU)." >&2
+	exit 1
+fi
+
+PER_THREAD=$(((FLOWS + THREADS - 1) / THREADS))
+if [ $PER_THREAD -gt 64512 ]; then
+	echo "Too many flows per thread; raise the thread count." >&2
+	exit 1
+fi
+
+for t in $(seq 0 $((THREADS - 1))); do
+	pgcommon $t 2001:db8::$(printf %x $((16 + t)))
+	pgset $PG/$DEV@$t "dst6 64:ff9b::192.0.2.5"
+	pgset $PG/$DEV@$t "udp_src_min 1024"
+	pgset $PG/$DEV@$t "udp_src_max $((1024 + PER_THREAD - 1))"
+	[ "$PPS" -gt 0 ] && pgset $PG/$DEV@$t "ratep $((PPS / THREADS))"
+done
+
+if [ "$NEW" -gt 0 ]; then
+	t=$THREADS
+	pgcommon $t 2001:db8::$(printf %x $((16 + t)))
+	# Random destinations are (random | min) & max.
+	pgset $PG/$DEV@$t "dst6_min 64:ff9b::cb00:7100"
+	pgset $PG/$DEV@$t "dst6_max 64:ff9b::cb00:71ff"
+	pgset $PG/$DEV@$t "udp_src_min 1024"
+	pgset $PG/$DEV@$t "udp_src_max 65535"
+	pgset $PG/$DEV@$t "flag UDPSRC_RND"
+	pgset $PG/$DEV@$t "ratep $NEW"
+fi
+
+exit 0
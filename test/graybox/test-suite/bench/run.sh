@@ -0,0 +1,196 @@
+#!/bin/bash
+
+# Pushes pktgen traffic through the Graybox namespaces (client6ns -> joolns ->
+# client4ns), and reports throughput, per-stage latency, softirq load and
+# Jool's counters.
+#
+# See README.md.
+
+usage() {
+	cat <<USAGE
+Usage: $0 [options]
+	-m <nat64|siit>  Translator. (Default: nat64)
+	-f <flows>       Long-lived flows. (Default: 1000)
+	-n <flows/s>     New flows per second, on top of the long-lived ones.
+	                 (NAT64 only. Default: 0)
+	-r <pps>         Packets per second of the long-lived flows.
+	                 (Default: 0, which means as fast as possible)
+	-s <bytes>       Packet size, including the Ethernet header.
+	                 (Default: 78, the smallest pktgen IPv6 packet)
+	-i <weights>     pktgen IMIX weights, eg. "78,7 576,4 1500,1".
+	                 Overrides -s.
+	-t <threads>     pktgen threads for the long-lived flows. (Default: 1)
+	-d <seconds>     Duration. (Default: 10)
+	-c               Print the results as CSV.
+	-k               Keep the namespaces. (Default: destroy them at the end)
+USAGE
+	exit 1
+}
+
+MODE=nat64
+FLOWS=1000
+NEW=0
+PPS=0
+SIZE=78
+IMIX=-
+THREADS=1
+DURATION=10
+CSV=false
+KEEP=false
+
+while getopts "m:f:n:r:s:i:t:d:ck" opt; do
+	case $opt in
+	m) MODE=$OPTARG;;
+	f) FLOWS=$OPTARG;;
+	n) NEW=$OPTARG;;
+	r) PPS=$OPTARG;;
+	s) SIZE=$OPTARG;;
+	i) IMIX=$OPTARG;;
+	t) THREADS=$OPTARG;;
+	d) DURATION=$OPTARG;;
+	c) CSV=true;;
+	k) KEEP=true;;
+	*) usage;;
+	esac
+done
+
+case $MODE in
+nat64) JOOL=jool;;
+siit) JOOL=jool_siit; NEW=0;;
+*) usage;;
+esac
+
+if [ $(id -u) != 0 ]; then
+	echo "Please start the script as root or sudo."
+	exit 1
+fi
+
+cd `dirname $0`
+TMP=$(mktemp -d)
+LATENCY_PARAM=/sys/module/jool_common/parameters/latency_stats
+
+cleanup() {
+	[ -n "$OLD_LATENCY" ] && echo $OLD_LATENCY > $LATENCY_PARAM
+	./end.sh
+	$KEEP || ../namespace-destroy.sh
+	rm -rf $TMP
+}
+
+# $1: namespace, $2: interface, $3: rx_packets or tx_packets
+counter() {
+	ip netns exec $1 cat /sys/class/net/$2/statistics/$3
+}
+
+# Writes the counters and histograms to $TMP/$1.*.
+snapshot() {
+	ip netns exec joolns $JOOL stats display --all --csv --no-headers \
+		> $TMP/$1.stats
+	ip netns exec joolns $JOOL stats latency --all --csv --no-headers \
+		> $TMP/$1.latency
+	grep "^cpu" /proc/stat > $TMP/$1.cpu
+	counter client6ns to_jool_v6 tx_packets > $TMP/$1.tx
+	counter client4ns to_jool_v4 rx_packets > $TMP/$1.rx
+}
+
+# Prints a result in the selected format. $1: name, $2: value
+report() {
+	if $CSV; then
+		echo "$1,$2"
+	else
+		printf "%-40s %s\n" "$1:" "$2"
+	fi
+}
+
+modprobe pktgen || exit 1
+../namespace-create.sh > /dev/null
+trap cleanup EXIT
+
+ip netns exec joolns ./setup-jool.sh $MODE || exit 1
+ip netns exec client6ns ./setup-n6.sh
+ip netns exec client4ns ./setup-n4.sh
+../wait.sh 64:ff9b::192.0.2.5 > /dev/null
+
+MAC=$(ip netns exec joolns cat /sys/class/net/to_client_v6/address)
+ip netns exec client6ns ./pktgen.sh "$MAC" $THREADS $FLOWS $PPS $SIZE \
+		"$IMIX" $NEW || exit 1
+
+OLD_LATENCY=$(cat $LATENCY_PARAM)
+echo 1 > $LATENCY_PARAM
+
+snapshot before
+ip netns exec client6ns sh -c "echo start > /proc/net/pktgen/pgctrl" &
+sleep $DURATION
+ip netns exec client6ns sh -c "echo stop > /proc/net/pktgen/pgctrl"
+wait
+snapshot after
+
+$CSV && echo "Metric,Value"
+
+TX=$(($(cat $TMP/after.tx) - $(cat $TMP/before.tx)))
+RX=$(($(cat $TMP/after.rx) - $(cat $TMP/before.rx)))
+report "sent_pps" $((TX / DURATION))
+report "received_mpps" $(awk "BEGIN { printf \"%.3f\", $RX / $DURATION / 1000000 }")
+report "lost_packets" $((TX - RX))
+
+# /proc/stat: cpu<n> user nice system idle iowait irq softirq ...
+paste -d' ' $TMP/before.cpu $TMP/after.cpu | awk '
+{
+	n = NF / 2;
+	total = 0;
+	for (i = 2; i <= n; i++)
+		total += $(n + i) - $i;
+	pct = total ? 100 * ($(n + 8) - $8) / total : 0;
+	if ($1 == "cpu")
+		all = pct;
+	else if (pct > max)
+		max = pct;
+}
+END { printf "%.1f %.1f\n", all, max }' | {
+	read ALL MAX
+	report "softirq_cpu_pct" $ALL
+	report "softirq_busiest_cpu_pct" $MAX
+}
+
+# Histogram deltas; the buckets are powers of two, so the percentiles are the
+# upper bounds of the buckets they fall in.
+awk -F, '
+NR == FNR { before[$1 "," $2 "," $3] = $4; next }
+{
+	key = $1 "." $2;
+	if (!(key in total))
+		order[++n] = key;
+	delta = $4 - before[$1 "," $2 "," $3];
+	total[key] += delta;
+	b = ++buckets[key];
+	count[key, b] = delta;
+	upper[key, b] = $3 ? 2 * $3 : 2;
+}
+END {
+	for (i = 1; i <= n; i++) {
+		key = order[i];
+		if (!total[key])
+			continue;
+		seen = 0;
+		p50 = p99 = "";
+		for (b = 1; b <= buckets[key]; b++) {
+			seen += count[key, b];
+			if (p50 == "" && seen >= 0.5 * total[key])
+				p50 = upper[key, b];
+			if (p99 == "" && seen >= 0.99 * total[key])
+				p99 = upper[key, b];
+		}
+		print key ".p50_ns " p50;
+		print key ".p99_ns " p99;
+	}
+}' $TMP/before.latency $TMP/after.latency | while read NAME VALUE; do
+	report "$NAME" $VALUE
+done
+
+# Counter deltas, except for the gauges, which are reported as they ended.
+awk -F, '
+NR == FNR { before[$1] = $2; next }
+$1 == "JSTAT_BIB_ENTRIES" || $1 == "JSTAT_SESSIONS" { print $1 " " $2; next }
+$2 != before[$1] { print $1 " " ($2 - before[$1]) }
+' $TMP/before.stats $TMP/after.stats | while read NAME VALUE; do
+	report "$NAME" $VALUE
+done
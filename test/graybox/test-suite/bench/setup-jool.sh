@@ -0,0 +1,31 @@
+#!/bin/sh
+
+# Usage: setup-jool.sh <nat64|siit>
+
+modprobe -rq jool_siit
+modprobe -rq jool
+ip addr flush dev to_client_v6 scope global
+ip addr flush dev to_client_v4 scope global
+ip link set to_client_v6 up
+ip link set to_client_v4 up
+
+ip addr add 2001:db8::1/96 dev to_client_v6
+ip addr add 192.0.2.2/24 dev to_client_v4
+# Destination of the new flows (run.sh -n).
+ip route add 203.0.113.0/24 via 192.0.2.5
+
+sysctl -w net.ipv4.conf.all.forwarding=1 > /dev/null
+sysctl -w net.ipv6.conf.all.forwarding=1 > /dev/null
+
+if [ "$1" = "siit" ]; then
+	modprobe jool_siit
+	jool_siit instance add --netfilter -6 64:ff9b::/96
+	# The senders are 2001:db8::10 and up.
+	jool_siit eamt add 2001:db8::/120 198.51.100.0/24
+else
+	modprobe jool
+	jool instance add --netfilter -6 64:ff9b::/96
+	jool pool4 add 192.0.2.2 1024-65535 --udp
+	# For wait.sh's pings.
+	jool pool4 add 192.0.2.2 1024-65535 --icmp
+fi
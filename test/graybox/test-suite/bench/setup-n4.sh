@@ -0,0 +1,7 @@
+#!/bin/sh
+
+ip addr flush dev to_jool_v4 scope global
+ip link set to_jool_v4 up
+ip addr add 192.0.2.5/24 dev to_jool_v4
+# For wait.sh's pings, in SIIT mode.
+ip route add 198.51.100.0/24 via 192.0.2.2
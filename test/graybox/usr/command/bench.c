@@ -0,0 +1,140 @@
+#include "usr/command/bench.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <netlink/attr.h>
+#include "usr/log.h"
+#include "usr/command/common.h"
+
+static int parse_u32(char *name, char *str, __u32 *result)
+{
+	unsigned long value;
+	char *end;
+
+	errno = 0;
+	value = strtoul(str, &end, 10);
+	if (errno || *end != '\0' || end == str || value > UINT_MAX) {
+		pr_err("%s '%s' is not a valid 32-bit unsigned integer.",
+				name, str);
+		return -EINVAL;
+	}
+
+	*result = value;
+	return 0;
+}
+
+static int start_init_request(int argc, char **argv,
+		struct bench_request *req)
+{
+	int error;
+
+	if (argc < 3) {
+		pr_err("bench start needs a rate (packets per second; 0 is unlimited), a flow count and a packet count.");
+		return -EINVAL;
+	}
+
+	error = parse_u32("Rate", argv[0], &req->rate);
+	if (error)
+		return error;
+	error = parse_u32("Flow count", argv[1], &req->flows);
+	if (error)
+		return error;
+	return parse_u32("Packet count", argv[2], &req->count);
+}
+
+int bench_init_request(int argc, char **argv, enum graybox_command *cmd,
+		struct bench_request *req)
+{
+	if (argc < 1) {
+		pr_err("bench needs an operation as first argument.");
+		return -EINVAL;
+	}
+
+	if (strcasecmp(argv[0], "add") == 0) {
+		if (argc < 2) {
+			pr_err("bench add requires a packet file as argument.");
+			return -EINVAL;
+		}
+		*cmd = COMMAND_BENCH_ADD;
+		return load_pkt(argv[1], &req->pkt, &req->pkt_len);
+	} else if (strcasecmp(argv[0], "start") == 0) {
+		*cmd = COMMAND_BENCH_START;
+		return start_init_request(argc - 1, argv + 1, req);
+	} else if (strcasecmp(argv[0], "stop") == 0) {
+		*cmd = COMMAND_BENCH_STOP;
+		return 0;
+	} else if (strcasecmp(argv[0], "display") == 0) {
+		*cmd = COMMAND_BENCH_DISPLAY;
+		return 0;
+	}
+
+	pr_err("Unknown operation for bench: %s", argv[0]);
+	return -EINVAL;
+}
+
+void bench_clean(struct bench_request *req)
+{
+	if (req->pkt)
+		free(req->pkt);
+}
+
+int bench_build_pkt(enum graybox_command cmd, struct bench_request *req,
+		struct nl_msg *pkt)
+{
+	int error;
+
+	switch (cmd) {
+	case COMMAND_BENCH_ADD:
+		error = nla_put(pkt, ATTR_PKT, req->pkt_len, req->pkt);
+		return (error < 0) ? error : 0;
+	case COMMAND_BENCH_START:
+		error = nla_put_u32(pkt, ATTR_BENCH_RATE, req->rate);
+		if (error < 0)
+			return error;
+		error = nla_put_u32(pkt, ATTR_BENCH_FLOWS, req->flows);
+		if (error < 0)
+			return error;
+		error = nla_put_u32(pkt, ATTR_BENCH_COUNT, req->count);
+		return (error < 0) ? error : 0;
+	default:
+		return 0;
+	}
+}
+
+int bench_response_handle(struct nlattr **attrs, void *arg)
+{
+	struct graybox_bench_stats *stats;
+	double seconds;
+
+	if (!attrs[ATTR_BENCH_STATS]) {
+		pr_err("The module's response lacks a benchmark stats structure.");
+		return -EINVAL;
+	}
+
+	stats = nla_data(attrs[ATTR_BENCH_STATS]);
+	seconds = stats->duration / 1000000000.0;
+
+	printf("Sent:          %llu\n", (unsigned long long)stats->sent);
+	printf("Send failures: %llu\n",
+			(unsigned long long)stats->send_failures);
+	printf("Pending:       %llu\n", (unsigned long long)stats->pending);
+	printf("Received:      %llu\n", (unsigned long long)stats->received);
+	printf("Lost:          %llu\n", (stats->sent > stats->received)
+			? (unsigned long long)(stats->sent - stats->received)
+			: 0llu);
+	printf("Duration:      %.3f s\n", seconds);
+	if (seconds > 0) {
+		printf("Send rate:     %.0f pps\n", stats->sent / seconds);
+		printf("Receive rate:  %.0f pps\n", stats->received / seconds);
+	}
+	if (stats->received) {
+		printf("Latency:\n");
+		printf("	Min: %.3f us\n", stats->latency_min / 1000.0);
+		printf("	Avg: %.3f us\n", stats->latency_total / 1000.0
+				/ stats->received);
+		printf("	Max: %.3f us\n", stats->latency_max / 1000.0);
+	}
+
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef _GRAYBOX_USR_CMD_BENCH_H
+#define _GRAYBOX_USR_CMD_BENCH_H
+
+#include <stddef.h>
+#include <netlink/msg.h>
+#include "common/graybox-types.h"
+
+struct bench_request {
+	/* add */
+	unsigned char *pkt;
+	size_t pkt_len;
+	/* start */
+	__u32 rate;
+	__u32 flows;
+	__u32 count;
+};
+
+int bench_init_request(int argc, char **argv, enum graybox_command *cmd,
+		struct bench_request *req);
+void bench_clean(struct bench_request *req);
+int bench_build_pkt(enum graybox_command cmd, struct bench_request *req,
+		struct nl_msg *pkt);
+int bench_response_handle(struct nlattr **attrs, void *arg);
+
+#endif
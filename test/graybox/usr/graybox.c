@@ -3,6 +3,7 @@
 #include <netlink/attr.h>
 
 #include "common/graybox-types.h"
+#include "usr/command/bench.h"
 #include "usr/command/expect.h"
 #include "usr/command/send.h"
 #include "usr/command/stats.h"
@@ -14,6 +15,7 @@ struct request {
 	union {
 		struct expect_add_request expect_add;
 		struct send_request send;
+		struct bench_request bench;
 	};
 };
 
@@ -36,6 +38,8 @@ static int request_init(int argc, char **argv, struct request *request)
 		return send_init_request(argc, argv, &request->cmd, &request->send);
 	} else if (strcasecmp(type, "stats") == 0) {
 		return stats_init_request(argc, argv, &request->cmd);
+	} else if (strcasecmp(type, "bench") == 0) {
+		return bench_init_request(argc, argv, &request->cmd, &request->bench);
 	}
 
 	pr_err("'%s' is an unknown operation.", type);
@@ -51,9 +55,15 @@ static void request_clean(struct request *req)
 	case COMMAND_SEND:
 		send_clean(&req->send);
 		break;
+	case COMMAND_BENCH_ADD:
+		bench_clean(&req->bench);
+		break;
 	case COMMAND_EXPECT_FLUSH:
 	case COMMAND_STATS_DISPLAY:
 	case COMMAND_STATS_FLUSH:
+	case COMMAND_BENCH_START:
+	case COMMAND_BENCH_STOP:
+	case COMMAND_BENCH_DISPLAY:
 		break;
 	}
 }
@@ -74,9 +84,15 @@ static int build_packet(struct request *req, struct nl_msg **result)
 	case COMMAND_SEND:
 		error = send_build_pkt(&req->send, msg);
 		break;
+	case COMMAND_BENCH_ADD:
+	case COMMAND_BENCH_START:
+		error = bench_build_pkt(req->cmd, &req->bench, msg);
+		break;
 	case COMMAND_EXPECT_FLUSH:
 	case COMMAND_STATS_DISPLAY:
 	case COMMAND_STATS_FLUSH:
+	case COMMAND_BENCH_STOP:
+	case COMMAND_BENCH_DISPLAY:
 		break;
 	}
 
@@ -97,9 +113,14 @@ static int send_request(struct request *req, struct nl_msg *msg)
 	case COMMAND_EXPECT_FLUSH:
 	case COMMAND_SEND:
 	case COMMAND_STATS_FLUSH:
+	case COMMAND_BENCH_ADD:
+	case COMMAND_BENCH_START:
+	case COMMAND_BENCH_STOP:
 		return nlsocket_send(msg, NULL, NULL);
 	case COMMAND_STATS_DISPLAY:
 		return nlsocket_send(msg, stats_response_handle, NULL);
+	case COMMAND_BENCH_DISPLAY:
+		return nlsocket_send(msg, bench_response_handle, NULL);
 	}
 
 	pr_err("Unknown command code: %d", req->cmd);
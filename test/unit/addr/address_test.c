@@ -77,6 +77,57 @@ static bool contains_test(void)
 	return success;
 }
 
+static int sign(int value)
+{
+	return (value > 0) - (value < 0);
+}
+
+/* The word-wise comparisons have to keep memcmp()'s order. */
+static bool compare_test(void)
+{
+	struct ipv6_transport_addr a6, b6;
+	struct ipv4_transport_addr a4, b4;
+	int expected;
+	unsigned int i;
+	bool success = true;
+
+	for (i = 0; i < 1000; i++) {
+		get_random_bytes(&a6, sizeof(a6));
+		/* Make them differ in one byte, or only in the port. */
+		b6 = a6;
+		if (i % 17 == 16)
+			b6.l4++;
+		else
+			b6.l3.s6_addr[i % 17] ^= 1 << (i % 8);
+
+		expected = ipv6_addr_cmp(&a6.l3, &b6.l3);
+		if (!expected)
+			expected = ((int)a6.l4) - ((int)b6.l4);
+		success &= ASSERT_INT(sign(expected),
+				sign(taddr6_compare(&a6, &b6)),
+				"%pI6c#%u vs %pI6c#%u", &a6.l3, a6.l4,
+				&b6.l3, b6.l4);
+
+		get_random_bytes(&a4, sizeof(a4));
+		get_random_bytes(&b4, sizeof(b4));
+		if (i & 1)
+			b4.l3 = a4.l3;
+
+		expected = ipv4_addr_cmp(&a4.l3, &b4.l3);
+		if (!expected)
+			expected = ((int)a4.l4) - ((int)b4.l4);
+		success &= ASSERT_INT(sign(expected),
+				sign(taddr4_compare(&a4, &b4)),
+				"%pI4#%u vs %pI4#%u", &a4.l3, a4.l4,
+				&b4.l3, b4.l4);
+	}
+
+	success &= ASSERT_INT(0, taddr6_compare(&a6, &a6), "equal 6");
+	success &= ASSERT_INT(0, taddr4_compare(&a4, &a4), "equal 4");
+
+	return success;
+}
+
 int init_module(void)
 {
 	struct test_group test = {
@@ -88,6 +139,7 @@ int init_module(void)
 
 	test_group_test(&test, addr_count_test, "Addr count");
 	test_group_test(&test, contains_test, "Prefix contains");
+	test_group_test(&test, compare_test, "Transport address comparison");
 
 	return test_group_end(&test);
 }
@@ -205,6 +205,54 @@ static bool test_flow(void)
 	return success;
 }
 
+static bool init_bulk_entry(struct bib_entry *entry, char *addr6, u16 port6,
+		char *addr4, u16 port4)
+{
+	if (str_to_addr6(addr6, &entry->addr6.l3))
+		return false;
+	if (str_to_addr4(addr4, &entry->addr4.l3))
+		return false;
+	entry->addr6.l4 = port6;
+	entry->addr4.l4 = port4;
+	entry->l4_proto = PROTO;
+	entry->is_static = true;
+	return true;
+}
+
+static bool test_bulk(void)
+{
+	struct bib_entry entries[4];
+	unsigned long failures[BITS_TO_LONGS(ARRAY_SIZE(entries))];
+	bool success = true;
+
+	bib_flush(&jool);
+	drop_test_bibs();
+
+	/* Out of order, and the last one collides with the first (in IPv4). */
+	success &= init_bulk_entry(&entries[0], "2001:db8::3", 10, "192.0.2.3", 10);
+	success &= init_bulk_entry(&entries[1], "2001:db8::0", 10, "192.0.2.1", 21);
+	success &= init_bulk_entry(&entries[2], "2001:db8::1", 19, "192.0.2.0", 20);
+	success &= init_bulk_entry(&entries[3], "2001:db8::2", 8, "192.0.2.3", 10);
+	if (!success)
+		return false;
+
+	success &= ASSERT_INT(0, bib_add_static_bulk(&jool, entries,
+			ARRAY_SIZE(entries), failures), "bulk result");
+	success &= ASSERT_BOOL(false, test_bit(0, failures), "entry 0");
+	success &= ASSERT_BOOL(false, test_bit(1, failures), "entry 1");
+	success &= ASSERT_BOOL(false, test_bit(2, failures), "entry 2");
+	success &= ASSERT_BOOL(true, test_bit(3, failures), "entry 3");
+
+	bibs6[3][10] = bibs4[3][10] = &entries[0];
+	bibs6[0][10] = bibs4[1][21] = &entries[1];
+	bibs6[1][19] = bibs4[0][20] = &entries[2];
+	success &= test_db();
+
+	bib_flush(&jool);
+	drop_test_bibs();
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
@@ -234,6 +282,7 @@ int init_module(void)
 		return -EINVAL;
 
 	test_group_test(&test, test_flow, "Flow");
+	test_group_test(&test, test_bulk, "Bulk add");
 
 	return test_group_end(&test);
 }
@@ -142,6 +142,115 @@ static bool test_foreach(void)
 	return success;
 }
 
+/* Enough to span several of the foreach's chunks, plus a runt. */
+#define MANY_BIB_COUNT 100
+
+struct many_iteration_args {
+	unsigned int count;
+	struct ipv4_transport_addr last;
+};
+
+static int many_cb(struct bib_entry const *bib, void *void_args)
+{
+	struct many_iteration_args *args = void_args;
+
+	/* Chunks must resume right after the previous one, in order. */
+	if (args->count > 0 && taddr4_compare(&args->last, &bib->addr4) >= 0) {
+		log_err("Entry %u (port %u) does not follow port %u.",
+				args->count, bib->addr4.l4, args->last.l4);
+		return -EINVAL;
+	}
+
+	args->last = bib->addr4;
+	args->count++;
+	return 0;
+}
+
+static bool test_foreach_chunks(void)
+{
+	struct bib_entry entry;
+	struct ipv4_transport_addr offset;
+	struct many_iteration_args args;
+	unsigned int i;
+	int error;
+	bool success = true;
+
+	for (i = 0; i < MANY_BIB_COUNT; i++) {
+		entry.addr4.l3.s_addr = cpu_to_be32(0xc0000201u);
+		entry.addr4.l4 = 1000 + i;
+		if (str_to_addr6("2001:db8::1", &entry.addr6.l3))
+			return false;
+		entry.addr6.l4 = 1000 + i;
+		entry.l4_proto = L4PROTO_UDP;
+		if (bib_add_static(&jool, &entry))
+			return false;
+	}
+
+	memset(&args, 0, sizeof(args));
+	error = bib_foreach(jool.nat64.bib, L4PROTO_UDP, many_cb, &args, NULL);
+	success &= ASSERT_INT(0, error, "full result");
+	success &= ASSERT_UINT(MANY_BIB_COUNT, args.count, "full counter");
+
+	memset(&args, 0, sizeof(args));
+	offset.l3.s_addr = cpu_to_be32(0xc0000201u);
+	offset.l4 = 1009;
+	error = bib_foreach(jool.nat64.bib, L4PROTO_UDP, many_cb, &args,
+			&offset);
+	success &= ASSERT_INT(0, error, "offset result");
+	success &= ASSERT_UINT(MANY_BIB_COUNT - 10, args.count,
+			"offset counter");
+
+	return success;
+}
+
+static int range_foreach(char *prefix, __u8 len, __u16 min, __u16 max,
+		struct many_iteration_args *args)
+{
+	struct ipv4_range range;
+
+	if (str_to_addr4(prefix, &range.prefix.addr))
+		return -EINVAL;
+	range.prefix.len = len;
+	range.ports.min = min;
+	range.ports.max = max;
+
+	memset(args, 0, sizeof(*args));
+	return bib_foreach_range(jool.nat64.bib, L4PROTO_UDP, many_cb, args,
+			NULL, &range);
+}
+
+static bool test_foreach_range(void)
+{
+	struct many_iteration_args args;
+	int error;
+	bool success = true;
+
+	if (!insert_test_bibs())
+		return false;
+
+	error = range_foreach("192.0.2.2", 32, 0, 65535, &args);
+	success &= ASSERT_INT(0, error, "address result");
+	success &= ASSERT_UINT(3, args.count, "address counter");
+
+	error = range_foreach("192.0.2.2", 32, 60, 200, &args);
+	success &= ASSERT_INT(0, error, "address/ports result");
+	success &= ASSERT_UINT(2, args.count, "address/ports counter");
+
+	error = range_foreach("192.0.2.0", 30, 100, 100, &args);
+	success &= ASSERT_INT(0, error, "port result");
+	success &= ASSERT_UINT(3, args.count, "port counter");
+
+	error = range_foreach("192.0.2.2", 31, 0, 65535, &args);
+	success &= ASSERT_INT(0, error, "prefix result");
+	success &= ASSERT_UINT(4, args.count, "prefix counter");
+
+	error = range_foreach("198.51.100.0", 24, 0, 65535, &args);
+	success &= ASSERT_INT(0, error, "empty result");
+	success &= ASSERT_UINT(0, args.count, "empty counter");
+
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
@@ -171,6 +280,8 @@ int init_module(void)
 		return -EINVAL;
 
 	test_group_test(&test, test_foreach, "Foreach");
+	test_group_test(&test, test_foreach_chunks, "Foreach, several chunks");
+	test_group_test(&test, test_foreach_range, "Foreach, restricted to a range");
 
 	return test_group_end(&test);
 }
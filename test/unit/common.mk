@@ -13,6 +13,7 @@ ccflags-y += -I$(src)/..
 MIN_REQS = ../../../src/common/types.o \
 	../../../src/mod/common/types.o \
 	../../../src/mod/common/address.o \
+	../../../src/mod/common/tracepoints.o \
 	../framework/unit_test.o
 
 #../impersonator/stats.o
@@ -12,16 +12,22 @@ MODULE_AUTHOR("aleiva");
 MODULE_DESCRIPTION("Unit tests for the EAMT module");
 
 static struct eam_table *eamt;
+static struct jool_stats *stats;
 
 static int init(void)
 {
 	eamt = eamt_alloc();
-	return eamt ? 0 : -ENOMEM;
+	if (!eamt)
+		return -ENOMEM;
+	stats = jstat_alloc();
+	return 0;
 }
 
 static void clean(void)
 {
 	eamt_put(eamt);
+	/* Wait for the nodes eamt_rm() released. */
+	rcu_barrier_bh();
 }
 
 static int __add_entry(char *addr4, __u8 len4, char *addr6, __u8 len6)
@@ -29,6 +35,7 @@ static int __add_entry(char *addr4, __u8 len4, char *addr6, __u8 len6)
 	struct eamt_entry new;
 	int error;
 
+	memset(&new, 0, sizeof(new));
 	if (str_to_addr4(addr4, &new.prefix4.addr))
 		return false;
 	new.prefix4.len = len4;
@@ -99,7 +106,8 @@ static bool test_6to4(char *addr6_str, char *addr4_str)
 		return false;
 
 	if (addr4_str) {
-		success &= ASSERT_INT(0, eamt_xlat_6to4(eamt, &addr6, &result),
+		success &= ASSERT_INT(0,
+				eamt_xlat_6to4(eamt, &addr6, &result, stats),
 				"errcode");
 		success &= ASSERT_ADDR4(addr4_str, &result.addr,
 				"resulting address");
@@ -107,7 +115,7 @@ static bool test_6to4(char *addr6_str, char *addr4_str)
 			"translation method");
 	} else {
 		success &= ASSERT_INT(-ESRCH,
-				eamt_xlat_6to4(eamt, &addr6, &result),
+				eamt_xlat_6to4(eamt, &addr6, &result, stats),
 				"errcode");
 	}
 
@@ -124,7 +132,8 @@ static bool test_4to6(char *addr4_str, char *addr6_str)
 		return false;
 
 	if (addr6_str) {
-		success &= ASSERT_INT(0, eamt_xlat_4to6(eamt, &addr4, &result),
+		success &= ASSERT_INT(0,
+				eamt_xlat_4to6(eamt, &addr4, &result, stats),
 				"errcode");
 		success &= ASSERT_ADDR6(addr6_str, &result.addr,
 				"resulting address");
@@ -132,7 +141,7 @@ static bool test_4to6(char *addr4_str, char *addr6_str)
 				"translation method");
 	} else {
 		success &= ASSERT_INT(-ESRCH,
-				eamt_xlat_4to6(eamt, &addr4, &result),
+				eamt_xlat_4to6(eamt, &addr4, &result, stats),
 				"errcode");
 	}
 
@@ -455,6 +464,420 @@ static bool remove_test(void)
 	return success;
 }
 
+static bool rebuild_lcts_now(void)
+{
+	bool success = true;
+
+	flush_delayed_work(&eamt->rebuild_work);
+	success &= ASSERT_BOOL(true, !!rcu_access_pointer(eamt->lct6),
+			"lct6 published");
+	success &= ASSERT_BOOL(true, !!rcu_access_pointer(eamt->lct4),
+			"lct4 published");
+
+	return success;
+}
+
+static bool lctrie_test(void)
+{
+	struct eamt_entry new;
+	unsigned int i;
+	bool success = true;
+
+	/* Small table; 8-bit root */
+	success &= create_four_story_trie();
+	success &= rebuild_lcts_now();
+	if (!success)
+		return false;
+
+	success &= test("1.0.0.0", "1::");
+	success &= test("2.0.0.0", "1:1::");
+	success &= test("3.0.0.0", "1:2::");
+	success &= test("4.0.0.0", "1:1:1::");
+	success &= test("5.0.0.0", "1:1:2::");
+	success &= test("6.0.0.0", "1:2:1::");
+	success &= test("7.0.0.0", "1:2:1:1::");
+	success &= test_6to4("1:2:1:2::", "6.0.0.0");
+	success &= test_6to4("2::", NULL);
+	success &= test_4to6("8.0.0.0", NULL);
+
+	/* Updates have to unpublish the snapshots until they're rebuilt */
+	success &= remove_entry(NULL, 0, "1:2:1:1::", 64, 0);
+	success &= ASSERT_BOOL(false, !!rcu_access_pointer(eamt->lct6),
+			"lct6 unpublished");
+	success &= test_6to4("1:2:1:1::", "6.0.0.0");
+	success &= test_4to6("7.0.0.0", NULL);
+	eamt_flush(eamt);
+
+	/* Big table; 16-bit root, skipped bytes, pushed leaves */
+	success &= add_entry("10.0.0.0", 16, "2001:db8:1::", 112);
+	for (i = 0; i < 512; i++) {
+		new.prefix4.addr.s_addr = cpu_to_be32(0x0a000000u | i);
+		new.prefix4.len = 32;
+		if (str_to_addr6("2001:db8::", &new.prefix6.addr))
+			return false;
+		new.prefix6.addr.s6_addr32[3] = cpu_to_be32(i);
+		new.prefix6.len = 128;
+		if (eamt_add(eamt, &new, true, false)) {
+			log_err("The call to eamt_add() failed.");
+			return false;
+		}
+	}
+	success &= rebuild_lcts_now();
+	if (!success)
+		return false;
+
+	success &= test("10.0.0.0", "2001:db8::");
+	success &= test("10.0.1.44", "2001:db8::12c");
+	success &= test("10.0.1.255", "2001:db8::1ff");
+	success &= test("10.0.2.0", "2001:db8:1::200");
+	success &= test("10.0.255.255", "2001:db8:1::ffff");
+	success &= test_6to4("2001:db8::200", NULL);
+	success &= test_6to4("2001:db9::1", NULL);
+	success &= test_4to6("10.1.0.0", NULL);
+	eamt_flush(eamt);
+
+	return success;
+}
+
+static bool cache_test(void)
+{
+	bool success = true;
+
+	success &= add_entry("192.0.2.0", 24, "2001:db8::", 120);
+	if (!success)
+		return false;
+
+	/* Fill the slots, then hit them */
+	success &= test("192.0.2.1", "2001:db8::1");
+	success &= test("192.0.2.1", "2001:db8::1");
+	success &= test_6to4("2001:db8:1::1", NULL);
+	success &= test_6to4("2001:db8:1::1", NULL);
+	success &= test_4to6("198.51.100.1", NULL);
+	success &= test_4to6("198.51.100.1", NULL);
+
+	/* Updates have to invalidate the hits and misses */
+	success &= add_entry("198.51.100.0", 24, "2001:db8:1::", 120);
+	success &= test("198.51.100.1", "2001:db8:1::1");
+	success &= remove_entry("192.0.2.0", 24, NULL, 0, 0);
+	success &= test_6to4("2001:db8::1", NULL);
+	success &= test_4to6("192.0.2.1", NULL);
+	eamt_flush(eamt);
+	success &= test_6to4("2001:db8:1::1", NULL);
+	success &= test_4to6("198.51.100.1", NULL);
+
+	return success;
+}
+
+static int __stage_entry(char *addr4, __u8 len4, char *addr6, __u8 len6,
+		bool force)
+{
+	struct eamt_entry new;
+
+	memset(&new, 0, sizeof(new));
+	if (str_to_addr4(addr4, &new.prefix4.addr))
+		return -EINVAL;
+	new.prefix4.len = len4;
+	if (str_to_addr6(addr6, &new.prefix6.addr))
+		return -EINVAL;
+	new.prefix6.len = len6;
+
+	return eamt_stage(eamt, &new, force);
+}
+
+static bool stage_entry(char *addr4, __u8 len4, char *addr6, __u8 len6,
+		bool force)
+{
+	return ASSERT_INT(0, __stage_entry(addr4, len4, addr6, len6, force),
+			"eamt_stage()");
+}
+
+/*
+ * Are all of @trie's nodes in the same arena, with the root (the first node in
+ * breadth-first order) at the beginning?
+ */
+static bool is_packed(struct rtrie *trie)
+{
+	struct rtrie_node *root = rcu_access_pointer(trie->root);
+	struct rtrie_node *node;
+
+	list_for_each_entry(node, &trie->list, list_hook)
+		if (!node->arena || node->arena != root->arena || node < root)
+			return false;
+
+	return true;
+}
+
+static bool bulk_test(void)
+{
+	bool success = true;
+
+	/* The four story trie, out of order */
+	success &= stage_entry("7.0.0.0", 32, "1:2:1:1::", 64, true);
+	success &= stage_entry("2.0.0.0", 32, "1:1::", 32, true);
+	success &= stage_entry("5.0.0.0", 32, "1:1:2::", 48, true);
+	success &= stage_entry("1.0.0.0", 32, "1::", 16, true);
+	success &= stage_entry("6.0.0.0", 32, "1:2:1::", 48, true);
+	success &= stage_entry("4.0.0.0", 32, "1:1:1::", 48, true);
+	success &= stage_entry("3.0.0.0", 32, "1:2::", 32, true);
+	success &= stage_entry("10.0.0.0", 24, "2001:db8::", 120, true);
+	success &= ASSERT_INT(0, eamt_commit_staged(eamt), "commit");
+	success &= ASSERT_U64(8ULL, eamt->count, "count");
+	if (!success)
+		return false;
+
+	success &= ASSERT_BOOL(true, is_packed(&eamt->trie6), "trie6 arena");
+	success &= ASSERT_BOOL(true, is_packed(&eamt->trie4), "trie4 arena");
+
+	success &= test("1.0.0.0", "1::");
+	success &= test("2.0.0.0", "1:1::");
+	success &= test("3.0.0.0", "1:2::");
+	success &= test("4.0.0.0", "1:1:1::");
+	success &= test("5.0.0.0", "1:1:2::");
+	success &= test("6.0.0.0", "1:2:1::");
+	success &= test("7.0.0.0", "1:2:1:1::");
+	success &= test("10.0.0.5", "2001:db8::5");
+	success &= test_6to4("1:2:1:2::", "6.0.0.0");
+	success &= test_6to4("2::", NULL);
+	success &= test_4to6("8.0.0.0", NULL);
+
+	/* The built tries have to support the regular updates */
+	success &= remove_entry(NULL, 0, "1:2::", 32, 0);
+	success &= test_6to4("1:2::", "1.0.0.0");
+	success &= test("6.0.0.0", "1:2:1::");
+	success &= add_entry("3.0.0.0", 32, "1:2::", 32);
+	success &= test("3.0.0.0", "1:2::");
+	eamt_flush(eamt);
+
+	/* Overlapping entries need force */
+	success &= stage_entry("1.0.0.0", 24, "1::", 120, false);
+	success &= stage_entry("1.0.0.0", 32, "2::", 128, false);
+	success &= ASSERT_INT(-EEXIST, eamt_commit_staged(eamt),
+			"overlapping commit");
+	success &= ASSERT_BOOL(true, eamt_is_empty(eamt), "empty after error");
+
+	/* Duplicates are never allowed */
+	success &= stage_entry("1.0.0.0", 32, "1::", 128, true);
+	success &= stage_entry("1.0.0.0", 32, "1::", 128, true);
+	success &= ASSERT_INT(-EEXIST, eamt_commit_staged(eamt),
+			"duplicate commit");
+	success &= ASSERT_BOOL(true, eamt_is_empty(eamt), "empty after error");
+
+	return success;
+}
+
+struct foreach_state {
+	unsigned int calls;
+	unsigned int max;
+	struct ipv4_prefix last;
+};
+
+static int count_cb(struct eamt_entry const *eam, void *arg)
+{
+	struct foreach_state *state = arg;
+
+	if (state->calls == state->max)
+		return 1;
+	state->calls++;
+	state->last = eam->prefix4;
+	return 0;
+}
+
+static bool foreach_test(void)
+{
+	struct foreach_state state;
+	struct ipv4_prefix bogus;
+	unsigned int total;
+	bool success = true;
+
+	success &= create_four_story_trie();
+	if (!success)
+		return false;
+
+	/* Pages of two */
+	total = 0;
+	state.calls = 0;
+	state.max = 2;
+	success &= ASSERT_INT(1, eamt_foreach(eamt, count_cb, &state, NULL),
+			"first page");
+	total += state.calls;
+	while (success && state.calls == state.max && total < 100) {
+		state.calls = 0;
+		success &= ASSERT_BOOL(true, eamt_foreach(eamt, count_cb,
+				&state, &state.last) >= 0, "next page");
+		total += state.calls;
+	}
+	success &= ASSERT_UINT(7, total, "entries visited");
+
+	/* Offsets that aren't entries */
+	bogus.addr.s_addr = cpu_to_be32(0x08000000);
+	bogus.len = 32;
+	state.calls = 0;
+	state.max = 10;
+	success &= ASSERT_INT(-ESRCH, eamt_foreach(eamt, count_cb, &state,
+			&bogus), "missing offset");
+	bogus.addr.s_addr = cpu_to_be32(0x00000000);
+	bogus.len = 6;
+	success &= ASSERT_INT(-ESRCH, eamt_foreach(eamt, count_cb, &state,
+			&bogus), "inode offset");
+
+	eamt_flush(eamt);
+	return success;
+}
+
+static bool memory_test(void)
+{
+	__u64 nodes, bytes;
+	bool success = true;
+
+	eamt_memory(eamt, &nodes, &bytes);
+	success &= ASSERT_U64(0ull, nodes, "empty nodes");
+	success &= ASSERT_U64(0ull, bytes, "empty bytes");
+
+	success &= create_four_story_trie();
+	if (!success)
+		return false;
+
+	/* Seven white nodes per trie, plus whatever black nodes they need. */
+	eamt_memory(eamt, &nodes, &bytes);
+	success &= ASSERT_BOOL(true, nodes >= 14, "nodes");
+	success &= ASSERT_BOOL(true, bytes >= nodes * sizeof(struct rtrie_node),
+			"bytes");
+
+	eamt_flush(eamt);
+	eamt_memory(eamt, &nodes, &bytes);
+	success &= ASSERT_U64(0ull, nodes, "flushed nodes");
+	success &= ASSERT_U64(0ull, bytes, "flushed bytes");
+
+	return success;
+}
+
+static bool publish_test(void)
+{
+	struct eam_table *other;
+	struct eam_table *found;
+	bool success = true;
+
+	success &= ASSERT_PTR(NULL, eamt_find_published("tenants"),
+			"not published yet");
+	success &= ASSERT_INT(0, eamt_publish(eamt, "tenants"), "publish");
+	success &= ASSERT_BOOL(true, eamt_is_published(eamt), "read-only");
+
+	found = eamt_find_published("tenants");
+	success &= ASSERT_PTR(eamt, found, "found");
+	if (found)
+		eamt_put(found);
+
+	/* A newer table takes the name over. */
+	other = eamt_alloc();
+	if (!other)
+		return false;
+	success &= ASSERT_INT(0, eamt_publish(other, "tenants"), "republish");
+	found = eamt_find_published("tenants");
+	success &= ASSERT_PTR(other, found, "found the newer one");
+	if (found)
+		eamt_put(found);
+	success &= ASSERT_BOOL(true, eamt_is_published(eamt),
+			"the old one stays read-only");
+
+	/* The last reference takes the name with it. */
+	eamt_put(other);
+	success &= ASSERT_PTR(NULL, eamt_find_published("tenants"),
+			"unlisted");
+
+	return success;
+}
+
+static int __add_map(char *addr4, __u8 len4, char *addr6, __u8 len6,
+		__u8 ea_len, __u8 psid_offset)
+{
+	struct eamt_entry new;
+
+	memset(&new, 0, sizeof(new));
+	if (str_to_addr4(addr4, &new.prefix4.addr))
+		return -EINVAL;
+	new.prefix4.len = len4;
+	if (str_to_addr6(addr6, &new.prefix6.addr))
+		return -EINVAL;
+	new.prefix6.len = len6;
+	new.ea_len = ea_len;
+	new.psid_offset = psid_offset;
+
+	return eamt_add(eamt, &new, false, true);
+}
+
+static bool test_map(char *addr4_str, __u16 port, char *addr6_str)
+{
+	struct in_addr addr4;
+	struct in6_addr addr6;
+	struct result_addrxlat46 result46;
+	struct result_addrxlat64 result64;
+	bool success = true;
+
+	if (str_to_addr4(addr4_str, &addr4))
+		return false;
+	if (str_to_addr6(addr6_str, &addr6))
+		return false;
+
+	success &= ASSERT_INT(0, eamt_xlat_4to6(eamt, &addr4, &result46, stats),
+			"4to6 errcode");
+	success &= ASSERT_BOOL(true, eamt_is_map(&result46.entry.eam),
+			"4to6 rule");
+	success &= ASSERT_INT(0, eamt_map_4to6(&result46.entry.eam, &addr4,
+			port, &result46.addr), "PSID embedding");
+	success &= ASSERT_ADDR6(addr6_str, &result46.addr, "4to6 result");
+
+	success &= ASSERT_INT(0, eamt_xlat_6to4(eamt, &addr6, &result64, stats),
+			"6to4 errcode");
+	success &= ASSERT_ADDR4(addr4_str, &result64.addr, "6to4 result");
+	success &= ASSERT_BOOL(true, eamt_map_port_matches(&result64.entry.eam,
+			&addr6, port), "port matches");
+
+	return success;
+}
+
+static bool map_test(void)
+{
+	struct in_addr addr4;
+	struct in6_addr addr6;
+	struct result_addrxlat46 result46;
+	bool success = true;
+
+	/* Rule validations */
+	success &= ASSERT_INT(-EINVAL, __add_map("192.0.2.0", 24, "2001:db8::", 40, 7, 6),
+			"EA bits shorter than the IPv4 suffix");
+	success &= ASSERT_INT(-EINVAL, __add_map("192.0.2.0", 24, "2001:db8::", 40, 20, 6),
+			"PSID spills out of the port");
+	success &= ASSERT_INT(-EINVAL, __add_map("192.0.2.0", 24, "2001:db8::", 56, 16, 6),
+			"EA bits reach the interface ID");
+
+	/* RFC 7597, Appendix A, example 1 */
+	success &= ASSERT_INT(0, __add_map("192.0.2.0", 24, "2001:db8::", 40, 16, 6),
+			"add");
+	/* Port 1232: i = 1, PSID = 0x34, j = 0. */
+	success &= test_map("192.0.2.18", 1232,
+			"2001:db8:12:3400:0:c000:212:34");
+	/* Port 65535: PSID 0xff. */
+	success &= test_map("192.0.2.18", 65535,
+			"2001:db8:12:ff00:0:c000:212:ff");
+
+	if (str_to_addr4("192.0.2.18", &addr4))
+		return false;
+	if (str_to_addr6("2001:db8:12:3400:0:c000:212:34", &addr6))
+		return false;
+
+	success &= ASSERT_INT(0, eamt_xlat_4to6(eamt, &addr4, &result46, stats),
+			"4to6 errcode");
+	success &= ASSERT_BOOL(false, eamt_map_port_matches(&result46.entry.eam,
+			&addr6, 1236), "port of PSID 0x35");
+	success &= ASSERT_INT(-ESRCH, eamt_map_4to6(&result46.entry.eam, &addr4,
+			80, &result46.addr), "system port");
+	success &= ASSERT_BOOL(false, eamt_map_port_matches(&result46.entry.eam,
+			&addr6, 80), "system port (6to4)");
+
+	eamt_flush(eamt);
+	return success;
+}
+
 static int address_mapping_test_init(void)
 {
 	struct test_group test = {
@@ -472,6 +895,13 @@ static int address_mapping_test_init(void)
 	test_group_test(&test, rfc7757_overlapping_test, "RFC 7757 Section 5, 1st half");
 	test_group_test(&test, rfc7757_identical_test, "RFC 7757 Section 5, 2nd half");
 	test_group_test(&test, remove_test, "remove function");
+	test_group_test(&test, lctrie_test, "lctrie");
+	test_group_test(&test, cache_test, "per-CPU cache");
+	test_group_test(&test, bulk_test, "bulk load");
+	test_group_test(&test, foreach_test, "foreach offsets");
+	test_group_test(&test, memory_test, "memory accounting");
+	test_group_test(&test, publish_test, "publishing");
+	test_group_test(&test, map_test, "MAP-T rules");
 
 	return test_group_end(&test);
 }
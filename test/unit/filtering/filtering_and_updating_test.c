@@ -447,7 +447,7 @@ static bool test_icmp(void)
  */
 static bool test_tcp(void)
 {
-	struct xlation state = { .jool = jool };
+	struct xlation state = { .jool = &jool };
 	struct sk_buff *skb;
 	bool success = true;
 
@@ -524,6 +524,170 @@ static bool test_tcp(void)
 	return success;
 }
 
+static bool send_udp6(struct xlation *state, char *src6, char *dst6,
+		verdict expected, char *test_name)
+{
+	struct sk_buff *skb;
+	bool success;
+
+	if (create_skb6_udp(src6, 1212, dst6, 3434, 16, 32, &skb))
+		return false;
+	if (pkt_init_ipv6(state, skb))
+		return false;
+	if (determine_in_tuple(state) != VERDICT_CONTINUE)
+		return false;
+
+	success = ASSERT_INT(expected, ipv6_simple(state), "%s", test_name);
+
+	kfree_skb(skb);
+	return success;
+}
+
+static bool test_subscriber_quotas(void)
+{
+	struct xlation state;
+	struct pool4_entry entry;
+	bool success = true;
+
+	xlation_init(&state, &jool);
+	jool.globals.nat64.bib.subscriber_max_ports = 1;
+	jool.globals.nat64.bib.subscriber_max_sessions = 2;
+
+	/* So the other subscriber doesn't get mistaken for pool4 exhaustion. */
+	entry.mark = 0;
+	entry.iterations = 0;
+	entry.flags = ITERATIONS_SET | ITERATIONS_INFINITE;
+	entry.proto = L4PROTO_UDP;
+	if (str_to_addr4("192.0.2.129", &entry.range.prefix.addr))
+		return false;
+	entry.range.prefix.len = 32;
+	entry.range.ports.min = 1024;
+	entry.range.ports.max = 1024;
+	if (pool4db_add(jool.nat64.pool4, &entry))
+		return false;
+
+	success &= send_udp6(&state, "1::2", "3::4", VERDICT_CONTINUE, "First BIB");
+	/* 1::3 is in 1::2's /64. */
+	success &= send_udp6(&state, "1::3", "3::4", VERDICT_DROP, "Second BIB");
+	success &= assert_bib_count(1, L4PROTO_UDP);
+
+	success &= send_udp6(&state, "1::2", "3::5", VERDICT_CONTINUE, "Second session");
+	success &= send_udp6(&state, "1::2", "3::6", VERDICT_DROP, "Third session");
+	success &= assert_session_count(2, L4PROTO_UDP);
+
+	success &= send_udp6(&state, "2::2", "3::4", VERDICT_CONTINUE, "Other subscriber");
+	success &= assert_bib_count(2, L4PROTO_UDP);
+	success &= assert_session_count(3, L4PROTO_UDP);
+
+	return success;
+}
+
+static bool test_subscriber_rates(void)
+{
+	struct xlation state;
+	bool success = true;
+
+	xlation_init(&state, &jool);
+	jool.globals.nat64.bib.subscriber_session_rate = 1;
+	jool.globals.nat64.bib.subscriber_packet_rate = 2;
+	jool.fast.subscriber_packet_rate = 2;
+
+	/* The first session spends the subscriber's only session token. */
+	success &= send_udp6(&state, "1::2", "3::4", VERDICT_CONTINUE, "First session");
+	success &= send_udp6(&state, "1::3", "3::5", VERDICT_DROP, "Second session");
+	success &= send_udp6(&state, "1::2", "3::4", VERDICT_CONTINUE, "Existing session");
+	success &= assert_session_count(1, L4PROTO_UDP);
+
+	/* The bucket starts full. */
+	success &= ASSERT_BOOL(true, bib_police6(&state), "First packet");
+	success &= ASSERT_BOOL(true, bib_police6(&state), "Second packet");
+	success &= ASSERT_BOOL(false, bib_police6(&state), "Third packet");
+
+	/* Untracked subscribers are not policed. */
+	if (init_tuple6(&state.in.tuple, "2::2", 1212, "3::4", 3434, L4PROTO_UDP))
+		return false;
+	success &= ASSERT_BOOL(true, bib_police6(&state), "Other subscriber");
+
+	return success;
+}
+
+/*
+ * Past syn-flood-threshold, V6 SYNs are translated, but their connections are
+ * only stored once the V4 SYN arrives.
+ */
+static bool test_syn_flood(void)
+{
+	struct xlation state = { .jool = &jool };
+	struct pool4_entry entry;
+	struct sk_buff *skb;
+	bool success = true;
+
+	jool.globals.nat64.bib.syn_flood_threshold = 1;
+
+	log_debug(&state, "== V6 SYN (below the threshold) ==");
+	if (init_tuple6(&state.in.tuple, "1::2", 1212, "3::4", 3434, L4PROTO_TCP))
+		return false;
+	if (create_tcp_packet(&skb, L3PROTO_IPV6, true, false, false))
+		return false;
+	if (pkt_init_ipv6(&state, skb))
+		return false;
+
+	success &= ASSERT_VERDICT(CONTINUE, ipv6_tcp(&state), "Stored result");
+	success &= assert_bib_count(1, L4PROTO_TCP);
+	success &= assert_session_count(1, L4PROTO_TCP);
+
+	kfree_skb(skb);
+
+	/* The deferred connection needs a mask of its own. */
+	entry.mark = 0;
+	entry.iterations = 0;
+	entry.flags = ITERATIONS_SET | ITERATIONS_INFINITE;
+	entry.proto = L4PROTO_TCP;
+	if (str_to_addr4("192.0.2.129", &entry.range.prefix.addr))
+		return false;
+	entry.range.prefix.len = 32;
+	entry.range.ports.min = 1024;
+	entry.range.ports.max = 1024;
+	if (pool4db_add(jool.nat64.pool4, &entry))
+		return false;
+
+	log_debug(&state, "== V6 SYN (above the threshold) ==");
+	if (init_tuple6(&state.in.tuple, "1::2", 1313, "3::4", 3434, L4PROTO_TCP))
+		return false;
+	if (create_tcp_packet(&skb, L3PROTO_IPV6, true, false, false))
+		return false;
+	if (pkt_init_ipv6(&state, skb))
+		return false;
+
+	success &= ASSERT_VERDICT(CONTINUE, ipv6_tcp(&state), "Deferred result");
+	success &= assert_bib_count(1, L4PROTO_TCP);
+	success &= assert_session_count(1, L4PROTO_TCP);
+	success &= ASSERT_ADDR4("192.0.2.129",
+			&state.entries.session.src4.l3, "Deferred mask");
+
+	kfree_skb(skb);
+
+	log_debug(&state, "== V4 SYN ==");
+	if (invert_tuple(&state))
+		return false;
+	if (create_tcp_packet(&skb, L3PROTO_IPV4, true, false, false))
+		return false;
+	if (pkt_init_ipv4(&state, skb))
+		return false;
+
+	success &= ASSERT_VERDICT(CONTINUE, ipv4_tcp(&state), "Answer result");
+	success &= assert_bib_count(2, L4PROTO_TCP);
+	success &= assert_bib_exists("1::2", 1313, "192.0.2.129", 1024, L4PROTO_TCP, 1);
+	success &= assert_session_count(2, L4PROTO_TCP);
+	success &= assert_session_exists("1::2", 1313, "3::4", 3434,
+			"192.0.2.129", 1024, "0.0.0.4", 3434,
+			L4PROTO_TCP, ESTABLISHED, SESSION_TIMER_EST, TCP_EST);
+
+	kfree_skb(skb);
+
+	return success;
+}
+
 static void defrag_dummy(struct net *ns)
 {
 	/* No code */
@@ -627,6 +791,9 @@ static int filtering_test_init(void)
 	test_group_test(&test, test_udp, "UDP");
 	test_group_test(&test, test_icmp, "ICMP");
 	test_group_test(&test, test_tcp, "test_tcp");
+	test_group_test(&test, test_syn_flood, "SYN flood protection");
+	test_group_test(&test, test_subscriber_quotas, "Subscriber quotas");
+	test_group_test(&test, test_subscriber_rates, "Subscriber rates");
 
 	return test_group_end(&test);
 }
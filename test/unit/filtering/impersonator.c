@@ -1,4 +1,6 @@
+#include "mod/common/init.h"
 #include "mod/common/joold.h"
+#include "mod/common/natlog.h"
 #include "framework/unit_test.h"
 
 static struct fake {
@@ -25,6 +27,46 @@ void joold_put(struct joold_queue *queue)
 	/* No code. */
 }
 
+/* The test sets up the RFC 6056 transform on its own, and needs no timer. */
+int jool_nat64_machinery_get(void)
+{
+	return 0;
+}
+
+void jool_nat64_machinery_put(void)
+{
+	/* No code. */
+}
+
+struct natlog *natlog_alloc(void)
+{
+	return (struct natlog *)&dummy;
+}
+
+void natlog_get(struct natlog *log)
+{
+	/* No code. */
+}
+
+void natlog_put(struct natlog *log)
+{
+	/* No code. */
+}
+
+void natlog_add(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4, l4_protocol proto,
+		enum natlog_event event)
+{
+	/* No code. */
+}
+
+void natlog_add_block(struct xlator *jool, struct in6_addr const *src6,
+		struct in_addr const *src4, __u16 min, __u16 max,
+		l4_protocol proto, enum natlog_event event)
+{
+	/* No code. */
+}
+
 int foreach_ifa(struct net *ns, int (*cb)(struct in_ifaddr *, void const *),
 		void const *args)
 {
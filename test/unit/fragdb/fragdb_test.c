@@ -0,0 +1,194 @@
+#include <linux/module.h>
+
+#include "framework/skb_generator.h"
+#include "framework/unit_test.h"
+#include "mod/common/db/fragdb.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Fragment cache module test");
+
+static struct xlator jool;
+
+static int init(void)
+{
+	memset(&jool, 0, sizeof(jool));
+	jool.stats = jstat_alloc();
+	jool.nat64.fragdb = fragdb_alloc();
+	return jool.nat64.fragdb ? 0 : -ENOMEM;
+}
+
+static void clean(void)
+{
+	/* Also releases the fragments the tests left held. */
+	fragdb_put(jool.nat64.fragdb);
+}
+
+/*
+ * Initializes @state as the fragment of 192.0.2.1#5000 -> 198.51.100.1#53
+ * (IPv4 identification @id) at @offset. Subsequent fragments get no ports.
+ */
+static int init_frag(struct xlation *state, __u16 id, __u16 offset, bool mf)
+{
+	struct sk_buff *skb;
+	struct iphdr *hdr;
+	struct tuple *tuple;
+	int error;
+
+	error = create_skb4_udp("192.0.2.1", 5000, "198.51.100.1", 53, 100, 64,
+			&skb);
+	if (error)
+		return error;
+
+	hdr = ip_hdr(skb);
+	hdr->id = cpu_to_be16(id);
+	hdr->frag_off = build_ipv4_frag_off_field(false, mf, offset);
+
+	xlation_init(state, &jool);
+	pkt_fill(&state->in, skb, L3PROTO_IPV4, L4PROTO_UDP, NULL,
+			skb_transport_header(skb), &state->in);
+
+	tuple = &state->in.tuple;
+	tuple->src.addr4.l3.s_addr = hdr->saddr;
+	tuple->dst.addr4.l3.s_addr = hdr->daddr;
+	tuple->l3_proto = L3PROTO_IPV4;
+	tuple->l4_proto = L4PROTO_UDP;
+	if (offset == 0) {
+		tuple->src.addr4.l4 = 5000;
+		tuple->dst.addr4.l4 = 53;
+	}
+
+	return 0;
+}
+
+static bool test_in_order(void)
+{
+	struct xlation first, last;
+	bool success = true;
+
+	if (init_frag(&first, 1, 0, true))
+		return false;
+	if (init_frag(&last, 1, 64, false))
+		goto end;
+
+	fragdb_add(&first);
+	success &= ASSERT_PTR(NULL, fragdb_pop(&first), "nothing held");
+
+	success &= ASSERT_INT(VERDICT_CONTINUE, fragdb_find(&last), "find");
+	success &= ASSERT_UINT(5000, last.in.tuple.src.addr4.l4, "src port");
+	success &= ASSERT_UINT(53, last.in.tuple.dst.addr4.l4, "dst port");
+
+	kfree_skb(last.in.skb);
+end:	kfree_skb(first.in.skb);
+	return success;
+}
+
+static bool test_out_of_order(void)
+{
+	struct xlation first, early, stranger;
+	struct sk_buff *popped;
+	bool success = true;
+
+	if (init_frag(&early, 2, 64, false))
+		return false;
+	if (init_frag(&stranger, 3, 64, false)) {
+		kfree_skb(early.in.skb);
+		return false;
+	}
+	if (init_frag(&first, 2, 0, true)) {
+		kfree_skb(early.in.skb);
+		kfree_skb(stranger.in.skb);
+		return false;
+	}
+
+	/* From now on, fragdb owns the held skbs. */
+	success &= ASSERT_INT(VERDICT_STOLEN, fragdb_find(&early), "early");
+	success &= ASSERT_INT(VERDICT_STOLEN, fragdb_find(&stranger),
+			"stranger");
+
+	fragdb_add(&first);
+	popped = fragdb_pop(&first);
+	success &= ASSERT_PTR(early.in.skb, popped, "early pop");
+	/* The stranger belongs to some other datagram. */
+	success &= ASSERT_PTR(NULL, fragdb_pop(&first), "second pop");
+
+	if (popped)
+		kfree_skb(popped);
+	kfree_skb(first.in.skb);
+	return success;
+}
+
+static bool test_bounded(void)
+{
+	struct xlation state;
+	struct frag_held *held;
+	unsigned int i;
+	bool success = true;
+
+	/* None of these have first fragments; the oldest keep making room. */
+	for (i = 0; i < 2 * FRAGDB_HELD; i++) {
+		if (init_frag(&state, 100 + i, 64, false))
+			return false;
+		success &= ASSERT_INT(VERDICT_STOLEN, fragdb_find(&state),
+				"hold %u", i);
+	}
+
+	held = this_cpu_ptr(jool.nat64.fragdb->cache)->held;
+	for (i = 0; i < FRAGDB_HELD; i++)
+		success &= ASSERT_BOOL(true, held[i].skb != NULL, "slot %u", i);
+
+	return success;
+}
+
+/* The caches are per-CPU, so the tests have to stay on one CPU. */
+static bool run(bool (*test)(void))
+{
+	bool success;
+
+	local_bh_disable();
+	success = test();
+	local_bh_enable();
+
+	return success;
+}
+
+static bool in_order(void)
+{
+	return run(test_in_order);
+}
+
+static bool out_of_order(void)
+{
+	return run(test_out_of_order);
+}
+
+static bool bounded(void)
+{
+	return run(test_bounded);
+}
+
+static int fragdb_test_init(void)
+{
+	struct test_group test = {
+		.name = "Fragment cache",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, in_order, "In order");
+	test_group_test(&test, out_of_order, "Out of order");
+	test_group_test(&test, bounded, "Bounded hold queue");
+
+	return test_group_end(&test);
+}
+
+static void fragdb_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(fragdb_test_init);
+module_exit(fragdb_test_exit);
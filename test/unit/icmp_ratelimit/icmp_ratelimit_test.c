@@ -0,0 +1,144 @@
+#include <linux/module.h>
+
+#include "framework/unit_test.h"
+#include "mod/common/icmp_ratelimit.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("ICMP error rate limiter module test");
+
+static struct xlator jool;
+
+static int init(void)
+{
+	memset(&jool, 0, sizeof(jool));
+	jool.icmp_ratelimit = icmp_ratelimit_alloc();
+	return jool.icmp_ratelimit ? 0 : -ENOMEM;
+}
+
+static void clean(void)
+{
+	icmp_ratelimit_put(jool.icmp_ratelimit);
+}
+
+static __be32 addr4(__u32 addr)
+{
+	return cpu_to_be32(addr);
+}
+
+/*
+ * Note: The tests assume they run in less than a second. Otherwise the buckets
+ * refill.
+ */
+
+static bool test_unlimited(void)
+{
+	unsigned int i;
+	bool success = true;
+
+	jool.globals.icmp_error_rate = 0;
+	jool.globals.icmp_error_source_rate = 0;
+
+	for (i = 0; i < 100; i++)
+		success &= ASSERT_BOOL(true, icmp_ratelimit_allow4(&jool,
+				addr4(0xc0000201)), "error %u", i);
+
+	return success;
+}
+
+static bool test_source(void)
+{
+	struct in6_addr addr6 = { .s6_addr32 = { cpu_to_be32(0x20010db8) } };
+	bool success = true;
+
+	jool.globals.icmp_error_rate = 0;
+	jool.globals.icmp_error_source_rate = 2;
+
+	/* 192.0.2.1 and 192.0.2.2 share a /24. */
+	success &= ASSERT_BOOL(true, icmp_ratelimit_allow4(&jool, addr4(0xc0000201)),
+			"1st");
+	success &= ASSERT_BOOL(true, icmp_ratelimit_allow4(&jool, addr4(0xc0000202)),
+			"2nd");
+	success &= ASSERT_BOOL(false, icmp_ratelimit_allow4(&jool, addr4(0xc0000201)),
+			"3rd");
+
+	/* Different /24. */
+	success &= ASSERT_BOOL(true, icmp_ratelimit_allow4(&jool, addr4(0xc6336401)),
+			"other /24");
+	/* 2001:db8:: can't be mistaken for any IPv4 /24. */
+	success &= ASSERT_BOOL(true, icmp_ratelimit_allow6(&jool, &addr6),
+			"/64");
+
+	return success;
+}
+
+static bool test_instance(void)
+{
+	struct in6_addr addr6 = { .s6_addr32 = { cpu_to_be32(0x20010db8) } };
+	bool success = true;
+
+	jool.globals.icmp_error_rate = 2;
+	jool.globals.icmp_error_source_rate = 0;
+
+	success &= ASSERT_BOOL(true, icmp_ratelimit_allow4(&jool, addr4(0xcb007101)),
+			"1st");
+	success &= ASSERT_BOOL(true, icmp_ratelimit_allow6(&jool, &addr6),
+			"2nd");
+	success &= ASSERT_BOOL(false, icmp_ratelimit_allow4(&jool, addr4(0xc6336401)),
+			"3rd");
+
+	return success;
+}
+
+/* The buckets are per-CPU, so the tests have to stay on one CPU. */
+static bool run(bool (*test)(void))
+{
+	bool success;
+
+	local_bh_disable();
+	success = test();
+	local_bh_enable();
+
+	return success;
+}
+
+static bool unlimited(void)
+{
+	return run(test_unlimited);
+}
+
+static bool source(void)
+{
+	return run(test_source);
+}
+
+static bool instance(void)
+{
+	return run(test_instance);
+}
+
+static int icmp_ratelimit_test_init(void)
+{
+	struct test_group test = {
+		.name = "ICMP error rate limiter",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, unlimited, "Unlimited");
+	test_group_test(&test, source, "Per source");
+	test_group_test(&test, instance, "Per instance");
+
+	return test_group_end(&test);
+}
+
+static void icmp_ratelimit_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(icmp_ratelimit_test_init);
+module_exit(icmp_ratelimit_test_exit);
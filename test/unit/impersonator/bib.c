@@ -1,3 +1,4 @@
+#include "mod/common/natlog.h"
 #include "mod/common/db/pool4/db.h"
 #include "mod/common/db/bib/pkt_queue.h"
 #include "framework/unit_test.h"
@@ -13,6 +14,19 @@ int mask_domain_next(struct mask_domain *masks,
 	return broken_unit_call(__func__);
 }
 
+int mask_domain_skip(struct mask_domain *masks,
+		struct ipv4_transport_addr *addr,
+		unsigned int port)
+{
+	return broken_unit_call(__func__);
+}
+
+bool mask_domain_set_occupancy(struct mask_domain *masks, unsigned int used)
+{
+	broken_unit_call(__func__);
+	return false;
+}
+
 void mask_domain_commit(struct mask_domain *masks)
 {
 	broken_unit_call(__func__);
@@ -25,6 +39,12 @@ bool mask_domain_matches(struct mask_domain *masks,
 	return false;
 }
 
+int mask_domain_foreach_range(struct mask_domain *masks,
+		mask_domain_range_cb cb, void *arg)
+{
+	return broken_unit_call(__func__);
+}
+
 bool mask_domain_is_dynamic(struct mask_domain *masks)
 {
 	return false;
@@ -35,6 +55,16 @@ __u32 mask_domain_get_mark(struct mask_domain *masks)
 	return 0;
 }
 
+bool pool4db_is_empty(struct pool4 *pool)
+{
+	return false;
+}
+
+unsigned int pool4db_taddr_count(struct pool4 *pool, l4_protocol proto)
+{
+	return 0;
+}
+
 struct pktqueue *pktqueue_alloc(void)
 {
 	return (struct pktqueue *)&dummy;
@@ -46,14 +76,16 @@ void pktqueue_release(struct pktqueue *queue)
 }
 
 int pktqueue_add(struct pktqueue *queue, struct packet *pkt,
-		struct ipv6_transport_addr *dst6, bool too_many)
+		struct ipv6_transport_addr *dst6, bool too_many,
+		unsigned int src_max)
 {
 	return broken_unit_call(__func__);
 }
 
-void pktqueue_rm(struct pktqueue *queue, struct ipv4_transport_addr *src4)
+unsigned int pktqueue_rm(struct pktqueue *queue,
+		struct ipv4_transport_addr *src4)
 {
-	/* No code. */
+	return 0;
 }
 
 struct pktqueue_session *pktqueue_find(struct pktqueue *queue,
@@ -79,3 +111,17 @@ void pktqueue_clean(struct list_head *probes)
 {
 	broken_unit_call(__func__);
 }
+
+void natlog_add(struct xlator *jool, struct ipv6_transport_addr const *src6,
+		struct ipv4_transport_addr const *src4, l4_protocol proto,
+		enum natlog_event event)
+{
+	/* No code. */
+}
+
+void natlog_add_block(struct xlator *jool, struct in6_addr const *src6,
+		struct in_addr const *src4, __u16 min, __u16 max,
+		l4_protocol proto, enum natlog_event event)
+{
+	/* No code. */
+}
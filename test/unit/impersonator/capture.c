@@ -0,0 +1,41 @@
+#include "mod/common/capture.h"
+
+/**
+ * @file
+ * The packet capture, minus the Netlink multicasts. The tests never enable it.
+ */
+
+static struct capture {
+	int junk;
+} phony;
+
+struct capture *capture_alloc(void)
+{
+	return &phony;
+}
+
+void capture_get(struct capture *capture)
+{
+	/* No code. */
+}
+
+void capture_put(struct capture *capture)
+{
+	/* No code. */
+}
+
+int capture_prepare(struct xlator *jool)
+{
+	return 0;
+}
+
+bool __capture_sample(struct capture *capture, __u32 rate)
+{
+	return false;
+}
+
+void capture_pkt(struct xlator *jool, struct sk_buff *skb,
+		enum capture_direction direction)
+{
+	/* No code. */
+}
@@ -1,4 +1,8 @@
+#include "mod/common/init.h"
 #include "mod/common/joold.h"
+#include "mod/common/natlog.h"
+#include "mod/common/db/fragdb.h"
+#include "mod/common/db/talkers.h"
 #include "mod/common/db/pool4/db.h"
 #include "mod/common/db/bib/db.h"
 #include "mod/common/steps/compute_outgoing_tuple.h"
@@ -53,6 +57,76 @@ void joold_put(struct joold_queue *queue)
 	fail(__func__);
 }
 
+struct natlog *natlog_alloc(void)
+{
+	fail(__func__);
+	return NULL;
+}
+
+void natlog_get(struct natlog *log)
+{
+	fail(__func__);
+}
+
+void natlog_put(struct natlog *log)
+{
+	fail(__func__);
+}
+
+bool __natlog_latency_sample(struct natlog *log, __u32 rate)
+{
+	fail(__func__);
+	return false;
+}
+
+void natlog_add_latency(struct xlation *state, verdict result)
+{
+	fail(__func__);
+}
+
+struct fragdb *fragdb_alloc(void)
+{
+	fail(__func__);
+	return NULL;
+}
+
+void fragdb_get(struct fragdb *db)
+{
+	fail(__func__);
+}
+
+void fragdb_put(struct fragdb *db)
+{
+	fail(__func__);
+}
+
+void fragdb_add(struct xlation *state)
+{
+	fail(__func__);
+}
+
+struct sk_buff *fragdb_pop(struct xlation *state)
+{
+	fail(__func__);
+	return NULL;
+}
+
+struct talkers *talkers_alloc(void)
+{
+	fail(__func__);
+	return NULL;
+}
+
+void talkers_get(struct talkers *talkers)
+{
+	fail(__func__);
+}
+
+void talkers_put(struct talkers *talkers)
+{
+	fail(__func__);
+}
+
 struct pool4 *pool4db_alloc(void)
 {
 	fail(__func__);
@@ -96,3 +170,13 @@ verdict handling_hairpinning_nat64(struct xlation *old)
 	fail(__func__);
 	return VERDICT_DROP;
 }
+
+int jool_nat64_machinery_get(void)
+{
+	return fail(__func__);
+}
+
+void jool_nat64_machinery_put(void)
+{
+	fail(__func__);
+}
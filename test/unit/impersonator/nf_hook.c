@@ -11,3 +11,9 @@ unsigned int hook_ipv4(void *priv, struct sk_buff *skb,
 {
 	return NF_ACCEPT;
 }
+
+unsigned int hook_ingress(void *priv, struct sk_buff *skb,
+		const struct nf_hook_state *nhs)
+{
+	return NF_ACCEPT;
+}
@@ -1,9 +1,45 @@
 #include "mod/common/route.h"
 
+#include <linux/kref.h>
 #include "mod/common/dev.h"
 #include "mod/common/log.h"
+#include "mod/common/wkmalloc.h"
 #include "framework/unit_test.h"
 
+struct route_cache {
+	struct kref refs;
+};
+
+struct route_cache *route_cache_alloc(void)
+{
+	struct route_cache *result;
+
+	result = wkmalloc(struct route_cache, GFP_KERNEL);
+	if (result)
+		kref_init(&result->refs);
+	return result;
+}
+
+void route_cache_get(struct route_cache *cache)
+{
+	kref_get(&cache->refs);
+}
+
+static void route_cache_release(struct kref *refs)
+{
+	wkfree(struct route_cache, container_of(refs, struct route_cache, refs));
+}
+
+void route_cache_put(struct route_cache *cache)
+{
+	kref_put(&cache->refs, route_cache_release);
+}
+
+void route_next_hops_sync(struct xlator *jool, struct net_device *gone)
+{
+	/* Nothing to resolve; route4() and route6() never route. */
+}
+
 struct dst_entry *route4(struct xlator *jool, struct flowi4 *flow)
 {
 	log_debug(jool, "Pretending I'm routing an IPv4 packet.");
@@ -33,3 +33,31 @@ void jstat_add(struct jool_stats *stats, enum jool_stat_id stat, int addend)
 {
 	/* No code. */
 }
+
+void jstat_flush(struct jool_stats *stats, __u16 const *ids,
+		unsigned int count, enum jool_stat_id bytes_id,
+		unsigned int bytes)
+{
+	/* No code. */
+}
+
+void jstat_set(struct jool_stats *stats, enum jool_stat_id stat, __u64 value)
+{
+	/* No code. */
+}
+
+DEFINE_STATIC_KEY_FALSE(jstat_latency_key);
+
+void __jlat_stop(struct jool_stats *stats, enum jool_latency_dir dir,
+		enum jool_latency_stage stage, u64 start)
+{
+	/* No code. */
+}
+
+DEFINE_STATIC_KEY_FALSE(jstat_lifetime_key);
+
+void jlife_record(struct jool_stats *stats, enum jool_lifetime_metric metric,
+		enum jool_lifetime_class class, unsigned long duration)
+{
+	/* No code. */
+}
@@ -1,5 +1,6 @@
 #include "mod/common/xlator.h"
 
+#include "mod/common/address.h"
 #include "mod/common/db/global.h"
 #include "mod/common/db/bib/db.h"
 
@@ -21,12 +22,24 @@ int xlator_init(struct xlator *jool, struct net *ns, char *iname,
 	error = globals_init(&jool->globals, XT_NAT64, pool6);
 	if (error)
 		return error;
+	xlator_sync_fast(jool);
 	jool->nat64.bib = bib_alloc();
 
 	return jool->nat64.bib ? 0 : -ENOMEM;
 }
 
+void xlator_get(struct xlator *jool)
+{
+	bib_get(jool->nat64.bib);
+}
+
 void xlator_put(struct xlator *jool)
 {
 	bib_put(jool->nat64.bib);
 }
+
+int xlator_pool6_find(struct xlator const *jool, struct in6_addr const *addr)
+{
+	/* The BIB tests don't use pool6-tenants. */
+	return prefix6_contains(&jool->fast.pool6, addr) ? 0 : -ESRCH;
+}
@@ -14,11 +14,12 @@ static struct session_entry ss[9];
 
 /********************** Mocks **********************/
 
-struct sk_buff *sent;
+/* Packets sent, oldest first. */
+static struct sk_buff_head sent;
 
 void sendpkt_multicast(struct xlator *jool, struct sk_buff *skb)
 {
-	sent = skb;
+	skb_queue_tail(&sent, skb);
 }
 
 static struct genl_family family_mock = {
@@ -46,7 +47,17 @@ int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 	if (proto != L4PROTO_TCP)
 		return 0;
 
-	for (s = foreach_start; s < foreach_end; s++) {
+	s = foreach_start;
+	if (offset) {
+		for (; s < foreach_end; s++)
+			if (taddr4_equals(&offset->offset.src, &ss[s].src4) &&
+			    taddr4_equals(&offset->offset.dst, &ss[s].dst4))
+				break;
+		if (s < foreach_end && !offset->include_offset)
+			s++;
+	}
+
+	for (; s < foreach_end; s++) {
 		error = cb(&ss[s], cb_arg);
 		if (error)
 			return error;
@@ -55,9 +66,40 @@ int bib_foreach_session(struct xlator *jool, l4_protocol proto,
 	return 0;
 }
 
-int bib_add_session(struct xlator *jool,
-		struct session_entry *session,
-		struct collision_cb *cb)
+/* The tests only use the Netlink transport. (No UDP, no ring.) */
+int joold_udp_start(struct xlator *jool, struct joold_udp_cfg *cfg,
+		struct joold_udp **result)
+{
+	return -EINVAL;
+}
+
+void joold_udp_stop(struct joold_udp *udp)
+{
+	/* Empty */
+}
+
+int joold_udp_send(struct joold_udp *udp, void *data, size_t len)
+{
+	return -EINVAL;
+}
+
+void *joold_ring_reserve(struct joold_ring *ring, size_t len)
+{
+	return NULL;
+}
+
+void joold_ring_commit(struct joold_ring *ring)
+{
+	/* Empty */
+}
+
+void joold_ring_wake(struct joold_ring *ring)
+{
+	/* Empty */
+}
+
+int bib_sync(struct xlator *jool, struct session_entry *sessions,
+		unsigned int count, bib_sync_cb cb, void *arg)
 {
 	return -EINVAL;
 }
@@ -117,12 +159,35 @@ static struct joold_queue *init_xlator(struct xlator *jool)
 	jool->globals.nat64.joold.flush_deadline = 2000;
 	jool->globals.nat64.joold.capacity = 4;
 	jool->globals.nat64.joold.max_sessions_per_pkt = 3;
+	jool->globals.nat64.joold.max_outstanding = 1;
+	jool->globals.nat64.joold.sync_tcp = true;
+	jool->globals.nat64.joold.sync_udp = true;
+	jool->globals.nat64.joold.sync_icmp = true;
+	jool->globals.nat64.joold.min_age = 0;
+	jool->globals.nat64.joold.established_only = false;
+	jool->globals.nat64.joold.flush_window = 0;
+	jool->globals.pool6.set = true;
+	jool->globals.pool6.prefix.addr.s6_addr32[0] = cpu_to_be32(0x0064ff9b);
+	jool->globals.pool6.prefix.addr.s6_addr32[1] = 0;
+	jool->globals.pool6.prefix.addr.s6_addr32[2] = 0;
+	jool->globals.pool6.prefix.addr.s6_addr32[3] = 0;
+	jool->globals.pool6.prefix.len = 96;
 	jool->nat64.joold = joold_alloc();
 	return jool->nat64.joold;
 }
 
 /********************** Asserts **********************/
 
+static bool assert_queue(struct joold_queue *joold, unsigned int flags,
+		unsigned int outstanding, char *name)
+{
+	bool success = true;
+	success &= ASSERT_UINT(flags, joold->flags, "%s flags", name);
+	success &= ASSERT_UINT(outstanding, joold->outstanding,
+			"%s outstanding", name);
+	return success;
+}
+
 static bool assert_deferred(struct joold_queue *joold, ...)
 {
 	struct session_entry *expected;
@@ -160,11 +225,31 @@ end:	va_end(args);
 	return success;
 }
 
+struct batch_sessions {
+	struct session_entry sessions[8];
+	unsigned int count;
+};
+
+static int collect_session(struct session_entry *session, void *arg)
+{
+	struct batch_sessions *batch = arg;
+
+	if (batch->count >= ARRAY_SIZE(batch->sessions))
+		return -ENOSPC;
+
+	batch->sessions[batch->count++] = *session;
+	return 0;
+}
+
 static bool assert_skb(int garbage, ...)
 {
-	struct session_entry *expected, actual;
+	struct session_entry *expected;
+	struct sk_buff *skb;
+	struct batch_sessions actual;
 	struct nlattr *root, *attr;
 	struct bib_config bibcfg;
+	struct ipv6_prefix pool6;
+	unsigned int i;
 	int rem;
 	va_list args;
 	bool success;
@@ -174,14 +259,17 @@ static bool assert_skb(int garbage, ...)
 	expected = va_arg(args, struct session_entry *);
 	va_end(args);
 
+	skb = skb_dequeue(&sent);
 	if (expected != NULL) {
-		if (!ASSERT_NOTNULL(sent, "skb was sent"))
+		if (!ASSERT_NOTNULL(skb, "skb was sent"))
 			return false;
 	} else {
-		return ASSERT_NULL(sent, "skb was not sent");
+		success = ASSERT_NULL(skb, "skb was not sent");
+		kfree_skb(skb);
+		return success;
 	}
 
-	root = nlmsg_attrdata(nlmsg_hdr(sent), GENL_HDRLEN + JOOLNL_HDRLEN);
+	root = nlmsg_attrdata(nlmsg_hdr(skb), GENL_HDRLEN + JOOLNL_HDRLEN);
 	success = ASSERT_UINT(JNLAR_SESSION_ENTRIES, nla_type(root), "root");
 
 	memset(&bibcfg, 0, sizeof(bibcfg));
@@ -190,24 +278,36 @@ static bool assert_skb(int garbage, ...)
 	bibcfg.ttl.udp = 1000 * UDP_DEFAULT;
 	bibcfg.ttl.icmp = 1000 * ICMP_DEFAULT;
 
-	va_start(args, garbage);
+	memset(&pool6, 0, sizeof(pool6));
+	pool6.addr.s6_addr32[0] = cpu_to_be32(0x0064ff9b);
+	pool6.len = 96;
 
+	actual.count = 0;
 	nla_for_each_nested(attr, root, rem) {
-		error = jnla_get_session_joold(attr, "session", &bibcfg, &actual);
+		success &= ASSERT_UINT(JNLAL_SESSION_BATCH, nla_type(attr),
+				"batch type");
+		error = jnla_get_session_batch(attr, &bibcfg, &pool6,
+				collect_session, &actual);
 		if (error) {
-			log_err("jnla_get_session: errcode %d", error);
+			log_err("jnla_get_session_batch: errcode %d", error);
 			success = false;
 			goto end;
 		}
+	}
 
+	va_start(args, garbage);
+
+	for (i = 0; i < actual.count; i++) {
 		expected = va_arg(args, struct session_entry *);
 		if (!expected) {
-			log_err("Unexpected pkt session: " SEPP, SEPA(&actual));
+			log_err("Unexpected pkt session: " SEPP,
+					SEPA(&actual.sessions[i]));
 			success = false;
-			goto end;
+			goto end_args;
 		}
 
-		success &= ASSERT_SESSION(expected, &actual, "packet'd");
+		success &= ASSERT_SESSION(expected, &actual.sessions[i],
+				"packet'd");
 	}
 
 	expected = va_arg(args, struct session_entry *);
@@ -216,9 +316,9 @@ static bool assert_skb(int garbage, ...)
 		success = false;
 	}
 
-end:	va_end(args);
-	kfree_skb(sent);
-	sent = NULL;
+end_args:
+	va_end(args);
+end:	kfree_skb(skb);
 	return success;
 }
 
@@ -230,10 +330,8 @@ static bool print_sizes(void)
 	struct sk_buff *skb;
 	struct joolnlhdr *jhdr;
 	struct nlattr *root;
-	struct session_entry dummy_session;
 	size_t basic_size; /* NL header + GNL header + Jool header */
-	size_t root_size;
-	size_t session_size;
+	size_t root_size; /* Both attribute headers + batch header */
 
 	skb = genlmsg_new(1000, GFP_ATOMIC);
 	if (!skb)
@@ -249,17 +347,19 @@ static bool print_sizes(void)
 	if (WARN(!root, "nla_nest_start() returned NULL"))
 		goto end;
 
-	root_size = skb->len - basic_size;
-
-	memset(&dummy_session, 0, sizeof(dummy_session));
-	if (jnla_put_session_joold(skb, JNLAL_ENTRY, &dummy_session) != 0)
+	if (!nla_reserve(skb, JNLAL_SESSION_BATCH,
+			jnla_session_batch_size(0, false)))
 		goto end;
 
-	session_size = skb->len - basic_size - root_size;
+	root_size = skb->len - basic_size;
 
 	log_info("Kernel headers size: %zu", basic_size);
 	log_info("Netlink attribute header size: %zu", root_size);
-	log_info("Serialized session size: %zu", session_size);
+	log_info("Serialized session size: %zu (%zu with dst6 elided)",
+			jnla_session_batch_size(1, false)
+			- jnla_session_batch_size(0, false),
+			jnla_session_batch_size(1, true)
+			- jnla_session_batch_size(0, true));
 
 end:	kfree_skb(skb);
 	return true;
@@ -277,7 +377,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("1");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags1");
+	success &= assert_queue(joold, 0, 0, "flags1");
 	success &= assert_deferred(joold, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -285,7 +385,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("2");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags2");
+	success &= assert_queue(joold, 0, 0, "flags2");
 	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -293,7 +393,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("3");
 	joold_add(&jool, &ss[2]);
-	success &= ASSERT_UINT(0, joold->flags, "flags3");
+	success &= assert_queue(joold, 0, 1, "flags3");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
@@ -303,7 +403,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("4");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags1");
+	success &= assert_queue(joold, 0, 1, "flags1");
 	success &= assert_deferred(joold, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -311,7 +411,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("5");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(0, joold->flags, "flags2");
+	success &= assert_queue(joold, 0, 1, "flags2");
 	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -319,7 +419,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("6");
 	joold_add(&jool, &ss[2]);
-	success &= ASSERT_UINT(0, joold->flags, "flags3");
+	success &= assert_queue(joold, 0, 1, "flags3");
 	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -327,7 +427,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("7");
 	joold_add(&jool, &ss[3]);
-	success &= ASSERT_UINT(0, joold->flags, "flags4");
+	success &= assert_queue(joold, 0, 1, "flags4");
 	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -336,7 +436,7 @@ static bool test_no_flush_asap(void)
 	/* Capacity exceeded; drop new session */
 	log_info("8");
 	joold_add(&jool, &ss[4]);
-	success &= ASSERT_UINT(0, joold->flags, "flags5");
+	success &= assert_queue(joold, 0, 1, "flags5");
 	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -345,7 +445,7 @@ static bool test_no_flush_asap(void)
 	/* ACK */
 	log_info("9");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags6");
+	success &= assert_queue(joold, 0, 1, "flags6");
 	success &= assert_deferred(joold, &ss[3], NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
@@ -354,7 +454,7 @@ static bool test_no_flush_asap(void)
 	/* ACK again */
 	log_info("10");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags7");
+	success &= assert_queue(joold, 0, 0, "flags7");
 	success &= assert_deferred(joold, &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -363,7 +463,7 @@ static bool test_no_flush_asap(void)
 	/* Refill; make sure we're still stable after the ACK */
 	log_info("11");
 	joold_add(&jool, &ss[4]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags8");
+	success &= assert_queue(joold, 0, 0, "flags8");
 	success &= assert_deferred(joold, &ss[3], &ss[4], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -371,7 +471,7 @@ static bool test_no_flush_asap(void)
 
 	log_info("12");
 	joold_add(&jool, &ss[5]);
-	success &= ASSERT_UINT(0, joold->flags, "flags9");
+	success &= assert_queue(joold, 0, 1, "flags9");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
 	if (!success)
@@ -380,7 +480,7 @@ static bool test_no_flush_asap(void)
 	/* Try an ACK on an empty joold */
 	log_info("13");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags10");
+	success &= assert_queue(joold, 0, 0, "flags10");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 
@@ -388,6 +488,141 @@ end:	joold_put(joold);
 	return success;
 }
 
+/* Updates of sessions that are still queued should replace the old ones. */
+static bool test_coalesce(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	struct session_entry updated;
+	struct deferred_session *queued;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+
+	/* Fill the window, so the next sessions have to wait. */
+	joold_add(&jool, &ss[0]);
+	joold_add(&jool, &ss[1]);
+	joold_add(&jool, &ss[2]);
+	success &= assert_queue(joold, 0, 1, "flags1");
+	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	if (!success)
+		goto end;
+
+	joold_add(&jool, &ss[3]);
+	joold_add(&jool, &ss[4]);
+	updated = ss[3];
+	updated.state = ESTABLISHED;
+	joold_add(&jool, &updated);
+	success &= assert_queue(joold, 0, 1, "flags2");
+	success &= assert_deferred(joold, &ss[3], &ss[4], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	queued = list_first_entry(&joold->deferred.list,
+			struct deferred_session, lh);
+	success &= ASSERT_UINT(ESTABLISHED, queued->session.state, "state");
+
+	/* Sent sessions are no longer coalescing candidates. */
+	joold_add(&jool, &ss[5]);
+	joold_ack(&jool);
+	success &= assert_queue(joold, 0, 1, "flags3");
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
+	if (!success)
+		goto end;
+
+	joold_add(&jool, &updated);
+	success &= assert_deferred(joold, &ss[3], NULL);
+
+end:	joold_put(joold);
+	return success;
+}
+
+static bool test_flush_window(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+	jool.globals.nat64.joold.flush_asap = true;
+	jool.globals.nat64.joold.flush_window = 1000;
+
+	/* ss-flush-asap yields to the window. */
+	joold_add(&jool, &ss[0]);
+	joold_add(&jool, &ss[1]);
+	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Full packets don't wait. */
+	joold_add(&jool, &ss[2]);
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	if (!success)
+		goto end;
+	joold_ack(&jool);
+
+	/* The window expires; the incomplete packet goes out. */
+	joold_add(&jool, &ss[3]);
+	success &= assert_skb(0, NULL);
+	request_window_flush(&jool);
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, &ss[3], NULL);
+	success &= ASSERT_BOOL(false,
+			test_bit(JQP_WINDOW_DUE, &joold->pending), "due");
+
+end:	joold_put(joold);
+	return success;
+}
+
+static bool test_policies(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	struct session_entry session;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+
+	/* Out of the window, so nothing gets sent. */
+	joold->outstanding = 1;
+
+	jool.globals.nat64.joold.sync_tcp = false;
+	joold_add(&jool, &ss[0]);
+	success &= assert_deferred(joold, NULL);
+	jool.globals.nat64.joold.sync_tcp = true;
+
+	jool.globals.nat64.joold.established_only = true;
+	session = ss[0];
+	session.state = V4_INIT;
+	joold_add(&jool, &session);
+	success &= assert_deferred(joold, NULL);
+	jool.globals.nat64.joold.established_only = false;
+
+	jool.globals.nat64.joold.min_age = 1000;
+	session = ss[0];
+	session.create_time = jiffies;
+	joold_add(&jool, &session);
+	success &= assert_deferred(joold, NULL);
+	session.create_time = jiffies - 2 * HZ;
+	joold_add(&jool, &session);
+	success &= assert_deferred(joold, &ss[0], NULL);
+
+	success &= assert_skb(0, NULL);
+
+	joold_put(joold);
+	return success;
+}
+
 static bool test_flush_asap(void)
 {
 	struct xlator jool;
@@ -402,7 +637,7 @@ static bool test_flush_asap(void)
 	/* Flush immediately */
 	log_info("1");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags1");
+	success &= assert_queue(joold, 0, 1, "flags1");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], NULL);
 	if (!success)
@@ -411,7 +646,7 @@ static bool test_flush_asap(void)
 	/* No ACK; postpone flush despite ss-flush-asap */
 	log_info("2");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(0, joold->flags, "flags2");
+	success &= assert_queue(joold, 0, 1, "flags2");
 	success &= assert_deferred(joold, &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -420,7 +655,7 @@ static bool test_flush_asap(void)
 	/* ACK; flush */
 	log_info("3");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags3");
+	success &= assert_queue(joold, 0, 1, "flags3");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[1], NULL);
 	if (!success)
@@ -429,7 +664,7 @@ static bool test_flush_asap(void)
 	/* Reach capacity */
 	log_info("4");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags4");
+	success &= assert_queue(joold, 0, 1, "flags4");
 	success &= assert_deferred(joold, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -437,7 +672,7 @@ static bool test_flush_asap(void)
 
 	log_info("5");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(0, joold->flags, "flags5");
+	success &= assert_queue(joold, 0, 1, "flags5");
 	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -445,7 +680,7 @@ static bool test_flush_asap(void)
 
 	log_info("6");
 	joold_add(&jool, &ss[2]);
-	success &= ASSERT_UINT(0, joold->flags, "flags6");
+	success &= assert_queue(joold, 0, 1, "flags6");
 	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -453,7 +688,7 @@ static bool test_flush_asap(void)
 
 	log_info("7");
 	joold_add(&jool, &ss[3]);
-	success &= ASSERT_UINT(0, joold->flags, "flags7");
+	success &= assert_queue(joold, 0, 1, "flags7");
 	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -462,7 +697,7 @@ static bool test_flush_asap(void)
 	/* Capacity reached; drop session */
 	log_info("8");
 	joold_add(&jool, &ss[4]);
-	success &= ASSERT_UINT(0, joold->flags, "flags8");
+	success &= assert_queue(joold, 0, 1, "flags8");
 	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -471,7 +706,7 @@ static bool test_flush_asap(void)
 	/* Again */
 	log_info("9");
 	joold_add(&jool, &ss[5]);
-	success &= ASSERT_UINT(0, joold->flags, "flags9");
+	success &= assert_queue(joold, 0, 1, "flags9");
 	success &= assert_deferred(joold, &ss[0], &ss[1], &ss[2], &ss[3], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -480,7 +715,7 @@ static bool test_flush_asap(void)
 	/* ACK, finally */
 	log_info("10");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags10");
+	success &= assert_queue(joold, 0, 1, "flags10");
 	success &= assert_deferred(joold, &ss[3], NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
@@ -489,7 +724,7 @@ static bool test_flush_asap(void)
 	/* Again */
 	log_info("11");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags11");
+	success &= assert_queue(joold, 0, 1, "flags11");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[3], NULL);
 	if (!success)
@@ -498,7 +733,7 @@ static bool test_flush_asap(void)
 	/* Again */
 	log_info("12");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags12");
+	success &= assert_queue(joold, 0, 0, "flags12");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -507,7 +742,7 @@ static bool test_flush_asap(void)
 	/* Flush, ACK, flush */
 	log_info("13");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags13");
+	success &= assert_queue(joold, 0, 1, "flags13");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], NULL);
 	if (!success)
@@ -515,7 +750,7 @@ static bool test_flush_asap(void)
 
 	log_info("14");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags14");
+	success &= assert_queue(joold, 0, 0, "flags14");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -523,7 +758,7 @@ static bool test_flush_asap(void)
 
 	log_info("15");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags15");
+	success &= assert_queue(joold, 0, 1, "flags15");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], NULL);
 
@@ -545,7 +780,7 @@ static bool test_advertise(void)
 	log_info("1");
 	foreach_end = 0;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags1");
+	success &= assert_queue(joold, 0, 0, "flags1");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -555,7 +790,7 @@ static bool test_advertise(void)
 	log_info("2");
 	foreach_end = 1;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags2");
+	success &= assert_queue(joold, 0, 1, "flags2");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], NULL);
 	if (!success)
@@ -564,8 +799,8 @@ static bool test_advertise(void)
 	/* Single session advertise, postponed because no ACK */
 	log_info("3");
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags3");
-	success &= assert_deferred(joold, &ss[0], NULL);
+	success &= assert_queue(joold, JQF_AD_ONGOING, 1, "flags3");
+	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
@@ -573,16 +808,16 @@ static bool test_advertise(void)
 	/* ACK */
 	log_info("4");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags4");
+	success &= assert_queue(joold, 0, 1, "flags4");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], NULL);
 	if (!success)
 		goto end;
 
-	/* Enable JQF_ACK_RECEIVED */
+	/* Return the credit */
 	log_info("5");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags5");
+	success &= assert_queue(joold, 0, 0, "flags5");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -592,16 +827,16 @@ static bool test_advertise(void)
 	log_info("6");
 	foreach_end = 3;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags6");
+	success &= assert_queue(joold, 0, 1, "flags6");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
 		goto end;
 
-	/* Enable JQF_ACK_RECEIVED */
+	/* Return the credit */
 	log_info("7");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags7");
+	success &= assert_queue(joold, 0, 0, "flags7");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -611,8 +846,8 @@ static bool test_advertise(void)
 	log_info("8");
 	foreach_end = 4;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags8");
-	success &= assert_deferred(joold, &ss[3], NULL);
+	success &= assert_queue(joold, JQF_AD_ONGOING, 1, "flags8");
+	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
 		goto end;
@@ -620,8 +855,8 @@ static bool test_advertise(void)
 	/* Make sure advertises don't stack */
 	log_info("9");
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags9");
-	success &= assert_deferred(joold, &ss[3], NULL);
+	success &= assert_queue(joold, JQF_AD_ONGOING, 1, "flags9");
+	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
@@ -629,16 +864,16 @@ static bool test_advertise(void)
 	/* Send 2nd packet */
 	log_info("10");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags10");
+	success &= assert_queue(joold, 0, 1, "flags10");
 	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[3], NULL);
 	if (!success)
 		goto end;
 
-	/* Large advertise, and joold isn't empty */
+	/* Large advertise, and joold isn't empty. Only the window is pulled. */
 	log_info("11");
 	joold_add(&jool, &ss[0]);
-	success &= ASSERT_UINT(0, joold->flags, "flags11");
+	success &= assert_queue(joold, 0, 1, "flags11");
 	success &= assert_deferred(joold, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -646,7 +881,7 @@ static bool test_advertise(void)
 
 	log_info("12");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags12");
+	success &= assert_queue(joold, 0, 0, "flags12");
 	success &= assert_deferred(joold, &ss[0], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -654,7 +889,7 @@ static bool test_advertise(void)
 
 	log_info("13");
 	joold_add(&jool, &ss[1]);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags13");
+	success &= assert_queue(joold, 0, 0, "flags13");
 	success &= assert_deferred(joold, &ss[0], &ss[1], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
@@ -664,42 +899,151 @@ static bool test_advertise(void)
 	foreach_start = 2;
 	foreach_end = 8;
 	joold_advertise(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags14");
-	success &= assert_deferred(joold, &ss[3], &ss[4], &ss[5], &ss[6],
-			&ss[7], NULL);
+	success &= assert_queue(joold, JQF_AD_ONGOING, 1, "flags14");
+	success &= assert_deferred(joold, NULL);
 	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
 	if (!success)
 		goto end;
 
 	log_info("15");
 	joold_add(&jool, &ss[8]);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags15");
-	success &= assert_deferred(joold, &ss[3], &ss[4], &ss[5], &ss[6],
-			&ss[7], &ss[8], NULL);
+	success &= assert_queue(joold, JQF_AD_ONGOING, 1, "flags15");
+	success &= assert_deferred(joold, &ss[8], NULL);
 	success &= assert_skb(0, NULL);
 	if (!success)
 		goto end;
 
 	log_info("16");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_AD_ONGOING, joold->flags, "flags16");
-	success &= assert_deferred(joold, &ss[6], &ss[7], &ss[8], NULL);
-	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
+	success &= assert_queue(joold, JQF_AD_ONGOING, 1, "flags16");
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, &ss[8], &ss[3], &ss[4], NULL);
 	if (!success)
 		goto end;
 
 	log_info("17");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(0, joold->flags, "flags17");
+	success &= assert_queue(joold, 0, 1, "flags17");
 	success &= assert_deferred(joold, NULL);
-	success &= assert_skb(0, &ss[6], &ss[7], &ss[8], NULL);
+	success &= assert_skb(0, &ss[5], &ss[6], &ss[7], NULL);
 	if (!success)
 		goto end;
 
 	log_info("18");
 	joold_ack(&jool);
-	success &= ASSERT_UINT(JQF_ACK_RECEIVED, joold->flags, "flags18");
+	success &= assert_queue(joold, 0, 0, "flags18");
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Cancel midway */
+	log_info("19");
+	foreach_start = 0;
+	joold_advertise(&jool);
+	success &= assert_queue(joold, JQF_AD_ONGOING, 1, "flags19");
+	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	if (!success)
+		goto end;
+
+	log_info("20");
+	success &= ASSERT_INT(0, joold_advertise_cancel(&jool), "cancel");
+	success &= assert_queue(joold, 0, 1, "flags20");
+	success &= ASSERT_INT(-EINVAL, joold_advertise_cancel(&jool),
+			"cancel again");
+	if (!success)
+		goto end;
+
+	log_info("21");
+	joold_ack(&jool);
+	success &= assert_queue(joold, 0, 0, "flags21");
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, NULL);
+
+end:	joold_put(joold);
+	return success;
+}
+
+static bool test_window(void)
+{
+	struct xlator jool;
+	struct joold_queue *joold;
+	bool success = true;
+
+	joold = init_xlator(&jool);
+	if (!joold)
+		return false;
+	jool.globals.nat64.joold.flush_asap = true;
+	jool.globals.nat64.joold.max_outstanding = 3;
+
+	/* Fill the window, one packet per session */
+	log_info("1");
+	joold_add(&jool, &ss[0]);
+	joold_add(&jool, &ss[1]);
+	joold_add(&jool, &ss[2]);
+	success &= assert_queue(joold, 0, 3, "flags1");
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, &ss[0], NULL);
+	success &= assert_skb(0, &ss[1], NULL);
+	success &= assert_skb(0, &ss[2], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Window is full; queue */
+	log_info("2");
+	joold_add(&jool, &ss[3]);
+	joold_add(&jool, &ss[4]);
+	joold_add(&jool, &ss[5]);
+	joold_add(&jool, &ss[6]);
+	success &= assert_queue(joold, 0, 3, "flags2");
+	success &= assert_deferred(joold, &ss[3], &ss[4], &ss[5], &ss[6], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Each ACK is worth one packet */
+	log_info("3");
+	joold_ack(&jool);
+	success &= assert_queue(joold, 0, 3, "flags3");
+	success &= assert_deferred(joold, &ss[6], NULL);
+	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	log_info("4");
+	joold_ack(&jool);
+	success &= assert_queue(joold, 0, 3, "flags4");
 	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, &ss[6], NULL);
+	success &= assert_skb(0, NULL);
+	if (!success)
+		goto end;
+
+	/* Drain the window */
+	log_info("5");
+	joold_ack(&jool);
+	joold_ack(&jool);
+	joold_ack(&jool);
+	success &= assert_queue(joold, 0, 0, "flags5");
+	success &= assert_skb(0, NULL);
+	/* Extra ACKs are harmless */
+	joold_ack(&jool);
+	success &= assert_queue(joold, 0, 0, "flags5b");
+	if (!success)
+		goto end;
+
+	/* A large advertise can use the whole window at once */
+	log_info("6");
+	foreach_start = 0;
+	foreach_end = 7;
+	joold_advertise(&jool);
+	success &= assert_queue(joold, 0, 3, "flags6");
+	success &= assert_deferred(joold, NULL);
+	success &= assert_skb(0, &ss[0], &ss[1], &ss[2], NULL);
+	success &= assert_skb(0, &ss[3], &ss[4], &ss[5], NULL);
+	success &= assert_skb(0, &ss[6], NULL);
 	success &= assert_skb(0, NULL);
 
 end:	joold_put(joold);
@@ -715,12 +1059,18 @@ int init_module(void)
 		.setup_fn = init_sessions,
 	};
 
+	skb_queue_head_init(&sent);
+
 	if (test_group_begin(&test))
 		return -EINVAL;
 	test_group_test(&test, print_sizes, "print sizes");
 	test_group_test(&test, test_no_flush_asap, "ss-flush-asap disabled");
 	test_group_test(&test, test_flush_asap, "ss-flush-asap enabled");
+	test_group_test(&test, test_coalesce, "update coalescing");
+	test_group_test(&test, test_flush_window, "ss-flush-window");
+	test_group_test(&test, test_policies, "sync policies");
 	test_group_test(&test, test_advertise, "advertise");
+	test_group_test(&test, test_window, "ss-max-outstanding");
 	return test_group_end(&test);
 }
 
@@ -91,6 +91,93 @@ static bool simple_test(void)
 	return validate("2001:db8::", 120, "192.0.2.0", 24);
 }
 
+static bool set_marks(char *iname, __u32 first, __u32 last)
+{
+	struct xlator jool;
+	int error;
+
+	error = xlator_find_current(iname, XF_NETFILTER | XT_SIIT, &jool);
+	if (error) {
+		log_info("xlator_find_current() threw %d", error);
+		return false;
+	}
+
+	jool.globals.netfilter_marks.set = true;
+	jool.globals.netfilter_marks.first = first;
+	jool.globals.netfilter_marks.last = last;
+	error = xlator_update_globals(&jool);
+
+	xlator_put(&jool);
+	return ASSERT_INT(0, error, "update %s", iname);
+}
+
+static bool assert_dispatch(__u32 mark, char *expected)
+{
+	struct xlator *jool;
+	int error;
+	bool success = true;
+
+	rcu_read_lock_bh();
+	error = xlator_find_netfilter(ns, mark, &jool);
+	if (expected) {
+		success &= ASSERT_INT(0, error, "mark %u result", mark);
+		if (!error)
+			success &= ASSERT_INT(0, strcmp(expected, jool->iname),
+					"mark %u instance", mark);
+	} else {
+		success &= ASSERT_INT(-ESRCH, error, "mark %u result", mark);
+	}
+	rcu_read_unlock_bh();
+
+	return success;
+}
+
+/*
+ * Several Netfilter instances in the same namespace, told apart by
+ * netfilter-marks.
+ */
+static bool dispatch_test(void)
+{
+	struct xlator jool;
+	bool success = true;
+
+	/* Two instances can't both take the unclaimed marks. */
+	success &= ASSERT_INT(-EEXIST, xlator_add(XF_NETFILTER | XT_SIIT,
+			"second", NULL, NULL), "second catch-all");
+
+	success &= set_marks(INAME_DEFAULT, 100, 199);
+	success &= ASSERT_INT(0, xlator_add(XF_NETFILTER | XT_SIIT, "second",
+			NULL, NULL), "second");
+	if (!success)
+		return false;
+
+	success &= assert_dispatch(99, "second");
+	success &= assert_dispatch(100, INAME_DEFAULT);
+	success &= assert_dispatch(199, INAME_DEFAULT);
+	success &= assert_dispatch(200, "second");
+
+	success &= set_marks("second", 150, 250);
+	success &= set_marks("second", 200, 299);
+	success &= assert_dispatch(99, NULL);
+	success &= assert_dispatch(150, INAME_DEFAULT);
+	success &= assert_dispatch(250, "second");
+	success &= assert_dispatch(300, NULL);
+
+	success &= ASSERT_INT(0, xlator_rm(XT_SIIT, "second"), "rm second");
+	success &= assert_dispatch(250, NULL);
+
+	/* Back to the catch-all, for the tests that follow. */
+	success &= ASSERT_INT(0, xlator_find_current(INAME_DEFAULT,
+			XF_NETFILTER | XT_SIIT, &jool), "find");
+	if (!success)
+		return false;
+	jool.globals.netfilter_marks.set = false;
+	success &= ASSERT_INT(0, xlator_update_globals(&jool), "restore");
+	xlator_put(&jool);
+
+	return success && assert_dispatch(250, INAME_DEFAULT);
+}
+
 /**
  * Superfluous test over the jparser. It's mostly just API manhandling so krefs
  * can be tested next.
@@ -145,7 +232,8 @@ static bool atomic_test(void)
 }
 
 /**
- * Test the previous test handled krefs correctly.
+ * Test the previous test handled krefs correctly. (xlator_update_globals()
+ * must not leave extra references behind, not even for a grace period.)
  */
 static bool krefs_test(void)
 {
@@ -276,6 +364,7 @@ int init_module(void)
 	}
 
 	test_group_test(&test, simple_test, "xlator API");
+	test_group_test(&test, dispatch_test, "Netfilter dispatch");
 	test_group_test(&test, krefs_test, "kfref checks 1");
 	test_group_test(&test, atomic_test, "atomic config API");
 	test_group_test(&test, krefs_test, "kfref checks 2");
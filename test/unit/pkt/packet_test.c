@@ -119,6 +119,75 @@ static bool test_inner_validation6(void)
 	return result;
 }
 
+static bool test_tuple4(void)
+{
+	static struct xlation state; /* Too large for the stack. */
+	static struct xlator jool; /* Too large for the stack. */
+	struct tuple expected;
+	struct sk_buff *skb;
+	bool result = true;
+
+	memset(&jool, 0, sizeof(jool));
+	jool.flags = XT_NAT64;
+	xlation_init(&state, &jool);
+
+	if (init_tuple4(&expected, "192.0.2.1", 5000, "198.51.100.1", 53,
+			L4PROTO_UDP))
+		return false;
+	if (create_skb4_udp("192.0.2.1", 5000, "198.51.100.1", 53, 100, 32,
+			&skb))
+		return false;
+	result &= ASSERT_VERDICT(CONTINUE, pkt_init_ipv4(&state, skb), "UDP");
+	result &= ASSERT_TUPLE(&expected, &state.in.tuple, "UDP tuple");
+	kfree_skb(skb);
+
+	if (init_tuple4(&expected, "192.0.2.2", 80, "192.0.2.128", 1024,
+			L4PROTO_TCP))
+		return false;
+	/* The inner packet is 192.0.2.128#1024 -> 192.0.2.2#80. */
+	if (create_skb4_icmp_error("1.1.1.1", "2.2.2.2", 100, 32, &skb))
+		return false;
+	result &= ASSERT_VERDICT(CONTINUE, pkt_init_ipv4(&state, skb), "error");
+	result &= ASSERT_TUPLE(&expected, &state.in.tuple, "error tuple");
+	kfree_skb(skb);
+
+	return result;
+}
+
+static bool test_tuple6(void)
+{
+	static struct xlation state; /* Too large for the stack. */
+	static struct xlator jool; /* Too large for the stack. */
+	struct tuple expected;
+	struct sk_buff *skb;
+	bool result = true;
+
+	memset(&jool, 0, sizeof(jool));
+	jool.flags = XT_NAT64;
+	xlation_init(&state, &jool);
+
+	if (init_tuple6(&expected, "1::1", 5000, "64::192.0.2.5", 53,
+			L4PROTO_UDP))
+		return false;
+	if (create_skb6_udp("1::1", 5000, "64::192.0.2.5", 53, 100, 32, &skb))
+		return false;
+	result &= ASSERT_VERDICT(CONTINUE, pkt_init_ipv6(&state, skb), "UDP");
+	result &= ASSERT_TUPLE(&expected, &state.in.tuple, "UDP tuple");
+	kfree_skb(skb);
+
+	if (init_tuple6(&expected, "64::192.0.2.5", 51234, "1::1", 50080,
+			L4PROTO_TCP))
+		return false;
+	/* The inner packet is 1::1#50080 -> 64::192.0.2.5#51234. */
+	if (create_skb6_icmp_error("1::1", "2::2", 100, 32, &skb))
+		return false;
+	result &= ASSERT_VERDICT(CONTINUE, pkt_init_ipv6(&state, skb), "error");
+	result &= ASSERT_TUPLE(&expected, &state.in.tuple, "error tuple");
+	kfree_skb(skb);
+
+	return result;
+}
+
 int init_module(void)
 {
 	struct test_group test = {
@@ -134,6 +203,8 @@ int init_module(void)
 
 	test_group_test(&test, test_inner_validation4, "Inner IPv4 pkt validation");
 	test_group_test(&test, test_inner_validation6, "Inner IPv6 pkt validation");
+	test_group_test(&test, test_tuple4, "IPv4 tuple summarization");
+	test_group_test(&test, test_tuple6, "IPv6 tuple summarization");
 
 	return test_group_end(&test);
 }
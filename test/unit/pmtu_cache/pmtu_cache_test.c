@@ -0,0 +1,116 @@
+#include <linux/module.h>
+
+#include "framework/unit_test.h"
+#include "mod/common/pmtu_cache.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Path MTU cache module test");
+
+static struct xlator jool;
+
+static int init(void)
+{
+	memset(&jool, 0, sizeof(jool));
+	jool.pmtu = pmtu_cache_alloc();
+	return jool.pmtu ? 0 : -ENOMEM;
+}
+
+static void clean(void)
+{
+	pmtu_cache_put(jool.pmtu);
+}
+
+static struct in6_addr addr6(__u32 a, __u32 b, __u32 c, __u32 d)
+{
+	struct in6_addr result;
+
+	result.s6_addr32[0] = cpu_to_be32(a);
+	result.s6_addr32[1] = cpu_to_be32(b);
+	result.s6_addr32[2] = cpu_to_be32(c);
+	result.s6_addr32[3] = cpu_to_be32(d);
+	return result;
+}
+
+static bool test_learn(void)
+{
+	struct in6_addr dst = addr6(0x20010db8, 0x00010000, 0, 1);
+	struct in6_addr neighbor = addr6(0x20010db8, 0x00010000, 0, 2);
+	struct in6_addr stranger = addr6(0x20010db8, 0x00020000, 0, 1);
+	bool success = true;
+
+	success &= ASSERT_UINT(1500, pmtu_cache_limit(&jool, &dst, 1500),
+			"unknown");
+
+	pmtu_cache_learn(&jool, &dst, 1400);
+	success &= ASSERT_UINT(1400, pmtu_cache_limit(&jool, &dst, 1500),
+			"learned");
+	success &= ASSERT_UINT(1300, pmtu_cache_limit(&jool, &dst, 1300),
+			"next hop is lower");
+	success &= ASSERT_UINT(1400, pmtu_cache_limit(&jool, &neighbor, 1500),
+			"same /64");
+	success &= ASSERT_UINT(1500, pmtu_cache_limit(&jool, &stranger, 1500),
+			"other /64");
+
+	/* PTBs only lower it. */
+	pmtu_cache_learn(&jool, &dst, 1450);
+	success &= ASSERT_UINT(1400, pmtu_cache_limit(&jool, &dst, 1500),
+			"higher report");
+	pmtu_cache_learn(&jool, &dst, 1350);
+	success &= ASSERT_UINT(1350, pmtu_cache_limit(&jool, &dst, 1500),
+			"lower report");
+
+	/* IPv6 can't go below 1280. */
+	pmtu_cache_learn(&jool, &dst, 576);
+	success &= ASSERT_UINT(1280, pmtu_cache_limit(&jool, &dst, 1500),
+			"illegal report");
+
+	return success;
+}
+
+static bool test_expiration(void)
+{
+	struct in6_addr dst = addr6(0x20010db8, 0x00030000, 0, 1);
+	struct pmtu_slot *slot = get_slot(jool.pmtu, prefix64(&dst));
+	bool success = true;
+
+	pmtu_cache_learn(&jool, &dst, 1400);
+	success &= ASSERT_UINT(1400, pmtu_cache_limit(&jool, &dst, 1500),
+			"fresh");
+
+	slot->expires = jiffies - 1;
+	success &= ASSERT_UINT(1500, pmtu_cache_limit(&jool, &dst, 1500),
+			"expired");
+
+	/* Expired entries don't hold new reports back. */
+	pmtu_cache_learn(&jool, &dst, 1450);
+	success &= ASSERT_UINT(1450, pmtu_cache_limit(&jool, &dst, 1500),
+			"relearned");
+
+	return success;
+}
+
+static int pmtu_cache_test_init(void)
+{
+	struct test_group test = {
+		.name = "Path MTU cache",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, test_learn, "Learn");
+	test_group_test(&test, test_expiration, "Expiration");
+
+	return test_group_end(&test);
+}
+
+static void pmtu_cache_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(pmtu_cache_test_init);
+module_exit(pmtu_cache_test_exit);
@@ -6,6 +6,11 @@ int rfc6056_f(struct xlation *state, unsigned int *result)
 	return broken_unit_call(__func__);
 }
 
+unsigned int rfc6056_ephemeral_seed(void const *owner, unsigned int cpu)
+{
+	return 0;
+}
+
 int __rfc6052_6to4(struct ipv6_prefix const *prefix, struct in6_addr const *src,
 		struct in_addr *dst)
 {
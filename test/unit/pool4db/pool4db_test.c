@@ -516,6 +516,382 @@ static bool test_flush(void)
 	return success;
 }
 
+static bool test_deterministic(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	struct mask_domain *masks;
+	struct ipv4_range *ranges;
+	struct ipv4_transport_addr addr;
+	bool consecutive;
+	bool success = true;
+
+	/* 200 ports, so 16 subscribers get 12 each. */
+	if (!add(0xc0000201U, 32, 1000, 1099)) /* 192.0.2.1 (1000-1099) */
+		return false;
+	if (!add(0xc0000202U, 32, 2000, 2099)) /* 192.0.2.2 (2000-2099) */
+		return false;
+
+	memset(&jool, 0, sizeof(jool));
+	jool.nat64.pool4 = pool;
+	jool.globals.nat64.deterministic_prefix.set = true;
+	if (str_to_addr6("2001:db8::",
+			&jool.globals.nat64.deterministic_prefix.prefix.addr))
+		return false;
+	jool.globals.nat64.deterministic_prefix.prefix.len = 56;
+	jool.globals.nat64.deterministic_len = 60;
+
+	memset(&state, 0, sizeof(state));
+	state.jool = &jool;
+	state.in.skb = alloc_skb(0, GFP_KERNEL);
+	if (!state.in.skb)
+		return false;
+	state.in.skb->mark = 1;
+	state.in.tuple.l4_proto = L4PROTO_TCP;
+
+	/* Subscriber 8 gets ports 96-107, which straddle both entries. */
+	if (str_to_addr6("2001:db8:0:80::1", &state.in.tuple.src.addr6.l3))
+		goto end;
+	success &= ASSERT_VERDICT(CONTINUE, mask_domain_find(&state, &masks),
+			"subscriber 8 find");
+	if (!success)
+		goto end;
+
+	ranges = masks->ranges;
+	success &= ASSERT_UINT(12, masks->taddr_count, "taddr count");
+	success &= ASSERT_UINT(2, masks->range_count, "range count");
+	success &= ASSERT_ADDR4("192.0.2.1", &ranges[0].prefix.addr, "r0 addr");
+	success &= ASSERT_UINT(1096, ranges[0].ports.min, "r0 min");
+	success &= ASSERT_UINT(1099, ranges[0].ports.max, "r0 max");
+	success &= ASSERT_ADDR4("192.0.2.2", &ranges[1].prefix.addr, "r1 addr");
+	success &= ASSERT_UINT(2000, ranges[1].ports.min, "r1 min");
+	success &= ASSERT_UINT(2007, ranges[1].ports.max, "r1 max");
+
+	/* The slice is iterated from its beginning. */
+	success &= ASSERT_INT(0, mask_domain_next(masks, &addr, &consecutive),
+			"next");
+	success &= ASSERT_UINT(1096, addr.l4, "first port");
+	mask_domain_put(masks);
+
+	/* The last subscriber. (Ports 180-191; the rest are leftovers.) */
+	if (str_to_addr6("2001:db8:0:f0::1", &state.in.tuple.src.addr6.l3))
+		goto end;
+	success &= ASSERT_VERDICT(CONTINUE, mask_domain_find(&state, &masks),
+			"subscriber 15 find");
+	if (!success)
+		goto end;
+
+	ranges = masks->ranges;
+	success &= ASSERT_UINT(1, masks->range_count, "range count 15");
+	success &= ASSERT_UINT(2080, ranges[0].ports.min, "r0 min 15");
+	success &= ASSERT_UINT(2091, ranges[0].ports.max, "r0 max 15");
+	mask_domain_put(masks);
+
+end:
+	kfree_skb(state.in.skb);
+	pool4db_flush(pool);
+	return success;
+}
+
+static bool test_snapshot(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	struct mask_domain *masks;
+	struct mask_domain *nested;
+	struct ipv4_transport_addr addr;
+	struct pool4_snapshot *old;
+	bool success = true;
+
+	/* 100 ports, so 16 subscribers get 6 each. */
+	if (!add(0xc0000201U, 32, 1000, 1099)) /* 192.0.2.1 (1000-1099) */
+		return false;
+
+	memset(&jool, 0, sizeof(jool));
+	jool.nat64.pool4 = pool;
+	jool.globals.nat64.deterministic_prefix.set = true;
+	if (str_to_addr6("2001:db8::",
+			&jool.globals.nat64.deterministic_prefix.prefix.addr))
+		return false;
+	jool.globals.nat64.deterministic_prefix.prefix.len = 56;
+	jool.globals.nat64.deterministic_len = 60;
+
+	memset(&state, 0, sizeof(state));
+	state.jool = &jool;
+	state.in.skb = alloc_skb(0, GFP_KERNEL);
+	if (!state.in.skb)
+		return false;
+	state.in.skb->mark = 1;
+	state.in.tuple.l4_proto = L4PROTO_TCP;
+	if (str_to_addr6("2001:db8::1", &state.in.tuple.src.addr6.l3))
+		goto end;
+
+	/* The add already published the snapshot. */
+	old = rcu_access_pointer(pool->snapshot);
+	success &= ASSERT_BOOL(true, old != NULL, "snapshot published");
+	success &= ASSERT_BOOL(false, pool->stale, "fresh snapshot");
+	success &= ASSERT_VERDICT(CONTINUE, mask_domain_find(&state, &masks),
+			"first find");
+	if (!success)
+		goto end;
+	success &= ASSERT_BOOL(true, masks->percpu, "CPU domain");
+	success &= ASSERT_UINT(6, masks->taddr_count, "first taddr count");
+	success &= ASSERT_UINT(1005, masks->ranges[0].ports.max, "first max");
+	mask_domain_put(masks);
+	success &= ASSERT_PTR(old, rcu_access_pointer(pool->snapshot),
+			"finds don't rebuild the snapshot");
+
+	/* pool4db_contains() reads the same snapshot. */
+	addr.l3.s_addr = cpu_to_be32(0xc0000201U);
+	addr.l4 = 1099;
+	success &= ASSERT_BOOL(true, pool4db_contains(pool, ns, L4PROTO_TCP,
+			&addr), "contains 192.0.2.1#1099");
+	addr.l4 = 1100;
+	success &= ASSERT_BOOL(false, pool4db_contains(pool, ns, L4PROTO_TCP,
+			&addr), "contains 192.0.2.1#1100");
+	addr.l3.s_addr = cpu_to_be32(0xc0000202U);
+	addr.l4 = 2000;
+	success &= ASSERT_BOOL(false, pool4db_contains(pool, ns, L4PROTO_TCP,
+			&addr), "contains 192.0.2.2#2000");
+
+	/* Changes replace the snapshot, and the next find sees them. */
+	if (!add(0xc0000202U, 32, 2000, 2099)) { /* 192.0.2.2 (2000-2099) */
+		success = false;
+		goto end;
+	}
+	success &= ASSERT_BOOL(true, rcu_access_pointer(pool->snapshot) != old,
+			"snapshot replaced");
+	success &= ASSERT_BOOL(true, pool4db_contains(pool, ns, L4PROTO_TCP,
+			&addr), "contains 192.0.2.2#2000 after the add");
+
+	/* A stale snapshot sends the exact lookups to the trees. */
+	pool->stale = true;
+	success &= ASSERT_BOOL(true, pool4db_contains(pool, ns, L4PROTO_TCP,
+			&addr), "stale contains 192.0.2.2#2000");
+	addr.l4 = 2100;
+	success &= ASSERT_BOOL(false, pool4db_contains(pool, ns, L4PROTO_TCP,
+			&addr), "stale contains 192.0.2.2#2100");
+	success &= ASSERT_BOOL(true, pool4db_may_contain(pool,
+			cpu_to_be32(0xc0000202U)), "stale may contain 192.0.2.2");
+	success &= ASSERT_BOOL(false, pool4db_may_contain(pool,
+			cpu_to_be32(0xc0000203U)), "stale may contain 192.0.2.3");
+	success &= ASSERT_UINT(200, pool4db_taddr_count(pool, L4PROTO_TCP),
+			"stale taddr count");
+	success &= ASSERT_BOOL(false, pool4db_is_empty(pool), "stale empty");
+	pool->stale = false;
+	success &= ASSERT_VERDICT(CONTINUE, mask_domain_find(&state, &masks),
+			"second find");
+	if (!success)
+		goto end;
+	success &= ASSERT_UINT(12, masks->taddr_count, "second taddr count");
+	success &= ASSERT_UINT(1011, masks->ranges[0].ports.max, "second max");
+
+	/* The CPU's domain is taken, so the nested one has to be allocated. */
+	success &= ASSERT_VERDICT(CONTINUE, mask_domain_find(&state, &nested),
+			"nested find");
+	if (success) {
+		success &= ASSERT_BOOL(false, nested->percpu, "allocated domain");
+		success &= ASSERT_UINT(12, nested->taddr_count, "nested count");
+		mask_domain_put(nested);
+	}
+	mask_domain_put(masks);
+
+end:
+	kfree_skb(state.in.skb);
+	pool4db_flush(pool);
+	return success;
+}
+
+static bool test_covers(void)
+{
+	struct ipv4_transport_addr addr;
+	__u16 last;
+	bool success = true;
+
+	/* 192.0.2.1 (1000-1099, 1100-1199, 1300-1400) */
+	if (!add(0xc0000201U, 32, 1000, 1099)
+			|| !add(0xc0000201U, 32, 1100, 1199)
+			|| !add(0xc0000201U, 32, 1300, 1400))
+		return false;
+
+	addr.l3.s_addr = cpu_to_be32(0xc0000201U);
+	addr.l4 = 1050;
+	success &= ASSERT_BOOL(true, pool4db_covers(pool, ns, L4PROTO_TCP,
+			&addr, &last), "covers 1050");
+	success &= ASSERT_UINT(1199, last, "1050's run");
+	addr.l4 = 1250;
+	success &= ASSERT_BOOL(false, pool4db_covers(pool, ns, L4PROTO_TCP,
+			&addr, &last), "covers 1250");
+	addr.l4 = 1300;
+	success &= ASSERT_BOOL(true, pool4db_covers(pool, ns, L4PROTO_TCP,
+			&addr, &last), "covers 1300");
+	success &= ASSERT_UINT(1400, last, "1300's run");
+
+	addr.l3.s_addr = cpu_to_be32(0xc0000202U);
+	success &= ASSERT_BOOL(false, pool4db_covers(pool, ns, L4PROTO_TCP,
+			&addr, &last), "covers 192.0.2.2");
+
+	pool4db_flush(pool);
+	return success;
+}
+
+/* 192.0.2.1 (1-8192), as a single-range domain with automatic iterations. */
+static void init_domain(struct mask_domain *masks, struct ipv4_range *range)
+{
+	memset(masks, 0, sizeof(*masks));
+	range->prefix.addr.s_addr = cpu_to_be32(0xc0000201U);
+	range->prefix.len = 32;
+	range->ports.min = 1;
+	range->ports.max = 8192;
+
+	masks->taddr_count = 8192;
+	masks->max_iterations = auto_max_iterations(8192);
+	masks->auto_iterations = true;
+	masks->range_count = 1;
+	masks->ranges = range;
+	masks->current_range = range;
+	masks->current_port = 0;
+}
+
+static bool test_occupancy(void)
+{
+	struct mask_domain masks;
+	struct ipv4_range range;
+	struct ipv4_transport_addr addr;
+	bool consecutive;
+	bool success = true;
+
+	/* Mostly empty: the static heuristic stands, skips are charged. */
+	init_domain(&masks, &range);
+	success &= ASSERT_UINT(1024, masks.max_iterations, "auto iterations");
+	success &= ASSERT_BOOL(false, mask_domain_set_occupancy(&masks, 7167),
+			"just below 7/8");
+	success &= ASSERT_UINT(1024, masks.max_iterations, "unchanged");
+	success &= ASSERT_INT(0, mask_domain_next(&masks, &addr, &consecutive),
+			"uncrowded next");
+	success &= ASSERT_INT(-ENOENT, mask_domain_skip(&masks, &addr, 8000),
+			"uncrowded skip");
+
+	/* Crowded, with few free masks: the limit grows to the whole domain. */
+	init_domain(&masks, &range);
+	success &= ASSERT_BOOL(true, mask_domain_set_occupancy(&masks, 8190),
+			"crowded");
+	success &= ASSERT_UINT(8192, masks.max_iterations, "raised iterations");
+	success &= ASSERT_INT(0, mask_domain_next(&masks, &addr, &consecutive),
+			"crowded next");
+	success &= ASSERT_INT(0, mask_domain_skip(&masks, &addr, 8000),
+			"crowded skip");
+	success &= ASSERT_UINT(8000, addr.l4, "skipped port");
+	success &= ASSERT_INT(0, mask_domain_next(&masks, &addr, &consecutive),
+			"next after skip");
+	success &= ASSERT_UINT(8001, addr.l4, "port after skip");
+
+	/* Crowded, but not that much: only the skips are forgiven. */
+	init_domain(&masks, &range);
+	success &= ASSERT_BOOL(true, mask_domain_set_occupancy(&masks, 7168),
+			"exactly 7/8");
+	success &= ASSERT_UINT(1024, masks.max_iterations, "kept iterations");
+	success &= ASSERT_INT(0, mask_domain_next(&masks, &addr, &consecutive),
+			"7/8 next");
+	success &= ASSERT_INT(0, mask_domain_skip(&masks, &addr, 8000),
+			"7/8 skip");
+
+	/* Users' limits are not touched. */
+	init_domain(&masks, &range);
+	masks.max_iterations = 10;
+	masks.auto_iterations = false;
+	success &= ASSERT_BOOL(true, mask_domain_set_occupancy(&masks, 8192),
+			"full");
+	success &= ASSERT_UINT(10, masks.max_iterations, "manual iterations");
+
+	return success;
+}
+
+static void init_entry(struct pool4_entry *entry, __u32 addr, __u8 prefix_len,
+		__u16 min, __u16 max)
+{
+	entry->mark = 1;
+	entry->iterations = 0;
+	entry->flags = ITERATIONS_SET | ITERATIONS_INFINITE;
+	entry->proto = L4PROTO_TCP;
+	entry->range.prefix.addr.s_addr = cpu_to_be32(addr);
+	entry->range.prefix.len = prefix_len;
+	entry->range.ports.min = min;
+	entry->range.ports.max = max;
+}
+
+static bool test_bulk(void)
+{
+	struct pool4_entry entries[5];
+	struct pool4_entry samples[9];
+	struct pool4_table *table;
+	bool success = true;
+
+	/* Same as add_common_samples(), out of order. */
+	init_entry(&entries[0], 0xc0000210U, 32, 22, 23);
+	init_entry(&entries[1], 0xc0000220U, 30, 1, 1);
+	init_entry(&entries[2], 0xc0000200U, 31, 7, 6);
+	init_entry(&entries[3], 0xc0000210U, 31, 19, 19);
+	init_entry(&entries[4], 0xc0000210U, 32, 15, 18);
+	entries[4].flags = ITERATIONS_SET;
+	entries[4].iterations = 1234;
+
+	init_sample(&samples[0], 0xc0000200U, 6, 7);
+	init_sample(&samples[1], 0xc0000201U, 6, 7);
+	init_sample(&samples[2], 0xc0000210U, 15, 19);
+	init_sample(&samples[3], 0xc0000210U, 22, 23);
+	init_sample(&samples[4], 0xc0000211U, 19, 19);
+	init_sample(&samples[5], 0xc0000220U, 1, 1);
+	init_sample(&samples[6], 0xc0000221U, 1, 1);
+	init_sample(&samples[7], 0xc0000222U, 1, 1);
+	init_sample(&samples[8], 0xc0000223U, 1, 1);
+
+	success &= ASSERT_INT(0, pool4db_add_bulk(pool, entries, 5), "bulk");
+	success &= __foreach(samples, 9, 16);
+	success &= assert_contains_range(0, 1, 6, 7, true);
+	success &= assert_contains_range(16, 16, 15, 19, true);
+	success &= assert_contains_range(16, 16, 20, 21, false);
+	success &= assert_contains_range(17, 17, 19, 19, true);
+	success &= assert_contains_range(17, 17, 18, 18, false);
+
+	/* The last ITERATIONS_SET wins. */
+	table = find_by_mark(&pool->tree_mark.tcp, 1);
+	if (!ASSERT_BOOL(true, table != NULL, "mark table"))
+		return false;
+	success &= ASSERT_UINT(ITERATIONS_SET, table->max_iterations_flags,
+			"iterations flags");
+	success &= ASSERT_UINT(1234, table->max_iterations_allowed,
+			"iterations");
+
+	/* On top of existing tables; fuses 192.0.2.16 (15-23). */
+	init_entry(&entries[0], 0xc0000210U, 32, 20, 21);
+	init_entry(&entries[1], 0xc0000224U, 32, 1, 1);
+	success &= ASSERT_INT(0, pool4db_add_bulk(pool, entries, 2),
+			"bulk on top");
+
+	init_sample(&samples[2], 0xc0000210U, 15, 23);
+	samples[3] = samples[4];
+	samples[4] = samples[5];
+	samples[5] = samples[6];
+	samples[6] = samples[7];
+	samples[7] = samples[8];
+	init_sample(&samples[8], 0xc0000224U, 1, 1);
+	success &= __foreach(samples, 9, 19);
+	success &= assert_contains_range(16, 16, 15, 23, true);
+	success &= assert_contains_range(36, 36, 1, 1, true);
+
+	/* Illegal input leaves the pool alone. */
+	init_entry(&entries[0], 0xc0000230U, 32, 1, 1);
+	entries[1].flags = ITERATIONS_SET;
+	entries[1].iterations = 0;
+	success &= ASSERT_INT(-EINVAL, pool4db_add_bulk(pool, entries, 2),
+			"zero iterations");
+	success &= __foreach(samples, 9, 19);
+
+	pool4db_flush(pool);
+	return success;
+}
+
 static int init(void)
 {
 	pool = pool4db_alloc();
@@ -536,6 +912,8 @@ static void clean(void)
 {
 	put_net(ns);
 	pool4db_put(pool);
+	/* Wait for the replaced snapshots. */
+	rcu_barrier();
 }
 
 int init_module(void)
@@ -557,6 +935,11 @@ int init_module(void)
 	test_group_test(&test, test_add, "Add");
 	test_group_test(&test, test_rm, "Rm");
 	test_group_test(&test, test_flush, "Flush");
+	test_group_test(&test, test_bulk, "Bulk add");
+	test_group_test(&test, test_deterministic, "Deterministic mode");
+	test_group_test(&test, test_snapshot, "Snapshot");
+	test_group_test(&test, test_covers, "Covers");
+	test_group_test(&test, test_occupancy, "Occupancy");
 
 	return test_group_end(&test);
 }
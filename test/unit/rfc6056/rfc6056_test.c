@@ -9,12 +9,14 @@ MODULE_DESCRIPTION("Port allocator module test.");
 
 static bool test_md5(void)
 {
+	struct xlator jool;
 	struct xlation state;
 	struct tuple *tuple6;
 	unsigned int result;
 	bool success = true;
 
-	xlation_init(&state, NULL);
+	memset(&jool, 0, sizeof(jool));
+	xlation_init(&state, &jool);
 	tuple6 = &state.in.tuple;
 
 	tuple6->src.addr6.l3.s6_addr[0] = 'a';
@@ -50,7 +52,7 @@ static bool test_md5(void)
 	tuple6->dst.addr6.l3.s6_addr[14] = 'E';
 	tuple6->dst.addr6.l3.s6_addr[15] = 'F';
 	tuple6->dst.addr6.l4 = (__force __u16)cpu_to_be16(('G' << 8) | 'H');
-	state.jool.globals.nat64.f_args = 0b1011;
+	jool.globals.nat64.f_args = 0b1011;
 
 	secret_key[0] = 'I';
 	secret_key[1] = 'J';
@@ -63,18 +65,22 @@ static bool test_md5(void)
 	return success;
 }
 
-static bool f_args_test(void)
+static bool __f_args_test(__u8 f_hash)
 {
+	struct xlator jool;
 	struct xlation state;
 	bool success = true;
 	unsigned int result1;
 	unsigned int result2;
 
-	xlation_init(&state, NULL);
+	memset(&jool, 0, sizeof(jool));
+	xlation_init(&state, &jool);
+
+	jool.globals.nat64.f_hash = f_hash;
 
 	if (init_tuple6(&state.in.tuple, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
 		return false;
-	state.jool.globals.nat64.f_args = 0b1111;
+	jool.globals.nat64.f_args = 0b1111;
 
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result1), "result 1");
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result2), "result 2");
@@ -95,7 +101,7 @@ static bool f_args_test(void)
 
 	if (init_tuple6(&state.in.tuple, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
 		return false;
-	state.jool.globals.nat64.f_args = 0b0010;
+	jool.globals.nat64.f_args = 0b0010;
 
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result1), "result 4");
 	success &= ASSERT_INT(0, rfc6056_f(&state, &result2), "result 5");
@@ -118,6 +124,42 @@ static bool f_args_test(void)
 	return success;
 }
 
+static bool f_args_test(void)
+{
+	return __f_args_test(F_HASH_MD5);
+}
+
+static bool siphash_f_args_test(void)
+{
+	return __f_args_test(F_HASH_SIPHASH);
+}
+
+static bool siphash_test(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	unsigned int result1;
+	unsigned int result2;
+	bool success = true;
+
+	memset(&jool, 0, sizeof(jool));
+	xlation_init(&state, &jool);
+	if (init_tuple6(&state.in.tuple, "1::1", 1111, "2::2", 2222, L4PROTO_TCP))
+		return false;
+	jool.globals.nat64.f_args = 0b1011;
+
+	jool.globals.nat64.f_hash = F_HASH_MD5;
+	success &= ASSERT_INT(0, rfc6056_f(&state, &result1), "MD5");
+	jool.globals.nat64.f_hash = F_HASH_SIPHASH;
+	success &= ASSERT_INT(0, rfc6056_f(&state, &result2), "SipHash");
+
+	/* Same false negative disclaimer as in __f_args_test(). */
+	success &= ASSERT_BOOL(true, result1 != result2,
+			"f-hash selects the hash function");
+
+	return success;
+}
+
 int init_module(void)
 {
 	struct test_group test = {
@@ -131,6 +173,8 @@ int init_module(void)
 
 	test_group_test(&test, test_md5, "MD5 Test");
 	test_group_test(&test, f_args_test, "F() arguments test");
+	test_group_test(&test, siphash_test, "SipHash Test");
+	test_group_test(&test, siphash_f_args_test, "SipHash F() arguments test");
 
 	return test_group_end(&test);
 }
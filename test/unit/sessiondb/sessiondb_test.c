@@ -250,6 +250,100 @@ static bool simple_session(void)
 	return success;
 }
 
+struct snapshot {
+	struct session_entry entries[16];
+	unsigned int count;
+};
+
+static int snapshot_cb(struct session_entry const *session, void *arg)
+{
+	struct snapshot *snapshot = arg;
+
+	if (snapshot->count >= ARRAY_SIZE(snapshot->entries))
+		return -EINVAL;
+	snapshot->entries[snapshot->count++] = *session;
+	return 0;
+}
+
+static bool import_sessions(void)
+{
+	struct snapshot snapshot;
+	bool success = true;
+
+	if (!insert_test_sessions())
+		return false;
+
+	snapshot.count = 0;
+	success &= ASSERT_INT(0, bib_foreach_session(&jool, PROTO, snapshot_cb,
+			&snapshot, NULL), "snapshot");
+	success &= ASSERT_UINT(16, snapshot.count, "snapshot count");
+	if (!success)
+		return false;
+
+	/* Import over the existing sessions; nothing should change. */
+	success &= ASSERT_INT(0, bib_import(&jool, snapshot.entries,
+			snapshot.count), "redundant import");
+	success &= test_db();
+
+	/* Restore from scratch. (@sessions still holds the expectations.) */
+	bib_flush(&jool);
+	success &= ASSERT_INT(16, bib_import(&jool, snapshot.entries,
+			snapshot.count), "import");
+	success &= test_db();
+
+	success &= flush();
+	return success;
+}
+
+static enum session_fate sync_cb(struct session_entry *old,
+		struct session_entry const *new, void *arg)
+{
+	unsigned int *collisions = arg;
+
+	if (session_equals(old, new))
+		(*collisions)++;
+	return FATE_PRESERVE;
+}
+
+static bool sync_sessions(void)
+{
+	struct snapshot snapshot;
+	unsigned int collisions;
+	unsigned int i;
+	bool success = true;
+
+	if (!insert_test_sessions())
+		return false;
+
+	snapshot.count = 0;
+	success &= ASSERT_INT(0, bib_foreach_session(&jool, PROTO, snapshot_cb,
+			&snapshot, NULL), "snapshot");
+	success &= ASSERT_UINT(16, snapshot.count, "snapshot count");
+	if (!success)
+		return false;
+
+	/* Scramble the order; bib_sync() has to sort them back. */
+	for (i = 0; i < snapshot.count / 2; i++)
+		swap(snapshot.entries[i], snapshot.entries[snapshot.count - i - 1]);
+
+	/* Every session already exists, so they all collide. */
+	collisions = 0;
+	success &= ASSERT_INT(0, bib_sync(&jool, snapshot.entries,
+			snapshot.count, sync_cb, &collisions), "redundant sync");
+	success &= ASSERT_UINT(16, collisions, "collisions");
+	success &= test_db();
+
+	collisions = 0;
+	bib_flush(&jool);
+	success &= ASSERT_INT(0, bib_sync(&jool, snapshot.entries,
+			snapshot.count, sync_cb, &collisions), "sync");
+	success &= ASSERT_UINT(0, collisions, "fresh collisions");
+	success &= test_db();
+
+	success &= flush();
+	return success;
+}
+
 enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 {
 	return FATE_RM;
@@ -257,8 +351,17 @@ enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 
 static int init(void)
 {
+	struct ipv6_prefix pool6;
+
+	/* Sessions don't store dst6.l3; it's inferred from dst4 and pool6. */
+	pool6.addr.s6_addr32[0] = cpu_to_be32(0x0064ff9bu);
+	pool6.addr.s6_addr32[1] = 0;
+	pool6.addr.s6_addr32[2] = 0;
+	pool6.addr.s6_addr32[3] = 0;
+	pool6.len = 96;
+
 	return xlator_init(&jool, NULL, INAME_DEFAULT, XF_NETFILTER | XT_NAT64,
-			NULL);
+			&pool6);
 }
 
 static void clean(void)
@@ -279,6 +382,8 @@ int init_module(void)
 		return -EINVAL;
 
 	test_group_test(&test, simple_session, "Single Session");
+	test_group_test(&test, import_sessions, "Import");
+	test_group_test(&test, sync_sessions, "Sync");
 
 	return test_group_end(&test);
 }
@@ -273,8 +273,17 @@ enum session_fate tcp_est_expire_cb(struct session_entry *session, void *arg)
 
 static int init(void)
 {
+	struct ipv6_prefix pool6;
+
+	/* Sessions don't store dst6.l3; it's inferred from dst4 and pool6. */
+	pool6.addr.s6_addr32[0] = cpu_to_be32(0x0064ff9bu);
+	pool6.addr.s6_addr32[1] = 0;
+	pool6.addr.s6_addr32[2] = 0;
+	pool6.addr.s6_addr32[3] = 0;
+	pool6.len = 96;
+
 	return xlator_init(&jool, NULL, INAME_DEFAULT, XF_NETFILTER | XT_NAT64,
-			NULL);
+			&pool6);
 }
 
 static void clean(void)
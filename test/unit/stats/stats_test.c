@@ -0,0 +1,141 @@
+#include <linux/module.h>
+
+#include "framework/unit_test.h"
+#include "mod/common/stats.c"
+
+MODULE_LICENSE(JOOL_LICENSE);
+MODULE_AUTHOR("Alberto Leiva");
+MODULE_DESCRIPTION("Stats module test");
+
+/*
+ * Note: No timer runs during these tests, same as with SIIT instances. The
+ * rates are only ever updated by the queries.
+ */
+
+static struct jool_stats *stats;
+
+static int init(void)
+{
+	stats = jstat_alloc();
+	return stats ? 0 : -ENOMEM;
+}
+
+static void clean(void)
+{
+	jstat_put(stats);
+}
+
+/* Pretends the last update happened @secs seconds ago. */
+static void rewind(unsigned int secs)
+{
+	spin_lock_bh(&stats->rates.lock);
+	stats->rates.time = jiffies - secs * HZ;
+	spin_unlock_bh(&stats->rates.lock);
+}
+
+static __u64 query(enum jool_rate_id id)
+{
+	__u64 rates[JRATE_COUNT];
+	jstat_query_rates(stats, rates);
+	return rates[id] >> JRATE_SHIFT;
+}
+
+/* Allows a few jiffies to go by between the rewind and the query. */
+static bool assert_rate(__u64 min, __u64 max, enum jool_rate_id id,
+		char *test_name)
+{
+	__u64 rate = query(id);
+	bool success = true;
+
+	success &= ASSERT_BOOL(true, min <= rate, "%s >= %llu (%llu)",
+			test_name, min, rate);
+	success &= ASSERT_BOOL(true, rate <= max, "%s <= %llu (%llu)",
+			test_name, max, rate);
+	return success;
+}
+
+static bool test_too_soon(void)
+{
+	bool success = true;
+
+	jstat_add(stats, JSTAT_RECEIVED4, 1000);
+	success &= ASSERT_U64(0, query(JRATE_RECEIVED4), "Fresh instance");
+	success &= ASSERT_U64(0, query(JRATE_RECEIVED6), "Other rate");
+
+	return success;
+}
+
+static bool test_first_query(void)
+{
+	bool success = true;
+
+	jstat_add(stats, JSTAT_RECEIVED4, 1000);
+	rewind(2);
+	success &= assert_rate(490, 500, JRATE_RECEIVED4, "Received4");
+	success &= ASSERT_U64(0, query(JRATE_RECEIVED6), "Received6");
+
+	return success;
+}
+
+static bool test_ewma(void)
+{
+	bool success = true;
+
+	jstat_add(stats, JSTAT_RECEIVED4, 1000);
+	rewind(2);
+	success &= assert_rate(490, 500, JRATE_RECEIVED4, "First");
+
+	/* Two periods of silence: 500 * (3/4)^2 */
+	rewind(4);
+	success &= assert_rate(270, 282, JRATE_RECEIVED4, "Decayed");
+
+	/* One period back at 500: a quarter of the way up */
+	jstat_add(stats, JSTAT_RECEIVED4, 1000);
+	rewind(2);
+	success &= assert_rate(325, 336, JRATE_RECEIVED4, "Recovering");
+
+	return success;
+}
+
+static bool test_long_silence(void)
+{
+	bool success = true;
+
+	jstat_add(stats, JSTAT_RECEIVED4, 1000);
+	rewind(2);
+	success &= assert_rate(490, 500, JRATE_RECEIVED4, "First");
+
+	/* The old average is forgotten; only the new sample counts */
+	jstat_add(stats, JSTAT_RECEIVED4, 3000);
+	rewind(100);
+	success &= assert_rate(29, 30, JRATE_RECEIVED4, "After 100 seconds");
+
+	return success;
+}
+
+static int stats_test_init(void)
+{
+	struct test_group test = {
+		.name = "Stats",
+		.init_fn = init,
+		.clean_fn = clean,
+	};
+
+	if (test_group_begin(&test))
+		return -EINVAL;
+
+	test_group_test(&test, test_too_soon, "Rates, too soon");
+	test_group_test(&test, test_first_query, "Rates, first query");
+	test_group_test(&test, test_ewma, "Rates, EWMA");
+	test_group_test(&test, test_long_silence, "Rates, long silence");
+
+	return test_group_end(&test);
+}
+
+static void stats_test_exit(void)
+{
+	/* No code. */
+}
+
+module_init(stats_test_init);
+module_exit(stats_test_exit);
@@ -136,21 +136,25 @@ static bool test_function_build_id_field(void)
 #define min_mtu(packet, in, out, len) be32_to_cpu(icmp6_minimum_mtu(&state, packet, out, in, len))
 static bool test_function_icmp6_minimum_mtu(void)
 {
+	struct xlator jool;
 	struct xlation state;
 	int i;
 	bool success = true;
 
-	if (globals_init(&state.jool.globals, XT_SIIT, NULL))
+	xlation_init(&state, &jool);
+	jool.flags = XF_NETFILTER | XT_SIIT;
+	if (globals_init(&jool.globals, XT_SIIT, NULL))
 		return false;
+	xlator_sync_fast(&jool);
 
 	/*
 	 * I'm assuming the default plateaus list has 3 elements or more.
 	 * (so I don't have to reallocate mtu_plateaus)
 	 */
-	state.jool.globals.plateaus.values[0] = 5000;
-	state.jool.globals.plateaus.values[1] = 4000;
-	state.jool.globals.plateaus.values[2] = 500;
-	state.jool.globals.plateaus.count = 2;
+	jool.globals.plateaus.values[0] = 5000;
+	jool.globals.plateaus.values[1] = 4000;
+	jool.globals.plateaus.values[2] = 500;
+	jool.globals.plateaus.count = 2;
 
 	/* Simple tests */
 	success &= ASSERT_UINT(1320, min_mtu(1300, 3000, 3000, 2000), "min(1300, 3000, 3000)");
@@ -347,6 +351,110 @@ static bool test_function_icmp4_minimum_mtu(void)
 	return success;
 }
 
+static __u32 get_flow_label(struct ipv6hdr *hdr)
+{
+	return ((hdr->flow_lbl[0] & 0x0F) << 16) | (hdr->flow_lbl[1] << 8)
+			| hdr->flow_lbl[2];
+}
+
+static __u32 label_of(struct xlation *state, __be16 sport, bool fragment)
+{
+	struct ipv6hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	state->flowx.v6.flowi.fl6_sport = sport;
+	ttpcomm_set_flow_label(state, &hdr, fragment);
+	return get_flow_label(&hdr);
+}
+
+static bool test_function_flow_label(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	struct flowi6 *flow = &state.flowx.v6.flowi;
+	struct ipv6hdr hdr;
+	__u32 label;
+	bool success = true;
+
+	xlation_init(&state, &jool);
+	jool.flags = XF_NETFILTER | XT_SIIT;
+	if (globals_init(&jool.globals, XT_SIIT, NULL))
+		return false;
+	xlator_sync_fast(&jool);
+
+	memset(flow, 0, sizeof(*flow));
+	success &= str_to_addr6("2001:db8::1", &flow->saddr) == 0;
+	success &= str_to_addr6("2001:db8::2", &flow->daddr) == 0;
+	flow->flowi6_proto = IPPROTO_UDP;
+	flow->fl6_dport = cpu_to_be16(53);
+
+	success &= ASSERT_UINT(0, label_of(&state, cpu_to_be16(1000), false),
+			"Disabled");
+
+	jool.globals.generate_flow_label = true;
+	xlator_sync_fast(&jool);
+
+	label = label_of(&state, cpu_to_be16(1000), false);
+	success &= ASSERT_TRUE(label != 0, "Labeled");
+	success &= ASSERT_UINT(label,
+			label_of(&state, cpu_to_be16(1000), false),
+			"Same flow, same label");
+
+	label = label_of(&state, cpu_to_be16(1000), true);
+	success &= ASSERT_UINT(label, label_of(&state, cpu_to_be16(2000), true),
+			"Fragments ignore the ports");
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.priority = 0xA;
+	hdr.flow_lbl[0] = 0xB0;
+	ttpcomm_set_flow_label(&state, &hdr, false);
+	success &= ASSERT_UINT(0xA, hdr.priority, "Traffic Class high");
+	success &= ASSERT_UINT(0xB, hdr.flow_lbl[0] >> 4, "Traffic Class low");
+
+	return success;
+}
+
+static bool test_function_ipv4_id(void)
+{
+	struct xlator jool;
+	struct xlation state;
+	struct sk_buff *skb;
+	struct iphdr hdr;
+	__u16 id;
+	bool success = true;
+
+	xlation_init(&state, &jool);
+	jool.flags = XF_NETFILTER | XT_SIIT;
+	if (globals_init(&jool.globals, XT_SIIT, NULL))
+		return false;
+
+	skb = alloc_skb(0, GFP_KERNEL);
+	if (!skb)
+		return false;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.frag_off = cpu_to_be16(IP_DF);
+
+	jool.globals.ipv4_id_policy = IIP_ZERO;
+	xlator_sync_fast(&jool);
+	hdr.id = cpu_to_be16(1234);
+	ttpcomm_select_ipv4_id(&state, skb, &hdr);
+	success &= ASSERT_BE16(0, hdr.id, "Zero");
+
+	jool.globals.ipv4_id_policy = IIP_COUNTER;
+	xlator_sync_fast(&jool);
+	get_cpu();
+	ttpcomm_select_ipv4_id(&state, skb, &hdr);
+	id = be16_to_cpu(hdr.id);
+	ttpcomm_select_ipv4_id(&state, skb, &hdr);
+	put_cpu();
+	success &= ASSERT_UINT((__u16)(id + 1), be16_to_cpu(hdr.id),
+			"Counter");
+
+	kfree_skb(skb);
+	return success;
+}
+
 int init_module(void)
 {
 	struct test_group test = {
@@ -365,6 +473,8 @@ int init_module(void)
 	test_group_test(&test, test_function_build_protocol_field, "Build protocol function");
 	test_group_test(&test, test_function_has_nonzero_segments_left, "Segments left indicator function");
 	test_group_test(&test, test_function_icmp4_minimum_mtu, "ICMP4 Minimum MTU function");
+	test_group_test(&test, test_function_flow_label, "Flow label generator");
+	test_group_test(&test, test_function_ipv4_id, "IPv4 ID policies");
 
 	return test_group_end(&test);
 }